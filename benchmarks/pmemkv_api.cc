@@ -0,0 +1,337 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_api.cc -- benchmark of the overhead of pmemkv's C and C++ APIs. It
+ * drives the blackhole engine, which accepts every operation and does
+ * nothing, so the measured time is the cost of the API layer: checking of
+ * arguments, catching exceptions and translating them to statuses in the C
+ * API, wrapping of callbacks in std::function, construction of result<> and
+ * parsing of the config on open.
+ *
+ * Every entry point is called in a loop (single thread) and printed as a line
+ * of CSV: the API, name of the entry point and nanoseconds per call (the
+ * minimum of all runs).
+ *
+ * Example:
+ *	pmemkv_api --iterations=10000000 --runs=5
+ */
+
+#include <libpmemkv.h>
+#include <libpmemkv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace pmem::kv;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+static const char *ENGINE = "blackhole";
+
+struct options {
+	size_t iterations = 10000000;
+	size_t open_iterations = 10000;
+	size_t key_size = 16;
+	size_t value_size = 100;
+	size_t batch_size = 16;
+	size_t runs = 3;
+};
+
+/* statuses of all calls are summed, so that none of them can be optimized out */
+static uint64_t checksum = 0;
+
+static void nop_get_v(const char *, size_t, void *)
+{
+}
+
+static int nop_get_kv(const char *, size_t, const char *, size_t, void *)
+{
+	return 0;
+}
+
+/* Calls f() iterations times, runs times, and returns the fastest ns per call */
+template <typename F>
+static double measure(const options &opts, size_t iterations, F &&f)
+{
+	auto best = std::numeric_limits<double>::max();
+	for (size_t r = 0; r < opts.runs; ++r) {
+		auto begin = clock_type::now();
+		for (size_t i = 0; i < iterations; ++i)
+			checksum += static_cast<uint64_t>(f());
+		auto end = clock_type::now();
+
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end -
+									       begin);
+		best = std::min(best,
+				static_cast<double>(ns.count()) /
+					static_cast<double>(iterations));
+	}
+
+	return best;
+}
+
+static void report(const char *api, const char *entry_point, double ns)
+{
+	std::printf("%s,%s,%.2f\n", api, entry_point, ns);
+	std::fflush(stdout);
+}
+
+static pmemkv_config *make_c_config()
+{
+	auto cfg = pmemkv_config_new();
+	if (cfg == nullptr || pmemkv_config_put_path(cfg, "/dev/null") != 0 ||
+	    pmemkv_config_put_size(cfg, 1024ULL * 1024ULL * 1024ULL) != 0 ||
+	    pmemkv_config_put_string(cfg, "key_type", "binary") != 0 ||
+	    pmemkv_config_put_uint64(cfg, "latency_stats", 0) != 0)
+		throw std::runtime_error(pmemkv_errormsg());
+
+	return cfg;
+}
+
+static config make_config()
+{
+	config cfg;
+	if (cfg.put_path("/dev/null") != status::OK ||
+	    cfg.put_size(1024ULL * 1024ULL * 1024ULL) != status::OK ||
+	    cfg.put_string("key_type", "binary") != status::OK ||
+	    cfg.put_uint64("latency_stats", 0) != status::OK)
+		throw std::runtime_error(errormsg());
+
+	return cfg;
+}
+
+static void run_c_api(const options &opts, const std::string &key,
+		      const std::string &value)
+{
+	const char *k = key.data();
+	size_t kb = key.size();
+	const char *v = value.data();
+	size_t vb = value.size();
+
+	report("c", "open_close", measure(opts, opts.open_iterations, [&] {
+		       pmemkv_db *db;
+		       auto s = pmemkv_open(ENGINE, make_c_config(), &db);
+		       if (s == PMEMKV_STATUS_OK)
+			       pmemkv_close(db);
+		       return s;
+	       }));
+
+	pmemkv_db *db;
+	if (pmemkv_open(ENGINE, make_c_config(), &db) != PMEMKV_STATUS_OK)
+		throw std::runtime_error(pmemkv_errormsg());
+
+	report("c", "exists",
+	       measure(opts, opts.iterations, [&] { return pmemkv_exists(db, k, kb); }));
+	report("c", "get", measure(opts, opts.iterations, [&] {
+		       return pmemkv_get(db, k, kb, nop_get_v, nullptr);
+	       }));
+
+	std::vector<char> buffer(opts.value_size);
+	report("c", "get_copy", measure(opts, opts.iterations, [&] {
+		       size_t size;
+		       return pmemkv_get_copy(db, k, kb, buffer.data(), buffer.size(),
+					      &size);
+	       }));
+	report("c", "put", measure(opts, opts.iterations,
+				   [&] { return pmemkv_put(db, k, kb, v, vb); }));
+	report("c", "remove",
+	       measure(opts, opts.iterations, [&] { return pmemkv_remove(db, k, kb); }));
+	report("c", "count_all", measure(opts, opts.iterations, [&] {
+		       size_t cnt;
+		       return pmemkv_count_all(db, &cnt);
+	       }));
+
+	/* batches are reported per key */
+	std::vector<const char *> ks(opts.batch_size, k), vs(opts.batch_size, v);
+	std::vector<size_t> kbs(opts.batch_size, kb), vbs(opts.batch_size, vb);
+	auto batches = std::max<size_t>(opts.iterations / opts.batch_size, 1);
+	report("c", "get_batch_per_key",
+	       measure(opts, batches,
+		       [&] {
+			       return pmemkv_get_batch(db, ks.data(), kbs.data(),
+						       ks.size(), nop_get_kv, nullptr);
+		       }) /
+		       static_cast<double>(opts.batch_size));
+	report("c", "put_batch_per_key",
+	       measure(opts, batches,
+		       [&] {
+			       return pmemkv_put_batch(db, ks.data(), kbs.data(),
+						       vs.data(), vbs.data(), ks.size());
+		       }) /
+		       static_cast<double>(opts.batch_size));
+
+	pmemkv_key_handle *handle;
+	if (pmemkv_key_handle_new(db, k, kb, &handle) != PMEMKV_STATUS_OK)
+		throw std::runtime_error(pmemkv_errormsg());
+
+	report("c", "get_by_handle", measure(opts, opts.iterations, [&] {
+		       return pmemkv_get_by_handle(db, handle, nop_get_v, nullptr);
+	       }));
+	report("c", "put_by_handle", measure(opts, opts.iterations, [&] {
+		       return pmemkv_put_by_handle(db, handle, v, vb);
+	       }));
+
+	pmemkv_key_handle_delete(handle);
+	pmemkv_close(db);
+}
+
+static void run_cpp_api(const options &opts, const std::string &key,
+			const std::string &value)
+{
+	report("cpp", "open_close", measure(opts, opts.open_iterations, [&] {
+		       db kv;
+		       return kv.open(ENGINE, make_config());
+	       }));
+
+	db kv;
+	if (kv.open(ENGINE, make_config()) != status::OK)
+		throw std::runtime_error(errormsg());
+
+	report("cpp", "exists",
+	       measure(opts, opts.iterations, [&] { return kv.exists(key); }));
+	report("cpp", "get_callback", measure(opts, opts.iterations, [&] {
+		       return kv.get(key, nop_get_v, nullptr);
+	       }));
+	report("cpp", "get_lambda", measure(opts, opts.iterations, [&] {
+		       return kv.get(key, [](string_view) {});
+	       }));
+	report("cpp", "get_std_function", measure(opts, opts.iterations, [&] {
+		       return kv.get(key, std::function<get_v_function>(
+						  [](string_view) {}));
+	       }));
+
+	std::string out;
+	report("cpp", "get_string", measure(opts, opts.iterations,
+					    [&] { return kv.get(key, &out); }));
+	report("cpp", "put",
+	       measure(opts, opts.iterations, [&] { return kv.put(key, value); }));
+	report("cpp", "remove",
+	       measure(opts, opts.iterations, [&] { return kv.remove(key); }));
+
+	std::vector<string_view> keys(opts.batch_size, key);
+	std::vector<string_view> values(opts.batch_size, value);
+	auto batches = std::max<size_t>(opts.iterations / opts.batch_size, 1);
+	report("cpp", "get_batch_per_key",
+	       measure(opts, batches,
+		       [&] { return kv.get_batch(keys, nop_get_kv, nullptr); }) /
+		       static_cast<double>(opts.batch_size));
+	report("cpp", "put_batch_per_key",
+	       measure(opts, batches, [&] { return kv.put_batch(keys, values); }) /
+		       static_cast<double>(opts.batch_size));
+
+	/* construction and destruction of result<> with a handle */
+	report("cpp", "make_key_handle", measure(opts, opts.iterations, [&] {
+		       return kv.make_key_handle(key).get_status();
+	       }));
+
+	auto handle = kv.make_key_handle(key);
+	if (!handle.is_ok())
+		throw std::runtime_error(errormsg());
+
+	report("cpp", "get_by_handle", measure(opts, opts.iterations, [&] {
+		       return kv.get(handle.get_value(), nop_get_v, nullptr);
+	       }));
+	report("cpp", "put_by_handle", measure(opts, opts.iterations, [&] {
+		       return kv.put(handle.get_value(), value);
+	       }));
+
+	report("cpp", "new_read_iterator", measure(opts, opts.open_iterations, [&] {
+		       return kv.new_read_iterator().get_status();
+	       }));
+}
+
+static void usage(const char *prog)
+{
+	std::cerr << "Usage: " << prog << " [options]" << std::endl
+		  << "Options:" << std::endl
+		  << "  --iterations=<n>      calls of every entry point in a run"
+		  << " (default: 10000000)" << std::endl
+		  << "  --open_iterations=<n> opens (and iterators) in a run"
+		  << " (default: 10000)" << std::endl
+		  << "  --key_size=<bytes>    size of the key (default: 16)" << std::endl
+		  << "  --value_size=<bytes>  size of the value (default: 100)"
+		  << std::endl
+		  << "  --batch_size=<n>      keys in batched calls (default: 16)"
+		  << std::endl
+		  << "  --runs=<n>            runs of every entry point, the fastest"
+		  << " is reported (default: 3)" << std::endl;
+}
+
+static bool parse_args(int argc, char *argv[], options &opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			return false;
+
+		auto name = arg.substr(2, eq - 2);
+		auto value = arg.substr(eq + 1);
+
+		try {
+			if (name == "iterations")
+				opts.iterations = std::stoull(value);
+			else if (name == "open_iterations")
+				opts.open_iterations = std::stoull(value);
+			else if (name == "key_size")
+				opts.key_size = std::stoull(value);
+			else if (name == "value_size")
+				opts.value_size = std::stoull(value);
+			else if (name == "batch_size")
+				opts.batch_size = std::stoull(value);
+			else if (name == "runs")
+				opts.runs = std::stoull(value);
+			else
+				return false;
+		} catch (std::exception &e) {
+			return false;
+		}
+	}
+
+	return opts.iterations > 0 && opts.open_iterations > 0 && opts.key_size > 0 &&
+		opts.batch_size > 0 && opts.runs > 0;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	options opts;
+	if (!parse_args(argc, argv, opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::string key(opts.key_size, 'k');
+	std::string value(opts.value_size, 'v');
+
+	std::printf("# Engine:     %s\n", ENGINE);
+	std::printf("# Keys:       %zu bytes, values: %zu bytes\n", opts.key_size,
+		    opts.value_size);
+	std::printf("api,entry_point,ns_per_call\n");
+
+	try {
+		run_c_api(opts, key, value);
+		run_cpp_api(opts, key, value);
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	/* printed, so that the calls have a visible effect */
+	std::printf("# Checksum:   %llu\n", static_cast<unsigned long long>(checksum));
+
+	return 0;
+}
@@ -0,0 +1,411 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_bench.cc -- db_bench-like benchmark, which can be run on any engine
+ * compiled into libpmemkv. It executes a list of benchmarks (e.g. fillrandom,
+ * readrandom) and reports throughput and latency percentiles of each of them.
+ *
+ * Example:
+ *	pmemkv_bench --engine=cmap --db=/mnt/pmem/pool --db_size=1073741824 \
+ *		--benchmarks=fillrandom,readrandom --num=1000000 --threads=4
+ */
+
+#include <libpmemkv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pmem::kv;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+	std::string engine = "cmap";
+	std::string path;
+	size_t db_size = 1024ULL * 1024ULL * 1024ULL;
+	std::string benchmarks = "fillseq,readrandom,readseq,overwrite,deleterandom";
+	size_t num = 1000000;
+	size_t reads = 0; /* 0 means the same as num */
+	size_t key_size = 16;
+	size_t value_size = 100;
+	size_t threads = 1;
+	uint64_t seed = 0;
+	bool histogram = true;
+};
+
+/* Latencies (in nanoseconds) and counters collected by a single thread */
+struct thread_stats {
+	std::vector<uint64_t> latencies;
+	size_t ops = 0;
+	size_t found = 0;
+	size_t bytes = 0;
+	size_t errors = 0;
+};
+
+class benchmark_context {
+public:
+	benchmark_context(db &kv, const options &opts) : kv(kv), opts(opts)
+	{
+		std::mt19937_64 gen(opts.seed);
+		value_buffer.resize(opts.value_size * 2 + 1);
+		for (auto &c : value_buffer)
+			c = static_cast<char>('a' + gen() % 26);
+	}
+
+	/* Generates a key of opts.key_size bytes from a number, keys keep
+	 * ordering of numbers */
+	std::string key(uint64_t n) const
+	{
+		char buf[32];
+		int len = std::snprintf(buf, sizeof(buf), "%016llu",
+					static_cast<unsigned long long>(n));
+		std::string k(buf, static_cast<size_t>(len));
+		if (k.size() < opts.key_size)
+			k.append(opts.key_size - k.size(), 'k');
+		else
+			k = k.substr(k.size() - opts.key_size);
+
+		return k;
+	}
+
+	string_view value(uint64_t n) const
+	{
+		return string_view(value_buffer.data() + n % (opts.value_size + 1),
+				   opts.value_size);
+	}
+
+	db &kv;
+	const options &opts;
+
+private:
+	std::string value_buffer;
+};
+
+using benchmark_fn = std::function<void(benchmark_context &, size_t tid, thread_stats &)>;
+
+struct benchmark_def {
+	benchmark_fn fn;
+	bool multithreaded;
+	bool uses_reads;
+};
+
+template <typename Op>
+static void measure(thread_stats &stats, bool histogram, Op &&op)
+{
+	auto start = clock_type::now();
+	op();
+	if (histogram)
+		stats.latencies.push_back(static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				clock_type::now() - start)
+				.count()));
+	++stats.ops;
+}
+
+/* Returns range [begin, end) of operations to be executed by thread tid */
+static std::pair<size_t, size_t> thread_range(size_t n, size_t threads, size_t tid)
+{
+	size_t per_thread = n / threads;
+	size_t begin = per_thread * tid;
+	size_t end = (tid == threads - 1) ? n : begin + per_thread;
+
+	return {begin, end};
+}
+
+static void do_write(benchmark_context &ctx, size_t tid, thread_stats &stats, bool seq)
+{
+	auto range = thread_range(ctx.opts.num, ctx.opts.threads, tid);
+	std::mt19937_64 gen(ctx.opts.seed + tid + 1);
+
+	for (size_t i = range.first; i < range.second; ++i) {
+		uint64_t n = seq ? i : gen() % ctx.opts.num;
+		auto k = ctx.key(n);
+		auto v = ctx.value(n);
+		measure(stats, ctx.opts.histogram, [&] {
+			if (ctx.kv.put(k, v) != status::OK)
+				++stats.errors;
+		});
+		stats.bytes += k.size() + v.size();
+	}
+}
+
+static void fillseq(benchmark_context &ctx, size_t tid, thread_stats &stats)
+{
+	do_write(ctx, tid, stats, true);
+}
+
+static void fillrandom(benchmark_context &ctx, size_t tid, thread_stats &stats)
+{
+	do_write(ctx, tid, stats, false);
+}
+
+static void readrandom(benchmark_context &ctx, size_t tid, thread_stats &stats)
+{
+	size_t reads = ctx.opts.reads ? ctx.opts.reads : ctx.opts.num;
+	auto range = thread_range(reads, ctx.opts.threads, tid);
+	std::mt19937_64 gen(ctx.opts.seed + tid + 1);
+	std::string value;
+
+	for (size_t i = range.first; i < range.second; ++i) {
+		auto k = ctx.key(gen() % ctx.opts.num);
+		measure(stats, ctx.opts.histogram, [&] {
+			auto s = ctx.kv.get(k, &value);
+			if (s == status::OK) {
+				++stats.found;
+				stats.bytes += k.size() + value.size();
+			} else if (s != status::NOT_FOUND) {
+				++stats.errors;
+			}
+		});
+	}
+}
+
+static void readseq(benchmark_context &ctx, size_t, thread_stats &stats)
+{
+	/* iterates over all records, latency is measured per whole scan */
+	measure(stats, ctx.opts.histogram, [&] {
+		auto s = ctx.kv.get_all([&](string_view k, string_view v) {
+			++stats.found;
+			stats.bytes += k.size() + v.size();
+			return 0;
+		});
+		if (s != status::OK)
+			++stats.errors;
+	});
+	stats.ops = stats.found;
+}
+
+static void deleterandom(benchmark_context &ctx, size_t tid, thread_stats &stats)
+{
+	auto range = thread_range(ctx.opts.num, ctx.opts.threads, tid);
+	std::mt19937_64 gen(ctx.opts.seed + tid + 1);
+
+	for (size_t i = range.first; i < range.second; ++i) {
+		auto k = ctx.key(gen() % ctx.opts.num);
+		measure(stats, ctx.opts.histogram, [&] {
+			auto s = ctx.kv.remove(k);
+			if (s == status::OK)
+				++stats.found;
+			else if (s != status::NOT_FOUND)
+				++stats.errors;
+		});
+	}
+}
+
+static const std::map<std::string, benchmark_def> &benchmarks()
+{
+	static const std::map<std::string, benchmark_def> defs = {
+		{"fillseq", {fillseq, true, false}},
+		{"fillrandom", {fillrandom, true, false}},
+		{"overwrite", {fillrandom, true, false}},
+		{"readrandom", {readrandom, true, true}},
+		{"readseq", {readseq, false, false}},
+		{"deleterandom", {deleterandom, true, false}},
+	};
+
+	return defs;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+
+	auto idx = static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1));
+	return sorted[idx];
+}
+
+static void report(const std::string &name, const options &opts,
+		   std::vector<thread_stats> &stats, double seconds)
+{
+	thread_stats total;
+	for (auto &s : stats) {
+		total.ops += s.ops;
+		total.found += s.found;
+		total.bytes += s.bytes;
+		total.errors += s.errors;
+		total.latencies.insert(total.latencies.end(), s.latencies.begin(),
+				       s.latencies.end());
+	}
+
+	double ops_per_sec = seconds > 0 ? static_cast<double>(total.ops) / seconds : 0;
+	double mb_per_sec = seconds > 0
+		? static_cast<double>(total.bytes) / (1024.0 * 1024.0) / seconds
+		: 0;
+
+	std::printf("%-14s : %12.0f ops/s %10.1f MB/s (%zu ops, %zu found, %zu errors, %.3f s)\n",
+		    name.c_str(), ops_per_sec, mb_per_sec, total.ops, total.found,
+		    total.errors, seconds);
+
+	if (opts.histogram && !total.latencies.empty()) {
+		std::sort(total.latencies.begin(), total.latencies.end());
+		std::printf("%-14s   latency [ns]: p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+			    "", static_cast<unsigned long long>(percentile(total.latencies, 50)),
+			    static_cast<unsigned long long>(percentile(total.latencies, 90)),
+			    static_cast<unsigned long long>(percentile(total.latencies, 99)),
+			    static_cast<unsigned long long>(percentile(total.latencies, 99.9)),
+			    static_cast<unsigned long long>(total.latencies.back()));
+	}
+}
+
+static void run_benchmark(db &kv, const options &opts, const std::string &name,
+			  const benchmark_def &def)
+{
+	benchmark_context ctx(kv, opts);
+	size_t threads = def.multithreaded ? opts.threads : 1;
+	std::vector<thread_stats> stats(threads);
+	size_t ops = def.uses_reads && opts.reads ? opts.reads : opts.num;
+	if (opts.histogram)
+		for (auto &s : stats)
+			s.latencies.reserve(ops / threads + 1);
+
+	auto start = clock_type::now();
+	std::vector<std::thread> workers;
+	for (size_t tid = 0; tid < threads; ++tid)
+		workers.emplace_back([&, tid] { def.fn(ctx, tid, stats[tid]); });
+	for (auto &w : workers)
+		w.join();
+	auto end = clock_type::now();
+
+	report(name, opts, stats,
+	       std::chrono::duration_cast<std::chrono::duration<double>>(end - start)
+		       .count());
+}
+
+static void usage(const char *prog)
+{
+	std::cerr
+		<< "Usage: " << prog << " [options]" << std::endl
+		<< "Options:" << std::endl
+		<< "  --engine=<name>         engine name (default: cmap)" << std::endl
+		<< "  --db=<path>             path to the pool (or directory for"
+		<< " volatile engines)" << std::endl
+		<< "  --db_size=<bytes>       size of the pool (default: 1GiB)" << std::endl
+		<< "  --benchmarks=<list>     comma separated list of: fillseq,"
+		<< " fillrandom, overwrite, readrandom, readseq, deleterandom" << std::endl
+		<< "  --num=<n>               number of records (default: 1000000)"
+		<< std::endl
+		<< "  --reads=<n>             number of reads (default: num)" << std::endl
+		<< "  --key_size=<bytes>      size of keys (default: 16)" << std::endl
+		<< "  --value_size=<bytes>    size of values (default: 100)" << std::endl
+		<< "  --threads=<n>           number of threads (default: 1), use 1"
+		<< " for single-threaded engines" << std::endl
+		<< "  --seed=<n>              seed of random generators (default: 0)"
+		<< std::endl
+		<< "  --histogram=<0|1>       measure latency of each operation"
+		<< " (default: 1)" << std::endl;
+}
+
+static bool parse_args(int argc, char *argv[], options &opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			return false;
+
+		auto name = arg.substr(2, eq - 2);
+		auto value = arg.substr(eq + 1);
+
+		try {
+			if (name == "engine")
+				opts.engine = value;
+			else if (name == "db")
+				opts.path = value;
+			else if (name == "db_size")
+				opts.db_size = std::stoull(value);
+			else if (name == "benchmarks")
+				opts.benchmarks = value;
+			else if (name == "num")
+				opts.num = std::stoull(value);
+			else if (name == "reads")
+				opts.reads = std::stoull(value);
+			else if (name == "key_size")
+				opts.key_size = std::stoull(value);
+			else if (name == "value_size")
+				opts.value_size = std::stoull(value);
+			else if (name == "threads")
+				opts.threads = std::stoull(value);
+			else if (name == "seed")
+				opts.seed = std::stoull(value);
+			else if (name == "histogram")
+				opts.histogram = std::stoull(value) != 0;
+			else
+				return false;
+		} catch (std::exception &e) {
+			return false;
+		}
+	}
+
+	return opts.threads > 0 && opts.num > 0 && opts.key_size > 0;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	options opts;
+	if (!parse_args(argc, argv, opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<std::string> names;
+	std::stringstream ss(opts.benchmarks);
+	std::string name;
+	while (std::getline(ss, name, ',')) {
+		if (benchmarks().find(name) == benchmarks().end()) {
+			std::cerr << "Unknown benchmark: " << name << std::endl;
+			usage(argv[0]);
+			return 1;
+		}
+		names.push_back(name);
+	}
+
+	config cfg;
+	if (!opts.path.empty()) {
+		if (cfg.put_path(opts.path) != status::OK ||
+		    cfg.put_size(opts.db_size) != status::OK ||
+		    cfg.put_create_if_missing(true) != status::OK) {
+			std::cerr << errormsg() << std::endl;
+			return 1;
+		}
+	}
+
+	db kv;
+	if (kv.open(opts.engine, std::move(cfg)) != status::OK) {
+		std::cerr << "Cannot open engine " << opts.engine << ": " << errormsg()
+			  << std::endl;
+		return 1;
+	}
+
+	std::printf("Engine:     %s\n", opts.engine.c_str());
+	std::printf("Keys:       %zu bytes each\n", opts.key_size);
+	std::printf("Values:     %zu bytes each\n", opts.value_size);
+	std::printf("Entries:    %zu\n", opts.num);
+	std::printf("Threads:    %zu\n", opts.threads);
+	std::printf("------------------------------------------------\n");
+
+	for (auto &n : names)
+		run_benchmark(kv, opts, n, benchmarks().at(n));
+
+	kv.close();
+
+	return 0;
+}
@@ -0,0 +1,277 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_components.cc -- microbenchmarks (based on Google Benchmark) of
+ * internal building blocks of engines: hashing of keys, comparators,
+ * polymorphic_string and dram_log, for a range of key sizes.
+ *
+ * polymorphic_string is benchmarked on a pool, created at the path given by
+ * PMEMKV_COMPONENTS_POOL environment variable (/dev/shm/pmemkv_components by
+ * default) and removed at exit.
+ *
+ * Example:
+ *	PMEMKV_COMPONENTS_POOL=/mnt/pmem/components pmemkv_components \
+ *		--benchmark_filter=hash
+ */
+
+#include "comparator/comparator.h"
+#include "engines/cmap.h"
+#include "fast_hash.h"
+#include "polymorphic_string.h"
+#include "transaction.h"
+
+#include <benchmark/benchmark.h>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace pmem::kv;
+
+namespace
+{
+
+/* sizes of keys: 8, 16, 32, ..., 1024 bytes */
+static const int64_t MIN_KEY_SIZE = 8;
+static const int64_t MAX_KEY_SIZE = 1024;
+
+/* number of records in a dram_log, as in a typical transaction */
+static const size_t LOG_RECORDS = 100;
+static const size_t LOG_VALUE_SIZE = 100;
+
+static const size_t POOL_SIZE = 64 * 1024 * 1024;
+
+struct root {
+	pmem::obj::persistent_ptr<polymorphic_string> str;
+};
+
+static pmem::obj::pool<root> pop;
+
+static std::string make_key(size_t size, size_t seed = 0)
+{
+	std::string key(size, 'k');
+	for (size_t i = 0; i < size; ++i)
+		key[i] = static_cast<char>('a' + (i * 7 + seed) % 26);
+
+	return key;
+}
+
+static void key_sizes(benchmark::internal::Benchmark *b)
+{
+	b->RangeMultiplier(2)->Range(MIN_KEY_SIZE, MAX_KEY_SIZE);
+}
+
+static void set_bytes(benchmark::State &state)
+{
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+				state.range(0));
+}
+
+static void BM_fast_hash(benchmark::State &state)
+{
+	auto key = make_key(static_cast<size_t>(state.range(0)));
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(fast_hash(key.size(), key.data()));
+
+	set_bytes(state);
+}
+BENCHMARK(BM_fast_hash)->Apply(key_sizes);
+
+static void BM_cmap_string_hasher(benchmark::State &state)
+{
+	auto key = make_key(static_cast<size_t>(state.range(0)));
+	internal::cmap::string_hasher hasher;
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(hasher(string_view(key)));
+
+	set_bytes(state);
+}
+BENCHMARK(BM_cmap_string_hasher)->Apply(key_sizes);
+
+/* hash function of pools created before LAYOUT_VERSION, for comparison */
+static void BM_cmap_legacy_string_hasher(benchmark::State &state)
+{
+	auto key = make_key(static_cast<size_t>(state.range(0)));
+	internal::cmap::legacy_string_hasher hasher;
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(hasher(string_view(key)));
+
+	set_bytes(state);
+}
+BENCHMARK(BM_cmap_legacy_string_hasher)->Apply(key_sizes);
+
+/*
+ * Keys of comparisons differ only in the last byte, so the whole keys are
+ * compared.
+ */
+template <typename F>
+static void compare_keys(benchmark::State &state, F &&compare)
+{
+	auto key1 = make_key(static_cast<size_t>(state.range(0)));
+	auto key2 = key1;
+	key2.back() = static_cast<char>(key2.back() + 1);
+
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(compare(string_view(key1), string_view(key2)));
+		benchmark::ClobberMemory();
+	}
+
+	set_bytes(state);
+}
+
+/* default comparator of sorted engines, with the built-in binary order */
+static void BM_comparator_binary(benchmark::State &state)
+{
+	internal::comparator cmp(internal::binary_compare,
+				 "__pmemkv_binary_comparator", nullptr,
+				 internal::comparator::order::binary);
+
+	compare_keys(state, [&](string_view k1, string_view k2) {
+		return cmp.compare(k1, k2);
+	});
+}
+BENCHMARK(BM_comparator_binary)->Apply(key_sizes);
+
+/* the same order, but as a custom comparator - called through a pointer */
+static void BM_comparator_custom(benchmark::State &state)
+{
+	internal::comparator cmp(internal::binary_compare, "custom", nullptr);
+
+	compare_keys(state, [&](string_view k1, string_view k2) {
+		return cmp.compare(k1, k2);
+	});
+}
+BENCHMARK(BM_comparator_custom)->Apply(key_sizes);
+
+static void BM_memcmp(benchmark::State &state)
+{
+	compare_keys(state, [](string_view k1, string_view k2) {
+		auto n = std::min(k1.size(), k2.size());
+		auto r = std::memcmp(k1.data(), k2.data(), n);
+		return r != 0 ? r : (k1.size() < k2.size() ? -1 : k1.size() > k2.size());
+	});
+}
+BENCHMARK(BM_memcmp)->Apply(key_sizes);
+
+/* construction includes allocation, both in a single transaction */
+static void BM_polymorphic_string_construct(benchmark::State &state)
+{
+	auto key = make_key(static_cast<size_t>(state.range(0)));
+
+	for (auto _ : state) {
+		pmem::obj::transaction::run(pop, [&] {
+			auto str = pmem::obj::make_persistent<polymorphic_string>(
+				string_view(key));
+			pmem::obj::delete_persistent<polymorphic_string>(str);
+		});
+	}
+
+	set_bytes(state);
+}
+BENCHMARK(BM_polymorphic_string_construct)->Apply(key_sizes);
+
+/* keys of the same size are assigned alternately, in a transaction each */
+static void BM_polymorphic_string_assign(benchmark::State &state)
+{
+	auto key1 = make_key(static_cast<size_t>(state.range(0)));
+	auto key2 = make_key(static_cast<size_t>(state.range(0)), 1);
+	auto &str = *pop.root()->str;
+	bool first = true;
+
+	for (auto _ : state) {
+		pmem::obj::transaction::run(
+			pop, [&] { str = string_view(first ? key1 : key2); });
+		first = !first;
+	}
+
+	set_bytes(state);
+}
+BENCHMARK(BM_polymorphic_string_assign)->Apply(key_sizes);
+
+/* the log keeps its buffers after clear(), as it does between transactions */
+static void BM_dram_log_insert(benchmark::State &state)
+{
+	auto key = make_key(static_cast<size_t>(state.range(0)));
+	std::string value(LOG_VALUE_SIZE, 'v');
+	internal::dram_log log;
+
+	for (auto _ : state) {
+		for (size_t i = 0; i < LOG_RECORDS; ++i)
+			log.insert(key, value);
+		log.clear();
+	}
+
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * LOG_RECORDS));
+}
+BENCHMARK(BM_dram_log_insert)->Apply(key_sizes);
+
+/* replay as done on commit - every record is visited once */
+static void BM_dram_log_replay(benchmark::State &state)
+{
+	auto key = make_key(static_cast<size_t>(state.range(0)));
+	std::string value(LOG_VALUE_SIZE, 'v');
+	internal::dram_log log;
+	for (size_t i = 0; i < LOG_RECORDS; ++i) {
+		if (i % 4 == 3)
+			log.remove(key);
+		else
+			log.insert(key, value);
+	}
+
+	for (auto _ : state) {
+		size_t bytes = 0;
+		log.foreach ([&](const internal::dram_log::element_type &e) {
+			bytes += e.first.size() + e.second.size();
+		},
+			     [&](const internal::dram_log::element_type &e) {
+				     bytes += e.first.size();
+			     });
+		benchmark::DoNotOptimize(bytes);
+	}
+
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * LOG_RECORDS));
+}
+BENCHMARK(BM_dram_log_replay)->Apply(key_sizes);
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+
+	const char *path = std::getenv("PMEMKV_COMPONENTS_POOL");
+	if (!path)
+		path = "/dev/shm/pmemkv_components";
+
+	try {
+		pop = pmem::obj::pool<root>::create(path, "pmemkv_components", POOL_SIZE,
+						    S_IRWXU);
+		pmem::obj::transaction::run(pop, [&] {
+			auto r = pop.root();
+			r->str = pmem::obj::make_persistent<polymorphic_string>();
+		});
+	} catch (std::exception &e) {
+		std::cerr << "Cannot create pool " << path << ": " << e.what()
+			  << std::endl;
+		return 1;
+	}
+
+	benchmark::RunSpecifiedBenchmarks();
+
+	pop.close();
+	std::remove(path);
+
+	return 0;
+}
@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_memory.cc -- benchmark of persistent memory used per record by
+ * pmemobj-based engines. For every engine, key size and value size, it loads
+ * records into a new pool, opened with "memory_stats" config parameter, and
+ * prints (as CSV) bytes per key in total and per class of the engine's
+ * structures (e.g. nodes, leaves, separately allocated keys and values),
+ * as reported by "memory.*" statistics.
+ *
+ * Example:
+ *	pmemkv_memory --engines=cmap,stree,csmap,radix --db=/mnt/pmem/pool \
+ *		--key_sizes=16,64 --value_sizes=16,64,256,1024 --records=100000
+ */
+
+#include <libpmemkv.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace pmem::kv;
+
+namespace
+{
+
+struct options {
+	std::string engines = "cmap";
+	std::string path;
+	size_t db_size = 1024ULL * 1024ULL * 1024ULL;
+	std::string key_sizes = "16,64";
+	std::string value_sizes = "16,64,256,1024";
+	size_t records = 100000;
+};
+
+/* Unique key of exactly 'size' bytes (the number is at its end) */
+static std::string key_of(uint64_t n, size_t size)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%016llu", static_cast<unsigned long long>(n));
+	std::string num = buf;
+
+	if (size <= num.size())
+		return num.substr(num.size() - size);
+
+	return std::string(size - num.size(), 'k') + num;
+}
+
+/* Checks if key_of() gives 'records' different keys of the given size */
+static bool unique_keys(size_t size, size_t records)
+{
+	if (size == 0)
+		return false;
+
+	/* there are 10^size different keys shorter than 16 bytes */
+	uint64_t keys = 1;
+	for (size_t i = 0; i < size && i < 16; ++i)
+		keys *= 10;
+
+	return size >= 16 || records <= keys;
+}
+
+static std::vector<size_t> split_sizes(const std::string &list)
+{
+	std::vector<size_t> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			items.push_back(std::stoull(item));
+
+	return items;
+}
+
+static std::vector<std::string> split(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+
+	return items;
+}
+
+/* Loads records of the given sizes into a new pool and prints a line of results */
+static bool run(const options &opts, const std::string &engine, size_t key_size,
+		size_t value_size)
+{
+	std::remove(opts.path.c_str());
+
+	config cfg;
+	if (cfg.put_path(opts.path) != status::OK ||
+	    cfg.put_size(opts.db_size) != status::OK ||
+	    cfg.put_create_or_error_if_exists(true) != status::OK ||
+	    cfg.put_uint64("memory_stats", 1) != status::OK)
+		throw std::runtime_error(errormsg());
+
+	db kv;
+	if (kv.open(engine, std::move(cfg)) != status::OK) {
+		std::cerr << "Cannot open engine " << engine << ": " << errormsg()
+			  << std::endl;
+		return false;
+	}
+
+	std::string value(value_size, 'v');
+	for (size_t i = 0; i < opts.records; ++i) {
+		if (kv.put(key_of(i, key_size), value) != status::OK) {
+			std::cerr << "Cannot load records: " << errormsg() << std::endl;
+			return false;
+		}
+	}
+
+	std::map<std::string, uint64_t> stats;
+	if (kv.get_stats(stats) != status::OK) {
+		std::cerr << "Cannot get statistics: " << errormsg() << std::endl;
+		return false;
+	}
+
+	std::printf("%s,%zu,%zu,%zu,%llu,%llu,", engine.c_str(), key_size, value_size,
+		    opts.records,
+		    static_cast<unsigned long long>(stats["memory.bytes_per_key"]),
+		    static_cast<unsigned long long>(stats["pool.allocated_bytes"] /
+						    opts.records));
+
+	/* "memory.<class>.bytes_per_key" statistics, printed as <class>=<bytes> */
+	static const std::string suffix = ".bytes_per_key";
+	bool first = true;
+	for (auto &st : stats) {
+		auto &name = st.first;
+		if (name.compare(0, 7, "memory.") != 0 ||
+		    name.size() <= 7 + suffix.size() ||
+		    name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+			continue;
+
+		auto class_name = name.substr(7, name.size() - 7 - suffix.size());
+		std::printf("%s%s=%llu", first ? "" : ";", class_name.c_str(),
+			    static_cast<unsigned long long>(st.second));
+		first = false;
+	}
+	std::printf("\n");
+	std::fflush(stdout);
+
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	std::cerr << "Usage: " << prog << " [options]" << std::endl
+		  << "Options:" << std::endl
+		  << "  --engines=<list>     comma separated pmemobj-based engines"
+		  << " (default: cmap)" << std::endl
+		  << "  --db=<path>          path to the pool (required, it's"
+		  << " overwritten)" << std::endl
+		  << "  --db_size=<bytes>    size of the pool (default: 1GiB)"
+		  << std::endl
+		  << "  --key_sizes=<list>   comma separated sizes of keys"
+		  << " (default: 16,64)" << std::endl
+		  << "  --value_sizes=<list> comma separated sizes of values"
+		  << " (default: 16,64,256,1024)" << std::endl
+		  << "  --records=<n>        number of loaded records (default: 100000)"
+		  << std::endl;
+}
+
+static bool parse_args(int argc, char *argv[], options &opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			return false;
+
+		auto name = arg.substr(2, eq - 2);
+		auto value = arg.substr(eq + 1);
+
+		try {
+			if (name == "engines")
+				opts.engines = value;
+			else if (name == "db")
+				opts.path = value;
+			else if (name == "db_size")
+				opts.db_size = std::stoull(value);
+			else if (name == "key_sizes")
+				opts.key_sizes = value;
+			else if (name == "value_sizes")
+				opts.value_sizes = value;
+			else if (name == "records")
+				opts.records = std::stoull(value);
+			else
+				return false;
+		} catch (std::exception &e) {
+			return false;
+		}
+	}
+
+	return !opts.path.empty() && opts.records > 0;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	options opts;
+	if (!parse_args(argc, argv, opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<size_t> key_sizes, value_sizes;
+	try {
+		key_sizes = split_sizes(opts.key_sizes);
+		value_sizes = split_sizes(opts.value_sizes);
+	} catch (std::exception &e) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (auto k : key_sizes) {
+		if (!unique_keys(k, opts.records)) {
+			std::cerr << "Keys of " << k << " bytes cannot be unique"
+				  << std::endl;
+			return 1;
+		}
+	}
+
+	std::printf("# Pool:       %s (%zu bytes)\n", opts.path.c_str(), opts.db_size);
+	std::printf("# Records:    %zu\n", opts.records);
+	std::printf("engine,key_size,value_size,records,bytes_per_key,"
+		    "allocated_bytes_per_key,classes_bytes_per_key\n");
+
+	try {
+		for (auto &engine : split(opts.engines))
+			for (auto k : key_sizes)
+				for (auto v : value_sizes)
+					if (!run(opts, engine, k, v))
+						return 1;
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	std::remove(opts.path.c_str());
+
+	return 0;
+}
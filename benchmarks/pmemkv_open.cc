@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_open.cc -- benchmark of opening (startup and recovery) of pmemobj-based
+ * engines. For every engine and number of records, it builds a pool, closes it
+ * and then opens it again a number of times. Before every open, pages of the
+ * pool file are dropped from the page cache (unless --cold=0), so the open is
+ * a cold one (on a DAX file system there is no page cache anyway).
+ *
+ * Every open is printed as CSV: the total time measured here and the phases
+ * measured by pmemkv ("open.*" statistics, e.g. opening of the pool and
+ * recovery of the engine), as name=nanoseconds pairs.
+ *
+ * Example:
+ *	pmemkv_open --engines=cmap,stree,csmap --db=/mnt/pmem/pool \
+ *		--db_size=8589934592 --records=1000000,10000000 --runs=5
+ */
+
+#include <libpmemkv.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace pmem::kv;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+	std::string engines = "cmap";
+	std::string path;
+	size_t db_size = 1024ULL * 1024ULL * 1024ULL;
+	std::string records = "1000000";
+	size_t value_size = 100;
+	size_t runs = 5;
+	bool cold = true;
+};
+
+static std::string key_of(uint64_t n)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "key%016llu",
+		      static_cast<unsigned long long>(n));
+
+	return buf;
+}
+
+static std::vector<std::string> split(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+
+	return items;
+}
+
+static config make_config(const options &opts, bool create)
+{
+	config cfg;
+	if (cfg.put_path(opts.path) != status::OK ||
+	    (create && cfg.put_size(opts.db_size) != status::OK) ||
+	    (create && cfg.put_create_or_error_if_exists(true) != status::OK))
+		throw std::runtime_error(errormsg());
+
+	return cfg;
+}
+
+/* Creates the pool with the given number of records and closes it */
+static bool build(const options &opts, const std::string &engine, size_t records)
+{
+	std::remove(opts.path.c_str());
+
+	db kv;
+	if (kv.open(engine, make_config(opts, true)) != status::OK) {
+		std::cerr << "Cannot create engine " << engine << ": " << errormsg()
+			  << std::endl;
+		return false;
+	}
+
+	std::string value(opts.value_size, 'v');
+	for (size_t i = 0; i < records; ++i) {
+		if (kv.put(key_of(i), value) != status::OK) {
+			std::cerr << "Cannot load records: " << errormsg() << std::endl;
+			return false;
+		}
+	}
+
+	kv.close();
+
+	return true;
+}
+
+/* Writes back and drops pages of the pool file from the page cache */
+static void drop_page_cache(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	fsync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+/* Opens the pool once and prints a line of results */
+static bool run(const options &opts, const std::string &engine, size_t records,
+		size_t run_no)
+{
+	if (opts.cold)
+		drop_page_cache(opts.path);
+
+	db kv;
+	auto cfg = make_config(opts, false);
+	auto begin = clock_type::now();
+	auto s = kv.open(engine, std::move(cfg));
+	auto end = clock_type::now();
+	if (s != status::OK) {
+		std::cerr << "Cannot open engine " << engine << ": " << errormsg()
+			  << std::endl;
+		return false;
+	}
+
+	std::map<std::string, uint64_t> stats;
+	if (kv.get_stats(stats) != status::OK)
+		stats.clear();
+
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
+	std::printf("%s,%zu,%zu,%llu,", engine.c_str(), records, run_no,
+		    static_cast<unsigned long long>(ns.count()));
+
+	/* "open.<phase>_ns" statistics, printed as <phase>=<ns> */
+	bool first = true;
+	for (auto &st : stats) {
+		auto &name = st.first;
+		if (name.compare(0, 5, "open.") != 0 || name.size() < 8)
+			continue;
+
+		auto phase = name.substr(5, name.size() - 8);
+		std::printf("%s%s=%llu", first ? "" : ";", phase.c_str(),
+			    static_cast<unsigned long long>(st.second));
+		first = false;
+	}
+	std::printf("\n");
+	std::fflush(stdout);
+
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	std::cerr << "Usage: " << prog << " [options]" << std::endl
+		  << "Options:" << std::endl
+		  << "  --engines=<list>     comma separated pmemobj-based engines"
+		  << " (default: cmap)" << std::endl
+		  << "  --db=<path>          path to the pool (required, it's"
+		  << " overwritten)" << std::endl
+		  << "  --db_size=<bytes>    size of the pool (default: 1GiB)"
+		  << std::endl
+		  << "  --records=<list>     comma separated numbers of records"
+		  << " (default: 1000000)" << std::endl
+		  << "  --value_size=<bytes> size of values (default: 100)" << std::endl
+		  << "  --runs=<n>           number of opens of every pool"
+		  << " (default: 5)" << std::endl
+		  << "  --cold=<0|1>         drop the pool from the page cache before"
+		  << " every open (default: 1)" << std::endl;
+}
+
+static bool parse_args(int argc, char *argv[], options &opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			return false;
+
+		auto name = arg.substr(2, eq - 2);
+		auto value = arg.substr(eq + 1);
+
+		try {
+			if (name == "engines")
+				opts.engines = value;
+			else if (name == "db")
+				opts.path = value;
+			else if (name == "db_size")
+				opts.db_size = std::stoull(value);
+			else if (name == "records")
+				opts.records = value;
+			else if (name == "value_size")
+				opts.value_size = std::stoull(value);
+			else if (name == "runs")
+				opts.runs = std::stoull(value);
+			else if (name == "cold")
+				opts.cold = std::stoull(value) != 0;
+			else
+				return false;
+		} catch (std::exception &e) {
+			return false;
+		}
+	}
+
+	return !opts.path.empty() && opts.runs > 0;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	options opts;
+	if (!parse_args(argc, argv, opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<size_t> record_counts;
+	try {
+		for (auto &n : split(opts.records))
+			record_counts.push_back(std::stoull(n));
+	} catch (std::exception &e) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::printf("# Pool:       %s (%zu bytes)\n", opts.path.c_str(), opts.db_size);
+	std::printf("# Values:     %zu bytes each\n", opts.value_size);
+	std::printf("# Cold opens: %s\n", opts.cold ? "yes" : "no");
+	std::printf("engine,records,run,open_ns,phases_ns\n");
+
+	try {
+		for (auto &engine : split(opts.engines)) {
+			for (auto records : record_counts) {
+				if (!build(opts, engine, records))
+					return 1;
+
+				for (size_t r = 0; r < opts.runs; ++r)
+					if (!run(opts, engine, records, r))
+						return 1;
+			}
+		}
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	std::remove(opts.path.c_str());
+
+	return 0;
+}
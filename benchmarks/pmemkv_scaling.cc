@@ -0,0 +1,557 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_scaling.cc -- thread-scaling benchmark of concurrent engines. It loads
+ * records into the database and then, for every combination of operation mix,
+ * pinning of threads and number of threads, runs uniformly distributed gets
+ * and puts for a fixed time. Throughput (total and per thread), CPU cache
+ * misses (if perf events are available) and lock contention (if reported by
+ * the engine's statistics) of every run are printed as CSV.
+ *
+ * Example:
+ *	pmemkv_scaling --engine=cmap --db=/mnt/pmem/pool --db_size=4294967296 \
+ *		--threads=1,2,4,8,16 --mixes=read,mixed,write --pinning=none,compact
+ */
+
+#include <libpmemkv.hpp>
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pmem::kv;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+/* percentages of puts of the operation mixes */
+static const std::map<std::string, unsigned> &mixes()
+{
+	static const std::map<std::string, unsigned> defs = {
+		{"read", 0},
+		{"mixed", 50},
+		{"write", 100},
+	};
+
+	return defs;
+}
+
+/*
+ * Pinning of threads: none (left to the scheduler), compact (consecutive
+ * threads on CPUs of the same NUMA node, until it's full) and spread (threads
+ * assigned to NUMA nodes round-robin).
+ */
+enum class pinning { NONE, COMPACT, SPREAD };
+
+struct options {
+	std::string engine = "cmap";
+	std::string path;
+	size_t db_size = 1024ULL * 1024ULL * 1024ULL;
+	size_t records = 1000000;
+	size_t value_size = 100;
+	double duration = 2;
+	std::string threads;
+	std::string mixes = "read,mixed,write";
+	std::string pinnings = "none,compact";
+	uint64_t seed = 0;
+};
+
+static std::string key_of(uint64_t n)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "key%016llu",
+		      static_cast<unsigned long long>(n));
+
+	return buf;
+}
+
+/* Parses a list of CPUs in the kernel's format, e.g. "0-3,8,10-11" */
+static std::vector<int> parse_cpu_list(const std::string &list)
+{
+	std::vector<int> cpus;
+	std::stringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		if (range.empty())
+			continue;
+
+		auto dash = range.find('-');
+		int first = std::stoi(range.substr(0, dash));
+		int last = dash == std::string::npos ? first
+						     : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+/*
+ * Returns CPUs of every NUMA node (read from sysfs), restricted to the ones
+ * the process may run on. Without NUMA information, all of them are one node.
+ */
+static std::vector<std::vector<int>> numa_nodes()
+{
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+
+	std::vector<std::vector<int>> nodes;
+	for (int node = 0;; ++node) {
+		std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) +
+				"/cpulist");
+		if (!f)
+			break;
+
+		std::string list;
+		std::getline(f, list);
+		std::vector<int> cpus;
+		for (auto cpu : parse_cpu_list(list))
+			if (CPU_ISSET(static_cast<size_t>(cpu), &allowed))
+				cpus.push_back(cpu);
+		if (!cpus.empty())
+			nodes.push_back(cpus);
+	}
+
+	if (nodes.empty()) {
+		nodes.emplace_back();
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			if (CPU_ISSET(static_cast<size_t>(cpu), &allowed))
+				nodes.back().push_back(cpu);
+	}
+
+	return nodes;
+}
+
+/* Returns CPUs for consecutive threads, according to the pinning */
+static std::vector<int> cpu_order(pinning p,
+				  const std::vector<std::vector<int>> &nodes)
+{
+	std::vector<int> order;
+	if (p == pinning::COMPACT) {
+		for (auto &node : nodes)
+			order.insert(order.end(), node.begin(), node.end());
+	} else if (p == pinning::SPREAD) {
+		for (size_t i = 0;; ++i) {
+			bool added = false;
+			for (auto &node : nodes) {
+				if (i < node.size()) {
+					order.push_back(node[i]);
+					added = true;
+				}
+			}
+			if (!added)
+				break;
+		}
+	}
+
+	return order;
+}
+
+static void pin_thread(int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(static_cast<size_t>(cpu), &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Counter of CPU cache misses of the calling thread (in user space), or -1
+ * if perf events are not available (e.g. restricted by perf_event_paranoid).
+ */
+static int open_cache_misses_counter()
+{
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+static bool read_counter(int fd, uint64_t &value)
+{
+	return fd >= 0 && read(fd, &value, sizeof(value)) == sizeof(value);
+}
+
+struct thread_result {
+	uint64_t ops = 0;
+	uint64_t errors = 0;
+	uint64_t cache_misses = 0;
+	bool cache_misses_valid = false;
+};
+
+struct run_result {
+	uint64_t ops = 0;
+	uint64_t errors = 0;
+	double seconds = 0;
+	uint64_t cache_misses = 0;
+	bool cache_misses_valid = true;
+};
+
+static run_result run(db &kv, const options &opts, const std::string &value,
+		      unsigned put_percent, const std::vector<int> &cpus, size_t threads)
+{
+	std::vector<thread_result> results(threads);
+	std::atomic<size_t> ready(0);
+	std::atomic<bool> start(false);
+	std::atomic<bool> stop(false);
+
+	auto worker = [&](size_t tid) {
+		if (!cpus.empty())
+			pin_thread(cpus[tid % cpus.size()]);
+
+		std::mt19937_64 gen(opts.seed + tid);
+		std::uniform_int_distribution<uint64_t> keys(0, opts.records - 1);
+		std::uniform_int_distribution<unsigned> percent(0, 99);
+		auto &r = results[tid];
+		int fd = open_cache_misses_counter();
+
+		++ready;
+		while (!start.load())
+			std::this_thread::yield();
+
+		uint64_t misses_start = 0;
+		r.cache_misses_valid = read_counter(fd, misses_start);
+
+		/* the stop flag is checked every 64 operations */
+		while (!stop.load(std::memory_order_relaxed)) {
+			for (int i = 0; i < 64; ++i) {
+				auto k = key_of(keys(gen));
+				status s;
+				if (percent(gen) < put_percent)
+					s = kv.put(k, value);
+				else
+					s = kv.get(k, [](string_view) {});
+				if (s != status::OK)
+					++r.errors;
+			}
+			r.ops += 64;
+		}
+
+		uint64_t misses_end = 0;
+		if (r.cache_misses_valid && read_counter(fd, misses_end))
+			r.cache_misses = misses_end - misses_start;
+		else
+			r.cache_misses_valid = false;
+		if (fd >= 0)
+			close(fd);
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t tid = 0; tid < threads; ++tid)
+		workers.emplace_back(worker, tid);
+	while (ready.load() != threads)
+		std::this_thread::yield();
+
+	auto begin = clock_type::now();
+	start = true;
+	std::this_thread::sleep_for(std::chrono::duration<double>(opts.duration));
+	stop = true;
+	for (auto &w : workers)
+		w.join();
+	auto end = clock_type::now();
+
+	run_result result;
+	result.seconds =
+		std::chrono::duration_cast<std::chrono::duration<double>>(end - begin)
+			.count();
+	for (auto &r : results) {
+		result.ops += r.ops;
+		result.errors += r.errors;
+		result.cache_misses += r.cache_misses;
+		result.cache_misses_valid =
+			result.cache_misses_valid && r.cache_misses_valid;
+	}
+
+	return result;
+}
+
+/*
+ * Sums statistics of lock contention reported by the engine ("lock.<class>.
+ * contended" and "lock.<class>.wait_ns"), returns false if there are none.
+ */
+static bool lock_stats(db &kv, uint64_t &contended, uint64_t &wait_ns)
+{
+	std::map<std::string, uint64_t> stats;
+	if (kv.get_stats(stats) != status::OK)
+		return false;
+
+	bool found = false;
+	contended = wait_ns = 0;
+	for (auto &s : stats) {
+		auto &name = s.first;
+		if (name.compare(0, 5, "lock.") != 0)
+			continue;
+
+		auto dot = name.rfind('.');
+		if (name.compare(dot, std::string::npos, ".contended") == 0)
+			contended += s.second;
+		else if (name.compare(dot, std::string::npos, ".wait_ns") == 0)
+			wait_ns += s.second;
+		else
+			continue;
+		found = true;
+	}
+
+	return found;
+}
+
+static void print_per_op(bool valid, uint64_t value, uint64_t ops)
+{
+	if (valid && ops > 0)
+		std::printf("%.3f",
+			    static_cast<double>(value) / static_cast<double>(ops));
+	else
+		std::printf("n/a");
+}
+
+/* Runs the mix with the given threads and prints a line of results */
+static void report(db &kv, const options &opts, const std::string &value,
+		   const std::string &mix, const std::string &pinning_name,
+		   const std::vector<int> &cpus, size_t threads)
+{
+	uint64_t contended_start = 0, wait_start = 0;
+	bool locks = lock_stats(kv, contended_start, wait_start);
+
+	auto r = run(kv, opts, value, mixes().at(mix), cpus, threads);
+
+	uint64_t contended_end = 0, wait_end = 0;
+	locks = locks && lock_stats(kv, contended_end, wait_end);
+
+	auto tput = r.seconds > 0 ? static_cast<double>(r.ops) / r.seconds : 0;
+	std::printf("%s,%s,%zu,%.0f,%.0f,%llu,", mix.c_str(), pinning_name.c_str(),
+		    threads, tput, tput / static_cast<double>(threads),
+		    static_cast<unsigned long long>(r.errors));
+	print_per_op(r.cache_misses_valid, r.cache_misses, r.ops);
+	std::printf(",");
+	print_per_op(locks, contended_end - contended_start, r.ops);
+	std::printf(",");
+	print_per_op(locks, wait_end - wait_start, r.ops);
+	std::printf("\n");
+	std::fflush(stdout);
+}
+
+static std::vector<std::string> split(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+
+	return items;
+}
+
+/* 1, 2, 4, ... up to the number of CPUs (and the number of CPUs itself) */
+static std::vector<size_t> default_threads(size_t cpus)
+{
+	std::vector<size_t> threads;
+	for (size_t n = 1; n < cpus; n *= 2)
+		threads.push_back(n);
+	threads.push_back(std::max<size_t>(cpus, 1));
+
+	return threads;
+}
+
+static bool parse_pinning(const std::string &name, pinning &p)
+{
+	if (name == "none")
+		p = pinning::NONE;
+	else if (name == "compact")
+		p = pinning::COMPACT;
+	else if (name == "spread")
+		p = pinning::SPREAD;
+	else
+		return false;
+
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	std::cerr << "Usage: " << prog << " [options]" << std::endl
+		  << "Options:" << std::endl
+		  << "  --engine=<name>      engine name (default: cmap)" << std::endl
+		  << "  --db=<path>          path to the pool (or directory for"
+		  << " volatile engines)" << std::endl
+		  << "  --db_size=<bytes>    size of the pool (default: 1GiB)"
+		  << std::endl
+		  << "  --records=<n>        number of loaded records"
+		  << " (default: 1000000)"
+		  << std::endl
+		  << "  --value_size=<bytes> size of values (default: 100)" << std::endl
+		  << "  --duration=<s>       duration of every run in seconds"
+		  << " (default: 2)" << std::endl
+		  << "  --threads=<list>     comma separated numbers of threads"
+		  << " (default: 1, 2, 4, ... up to the number of CPUs)" << std::endl
+		  << "  --mixes=<list>       operation mixes: read (100% gets), mixed"
+		  << " (50% puts), write (100% puts) (default: read,mixed,write)"
+		  << std::endl
+		  << "  --pinning=<list>     pinning of threads: none, compact (fill"
+		  << " NUMA nodes one by one), spread (round-robin over NUMA nodes)"
+		  << " (default: none,compact)" << std::endl
+		  << "  --seed=<n>           seed of random generators (default: 0)"
+		  << std::endl;
+}
+
+static bool parse_args(int argc, char *argv[], options &opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			return false;
+
+		auto name = arg.substr(2, eq - 2);
+		auto value = arg.substr(eq + 1);
+
+		try {
+			if (name == "engine")
+				opts.engine = value;
+			else if (name == "db")
+				opts.path = value;
+			else if (name == "db_size")
+				opts.db_size = std::stoull(value);
+			else if (name == "records")
+				opts.records = std::stoull(value);
+			else if (name == "value_size")
+				opts.value_size = std::stoull(value);
+			else if (name == "duration")
+				opts.duration = std::stod(value);
+			else if (name == "threads")
+				opts.threads = value;
+			else if (name == "mixes")
+				opts.mixes = value;
+			else if (name == "pinning")
+				opts.pinnings = value;
+			else if (name == "seed")
+				opts.seed = std::stoull(value);
+			else
+				return false;
+		} catch (std::exception &e) {
+			return false;
+		}
+	}
+
+	return opts.records > 0 && opts.duration > 0;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	options opts;
+	if (!parse_args(argc, argv, opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	auto nodes = numa_nodes();
+	size_t cpus = 0;
+	for (auto &node : nodes)
+		cpus += node.size();
+
+	std::vector<size_t> thread_counts;
+	try {
+		for (auto &n : split(opts.threads))
+			thread_counts.push_back(std::stoull(n));
+	} catch (std::exception &e) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (thread_counts.empty())
+		thread_counts = default_threads(cpus);
+	if (std::find(thread_counts.begin(), thread_counts.end(), 0) !=
+	    thread_counts.end()) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<std::string> mix_names = split(opts.mixes);
+	for (auto &m : mix_names) {
+		if (mixes().find(m) == mixes().end()) {
+			std::cerr << "Unknown mix: " << m << std::endl;
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<std::pair<std::string, pinning>> pinnings;
+	for (auto &name : split(opts.pinnings)) {
+		pinning p;
+		if (!parse_pinning(name, p)) {
+			std::cerr << "Unknown pinning: " << name << std::endl;
+			usage(argv[0]);
+			return 1;
+		}
+		pinnings.emplace_back(name, p);
+	}
+
+	config cfg;
+	if (!opts.path.empty()) {
+		if (cfg.put_path(opts.path) != status::OK ||
+		    cfg.put_size(opts.db_size) != status::OK ||
+		    cfg.put_create_if_missing(true) != status::OK) {
+			std::cerr << errormsg() << std::endl;
+			return 1;
+		}
+	}
+
+	db kv;
+	if (kv.open(opts.engine, std::move(cfg)) != status::OK) {
+		std::cerr << "Cannot open engine " << opts.engine << ": " << errormsg()
+			  << std::endl;
+		return 1;
+	}
+
+	std::string value(opts.value_size, 'v');
+	for (size_t i = 0; i < opts.records; ++i) {
+		if (kv.put(key_of(i), value) != status::OK) {
+			std::cerr << "Cannot load records: " << errormsg() << std::endl;
+			return 1;
+		}
+	}
+
+	std::printf("# Engine:     %s\n", opts.engine.c_str());
+	std::printf("# Records:    %zu\n", opts.records);
+	std::printf("# Values:     %zu bytes each\n", opts.value_size);
+	std::printf("# CPUs:       %zu in %zu NUMA node(s)\n", cpus, nodes.size());
+	std::printf("mix,pinning,threads,ops_per_sec,ops_per_sec_per_thread,errors,"
+		    "cache_misses_per_op,lock_contended_per_op,lock_wait_ns_per_op\n");
+
+	for (auto &m : mix_names) {
+		for (auto &p : pinnings) {
+			auto order = cpu_order(p.second, nodes);
+			for (auto threads : thread_counts)
+				report(kv, opts, value, m, p.first, order, threads);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,604 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_ycsb.cc -- driver of YCSB core workloads (A-F), which can be run on
+ * any engine compiled into libpmemkv. It loads recordcount records and then
+ * runs operationcount operations of the given workloads, reporting throughput
+ * and latency percentiles of each operation type in YCSB's output format
+ * ("[SECTION], metric, value"), so results can be compared across releases.
+ *
+ * Example:
+ *	pmemkv_ycsb --engine=cmap --db=/mnt/pmem/pool --db_size=4294967296 \
+ *		--workloads=a,b,c,f,d --recordcount=1000000 --threads=4
+ */
+
+#include <libpmemkv.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pmem::kv;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+enum class distribution { UNIFORM, ZIPFIAN, LATEST };
+
+enum op_type { OP_READ, OP_UPDATE, OP_INSERT, OP_SCAN, OP_RMW, OP_TYPES };
+
+static const char *op_names[OP_TYPES] = {"READ", "UPDATE", "INSERT", "SCAN",
+					 "READ-MODIFY-WRITE"};
+
+/* Proportions of operations and the key chooser of a workload */
+struct workload {
+	double proportions[OP_TYPES];
+	distribution keys;
+};
+
+/* Core workloads, as defined in YCSB's workloads/workload[a-f] files */
+static const std::map<std::string, workload> &core_workloads()
+{
+	static const std::map<std::string, workload> defs = {
+		/* update heavy */
+		{"a", {{0.5, 0.5, 0, 0, 0}, distribution::ZIPFIAN}},
+		/* read mostly */
+		{"b", {{0.95, 0.05, 0, 0, 0}, distribution::ZIPFIAN}},
+		/* read only */
+		{"c", {{1, 0, 0, 0, 0}, distribution::ZIPFIAN}},
+		/* read latest */
+		{"d", {{0.95, 0, 0.05, 0, 0}, distribution::LATEST}},
+		/* short ranges */
+		{"e", {{0, 0, 0.05, 0.95, 0}, distribution::ZIPFIAN}},
+		/* read-modify-write */
+		{"f", {{0.5, 0, 0, 0, 0.5}, distribution::ZIPFIAN}},
+	};
+
+	return defs;
+}
+
+struct options {
+	std::string engine = "cmap";
+	std::string path;
+	size_t db_size = 1024ULL * 1024ULL * 1024ULL;
+	std::string workloads = "a";
+	bool load = true;
+	size_t recordcount = 1000000;
+	size_t operationcount = 1000000;
+	/* fieldcount * fieldlength of YCSB's defaults, stored as one value */
+	size_t value_size = 1000;
+	size_t max_scan_length = 100;
+	/* overrides distribution of all workloads, if not empty */
+	std::string request_distribution;
+	double zipfian_constant = 0.99;
+	size_t threads = 1;
+	uint64_t seed = 0;
+};
+
+/* FNV-1a hash of a 64-bit number, used by YCSB to scramble key numbers */
+static uint64_t fnv_hash64(uint64_t n)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (int i = 0; i < 8; ++i) {
+		hash ^= n & 0xff;
+		hash *= 1099511628211ULL;
+		n >>= 8;
+	}
+
+	return hash;
+}
+
+/* Keys are not inserted in order of their numbers (YCSB's "hashed" order) */
+static std::string key_of(uint64_t n)
+{
+	return "user" + std::to_string(fnv_hash64(n));
+}
+
+/*
+ * Zipfian generator of numbers in [0, items), as described in "Quickly
+ * Generating Billion-Record Synthetic Databases" by Gray et al. (which is
+ * what YCSB uses). Item 0 is the most popular one. The number of items may
+ * grow, zeta is then updated incrementally.
+ */
+class zipfian_generator {
+public:
+	zipfian_generator(uint64_t items, double theta)
+	    : items(0), theta(theta), zeta2(zeta(0, 2)), zetan(0)
+	{
+		alpha = 1.0 / (1.0 - theta);
+		grow(items);
+	}
+
+	uint64_t next(std::mt19937_64 &gen, uint64_t n)
+	{
+		grow(n);
+
+		double u = std::uniform_real_distribution<double>(0, 1)(gen);
+		double uz = u * zetan;
+		if (uz < 1.0)
+			return 0;
+		if (uz < 1.0 + std::pow(0.5, theta))
+			return 1;
+
+		auto ret = static_cast<uint64_t>(
+			static_cast<double>(items) * std::pow(eta * u - eta + 1, alpha));
+		return std::min(ret, items - 1);
+	}
+
+private:
+	double zeta(uint64_t from, uint64_t to) const
+	{
+		double sum = 0;
+		for (uint64_t i = from; i < to; ++i)
+			sum += 1.0 / std::pow(static_cast<double>(i + 1), theta);
+
+		return sum;
+	}
+
+	void grow(uint64_t n)
+	{
+		if (n <= items)
+			return;
+
+		zetan += zeta(items, n);
+		items = n;
+		eta = (1 - std::pow(2.0 / static_cast<double>(items), 1 - theta)) /
+			(1 - zeta2 / zetan);
+	}
+
+	uint64_t items;
+	double theta;
+	double zeta2;
+	double zetan;
+	double alpha;
+	double eta;
+};
+
+/* Chooses numbers of existing keys, each thread has its own chooser */
+class key_chooser {
+public:
+	key_chooser(distribution dist, uint64_t items, const options &opts,
+		    uint64_t seed)
+	    : dist(dist), gen(seed), zipfian(items, opts.zipfian_constant)
+	{
+	}
+
+	/* Returns a number in [0, n), n is the current number of keys */
+	uint64_t next(uint64_t n)
+	{
+		switch (dist) {
+			case distribution::UNIFORM:
+				return std::uniform_int_distribution<uint64_t>(
+					0, n - 1)(gen);
+			case distribution::LATEST:
+				/* the most recently inserted keys are the hottest */
+				return n - 1 - zipfian.next(gen, n);
+			case distribution::ZIPFIAN:
+			default:
+				/* hot keys are scattered over the key space */
+				return fnv_hash64(zipfian.next(gen, n)) % n;
+		}
+	}
+
+	std::mt19937_64 &generator()
+	{
+		return gen;
+	}
+
+private:
+	distribution dist;
+	std::mt19937_64 gen;
+	zipfian_generator zipfian;
+};
+
+/* Latencies (in nanoseconds) and counters of operations of a single thread */
+struct thread_stats {
+	std::vector<uint64_t> latencies[OP_TYPES];
+	size_t errors[OP_TYPES] = {};
+	size_t not_found[OP_TYPES] = {};
+};
+
+struct run_context {
+	db &kv;
+	const options &opts;
+	std::string value_buffer;
+	/* number of keys inserted so far (by the load and insert operations) */
+	std::atomic<uint64_t> key_count;
+
+	run_context(db &kv, const options &opts) : kv(kv), opts(opts), key_count(0)
+	{
+		std::mt19937_64 gen(opts.seed);
+		value_buffer.resize(opts.value_size * 2 + 1);
+		for (auto &c : value_buffer)
+			c = static_cast<char>('a' + gen() % 26);
+	}
+
+	string_view value(uint64_t n) const
+	{
+		return string_view(value_buffer.data() + n % (opts.value_size + 1),
+				   opts.value_size);
+	}
+};
+
+template <typename Op>
+static void measure(thread_stats &stats, op_type type, Op &&op)
+{
+	auto start = clock_type::now();
+	auto s = op();
+	stats.latencies[type].push_back(static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() -
+								     start)
+			.count()));
+
+	if (s == status::NOT_FOUND)
+		++stats.not_found[type];
+	else if (s != status::OK && s != status::STOPPED_BY_CB)
+		++stats.errors[type];
+}
+
+/* Returns range [begin, end) of operations to be executed by thread tid */
+static std::pair<size_t, size_t> thread_range(size_t n, size_t threads, size_t tid)
+{
+	size_t per_thread = n / threads;
+	size_t begin = per_thread * tid;
+	size_t end = (tid == threads - 1) ? n : begin + per_thread;
+
+	return {begin, end};
+}
+
+static void load(run_context &ctx, size_t tid, thread_stats &stats)
+{
+	auto range = thread_range(ctx.opts.recordcount, ctx.opts.threads, tid);
+
+	for (size_t i = range.first; i < range.second; ++i) {
+		auto k = key_of(i);
+		measure(stats, OP_INSERT, [&] { return ctx.kv.put(k, ctx.value(i)); });
+	}
+}
+
+static op_type choose_op(const workload &w, std::mt19937_64 &gen)
+{
+	double r = std::uniform_real_distribution<double>(0, 1)(gen);
+	for (int t = 0; t < OP_TYPES; ++t) {
+		if (r < w.proportions[t])
+			return static_cast<op_type>(t);
+		r -= w.proportions[t];
+	}
+
+	return OP_READ;
+}
+
+static void run(run_context &ctx, const workload &w, size_t tid, thread_stats &stats)
+{
+	auto range = thread_range(ctx.opts.operationcount, ctx.opts.threads, tid);
+	auto items = std::max<uint64_t>(ctx.key_count.load(), 1);
+	key_chooser chooser(w.keys, items, ctx.opts, ctx.opts.seed + tid + 1);
+	auto &gen = chooser.generator();
+	std::string value;
+
+	for (size_t i = range.first; i < range.second; ++i) {
+		auto type = choose_op(w, gen);
+
+		if (type == OP_INSERT) {
+			auto n = ctx.key_count.fetch_add(1);
+			auto k = key_of(n);
+			measure(stats, type, [&] { return ctx.kv.put(k, ctx.value(n)); });
+			continue;
+		}
+
+		auto n = chooser.next(std::max<uint64_t>(ctx.key_count.load(), 1));
+		auto k = key_of(n);
+
+		switch (type) {
+			case OP_READ:
+				measure(stats, type,
+					[&] { return ctx.kv.get(k, &value); });
+				break;
+			case OP_UPDATE:
+				measure(stats, type,
+					[&] { return ctx.kv.put(k, ctx.value(i)); });
+				break;
+			case OP_SCAN: {
+				auto len = std::uniform_int_distribution<size_t>(
+					1, ctx.opts.max_scan_length)(gen);
+				measure(stats, type, [&] {
+					size_t read = 0;
+					return ctx.kv.get_equal_above(
+						k, [&](string_view, string_view) {
+							return ++read < len ? 0 : 1;
+						});
+				});
+				break;
+			}
+			case OP_RMW:
+				measure(stats, type, [&] {
+					auto s = ctx.kv.get(k, &value);
+					if (s != status::OK)
+						return s;
+					return ctx.kv.put(k, ctx.value(i));
+				});
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+
+	auto idx = static_cast<size_t>(p / 100.0 *
+				       static_cast<double>(sorted.size() - 1));
+	return sorted[idx];
+}
+
+static void report(const std::string &phase, std::vector<thread_stats> &stats,
+		   double seconds)
+{
+	size_t total_ops = 0;
+	std::vector<uint64_t> latencies[OP_TYPES];
+	size_t errors[OP_TYPES] = {}, not_found[OP_TYPES] = {};
+	for (auto &s : stats) {
+		for (int t = 0; t < OP_TYPES; ++t) {
+			latencies[t].insert(latencies[t].end(), s.latencies[t].begin(),
+					    s.latencies[t].end());
+			errors[t] += s.errors[t];
+			not_found[t] += s.not_found[t];
+		}
+	}
+	for (int t = 0; t < OP_TYPES; ++t)
+		total_ops += latencies[t].size();
+
+	std::printf("[%s], RunTime(ms), %.0f\n", phase.c_str(), seconds * 1000);
+	std::printf("[%s], Throughput(ops/sec), %.2f\n", phase.c_str(),
+		    seconds > 0 ? static_cast<double>(total_ops) / seconds : 0);
+
+	for (int t = 0; t < OP_TYPES; ++t) {
+		auto &l = latencies[t];
+		if (l.empty())
+			continue;
+
+		std::sort(l.begin(), l.end());
+		uint64_t sum = 0;
+		for (auto v : l)
+			sum += v;
+
+		auto name = op_names[t];
+		auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+		std::printf("[%s], Operations, %zu\n", name, l.size());
+		std::printf("[%s], AverageLatency(us), %.3f\n", name,
+			    us(sum) / static_cast<double>(l.size()));
+		std::printf("[%s], MinLatency(us), %.3f\n", name, us(l.front()));
+		std::printf("[%s], MaxLatency(us), %.3f\n", name, us(l.back()));
+		std::printf("[%s], 50thPercentileLatency(us), %.3f\n", name,
+			    us(percentile(l, 50)));
+		std::printf("[%s], 95thPercentileLatency(us), %.3f\n", name,
+			    us(percentile(l, 95)));
+		std::printf("[%s], 99thPercentileLatency(us), %.3f\n", name,
+			    us(percentile(l, 99)));
+		std::printf("[%s], 99.9thPercentileLatency(us), %.3f\n", name,
+			    us(percentile(l, 99.9)));
+		std::printf("[%s], Return=OK, %zu\n", name,
+			    l.size() - errors[t] - not_found[t]);
+		if (not_found[t])
+			std::printf("[%s], Return=NOT_FOUND, %zu\n", name, not_found[t]);
+		if (errors[t])
+			std::printf("[%s], Return=ERROR, %zu\n", name, errors[t]);
+	}
+}
+
+template <typename F>
+static void run_phase(run_context &ctx, const std::string &phase, size_t ops, F &&fn)
+{
+	std::vector<thread_stats> stats(ctx.opts.threads);
+	for (auto &s : stats)
+		for (auto &l : s.latencies)
+			l.reserve(ops / ctx.opts.threads / 2 + 1);
+
+	auto start = clock_type::now();
+	std::vector<std::thread> workers;
+	for (size_t tid = 0; tid < ctx.opts.threads; ++tid)
+		workers.emplace_back([&, tid] { fn(tid, stats[tid]); });
+	for (auto &w : workers)
+		w.join();
+	auto end = clock_type::now();
+
+	report(phase, stats,
+	       std::chrono::duration_cast<std::chrono::duration<double>>(end - start)
+		       .count());
+}
+
+static bool parse_distribution(const std::string &name, distribution &dist)
+{
+	if (name == "uniform")
+		dist = distribution::UNIFORM;
+	else if (name == "zipfian")
+		dist = distribution::ZIPFIAN;
+	else if (name == "latest")
+		dist = distribution::LATEST;
+	else
+		return false;
+
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	std::cerr
+		<< "Usage: " << prog << " [options]" << std::endl
+		<< "Options:" << std::endl
+		<< "  --engine=<name>               engine name (default: cmap)"
+		<< std::endl
+		<< "  --db=<path>                   path to the pool (or directory for"
+		<< " volatile engines)" << std::endl
+		<< "  --db_size=<bytes>             size of the pool (default: 1GiB)"
+		<< std::endl
+		<< "  --workloads=<list>            comma separated list of core"
+		<< " workloads: a, b, c, d, e, f (default: a)" << std::endl
+		<< "  --load=<0|1>                  load recordcount records first"
+		<< " (default: 1)" << std::endl
+		<< "  --recordcount=<n>             number of loaded records"
+		<< " (default: 1000000)" << std::endl
+		<< "  --operationcount=<n>          number of operations of each"
+		<< " workload (default: 1000000)" << std::endl
+		<< "  --value_size=<bytes>          size of values (default: 1000)"
+		<< std::endl
+		<< "  --max_scan_length=<n>         maximum number of records read"
+		<< " by a scan (default: 100)" << std::endl
+		<< "  --request_distribution=<name> uniform, zipfian or latest"
+		<< " (default: as defined by the workload)" << std::endl
+		<< "  --zipfian_constant=<theta>    skew of zipfian distributions"
+		<< " (default: 0.99)" << std::endl
+		<< "  --threads=<n>                 number of threads (default: 1),"
+		<< " use 1 for single-threaded engines" << std::endl
+		<< "  --seed=<n>                    seed of random generators"
+		<< " (default: 0)" << std::endl;
+}
+
+static bool parse_args(int argc, char *argv[], options &opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			return false;
+
+		auto name = arg.substr(2, eq - 2);
+		auto value = arg.substr(eq + 1);
+
+		try {
+			if (name == "engine")
+				opts.engine = value;
+			else if (name == "db")
+				opts.path = value;
+			else if (name == "db_size")
+				opts.db_size = std::stoull(value);
+			else if (name == "workloads")
+				opts.workloads = value;
+			else if (name == "load")
+				opts.load = std::stoull(value) != 0;
+			else if (name == "recordcount")
+				opts.recordcount = std::stoull(value);
+			else if (name == "operationcount")
+				opts.operationcount = std::stoull(value);
+			else if (name == "value_size")
+				opts.value_size = std::stoull(value);
+			else if (name == "max_scan_length")
+				opts.max_scan_length = std::stoull(value);
+			else if (name == "request_distribution")
+				opts.request_distribution = value;
+			else if (name == "zipfian_constant")
+				opts.zipfian_constant = std::stod(value);
+			else if (name == "threads")
+				opts.threads = std::stoull(value);
+			else if (name == "seed")
+				opts.seed = std::stoull(value);
+			else
+				return false;
+		} catch (std::exception &e) {
+			return false;
+		}
+	}
+
+	return opts.threads > 0 && opts.recordcount > 0 && opts.max_scan_length > 0 &&
+		opts.zipfian_constant > 0 && opts.zipfian_constant < 1;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	options opts;
+	if (!parse_args(argc, argv, opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	distribution override_dist = distribution::ZIPFIAN;
+	if (!opts.request_distribution.empty() &&
+	    !parse_distribution(opts.request_distribution, override_dist)) {
+		std::cerr << "Unknown request distribution: " << opts.request_distribution
+			  << std::endl;
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<std::pair<std::string, workload>> workloads;
+	std::stringstream ss(opts.workloads);
+	std::string name;
+	while (std::getline(ss, name, ',')) {
+		auto it = core_workloads().find(name);
+		if (it == core_workloads().end()) {
+			std::cerr << "Unknown workload: " << name << std::endl;
+			usage(argv[0]);
+			return 1;
+		}
+
+		auto w = it->second;
+		if (!opts.request_distribution.empty())
+			w.keys = override_dist;
+		workloads.emplace_back(name, w);
+	}
+
+	config cfg;
+	if (!opts.path.empty()) {
+		if (cfg.put_path(opts.path) != status::OK ||
+		    cfg.put_size(opts.db_size) != status::OK ||
+		    cfg.put_create_if_missing(true) != status::OK) {
+			std::cerr << errormsg() << std::endl;
+			return 1;
+		}
+	}
+
+	db kv;
+	if (kv.open(opts.engine, std::move(cfg)) != status::OK) {
+		std::cerr << "Cannot open engine " << opts.engine << ": " << errormsg()
+			  << std::endl;
+		return 1;
+	}
+
+	std::printf("Engine:         %s\n", opts.engine.c_str());
+	std::printf("Records:        %zu\n", opts.recordcount);
+	std::printf("Operations:     %zu per workload\n", opts.operationcount);
+	std::printf("Values:         %zu bytes each\n", opts.value_size);
+	std::printf("Threads:        %zu\n", opts.threads);
+	std::printf("------------------------------------------------\n");
+
+	run_context ctx(kv, opts);
+	if (opts.load) {
+		std::printf("# load\n");
+		run_phase(ctx, "LOAD", opts.recordcount,
+			  [&](size_t tid, thread_stats &stats) {
+				  load(ctx, tid, stats);
+			  });
+	}
+	/* keys which are (assumed to be) loaded into the database */
+	ctx.key_count = opts.recordcount;
+
+	for (auto &w : workloads) {
+		std::printf("# workload %s\n", w.first.c_str());
+		run_phase(ctx, "OVERALL", opts.operationcount,
+			  [&](size_t tid, thread_stats &stats) {
+				  run(ctx, w.second, tid, stats);
+			  });
+	}
+
+	kv.close();
+
+	return 0;
+}
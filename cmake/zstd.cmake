@@ -0,0 +1,30 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+message(STATUS "Checking for module 'libzstd'")
+
+if(PKG_CONFIG_FOUND)
+	pkg_check_modules(ZSTD QUIET libzstd>=${ZSTD_REQUIRED_VERSION})
+endif()
+
+if(NOT ZSTD_FOUND)
+	# try old method
+	include(FindPackageHandleStandardArgs)
+	find_path(ZSTD_INCLUDEDIR zstd.h)
+	find_library(ZSTD_LIBRARY NAMES zstd libzstd)
+	mark_as_advanced(ZSTD_LIBRARY ZSTD_INCLUDEDIR)
+	find_package_handle_standard_args(ZSTD DEFAULT_MSG ZSTD_INCLUDEDIR ZSTD_LIBRARY)
+
+	if(ZSTD_FOUND)
+		set(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+		set(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDEDIR})
+		message(STATUS "  Found in dir '${ZSTD_INCLUDEDIR}' the old way (w/o pkg-config)")
+	else()
+		message(FATAL_ERROR "zstd library (>=${ZSTD_REQUIRED_VERSION}) not found")
+	endif()
+else()
+	message(STATUS "  Found in dir '${ZSTD_LIBDIR}' using pkg-config (ver: ${ZSTD_VERSION})")
+endif()
+
+include_directories(${ZSTD_INCLUDE_DIRS})
+link_directories(${ZSTD_LIBRARY_DIRS})
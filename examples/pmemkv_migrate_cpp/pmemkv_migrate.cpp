@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_migrate.cpp -- tool which copies all elements of a database to
+ * a database of another engine (e.g. from cmap to csmap), by db::migrate_to().
+ * Both databases are opened with configs given in JSON. The source is scanned
+ * by the given number of threads; unless the destination's config sets
+ * "durability", it's opened with deferred durability, so elements are made
+ * durable once, at the end of the migration.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <libpmemkv.hpp>
+#include <libpmemkv_json_config.h>
+#include <string>
+
+using namespace pmem::kv;
+
+static config config_from_json(const char *json)
+{
+	pmemkv_config *cfg = pmemkv_config_new();
+	if (cfg == nullptr) {
+		std::cerr << pmemkv_errormsg() << std::endl;
+		exit(1);
+	}
+
+	if (pmemkv_config_from_json(cfg, json) != PMEMKV_STATUS_OK) {
+		std::cerr << pmemkv_config_from_json_errormsg() << std::endl;
+		pmemkv_config_delete(cfg);
+		exit(1);
+	}
+
+	return config(cfg);
+}
+
+static void open_db(db &kv, const char *engine, config &&cfg)
+{
+	auto s = kv.open(engine, std::move(cfg));
+	if (s != status::OK) {
+		std::cerr << "Cannot open " << engine << ": " << kv.errormsg() << std::endl;
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 5) {
+		std::cerr << "Usage: " << argv[0]
+			  << " src_engine src_json_config dst_engine dst_json_config"
+			     " [threads]"
+			  << std::endl;
+		exit(1);
+	}
+
+	std::size_t threads = argc > 5 ? std::stoull(argv[5]) : 1;
+
+	auto dst_cfg = config_from_json(argv[4]);
+	std::string durability;
+	if (dst_cfg.get_string("durability", durability) == status::NOT_FOUND)
+		dst_cfg.put_string("durability", "deferred");
+
+	db src, dst;
+	open_db(src, argv[1], config_from_json(argv[2]));
+	open_db(dst, argv[3], std::move(dst_cfg));
+
+	auto start = std::chrono::steady_clock::now();
+	auto s = src.migrate_to(dst, threads);
+	auto end = std::chrono::steady_clock::now();
+
+	if (s != status::OK) {
+		std::cerr << "Migration failed: " << src.errormsg() << std::endl;
+		exit(1);
+	}
+
+	std::size_t cnt = 0;
+	dst.count_all(cnt);
+	std::cout << "Migrated to " << argv[3] << ", it has " << cnt << " elements ("
+		  << std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+			     .count()
+		  << " ms)" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "access_stats.h"
+#include "exceptions.h"
+#include "fast_hash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+frequency_sketch::frequency_sketch(std::size_t width)
+{
+	std::size_t size = 1;
+	while (size < width)
+		size <<= 1;
+
+	mask = size - 1;
+	counters.reset(new std::atomic<uint32_t>[size * DEPTH]);
+	clear();
+}
+
+/* rows are indexed by double hashing of a single hash of the key */
+std::size_t frequency_sketch::index(uint64_t hash, std::size_t row) const
+{
+	auto h1 = hash & 0xffffffffULL;
+	auto h2 = (hash >> 32) | 1;
+
+	return row * (mask + 1) + ((h1 + row * h2) & mask);
+}
+
+void frequency_sketch::add(string_view key)
+{
+	auto hash = fast_hash(key.size(), key.data());
+	for (std::size_t row = 0; row < DEPTH; ++row)
+		counters[index(hash, row)].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t frequency_sketch::estimate(string_view key) const
+{
+	auto hash = fast_hash(key.size(), key.data());
+	auto min = std::numeric_limits<uint32_t>::max();
+	for (std::size_t row = 0; row < DEPTH; ++row) {
+		auto &counter = counters[index(hash, row)];
+		min = std::min(min, counter.load(std::memory_order_relaxed));
+	}
+
+	return min;
+}
+
+void frequency_sketch::age()
+{
+	for (std::size_t i = 0; i < (mask + 1) * DEPTH; ++i)
+		counters[i].store(counters[i].load(std::memory_order_relaxed) / 2,
+				  std::memory_order_relaxed);
+}
+
+void frequency_sketch::clear()
+{
+	for (std::size_t i = 0; i < (mask + 1) * DEPTH; ++i)
+		counters[i].store(0, std::memory_order_relaxed);
+}
+
+constexpr std::size_t distinct_counter::PRECISION;
+constexpr std::size_t distinct_counter::REGISTERS;
+
+distinct_counter::distinct_counter()
+{
+	clear();
+}
+
+/* a register keeps the maximal position of the first set bit of its hashes */
+void distinct_counter::add(uint64_t hash) noexcept
+{
+	auto &reg = registers[static_cast<std::size_t>(hash >> (64 - PRECISION))];
+	auto rest = (hash << PRECISION) | (1ULL << (PRECISION - 1));
+	auto rank = static_cast<uint8_t>(__builtin_clzll(rest) + 1);
+
+	auto current = reg.load(std::memory_order_relaxed);
+	while (current < rank &&
+	       !reg.compare_exchange_weak(current, rank, std::memory_order_relaxed))
+		;
+}
+
+uint64_t distinct_counter::estimate() const noexcept
+{
+	const double m = static_cast<double>(REGISTERS);
+	double sum = 0;
+	std::size_t zeros = 0;
+	for (auto &reg : registers) {
+		auto r = reg.load(std::memory_order_relaxed);
+		sum += std::ldexp(1.0, -static_cast<int>(r));
+		if (r == 0)
+			zeros++;
+	}
+
+	double e = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+
+	/* linear counting is more accurate for small cardinalities */
+	if (e <= 2.5 * m && zeros > 0)
+		e = m * std::log(m / static_cast<double>(zeros));
+
+	return static_cast<uint64_t>(e + 0.5);
+}
+
+void distinct_counter::clear() noexcept
+{
+	for (auto &reg : registers)
+		reg.store(0, std::memory_order_relaxed);
+}
+
+constexpr std::size_t access_stats::TOP_KEYS;
+
+/* width of the sketch, it's aged every SKETCH_WIDTH * 8 sampled accesses */
+static constexpr std::size_t SKETCH_WIDTH = 4096;
+
+access_stats::access_stats(uint64_t sampling_rate)
+    : sampling_rate(sampling_rate),
+      sampled(0),
+      recent(0),
+      age_interval(SKETCH_WIDTH * 8),
+      next_age(age_interval),
+      sketch(SKETCH_WIDTH)
+{
+	if (sampling_rate == 0)
+		throw internal::invalid_argument(
+			"Config item \"access_sampling\" must be greater than 0");
+
+	top.reserve(TOP_KEYS);
+}
+
+void access_stats::record_sampled(string_view key)
+{
+	auto n = sampled.fetch_add(1, std::memory_order_relaxed) + 1;
+	recent.fetch_add(1, std::memory_order_relaxed);
+
+	sketch.add(key);
+	distinct.add(fast_hash(key.size(), key.data()));
+	record_top(key);
+
+	auto age_at = next_age.load(std::memory_order_relaxed);
+	if (n >= age_at &&
+	    next_age.compare_exchange_strong(age_at, age_at + age_interval,
+					     std::memory_order_relaxed)) {
+		sketch.age();
+
+		std::lock_guard<std::mutex> lock(top_mtx);
+		for (auto &t : top)
+			t.count /= 2;
+		recent.store(recent.load(std::memory_order_relaxed) / 2,
+			     std::memory_order_relaxed);
+	}
+}
+
+/* space-saving: an unknown key replaces the least frequent one */
+void access_stats::record_top(string_view key)
+{
+	std::unique_lock<std::mutex> lock(top_mtx, std::try_to_lock);
+	if (!lock.owns_lock())
+		return;
+
+	auto min = top.end();
+	for (auto it = top.begin(); it != top.end(); ++it) {
+		if (string_view(it->key) == key) {
+			it->count++;
+			return;
+		}
+		if (min == top.end() || it->count < min->count)
+			min = it;
+	}
+
+	if (top.size() < TOP_KEYS) {
+		top.push_back(top_key{std::string(key.data(), key.size()), 1});
+	} else {
+		min->key.assign(key.data(), key.size());
+		min->count++;
+	}
+}
+
+uint64_t access_stats::estimate(string_view key) const
+{
+	return sketch.estimate(key) * sampling_rate;
+}
+
+void access_stats::reset()
+{
+	sampled.store(0, std::memory_order_relaxed);
+	recent.store(0, std::memory_order_relaxed);
+	next_age.store(age_interval, std::memory_order_relaxed);
+	sketch.clear();
+	distinct.clear();
+
+	std::lock_guard<std::mutex> lock(top_mtx);
+	top.clear();
+}
+
+/* printable characters of the key are kept, other bytes are hex-escaped */
+static std::string escape_key(const std::string &key)
+{
+	std::string escaped;
+	for (auto c : key) {
+		auto u = static_cast<unsigned char>(c);
+		if (u >= 0x20 && u < 0x7f && c != '\\') {
+			escaped += c;
+		} else {
+			char buf[8];
+			std::snprintf(buf, sizeof(buf), "\\x%02x", u);
+			escaped += buf;
+		}
+	}
+
+	return escaped;
+}
+
+void access_stats::get(stats_sink &sink) const
+{
+	auto n = sampled.load(std::memory_order_relaxed);
+
+	sink.add("access.sampling_rate", sampling_rate);
+	sink.add("access.sampled_ops", n);
+	sink.add("access.working_set_keys", n > 0 ? distinct.estimate() : 0);
+
+	std::vector<top_key> keys;
+	{
+		std::lock_guard<std::mutex> lock(top_mtx);
+		keys = top;
+	}
+
+	/* counts of the table are overestimated, the sketch is more accurate */
+	uint64_t top_sampled = 0;
+	for (auto &t : keys) {
+		auto count = sketch.estimate(t.key);
+		sink.add("access.top." + escape_key(t.key), count * sampling_rate);
+		top_sampled += count;
+	}
+
+	/* share of recent sampled accesses which went to the top keys */
+	auto r = recent.load(std::memory_order_relaxed);
+	if (r > 0)
+		sink.add("access.top_percent", std::min<uint64_t>(top_sampled * 100 / r, 100));
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
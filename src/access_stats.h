@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_ACCESS_STATS_H
+#define LIBPMEMKV_ACCESS_STATS_H
+
+#include "libpmemkv.hpp"
+#include "stats.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Count-min sketch of sampled accesses to keys. Counters are halved by age(),
+ * so estimates reflect recent accesses.
+ */
+class frequency_sketch {
+public:
+	explicit frequency_sketch(std::size_t width);
+
+	void add(string_view key);
+	uint32_t estimate(string_view key) const;
+	void age();
+	void clear();
+
+	std::size_t width() const
+	{
+		return mask + 1;
+	}
+
+private:
+	static const std::size_t DEPTH = 4;
+
+	std::size_t index(uint64_t hash, std::size_t row) const;
+
+	std::size_t mask;
+	std::unique_ptr<std::atomic<uint32_t>[]> counters;
+};
+
+/*
+ * HyperLogLog estimator of the number of distinct keys, with 2^PRECISION
+ * registers (relative error of about 1.6%).
+ */
+class distinct_counter {
+public:
+	static constexpr std::size_t PRECISION = 12;
+	static constexpr std::size_t REGISTERS = 1 << PRECISION;
+
+	distinct_counter();
+
+	void add(uint64_t hash) noexcept;
+	uint64_t estimate() const noexcept;
+	void clear() noexcept;
+
+private:
+	std::array<std::atomic<uint8_t>, REGISTERS> registers;
+};
+
+/**
+ * access_stats tracks which keys of a database are accessed, enabled by
+ * "access_sampling" config parameter: operations on a single key are sampled
+ * (randomly, one in N on average) into a frequency sketch, a distinct counter
+ * and a small table of the most frequent keys (space-saving algorithm). Other
+ * operations only step a thread-local random number generator.
+ *
+ * The number of distinct keys sampled since opening (or the last reset) is
+ * the estimate of the working set - it is a lower bound, since a key accessed
+ * k times is missed with probability (1 - 1/N)^k. Estimates of accesses (per
+ * key and of the table of the most frequent keys, which only selects the keys)
+ * are counts of recent sampled accesses in the frequency sketch, multiplied
+ * by N.
+ *
+ * Estimates are also used by the read cache ("read_cache_admission").
+ */
+class access_stats {
+public:
+	/* number of the most frequent keys which are tracked */
+	static constexpr std::size_t TOP_KEYS = 16;
+
+	explicit access_stats(uint64_t sampling_rate);
+
+	access_stats(const access_stats &) = delete;
+	access_stats &operator=(const access_stats &) = delete;
+
+	/* Counts an access to the key, if it's sampled */
+	void record(string_view key)
+	{
+		/* xorshift, so that periodic access patterns are not aliased */
+		static thread_local uint64_t rng = 88172645463325252ULL;
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+		if (rng % sampling_rate != 0)
+			return;
+
+		record_sampled(key);
+	}
+
+	/* Estimated number of recent accesses to the key */
+	uint64_t estimate(string_view key) const;
+
+	void reset();
+	void get(stats_sink &sink) const;
+
+private:
+	struct top_key {
+		std::string key;
+		uint64_t count;
+	};
+
+	void record_sampled(string_view key);
+	void record_top(string_view key);
+
+	const uint64_t sampling_rate;
+	std::atomic<uint64_t> sampled;
+	/* sampled accesses, halved (like the sketch) when it's aged */
+	std::atomic<uint64_t> recent;
+	/* sampled accesses after which the sketch is aged */
+	uint64_t age_interval;
+	std::atomic<uint64_t> next_age;
+
+	frequency_sketch sketch;
+	distinct_counter distinct;
+
+	/* updated with try_lock, sampled accesses of a contended lock are skipped */
+	mutable std::mutex top_mtx;
+	std::vector<top_key> top;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_ACCESS_STATS_H */
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "async_queue.h"
+#include "exceptions.h"
+
+#include <limits>
+#include <new>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+static void copy_value(const char *v, size_t vb, void *arg)
+{
+	static_cast<std::string *>(arg)->assign(v, vb);
+}
+
+async_queue::async_queue(engine_base *engine, thread_pool &pool, bool inline_completion)
+    : engine(engine), pool(pool), inline_completion(inline_completion)
+{
+}
+
+/* Waits for all submitted operations and calls their completion callbacks. */
+async_queue::~async_queue()
+{
+	wait();
+	poll(std::numeric_limits<std::size_t>::max());
+}
+
+void async_queue::get(string_view key, pmemkv_async_callback *callback, void *arg)
+{
+	submit(operation_ptr(new operation{op_type::GET, std::string(key.data(), key.size()),
+					   std::string(), callback, arg, status::OK}));
+}
+
+void async_queue::put(string_view key, string_view value,
+		      pmemkv_async_callback *callback, void *arg)
+{
+	submit(operation_ptr(new operation{op_type::PUT, std::string(key.data(), key.size()),
+					   std::string(value.data(), value.size()),
+					   callback, arg, status::OK}));
+}
+
+void async_queue::remove(string_view key, pmemkv_async_callback *callback, void *arg)
+{
+	submit(operation_ptr(new operation{op_type::REMOVE,
+					   std::string(key.data(), key.size()),
+					   std::string(), callback, arg, status::OK}));
+}
+
+/*
+ * Calls completion callbacks of at most 'max' finished operations.
+ * Returns number of callbacks called.
+ */
+std::size_t async_queue::poll(std::size_t max)
+{
+	std::size_t n = 0;
+	while (n < max) {
+		operation_ptr op;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (completed.empty())
+				break;
+
+			op = std::move(completed.front());
+			completed.pop_front();
+		}
+
+		complete(*op);
+		++n;
+	}
+
+	return n;
+}
+
+/* Blocks until all submitted operations are executed. */
+void async_queue::wait()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&] { return pending.empty() && !running; });
+}
+
+void async_queue::submit(operation_ptr op)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	pending.emplace_back(std::move(op));
+
+	/* only one task per queue is active at a time, to keep ops ordered */
+	if (!running) {
+		running = true;
+		lock.unlock();
+		try {
+			pool.submit([this] { process(); });
+		} catch (...) {
+			lock.lock();
+			running = false;
+			pending.pop_back();
+			throw;
+		}
+	}
+}
+
+void async_queue::process()
+{
+	while (true) {
+		operation_ptr op;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (pending.empty()) {
+				running = false;
+				cv.notify_all();
+				return;
+			}
+
+			op = std::move(pending.front());
+			pending.pop_front();
+		}
+
+		execute(*op);
+
+		if (inline_completion) {
+			complete(*op);
+		} else {
+			std::unique_lock<std::mutex> lock(mtx);
+			completed.emplace_back(std::move(op));
+		}
+	}
+}
+
+void async_queue::execute(operation &op)
+{
+	try {
+		switch (op.type) {
+			case op_type::GET:
+				op.result = engine->get(op.key, copy_value, &op.value);
+				break;
+			case op_type::PUT:
+				op.result = engine->put(op.key, op.value);
+				break;
+			case op_type::REMOVE:
+				op.result = engine->remove(op.key);
+				break;
+		}
+	} catch (error &e) {
+		op.result = static_cast<status>(e.status_code);
+	} catch (std::bad_alloc &e) {
+		op.result = status::OUT_OF_MEMORY;
+	} catch (...) {
+		op.result = status::UNKNOWN_ERROR;
+	}
+}
+
+void async_queue::complete(operation &op)
+{
+	if (!op.callback)
+		return;
+
+	if (op.type == op_type::GET && op.result == status::OK)
+		op.callback(static_cast<int>(op.result), op.value.data(), op.value.size(),
+			    op.arg);
+	else
+		op.callback(static_cast<int>(op.result), nullptr, 0, op.arg);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
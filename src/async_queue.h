@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_ASYNC_QUEUE_H
+#define LIBPMEMKV_ASYNC_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "engine.h"
+#include "libpmemkv.h"
+#include "thread_pool.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * async_queue is a submission/completion queue of operations on a single
+ * engine. Submitted operations are executed by threads from a thread_pool,
+ * one at a time and in order of submission (so e.g. get will see the result
+ * of previously submitted put). Multiple queues may execute in parallel.
+ *
+ * Completion callbacks are called either directly by a worker thread
+ * (if 'inline_completion' is set) or by a thread which calls poll().
+ */
+class async_queue {
+public:
+	async_queue(engine_base *engine, thread_pool &pool, bool inline_completion);
+	~async_queue();
+
+	async_queue(const async_queue &) = delete;
+	async_queue &operator=(const async_queue &) = delete;
+
+	void get(string_view key, pmemkv_async_callback *callback, void *arg);
+	void put(string_view key, string_view value, pmemkv_async_callback *callback,
+		 void *arg);
+	void remove(string_view key, pmemkv_async_callback *callback, void *arg);
+
+	std::size_t poll(std::size_t max);
+	void wait();
+
+private:
+	enum class op_type { GET, PUT, REMOVE };
+
+	struct operation {
+		op_type type;
+		std::string key;
+		std::string value;
+		pmemkv_async_callback *callback;
+		void *arg;
+		status result;
+	};
+
+	using operation_ptr = std::unique_ptr<operation>;
+
+	void submit(operation_ptr op);
+	void process();
+	void execute(operation &op);
+	void complete(operation &op);
+
+	engine_base *engine;
+	thread_pool &pool;
+	bool inline_completion;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<operation_ptr> pending;
+	std::deque<operation_ptr> completed;
+	bool running = false;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_ASYNC_QUEUE_H */
@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "bloom_filter.h"
+#include "crc_hash.h"
+#include "exceptions.h"
+
+#include <algorithm>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr std::size_t bloom_filter::BLOCK_BITS;
+constexpr std::size_t bloom_filter::MIN_CAPACITY;
+
+/* rotates the hash to get the step between probed bits (as in LevelDB) */
+static inline uint32_t probe_step(uint32_t h)
+{
+	return (h >> 17) | (h << 15);
+}
+
+std::unique_ptr<bloom_filter> bloom_filter::from_config(config &cfg)
+{
+	uint64_t bits_per_key = 0;
+	cfg.get_uint64("bloom_bits_per_key", &bits_per_key);
+	if (bits_per_key == 0)
+		return nullptr;
+
+	if (bits_per_key > 64)
+		throw internal::invalid_argument("Config item: \"bloom_bits_per_key\" "
+						 "must not be greater than 64");
+
+	return std::unique_ptr<bloom_filter>(
+		new bloom_filter(static_cast<std::size_t>(bits_per_key)));
+}
+
+bloom_filter::bloom_filter(std::size_t bits_per_key)
+    : bits_per_key(bits_per_key),
+      /* optimal number of probes is bits_per_key * ln(2) */
+      probes(std::max<std::size_t>(1, bits_per_key * 69 / 100)),
+      keys(0)
+{
+	reset(0);
+}
+
+void bloom_filter::reset(std::size_t keys)
+{
+	capacity = std::max(keys * 2, MIN_CAPACITY);
+	blocks_number = (capacity * bits_per_key + BLOCK_BITS - 1) / BLOCK_BITS;
+	blocks.reset(new block[blocks_number]);
+	for (std::size_t i = 0; i < blocks_number; ++i)
+		for (auto &w : blocks[i].words)
+			w.store(0, std::memory_order_relaxed);
+
+	this->keys.store(keys, std::memory_order_relaxed);
+}
+
+/* picks the block with upper half of the hash, lower one selects the bits */
+std::size_t bloom_filter::block_index(uint64_t hash) const
+{
+	return static_cast<std::size_t>(((hash >> 32) * blocks_number) >> 32);
+}
+
+void bloom_filter::add(string_view key)
+{
+	auto hash = crc_hash(key.size(), key.data());
+	auto &b = blocks[block_index(hash)];
+
+	auto h = static_cast<uint32_t>(hash);
+	auto step = probe_step(h);
+	for (std::size_t i = 0; i < probes; ++i, h += step) {
+		auto bit = h % BLOCK_BITS;
+		b.words[bit / 64].fetch_or(uint64_t(1) << (bit % 64),
+					   std::memory_order_relaxed);
+	}
+}
+
+bool bloom_filter::may_contain(string_view key) const
+{
+	auto hash = crc_hash(key.size(), key.data());
+	auto &b = blocks[block_index(hash)];
+
+	auto h = static_cast<uint32_t>(hash);
+	auto step = probe_step(h);
+	for (std::size_t i = 0; i < probes; ++i, h += step) {
+		auto bit = h % BLOCK_BITS;
+		if (!(b.words[bit / 64].load(std::memory_order_relaxed) &
+		      (uint64_t(1) << (bit % 64))))
+			return false;
+	}
+
+	return true;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
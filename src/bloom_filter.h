@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_BLOOM_FILTER_H
+#define LIBPMEMKV_BLOOM_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "config.h"
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * bloom_filter is a DRAM filter of keys of a persistent engine, which lets
+ * lookups of absent keys return without reading PMem. It's a blocked Bloom
+ * filter - all bits of a key are in a single 64-byte block, so a lookup
+ * touches one cache line.
+ *
+ * Bits are never cleared, so removed keys only increase the false positive
+ * rate. Engines rebuild the filter (add all their keys to it, after reset())
+ * on open and when full() - once more keys were inserted than it was sized
+ * for. add() has to be called before the key becomes visible in the engine
+ * and may run concurrently with other add() and may_contain() calls; reset()
+ * must be exclusive.
+ */
+class bloom_filter {
+public:
+	/* Returns filter configured by "bloom_bits_per_key", null if it's 0 */
+	static std::unique_ptr<bloom_filter> from_config(config &cfg);
+
+	explicit bloom_filter(std::size_t bits_per_key);
+
+	bloom_filter(const bloom_filter &) = delete;
+	bloom_filter &operator=(const bloom_filter &) = delete;
+
+	/* Clears the filter and sizes it for (more than) 'keys' keys */
+	void reset(std::size_t keys);
+
+	void add(string_view key);
+	/* Returns false if the key was surely not added */
+	bool may_contain(string_view key) const;
+
+	/* Records insertion of new keys (already passed to add()) */
+	void inserted(std::size_t n = 1)
+	{
+		keys.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	bool full() const
+	{
+		return keys.load(std::memory_order_relaxed) > capacity;
+	}
+
+	std::size_t size_bytes() const
+	{
+		return blocks_number * sizeof(block);
+	}
+
+private:
+	static constexpr std::size_t BLOCK_BITS = 512;
+	static constexpr std::size_t MIN_CAPACITY = 1024;
+
+	struct block {
+		std::atomic<uint64_t> words[BLOCK_BITS / 64];
+	};
+
+	std::size_t block_index(uint64_t hash) const;
+
+	std::size_t bits_per_key;
+	std::size_t probes;
+	std::size_t capacity = 0;
+	std::size_t blocks_number = 0;
+	std::unique_ptr<block[]> blocks;
+	std::atomic<std::size_t> keys;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_BLOOM_FILTER_H */
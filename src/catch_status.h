@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_CATCH_STATUS_H
+#define LIBPMEMKV_CATCH_STATUS_H
+
+#include <new>
+#include <stdexcept>
+
+#include <libpmemobj++/pexceptions.hpp>
+
+#include "exceptions.h"
+#include "libpmemkv.h"
+#include "out.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Calls f() and returns its status; exceptions thrown by it are mapped to
+ * statuses (and their messages to the last error message of the thread).
+ */
+template <typename Function>
+inline int catch_and_return_status(const char *func_name, Function &&f)
+{
+	int status = PMEMKV_STATUS_UNKNOWN_ERROR;
+	try {
+		status = static_cast<int>(f());
+	} catch (pmem::kv::internal::error &e) {
+		out_err(func_name, e.what());
+		status = e.status_code;
+	} catch (std::bad_alloc &e) {
+		out_err(func_name, e.what());
+		status = PMEMKV_STATUS_OUT_OF_MEMORY;
+	} catch (std::runtime_error &e) {
+		out_err(func_name, e.what());
+		status = PMEMKV_STATUS_UNKNOWN_ERROR;
+	} catch (std::invalid_argument &e) {
+		out_err(func_name, e.what());
+		status = PMEMKV_STATUS_INVALID_ARGUMENT;
+	} catch (pmem::transaction_scope_error &e) {
+		out_err(func_name, e.what());
+		status = PMEMKV_STATUS_TRANSACTION_SCOPE_ERROR;
+	} catch (std::exception &e) {
+		out_err(func_name, e.what());
+		status = PMEMKV_STATUS_UNKNOWN_ERROR;
+	} catch (...) {
+		out_err(func_name, "Unspecified error");
+		status = PMEMKV_STATUS_UNKNOWN_ERROR;
+	}
+	set_last_status(status);
+	return status;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_CATCH_STATUS_H */
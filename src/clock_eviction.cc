@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "clock_eviction.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr std::size_t clock_eviction::SECOND_CHANCES;
+constexpr std::size_t clock_eviction::TRIM_STEPS;
+constexpr std::size_t clock_eviction::MIN_QUEUED;
+
+/* reference bits of keys; with no limit of records, a fixed number of them */
+static std::size_t references_number(std::size_t max_items)
+{
+	const std::size_t min = 1 << 10, max = 1 << 22;
+	if (max_items == 0)
+		return 1 << 16;
+
+	std::size_t n = min;
+	while (n < max_items && n < max)
+		n *= 2;
+
+	return n;
+}
+
+clock_eviction::clock_eviction(std::size_t max_items, std::size_t max_bytes,
+			       std::size_t shards_number)
+    : max_items(max_items),
+      max_bytes(max_bytes),
+      items(0),
+      bytes(0),
+      queued(0),
+      shards_number(shards_number ? shards_number : 1),
+      shards(new shard[this->shards_number]),
+      hand(0),
+      references_mask(references_number(max_items) - 1),
+      referenced(new std::atomic<uint8_t>[references_mask + 1])
+{
+	for (std::size_t i = 0; i <= references_mask; ++i)
+		referenced[i].store(0, std::memory_order_relaxed);
+}
+
+/* Counts a new record and queues its key */
+void clock_eviction::inserted(string_view key, uint64_t hash, std::size_t bytes)
+{
+	items.fetch_add(1, std::memory_order_relaxed);
+	this->bytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+
+	push(queued_key{std::string(key.data(), key.size()), hash});
+}
+
+void clock_eviction::resized(std::size_t old_bytes, std::size_t new_bytes)
+{
+	bytes.fetch_add(static_cast<int64_t>(new_bytes) - static_cast<int64_t>(old_bytes),
+			std::memory_order_relaxed);
+}
+
+/* Counts a removed record, its key is dropped from the queue when it's popped */
+void clock_eviction::removed(std::size_t bytes)
+{
+	items.fetch_sub(1, std::memory_order_relaxed);
+	this->bytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+}
+
+clock_eviction::shard &clock_eviction::shard_for(uint64_t hash)
+{
+	/* low bits index the reference bits, shard is picked by the high ones */
+	return shards[(hash >> 32) % shards_number];
+}
+
+/* Queues the key, unless it's already queued (e.g. removed and inserted again) */
+void clock_eviction::push(queued_key k)
+{
+	auto &s = shard_for(k.hash);
+	std::unique_lock<std::mutex> lock(s.mtx);
+
+	auto ret = s.keys.emplace(std::move(k.key), k.hash);
+	if (!ret.second)
+		return;
+
+	s.order.push_back(&*ret.first);
+	queued.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Takes the oldest key of the next non-empty shard, false if all are empty */
+bool clock_eviction::pop(queued_key &k)
+{
+	for (std::size_t i = 0; i < shards_number; ++i) {
+		auto &s = shards[hand.fetch_add(1, std::memory_order_relaxed) %
+				 shards_number];
+		std::unique_lock<std::mutex> lock(s.mtx);
+		if (s.order.empty())
+			continue;
+
+		auto e = s.order.front();
+		s.order.pop_front();
+		k.key = e->first;
+		k.hash = e->second;
+		s.keys.erase(k.key);
+		queued.fetch_sub(1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	return false;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
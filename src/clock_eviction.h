@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_CLOCK_EVICTION_H
+#define LIBPMEMKV_CLOCK_EVICTION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * clock_eviction keeps an engine within a limit of records and/or bytes (sizes
+ * of keys and values), evicting records with the CLOCK policy: a record which
+ * was read since it was last considered gets a second chance.
+ *
+ * The engine reports insertions, changes of sizes and removals of records and
+ * calls make_room() after modifications, with no record locked. Records are
+ * queued for eviction (by copies of their keys) in shards, each protected by
+ * its own mutex and taken by the evicting threads in turn. Reference bits are
+ * kept outside of the queue, in a table indexed by hashes of keys, so reads
+ * only set a byte (touch()), without any lock. Keys with colliding hashes
+ * share their bits, so the policy is approximate.
+ *
+ * Records removed by the engine stay in the queue until they are popped, so
+ * make_room() also drops such keys, when there are too many of them.
+ */
+class clock_eviction {
+public:
+	static constexpr std::size_t SECOND_CHANCES = 256;
+	static constexpr std::size_t TRIM_STEPS = 16;
+	static constexpr std::size_t MIN_QUEUED = 1024;
+
+	/* 0 means no limit, at least one of the limits must be set */
+	clock_eviction(std::size_t max_items, std::size_t max_bytes,
+		       std::size_t shards_number);
+
+	clock_eviction(const clock_eviction &) = delete;
+	clock_eviction &operator=(const clock_eviction &) = delete;
+
+	void touch(uint64_t hash)
+	{
+		auto &bit = referenced[hash & references_mask];
+		if (!bit.load(std::memory_order_relaxed))
+			bit.store(1, std::memory_order_relaxed);
+	}
+
+	void inserted(string_view key, uint64_t hash, std::size_t bytes);
+	void resized(std::size_t old_bytes, std::size_t new_bytes);
+	void removed(std::size_t bytes);
+
+	bool over_limit() const
+	{
+		return (max_items && items.load(std::memory_order_relaxed) >
+				 static_cast<int64_t>(max_items)) ||
+			(max_bytes && bytes.load(std::memory_order_relaxed) >
+				 static_cast<int64_t>(max_bytes));
+	}
+
+	/*
+	 * Evicts records until the limits are met. visit(key, hash, erase)
+	 * returns false if the key is not stored by the engine, otherwise it
+	 * removes the record (calling removed()) if 'erase' is set.
+	 */
+	template <typename F>
+	void make_room(F &&visit)
+	{
+		std::size_t second_chances = 0;
+		while (over_limit()) {
+			queued_key k;
+			if (!pop(k))
+				return;
+
+			if (second_chances < SECOND_CHANCES && clear_reference(k.hash)) {
+				++second_chances;
+				push(std::move(k));
+				continue;
+			}
+
+			visit(string_view(k.key), k.hash, true);
+		}
+
+		/* keys of removed records are dropped, live ones requeued */
+		for (std::size_t i = 0; i < TRIM_STEPS && too_many_queued(); ++i) {
+			queued_key k;
+			if (!pop(k))
+				return;
+
+			if (visit(string_view(k.key), k.hash, false))
+				push(std::move(k));
+		}
+	}
+
+private:
+	struct queued_key {
+		std::string key;
+		uint64_t hash;
+	};
+
+	struct shard {
+		std::mutex mtx;
+		/* keys, each queued once, with their hashes */
+		std::unordered_map<std::string, uint64_t> keys;
+		/* order of eviction, pointing to elements of keys */
+		std::deque<const std::pair<const std::string, uint64_t> *> order;
+	};
+
+	bool clear_reference(uint64_t hash)
+	{
+		auto &bit = referenced[hash & references_mask];
+		return bit.load(std::memory_order_relaxed) &&
+			bit.exchange(0, std::memory_order_relaxed);
+	}
+
+	bool too_many_queued() const
+	{
+		auto n = items.load(std::memory_order_relaxed);
+		return queued.load(std::memory_order_relaxed) >
+			2 * (n > 0 ? n : 0) + static_cast<int64_t>(MIN_QUEUED);
+	}
+
+	shard &shard_for(uint64_t hash);
+	void push(queued_key k);
+	bool pop(queued_key &k);
+
+	std::size_t max_items;
+	std::size_t max_bytes;
+
+	/* may be transiently negative, as updates race with each other */
+	std::atomic<int64_t> items;
+	std::atomic<int64_t> bytes;
+	std::atomic<int64_t> queued;
+
+	std::size_t shards_number;
+	std::unique_ptr<shard[]> shards;
+	/* shard to pop from next */
+	std::atomic<std::size_t> hand;
+
+	std::size_t references_mask;
+	std::unique_ptr<std::atomic<uint8_t>[]> referenced;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_CLOCK_EVICTION_H */
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #ifndef LIBPMEMKV_COMPARATOR_H
 #define LIBPMEMKV_COMPARATOR_H
@@ -10,6 +10,9 @@
 #include "../libpmemkv.hpp"
 #include "../out.h"
 
+#include <cstring>
+#include <limits>
+
 namespace pmem
 {
 namespace kv
@@ -17,40 +20,127 @@ namespace kv
 namespace internal
 {
 
+static inline int binary_compare(const char *key1, size_t kb1, const char *key2,
+				 size_t kb2, void *arg)
+{
+	(void)arg;
+	return string_view(key1, kb1).compare(string_view(key2, kb2));
+}
+
+/*
+ * Comparator of 8-byte integer keys ("key_type": "uint64" config parameter):
+ * keys are compared as native-endian uint64_t values. Keys of other sizes
+ * are greater than all integer keys and ordered by bytes among themselves.
+ */
+static inline uint64_t uint64_key_prefix(const char *key, size_t kb, void *arg)
+{
+	(void)arg;
+	if (kb != sizeof(uint64_t))
+		return std::numeric_limits<uint64_t>::max();
+
+	uint64_t value;
+	std::memcpy(&value, key, sizeof(value));
+	return value;
+}
+
+static inline int uint64_compare(const char *key1, size_t kb1, const char *key2,
+				 size_t kb2, void *arg)
+{
+	bool int1 = kb1 == sizeof(uint64_t), int2 = kb2 == sizeof(uint64_t);
+	if (!int1 || !int2) {
+		if (int1 != int2)
+			return int1 ? -1 : 1;
+
+		return binary_compare(key1, kb1, key2, kb2, arg);
+	}
+
+	auto value1 = uint64_key_prefix(key1, kb1, arg);
+	auto value2 = uint64_key_prefix(key2, kb2, arg);
+	return value1 < value2 ? -1 : (value1 > value2 ? 1 : 0);
+}
+
 class comparator {
 public:
-	comparator(pmemkv_compare_function *cmp, std::string name, void *arg)
-	    : cmp(cmp), name_(name), arg(arg)
+	/* built-in orders are inlined, functions of custom ones are called */
+	enum class order { custom, binary, uint64 };
+
+	comparator(pmemkv_compare_function *cmp, std::string name, void *arg,
+		   order ord = order::custom)
+	    : cmp(cmp), name_(name), arg(arg), ord(ord)
 	{
 	}
 
 	int compare(string_view key1, string_view key2) const
 	{
+		if (ord == order::binary)
+			return key1.compare(key2);
+		if (ord == order::uint64)
+			return uint64_compare(key1.data(), key1.size(), key2.data(),
+					      key2.size(), nullptr);
+
 		return (*cmp)(key1.data(), key1.size(), key2.data(), key2.size(), arg);
 	}
 
+	/*
+	 * Returns integer prefix of the key: for any keys k1 < k2
+	 * key_prefix(k1) <= key_prefix(k2) must hold, so keys with different
+	 * prefixes are ordered without calling the comparison function. For the
+	 * binary comparator these are the first 8 bytes, as a big-endian number.
+	 * Without a prefix function all prefixes are 0 (they never differ).
+	 */
+	uint64_t key_prefix(string_view key) const
+	{
+		if (ord == order::binary) {
+			uint64_t prefix = 0;
+			for (size_t i = 0; i < sizeof(prefix); ++i) {
+				uint64_t byte = i < key.size()
+					? static_cast<unsigned char>(key.data()[i])
+					: 0;
+				prefix = (prefix << 8) | byte;
+			}
+			return prefix;
+		}
+		if (ord == order::uint64)
+			return uint64_key_prefix(key.data(), key.size(), nullptr);
+
+		return prefix_fn ? (*prefix_fn)(key.data(), key.size(), arg) : 0;
+	}
+
+	void set_key_prefix(pmemkv_key_prefix_function *fn)
+	{
+		prefix_fn = fn;
+	}
+
 	std::string name() const
 	{
 		return name_;
 	}
 
+	/* true if keys are ordered byte by byte, so equal keys are identical */
+	bool is_binary() const
+	{
+		return ord == order::binary;
+	}
+
 private:
 	pmemkv_compare_function *cmp;
+	pmemkv_key_prefix_function *prefix_fn = nullptr;
 	std::string name_;
 	void *arg;
+	order ord;
 };
 
-static inline int binary_compare(const char *key1, size_t kb1, const char *key2,
-				 size_t kb2, void *arg)
+static inline const comparator &binary_comparator()
 {
-	(void)arg;
-	return string_view(key1, kb1).compare(string_view(key2, kb2));
+	static const comparator cmp(binary_compare, "__pmemkv_binary_comparator",
+				    nullptr, comparator::order::binary);
+	return cmp;
 }
 
-static inline const comparator &binary_comparator()
+static inline const comparator &uint64_comparator()
 {
-	static const comparator cmp(binary_compare, "__pmemkv_binary_comparator",
-				    nullptr);
+	static const comparator cmp(uint64_compare, "__pmemkv_uint64_comparator",
+				    nullptr, comparator::order::uint64);
 	return cmp;
 }
 
@@ -67,14 +157,53 @@ static inline string_view make_string_view(string_view v)
 	return v;
 }
 
+/*
+ * Sets *upper* to the lowest key (in binary order) which is greater than all
+ * keys starting with *prefix*. Returns false if there is no such key, i.e.
+ * prefix is empty or consists of 0xff bytes only.
+ */
+static inline bool prefix_upper_bound(string_view prefix, std::string &upper)
+{
+	upper.assign(prefix.data(), prefix.size());
+	while (!upper.empty() && static_cast<unsigned char>(upper.back()) == 0xff)
+		upper.pop_back();
+
+	if (upper.empty())
+		return false;
+
+	upper.back() = static_cast<char>(static_cast<unsigned char>(upper.back()) + 1);
+	return true;
+}
+
+static inline bool has_prefix(string_view key, string_view prefix)
+{
+	return key.size() >= prefix.size() &&
+		string_view(key.data(), prefix.size()).compare(prefix) == 0;
+}
+
+/*
+ * Returns comparator set in the config, or the one selected by "key_type"
+ * parameter ("string", the default, or "uint64").
+ */
 static inline const comparator *extract_comparator(internal::config &cfg)
 {
 	comparator *cmp;
+	const char *key_type;
 
-	if (!cfg.get_object("comparator", (void **)&cmp))
+	bool has_cmp = cfg.get_object("comparator", (void **)&cmp);
+	if (!cfg.get_string("key_type", &key_type))
+		return has_cmp ? cmp : &internal::binary_comparator();
+
+	if (has_cmp)
+		throw internal::invalid_argument(
+			"\"comparator\" and \"key_type\" cannot be used together");
+
+	if (std::strcmp(key_type, "string") == 0)
 		return &internal::binary_comparator();
-	else
-		return cmp;
+	if (std::strcmp(key_type, "uint64") == 0)
+		return &internal::uint64_comparator();
+
+	throw internal::invalid_argument("Unknown key_type: " + std::string(key_type));
 }
 
 } /* namespace internal */
@@ -65,6 +65,17 @@ public:
 		return (cmp->compare(key1, key2) < 0);
 	}
 
+	template <typename T>
+	uint64_t key_prefix(const T &key) const
+	{
+		return cmp->key_prefix(make_string_view(key));
+	}
+
+	bool is_binary() const
+	{
+		return cmp->is_binary();
+	}
+
 private:
 	pmem::obj::string name;
 	const comparator *cmp = nullptr;
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #ifndef LIBPMEMKV_VOLATILE_COMPARATOR_H
 #define LIBPMEMKV_VOLATILE_COMPARATOR_H
@@ -31,6 +31,17 @@ public:
 		return (cmp->compare(key1, key2) < 0);
 	}
 
+	template <typename T>
+	uint64_t key_prefix(const T &key) const
+	{
+		return cmp->key_prefix(make_string_view(key));
+	}
+
+	bool is_binary() const
+	{
+		return cmp->is_binary();
+	}
+
 private:
 	const comparator *cmp;
 };
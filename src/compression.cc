@@ -0,0 +1,693 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "compression.h"
+#include "exceptions.h"
+
+#include <cstring>
+#include <vector>
+#include <zstd.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* first byte of every stored value */
+enum value_header : char { VALUE_RAW = 0, VALUE_ZSTD = 1 };
+
+static ZSTD_CCtx *compression_ctx()
+{
+	static thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> ctx(
+		ZSTD_createCCtx(), ZSTD_freeCCtx);
+	if (!ctx)
+		throw std::bad_alloc();
+
+	return ctx.get();
+}
+
+static ZSTD_DCtx *decompression_ctx()
+{
+	static thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> ctx(
+		ZSTD_createDCtx(), ZSTD_freeDCtx);
+	if (!ctx)
+		throw std::bad_alloc();
+
+	return ctx.get();
+}
+
+static void throw_corrupted()
+{
+	throw internal::error("Stored value is corrupted or was compressed with "
+			      "a different dictionary");
+}
+
+compression_options compression_options::from_config(config &cfg)
+{
+	compression_options options;
+
+	const char *type;
+	if (!cfg.get_string("compression", &type) || std::strcmp(type, "none") == 0)
+		return options;
+
+	if (std::strcmp(type, "zstd") != 0)
+		throw internal::invalid_argument("Unknown compression: " +
+						 std::string(type));
+	options.enabled = true;
+
+	int64_t level;
+	if (cfg.get_int64("compression_level", &level)) {
+		if (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel())
+			throw internal::invalid_argument(
+				"compression_level out of range: " +
+				std::to_string(level));
+		options.level = static_cast<int>(level);
+	}
+
+	uint64_t min_size;
+	if (cfg.get_uint64("compression_min_size", &min_size))
+		options.min_size = min_size;
+
+	const void *dictionary;
+	std::size_t dictionary_size;
+	if (cfg.get_data("compression_dictionary", &dictionary, &dictionary_size))
+		options.dictionary.assign(static_cast<const char *>(dictionary),
+					  dictionary_size);
+
+	return options;
+}
+
+compressed_engine::compressed_engine(std::unique_ptr<engine_base> engine,
+				     const compression_options &options)
+    : engine(std::move(engine)), options(options)
+{
+	if (options.dictionary.empty())
+		return;
+
+	cdict = ZSTD_createCDict(options.dictionary.data(), options.dictionary.size(),
+				 options.level);
+	ddict = ZSTD_createDDict(options.dictionary.data(), options.dictionary.size());
+	if (!cdict || !ddict) {
+		ZSTD_freeCDict(cdict);
+		ZSTD_freeDDict(ddict);
+		throw internal::invalid_argument("Invalid compression_dictionary");
+	}
+}
+
+compressed_engine::~compressed_engine()
+{
+	ZSTD_freeCDict(cdict);
+	ZSTD_freeDDict(ddict);
+}
+
+void compressed_engine::compress(string_view value, std::string &out) const
+{
+	auto offset = out.size();
+
+	if (value.size() >= options.min_size) {
+		auto bound = ZSTD_compressBound(value.size());
+		out.resize(offset + 1 + bound);
+
+		auto dst = &out[offset + 1];
+		auto ctx = compression_ctx();
+		auto size = cdict
+			? ZSTD_compress_usingCDict(ctx, dst, bound, value.data(),
+						   value.size(), cdict)
+			: ZSTD_compressCCtx(ctx, dst, bound, value.data(), value.size(),
+					    options.level);
+
+		/* incompressible values are stored raw */
+		if (!ZSTD_isError(size) && size < value.size()) {
+			out[offset] = VALUE_ZSTD;
+			out.resize(offset + 1 + size);
+			return;
+		}
+
+		out.resize(offset);
+	}
+
+	out.push_back(VALUE_RAW);
+	out.append(value.data(), value.size());
+}
+
+bool compressed_engine::decompress(string_view stored, std::string &buf,
+				   string_view &value) const
+{
+	if (stored.size() == 0)
+		return false;
+
+	auto payload = stored.data() + 1;
+	auto payload_size = stored.size() - 1;
+
+	if (stored.data()[0] == VALUE_RAW) {
+		value = string_view(payload, payload_size);
+		return true;
+	}
+
+	if (stored.data()[0] != VALUE_ZSTD)
+		return false;
+
+	auto size = ZSTD_getFrameContentSize(payload, payload_size);
+	if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+		return false;
+
+	buf.resize(size);
+	auto ctx = decompression_ctx();
+	auto ret = ddict ? ZSTD_decompress_usingDDict(ctx, &buf[0], buf.size(), payload,
+						      payload_size, ddict)
+			 : ZSTD_decompressDCtx(ctx, &buf[0], buf.size(), payload,
+					       payload_size);
+	if (ZSTD_isError(ret) || ret != size)
+		return false;
+
+	value = string_view(buf.data(), buf.size());
+	return true;
+}
+
+bool compressed_engine::decompressed_size(string_view stored, std::size_t &size) const
+{
+	if (stored.size() == 0)
+		return false;
+
+	auto payload = stored.data() + 1;
+	auto payload_size = stored.size() - 1;
+
+	if (stored.data()[0] == VALUE_RAW) {
+		size = payload_size;
+		return true;
+	}
+
+	if (stored.data()[0] != VALUE_ZSTD)
+		return false;
+
+	/* the size is stored in the header of the frame */
+	auto frame_size = ZSTD_getFrameContentSize(payload, payload_size);
+	if (frame_size == ZSTD_CONTENTSIZE_ERROR ||
+	    frame_size == ZSTD_CONTENTSIZE_UNKNOWN)
+		return false;
+
+	size = static_cast<std::size_t>(frame_size);
+	return true;
+}
+
+struct decompress_kv_context {
+	const compressed_engine *engine;
+	get_kv_callback *callback;
+	void *arg;
+	bool corrupted;
+	std::string buf;
+};
+
+static int decompress_kv(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	auto ctx = static_cast<decompress_kv_context *>(arg);
+
+	string_view value;
+	if (!ctx->engine->decompress(string_view(v, vb), ctx->buf, value)) {
+		ctx->corrupted = true;
+		return 1;
+	}
+
+	return ctx->callback(k, kb, value.data(), value.size(), ctx->arg);
+}
+
+/* Calls f with a callback, which decompresses values passed to 'callback' */
+template <typename F>
+status compressed_engine::read_kv(get_kv_callback *callback, void *arg, F &&f)
+{
+	decompress_kv_context ctx{this, callback, arg, false, {}};
+
+	auto s = f(decompress_kv, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	return s;
+}
+
+/* every partition is read by a different thread, with its own buffer */
+template <typename F>
+status compressed_engine::read_kv_parallel(std::size_t partitions,
+					   get_kv_callback *callback, void **args,
+					   F &&f)
+{
+	std::vector<decompress_kv_context> contexts;
+	std::vector<void *> ctx_args;
+	contexts.reserve(partitions);
+	for (std::size_t i = 0; i < partitions; ++i) {
+		contexts.push_back({this, callback, args ? args[i] : nullptr, false, {}});
+		ctx_args.push_back(&contexts.back());
+	}
+
+	auto s = f(decompress_kv, ctx_args.data());
+	for (auto &ctx : contexts) {
+		if (ctx.corrupted)
+			throw_corrupted();
+	}
+
+	return s;
+}
+
+std::string compressed_engine::name()
+{
+	return engine->name();
+}
+
+status compressed_engine::count_all(std::size_t &cnt)
+{
+	return engine->count_all(cnt);
+}
+
+status compressed_engine::count_above(string_view key, std::size_t &cnt)
+{
+	return engine->count_above(key, cnt);
+}
+
+status compressed_engine::count_equal_above(string_view key, std::size_t &cnt)
+{
+	return engine->count_equal_above(key, cnt);
+}
+
+status compressed_engine::count_equal_below(string_view key, std::size_t &cnt)
+{
+	return engine->count_equal_below(key, cnt);
+}
+
+status compressed_engine::count_below(string_view key, std::size_t &cnt)
+{
+	return engine->count_below(key, cnt);
+}
+
+status compressed_engine::count_between(string_view key1, string_view key2,
+					std::size_t &cnt)
+{
+	return engine->count_between(key1, key2, cnt);
+}
+
+status compressed_engine::count_between_approx(string_view key1, string_view key2,
+					       std::size_t &cnt)
+{
+	return engine->count_between_approx(key1, key2, cnt);
+}
+
+status compressed_engine::get_all(get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_all(cb, ctx);
+	});
+}
+
+status compressed_engine::get_all_parallel(std::size_t partitions,
+					   get_kv_callback *callback, void **args)
+{
+	return read_kv_parallel(partitions, callback, args,
+				[&](get_kv_callback *cb, void **ctx_args) {
+					return engine->get_all_parallel(partitions, cb,
+									ctx_args);
+				});
+}
+
+status compressed_engine::get_above(string_view key, get_kv_callback *callback,
+				    void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_above(key, cb, ctx);
+	});
+}
+
+status compressed_engine::get_equal_above(string_view key, get_kv_callback *callback,
+					  void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_equal_above(key, cb, ctx);
+	});
+}
+
+status compressed_engine::get_equal_below(string_view key, get_kv_callback *callback,
+					  void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_equal_below(key, cb, ctx);
+	});
+}
+
+status compressed_engine::get_below(string_view key, get_kv_callback *callback,
+				    void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_below(key, cb, ctx);
+	});
+}
+
+status compressed_engine::get_between(string_view key1, string_view key2,
+				      get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_between(key1, key2, cb, ctx);
+	});
+}
+
+status compressed_engine::get_between_parallel(string_view key1, string_view key2,
+					       std::size_t partitions,
+					       get_kv_callback *callback, void **args)
+{
+	return read_kv_parallel(partitions, callback, args,
+				[&](get_kv_callback *cb, void **ctx_args) {
+					return engine->get_between_parallel(
+						key1, key2, partitions, cb, ctx_args);
+				});
+}
+
+status compressed_engine::get_above_paged(string_view key, std::size_t offset,
+					  std::size_t limit, get_kv_callback *callback,
+					  void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_above_paged(key, offset, limit, cb, ctx);
+	});
+}
+
+status compressed_engine::get_between_paged(string_view key1, string_view key2,
+					    std::size_t offset, std::size_t limit,
+					    get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_between_paged(key1, key2, offset, limit, cb, ctx);
+	});
+}
+
+status compressed_engine::get_prefix(string_view prefix, get_kv_callback *callback,
+				     void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_prefix(prefix, cb, ctx);
+	});
+}
+
+/* keys are stored as they are, so key-only scans don't decompress anything */
+status compressed_engine::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	return engine->get_keys_all(callback, arg);
+}
+
+status compressed_engine::get_keys_between(string_view key1, string_view key2,
+					   get_kv_callback *callback, void *arg)
+{
+	return engine->get_keys_between(key1, key2, callback, arg);
+}
+
+status compressed_engine::prefetch(string_view key)
+{
+	return engine->prefetch(key);
+}
+
+status compressed_engine::prefetch_range(string_view key1, string_view key2)
+{
+	return engine->prefetch_range(key1, key2);
+}
+
+status compressed_engine::exists(string_view key)
+{
+	return engine->exists(key);
+}
+
+uint64_t compressed_engine::key_hash(string_view key)
+{
+	return engine->key_hash(key);
+}
+
+status compressed_engine::exists_hashed(string_view key, uint64_t hash)
+{
+	return engine->exists_hashed(key, hash);
+}
+
+struct decompress_v_context {
+	const compressed_engine *engine;
+	get_v_callback *callback;
+	void *arg;
+	bool corrupted;
+	std::string buf;
+};
+
+static void decompress_v(const char *v, size_t vb, void *arg)
+{
+	auto ctx = static_cast<decompress_v_context *>(arg);
+
+	string_view value;
+	if (!ctx->engine->decompress(string_view(v, vb), ctx->buf, value)) {
+		ctx->corrupted = true;
+		return;
+	}
+
+	ctx->callback(value.data(), value.size(), ctx->arg);
+}
+
+status compressed_engine::get(string_view key, get_v_callback *callback, void *arg)
+{
+	decompress_v_context ctx{this, callback, arg, false, {}};
+
+	auto s = engine->get(key, decompress_v, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	return s;
+}
+
+struct value_size_context {
+	const compressed_engine *engine;
+	std::size_t size;
+	bool corrupted;
+};
+
+static void stored_value_size(const char *v, size_t vb, void *arg)
+{
+	auto ctx = static_cast<value_size_context *>(arg);
+	ctx->corrupted = !ctx->engine->decompressed_size(string_view(v, vb), ctx->size);
+}
+
+status compressed_engine::value_size(string_view key, std::size_t &size)
+{
+	value_size_context ctx{this, 0, false};
+
+	auto s = engine->get(key, stored_value_size, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	if (s == status::OK)
+		size = ctx.size;
+
+	return s;
+}
+
+status compressed_engine::get_hashed(string_view key, uint64_t hash,
+				     get_v_callback *callback, void *arg)
+{
+	decompress_v_context ctx{this, callback, arg, false, {}};
+
+	auto s = engine->get_hashed(key, hash, decompress_v, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	return s;
+}
+
+status compressed_engine::get_batch(const string_view *keys, std::size_t n,
+				    get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_batch(keys, n, cb, ctx);
+	});
+}
+
+status compressed_engine::put(string_view key, string_view value)
+{
+	static thread_local std::string stored;
+	stored.clear();
+	compress(value, stored);
+
+	return engine->put(key, stored);
+}
+
+status compressed_engine::put_hashed(string_view key, uint64_t hash, string_view value)
+{
+	static thread_local std::string stored;
+	stored.clear();
+	compress(value, stored);
+
+	return engine->put_hashed(key, hash, stored);
+}
+
+status compressed_engine::put_batch(const string_view *keys, const string_view *values,
+				    std::size_t n)
+{
+	std::vector<std::string> stored(n);
+	std::vector<string_view> stored_views;
+	stored_views.reserve(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		compress(values[i], stored[i]);
+		stored_views.emplace_back(stored[i]);
+	}
+
+	return engine->put_batch(keys, stored_views.data(), n);
+}
+
+struct compress_update_context {
+	const compressed_engine *engine;
+	update_callback *callback;
+	void *arg;
+	bool corrupted;
+	std::string buf;
+	std::string stored;
+};
+
+static int compress_update(const char *v, size_t vb, const char **new_value,
+			   size_t *new_valuebytes, void *arg)
+{
+	auto ctx = static_cast<compress_update_context *>(arg);
+
+	string_view current;
+	if (v && !ctx->engine->decompress(string_view(v, vb), ctx->buf, current)) {
+		ctx->corrupted = true;
+		return 1;
+	}
+
+	const char *value;
+	size_t valuebytes;
+	auto ret = ctx->callback(v ? current.data() : nullptr, current.size(), &value,
+				 &valuebytes, ctx->arg);
+	if (ret != 0)
+		return ret;
+
+	ctx->stored.clear();
+	ctx->engine->compress(string_view(value, valuebytes), ctx->stored);
+	*new_value = ctx->stored.data();
+	*new_valuebytes = ctx->stored.size();
+
+	return 0;
+}
+
+status compressed_engine::update(string_view key, update_callback *callback, void *arg)
+{
+	compress_update_context ctx{this, callback, arg, false, {}, {}};
+
+	auto s = engine->update(key, compress_update, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	return s;
+}
+
+status compressed_engine::remove(string_view key)
+{
+	return engine->remove(key);
+}
+
+status compressed_engine::take(string_view key, get_v_callback *callback, void *arg)
+{
+	decompress_v_context ctx{this, callback, arg, false, {}};
+
+	auto s = engine->take(key, decompress_v, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	return s;
+}
+
+status compressed_engine::remove_between(string_view key1, string_view key2,
+					 std::size_t &cnt)
+{
+	return engine->remove_between(key1, key2, cnt);
+}
+
+status compressed_engine::defrag(double start_percent, double amount_percent)
+{
+	return engine->defrag(start_percent, amount_percent);
+}
+
+status compressed_engine::sync()
+{
+	return engine->sync();
+}
+
+/* snapshots keep stored (compressed) values */
+status compressed_engine::snapshot_save(const std::string &path)
+{
+	return engine->snapshot_save(path);
+}
+
+status compressed_engine::snapshot_load(const std::string &path)
+{
+	return engine->snapshot_load(path);
+}
+
+status compressed_engine::snapshot_export(int fd, uint64_t max_bytes_per_sec)
+{
+	return engine->snapshot_export(fd, max_bytes_per_sec);
+}
+
+/* Transaction which compresses values before putting them */
+class compressed_transaction : public transaction {
+public:
+	compressed_transaction(const compressed_engine *engine, transaction *tx)
+	    : engine(engine), tx(tx)
+	{
+	}
+
+	status put(string_view key, string_view value) final
+	{
+		stored.clear();
+		engine->compress(value, stored);
+
+		return tx->put(key, stored);
+	}
+
+	status remove(string_view key) final
+	{
+		return tx->remove(key);
+	}
+
+	status get(string_view key, get_v_callback *callback, void *arg) final
+	{
+		decompress_v_context ctx{engine, callback, arg, false, {}};
+
+		auto s = tx->get(key, decompress_v, &ctx);
+		if (ctx.corrupted)
+			throw_corrupted();
+
+		return s;
+	}
+
+	status commit() final
+	{
+		return tx->commit();
+	}
+
+	void abort() final
+	{
+		tx->abort();
+	}
+
+private:
+	const compressed_engine *engine;
+	std::unique_ptr<transaction> tx;
+	std::string stored;
+};
+
+internal::transaction *compressed_engine::begin_tx()
+{
+	std::unique_ptr<transaction> tx(engine->begin_tx());
+	auto result = new compressed_transaction(this, tx.get());
+	tx.release();
+
+	return result;
+}
+
+status compressed_engine::stats(internal::stats_sink &sink)
+{
+	return engine->stats(sink);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_COMPRESSION_H
+#define LIBPMEMKV_COMPRESSION_H
+
+#include "config.h"
+#include "engine.h"
+
+#include <memory>
+#include <string>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Compression parameters read from the config ("compression*" items) */
+struct compression_options {
+	/* false if "compression" is not set (or is set to "none") */
+	bool enabled = false;
+	int level = 3;
+	/* values shorter than that are always stored raw */
+	std::size_t min_size = 64;
+	/* trained zstd dictionary, may be empty */
+	std::string dictionary;
+
+	static compression_options from_config(config &cfg);
+};
+
+/*
+ * Engine which compresses values (with zstd) before passing them to the
+ * underlying engine and decompresses them on reads. Every stored value starts
+ * with a header byte, which tells whether the rest of it is a zstd frame or
+ * the raw value - values which don't get smaller are stored raw.
+ *
+ * Keys are passed unmodified, so ordering and all key-only operations are
+ * handled by the underlying engine. Iterators are not supported, as their
+ * (partial) reads and writes address bytes of the stored values.
+ */
+class compressed_engine : public engine_base {
+public:
+	compressed_engine(std::unique_ptr<engine_base> engine,
+			  const compression_options &options);
+	~compressed_engine();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_between_approx(string_view key1, string_view key2,
+				    std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2,
+				    std::size_t partitions, get_kv_callback *callback,
+				    void **args) final;
+	status get_above_paged(string_view key, std::size_t offset, std::size_t limit,
+			       get_kv_callback *callback, void *arg) final;
+	status get_between_paged(string_view key1, string_view key2, std::size_t offset,
+				 std::size_t limit, get_kv_callback *callback,
+				 void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
+	status get_keys_between(string_view key1, string_view key2,
+				get_kv_callback *callback, void *arg) final;
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status value_size(string_view key, std::size_t &size) final;
+	status get_batch(const string_view *keys, std::size_t n,
+			 get_kv_callback *callback, void *arg) final;
+
+	status put(string_view key, string_view value) final;
+
+	uint64_t key_hash(string_view key) final;
+	status exists_hashed(string_view key, uint64_t hash) final;
+	status get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			  void *arg) final;
+	status put_hashed(string_view key, uint64_t hash, string_view value) final;
+
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+
+	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2,
+			      std::size_t &cnt) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+	status sync() final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
+	status snapshot_export(int fd, uint64_t max_bytes_per_sec) final;
+
+	internal::transaction *begin_tx() final;
+
+	status stats(internal::stats_sink &sink) final;
+
+	/* appends stored form (header and payload) of the value to 'out' */
+	void compress(string_view value, std::string &out) const;
+	/*
+	 * Sets 'value' to the value of 'stored' (decompressed into 'buf', if
+	 * needed), returns false if 'stored' is corrupted.
+	 */
+	bool decompress(string_view stored, std::string &buf, string_view &value) const;
+	/* Sets 'size' to size of the value of 'stored', without decompressing it */
+	bool decompressed_size(string_view stored, std::size_t &size) const;
+
+private:
+	template <typename F>
+	status read_kv(get_kv_callback *callback, void *arg, F &&f);
+	template <typename F>
+	status read_kv_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args, F &&f);
+
+	std::unique_ptr<engine_base> engine;
+	compression_options options;
+	ZSTD_CDict_s *cdict = nullptr;
+	ZSTD_DDict_s *ddict = nullptr;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_COMPRESSION_H */
@@ -5,6 +5,7 @@
 #define LIBPMEMKV_CONFIG_H
 
 #include <limits>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -189,6 +190,43 @@ public:
 		return size;
 	}
 
+	/*
+	 * Returns a copy of the config. Objects are not copied but shared with
+	 * this config (which still owns them), so the copy must not outlive it.
+	 */
+	std::unique_ptr<config> shared_copy() const
+	{
+		std::unique_ptr<config> copy(new config());
+
+		for (auto &item : umap) {
+			auto &key = item.first;
+			auto &v = item.second;
+
+			switch (v.item_type) {
+				case type::STRING:
+					copy->put(key, v.string_v.c_str());
+					break;
+				case type::INT64:
+					copy->put(key, v.sint64);
+					break;
+				case type::UINT64:
+					copy->put(key, v.uint64);
+					break;
+				case type::DATA:
+					copy->put(key, (const void *)v.data.data(),
+						  v.data.size());
+					break;
+				case type::OBJECT:
+					copy->put(key, v.object.ptr,
+						  static_cast<void (*)(void *)>(nullptr),
+						  v.object.getter);
+					break;
+			}
+		}
+
+		return copy;
+	}
+
 private:
 	std::string type_names[6] = {"string", "int64", "uint64", "data", "object"};
 	enum class type { STRING, INT64, UINT64, DATA, OBJECT };
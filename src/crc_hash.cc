@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "crc_hash.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* reflected CRC32C polynomial */
+static const uint32_t CRC32C_POLY = 0x82f63b78;
+
+static const uint32_t *crc32c_table()
+{
+	static const struct table {
+		uint32_t v[256];
+
+		table()
+		{
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k)
+					c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+				v[i] = c;
+			}
+		}
+	} t;
+
+	return t.v;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const char *data, std::size_t size)
+{
+	auto table = crc32c_table();
+	for (std::size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, const char *data, std::size_t size)
+{
+	uint64_t c = crc;
+	for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, data, sizeof(word));
+		c = _mm_crc32_u64(c, word);
+		data += sizeof(uint64_t);
+	}
+
+	auto c32 = static_cast<uint32_t>(c);
+	for (; size > 0; --size)
+		c32 = _mm_crc32_u8(c32, static_cast<uint8_t>(*data++));
+
+	return c32;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_hw(uint32_t crc, const char *data, std::size_t size)
+{
+	for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, data, sizeof(word));
+		crc = __crc32cd(crc, word);
+		data += sizeof(uint64_t);
+	}
+
+	for (; size > 0; --size)
+		crc = __crc32cb(crc, static_cast<uint8_t>(*data++));
+
+	return crc;
+}
+#endif
+
+using crc32c_function = uint32_t (*)(uint32_t, const char *, std::size_t);
+
+static crc32c_function select_crc32c()
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		return crc32c_hw;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	return crc32c_hw;
+#endif
+	return crc32c_sw;
+}
+
+static const crc32c_function crc32c_impl = select_crc32c();
+
+uint32_t crc32c(uint32_t crc, const char *data, std::size_t size)
+{
+	return crc32c_impl(crc, data, size);
+}
+
+uint64_t crc_hash(std::size_t key_size, const char *key)
+{
+	uint64_t h = ~crc32c(~0U, key, key_size);
+
+	/* spread the crc (and the key size) over all 64 bits (murmur3 finalizer) */
+	h = (h << 32 | h) ^ (static_cast<uint64_t>(key_size) * 0x9e3779b97f4a7c15ULL);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
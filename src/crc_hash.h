@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_CRC_HASH_H
+#define LIBPMEMKV_CRC_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * Computes CRC32C (Castagnoli) of data, continuing from crc. It uses CRC
+ * instructions of the CPU - SSE4.2 (detected at load time) or ARMv8 (if
+ * enabled for the build) - and a lookup table otherwise. The result doesn't
+ * depend on the implementation used.
+ */
+uint32_t crc32c(uint32_t crc, const char *data, std::size_t size);
+
+/**
+ * Hashes a key using crc32c, finished with a 64-bit mix. It's faster than
+ * fast_hash() on CPUs with CRC instructions (8 bytes per instruction, with
+ * no multiplication per word) and gives the same values on every CPU,
+ * so it's safe to persist - but pools of existing engines keep fast_hash().
+ */
+uint64_t crc_hash(std::size_t key_size, const char *key);
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_CRC_HASH_H */
@@ -0,0 +1,555 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "deferred.h"
+#include "exceptions.h"
+#include "out.h"
+
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+deferred_options deferred_options::from_config(config &cfg)
+{
+	deferred_options options;
+
+	const char *durability;
+	if (cfg.get_string("durability", &durability)) {
+		if (std::strcmp(durability, "deferred") == 0)
+			options.enabled = true;
+		else if (std::strcmp(durability, "sync") != 0)
+			throw internal::invalid_argument("Unknown durability: " +
+							 std::string(durability));
+	}
+
+	uint64_t interval_ms;
+	if (cfg.get_uint64("deferred_interval_ms", &interval_ms)) {
+		if (interval_ms == 0)
+			throw internal::invalid_argument(
+				"Config item \"deferred_interval_ms\" must be greater than 0");
+		options.interval = std::chrono::milliseconds(interval_ms);
+	}
+
+	uint64_t max_keys;
+	if (cfg.get_uint64("deferred_max_keys", &max_keys)) {
+		if (max_keys == 0)
+			throw internal::invalid_argument(
+				"Config item \"deferred_max_keys\" must be greater than 0");
+		options.max_keys = static_cast<std::size_t>(max_keys);
+	}
+
+	return options;
+}
+
+deferred_engine::deferred_engine(std::unique_ptr<engine_base> engine,
+				 const deferred_options &options)
+    : engine(std::move(engine)), options(options), applies(0), applied_keys(0)
+{
+	apply_task.reset(new background_task(
+		[this] {
+			apply();
+			return background_task::clock_type::duration(
+				this->options.interval);
+		},
+		options.interval));
+}
+
+/* pending writes are applied on close, as by sync() */
+deferred_engine::~deferred_engine()
+{
+	/* waits for the running step */
+	apply_task.reset();
+
+	apply();
+}
+
+deferred_engine::lookup deferred_engine::find(string_view key, std::string *value)
+{
+	std::string k(key.data(), key.size());
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	auto it = pending.find(k);
+	if (it == pending.end()) {
+		it = applying.find(k);
+		if (it == applying.end())
+			return lookup::NOT_PENDING;
+	}
+
+	if (it->second.removed)
+		return lookup::REMOVED;
+
+	if (value)
+		*value = it->second.value;
+
+	return lookup::FOUND;
+}
+
+/*
+ * Pending writes are moved to 'applying' (where reads still see them) and
+ * put to the engine in a single batch, removes follow. Both maps hold only
+ * the latest write of every key, so the order of the writes doesn't matter.
+ *
+ * A failure is kept for sync(), as the writes may be applied by any thread
+ * (or in the background) - they are discarded.
+ */
+status deferred_engine::apply() noexcept
+{
+	std::lock_guard<std::mutex> apply_lock(apply_mtx);
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (pending.empty())
+			return status::OK;
+
+		applying.swap(pending);
+	}
+
+	auto s = status::OK;
+	try {
+		std::vector<string_view> keys, values, removed;
+		keys.reserve(applying.size());
+		values.reserve(applying.size());
+		for (auto &w : applying) {
+			if (w.second.removed) {
+				removed.emplace_back(w.first);
+			} else {
+				keys.emplace_back(w.first);
+				values.emplace_back(w.second.value);
+			}
+		}
+
+		if (!keys.empty())
+			s = engine->put_batch(keys.data(), values.data(), keys.size());
+		for (auto &key : removed) {
+			if (s != status::OK)
+				break;
+
+			auto ret = engine->remove(key);
+			if (ret != status::OK && ret != status::NOT_FOUND)
+				s = ret;
+		}
+	} catch (internal::error &e) {
+		LOG("Applying of deferred writes failed: " << e.what());
+		s = static_cast<status>(e.status_code);
+	} catch (std::bad_alloc &e) {
+		s = status::OUT_OF_MEMORY;
+	} catch (std::exception &e) {
+		LOG("Applying of deferred writes failed: " << e.what());
+		s = status::UNKNOWN_ERROR;
+	}
+
+	applies.fetch_add(1, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(mtx);
+	if (s == status::OK)
+		applied_keys.fetch_add(applying.size(), std::memory_order_relaxed);
+	else if (failed == status::OK)
+		failed = s;
+	applying.clear();
+
+	return s;
+}
+
+/* writers apply pending writes themselves, so they can't outgrow max_keys */
+void deferred_engine::apply_if_full(std::size_t pending_keys)
+{
+	if (pending_keys >= options.max_keys)
+		apply();
+}
+
+std::string deferred_engine::name()
+{
+	return engine->name();
+}
+
+status deferred_engine::count_all(std::size_t &cnt)
+{
+	apply();
+	return engine->count_all(cnt);
+}
+
+status deferred_engine::count_above(string_view key, std::size_t &cnt)
+{
+	apply();
+	return engine->count_above(key, cnt);
+}
+
+status deferred_engine::count_equal_above(string_view key, std::size_t &cnt)
+{
+	apply();
+	return engine->count_equal_above(key, cnt);
+}
+
+status deferred_engine::count_equal_below(string_view key, std::size_t &cnt)
+{
+	apply();
+	return engine->count_equal_below(key, cnt);
+}
+
+status deferred_engine::count_below(string_view key, std::size_t &cnt)
+{
+	apply();
+	return engine->count_below(key, cnt);
+}
+
+status deferred_engine::count_between(string_view key1, string_view key2,
+				      std::size_t &cnt)
+{
+	apply();
+	return engine->count_between(key1, key2, cnt);
+}
+
+status deferred_engine::count_between_approx(string_view key1, string_view key2,
+					     std::size_t &cnt)
+{
+	apply();
+	return engine->count_between_approx(key1, key2, cnt);
+}
+
+status deferred_engine::get_all(get_kv_callback *callback, void *arg)
+{
+	apply();
+	return engine->get_all(callback, arg);
+}
+
+status deferred_engine::get_all_parallel(std::size_t partitions,
+					 get_kv_callback *callback, void **args)
+{
+	apply();
+	return engine->get_all_parallel(partitions, callback, args);
+}
+
+status deferred_engine::get_above(string_view key, get_kv_callback *callback,
+				  void *arg)
+{
+	apply();
+	return engine->get_above(key, callback, arg);
+}
+
+status deferred_engine::get_equal_above(string_view key, get_kv_callback *callback,
+					void *arg)
+{
+	apply();
+	return engine->get_equal_above(key, callback, arg);
+}
+
+status deferred_engine::get_equal_below(string_view key, get_kv_callback *callback,
+					void *arg)
+{
+	apply();
+	return engine->get_equal_below(key, callback, arg);
+}
+
+status deferred_engine::get_below(string_view key, get_kv_callback *callback,
+				  void *arg)
+{
+	apply();
+	return engine->get_below(key, callback, arg);
+}
+
+status deferred_engine::get_between(string_view key1, string_view key2,
+				    get_kv_callback *callback, void *arg)
+{
+	apply();
+	return engine->get_between(key1, key2, callback, arg);
+}
+
+status deferred_engine::get_between_parallel(string_view key1, string_view key2,
+					     std::size_t partitions,
+					     get_kv_callback *callback, void **args)
+{
+	apply();
+	return engine->get_between_parallel(key1, key2, partitions, callback, args);
+}
+
+status deferred_engine::get_above_paged(string_view key, std::size_t offset,
+					std::size_t limit, get_kv_callback *callback,
+					void *arg)
+{
+	apply();
+	return engine->get_above_paged(key, offset, limit, callback, arg);
+}
+
+status deferred_engine::get_between_paged(string_view key1, string_view key2,
+					  std::size_t offset, std::size_t limit,
+					  get_kv_callback *callback, void *arg)
+{
+	apply();
+	return engine->get_between_paged(key1, key2, offset, limit, callback, arg);
+}
+
+status deferred_engine::get_prefix(string_view prefix, get_kv_callback *callback,
+				   void *arg)
+{
+	apply();
+	return engine->get_prefix(prefix, callback, arg);
+}
+
+status deferred_engine::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	apply();
+	return engine->get_keys_all(callback, arg);
+}
+
+status deferred_engine::get_keys_between(string_view key1, string_view key2,
+					 get_kv_callback *callback, void *arg)
+{
+	apply();
+	return engine->get_keys_between(key1, key2, callback, arg);
+}
+
+/* pending writes are in DRAM already, only the engine is prefetched */
+status deferred_engine::prefetch(string_view key)
+{
+	return engine->prefetch(key);
+}
+
+status deferred_engine::prefetch_range(string_view key1, string_view key2)
+{
+	return engine->prefetch_range(key1, key2);
+}
+
+status deferred_engine::exists(string_view key)
+{
+	switch (find(key, nullptr)) {
+		case lookup::FOUND:
+			return status::OK;
+		case lookup::REMOVED:
+			return status::NOT_FOUND;
+		default:
+			return engine->exists(key);
+	}
+}
+
+/* the callback is called without the lock held, with a copy of the value */
+status deferred_engine::get(string_view key, get_v_callback *callback, void *arg)
+{
+	std::string value;
+	switch (find(key, &value)) {
+		case lookup::FOUND:
+			callback(value.data(), value.size(), arg);
+			return status::OK;
+		case lookup::REMOVED:
+			return status::NOT_FOUND;
+		default:
+			return engine->get(key, callback, arg);
+	}
+}
+
+status deferred_engine::value_size(string_view key, std::size_t &size)
+{
+	std::string value;
+	switch (find(key, &value)) {
+		case lookup::FOUND:
+			size = value.size();
+			return status::OK;
+		case lookup::REMOVED:
+			return status::NOT_FOUND;
+		default:
+			return engine->value_size(key, size);
+	}
+}
+
+status deferred_engine::put(string_view key, string_view value)
+{
+	std::size_t pending_keys;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto &w = pending[std::string(key.data(), key.size())];
+		w.removed = false;
+		w.value.assign(value.data(), value.size());
+		pending_keys = pending.size();
+	}
+
+	apply_if_full(pending_keys);
+
+	return status::OK;
+}
+
+/* the whole batch is applied at once, the same as by the engine */
+status deferred_engine::put_batch(const string_view *keys, const string_view *values,
+				  std::size_t n)
+{
+	std::size_t pending_keys;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (std::size_t i = 0; i < n; ++i) {
+			auto &w = pending[std::string(keys[i].data(), keys[i].size())];
+			w.removed = false;
+			w.value.assign(values[i].data(), values[i].size());
+		}
+		pending_keys = pending.size();
+	}
+
+	apply_if_full(pending_keys);
+
+	return status::OK;
+}
+
+status deferred_engine::update(string_view key, update_callback *callback, void *arg)
+{
+	apply();
+	return engine->update(key, callback, arg);
+}
+
+status deferred_engine::read_value(string_view key, std::size_t pos, std::size_t n,
+				   get_v_callback *callback, void *arg)
+{
+	apply();
+	return engine->read_value(key, pos, n, callback, arg);
+}
+
+status deferred_engine::write_value(string_view key, std::size_t pos,
+				    string_view data)
+{
+	apply();
+	return engine->write_value(key, pos, data);
+}
+
+status deferred_engine::append_value(string_view key, string_view data)
+{
+	apply();
+	return engine->append_value(key, data);
+}
+
+status deferred_engine::compare_exchange(string_view key, string_view expected,
+					 string_view desired)
+{
+	apply();
+	return engine->compare_exchange(key, expected, desired);
+}
+
+status deferred_engine::fetch_add(string_view key, uint64_t delta, uint64_t &old_value)
+{
+	apply();
+	return engine->fetch_add(key, delta, old_value);
+}
+
+status deferred_engine::put_if_absent(string_view key, string_view value, bool &inserted)
+{
+	apply();
+	return engine->put_if_absent(key, value, inserted);
+}
+
+/*
+ * A remove of a key which doesn't exist returns NOT_FOUND, as for the
+ * engine, so the engine is checked if there is no pending write of the key.
+ */
+status deferred_engine::remove(string_view key)
+{
+	auto found = find(key, nullptr);
+	if (found == lookup::REMOVED ||
+	    (found == lookup::NOT_PENDING && engine->exists(key) == status::NOT_FOUND))
+		return status::NOT_FOUND;
+
+	std::size_t pending_keys;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto &w = pending[std::string(key.data(), key.size())];
+		w.removed = true;
+		w.value.clear();
+		pending_keys = pending.size();
+	}
+
+	apply_if_full(pending_keys);
+
+	return status::OK;
+}
+
+/* pending writes are applied first, so the engine takes the latest value */
+status deferred_engine::take(string_view key, get_v_callback *callback, void *arg)
+{
+	apply();
+	return engine->take(key, callback, arg);
+}
+
+status deferred_engine::remove_between(string_view key1, string_view key2,
+				       std::size_t &cnt)
+{
+	apply();
+	return engine->remove_between(key1, key2, cnt);
+}
+
+status deferred_engine::defrag(double start_percent, double amount_percent)
+{
+	return engine->defrag(start_percent, amount_percent);
+}
+
+status deferred_engine::snapshot_save(const std::string &path)
+{
+	apply();
+	return engine->snapshot_save(path);
+}
+
+status deferred_engine::snapshot_load(const std::string &path)
+{
+	apply();
+	return engine->snapshot_load(path);
+}
+
+status deferred_engine::snapshot_export(int fd, uint64_t max_bytes_per_sec)
+{
+	apply();
+	return engine->snapshot_export(fd, max_bytes_per_sec);
+}
+
+internal::transaction *deferred_engine::begin_tx()
+{
+	apply();
+	return engine->begin_tx();
+}
+
+internal::iterator_base *deferred_engine::new_iterator()
+{
+	apply();
+	return engine->new_iterator();
+}
+
+internal::iterator_base *deferred_engine::new_const_iterator()
+{
+	apply();
+	return engine->new_const_iterator();
+}
+
+/* Makes all writes, which returned before, durable */
+status deferred_engine::sync()
+{
+	apply();
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto s = failed;
+	failed = status::OK;
+
+	return s;
+}
+
+status deferred_engine::stats(internal::stats_sink &sink)
+{
+	auto s = engine->stats(sink);
+	if (s != status::OK)
+		return s;
+
+	std::size_t pending_keys;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		pending_keys = pending.size() + applying.size();
+	}
+
+	sink.add("deferred.pending_keys", pending_keys);
+	sink.add("deferred.applies", applies.load(std::memory_order_relaxed));
+	sink.add("deferred.applied_keys", applied_keys.load(std::memory_order_relaxed));
+
+	return status::OK;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
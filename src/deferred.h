@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_DEFERRED_H
+#define LIBPMEMKV_DEFERRED_H
+
+#include "config.h"
+#include "engine.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Parameters of deferred durability read from the config */
+struct deferred_options {
+	/* set if "durability" is "deferred" ("sync" is the default) */
+	bool enabled = false;
+	/* pending writes are applied at least that often ("deferred_interval_ms") */
+	std::chrono::milliseconds interval{10};
+	/* number of pending keys at which a writer applies them ("deferred_max_keys") */
+	std::size_t max_keys = 4096;
+
+	static deferred_options from_config(config &cfg);
+};
+
+/*
+ * Engine with deferred durability ("durability" config parameter set to
+ * "deferred"). Puts and removes are kept in DRAM and return at once; they are
+ * applied to the underlying engine in batches (by put_batch, so transaction
+ * setup and drains are paid once per batch) by a background task, every
+ * interval, by the writer which fills up the batch and by sync(). Writes
+ * which are not applied yet are lost on a crash, but the underlying engine
+ * stays consistent - it only sees ordinary writes.
+ *
+ * get and exists see pending writes. All other operations (scans, counts,
+ * update, partial writes, transactions, iterators, snapshots) apply pending
+ * writes first and go directly to the underlying engine, so their writes are
+ * durable when they return.
+ *
+ * If applying of writes fails (e.g. in the background), the error is returned
+ * by the next sync() (as with fsync()) and the failed writes are discarded.
+ */
+class deferred_engine : public engine_base {
+public:
+	deferred_engine(std::unique_ptr<engine_base> engine,
+			const deferred_options &options);
+	~deferred_engine();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_between_approx(string_view key1, string_view key2,
+				    std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2,
+				    std::size_t partitions, get_kv_callback *callback,
+				    void **args) final;
+	status get_above_paged(string_view key, std::size_t offset, std::size_t limit,
+			       get_kv_callback *callback, void *arg) final;
+	status get_between_paged(string_view key1, string_view key2, std::size_t offset,
+				 std::size_t limit, get_kv_callback *callback,
+				 void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
+	status get_keys_between(string_view key1, string_view key2,
+				get_kv_callback *callback, void *arg) final;
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status value_size(string_view key, std::size_t &size) final;
+
+	status put(string_view key, string_view value) final;
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+
+	status read_value(string_view key, std::size_t pos, std::size_t n,
+			  get_v_callback *callback, void *arg) final;
+	status write_value(string_view key, std::size_t pos, string_view data) final;
+	status append_value(string_view key, string_view data) final;
+	status compare_exchange(string_view key, string_view expected,
+				string_view desired) final;
+	status fetch_add(string_view key, uint64_t delta, uint64_t &old_value) final;
+	status put_if_absent(string_view key, string_view value, bool &inserted) final;
+
+	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2,
+			      std::size_t &cnt) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
+	status snapshot_export(int fd, uint64_t max_bytes_per_sec) final;
+
+	internal::transaction *begin_tx() final;
+
+	internal::iterator_base *new_iterator() final;
+	internal::iterator_base *new_const_iterator() final;
+
+	status sync() final;
+
+	status stats(internal::stats_sink &sink) final;
+
+private:
+	/* the latest write of a key, not yet applied to the engine */
+	struct pending_write {
+		bool removed;
+		std::string value;
+	};
+
+	using write_map = std::unordered_map<std::string, pending_write>;
+
+	enum class lookup { FOUND, REMOVED, NOT_PENDING };
+
+	/* Copies the pending value of the key (if there is one) to value */
+	lookup find(string_view key, std::string *value);
+
+	/* Applies all pending writes to the engine, returns their status */
+	status apply() noexcept;
+	void apply_if_full(std::size_t pending_keys);
+
+	std::unique_ptr<engine_base> engine;
+	const deferred_options options;
+
+	std::mutex mtx;
+	write_map pending;
+	/* writes being applied by apply(), still visible to reads */
+	write_map applying;
+	/* failure of applying writes in the background, returned by sync() */
+	status failed = status::OK;
+
+	/* serializes apply() */
+	std::mutex apply_mtx;
+
+	std::atomic<uint64_t> applies;
+	std::atomic<uint64_t> applied_keys;
+
+	std::unique_ptr<background_task> apply_task;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_DEFERRED_H */
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "defrag_service.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+defrag_service::defrag_service(defrag_function defrag, double budget_percent,
+			       double slice_percent, thread_pool &pool)
+    : defrag(std::move(defrag)),
+      budget_percent(budget_percent),
+      slice_percent(slice_percent)
+{
+	if (budget_percent <= 0 || budget_percent > 100)
+		throw internal::invalid_argument("Defrag budget must be in range (0, 100]");
+	if (slice_percent <= 0 || slice_percent > 100)
+		throw internal::invalid_argument("Defrag slice must be in range (0, 100]");
+
+	task.reset(new background_task([this] { return step(); },
+				       background_task::clock_type::duration::zero(),
+				       pool));
+}
+
+defrag_service::~defrag_service()
+{
+	/* waits for the running slice */
+	task.reset();
+}
+
+/* Defragments a single slice, returns the delay of the next one */
+background_task::clock_type::duration defrag_service::step()
+{
+	using clock_type = background_task::clock_type;
+
+	auto amount = std::min(slice_percent, 100 - start);
+
+	auto begin = clock_type::now();
+	/*
+	 * Failure of a single slice (e.g. DEFRAG_ERROR when there is no
+	 * space to relocate objects) is not fatal, it will be retried
+	 * in the next pass.
+	 */
+	try {
+		defrag(start, amount);
+	} catch (...) {
+	}
+	auto elapsed = clock_type::now() - begin;
+
+	start += amount;
+	if (start >= 100)
+		start = 0;
+
+	/* delay the next slice so that defrag takes budget_percent of the time */
+	return std::chrono::duration_cast<clock_type::duration>(
+		elapsed * (100 - budget_percent) / budget_percent);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_DEFRAG_SERVICE_H
+#define LIBPMEMKV_DEFRAG_SERVICE_H
+
+#include <functional>
+#include <memory>
+
+#include "libpmemkv.hpp"
+#include "thread_pool.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * defrag_service runs defragmentation of an engine in the background, as
+ * a background_task on the pool of worker threads.
+ *
+ * Data is defragmented in small slices ('slice_percent' percent of elements
+ * at a time, wrapping around after the last one), so that foreground
+ * operations are blocked only for a short time. The next slice is delayed
+ * long enough for defragmentation to use at most 'budget_percent' percent of
+ * a worker's time.
+ */
+class defrag_service {
+public:
+	using defrag_function = std::function<status(double start, double amount)>;
+
+	defrag_service(defrag_function defrag, double budget_percent,
+		       double slice_percent,
+		       thread_pool &pool = thread_pool::get_default());
+	~defrag_service();
+
+	defrag_service(const defrag_service &) = delete;
+	defrag_service &operator=(const defrag_service &) = delete;
+
+private:
+	background_task::clock_type::duration step();
+
+	defrag_function defrag;
+	double budget_percent;
+	double slice_percent;
+	double start = 0;
+
+	std::unique_ptr<background_task> task;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_DEFRAG_SERVICE_H */
@@ -2,12 +2,25 @@
 /* Copyright 2017-2021, Intel Corporation */
 
 #include "engine.h"
+#include "comparator/comparator.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
 
 namespace pmem
 {
 namespace kv
 {
 
+static std::atomic<uint64_t> next_engine_id(1);
+
+engine_base::engine_base() : id_(next_engine_id++)
+{
+}
+
 std::map<std::string, storage_engine_factory::factory_type> &
 storage_engine_factory::get_engine_factories()
 {
@@ -87,11 +100,31 @@ status engine_base::count_between(string_view key1, string_view key2, std::size_
 	return status::NOT_SUPPORTED;
 }
 
+/*
+ * Default implementation of count_between_approx - engines which can't
+ * estimate the size of a range return the exact one.
+ */
+status engine_base::count_between_approx(string_view key1, string_view key2,
+					 std::size_t &cnt)
+{
+	return count_between(key1, key2, cnt);
+}
+
 status engine_base::get_all(get_kv_callback *callback, void *arg)
 {
 	return status::NOT_SUPPORTED;
 }
 
+/*
+ * Default implementation of get_all_parallel - all elements are visited
+ * by get_all(), as a single (first) partition.
+ */
+status engine_base::get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				     void **args)
+{
+	return get_all(callback, args ? args[0] : nullptr);
+}
+
 status engine_base::get_above(string_view key, get_kv_callback *callback, void *arg)
 {
 	return status::NOT_SUPPORTED;
@@ -118,16 +151,675 @@ status engine_base::get_between(string_view key1, string_view key2,
 	return status::NOT_SUPPORTED;
 }
 
+/*
+ * Default implementation of get_between_parallel - the range is visited by
+ * get_between(), as a single (first) partition.
+ */
+status engine_base::get_between_parallel(string_view key1, string_view key2,
+					 std::size_t partitions,
+					 get_kv_callback *callback, void **args)
+{
+	return get_between(key1, key2, callback, args ? args[0] : nullptr);
+}
+
+struct get_paged_context {
+	std::size_t offset;
+	std::size_t limit;
+	get_kv_callback *callback;
+	void *arg;
+	bool stopped_by_callback;
+};
+
+static int get_paged_filter(const char *k, size_t kb, const char *v, size_t vb,
+			    void *arg)
+{
+	auto ctx = static_cast<get_paged_context *>(arg);
+	if (ctx->offset > 0) {
+		--ctx->offset;
+		return 0;
+	}
+
+	if (ctx->callback(k, kb, v, vb, ctx->arg) != 0) {
+		ctx->stopped_by_callback = true;
+		return 1;
+	}
+
+	/* stop the scan after the last requested element */
+	return --ctx->limit == 0 ? 1 : 0;
+}
+
+/*
+ * Runs the scan with get_paged_filter. Only a stop requested by the user's
+ * callback is reported as STOPPED_BY_CB.
+ */
+template <typename F>
+static status get_paged(std::size_t offset, std::size_t limit,
+			get_kv_callback *callback, void *arg, F &&scan)
+{
+	if (limit == 0)
+		return status::OK;
+
+	get_paged_context ctx{offset, limit, callback, arg, false};
+	auto s = scan(get_paged_filter, &ctx);
+	if (s == status::STOPPED_BY_CB && !ctx.stopped_by_callback)
+		return status::OK;
+
+	return s;
+}
+
+status engine_base::get_above_paged(string_view key, std::size_t offset,
+				    std::size_t limit, get_kv_callback *callback,
+				    void *arg)
+{
+	return get_paged(offset, limit, callback, arg,
+			 [&](get_kv_callback *cb, void *ctx) {
+				 return get_above(key, cb, ctx);
+			 });
+}
+
+status engine_base::get_between_paged(string_view key1, string_view key2,
+				      std::size_t offset, std::size_t limit,
+				      get_kv_callback *callback, void *arg)
+{
+	return get_paged(offset, limit, callback, arg,
+			 [&](get_kv_callback *cb, void *ctx) {
+				 return get_between(key1, key2, cb, ctx);
+			 });
+}
+
+struct get_keys_context {
+	get_kv_callback *callback;
+	void *arg;
+};
+
+static int get_keys_filter(const char *k, size_t kb, const char *v, size_t vb,
+			   void *arg)
+{
+	auto ctx = static_cast<get_keys_context *>(arg);
+	return ctx->callback(k, kb, nullptr, 0, ctx->arg);
+}
+
+status engine_base::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	get_keys_context ctx{callback, arg};
+	return get_all(get_keys_filter, &ctx);
+}
+
+status engine_base::get_keys_between(string_view key1, string_view key2,
+				     get_kv_callback *callback, void *arg)
+{
+	get_keys_context ctx{callback, arg};
+	return get_between(key1, key2, get_keys_filter, &ctx);
+}
+
+struct get_prefix_context {
+	string_view prefix;
+	get_kv_callback *callback;
+	void *arg;
+};
+
+static int get_prefix_filter(const char *k, size_t kb, const char *v, size_t vb,
+			     void *arg)
+{
+	auto ctx = static_cast<get_prefix_context *>(arg);
+	if (!internal::has_prefix(string_view(k, kb), ctx->prefix))
+		return 0;
+
+	return ctx->callback(k, kb, v, vb, ctx->arg);
+}
+
+/*
+ * Default implementation of get_prefix - it filters out all elements visited
+ * by get_all(), so it works for engines with any order of keys.
+ */
+status engine_base::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	get_prefix_context ctx{prefix, callback, arg};
+
+	return get_all(get_prefix_filter, &ctx);
+}
+
+status engine_base::prefetch(string_view key)
+{
+	return status::NOT_SUPPORTED;
+}
+
+status engine_base::prefetch_range(string_view key1, string_view key2)
+{
+	return status::NOT_SUPPORTED;
+}
+
 status engine_base::exists(string_view key)
 {
 	return status::NOT_SUPPORTED;
 }
 
+uint64_t engine_base::key_hash(string_view key)
+{
+	return 0;
+}
+
+status engine_base::exists_hashed(string_view key, uint64_t hash)
+{
+	return exists(key);
+}
+
+status engine_base::get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			       void *arg)
+{
+	return get(key, callback, arg);
+}
+
+status engine_base::put_hashed(string_view key, uint64_t hash, string_view value)
+{
+	return put(key, value);
+}
+
+static void get_value_size(const char *v, size_t vb, void *arg)
+{
+	*static_cast<std::size_t *>(arg) = vb;
+}
+
+/*
+ * Default implementation of value_size - the size is passed by get(),
+ * which doesn't copy the value in most engines.
+ */
+status engine_base::value_size(string_view key, std::size_t &size)
+{
+	return get(key, get_value_size, &size);
+}
+
+struct get_batch_context {
+	string_view key;
+	get_kv_callback *callback;
+	void *arg;
+	int ret;
+};
+
+static void get_batch_callback(const char *v, size_t vb, void *arg)
+{
+	auto c = static_cast<get_batch_context *>(arg);
+	c->ret = c->callback(c->key.data(), c->key.size(), v, vb, c->arg);
+}
+
+/*
+ * Default implementation of get_batch - it simply calls get() for every key.
+ * Engines which can overlap lookups (e.g. by prefetching) should override it.
+ */
+status engine_base::get_batch(const string_view *keys, std::size_t n,
+			      get_kv_callback *callback, void *arg)
+{
+	auto s = status::OK;
+
+	for (std::size_t i = 0; i < n; ++i) {
+		get_batch_context ctx = {keys[i], callback, arg, 0};
+
+		auto ret = get(keys[i], get_batch_callback, &ctx);
+		if (ret == status::NOT_FOUND) {
+			s = status::NOT_FOUND;
+			continue;
+		} else if (ret != status::OK) {
+			return ret;
+		}
+
+		if (ctx.ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return s;
+}
+
+static void get_pinned_copy(const char *v, size_t vb, void *arg)
+{
+	static_cast<internal::copied_pinned_value *>(arg)->data.assign(v, vb);
+}
+
+/*
+ * Default implementation of get_pinned - it copies the value, so it's not
+ * faster than get(), but allows using the same API for all engines.
+ */
+status engine_base::get_pinned(string_view key,
+			       std::unique_ptr<internal::pinned_value_base> &pinned)
+{
+	std::unique_ptr<internal::copied_pinned_value> copy(
+		new internal::copied_pinned_value());
+
+	auto s = get(key, get_pinned_copy, copy.get());
+	if (s == status::OK)
+		pinned = std::move(copy);
+
+	return s;
+}
+
+/* Records expire only in databases opened with "ttl" config flag (ttl_engine) */
+status engine_base::put_ttl(string_view key, string_view value, uint64_t ttl_ms)
+{
+	return status::NOT_SUPPORTED;
+}
+
+/*
+ * Default implementation of put_batch - it simply calls put() for every
+ * key-value pair, hence the batch is not applied atomically.
+ */
+status engine_base::put_batch(const string_view *keys, const string_view *values,
+			      std::size_t n)
+{
+	for (std::size_t i = 0; i < n; ++i) {
+		auto s = put(keys[i], values[i]);
+		if (s != status::OK)
+			return s;
+	}
+
+	return status::OK;
+}
+
+static void update_copy(const char *v, size_t vb, void *arg)
+{
+	static_cast<std::string *>(arg)->assign(v, vb);
+}
+
+/*
+ * Default implementation of update - it calls get() and put(), so it's
+ * atomic only if no other thread modifies the database at the same time.
+ * Concurrent engines override it and run the callback under the lock of
+ * the record.
+ */
+status engine_base::update(string_view key, update_callback *callback, void *arg)
+{
+	std::string current;
+	auto s = get(key, update_copy, &current);
+	if (s != status::OK && s != status::NOT_FOUND)
+		return s;
+
+	const char *new_value;
+	size_t new_valuebytes;
+	auto ret = callback(s == status::OK ? current.data() : nullptr, current.size(),
+			    &new_value, &new_valuebytes, arg);
+	if (ret != 0)
+		return status::STOPPED_BY_CB;
+
+	return put(key, string_view(new_value, new_valuebytes));
+}
+
+struct read_value_context {
+	std::size_t pos;
+	std::size_t n;
+	get_v_callback *callback;
+	void *arg;
+	bool out_of_range;
+};
+
+static void read_value_part(const char *v, size_t vb, void *arg)
+{
+	auto c = static_cast<read_value_context *>(arg);
+	if (c->pos > vb) {
+		c->out_of_range = true;
+		return;
+	}
+
+	auto n = std::min(c->n, vb - c->pos);
+	if (n > 0)
+		c->callback(v + c->pos, n, c->arg);
+}
+
+/*
+ * Default implementation of read_value - it gets the whole value and passes
+ * the requested part of it to the callback.
+ */
+status engine_base::read_value(string_view key, std::size_t pos, std::size_t n,
+			       get_v_callback *callback, void *arg)
+{
+	read_value_context ctx = {pos, n, callback, arg, false};
+
+	auto s = get(key, read_value_part, &ctx);
+	if (ctx.out_of_range)
+		throw internal::invalid_argument(
+			"Position is beyond the end of the value");
+
+	return s;
+}
+
+struct write_value_context {
+	std::size_t pos;
+	string_view data;
+	/* creates the record if it doesn't exist (instead of failing) */
+	bool create;
+	status s;
+	std::string value;
+};
+
+static int write_value_part(const char *v, size_t vb, const char **new_value,
+			    size_t *new_valuebytes, void *arg)
+{
+	auto c = static_cast<write_value_context *>(arg);
+	if (!v && !c->create) {
+		c->s = status::NOT_FOUND;
+		return 1;
+	}
+
+	auto pos = c->create ? vb : c->pos;
+	if (pos > vb) {
+		c->s = status::INVALID_ARGUMENT;
+		return 1;
+	}
+
+	c->value.assign(v ? v : "", vb);
+	c->value.replace(pos, c->data.size(), c->data.data(), c->data.size());
+	*new_value = c->value.data();
+	*new_valuebytes = c->value.size();
+
+	return 0;
+}
+
+/*
+ * Default implementations of write_value and append_value - they modify a copy
+ * of the whole value by update(), so they are as atomic as update() is.
+ */
+status engine_base::write_value(string_view key, std::size_t pos, string_view data)
+{
+	write_value_context ctx = {pos, data, false, status::OK, {}};
+
+	auto s = update(key, write_value_part, &ctx);
+	if (ctx.s == status::INVALID_ARGUMENT)
+		throw internal::invalid_argument(
+			"Position is beyond the end of the value");
+
+	return ctx.s != status::OK ? ctx.s : s;
+}
+
+status engine_base::append_value(string_view key, string_view data)
+{
+	write_value_context ctx = {0, data, true, status::OK, {}};
+
+	return update(key, write_value_part, &ctx);
+}
+
+struct compare_exchange_context {
+	string_view expected;
+	string_view desired;
+	status s;
+};
+
+static int compare_exchange_value(const char *v, size_t vb, const char **new_value,
+				  size_t *new_valuebytes, void *arg)
+{
+	auto c = static_cast<compare_exchange_context *>(arg);
+	if (!v) {
+		c->s = status::NOT_FOUND;
+		return 1;
+	}
+
+	if (string_view(v, vb).compare(c->expected) != 0) {
+		c->s = status::VALUE_MISMATCH;
+		return 1;
+	}
+
+	c->s = status::OK;
+	*new_value = c->desired.data();
+	*new_valuebytes = c->desired.size();
+
+	return 0;
+}
+
+/*
+ * Default implementation of compare_exchange - the value is compared and
+ * replaced by update(), so engines which run update's callback under the lock
+ * of the record (cmap, csmap, vcmap, robinhood) make it atomic.
+ */
+status engine_base::compare_exchange(string_view key, string_view expected,
+				     string_view desired)
+{
+	compare_exchange_context ctx = {expected, desired, status::OK};
+
+	auto s = update(key, compare_exchange_value, &ctx);
+
+	return ctx.s != status::OK ? ctx.s : s;
+}
+
+struct fetch_add_context {
+	uint64_t delta;
+	uint64_t old_value;
+	uint64_t new_value;
+	bool invalid;
+};
+
+static int fetch_add_value(const char *v, size_t vb, const char **new_value,
+			   size_t *new_valuebytes, void *arg)
+{
+	auto c = static_cast<fetch_add_context *>(arg);
+	if (v && vb != sizeof(uint64_t)) {
+		c->invalid = true;
+		return 1;
+	}
+
+	c->old_value = 0;
+	if (v)
+		std::memcpy(&c->old_value, v, sizeof(uint64_t));
+	c->new_value = c->old_value + c->delta;
+
+	*new_value = reinterpret_cast<const char *>(&c->new_value);
+	*new_valuebytes = sizeof(uint64_t);
+
+	return 0;
+}
+
+/*
+ * Default implementation of fetch_add - the value is replaced by update(),
+ * so it's as atomic as update() is.
+ */
+status engine_base::fetch_add(string_view key, uint64_t delta, uint64_t &old_value)
+{
+	fetch_add_context ctx = {delta, 0, 0, false};
+
+	auto s = update(key, fetch_add_value, &ctx);
+	if (ctx.invalid)
+		throw internal::invalid_argument("Value is not an 8-byte integer");
+
+	if (s == status::OK)
+		old_value = ctx.old_value;
+
+	return s;
+}
+
+struct put_if_absent_context {
+	string_view value;
+	bool inserted;
+};
+
+static int put_if_absent_value(const char *v, size_t vb, const char **new_value,
+			       size_t *new_valuebytes, void *arg)
+{
+	auto c = static_cast<put_if_absent_context *>(arg);
+	if (v)
+		return 1;
+
+	c->inserted = true;
+	*new_value = c->value.data();
+	*new_valuebytes = c->value.size();
+
+	return 0;
+}
+
+/*
+ * Default implementation of put_if_absent - the record is looked up and
+ * created by a single update(), an existing one is left untouched.
+ */
+status engine_base::put_if_absent(string_view key, string_view value, bool &inserted)
+{
+	put_if_absent_context ctx = {value, false};
+
+	auto s = update(key, put_if_absent_value, &ctx);
+	inserted = ctx.inserted && s == status::OK;
+
+	return s == status::STOPPED_BY_CB ? status::OK : s;
+}
+
+/*
+ * Default implementation of take - it calls get() and remove(), so it's
+ * atomic only if no other thread modifies the record at the same time.
+ * The callback is called only if the record was removed by this call.
+ */
+status engine_base::take(string_view key, get_v_callback *callback, void *arg)
+{
+	std::string value;
+	auto s = get(key, update_copy, &value);
+	if (s != status::OK)
+		return s;
+
+	s = remove(key);
+	if (s == status::OK)
+		callback(value.data(), value.size(), arg);
+
+	return s;
+}
+
+status engine_base::remove_between(string_view key1, string_view key2,
+				   std::size_t &cnt)
+{
+	return status::NOT_SUPPORTED;
+}
+
 status engine_base::defrag(double start_percent, double amount_percent)
 {
 	return status::NOT_SUPPORTED;
 }
 
+status engine_base::sync()
+{
+	return status::OK;
+}
+
+static int snapshot_write_record(const char *k, size_t kb, const char *v, size_t vb,
+				 void *arg)
+{
+	static_cast<internal::snapshot_writer *>(arg)->write(string_view(k, kb),
+							     string_view(v, vb));
+	return 0;
+}
+
+/*
+ * Default implementation of snapshot_save - records are written in the order
+ * of get_all(), so the snapshot is sorted (and bulk loaded by sorted engines)
+ * if the engine is. It's not a point-in-time copy if other threads write to
+ * the database at the same time.
+ */
+status engine_base::snapshot_save(const std::string &path)
+{
+	internal::snapshot_writer writer(path);
+
+	auto s = get_all(snapshot_write_record, &writer);
+	if (s != status::OK)
+		return s;
+
+	writer.commit();
+
+	return status::OK;
+}
+
+/*
+ * Default implementation of snapshot_load - every block of the snapshot is
+ * put by put_batch(), directly from the mapped file, so the load is as atomic
+ * as put_batch() of the engine (per block) and as parallel (e.g. cmap splits
+ * big batches between threads by hashes of keys).
+ */
+status engine_base::snapshot_load(const std::string &path)
+{
+	internal::snapshot_reader reader(path);
+
+	auto s = status::OK;
+	reader.read_batches(
+		[&](const string_view *keys, const string_view *values, std::size_t n) {
+			if (s == status::OK)
+				s = put_batch(keys, values, n);
+		});
+
+	return s;
+}
+
+/* Records read by a single call of the engine's scan, while exporting */
+struct export_chunk {
+	static constexpr std::size_t MAX_RECORDS = 1024;
+
+	std::vector<std::pair<std::string, std::string>> records;
+	std::size_t n = 0;
+	std::size_t bytes = 0;
+
+	bool full() const
+	{
+		return n >= MAX_RECORDS || bytes >= internal::snapshot::BLOCK_SIZE;
+	}
+};
+
+/* strings of records are reused by the next chunks */
+static int export_collect(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	auto chunk = static_cast<export_chunk *>(arg);
+	if (chunk->n == chunk->records.size())
+		chunk->records.emplace_back();
+
+	chunk->records[chunk->n].first.assign(k, kb);
+	chunk->records[chunk->n].second.assign(v, vb);
+	chunk->n++;
+	chunk->bytes += kb + vb;
+
+	return chunk->full() ? 1 : 0;
+}
+
+static int export_stop(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	return 1;
+}
+
+/*
+ * Default implementation of snapshot_export. Records of sorted engines are
+ * read in chunks, each by a separate scan (starting above the last exported
+ * key), so locks of the engine are held only while a chunk is copied and
+ * never while the file is written (or the writer sleeps because of the rate
+ * limit). Engines without range scans (hashmaps) are exported by get_all(),
+ * which doesn't lock the whole map in cmap.
+ *
+ * The export is fuzzy: records written during the export may or may not be
+ * included, but every record which wasn't modified is.
+ */
+status engine_base::snapshot_export(int fd, uint64_t max_bytes_per_sec)
+{
+	internal::snapshot_writer writer(fd);
+	writer.set_rate_limit(max_bytes_per_sec);
+
+	auto s = get_above(string_view(), export_stop, nullptr);
+	if (s == status::NOT_SUPPORTED) {
+		s = get_all(snapshot_write_record, &writer);
+		if (s != status::OK)
+			return s;
+
+		writer.commit();
+
+		return status::OK;
+	}
+
+	export_chunk chunk;
+	s = get_all(export_collect, &chunk);
+	while (s == status::OK || s == status::STOPPED_BY_CB) {
+		for (std::size_t i = 0; i < chunk.n; ++i)
+			writer.write(chunk.records[i].first, chunk.records[i].second);
+
+		if (!chunk.full())
+			break;
+
+		auto last_key = std::move(chunk.records[chunk.n - 1].first);
+		chunk.n = 0;
+		chunk.bytes = 0;
+		s = get_above(last_key, export_collect, &chunk);
+	}
+
+	if (s != status::OK && s != status::STOPPED_BY_CB)
+		return s;
+
+	writer.commit();
+
+	return status::OK;
+}
+
 internal::transaction *engine_base::begin_tx()
 {
 	throw internal::not_supported("Transactions are not supported in this engine");
@@ -143,5 +835,87 @@ engine_base::iterator *engine_base::new_const_iterator()
 	throw internal::not_supported("Iterators are not supported in this engine");
 }
 
+/*
+ * Passes engine-specific statistics to the sink. By default there are none.
+ */
+status engine_base::stats(internal::stats_sink &sink)
+{
+	return status::OK;
+}
+
+void engine_base::enable_latency_stats()
+{
+	if (!latency_)
+		latency_.reset(new internal::latency_stats());
+}
+
+/*
+ * Returns latency statistics of the engine or nullptr, if they are not enabled
+ * ("latency_stats" config parameter).
+ */
+internal::latency_stats *engine_base::latency()
+{
+	return latency_.get();
+}
+
+void engine_base::enable_persist_stats()
+{
+	if (!persist_)
+		persist_.reset(new internal::persist_stats());
+}
+
+/*
+ * Returns statistics of writes to persistent memory of the engine or nullptr,
+ * if they are not enabled ("persist_stats" config parameter).
+ */
+internal::persist_stats *engine_base::persist()
+{
+	return persist_.get();
+}
+
+void engine_base::set_open_timings(std::unique_ptr<internal::open_stats> timings)
+{
+	open_timings_ = std::move(timings);
+}
+
+/*
+ * Returns durations of phases of opening the engine or nullptr, if it was not
+ * opened by pmemkv_open().
+ */
+internal::open_stats *engine_base::open_timings()
+{
+	return open_timings_.get();
+}
+
+void engine_base::enable_access_stats(uint64_t sampling_rate)
+{
+	if (!access_)
+		access_.reset(new internal::access_stats(sampling_rate));
+}
+
+/*
+ * Returns statistics of sampled accesses to keys of the engine or nullptr,
+ * if they are not enabled ("access_sampling" config parameter).
+ */
+internal::access_stats *engine_base::access()
+{
+	return access_.get();
+}
+
+void engine_base::enable_slow_op_log(const std::string &engine, uint64_t threshold_ns)
+{
+	if (!slow_ops_)
+		slow_ops_.reset(new internal::slow_op_log(engine, threshold_ns));
+}
+
+/*
+ * Returns the log of slow operations of the engine or nullptr, if it's not
+ * enabled ("slow_op_threshold_ns" config parameter).
+ */
+internal::slow_op_log *engine_base::slow_ops()
+{
+	return slow_ops_.get();
+}
+
 } // namespace kv
 } // namespace pmem
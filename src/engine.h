@@ -8,9 +8,12 @@
 #include <memory>
 #include <string>
 
+#include "access_stats.h"
 #include "config.h"
 #include "iterator.h"
 #include "libpmemkv.hpp"
+#include "pinned_value.h"
+#include "stats.h"
 #include "transaction.h"
 
 namespace pmem
@@ -33,7 +36,7 @@ class engine_base {
 	using iterator = internal::iterator_base;
 
 public:
-	engine_base() = default;
+	engine_base();
 	virtual ~engine_base() = default;
 
 	virtual std::string name() = 0;
@@ -45,8 +48,12 @@ public:
 	virtual status count_below(string_view key, std::size_t &cnt);
 	virtual status count_between(string_view key1, string_view key2,
 				     std::size_t &cnt);
+	virtual status count_between_approx(string_view key1, string_view key2,
+					    std::size_t &cnt);
 
 	virtual status get_all(get_kv_callback *callback, void *arg);
+	virtual status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+					void **args);
 	virtual status get_above(string_view key, get_kv_callback *callback, void *arg);
 	virtual status get_equal_above(string_view key, get_kv_callback *callback,
 				       void *arg);
@@ -55,19 +62,130 @@ public:
 	virtual status get_below(string_view key, get_kv_callback *callback, void *arg);
 	virtual status get_between(string_view key1, string_view key2,
 				   get_kv_callback *callback, void *arg);
+	virtual status get_between_parallel(string_view key1, string_view key2,
+					    std::size_t partitions,
+					    get_kv_callback *callback, void **args);
+	/*
+	 * Range reads skipping 'offset' first elements and visiting at most
+	 * 'limit' of them. Default implementations skip elements visited by
+	 * get_above() / get_between() and stop it after the limit.
+	 */
+	virtual status get_above_paged(string_view key, std::size_t offset,
+				       std::size_t limit, get_kv_callback *callback,
+				       void *arg);
+	virtual status get_between_paged(string_view key1, string_view key2,
+					 std::size_t offset, std::size_t limit,
+					 get_kv_callback *callback, void *arg);
+	virtual status get_prefix(string_view prefix, get_kv_callback *callback,
+				  void *arg);
+	/*
+	 * Scans passing only keys to the callback (value is null, of size 0).
+	 * Default implementations drop values visited by get_all() and
+	 * get_between(), engines override them to not read values at all.
+	 */
+	virtual status get_keys_all(get_kv_callback *callback, void *arg);
+	virtual status get_keys_between(string_view key1, string_view key2,
+					get_kv_callback *callback, void *arg);
+	/*
+	 * Hints that the key (or keys in range [key1, key2]) will be read soon.
+	 * Engines walk their nodes on the shared thread pool and prefetch them,
+	 * without blocking the caller.
+	 */
+	virtual status prefetch(string_view key);
+	virtual status prefetch_range(string_view key1, string_view key2);
 
 	virtual status exists(string_view key);
 
 	virtual status get(string_view key, get_v_callback *callback, void *arg) = 0;
+	/* Size of the value, engines read it without reading the value itself */
+	virtual status value_size(string_view key, std::size_t &size);
+	virtual status get_batch(const string_view *keys, std::size_t n,
+				 get_kv_callback *callback, void *arg);
+	virtual status get_pinned(string_view key,
+				  std::unique_ptr<internal::pinned_value_base> &pinned);
 	virtual status put(string_view key, string_view value) = 0;
+	/* Puts the value, which expires after ttl_ms (with "ttl" config flag) */
+	virtual status put_ttl(string_view key, string_view value, uint64_t ttl_ms);
+
+	/*
+	 * Lookups with the key's hash precomputed by key_hash() (used by key
+	 * handles). Engines which don't hash keys return 0 from key_hash() and
+	 * ignore the hash.
+	 */
+	virtual uint64_t key_hash(string_view key);
+	virtual status exists_hashed(string_view key, uint64_t hash);
+	virtual status get_hashed(string_view key, uint64_t hash,
+				  get_v_callback *callback, void *arg);
+	virtual status put_hashed(string_view key, uint64_t hash, string_view value);
+
+	virtual status put_batch(const string_view *keys, const string_view *values,
+				 std::size_t n);
+	virtual status update(string_view key, update_callback *callback, void *arg);
+
+	/*
+	 * Partial reads and writes of values. Engines which store values in
+	 * extents (lvmap) touch only the extents in the given range, the default
+	 * implementations read (and write) whole values.
+	 */
+	virtual status read_value(string_view key, std::size_t pos, std::size_t n,
+				  get_v_callback *callback, void *arg);
+	virtual status write_value(string_view key, std::size_t pos, string_view data);
+	virtual status append_value(string_view key, string_view data);
+	virtual status compare_exchange(string_view key, string_view expected,
+					string_view desired);
+	/* Adds delta to an 8-byte integer value, the old value is returned */
+	virtual status fetch_add(string_view key, uint64_t delta, uint64_t &old_value);
+	/* Puts the value only if the key doesn't exist, 'inserted' tells if it did */
+	virtual status put_if_absent(string_view key, string_view value, bool &inserted);
 	virtual status remove(string_view key) = 0;
+	/* Passes the value to the callback and removes the record */
+	virtual status take(string_view key, get_v_callback *callback, void *arg);
+	virtual status remove_between(string_view key1, string_view key2,
+				      std::size_t &cnt);
 	virtual status defrag(double start_percent, double amount_percent);
+	/* Makes writes durable, engines' writes are durable when they return */
+	virtual status sync();
+
+	/*
+	 * Default implementations save records read by get_all() and load
+	 * them by put_batch(), a block of the snapshot at a time.
+	 */
+	virtual status snapshot_save(const std::string &path);
+	virtual status snapshot_load(const std::string &path);
+	/*
+	 * Default implementation exports sorted engines in chunks of records
+	 * (read by separate get_above() calls) and others by get_all().
+	 */
+	virtual status snapshot_export(int fd, uint64_t max_bytes_per_sec);
 
 	virtual internal::transaction *begin_tx();
 
 	virtual iterator *new_iterator();
 	virtual iterator *new_const_iterator();
 
+	virtual status stats(internal::stats_sink &sink);
+
+	void enable_latency_stats();
+	internal::latency_stats *latency();
+
+	void enable_persist_stats();
+	internal::persist_stats *persist();
+
+	void set_open_timings(std::unique_ptr<internal::open_stats> timings);
+	internal::open_stats *open_timings();
+
+	void enable_access_stats(uint64_t sampling_rate);
+	internal::access_stats *access();
+
+	void enable_slow_op_log(const std::string &engine, uint64_t threshold_ns);
+	internal::slow_op_log *slow_ops();
+
+	/* Id of the engine instance, unique in the process (ids are not reused) */
+	uint64_t id() const
+	{
+		return id_;
+	}
+
 	/**
 	 * factory_base is an interface for engine factory.
 	 * Should be implemented for registration purposes.
@@ -80,6 +198,14 @@ public:
 			create(std::unique_ptr<internal::config>) = 0;
 		virtual std::string get_name() = 0;
 	};
+
+private:
+	std::unique_ptr<internal::latency_stats> latency_;
+	std::unique_ptr<internal::persist_stats> persist_;
+	std::unique_ptr<internal::open_stats> open_timings_;
+	std::unique_ptr<internal::access_stats> access_;
+	std::unique_ptr<internal::slow_op_log> slow_ops_;
+	const uint64_t id_;
 };
 
 /**
@@ -0,0 +1,1021 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "blockstore.h"
+#include "../crc_hash.h"
+#include "../exceptions.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace blockstore
+{
+
+static uint64_t align_up(uint64_t size)
+{
+	return (size + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+}
+
+static uint64_t record_size(uint64_t key_size, uint64_t value_size)
+{
+	auto size = sizeof(record) + key_size + value_size;
+
+	return (size + 7) & ~uint64_t(7);
+}
+
+static uint64_t record_size(const record *r)
+{
+	return record_size(r->key_size, r->value_size == TOMBSTONE ? 0 : r->value_size);
+}
+
+static string_view key_of(const record *r)
+{
+	return string_view(reinterpret_cast<const char *>(r + 1), r->key_size);
+}
+
+static string_view value_of(const record *r)
+{
+	return string_view(reinterpret_cast<const char *>(r + 1) + r->key_size,
+			   r->value_size);
+}
+
+static uint32_t batch_crc(const batch_header &h, const char *records)
+{
+	batch_header copy = h;
+	copy.crc = 0;
+	auto crc = crc32c(0, reinterpret_cast<const char *>(&copy), sizeof(copy));
+
+	return crc32c(crc, records, h.size);
+}
+
+/*
+ * Returns size of the valid batch at 'pos' of the segment's data (with the
+ * padding), or 0 if there's none.
+ */
+static uint64_t valid_batch(const char *data, uint64_t size, uint64_t pos, uint64_t seq)
+{
+	if (pos + sizeof(batch_header) > size)
+		return 0;
+
+	batch_header h;
+	std::memcpy(&h, data + pos, sizeof(h));
+	if (h.magic != BATCH_MAGIC || h.seq != seq ||
+	    h.size > size - pos - sizeof(batch_header))
+		return 0;
+	if (batch_crc(h, data + pos + sizeof(h)) != h.crc)
+		return 0;
+
+	return align_up(sizeof(batch_header) + h.size);
+}
+
+/* Calls f(record, offset in the data) for every record of the valid batch */
+template <typename F>
+static void for_each_record(const char *data, uint64_t pos, F &&f)
+{
+	batch_header h;
+	std::memcpy(&h, data + pos, sizeof(h));
+
+	auto first = pos + sizeof(batch_header);
+	for (uint64_t off = first; off < first + h.size;) {
+		auto r = reinterpret_cast<const record *>(data + off);
+		f(r, off);
+		off += record_size(r);
+	}
+}
+
+static uint64_t get_percent(internal::config &cfg, const char *key, uint64_t def)
+{
+	uint64_t value = def;
+	cfg.get_uint64(key, &value);
+	if (value == 0 || value > 100)
+		throw internal::invalid_argument("Config item \"" + std::string(key) +
+						 "\" must be in range [1, 100]");
+
+	return value;
+}
+
+aligned_buffer make_aligned(std::size_t size)
+{
+	void *p = nullptr;
+	if (posix_memalign(&p, BLOCK_SIZE, align_up(std::max<std::size_t>(size, 1))) !=
+	    0)
+		throw std::bad_alloc();
+
+	return aligned_buffer(static_cast<char *>(p));
+}
+
+constexpr std::size_t block_cache::SHARDS;
+
+block_cache::block_cache(std::size_t bytes)
+    : hits(0), misses(0), shards(new shard[SHARDS])
+{
+	auto frames = bytes / BLOCK_SIZE;
+	frames_per_shard = frames == 0 ? 0 : std::max<std::size_t>(frames / SHARDS, 1);
+
+	for (std::size_t i = 0; i < SHARDS && frames_per_shard; ++i) {
+		shards[i].data = make_aligned(frames_per_shard * BLOCK_SIZE);
+		shards[i].frames.reserve(frames_per_shard);
+	}
+}
+
+bool block_cache::read(uint64_t block, char *dst)
+{
+	if (frames_per_shard == 0) {
+		misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	auto &s = shards[block % SHARDS];
+	std::unique_lock<std::mutex> lock(s.mtx);
+
+	auto it = s.frames_map.find(block);
+	if (it == s.frames_map.end()) {
+		misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	s.frames[it->second].referenced = true;
+	std::memcpy(dst, s.data.get() + it->second * BLOCK_SIZE, BLOCK_SIZE);
+	hits.fetch_add(1, std::memory_order_relaxed);
+
+	return true;
+}
+
+/* The block replaces its cached copy or a frame not referenced since last visit */
+void block_cache::insert(uint64_t block, const char *src)
+{
+	if (frames_per_shard == 0)
+		return;
+
+	auto &s = shards[block % SHARDS];
+	std::unique_lock<std::mutex> lock(s.mtx);
+
+	std::size_t idx;
+	auto it = s.frames_map.find(block);
+	if (it != s.frames_map.end()) {
+		idx = it->second;
+	} else if (s.frames.size() < frames_per_shard) {
+		idx = s.frames.size();
+		s.frames.push_back(frame{block, false});
+		s.frames_map.emplace(block, idx);
+	} else {
+		while (s.frames[s.hand].referenced) {
+			s.frames[s.hand].referenced = false;
+			s.hand = (s.hand + 1) % frames_per_shard;
+		}
+		idx = s.hand;
+		s.hand = (s.hand + 1) % frames_per_shard;
+
+		s.frames_map.erase(s.frames[idx].block);
+		s.frames[idx].block = block;
+		s.frames_map.emplace(block, idx);
+	}
+
+	s.frames[idx].referenced = true;
+	std::memcpy(s.data.get() + idx * BLOCK_SIZE, src, BLOCK_SIZE);
+}
+
+} /* namespace blockstore */
+} /* namespace internal */
+
+using namespace internal::blockstore;
+
+blockstore::blockstore(std::unique_ptr<internal::config> cfg)
+    : mtx(std::thread::hardware_concurrency())
+{
+	segment_size = SEGMENT_SIZE;
+	cfg->get_uint64("segment_size", &segment_size);
+	if (segment_size < 2 * BLOCK_SIZE || segment_size > (1ULL << 31) ||
+	    segment_size % BLOCK_SIZE != 0)
+		throw internal::invalid_argument(
+			"Config item \"segment_size\" must be a multiple of 4096 in range [8192, 2^31]");
+	gc_threshold = get_percent(*cfg, "gc_threshold", GC_THRESHOLD);
+	gc_budget_percent = get_percent(*cfg, "gc_budget_percent", GC_BUDGET_PERCENT);
+
+	uint64_t queue_depth = QUEUE_DEPTH;
+	cfg->get_uint64("queue_depth", &queue_depth);
+	if (queue_depth == 0 || queue_depth > 4096)
+		throw internal::invalid_argument(
+			"Config item \"queue_depth\" must be in range [1, 4096]");
+
+	uint64_t cache_size = CACHE_SIZE;
+	cfg->get_uint64("cache_size", &cache_size);
+	cache.reset(new block_cache(cache_size));
+
+	internal::open_phase phase("blockstore.open");
+	Open(*cfg);
+
+	try {
+		io.reset(new internal::io_ring(fd, static_cast<unsigned>(queue_depth)));
+
+		phase.next("blockstore.recover");
+		Recover();
+		phase.end();
+	} catch (...) {
+		io.reset();
+		close(fd);
+		throw;
+	}
+
+	cleaner.reset(new internal::background_task([this] { return CleanStep(); },
+						    clock_type::duration::zero()));
+
+	LOG("Started ok" << (io->async() ? "" : " (synchronous I/O)")
+			 << (direct_io ? "" : " (buffered I/O)"));
+}
+
+blockstore::~blockstore()
+{
+	/*
+	 * Waits for the running step, which may still wake the cleaner (a no-op
+	 * for a stopped task), so the pointer is cleared only afterwards.
+	 */
+	delete cleaner.get();
+	cleaner.release();
+	io.reset();
+	if (fd >= 0)
+		close(fd);
+
+	LOG("Stopped ok");
+}
+
+std::string blockstore::name()
+{
+	return "blockstore";
+}
+
+/*
+ * Opens (or creates) the file, with O_DIRECT unless it's disabled or not
+ * supported by the file system (e.g. tmpfs). The file is locked, so it can't
+ * be opened by two databases at once.
+ */
+void blockstore::Open(internal::config &cfg)
+{
+	auto path = cfg.get_path();
+
+	uint64_t create_if_missing = 0, create_or_error_if_exists = 0;
+	cfg.get_uint64("create_if_missing", &create_if_missing);
+	cfg.get_uint64("create_or_error_if_exists", &create_or_error_if_exists);
+	if (create_if_missing && create_or_error_if_exists)
+		throw internal::invalid_argument(
+			"Both flags set in config: \"create_if_missing\" and \"create_or_error_if_exists\"");
+
+	uint64_t direct = 1;
+	cfg.get_uint64("direct_io", &direct);
+	direct_io = direct != 0;
+
+	int flags = O_RDWR | O_CLOEXEC;
+	if (create_if_missing)
+		flags |= O_CREAT;
+	if (create_or_error_if_exists)
+		flags |= O_CREAT | O_EXCL;
+
+	fd = open(path.c_str(), flags | (direct_io ? O_DIRECT : 0), 0666);
+	if (fd < 0 && direct_io && errno == EINVAL) {
+		direct_io = false;
+		fd = open(path.c_str(), flags, 0666);
+	}
+	if (fd < 0)
+		throw internal::error("Cannot open file " + path + ": " +
+				      std::strerror(errno));
+
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		auto err = errno;
+		close(fd);
+		throw internal::error("Cannot lock file " + path + ": " +
+				      std::strerror(err));
+	}
+}
+
+/*
+ * Writes the superblock of an empty file or checks the existing one. Then
+ * the first block of every slot is read (in a single submission) and segments
+ * are replayed in order of their seq: a record overrides records of its key
+ * with lower versions, tombstones are kept until the end of the replay. New
+ * batches go to a new segment - the tail of the last one may hold a torn
+ * batch, followed by one which was written (but not committed) before a crash.
+ */
+void blockstore::Recover()
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		throw internal::error(std::string("fstat failed: ") + std::strerror(errno));
+
+	auto block = make_aligned(BLOCK_SIZE);
+	std::memset(block.get(), 0, BLOCK_SIZE);
+	superblock sb;
+
+	if (st.st_size == 0) {
+		sb = superblock{SUPERBLOCK_MAGIC, VERSION, BLOCK_SIZE, segment_size};
+		std::memcpy(block.get(), &sb, sizeof(sb));
+		internal::io_op ops[] = {internal::io_op::write(block.get(), BLOCK_SIZE, 0),
+					 internal::io_op::fsync()};
+		io->run(ops, 2);
+		return;
+	}
+
+	auto op = internal::io_op::read(block.get(), BLOCK_SIZE, 0);
+	io->run(&op, 1);
+	std::memcpy(&sb, block.get(), sizeof(sb));
+	if (sb.magic != SUPERBLOCK_MAGIC || sb.version != VERSION ||
+	    sb.block_size != BLOCK_SIZE)
+		throw internal::invalid_argument("File is not a blockstore database");
+	segment_size = sb.segment_size;
+
+	auto size = static_cast<uint64_t>(st.st_size);
+	if (size > BLOCK_SIZE)
+		slots = (size - BLOCK_SIZE + segment_size - 1) / segment_size;
+
+	/* first blocks of all slots */
+	auto firsts = make_aligned(slots * BLOCK_SIZE);
+	std::vector<internal::io_op> ops;
+	for (uint64_t i = 0; i < slots; ++i)
+		ops.push_back(internal::io_op::read(firsts.get() + i * BLOCK_SIZE,
+						    BLOCK_SIZE, SlotOffset(i)));
+	io->run(ops.data(), ops.size());
+
+	for (uint64_t i = 0; i < slots; ++i) {
+		batch_header h;
+		std::memcpy(&h, firsts.get() + i * BLOCK_SIZE, sizeof(h));
+		if (h.magic == BATCH_MAGIC && h.seq != 0 && !segments.count(h.seq))
+			segments[h.seq] = segment_info{i, 0, 0};
+		else
+			free_slots.push_back(i);
+	}
+
+	std::unordered_map<std::string, uint64_t> tombstones;
+	auto data = make_aligned(segment_size);
+	for (auto it = segments.begin(); it != segments.end();) {
+		auto seq = it->first;
+		auto &info = it->second;
+		auto offset = SlotOffset(info.slot);
+
+		/* the last slot may be shorter */
+		auto len = std::min(segment_size, size - offset);
+		ops.clear();
+		for (uint64_t pos = 0; pos < len; pos += BATCH_BYTES)
+			ops.push_back(internal::io_op::read(data.get() + pos,
+							    std::min(BATCH_BYTES, len - pos),
+							    offset + pos));
+		io->run(ops.data(), ops.size());
+
+		uint64_t pos = 0, live = 0;
+		while (auto batch = valid_batch(data.get(), len, pos, seq)) {
+			for_each_record(data.get(), pos, [&](const record *r, uint64_t off) {
+				auto rsize = record_size(r);
+				std::string key(key_of(r).data(), key_of(r).size());
+				location loc{offset + off, seq, r->version,
+					     static_cast<uint32_t>(rsize)};
+
+				auto t = tombstones.find(key);
+				auto e = index.find(key);
+				uint64_t latest = t != tombstones.end() ? t->second : 0;
+				if (e != index.end())
+					latest = std::max(latest, e->second.version);
+
+				if (r->version >= latest) {
+					if (r->value_size != TOMBSTONE)
+						live += rsize;
+					if (e != index.end()) {
+						AddDead(e->second.seq, e->second.size);
+						if (e->second.seq == seq)
+							live -= e->second.size;
+					}
+					if (r->value_size == TOMBSTONE) {
+						if (e != index.end())
+							index.erase(e);
+						tombstones[key] = r->version;
+					} else {
+						index[key] = loc;
+						if (t != tombstones.end())
+							tombstones.erase(t);
+					}
+				}
+
+				next_version = std::max(next_version, r->version + 1);
+			});
+			pos += batch;
+		}
+
+		if (pos == 0) {
+			/* not even the first batch is valid, e.g. it's torn */
+			free_slots.push_back(info.slot);
+			it = segments.erase(it);
+			continue;
+		}
+
+		/* everything but live records, with headers of batches and padding */
+		info.tail = pos;
+		info.dead = pos - live;
+		next_seq = std::max(next_seq, seq + 1);
+		++it;
+	}
+
+	dead_bytes = 0;
+	for (auto &s : segments)
+		dead_bytes += s.second.dead;
+}
+
+status blockstore::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	cnt = index.size();
+
+	return status::OK;
+}
+
+/* records are read in groups, each by a single submission */
+status blockstore::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	std::vector<const std::string *> keys;
+	std::vector<location> locs;
+	std::vector<aligned_buffer> bufs;
+	for (auto it = index.begin(); it != index.end();) {
+		keys.clear();
+		locs.clear();
+		for (; it != index.end() && locs.size() < QUEUE_DEPTH; ++it) {
+			keys.push_back(&it->first);
+			locs.push_back(it->second);
+		}
+
+		ReadRecords(locs.data(), locs.size(), bufs);
+		for (std::size_t i = 0; i < locs.size(); ++i) {
+			auto r = reinterpret_cast<const record *>(
+				bufs[i].get() + locs[i].offset % BLOCK_SIZE);
+			auto value = value_of(r);
+			auto ret = callback(keys[i]->data(), keys[i]->size(), value.data(),
+					    value.size(), arg);
+			if (ret != 0)
+				return status::STOPPED_BY_CB;
+		}
+	}
+
+	return status::OK;
+}
+
+status blockstore::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	bool found = index.find(std::string(key.data(), key.size())) != index.end();
+
+	return found ? status::OK : status::NOT_FOUND;
+}
+
+status blockstore::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto it = index.find(std::string(key.data(), key.size()));
+	if (it == index.end()) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	std::vector<aligned_buffer> bufs;
+	ReadRecords(&it->second, 1, bufs);
+	auto r = reinterpret_cast<const record *>(bufs[0].get() +
+						  it->second.offset % BLOCK_SIZE);
+	auto value = value_of(r);
+	callback(value.data(), value.size(), arg);
+
+	return status::OK;
+}
+
+/* blocks of all found keys, which are not cached, are read by a single submission */
+status blockstore::get_batch(const string_view *keys, std::size_t n,
+			     get_kv_callback *callback, void *arg)
+{
+	LOG("get_batch n=" << n);
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	std::vector<std::size_t> found;
+	std::vector<location> locs;
+	for (std::size_t i = 0; i < n; ++i) {
+		auto it = index.find(std::string(keys[i].data(), keys[i].size()));
+		if (it == index.end())
+			continue;
+		found.push_back(i);
+		locs.push_back(it->second);
+	}
+
+	std::vector<aligned_buffer> bufs;
+	ReadRecords(locs.data(), locs.size(), bufs);
+	for (std::size_t i = 0; i < found.size(); ++i) {
+		auto r = reinterpret_cast<const record *>(bufs[i].get() +
+							  locs[i].offset % BLOCK_SIZE);
+		auto value = value_of(r);
+		auto &key = keys[found[i]];
+		if (callback(key.data(), key.size(), value.data(), value.size(), arg) != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return found.size() == n ? status::OK : status::NOT_FOUND;
+}
+
+status blockstore::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+
+	std::unique_lock<std::mutex> lock(write_mtx);
+	auto state = Enqueue(key, value, false, next_version++, nullptr);
+	Commit(lock, {state});
+
+	return status::OK;
+}
+
+/*
+ * Records of the batch are committed together - they're written atomically,
+ * unless they don't fit in a single batch (of BATCH_BYTES).
+ */
+status blockstore::put_batch(const string_view *keys, const string_view *values,
+			     std::size_t n)
+{
+	LOG("put_batch n=" << n);
+
+	/* none of the records is written if any of them is invalid */
+	for (std::size_t i = 0; i < n; ++i)
+		CheckRecord(keys[i], values[i]);
+
+	std::unique_lock<std::mutex> lock(write_mtx);
+	std::vector<std::shared_ptr<batch_state>> states;
+	for (std::size_t i = 0; i < n; ++i) {
+		auto state = Enqueue(keys[i], values[i], false, next_version++, nullptr);
+		if (states.empty() || states.back() != state)
+			states.push_back(state);
+	}
+	Commit(lock, states);
+
+	return status::OK;
+}
+
+/* the tombstone is dead as soon as it's written, it's kept only for replay */
+status blockstore::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+
+	{
+		internal::shared_lock_guard<mutex_type> lock(mtx);
+		if (index.find(std::string(key.data(), key.size())) == index.end())
+			return status::NOT_FOUND;
+	}
+
+	std::unique_lock<std::mutex> lock(write_mtx);
+	auto state = Enqueue(key, string_view(), true, next_version++, nullptr);
+	Commit(lock, {state});
+
+	return status::OK;
+}
+
+status blockstore::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	sink.add("count", index.size());
+	sink.add("blockstore.segments", segments.size());
+	sink.add("blockstore.file_size", BLOCK_SIZE + slots * segment_size);
+	sink.add("blockstore.dead_bytes", dead_bytes);
+	sink.add("blockstore.cleaned_segments", cleaned_segments);
+	sink.add("blockstore.relocated_bytes", relocated_bytes);
+	sink.add("blockstore.flushes", flushes);
+	sink.add("blockstore.batches", batches_written);
+	sink.add("blockstore.cache_hits", cache->hits.load());
+	sink.add("blockstore.cache_misses", cache->misses.load());
+	sink.add("blockstore.io_uring", io->async() ? 1 : 0);
+	sink.add("blockstore.direct_io", direct_io ? 1 : 0);
+
+	return status::OK;
+}
+
+/*
+ * Blocks of the records are copied from the buffer pool; missing ones are
+ * read (runs of consecutive blocks by a single operation) in one submission
+ * and added to the pool.
+ */
+void blockstore::ReadRecords(const location *locs, std::size_t n,
+			     std::vector<aligned_buffer> &out)
+{
+	struct run {
+		char *dst;
+		uint64_t block;
+		uint64_t blocks;
+	};
+
+	out.clear();
+	std::vector<internal::io_op> ops;
+	std::vector<run> runs;
+	for (std::size_t i = 0; i < n; ++i) {
+		auto first = locs[i].offset / BLOCK_SIZE;
+		auto last = (locs[i].offset + locs[i].size - 1) / BLOCK_SIZE;
+		out.push_back(make_aligned((last - first + 1) * BLOCK_SIZE));
+
+		for (auto b = first; b <= last; ++b) {
+			auto dst = out.back().get() + (b - first) * BLOCK_SIZE;
+			if (cache->read(b, dst))
+				continue;
+
+			if (!runs.empty() && runs.back().block + runs.back().blocks == b &&
+			    runs.back().dst + runs.back().blocks * BLOCK_SIZE == dst)
+				runs.back().blocks++;
+			else
+				runs.push_back(run{dst, b, 1});
+		}
+	}
+
+	for (auto &r : runs)
+		ops.push_back(internal::io_op::read(r.dst, r.blocks * BLOCK_SIZE,
+						    r.block * BLOCK_SIZE));
+	io->run(ops.data(), ops.size());
+
+	for (auto &r : runs)
+		for (uint64_t b = 0; b < r.blocks; ++b)
+			cache->insert(r.block + b, r.dst + b * BLOCK_SIZE);
+}
+
+void blockstore::CheckRecord(string_view key, string_view value) const
+{
+	auto size = record_size(key.size(), value.size());
+	if (sizeof(batch_header) + size > segment_size || value.size() >= TOMBSTONE)
+		throw internal::invalid_argument("Record is larger than a segment");
+}
+
+std::shared_ptr<blockstore::batch_state>
+blockstore::Enqueue(string_view key, string_view value, bool tombstone, uint64_t version,
+		    const location *old)
+{
+	CheckRecord(key, value);
+	auto size = record_size(key.size(), value.size());
+
+	if (pending.empty() ||
+	    (!pending.back().data.empty() &&
+	     sizeof(batch_header) + pending.back().data.size() + size > BATCH_BYTES)) {
+		pending.emplace_back();
+		pending.back().state = std::make_shared<batch_state>();
+	}
+
+	auto &batch = pending.back();
+	record r{static_cast<uint32_t>(key.size()),
+		 tombstone ? TOMBSTONE : static_cast<uint32_t>(value.size()), version};
+	pending_record p{static_cast<uint32_t>(batch.data.size()),
+			 static_cast<uint32_t>(size), tombstone, old != nullptr,
+			 old ? *old : location()};
+
+	batch.data.append(reinterpret_cast<const char *>(&r), sizeof(r));
+	batch.data.append(key.data(), key.size());
+	batch.data.append(value.data(), value.size());
+	batch.data.resize(p.pos + size, '\0');
+	batch.records.push_back(p);
+
+	return batch.state;
+}
+
+/*
+ * Group commit: the first waiting writer takes all pending batches and
+ * writes them (without write_mtx, so other writers can queue the next ones),
+ * the others wait until their batches are done.
+ */
+void blockstore::Commit(std::unique_lock<std::mutex> &lock,
+			const std::vector<std::shared_ptr<batch_state>> &states)
+{
+	for (auto &state : states) {
+		while (!state->done) {
+			if (flushing) {
+				write_cv.wait(lock);
+				continue;
+			}
+
+			std::deque<pending_batch> batches;
+			batches.swap(pending);
+			flushing = true;
+			lock.unlock();
+
+			std::exception_ptr error;
+			try {
+				Flush(batches);
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			lock.lock();
+			flushing = false;
+			for (auto &b : batches) {
+				b.state->error = error;
+				b.state->done = true;
+			}
+			write_cv.notify_all();
+		}
+	}
+
+	for (auto &state : states)
+		if (state->error)
+			std::rethrow_exception(state->error);
+}
+
+/*
+ * Batches are placed at the tail of the current segment (or of new ones),
+ * written together with fdatasync after them, added to the buffer pool
+ * and applied to the index. If writing fails, the current segment is sealed,
+ * so later batches don't follow a missing one.
+ */
+void blockstore::Flush(std::deque<pending_batch> &batches)
+{
+	struct placed {
+		aligned_buffer buf;
+		uint64_t size;
+		uint64_t offset;
+		uint64_t seq;
+	};
+
+	std::vector<placed> out;
+	{
+		std::unique_lock<mutex_type> lock(mtx);
+		for (auto &b : batches) {
+			auto size = align_up(sizeof(batch_header) + b.data.size());
+			if (sealed || segments.rbegin()->second.tail + size > segment_size)
+				NewSegment();
+
+			auto &cur = *segments.rbegin();
+			out.push_back(placed{make_aligned(size), size,
+					     SlotOffset(cur.second.slot) + cur.second.tail,
+					     cur.first});
+			cur.second.tail += size;
+			/* header and padding are dead from the start */
+			AddDead(cur.first, size - b.data.size());
+		}
+	}
+
+	std::vector<internal::io_op> ops;
+	for (std::size_t i = 0; i < batches.size(); ++i) {
+		auto &b = batches[i];
+		auto buf = out[i].buf.get();
+
+		batch_header h{BATCH_MAGIC, out[i].seq, b.data.size(), 0,
+			       static_cast<uint32_t>(b.records.size())};
+		h.crc = batch_crc(h, b.data.data());
+		std::memcpy(buf, &h, sizeof(h));
+		std::memcpy(buf + sizeof(h), b.data.data(), b.data.size());
+		std::memset(buf + sizeof(h) + b.data.size(), 0,
+			    out[i].size - sizeof(h) - b.data.size());
+
+		ops.push_back(internal::io_op::write(buf, out[i].size, out[i].offset));
+	}
+	ops.push_back(internal::io_op::fsync());
+
+	try {
+		io->run(ops.data(), ops.size());
+	} catch (...) {
+		std::unique_lock<mutex_type> lock(mtx);
+		sealed = true;
+		for (std::size_t i = 0; i < batches.size(); ++i)
+			AddDead(out[i].seq, batches[i].data.size());
+		throw;
+	}
+
+	for (auto &p : out)
+		for (uint64_t b = 0; b < p.size / BLOCK_SIZE; ++b)
+			cache->insert(p.offset / BLOCK_SIZE + b, p.buf.get() + b * BLOCK_SIZE);
+
+	std::unique_lock<mutex_type> lock(mtx);
+	for (std::size_t i = 0; i < batches.size(); ++i)
+		Apply(batches[i], out[i].seq, out[i].offset);
+	flushes++;
+	batches_written += batches.size();
+}
+
+/*
+ * A relocated record replaces the record of its key only if the index still
+ * points to the original (the key wasn't written since it was copied).
+ */
+void blockstore::Apply(const pending_batch &batch, uint64_t seq, uint64_t offset)
+{
+	for (auto &p : batch.records) {
+		auto r = reinterpret_cast<const record *>(batch.data.data() + p.pos);
+		location loc{offset + sizeof(batch_header) + p.pos, seq, r->version, p.size};
+		std::string key(key_of(r).data(), key_of(r).size());
+
+		auto it = index.find(key);
+		if (p.relocated) {
+			relocated_bytes += p.size;
+			if (!p.tombstone && it != index.end() && it->second == p.old) {
+				it->second = loc;
+				AddDead(p.old.seq, p.size);
+			} else {
+				AddDead(seq, p.size);
+			}
+			continue;
+		}
+
+		if (it != index.end())
+			AddDead(it->second.seq, it->second.size);
+
+		if (p.tombstone) {
+			if (it != index.end())
+				index.erase(it);
+			AddDead(seq, p.size);
+		} else if (it != index.end()) {
+			it->second = loc;
+		} else {
+			index.emplace(std::move(key), loc);
+		}
+	}
+}
+
+/*
+ * The previous segment is sealed, it may be cleaned from now on. A new
+ * segment takes a free slot or extends the file.
+ */
+void blockstore::NewSegment()
+{
+	uint64_t slot;
+	if (!free_slots.empty()) {
+		slot = free_slots.back();
+		free_slots.pop_back();
+	} else {
+		slot = slots++;
+	}
+
+	auto seq = next_seq++;
+	segments[seq] = segment_info{slot, 0, 0};
+	sealed = false;
+
+	if (segments.size() > 1 && Qualifies(std::prev(segments.end(), 2)->first))
+		cleaner->wake();
+}
+
+/*
+ * The first block of the slot is zeroed (and flushed) before the slot is
+ * reused, so batches of the segment are never replayed again.
+ */
+void blockstore::FreeSegment(uint64_t seq)
+{
+	uint64_t slot;
+	{
+		internal::shared_lock_guard<mutex_type> lock(mtx);
+		slot = segments.at(seq).slot;
+	}
+
+	auto block = make_aligned(BLOCK_SIZE);
+	std::memset(block.get(), 0, BLOCK_SIZE);
+	internal::io_op ops[] = {
+		internal::io_op::write(block.get(), BLOCK_SIZE, SlotOffset(slot)),
+		internal::io_op::fsync()};
+	io->run(ops, 2);
+
+	std::unique_lock<mutex_type> lock(mtx);
+	dead_bytes -= segments.at(seq).dead;
+	segments.erase(seq);
+	free_slots.push_back(slot);
+	cleaned_segments++;
+}
+
+void blockstore::AddDead(uint64_t seq, uint64_t bytes)
+{
+	auto &info = segments.at(seq);
+	bool qualified = Qualifies(seq);
+
+	info.dead += bytes;
+	dead_bytes += bytes;
+
+	if (cleaner && !qualified && Qualifies(seq))
+		cleaner->wake();
+}
+
+/* the current segment is never cleaned */
+bool blockstore::Qualifies(uint64_t seq) const
+{
+	if (seq == segments.rbegin()->first && !sealed)
+		return false;
+
+	auto &info = segments.at(seq);
+
+	return info.tail == 0 || info.dead * 100 >= info.tail * gc_threshold;
+}
+
+/*
+ * The segment with the highest ratio of dead bytes is read and its live
+ * records (those the index points to) are appended again, committed as any
+ * other write. A tombstone is copied only if there are older segments, which
+ * may hold a record of its key. When the copies are written, the segment is
+ * freed (a crash before that leaves both copies, with the same versions).
+ */
+blockstore::clock_type::duration blockstore::CleanStep()
+{
+	auto begin = clock_type::now();
+	bool done = false;
+	try {
+		uint64_t victim = 0;
+		segment_info info;
+		{
+			internal::shared_lock_guard<mutex_type> lock(mtx);
+			double best = -1;
+			for (auto &s : segments) {
+				if (!Qualifies(s.first))
+					continue;
+				auto &i = s.second;
+				double ratio = i.tail ? double(i.dead) / double(i.tail) : 1;
+				if (ratio > best) {
+					best = ratio;
+					victim = s.first;
+				}
+			}
+			if (victim != 0)
+				info = segments.at(victim);
+		}
+
+		if (victim == 0)
+			return internal::background_task::idle;
+
+		auto offset = SlotOffset(info.slot);
+		auto data = make_aligned(info.tail);
+		std::vector<internal::io_op> ops;
+		for (uint64_t pos = 0; pos < info.tail; pos += BATCH_BYTES)
+			ops.push_back(internal::io_op::read(
+				data.get() + pos, std::min(BATCH_BYTES, info.tail - pos),
+				offset + pos));
+		io->run(ops.data(), ops.size());
+
+		struct copy {
+			const record *r;
+			location old;
+		};
+		std::vector<copy> copies;
+		{
+			internal::shared_lock_guard<mutex_type> lock(mtx);
+			bool older = segments.begin()->first < victim;
+
+			uint64_t pos = 0;
+			while (auto batch = valid_batch(data.get(), info.tail, pos, victim)) {
+				for_each_record(data.get(), pos, [&](const record *r,
+								     uint64_t off) {
+					location loc{offset + off, victim, r->version,
+						     static_cast<uint32_t>(record_size(r))};
+					auto it = index.find(std::string(key_of(r).data(),
+									 key_of(r).size()));
+					if (r->value_size == TOMBSTONE) {
+						if (older && it == index.end())
+							copies.push_back(copy{r, loc});
+					} else if (it != index.end() && it->second == loc) {
+						copies.push_back(copy{r, loc});
+					}
+				});
+				pos += batch;
+			}
+		}
+
+		if (!copies.empty()) {
+			std::unique_lock<std::mutex> lock(write_mtx);
+			std::vector<std::shared_ptr<batch_state>> states;
+			for (auto &c : copies) {
+				bool tombstone = c.r->value_size == TOMBSTONE;
+				auto state = Enqueue(key_of(c.r),
+						     tombstone ? string_view() : value_of(c.r),
+						     tombstone, c.r->version, &c.old);
+				if (states.empty() || states.back() != state)
+					states.push_back(state);
+			}
+			Commit(lock, states);
+		}
+
+		FreeSegment(victim);
+		done = true;
+	} catch (...) {
+		/* e.g. an I/O error, retried later */
+	}
+
+	auto elapsed = clock_type::now() - begin;
+	if (!done)
+		elapsed = std::max<clock_type::duration>(elapsed, std::chrono::seconds(1));
+
+	return std::chrono::duration_cast<clock_type::duration>(
+		elapsed * (100 - gc_budget_percent) / gc_budget_percent);
+}
+
+static factory_registerer register_blockstore(
+	std::unique_ptr<engine_base::factory_base>(new blockstore_factory));
+
+} // namespace kv
+} // namespace pmem
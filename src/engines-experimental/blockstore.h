@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_BLOCKSTORE_H
+#define LIBPMEMKV_BLOCKSTORE_H
+
+#include "../engine.h"
+#include "../io_ring.h"
+#include "../sharded_shared_mutex.h"
+#include "../thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace blockstore
+{
+
+/* unit of I/O and of the cache, offsets of all writes are aligned to it */
+static constexpr uint64_t BLOCK_SIZE = 4096;
+/* default size of a segment of the file */
+static constexpr uint64_t SEGMENT_SIZE = 16 << 20;
+/* default size of the buffer pool */
+static constexpr uint64_t CACHE_SIZE = 64 << 20;
+/* default number of operations submitted to io_uring at once */
+static constexpr uint64_t QUEUE_DEPTH = 64;
+/* pending records are split into batches of (about) that many bytes */
+static constexpr uint64_t BATCH_BYTES = 1 << 20;
+/* minimal percent of dead bytes of a segment, for it to be cleaned */
+static constexpr uint64_t GC_THRESHOLD = 50;
+/* percent of a worker's time the cleaner may use */
+static constexpr uint64_t GC_BUDGET_PERCENT = 10;
+/* value size of a record which marks its key removed */
+static constexpr uint32_t TOMBSTONE = ~0U;
+
+static constexpr uint64_t SUPERBLOCK_MAGIC = 0x534b4c42564b4d50ULL; /* "PMKVBLKS" */
+static constexpr uint64_t BATCH_MAGIC = 0x48435442564b4d50ULL;	    /* "PMKVBTCH" */
+static constexpr uint64_t VERSION = 1;
+
+/* the first block of the file */
+struct superblock {
+	uint64_t magic;
+	uint64_t version;
+	uint64_t block_size;
+	uint64_t segment_size;
+};
+
+/*
+ * Batch of records, written by a single write at a block boundary of its
+ * segment and padded to the block size. Batches of a segment follow each
+ * other, the first one which isn't valid (or belongs to a previous use of the
+ * segment - it has a different seq) ends the segment.
+ */
+struct batch_header {
+	uint64_t magic;
+	/* seq of the segment */
+	uint64_t seq;
+	/* bytes of records following the header */
+	uint64_t size;
+	/* crc32c of the header (with crc set to 0) and the records */
+	uint32_t crc;
+	uint32_t records;
+};
+
+/*
+ * Record is the header followed by the key and the value, padded to 8 bytes.
+ * Versions order records of a key, whatever segments they are in - records
+ * relocated by the cleaner keep their versions.
+ */
+struct record {
+	uint32_t key_size;
+	uint32_t value_size;
+	uint64_t version;
+};
+
+/* DRAM state of a segment */
+struct segment_info {
+	/* number of the segment's slot in the file */
+	uint64_t slot;
+	/* bytes of written batches (block aligned) */
+	uint64_t tail;
+	/* bytes of dead records, headers of batches and padding */
+	uint64_t dead;
+};
+
+/* record of a key, in the segment 'seq' */
+struct location {
+	/* offset of the record in the file */
+	uint64_t offset;
+	uint64_t seq;
+	uint64_t version;
+	uint32_t size;
+
+	bool operator==(const location &other) const
+	{
+		return offset == other.offset && seq == other.seq;
+	}
+};
+
+struct free_deleter {
+	void operator()(char *p) const
+	{
+		std::free(p);
+	}
+};
+
+/* buffer aligned to BLOCK_SIZE, as required by O_DIRECT */
+using aligned_buffer = std::unique_ptr<char[], free_deleter>;
+
+aligned_buffer make_aligned(std::size_t size);
+
+/**
+ * DRAM buffer pool of blocks of the file - a fixed number of frames split
+ * into shards (by block number), each with its own lock and CLOCK hand.
+ */
+class block_cache {
+public:
+	static constexpr std::size_t SHARDS = 16;
+
+	block_cache(std::size_t bytes);
+
+	/* Copies the block to 'dst', returns false if it's not cached */
+	bool read(uint64_t block, char *dst);
+	void insert(uint64_t block, const char *src);
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+
+private:
+	struct frame {
+		uint64_t block;
+		bool referenced;
+	};
+
+	struct shard {
+		std::mutex mtx;
+		std::unordered_map<uint64_t, std::size_t> frames_map;
+		std::vector<frame> frames;
+		aligned_buffer data;
+		std::size_t hand = 0;
+	};
+
+	std::size_t frames_per_shard;
+	std::unique_ptr<shard[]> shards;
+};
+
+} /* namespace blockstore */
+} /* namespace internal */
+
+/**
+ * Persistent engine for regular files (e.g. on NVMe drives), for hosts without
+ * persistent memory. The file is log-structured (as in logstore): puts and
+ * removes append records to batches, which are written to the current
+ * segment of the file - a block aligned write through io_uring (with
+ * O_DIRECT, bypassing the page cache), followed by fdatasync. Concurrent
+ * writers are committed together: one of them writes all pending batches
+ * in a single submission, while the others wait.
+ *
+ * A hash map in DRAM, rebuilt by replaying the segments when the file is
+ * opened, maps keys to their records. Values are read from the file through
+ * a DRAM buffer pool of blocks; misses of get_batch and get_all are read by
+ * a single submission.
+ *
+ * Segments with enough dead bytes are cleaned in the background: their live
+ * records are appended again and the segment's slot in the file is reused.
+ */
+class blockstore : public engine_base {
+public:
+	blockstore(std::unique_ptr<internal::config> cfg);
+	~blockstore();
+
+	blockstore(const blockstore &) = delete;
+	blockstore &operator=(const blockstore &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status get_all(get_kv_callback *callback, void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status get_batch(const string_view *keys, std::size_t n,
+			 get_kv_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
+	status remove(string_view key) final;
+
+	status stats(internal::stats_sink &sink) final;
+
+private:
+	using mutex_type = internal::sharded_shared_mutex;
+	using clock_type = internal::background_task::clock_type;
+	using location = internal::blockstore::location;
+
+	/* state of a pending batch, shared with writers waiting for it */
+	struct batch_state {
+		bool done = false;
+		std::exception_ptr error;
+	};
+
+	struct pending_record {
+		/* offset of the record in the batch's data */
+		uint32_t pos;
+		uint32_t size;
+		bool tombstone;
+		/* copy of the record at 'old' (made by the cleaner) */
+		bool relocated;
+		location old;
+	};
+
+	struct pending_batch {
+		std::string data;
+		std::vector<pending_record> records;
+		std::shared_ptr<batch_state> state;
+	};
+
+	void Open(internal::config &cfg);
+	void Recover();
+
+	uint64_t SlotOffset(uint64_t slot) const
+	{
+		return internal::blockstore::BLOCK_SIZE + slot * segment_size;
+	}
+
+	/*
+	 * Reads blocks of the records, a record starts in its buffer at offset
+	 * (of the record) modulo BLOCK_SIZE.
+	 */
+	void ReadRecords(const location *locs, std::size_t n,
+			 std::vector<internal::blockstore::aligned_buffer> &out);
+
+	/* Throws if the record doesn't fit in a segment */
+	void CheckRecord(string_view key, string_view value) const;
+	/* Appends the record to the pending batches, must hold write_mtx */
+	std::shared_ptr<batch_state> Enqueue(string_view key, string_view value,
+					     bool tombstone, uint64_t version,
+					     const location *old);
+	/* Waits until the batches are written, one of the writers writes them */
+	void Commit(std::unique_lock<std::mutex> &lock,
+		    const std::vector<std::shared_ptr<batch_state>> &states);
+	void Flush(std::deque<pending_batch> &batches);
+	void Apply(const pending_batch &batch, uint64_t seq, uint64_t offset);
+
+	void NewSegment();
+	void FreeSegment(uint64_t seq);
+	/* Marks the bytes dead, waking the cleaner if their segment qualifies */
+	void AddDead(uint64_t seq, uint64_t bytes);
+	bool Qualifies(uint64_t seq) const;
+
+	/* Cleans a whole segment, returns the delay of the next step */
+	clock_type::duration CleanStep();
+
+	int fd = -1;
+	bool direct_io;
+	uint64_t segment_size;
+	uint64_t gc_threshold;
+	uint64_t gc_budget_percent;
+
+	std::unique_ptr<internal::io_ring> io;
+	std::unique_ptr<internal::blockstore::block_cache> cache;
+
+	std::unordered_map<std::string, location> index;
+	/* segments by their seq, the last one is the current segment */
+	std::map<uint64_t, internal::blockstore::segment_info> segments;
+	/* slots of the file which hold no segment */
+	std::vector<uint64_t> free_slots;
+	uint64_t slots = 0;
+	uint64_t next_seq = 1;
+	/* the current segment takes no more batches (e.g. after a failed write) */
+	bool sealed = true;
+
+	uint64_t dead_bytes = 0;
+	uint64_t cleaned_segments = 0;
+	uint64_t relocated_bytes = 0;
+	uint64_t flushes = 0;
+	uint64_t batches_written = 0;
+
+	/* readers hold shared lock, index and segments are changed under exclusive */
+	mutable mutex_type mtx;
+
+	/* protects pending batches, versions and 'flushing' */
+	std::mutex write_mtx;
+	std::condition_variable write_cv;
+	std::deque<pending_batch> pending;
+	uint64_t next_version = 1;
+	bool flushing = false;
+
+	std::unique_ptr<internal::background_task> cleaner;
+};
+
+class blockstore_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new blockstore(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "blockstore";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_BLOCKSTORE_H */
@@ -5,21 +5,71 @@
 
 #include "../iterator.h"
 #include "../out.h"
+#include "../parallel_scan.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <thread>
 
 namespace pmem
 {
 namespace kv
 {
 
+constexpr std::size_t csmap::PURGE_BATCH;
+
+/* percent of elements defragmented at once by the background defrag */
+static const double BACKGROUND_DEFRAG_SLICE = 1;
+
 csmap::csmap(std::unique_ptr<internal::config> cfg)
-    : pmemobj_engine_base(cfg, "pmemkv_csmap"), config(std::move(cfg))
+    : pmemobj_engine_base(cfg, "pmemkv_csmap_v2"),
+      mtx(std::thread::hardware_concurrency()),
+      config(std::move(cfg)),
+      tombstones(0)
 {
+	uint64_t snapshot_reads_cfg = 0;
+	config->get_uint64("snapshot_reads", &snapshot_reads_cfg);
+	snapshot_reads = snapshot_reads_cfg != 0;
+
+	internal::open_phase phase("csmap.recover");
 	Recover();
+	filter = internal::bloom_filter::from_config(*config);
+	if (filter) {
+		phase.next("csmap.filter");
+		rebuild_filter();
+	}
+	phase.end();
+	purge_task.reset(new internal::background_task([this] { return purge_step(); }));
+	prefetcher.reset(new internal::prefetch_queue(
+		[this](const internal::prefetch_request &r) { prefetch_walk(r); }));
+
+	uint64_t defrag_budget = 0;
+	config->get_uint64("background_defrag", &defrag_budget);
+	if (defrag_budget > 0) {
+		defrag_svc.reset(new internal::defrag_service(
+			[this](double start, double amount) {
+				return defrag(start, amount);
+			},
+			static_cast<double>(defrag_budget), BACKGROUND_DEFRAG_SLICE));
+	}
 	LOG("Started ok");
 }
 
 csmap::~csmap()
 {
+	/* waits for the running walk, defrag and purge */
+	prefetcher.reset();
+	defrag_svc.reset();
+	purge_task.reset();
+
+	/* no tombstones are left after a clean shutdown */
+	purge(purge_keys);
+	auto pmem_ptr =
+		static_cast<internal::csmap::pmem_type *>(pmemobj_direct(*root_oid));
+	pmem_ptr->purge_pending = 0;
+	pmpool.persist(pmem_ptr->purge_pending);
+
 	LOG("Stopped ok");
 }
 
@@ -32,7 +82,10 @@ status csmap::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
-	cnt = container->size();
+	/* tombstones are unlinked concurrently, the number may be off for a while */
+	auto removed = tombstones.load();
+	auto size = container->size();
+	cnt = size > removed ? size - removed : 0;
 
 	return status::OK;
 }
@@ -47,7 +100,7 @@ status csmap::count_above(string_view key, std::size_t &cnt)
 	auto first = container->upper_bound(key);
 	auto last = container->end();
 
-	cnt = internal::distance(first, last);
+	cnt = count(first, last);
 
 	return status::OK;
 }
@@ -62,7 +115,7 @@ status csmap::count_equal_above(string_view key, std::size_t &cnt)
 	auto first = container->lower_bound(key);
 	auto last = container->end();
 
-	cnt = internal::distance(first, last);
+	cnt = count(first, last);
 
 	return status::OK;
 }
@@ -77,7 +130,7 @@ status csmap::count_equal_below(string_view key, std::size_t &cnt)
 	auto first = container->begin();
 	auto last = container->upper_bound(key);
 
-	cnt = internal::distance(first, last);
+	cnt = count(first, last);
 
 	return status::OK;
 }
@@ -92,7 +145,7 @@ status csmap::count_below(string_view key, std::size_t &cnt)
 	auto first = container->begin();
 	auto last = container->lower_bound(key);
 
-	cnt = internal::distance(first, last);
+	cnt = count(first, last);
 
 	return status::OK;
 }
@@ -108,7 +161,7 @@ status csmap::count_between(string_view key1, string_view key2, std::size_t &cnt
 		auto first = container->upper_bound(key1);
 		auto last = container->lower_bound(key2);
 
-		cnt = internal::distance(first, last);
+		cnt = count(first, last);
 	} else {
 		cnt = 0;
 	}
@@ -116,15 +169,154 @@ status csmap::count_between(string_view key1, string_view key2, std::size_t &cnt
 	return status::OK;
 }
 
+/*
+ * Counts elements in the range [first, last), except removed ones
+ * (their flags are read only if there are any tombstones).
+ */
+std::size_t csmap::count(typename container_type::iterator first,
+			 typename container_type::iterator last)
+{
+	if (tombstones.load() == 0)
+		return internal::distance(first, last);
+
+	std::size_t cnt = 0;
+	for (auto it = first; it != last; ++it) {
+		if (read(it->second, generation, nullptr))
+			++cnt;
+	}
+
+	return cnt;
+}
+
+/*
+ * Reads the record without locking it (copies the value, if requested, so it
+ * can't be changed under the callback). Returns false if it's removed.
+ *
+ * A value stored inline (in the string of the record) is copied optimistically,
+ * as the node is not freed while the global lock is held. A longer one is in
+ * a separate allocation, which a writer frees while changing the value, so it's
+ * copied with the record locked.
+ */
+bool csmap::read(const internal::csmap::mapped_type &record, uint64_t generation,
+		 std::string *value, uint64_t *version)
+{
+	auto inline_begin = reinterpret_cast<const char *>(&record.val);
+	auto inline_end = inline_begin + sizeof(record.val);
+
+	while (true) {
+		auto v = record.mtx.read_begin(generation);
+		bool deleted = record.deleted;
+		auto size = record.val.size();
+		auto data = record.val.c_str();
+
+		/* data and size are consistent, data may be freed only after that */
+		if (!record.mtx.validate(v))
+			continue;
+
+		if (value && !deleted &&
+		    (data < inline_begin || data + size > inline_end)) {
+			auto &mtx = const_cast<node_mutex_type &>(record.mtx);
+			unique_node_lock_type lock(mtx, generation);
+			deleted = record.deleted;
+			if (!deleted)
+				value->assign(record.val.c_str(), record.val.size());
+			if (version)
+				*version = record.mtx.next_version();
+
+			return !deleted;
+		}
+
+		if (value && !deleted)
+			value->assign(data, size);
+
+		if (record.mtx.validate(v)) {
+			if (version)
+				*version = v;
+			return !deleted;
+		}
+	}
+}
+
+/*
+ * Reads the record and checks if a version of it was saved for the snapshot
+ * in the meantime - if not, the version of the read is validated, as a writer
+ * might have saved one (and changed the record) after the check.
+ */
+bool csmap::read(const internal::csmap::mapped_type &record, uint64_t generation,
+		 std::string *value, const internal::csmap::snapshot &snap)
+{
+	if (!snap)
+		return read(record, generation, value);
+
+	while (true) {
+		uint64_t version;
+		bool found = read(record, generation, value, &version);
+
+		bool deleted;
+		if (snap.find(record, value, deleted))
+			return !deleted;
+
+		if (record.mtx.validate(version))
+			return found;
+	}
+}
+
+bool csmap::read_size(const internal::csmap::mapped_type &record, uint64_t generation,
+		      std::size_t &size)
+{
+	while (true) {
+		auto v = record.mtx.read_begin(generation);
+		bool deleted = record.deleted;
+		size = record.val.size();
+
+		if (record.mtx.validate(v))
+			return !deleted;
+	}
+}
+
 status csmap::iterate(typename container_type::iterator first,
 		      typename container_type::iterator last, get_kv_callback *callback,
 		      void *arg)
 {
+	/* with snapshot reads, the whole range is read as of one point in time */
+	internal::csmap::snapshot snap;
+	snap.take(snapshot_reads ? &versions : nullptr);
+
+	return iterate(first, last, callback, arg, snap);
+}
+
+status csmap::iterate(typename container_type::iterator first,
+		      typename container_type::iterator last, get_kv_callback *callback,
+		      void *arg, const internal::csmap::snapshot &snap)
+{
+	std::string value;
 	for (auto it = first; it != last; ++it) {
-		shared_node_lock_type lock(it->second.mtx);
+		if (!read(it->second, generation, &value, snap))
+			continue;
 
-		auto ret = callback(it->first.c_str(), it->first.size(),
-				    it->second.val.c_str(), it->second.val.size(), arg);
+		auto ret = callback(it->first.c_str(), it->first.size(), value.c_str(),
+				    value.size(), arg);
+
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return status::OK;
+}
+
+/* as iterate(), but values are not copied, only checked to be not deleted */
+status csmap::iterate_keys(typename container_type::iterator first,
+			   typename container_type::iterator last,
+			   get_kv_callback *callback, void *arg)
+{
+	internal::csmap::snapshot snap;
+	snap.take(snapshot_reads ? &versions : nullptr);
+
+	for (auto it = first; it != last; ++it) {
+		if (!read(it->second, generation, nullptr, snap))
+			continue;
+
+		auto ret = callback(it->first.c_str(), it->first.size(), nullptr, 0, arg);
 
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
@@ -215,13 +407,195 @@ status csmap::get_between(string_view key1, string_view key2, get_kv_callback *c
 	return status::OK;
 }
 
+status csmap::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_keys_all");
+	check_outside_tx();
+
+	shared_global_lock_type lock(mtx);
+
+	return iterate_keys(container->begin(), container->end(), callback, arg);
+}
+
+status csmap::get_keys_between(string_view key1, string_view key2,
+			       get_kv_callback *callback, void *arg)
+{
+	LOG("get_keys_between for key1=" << key1.data() << ", key2=" << key2.data());
+	check_outside_tx();
+
+	if (container->key_comp()(key1, key2)) {
+		shared_global_lock_type lock(mtx);
+
+		auto first = container->upper_bound(key1);
+		auto last = container->lower_bound(key2);
+		return iterate_keys(first, last, callback, arg);
+	}
+
+	return status::OK;
+}
+
+status csmap::prefetch(string_view key)
+{
+	LOG("prefetch key=" << std::string(key.data(), key.size()));
+	prefetcher->submit(key);
+
+	return status::OK;
+}
+
+status csmap::prefetch_range(string_view key1, string_view key2)
+{
+	LOG("prefetch_range for key1=" << key1.data() << ", key2=" << key2.data());
+	prefetcher->submit(key1, key2);
+
+	return status::OK;
+}
+
+/*
+ * Searches of the skip list read the towers on the path to the keys, values
+ * are prefetched - as in read(), the record is not locked, so its value is
+ * prefetched only if it wasn't changed while its address was read. The range
+ * is walked in chunks, each under its own hold of the global lock (see
+ * prefetch_queue::chunk_size).
+ */
+void csmap::prefetch_walk(const internal::prefetch_request &request)
+{
+	std::string key1 = request.key1;
+	string_view key2 = request.point ? string_view(request.key1)
+					 : string_view(request.key2);
+	if (container->key_comp()(key2, string_view(key1)))
+		return;
+
+	while (true) {
+		shared_global_lock_type lock(mtx);
+
+		auto last = container->upper_bound(key2);
+		auto it = container->lower_bound(string_view(key1));
+		for (std::size_t n = 0; it != last && n < internal::prefetch_queue::chunk_size;
+		     ++it, ++n) {
+			auto v = it->second.mtx.read_begin(generation);
+			auto size = it->second.val.size();
+			auto data = it->second.val.c_str();
+
+			if (it->second.mtx.validate(v))
+				internal::prefetch_bytes(data, size);
+		}
+
+		if (it == last)
+			return;
+
+		key1.assign(it->first.data(), it->first.size());
+	}
+}
+
+/*
+ * Skip list has no inner nodes to split the range at, so (like in
+ * radix::get_all_parallel) it's split by keys: all keys in the range share
+ * the prefix of the first and the last one, subranges start at keys of the
+ * prefix followed by each possible next byte. Their starts are looked up and
+ * grouped (in order) into partitions, which are scanned in parallel under the
+ * global lock taken by this thread (and, with snapshot reads, as of a single
+ * snapshot).
+ */
+status csmap::get_between_parallel(string_view key1, string_view key2,
+				   std::size_t partitions, get_kv_callback *callback,
+				   void **args)
+{
+	LOG("get_between_parallel for key1=" << key1.data() << ", key2=" << key2.data());
+	check_outside_tx();
+
+	/* keys are split bytewise, which matches only the binary order */
+	if (!container->key_comp().is_binary())
+		return engine_base::get_between_parallel(key1, key2, partitions, callback,
+							 args);
+
+	if (!container->key_comp()(key1, key2))
+		return status::OK;
+
+	shared_global_lock_type lock(mtx);
+
+	auto first = container->upper_bound(key1);
+	auto last = container->lower_bound(key2);
+
+	std::vector<container_type::iterator> subranges;
+	if (first != last) {
+		auto back = container->find_lower(key2);
+		string_view low(first->first.data(), first->first.size());
+		string_view high(back->first.data(), back->first.size());
+
+		std::size_t prefix = 0;
+		while (prefix < low.size() && prefix < high.size() &&
+		       low.data()[prefix] == high.data()[prefix])
+			++prefix;
+
+		subranges.push_back(first);
+
+		if (prefix < high.size()) {
+			std::string key(high.data(), prefix + 1);
+			unsigned c = prefix < low.size()
+				? static_cast<unsigned char>(low.data()[prefix]) + 1u
+				: 0u;
+			unsigned end = static_cast<unsigned char>(high.data()[prefix]);
+			for (; c <= end; ++c) {
+				key.back() = static_cast<char>(c);
+				auto it = container->lower_bound(string_view(key));
+				if (it != subranges.back())
+					subranges.push_back(it);
+			}
+		}
+	}
+
+	partitions = std::max<std::size_t>(1, std::min(partitions, subranges.size()));
+
+	std::vector<container_type::iterator> bounds;
+	bounds.reserve(partitions + 1);
+	for (std::size_t i = 0; i < partitions && !subranges.empty(); ++i)
+		bounds.push_back(subranges[i * subranges.size() / partitions]);
+	bounds.push_back(last);
+
+	internal::csmap::snapshot snap;
+	snap.take(snapshot_reads ? &versions : nullptr);
+
+	return internal::parallel_scan(
+		bounds.size() - 1, callback, args,
+		[&](std::size_t partition, get_kv_callback *cb, void *arg) {
+			return iterate(bounds[partition], bounds[partition + 1], cb, arg,
+				       snap);
+		});
+}
+
+status csmap::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+
+	if (!container->key_comp().is_binary())
+		return engine_base::get_prefix(prefix, callback, arg);
+
+	shared_global_lock_type lock(mtx);
+
+	std::string upper;
+	auto first = container->lower_bound(prefix);
+	auto last = internal::prefix_upper_bound(prefix, upper)
+		? container->lower_bound(string_view(upper))
+		: container->end();
+
+	return iterate(first, last, callback, arg);
+}
+
 status csmap::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
 	shared_global_lock_type lock(mtx);
-	return container->contains(key) ? status::OK : status::NOT_FOUND;
+	if (filter && !filter->may_contain(key))
+		return status::NOT_FOUND;
+
+	auto it = container->find(key);
+	if (it == container->end())
+		return status::NOT_FOUND;
+
+	return read(it->second, generation, nullptr) ? status::OK : status::NOT_FOUND;
 }
 
 status csmap::get(string_view key, get_v_callback *callback, void *arg)
@@ -230,17 +604,36 @@ status csmap::get(string_view key, get_v_callback *callback, void *arg)
 	check_outside_tx();
 
 	shared_global_lock_type lock(mtx);
-	auto it = container->find(key);
+	auto it = (filter && !filter->may_contain(key)) ? container->end()
+							: container->find(key);
 	if (it != container->end()) {
-		shared_node_lock_type lock(it->second.mtx);
-		callback(it->second.val.c_str(), it->second.val.size(), arg);
-		return status::OK;
+		static thread_local std::string value;
+		if (read(it->second, generation, &value)) {
+			callback(value.c_str(), value.size(), arg);
+			return status::OK;
+		}
 	}
 
 	LOG("  key not found");
 	return status::NOT_FOUND;
 }
 
+/* unlike get(), the value is not copied */
+status csmap::value_size(string_view key, std::size_t &size)
+{
+	LOG("value_size key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	shared_global_lock_type lock(mtx);
+	auto it = (filter && !filter->may_contain(key)) ? container->end()
+							: container->find(key);
+	if (it != container->end() && read_size(it->second, generation, size))
+		return status::OK;
+
+	LOG("  key not found");
+	return status::NOT_FOUND;
+}
+
 status csmap::put(string_view key, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
@@ -249,25 +642,373 @@ status csmap::put(string_view key, string_view value)
 
 	shared_global_lock_type lock(mtx);
 
-	auto result = container->try_emplace(key, value);
+	/* the key is added before it's visible to concurrent readers */
+	if (filter)
+		filter->add(key);
+
+	/*
+	 * With snapshot reads, a new key is inserted as a tombstone and revived
+	 * (with the record locked), so the insertion is saved as any other change.
+	 */
+	auto result = snapshot_reads ? container->try_emplace(key, string_view(), true)
+				     : container->try_emplace(key, value);
+	if (result.second && snapshot_reads)
+		tombstones++;
 
-	if (result.second == false) {
+	if (result.second == false || snapshot_reads) {
 		auto &it = result.first;
-		unique_node_lock_type lock(it->second.mtx);
-		pmem::obj::transaction::run(pmpool, [&] {
-			it->second.val.assign(value.data(), value.size());
-		});
+		unique_node_lock_type lock(it->second.mtx, generation);
+		bool revived = it->second.deleted;
+		versions.save(it->second);
+		try {
+			pmem::obj::transaction::run(pmpool, [&] {
+				it->second.val.assign(value.data(), value.size());
+				if (revived)
+					it->second.deleted = 0;
+			});
+		} catch (...) {
+			lock.unlock();
+			if (result.second)
+				schedule_purge({std::string(key.data(), key.size())});
+			throw;
+		}
+		if (revived)
+			tombstones--;
+	}
+
+	if (result.second && filter) {
+		filter->inserted();
+		lock.unlock();
+		grow_filter();
 	}
 
 	return status::OK;
 }
 
+status csmap::update(string_view key, update_callback *callback, void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	shared_global_lock_type lock(mtx);
+
+	const char *new_value;
+	size_t new_valuebytes;
+	/* tombstone inserted by this call, in the snapshot mode (see put()) */
+	bool inserted = false;
+	while (true) {
+		auto it = container->find(key);
+		if (it != container->end()) {
+			unique_node_lock_type node_lock(it->second.mtx,
+							generation);
+			/* removed record is not visible, it's inserted again */
+			bool revived = it->second.deleted;
+			int ret = revived ? callback(nullptr, 0, &new_value,
+						     &new_valuebytes, arg)
+					  : callback(it->second.val.c_str(),
+						     it->second.val.size(), &new_value,
+						     &new_valuebytes, arg);
+			if (ret != 0) {
+				node_lock.unlock();
+				if (inserted)
+					schedule_purge(
+						{std::string(key.data(), key.size())});
+				return status::STOPPED_BY_CB;
+			}
+
+			versions.save(it->second);
+			try {
+				pmem::obj::transaction::run(pmpool, [&] {
+					it->second.val.assign(new_value, new_valuebytes);
+					if (revived)
+						it->second.deleted = 0;
+				});
+			} catch (...) {
+				node_lock.unlock();
+				if (inserted)
+					schedule_purge(
+						{std::string(key.data(), key.size())});
+				throw;
+			}
+			if (revived)
+				tombstones--;
+
+			node_lock.unlock();
+			if (inserted && filter) {
+				filter->inserted();
+				lock.unlock();
+				grow_filter();
+			}
+
+			return status::OK;
+		}
+
+		if (snapshot_reads) {
+			if (filter)
+				filter->add(key);
+			if (container->try_emplace(key, string_view(), true).second) {
+				tombstones++;
+				inserted = true;
+			}
+			continue;
+		}
+
+		if (callback(nullptr, 0, &new_value, &new_valuebytes, arg) != 0)
+			return status::STOPPED_BY_CB;
+
+		if (filter)
+			filter->add(key);
+
+		auto result =
+			container->try_emplace(key, string_view(new_value, new_valuebytes));
+		if (result.second) {
+			if (filter) {
+				filter->inserted();
+				lock.unlock();
+				grow_filter();
+			}
+			return status::OK;
+		}
+
+		/* record was inserted by another thread, update its value */
+	}
+}
+
 status csmap::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+
+	shared_global_lock_type lock(mtx);
+	auto it = container->find(key);
+	if (it == container->end())
+		return status::NOT_FOUND;
+
+	{
+		unique_node_lock_type node_lock(it->second.mtx, generation);
+		if (it->second.deleted)
+			return status::NOT_FOUND;
+
+		versions.save(it->second);
+		pmem::obj::transaction::run(pmpool, [&] { it->second.deleted = 1; });
+		tombstones++;
+	}
+
+	schedule_purge({std::string(key.data(), key.size())});
+
+	return status::OK;
+}
+
+/* the value is passed to the callback under the node lock of its removal */
+status csmap::take(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("take key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	shared_global_lock_type lock(mtx);
+	auto it = (filter && !filter->may_contain(key)) ? container->end()
+							: container->find(key);
+	if (it == container->end())
+		return status::NOT_FOUND;
+
+	{
+		unique_node_lock_type node_lock(it->second.mtx, generation);
+		if (it->second.deleted)
+			return status::NOT_FOUND;
+
+		callback(it->second.val.c_str(), it->second.val.size(), arg);
+
+		versions.save(it->second);
+		pmem::obj::transaction::run(pmpool, [&] { it->second.deleted = 1; });
+		tombstones++;
+	}
+
+	schedule_purge({std::string(key.data(), key.size())});
+
+	return status::OK;
+}
+
+/*
+ * Erases the range under the exclusive lock, after a single lookup of its
+ * bounds - nodes are unlinked one after another, without searching for them.
+ */
+status csmap::remove_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("remove_between for key1=" << key1.data() << ", key2=" << key2.data());
+	check_outside_tx();
+
+	cnt = 0;
+	if (!container->key_comp()(key1, key2))
+		return status::OK;
+
+	unique_global_lock_type lock(mtx);
+
+	auto it = container->upper_bound(key1);
+	auto last = container->lower_bound(key2);
+	while (it != last) {
+		if (it->second.deleted)
+			tombstones--;
+		else
+			++cnt;
+		it = container->unsafe_erase(it);
+	}
+
+	return status::OK;
+}
+
+/*
+ * Relocates data of keys and values which don't fit in nodes (as data of
+ * pmem::obj::string) of the elements in the range, under the exclusive lock.
+ * Nodes are linked by a pointer per level of the skip list, so they are not
+ * relocated. The map has no index of positions, so the range is found by
+ * walking from the first element (tombstones are counted as well).
+ */
+status csmap::defrag(double start_percent, double amount_percent)
+{
+	LOG("defrag: start_percent = " << start_percent
+				       << " amount_percent = " << amount_percent);
+	check_outside_tx();
+
+	try {
+		unique_global_lock_type lock(mtx);
+
+		auto range = defrag_positions(container->size(), start_percent,
+					      amount_percent);
+		pmem::obj::defrag my_defrag(pmpool);
+
+		auto it = container->begin();
+		for (std::size_t i = 0; i < range.second && it != container->end();
+		     ++i, ++it) {
+			if (i < range.first)
+				continue;
+			/* keys are const in the map, only their data is moved */
+			my_defrag.add(const_cast<internal::csmap::key_type &>(it->first));
+			my_defrag.add(it->second.val);
+		}
+
+		my_defrag.run();
+	} catch (std::range_error &e) {
+		out_err("defrag", e.what());
+		return status::INVALID_ARGUMENT;
+	} catch (pmem::defrag_error &e) {
+		out_err("defrag", e.what());
+		return status::DEFRAG_ERROR;
+	}
+
+	return status::OK;
+}
+
+status csmap::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	internal::lock_class_stats locks;
+	locks.add(mtx);
+	locks.report(sink, "csmap_global");
+
+	std::size_t cnt = 0;
+	count_all(cnt);
+	report_memory(sink, cnt);
+
+	return status::OK;
+}
+
+/*
+ * Keys and values which don't fit in nodes of the map are allocated separately
+ * (as data of pmem::obj::string), the rest are nodes (with their locks).
+ */
+internal::memory_stats csmap::memory_types()
+{
+	internal::memory_stats mem("nodes");
+	mem.add_type(pmem::detail::type_num<internal::csmap::pmem_type>(), "root",
+		     sizeof(internal::csmap::pmem_type));
+	mem.add_type(pmem::detail::type_num<char>(), "strings");
+
+	return mem;
+}
+
+void csmap::rebuild_filter()
+{
+	filter->reset(container->size());
+	for (auto &e : *container)
+		filter->add(string_view(e.first.cdata(), e.first.size()));
+}
+
+void csmap::grow_filter()
+{
+	if (!filter->full())
+		return;
+
 	unique_global_lock_type lock(mtx);
-	return container->unsafe_erase(key) > 0 ? status::OK : status::NOT_FOUND;
+	if (filter->full())
+		rebuild_filter();
+}
+
+/* Passes keys of removed records to the background task */
+void csmap::schedule_purge(std::vector<std::string> &&keys)
+{
+	if (keys.empty())
+		return;
+
+	bool notify;
+	{
+		std::unique_lock<std::mutex> lock(purge_mtx);
+		purge_keys.insert(purge_keys.end(), std::make_move_iterator(keys.begin()),
+				  std::make_move_iterator(keys.end()));
+		notify = purge_keys.size() >= PURGE_BATCH;
+	}
+	if (notify)
+		purge_task->wake();
+}
+
+/*
+ * Unlinks nodes of the given keys, if they are still removed (they might
+ * have been put again, or unlinked by remove_between).
+ */
+void csmap::purge(const std::vector<std::string> &keys)
+{
+	for (auto &key : keys) {
+		auto it = container->find(string_view(key.data(), key.size()));
+		if (it != container->end() && it->second.deleted) {
+			container->unsafe_erase(it);
+			tombstones--;
+		}
+	}
+}
+
+/*
+ * Unlinks removed nodes in batches. unsafe_erase() can't run concurrently
+ * with any other operation, so an exclusive lock is needed, but it's only
+ * tried - if readers (e.g. a long-living iterator) don't leave soon, the
+ * task lets them in again and retries later.
+ */
+internal::background_task::clock_type::duration csmap::purge_step()
+{
+	std::vector<std::string> keys;
+	{
+		std::unique_lock<std::mutex> lock(purge_mtx);
+		if (purge_keys.size() < PURGE_BATCH)
+			return internal::background_task::idle;
+		keys.swap(purge_keys);
+	}
+
+	if (!mtx.try_lock_for(std::chrono::milliseconds(1))) {
+		/* retried later, destructor purges the rest if it comes first */
+		std::unique_lock<std::mutex> lock(purge_mtx);
+		purge_keys.insert(purge_keys.end(), std::make_move_iterator(keys.begin()),
+				  std::make_move_iterator(keys.end()));
+		return std::chrono::milliseconds(10);
+	}
+
+	purge(keys);
+	mtx.unlock();
+
+	return internal::background_task::idle;
 }
 
 void csmap::Recover()
@@ -277,9 +1018,26 @@ void csmap::Recover()
 			pmemobj_direct(*root_oid));
 
 		container = &pmem_ptr->map;
+		internal::open_phase phase("csmap.runtime_initialize");
 		container->runtime_initialize();
+		phase.next("csmap.comparator");
 		container->key_comp().runtime_initialize(
 			internal::extract_comparator(*config));
+		phase.end();
+
+		/* the engine wasn't closed cleanly, unlink all removed nodes */
+		if (pmem_ptr->purge_pending) {
+			internal::open_phase purge_phase("csmap.purge");
+			auto it = container->begin();
+			while (it != container->end()) {
+				if (it->second.deleted) {
+					it = container->unsafe_erase(it);
+				} else {
+					it->second.mtx.reset();
+					++it;
+				}
+			}
+		}
 	} else {
 		pmem::obj::transaction::run(pmpool, [&] {
 			pmem::obj::transaction::snapshot(root_oid);
@@ -294,92 +1052,115 @@ void csmap::Recover()
 				internal::extract_comparator(*config));
 		});
 	}
+
+	auto pmem_ptr =
+		static_cast<internal::csmap::pmem_type *>(pmemobj_direct(*root_oid));
+	pmem_ptr->purge_pending = 1;
+	pmpool.persist(pmem_ptr->purge_pending);
+
+	/* record locks left by earlier opens (maybe locked) are of older ones */
+	pmem_ptr->generation = pmem_ptr->generation + 1;
+	pmpool.persist(pmem_ptr->generation);
+	generation = pmem_ptr->generation.get_ro() << 32;
+}
+
+internal::transaction *csmap::begin_tx()
+{
+	return new internal::csmap::transaction(*this);
 }
 
 internal::iterator_base *csmap::new_iterator()
 {
-	return new csmap_iterator<false>{container, mtx};
+	return new csmap_iterator<false>{container, mtx, generation, versions,
+					 direct_write_range};
 }
 
 internal::iterator_base *csmap::new_const_iterator()
 {
-	return new csmap_iterator<true>{container, mtx};
+	return new csmap_iterator<true>{container, mtx, generation,
+					snapshot_reads ? &versions : nullptr};
 }
 
-csmap::csmap_iterator<true>::csmap_iterator(container_type *c, global_mutex_type &mtx)
-    : container(c), lock(mtx), pop(pmem::obj::pool_by_vptr(c))
+csmap::csmap_iterator<true>::csmap_iterator(container_type *c, global_mutex_type &mtx,
+					    uint64_t generation,
+					    internal::csmap::version_store *snapshots)
+    : container(c),
+      it_(c->end()),
+      lock(mtx),
+      generation(generation),
+      pop(pmem::obj::pool_by_vptr(c)),
+      snapshots(snapshots)
 {
 }
 
-csmap::csmap_iterator<false>::csmap_iterator(container_type *c, global_mutex_type &mtx)
-    : csmap::csmap_iterator<true>(c, mtx)
+csmap::csmap_iterator<false>::csmap_iterator(container_type *c, global_mutex_type &mtx,
+					     uint64_t generation,
+					     internal::csmap::version_store &versions,
+					     bool direct_write)
+    : csmap::csmap_iterator<true>(c, mtx, generation, nullptr),
+      versions(versions),
+      direct_write(direct_write),
+      tx(pop)
 {
 }
 
 status csmap::csmap_iterator<true>::seek(string_view key)
 {
 	init_seek();
+	take_snapshot();
+
+	/* the bound is the key, if it's present */
+	it_ = find_bound(key, false);
+	if (it_ != container->end() &&
+	    !container->key_comp()(key,
+				   string_view(it_->first.data(), it_->first.size())) &&
+	    lock_current())
+		return status::OK;
 
-	it_ = container->find(key);
-	if (it_ == container->end()) {
-		return status::NOT_FOUND;
-	}
-
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	it_ = container->end();
+	snap.release();
 
-	return status::OK;
+	return status::NOT_FOUND;
 }
 
 status csmap::csmap_iterator<true>::seek_lower(string_view key)
 {
 	init_seek();
+	take_snapshot();
 
 	it_ = container->find_lower(key);
-	if (it_ == container->end())
-		return status::NOT_FOUND;
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
-
-	return status::OK;
+	return lock_backward();
 }
 
 status csmap::csmap_iterator<true>::seek_lower_eq(string_view key)
 {
 	init_seek();
+	take_snapshot();
 
 	it_ = container->find_lower_eq(key);
-	if (it_ == container->end())
-		return status::NOT_FOUND;
-
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
 
-	return status::OK;
+	return lock_backward();
 }
 
 status csmap::csmap_iterator<true>::seek_higher(string_view key)
 {
 	init_seek();
+	take_snapshot();
 
-	it_ = container->find_higher(key);
-	if (it_ == container->end())
-		return status::NOT_FOUND;
-
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	it_ = find_bound(key, true);
 
-	return status::OK;
+	return lock_forward();
 }
 
 status csmap::csmap_iterator<true>::seek_higher_eq(string_view key)
 {
 	init_seek();
+	take_snapshot();
 
-	it_ = container->find_higher_eq(key);
-	if (it_ == container->end())
-		return status::NOT_FOUND;
-
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	it_ = find_bound(key, false);
 
-	return status::OK;
+	return lock_forward();
 }
 
 status csmap::csmap_iterator<true>::seek_to_first()
@@ -389,30 +1170,71 @@ status csmap::csmap_iterator<true>::seek_to_first()
 	if (container->empty())
 		return status::NOT_FOUND;
 
+	take_snapshot();
 	it_ = container->begin();
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
-
-	return status::OK;
+	return lock_forward();
 }
 
 status csmap::csmap_iterator<true>::is_next()
 {
 	auto tmp = it_;
-	if (tmp == container->end() || ++tmp == container->end())
+	if (tmp == container->end())
 		return status::NOT_FOUND;
 
-	return status::OK;
+	for (++tmp; !past_bound(tmp); ++tmp) {
+		if (csmap::read(tmp->second, generation, nullptr, snap))
+			return status::OK;
+	}
+
+	return status::NOT_FOUND;
 }
 
 status csmap::csmap_iterator<true>::next()
 {
 	init_seek();
 
-	if (it_ == container->end() || ++it_ == container->end())
+	if (it_ == container->end())
+		return status::NOT_FOUND;
+
+	++it_;
+
+	return lock_forward();
+}
+
+/*
+ * Only the current entry is locked, the following ones are read (and their
+ * values copied, unless the batch is keys-only) without locking, like in
+ * get_all. Keys are not copied, nodes are not freed while the global lock
+ * is held.
+ */
+status csmap::csmap_iterator<true>::next_batch(internal::iterator_batch &batch)
+{
+	init_seek();
+
+	if (it_ == container->end())
 		return status::NOT_FOUND;
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	if (batch_values.size() < batch.capacity)
+		batch_values.resize(batch.capacity);
+
+	for (; !past_bound(it_) && !batch.full(); ++it_) {
+		auto &value = batch_values[batch.size];
+		if (!csmap::read(it_->second, generation,
+				 batch.keys_only() ? nullptr : &value, snap))
+			continue;
+
+		batch.push(string_view(it_->first.data(), it_->first.size()), value);
+	}
+
+	lock_forward();
+
+	return batch.size > 0 ? status::OK : status::NOT_FOUND;
+}
+
+status csmap::csmap_iterator<true>::set_upper_bound(const string_view *key)
+{
+	bound.set(key);
 
 	return status::OK;
 }
@@ -429,6 +1251,13 @@ result<pmem::obj::slice<const char *>> csmap::csmap_iterator<true>::read_range(s
 {
 	assert(it_ != container->end());
 
+	if (snapshots) {
+		if (pos + n > value.size() || pos + n < pos)
+			n = value.size() - pos;
+
+		return {{value.data() + pos, value.data() + pos + n}};
+	}
+
 	if (pos + n > it_->second.val.size() || pos + n < pos)
 		n = it_->second.val.size() - pos;
 
@@ -443,6 +1272,12 @@ result<pmem::obj::slice<char *>> csmap::csmap_iterator<false>::write_range(size_
 	if (pos + n > it_->second.val.size() || pos + n < pos)
 		n = it_->second.val.size() - pos;
 
+	if (direct_write) {
+		if (!tx.active())
+			versions.save(it_->second);
+		return {tx.add(it_->second.val.cdata() + pos, n)};
+	}
+
 	log.push_back({{it_->second.val.cdata() + pos, n}, pos});
 	auto &val = log.back().first;
 
@@ -451,6 +1286,13 @@ result<pmem::obj::slice<char *>> csmap::csmap_iterator<false>::write_range(size_
 
 status csmap::csmap_iterator<false>::commit()
 {
+	if (direct_write) {
+		tx.commit();
+		return status::OK;
+	}
+
+	if (!log.empty())
+		versions.save(it_->second);
 	pmem::obj::transaction::run(pop, [&] {
 		for (auto &p : log) {
 			auto dest = it_->second.val.range(p.second, p.first.size());
@@ -464,22 +1306,408 @@ status csmap::csmap_iterator<false>::commit()
 
 void csmap::csmap_iterator<false>::abort()
 {
+	tx.abort();
 	log.clear();
 }
 
+/*
+ * Releases also the global lock (and the snapshot), so a reset iterator
+ * doesn't block purges of removed records. It's taken again by the next seek.
+ */
+void csmap::csmap_iterator<true>::reset()
+{
+	init_seek();
+	it_ = container->end();
+	snap.release();
+	lock.unlock();
+}
+
 void csmap::csmap_iterator<true>::init_seek()
 {
-	if (it_ != container->end())
+	if (!lock.owns_lock()) {
+		lock.lock();
+		return;
+	}
+
+	if (node_lock.owns_lock())
 		node_lock.unlock();
 }
 
+/* Starts a new snapshot, in the snapshot mode */
+void csmap::csmap_iterator<true>::take_snapshot()
+{
+	if (snapshots)
+		snap.take(snapshots);
+}
+
+/*
+ * Returns the first element not less than the key (greater, if 'upper'). If
+ * the current element is not above the key, the next FINGER_SEARCH_STEPS
+ * elements are checked first - a seek a bit above the previous one (e.g. in
+ * a merge join or a skip scan) usually finds it there, without a search from
+ * the head of the skip list. Nodes are not freed while the global lock is
+ * held, so the current one is still linked.
+ */
+csmap::container_type::iterator csmap::csmap_iterator<true>::find_bound(string_view key,
+									bool upper)
+{
+	auto comp = container->key_comp();
+	auto key_of = [](const container_type::iterator &it) {
+		return string_view(it->first.data(), it->first.size());
+	};
+
+	if (it_ != container->end() && !comp(key, key_of(it_))) {
+		auto it = it_;
+		for (std::size_t i = 0; i < FINGER_SEARCH_STEPS; ++i, ++it) {
+			if (it == container->end())
+				return it;
+			if (upper ? comp(key, key_of(it)) : !comp(key_of(it), key))
+				return it;
+		}
+	}
+
+	return upper ? container->find_higher(key) : container->find_higher_eq(key);
+}
+
+/* Returns true if 'it' is the end or is not lower than the upper bound */
+bool csmap::csmap_iterator<true>::past_bound(const container_type::iterator &it)
+{
+	return it == container->end() ||
+		bound.reached(string_view(it->first.data(), it->first.size()),
+			      container->key_comp());
+}
+
+/*
+ * Locks the element pointed by it_ (in the snapshot mode, copies its value as
+ * of the snapshot instead), returns false if it's removed.
+ */
+bool csmap::csmap_iterator<true>::lock_current()
+{
+	if (snapshots)
+		return csmap::read(it_->second, generation, &value, snap);
+
+	node_lock = csmap::unique_node_lock_type(it_->second.mtx, generation);
+	if (!it_->second.deleted)
+		return true;
+
+	node_lock.unlock();
+	return false;
+}
+
+/*
+ * Locks the element pointed by it_ or, if it's removed, the first following
+ * one which is not. The snapshot is not needed once the end (or the upper
+ * bound) is reached.
+ */
+status csmap::csmap_iterator<true>::lock_forward()
+{
+	for (; !past_bound(it_); ++it_) {
+		if (lock_current())
+			return status::OK;
+	}
+
+	it_ = container->end();
+	snap.release();
+	return status::NOT_FOUND;
+}
+
+/*
+ * Locks the element pointed by it_ or, if it's removed, the first preceding
+ * one which is not (skip list has no backward links, so it's searched for).
+ */
+status csmap::csmap_iterator<true>::lock_backward()
+{
+	while (it_ != container->end()) {
+		if (lock_current())
+			return status::OK;
+
+		auto key = string_view(it_->first.data(), it_->first.size());
+		it_ = container->find_lower(key);
+	}
+
+	snap.release();
+	return status::NOT_FOUND;
+}
+
 void csmap::csmap_iterator<false>::init_seek()
 {
+	/* changes are rolled back while the record is still locked */
+	abort();
+
 	csmap::csmap_iterator<true>::init_seek();
+}
+
+namespace internal
+{
+namespace csmap
+{
+
+uint64_t version_store::acquire()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	snapshots.insert(seq);
+	n_snapshots++;
+	/* pairs with the fence in active() - writers see the snapshot or it sees
+	 * their locks */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	return seq;
+}
+
+void version_store::release(uint64_t snapshot)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	snapshots.erase(snapshots.find(snapshot));
+	n_snapshots--;
+
+	auto oldest = snapshots.empty() ? std::numeric_limits<uint64_t>::max()
+					: *snapshots.begin();
+	while (!order.empty() && order.front().first <= oldest) {
+		auto it = versions.find(order.front().second);
+		it->second.pop_front();
+		if (it->second.empty())
+			versions.erase(it);
+		order.pop_front();
+	}
+	n_versions.store(order.size(), std::memory_order_release);
+}
+
+bool version_store::active() const
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return n_snapshots.load(std::memory_order_relaxed) != 0;
+}
+
+void version_store::save(const mapped_type *const *records, std::size_t n)
+{
+	if (!active())
+		return;
+
+	std::unique_lock<std::mutex> lock(mtx);
+	if (snapshots.empty())
+		return;
+
+	++seq;
+	for (std::size_t i = 0; i < n; ++i) {
+		auto &record = *records[i];
+		bool deleted = record.deleted;
+		versions[&record].push_back(version{
+			seq, deleted,
+			deleted ? std::string()
+				: std::string(record.val.c_str(), record.val.size())});
+		order.emplace_back(seq, &record);
+	}
+	n_versions.store(order.size(), std::memory_order_release);
+}
+
+bool version_store::find(const mapped_type &record, uint64_t snapshot,
+			 std::string *value, bool &deleted) const
+{
+	if (n_versions.load(std::memory_order_acquire) == 0)
+		return false;
+
+	std::unique_lock<std::mutex> lock(mtx);
+	auto it = versions.find(&record);
+	if (it == versions.end())
+		return false;
+
+	for (auto &v : it->second) {
+		if (v.until <= snapshot)
+			continue;
+
+		deleted = v.deleted;
+		if (value && !deleted)
+			*value = v.value;
+		return true;
+	}
+
+	return false;
+}
+
+transaction::transaction(::pmem::kv::csmap &engine) : engine(engine)
+{
+}
+
+status transaction::put(string_view key, string_view value)
+{
+	log.insert(key, value);
+	return status::OK;
+}
+
+status transaction::remove(string_view key)
+{
+	log.remove(key);
+	return status::OK;
+}
+
+status transaction::get(string_view key, get_v_callback *callback, void *arg)
+{
+	return log.get(key, callback, arg, [&] {
+		::pmem::kv::csmap::shared_global_lock_type lock(engine.mtx);
+		auto container = engine.container;
+
+		auto it = (engine.filter && !engine.filter->may_contain(key))
+			? container->end()
+			: container->find(key);
+		const mapped_type *record = nullptr;
+		uint64_t version = 0;
+		bool found = false;
+		if (it != container->end()) {
+			record = &it->second;
+			found = ::pmem::kv::csmap::read(*record, engine.generation,
+							&value, &version);
+		}
+
+		reads.push_back(read_entry{std::string(key.data(), key.size()), record,
+					   version});
+		if (!found)
+			return status::NOT_FOUND;
+
+		callback(value.c_str(), value.size(), arg);
+		return status::OK;
+	});
+}
+
+bool transaction::validate(const std::map<std::string, const string_view *> &writes,
+			   const std::vector<std::string> &inserted) const
+{
+	auto container = engine.container;
+	for (auto &r : reads) {
+		auto it = container->find(string_view(r.key.data(), r.key.size()));
+		const mapped_type *record =
+			it == container->end() ? nullptr : &it->second;
+
+		/* nodes are freed only after being purged, address tells if it was */
+		if (record != r.record) {
+			/* tombstone of a key inserted by this commit */
+			if (!r.record &&
+			    std::binary_search(inserted.begin(), inserted.end(), r.key))
+				continue;
+			return false;
+		}
+
+		if (!record)
+			continue;
+
+		bool locked = writes.count(r.key) != 0;
+		if (locked ? !record->mtx.validate_locked(r.version, engine.generation)
+			   : !record->mtx.validate(r.version))
+			return false;
+	}
+
+	return true;
+}
+
+status transaction::commit()
+{
+	/* only the last operation on every key has to be applied */
+	std::map<std::string, const string_view *> last_ops;
+	log.foreach (
+		[&](const dram_log::element_type &e) {
+			last_ops[std::string(e.first.data(), e.first.size())] = &e.second;
+		},
+		[&](const dram_log::element_type &e) {
+			last_ops[std::string(e.first.data(), e.first.size())] = nullptr;
+		});
+
+	::pmem::kv::csmap::shared_global_lock_type lock(engine.mtx);
+	auto container = engine.container;
+
+	/* new keys are invisible until the commit */
+	std::vector<std::string> inserted;
+	for (auto &op : last_ops) {
+		if (!op.second)
+			continue;
+
+		string_view key(op.first.data(), op.first.size());
+		if (engine.filter)
+			engine.filter->add(key);
+		if (container->try_emplace(key, string_view(), true).second) {
+			engine.tombstones++;
+			inserted.push_back(op.first);
+		}
+	}
+
+	std::vector<::pmem::kv::csmap::unique_node_lock_type> locks;
+	std::vector<std::pair<mapped_type *, const string_view *>> records;
+	std::vector<std::string> removed;
+	std::size_t revived = 0;
+	for (auto &op : last_ops) {
+		auto it = container->find(string_view(op.first.data(), op.first.size()));
+		/* removed key doesn't exist */
+		if (it == container->end())
+			continue;
+
+		locks.emplace_back(it->second.mtx, engine.generation);
+		records.emplace_back(&it->second, op.second);
+
+		if (op.second && it->second.deleted)
+			++revived;
+		else if (!op.second && !it->second.deleted)
+			removed.push_back(op.first);
+	}
+
+	if (!validate(last_ops, inserted)) {
+		locks.clear();
+		engine.schedule_purge(std::move(inserted));
+		abort();
+
+		return status::TRANSACTION_CONFLICT;
+	}
+
+	/* all changes of the commit are seen by snapshots at once */
+	if (engine.versions.active()) {
+		std::vector<const mapped_type *> changed;
+		for (auto &r : records)
+			changed.push_back(r.first);
+		engine.versions.save(changed.data(), changed.size());
+	}
+
+	try {
+		pmem::obj::transaction::run(engine.pmpool, [&] {
+			for (auto &r : records) {
+				if (r.second) {
+					r.first->val.assign(r.second->data(),
+							    r.second->size());
+					if (r.first->deleted)
+						r.first->deleted = 0;
+				} else if (!r.first->deleted) {
+					r.first->deleted = 1;
+				}
+			}
+		});
+	} catch (...) {
+		locks.clear();
+		engine.schedule_purge(std::move(inserted));
+		throw;
+	}
+
+	engine.tombstones += removed.size();
+	engine.tombstones -= revived;
+	locks.clear();
+	engine.schedule_purge(std::move(removed));
 
 	log.clear();
+	reads.clear();
+
+	if (engine.filter) {
+		engine.filter->inserted(inserted.size());
+		lock.unlock();
+		engine.grow_filter();
+	}
+
+	return status::OK;
+}
+
+void transaction::abort()
+{
+	log.clear();
+	reads.clear();
 }
 
+} /* namespace csmap */
+} /* namespace internal */
+
 static factory_registerer
 	register_csmap(std::unique_ptr<engine_base::factory_base>(new csmap_factory));
 
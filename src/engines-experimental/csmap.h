@@ -4,16 +4,32 @@
 #ifndef LIBPMEMKV_CSMAP_H
 #define LIBPMEMKV_CSMAP_H
 
+#include "../bloom_filter.h"
 #include "../comparator/pmemobj_comparator.h"
+#include "../defrag_service.h"
+#include "../lock_stats.h"
 #include "../pmemobj_engine.h"
+#include "../prefetch.h"
+#include "../sharded_shared_mutex.h"
+#include "../thread_pool.h"
 
 #include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/defrag.hpp>
 #include <libpmemobj++/experimental/concurrent_map.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
-#include <libpmemobj++/shared_mutex.hpp>
 
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
+#include <set>
 #include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace pmem
 {
@@ -28,6 +44,148 @@ using key_type = pmem::obj::string;
 
 static_assert(sizeof(key_type) == 32, "");
 
+/**
+ * version_lock is a sequence lock of a single record. Writers make the version
+ * odd for the duration of a change, and readers don't write anything - they
+ * read the record and validate that the version has not changed in the
+ * meantime.
+ *
+ * It resides in PMem, but it's never persisted - the upper half of the word is
+ * the generation of the engine, a counter persisted in the pool and
+ * incremented by every open (passed to the functions below, shifted), and
+ * a word of an earlier generation (left by an earlier open, maybe locked) is
+ * treated as unlocked.
+ */
+class version_lock {
+public:
+	version_lock() : version(0)
+	{
+	}
+
+	void lock(uint64_t generation)
+	{
+		while (true) {
+			auto v = version.load(std::memory_order_relaxed);
+			uint64_t desired;
+			if ((v & ~seq_mask) != generation)
+				desired = generation | 1;
+			else if (!(v & 1))
+				desired = v + 1;
+			else {
+				std::this_thread::yield();
+				continue;
+			}
+
+			if (version.compare_exchange_weak(v, desired,
+							  std::memory_order_acquire))
+				return;
+		}
+	}
+
+	void unlock()
+	{
+		version.fetch_add(1, std::memory_order_release);
+	}
+
+	/* Waits until there is no writer, returns version to pass to validate() */
+	uint64_t read_begin(uint64_t generation) const
+	{
+		while (true) {
+			auto v = version.load(std::memory_order_acquire);
+			if ((v & ~seq_mask) != generation || !(v & 1))
+				return v;
+			std::this_thread::yield();
+		}
+	}
+
+	/* Returns true if the record wasn't changed since read_begin() */
+	bool validate(uint64_t v) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return version.load(std::memory_order_relaxed) == v;
+	}
+
+	/*
+	 * Returns true if the record, locked by the caller, wasn't changed
+	 * between read_begin() returning v and lock()
+	 */
+	bool validate_locked(uint64_t v, uint64_t generation) const
+	{
+		auto locked = (v & ~seq_mask) != generation ? generation | 1 : v + 1;
+		return version.load(std::memory_order_relaxed) == locked;
+	}
+
+	/* Returns the version the record will have once the caller unlocks it */
+	uint64_t next_version() const
+	{
+		return version.load(std::memory_order_relaxed) + 1;
+	}
+
+	void reset()
+	{
+		version.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	static constexpr uint64_t seq_mask = (uint64_t(1) << 32) - 1;
+
+	std::atomic<uint64_t> version;
+};
+
+static_assert(sizeof(version_lock) == 8, "");
+
+/* Owns a version_lock of the given generation, unlocks it when destroyed */
+class unique_version_lock {
+public:
+	unique_version_lock() = default;
+
+	unique_version_lock(version_lock &mtx, uint64_t generation) : mtx(&mtx)
+	{
+		mtx.lock(generation);
+	}
+
+	unique_version_lock(const unique_version_lock &) = delete;
+	unique_version_lock &operator=(const unique_version_lock &) = delete;
+
+	unique_version_lock(unique_version_lock &&other) : mtx(other.mtx)
+	{
+		other.mtx = nullptr;
+	}
+
+	unique_version_lock &operator=(unique_version_lock &&other)
+	{
+		if (this != &other) {
+			if (mtx)
+				mtx->unlock();
+			mtx = other.mtx;
+			other.mtx = nullptr;
+		}
+
+		return *this;
+	}
+
+	~unique_version_lock()
+	{
+		if (mtx)
+			mtx->unlock();
+	}
+
+	bool owns_lock() const
+	{
+		return mtx != nullptr;
+	}
+
+	void unlock()
+	{
+		assert(mtx);
+		mtx->unlock();
+		mtx = nullptr;
+	}
+
+private:
+	version_lock *mtx = nullptr;
+};
+
 struct mapped_type {
 	mapped_type() = default;
 
@@ -47,27 +205,153 @@ struct mapped_type {
 	{
 	}
 
-	pmem::obj::shared_mutex mtx;
+	mapped_type(string_view str, bool removed)
+	    : val(str.data(), str.size()), deleted(removed ? 1 : 0)
+	{
+	}
+
+	version_lock mtx;
 	pmem::obj::string val;
+	/* set by remove, the node is unlinked from the map later (tombstone) */
+	pmem::obj::p<uint64_t> deleted{0};
 };
 
-static_assert(sizeof(mapped_type) == 96, "");
+static_assert(sizeof(mapped_type) == 48, "");
+
+/**
+ * version_store keeps old versions of records in DRAM, for snapshot reads
+ * ("snapshot_reads" config item). A snapshot is a sequence number. While there
+ * are any snapshots, writers (with the record locked) save the state of
+ * the record before a change, under the next sequence number - a snapshot
+ * reads the oldest version saved after it was taken or, if there is none,
+ * the record itself. Versions are freed once no snapshot older than them is
+ * left.
+ *
+ * Snapshots are held only with the global lock of the engine held shared, so
+ * nodes (which are unlinked under the exclusive lock) are never freed while
+ * they have any versions.
+ */
+class version_store {
+public:
+	version_store() : n_snapshots(0), n_versions(0)
+	{
+	}
+
+	version_store(const version_store &) = delete;
+	version_store &operator=(const version_store &) = delete;
+
+	/* Takes a new snapshot, returns its number to pass to release() */
+	uint64_t acquire();
+	/* Releases the snapshot and frees versions which are no longer needed */
+	void release(uint64_t snapshot);
+	/* Returns true if there are any snapshots (versions are saved only then) */
+	bool active() const;
+
+	/*
+	 * Saves states of the records (locked by the caller) before they are
+	 * changed together, does nothing if there are no snapshots.
+	 */
+	void save(const mapped_type *const *records, std::size_t n);
+
+	void save(const mapped_type &record)
+	{
+		auto r = &record;
+		save(&r, 1);
+	}
+
+	/*
+	 * Copies the version of the record visible to the snapshot (value only
+	 * if it's not removed and 'value' is not null), returns false if the
+	 * record itself is visible.
+	 */
+	bool find(const mapped_type &record, uint64_t snapshot, std::string *value,
+		  bool &deleted) const;
+
+private:
+	struct version {
+		/* the version is visible to snapshots older than that */
+		uint64_t until;
+		bool deleted;
+		std::string value;
+	};
+
+	mutable std::mutex mtx;
+	uint64_t seq = 0;
+	std::multiset<uint64_t> snapshots;
+	/* versions of records, from the oldest one */
+	std::unordered_map<const mapped_type *, std::deque<version>> versions;
+	/* records in the order in which their versions were saved */
+	std::deque<std::pair<uint64_t, const mapped_type *>> order;
+	/* checked without the mutex, by writers and readers */
+	std::atomic<std::size_t> n_snapshots;
+	std::atomic<std::size_t> n_versions;
+};
+
+/* Snapshot taken from a version_store, released by the destructor */
+class snapshot {
+public:
+	snapshot() = default;
+
+	snapshot(const snapshot &) = delete;
+	snapshot &operator=(const snapshot &) = delete;
+
+	~snapshot()
+	{
+		release();
+	}
+
+	/* Releases the current snapshot and takes a new one (if store isn't null) */
+	void take(version_store *s)
+	{
+		release();
+		if (s)
+			seq = s->acquire();
+		store = s;
+	}
+
+	void release()
+	{
+		if (store)
+			store->release(seq);
+		store = nullptr;
+	}
+
+	explicit operator bool() const
+	{
+		return store != nullptr;
+	}
+
+	bool find(const mapped_type &record, std::string *value, bool &deleted) const
+	{
+		return store->find(record, seq, value, deleted);
+	}
+
+private:
+	version_store *store = nullptr;
+	uint64_t seq = 0;
+};
 
 using map_type = pmem::obj::experimental::concurrent_map<key_type, mapped_type,
 							 internal::pmemobj_compare>;
 
 struct pmem_type {
-	pmem_type() : map()
+	pmem_type() : map(), purge_pending(0), generation(0)
 	{
 		std::memset(reserved, 0, sizeof(reserved));
 	}
 
 	map_type map;
-	uint64_t reserved[8];
+	/* set while the engine is open, tombstones may be left if it's set */
+	pmem::obj::p<uint64_t> purge_pending;
+	/* incremented by every open, generation of record locks (version_lock) */
+	pmem::obj::p<uint64_t> generation;
+	uint64_t reserved[6];
 };
 
 static_assert(sizeof(pmem_type) == sizeof(map_type) + 64, "");
 
+class transaction;
+
 } /* namespace csmap */
 } /* namespace internal */
 
@@ -100,39 +384,112 @@ public:
 	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			   void *arg) final;
-
+	status get_between_parallel(string_view key1, string_view key2,
+				    std::size_t partitions, get_kv_callback *callback,
+				    void **args) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
+	status get_keys_between(string_view key1, string_view key2,
+				get_kv_callback *callback, void *arg) final;
+
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
 	status exists(string_view key) final;
 
 	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status value_size(string_view key, std::size_t &size) final;
 
 	status put(string_view key, string_view value) final;
 
+	status update(string_view key, update_callback *callback, void *arg) final;
+
 	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+
+	status stats(internal::stats_sink &sink) final;
 
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
+	internal::transaction *begin_tx() final;
+
 private:
-	using node_mutex_type = pmem::obj::shared_mutex;
-	using global_mutex_type = std::shared_timed_mutex;
+	friend class internal::csmap::transaction;
+
+	using node_mutex_type = internal::csmap::version_lock;
+	using global_mutex_type =
+		internal::instrumented_mutex<internal::reader_indicator_mutex>;
 	using shared_global_lock_type = std::shared_lock<global_mutex_type>;
 	using unique_global_lock_type = std::unique_lock<global_mutex_type>;
-	using shared_node_lock_type = std::shared_lock<node_mutex_type>;
-	using unique_node_lock_type = std::unique_lock<node_mutex_type>;
+	using unique_node_lock_type = internal::csmap::unique_version_lock;
 	using container_type = internal::csmap::map_type;
 
+	/* number of removed keys, after which their nodes are unlinked */
+	static constexpr std::size_t PURGE_BATCH = 1024;
+
+	internal::memory_stats memory_types() final;
 	void Recover();
 	status iterate(typename container_type::iterator first,
 		       typename container_type::iterator last, get_kv_callback *callback,
 		       void *arg);
+	status iterate(typename container_type::iterator first,
+		       typename container_type::iterator last, get_kv_callback *callback,
+		       void *arg, const internal::csmap::snapshot &snap);
+	status iterate_keys(typename container_type::iterator first,
+			    typename container_type::iterator last,
+			    get_kv_callback *callback, void *arg);
+	std::size_t count(typename container_type::iterator first,
+			  typename container_type::iterator last);
+	/*
+	 * Copies value (if not null), sets version of the read (if not null).
+	 * Values not stored inline in the record are copied with it locked.
+	 */
+	static bool read(const internal::csmap::mapped_type &record, uint64_t generation,
+			 std::string *value, uint64_t *version = nullptr);
+	/* Reads the record as of the snapshot, if it's taken */
+	static bool read(const internal::csmap::mapped_type &record, uint64_t generation,
+			 std::string *value, const internal::csmap::snapshot &snap);
+	/* Reads only size of the value, returns false if the record is removed */
+	static bool read_size(const internal::csmap::mapped_type &record,
+			      uint64_t generation, std::size_t &size);
+	void schedule_purge(std::vector<std::string> &&keys);
+	void purge(const std::vector<std::string> &keys);
+	internal::background_task::clock_type::duration purge_step();
+	/* Finds the keys and prefetches their values, on the prefetcher's thread */
+	void prefetch_walk(const internal::prefetch_request &request);
+	/* Adds all keys (also of tombstones) to the filter, must be exclusive */
+	void rebuild_filter();
+	/* Rebuilds the filter under the exclusive lock, if it's full */
+	void grow_filter();
 
 	/*
 	 * We take read lock for thread-safe methods (like get/insert/get_all) to
-	 * synchronize with unsafe_erase() which is not thread-safe.
+	 * synchronize with unsafe_erase() which is not thread-safe. Readers only
+	 * mark themselves in a shard of the lock, so they don't share a cache line.
 	 */
 	global_mutex_type mtx;
 	container_type *container;
+	/* generation of record locks of this open, shifted to the upper half */
+	uint64_t generation = 0;
 	std::unique_ptr<internal::config> config;
+	/* DRAM filter of keys, enabled by "bloom_bits_per_key" */
+	std::unique_ptr<internal::bloom_filter> filter;
+	/* read iterators and get_* read a snapshot, old versions are kept */
+	bool snapshot_reads = false;
+	internal::csmap::version_store versions;
+
+	/* removed nodes are unlinked in batches by a background task */
+	std::atomic<std::size_t> tombstones;
+	std::vector<std::string> purge_keys;
+	std::mutex purge_mtx;
+	std::unique_ptr<internal::background_task> purge_task;
+	std::unique_ptr<internal::prefetch_queue> prefetcher;
+	/* set only if background defrag is enabled ("background_defrag" config) */
+	std::unique_ptr<internal::defrag_service> defrag_svc;
 };
 
 template <>
@@ -140,7 +497,8 @@ class csmap::csmap_iterator<true> : public internal::iterator_base {
 	using container_type = csmap::container_type;
 
 public:
-	csmap_iterator(container_type *container, global_mutex_type &mtx);
+	csmap_iterator(container_type *container, global_mutex_type &mtx,
+		       uint64_t generation, internal::csmap::version_store *snapshots);
 
 	status seek(string_view key) final;
 	status seek_lower(string_view key) final;
@@ -152,19 +510,45 @@ public:
 
 	status is_next() final;
 	status next() final;
+	status next_batch(internal::iterator_batch &batch) final;
+
+	status set_upper_bound(const string_view *key) final;
 
 	result<string_view> key() final;
 
 	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
 
+	void reset() final;
+
 protected:
+	/* number of elements after the current one, checked by a seek before a search */
+	static constexpr std::size_t FINGER_SEARCH_STEPS = 8;
+
 	container_type *container;
 	container_type::iterator it_;
 	csmap::shared_global_lock_type lock;
 	csmap::unique_node_lock_type node_lock;
+	/* generation of record locks of the engine */
+	uint64_t generation;
 	pmem::obj::pool_base pop;
+	/* copies of values returned by next_batch, reused between calls */
+	std::vector<std::string> batch_values;
+	/*
+	 * Set in the snapshot mode, in which records are not locked - every seek
+	 * takes a snapshot and the current value is copied.
+	 */
+	internal::csmap::version_store *snapshots;
+	internal::csmap::snapshot snap;
+	std::string value;
+	internal::iterator_bound bound;
 
 	void init_seek();
+	void take_snapshot();
+	bool past_bound(const container_type::iterator &it);
+	container_type::iterator find_bound(string_view key, bool upper);
+	bool lock_current();
+	status lock_forward();
+	status lock_backward();
 };
 
 template <>
@@ -172,7 +556,9 @@ class csmap::csmap_iterator<false> : public csmap::csmap_iterator<true> {
 	using container_type = csmap::container_type;
 
 public:
-	csmap_iterator(container_type *container, global_mutex_type &mtx);
+	csmap_iterator(container_type *container, global_mutex_type &mtx,
+		       uint64_t generation, internal::csmap::version_store &versions,
+		       bool direct_write);
 
 	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
 
@@ -180,11 +566,69 @@ public:
 	void abort() final;
 
 private:
+	/* changed records are saved for snapshots of read iterators */
+	internal::csmap::version_store &versions;
 	std::vector<std::pair<std::string, size_t>> log;
+	/* used instead of the log in the direct mode, the record is locked */
+	bool direct_write;
+	internal::direct_write_tx tx;
 
 	void init_seek() final;
 };
 
+namespace internal
+{
+namespace csmap
+{
+
+/*
+ * Transaction of csmap. Operations are buffered in dram_log and only the
+ * last operation on every key is applied on commit. New keys are inserted
+ * first as removed records (tombstones), which are invisible to readers.
+ * Then all records are locked in order of keys, so concurrent commits can't
+ * deadlock, and their values and tombstone flags are changed in a single
+ * pmemobj transaction.
+ *
+ * get() records the version of every record it reads (outside of the log).
+ * Once all written records are locked, commit validates that none of the read
+ * records was changed (or replaced) in the meantime, otherwise nothing is
+ * applied and TRANSACTION_CONFLICT is returned - this gives serializable
+ * (optimistic) transactions, without holding any locks before the commit.
+ */
+class transaction : public ::pmem::kv::internal::transaction {
+public:
+	transaction(::pmem::kv::csmap &engine);
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status commit() final;
+	void abort() final;
+
+private:
+	/* record read by get(), 'record' is null if the key wasn't found */
+	struct read_entry {
+		std::string key;
+		const mapped_type *record;
+		uint64_t version;
+	};
+
+	/*
+	 * Returns true if records read by get() are unchanged, must be called
+	 * with all (existing) keys of 'writes' locked and new keys ('inserted',
+	 * sorted) inserted as tombstones.
+	 */
+	bool validate(const std::map<std::string, const string_view *> &writes,
+		      const std::vector<std::string> &inserted) const;
+
+	::pmem::kv::csmap &engine;
+	dram_log log;
+	std::vector<read_entry> reads;
+	std::string value;
+};
+
+} /* namespace csmap */
+} /* namespace internal */
+
 class csmap_factory : public engine_base::factory_base {
 public:
 	std::unique_ptr<engine_base>
@@ -0,0 +1,666 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "darray.h"
+#include "../exceptions.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace darray
+{
+
+/* Returns the first 8 bytes of the key (padded with zeros) as an integer */
+static uint64_t key_to_int(string_view key)
+{
+	uint64_t k = 0;
+	for (std::size_t i = 0; i < KEY_SIZE; ++i) {
+		auto byte = i < key.size() ? static_cast<unsigned char>(key.data()[i]) : 0;
+		k = (k << 8) | byte;
+	}
+
+	return k;
+}
+
+static void int_to_key(uint64_t k, char *key)
+{
+	for (std::size_t i = KEY_SIZE; i > 0; --i) {
+		key[i - 1] = static_cast<char>(k & 0xff);
+		k >>= 8;
+	}
+}
+
+/* Returns false if the key can't be stored in the engine */
+static bool exact_key(string_view key, uint64_t &k)
+{
+	if (key.size() != KEY_SIZE)
+		return false;
+
+	k = key_to_int(key);
+	return true;
+}
+
+/*
+ * Sets 'low' to the lowest integer greater than the key (of any size,
+ * compared bytewise), or equal to it if 'eq' is set; false if there's none.
+ * An 8-byte key is greater than a shorter one if it's not lower than the
+ * shorter one padded with zeros, and greater than a longer one if it's
+ * greater than its first 8 bytes.
+ */
+static bool low_bound(string_view key, bool eq, uint64_t &low)
+{
+	auto k = key_to_int(key);
+	if (key.size() != KEY_SIZE)
+		eq = key.size() < KEY_SIZE;
+
+	if (!eq && k == std::numeric_limits<uint64_t>::max())
+		return false;
+
+	low = eq ? k : k + 1;
+	return true;
+}
+
+static bool high_bound(string_view key, bool eq, uint64_t &high)
+{
+	auto k = key_to_int(key);
+	if (key.size() != KEY_SIZE)
+		eq = key.size() > KEY_SIZE;
+
+	if (!eq && k == 0)
+		return false;
+
+	high = eq ? k : k - 1;
+	return true;
+}
+
+/* number of bits of keys covered by a node of the level (0 - a page) */
+static uint64_t level_bits(uint64_t level)
+{
+	return PAGE_BITS + TABLE_BITS * level;
+}
+
+static uint64_t level_mask(uint64_t level)
+{
+	auto bits = level_bits(level);
+
+	return bits >= 64 ? std::numeric_limits<uint64_t>::max() : (1ULL << bits) - 1;
+}
+
+/* Returns the number of levels of tables needed for the key */
+static uint64_t height_of(uint64_t key)
+{
+	uint64_t height = 1;
+	while (height < MAX_HEIGHT && (key >> level_bits(height)) != 0)
+		height++;
+
+	return height;
+}
+
+/* Returns the position of the key's link in a table of the level */
+static uint64_t table_index(uint64_t key, uint64_t level)
+{
+	return (key >> level_bits(level - 1)) & (TABLE_SLOTS - 1);
+}
+
+/*
+ * Stores the word with a single (failure-atomic) 8-byte store and persists
+ * it. Writers are serialized, so no other thread reads it concurrently.
+ */
+static void store_persist(pmem::obj::pool_base &pool, uint64_t *dest, uint64_t value)
+{
+	reinterpret_cast<std::atomic<uint64_t> *>(dest)->store(value,
+							      std::memory_order_relaxed);
+	pool.persist(dest, sizeof(*dest));
+}
+
+} /* namespace darray */
+} /* namespace internal */
+
+using namespace internal::darray;
+
+darray::darray(std::unique_ptr<internal::config> cfg)
+    : pmemobj_engine_base(cfg, "pmemkv_darray"), mtx(std::thread::hardware_concurrency())
+{
+	uint64_t size = 0;
+	bool size_set = cfg->get_uint64("value_size", &size);
+	if (size_set && (size == 0 || size > MAX_VALUE_SIZE))
+		throw internal::invalid_argument(
+			"Config item \"value_size\" must be in range [1, " +
+			std::to_string(MAX_VALUE_SIZE) + "]");
+	value_size = size_set ? size : VALUE_SIZE;
+
+	register_alloc_class(sizeof(table));
+
+	internal::open_phase phase("darray.recover");
+	Recover();
+	phase.end();
+
+	if (size_set && size != value_size)
+		throw internal::invalid_argument(
+			"Config item \"value_size\" doesn't match the pool's value size (" +
+			std::to_string(value_size) + ")");
+
+	register_alloc_class(PageBytes());
+
+	LOG("Started ok");
+}
+
+darray::~darray()
+{
+	LOG("Stopped ok");
+}
+
+std::string darray::name()
+{
+	return "darray";
+}
+
+status darray::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	cnt = count;
+
+	return status::OK;
+}
+
+status darray::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return CountRange(&low, false, nullptr, false, cnt);
+}
+
+status darray::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return CountRange(&low, true, nullptr, false, cnt);
+}
+
+status darray::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return CountRange(nullptr, false, &high, true, cnt);
+}
+
+status darray::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return CountRange(nullptr, false, &high, false, cnt);
+}
+
+status darray::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between for key1=" << std::string(key1.data(), key1.size())
+				      << ", key2="
+				      << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	std::string low(key1.data(), key1.size());
+	std::string high(key2.data(), key2.size());
+	return CountRange(&low, false, &high, false, cnt);
+}
+
+status darray::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	check_outside_tx();
+	return GetRange(nullptr, false, nullptr, false, callback, arg);
+}
+
+status darray::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return GetRange(&low, false, nullptr, false, callback, arg);
+}
+
+status darray::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return GetRange(&low, true, nullptr, false, callback, arg);
+}
+
+status darray::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return GetRange(nullptr, false, &high, true, callback, arg);
+}
+
+status darray::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return GetRange(nullptr, false, &high, false, callback, arg);
+}
+
+status darray::get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg)
+{
+	LOG("get_between for key1=" << std::string(key1.data(), key1.size())
+				    << ", key2="
+				    << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	std::string low(key1.data(), key1.size());
+	std::string high(key2.data(), key2.size());
+	return GetRange(&low, false, &high, false, callback, arg);
+}
+
+status darray::GetRange(const std::string *low, bool low_eq, const std::string *high,
+			bool high_eq, get_kv_callback *callback, void *arg)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	uint64_t low_key = 0;
+	uint64_t high_key = std::numeric_limits<uint64_t>::max();
+	if (low && !low_bound(*low, low_eq, low_key))
+		return status::OK;
+	if (high && !high_bound(*high, high_eq, high_key))
+		return status::OK;
+
+	char key[KEY_SIZE];
+	auto ret = Scan(low_key, high_key, [&](uint64_t k, const char *value) {
+		int_to_key(k, key);
+		return callback(key, KEY_SIZE, value, value_size, arg);
+	});
+
+	return ret != 0 ? status::STOPPED_BY_CB : status::OK;
+}
+
+status darray::CountRange(const std::string *low, bool low_eq, const std::string *high,
+			  bool high_eq, std::size_t &cnt)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	cnt = 0;
+
+	uint64_t low_key = 0;
+	uint64_t high_key = std::numeric_limits<uint64_t>::max();
+	if (low && !low_bound(*low, low_eq, low_key))
+		return status::OK;
+	if (high && !high_bound(*high, high_eq, high_key))
+		return status::OK;
+
+	std::size_t result = 0;
+	Scan(low_key, high_key, [&](uint64_t, const char *) {
+		result++;
+		return 0;
+	});
+
+	cnt = result;
+
+	return status::OK;
+}
+
+status darray::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t k;
+	if (!exact_key(key, k))
+		return status::NOT_FOUND;
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto p = FindPage(k);
+	auto idx = k & (PAGE_SLOTS - 1);
+	if (!p || !(p->bitmap[idx / 64] & (1ULL << (idx % 64))))
+		return status::NOT_FOUND;
+
+	return status::OK;
+}
+
+status darray::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t k;
+	if (!exact_key(key, k))
+		return status::NOT_FOUND;
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto p = FindPage(k);
+	auto idx = k & (PAGE_SLOTS - 1);
+	if (!p || !(p->bitmap[idx / 64] & (1ULL << (idx % 64)))) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	callback(Slot(p, idx), value_size, arg);
+
+	return status::OK;
+}
+
+/*
+ * A value of a new key is persisted in its slot before the slot's bit is set.
+ * An existing value is replaced in place: with a single 8-byte store, if
+ * values fit in it, or in a transaction.
+ */
+status darray::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+
+	uint64_t k;
+	if (!exact_key(key, k))
+		throw internal::invalid_argument("Keys of darray must have " +
+						 std::to_string(KEY_SIZE) + " bytes");
+	if (value.size() != value_size)
+		throw internal::invalid_argument("Values of darray must have " +
+						 std::to_string(value_size) + " bytes");
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto p = FindPage(k);
+	if (!p)
+		p = AllocPage(k);
+
+	auto idx = k & (PAGE_SLOTS - 1);
+	auto &word = p->bitmap[idx / 64];
+	auto bit = 1ULL << (idx % 64);
+	auto slot = Slot(p, idx);
+
+	if (!(word & bit)) {
+		pmemobj_memcpy_persist(pmpool.handle(), slot, value.data(), value.size());
+		store_persist(pmpool, &word, word | bit);
+		count++;
+	} else if (slot_size == sizeof(uint64_t)) {
+		uint64_t v = 0;
+		std::memcpy(&v, value.data(), value.size());
+		store_persist(pmpool, reinterpret_cast<uint64_t *>(slot), v);
+	} else {
+		pmem::obj::transaction::run(pmpool, [&] {
+			pmem::obj::transaction::snapshot(slot, value.size());
+			std::memcpy(slot, value.data(), value.size());
+		});
+	}
+
+	return status::OK;
+}
+
+/* a page is freed when its last value is removed */
+status darray::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t k;
+	if (!exact_key(key, k))
+		return status::NOT_FOUND;
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto p = FindPage(k);
+	auto idx = k & (PAGE_SLOTS - 1);
+	auto bit = 1ULL << (idx % 64);
+	if (!p || !(p->bitmap[idx / 64] & bit))
+		return status::NOT_FOUND;
+
+	auto &word = p->bitmap[idx / 64];
+	auto zeros = std::count(std::begin(p->bitmap), std::end(p->bitmap), 0ULL);
+
+	if ((word & ~bit) == 0 && static_cast<uint64_t>(zeros) == PAGE_SLOTS / 64 - 1)
+		FreePage(k);
+	else
+		store_persist(pmpool, &word, word & ~bit);
+
+	count--;
+
+	return status::OK;
+}
+
+status darray::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	sink.add("count", count);
+	sink.add("darray.value_size", value_size);
+	sink.add("darray.height", pmem_root->height);
+	sink.add("darray.pages", pages);
+	sink.add("darray.tables", tables);
+
+	report_memory(sink, count);
+
+	return status::OK;
+}
+
+internal::memory_stats darray::memory_types()
+{
+	internal::memory_stats mem;
+	mem.add_type(pmem::detail::type_num<table>(), "tables", sizeof(table));
+	mem.add_type(pmem::detail::type_num<char>(), "pages");
+
+	return mem;
+}
+
+uint64_t darray::PageBytes() const
+{
+	return sizeof(page) + PAGE_SLOTS * slot_size;
+}
+
+page *darray::FindPage(uint64_t key) const
+{
+	auto height = pmem_root->height;
+	if (height == 0 || (height < MAX_HEIGHT && (key >> level_bits(height)) != 0))
+		return nullptr;
+
+	auto offset = pmem_root->top;
+	for (auto level = height; level > 0 && offset != 0; --level)
+		offset = Table(offset)->slots[table_index(key, level)];
+
+	return offset != 0 ? Page(offset) : nullptr;
+}
+
+/*
+ * The tree grows by new top tables, which link the previous top one as their
+ * first child. Missing tables on the path to the page and the page itself
+ * are allocated in the same transaction.
+ */
+page *darray::AllocPage(uint64_t key)
+{
+	uint64_t new_tables = 0;
+	uint64_t offset = 0;
+
+	pmem::obj::transaction::run(pmpool, [&] {
+		auto height = height_of(key);
+		if (pmem_root->height == 0) {
+			pmem::obj::transaction::snapshot(pmem_root);
+			pmem_root->top = pmem::obj::make_persistent<table>().raw().off;
+			pmem_root->height = height;
+			new_tables++;
+		}
+		while (pmem_root->height < height) {
+			auto t = pmem::obj::make_persistent<table>();
+			t->slots[0] = pmem_root->top;
+			pmem::obj::transaction::snapshot(pmem_root);
+			pmem_root->top = t.raw().off;
+			pmem_root->height++;
+			new_tables++;
+		}
+
+		offset = pmem_root->top;
+		for (auto level = pmem_root->height; level > 0; --level) {
+			auto link = &Table(offset)->slots[table_index(key, level)];
+			if (*link == 0) {
+				pmem::obj::transaction::snapshot(link);
+				if (level > 1) {
+					*link = pmem::obj::make_persistent<table>().raw().off;
+					new_tables++;
+				} else {
+					*link = pmem::obj::make_persistent<char[]>(PageBytes())
+							.raw()
+							.off;
+				}
+			}
+			offset = *link;
+		}
+	});
+
+	tables += new_tables;
+	pages++;
+
+	return Page(offset);
+}
+
+void darray::FreePage(uint64_t key)
+{
+	pmem::obj::transaction::run(pmpool, [&] {
+		auto offset = pmem_root->top;
+		for (auto level = pmem_root->height; level > 1; --level)
+			offset = Table(offset)->slots[table_index(key, level)];
+
+		auto link = &Table(offset)->slots[table_index(key, 1)];
+		pmem::obj::persistent_ptr<char[]> ptr(pmemobj_oid(Page(*link)));
+		pmem::obj::delete_persistent<char[]>(ptr, PageBytes());
+
+		pmem::obj::transaction::snapshot(link);
+		*link = 0;
+	});
+
+	pages--;
+}
+
+int darray::Scan(uint64_t low, uint64_t high, const value_function &f) const
+{
+	auto height = pmem_root->height;
+	if (height == 0 || low > high)
+		return 0;
+	if (height < MAX_HEIGHT && (low >> level_bits(height)) != 0)
+		return 0;
+
+	return Scan(pmem_root->top, height, low, std::min(high, level_mask(height)), f);
+}
+
+/* low and high are within the node, which covers keys of the same prefix */
+int darray::Scan(uint64_t offset, uint64_t level, uint64_t low, uint64_t high,
+		 const value_function &f) const
+{
+	if (level == 0) {
+		auto p = Page(offset);
+		auto prefix = low & ~(PAGE_SLOTS - 1);
+		auto first = low & (PAGE_SLOTS - 1);
+		auto last = high & (PAGE_SLOTS - 1);
+
+		for (auto w = first / 64; w <= last / 64; ++w) {
+			auto bits = p->bitmap[w];
+			if (w == first / 64)
+				bits &= ~0ULL << (first % 64);
+			if (w == last / 64 && last % 64 != 63)
+				bits &= (1ULL << (last % 64 + 1)) - 1;
+
+			while (bits) {
+				auto idx = w * 64 +
+					static_cast<uint64_t>(__builtin_ctzll(bits));
+				bits &= bits - 1;
+
+				auto ret = f(prefix | idx, Slot(p, idx));
+				if (ret != 0)
+					return ret;
+			}
+		}
+
+		return 0;
+	}
+
+	auto t = Table(offset);
+	auto shift = level_bits(level - 1);
+	auto prefix = low & ~level_mask(level);
+	auto first = table_index(low, level);
+	auto last = table_index(high, level);
+
+	for (auto i = first; i <= last; ++i) {
+		if (t->slots[i] == 0)
+			continue;
+
+		auto child = prefix | (i << shift);
+		auto ret = Scan(t->slots[i], level - 1, i == first ? low : child,
+				i == last ? high : child | level_mask(level - 1), f);
+		if (ret != 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+void darray::Walk(uint64_t offset, uint64_t level)
+{
+	if (level == 0) {
+		auto p = Page(offset);
+		for (auto w : p->bitmap)
+			count += static_cast<std::size_t>(__builtin_popcountll(w));
+		pages++;
+		return;
+	}
+
+	for (auto child : Table(offset)->slots) {
+		if (child != 0)
+			Walk(child, level - 1);
+	}
+	tables++;
+}
+
+/* the value size (of the config or the default one) is stored in a new pool */
+void darray::Recover()
+{
+	if (OID_IS_NULL(*root_oid)) {
+		pmem::obj::transaction::run(pmpool, [&] {
+			pmem::obj::transaction::snapshot(root_oid);
+			*root_oid = pmem::obj::make_persistent<pmem_type>().raw();
+		});
+	}
+
+	pmem_root = static_cast<pmem_type *>(pmemobj_direct(*root_oid));
+	base = reinterpret_cast<char *>(pmpool.handle());
+
+	if (pmem_root->value_size == 0) {
+		pmem::obj::transaction::run(pmpool, [&] {
+			pmem::obj::transaction::snapshot(&pmem_root->value_size);
+			pmem_root->value_size = value_size;
+		});
+	}
+
+	value_size = pmem_root->value_size;
+	slot_size = (value_size + 7) & ~uint64_t(7);
+
+	if (pmem_root->height != 0)
+		Walk(pmem_root->top, pmem_root->height);
+}
+
+static factory_registerer
+	register_darray(std::unique_ptr<engine_base::factory_base>(new darray_factory));
+
+} // namespace kv
+} // namespace pmem
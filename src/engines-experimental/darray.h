@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_DARRAY_H
+#define LIBPMEMKV_DARRAY_H
+
+#include "../pmemobj_engine.h"
+#include "../sharded_shared_mutex.h"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/make_persistent_array.hpp>
+
+#include <cstring>
+#include <functional>
+#include <memory>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace darray
+{
+
+/* size of all keys of the engine */
+static constexpr std::size_t KEY_SIZE = 8;
+/* default size of all values of the engine */
+static constexpr uint64_t VALUE_SIZE = 8;
+/* maximal size of values, so that a page is not too large for an allocation */
+static constexpr uint64_t MAX_VALUE_SIZE = 4096;
+/* a page holds 2^PAGE_BITS values, a table 2^TABLE_BITS links */
+static constexpr unsigned PAGE_BITS = 9;
+static constexpr unsigned TABLE_BITS = 9;
+static constexpr uint64_t PAGE_SLOTS = 1ULL << PAGE_BITS;
+static constexpr uint64_t TABLE_SLOTS = 1ULL << TABLE_BITS;
+/* number of levels of tables, which cover all 64-bit keys */
+static constexpr uint64_t MAX_HEIGHT = (64 - PAGE_BITS + TABLE_BITS - 1) / TABLE_BITS;
+
+/* Level of the radix tree of pages, links are offsets in the pool (0 - none) */
+struct table {
+	table()
+	{
+		std::memset(slots, 0, sizeof(slots));
+	}
+
+	uint64_t slots[TABLE_SLOTS];
+};
+
+/*
+ * Page is allocated with its values (in slots of a size rounded up to 8
+ * bytes), which follow the header. A value is present if its bit is set.
+ */
+struct page {
+	uint64_t bitmap[PAGE_SLOTS / 64];
+};
+
+struct pmem_type {
+	pmem_type() : value_size(0), height(0), top(0)
+	{
+		std::memset(reserved, 0, sizeof(reserved));
+	}
+
+	uint64_t value_size;
+	/* number of levels of tables above pages (0 - empty) */
+	uint64_t height;
+	/* offset of the top table */
+	uint64_t top;
+	uint64_t reserved[8];
+};
+
+} /* namespace darray */
+} /* namespace internal */
+
+/**
+ * Dense array engine, for 8-byte keys (integers, ordered bytewise as
+ * big-endian ones) and values of a fixed size. Values are kept in pages of
+ * a persistent, sparse array, indexed directly by keys: pages are reached
+ * through a radix tree of tables (as page tables are), which grows in height
+ * with the largest key. Only pages which hold values are allocated, so for
+ * dense keys memory use is close to the size of values.
+ *
+ * A new value is written to its (free) slot before the bit, which marks it
+ * present, is set; values of up to 8 bytes are replaced with a single atomic
+ * store, larger ones in a transaction. Iteration walks pages in order of keys.
+ *
+ * Readers run concurrently, writers are serialized.
+ */
+class darray : public pmemobj_engine_base<internal::darray::pmem_type> {
+public:
+	darray(std::unique_ptr<internal::config> cfg);
+	~darray();
+
+	darray(const darray &) = delete;
+	darray &operator=(const darray &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+
+	status stats(internal::stats_sink &sink) final;
+
+protected:
+	internal::memory_stats memory_types() final;
+
+private:
+	using mutex_type = internal::sharded_shared_mutex;
+	using page = internal::darray::page;
+	using table = internal::darray::table;
+	using value_function = std::function<int(uint64_t key, const char *value)>;
+
+	void Recover();
+	/* Counts pages, tables and values under the node of the given level */
+	void Walk(uint64_t offset, uint64_t level);
+
+	table *Table(uint64_t offset) const
+	{
+		return reinterpret_cast<table *>(base + offset);
+	}
+	page *Page(uint64_t offset) const
+	{
+		return reinterpret_cast<page *>(base + offset);
+	}
+	char *Slot(page *p, uint64_t idx) const
+	{
+		return reinterpret_cast<char *>(p + 1) + idx * slot_size;
+	}
+
+	/* Returns the page of the key, or nullptr */
+	page *FindPage(uint64_t key) const;
+	/* Returns the page of the key, allocating it (and tables) if needed */
+	page *AllocPage(uint64_t key);
+	/* Frees the (empty) page of the key */
+	void FreePage(uint64_t key);
+	uint64_t PageBytes() const;
+
+	/* Calls f for values of keys in [low, high], in order */
+	int Scan(uint64_t offset, uint64_t level, uint64_t low, uint64_t high,
+		 const value_function &f) const;
+	int Scan(uint64_t low, uint64_t high, const value_function &f) const;
+
+	status GetRange(const std::string *low, bool low_eq, const std::string *high,
+			bool high_eq, get_kv_callback *callback, void *arg);
+	status CountRange(const std::string *low, bool low_eq, const std::string *high,
+			  bool high_eq, std::size_t &cnt);
+
+	internal::darray::pmem_type *pmem_root = nullptr;
+	char *base = nullptr;
+
+	uint64_t value_size;
+	uint64_t slot_size;
+
+	std::size_t count = 0;
+	uint64_t pages = 0;
+	uint64_t tables = 0;
+
+	/* readers hold shared lock, writers exclusive one */
+	mutable mutex_type mtx;
+};
+
+class darray_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new darray(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "darray";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_DARRAY_H */
@@ -0,0 +1,526 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "ehash.h"
+#include "../exceptions.h"
+#include "../fast_hash.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace ehash
+{
+
+/* bits of the hash not used to pick segments (top bits) or buckets (low ones) */
+static uint8_t fingerprint(uint64_t hash)
+{
+	return static_cast<uint8_t>(hash >> 8);
+}
+
+static bucket &probe_bucket(segment &s, uint64_t hash, std::size_t i)
+{
+	return s.buckets[(hash + i) & (SEGMENT_BUCKETS - 1)];
+}
+
+static bool slot_used(const bucket &b, std::size_t slot)
+{
+	return (b.used & (1u << slot)) != 0;
+}
+
+static std::size_t used_slots(const bucket &b)
+{
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < BUCKET_SLOTS; ++i)
+		n += slot_used(b, i) ? 1 : 0;
+
+	return n;
+}
+
+static record_header header_of(const char *record)
+{
+	record_header h;
+	std::memcpy(&h, record, sizeof(h));
+
+	return h;
+}
+
+/*
+ * Marks the segment as modified (odd version) for the lifetime of the object,
+ * so that concurrent reads of the segment are retried. There's a single
+ * writer at a time.
+ */
+class write_guard {
+public:
+	write_guard(segment_desc &desc) : desc(desc)
+	{
+		auto v = desc.version.load(std::memory_order_relaxed);
+		desc.version.store(v + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	~write_guard()
+	{
+		auto v = desc.version.load(std::memory_order_relaxed);
+		desc.version.store(v + 1, std::memory_order_release);
+	}
+
+	write_guard(const write_guard &) = delete;
+	write_guard &operator=(const write_guard &) = delete;
+
+private:
+	segment_desc &desc;
+};
+
+} /* namespace ehash */
+} /* namespace internal */
+
+using namespace internal::ehash;
+
+ehash::ehash(std::unique_ptr<internal::config> cfg)
+    : pmemobj_engine_base(cfg, "pmemkv_ehash"), dir(nullptr), count(0)
+{
+	register_alloc_class(sizeof(segment));
+
+	internal::open_phase phase("ehash.recover");
+	Recover();
+	phase.end();
+
+	LOG("Started ok");
+}
+
+ehash::~ehash()
+{
+	LOG("Stopped ok");
+}
+
+std::string ehash::name()
+{
+	return "ehash";
+}
+
+status ehash::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	check_outside_tx();
+	cnt = count.load(std::memory_order_relaxed);
+
+	return status::OK;
+}
+
+status ehash::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	check_outside_tx();
+	std::lock_guard<std::mutex> lock(mtx);
+
+	for (auto &desc : segments) {
+		for (auto &b : desc->seg->buckets) {
+			for (std::size_t i = 0; i < BUCKET_SLOTS; ++i) {
+				if (!slot_used(b, i))
+					continue;
+
+				auto rec = Record(b.records[i]);
+				auto h = header_of(rec);
+				auto key = rec + sizeof(h);
+				auto ret = callback(key, h.key_size, key + h.key_size,
+						    h.value_size, arg);
+				if (ret != 0)
+					return status::STOPPED_BY_CB;
+			}
+		}
+	}
+
+	return status::OK;
+}
+
+status ehash::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	return Read(key, nullptr) ? status::OK : status::NOT_FOUND;
+}
+
+/* the value is copied (and validated), so the callback is called without locks */
+status ehash::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	std::string value;
+	if (!Read(key, &value)) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	callback(value.data(), value.size(), arg);
+
+	return status::OK;
+}
+
+status ehash::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+
+	auto hash = fast_hash(key.size(), key.data());
+	std::lock_guard<std::mutex> lock(mtx);
+
+	while (true) {
+		auto d = dir.load(std::memory_order_relaxed);
+		auto desc = d->entries[d->index(hash)].load(std::memory_order_relaxed);
+		auto &s = *desc->seg;
+
+		std::size_t slot;
+		auto b = Find(s, hash, key, slot);
+		if (b) {
+			write_guard guard(*desc);
+			pmem::obj::transaction::run(pmpool, [&] {
+				auto old = b->records[slot];
+				pmem::obj::transaction::snapshot(&b->records[slot]);
+				b->records[slot] = NewRecord(hash, key, value);
+				FreeRecord(old);
+			});
+
+			return status::OK;
+		}
+
+		for (std::size_t p = 0; p < PROBE_BUCKETS; ++p) {
+			auto &free = probe_bucket(s, hash, p);
+			for (std::size_t i = 0; i < BUCKET_SLOTS; ++i) {
+				if (slot_used(free, i))
+					continue;
+
+				write_guard guard(*desc);
+				pmem::obj::transaction::run(pmpool, [&] {
+					pmem::obj::transaction::snapshot(&free);
+					free.records[i] = NewRecord(hash, key, value);
+					free.fingerprints[i] = fingerprint(hash);
+					free.used = static_cast<uint8_t>(free.used | (1u << i));
+				});
+				count.fetch_add(1, std::memory_order_relaxed);
+
+				return status::OK;
+			}
+		}
+
+		Split(desc);
+	}
+}
+
+status ehash::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	auto hash = fast_hash(key.size(), key.data());
+	std::lock_guard<std::mutex> lock(mtx);
+
+	auto d = dir.load(std::memory_order_relaxed);
+	auto desc = d->entries[d->index(hash)].load(std::memory_order_relaxed);
+
+	std::size_t slot;
+	auto b = Find(*desc->seg, hash, key, slot);
+	if (!b)
+		return status::NOT_FOUND;
+
+	write_guard guard(*desc);
+	pmem::obj::transaction::run(pmpool, [&] {
+		pmem::obj::transaction::snapshot(b);
+		b->used = static_cast<uint8_t>(b->used & ~(1u << slot));
+		FreeRecord(b->records[slot]);
+	});
+	count.fetch_sub(1, std::memory_order_relaxed);
+
+	return status::OK;
+}
+
+status ehash::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+	std::lock_guard<std::mutex> lock(mtx);
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	auto cnt = count.load(std::memory_order_relaxed);
+	sink.add("count", cnt);
+	sink.add("ehash.segments", segments.size());
+	sink.add("ehash.global_depth", dir.load(std::memory_order_relaxed)->depth);
+	sink.add("ehash.splits", splits);
+	sink.add("ehash.directory_doublings", doublings);
+
+	report_memory(sink, cnt);
+
+	return status::OK;
+}
+
+internal::memory_stats ehash::memory_types()
+{
+	internal::memory_stats mem;
+	mem.add_type(pmem::detail::type_num<segment>(), "segments", sizeof(segment));
+	mem.add_type(pmem::detail::type_num<char>(), "records");
+
+	return mem;
+}
+
+/*
+ * Optimistic read: the version of the segment is checked before sizes read
+ * from a record are used (the record may be freed and its memory reused by
+ * a concurrent writer, but it stays within the pool) and after the value is
+ * copied. If it changed, or the segment was split after it was looked up in
+ * the directory, the read is retried.
+ */
+bool ehash::Read(string_view key, std::string *value)
+{
+	auto hash = fast_hash(key.size(), key.data());
+	auto fp = fingerprint(hash);
+
+	while (true) {
+		auto d = dir.load(std::memory_order_acquire);
+		auto desc = d->entries[d->index(hash)].load(std::memory_order_acquire);
+		auto v = desc->version.load(std::memory_order_acquire);
+		if (v & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (dir.load(std::memory_order_acquire) != d ||
+		    d->entries[d->index(hash)].load(std::memory_order_acquire) != desc)
+			continue;
+
+		auto changed = [&] {
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return desc->version.load(std::memory_order_relaxed) != v;
+		};
+
+		bool found = false, stale = false;
+		for (std::size_t p = 0; p < PROBE_BUCKETS && !found && !stale; ++p) {
+			auto &b = probe_bucket(*desc->seg, hash, p);
+			for (std::size_t i = 0; i < BUCKET_SLOTS; ++i) {
+				if (!slot_used(b, i) || b.fingerprints[i] != fp)
+					continue;
+
+				auto rec = Record(b.records[i]);
+				auto h = header_of(rec);
+				if (h.hash != hash || h.key_size != key.size())
+					continue;
+				if (changed()) {
+					stale = true;
+					break;
+				}
+				if (std::memcmp(rec + sizeof(h), key.data(), key.size()) != 0)
+					continue;
+
+				if (value)
+					value->assign(rec + sizeof(h) + h.key_size,
+						      h.value_size);
+				found = true;
+				break;
+			}
+		}
+
+		if (stale || changed())
+			continue;
+
+		return found;
+	}
+}
+
+bucket *ehash::Find(segment &s, uint64_t hash, string_view key, std::size_t &slot)
+{
+	auto fp = fingerprint(hash);
+	for (std::size_t p = 0; p < PROBE_BUCKETS; ++p) {
+		auto &b = probe_bucket(s, hash, p);
+		for (std::size_t i = 0; i < BUCKET_SLOTS; ++i) {
+			if (!slot_used(b, i) || b.fingerprints[i] != fp)
+				continue;
+
+			auto rec = Record(b.records[i]);
+			auto h = header_of(rec);
+			if (h.hash == hash && h.key_size == key.size() &&
+			    std::memcmp(rec + sizeof(h), key.data(), key.size()) == 0) {
+				slot = i;
+				return &b;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+/*
+ * Records with the next bit of the hash set move to the new segment, to the
+ * same buckets and slots (they are free there, as the new segment gets only
+ * a subset of records of the old one). Old buckets are snapshotted only if
+ * any of their records moves.
+ */
+void ehash::Split(segment_desc *desc)
+{
+	auto depth = desc->depth;
+	if (depth >= MAX_DEPTH)
+		throw internal::error("Too many keys with the same hash prefix");
+
+	auto d = dir.load(std::memory_order_relaxed);
+	if (depth == d->depth) {
+		Double();
+		d = dir.load(std::memory_order_relaxed);
+	}
+
+	/* DRAM structures are updated after the transaction, so they can't fail */
+	segments.reserve(segments.size() + 1);
+	std::unique_ptr<segment_desc> added(
+		new segment_desc(nullptr, depth + 1, (desc->pattern << 1) | 1));
+
+	write_guard guard(*desc);
+
+	auto &s = *desc->seg;
+	const uint64_t bit = uint64_t(1) << (63 - depth);
+	pmem::obj::transaction::run(pmpool, [&] {
+		auto n = pmem::obj::make_persistent<segment>(
+			internal::alloc_class_flag(pmpool.handle(), sizeof(segment)));
+
+		for (std::size_t i = 0; i < SEGMENT_BUCKETS; ++i) {
+			auto &src = s.buckets[i];
+			auto &dst = n->buckets[i];
+
+			unsigned moved = 0;
+			for (std::size_t slot = 0; slot < BUCKET_SLOTS; ++slot) {
+				if (slot_used(src, slot) &&
+				    (header_of(Record(src.records[slot])).hash & bit))
+					moved |= 1u << slot;
+			}
+			if (moved == 0)
+				continue;
+
+			pmem::obj::transaction::snapshot(&src);
+			for (std::size_t slot = 0; slot < BUCKET_SLOTS; ++slot) {
+				if ((moved & (1u << slot)) == 0)
+					continue;
+				dst.fingerprints[slot] = src.fingerprints[slot];
+				dst.records[slot] = src.records[slot];
+			}
+			dst.used = static_cast<uint8_t>(moved);
+			src.used = static_cast<uint8_t>(src.used & ~moved);
+		}
+
+		n->depth = added->depth;
+		n->pattern = added->pattern;
+		n->next = pmem_root->head;
+		s.depth = depth + 1;
+		s.pattern = desc->pattern << 1;
+		pmem_root->head = n;
+
+		added->seg = n.get();
+	});
+
+	desc->depth = depth + 1;
+	desc->pattern <<= 1;
+
+	/* the upper half of directory entries of the segment point to the new one */
+	auto shift = d->depth - added->depth;
+	auto first = static_cast<std::size_t>(added->pattern << shift);
+	for (std::size_t i = first; i < first + (std::size_t(1) << shift); ++i)
+		d->entries[i].store(added.get(), std::memory_order_release);
+
+	segments.push_back(std::move(added));
+	splits++;
+}
+
+/*
+ * The new directory has every entry of the old one twice. Readers which still
+ * use the old one notice it was replaced and retry, so it's kept until close.
+ */
+void ehash::Double()
+{
+	auto old = dir.load(std::memory_order_relaxed);
+
+	directories.reserve(directories.size() + 1);
+	std::unique_ptr<directory> d(new directory(old->depth + 1));
+	for (std::size_t i = 0; i < old->size(); ++i) {
+		auto desc = old->entries[i].load(std::memory_order_relaxed);
+		d->entries[2 * i].store(desc, std::memory_order_relaxed);
+		d->entries[2 * i + 1].store(desc, std::memory_order_relaxed);
+	}
+
+	dir.store(d.get(), std::memory_order_release);
+	directories.push_back(std::move(d));
+	doublings++;
+}
+
+uint64_t ehash::NewRecord(uint64_t hash, string_view key, string_view value)
+{
+	record_header h{hash, key.size(), value.size()};
+	auto rec = pmem::obj::make_persistent<char[]>(sizeof(h) + key.size() +
+						      value.size());
+
+	char *dest = rec.get();
+	std::memcpy(dest, &h, sizeof(h));
+	std::memcpy(dest + sizeof(h), key.data(), key.size());
+	std::memcpy(dest + sizeof(h) + key.size(), value.data(), value.size());
+	pmpool.persist(dest, sizeof(h) + key.size() + value.size());
+
+	return rec.raw().off;
+}
+
+void ehash::FreeRecord(uint64_t offset)
+{
+	auto rec = Record(offset);
+	auto h = header_of(rec);
+	pmem::obj::persistent_ptr<char[]> ptr(pmemobj_oid(rec));
+	pmem::obj::delete_persistent<char[]>(ptr,
+					     sizeof(h) + h.key_size + h.value_size);
+}
+
+/* the directory covers every segment with 2^(global depth - its depth) entries */
+void ehash::Recover()
+{
+	if (OID_IS_NULL(*root_oid)) {
+		pmem::obj::transaction::run(pmpool, [&] {
+			pmem::obj::transaction::snapshot(root_oid);
+			auto root = pmem::obj::make_persistent<pmem_type>();
+			root->head = pmem::obj::make_persistent<segment>(
+				internal::alloc_class_flag(pmpool.handle(),
+							   sizeof(segment)));
+			*root_oid = root.raw();
+		});
+	}
+
+	pmem_root = static_cast<pmem_type *>(pmemobj_direct(*root_oid));
+
+	std::size_t depth = 0, cnt = 0;
+	for (segment_ptr s = pmem_root->head; s != nullptr; s = s->next) {
+		segments.emplace_back(new segment_desc(s.get(), s->depth, s->pattern));
+		depth = std::max<std::size_t>(depth, s->depth);
+		for (auto &b : s->buckets)
+			cnt += used_slots(b);
+	}
+
+	std::unique_ptr<directory> d(new directory(depth));
+	for (auto &desc : segments) {
+		auto shift = depth - desc->depth;
+		auto first = static_cast<std::size_t>(desc->pattern << shift);
+		for (std::size_t i = first; i < first + (std::size_t(1) << shift); ++i)
+			d->entries[i].store(desc.get(), std::memory_order_relaxed);
+	}
+
+	dir.store(d.get(), std::memory_order_release);
+	directories.push_back(std::move(d));
+	count.store(cnt, std::memory_order_relaxed);
+}
+
+static factory_registerer
+	register_ehash(std::unique_ptr<engine_base::factory_base>(new ehash_factory));
+
+} // namespace kv
+} // namespace pmem
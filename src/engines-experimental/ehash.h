@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_EHASH_H
+#define LIBPMEMKV_EHASH_H
+
+#include "../pmemobj_engine.h"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/make_persistent_array.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace ehash
+{
+
+/* slots of a bucket, so that a bucket takes a single cache line */
+static constexpr std::size_t BUCKET_SLOTS = 7;
+static constexpr std::size_t SEGMENT_BUCKETS = 256;
+/* a key may be stored in its bucket or in the following ones */
+static constexpr std::size_t PROBE_BUCKETS = 2;
+/* limit of splits of a segment (keys with equal hashes can't be split) */
+static constexpr std::size_t MAX_DEPTH = 48;
+
+/*
+ * Slots with records (offsets in the pool) and one-byte fingerprints of
+ * their hashes, so that most of the records which don't match are not read.
+ */
+struct bucket {
+	uint8_t fingerprints[BUCKET_SLOTS];
+	/* bitmap of slots in use */
+	uint8_t used;
+	uint64_t records[BUCKET_SLOTS];
+};
+
+static_assert(sizeof(bucket) == 64, "bucket has to take a cache line");
+
+/*
+ * Segment holds keys with the top 'depth' bits of hashes equal to 'pattern'.
+ * Within the segment, keys are placed by the low bits of hashes.
+ */
+struct segment {
+	segment() : next(nullptr), depth(0), pattern(0)
+	{
+		std::memset(reserved, 0, sizeof(reserved));
+		std::memset(buckets, 0, sizeof(buckets));
+	}
+
+	pmem::obj::persistent_ptr<segment> next;
+	pmem::obj::p<uint64_t> depth;
+	pmem::obj::p<uint64_t> pattern;
+	/* pads the header to a cache line */
+	uint64_t reserved[4];
+	bucket buckets[SEGMENT_BUCKETS];
+};
+
+struct pmem_type {
+	pmem_type() : head(nullptr)
+	{
+		std::memset(reserved, 0, sizeof(reserved));
+	}
+
+	/* list of all segments (in no particular order) */
+	pmem::obj::persistent_ptr<segment> head;
+	uint64_t reserved[8];
+};
+
+/* record is the header followed by the key and the value */
+struct record_header {
+	uint64_t hash;
+	uint64_t key_size;
+	uint64_t value_size;
+};
+
+/* DRAM state of a segment, kept until the engine is closed */
+struct segment_desc {
+	segment_desc(segment *seg, std::size_t depth, uint64_t pattern)
+	    : seg(seg), depth(depth), pattern(pattern), version(0)
+	{
+	}
+
+	segment *seg;
+	std::size_t depth;
+	uint64_t pattern;
+	/* odd while the segment is modified */
+	std::atomic<uint64_t> version;
+};
+
+/* directory of segments, indexed by the top 'depth' bits of hashes */
+struct directory {
+	directory(std::size_t depth)
+	    : depth(depth), entries(new std::atomic<segment_desc *>[size()])
+	{
+	}
+
+	std::size_t size() const
+	{
+		return std::size_t(1) << depth;
+	}
+
+	std::size_t index(uint64_t hash) const
+	{
+		return depth == 0 ? 0 : static_cast<std::size_t>(hash >> (64 - depth));
+	}
+
+	const std::size_t depth;
+	std::unique_ptr<std::atomic<segment_desc *>[]> entries;
+};
+
+} /* namespace ehash */
+} /* namespace internal */
+
+/**
+ * Persistent hash table with extendible hashing (as in CCEH and Dash). Keys
+ * are hashed to segments of cache-line buckets by a directory, kept in DRAM
+ * (and rebuilt from the segments when the pool is opened). A full segment is
+ * split in two, with a single transaction which moves only its own records,
+ * so the table grows one segment at a time, without rehashing all keys.
+ * The directory is doubled (in DRAM only) when a segment splits past it.
+ *
+ * Keys and values (of any size) are stored out of line, in records pointed
+ * to by slots of buckets; fingerprints of hashes let lookups skip most of
+ * the records which don't match.
+ *
+ * Reads (get and exists) take no locks: they validate the version of the
+ * segment (odd while a writer modifies it) and retry if it changed.
+ * Writers are serialized, as are scans (get_all), which block writers.
+ */
+class ehash : public pmemobj_engine_base<internal::ehash::pmem_type> {
+public:
+	ehash(std::unique_ptr<internal::config> cfg);
+	~ehash();
+
+	ehash(const ehash &) = delete;
+	ehash &operator=(const ehash &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status get_all(get_kv_callback *callback, void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+
+	status stats(internal::stats_sink &sink) final;
+
+protected:
+	internal::memory_stats memory_types() final;
+
+private:
+	using segment_ptr = pmem::obj::persistent_ptr<internal::ehash::segment>;
+
+	void Recover();
+
+	/* Copies the value of the key to 'value' (if not null), without locks */
+	bool Read(string_view key, std::string *value);
+
+	/* Returns the bucket and the slot of the key, or nullptr (writers only) */
+	internal::ehash::bucket *Find(internal::ehash::segment &s, uint64_t hash,
+				      string_view key, std::size_t &slot);
+	/* Splits the segment in two, doubling the directory if needed */
+	void Split(internal::ehash::segment_desc *desc);
+	void Double();
+
+	/* Allocates a record, must be called in a transaction */
+	uint64_t NewRecord(uint64_t hash, string_view key, string_view value);
+	void FreeRecord(uint64_t offset);
+	const char *Record(uint64_t offset)
+	{
+		return reinterpret_cast<const char *>(pmpool.handle()) + offset;
+	}
+
+	internal::ehash::pmem_type *pmem_root = nullptr;
+
+	/* descriptors of all segments and all directories (old ones may be read) */
+	std::vector<std::unique_ptr<internal::ehash::segment_desc>> segments;
+	std::vector<std::unique_ptr<internal::ehash::directory>> directories;
+	std::atomic<internal::ehash::directory *> dir;
+
+	std::atomic<std::size_t> count;
+	uint64_t splits = 0;
+	uint64_t doublings = 0;
+
+	/* serializes writers and scans */
+	std::mutex mtx;
+};
+
+class ehash_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new ehash(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "ehash";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_EHASH_H */
@@ -0,0 +1,1050 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "lindex.h"
+#include "../exceptions.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace lindex
+{
+
+void learned_model::build(const std::vector<uint64_t> &keys, std::size_t epsilon)
+{
+	const double eps = static_cast<double>(epsilon);
+
+	model.clear();
+	size = keys.size();
+
+	std::size_t i = 0;
+	while (i < size) {
+		/* slopes of lines through the first point, which fit all points */
+		double slope_lo = 0;
+		double slope_hi = std::numeric_limits<double>::infinity();
+
+		std::size_t j = i + 1;
+		for (; j < size; ++j) {
+			auto dx = static_cast<double>(keys[j] - keys[i]);
+			auto dy = static_cast<double>(j - i);
+			auto lo = (dy - eps) / dx;
+			auto hi = (dy + eps) / dx;
+			if (lo > slope_hi || hi < slope_lo)
+				break;
+
+			slope_lo = std::max(slope_lo, lo);
+			slope_hi = std::min(slope_hi, hi);
+		}
+
+		double slope = j - i > 1 ? (slope_lo + slope_hi) / 2 : 0;
+		model.push_back({keys[i], static_cast<double>(i), slope});
+		i = j;
+	}
+}
+
+/* predictions don't pass the first position of the next piece */
+std::size_t learned_model::predict(uint64_t key) const
+{
+	auto it = std::upper_bound(
+		model.begin(), model.end(), key,
+		[](uint64_t k, const piece &p) { return k < p.first_key; });
+	if (it == model.begin())
+		return 0;
+
+	auto next = it--;
+	double pos = it->first_pos + it->slope * static_cast<double>(key - it->first_key);
+	double max = next != model.end() ? next->first_pos : static_cast<double>(size - 1);
+
+	return static_cast<std::size_t>(std::min(pos, max) + 0.5);
+}
+
+/* Returns the first 8 bytes of the key (padded with zeros) as an integer */
+static uint64_t key_to_int(string_view key)
+{
+	uint64_t k = 0;
+	for (std::size_t i = 0; i < KEY_SIZE; ++i) {
+		auto byte = i < key.size() ? static_cast<unsigned char>(key.data()[i]) : 0;
+		k = (k << 8) | byte;
+	}
+
+	return k;
+}
+
+static void int_to_key(uint64_t k, char *key)
+{
+	for (std::size_t i = KEY_SIZE; i > 0; --i) {
+		key[i - 1] = static_cast<char>(k & 0xff);
+		k >>= 8;
+	}
+}
+
+/* Returns false if the key can't be stored in the engine */
+static bool exact_key(string_view key, uint64_t &k)
+{
+	if (key.size() != KEY_SIZE)
+		return false;
+
+	k = key_to_int(key);
+	return true;
+}
+
+/*
+ * Bounds of keys greater (lower) than a key of any size, compared bytewise.
+ * An 8-byte key is greater than a shorter one if it's not lower than the
+ * shorter one padded with zeros, and greater than a longer one if it's
+ * greater than its first 8 bytes.
+ */
+static key_bound bound_above(string_view key, bool eq)
+{
+	auto k = key_to_int(key);
+	if (key.size() < KEY_SIZE)
+		return {k, true};
+	if (key.size() > KEY_SIZE)
+		return {k, false};
+	return {k, eq};
+}
+
+static key_bound bound_below(string_view key, bool eq)
+{
+	auto k = key_to_int(key);
+	if (key.size() < KEY_SIZE)
+		return {k, false};
+	if (key.size() > KEY_SIZE)
+		return {k, true};
+	return {k, eq};
+}
+
+static bool above(uint64_t key, const key_bound &bound)
+{
+	return key > bound.key || (bound.eq && key == bound.key);
+}
+
+static bool below(uint64_t key, const key_bound &bound)
+{
+	return key < bound.key || (bound.eq && key == bound.key);
+}
+
+static string_view value_of(const entry &e)
+{
+	const char *data = e.value.get();
+	uint64_t size;
+	std::memcpy(&size, data, sizeof(size));
+
+	return string_view(data + sizeof(size), static_cast<std::size_t>(size));
+}
+
+/* Returns the position of the first entry of the sorted array not lower than key */
+static std::size_t sorted_lower(const segment &s, uint64_t key)
+{
+	std::size_t n = s.sorted;
+	auto it = std::lower_bound(
+		s.entries, s.entries + n, key,
+		[](const entry &e, uint64_t k) { return e.key < k; });
+
+	return internal::distance(s.entries, it);
+}
+
+/* Returns the position of the first entry of the sorted array greater than key */
+static std::size_t sorted_upper(const segment &s, uint64_t key)
+{
+	std::size_t n = s.sorted;
+	auto it = std::upper_bound(
+		s.entries, s.entries + n, key,
+		[](uint64_t k, const entry &e) { return k < e.key; });
+
+	return internal::distance(s.entries, it);
+}
+
+/* Returns the entry of the key (removed one, in the sorted array), or nullptr */
+static entry *find_entry(segment &s, uint64_t key)
+{
+	std::size_t n = s.sorted;
+	auto i = sorted_lower(s, key);
+	if (i < n && s.entries[i].key == key)
+		return &s.entries[i];
+
+	std::size_t d = s.delta;
+	for (i = 0; i < d; ++i) {
+		if (s.buffer[i].key == key)
+			return &s.buffer[i];
+	}
+
+	return nullptr;
+}
+
+/* Fills 'out' with entries of the segment (with values), in order of keys */
+static void segment_entries(const segment &s, std::vector<const entry *> &out)
+{
+	std::size_t n = s.sorted;
+	std::size_t d = s.delta;
+
+	const entry *buffered[DELTA_KEYS];
+	for (std::size_t i = 0; i < d; ++i)
+		buffered[i] = &s.buffer[i];
+	std::sort(buffered, buffered + d,
+		  [](const entry *a, const entry *b) { return a->key < b->key; });
+
+	out.clear();
+	std::size_t j = 0;
+	for (std::size_t i = 0; i < n; ++i) {
+		auto &e = s.entries[i];
+		while (j < d && buffered[j]->key < e.key)
+			out.push_back(buffered[j++]);
+		if (e.value != nullptr)
+			out.push_back(&e);
+	}
+	while (j < d)
+		out.push_back(buffered[j++]);
+}
+
+/* Sets key to the lowest key of the segment within the bound */
+static bool segment_higher(const segment &s, const key_bound &bound, uint64_t &key)
+{
+	bool found = false;
+
+	std::size_t n = s.sorted;
+	for (auto i = sorted_lower(s, bound.key); i < n; ++i) {
+		auto &e = s.entries[i];
+		if (e.value != nullptr && above(e.key, bound)) {
+			key = e.key;
+			found = true;
+			break;
+		}
+	}
+
+	std::size_t d = s.delta;
+	for (std::size_t i = 0; i < d; ++i) {
+		auto k = s.buffer[i].key;
+		if (above(k, bound) && (!found || k < key)) {
+			key = k;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+/* Sets key to the highest key of the segment within the bound */
+static bool segment_lower(const segment &s, const key_bound &bound, uint64_t &key)
+{
+	bool found = false;
+
+	for (auto i = sorted_upper(s, bound.key); i > 0; --i) {
+		auto &e = s.entries[i - 1];
+		if (e.value != nullptr && below(e.key, bound)) {
+			key = e.key;
+			found = true;
+			break;
+		}
+	}
+
+	std::size_t d = s.delta;
+	for (std::size_t i = 0; i < d; ++i) {
+		auto k = s.buffer[i].key;
+		if (below(k, bound) && (!found || k > key)) {
+			key = k;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+} /* namespace lindex */
+} /* namespace internal */
+
+using namespace internal::lindex;
+
+lindex::lindex(std::unique_ptr<internal::config> cfg)
+    : pmemobj_engine_base(cfg, "pmemkv_lindex"), mtx(std::thread::hardware_concurrency())
+{
+	register_alloc_class(sizeof(segment));
+
+	internal::open_phase phase("lindex.recover");
+	Recover();
+	phase.end();
+
+	LOG("Started ok");
+}
+
+lindex::~lindex()
+{
+	LOG("Stopped ok");
+}
+
+std::string lindex::name()
+{
+	return "lindex";
+}
+
+status lindex::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	cnt = count;
+
+	return status::OK;
+}
+
+status lindex::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return CountRange(&low, false, nullptr, false, cnt);
+}
+
+status lindex::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return CountRange(&low, true, nullptr, false, cnt);
+}
+
+status lindex::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return CountRange(nullptr, false, &high, true, cnt);
+}
+
+status lindex::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return CountRange(nullptr, false, &high, false, cnt);
+}
+
+status lindex::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between for key1=" << std::string(key1.data(), key1.size())
+				      << ", key2="
+				      << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	std::string low(key1.data(), key1.size());
+	std::string high(key2.data(), key2.size());
+	return CountRange(&low, false, &high, false, cnt);
+}
+
+status lindex::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	check_outside_tx();
+	return GetRange(nullptr, false, nullptr, false, callback, arg);
+}
+
+status lindex::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return GetRange(&low, false, nullptr, false, callback, arg);
+}
+
+status lindex::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return GetRange(&low, true, nullptr, false, callback, arg);
+}
+
+status lindex::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return GetRange(nullptr, false, &high, true, callback, arg);
+}
+
+status lindex::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return GetRange(nullptr, false, &high, false, callback, arg);
+}
+
+status lindex::get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg)
+{
+	LOG("get_between for key1=" << std::string(key1.data(), key1.size())
+				    << ", key2="
+				    << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	std::string low(key1.data(), key1.size());
+	std::string high(key2.data(), key2.size());
+	return GetRange(&low, false, &high, false, callback, arg);
+}
+
+status lindex::GetRange(const std::string *low, bool low_eq, const std::string *high,
+			bool high_eq, get_kv_callback *callback, void *arg)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	key_bound low_bound{0, false}, high_bound{0, false};
+	if (low)
+		low_bound = bound_above(*low, low_eq);
+	if (high)
+		high_bound = bound_below(*high, high_eq);
+
+	char key[KEY_SIZE];
+	auto ret = Scan(low ? &low_bound : nullptr, high ? &high_bound : nullptr,
+			[&](uint64_t k, const entry &e) {
+				int_to_key(k, key);
+				auto value = value_of(e);
+				return callback(key, KEY_SIZE, value.data(), value.size(),
+						arg);
+			});
+
+	return ret != 0 ? status::STOPPED_BY_CB : status::OK;
+}
+
+status lindex::CountRange(const std::string *low, bool low_eq, const std::string *high,
+			  bool high_eq, std::size_t &cnt)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	key_bound low_bound{0, false}, high_bound{0, false};
+	if (low)
+		low_bound = bound_above(*low, low_eq);
+	if (high)
+		high_bound = bound_below(*high, high_eq);
+
+	std::size_t result = 0;
+	Scan(low ? &low_bound : nullptr, high ? &high_bound : nullptr,
+	     [&](uint64_t, const entry &) {
+		     result++;
+		     return 0;
+	     });
+
+	cnt = result;
+
+	return status::OK;
+}
+
+status lindex::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t k;
+	if (!exact_key(key, k))
+		return status::NOT_FOUND;
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	return Find(k) ? status::OK : status::NOT_FOUND;
+}
+
+status lindex::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t k;
+	if (!exact_key(key, k))
+		return status::NOT_FOUND;
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto e = Find(k);
+	if (!e) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	auto value = value_of(*e);
+	callback(value.data(), value.size(), arg);
+
+	return status::OK;
+}
+
+status lindex::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+
+	uint64_t k;
+	if (!exact_key(key, k))
+		throw internal::invalid_argument("Keys of lindex must have " +
+						 std::to_string(KEY_SIZE) + " bytes");
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto idx = FindSegment(k);
+	auto &s = *segments[idx];
+
+	auto e = find_entry(s, k);
+	if (e) {
+		bool removed = e->value == nullptr;
+		pmem::obj::transaction::run(pmpool, [&] {
+			auto old = e->value;
+			e->value = AllocValue(value);
+			if (!removed)
+				FreeValue(old);
+		});
+
+		if (removed)
+			count++;
+		return status::OK;
+	}
+
+	std::size_t d = s.delta;
+	if (d < DELTA_KEYS) {
+		pmem::obj::transaction::run(pmpool, [&] {
+			auto &b = s.buffer[d];
+			pmem::obj::transaction::snapshot(&b.key);
+			b.key = k;
+			b.value = AllocValue(value);
+			s.delta = static_cast<uint32_t>(d + 1);
+		});
+	} else {
+		Rebuild(idx, k, value);
+	}
+
+	count++;
+
+	return status::OK;
+}
+
+/*
+ * Keys of the sorted array are only marked as removed (until the segment is
+ * rebuilt), a key of the buffer is replaced by the last one.
+ */
+status lindex::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t k;
+	if (!exact_key(key, k))
+		return status::NOT_FOUND;
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto &s = *segments[FindSegment(k)];
+	auto e = find_entry(s, k);
+	if (!e || e->value == nullptr)
+		return status::NOT_FOUND;
+
+	pmem::obj::transaction::run(pmpool, [&] {
+		FreeValue(e->value);
+
+		std::size_t d = s.delta;
+		if (e >= &s.buffer[0]) {
+			auto &last = s.buffer[d - 1];
+			if (e != &last) {
+				pmem::obj::transaction::snapshot(&e->key);
+				e->key = last.key;
+				e->value = last.value;
+			}
+			s.delta = static_cast<uint32_t>(d - 1);
+		} else {
+			e->value = nullptr;
+		}
+	});
+
+	count--;
+
+	return status::OK;
+}
+
+internal::iterator_base *lindex::new_iterator()
+{
+	return new lindex_iterator{this};
+}
+
+internal::iterator_base *lindex::new_const_iterator()
+{
+	return new lindex_const_iterator{this};
+}
+
+status lindex::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	sink.add("count", count);
+	sink.add("lindex.segments", segments.size());
+	sink.add("lindex.model_pieces", model.pieces());
+	sink.add("lindex.segment_rebuilds", rebuilds);
+	sink.add("lindex.model_builds", model_builds);
+
+	report_memory(sink, count);
+
+	return status::OK;
+}
+
+internal::memory_stats lindex::memory_types()
+{
+	internal::memory_stats mem;
+	mem.add_type(pmem::detail::type_num<segment>(), "segments", sizeof(segment));
+	mem.add_type(pmem::detail::type_num<char>(), "values");
+
+	return mem;
+}
+
+/*
+ * The window of segments around the predicted position grows with segments
+ * added since the model was built (each of them shifts positions by one);
+ * if the key is not within it (e.g. it's far beyond the keys the model was
+ * built for), all segments are searched.
+ */
+std::size_t lindex::FindSegment(uint64_t key) const
+{
+	assert(!lows.empty() && lows[0] == 0);
+
+	auto n = lows.size();
+	auto err = MODEL_EPSILON + drift + 1;
+	auto pos = std::min(model.predict(key), n - 1);
+	auto lo = pos > err ? pos - err : 0;
+	auto hi = std::min(n, pos + err + 1);
+
+	auto first = lows.begin();
+	auto last = lows.end();
+	if (lows[lo] <= key && (hi == n || lows[hi] > key)) {
+		first += static_cast<std::ptrdiff_t>(lo);
+		last = lows.begin() + static_cast<std::ptrdiff_t>(hi);
+	}
+
+	return internal::distance(lows.begin(), std::upper_bound(first, last, key)) - 1;
+}
+
+entry *lindex::Find(uint64_t key) const
+{
+	auto e = find_entry(*segments[FindSegment(key)], key);
+
+	return e && e->value != nullptr ? e : nullptr;
+}
+
+bool lindex::Higher(const key_bound &bound, uint64_t &key) const
+{
+	for (auto i = FindSegment(bound.key); i < segments.size(); ++i) {
+		if (segment_higher(*segments[i], bound, key))
+			return true;
+	}
+
+	return false;
+}
+
+/* keys lower than the bound may only be in segments up to the one of the bound */
+bool lindex::Lower(const key_bound &bound, uint64_t &key) const
+{
+	for (auto i = FindSegment(bound.key) + 1; i > 0; --i) {
+		if (segment_lower(*segments[i - 1], bound, key))
+			return true;
+	}
+
+	return false;
+}
+
+int lindex::Scan(const key_bound *low, const key_bound *high,
+		 const entry_function &f) const
+{
+	std::vector<const entry *> entries;
+	entries.reserve(SEGMENT_KEYS + DELTA_KEYS);
+
+	for (auto i = low ? FindSegment(low->key) : 0; i < segments.size(); ++i) {
+		auto &s = *segments[i];
+		if (high && !below(s.low, *high))
+			break;
+
+		segment_entries(s, entries);
+		for (auto e : entries) {
+			if (low && !above(e->key, *low))
+				continue;
+			if (high && !below(e->key, *high))
+				return 0;
+
+			auto ret = f(e->key, *e);
+			if (ret != 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Live entries of the segment (with the new one) are copied to a new segment
+ * or, if they don't fit in its sorted array, split in halves between two new
+ * ones. Values are not copied, new entries point to the same ones.
+ */
+void lindex::Rebuild(std::size_t idx, uint64_t key, string_view value)
+{
+	auto old = segments[idx];
+
+	std::vector<const entry *> live;
+	segment_entries(*old, live);
+
+	std::size_t total = live.size() + 1;
+	std::size_t first = total > SEGMENT_KEYS ? total / 2 : total;
+
+	/* DRAM structures are updated after the transaction, so they can't fail */
+	segments.reserve(segments.size() + 1);
+	lows.reserve(lows.size() + 1);
+
+	segment_ptr parts[2];
+	pmem::obj::transaction::run(pmpool, [&] {
+		std::vector<entry> merged;
+		merged.reserve(total);
+		auto pos = std::lower_bound(
+			live.begin(), live.end(), key,
+			[](const entry *e, uint64_t k) { return e->key < k; });
+		for (auto it = live.begin(); it != pos; ++it)
+			merged.push_back(**it);
+		merged.push_back(entry{key, AllocValue(value)});
+		for (auto it = pos; it != live.end(); ++it)
+			merged.push_back(**it);
+
+		auto flag = internal::alloc_class_flag(pmpool.handle(), sizeof(segment));
+		auto fill = [&](segment &s, std::size_t from, std::size_t to) {
+			for (auto i = from; i < to; ++i)
+				s.entries[i - from] = merged[i];
+			s.sorted = static_cast<uint32_t>(to - from);
+		};
+
+		parts[0] = pmem::obj::make_persistent<segment>(flag);
+		parts[0]->low = old->low;
+		parts[0]->next = old->next;
+		fill(*parts[0], 0, first);
+
+		if (first < total) {
+			parts[1] = pmem::obj::make_persistent<segment>(flag);
+			parts[1]->low = merged[first].key;
+			parts[1]->next = old->next;
+			fill(*parts[1], first, total);
+			parts[0]->next = parts[1];
+		}
+
+		if (idx == 0)
+			pmem_root->head = parts[0];
+		else
+			segments[idx - 1]->next = parts[0];
+
+		pmem::obj::delete_persistent<segment>(old);
+	});
+
+	segments[idx] = parts[0];
+	if (parts[1] != nullptr) {
+		auto pos = static_cast<std::ptrdiff_t>(idx + 1);
+		segments.insert(segments.begin() + pos, parts[1]);
+		lows.insert(lows.begin() + pos, static_cast<uint64_t>(parts[1]->low));
+		if (++drift > MODEL_EPSILON)
+			BuildModel();
+	}
+
+	rebuilds++;
+}
+
+pmem::obj::persistent_ptr<char[]> lindex::AllocValue(string_view value)
+{
+	uint64_t size = value.size();
+	auto v = pmem::obj::make_persistent<char[]>(sizeof(size) + value.size());
+	pmpool.memcpy_persist(v.get(), &size, sizeof(size));
+	pmpool.memcpy_persist(v.get() + sizeof(size), value.data(), value.size());
+
+	return v;
+}
+
+void lindex::FreeValue(pmem::obj::persistent_ptr<char[]> value)
+{
+	uint64_t size;
+	std::memcpy(&size, value.get(), sizeof(size));
+	pmem::obj::delete_persistent<char[]>(value, sizeof(size) + size);
+}
+
+void lindex::BuildModel()
+{
+	model.build(lows, MODEL_EPSILON);
+	drift = 0;
+	model_builds++;
+}
+
+void lindex::Recover()
+{
+	if (OID_IS_NULL(*root_oid)) {
+		pmem::obj::transaction::run(pmpool, [&] {
+			pmem::obj::transaction::snapshot(root_oid);
+			auto root = pmem::obj::make_persistent<pmem_type>();
+			root->head = pmem::obj::make_persistent<segment>(
+				internal::alloc_class_flag(pmpool.handle(),
+							   sizeof(segment)));
+			*root_oid = root.raw();
+		});
+	}
+
+	pmem_root = static_cast<pmem_type *>(pmemobj_direct(*root_oid));
+
+	for (segment_ptr s = pmem_root->head; s != nullptr; s = s->next) {
+		segments.push_back(s);
+		lows.push_back(s->low);
+
+		std::size_t n = s->sorted;
+		std::size_t d = s->delta;
+		count += d;
+		for (std::size_t i = 0; i < n; ++i) {
+			if (s->entries[i].value != nullptr)
+				count++;
+		}
+	}
+
+	BuildModel();
+}
+
+// ===============================================================================================
+// ITERATOR METHODS
+// ===============================================================================================
+
+lindex::lindex_const_iterator::lindex_const_iterator(lindex *engine) : engine(engine)
+{
+}
+
+lindex::lindex_iterator::lindex_iterator(lindex *engine)
+    : lindex::lindex_const_iterator(engine)
+{
+}
+
+status lindex::lindex_const_iterator::set(bool found, uint64_t key)
+{
+	valid = found;
+	if (found)
+		current_key = key;
+
+	return found ? status::OK : status::NOT_FOUND;
+}
+
+bool lindex::lindex_const_iterator::below_bound(uint64_t key)
+{
+	int_to_key(key, key_buf);
+
+	return !bound.reached(string_view(key_buf, KEY_SIZE));
+}
+
+status lindex::lindex_const_iterator::set_forward(bool found, uint64_t key)
+{
+	return set(found && below_bound(key), key);
+}
+
+const entry &lindex::lindex_const_iterator::current() const
+{
+	assert(valid);
+	auto e = engine->Find(current_key);
+	assert(e);
+
+	return *e;
+}
+
+status lindex::lindex_const_iterator::seek(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	uint64_t k = 0;
+	bool found = exact_key(key, k) && engine->Find(k) != nullptr;
+
+	return set(found, k);
+}
+
+status lindex::lindex_const_iterator::seek_lower(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	uint64_t k = 0;
+	bool found = engine->Lower(bound_below(key, false), k);
+
+	return set(found, k);
+}
+
+status lindex::lindex_const_iterator::seek_lower_eq(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	uint64_t k = 0;
+	bool found = engine->Lower(bound_below(key, true), k);
+
+	return set(found, k);
+}
+
+status lindex::lindex_const_iterator::seek_higher(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	uint64_t k = 0;
+	bool found = engine->Higher(bound_above(key, false), k);
+
+	return set_forward(found, k);
+}
+
+status lindex::lindex_const_iterator::seek_higher_eq(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	uint64_t k = 0;
+	bool found = engine->Higher(bound_above(key, true), k);
+
+	return set_forward(found, k);
+}
+
+status lindex::lindex_const_iterator::seek_to_first()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	uint64_t k = 0;
+	bool found = engine->Higher({0, true}, k);
+
+	return set_forward(found, k);
+}
+
+status lindex::lindex_const_iterator::seek_to_last()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	uint64_t k = 0;
+	bool found = engine->Lower({std::numeric_limits<uint64_t>::max(), true}, k);
+
+	return set(found, k);
+}
+
+status lindex::lindex_const_iterator::is_next()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	if (!valid)
+		return status::NOT_FOUND;
+
+	uint64_t k;
+	bool found = engine->Higher({current_key, false}, k) && below_bound(k);
+
+	return found ? status::OK : status::NOT_FOUND;
+}
+
+status lindex::lindex_const_iterator::next()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	if (!valid)
+		return status::NOT_FOUND;
+
+	uint64_t k = 0;
+	bool found = engine->Higher({current_key, false}, k);
+
+	return set_forward(found, k);
+}
+
+status lindex::lindex_const_iterator::prev()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	if (!valid)
+		return status::NOT_FOUND;
+
+	/* stays at the first element, if there's nothing before it */
+	uint64_t k;
+	if (!engine->Lower({current_key, false}, k))
+		return status::NOT_FOUND;
+
+	current_key = k;
+
+	return status::OK;
+}
+
+status lindex::lindex_const_iterator::set_upper_bound(const string_view *key)
+{
+	bound.set(key);
+
+	return status::OK;
+}
+
+result<string_view> lindex::lindex_const_iterator::key()
+{
+	assert(valid);
+	int_to_key(current_key, key_buf);
+
+	return string_view(key_buf, KEY_SIZE);
+}
+
+result<pmem::obj::slice<const char *>>
+lindex::lindex_const_iterator::read_range(size_t pos, size_t n)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	auto value = value_of(current());
+
+	if (pos + n > value.size() || pos + n < pos)
+		n = value.size() - pos;
+
+	auto val = value.data() + pos;
+
+	return {pmem::obj::slice<const char *>(val, val + n)};
+}
+
+result<pmem::obj::slice<char *>> lindex::lindex_iterator::write_range(size_t pos,
+								      size_t n)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	auto value = value_of(current());
+
+	if (pos + n > value.size() || pos + n < pos)
+		n = value.size() - pos;
+
+	log.push_back({std::string(value.data() + pos, n), pos});
+	auto &val = log.back().first;
+
+	return {{&val[0], &val[0] + n}};
+}
+
+status lindex::lindex_iterator::commit()
+{
+	std::unique_lock<mutex_type> lock(engine->mtx);
+	pmem::obj::transaction::run(engine->pmpool, [&] {
+		auto val = const_cast<char *>(value_of(current()).data());
+		for (auto &p : log) {
+			if (p.first.empty())
+				continue;
+			pmem::obj::transaction::snapshot(val + p.second, p.first.size());
+			std::copy(p.first.begin(), p.first.end(), val + p.second);
+		}
+	});
+	log.clear();
+
+	return status::OK;
+}
+
+void lindex::lindex_iterator::abort()
+{
+	log.clear();
+}
+
+static factory_registerer
+	register_lindex(std::unique_ptr<engine_base::factory_base>(new lindex_factory));
+
+} // namespace kv
+} // namespace pmem
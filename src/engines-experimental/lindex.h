@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_LINDEX_H
+#define LIBPMEMKV_LINDEX_H
+
+#include "../iterator.h"
+#include "../pmemobj_engine.h"
+#include "../sharded_shared_mutex.h"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/make_persistent_array.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace lindex
+{
+
+/* size of all keys of the engine */
+static constexpr std::size_t KEY_SIZE = 8;
+/* capacity of the sorted array of a segment */
+static constexpr std::size_t SEGMENT_KEYS = 256;
+/* capacity of the (unsorted) insert buffer of a segment */
+static constexpr std::size_t DELTA_KEYS = 32;
+/* maximal error of segment positions predicted by the model */
+static constexpr std::size_t MODEL_EPSILON = 4;
+
+/*
+ * Key (as a big-endian integer, so that integers order as the key bytes do)
+ * and its value - size (uint64_t) followed by data; null value marks a key
+ * removed from the sorted array.
+ */
+struct entry {
+	uint64_t key;
+	pmem::obj::persistent_ptr<char[]> value;
+};
+
+/*
+ * Part of the key space, from 'low' up to 'low' of the next segment. Keys are
+ * kept in a sorted array and new ones are added to the delta buffer, merged
+ * into the array (copy-on-write) when the buffer is full.
+ */
+struct segment {
+	segment() : next(nullptr), low(0), sorted(0), delta(0)
+	{
+	}
+
+	pmem::obj::persistent_ptr<segment> next;
+	pmem::obj::p<uint64_t> low;
+	pmem::obj::p<uint32_t> sorted;
+	pmem::obj::p<uint32_t> delta;
+	entry entries[SEGMENT_KEYS];
+	entry buffer[DELTA_KEYS];
+};
+
+struct pmem_type {
+	pmem_type() : head(nullptr)
+	{
+		std::memset(reserved, 0, sizeof(reserved));
+	}
+
+	/* list of segments, in order of keys, there's always at least one */
+	pmem::obj::persistent_ptr<segment> head;
+	uint64_t reserved[8];
+};
+
+/*
+ * Piecewise-linear model (as of PGM-index) of positions of sorted keys. Every
+ * piece predicts positions of its keys with an error of at most epsilon; its
+ * slope is chosen by the shrinking cone algorithm, which extends the piece
+ * while any line passing through its first point is within the bounds.
+ */
+class learned_model {
+public:
+	void build(const std::vector<uint64_t> &keys, std::size_t epsilon);
+	std::size_t predict(uint64_t key) const;
+
+	std::size_t pieces() const
+	{
+		return model.size();
+	}
+
+private:
+	struct piece {
+		uint64_t first_key;
+		double first_pos;
+		double slope;
+	};
+
+	std::vector<piece> model;
+	std::size_t size = 0;
+};
+
+/*
+ * Bound of a range of keys, as an integer: a key is within it if it's greater
+ * (lower, for upper bounds) than 'key' or equal to it, if 'eq' is set.
+ */
+struct key_bound {
+	uint64_t key;
+	bool eq;
+};
+
+} /* namespace lindex */
+} /* namespace internal */
+
+/**
+ * Learned-index engine for 8-byte keys (ordered bytewise, as big-endian
+ * integers). Data is kept in a persistent list of segments, each with a sorted
+ * array of entries and a small delta buffer for inserts. In DRAM, the engine
+ * keeps the lowest keys of all segments and a piecewise-linear model of their
+ * positions, rebuilt on open - a lookup of the segment of a key takes a binary
+ * search of a few elements around the predicted position (instead of
+ * a descent of a tree).
+ *
+ * Inserts go to the delta buffer of the segment (updates and removes are
+ * done in place); a full buffer is merged with the sorted array into a new
+ * segment (or two, if it doesn't fit), which replaces the old one. Segments
+ * added by splits make predictions less precise, so the search window is
+ * widened by their number and the model is rebuilt when they exceed its error.
+ *
+ * Readers run concurrently, writers are serialized.
+ */
+class lindex : public pmemobj_engine_base<internal::lindex::pmem_type> {
+public:
+	lindex(std::unique_ptr<internal::config> cfg);
+	~lindex();
+
+	lindex(const lindex &) = delete;
+	lindex &operator=(const lindex &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+
+	internal::iterator_base *new_iterator() final;
+	internal::iterator_base *new_const_iterator() final;
+
+	status stats(internal::stats_sink &sink) final;
+
+protected:
+	internal::memory_stats memory_types() final;
+
+private:
+	using mutex_type = internal::sharded_shared_mutex;
+	using segment_ptr = pmem::obj::persistent_ptr<internal::lindex::segment>;
+	using entry_function =
+		std::function<int(uint64_t key, const internal::lindex::entry &)>;
+
+	class lindex_const_iterator;
+	class lindex_iterator;
+
+	void Recover();
+	void BuildModel();
+
+	/* Returns the index of the segment, which may contain the key */
+	std::size_t FindSegment(uint64_t key) const;
+	/* Returns the entry of the key (with a value), or nullptr */
+	internal::lindex::entry *Find(uint64_t key) const;
+	/* Returns the lowest (highest) key within the bound, false if none */
+	bool Higher(const internal::lindex::key_bound &bound, uint64_t &key) const;
+	bool Lower(const internal::lindex::key_bound &bound, uint64_t &key) const;
+	/* Calls f for entries of keys within the bounds (if set), in order */
+	int Scan(const internal::lindex::key_bound *low,
+		 const internal::lindex::key_bound *high, const entry_function &f) const;
+
+	status GetRange(const std::string *low, bool low_eq, const std::string *high,
+			bool high_eq, get_kv_callback *callback, void *arg);
+	status CountRange(const std::string *low, bool low_eq, const std::string *high,
+			  bool high_eq, std::size_t &cnt);
+
+	/*
+	 * Replaces the (full) segment with one or two new ones, holding all its
+	 * keys and the new one, in a single transaction.
+	 */
+	void Rebuild(std::size_t idx, uint64_t key, string_view value);
+	/* Allocates a value, must be called in a transaction */
+	pmem::obj::persistent_ptr<char[]> AllocValue(string_view value);
+	void FreeValue(pmem::obj::persistent_ptr<char[]> value);
+
+	internal::lindex::pmem_type *pmem_root = nullptr;
+	/* persistent segments and their lowest keys, in order */
+	std::vector<segment_ptr> segments;
+	std::vector<uint64_t> lows;
+	internal::lindex::learned_model model;
+	/* segments added since the model was built */
+	std::size_t drift = 0;
+	std::size_t count = 0;
+	uint64_t rebuilds = 0;
+	uint64_t model_builds = 0;
+
+	/* readers hold shared lock, writers exclusive one */
+	mutable mutex_type mtx;
+};
+
+/*
+ * Iterators are positioned on keys (not on entries, which move when segments
+ * are rebuilt) and hold the shared lock only for the duration of a call, so
+ * they must not be used while other threads modify the database.
+ */
+class lindex::lindex_const_iterator : public internal::iterator_base {
+public:
+	lindex_const_iterator(lindex *engine);
+
+	status seek(string_view key) final;
+	status seek_lower(string_view key) final;
+	status seek_lower_eq(string_view key) final;
+	status seek_higher(string_view key) final;
+	status seek_higher_eq(string_view key) final;
+
+	status seek_to_first() final;
+	status seek_to_last() final;
+
+	status is_next() final;
+	status next() final;
+	status prev() final;
+
+	status set_upper_bound(const string_view *key) final;
+
+	result<string_view> key() final;
+
+	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
+
+protected:
+	/* moves to the key (if found), forward moves stop at the upper bound */
+	status set(bool found, uint64_t key);
+	status set_forward(bool found, uint64_t key);
+	bool below_bound(uint64_t key);
+	const internal::lindex::entry &current() const;
+
+	lindex *engine;
+	internal::iterator_bound bound;
+	bool valid = false;
+	uint64_t current_key = 0;
+	char key_buf[internal::lindex::KEY_SIZE];
+};
+
+class lindex::lindex_iterator : public lindex::lindex_const_iterator {
+public:
+	lindex_iterator(lindex *engine);
+
+	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
+
+	status commit() final;
+	void abort() final;
+
+private:
+	std::vector<std::pair<std::string, size_t>> log;
+};
+
+class lindex_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new lindex(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "lindex";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_LINDEX_H */
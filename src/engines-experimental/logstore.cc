@@ -0,0 +1,463 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "logstore.h"
+#include "../exceptions.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace logstore
+{
+
+static uint64_t record_size(uint64_t key_size, uint64_t value_size)
+{
+	auto size = sizeof(record) + key_size + value_size;
+
+	return (size + 7) & ~uint64_t(7);
+}
+
+static uint64_t record_size(const record *r)
+{
+	return record_size(r->key_size, r->value_size == TOMBSTONE ? 0 : r->value_size);
+}
+
+static string_view key_of(const record *r)
+{
+	return string_view(reinterpret_cast<const char *>(r + 1), r->key_size);
+}
+
+static string_view value_of(const record *r)
+{
+	return string_view(reinterpret_cast<const char *>(r + 1) + r->key_size,
+			   r->value_size);
+}
+
+static uint64_t get_percent(internal::config &cfg, const char *key, uint64_t def)
+{
+	uint64_t value = def;
+	cfg.get_uint64(key, &value);
+	if (value == 0 || value > 100)
+		throw internal::invalid_argument("Config item \"" + std::string(key) +
+						 "\" must be in range [1, 100]");
+
+	return value;
+}
+
+} /* namespace logstore */
+} /* namespace internal */
+
+using namespace internal::logstore;
+
+logstore::logstore(std::unique_ptr<internal::config> cfg)
+    : pmemobj_engine_base(cfg, "pmemkv_logstore"), mtx(std::thread::hardware_concurrency())
+{
+	segment_size = SEGMENT_SIZE;
+	cfg->get_uint64("segment_size", &segment_size);
+	if (segment_size < 4096)
+		throw internal::invalid_argument(
+			"Config item \"segment_size\" must be at least 4096");
+	gc_threshold = get_percent(*cfg, "gc_threshold", GC_THRESHOLD);
+	gc_budget_percent = get_percent(*cfg, "gc_budget_percent", GC_BUDGET_PERCENT);
+
+	internal::open_phase phase("logstore.recover");
+	Recover();
+	phase.end();
+
+	cleaner.reset(new internal::background_task([this] { return CleanStep(); },
+						    clock_type::duration::zero()));
+
+	LOG("Started ok");
+}
+
+logstore::~logstore()
+{
+	/* waits for the running step */
+	cleaner.reset();
+
+	LOG("Stopped ok");
+}
+
+std::string logstore::name()
+{
+	return "logstore";
+}
+
+status logstore::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	cnt = index.size();
+
+	return status::OK;
+}
+
+status logstore::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	for (auto &e : index) {
+		auto r = Record(e.second.record);
+		auto value = value_of(r);
+		auto ret = callback(e.first.data(), e.first.size(), value.data(),
+				    value.size(), arg);
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return status::OK;
+}
+
+status logstore::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	bool found = index.find(std::string(key.data(), key.size())) != index.end();
+
+	return found ? status::OK : status::NOT_FOUND;
+}
+
+status logstore::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto it = index.find(std::string(key.data(), key.size()));
+	if (it == index.end()) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	auto value = value_of(Record(it->second.record));
+	callback(value.data(), value.size(), arg);
+
+	return status::OK;
+}
+
+status logstore::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto offset = Append(key, value, false);
+
+	location loc{offset, segments.rbegin()->first};
+	auto res = index.emplace(std::string(key.data(), key.size()), loc);
+	if (!res.second) {
+		auto old = res.first->second;
+		res.first->second = loc;
+		AddDead(old.seq, record_size(Record(old.record)));
+	}
+
+	return status::OK;
+}
+
+/* the tombstone is dead as soon as it's written, it's kept only for replay */
+status logstore::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto it = index.find(std::string(key.data(), key.size()));
+	if (it == index.end())
+		return status::NOT_FOUND;
+
+	auto offset = Append(key, string_view(), true);
+	auto old = it->second;
+	index.erase(it);
+
+	AddDead(old.seq, record_size(Record(old.record)));
+	AddDead(segments.rbegin()->first, record_size(Record(offset)));
+
+	return status::OK;
+}
+
+status logstore::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	sink.add("count", index.size());
+	sink.add("logstore.segments", segments.size());
+	sink.add("logstore.dead_bytes", dead_bytes);
+	sink.add("logstore.cleaned_segments", cleaned_segments);
+	sink.add("logstore.relocated_bytes", relocated_bytes);
+
+	report_memory(sink, index.size());
+
+	return status::OK;
+}
+
+internal::memory_stats logstore::memory_types()
+{
+	internal::memory_stats mem;
+	mem.add_type(pmem::detail::type_num<char>(), "segments");
+
+	return mem;
+}
+
+/*
+ * The record is persisted before the tail of the segment is moved past it,
+ * so a crash leaves either the whole record or none of it in the log.
+ */
+uint64_t logstore::Append(string_view key, string_view value, bool tombstone)
+{
+	auto size = record_size(key.size(), value.size());
+
+	auto seg = segments.empty() ? nullptr : Segment(segments.rbegin()->second.offset);
+	if (!seg || seg->tail + size > seg->size) {
+		NewSegment(std::max(segment_size, size));
+		seg = Segment(segments.rbegin()->second.offset);
+	}
+
+	auto offset = segments.rbegin()->second.offset + sizeof(segment) + seg->tail;
+	auto dest = base + offset;
+
+	record r{key.size(), tombstone ? TOMBSTONE : value.size()};
+	std::memcpy(dest, &r, sizeof(r));
+	std::memcpy(dest + sizeof(r), key.data(), key.size());
+	std::memcpy(dest + sizeof(r) + key.size(), value.data(), value.size());
+	pmpool.persist(dest, size);
+
+	seg->tail += size;
+	pmpool.persist(&seg->tail, sizeof(seg->tail));
+
+	return offset;
+}
+
+/*
+ * The previous segment is sealed, it may be cleaned from now on. The cleaner
+ * is woken only if it's idle (with no victim), otherwise its next step is
+ * already scheduled.
+ */
+void logstore::NewSegment(uint64_t size)
+{
+	uint64_t offset = 0;
+	auto seq = next_seq;
+	pmem::obj::transaction::run(pmpool, [&] {
+		auto ptr = pmem::obj::make_persistent<char[]>(sizeof(segment) + size);
+		auto seg = reinterpret_cast<segment *>(ptr.get());
+		seg->next = pmem_root->head;
+		seg->seq = seq;
+		seg->size = size;
+		seg->tail = 0;
+
+		pmem::obj::transaction::snapshot(&pmem_root->head);
+		pmem_root->head = ptr.raw().off;
+		offset = ptr.raw().off;
+	});
+
+	next_seq++;
+	segments[seq] = segment_info{offset, 0};
+
+	if (victim == 0 && segments.size() > 1 &&
+	    Qualifies(std::prev(segments.end(), 2)->first))
+		cleaner->wake();
+}
+
+void logstore::FreeSegment(uint64_t seq)
+{
+	auto offset = segments.at(seq).offset;
+	auto seg = Segment(offset);
+
+	pmem::obj::transaction::run(pmpool, [&] {
+		uint64_t *pred = &pmem_root->head;
+		while (*pred != offset)
+			pred = &Segment(*pred)->next;
+
+		pmem::obj::transaction::snapshot(pred);
+		*pred = seg->next;
+
+		pmem::obj::persistent_ptr<char[]> ptr(pmemobj_oid(seg));
+		pmem::obj::delete_persistent<char[]>(ptr, sizeof(segment) + seg->size);
+	});
+
+	dead_bytes -= segments.at(seq).dead;
+	segments.erase(seq);
+}
+
+void logstore::AddDead(uint64_t seq, uint64_t bytes)
+{
+	auto &info = segments.at(seq);
+	bool qualified = Qualifies(seq);
+
+	info.dead += bytes;
+	dead_bytes += bytes;
+
+	if (victim == 0 && !qualified && Qualifies(seq))
+		cleaner->wake();
+}
+
+/* the current segment is never cleaned */
+bool logstore::Qualifies(uint64_t seq) const
+{
+	if (seq == segments.rbegin()->first)
+		return false;
+
+	auto &info = segments.at(seq);
+	auto used = Segment(info.offset)->tail;
+
+	return used == 0 || info.dead * 100 >= used * gc_threshold;
+}
+
+/*
+ * Live records of the segment (those the index points to) are appended to
+ * the log again. A tombstone is copied only if there are older segments,
+ * which may hold a record of its key - otherwise nothing can be revived by
+ * dropping it. When the whole segment is relocated, it's freed (a crash
+ * before that leaves both copies, the later of which wins on replay).
+ */
+logstore::clock_type::duration logstore::CleanStep()
+{
+	auto begin = clock_type::now();
+	bool done = false;
+	try {
+		std::unique_lock<mutex_type> lock(mtx);
+
+		if (victim == 0) {
+			/* the segment with the highest ratio of dead bytes */
+			double best = -1;
+			for (auto &s : segments) {
+				if (!Qualifies(s.first))
+					continue;
+				auto used = Segment(s.second.offset)->tail;
+				double ratio = used ? double(s.second.dead) / double(used) : 1;
+				if (ratio > best) {
+					best = ratio;
+					victim = s.first;
+				}
+			}
+			victim_pos = 0;
+		}
+
+		if (victim == 0)
+			return internal::background_task::idle;
+
+		auto info = segments.at(victim);
+		auto seg = Segment(info.offset);
+		bool older = segments.begin()->first < victim;
+		auto first = info.offset + sizeof(segment);
+
+		uint64_t scanned = 0;
+		while (victim_pos < seg->tail && scanned < GC_STEP_BYTES) {
+			auto offset = first + victim_pos;
+			auto r = Record(offset);
+			auto size = record_size(r);
+			std::string key(key_of(r).data(), key_of(r).size());
+
+			auto it = index.find(key);
+			if (r->value_size == TOMBSTONE) {
+				if (older && it == index.end()) {
+					Append(key, string_view(), true);
+					AddDead(segments.rbegin()->first, size);
+					relocated_bytes += size;
+				}
+			} else if (it != index.end() && it->second.record == offset) {
+				auto copy = Append(key, value_of(r), false);
+				it->second = location{copy, segments.rbegin()->first};
+				relocated_bytes += size;
+			}
+
+			victim_pos += size;
+			scanned += size;
+		}
+
+		if (victim_pos >= seg->tail) {
+			FreeSegment(victim);
+			victim = 0;
+			cleaned_segments++;
+		}
+		done = true;
+	} catch (...) {
+		/* e.g. out of space for the relocated records, retried later */
+	}
+
+	auto elapsed = clock_type::now() - begin;
+	if (!done)
+		elapsed = std::max<clock_type::duration>(elapsed, std::chrono::seconds(1));
+
+	return std::chrono::duration_cast<clock_type::duration>(
+		elapsed * (100 - gc_budget_percent) / gc_budget_percent);
+}
+
+/*
+ * Segments are replayed in order of their seq, every record overrides
+ * earlier ones of its key.
+ */
+void logstore::Recover()
+{
+	if (OID_IS_NULL(*root_oid)) {
+		pmem::obj::transaction::run(pmpool, [&] {
+			pmem::obj::transaction::snapshot(root_oid);
+			*root_oid = pmem::obj::make_persistent<pmem_type>().raw();
+		});
+	}
+
+	pmem_root = static_cast<pmem_type *>(pmemobj_direct(*root_oid));
+	base = reinterpret_cast<char *>(pmpool.handle());
+
+	for (auto offset = pmem_root->head; offset != 0; offset = Segment(offset)->next) {
+		auto seg = Segment(offset);
+		segments[seg->seq] = segment_info{offset, 0};
+		next_seq = std::max(next_seq, seg->seq + 1);
+	}
+
+	for (auto &s : segments) {
+		auto seg = Segment(s.second.offset);
+		auto first = s.second.offset + sizeof(segment);
+		for (uint64_t pos = 0; pos < seg->tail;) {
+			auto offset = first + pos;
+			auto r = Record(offset);
+			auto size = record_size(r);
+			std::string key(key_of(r).data(), key_of(r).size());
+
+			auto it = index.find(key);
+			if (it != index.end()) {
+				auto &old = segments.at(it->second.seq);
+				old.dead += record_size(Record(it->second.record));
+				dead_bytes += record_size(Record(it->second.record));
+			}
+
+			if (r->value_size == TOMBSTONE) {
+				if (it != index.end())
+					index.erase(it);
+				s.second.dead += size;
+				dead_bytes += size;
+			} else {
+				index[key] = location{offset, s.first};
+			}
+
+			pos += size;
+		}
+	}
+}
+
+static factory_registerer
+	register_logstore(std::unique_ptr<engine_base::factory_base>(new logstore_factory));
+
+} // namespace kv
+} // namespace pmem
@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_LOGSTORE_H
+#define LIBPMEMKV_LOGSTORE_H
+
+#include "../pmemobj_engine.h"
+#include "../sharded_shared_mutex.h"
+#include "../thread_pool.h"
+
+#include <libpmemobj++/make_persistent_array.hpp>
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace logstore
+{
+
+/* default size of a log segment */
+static constexpr uint64_t SEGMENT_SIZE = 4 << 20;
+/* minimal percent of dead bytes of a segment, for it to be cleaned */
+static constexpr uint64_t GC_THRESHOLD = 50;
+/* percent of a worker's time the cleaner may use */
+static constexpr uint64_t GC_BUDGET_PERCENT = 10;
+/* bytes of a segment scanned by a single step of the cleaner */
+static constexpr uint64_t GC_STEP_BYTES = 256 << 10;
+/* value size of a record which marks its key removed */
+static constexpr uint64_t TOMBSTONE = ~0ULL;
+
+/*
+ * Segment of the log, allocated with its data. Records are appended at
+ * 'tail', which is updated (atomically) after the record is persisted -
+ * only records below it are valid.
+ */
+struct segment {
+	uint64_t next;
+	/* order of segments, records of later ones override earlier ones */
+	uint64_t seq;
+	/* size of the data */
+	uint64_t size;
+	uint64_t tail;
+	uint64_t reserved[4];
+};
+
+/* record is the header followed by the key and the value, padded to 8 bytes */
+struct record {
+	uint64_t key_size;
+	uint64_t value_size;
+};
+
+struct pmem_type {
+	pmem_type() : head(0)
+	{
+		std::memset(reserved, 0, sizeof(reserved));
+	}
+
+	/* offset of the first segment of the list (in no particular order) */
+	uint64_t head;
+	uint64_t reserved[8];
+};
+
+/* DRAM state of a segment */
+struct segment_info {
+	uint64_t offset;
+	/* bytes of records which were overwritten, removed or are tombstones */
+	uint64_t dead;
+};
+
+/* record of a key, in the segment 'seq' */
+struct location {
+	uint64_t record;
+	uint64_t seq;
+};
+
+} /* namespace logstore */
+} /* namespace internal */
+
+/**
+ * Log-structured engine (as Bitcask): every put and remove appends a record
+ * (a tombstone, for a remove) to the tail of the current segment of the log -
+ * a large block of the pool - so writes are sequential and take no allocation,
+ * except for a new segment when the current one is full. A hash map in DRAM,
+ * rebuilt by replaying the log when the pool is opened, maps keys to their
+ * latest records.
+ *
+ * Segments with enough dead bytes (of overwritten and removed records) are
+ * cleaned in the background: their live records are appended to the log
+ * again and the segment is freed. The cleaner works in small steps, delayed
+ * to use a limited part of a worker's time.
+ *
+ * Readers run concurrently, writers (and steps of the cleaner) are serialized.
+ */
+class logstore : public pmemobj_engine_base<internal::logstore::pmem_type> {
+public:
+	logstore(std::unique_ptr<internal::config> cfg);
+	~logstore();
+
+	logstore(const logstore &) = delete;
+	logstore &operator=(const logstore &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status get_all(get_kv_callback *callback, void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+
+	status stats(internal::stats_sink &sink) final;
+
+protected:
+	internal::memory_stats memory_types() final;
+
+private:
+	using mutex_type = internal::sharded_shared_mutex;
+	using clock_type = internal::background_task::clock_type;
+
+	void Recover();
+
+	internal::logstore::segment *Segment(uint64_t offset) const
+	{
+		return reinterpret_cast<internal::logstore::segment *>(base + offset);
+	}
+	const internal::logstore::record *Record(uint64_t offset) const
+	{
+		return reinterpret_cast<const internal::logstore::record *>(base +
+									      offset);
+	}
+
+	/* Appends the record to the log, returns its offset */
+	uint64_t Append(string_view key, string_view value, bool tombstone);
+	void NewSegment(uint64_t size);
+	void FreeSegment(uint64_t seq);
+	/* Marks the record dead, waking the cleaner if its segment qualifies */
+	void AddDead(uint64_t seq, uint64_t bytes);
+	bool Qualifies(uint64_t seq) const;
+
+	/* Cleans a part of a segment, returns the delay of the next step */
+	clock_type::duration CleanStep();
+
+	internal::logstore::pmem_type *pmem_root = nullptr;
+	char *base = nullptr;
+
+	uint64_t segment_size;
+	uint64_t gc_threshold;
+	uint64_t gc_budget_percent;
+
+	std::unordered_map<std::string, internal::logstore::location> index;
+	/* segments by their seq, the last one is the current segment */
+	std::map<uint64_t, internal::logstore::segment_info> segments;
+	uint64_t next_seq = 1;
+
+	/* segment being cleaned (0 - none) and the offset of its next record */
+	uint64_t victim = 0;
+	uint64_t victim_pos = 0;
+
+	uint64_t dead_bytes = 0;
+	uint64_t cleaned_segments = 0;
+	uint64_t relocated_bytes = 0;
+
+	/* readers hold shared lock, writers exclusive one */
+	mutable mutex_type mtx;
+
+	std::unique_ptr<internal::background_task> cleaner;
+};
+
+class logstore_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new logstore(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "logstore";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_LOGSTORE_H */
@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "lvmap.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+#include <thread>
+
+#define LVMAP_DEFAULT_EXTENT_SIZE (256 * 1024)
+
+namespace pmem
+{
+namespace kv
+{
+
+lvmap::lvmap(std::unique_ptr<internal::config> cfg)
+    : pmemobj_engine_base(cfg, "pmemkv_lvmap"), mtx(std::thread::hardware_concurrency())
+{
+	uint64_t extent_size_cfg = LVMAP_DEFAULT_EXTENT_SIZE;
+	cfg->get_uint64("extent_size", &extent_size_cfg);
+	if (extent_size_cfg == 0)
+		throw internal::invalid_argument(
+			"Config item \"extent_size\" must be greater than 0");
+	extent_size = static_cast<std::size_t>(extent_size_cfg);
+
+	Recover();
+	LOG("Started ok");
+}
+
+lvmap::~lvmap()
+{
+	LOG("Stopped ok");
+}
+
+std::string lvmap::name()
+{
+	return "lvmap";
+}
+
+status lvmap::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	cnt = container->size();
+
+	return status::OK;
+}
+
+status lvmap::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	std::string buf;
+	for (auto it = container->begin(); it != container->end(); ++it) {
+		string_view key = it->key();
+		string_view value;
+		read_all(it->value(), buf, value);
+
+		auto ret =
+			callback(key.data(), key.size(), value.data(), value.size(), arg);
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return status::OK;
+}
+
+status lvmap::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	return container->find(key) != container->end() ? status::OK : status::NOT_FOUND;
+}
+
+status lvmap::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto it = container->find(key);
+	if (it == container->end()) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	std::string buf;
+	string_view value;
+	read_all(it->value(), buf, value);
+	callback(value.data(), value.size(), arg);
+
+	return status::OK;
+}
+
+status lvmap::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	pmem::obj::transaction::run(pmpool, [&] {
+		auto result = container->try_emplace(key);
+		auto &v = result.first->value();
+		if (!result.second) {
+			free_extents(v);
+			v.size = 0;
+		}
+
+		write_extents(v, 0, value);
+	});
+
+	return status::OK;
+}
+
+status lvmap::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto it = container->find(key);
+	if (it == container->end())
+		return status::NOT_FOUND;
+
+	pmem::obj::transaction::run(pmpool, [&] {
+		free_extents(it->value());
+		container->erase(it);
+	});
+
+	return status::OK;
+}
+
+status lvmap::read_value(string_view key, std::size_t pos, std::size_t n,
+			 get_v_callback *callback, void *arg)
+{
+	LOG("read_value key=" << std::string(key.data(), key.size()) << ", pos=" << pos
+			      << ", n=" << n);
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto it = container->find(key);
+	if (it == container->end()) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	if (pos > it->value().size)
+		throw internal::invalid_argument(
+			"Position is beyond the end of the value");
+
+	read_extents(it->value(), pos, n, callback, arg);
+
+	return status::OK;
+}
+
+status lvmap::write_value(string_view key, std::size_t pos, string_view data)
+{
+	LOG("write_value key=" << std::string(key.data(), key.size()) << ", pos=" << pos
+			       << ", data.size=" << std::to_string(data.size()));
+	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto it = container->find(key);
+	if (it == container->end())
+		return status::NOT_FOUND;
+
+	auto &v = it->value();
+	if (pos > v.size)
+		throw internal::invalid_argument(
+			"Position is beyond the end of the value");
+
+	pmem::obj::transaction::run(pmpool, [&] { write_extents(v, pos, data); });
+
+	return status::OK;
+}
+
+status lvmap::append_value(string_view key, string_view data)
+{
+	LOG("append_value key=" << std::string(key.data(), key.size())
+				<< ", data.size=" << std::to_string(data.size()));
+	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	pmem::obj::transaction::run(pmpool, [&] {
+		auto &v = container->try_emplace(key).first->value();
+		write_extents(v, v.size, data);
+	});
+
+	return status::OK;
+}
+
+status lvmap::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	sink.add("count", container->size());
+	sink.add("extent_size", extent_size);
+
+	report_memory(sink, container->size());
+
+	return status::OK;
+}
+
+void lvmap::write_extents(internal::lvmap::value_index &value, std::size_t pos,
+			  string_view data)
+{
+	const std::size_t size = value.size;
+	const std::size_t end = pos + data.size();
+	const auto &extents = value.extents;
+	const char *src = data.data();
+
+	assert(pos <= size);
+
+	while (pos < end) {
+		std::size_t i = pos / extent_size;
+		std::size_t off = pos % extent_size;
+		std::size_t len = std::min(extent_size - off, end - pos);
+		/* bytes of the extent which are in use (before this write) */
+		std::size_t first = i * extent_size;
+		std::size_t used = size > first ? std::min(extent_size, size - first) : 0;
+
+		if (i == extents.size()) {
+			auto extent = pmem::obj::make_persistent<char[]>(extent_size);
+			pmpool.memcpy_persist(extent.get() + off, src, len);
+			value.extents.push_back(extent);
+		} else if (off == 0 && len >= used) {
+			/* all data of the extent is overwritten, no need to log it */
+			auto extent = pmem::obj::make_persistent<char[]>(extent_size);
+			pmpool.memcpy_persist(extent.get(), src, len);
+			pmem::obj::delete_persistent<char[]>(extents[i], extent_size);
+			value.extents[i] = extent;
+		} else {
+			/* only the bytes in use have to be restored on abort */
+			char *dest = extents[i].get() + off;
+			if (off < used)
+				pmem::obj::transaction::snapshot(
+					dest, std::min(len, used - off));
+			pmpool.memcpy_persist(dest, src, len);
+		}
+
+		pos += len;
+		src += len;
+	}
+
+	if (end > size)
+		value.size = end;
+}
+
+void lvmap::free_extents(internal::lvmap::value_index &value)
+{
+	const auto &extents = value.extents;
+	for (const auto &extent : extents)
+		pmem::obj::delete_persistent<char[]>(extent, extent_size);
+
+	value.extents.clear();
+}
+
+void lvmap::read_extents(const internal::lvmap::value_index &value, std::size_t pos,
+			 std::size_t n, get_v_callback *callback, void *arg) const
+{
+	const std::size_t size = value.size;
+	const std::size_t end = n > size - pos ? size : pos + n;
+
+	while (pos < end) {
+		std::size_t off = pos % extent_size;
+		std::size_t len = std::min(extent_size - off, end - pos);
+		callback(value.extents[pos / extent_size].get() + off, len, arg);
+		pos += len;
+	}
+}
+
+static void append_part(const char *v, size_t vb, void *arg)
+{
+	static_cast<std::string *>(arg)->append(v, vb);
+}
+
+void lvmap::read_all(const internal::lvmap::value_index &value, std::string &buf,
+		     string_view &out) const
+{
+	if (value.extents.size() <= 1) {
+		out = value.extents.empty()
+			? string_view()
+			: string_view(value.extents[0].get(), value.size);
+		return;
+	}
+
+	buf.clear();
+	buf.reserve(value.size);
+	read_extents(value, 0, value.size, append_part, &buf);
+	out = buf;
+}
+
+void lvmap::Recover()
+{
+	if (!OID_IS_NULL(*root_oid)) {
+		auto pmem_ptr = static_cast<internal::lvmap::pmem_type *>(
+			pmemobj_direct(*root_oid));
+
+		container = &pmem_ptr->map;
+		/* extent size is fixed by the pool, "extent_size" is ignored */
+		extent_size = static_cast<std::size_t>(pmem_ptr->extent_size);
+	} else {
+		pmem::obj::transaction::run(pmpool, [&] {
+			pmem::obj::transaction::snapshot(root_oid);
+			*root_oid = pmem::obj::make_persistent<
+					    internal::lvmap::pmem_type>(extent_size)
+					    .raw();
+			auto pmem_ptr = static_cast<internal::lvmap::pmem_type *>(
+				pmemobj_direct(*root_oid));
+			container = &pmem_ptr->map;
+		});
+	}
+}
+
+static factory_registerer
+	register_lvmap(std::unique_ptr<engine_base::factory_base>(new lvmap_factory));
+
+} // namespace kv
+} // namespace pmem
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_LVMAP_H
+#define LIBPMEMKV_LVMAP_H
+
+#include "../pmemobj_engine.h"
+#include "../sharded_shared_mutex.h"
+
+#include <libpmemobj++/container/vector.hpp>
+#include <libpmemobj++/make_persistent_array.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+
+#include <libpmemobj++/experimental/inline_string.hpp>
+#include <libpmemobj++/experimental/radix_tree.hpp>
+
+#include <cstring>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace lvmap
+{
+
+using extent_ptr = pmem::obj::persistent_ptr<char[]>;
+
+/*
+ * Value split into extents of the same size - all of them, except the last
+ * one, are full.
+ */
+struct value_index {
+	value_index() : size(0)
+	{
+	}
+
+	pmem::obj::p<uint64_t> size;
+	pmem::obj::vector<extent_ptr> extents;
+};
+
+using map_type =
+	pmem::obj::experimental::radix_tree<pmem::obj::experimental::inline_string,
+					    value_index>;
+
+struct pmem_type {
+	pmem_type(uint64_t size) : map(), extent_size(size)
+	{
+		std::memset(reserved, 0, sizeof(reserved));
+	}
+
+	map_type map;
+	/* set when the pool is created */
+	pmem::obj::p<uint64_t> extent_size;
+	uint64_t reserved[8];
+};
+
+} /* namespace lvmap */
+} /* namespace internal */
+
+/**
+ * Large-value engine - values are stored in fixed-size extents (of
+ * "extent_size" bytes), indexed by a radix tree of keys.
+ *
+ * Values don't have to be stored (or read) in a single buffer:
+ * append_value() and write_value() allocate and write only the extents in
+ * the given range, and read_value() passes the value to the callback extent
+ * by extent. A write which covers whole extents replaces them with new ones
+ * (instead of snapshotting the old data), a partial one snapshots only
+ * the modified bytes.
+ *
+ * get() passes the value in a single buffer, so values stored in more than one
+ * extent are copied. Readers run concurrently, writers are serialized.
+ */
+class lvmap : public pmemobj_engine_base<internal::lvmap::pmem_type> {
+public:
+	lvmap(std::unique_ptr<internal::config> cfg);
+	~lvmap();
+
+	lvmap(const lvmap &) = delete;
+	lvmap &operator=(const lvmap &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status get_all(get_kv_callback *callback, void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+
+	status read_value(string_view key, std::size_t pos, std::size_t n,
+			  get_v_callback *callback, void *arg) final;
+	status write_value(string_view key, std::size_t pos, string_view data) final;
+	status append_value(string_view key, string_view data) final;
+
+	status stats(internal::stats_sink &sink) final;
+
+private:
+	using container_type = internal::lvmap::map_type;
+	using mutex_type = internal::sharded_shared_mutex;
+
+	void Recover();
+
+	/*
+	 * Writes 'data' at 'pos' of the value, allocating extents past its end,
+	 * must be called in a transaction.
+	 */
+	void write_extents(internal::lvmap::value_index &value, std::size_t pos,
+			   string_view data);
+	/* Frees all extents of the value, must be called in a transaction */
+	void free_extents(internal::lvmap::value_index &value);
+	/* Calls callback for consecutive parts of bytes [pos, pos + n) */
+	void read_extents(const internal::lvmap::value_index &value, std::size_t pos,
+			  std::size_t n, get_v_callback *callback, void *arg) const;
+	/* Passes the whole value, copying it to 'buf' if it spans many extents */
+	void read_all(const internal::lvmap::value_index &value, std::string &buf,
+		      string_view &out) const;
+
+	container_type *container;
+	std::size_t extent_size;
+	/* readers hold shared lock, writers exclusive one */
+	mutex_type mtx;
+};
+
+class lvmap_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new lvmap(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "lvmap";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_LVMAP_H */
@@ -3,6 +3,14 @@
 
 #include "radix.h"
 #include "../out.h"
+#include "../parallel_scan.h"
+#include "../trace.h"
+
+#include <algorithm>
+#include <climits>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace pmem
 {
@@ -12,8 +20,9 @@ namespace internal
 {
 namespace radix
 {
-transaction::transaction(pmem::obj::pool_base &pop, map_type *container)
-    : pop(pop), container(container)
+transaction::transaction(pmem::obj::pool_base &pop, map_type *container,
+			 sharded_shared_mutex &mtx, bloom_filter *filter)
+    : pop(pop), container(container), mtx(mtx), filter(filter)
 {
 }
 
@@ -29,22 +38,49 @@ status transaction::remove(string_view key)
 	return status::OK;
 }
 
+status transaction::get(string_view key, get_v_callback *callback, void *arg)
+{
+	return log.get(key, callback, arg, [&] {
+		shared_lock_guard<sharded_shared_mutex> lock(mtx);
+		if (filter && !filter->may_contain(key))
+			return status::NOT_FOUND;
+
+		auto it = container->find(key);
+		if (it == container->end())
+			return status::NOT_FOUND;
+
+		auto value = string_view(it->value());
+		callback(value.data(), value.size(), arg);
+		return status::OK;
+	});
+}
+
 status transaction::commit()
 {
 	auto insert_cb = [&](const dram_log::element_type &e) {
+		if (filter)
+			filter->add(e.first);
+
 		auto result = container->try_emplace(e.first, e.second);
 
 		if (result.second == false)
 			result.first.assign_val(e.second);
+		else if (filter)
+			filter->inserted();
 	};
 
 	auto remove_cb = [&](const dram_log::element_type &e) {
 		container->erase(e.first);
 	};
 
+	std::unique_lock<sharded_shared_mutex> lock(mtx);
+	PMEMKV_PROBE2(tx__commit_start, "radix", log.size());
 	pmem::obj::transaction::run(pop, [&] { log.foreach (insert_cb, remove_cb); });
+	if (filter && filter->full())
+		rebuild_filter(*filter, *container);
 
 	log.clear();
+	PMEMKV_PROBE1(tx__commit_done, "radix");
 
 	return status::OK;
 }
@@ -53,18 +89,36 @@ void transaction::abort()
 {
 	log.clear();
 }
+
+void rebuild_filter(bloom_filter &filter, const map_type &container)
+{
+	filter.reset(container.size());
+	for (auto it = container.begin(); it != container.end(); ++it)
+		filter.add(it->key());
+}
 } /* namespace radix */
 } /* namespace internal */
 
 radix::radix(std::unique_ptr<internal::config> cfg)
-    : pmemobj_engine_base(cfg, "pmemkv_radix"), config(std::move(cfg))
-{
-	Recover();
+    : pmemobj_engine_base(cfg, "pmemkv_radix"),
+      mtx(std::thread::hardware_concurrency()),
+      config(std::move(cfg))
+{
+	PMEMKV_PROBE1(recovery__start, "radix");
+	{
+		internal::open_phase phase("radix.recover");
+		Recover();
+	}
+	PMEMKV_PROBE2(recovery__done, "radix", container->size());
+	prefetcher.reset(new internal::prefetch_queue(
+		[this](const internal::prefetch_request &r) { prefetch_walk(r); }));
 	LOG("Started ok");
 }
 
 radix::~radix()
 {
+	/* waits for the running walk */
+	prefetcher.reset();
 	LOG("Stopped ok");
 }
 
@@ -77,15 +131,46 @@ status radix::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	cnt = container->size();
 
 	return status::OK;
 }
 
+status radix::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	sink.add("count", container->size());
+	if (filter)
+		sink.add("bloom_filter.bytes", filter->size_bytes());
+
+	report_memory(sink, container->size());
+
+	return status::OK;
+}
+
+/* keys and values are stored in leaves of the tree */
+internal::memory_stats radix::memory_types()
+{
+	internal::memory_stats mem("nodes");
+	mem.add_type(pmem::detail::type_num<internal::radix::pmem_type>(), "root",
+		     sizeof(internal::radix::pmem_type));
+
+	return mem;
+}
+
 status radix::count_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_above for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->upper_bound(key);
 	auto last = container->end();
@@ -99,6 +184,7 @@ status radix::count_equal_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->lower_bound(key);
 	auto last = container->end();
@@ -112,6 +198,7 @@ status radix::count_equal_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->begin();
 	auto last = container->upper_bound(key);
@@ -125,6 +212,7 @@ status radix::count_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_below for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->begin();
 	auto last = container->lower_bound(key);
@@ -138,6 +226,7 @@ status radix::count_between(string_view key1, string_view key2, std::size_t &cnt
 {
 	LOG("count_between for key1=" << key1.data() << ", key2=" << key2.data());
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	if (key1.compare(key2) < 0) {
 		auto first = container->upper_bound(key1);
@@ -173,6 +262,7 @@ status radix::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->begin();
 	auto last = container->end();
@@ -180,10 +270,63 @@ status radix::get_all(get_kv_callback *callback, void *arg)
 	return iterate(first, last, callback, arg);
 }
 
+/*
+ * radix_tree doesn't expose its nodes, so the split into subtrees is found by
+ * keys: all keys share the prefix of the first and the last one, subtrees
+ * below it start at keys of the prefix followed by each possible byte. They
+ * are looked up with lower_bound() and grouped (in order) into partitions,
+ * which are scanned in parallel under the read lock taken by this thread.
+ */
+status radix::get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+			       void **args)
+{
+	LOG("get_all_parallel");
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	const container_type &map = *container;
+	std::vector<container_type::const_iterator> subtrees;
+	if (!map.empty()) {
+		string_view first = map.begin()->key();
+		string_view last = (--map.end())->key();
+
+		std::size_t prefix = 0;
+		while (prefix < first.size() && prefix < last.size() &&
+		       first.data()[prefix] == last.data()[prefix])
+			++prefix;
+
+		subtrees.push_back(map.begin());
+
+		std::string key(first.data(), prefix);
+		key.push_back('\0');
+		for (unsigned c = 1; c <= UCHAR_MAX; ++c) {
+			key.back() = static_cast<char>(c);
+			auto it = map.lower_bound(string_view(key));
+			if (it != map.end() && it != subtrees.back())
+				subtrees.push_back(it);
+		}
+	}
+
+	partitions = std::max<std::size_t>(1, std::min(partitions, subtrees.size()));
+
+	std::vector<container_type::const_iterator> bounds;
+	bounds.reserve(partitions + 1);
+	for (std::size_t i = 0; i < partitions && !subtrees.empty(); ++i)
+		bounds.push_back(subtrees[i * subtrees.size() / partitions]);
+	bounds.push_back(map.end());
+
+	return internal::parallel_scan(
+		bounds.size() - 1, callback, args,
+		[&](std::size_t partition, get_kv_callback *cb, void *arg) {
+			return iterate(bounds[partition], bounds[partition + 1], cb, arg);
+		});
+}
+
 status radix::get_above(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_above for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->upper_bound(key);
 	auto last = container->end();
@@ -195,6 +338,7 @@ status radix::get_equal_above(string_view key, get_kv_callback *callback, void *
 {
 	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->lower_bound(key);
 	auto last = container->end();
@@ -206,6 +350,7 @@ status radix::get_equal_below(string_view key, get_kv_callback *callback, void *
 {
 	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->begin();
 	auto last = container->upper_bound(key);
@@ -217,6 +362,7 @@ status radix::get_below(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_below for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = container->begin();
 	auto last = container->lower_bound(key);
@@ -229,6 +375,7 @@ status radix::get_between(string_view key1, string_view key2, get_kv_callback *c
 {
 	LOG("get_between for key1=" << key1.data() << ", key2=" << key2.data());
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	if (key1.compare(key2) < 0) {
 		auto first = container->upper_bound(key1);
@@ -239,10 +386,99 @@ status radix::get_between(string_view key1, string_view key2, get_kv_callback *c
 	return status::OK;
 }
 
+/*
+ * Keys starting with prefix are the leaves of a single subtree, lower_bound()
+ * descends straight into it and the leaves are visited until the first key
+ * out of the prefix.
+ */
+status radix::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	for (auto it = container->lower_bound(prefix); it != container->end(); ++it) {
+		string_view key = it->key();
+		if (!internal::has_prefix(key, prefix))
+			break;
+
+		string_view value = it->value();
+		auto ret =
+			callback(key.data(), key.size(), value.data(), value.size(), arg);
+
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return status::OK;
+}
+
+status radix::prefetch(string_view key)
+{
+	LOG("prefetch key=" << std::string(key.data(), key.size()));
+	prefetcher->submit(key);
+
+	return status::OK;
+}
+
+status radix::prefetch_range(string_view key1, string_view key2)
+{
+	LOG("prefetch_range for key1=" << key1.data() << ", key2=" << key2.data());
+	prefetcher->submit(key1, key2);
+
+	return status::OK;
+}
+
+/*
+ * Lookups read the nodes on the path to the leaves, values (which may be
+ * in separate allocations) are prefetched. A range is walked in chunks, each
+ * under its own hold of the lock (see prefetch_queue::chunk_size).
+ */
+void radix::prefetch_walk(const internal::prefetch_request &request)
+{
+	if (request.point) {
+		internal::shared_lock_guard<mutex_type> lock(mtx);
+
+		auto it = container->find(string_view(request.key1));
+		if (it != container->end()) {
+			string_view value = it->value();
+			internal::prefetch_bytes(value.data(), value.size());
+		}
+		return;
+	}
+
+	std::string key1 = request.key1;
+	string_view key2 = request.key2;
+	if (string_view(key1).compare(key2) > 0)
+		return;
+
+	while (true) {
+		internal::shared_lock_guard<mutex_type> lock(mtx);
+
+		auto last = container->upper_bound(key2);
+		auto it = container->lower_bound(string_view(key1));
+		for (std::size_t n = 0; it != last && n < internal::prefetch_queue::chunk_size;
+		     ++it, ++n) {
+			string_view value = it->value();
+			internal::prefetch_bytes(value.data(), value.size());
+		}
+
+		if (it == last)
+			return;
+
+		string_view key = it->key();
+		key1.assign(key.data(), key.size());
+	}
+}
+
 status radix::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	if (filter && !filter->may_contain(key))
+		return status::NOT_FOUND;
 
 	return container->find(key) != container->end() ? status::OK : status::NOT_FOUND;
 }
@@ -251,8 +487,10 @@ status radix::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
-	auto it = container->find(key);
+	auto it = (filter && !filter->may_contain(key)) ? container->end()
+							: container->find(key);
 	if (it != container->end()) {
 		auto value = string_view(it->value());
 		callback(value.data(), value.size(), arg);
@@ -268,21 +506,51 @@ status radix::put(string_view key, string_view value)
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	insert_or_assign(key, value);
+
+	return status::OK;
+}
+
+status radix::put_batch(const string_view *keys, const string_view *values,
+			std::size_t n)
+{
+	LOG("put_batch n=" << n);
+
+	std::unique_lock<mutex_type> lock(mtx);
+	return put_batch_tx(keys, values, n, [&](string_view key, string_view value) {
+		insert_or_assign(key, value);
+	});
+}
+
+/*
+ * A new key gets its own leaf, allocated by the container (try_emplace), which
+ * has no hook for the engine to place leaves - small records can't be packed
+ * into shared chunks here.
+ */
+void radix::insert_or_assign(string_view key, string_view value)
+{
+	if (filter)
+		filter->add(key);
 
 	auto result = container->try_emplace(key, value);
 
 	if (result.second == false) {
 		pmem::obj::transaction::run(pmpool,
 					    [&] { result.first.assign_val(value); });
+	} else if (filter) {
+		filter->inserted();
+		if (filter->full())
+			internal::radix::rebuild_filter(*filter, *container);
 	}
-
-	return status::OK;
 }
 
 status radix::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
 
 	auto it = container->find(key);
 
@@ -294,9 +562,55 @@ status radix::remove(string_view key)
 	return status::OK;
 }
 
+/* the leaf found by a single lookup is read and erased under the lock */
+status radix::take(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("take key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto it = (filter && !filter->may_contain(key)) ? container->end()
+							: container->find(key);
+	if (it == container->end()) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	auto value = string_view(it->value());
+	callback(value.data(), value.size(), arg);
+	container->erase(it);
+
+	return status::OK;
+}
+
+/* Erases the range in a single transaction, its bounds are looked up once */
+status radix::remove_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("remove_between for key1=" << key1.data() << ", key2=" << key2.data());
+	check_outside_tx();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	cnt = 0;
+	if (key1.compare(key2) >= 0)
+		return status::OK;
+
+	std::size_t removed = 0;
+	pmem::obj::transaction::run(pmpool, [&] {
+		auto it = container->upper_bound(key1);
+		auto last = container->lower_bound(key2);
+		while (it != last) {
+			it = container->erase(it);
+			++removed;
+		}
+	});
+	cnt = removed;
+
+	return status::OK;
+}
+
 internal::transaction *radix::begin_tx()
 {
-	return new internal::radix::transaction(pmpool, container);
+	return new internal::radix::transaction(pmpool, container, mtx, filter.get());
 }
 
 void radix::Recover()
@@ -317,44 +631,57 @@ void radix::Recover()
 			container = &pmem_ptr->map;
 		});
 	}
+
+	filter = internal::bloom_filter::from_config(*config);
+	if (filter) {
+		PMEMKV_PROBE2(recovery__phase, "radix", "filter");
+		internal::open_phase phase("radix.filter");
+		internal::radix::rebuild_filter(*filter, *container);
+	}
 }
 
 internal::iterator_base *radix::new_iterator()
 {
-	return new radix_iterator<false>{container};
+	return new radix_iterator<false>{container, &mtx, direct_write_range};
 }
 
 internal::iterator_base *radix::new_const_iterator()
 {
-	return new radix_iterator<true>{container};
+	return new radix_iterator<true>{container, &mtx};
 }
 
-radix::radix_iterator<true>::radix_iterator(container_type *c)
-    : container(c), pop(pmem::obj::pool_by_vptr(c))
+radix::radix_iterator<true>::radix_iterator(container_type *c, mutex_type *mtx)
+    : container(c), mtx(mtx), pop(pmem::obj::pool_by_vptr(c))
 {
 }
 
-radix::radix_iterator<false>::radix_iterator(container_type *c)
-    : radix::radix_iterator<true>(c)
+radix::radix_iterator<false>::radix_iterator(container_type *c, mutex_type *mtx,
+					     bool direct_write)
+    : radix::radix_iterator<true>(c, mtx), direct_write(direct_write), tx(pop)
 {
 }
 
 status radix::radix_iterator<true>::seek(string_view key)
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->find(key);
-	if (it_ != container->end())
+	it_ = find_bound(key, false);
+	if (it_ != container->end() &&
+	    string_view(it_->key().cdata(), it_->key().size()).compare(key) == 0)
 		return status::OK;
 
+	it_ = container->end();
+
 	return status::NOT_FOUND;
 }
 
 status radix::radix_iterator<true>::seek_lower(string_view key)
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->lower_bound(key);
+	it_ = find_bound(key, false);
 	if (it_ == container->begin()) {
 		it_ = container->end();
 		return status::NOT_FOUND;
@@ -368,8 +695,9 @@ status radix::radix_iterator<true>::seek_lower(string_view key)
 status radix::radix_iterator<true>::seek_lower_eq(string_view key)
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->upper_bound(key);
+	it_ = find_bound(key, true);
 	if (it_ == container->begin()) {
 		it_ = container->end();
 		return status::NOT_FOUND;
@@ -383,54 +711,57 @@ status radix::radix_iterator<true>::seek_lower_eq(string_view key)
 status radix::radix_iterator<true>::seek_higher(string_view key)
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->upper_bound(key);
-	if (it_ == container->end())
-		return status::NOT_FOUND;
+	it_ = find_bound(key, true);
 
-	return status::OK;
+	return check_bound();
 }
 
 status radix::radix_iterator<true>::seek_higher_eq(string_view key)
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->lower_bound(key);
-	if (it_ == container->end())
-		return status::NOT_FOUND;
+	it_ = find_bound(key, false);
 
-	return status::OK;
+	return check_bound();
 }
 
 status radix::radix_iterator<true>::seek_to_first()
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
 	if (container->empty())
 		return status::NOT_FOUND;
 
 	it_ = container->begin();
+	positioned = true;
 
-	return status::OK;
+	return check_bound();
 }
 
 status radix::radix_iterator<true>::seek_to_last()
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
 	if (container->empty())
 		return status::NOT_FOUND;
 
 	it_ = container->end();
 	--it_;
+	positioned = true;
 
 	return status::OK;
 }
 
 status radix::radix_iterator<true>::is_next()
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx, write_lock.owns_lock());
 	auto tmp = it_;
-	if (tmp == container->end() || ++tmp == container->end())
+	if (tmp == container->end() || past_bound(++tmp))
 		return status::NOT_FOUND;
 
 	return status::OK;
@@ -439,16 +770,20 @@ status radix::radix_iterator<true>::is_next()
 status radix::radix_iterator<true>::next()
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	if (it_ == container->end() || ++it_ == container->end())
+	if (it_ == container->end())
 		return status::NOT_FOUND;
 
-	return status::OK;
+	++it_;
+
+	return check_bound();
 }
 
 status radix::radix_iterator<true>::prev()
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
 	if (it_ == container->begin())
 		return status::NOT_FOUND;
@@ -458,8 +793,85 @@ status radix::radix_iterator<true>::prev()
 	return status::OK;
 }
 
+status radix::radix_iterator<true>::next_batch(internal::iterator_batch &batch)
+{
+	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
+
+	for (; !past_bound(it_) && !batch.full(); ++it_)
+		batch.push(string_view(it_->key().cdata(), it_->key().size()),
+			   batch.keys_only() ? string_view()
+					     : string_view(it_->value().cdata(),
+							   it_->value().size()));
+
+	check_bound();
+
+	return batch.size > 0 ? status::OK : status::NOT_FOUND;
+}
+
+status radix::radix_iterator<true>::set_upper_bound(const string_view *key)
+{
+	bound.set(key);
+
+	return status::OK;
+}
+
+/* Returns true if 'it' is the end or is not lower than the upper bound */
+bool radix::radix_iterator<true>::past_bound(const container_type::iterator &it)
+{
+	return it == container->end() ||
+		bound.reached(string_view(it->key().cdata(), it->key().size()));
+}
+
+/* Moves the iterator to the end if it's past the upper bound */
+status radix::radix_iterator<true>::check_bound()
+{
+	if (!past_bound(it_))
+		return status::OK;
+
+	it_ = container->end();
+	return status::NOT_FOUND;
+}
+
+/*
+ * Returns lower_bound (or upper_bound, if 'upper') of the key. If the current
+ * entry is not above the key, the bound is first looked for among the next
+ * FINGER_SEARCH_STEPS entries - a seek a bit above the previous one (e.g. in
+ * a merge join or a skip scan) usually finds it there, without a descent.
+ */
+radix::container_type::iterator radix::radix_iterator<true>::find_bound(string_view key,
+									 bool upper)
+{
+	auto key_of = [](const container_type::iterator &it) {
+		return string_view(it->key().cdata(), it->key().size());
+	};
+
+	if (positioned && it_ != container->end() && key_of(it_).compare(key) <= 0) {
+		auto it = it_;
+		for (std::size_t i = 0; i < FINGER_SEARCH_STEPS; ++i, ++it) {
+			if (it == container->end())
+				return it;
+
+			auto c = key_of(it).compare(key);
+			if (c > 0 || (c == 0 && !upper))
+				return it;
+		}
+	}
+
+	positioned = true;
+	return upper ? container->upper_bound(key) : container->lower_bound(key);
+}
+
+/* it_ may point to a freed leaf once other threads modify the tree */
+void radix::radix_iterator<true>::reset()
+{
+	positioned = false;
+	internal::iterator_base::reset();
+}
+
 result<string_view> radix::radix_iterator<true>::key()
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx, write_lock.owns_lock());
 	assert(it_ != container->end());
 
 	return string_view(it_->key().cdata(), it_->key().size());
@@ -468,6 +880,7 @@ result<string_view> radix::radix_iterator<true>::key()
 result<pmem::obj::slice<const char *>> radix::radix_iterator<true>::read_range(size_t pos,
 									       size_t n)
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx, write_lock.owns_lock());
 	assert(it_ != container->end());
 
 	if (pos + n > it_->value().size() || pos + n < pos)
@@ -479,11 +892,19 @@ result<pmem::obj::slice<const char *>> radix::radix_iterator<true>::read_range(s
 result<pmem::obj::slice<char *>> radix::radix_iterator<false>::write_range(size_t pos,
 									   size_t n)
 {
+	/* values are modified in place, readers are blocked until commit */
+	if (direct_write && !write_lock.owns_lock())
+		write_lock = std::unique_lock<mutex_type>(*mtx);
+
+	internal::shared_lock_guard<mutex_type> lock(*mtx, write_lock.owns_lock());
 	assert(it_ != container->end());
 
 	if (pos + n > it_->value().size() || pos + n < pos)
 		n = it_->value().size() - pos;
 
+	if (direct_write)
+		return {tx.add(it_->value().cdata() + pos, n)};
+
 	log.push_back({std::string(it_->value().cdata() + pos, n), pos});
 	auto &val = log.back().first;
 
@@ -492,6 +913,13 @@ result<pmem::obj::slice<char *>> radix::radix_iterator<false>::write_range(size_
 
 status radix::radix_iterator<false>::commit()
 {
+	if (direct_write) {
+		std::unique_lock<mutex_type> lock(std::move(write_lock));
+		tx.commit();
+		return status::OK;
+	}
+
+	std::unique_lock<mutex_type> lock(*mtx);
 	pmem::obj::transaction::run(pop, [&] {
 		for (auto &p : log) {
 			auto dest = it_->value().range(p.second, p.first.size());
@@ -505,6 +933,9 @@ status radix::radix_iterator<false>::commit()
 
 void radix::radix_iterator<false>::abort()
 {
+	tx.abort();
+	if (write_lock.owns_lock())
+		write_lock.unlock();
 	log.clear();
 }
 
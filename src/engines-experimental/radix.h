@@ -4,9 +4,12 @@
 #ifndef LIBPMEMKV_RADIX_H
 #define LIBPMEMKV_RADIX_H
 
+#include "../bloom_filter.h"
 #include "../comparator/pmemobj_comparator.h"
 #include "../iterator.h"
 #include "../pmemobj_engine.h"
+#include "../prefetch.h"
+#include "../sharded_shared_mutex.h"
 
 #include <libpmemobj++/persistent_ptr.hpp>
 
@@ -43,9 +46,11 @@ static_assert(sizeof(pmem_type) == sizeof(map_type) + 64, "");
 
 class transaction : public ::pmem::kv::internal::transaction {
 public:
-	transaction(pmem::obj::pool_base &pop, map_type *container);
+	transaction(pmem::obj::pool_base &pop, map_type *container,
+		    sharded_shared_mutex &mtx, bloom_filter *filter);
 	status put(string_view key, string_view value) final;
 	status remove(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
 	status commit() final;
 	void abort() final;
 
@@ -53,8 +58,13 @@ private:
 	pmem::obj::pool_base &pop;
 	dram_log log;
 	map_type *container;
+	sharded_shared_mutex &mtx;
+	bloom_filter *filter;
 };
 
+/* Adds all keys of the container to the filter, after resetting it */
+void rebuild_filter(bloom_filter &filter, const map_type &container);
+
 } /* namespace radix */
 } /* namespace internal */
 
@@ -62,13 +72,18 @@ private:
  * Radix tree engine backed by:
  * https://github.com/pmem/libpmemobj-cpp/blob/master/include/libpmemobj%2B%2B/experimental/radix_tree.hpp
  *
- * It is a sorted, singlethreaded engine. Unlike other sorted engines it does not support
- * custom comparator (the order is defined by the keys' representation).
+ * It is a sorted, concurrent engine (readers run concurrently, writers are
+ * serialized). Unlike other sorted engines it does not support custom comparator
+ * (the order is defined by the keys' representation).
  *
  * The implementation is a variation of a PATRICIA trie - the internal
  * nodes do not store the path explicitly, but only a position at which
  * the keys differ. Keys are stored entirely in leafs.
  *
+ * Nodes are defined by the container, not by the engine: every internal node
+ * has 16 slots, indexed directly by a 4-bit part of the key (so a child is
+ * found without a search, there's no node of another size to switch to).
+ *
  * More info about radix tree: https://en.wikipedia.org/wiki/Radix_tree
  */
 class radix : public pmemobj_engine_base<internal::radix::pmem_type> {
@@ -92,6 +107,8 @@ public:
 	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
 	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_equal_above(string_view key, get_kv_callback *callback,
 			       void *arg) final;
@@ -100,14 +117,24 @@ public:
 	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			   void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
 
 	status exists(string_view key) final;
 
 	status get(string_view key, get_v_callback *callback, void *arg) final;
 
 	status put(string_view key, string_view value) final;
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
 
 	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status stats(internal::stats_sink &sink) final;
 
 	internal::transaction *begin_tx() final;
 
@@ -116,14 +143,26 @@ public:
 
 private:
 	using container_type = internal::radix::map_type;
+	using mutex_type = internal::sharded_shared_mutex;
+
+	internal::memory_stats memory_types() final;
 
 	void Recover();
+	/* Inserts or overwrites the element, mutex must be locked */
+	void insert_or_assign(string_view key, string_view value);
 	status iterate(typename container_type::const_iterator first,
 		       typename container_type::const_iterator last,
 		       get_kv_callback *callback, void *arg);
+	/* Looks the keys up and prefetches their values, on the prefetcher's thread */
+	void prefetch_walk(const internal::prefetch_request &request);
 
 	container_type *container;
+	/* readers hold shared lock, put and remove exclusive one */
+	mutex_type mtx;
 	std::unique_ptr<internal::config> config;
+	/* DRAM filter of keys, enabled by "bloom_bits_per_key" */
+	std::unique_ptr<internal::bloom_filter> filter;
+	std::unique_ptr<internal::prefetch_queue> prefetcher;
 };
 
 template <>
@@ -131,7 +170,7 @@ class radix::radix_iterator<true> : public internal::iterator_base {
 	using container_type = radix::container_type;
 
 public:
-	radix_iterator(container_type *container);
+	radix_iterator(container_type *container, mutex_type *mtx);
 
 	status seek(string_view key) final;
 	status seek_lower(string_view key) final;
@@ -145,15 +184,33 @@ public:
 	status is_next() final;
 	status next() final;
 	status prev() final;
+	status next_batch(internal::iterator_batch &batch) final;
+
+	status set_upper_bound(const string_view *key) final;
 
 	result<string_view> key() final;
 
 	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
 
+	void reset() final;
+
 protected:
+	/* number of entries after the current one, checked by a seek before a descent */
+	static constexpr std::size_t FINGER_SEARCH_STEPS = 8;
+
 	container_type *container;
+	mutex_type *mtx;
 	container_type::iterator it_;
 	pmem::obj::pool_base pop;
+	/* held by a write iterator in the direct mode, from write_range to commit */
+	std::unique_lock<mutex_type> write_lock;
+	internal::iterator_bound bound;
+	/* it_ was set by a seek, so the next seek may search from it */
+	bool positioned = false;
+
+	bool past_bound(const container_type::iterator &it);
+	status check_bound();
+	container_type::iterator find_bound(string_view key, bool upper);
 };
 
 template <>
@@ -161,7 +218,7 @@ class radix::radix_iterator<false> : public radix::radix_iterator<true> {
 	using container_type = radix::container_type;
 
 public:
-	radix_iterator(container_type *container);
+	radix_iterator(container_type *container, mutex_type *mtx, bool direct_write);
 
 	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
 
@@ -170,6 +227,9 @@ public:
 
 private:
 	std::vector<std::pair<std::string, size_t>> log;
+	/* used instead of the log in the direct mode */
+	bool direct_write;
+	internal::direct_write_tx tx;
 };
 
 class radix_factory : public engine_base::factory_base {
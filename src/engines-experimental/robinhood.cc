@@ -5,6 +5,11 @@
 #include "../exceptions.h"
 #include "../fast_hash.h"
 #include "../out.h"
+#include "../parallel_scan.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
 
 #include <unistd.h>
 
@@ -48,6 +53,126 @@ static inline int entry_is_empty(uint64_t hash)
 	return hash == 0 || entry_is_deleted(hash);
 }
 
+/*
+ * entry_is_outofline -- checks if key and value of the entry are stored
+ * in a separate record
+ */
+static inline int entry_is_outofline(uint64_t hash)
+{
+	return (hash & OUTOFLINE_MASK) > 0;
+}
+
+/*
+ * fingerprint -- returns value stored in key field of the entry for given key,
+ * keys of ENTRY_SIZE are stored as they are
+ */
+static uint64_t fingerprint(string_view key)
+{
+	if (key.size() == ENTRY_SIZE)
+		return *reinterpret_cast<const uint64_t *>(key.data());
+
+	return fast_hash(key.size(), key.data());
+}
+
+/*
+ * shard_of -- returns shard, which the key with given fingerprint belongs to,
+ * 'shards' is a power of 2
+ */
+static size_t shard_of(uint64_t fp, size_t shards)
+{
+	return static_cast<size_t>(
+		fast_hash(ENTRY_SIZE, reinterpret_cast<const char *>(&fp)) &
+		(shards - 1));
+}
+
+/*
+ * record_oid -- returns oid of the record at given offset
+ */
+static PMEMoid record_oid(const struct hashmap_rp *hashmap, uint64_t off)
+{
+	return PMEMoid{hashmap->entries.oid.pool_uuid_lo, off};
+}
+
+/*
+ * record_get -- returns pointer to the record at given offset
+ */
+static const struct record *record_get(const struct hashmap_rp *hashmap, uint64_t off)
+{
+	return static_cast<const struct record *>(
+		pmemobj_direct(record_oid(hashmap, off)));
+}
+
+/*
+ * record_create -- reserves a record and fills it with given key and value.
+ * Returns offset of the record or 0 on error.
+ */
+static uint64_t record_create(PMEMobjpool *pop, struct pobj_action *act, string_view key,
+			      string_view value)
+{
+	size_t sz = sizeof(struct record) + key.size() + value.size();
+	TOID(struct record) record = POBJ_RESERVE_ALLOC(pop, struct record, sz, act);
+
+	if (TOID_IS_NULL(record)) {
+		LOG(std::string("record alloc failed: ") + pmemobj_errormsg());
+		return 0;
+	}
+
+	struct record *r = D_RW(record);
+	r->key_size = key.size();
+	r->value_size = value.size();
+
+	char *data = reinterpret_cast<char *>(r + 1);
+	std::memcpy(data, key.data(), key.size());
+	std::memcpy(data + key.size(), value.data(), value.size());
+
+	pmemobj_persist(pop, r, sz);
+
+	return record.oid.off;
+}
+
+/*
+ * entry_key -- returns key of the (non-empty) entry
+ */
+static string_view entry_key(const struct hashmap_rp *hashmap, const struct entry *e)
+{
+	if (!entry_is_outofline(e->hash))
+		return string_view(reinterpret_cast<const char *>(&e->key), ENTRY_SIZE);
+
+	const struct record *r = record_get(hashmap, e->value);
+
+	return string_view(reinterpret_cast<const char *>(r + 1), r->key_size);
+}
+
+/*
+ * entry_value -- returns value of the (non-empty) entry
+ */
+static string_view entry_value(const struct hashmap_rp *hashmap, const struct entry *e)
+{
+	if (!entry_is_outofline(e->hash))
+		return string_view(reinterpret_cast<const char *>(&e->value), ENTRY_SIZE);
+
+	const struct record *r = record_get(hashmap, e->value);
+
+	return string_view(reinterpret_cast<const char *>(r + 1) + r->key_size,
+			   r->value_size);
+}
+
+/*
+ * entry_matches -- checks if the (non-empty) entry holds given key,
+ * 'fp' is the fingerprint of the key
+ */
+static bool entry_matches(const struct hashmap_rp *hashmap, const struct entry *e,
+			  uint64_t fp, string_view key)
+{
+	if (e->key != fp)
+		return false;
+
+	if (!entry_is_outofline(e->hash))
+		return key.size() == ENTRY_SIZE;
+
+	return entry_key(hashmap, e).compare(key) == 0;
+}
+
 /*
  * increment_pos -- increment position index, skip 0
  */
@@ -70,17 +195,27 @@ static uint64_t probe_distance(const struct hashmap_rp *hashmap, uint64_t hash_k
 }
 
 /*
- * hash -- hash function based on Austin Appleby MurmurHash3 64-bit finalizer.
- * Returned value is modified to work with special values for unused and
- * deleted hashes.
+ * mix -- Austin Appleby MurmurHash3 64-bit finalizer
  */
-static uint64_t hash(const struct hashmap_rp *hashmap, uint64_t key)
+static uint64_t mix(uint64_t key)
 {
 	key ^= key >> 33;
 	key *= 0xff51afd7ed558ccd;
 	key ^= key >> 33;
 	key *= 0xc4ceb9fe1a85ec53;
 	key ^= key >> 33;
+
+	return key;
+}
+
+/*
+ * hash -- hash function based on mix(), its low bits are used.
+ * Returned value is modified to work with special values for unused and
+ * deleted hashes.
+ */
+static uint64_t hash(const struct hashmap_rp *hashmap, uint64_t key)
+{
+	key = mix(key);
 	key &= hashmap->capacity - 1;
 
 	/* first, 'tombstone' bit is used to indicate deleted item */
@@ -93,6 +228,88 @@ static uint64_t hash(const struct hashmap_rp *hashmap, uint64_t key)
 	return key == 0 ? 1 : key;
 }
 
+/*
+ * tag -- returns tag of an entry with given key, made of the high bits
+ * of mix() (which are independent of the hash)
+ */
+static uint8_t tag(uint64_t key)
+{
+	return static_cast<uint8_t>(TAG_USED | (mix(key) >> 57));
+}
+
+/*
+ * tag_slot -- returns position of the slot, which tag at index 'i' belongs to
+ */
+static uint64_t tag_slot(uint64_t capacity, uint64_t i)
+{
+	/* tags after the last slot are copies of the ones from slot 1 up */
+	return i < capacity ? i : i - capacity + 1;
+}
+
+/*
+ * tags_set -- sets tag of the slot and its copy (if it has one).
+ * Capacity is never less than INIT_ENTRIES_NUM_RP, so each slot has at most
+ * one copy.
+ */
+static void tags_set(struct hashmap_tags *tags, uint64_t pos, uint8_t t)
+{
+	tags->tags[pos] = t;
+	if (pos != 0 && pos <= HASHMAP_RP_TAG_GROUP)
+		tags->tags[tags->capacity + pos - 1] = t;
+}
+
+/*
+ * tags_free -- frees the tags array; if there's a reclaimer, only after
+ * lock-free readers, which may still use it, are gone
+ */
+static void tags_free(struct hashmap_tags *tags)
+{
+	if (tags->reclaimer && tags->tags)
+		tags->reclaimer->retire(tags->tags.release(),
+					tags->capacity + HASHMAP_RP_TAG_GROUP);
+
+	tags->tags.reset();
+	tags->capacity = 0;
+}
+
+/*
+ * tags_load -- (re)creates tags of all slots of the hashmap
+ */
+static void tags_load(struct hashmap_tags *tags, const struct hashmap_rp *hashmap)
+{
+	uint64_t capacity = hashmap->capacity;
+	if (tags->capacity != capacity) {
+		tags_free(tags);
+		tags->tags.reset(new uint8_t[capacity + HASHMAP_RP_TAG_GROUP]);
+		tags->capacity = capacity;
+	}
+
+	const struct entry *entry_p = D_RO(hashmap->entries);
+	for (uint64_t i = 0; i < capacity; ++i, ++entry_p) {
+		if (entry_p->hash == 0)
+			tags->tags[i] = TAG_EMPTY;
+		else if (entry_is_deleted(entry_p->hash))
+			tags->tags[i] = TAG_DELETED;
+		else
+			tags->tags[i] = tag(entry_p->key);
+	}
+
+	for (uint64_t i = capacity; i < capacity + HASHMAP_RP_TAG_GROUP; ++i)
+		tags->tags[i] = tags->tags[tag_slot(capacity, i)];
+}
+
+/*
+ * tags_match -- returns mask with the highest bit set in bytes of 'group' equal
+ * to 't'. It may report false positives, but only above a real match.
+ */
+static uint64_t tags_match(uint64_t group, uint8_t t)
+{
+	const uint64_t lows = 0x0101010101010101ULL;
+	auto x = group ^ (lows * t);
+
+	return (x - lows) & ~x & (lows << 7);
+}
+
 /*
  * hashmap_create -- hashmap initializer
  */
@@ -150,6 +367,8 @@ static void entry_update(PMEMobjpool *pop, struct hashmap_rp *hashmap,
 		entry_p->value = args->data.value;
 		entry_p->hash = args->data.hash;
 	} else {
+		tags_set(args->tags, args->pos, tag(args->data.key));
+
 		pmemobj_set_value(pop, args->actv + args->actv_cnt++, &entry_p->key,
 				  args->data.key);
 		pmemobj_set_value(pop, args->actv + args->actv_cnt++, &entry_p->value,
@@ -177,36 +396,58 @@ static void entry_add(PMEMobjpool *pop, struct hashmap_rp *hashmap,
 }
 
 /*
- * insert_helper -- inserts specified value into the hashmap
- * If function was called during rebuild process, no redo logs will be used.
+ * insert_helper -- inserts specified entry into the hashmap, only
+ * OUTOFLINE_MASK is taken from the hash of 'data'. 'key' is the key of
+ * the entry and 'extra' are up to HASHMAP_RP_MAX_EXTRA_ACTIONS actions
+ * (e.g. the reservation of its record), which get published along with it.
+ * If function was called during rebuild process, no redo logs will be used
+ * and no entry is expected to exist already.
  * returns:
  * - 0 if successful,
  * - -1 on error
  */
-static int insert_helper(PMEMobjpool *pop, struct hashmap_rp *hashmap, uint64_t key,
-			 uint64_t value, bool rebuild)
+static int insert_helper(PMEMobjpool *pop, struct hashmap_rp *hashmap,
+			 struct hashmap_tags *tags, const struct entry *data,
+			 string_view key, const struct pobj_action *extra,
+			 size_t extra_cnt, bool rebuild)
 {
 	struct pobj_action actv[HASHMAP_RP_MAX_ACTIONS];
 
 	struct add_entry args;
-	args.data.key = key;
-	args.data.value = value;
-	args.data.hash = hash(hashmap, key);
+	args.data.key = data->key;
+	args.data.value = data->value;
+	args.data.hash = hash(hashmap, data->key);
 	args.pos = args.data.hash;
+	args.data.hash |= data->hash & OUTOFLINE_MASK;
 	if (!rebuild) {
 		args.actv = actv;
 		args.actv_cnt = 0;
+		args.tags = tags;
+
+		assert(extra_cnt <= HASHMAP_RP_MAX_EXTRA_ACTIONS);
+		for (size_t i = 0; i < extra_cnt; ++i)
+			args.actv[args.actv_cnt++] = extra[i];
 	}
 
 	uint64_t dist = 0;
+	bool displaced = false;
 	struct entry *entry_p = NULL;
 
 	for (int n = 0; n < HASHMAP_RP_MAX_SWAPS; ++n) {
 		entry_p = D_RW(hashmap->entries);
 		entry_p += args.pos;
 
-		/* Case 1: key already exists, override value */
-		if (!entry_is_empty(entry_p->hash) && entry_p->key == args.data.key) {
+		/*
+		 * Case 1: key already exists, override value. Displaced
+		 * entries are already unique, they only need a new slot.
+		 */
+		if (!rebuild && !displaced && !entry_is_empty(entry_p->hash) &&
+		    entry_matches(hashmap, entry_p, args.data.key, key)) {
+			if (entry_is_outofline(entry_p->hash))
+				pmemobj_defer_free(pop,
+						   record_oid(hashmap, entry_p->value),
+						   args.actv + args.actv_cnt++);
+
 			entry_update(pop, hashmap, &args, rebuild);
 			if (!rebuild)
 				pmemobj_publish(pop, args.actv, args.actv_cnt);
@@ -241,6 +482,7 @@ static int insert_helper(PMEMobjpool *pop, struct hashmap_rp *hashmap, uint64_t
 			struct entry temp = *entry_p;
 			entry_update(pop, hashmap, &args, rebuild);
 			args.data = temp;
+			displaced = true;
 
 			dist = existing_dist;
 		}
@@ -253,34 +495,82 @@ static int insert_helper(PMEMobjpool *pop, struct hashmap_rp *hashmap, uint64_t
 		dist += 1;
 	}
 	LOG("insertion requires too many swaps");
-	if (!rebuild)
+	if (!rebuild) {
 		pmemobj_cancel(pop, args.actv, args.actv_cnt);
+		tags_load(tags, hashmap);
+	}
 
 	return -1;
 }
 
 /*
- * index_lookup -- checks if given key exists in hashmap.
- * Returns index number if key was found, 0 otherwise.
+ * seq_valid -- checks if version of the shard is still 's', so everything read
+ * since it was loaded is consistent
  */
-static uint64_t index_lookup(const struct hashmap_rp *hashmap, uint64_t key)
+static bool seq_valid(const std::atomic<uint64_t> *seq, uint64_t s)
 {
-	const uint64_t hash_lookup = hash(hashmap, key);
-	uint64_t pos = hash_lookup;
-	uint64_t dist = 0;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return seq->load(std::memory_order_relaxed) == s;
+}
 
-	const struct entry *entry_p = NULL;
-	do {
-		entry_p = D_RO(hashmap->entries);
-		entry_p += pos;
+/*
+ * index_lookup -- checks if given key (with fingerprint 'fp') exists in hashmap.
+ * Starting from the key's slot, it compares groups of tags with the key's tag
+ * and reads only entries with matching ones. The key can't be stored after
+ * a never used slot. Due to Robin Hood ordering, it's not stored after
+ * an entry, which is closer to its own slot either.
+ * If 'seq' is set, the lookup is done without the shard's lock: records are
+ * read only if the version of the shard is still 's'.
+ * Returns index number if key was found, 0 otherwise (or LOOKUP_RETRY if the
+ * shard was modified).
+ */
+static uint64_t index_lookup(const struct hashmap_rp *hashmap, const uint8_t *tags,
+			     string_view key, uint64_t fp,
+			     const std::atomic<uint64_t> *seq = nullptr, uint64_t s = 0)
+{
+	const uint8_t t = tag(fp);
+	const uint64_t capacity = hashmap->capacity;
+	const struct entry *entries = D_RO(hashmap->entries);
+
+	uint64_t pos = hash(hashmap, fp);
+	for (uint64_t dist = 0; dist < capacity; dist += HASHMAP_RP_TAG_GROUP) {
+		uint64_t group;
+		std::memcpy(&group, tags + pos, sizeof(group));
 
-		if (entry_p->hash == hash_lookup && entry_p->key == key)
-			return pos;
+		auto empty = tags_match(group, TAG_EMPTY);
+		auto matches = tags_match(group, t);
 
-		pos = increment_pos(hashmap, pos);
+		/* the lowest match is exact, matches after it are ignored */
+		if (empty)
+			matches &= (empty & (~empty + 1)) - 1;
 
-	} while (entry_p->hash != 0 &&
-		 (dist++) <= probe_distance(hashmap, entry_p->hash, pos) - 1);
+		for (; matches != 0; matches &= matches - 1) {
+			auto b = static_cast<uint64_t>(__builtin_ctzll(matches)) / 8;
+			auto i = tag_slot(capacity, pos + b);
+
+			/* a copy, since it may be modified by a writer */
+			const struct entry e = entries[i];
+			if (entry_is_empty(e.hash) || e.key != fp)
+				continue;
+
+			if (seq && entry_is_outofline(e.hash) && !seq_valid(seq, s))
+				return LOOKUP_RETRY;
+
+			if (entry_matches(hashmap, &e, fp, key))
+				return i;
+		}
+
+		if (empty)
+			return 0;
+
+		/* all slots of the group are in use, check the last one */
+		auto last = tag_slot(capacity, pos + HASHMAP_RP_TAG_GROUP - 1);
+		if (probe_distance(hashmap, entries[last].hash, last) <
+		    dist + HASHMAP_RP_TAG_GROUP - 1)
+			return 0;
+
+		pos = tag_slot(capacity, pos + HASHMAP_RP_TAG_GROUP);
+	}
 
 	return 0;
 }
@@ -298,7 +588,8 @@ static int entries_cache(PMEMobjpool *pop, struct hashmap_rp *dest,
 		if (entry_is_empty(e->hash))
 			continue;
 
-		if (insert_helper(pop, dest, e->key, e->value, true) == -1)
+		if (insert_helper(pop, dest, nullptr, e, string_view(), nullptr, 0,
+				  true) == -1)
 			return -1;
 	}
 	assert(src->count == dest->count);
@@ -311,7 +602,7 @@ static int entries_cache(PMEMobjpool *pop, struct hashmap_rp *dest,
  * Returns 0 on success, -1 otherwise.
  */
 static int hm_rp_rebuild(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
-			 size_t capacity_new)
+			 struct hashmap_tags *tags, size_t capacity_new)
 {
 	/*
 	 * We will need 6 actions:
@@ -363,6 +654,8 @@ static int hm_rp_rebuild(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
 	assert(sizeof(actv) / sizeof(actv[0]) >= actv_cnt);
 	pmemobj_publish(pop, actv, actv_cnt);
 
+	tags_load(tags, D_RO(hashmap));
+
 	return 0;
 
 rebuild_err:
@@ -371,6 +664,209 @@ rebuild_err:
 	return -1;
 }
 
+/*
+ * migration_active -- checks if the hashmap is being resized
+ */
+static bool migration_active(const struct hashmap_rp_migration *mig)
+{
+	return !TOID_IS_NULL(mig->entries);
+}
+
+/*
+ * migration_view -- returns hashmap made of the entries being moved, used
+ * to look them up
+ */
+static struct hashmap_rp migration_view(const struct hashmap_rp_migration *mig)
+{
+	struct hashmap_rp view;
+	view.count = mig->count;
+	view.capacity = mig->capacity;
+	view.resize_threshold = 0;
+	view.load_factor = 0;
+	view.entries = mig->entries;
+
+	return view;
+}
+
+/*
+ * migration_lookup -- checks if given key is among the entries, which are
+ * not moved yet. Returns index number if key was found, 0 otherwise.
+ */
+static uint64_t migration_lookup(const struct hashmap_rp_migration *mig,
+				 const struct hashmap_tags *tags, string_view key,
+				 uint64_t fp)
+{
+	if (!migration_active(mig))
+		return 0;
+
+	struct hashmap_rp view = migration_view(mig);
+	uint64_t pos = index_lookup(&view, tags->old->tags.get(), key, fp);
+
+	/* keys are unique, so if it's already moved, it's in the hashmap */
+	return pos >= mig->moved ? pos : 0;
+}
+
+/*
+ * migration_remove -- adds actions, which delete the entry (not moved yet)
+ * at given position
+ */
+static void migration_remove(PMEMobjpool *pop, struct hashmap_rp_migration *mig,
+			     uint64_t pos, struct pobj_action *actv, size_t &actv_cnt)
+{
+	struct hashmap_rp view = migration_view(mig);
+	struct entry *entry_p = D_RW(mig->entries) + pos;
+
+	if (entry_is_outofline(entry_p->hash))
+		pmemobj_defer_free(pop, record_oid(&view, entry_p->value),
+				   &actv[actv_cnt++]);
+
+	pmemobj_set_value(pop, &actv[actv_cnt++], &entry_p->hash,
+			  entry_p->hash | TOMBSTONE_MASK);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->count, mig->count - 1);
+}
+
+/*
+ * hm_rp_migrate -- moves entries from up to 'slots' slots of the hashmap being
+ * resized. Each entry is moved in a separate publish, along with the position
+ * of the next slot to move, so the resize can be continued after a crash.
+ * When all entries are moved, the old ones are freed.
+ * Returns 0 on success, -1 otherwise.
+ */
+static int hm_rp_migrate(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+			 struct hashmap_rp_migration *mig, struct hashmap_tags *tags,
+			 uint64_t slots)
+{
+	if (!migration_active(mig))
+		return 0;
+
+	struct hashmap_rp view = migration_view(mig);
+	const struct entry *entries = D_RO(mig->entries);
+
+	uint64_t pos = mig->moved;
+	uint64_t end = pos + std::min(slots, mig->capacity - pos);
+	for (; pos < end; ++pos) {
+		const struct entry *entry_p = entries + pos;
+		if (entry_is_empty(entry_p->hash))
+			continue;
+
+		/* records are not copied, the entry points to the same one */
+		struct pobj_action extra[2];
+		pmemobj_set_value(pop, &extra[0], &mig->moved, pos + 1);
+		pmemobj_set_value(pop, &extra[1], &mig->count, mig->count - 1);
+
+		if (insert_helper(pop, D_RW(hashmap), tags, entry_p,
+				  entry_key(&view, entry_p), extra, 2, false) != 0)
+			return -1;
+	}
+
+	/*
+	 * We will need 5 actions (if all entries are moved):
+	 * - 1 action to free old entries
+	 * - 2 actions to set null oid of old entries
+	 * - 1 action to reset capacity
+	 * - 1 action to reset number of moved slots
+	 */
+	struct pobj_action actv[5];
+	size_t actv_cnt = 0;
+
+	if (pos < mig->capacity) {
+		/* remaining slots could be empty */
+		if (mig->moved != pos) {
+			pmemobj_set_value(pop, &actv[actv_cnt++], &mig->moved, pos);
+			pmemobj_publish(pop, actv, actv_cnt);
+		}
+
+		return 0;
+	}
+
+	assert(mig->count == 0);
+
+	pmemobj_defer_free(pop, mig->entries.oid, &actv[actv_cnt++]);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->entries.oid.pool_uuid_lo, 0);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->entries.oid.off, 0);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->capacity, 0);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->moved, 0);
+
+	assert(sizeof(actv) / sizeof(actv[0]) >= actv_cnt);
+	pmemobj_publish(pop, actv, actv_cnt);
+
+	tags_free(tags->old.get());
+
+	return 0;
+}
+
+/*
+ * hm_rp_grow -- starts resize of the hashmap to twice its capacity. All entries
+ * become entries being moved and the hashmap gets new, empty ones.
+ * Returns 0 on success, -1 otherwise.
+ */
+static int hm_rp_grow(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		      struct hashmap_rp_migration *mig, struct hashmap_tags *tags)
+{
+	assert(!migration_active(mig));
+
+	/*
+	 * We will need 11 actions:
+	 * - 1 action to alloc memory for new entries
+	 * - 3 actions to set new capacity, resize threshold and count
+	 * - 2 actions to set new oid pointing to new entries
+	 * - 2 actions to set oid of entries being moved to the old entries
+	 * - 3 actions to set capacity, moved slots and count of entries being moved
+	 */
+	struct pobj_action actv[11];
+	size_t actv_cnt = 0;
+
+	uint64_t capacity_new = D_RO(hashmap)->capacity * 2;
+	size_t sz_alloc = sizeof(struct entry) * capacity_new;
+	uint64_t resize_threshold_new =
+		static_cast<uint64_t>(capacity_new * D_RO(hashmap)->load_factor);
+
+	TOID(struct entry)
+	entries = POBJ_XRESERVE_ALLOC(pop, struct entry, sz_alloc, &actv[actv_cnt],
+				      POBJ_XALLOC_ZERO);
+	if (TOID_IS_NULL(entries)) {
+		LOG(std::string("hashmap alloc failed: ") + pmemobj_errormsg());
+		return -1;
+	}
+	actv_cnt++;
+
+	pmemobj_set_value(pop, &actv[actv_cnt++], &D_RW(hashmap)->capacity, capacity_new);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &D_RW(hashmap)->resize_threshold,
+			  resize_threshold_new);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &D_RW(hashmap)->count, 0);
+
+	pmemobj_set_value(pop, &actv[actv_cnt++],
+			  &D_RW(hashmap)->entries.oid.pool_uuid_lo,
+			  entries.oid.pool_uuid_lo);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &D_RW(hashmap)->entries.oid.off,
+			  entries.oid.off);
+
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->entries.oid.pool_uuid_lo,
+			  D_RO(hashmap)->entries.oid.pool_uuid_lo);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->entries.oid.off,
+			  D_RO(hashmap)->entries.oid.off);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->capacity,
+			  D_RO(hashmap)->capacity);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->moved, 0);
+	pmemobj_set_value(pop, &actv[actv_cnt++], &mig->count, D_RO(hashmap)->count);
+
+	assert(sizeof(actv) / sizeof(actv[0]) >= actv_cnt);
+	pmemobj_publish(pop, actv, actv_cnt);
+
+	/* current tags become the old ones, new entries are all empty */
+	if (!tags->old) {
+		tags->old.reset(new struct hashmap_tags);
+		tags->old->reclaimer = tags->reclaimer;
+	}
+	tags->old->tags = std::move(tags->tags);
+	tags->old->capacity = tags->capacity;
+
+	tags->tags.reset(new uint8_t[capacity_new + HASHMAP_RP_TAG_GROUP]());
+	tags->capacity = capacity_new;
+
+	return 0;
+}
+
 /*
  * hm_rp_create --  initializes hashmap state, called after pmemobj_create
  */
@@ -383,21 +879,64 @@ int hm_rp_create(PMEMobjpool *pop, TOID(struct hashmap_rp) * map,
 }
 
 /*
- * hm_rp_insert -- rebuilds hashmap if necessary and wraps insert_helper.
+ * hm_rp_insert -- moves a part of entries of resized hashmap, starts a resize
+ * if necessary and wraps insert_helper.
+ * Key and value are stored inline if both of them are of ENTRY_SIZE,
+ * in a newly allocated record otherwise.
  * returns:
  * - 0 if successful,
  * - -1 if something bad happened
  */
-int hm_rp_insert(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap, uint64_t key,
-		 uint64_t value)
+int hm_rp_insert(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		 struct hashmap_rp_migration *mig, struct hashmap_tags *tags,
+		 string_view key, uint64_t fp, string_view value)
 {
-	if (D_RO(hashmap)->count + 1 >= D_RO(hashmap)->resize_threshold) {
-		uint64_t capacity_new = D_RO(hashmap)->capacity * 2;
-		if (hm_rp_rebuild(pop, hashmap, capacity_new) != 0)
+	struct entry data;
+	data.key = fp;
+
+	/* inline value may be read from the entries, which are moved or freed */
+	bool inline_entry = key.size() == ENTRY_SIZE && value.size() == ENTRY_SIZE;
+	if (inline_entry)
+		data.value = *reinterpret_cast<const uint64_t *>(value.data());
+
+	if (hm_rp_migrate(pop, hashmap, mig, tags, HASHMAP_RP_MIGRATION_STEP) != 0)
+		return -1;
+
+	if (D_RO(hashmap)->count + mig->count + 1 >= D_RO(hashmap)->resize_threshold) {
+		/* previous resize (if any) has to be finished first */
+		if (hm_rp_migrate(pop, hashmap, mig, tags, UINT64_MAX) != 0 ||
+		    hm_rp_grow(pop, hashmap, mig, tags) != 0)
 			return -1;
 	}
 
-	return insert_helper(pop, D_RW(hashmap), key, value, false);
+	/* old entry of the key (if any) is deleted, it must not be moved */
+	struct pobj_action extra[HASHMAP_RP_MAX_EXTRA_ACTIONS];
+	size_t extra_cnt = 0;
+
+	uint64_t old_pos = migration_lookup(mig, tags, key, fp);
+	if (old_pos != 0)
+		migration_remove(pop, mig, old_pos, extra, extra_cnt);
+
+	if (inline_entry) {
+		data.hash = 0;
+	} else {
+		data.value = record_create(pop, &extra[extra_cnt], key, value);
+		if (data.value == 0) {
+			pmemobj_cancel(pop, extra, extra_cnt);
+			return -1;
+		}
+		extra_cnt++;
+		data.hash = OUTOFLINE_MASK;
+	}
+
+	if (insert_helper(pop, D_RW(hashmap), tags, &data, key, extra, extra_cnt,
+			  false) != 0)
+		return -1;
+
+	if (old_pos != 0)
+		tags_set(tags->old.get(), old_pos, TAG_DELETED);
+
+	return 0;
 }
 
 /*
@@ -406,13 +945,34 @@ int hm_rp_insert(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap, uint64_t key
  * - 0 if successful,
  * - 1 if value didn't exist or if something bad happened
  */
-int hm_rp_remove(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap, uint64_t key)
+int hm_rp_remove(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		 struct hashmap_rp_migration *mig, struct hashmap_tags *tags,
+		 string_view key)
 {
-	const uint64_t pos = index_lookup(D_RO(hashmap), key);
-
-	if (pos == 0)
+	if (hm_rp_migrate(pop, hashmap, mig, tags, HASHMAP_RP_MIGRATION_STEP) != 0)
 		return 1;
 
+	const uint64_t fp = fingerprint(key);
+	const uint64_t pos = index_lookup(D_RO(hashmap), tags->tags.get(), key, fp);
+
+	if (pos == 0) {
+		const uint64_t old_pos = migration_lookup(mig, tags, key, fp);
+		if (old_pos == 0)
+			return 1;
+
+		struct pobj_action actv[3];
+		size_t actvcnt = 0;
+
+		migration_remove(pop, mig, old_pos, actv, actvcnt);
+
+		assert(sizeof(actv) / sizeof(actv[0]) >= actvcnt);
+		pmemobj_publish(pop, actv, actvcnt);
+
+		tags_set(tags->old.get(), old_pos, TAG_DELETED);
+
+		return 0;
+	}
+
 	struct entry *entry_p = D_RW(D_RW(hashmap)->entries);
 	entry_p += pos;
 
@@ -420,6 +980,10 @@ int hm_rp_remove(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap, uint64_t key
 
 	struct pobj_action actv[5];
 
+	if (entry_is_outofline(entry_p->hash))
+		pmemobj_defer_free(pop, record_oid(D_RO(hashmap), entry_p->value),
+				   &actv[actvcnt++]);
+
 	pmemobj_set_value(pop, &actv[actvcnt++], &entry_p->hash,
 			  entry_p->hash | TOMBSTONE_MASK);
 	pmemobj_set_value(pop, &actv[actvcnt++], &entry_p->value, 0);
@@ -430,61 +994,193 @@ int hm_rp_remove(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap, uint64_t key
 	assert(sizeof(actv) / sizeof(actv[0]) >= actvcnt);
 	pmemobj_publish(pop, actv, actvcnt);
 
+	tags_set(tags, pos, TAG_DELETED);
+
 	uint64_t reduced_threshold = static_cast<uint64_t>(
 		(static_cast<uint64_t>(D_RO(hashmap)->capacity / 2)) *
 		D_RO(hashmap)->load_factor);
 
-	if (reduced_threshold >= INIT_ENTRIES_NUM_RP &&
+	/* shrinking is done at once, when no resize is in progress */
+	if (!migration_active(mig) && reduced_threshold >= INIT_ENTRIES_NUM_RP &&
 	    D_RW(hashmap)->count < reduced_threshold &&
-	    hm_rp_rebuild(pop, hashmap, D_RO(hashmap)->capacity / 2))
+	    hm_rp_rebuild(pop, hashmap, tags, D_RO(hashmap)->capacity / 2))
 		return 1;
 
 	return 0;
 }
 
 /*
- * hm_rp_get -- checks whether specified key is in the hashmap.
+ * hm_rp_get -- checks whether specified key is in the hashmap (or among
+ * its entries being moved).
+ * Returns the value if key was found. The value is valid until the hashmap
+ * is modified.
+ */
+std::pair<string_view, bool> hm_rp_get(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+				       const struct hashmap_rp_migration *mig,
+				       const struct hashmap_tags *tags, string_view key,
+				       uint64_t fp)
+{
+	const struct entry *entry_p = D_RO(D_RO(hashmap)->entries);
+
+	uint64_t pos = index_lookup(D_RO(hashmap), tags->tags.get(), key, fp);
+	if (pos != 0)
+		return {entry_value(D_RO(hashmap), entry_p + pos), true};
+
+	pos = migration_lookup(mig, tags, key, fp);
+	if (pos != 0) {
+		struct hashmap_rp view = migration_view(mig);
+		return {entry_value(&view, D_RO(mig->entries) + pos), true};
+	}
+
+	return {string_view(), false};
+}
+
+/*
+ * hm_rp_inline_value -- returns pointer to the value of the key, if the key is
+ * in the hashmap (not among its entries being moved) and its entry keeps
+ * the value inline, nullptr otherwise.
+ */
+static uint64_t *hm_rp_inline_value(TOID(struct hashmap_rp) hashmap,
+				    const struct hashmap_tags *tags, string_view key,
+				    uint64_t fp)
+{
+	uint64_t pos = index_lookup(D_RO(hashmap), tags->tags.get(), key, fp);
+	if (pos == 0)
+		return nullptr;
+
+	struct entry *entry_p = D_RW(D_RW(hashmap)->entries) + pos;
+	if (entry_is_outofline(entry_p->hash))
+		return nullptr;
+
+	return &entry_p->value;
+}
+
+/*
+ * value_copy_shared -- copies value of the entry found by a lock-free lookup.
+ * The record is read only if version of the shard is still 's' (its size as
+ * well, before copying that many bytes).
+ * Returns 1 on success, -1 if the shard was modified.
+ */
+static int value_copy_shared(const struct hashmap_rp *hashmap,
+			     const struct entry *entry_p, std::string *value,
+			     const std::atomic<uint64_t> *seq, uint64_t s)
+{
+	const struct entry e = *entry_p;
+	if (!seq_valid(seq, s))
+		return -1;
+
+	if (!value)
+		return 1;
+
+	if (!entry_is_outofline(e.hash)) {
+		value->assign(reinterpret_cast<const char *>(&e.value), ENTRY_SIZE);
+		return seq_valid(seq, s) ? 1 : -1;
+	}
+
+	const struct record *r = record_get(hashmap, e.value);
+	uint64_t key_size = r->key_size;
+	uint64_t value_size = r->value_size;
+	if (!seq_valid(seq, s))
+		return -1;
+
+	value->assign(reinterpret_cast<const char *>(r + 1) + key_size, value_size);
+
+	return seq_valid(seq, s) ? 1 : -1;
+}
+
+/*
+ * hm_rp_get_shared -- lock-free version of hm_rp_get. Writers make version
+ * of the shard ('seq') odd while they modify it, 's' is its even value loaded
+ * by the caller. Fields of the hashmap and its tags are loaded first and used
+ * only if the version didn't change by then, so the tags (freed through
+ * the reclaimer) and entries are valid; records are read only after such
+ * a check as well. If a value is found, it's copied to 'value' (unless it's
+ * nullptr).
+ * Returns 1 if key was found, 0 if it wasn't and -1 if the shard was modified
+ * and the lookup has to be retried.
  */
-std::pair<uint64_t, bool> hm_rp_get(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
-				    uint64_t key)
+int hm_rp_get_shared(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		     const struct hashmap_rp_migration *mig,
+		     const struct hashmap_tags *tags, string_view key, uint64_t fp,
+		     const std::atomic<uint64_t> *seq, uint64_t s, std::string *value)
 {
-	struct entry *entry_p = reinterpret_cast<struct entry *>(
-		pmemobj_direct(D_RW(hashmap)->entries.oid));
+	const struct hashmap_rp view = *D_RO(hashmap);
+	const uint8_t *view_tags = tags->tags.get();
+	const struct hashmap_rp old_view = migration_view(mig);
+	const uint64_t moved = mig->moved;
+	const struct hashmap_tags *old = tags->old.get();
+	const uint8_t *old_tags = old ? old->tags.get() : nullptr;
+
+	if (!seq_valid(seq, s))
+		return -1;
+
+	uint64_t pos = index_lookup(&view, view_tags, key, fp, seq, s);
+	if (pos == LOOKUP_RETRY)
+		return -1;
+	if (pos != 0)
+		return value_copy_shared(&view, D_RO(view.entries) + pos, value, seq, s);
+
+	if (!TOID_IS_NULL(old_view.entries)) {
+		pos = index_lookup(&old_view, old_tags, key, fp, seq, s);
+		if (pos == LOOKUP_RETRY)
+			return -1;
+		if (pos >= moved && pos != 0)
+			return value_copy_shared(&old_view, D_RO(old_view.entries) + pos,
+						 value, seq, s);
+	}
+
+	return seq_valid(seq, s) ? 0 : -1;
+}
+
+/*
+ * hm_rp_prefetch -- prefetches the slot (and its tags), from which the lookup
+ * of the key starts.
+ */
+void hm_rp_prefetch(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		    const struct hashmap_tags *tags, string_view key)
+{
+	const struct entry *entry_p = D_RO(D_RO(hashmap)->entries);
+	uint64_t pos = hash(D_RO(hashmap), fingerprint(key));
 
-	uint64_t pos = index_lookup(D_RO(hashmap), key);
-	return pos == 0 ? std::pair<uint64_t, bool>{0, false}
-			: std::pair<uint64_t, bool>{(entry_p + pos)->value, true};
+	__builtin_prefetch(tags->tags.get() + pos);
+	__builtin_prefetch(entry_p + pos);
 }
 
 /*
- * hm_rp_lookup -- checks whether specified key is in the hashmap.
+ * hm_rp_lookup -- checks whether specified key is in the hashmap (or among
+ * its entries being moved).
  * Returns 1 if key was found, 0 otherwise.
  */
-int hm_rp_lookup(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap, uint64_t key)
+int hm_rp_lookup(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		 const struct hashmap_rp_migration *mig, const struct hashmap_tags *tags,
+		 string_view key)
 {
-	return index_lookup(D_RO(hashmap), key) != 0;
+	const uint64_t fp = fingerprint(key);
+
+	return index_lookup(D_RO(hashmap), tags->tags.get(), key, fp) != 0 ||
+		migration_lookup(mig, tags, key, fp) != 0;
 }
 
 /*
- * hm_rp_foreach -- calls cb for all values from the hashmap
+ * entries_foreach -- calls cb for entries of the hashmap from position 'first'
  */
-int hm_rp_foreach(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
-		  int (*cb)(const char *key, size_t key_size, const char *value,
-			    size_t value_size, void *arg),
-		  void *arg)
+static int entries_foreach(const struct hashmap_rp *hashmap, uint64_t first,
+			   int (*cb)(const char *key, size_t key_size, const char *value,
+				     size_t value_size, void *arg),
+			   void *arg)
 {
-	struct entry *entry_p = reinterpret_cast<struct entry *>(
-		pmemobj_direct(D_RO(hashmap)->entries.oid));
+	const struct entry *entry_p = D_RO(hashmap->entries) + first;
 
 	int ret = 0;
-	for (size_t i = 0; i < D_RO(hashmap)->capacity; ++i, ++entry_p) {
+	for (size_t i = first; i < hashmap->capacity; ++i, ++entry_p) {
 		uint64_t hash = entry_p->hash;
 		if (entry_is_empty(hash))
 			continue;
 
-		ret = cb(reinterpret_cast<const char *>(&(entry_p->key)), ENTRY_SIZE,
-			 reinterpret_cast<const char *>(&(entry_p->value)), ENTRY_SIZE,
-			 arg);
+		auto key = entry_key(hashmap, entry_p);
+		auto value = entry_value(hashmap, entry_p);
+
+		ret = cb(key.data(), key.size(), value.data(), value.size(), arg);
 
 		if (ret)
 			return ret;
@@ -493,28 +1189,215 @@ int hm_rp_foreach(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
 	return 0;
 }
 
+/*
+ * hm_rp_foreach -- calls cb for all values from the hashmap (and its entries
+ * being moved)
+ */
+int hm_rp_foreach(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		  const struct hashmap_rp_migration *mig,
+		  int (*cb)(const char *key, size_t key_size, const char *value,
+			    size_t value_size, void *arg),
+		  void *arg)
+{
+	int ret = entries_foreach(D_RO(hashmap), 0, cb, arg);
+	if (ret || !migration_active(mig))
+		return ret;
+
+	struct hashmap_rp view = migration_view(mig);
+	return entries_foreach(&view, mig->moved, cb, arg);
+}
+
+/*
+ * hm_rp_tags_load -- creates tags of the hashmap (and its entries being moved),
+ * called when it's opened
+ */
+void hm_rp_tags_load(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		     const struct hashmap_rp_migration *mig, struct hashmap_tags *tags)
+{
+	tags_load(tags, D_RO(hashmap));
+
+	if (migration_active(mig)) {
+		struct hashmap_rp view = migration_view(mig);
+		if (!tags->old) {
+			tags->old.reset(new struct hashmap_tags);
+			tags->old->reclaimer = tags->reclaimer;
+		}
+		tags_load(tags->old.get(), &view);
+	}
+}
+
+/*
+ * hm_rp_finish_resize -- moves all remaining entries of the resized hashmap
+ */
+int hm_rp_finish_resize(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+			struct hashmap_rp_migration *mig, struct hashmap_tags *tags)
+{
+	return hm_rp_migrate(pop, hashmap, mig, tags, UINT64_MAX);
+}
+
+/*
+ * hm_rp_split -- creates 'shards_new' hashmaps (a multiple of 'shards'), each
+ * with these entries of the hashmaps from 'map', which belong to it according
+ * to shard_of. Records are not copied. New hashmaps are written directly,
+ * actions which allocate them (and free the old ones) are appended to actv.
+ * Hashmaps can't be resized at the moment.
+ * Returns 0 on success, -1 otherwise.
+ */
+int hm_rp_split(PMEMobjpool *pop, const TOID(struct hashmap_rp) * map, size_t shards,
+		TOID(struct hashmap_rp) * map_new, size_t shards_new,
+		std::vector<pobj_action> &actv)
+{
+	std::vector<uint64_t> counts(shards_new, 0);
+	for (size_t i = 0; i < shards; ++i) {
+		const struct entry *e_begin = D_RO(D_RO(map[i])->entries);
+		const struct entry *e_end = e_begin + D_RO(map[i])->capacity;
+
+		for (const struct entry *e = e_begin; e != e_end; ++e) {
+			if (!entry_is_empty(e->hash))
+				counts[shard_of(e->key, shards_new)]++;
+		}
+	}
+
+	for (size_t j = 0; j < shards_new; ++j) {
+		float load_factor = D_RO(map[j % shards])->load_factor;
+		uint64_t capacity = INIT_ENTRIES_NUM_RP;
+		while (counts[j] + 1 >= static_cast<uint64_t>(capacity * load_factor))
+			capacity *= 2;
+
+		actv.emplace_back();
+		TOID(struct hashmap_rp)
+		hashmap = POBJ_RESERVE_NEW(pop, struct hashmap_rp, &actv.back());
+		if (TOID_IS_NULL(hashmap)) {
+			LOG(std::string("hashmap alloc failed: ") + pmemobj_errormsg());
+			return -1;
+		}
+
+		D_RW(hashmap)->count = 0;
+		D_RW(hashmap)->capacity = capacity;
+		D_RW(hashmap)->load_factor = load_factor;
+		D_RW(hashmap)->resize_threshold =
+			static_cast<uint64_t>(capacity * load_factor);
+
+		actv.emplace_back();
+		D_RW(hashmap)->entries =
+			POBJ_XRESERVE_ALLOC(pop, struct entry,
+					    sizeof(struct entry) * capacity,
+					    &actv.back(), POBJ_XALLOC_ZERO);
+		if (TOID_IS_NULL(D_RO(hashmap)->entries)) {
+			LOG(std::string("hashmap alloc failed: ") + pmemobj_errormsg());
+			return -1;
+		}
+
+		map_new[j] = hashmap;
+	}
+
+	for (size_t i = 0; i < shards; ++i) {
+		const struct entry *e_begin = D_RO(D_RO(map[i])->entries);
+		const struct entry *e_end = e_begin + D_RO(map[i])->capacity;
+
+		for (const struct entry *e = e_begin; e != e_end; ++e) {
+			if (entry_is_empty(e->hash))
+				continue;
+
+			auto hashmap = D_RW(map_new[shard_of(e->key, shards_new)]);
+			if (insert_helper(pop, hashmap, nullptr, e, string_view(),
+					  nullptr, 0, true) == -1)
+				return -1;
+		}
+	}
+
+	for (size_t j = 0; j < shards_new; ++j) {
+		pmemobj_persist(pop, D_RW(D_RW(map_new[j])->entries),
+				sizeof(struct entry) * D_RO(map_new[j])->capacity);
+		pmemobj_persist(pop, D_RW(map_new[j]), sizeof(struct hashmap_rp));
+	}
+
+	for (size_t i = 0; i < shards; ++i) {
+		actv.emplace_back();
+		pmemobj_defer_free(pop, D_RO(map[i])->entries.oid, &actv.back());
+		actv.emplace_back();
+		pmemobj_defer_free(pop, map[i].oid, &actv.back());
+	}
+
+	return 0;
+}
+
 /*
  * hm_rp_count -- returns number of elements
  */
-size_t hm_rp_count(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap)
+size_t hm_rp_count(PMEMobjpool *pop, TOID(struct hashmap_rp) hashmap,
+		   const struct hashmap_rp_migration *mig)
 {
-	return D_RO(hashmap)->count;
+	return D_RO(hashmap)->count + mig->count;
 }
 
 } /* namespace robinhood */
 } /* namespace internal */
 
-size_t robinhood::shard_hash(uint64_t key)
+/* Returns shard of the key with given fingerprint */
+size_t robinhood::shard_hash(uint64_t fp)
 {
-	return static_cast<size_t>(
-		fast_hash(ENTRY_SIZE, reinterpret_cast<const char *>(&key)) &
-		(shards_number - 1));
+	return internal::robinhood::shard_of(fp, shards_number);
+}
+
+/* It's done without the lock, prefetching a stale address is harmless */
+void robinhood::prefetch(string_view key)
+{
+	auto shard = shard_hash(key_hash(key));
+
+	hm_rp_prefetch(pmpool.handle(), container[shard], &tags[shard], key);
+}
+
+/*
+ * Looks up the key in the shard without taking its lock. The lookup is retried
+ * if a write to the shard was started before it's done. Retired tags are not
+ * freed while the lookup is in progress, but it leaves the epoch before waiting
+ * for a writer - the writer may be waiting for the readers to leave.
+ * Returns 1 if the key was found (and copies its value to 'value', unless it's
+ * nullptr), 0 otherwise.
+ */
+int robinhood::get_shared(string_view key, uint64_t fp, std::string *value)
+{
+	auto shard = shard_hash(fp);
+	const auto &seq = versions[shard].seq;
+
+	while (true) {
+		auto s = seq.load(std::memory_order_acquire);
+		if (s & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		internal::epoch_guard guard(reclaimer);
+		auto ret = hm_rp_get_shared(pmpool.handle(), container[shard],
+					    &migrations[shard], &tags[shard], key, fp,
+					    &seq, s, value);
+		if (ret != -1)
+			return ret;
+	}
 }
 
 robinhood::robinhood(std::unique_ptr<internal::config> cfg)
-    : pmemobj_engine_base(cfg, "pmemkv_robinhood")
+    : pmemobj_engine_base(cfg, "pmemkv_robinhood"),
+      reclaimer(std::thread::hardware_concurrency(),
+		[](void *ptr, std::size_t) { delete[] static_cast<uint8_t *>(ptr); })
 {
+	/* config has precedence over the env variable, 0 means it's not set */
+	uint64_t sn = 0;
+	auto sn_env = std::getenv("PMEMKV_ROBINHOOD_SHARDS_NUMBER");
+	if (sn_env)
+		sn = std::stoull(sn_env);
+	cfg->get_uint64("shards_number", &sn);
+
+	if ((sn & (sn - 1)) != 0)
+		throw internal::invalid_argument(
+			"Number of shards has to be a power of 2: " + std::to_string(sn));
+
+	shards_number = static_cast<size_t>(sn);
+
+	internal::open_phase phase("robinhood.recover");
 	Recover();
+	phase.end();
 
 	LOG("Started ok");
 }
@@ -537,7 +1420,7 @@ status robinhood::count_all(std::size_t &cnt)
 	size_t size = 0;
 	for (size_t i = 0; i < shards_number; ++i) {
 		shared_lock_type lock(mtxs[i]);
-		size += hm_rp_count(pmpool.handle(), container[i]);
+		size += hm_rp_count(pmpool.handle(), container[i], &migrations[i]);
 	}
 
 	cnt = size;
@@ -552,7 +1435,8 @@ status robinhood::get_all(get_kv_callback *callback, void *arg)
 
 	for (size_t i = 0; i < shards_number; ++i) {
 		shared_lock_type lock(mtxs[i]);
-		auto ret = hm_rp_foreach(pmpool.handle(), container[i], callback, arg);
+		auto ret = hm_rp_foreach(pmpool.handle(), container[i], &migrations[i],
+					 callback, arg);
 
 		if (ret)
 			return status::STOPPED_BY_CB;
@@ -561,66 +1445,124 @@ status robinhood::get_all(get_kv_callback *callback, void *arg)
 	return status::OK;
 }
 
-status robinhood::exists(string_view key)
+/* Partition 'i' scans shards i, i + partitions, i + 2 * partitions, ... */
+status robinhood::get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				   void **args)
 {
-	LOG("exists for key=" << std::string(key.data(), key.size()));
+	LOG("get_all_parallel");
 	check_outside_tx();
 
-	if (key.size() != ENTRY_SIZE)
-		return status::INVALID_ARGUMENT;
+	partitions = std::min(partitions, shards_number);
+
+	return internal::parallel_scan(
+		partitions, callback, args,
+		[&](std::size_t partition, get_kv_callback *cb, void *arg) {
+			for (size_t i = partition; i < shards_number; i += partitions) {
+				shared_lock_type lock(mtxs[i]);
+				auto ret = hm_rp_foreach(pmpool.handle(), container[i],
+							 &migrations[i], cb, arg);
 
-	auto k = *reinterpret_cast<const uint64_t *>(key.data());
+				if (ret)
+					return status::STOPPED_BY_CB;
+			}
 
-	auto shard = shard_hash(k);
-	shared_lock_type lock(mtxs[shard]);
+			return status::OK;
+		});
+}
 
-	return hm_rp_lookup(pmpool.handle(), container[shard], k) == 0 ? status::NOT_FOUND
-								       : status::OK;
+status robinhood::exists(string_view key)
+{
+	return exists_hashed(key, key_hash(key));
 }
 
 status robinhood::get(string_view key, get_v_callback *callback, void *arg)
 {
-	LOG("get key=" << std::string(key.data(), key.size()));
-	check_outside_tx();
+	return get_hashed(key, key_hash(key), callback, arg);
+}
 
-	if (key.size() != ENTRY_SIZE)
-		return status::INVALID_ARGUMENT;
+/* Keys are hashed to their fingerprints, which pick shards and slots */
+uint64_t robinhood::key_hash(string_view key)
+{
+	return internal::robinhood::fingerprint(key);
+}
 
-	auto k = *reinterpret_cast<const uint64_t *>(key.data());
+status robinhood::exists_hashed(string_view key, uint64_t hash)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
 
-	auto shard = shard_hash(k);
-	shared_lock_type lock(mtxs[shard]);
+	auto found = get_shared(key, hash, nullptr);
 
-	auto result = hm_rp_get(pmpool.handle(), container[shard], k);
+	return found == 0 ? status::NOT_FOUND : status::OK;
+}
 
-	lock.unlock();
+status robinhood::get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			     void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
 
-	if (!result.second) {
+	/* the value is copied, it may be modified as soon as it's read */
+	std::string value;
+	if (get_shared(key, hash, &value) == 0) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
 	}
 
-	callback(reinterpret_cast<const char *>(&result.first), ENTRY_SIZE, arg);
+	callback(value.data(), value.size(), arg);
 
 	return status::OK;
 }
 
+status robinhood::get_batch(const string_view *keys, std::size_t n,
+			    get_kv_callback *callback, void *arg)
+{
+	LOG("get_batch n=" << n);
+	check_outside_tx();
+
+	/* start loading slots of the first keys, before resolving any of them */
+	for (std::size_t i = 0; i < std::min<std::size_t>(n, HASHMAP_RP_PREFETCH_DISTANCE);
+	     ++i)
+		prefetch(keys[i]);
+
+	auto s = status::OK;
+	std::string value;
+	for (std::size_t i = 0; i < n; ++i) {
+		if (i + HASHMAP_RP_PREFETCH_DISTANCE < n)
+			prefetch(keys[i + HASHMAP_RP_PREFETCH_DISTANCE]);
+
+		if (get_shared(keys[i], key_hash(keys[i]), &value) == 0) {
+			LOG("  key not found");
+			s = status::NOT_FOUND;
+			continue;
+		}
+
+		auto ret = callback(keys[i].data(), keys[i].size(), value.data(),
+				    value.size(), arg);
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return s;
+}
+
 status robinhood::put(string_view key, string_view value)
+{
+	return put_hashed(key, key_hash(key), value);
+}
+
+status robinhood::put_hashed(string_view key, uint64_t hash, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
 
-	if (key.size() != ENTRY_SIZE || value.size() != ENTRY_SIZE)
-		return status::INVALID_ARGUMENT;
-
-	auto k = *reinterpret_cast<const uint64_t *>(key.data());
-	auto v = *reinterpret_cast<const uint64_t *>(value.data());
-
-	auto shard = shard_hash(k);
+	auto shard = shard_hash(hash);
 	unique_lock_type lock(mtxs[shard]);
+	internal::robinhood::version_guard guard(versions[shard]);
 
-	if (hm_rp_insert(pmpool.handle(), container[shard], k, v) != 0) {
+	if (hm_rp_insert(pmpool.handle(), container[shard], &migrations[shard],
+			 &tags[shard], key, hash, value) != 0) {
 		// XXX: Extend the C error handling code to pass the actual reason of the
 		// failure.
 		return status::UNKNOWN_ERROR;
@@ -629,20 +1571,94 @@ status robinhood::put(string_view key, string_view value)
 	return status::OK;
 }
 
-status robinhood::remove(string_view key)
+status robinhood::update(string_view key, update_callback *callback, void *arg)
 {
-	LOG("remove key=" << std::string(key.data(), key.size()));
+	LOG("update key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	if (key.size() != ENTRY_SIZE)
-		return status::INVALID_ARGUMENT;
+	auto fp = key_hash(key);
+	auto shard = shard_hash(fp);
+	unique_lock_type lock(mtxs[shard]);
+
+	auto result = hm_rp_get(pmpool.handle(), container[shard], &migrations[shard],
+				&tags[shard], key, fp);
+
+	const char *new_value;
+	size_t new_valuebytes;
+	if (callback(result.second ? result.first.data() : nullptr,
+		     result.second ? result.first.size() : 0, &new_value, &new_valuebytes,
+		     arg) != 0)
+		return status::STOPPED_BY_CB;
+
+	internal::robinhood::version_guard guard(versions[shard]);
+	if (hm_rp_insert(pmpool.handle(), container[shard], &migrations[shard],
+			 &tags[shard], key, fp,
+			 string_view(new_value, new_valuebytes)) != 0)
+		return status::UNKNOWN_ERROR;
+
+	return status::OK;
+}
+
+/*
+ * Values of inline entries (8-byte keys and values) are updated in place,
+ * by a single (failure atomic) 8-byte store and persist. Other keys (and keys
+ * of entries being moved by a resize) are put, as by update().
+ */
+status robinhood::fetch_add(string_view key, uint64_t delta, uint64_t &old_value)
+{
+	LOG("fetch_add key=" << std::string(key.data(), key.size())
+			     << ", delta=" << std::to_string(delta));
+	check_outside_tx();
+
+	auto fp = key_hash(key);
+	auto shard = shard_hash(fp);
+	unique_lock_type lock(mtxs[shard]);
+
+	auto value_p = internal::robinhood::hm_rp_inline_value(container[shard],
+							       &tags[shard], key, fp);
+	if (value_p) {
+		internal::robinhood::version_guard guard(versions[shard]);
+		old_value = *value_p;
+		*value_p = old_value + delta;
+		pmemobj_persist(pmpool.handle(), value_p, sizeof(uint64_t));
+
+		return status::OK;
+	}
+
+	auto result = hm_rp_get(pmpool.handle(), container[shard], &migrations[shard],
+				&tags[shard], key, fp);
+
+	uint64_t value = 0;
+	if (result.second) {
+		if (result.first.size() != sizeof(uint64_t))
+			throw internal::invalid_argument("Value is not an 8-byte integer");
+		std::memcpy(&value, result.first.data(), sizeof(uint64_t));
+	}
+
+	uint64_t new_value = value + delta;
+	internal::robinhood::version_guard guard(versions[shard]);
+	if (hm_rp_insert(pmpool.handle(), container[shard], &migrations[shard],
+			 &tags[shard], key, fp,
+			 string_view(reinterpret_cast<const char *>(&new_value),
+				     sizeof(uint64_t))) != 0)
+		return status::UNKNOWN_ERROR;
+
+	old_value = value;
+
+	return status::OK;
+}
 
-	auto k = *reinterpret_cast<const uint64_t *>(key.data());
+status robinhood::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
 
-	auto shard = shard_hash(k);
+	auto shard = shard_hash(key);
 	unique_lock_type lock(mtxs[shard]);
+	internal::robinhood::version_guard guard(versions[shard]);
 
-	auto result = hm_rp_remove(pmpool.handle(), container[shard], k);
+	auto result = hm_rp_remove(pmpool.handle(), container[shard], &migrations[shard],
+				   &tags[shard], key);
 
 	if (result == 1)
 		return status::NOT_FOUND;
@@ -650,27 +1666,163 @@ status robinhood::remove(string_view key)
 	return status::OK;
 }
 
-void robinhood::Recover()
+status robinhood::stats(internal::stats_sink &sink)
 {
-	auto sn = std::getenv("PMEMKV_ROBINHOOD_SHARDS_NUMBER");
-	if (sn)
-		shards_number = std::stoul(sn);
-	else
-		shards_number = SHARDS_DEFAULT;
+	LOG("stats");
+	check_outside_tx();
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	internal::lock_class_stats locks;
+	for (auto &m : mtxs)
+		locks.add(m);
+	locks.report(sink, "robinhood_shard");
+
+	std::size_t cnt = 0;
+	count_all(cnt);
+	report_memory(sink, cnt);
+
+	return status::OK;
+}
+
+/*
+ * Splits every shard into shards_new / shards_number ones, in a single publish.
+ * Since both numbers are powers of 2, each key of the old shard i goes to one
+ * of the shards i + k * shards_number, so locations of the other keys don't
+ * change (records are not copied, only entries are redistributed).
+ */
+void robinhood::Reshard(internal::robinhood::pmem_type *pmem_ptr, size_t shards_new)
+{
+	using namespace internal::robinhood;
+
+	auto pop = pmpool.handle();
+
+	for (size_t i = 0; i < shards_number; ++i) {
+		if (!migration_active(&migrations[i]))
+			continue;
+
+		hashmap_tags t;
+		hm_rp_tags_load(pop, container[i], &migrations[i], &t);
+		if (hm_rp_finish_resize(pop, container[i], &migrations[i], &t) == -1)
+			throw internal::error(
+				std::string("Cannot finish resize of shard: ") +
+				std::to_string(i));
+	}
+
+	auto actv = std::vector<pobj_action>();
+	actv.reserve(9 + 2 * shards_new + 2 * shards_number);
+
+	actv.emplace_back();
+	auto map = pmemobj_reserve(pop, &actv.back(),
+				   sizeof(TOID(struct hashmap_rp)) * shards_new, 0);
+	actv.emplace_back();
+	auto alloc = pmemobj_xreserve(pop, &actv.back(),
+				      sizeof(hashmap_rp_migration) * shards_new, 0,
+				      POBJ_XALLOC_ZERO);
+	if (OID_IS_NULL(map) || OID_IS_NULL(alloc)) {
+		pmemobj_cancel(pop, actv.data(), actv.size());
+		throw internal::error(std::string("Cannot allocate shards: ") +
+				      pmemobj_errormsg());
+	}
+
+	auto map_new = static_cast<TOID(struct hashmap_rp) *>(pmemobj_direct(map));
+	if (hm_rp_split(pop, container, shards_number, map_new, shards_new, actv) ==
+	    -1) {
+		pmemobj_cancel(pop, actv.data(), actv.size());
+		throw internal::error(std::string("Cannot split shards: ") +
+				      pmemobj_errormsg());
+	}
+	pmemobj_persist(pop, map_new, sizeof(TOID(struct hashmap_rp)) * shards_new);
+	pmemobj_persist(pop, pmemobj_direct(alloc),
+			sizeof(hashmap_rp_migration) * shards_new);
+
+	actv.emplace_back();
+	pmemobj_defer_free(pop, pmem_ptr->map.raw(), &actv.back());
+	actv.emplace_back();
+	pmemobj_defer_free(pop, pmem_ptr->migrations.raw(), &actv.back());
+
+	PMEMoid *oid = pmem_ptr->map.raw_ptr();
+	actv.emplace_back();
+	pmemobj_set_value(pop, &actv.back(), &oid->pool_uuid_lo, map.pool_uuid_lo);
+	actv.emplace_back();
+	pmemobj_set_value(pop, &actv.back(), &oid->off, map.off);
+
+	oid = pmem_ptr->migrations.raw_ptr();
+	actv.emplace_back();
+	pmemobj_set_value(pop, &actv.back(), &oid->pool_uuid_lo, alloc.pool_uuid_lo);
+	actv.emplace_back();
+	pmemobj_set_value(pop, &actv.back(), &oid->off, alloc.off);
+
+	actv.emplace_back();
+	pmemobj_set_value(pop, &actv.back(), &pmem_ptr->shards_number.get_rw(),
+			  shards_new);
 
+	if (pmemobj_publish(pop, actv.data(), actv.size()) != 0) {
+		pmemobj_cancel(pop, actv.data(), actv.size());
+		throw internal::error(std::string("Cannot publish split shards: ") +
+				      pmemobj_errormsg());
+	}
+
+	container = pmem_ptr->map.get();
+	migrations = pmem_ptr->migrations.get();
+	shards_number = shards_new;
+}
+
+void robinhood::Recover()
+{
 	if (!OID_IS_NULL(*root_oid)) {
 		auto pmem_ptr = static_cast<internal::robinhood::pmem_type *>(
 			pmemobj_direct(*root_oid));
 
 		container = pmem_ptr->map.get();
 
-		if (this->shards_number != pmem_ptr->shards_number)
+		/* shards can only be split, into 2^n ones each */
+		size_t shards_new = shards_number;
+		shards_number = pmem_ptr->shards_number;
+		if (shards_new == 0)
+			shards_new = shards_number;
+		else if (shards_new < shards_number || shards_new % shards_number != 0)
 			throw internal::invalid_argument(
 				"Wrong number of shards set: " +
-				std::to_string(this->shards_number) +
-				", expected: " + std::to_string(pmem_ptr->shards_number));
+				std::to_string(shards_new) +
+				", expected at least: " + std::to_string(shards_number));
+
+		if (pmem_ptr->migrations_magic != MIGRATIONS_MAGIC) {
+			pobj_action actv[4];
+
+			auto alloc = pmemobj_xreserve(
+				pmpool.handle(), &actv[0],
+				sizeof(internal::robinhood::hashmap_rp_migration) *
+					shards_number,
+				0, POBJ_XALLOC_ZERO);
+			if (OID_IS_NULL(alloc))
+				throw internal::error(
+					std::string("Cannot allocate resize state: ") +
+					pmemobj_errormsg());
+
+			PMEMoid *oid = pmem_ptr->migrations.raw_ptr();
+			pmemobj_set_value(pmpool.handle(), &actv[1], &oid->pool_uuid_lo,
+					  alloc.pool_uuid_lo);
+			pmemobj_set_value(pmpool.handle(), &actv[2], &oid->off,
+					  alloc.off);
+			pmemobj_set_value(pmpool.handle(), &actv[3],
+					  &pmem_ptr->migrations_magic, MIGRATIONS_MAGIC);
+
+			pmemobj_publish(pmpool.handle(), actv, 4);
+		}
 
+		migrations = pmem_ptr->migrations.get();
+
+		if (shards_new != shards_number) {
+			internal::open_phase phase("robinhood.reshard");
+			Reshard(pmem_ptr, shards_new);
+		}
 	} else {
+		if (shards_number == 0)
+			shards_number = SHARDS_DEFAULT;
+
 		auto actv = std::vector<pobj_action>();
 
 		actv.emplace_back();
@@ -696,6 +1848,18 @@ void robinhood::Recover()
 
 		container = pmem_ptr->map.get();
 
+		actv.emplace_back();
+		pmem_ptr->migrations = pmemobj_xreserve(
+			pmpool.handle(), &actv.back(),
+			sizeof(internal::robinhood::hashmap_rp_migration) * shards_number,
+			0, POBJ_XALLOC_ZERO);
+		pmem_ptr->migrations_magic = MIGRATIONS_MAGIC;
+
+		pmpool.persist(pmem_ptr->migrations);
+		pmpool.persist(&pmem_ptr->migrations_magic, sizeof(uint64_t));
+
+		migrations = pmem_ptr->migrations.get();
+
 		pmem_ptr->shards_number = this->shards_number;
 		pmpool.persist(pmem_ptr->shards_number);
 
@@ -706,7 +1870,16 @@ void robinhood::Recover()
 		pmemobj_publish(pmpool.handle(), actv.data(), actv.size());
 	}
 
+	internal::open_phase phase("robinhood.shards_setup");
 	mtxs = std::vector<mutex_type>(shards_number);
+	versions = std::vector<internal::robinhood::shard_version>(shards_number);
+
+	tags = std::vector<internal::robinhood::hashmap_tags>(shards_number);
+	for (size_t i = 0; i < shards_number; ++i) {
+		tags[i].reclaimer = &reclaimer;
+		hm_rp_tags_load(pmpool.handle(), container[i], &migrations[i],
+				&tags[i]);
+	}
 }
 
 static factory_registerer register_robinhood(
@@ -8,12 +8,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include <string>
+#include <vector>
 
 #include <libpmemobj++/persistent_ptr.hpp>
 
 #include "../comparator/pmemobj_comparator.h"
+#include "../epoch_reclaimer.h"
+#include "../lock_stats.h"
 #include "../pmemobj_engine.h"
 
 namespace pmem
@@ -37,12 +43,38 @@ namespace robinhood
 #define HASHMAP_RP_LOAD_FACTOR 0.5f
 /* Maximum number of swaps allowed during single insertion */
 #define HASHMAP_RP_MAX_SWAPS 150
-/* Size of an action array used during single insertion */
-#define HASHMAP_RP_MAX_ACTIONS (4 * HASHMAP_RP_MAX_SWAPS + 5)
-/* Size of a key or value (sizeof(uint64_t)) */
+/* Maximum number of actions published along with a single insertion */
+#define HASHMAP_RP_MAX_EXTRA_ACTIONS 4
+/*
+ * Size of an action array used during single insertion, including
+ * freeing of the old record and extra actions of the caller
+ */
+#define HASHMAP_RP_MAX_ACTIONS                                                           \
+	(4 * HASHMAP_RP_MAX_SWAPS + 6 + HASHMAP_RP_MAX_EXTRA_ACTIONS)
+/* Number of slots moved to the resized hashmap by each write operation */
+#define HASHMAP_RP_MIGRATION_STEP 8
+/* Number of keys, which are prefetched ahead in get_batch */
+#define HASHMAP_RP_PREFETCH_DISTANCE 8
+/* Size of a key or value stored inline in an entry (sizeof(uint64_t)) */
 #define ENTRY_SIZE 8
 
+/* Number of tags checked at once during lookup (they make a uint64_t) */
+#define HASHMAP_RP_TAG_GROUP 8
+
 #define TOMBSTONE_MASK (1ULL << 63)
+/* Set in hash of entries, which keep key and value in a separate record */
+#define OUTOFLINE_MASK (1ULL << 62)
+
+/* Marks initialized pmem_type::migrations ("RHMIGRAT") */
+#define MIGRATIONS_MAGIC 0x5441524749484d52ULL
+
+/* Returned by a lock-free lookup, which has to be retried */
+#define LOOKUP_RETRY UINT64_MAX
+
+/* Values of hashmap_tags */
+#define TAG_EMPTY 0x00
+#define TAG_DELETED 0x01
+#define TAG_USED 0x80
 
 /* layout definition */
 struct hashmap_rp;
@@ -50,12 +82,86 @@ TOID_DECLARE(struct hashmap_rp, HASHMAP_RP_TYPE_OFFSET + 0);
 
 TOID_DECLARE(struct entry, HASHMAP_RP_TYPE_OFFSET + 1);
 
+TOID_DECLARE(struct record, HASHMAP_RP_TYPE_OFFSET + 2);
+
+/*
+ * Keys and values of ENTRY_SIZE are stored inline, in key and value fields.
+ * Otherwise, key holds a fingerprint of the key, value holds an offset
+ * of the record with both of them and OUTOFLINE_MASK is set in hash.
+ */
 struct entry {
 	uint64_t key;
 	uint64_t value;
 	uint64_t hash;
 };
 
+/* key_size bytes of the key, followed by value_size bytes of the value */
+struct record {
+	uint64_t key_size;
+	uint64_t value_size;
+};
+
+/*
+ * Volatile metadata of hashmap's entries, a byte per slot: TAG_EMPTY for never
+ * used slots, TAG_DELETED for deleted entries and TAG_USED with 7 bits
+ * of the key's hash otherwise. Lookups compare HASHMAP_RP_TAG_GROUP tags
+ * at once and read only entries with matching tags. Tags of the first slots
+ * (skipping slot 0, which is never used) are repeated after the last one,
+ * so a group can be loaded starting at any slot.
+ */
+struct hashmap_tags {
+	std::unique_ptr<uint8_t[]> tags;
+	uint64_t capacity = 0;
+
+	/*
+	 * tags of the entries being moved, during resize. Once allocated, it's
+	 * kept (with no tags) after the resize, since lock-free readers may
+	 * still access it.
+	 */
+	std::unique_ptr<hashmap_tags> old;
+
+	/* replaced tags are passed to it, if set, instead of being freed */
+	epoch_reclaimer *reclaimer = nullptr;
+};
+
+/*
+ * Version of a shard for lock-free readers: it's odd while the shard is being
+ * modified and incremented again when it's done. Readers retry a lookup
+ * if the version changed in the meantime.
+ */
+struct shard_version {
+	shard_version() : seq(0)
+	{
+	}
+
+	std::atomic<uint64_t> seq;
+	/* avoids false sharing between neighbouring shards */
+	char padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+/* Keeps the version of a shard odd in a scope, taken under the shard's lock */
+class version_guard {
+public:
+	explicit version_guard(shard_version &version) : version(version)
+	{
+		version.seq.store(version.seq.load(std::memory_order_relaxed) + 1,
+				  std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	~version_guard()
+	{
+		version.seq.store(version.seq.load(std::memory_order_relaxed) + 1,
+				  std::memory_order_release);
+	}
+
+	version_guard(const version_guard &) = delete;
+	version_guard &operator=(const version_guard &) = delete;
+
+private:
+	shard_version &version;
+};
+
 struct add_entry {
 	struct entry data;
 
@@ -66,6 +172,9 @@ struct add_entry {
 	struct pobj_action *actv;
 	/* Action array index counter */
 	size_t actv_cnt;
+
+	/* tags updated along with the entries (not used during rebuild) */
+	struct hashmap_tags *tags;
 };
 
 struct hashmap_rp {
@@ -85,17 +194,44 @@ struct hashmap_rp {
 	TOID(struct entry) entries;
 };
 
+/*
+ * Resize of a hashmap, which is done gradually: the hashmap gets new entries
+ * and the old ones are moved to them by subsequent write operations. Entries
+ * at positions from 'moved' up are not moved yet (unless deleted), lookups
+ * check them when a key is not found in the hashmap.
+ */
+struct hashmap_rp_migration {
+	/* entries being moved (null if there's no resize in progress) */
+	TOID(struct entry) entries;
+
+	/* capacity of the entries being moved */
+	uint64_t capacity;
+
+	/* number of slots already moved */
+	uint64_t moved;
+
+	/* number of entries not moved yet, they are not included in hashmap's count */
+	uint64_t count;
+};
+
 using map_type = hashmap_rp;
 
 struct pmem_type {
-	pmem_type() : map()
+	pmem_type() : map(), migrations(), migrations_magic(MIGRATIONS_MAGIC)
 	{
 		std::memset(reserved, 0, sizeof(reserved));
 	}
 
 	obj::persistent_ptr<TOID(struct hashmap_rp)[]> map;
 	obj::p<size_t> shards_number;
-	uint64_t reserved[8];
+	/*
+	 * One per shard, allocated on open if the pool was created without
+	 * them. Since reserved words were not initialized, it's told by
+	 * migrations_magic being equal to MIGRATIONS_MAGIC.
+	 */
+	obj::persistent_ptr<hashmap_rp_migration[]> migrations;
+	uint64_t migrations_magic;
+	uint64_t reserved[5];
 };
 
 } /* namespace robinhood */
@@ -114,29 +250,59 @@ public:
 	status count_all(std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
 
 	status exists(string_view key) final;
 
 	status get(string_view key, get_v_callback *callback, void *arg) final;
 
+	status get_batch(const string_view *keys, std::size_t n, get_kv_callback *callback,
+			 void *arg) final;
+
 	status put(string_view key, string_view value) final;
 
+	uint64_t key_hash(string_view key) final;
+	status exists_hashed(string_view key, uint64_t hash) final;
+	status get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			  void *arg) final;
+	status put_hashed(string_view key, uint64_t hash, string_view value) final;
+
+	status update(string_view key, update_callback *callback, void *arg) final;
+	status fetch_add(string_view key, uint64_t delta, uint64_t &old_value) final;
+
 	status remove(string_view key) final;
 
+	status stats(internal::stats_sink &sink) final;
+
 private:
 	using container_type = internal::robinhood::map_type;
-	using mutex_type = std::shared_timed_mutex;
+	using mutex_type = internal::instrumented_mutex<std::shared_timed_mutex>;
 	using unique_lock_type = std::unique_lock<mutex_type>;
 	using shared_lock_type = std::shared_lock<mutex_type>;
 
 	void Recover();
+	void Reshard(internal::robinhood::pmem_type *pmem_ptr, size_t shards_new);
+
+	size_t shard_hash(uint64_t fp);
 
-	size_t shard_hash(uint64_t key);
+	void prefetch(string_view key);
+
+	int get_shared(string_view key, uint64_t fp, std::string *value);
 
 	TOID(struct internal::robinhood::hashmap_rp) * container;
 
+	internal::robinhood::hashmap_rp_migration *migrations;
+
+	std::vector<internal::robinhood::hashmap_tags> tags;
+
 	std::vector<mutex_type> mtxs;
 
+	std::vector<internal::robinhood::shard_version> versions;
+
+	/* frees tags replaced while lock-free readers may use them */
+	internal::epoch_reclaimer reclaimer;
+
 	size_t shards_number;
 };
 
@@ -0,0 +1,521 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "sharded.h"
+#include "../fast_hash.h"
+#include "../out.h"
+#include "../parallel_scan.h"
+
+#include <algorithm>
+
+namespace pmem
+{
+namespace kv
+{
+
+sharded::sharded(std::unique_ptr<internal::config> cfg) : config(std::move(cfg))
+{
+	const char *engine_name;
+	if (!config->get_string("engine", &engine_name))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"engine\"");
+
+	uint64_t shards_number;
+	if (!config->get_uint64("shards", &shards_number))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"shards\"");
+	if (shards_number == 0)
+		throw internal::invalid_argument(
+			"Config item \"shards\" must be greater than 0");
+
+	uint64_t lock_shards = 1;
+	config->get_uint64("lock_shards", &lock_shards);
+
+	shards.reserve(shards_number);
+	for (uint64_t i = 0; i < shards_number; ++i) {
+		auto key = "shard_" + std::to_string(i);
+
+		void *sub_config;
+		if (!config->get_object(key.c_str(), &sub_config))
+			throw internal::invalid_argument(
+				"Config does not contain item with key: \"" + key + "\"");
+
+		shards.emplace_back(storage_engine_factory::create_engine(
+			engine_name,
+			static_cast<internal::config *>(sub_config)->shared_copy()));
+	}
+
+	if (lock_shards)
+		locks.reset(new std::mutex[shards_number]);
+
+	LOG("Started ok");
+}
+
+sharded::~sharded()
+{
+	/* shards use objects from their sub-configs, close them first */
+	shards.clear();
+	LOG("Stopped ok");
+}
+
+std::string sharded::name()
+{
+	return "sharded";
+}
+
+/*
+ * Shard of the key - fast_hash is stable across runs, so keys are found in
+ * the same shards after reopening (if the number and order of shards is kept).
+ */
+std::size_t sharded::shard_of(string_view key) const
+{
+	return fast_hash(key.size(), key.data()) % shards.size();
+}
+
+sharded::lock_type sharded::lock(std::size_t shard)
+{
+	return locks ? lock_type(locks[shard]) : lock_type();
+}
+
+template <typename F>
+status sharded::for_each_shard(F f)
+{
+	for (std::size_t i = 0; i < shards.size(); ++i) {
+		auto lk = lock(i);
+		auto s = f(*shards[i]);
+		if (s != status::OK)
+			return s;
+	}
+
+	return status::OK;
+}
+
+status sharded::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	std::size_t sum = 0;
+	auto s = for_each_shard([&](engine_base &shard) {
+		std::size_t c = 0;
+		auto ret = shard.count_all(c);
+		sum += c;
+		return ret;
+	});
+	cnt = sum;
+
+	return s;
+}
+
+status sharded::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	std::size_t sum = 0;
+	auto s = for_each_shard([&](engine_base &shard) {
+		std::size_t c = 0;
+		auto ret = shard.count_above(key, c);
+		sum += c;
+		return ret;
+	});
+	cnt = sum;
+
+	return s;
+}
+
+status sharded::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	std::size_t sum = 0;
+	auto s = for_each_shard([&](engine_base &shard) {
+		std::size_t c = 0;
+		auto ret = shard.count_equal_above(key, c);
+		sum += c;
+		return ret;
+	});
+	cnt = sum;
+
+	return s;
+}
+
+status sharded::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	std::size_t sum = 0;
+	auto s = for_each_shard([&](engine_base &shard) {
+		std::size_t c = 0;
+		auto ret = shard.count_equal_below(key, c);
+		sum += c;
+		return ret;
+	});
+	cnt = sum;
+
+	return s;
+}
+
+status sharded::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	std::size_t sum = 0;
+	auto s = for_each_shard([&](engine_base &shard) {
+		std::size_t c = 0;
+		auto ret = shard.count_below(key, c);
+		sum += c;
+		return ret;
+	});
+	cnt = sum;
+
+	return s;
+}
+
+status sharded::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between for key1=" << key1.data() << ", key2=" << key2.data());
+	std::size_t sum = 0;
+	auto s = for_each_shard([&](engine_base &shard) {
+		std::size_t c = 0;
+		auto ret = shard.count_between(key1, key2, c);
+		sum += c;
+		return ret;
+	});
+	cnt = sum;
+
+	return s;
+}
+
+status sharded::count_between_approx(string_view key1, string_view key2,
+				     std::size_t &cnt)
+{
+	LOG("count_between_approx for key1=" << key1.data() << ", key2=" << key2.data());
+	std::size_t sum = 0;
+	auto s = for_each_shard([&](engine_base &shard) {
+		std::size_t c = 0;
+		auto ret = shard.count_between_approx(key1, key2, c);
+		sum += c;
+		return ret;
+	});
+	cnt = sum;
+
+	return s;
+}
+
+/* shards are visited one by one, so keys are not ordered across shards */
+status sharded::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	return for_each_shard(
+		[&](engine_base &shard) { return shard.get_all(callback, arg); });
+}
+
+status sharded::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_keys_all");
+	return for_each_shard(
+		[&](engine_base &shard) { return shard.get_keys_all(callback, arg); });
+}
+
+status sharded::prefetch(string_view key)
+{
+	LOG("prefetch key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->prefetch(key);
+}
+
+/* keys of the range are spread over all shards */
+status sharded::prefetch_range(string_view key1, string_view key2)
+{
+	LOG("prefetch_range for key1=" << key1.data() << ", key2=" << key2.data());
+	return for_each_shard(
+		[&](engine_base &shard) { return shard.prefetch_range(key1, key2); });
+}
+
+/*
+ * Partitions are groups of whole shards - partition p scans shards p, p + P,
+ * p + 2P, ... (where P is the number of partitions, at most one per shard).
+ */
+status sharded::get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				 void **args)
+{
+	LOG("get_all_parallel");
+	auto p_number = std::max<std::size_t>(1, std::min(partitions, shards.size()));
+
+	return internal::parallel_scan(
+		p_number, callback, args,
+		[&](std::size_t partition, get_kv_callback *cb, void *arg) {
+			for (auto i = partition; i < shards.size(); i += p_number) {
+				auto lk = lock(i);
+				auto s = shards[i]->get_all(cb, arg);
+				if (s != status::OK)
+					return s;
+			}
+
+			return status::OK;
+		});
+}
+
+status sharded::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->exists(key);
+}
+
+status sharded::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->get(key, callback, arg);
+}
+
+status sharded::value_size(string_view key, std::size_t &size)
+{
+	LOG("value_size key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->value_size(key, size);
+}
+
+struct get_batch_context {
+	/* indexes (in the whole batch) of keys of the shard */
+	const std::vector<std::size_t> &indexes;
+	const string_view *keys;
+	std::size_t next;
+
+	std::vector<std::string> &values;
+	std::vector<bool> &found;
+};
+
+/*
+ * Inner get_batch() calls the callback in order of keys, only for the present
+ * ones - keys skipped since the previous call were not found.
+ */
+static int get_batch_gather(const char *k, size_t kb, const char *v, size_t vb,
+			    void *arg)
+{
+	auto c = static_cast<get_batch_context *>(arg);
+	while (c->keys[c->indexes[c->next]].compare(string_view(k, kb)) != 0)
+		++c->next;
+
+	auto i = c->indexes[c->next++];
+	c->values[i].assign(v, vb);
+	c->found[i] = true;
+
+	return 0;
+}
+
+/*
+ * Keys are grouped by shards and every group is passed to get_batch() of its
+ * shard (so inner engines can overlap lookups). Values are copied, so that
+ * the callback can be called in order of the keys, after all lookups.
+ */
+status sharded::get_batch(const string_view *keys, std::size_t n,
+			  get_kv_callback *callback, void *arg)
+{
+	LOG("get_batch n=" << n);
+	std::vector<std::vector<std::size_t>> indexes(shards.size());
+	for (std::size_t i = 0; i < n; ++i)
+		indexes[shard_of(keys[i])].push_back(i);
+
+	std::vector<std::string> values(n);
+	std::vector<bool> found(n, false);
+	for (std::size_t i = 0; i < shards.size(); ++i) {
+		if (indexes[i].empty())
+			continue;
+
+		std::vector<string_view> group;
+		group.reserve(indexes[i].size());
+		for (auto idx : indexes[i])
+			group.push_back(keys[idx]);
+
+		get_batch_context ctx{indexes[i], keys, 0, values, found};
+
+		auto lk = lock(i);
+		auto s = shards[i]->get_batch(group.data(), group.size(),
+					      get_batch_gather, &ctx);
+		if (s != status::OK && s != status::NOT_FOUND)
+			return s;
+	}
+
+	auto s = status::OK;
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!found[i]) {
+			s = status::NOT_FOUND;
+			continue;
+		}
+
+		auto ret = callback(keys[i].data(), keys[i].size(), values[i].data(),
+				    values[i].size(), arg);
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return s;
+}
+
+status sharded::get_pinned(string_view key,
+			   std::unique_ptr<internal::pinned_value_base> &pinned)
+{
+	LOG("get_pinned key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->get_pinned(key, pinned);
+}
+
+status sharded::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->put(key, value);
+}
+
+/*
+ * Pairs are grouped by shards and every group is passed to put_batch() of its
+ * shard, so the batch is atomic only within a shard (if put_batch() of the
+ * inner engine is atomic).
+ */
+status sharded::put_batch(const string_view *keys, const string_view *values,
+			  std::size_t n)
+{
+	LOG("put_batch n=" << n);
+	std::vector<std::vector<string_view>> group_keys(shards.size());
+	std::vector<std::vector<string_view>> group_values(shards.size());
+	for (std::size_t i = 0; i < n; ++i) {
+		auto shard = shard_of(keys[i]);
+		group_keys[shard].push_back(keys[i]);
+		group_values[shard].push_back(values[i]);
+	}
+
+	for (std::size_t i = 0; i < shards.size(); ++i) {
+		if (group_keys[i].empty())
+			continue;
+
+		auto lk = lock(i);
+		auto &k = group_keys[i];
+		auto s = shards[i]->put_batch(k.data(), group_values[i].data(), k.size());
+		if (s != status::OK)
+			return s;
+	}
+
+	return status::OK;
+}
+
+status sharded::update(string_view key, update_callback *callback, void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->update(key, callback, arg);
+}
+
+status sharded::read_value(string_view key, std::size_t pos, std::size_t n,
+			   get_v_callback *callback, void *arg)
+{
+	LOG("read_value key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->read_value(key, pos, n, callback, arg);
+}
+
+status sharded::write_value(string_view key, std::size_t pos, string_view data)
+{
+	LOG("write_value key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->write_value(key, pos, data);
+}
+
+status sharded::append_value(string_view key, string_view data)
+{
+	LOG("append_value key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->append_value(key, data);
+}
+
+status sharded::compare_exchange(string_view key, string_view expected,
+				 string_view desired)
+{
+	LOG("compare_exchange key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->compare_exchange(key, expected, desired);
+}
+
+status sharded::fetch_add(string_view key, uint64_t delta, uint64_t &old_value)
+{
+	LOG("fetch_add key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->fetch_add(key, delta, old_value);
+}
+
+status sharded::put_if_absent(string_view key, string_view value, bool &inserted)
+{
+	LOG("put_if_absent key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->put_if_absent(key, value, inserted);
+}
+
+status sharded::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->remove(key);
+}
+
+status sharded::take(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("take key=" << std::string(key.data(), key.size()));
+	auto i = shard_of(key);
+	auto lk = lock(i);
+
+	return shards[i]->take(key, callback, arg);
+}
+
+status sharded::remove_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("remove_between for key1=" << key1.data() << ", key2=" << key2.data());
+	std::size_t sum = 0;
+	auto s = for_each_shard([&](engine_base &shard) {
+		std::size_t c = 0;
+		auto ret = shard.remove_between(key1, key2, c);
+		sum += c;
+		return ret;
+	});
+	cnt = sum;
+
+	return s;
+}
+
+status sharded::defrag(double start_percent, double amount_percent)
+{
+	LOG("defrag: start_percent = " << start_percent
+				       << " amount_percent = " << amount_percent);
+	return for_each_shard([&](engine_base &shard) {
+		return shard.defrag(start_percent, amount_percent);
+	});
+}
+
+static factory_registerer
+	register_sharded(std::unique_ptr<engine_base::factory_base>(new sharded_factory));
+
+} /* namespace kv */
+} /* namespace pmem */
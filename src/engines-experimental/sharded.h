@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_SHARDED_H
+#define LIBPMEMKV_SHARDED_H
+
+#include "../engine.h"
+
+#include <mutex>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+
+/**
+ * Meta-engine which hash-partitions keys over a number of underlying engines
+ * (shards), each one opened on its own pool with its own config. Point
+ * operations go to the shard of the key, counts and scans are gathered from
+ * all shards.
+ */
+class sharded : public engine_base {
+public:
+	sharded(std::unique_ptr<internal::config> cfg);
+	~sharded();
+
+	sharded(const sharded &) = delete;
+	sharded &operator=(const sharded &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_between_approx(string_view key1, string_view key2,
+				    std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status value_size(string_view key, std::size_t &size) final;
+	status get_batch(const string_view *keys, std::size_t n,
+			 get_kv_callback *callback, void *arg) final;
+	status get_pinned(string_view key,
+			  std::unique_ptr<internal::pinned_value_base> &pinned) final;
+
+	status put(string_view key, string_view value) final;
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+
+	status read_value(string_view key, std::size_t pos, std::size_t n,
+			  get_v_callback *callback, void *arg) final;
+	status write_value(string_view key, std::size_t pos, string_view data) final;
+	status append_value(string_view key, string_view data) final;
+	status compare_exchange(string_view key, string_view expected,
+				string_view desired) final;
+	status fetch_add(string_view key, uint64_t delta, uint64_t &old_value) final;
+	status put_if_absent(string_view key, string_view value, bool &inserted) final;
+
+	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+
+private:
+	using lock_type = std::unique_lock<std::mutex>;
+
+	std::size_t shard_of(string_view key) const;
+	lock_type lock(std::size_t shard);
+
+	/* runs f(shard) for every shard, stops at the first non-OK status */
+	template <typename F>
+	status for_each_shard(F f);
+
+	/* sub-configs of shards are owned (and shared) by this config */
+	std::unique_ptr<internal::config> config;
+
+	std::vector<std::unique_ptr<engine_base>> shards;
+
+	/* null if inner engines are thread-safe on their own ("lock_shards": 0) */
+	std::unique_ptr<std::mutex[]> locks;
+};
+
+class sharded_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new sharded(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "sharded";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_SHARDED_H */
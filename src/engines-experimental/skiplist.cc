@@ -0,0 +1,1136 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "skiplist.h"
+#include "../exceptions.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <new>
+#include <random>
+#include <thread>
+#include <unordered_set>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace skiplist
+{
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+	      "links are accessed as atomics");
+
+epoch_manager::epoch_manager(std::function<void(const retired &)> free)
+    : free(free),
+      n_slots(std::max<std::size_t>(16, 4 * std::thread::hardware_concurrency())),
+      slots(new slot[n_slots])
+{
+}
+
+/* no operation is running, all retired objects can be freed */
+epoch_manager::~epoch_manager()
+{
+	for (std::size_t i = 0; i < n_slots; ++i) {
+		for (auto &r : slots[i].objects)
+			free(r);
+	}
+}
+
+std::size_t epoch_manager::enter()
+{
+	auto i = std::hash<std::thread::id>()(std::this_thread::get_id()) % n_slots;
+	for (std::size_t tries = 1;; ++tries, i = (i + 1) % n_slots) {
+		bool claimed = false;
+		if (!slots[i].claimed.load(std::memory_order_relaxed) &&
+		    slots[i].claimed.compare_exchange_strong(claimed, true,
+							     std::memory_order_acquire))
+			break;
+
+		if (tries % n_slots == 0)
+			std::this_thread::yield();
+	}
+
+	slots[i].epoch.store(global.load());
+
+	return i;
+}
+
+void epoch_manager::exit(std::size_t i)
+{
+	auto &s = slots[i];
+	s.epoch.store(0);
+	if (s.objects.size() >= RECLAIM_BATCH)
+		reclaim(s);
+
+	s.claimed.store(false, std::memory_order_release);
+}
+
+/* objects are unlinked before they are retired */
+void epoch_manager::retire(std::size_t i, retired r)
+{
+	r.epoch = global.load();
+	slots[i].objects.push_back(r);
+	n_pending++;
+}
+
+std::size_t epoch_manager::pending() const
+{
+	return n_pending.load();
+}
+
+/*
+ * An operation which announced an epoch later than the one of a retired
+ * object, started after the object was unlinked, so it can't reach it.
+ */
+void epoch_manager::reclaim(slot &s)
+{
+	auto e = global.load();
+	auto oldest = std::numeric_limits<uint64_t>::max();
+	bool current = true;
+	for (std::size_t i = 0; i < n_slots; ++i) {
+		auto announced = slots[i].epoch.load();
+		if (announced == 0)
+			continue;
+		oldest = std::min(oldest, announced);
+		current = current && announced == e;
+	}
+
+	if (current)
+		global.compare_exchange_strong(e, e + 1);
+
+	auto kept = std::partition(s.objects.begin(), s.objects.end(),
+				   [&](const retired &r) { return r.epoch >= oldest; });
+	for (auto it = kept; it != s.objects.end(); ++it)
+		free(*it);
+	n_pending -= static_cast<std::size_t>(s.objects.end() - kept);
+	s.objects.erase(kept, s.objects.end());
+}
+
+struct node_args {
+	string_view key;
+	uint64_t next;
+	uint64_t value;
+	uint64_t tower;
+};
+
+static int construct_node(PMEMobjpool *pop, void *ptr, void *arg)
+{
+	auto args = static_cast<node_args *>(arg);
+	auto n = static_cast<node *>(ptr);
+
+	n->next = args->next;
+	n->value = args->value;
+	n->tower = args->tower;
+	n->key_size = args->key.size();
+	std::memcpy(n + 1, args->key.data(), args->key.size());
+	pmemobj_persist(pop, n, sizeof(node) + args->key.size());
+
+	return 0;
+}
+
+static int construct_value(PMEMobjpool *pop, void *ptr, void *arg)
+{
+	auto data = static_cast<string_view *>(arg);
+	auto v = static_cast<value *>(ptr);
+
+	v->size = data->size();
+	std::memcpy(v + 1, data->data(), data->size());
+	pmemobj_persist(pop, v, sizeof(value) + data->size());
+
+	return 0;
+}
+
+static std::atomic<uint64_t> &atomic_field(uint64_t &field)
+{
+	return *reinterpret_cast<std::atomic<uint64_t> *>(&field);
+}
+
+static tower *to_tower(uintptr_t link)
+{
+	return reinterpret_cast<tower *>(link & ~static_cast<uintptr_t>(MARK));
+}
+
+/* Returns the height of a new tower (0 - none), with 1/4 of nodes per level */
+static std::size_t random_height()
+{
+	static thread_local std::mt19937_64 rng(
+		std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+	auto r = rng();
+	std::size_t height = 0;
+	while (height < MAX_HEIGHT && (r & 3) == 0) {
+		++height;
+		r >>= 2;
+	}
+
+	return height;
+}
+
+} /* namespace skiplist */
+} /* namespace internal */
+
+using namespace internal::skiplist;
+
+skiplist::skiplist(std::unique_ptr<internal::config> cfg)
+    : pmemobj_engine_base(cfg, "pmemkv_skiplist"),
+      head(0, string_view(), MAX_HEIGHT),
+      count(0),
+      towers(0),
+      epochs([this](const retired &r) { FreeRetired(r); })
+{
+	internal::open_phase phase("skiplist.recover");
+	Recover();
+	phase.end();
+
+	LOG("Started ok");
+}
+
+/* retired towers are freed by the epoch manager, linked ones here */
+skiplist::~skiplist()
+{
+	auto t = to_tower(head.next[0].load());
+	while (t != nullptr) {
+		auto next = to_tower(t->next[0].load());
+		delete t;
+		t = next;
+	}
+
+	LOG("Stopped ok");
+}
+
+std::string skiplist::name()
+{
+	return "skiplist";
+}
+
+status skiplist::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	check_outside_tx();
+	cnt = count.load();
+
+	return status::OK;
+}
+
+status skiplist::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return CountRange(&low, false, nullptr, false, cnt);
+}
+
+status skiplist::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return CountRange(&low, true, nullptr, false, cnt);
+}
+
+status skiplist::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return CountRange(nullptr, false, &high, true, cnt);
+}
+
+status skiplist::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return CountRange(nullptr, false, &high, false, cnt);
+}
+
+status skiplist::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between for key1=" << std::string(key1.data(), key1.size())
+				      << ", key2="
+				      << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	std::string low(key1.data(), key1.size());
+	std::string high(key2.data(), key2.size());
+	return CountRange(&low, false, &high, false, cnt);
+}
+
+status skiplist::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	check_outside_tx();
+	return GetRange(nullptr, false, nullptr, false, callback, arg);
+}
+
+status skiplist::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return GetRange(&low, false, nullptr, false, callback, arg);
+}
+
+status skiplist::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return GetRange(&low, true, nullptr, false, callback, arg);
+}
+
+status skiplist::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return GetRange(nullptr, false, &high, true, callback, arg);
+}
+
+status skiplist::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return GetRange(nullptr, false, &high, false, callback, arg);
+}
+
+status skiplist::get_between(string_view key1, string_view key2,
+			     get_kv_callback *callback, void *arg)
+{
+	LOG("get_between for key1=" << std::string(key1.data(), key1.size())
+				    << ", key2="
+				    << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	std::string low(key1.data(), key1.size());
+	std::string high(key2.data(), key2.size());
+	return GetRange(&low, false, &high, false, callback, arg);
+}
+
+status skiplist::GetRange(const std::string *low, bool low_eq, const std::string *high,
+			  bool high_eq, get_kv_callback *callback, void *arg)
+{
+	epoch_guard guard(epochs);
+
+	string_view low_key, high_key;
+	if (low)
+		low_key = *low;
+	if (high)
+		high_key = *high;
+
+	auto ret = Scan(low ? &low_key : nullptr, low_eq, high ? &high_key : nullptr,
+			high_eq, [&](uint64_t n) {
+				auto key = KeyOf(n);
+				auto value = ValueOf(n);
+				return callback(key.data(), key.size(), value.data(),
+						value.size(), arg);
+			});
+
+	return ret != 0 ? status::STOPPED_BY_CB : status::OK;
+}
+
+status skiplist::CountRange(const std::string *low, bool low_eq, const std::string *high,
+			    bool high_eq, std::size_t &cnt)
+{
+	epoch_guard guard(epochs);
+
+	string_view low_key, high_key;
+	if (low)
+		low_key = *low;
+	if (high)
+		high_key = *high;
+
+	std::size_t result = 0;
+	Scan(low ? &low_key : nullptr, low_eq, high ? &high_key : nullptr, high_eq,
+	     [&](uint64_t) {
+		     ++result;
+		     return 0;
+	     });
+	cnt = result;
+
+	return status::OK;
+}
+
+status skiplist::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	epoch_guard guard(epochs);
+
+	auto n = Higher(&key, true);
+	bool found = n != 0 && KeyOf(n).compare(key) == 0;
+
+	return found ? status::OK : status::NOT_FOUND;
+}
+
+status skiplist::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	epoch_guard guard(epochs);
+
+	auto n = Higher(&key, true);
+	if (n == 0 || KeyOf(n).compare(key) != 0) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	auto value = ValueOf(n);
+	callback(value.data(), value.size(), arg);
+
+	return status::OK;
+}
+
+/*
+ * The node (and its tower) is allocated once, before the first attempt to
+ * link it, and freed if the key turns out to exist.
+ */
+status skiplist::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+	epoch_guard guard(epochs);
+
+	auto v = AllocValue(value);
+	uint64_t n = 0;
+	std::unique_ptr<tower> t;
+
+	while (true) {
+		std::atomic<uint64_t> *pred;
+		auto curr = Search(key, pred);
+
+		if (curr != 0 && KeyOf(curr).compare(key) == 0) {
+			auto &field = Value(curr);
+			auto old = field.exchange(v);
+			pmpool.persist(&field, sizeof(uint64_t));
+			guard.retire(old, false);
+
+			if (n != 0)
+				Free(n);
+
+			return status::OK;
+		}
+
+		if (n == 0) {
+			auto height = random_height();
+			if (height > 0)
+				t.reset(new tower(0, string_view(), height));
+			n = AllocNode(key, curr, v, t.get());
+			if (t) {
+				t->node = n;
+				t->key = KeyOf(n);
+			}
+		} else {
+			Node(n)->next = curr;
+			pmpool.persist(&Node(n)->next, sizeof(uint64_t));
+		}
+
+		if (pred->compare_exchange_strong(curr, n)) {
+			pmpool.persist(pred, sizeof(uint64_t));
+			break;
+		}
+	}
+
+	count++;
+
+	if (t) {
+		towers++;
+		auto linked = t.release();
+		LinkTower(linked);
+		Release(guard, linked);
+	}
+
+	return status::OK;
+}
+
+/*
+ * Marking the node's link removes it, the node is then unlinked (by this or
+ * any other search which passes it) and freed when no operation can read it.
+ */
+status skiplist::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	epoch_guard guard(epochs);
+
+	while (true) {
+		std::atomic<uint64_t> *pred;
+		auto curr = Search(key, pred);
+		if (curr == 0 || KeyOf(curr).compare(key) != 0)
+			return status::NOT_FOUND;
+
+		auto &next = Next(curr);
+		auto succ = next.load();
+		if ((succ & MARK) || !next.compare_exchange_strong(succ, succ | MARK))
+			continue;
+
+		pmpool.persist(&next, sizeof(uint64_t));
+		count--;
+
+		Search(key, pred);
+
+		auto t = reinterpret_cast<tower *>(Node(curr)->tower);
+		if (t) {
+			tower *preds[MAX_HEIGHT], *succs[MAX_HEIGHT];
+			FindTowers(key, preds, succs);
+			Release(guard, t);
+		} else {
+			guard.retire(curr, true);
+		}
+
+		return status::OK;
+	}
+}
+
+internal::iterator_base *skiplist::new_iterator()
+{
+	return new skiplist_iterator{this};
+}
+
+internal::iterator_base *skiplist::new_const_iterator()
+{
+	return new skiplist_const_iterator{this};
+}
+
+status skiplist::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	auto cnt = count.load();
+	sink.add("count", cnt);
+	sink.add("skiplist.towers", towers.load());
+	sink.add("skiplist.pending_frees", epochs.pending());
+
+	report_memory(sink, cnt);
+
+	return status::OK;
+}
+
+internal::memory_stats skiplist::memory_types()
+{
+	internal::memory_stats mem;
+	mem.add_type(pmem::detail::type_num<node>(), "nodes");
+	mem.add_type(pmem::detail::type_num<value>(), "values");
+
+	return mem;
+}
+
+std::atomic<uint64_t> &skiplist::Next(uint64_t offset) const
+{
+	return atomic_field(offset == 0 ? pmem_root->head : Node(offset)->next);
+}
+
+std::atomic<uint64_t> &skiplist::Value(uint64_t offset) const
+{
+	return atomic_field(Node(offset)->value);
+}
+
+string_view skiplist::KeyOf(uint64_t offset) const
+{
+	auto n = Node(offset);
+
+	return string_view(reinterpret_cast<const char *>(n + 1), n->key_size);
+}
+
+string_view skiplist::ValueOf(uint64_t offset) const
+{
+	auto v = reinterpret_cast<const value *>(
+		base + Value(offset).load(std::memory_order_acquire));
+
+	return string_view(reinterpret_cast<const char *>(v + 1), v->size);
+}
+
+bool skiplist::Removed(const tower *t) const
+{
+	return (Next(t->node).load() & MARK) != 0;
+}
+
+/* towers of removed nodes are skipped, but not unlinked */
+skiplist::tower *skiplist::Descend(const string_view *key) const
+{
+	auto pred = const_cast<tower *>(&head);
+	for (auto l = MAX_HEIGHT; l > 0; --l) {
+		auto curr = to_tower(pred->next[l - 1].load());
+		while (curr != nullptr) {
+			bool removed = Removed(curr);
+			if (!removed) {
+				if (key && curr->key.compare(*key) >= 0)
+					break;
+				pred = curr;
+			}
+			curr = to_tower(curr->next[l - 1].load());
+		}
+	}
+
+	return pred;
+}
+
+/*
+ * A tower is removed by marking its links, from the top, and then unlinked
+ * on every level. Towers of removed nodes (even if not marked yet) are
+ * removed before they're compared, so on return no tower of a removed
+ * node, with a key not greater than key, is linked.
+ */
+void skiplist::FindTowers(string_view key, tower **preds, tower **succs)
+{
+	bool restart;
+	do {
+		restart = false;
+		tower *pred = &head;
+		for (auto l = MAX_HEIGHT; l > 0 && !restart; --l) {
+			auto curr = to_tower(pred->next[l - 1].load());
+			while (curr != nullptr) {
+				auto succ = curr->next[l - 1].load();
+				if (!(succ & MARK) && Removed(curr)) {
+					MarkTower(curr);
+					succ = curr->next[l - 1].load();
+				}
+
+				if (succ & MARK) {
+					auto expected = reinterpret_cast<uintptr_t>(curr);
+					if (!pred->next[l - 1].compare_exchange_strong(
+						    expected, succ & ~MARK)) {
+						restart = true;
+						break;
+					}
+					curr = to_tower(succ);
+					continue;
+				}
+
+				if (curr->key.compare(key) >= 0)
+					break;
+
+				pred = curr;
+				curr = to_tower(succ);
+			}
+
+			preds[l - 1] = pred;
+			succs[l - 1] = curr;
+		}
+	} while (restart);
+}
+
+/* levels which are not linked yet are marked as well, so they never will be */
+void skiplist::MarkTower(tower *t)
+{
+	for (auto l = t->height; l > 0; --l) {
+		auto next = t->next[l - 1].load();
+		while (!(next & MARK) &&
+		       !t->next[l - 1].compare_exchange_weak(next, next | MARK))
+			;
+	}
+}
+
+/*
+ * Links the tower bottom-up. If the node is removed meanwhile, the tower is
+ * unlinked by the next search which passes it - or here, if it was linked
+ * after the remover's search.
+ */
+void skiplist::LinkTower(tower *t)
+{
+	tower *preds[MAX_HEIGHT], *succs[MAX_HEIGHT];
+	FindTowers(t->key, preds, succs);
+
+	bool removed = false;
+	for (std::size_t l = 0; l < t->height && !removed; ++l) {
+		while (true) {
+			auto next = t->next[l].load();
+			auto succ = reinterpret_cast<uintptr_t>(succs[l]);
+			if (next & MARK) {
+				removed = true;
+				break;
+			}
+			if (next != succ && !t->next[l].compare_exchange_strong(next, succ))
+				continue;
+
+			if (preds[l]->next[l].compare_exchange_strong(
+				    succ, reinterpret_cast<uintptr_t>(t)))
+				break;
+
+			FindTowers(t->key, preds, succs);
+		}
+	}
+
+	if (removed || Removed(t))
+		FindTowers(t->key, preds, succs);
+}
+
+/* the last of the inserter and the remover of the node retires it */
+void skiplist::Release(epoch_guard &guard, tower *t)
+{
+	if (t->refs.fetch_sub(1) == 1) {
+		towers--;
+		guard.retire(t->node, true, t);
+	}
+}
+
+uint64_t skiplist::Search(string_view key, std::atomic<uint64_t> *&pred)
+{
+	while (true) {
+		pred = &Next(Descend(&key)->node);
+		auto curr = pred->load();
+		if (curr & MARK)
+			continue;
+
+		bool restart = false;
+		while (curr != 0) {
+			auto &next = Next(curr);
+			auto succ = next.load();
+			if (succ & MARK) {
+				/* the node is retired by its remover */
+				if (!pred->compare_exchange_strong(curr, succ & ~MARK)) {
+					restart = true;
+					break;
+				}
+				pmpool.persist(pred, sizeof(uint64_t));
+				curr = succ & ~MARK;
+				continue;
+			}
+
+			if (KeyOf(curr).compare(key) >= 0)
+				break;
+
+			pred = &next;
+			curr = succ;
+		}
+
+		if (!restart)
+			return curr;
+	}
+}
+
+uint64_t skiplist::Higher(const string_view *key, bool eq) const
+{
+	while (true) {
+		auto start = key ? Descend(key)->node : 0;
+		auto curr = Next(start).load();
+		/* the start node was removed, its tower will be skipped now */
+		if (curr & MARK)
+			continue;
+
+		while (curr != 0) {
+			auto succ = Next(curr).load();
+			if (!(succ & MARK)) {
+				auto c = key ? KeyOf(curr).compare(*key) : 1;
+				if (c > 0 || (eq && c == 0))
+					return curr;
+			}
+			curr = succ & ~MARK;
+		}
+
+		return 0;
+	}
+}
+
+uint64_t skiplist::Lower(const string_view *key, bool eq) const
+{
+	while (true) {
+		auto start = Descend(key)->node;
+		auto curr = Next(start).load();
+		if (curr & MARK)
+			continue;
+
+		uint64_t found = start;
+		while (curr != 0) {
+			auto succ = Next(curr).load();
+			if (!(succ & MARK)) {
+				auto c = key ? KeyOf(curr).compare(*key) : -1;
+				if (c > 0 || (!eq && c == 0))
+					break;
+				found = curr;
+			}
+			curr = succ & ~MARK;
+		}
+
+		return found;
+	}
+}
+
+uint64_t skiplist::NextLive(uint64_t offset) const
+{
+	auto curr = Next(offset).load() & ~MARK;
+	while (curr != 0) {
+		auto succ = Next(curr).load();
+		if (!(succ & MARK))
+			break;
+		curr = succ & ~MARK;
+	}
+
+	return curr;
+}
+
+int skiplist::Scan(const string_view *low, bool low_eq, const string_view *high,
+		   bool high_eq, const scan_function &f) const
+{
+	for (auto n = Higher(low, low_eq); n != 0; n = NextLive(n)) {
+		if (high) {
+			auto c = KeyOf(n).compare(*high);
+			if (c > 0 || (!high_eq && c == 0))
+				break;
+		}
+
+		auto ret = f(n);
+		if (ret != 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+uint64_t skiplist::AllocNode(string_view key, uint64_t next, uint64_t value, tower *t)
+{
+	PMEMoid oid;
+	node_args args{key, next, value, reinterpret_cast<uint64_t>(t)};
+	if (pmemobj_alloc(pmpool.handle(), &oid, sizeof(node) + key.size(),
+			  pmem::detail::type_num<node>(), construct_node, &args) != 0)
+		throw std::bad_alloc();
+
+	return oid.off;
+}
+
+uint64_t skiplist::AllocValue(string_view data)
+{
+	PMEMoid oid;
+	if (pmemobj_alloc(pmpool.handle(), &oid, sizeof(value) + data.size(),
+			  pmem::detail::type_num<value>(), construct_value, &data) != 0)
+		throw std::bad_alloc();
+
+	return oid.off;
+}
+
+void skiplist::Free(uint64_t offset)
+{
+	PMEMoid oid = pmemobj_oid(base + offset);
+	pmemobj_free(&oid);
+}
+
+void skiplist::FreeRetired(const retired &r)
+{
+	if (r.is_node)
+		Free(Node(r.offset)->value);
+	Free(r.offset);
+	delete r.t;
+}
+
+/*
+ * Removed nodes are unlinked and objects which are not reachable (allocated
+ * or unlinked before a crash) are freed. Towers are then built in order of
+ * keys, appended to every level.
+ */
+void skiplist::Recover()
+{
+	if (OID_IS_NULL(*root_oid)) {
+		pmem::obj::transaction::run(pmpool, [&] {
+			pmem::obj::transaction::snapshot(root_oid);
+			*root_oid = pmem::obj::make_persistent<pmem_type>().raw();
+		});
+	}
+
+	pmem_root = static_cast<pmem_type *>(pmemobj_direct(*root_oid));
+	base = reinterpret_cast<char *>(pmpool.handle());
+
+	std::vector<uint64_t> nodes;
+	std::unordered_set<uint64_t> reachable;
+	auto pred = &pmem_root->head;
+	while (*pred != 0) {
+		auto n = Node(*pred);
+		if (n->next & MARK) {
+			*pred = n->next & ~MARK;
+			pmpool.persist(pred, sizeof(uint64_t));
+			continue;
+		}
+
+		nodes.push_back(*pred);
+		reachable.insert(*pred);
+		reachable.insert(n->value);
+		pred = &n->next;
+	}
+
+	auto node_type = pmem::detail::type_num<node>();
+	auto value_type = pmem::detail::type_num<value>();
+	auto oid = pmemobj_first(pmpool.handle());
+	while (!OID_IS_NULL(oid)) {
+		auto next = pmemobj_next(oid);
+		auto type = pmemobj_type_num(oid);
+		if ((type == node_type || type == value_type) && !reachable.count(oid.off))
+			pmemobj_free(&oid);
+		oid = next;
+	}
+
+	tower *last[MAX_HEIGHT];
+	std::fill(last, last + MAX_HEIGHT, &head);
+	for (auto offset : nodes) {
+		tower *t = nullptr;
+		auto height = random_height();
+		if (height > 0) {
+			t = new tower(offset, KeyOf(offset), height);
+			t->refs.store(1);
+			for (std::size_t l = 0; l < height; ++l) {
+				last[l]->next[l].store(reinterpret_cast<uintptr_t>(t));
+				last[l] = t;
+			}
+			towers++;
+		}
+
+		auto n = Node(offset);
+		if (n->tower != reinterpret_cast<uint64_t>(t)) {
+			n->tower = reinterpret_cast<uint64_t>(t);
+			pmpool.persist(&n->tower, sizeof(uint64_t));
+		}
+	}
+
+	count.store(nodes.size());
+}
+
+// ===============================================================================================
+// ITERATOR METHODS
+// ===============================================================================================
+
+skiplist::skiplist_const_iterator::skiplist_const_iterator(skiplist *engine)
+    : engine(engine)
+{
+}
+
+skiplist::skiplist_iterator::skiplist_iterator(skiplist *engine)
+    : skiplist::skiplist_const_iterator(engine)
+{
+}
+
+status skiplist::skiplist_const_iterator::set(uint64_t node)
+{
+	valid = node != 0;
+	if (valid) {
+		auto key = engine->KeyOf(node);
+		current_key.assign(key.data(), key.size());
+	}
+
+	return valid ? status::OK : status::NOT_FOUND;
+}
+
+status skiplist::skiplist_const_iterator::set_forward(uint64_t node)
+{
+	if (node != 0 && bound.reached(engine->KeyOf(node)))
+		node = 0;
+
+	return set(node);
+}
+
+bool skiplist::skiplist_const_iterator::read_value()
+{
+	assert(valid);
+	string_view key(current_key);
+	auto n = engine->Higher(&key, true);
+	if (n == 0 || engine->KeyOf(n).compare(key) != 0)
+		return false;
+
+	auto value = engine->ValueOf(n);
+	value_buf.assign(value.data(), value.size());
+
+	return true;
+}
+
+status skiplist::skiplist_const_iterator::seek(string_view key)
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	auto n = engine->Higher(&key, true);
+	if (n != 0 && engine->KeyOf(n).compare(key) != 0)
+		n = 0;
+
+	return set(n);
+}
+
+status skiplist::skiplist_const_iterator::seek_lower(string_view key)
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	return set(engine->Lower(&key, false));
+}
+
+status skiplist::skiplist_const_iterator::seek_lower_eq(string_view key)
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	return set(engine->Lower(&key, true));
+}
+
+status skiplist::skiplist_const_iterator::seek_higher(string_view key)
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	return set_forward(engine->Higher(&key, false));
+}
+
+status skiplist::skiplist_const_iterator::seek_higher_eq(string_view key)
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	return set_forward(engine->Higher(&key, true));
+}
+
+status skiplist::skiplist_const_iterator::seek_to_first()
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	return set_forward(engine->Higher(nullptr, true));
+}
+
+status skiplist::skiplist_const_iterator::seek_to_last()
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	return set(engine->Lower(nullptr, true));
+}
+
+status skiplist::skiplist_const_iterator::is_next()
+{
+	epoch_guard guard(engine->epochs);
+	if (!valid)
+		return status::NOT_FOUND;
+
+	string_view key(current_key);
+	auto n = engine->Higher(&key, false);
+	bool found = n != 0 && !bound.reached(engine->KeyOf(n));
+
+	return found ? status::OK : status::NOT_FOUND;
+}
+
+status skiplist::skiplist_const_iterator::next()
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	if (!valid)
+		return status::NOT_FOUND;
+
+	string_view key(current_key);
+	return set_forward(engine->Higher(&key, false));
+}
+
+/* stays at the first element, if there's nothing before it */
+status skiplist::skiplist_const_iterator::prev()
+{
+	epoch_guard guard(engine->epochs);
+	init_seek();
+
+	if (!valid)
+		return status::NOT_FOUND;
+
+	string_view key(current_key);
+	auto n = engine->Lower(&key, false);
+	if (n == 0)
+		return status::NOT_FOUND;
+
+	return set(n);
+}
+
+status skiplist::skiplist_const_iterator::set_upper_bound(const string_view *key)
+{
+	bound.set(key);
+
+	return status::OK;
+}
+
+result<string_view> skiplist::skiplist_const_iterator::key()
+{
+	assert(valid);
+
+	return string_view(current_key);
+}
+
+result<pmem::obj::slice<const char *>>
+skiplist::skiplist_const_iterator::read_range(size_t pos, size_t n)
+{
+	epoch_guard guard(engine->epochs);
+	if (!read_value())
+		return status::NOT_FOUND;
+
+	if (pos + n > value_buf.size() || pos + n < pos)
+		n = value_buf.size() - pos;
+
+	auto val = value_buf.data() + pos;
+
+	return {pmem::obj::slice<const char *>(val, val + n)};
+}
+
+result<pmem::obj::slice<char *>> skiplist::skiplist_iterator::write_range(size_t pos,
+									  size_t n)
+{
+	epoch_guard guard(engine->epochs);
+	if (!read_value())
+		return status::NOT_FOUND;
+
+	if (pos + n > value_buf.size() || pos + n < pos)
+		n = value_buf.size() - pos;
+
+	log.push_back({value_buf.substr(pos, n), pos});
+	auto &val = log.back().first;
+
+	return {{&val[0], &val[0] + n}};
+}
+
+/* the modified value replaces the current one, unless it changed meanwhile */
+status skiplist::skiplist_iterator::commit()
+{
+	epoch_guard guard(engine->epochs);
+
+	string_view key(current_key);
+	auto n = engine->Higher(&key, true);
+	if (n == 0 || engine->KeyOf(n).compare(key) != 0) {
+		log.clear();
+		return status::NOT_FOUND;
+	}
+
+	auto &field = engine->Value(n);
+	while (true) {
+		auto old = field.load(std::memory_order_acquire);
+		auto value = reinterpret_cast<const internal::skiplist::value *>(
+			engine->base + old);
+		std::string modified(reinterpret_cast<const char *>(value + 1),
+				     value->size);
+		for (auto &p : log) {
+			if (p.second + p.first.size() <= modified.size())
+				modified.replace(p.second, p.first.size(), p.first);
+		}
+
+		auto v = engine->AllocValue(modified);
+		if (field.compare_exchange_strong(old, v)) {
+			engine->pmpool.persist(&field, sizeof(uint64_t));
+			guard.retire(old, false);
+			break;
+		}
+
+		engine->Free(v);
+	}
+	log.clear();
+
+	return status::OK;
+}
+
+void skiplist::skiplist_iterator::abort()
+{
+	log.clear();
+}
+
+static factory_registerer
+	register_skiplist(std::unique_ptr<engine_base::factory_base>(new skiplist_factory));
+
+} // namespace kv
+} // namespace pmem
@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_SKIPLIST_H
+#define LIBPMEMKV_SKIPLIST_H
+
+#include "../iterator.h"
+#include "../pmemobj_engine.h"
+
+#include <libpmemobj++/make_persistent.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace skiplist
+{
+
+/* maximal number of levels of a tower, above the persistent list */
+static constexpr std::size_t MAX_HEIGHT = 16;
+/* lowest bit of a link marks its owner (a node or a level of a tower) removed */
+static constexpr uint64_t MARK = 1;
+
+/*
+ * Node of the persistent, sorted list, allocated with its key (which follows
+ * the node). Links are offsets in the pool, modified with atomic operations.
+ */
+struct node {
+	uint64_t next;
+	/* offset of the value (its size, followed by data) */
+	uint64_t value;
+	/* tower of the node, a DRAM pointer, valid only while the pool is open */
+	uint64_t tower;
+	uint64_t key_size;
+};
+
+struct value {
+	uint64_t size;
+};
+
+struct pmem_type {
+	pmem_type() : head(0)
+	{
+		std::memset(reserved, 0, sizeof(reserved));
+	}
+
+	/* offset of the first node of the list */
+	uint64_t head;
+	uint64_t reserved[8];
+};
+
+/*
+ * DRAM index of a node: its key (stored in the node) and links to the next
+ * towers on each of its levels.
+ */
+struct tower {
+	tower(uint64_t node, string_view key, std::size_t height)
+	    : node(node), key(key), height(height), refs(2)
+	{
+		for (auto &n : next)
+			n.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t node;
+	string_view key;
+	std::size_t height;
+	/* held by the inserter (until the tower is linked) and by the node */
+	std::atomic<int> refs;
+	std::atomic<uintptr_t> next[MAX_HEIGHT];
+};
+
+/* Node (with its value and tower, if set) or a value, unlinked by an operation */
+struct retired {
+	uint64_t epoch;
+	uint64_t offset;
+	bool is_node;
+	tower *t;
+};
+
+/*
+ * Epoch-based reclamation: every operation announces the global epoch in
+ * a slot for its duration, and objects it unlinks are retired (in the slot)
+ * with the epoch of their removal. They are freed when no operation, which
+ * might have reached them, is running - all active slots announce later
+ * epochs. The global epoch advances when all active slots announce it.
+ */
+class epoch_manager {
+public:
+	epoch_manager(std::function<void(const retired &)> free);
+	~epoch_manager();
+
+	std::size_t enter();
+	void exit(std::size_t slot);
+	void retire(std::size_t slot, retired r);
+
+	/* number of retired objects, which are not freed yet */
+	std::size_t pending() const;
+
+private:
+	/* retired objects are freed in batches, when an operation exits */
+	static constexpr std::size_t RECLAIM_BATCH = 64;
+
+	struct slot {
+		std::atomic<bool> claimed{false};
+		/* 0 if no operation is running */
+		std::atomic<uint64_t> epoch{0};
+		std::vector<retired> objects;
+		/* keeps slots in separate cache lines */
+		char padding[64];
+	};
+
+	void reclaim(slot &s);
+
+	std::function<void(const retired &)> free;
+	std::atomic<uint64_t> global{1};
+	std::atomic<std::size_t> n_pending{0};
+	std::size_t n_slots;
+	std::unique_ptr<slot[]> slots;
+};
+
+class epoch_guard {
+public:
+	epoch_guard(epoch_manager &epochs) : epochs(epochs), slot(epochs.enter())
+	{
+	}
+
+	~epoch_guard()
+	{
+		epochs.exit(slot);
+	}
+
+	epoch_guard(const epoch_guard &) = delete;
+	epoch_guard &operator=(const epoch_guard &) = delete;
+
+	void retire(uint64_t offset, bool is_node, tower *t = nullptr)
+	{
+		epochs.retire(slot, {0, offset, is_node, t});
+	}
+
+private:
+	epoch_manager &epochs;
+	std::size_t slot;
+};
+
+} /* namespace skiplist */
+} /* namespace internal */
+
+/**
+ * Lock-free, sorted engine. Keys and values are kept in a persistent list of
+ * nodes, sorted bytewise by keys, which is modified only by atomic
+ * operations (as Harris' list): a node is inserted by a compare-and-swap of
+ * its predecessor's link and removed by marking its own link first, then
+ * unlinking it. Random nodes get towers - levels of a skiplist, kept in DRAM
+ * and rebuilt when the pool is opened - which lead searches to a node close
+ * to the key. Values are replaced by swapping a pointer to a new one.
+ *
+ * No operation takes locks; unlinked nodes and replaced values are freed
+ * when no running operation may read them (epoch-based reclamation).
+ * Objects which were allocated, but not linked (or not freed) before
+ * a crash, are freed when the pool is opened.
+ */
+class skiplist : public pmemobj_engine_base<internal::skiplist::pmem_type> {
+public:
+	skiplist(std::unique_ptr<internal::config> cfg);
+	~skiplist();
+
+	skiplist(const skiplist &) = delete;
+	skiplist &operator=(const skiplist &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+
+	internal::iterator_base *new_iterator() final;
+	internal::iterator_base *new_const_iterator() final;
+
+	status stats(internal::stats_sink &sink) final;
+
+protected:
+	internal::memory_stats memory_types() final;
+
+private:
+	using node = internal::skiplist::node;
+	using tower = internal::skiplist::tower;
+	using scan_function = std::function<int(uint64_t node)>;
+
+	class skiplist_const_iterator;
+	class skiplist_iterator;
+
+	void Recover();
+
+	node *Node(uint64_t offset) const
+	{
+		return reinterpret_cast<node *>(base + offset);
+	}
+	/* Returns the link to the node after the given one (0 - the head) */
+	std::atomic<uint64_t> &Next(uint64_t offset) const;
+	std::atomic<uint64_t> &Value(uint64_t offset) const;
+	string_view KeyOf(uint64_t offset) const;
+	string_view ValueOf(uint64_t offset) const;
+	bool Removed(const tower *t) const;
+
+	/* Returns the last tower with a key lower than key (or the last one) */
+	tower *Descend(const string_view *key) const;
+	/* Finds neighbours of key on all levels, unlinking removed towers */
+	void FindTowers(string_view key, tower **preds, tower **succs);
+	void MarkTower(tower *t);
+	void LinkTower(tower *t);
+	void Release(internal::skiplist::epoch_guard &guard, tower *t);
+
+	/*
+	 * Returns the first node not lower than key (or 0) and the link which
+	 * points to it, unlinking removed nodes on the way.
+	 */
+	uint64_t Search(string_view key, std::atomic<uint64_t> *&pred);
+	/* Returns the first (last) node above (below) key, or 0 */
+	uint64_t Higher(const string_view *key, bool eq) const;
+	uint64_t Lower(const string_view *key, bool eq) const;
+	uint64_t NextLive(uint64_t offset) const;
+	/* Calls f for nodes within the bounds (if set), in order */
+	int Scan(const string_view *low, bool low_eq, const string_view *high,
+		 bool high_eq, const scan_function &f) const;
+
+	status GetRange(const std::string *low, bool low_eq, const std::string *high,
+			bool high_eq, get_kv_callback *callback, void *arg);
+	status CountRange(const std::string *low, bool low_eq, const std::string *high,
+			  bool high_eq, std::size_t &cnt);
+
+	uint64_t AllocNode(string_view key, uint64_t next, uint64_t value, tower *t);
+	uint64_t AllocValue(string_view value);
+	void Free(uint64_t offset);
+	void FreeRetired(const internal::skiplist::retired &r);
+
+	internal::skiplist::pmem_type *pmem_root = nullptr;
+	char *base = nullptr;
+
+	tower head;
+	std::atomic<std::size_t> count;
+	std::atomic<std::size_t> towers;
+
+	internal::skiplist::epoch_manager epochs;
+};
+
+/*
+ * Iterators are positioned on keys (nodes may be freed between calls), so
+ * every move is a search, and values are read into the iterator's buffer.
+ */
+class skiplist::skiplist_const_iterator : public internal::iterator_base {
+public:
+	skiplist_const_iterator(skiplist *engine);
+
+	status seek(string_view key) final;
+	status seek_lower(string_view key) final;
+	status seek_lower_eq(string_view key) final;
+	status seek_higher(string_view key) final;
+	status seek_higher_eq(string_view key) final;
+
+	status seek_to_first() final;
+	status seek_to_last() final;
+
+	status is_next() final;
+	status next() final;
+	status prev() final;
+
+	status set_upper_bound(const string_view *key) final;
+
+	result<string_view> key() final;
+
+	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
+
+protected:
+	/* moves to the node (if not 0), forward moves stop at the upper bound */
+	status set(uint64_t node);
+	status set_forward(uint64_t node);
+	/* copies the current value to value_buf, false if the key was removed */
+	bool read_value();
+
+	skiplist *engine;
+	internal::iterator_bound bound;
+	bool valid = false;
+	std::string current_key;
+	std::string value_buf;
+};
+
+class skiplist::skiplist_iterator : public skiplist::skiplist_const_iterator {
+public:
+	skiplist_iterator(skiplist *engine);
+
+	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
+
+	status commit() final;
+	void abort() final;
+
+private:
+	std::vector<std::pair<std::string, size_t>> log;
+};
+
+class skiplist_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new skiplist(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "skiplist";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_SKIPLIST_H */
@@ -1,13 +1,19 @@
 // SPDX-License-Identifier: BSD-3-Clause
 /* Copyright 2017-2021, Intel Corporation */
 
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <unistd.h>
 
 #include <libpmemobj++/make_persistent_atomic.hpp>
 #include <libpmemobj++/transaction.hpp>
 
 #include "../out.h"
+#include "../parallel_scan.h"
+#include "../snapshot.h"
+#include "../trace.h"
 #include "stree.h"
 
 using pmem::detail::conditional_add_to_tx;
@@ -19,33 +25,149 @@ namespace pmem
 namespace kv
 {
 
-stree::stree(std::unique_ptr<internal::config> cfg)
-    : pmemobj_engine_base(cfg, "pmemkv_stree"), config(std::move(cfg))
+/* percent of elements defragmented at once by the background defrag */
+static const double BACKGROUND_DEFRAG_SLICE = 1;
+
+template <typename Layout>
+basic_stree<Layout>::basic_stree(std::unique_ptr<internal::config> &cfg)
+    : base_type(cfg, Layout::layout()),
+      mtx(std::thread::hardware_concurrency()),
+      buffer_flushes(0)
 {
-	Recover();
+	using key_type = internal::stree::key_type;
+	using value_type = internal::stree::value_type;
+	using compare = internal::pmemobj_compare;
+	using leaf_type =
+		internal::leaf_node_t<key_type, value_type, compare, Layout::degree - 1>;
+	using inner_type = internal::inner_node_t<key_type, compare, Layout::degree - 1>;
+
+	/* nodes are allocated from classes of their exact size */
+	this->register_alloc_class(sizeof(leaf_type));
+	this->register_alloc_class(sizeof(inner_type));
+
+	/* big values are allocated from their own arena, apart from nodes */
+	uint64_t read_only = 0;
+	cfg->get_uint64("read_only", &read_only);
+	uint64_t separate = 0;
+	cfg->get_uint64("separate_values", &separate);
+	if (separate > 0 && !read_only) {
+		value_arena = internal::create_pool_arena(this->pmpool.handle());
+		separate_values = static_cast<std::size_t>(separate);
+	}
+
+	PMEMKV_PROBE1(recovery__start, "stree");
+	{
+		internal::open_phase phase("stree.recover");
+		Recover(*cfg);
+	}
+	PMEMKV_PROBE2(recovery__done, "stree", my_btree->size());
+	config = std::move(cfg);
+	prefetcher.reset(new internal::prefetch_queue(
+		[this](const internal::prefetch_request &r) { prefetch_walk(r); }));
+
+	uint64_t defrag_budget = 0;
+	config->get_uint64("background_defrag", &defrag_budget);
+	if (defrag_budget > 0) {
+		defrag_svc.reset(new internal::defrag_service(
+			[this](double start, double amount) {
+				return defrag(start, amount);
+			},
+			static_cast<double>(defrag_budget), BACKGROUND_DEFRAG_SLICE));
+	}
 	LOG("Started ok");
 }
 
-stree::~stree()
+template <typename Layout>
+basic_stree<Layout>::~basic_stree()
 {
+	/* waits for the running walk and defrag */
+	prefetcher.reset();
+	defrag_svc.reset();
+	Layout::close(*my_btree);
 	LOG("Stopped ok");
 }
 
-std::string stree::name()
+template <typename Layout>
+std::string basic_stree<Layout>::name()
 {
 	return "stree";
 }
 
-status stree::count_all(std::size_t &cnt)
+template <typename Layout>
+status basic_stree<Layout>::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	cnt = my_btree->size();
 
 	return status::OK;
 }
 
+template <typename Layout>
+status basic_stree<Layout>::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = base_type::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	auto tree = my_btree->stats();
+	auto size = my_btree->size();
+
+	sink.add("count", size);
+	sink.add("stree.degree", Layout::degree);
+	sink.add("stree.depth", tree.depth);
+	sink.add("stree.leaf_count", tree.leaves);
+	sink.add("stree.leaf_fill_percent",
+		 tree.leaves ? size * 100 / (tree.leaves * tree.leaf_capacity) : 0);
+	if (filter)
+		sink.add("bloom_filter.bytes", filter->size_bytes());
+	if (index)
+		sink.add("stree.hash_index_bytes", index->size_bytes());
+	if (buffer) {
+		sink.add("stree.write_buffer_bytes", buffer->capacity());
+		sink.add("stree.write_buffer_flushes", buffer_flushes.load());
+	}
+
+	this->report_memory(sink, size);
+
+	return status::OK;
+}
+
+/*
+ * Keys and values are stored in leaves, the ones which don't fit there are
+ * allocated separately (as data of pmem::obj::string). Inner nodes are
+ * persistent only in the persistent_inner_nodes layout.
+ */
+template <typename Layout>
+internal::memory_stats basic_stree<Layout>::memory_types()
+{
+	using key_type = internal::stree::key_type;
+	using value_type = internal::stree::value_type;
+	using compare = internal::pmemobj_compare;
+	using leaf_type =
+		internal::leaf_node_t<key_type, value_type, compare, Layout::degree - 1>;
+	using inner_type = internal::inner_node_t<key_type, compare, Layout::degree - 1>;
+
+	internal::memory_stats mem;
+	mem.add_type(internal::stree::PMEM_TYPE_NUM | Layout::degree, "tree",
+		     sizeof(container_type));
+	mem.add_type(pmem::detail::type_num<leaf_type>(), "leaves", sizeof(leaf_type));
+	mem.add_type(pmem::detail::type_num<inner_type>(), "inner_nodes",
+		     sizeof(inner_type));
+	mem.add_type(pmem::detail::type_num<char>(), "strings");
+	mem.add_type(internal::stree::PMEM_TYPE_NUM_LOGGED, "write_buffer");
+
+	return mem;
+}
+
 template <typename It>
 static std::size_t size(It first, It last)
 {
@@ -56,10 +178,13 @@ static std::size_t size(It first, It last)
 }
 
 /* above key, key exclusive */
-status stree::count_above(string_view key, std::size_t &cnt)
+template <typename Layout>
+status basic_stree<Layout>::count_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_above key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->upper_bound(key);
 	auto last = my_btree->end();
@@ -70,10 +195,13 @@ status stree::count_above(string_view key, std::size_t &cnt)
 }
 
 /* above or equal to key, key inclusive */
-status stree::count_equal_above(string_view key, std::size_t &cnt)
+template <typename Layout>
+status basic_stree<Layout>::count_equal_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_above key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->lower_bound(key);
 	auto last = my_btree->end();
@@ -84,10 +212,13 @@ status stree::count_equal_above(string_view key, std::size_t &cnt)
 }
 
 /* below key, key exclusive */
-status stree::count_below(string_view key, std::size_t &cnt)
+template <typename Layout>
+status basic_stree<Layout>::count_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_below key<" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->begin();
 	auto last = my_btree->lower_bound(key);
@@ -98,10 +229,13 @@ status stree::count_below(string_view key, std::size_t &cnt)
 }
 
 /* below or equal to key, key inclusive */
-status stree::count_equal_below(string_view key, std::size_t &cnt)
+template <typename Layout>
+status basic_stree<Layout>::count_equal_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_below key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->begin();
 	auto last = my_btree->upper_bound(key);
@@ -111,11 +245,15 @@ status stree::count_equal_below(string_view key, std::size_t &cnt)
 	return status::OK;
 }
 
-status stree::count_between(string_view key1, string_view key2, std::size_t &cnt)
+template <typename Layout>
+status basic_stree<Layout>::count_between(string_view key1, string_view key2,
+					  std::size_t &cnt)
 {
 	LOG("count_between key range=[" << std::string(key1.data(), key1.size()) << ","
 					<< std::string(key2.data(), key2.size()) << ")");
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	if (my_btree->key_comp()(key1, key2)) {
 		auto first = my_btree->upper_bound(key1);
@@ -129,10 +267,30 @@ status stree::count_between(string_view key1, string_view key2, std::size_t &cnt
 	return status::OK;
 }
 
-status stree::get_all(get_kv_callback *callback, void *arg)
+/* estimated from the shape of the tree, without walking over the range */
+template <typename Layout>
+status basic_stree<Layout>::count_between_approx(string_view key1, string_view key2,
+						 std::size_t &cnt)
+{
+	LOG("count_between_approx key range=["
+	    << std::string(key1.data(), key1.size()) << ","
+	    << std::string(key2.data(), key2.size()) << ")");
+	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	cnt = my_btree->count_between_approx(key1, key2);
+
+	return status::OK;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->begin();
 	auto last = my_btree->end();
@@ -140,11 +298,46 @@ status stree::get_all(get_kv_callback *callback, void *arg)
 	return internal::iterate_through_pairs(first, last, callback, arg);
 }
 
+/*
+ * The tree is split at separators of its inner nodes (see partition_keys()),
+ * parts are scanned in parallel under the read lock taken by this thread.
+ * Keys of partition i are lower than keys of partition i + 1.
+ */
+template <typename Layout>
+status basic_stree<Layout>::get_all_parallel(std::size_t partitions,
+					     get_kv_callback *callback, void **args)
+{
+	LOG("get_all_parallel");
+	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto keys = my_btree->partition_keys(partitions);
+
+	std::vector<container_iterator> bounds;
+	bounds.reserve(keys.size() + 2);
+	bounds.push_back(my_btree->begin());
+	for (auto &key : keys)
+		bounds.push_back(my_btree->lower_bound(key));
+	bounds.push_back(my_btree->end());
+
+	return internal::parallel_scan(
+		bounds.size() - 1, callback, args,
+		[&](std::size_t partition, get_kv_callback *cb, void *arg) {
+			return internal::iterate_through_pairs(
+				bounds[partition], bounds[partition + 1], cb, arg);
+		});
+}
+
 /* (key, end), above key */
-status stree::get_above(string_view key, get_kv_callback *callback, void *arg)
+template <typename Layout>
+status basic_stree<Layout>::get_above(string_view key, get_kv_callback *callback,
+				      void *arg)
 {
 	LOG("get_above start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->upper_bound(key);
 	auto last = my_btree->end();
@@ -153,10 +346,14 @@ status stree::get_above(string_view key, get_kv_callback *callback, void *arg)
 }
 
 /* [key, end), above or equal to key */
-status stree::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+template <typename Layout>
+status basic_stree<Layout>::get_equal_above(string_view key, get_kv_callback *callback,
+					    void *arg)
 {
 	LOG("get_equal_above start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->lower_bound(key);
 	auto last = my_btree->end();
@@ -165,10 +362,14 @@ status stree::get_equal_above(string_view key, get_kv_callback *callback, void *
 }
 
 /* [start, key], below or equal to key */
-status stree::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+template <typename Layout>
+status basic_stree<Layout>::get_equal_below(string_view key, get_kv_callback *callback,
+					    void *arg)
 {
 	LOG("get_equal_below start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->begin();
 	auto last = my_btree->upper_bound(key);
@@ -177,10 +378,14 @@ status stree::get_equal_below(string_view key, get_kv_callback *callback, void *
 }
 
 /* [start, key), less than key, key exclusive */
-status stree::get_below(string_view key, get_kv_callback *callback, void *arg)
+template <typename Layout>
+status basic_stree<Layout>::get_below(string_view key, get_kv_callback *callback,
+				      void *arg)
 {
 	LOG("get_below key<" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	auto first = my_btree->begin();
 	auto last = my_btree->lower_bound(key);
@@ -189,12 +394,15 @@ status stree::get_below(string_view key, get_kv_callback *callback, void *arg)
 }
 
 /* get between (key1, key2), key1 exclusive, key2 exclusive */
-status stree::get_between(string_view key1, string_view key2, get_kv_callback *callback,
-			  void *arg)
+template <typename Layout>
+status basic_stree<Layout>::get_between(string_view key1, string_view key2,
+					get_kv_callback *callback, void *arg)
 {
 	LOG("get_between key range=[" << std::string(key1.data(), key1.size()) << ","
 				      << std::string(key2.data(), key2.size()) << ")");
 	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	if (my_btree->key_comp()(key1, key2)) {
 		auto first = my_btree->upper_bound(key1);
@@ -206,12 +414,176 @@ status stree::get_between(string_view key1, string_view key2, get_kv_callback *c
 	return status::OK;
 }
 
-status stree::exists(string_view key)
+/* values are stored out of the leaves, key-only scans don't touch them */
+template <typename Layout>
+status basic_stree<Layout>::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_keys_all");
+	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto first = my_btree->begin();
+	auto last = my_btree->end();
+
+	return internal::iterate_through_keys(first, last, callback, arg);
+}
+
+template <typename Layout>
+status basic_stree<Layout>::get_keys_between(string_view key1, string_view key2,
+					     get_kv_callback *callback, void *arg)
+{
+	LOG("get_keys_between key range=[" << std::string(key1.data(), key1.size())
+					   << "," << std::string(key2.data(), key2.size())
+					   << ")");
+	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	if (my_btree->key_comp()(key1, key2)) {
+		auto first = my_btree->upper_bound(key1);
+		auto last = my_btree->lower_bound(key2);
+
+		return internal::iterate_through_keys(first, last, callback, arg);
+	}
+
+	return status::OK;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::prefetch(string_view key)
+{
+	LOG("prefetch key=" << std::string(key.data(), key.size()));
+	prefetcher->submit(key);
+
+	return status::OK;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::prefetch_range(string_view key1, string_view key2)
+{
+	LOG("prefetch_range key range=[" << std::string(key1.data(), key1.size())
+					 << "," << std::string(key2.data(), key2.size())
+					 << "]");
+	prefetcher->submit(key1, key2);
+
+	return status::OK;
+}
+
+/*
+ * The descent and the walk over leaves read the nodes (writes in the write
+ * buffer are in DRAM already), values are stored out of the leaves, so
+ * they're prefetched. The range is walked in chunks, each under its own
+ * hold of the lock (see prefetch_queue::chunk_size).
+ */
+template <typename Layout>
+void basic_stree<Layout>::prefetch_walk(const internal::prefetch_request &request)
+{
+	std::string key1 = request.key1;
+	string_view key2 = request.point ? string_view(request.key1)
+					 : string_view(request.key2);
+	if (my_btree->key_comp()(key2, string_view(key1)))
+		return;
+
+	while (true) {
+		internal::shared_lock_guard<mutex_type> lock(mtx);
+
+		auto last = my_btree->upper_bound(key2);
+		auto it = my_btree->lower_bound(string_view(key1));
+		for (std::size_t n = 0; it != last && n < internal::prefetch_queue::chunk_size;
+		     ++it, ++n)
+			internal::prefetch_bytes(it->second.c_str(), it->second.size());
+
+		if (it == last)
+			return;
+
+		key1.assign(it->first.cdata(), it->first.size());
+	}
+}
+
+/*
+ * Like get_all_parallel, but only subtrees which may contain keys from the
+ * range are split (see partition_keys()), so all partitions are in the range.
+ */
+template <typename Layout>
+status basic_stree<Layout>::get_between_parallel(string_view key1, string_view key2,
+						 std::size_t partitions,
+						 get_kv_callback *callback, void **args)
+{
+	LOG("get_between_parallel key range=[" << std::string(key1.data(), key1.size())
+					       << "," << std::string(key2.data(), key2.size())
+					       << ")");
+	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	if (!my_btree->key_comp()(key1, key2))
+		return status::OK;
+
+	auto keys = my_btree->partition_keys(partitions, key1, key2);
+
+	std::vector<container_iterator> bounds;
+	bounds.reserve(keys.size() + 2);
+	bounds.push_back(my_btree->upper_bound(key1));
+	for (auto &key : keys)
+		bounds.push_back(my_btree->lower_bound(key));
+	bounds.push_back(my_btree->lower_bound(key2));
+
+	return internal::parallel_scan(
+		bounds.size() - 1, callback, args,
+		[&](std::size_t partition, get_kv_callback *cb, void *arg) {
+			return internal::iterate_through_pairs(
+				bounds[partition], bounds[partition + 1], cb, arg);
+		});
+}
+
+/*
+ * With the binary comparator, keys starting with prefix form the range
+ * [prefix, upper), where upper is the prefix with its last byte incremented.
+ */
+template <typename Layout>
+status basic_stree<Layout>::get_prefix(string_view prefix, get_kv_callback *callback,
+				       void *arg)
+{
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+	flush_buffer();
+
+	if (!my_btree->key_comp().is_binary())
+		return engine_base::get_prefix(prefix, callback, arg);
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	std::string upper;
+	auto first = my_btree->lower_bound(prefix);
+	auto last = internal::prefix_upper_bound(prefix, upper)
+		? my_btree->lower_bound(string_view(upper))
+		: my_btree->end();
+
+	return internal::iterate_through_pairs(first, last, callback, arg);
+}
+
+template <typename Layout>
+status basic_stree<Layout>::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it = my_btree->find(key);
+	if (buffer) {
+		auto found = buffer->find(key, nullptr, nullptr);
+		if (found != internal::stree::write_buffer::lookup::NOT_BUFFERED)
+			return found == internal::stree::write_buffer::lookup::FOUND
+				? status::OK
+				: status::NOT_FOUND;
+	}
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	if (index)
+		return index->find(key) ? status::OK : status::NOT_FOUND;
+
+	auto it = (filter && !filter->may_contain(key)) ? my_btree->end()
+							: my_btree->find(key);
 	if (it == my_btree->end()) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
@@ -219,12 +591,37 @@ status stree::exists(string_view key)
 	return status::OK;
 }
 
-status stree::get(string_view key, get_v_callback *callback, void *arg)
+template <typename Layout>
+status basic_stree<Layout>::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get using callback for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it = my_btree->find(key);
+	/* buffered writes are newer than the tree */
+	if (buffer) {
+		auto found = buffer->find(key, callback, arg);
+		if (found != internal::stree::write_buffer::lookup::NOT_BUFFERED)
+			return found == internal::stree::write_buffer::lookup::FOUND
+				? status::OK
+				: status::NOT_FOUND;
+	}
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	/* the index has all keys of the tree, so its entry is read directly */
+	if (index) {
+		auto entry = index->find(key);
+		if (!entry) {
+			LOG("  key not found");
+			return status::NOT_FOUND;
+		}
+
+		callback(entry->second.c_str(), entry->second.size(), arg);
+		return status::OK;
+	}
+
+	auto it = (filter && !filter->may_contain(key)) ? my_btree->end()
+							: my_btree->find(key);
 	if (it == my_btree->end()) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
@@ -234,87 +631,693 @@ status stree::get(string_view key, get_v_callback *callback, void *arg)
 	return status::OK;
 }
 
-status stree::put(string_view key, string_view value)
+/*
+ * A batch with at least a key per leaf (on average) is looked up in order of
+ * the comparator, so consecutive keys are often found in the leaf of the
+ * previous one (or in the next leaf), without a descent. Keys of a sparser
+ * batch rarely share a leaf - their descents are interleaved instead, to
+ * overlap misses of the nodes. Callbacks are called in order of the batch.
+ */
+template <typename Layout>
+status basic_stree<Layout>::get_batch(const string_view *keys, std::size_t n,
+				      get_kv_callback *callback, void *arg)
+{
+	LOG("get_batch n=" << n);
+	check_outside_tx();
+
+	if (buffer)
+		return base_type::get_batch(keys, n, callback, arg);
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	std::vector<const entry_type *> entries(n, nullptr);
+	if (index) {
+		for (std::size_t i = 0; i < n; ++i)
+			entries[i] = index->find(keys[i]);
+	} else {
+		std::vector<std::size_t> order;
+		order.reserve(n);
+		for (std::size_t i = 0; i < n; ++i) {
+			if (!filter || filter->may_contain(keys[i]))
+				order.push_back(i);
+		}
+
+		std::vector<string_view> lookups;
+		lookups.reserve(order.size());
+		auto found = [&](std::size_t i, const entry_type &entry) {
+			entries[order[i]] = &entry;
+		};
+
+		auto leaf_capacity = typename container_type::tree_stats().leaf_capacity;
+		if (order.size() * leaf_capacity < my_btree->size()) {
+			for (auto i : order)
+				lookups.push_back(keys[i]);
+
+			my_btree->find_interleaved(lookups.data(), lookups.size(), found);
+		} else {
+			auto &comp = my_btree->key_comp();
+			std::sort(order.begin(), order.end(),
+				  [&](std::size_t a, std::size_t b) {
+					  return comp(keys[a], keys[b]);
+				  });
+
+			for (auto i : order)
+				lookups.push_back(keys[i]);
+
+			my_btree->find_sorted(lookups.data(), lookups.size(), found);
+		}
+	}
+
+	auto s = status::OK;
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!entries[i]) {
+			LOG("  key not found");
+			s = status::NOT_FOUND;
+			continue;
+		}
+
+		auto &value = entries[i]->second;
+		if (callback(keys[i].data(), keys[i].size(), value.c_str(), value.size(),
+			     arg) != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return s;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::put(string_view key, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
 
-	auto result = my_btree->try_emplace(key, value);
-	if (!result.second) { // key already exists, so update
-		typename internal::stree::btree_type::value_type &entry = *result.first;
-		transaction::manual tx(pmpool);
+	if (buffer && buffered(&key, &value, 1))
+		return status::OK;
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	try {
+		insert_or_assign(key, value);
+	} catch (...) {
+		/* index may point to entries of the rolled back transaction */
+		if (index)
+			rebuild_index();
+		throw;
+	}
+
+	return status::OK;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::put_batch(const string_view *keys, const string_view *values,
+				      std::size_t n)
+{
+	LOG("put_batch n=" << n);
+	check_outside_tx();
+
+	/* the whole batch is appended to the log at once, so it's atomic */
+	if (buffer && buffered(keys, values, n))
+		return status::OK;
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	/* sorted batch is bulk loaded into an empty tree, in a single transaction */
+	if (n > 0 && my_btree->size() == 0 && strictly_sorted(keys, n)) {
+		my_btree->bulk_load([&](typename container_type::bulk_builder &builder) {
+			for (std::size_t i = 0; i < n; ++i)
+				builder.push_back(keys[i], values[i]);
+		});
+		if (filter)
+			rebuild_filter();
+		if (index)
+			rebuild_index();
+
+		return status::OK;
+	}
+
+	try {
+		return this->put_batch_tx(keys, values, n,
+					  [&](string_view key, string_view value) {
+						  insert_or_assign(key, value);
+					  });
+	} catch (...) {
+		if (index)
+			rebuild_index();
+		throw;
+	}
+}
+
+template <typename Layout>
+void basic_stree<Layout>::insert_or_assign(string_view key, string_view value)
+{
+	if (filter)
+		filter->add(key);
+
+	bool separate = value_arena != 0 && value.size() >= separate_values;
+
+	/* entries moved by a split of a leaf are repointed in the index */
+	auto moved = [&](const entry_type *from, const entry_type *to) {
+		if (index)
+			index->moved(from, to);
+	};
+
+	/*
+	 * A separated value is assigned after the entry is inserted (with an
+	 * empty value), so that only the value's buffer is in its arena.
+	 */
+	std::pair<container_iterator, bool> result;
+	if (separate) {
+		transaction::manual tx(this->pmpool);
+		result = my_btree->try_emplace(key, string_view(), moved);
+		{
+			internal::arena_scope values(this->pmpool.handle(), value_arena);
+			result.first->second = value;
+		}
+		transaction::commit();
+	} else {
+		result = my_btree->try_emplace(key, value, moved);
+	}
+	if (result.second && index)
+		index->insert(key, &*result.first);
+
+	if (!result.second && !separate) { // key already exists, so update
+		typename container_type::value_type &entry = *result.first;
+		transaction::manual tx(this->pmpool);
 		entry.second = value;
 		transaction::commit();
+	} else if (result.second && filter) {
+		filter->inserted();
+		if (filter->full())
+			rebuild_filter();
 	}
-	return status::OK;
 }
 
-status stree::remove(string_view key)
+template <typename Layout>
+bool basic_stree<Layout>::strictly_sorted(const string_view *keys, std::size_t n) const
+{
+	auto &comp = my_btree->key_comp();
+	for (std::size_t i = 1; i < n; ++i) {
+		if (!comp(keys[i - 1], keys[i]))
+			return false;
+	}
+
+	return true;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	auto result = my_btree->erase(key);
+	/* a removal is buffered as a tombstone, if the key exists */
+	if (buffer) {
+		if (exists(key) != status::OK)
+			return status::NOT_FOUND;
+		if (buffered(&key, nullptr, 1))
+			return status::OK;
+	}
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	auto result = erase(key, [](const entry_type &) {});
 	return (result == 1) ? status::OK : status::NOT_FOUND;
 }
 
-void stree::Recover()
+/*
+ * The entry is read in the leaf found by the descent of its erase, under the
+ * exclusive lock. With the write buffer, the value may be buffered, so it's
+ * taken by get() and remove().
+ */
+template <typename Layout>
+status basic_stree<Layout>::take(string_view key, get_v_callback *callback, void *arg)
 {
+	LOG("take key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	if (buffer)
+		return base_type::take(key, callback, arg);
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	if (filter && !filter->may_contain(key))
+		return status::NOT_FOUND;
+	if (index && !index->find(key))
+		return status::NOT_FOUND;
+
+	auto result = erase(key, [&](const entry_type &entry) {
+		callback(entry.second.c_str(), entry.second.size(), arg);
+	});
+	return (result == 1) ? status::OK : status::NOT_FOUND;
+}
+
+template <typename Layout>
+template <typename F>
+std::size_t basic_stree<Layout>::erase(string_view key, F &&visit)
+{
+	if (!index)
+		return my_btree->erase(key, visit);
+
+	const entry_type *erased = nullptr;
+	auto result = my_btree->erase(key, [&](const entry_type &entry) {
+		erased = &entry;
+		visit(entry);
+	});
+	if (result == 1)
+		index->erase(index->hash(key), erased);
+
+	return result;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::remove_between(string_view key1, string_view key2,
+					   std::size_t &cnt)
+{
+	LOG("remove_between key range=(" << std::string(key1.data(), key1.size())
+					  << "," << std::string(key2.data(), key2.size())
+					  << ")");
+	check_outside_tx();
+	flush_buffer();
+	std::unique_lock<mutex_type> lock(mtx);
+
+	/* entries of the range are found before they are erased */
+	std::vector<std::pair<uint64_t, const entry_type *>> erased;
+	if (index && my_btree->key_comp()(key1, key2)) {
+		auto last = my_btree->lower_bound(key2);
+		for (auto it = my_btree->upper_bound(key1); it != last; ++it) {
+			string_view k(it->first.cdata(), it->first.size());
+			erased.emplace_back(index->hash(k), &*it);
+		}
+	}
+
+	cnt = my_btree->erase_between(key1, key2);
+
+	for (auto &e : erased)
+		index->erase(e.first, e.second);
+
+	return status::OK;
+}
+
+/*
+ * Relocates data of keys and values which don't fit in entries of leaves (as
+ * data of pmem::obj::string) of the elements in the range, under the exclusive
+ * lock. Leaves are allocated from a class of their exact size (and pointed to
+ * by their neighbours and parents), so they are not relocated. Buffered writes
+ * are not in the tree yet, they are not flushed.
+ */
+template <typename Layout>
+status basic_stree<Layout>::defrag(double start_percent, double amount_percent)
+{
+	LOG("defrag: start_percent = " << start_percent
+				       << " amount_percent = " << amount_percent);
+	check_outside_tx();
+
+	try {
+		std::unique_lock<mutex_type> lock(mtx);
+
+		auto range = base_type::defrag_positions(my_btree->size(), start_percent,
+							 amount_percent);
+		pmem::obj::defrag my_defrag(this->pmpool);
+
+		auto it = my_btree->begin();
+		for (std::size_t i = 0; i < range.second && !it.is_end(); ++i, ++it) {
+			if (i < range.first)
+				continue;
+			my_defrag.add(it->first);
+			my_defrag.add(it->second);
+		}
+
+		my_defrag.run();
+	} catch (std::range_error &e) {
+		out_err("defrag", e.what());
+		return status::INVALID_ARGUMENT;
+	} catch (pmem::defrag_error &e) {
+		out_err("defrag", e.what());
+		return status::DEFRAG_ERROR;
+	}
+
+	return status::OK;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::snapshot_save(const std::string &path)
+{
+	LOG("snapshot_save path=" << path);
+	check_outside_tx();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	internal::snapshot_writer writer(path, internal::snapshot::FLAG_SORTED);
+	for (auto &e : *my_btree)
+		writer.write(string_view(e.first.cdata(), e.first.size()),
+			     string_view(e.second.cdata(), e.second.size()));
+	writer.commit();
+
+	return status::OK;
+}
+
+template <typename Layout>
+status basic_stree<Layout>::snapshot_load(const std::string &path)
+{
+	LOG("snapshot_load path=" << path);
+	check_outside_tx();
+	flush_buffer();
+	internal::snapshot_reader reader(path);
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	/*
+	 * Sorted records are bulk loaded into an empty tree. Order of the
+	 * snapshot may still be different from the comparator's one (if it
+	 * was saved by some other engine), then the load is rolled back and
+	 * records are inserted one by one.
+	 */
+	if ((reader.flags() & internal::snapshot::FLAG_SORTED) &&
+	    my_btree->size() == 0) {
+		try {
+			my_btree->bulk_load(
+				[&](typename container_type::bulk_builder &builder) {
+					reader.read([&](string_view key,
+							string_view value) {
+						builder.push_back(key, value);
+					});
+				});
+			if (filter)
+				rebuild_filter();
+			if (index)
+				rebuild_index();
+
+			return status::OK;
+		} catch (internal::invalid_argument &) {
+			if (my_btree->size() != 0)
+				throw;
+		}
+	}
+
+	reader.read([&](string_view key, string_view value) {
+		insert_or_assign(key, value);
+	});
+
+	return status::OK;
+}
+
+/*
+ * Degree of the tree is stored in the type number of its object. Trees
+ * allocated without it were created by earlier versions, whose leaves and
+ * inner nodes have another layout, so they can't be opened.
+ */
+static uint64_t stored_degree(uint64_t type_num)
+{
+	using namespace internal::stree;
+
+	if ((type_num & ~PMEM_TYPE_NUM_DEGREE_MASK) != PMEM_TYPE_NUM)
+		throw layout_mismatch(type_num);
+
+	return type_num & PMEM_TYPE_NUM_DEGREE_MASK;
+}
+
+template <typename Layout>
+void basic_stree<Layout>::Recover(internal::config &cfg)
+{
+	auto root_oid = this->root_oid;
+
 	if (!OID_IS_NULL(*root_oid)) {
-		my_btree = (internal::stree::btree_type *)pmemobj_direct(*root_oid);
+		auto tree_oid = *root_oid;
+		if (pmemobj_type_num(tree_oid) == internal::stree::PMEM_TYPE_NUM_LOGGED) {
+			log = (internal::stree::write_log *)pmemobj_direct(tree_oid);
+			tree_oid = log->tree;
+		}
+
+		auto degree = stored_degree(pmemobj_type_num(tree_oid));
+		if (degree != Layout::degree)
+			throw internal::stree::degree_mismatch(degree);
+
+		my_btree = (container_type *)pmemobj_direct(tree_oid);
 		my_btree->key_comp().runtime_initialize(
-			internal::extract_comparator(*config));
+			internal::extract_comparator(cfg));
 	} else {
-		pmem::obj::transaction::run(pmpool, [&] {
+		pmem::obj::transaction::run(this->pmpool, [&] {
 			pmem::obj::transaction::snapshot(root_oid);
-			*root_oid =
-				pmem::obj::make_persistent<internal::stree::btree_type>()
-					.raw();
-			my_btree =
-				(internal::stree::btree_type *)pmemobj_direct(*root_oid);
+			auto oid = pmemobj_tx_xalloc(sizeof(container_type),
+						     internal::stree::PMEM_TYPE_NUM |
+							     Layout::degree,
+						     POBJ_XALLOC_NO_ABORT);
+			if (OID_IS_NULL(oid))
+				throw pmem::transaction_alloc_error(
+					"Failed to allocate stree data");
+
+			my_btree = new (pmemobj_direct(oid)) container_type();
+			*root_oid = oid;
 			my_btree->key_comp().initialize(
-				internal::extract_comparator(*config));
+				internal::extract_comparator(cfg));
 		});
 	}
+
+	/* DRAM part of the tree (if any) is built once the tree is consistent */
+	PMEMKV_PROBE2(recovery__phase, "stree", "index");
+	internal::open_phase phase("stree.index");
+	Layout::open(*my_btree, cfg);
+
+	filter = internal::bloom_filter::from_config(cfg);
+	if (filter) {
+		PMEMKV_PROBE2(recovery__phase, "stree", "filter");
+		phase.next("stree.filter");
+		rebuild_filter();
+	}
+
+	uint64_t hash_index = 0;
+	cfg.get_uint64("hash_index", &hash_index);
+	if (hash_index) {
+		/* keys are matched in the index byte by byte */
+		if (!my_btree->key_comp().is_binary())
+			throw internal::invalid_argument(
+				"Config item: \"hash_index\" requires the default comparator");
+
+		PMEMKV_PROBE2(recovery__phase, "stree", "hash_index");
+		phase.next("stree.hash_index");
+		index.reset(new internal::stree::point_index<entry_type>());
+		rebuild_index();
+	}
+
+	PMEMKV_PROBE2(recovery__phase, "stree", "buffer");
+	phase.next("stree.buffer");
+	open_buffer(cfg);
 }
 
-internal::iterator_base *stree::new_iterator()
+/*
+ * Writes left in the log are applied to the tree first, so the log can be
+ * resized or dropped. The log is allocated once the buffer is enabled and
+ * the root is switched to it, the tree is kept where it was.
+ */
+template <typename Layout>
+void basic_stree<Layout>::open_buffer(internal::config &cfg)
 {
-	return new stree_iterator<false>{my_btree};
+	using namespace internal::stree;
+
+	uint64_t size = 0;
+	cfg.get_uint64("write_buffer_size", &size);
+
+	if (!log && size == 0)
+		return;
+
+	auto cmp = internal::extract_comparator(cfg);
+	if (log) {
+		buffer.reset(new write_buffer(this->pmpool, log, cmp));
+		buffer->replay();
+		flush_buffer();
+
+		if (size == log->capacity) {
+			if (size == 0)
+				buffer.reset();
+			return;
+		}
+		buffer.reset();
+	}
+
+	pmem::obj::transaction::run(this->pmpool, [&] {
+		if (!log) {
+			auto root_oid = this->root_oid;
+			pmem::obj::transaction::snapshot(root_oid);
+
+			auto oid = pmemobj_tx_xalloc(
+				sizeof(write_log), PMEM_TYPE_NUM_LOGGED,
+				POBJ_XALLOC_ZERO | POBJ_XALLOC_NO_ABORT);
+			if (OID_IS_NULL(oid))
+				throw pmem::transaction_alloc_error(
+					"Failed to allocate stree write log");
+
+			log = (write_log *)pmemobj_direct(oid);
+			log->tree = *root_oid;
+			*root_oid = oid;
+		} else {
+			pmem::obj::transaction::snapshot(log);
+			if (!OID_IS_NULL(log->data) && pmemobj_tx_free(log->data) != 0)
+				throw pmem::transaction_free_error(
+					"Failed to free stree write log");
+			log->data = OID_NULL;
+		}
+
+		log->capacity = size;
+		log->used = 0;
+		if (size == 0)
+			return;
+
+		log->data = pmemobj_tx_xalloc(size, 0, POBJ_XALLOC_NO_ABORT);
+		if (OID_IS_NULL(log->data))
+			throw pmem::transaction_alloc_error(
+				"Failed to allocate stree write log");
+	});
+
+	if (size > 0)
+		buffer.reset(new write_buffer(this->pmpool, log, cmp));
+}
+
+template <typename Layout>
+bool basic_stree<Layout>::buffered(const string_view *keys, const string_view *values,
+				   std::size_t n)
+{
+	if (buffer->append(keys, values, n))
+		return true;
+
+	flush_buffer();
+
+	return buffer->append(keys, values, n);
 }
 
-internal::iterator_base *stree::new_const_iterator()
+/*
+ * Buffered writes are applied in order of keys, in a single transaction - an
+ * empty tree is bulk loaded, otherwise consecutive inserts go to the same or
+ * neighbouring leaves.
+ */
+template <typename Layout>
+bool basic_stree<Layout>::flush_buffer()
 {
-	return new stree_iterator<true>{my_btree};
+	if (!buffer || buffer->empty())
+		return false;
+
+	std::unique_lock<mutex_type> lock(mtx);
+
+	using map_type = internal::stree::write_buffer::map_type;
+	auto flushed = buffer->drain([&](const map_type &memtable) {
+		auto removes = std::any_of(memtable.begin(), memtable.end(),
+					   [](const map_type::value_type &e) {
+						   return e.second.removed;
+					   });
+
+		if (my_btree->size() == 0 && !removes) {
+			my_btree->bulk_load(
+				[&](typename container_type::bulk_builder &builder) {
+					for (auto &e : memtable)
+						builder.push_back(
+							string_view(e.first),
+							string_view(e.second.value));
+				});
+			if (filter)
+				rebuild_filter();
+			if (index)
+				rebuild_index();
+
+			return;
+		}
+
+		try {
+			pmem::obj::transaction::run(this->pmpool, [&] {
+				for (auto &e : memtable) {
+					string_view key(e.first);
+					if (e.second.removed)
+						erase(key, [](const entry_type &) {});
+					else
+						insert_or_assign(key, e.second.value);
+				}
+			});
+		} catch (...) {
+			if (index)
+				rebuild_index();
+			throw;
+		}
+	});
+
+	if (flushed)
+		++buffer_flushes;
+
+	return flushed;
 }
 
-stree::stree_iterator<true>::stree_iterator(container_type *c)
-    : container(c), it_(nullptr), pop(pmem::obj::pool_by_vptr(c))
+template <typename Layout>
+void basic_stree<Layout>::rebuild_filter()
 {
+	filter->reset(my_btree->size());
+	for (auto &e : *my_btree)
+		filter->add(string_view(e.first.cdata(), e.first.size()));
 }
 
-stree::stree_iterator<false>::stree_iterator(container_type *c)
-    : stree::stree_iterator<true>(c)
+template <typename Layout>
+void basic_stree<Layout>::rebuild_index()
 {
+	index->reset(my_btree->size());
+	for (auto &e : *my_btree)
+		index->insert(string_view(e.first.cdata(), e.first.size()), &e);
 }
 
-status stree::stree_iterator<true>::seek(string_view key)
+template <typename Layout>
+internal::iterator_base *basic_stree<Layout>::new_iterator()
+{
+	return new stree_iterator{this, my_btree, &mtx, this->direct_write_range};
+}
+
+template <typename Layout>
+internal::iterator_base *basic_stree<Layout>::new_const_iterator()
+{
+	return new stree_const_iterator{this, my_btree, &mtx};
+}
+
+template <typename Layout>
+basic_stree<Layout>::stree_const_iterator::stree_const_iterator(basic_stree *engine,
+								container_type *c,
+								mutex_type *mtx)
+    : engine(engine),
+      container(c),
+      mtx(mtx),
+      it_(nullptr),
+      pop(pmem::obj::pool_by_vptr(c))
+{
+}
+
+template <typename Layout>
+basic_stree<Layout>::stree_iterator::stree_iterator(basic_stree *engine,
+						    container_type *c, mutex_type *mtx,
+						    bool direct_write)
+    : basic_stree<Layout>::stree_const_iterator(engine, c, mtx),
+      direct_write(direct_write),
+      tx(this->pop)
+{
+}
+
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::seek(string_view key)
 {
 	init_seek();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->find(key);
-	if (it_ != container->end())
+	it_ = find_bound(key, false);
+	if (it_ != container->end() && !container->key_comp()(key, it_->first))
 		return status::OK;
 
+	it_ = container->end();
+
 	return status::NOT_FOUND;
 }
 
-status stree::stree_iterator<true>::seek_lower(string_view key)
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::seek_lower(string_view key)
 {
 	init_seek();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->lower_bound(key);
+	it_ = find_bound(key, false);
 	if (it_ == container->begin()) {
 		it_ = container->end();
 		return status::NOT_FOUND;
@@ -325,11 +1328,14 @@ status stree::stree_iterator<true>::seek_lower(string_view key)
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::seek_lower_eq(string_view key)
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::seek_lower_eq(string_view key)
 {
 	init_seek();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->upper_bound(key);
+	it_ = find_bound(key, true);
 	if (it_ == container->begin()) {
 		it_ = container->end();
 		return status::NOT_FOUND;
@@ -340,77 +1346,95 @@ status stree::stree_iterator<true>::seek_lower_eq(string_view key)
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::seek_higher(string_view key)
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::seek_higher(string_view key)
 {
 	init_seek();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->upper_bound(key);
-	if (it_ == container->end())
-		return status::NOT_FOUND;
+	it_ = find_bound(key, true);
 
-	return status::OK;
+	return check_bound();
 }
 
-status stree::stree_iterator<true>::seek_higher_eq(string_view key)
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::seek_higher_eq(string_view key)
 {
 	init_seek();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	it_ = container->lower_bound(key);
-	if (it_ == container->end())
-		return status::NOT_FOUND;
+	it_ = find_bound(key, false);
 
-	return status::OK;
+	return check_bound();
 }
 
-status stree::stree_iterator<true>::seek_to_first()
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::seek_to_first()
 {
 	init_seek();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
 	if (container->size() == 0)
 		return status::NOT_FOUND;
 
 	it_ = container->begin();
+	positioned = true;
 
-	return status::OK;
+	return check_bound();
 }
 
-status stree::stree_iterator<true>::seek_to_last()
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::seek_to_last()
 {
 	init_seek();
+	flush_buffer();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
 	if (container->size() == 0)
 		return status::NOT_FOUND;
 
 	it_ = container->end();
 	--it_;
+	positioned = true;
 
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::is_next()
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::is_next()
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx, write_lock.owns_lock());
 	auto tmp = it_;
-	if (tmp == container->end() || ++tmp == container->end())
+	if (tmp.is_end() || past_bound(++tmp))
 		return status::NOT_FOUND;
 
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::next()
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::next()
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	if (it_ == container->end() || ++it_ == container->end())
+	if (it_.is_end())
 		return status::NOT_FOUND;
 
-	return status::OK;
+	++it_;
+
+	return check_bound();
 }
 
-status stree::stree_iterator<true>::prev()
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::prev()
 {
 	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 
-	if (it_ == container->begin())
+	if (it_.is_begin())
 		return status::NOT_FOUND;
 
 	--it_;
@@ -418,16 +1442,102 @@ status stree::stree_iterator<true>::prev()
 	return status::OK;
 }
 
-result<string_view> stree::stree_iterator<true>::key()
+template <typename Layout>
+status
+basic_stree<Layout>::stree_const_iterator::next_batch(internal::iterator_batch &batch)
 {
+	init_seek();
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
+
+	for (; !past_bound(it_) && !batch.full(); ++it_)
+		batch.push(string_view(it_->first.cdata(), it_->first.length()),
+			   batch.keys_only()
+				   ? string_view()
+				   : string_view(it_->second.cdata(), it_->second.size()));
+
+	check_bound();
+
+	return batch.size > 0 ? status::OK : status::NOT_FOUND;
+}
+
+template <typename Layout>
+status
+basic_stree<Layout>::stree_const_iterator::set_upper_bound(const string_view *key)
+{
+	bound.set(key);
+
+	return status::OK;
+}
+
+/*
+ * Returns lower_bound (or upper_bound, if 'upper') of the key. A seek to
+ * a key a bit above the previous one (e.g. in a merge join or a skip scan)
+ * usually finds it in the current leaf or in one of the next few, without
+ * a descent from the root.
+ */
+template <typename Layout>
+typename basic_stree<Layout>::container_type::iterator
+basic_stree<Layout>::stree_const_iterator::find_bound(string_view key, bool upper)
+{
+	if (positioned)
+		return upper ? container->upper_bound(key, it_)
+			     : container->lower_bound(key, it_);
+
+	positioned = true;
+	return upper ? container->upper_bound(key) : container->lower_bound(key);
+}
+
+/* Applies buffered writes; they may have moved entries, so it_ is no hint */
+template <typename Layout>
+void basic_stree<Layout>::stree_const_iterator::flush_buffer()
+{
+	if (engine->flush_buffer())
+		positioned = false;
+}
+
+/* it_ may point to a freed leaf once other threads modify the tree */
+template <typename Layout>
+void basic_stree<Layout>::stree_const_iterator::reset()
+{
+	positioned = false;
+	internal::iterator_base::reset();
+}
+
+/* Returns true if 'it' is the end or is not lower than the upper bound */
+template <typename Layout>
+bool basic_stree<Layout>::stree_const_iterator::past_bound(
+	const typename container_type::iterator &it)
+{
+	return it.is_end() ||
+		bound.reached(string_view(it->first.cdata(), it->first.length()),
+			      container->key_comp());
+}
+
+/* Moves the iterator to the end if it's past the upper bound */
+template <typename Layout>
+status basic_stree<Layout>::stree_const_iterator::check_bound()
+{
+	if (!past_bound(it_))
+		return status::OK;
+
+	it_ = container->end();
+	return status::NOT_FOUND;
+}
+
+template <typename Layout>
+result<string_view> basic_stree<Layout>::stree_const_iterator::key()
+{
+	internal::shared_lock_guard<mutex_type> lock(*mtx, write_lock.owns_lock());
 	assert(it_ != container->end());
 
 	return string_view(it_->first.cdata(), it_->first.length());
 }
 
-result<pmem::obj::slice<const char *>> stree::stree_iterator<true>::read_range(size_t pos,
-									       size_t n)
+template <typename Layout>
+result<pmem::obj::slice<const char *>>
+basic_stree<Layout>::stree_const_iterator::read_range(size_t pos, size_t n)
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx, write_lock.owns_lock());
 	assert(it_ != container->end());
 
 	if (pos + n > it_->second.size() || pos + n < pos)
@@ -436,25 +1546,45 @@ result<pmem::obj::slice<const char *>> stree::stree_iterator<true>::read_range(s
 	return {it_->second.crange(pos, n)};
 }
 
-result<pmem::obj::slice<char *>> stree::stree_iterator<false>::write_range(size_t pos,
-									   size_t n)
+template <typename Layout>
+result<pmem::obj::slice<char *>>
+basic_stree<Layout>::stree_iterator::write_range(size_t pos, size_t n)
 {
-	assert(it_ != container->end());
+	auto &write_lock = this->write_lock;
+
+	/* values are modified in place, readers are blocked until commit */
+	if (direct_write && !write_lock.owns_lock())
+		write_lock = std::unique_lock<mutex_type>(*this->mtx);
+
+	internal::shared_lock_guard<mutex_type> lock(*this->mtx, write_lock.owns_lock());
+	auto &it_ = this->it_;
+	assert(it_ != this->container->end());
 
 	if (pos + n > it_->second.size() || pos + n < pos)
 		n = it_->second.size() - pos;
 
+	if (direct_write)
+		return {tx.add(it_->second.cdata() + pos, n)};
+
 	log.push_back({{it_->second.cdata() + pos, n}, pos});
 	auto &val = log.back().first;
 
 	return {{&val[0], &val[0] + n}};
 }
 
-status stree::stree_iterator<false>::commit()
+template <typename Layout>
+status basic_stree<Layout>::stree_iterator::commit()
 {
-	pmem::obj::transaction::run(pop, [&] {
+	if (direct_write) {
+		std::unique_lock<mutex_type> lock(std::move(this->write_lock));
+		tx.commit();
+		return status::OK;
+	}
+
+	std::unique_lock<mutex_type> lock(*this->mtx);
+	pmem::obj::transaction::run(this->pop, [&] {
 		for (auto &p : log) {
-			auto dest = it_->second.range(p.second, p.first.size());
+			auto dest = this->it_->second.range(p.second, p.first.size());
 			std::copy(p.first.begin(), p.first.end(), dest.begin());
 		}
 	});
@@ -463,11 +1593,24 @@ status stree::stree_iterator<false>::commit()
 	return status::OK;
 }
 
-void stree::stree_iterator<false>::abort()
+template <typename Layout>
+void basic_stree<Layout>::stree_iterator::abort()
 {
+	tx.abort();
+	if (this->write_lock.owns_lock())
+		this->write_lock.unlock();
 	log.clear();
 }
 
+template class basic_stree<internal::stree::persistent_inner_nodes<16>>;
+template class basic_stree<internal::stree::persistent_inner_nodes<32>>;
+template class basic_stree<internal::stree::persistent_inner_nodes<64>>;
+template class basic_stree<internal::stree::persistent_inner_nodes<128>>;
+template class basic_stree<internal::stree::volatile_inner_nodes<16>>;
+template class basic_stree<internal::stree::volatile_inner_nodes<32>>;
+template class basic_stree<internal::stree::volatile_inner_nodes<64>>;
+template class basic_stree<internal::stree::volatile_inner_nodes<128>>;
+
 static factory_registerer
 	register_stree(std::unique_ptr<engine_base::factory_base>(new stree_factory));
 
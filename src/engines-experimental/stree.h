@@ -5,13 +5,23 @@
 #define LIBPMEMKV_STREE_H
 
 #include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/defrag.hpp>
 #include <libpmemobj++/make_persistent.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
 
+#include "../bloom_filter.h"
 #include "../comparator/pmemobj_comparator.h"
+#include "../defrag_service.h"
 #include "../iterator.h"
 #include "../pmemobj_engine.h"
+#include "../prefetch.h"
+#include "../sharded_shared_mutex.h"
+#include "stree/hybrid_b_tree.h"
 #include "stree/persistent_b_tree.h"
+#include "stree/point_index.h"
+#include "stree/write_buffer.h"
+
+#include <atomic>
 
 using pmem::obj::persistent_ptr;
 using pmem::obj::pool;
@@ -28,29 +38,115 @@ namespace stree
 /**
  * Indicates the maximum number of descendants a single node can have.
  * DEGREE - 1 is the maximum number of entries a node can have.
+ * It's the default one, a pool can be created with a different degree
+ * (see stree_factory).
  */
 const size_t DEGREE = 32;
 
+/* type number of the tree object, its lowest bits are the degree of the tree */
+static constexpr uint64_t PMEM_TYPE_NUM = 0x7374726565000000ULL; /* "stree" */
+static constexpr uint64_t PMEM_TYPE_NUM_DEGREE_MASK = 0xffffULL;
+/* type number of the write_log, which points to the tree of its pool */
+static constexpr uint64_t PMEM_TYPE_NUM_LOGGED = 0x7374726565770000ULL; /* "streew" */
+
 using string_t = pmem::obj::string;
 
 using key_type = string_t;
 using value_type = string_t;
-using btree_type = b_tree<key_type, value_type, internal::pmemobj_compare, DEGREE>;
+template <std::size_t Degree>
+using btree_type = b_tree<key_type, value_type, internal::pmemobj_compare, Degree>;
+template <std::size_t Degree>
+using hybrid_btree_type =
+	hybrid_b_tree<key_type, value_type, internal::pmemobj_compare, Degree>;
+
+/*
+ * Thrown by the engine if the pool was created with another degree, so it
+ * can be opened again by the right instantiation.
+ */
+struct degree_mismatch : error {
+	degree_mismatch(uint64_t degree)
+	    : error("Pool was created with stree degree " + std::to_string(degree),
+		    PMEMKV_STATUS_INVALID_ARGUMENT),
+	      degree(degree)
+	{
+	}
+	uint64_t degree;
+};
+
+/* Thrown if the tree wasn't created by this version of the engine */
+struct layout_mismatch : error {
+	layout_mismatch(uint64_t type_num)
+	    : error("Incompatible stree layout (tree type number " +
+			    std::to_string(type_num) +
+			    "), the pool was created by an older version",
+		    PMEMKV_STATUS_INVALID_ARGUMENT)
+	{
+	}
+};
+
+/* Inner nodes are persistent, as leaves */
+template <std::size_t Degree>
+struct persistent_inner_nodes {
+	using tree_type = btree_type<Degree>;
+	static const std::size_t degree = Degree;
+
+	static const char *layout()
+	{
+		return "pmemkv_stree_v2";
+	}
+
+	static void open(tree_type &, internal::config &)
+	{
+	}
+
+	static void close(tree_type &)
+	{
+	}
+};
+
+/* Inner nodes are kept in DRAM, rebuilt from leaves on open */
+template <std::size_t Degree>
+struct volatile_inner_nodes {
+	using tree_type = hybrid_btree_type<Degree>;
+	static const std::size_t degree = Degree;
+
+	static const char *layout()
+	{
+		return "pmemkv_stree_hybrid_v2";
+	}
+
+	static void open(tree_type &tree, internal::config &cfg)
+	{
+		uint64_t numa_replicas = 0;
+		cfg.get_uint64("numa_replicas", &numa_replicas);
+		tree.runtime_initialize(numa_replicas != 0);
+	}
+
+	static void close(tree_type &tree)
+	{
+		tree.runtime_finalize();
+	}
+};
 
 } /* namespace stree */
 } /* namespace internal */
 
-class stree : public pmemobj_engine_base<internal::stree::btree_type> {
+template <typename Layout>
+class basic_stree : public pmemobj_engine_base<typename Layout::tree_type> {
 private:
-	using container_type = internal::stree::btree_type;
+	using base_type = pmemobj_engine_base<typename Layout::tree_type>;
+	using container_type = typename Layout::tree_type;
 	using container_iterator = typename container_type::iterator;
+	using entry_type = typename container_type::value_type;
+	using mutex_type = internal::sharded_shared_mutex;
 
-	template <bool IsConst>
+	class stree_const_iterator;
 	class stree_iterator;
 
 public:
-	stree(std::unique_ptr<internal::config> cfg);
-	~stree();
+	/* cfg is taken over only if the pool is opened, see stree_factory */
+	basic_stree(std::unique_ptr<internal::config> &cfg);
+	~basic_stree();
 
 	std::string name() final;
 
@@ -60,8 +156,12 @@ public:
 	status count_equal_below(string_view key, std::size_t &cnt) final;
 	status count_below(string_view key, std::size_t &cnt) final;
 	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_between_approx(string_view key1, string_view key2,
+				    std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
 	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_equal_above(string_view key, get_kv_callback *callback,
 			       void *arg) final;
@@ -70,29 +170,101 @@ public:
 	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			   void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2,
+				    std::size_t partitions, get_kv_callback *callback,
+				    void **args) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
+	status get_keys_between(string_view key1, string_view key2,
+				get_kv_callback *callback, void *arg) final;
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
 	status exists(string_view key) final;
 	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status get_batch(const string_view *keys, std::size_t n, get_kv_callback *callback,
+			 void *arg) final;
 	status put(string_view key, string_view value) final;
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
 	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2,
+			      std::size_t &cnt) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+
+	status stats(internal::stats_sink &sink) final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
 
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
 private:
-	stree(const stree &);
-	void operator=(const stree &);
-	void Recover();
-
-	internal::stree::btree_type *my_btree;
+	basic_stree(const basic_stree &);
+	void operator=(const basic_stree &);
+	internal::memory_stats memory_types() final;
+	void Recover(internal::config &cfg);
+	/* Inserts or overwrites the element, mutex must be locked */
+	void insert_or_assign(string_view key, string_view value);
+	/* Checks if keys are in strictly increasing order (so can be bulk loaded) */
+	bool strictly_sorted(const string_view *keys, std::size_t n) const;
+	/* Adds all keys to the filter, mutex must be locked */
+	void rebuild_filter();
+	/* Indexes all entries of the tree, mutex must be locked */
+	void rebuild_index();
+	/*
+	 * Erases the entry from the tree (passing it to 'visit' first) and from
+	 * the index, mutex must be locked. Returns the number of erased entries.
+	 */
+	template <typename F>
+	std::size_t erase(string_view key, F &&visit);
+	/* Creates, resizes or disables the write buffer, as set in cfg */
+	void open_buffer(internal::config &cfg);
+	/*
+	 * Appends the writes to the write buffer (flushing it once, if it's
+	 * full). Returns false if they have to be applied to the tree directly.
+	 */
+	bool buffered(const string_view *keys, const string_view *values, std::size_t n);
+	/* Applies all buffered writes to the tree, mutex must not be locked */
+	/* returns true if buffered writes were applied to the tree */
+	bool flush_buffer();
+	/* Descends to the keys and prefetches their values, on the prefetcher's thread */
+	void prefetch_walk(const internal::prefetch_request &request);
+
+	container_type *my_btree;
+	/* readers hold shared lock, put and remove exclusive one */
+	mutex_type mtx;
 	std::unique_ptr<internal::config> config;
+	/* DRAM filter of keys, enabled by "bloom_bits_per_key" */
+	std::unique_ptr<internal::bloom_filter> filter;
+	/* DRAM index of entries by keys, enabled by "hash_index" */
+	std::unique_ptr<internal::stree::point_index<entry_type>> index;
+	/* null if the pool has no write log */
+	internal::stree::write_log *log = nullptr;
+	/* DRAM memtable of writes, enabled by "write_buffer_size" */
+	std::unique_ptr<internal::stree::write_buffer> buffer;
+	std::atomic<uint64_t> buffer_flushes;
+	std::unique_ptr<internal::prefetch_queue> prefetcher;
+	/*
+	 * arena of values of at least separate_values bytes, 0 if they are
+	 * not separated ("separate_values" config parameter)
+	 */
+	unsigned value_arena = 0;
+	std::size_t separate_values = 0;
+	/* set only if background defrag is enabled ("background_defrag" config) */
+	std::unique_ptr<internal::defrag_service> defrag_svc;
 };
 
-template <>
-class stree::stree_iterator<true> : public internal::iterator_base {
-	using container_type = stree::container_type;
+template <typename Layout>
+class basic_stree<Layout>::stree_const_iterator : public internal::iterator_base {
+	using container_type = typename basic_stree<Layout>::container_type;
 
 public:
-	stree_iterator(container_type *container);
+	stree_const_iterator(basic_stree *engine, container_type *container,
+			     mutex_type *mtx);
 
 	status seek(string_view key) final;
 	status seek_lower(string_view key) final;
@@ -106,23 +278,43 @@ public:
 	status is_next() final;
 	status next() final;
 	status prev() final;
+	status next_batch(internal::iterator_batch &batch) final;
+
+	status set_upper_bound(const string_view *key) final;
 
 	result<string_view> key() final;
 
 	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
 
+	void reset() final;
+
 protected:
+	/* flushes the write buffer before seeks, so they see all writes */
+	basic_stree *engine;
 	container_type *container;
-	container_type::iterator it_;
+	mutex_type *mtx;
+	typename container_type::iterator it_;
 	pmem::obj::pool_base pop;
+	/* held by a write iterator in the direct mode, from write_range to commit */
+	std::unique_lock<mutex_type> write_lock;
+	internal::iterator_bound bound;
+	/* it_ was set by a seek, so the next seek may search from it */
+	bool positioned = false;
+
+	bool past_bound(const typename container_type::iterator &it);
+	status check_bound();
+	typename container_type::iterator find_bound(string_view key, bool upper);
+	void flush_buffer();
 };
 
-template <>
-class stree::stree_iterator<false> : public stree::stree_iterator<true> {
-	using container_type = stree::container_type;
+template <typename Layout>
+class basic_stree<Layout>::stree_iterator
+    : public basic_stree<Layout>::stree_const_iterator {
+	using container_type = typename basic_stree<Layout>::container_type;
 
 public:
-	stree_iterator(container_type *container);
+	stree_iterator(basic_stree *engine, container_type *container, mutex_type *mtx,
+		       bool direct_write);
 
 	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
 
@@ -131,20 +323,75 @@ public:
 
 private:
 	std::vector<std::pair<std::string, size_t>> log;
+	/* used instead of the log in the direct mode */
+	bool direct_write;
+	internal::direct_write_tx tx;
 };
 
+/**
+ * Creates the engine instantiated for the degree of the tree. The "degree"
+ * config is used only to create a new pool - if an existing pool was created
+ * with another one, the engine throws degree_mismatch and the pool is opened
+ * again, by the right instantiation.
+ */
 class stree_factory : public engine_base::factory_base {
 public:
 	std::unique_ptr<engine_base>
 	create(std::unique_ptr<internal::config> cfg) override
 	{
 		check_config_null(get_name(), cfg);
-		return std::unique_ptr<engine_base>(new stree(std::move(cfg)));
+
+		uint64_t volatile_inner_nodes = 0;
+		cfg->get_uint64("volatile_inner_nodes", &volatile_inner_nodes);
+		uint64_t degree = internal::stree::DEGREE;
+		cfg->get_uint64("degree", &degree);
+
+		try {
+			return create_engine(volatile_inner_nodes != 0, degree, cfg);
+		} catch (internal::stree::degree_mismatch &e) {
+			return create_engine(volatile_inner_nodes != 0, e.degree, cfg);
+		}
 	};
 	std::string get_name() override
 	{
 		return "stree";
 	};
+
+private:
+	static std::unique_ptr<engine_base>
+	create_engine(bool hybrid, uint64_t degree,
+		      std::unique_ptr<internal::config> &cfg)
+	{
+		switch (degree) {
+			case 16:
+				return create_instance<16>(hybrid, cfg);
+			case 32:
+				return create_instance<32>(hybrid, cfg);
+			case 64:
+				return create_instance<64>(hybrid, cfg);
+			case 128:
+				return create_instance<128>(hybrid, cfg);
+			default:
+				throw internal::invalid_argument(
+					"Unsupported stree degree: " +
+					std::to_string(degree) +
+					" (supported: 16, 32, 64, 128)");
+		}
+	}
+
+	template <std::size_t Degree>
+	static std::unique_ptr<engine_base>
+	create_instance(bool hybrid, std::unique_ptr<internal::config> &cfg)
+	{
+		using namespace internal::stree;
+
+		if (hybrid)
+			return std::unique_ptr<engine_base>(
+				new basic_stree<volatile_inner_nodes<Degree>>(cfg));
+
+		return std::unique_ptr<engine_base>(
+			new basic_stree<persistent_inner_nodes<Degree>>(cfg));
+	}
 };
 
 } /* namespace kv */
@@ -0,0 +1,989 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_HYBRID_B_TREE_H
+#define LIBPMEMKV_HYBRID_B_TREE_H
+
+#include "../../engines/vsmap/volatile_b_tree.h"
+#include "../../hugepage_pool.h"
+#include "../../numa.h"
+#include "../../parallel_scan.h"
+#include "persistent_b_tree.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * hybrid_b_tree keeps only leaves of the B+ tree (the same as leaves of
+ * b_tree) on PMem, linked in sorted order. Inner nodes are kept in DRAM:
+ * it's a volatile_b_tree of separators - copies of the first keys of all
+ * leaves but the first one - mapped to their leaves. The index is rebuilt
+ * (in parallel) by runtime_initialize() on every open, so splits and
+ * removals of leaves don't add inner nodes to transactions.
+ *
+ * Leaves which become empty are removed (unless it's the only one); leaves
+ * are never merged. A separator is not changed when the first key of its
+ * leaf is erased, it's still not greater than any key of the leaf.
+ *
+ * The index may be replicated on every NUMA node (see runtime_initialize()),
+ * then lookups of leaves descend the replica of the calling thread's node.
+ * Replicas are changed along with the index, so they need the same locking.
+ *
+ * The struct itself is persistent (it's the root object of the engine),
+ * pointer to the DRAM index is set when the pool is opened, as comparator's.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+class hybrid_b_tree {
+private:
+	const static std::size_t node_capacity = degree - 1;
+
+	using leaf_type = leaf_node_t<Key, T, Compare, node_capacity>;
+	using leaf_pptr = persistent_ptr<leaf_type>;
+
+	/* compares separators with keys using the comparator of the tree */
+	struct separator_compare {
+		using is_transparent = void;
+
+		template <typename U, typename V>
+		bool operator()(const U &lhs, const V &rhs) const
+		{
+			return (*comp)(lhs, rhs);
+		}
+
+		template <typename U>
+		uint64_t key_prefix(const U &key) const
+		{
+			return comp->key_prefix(key);
+		}
+
+		const Compare *comp;
+	};
+
+	using separators_type = volatile_b_tree<std::string, leaf_type *,
+						separator_compare, std::allocator<char>>;
+	/* nodes of a replica are allocated from a pool bound to its NUMA node */
+	using replica_type = volatile_b_tree<std::string, leaf_type *, separator_compare,
+					     pool_allocator<char>>;
+
+	struct volatile_index {
+		explicit volatile_index(const Compare *comp)
+		    : separators(separator_compare{comp}, std::allocator<char>())
+		{
+		}
+
+		separators_type separators;
+		/* copies of separators, one per NUMA node (none if not replicated) */
+		std::vector<std::unique_ptr<replica_type>> replicas;
+		std::size_t size = 0;
+	};
+
+public:
+	using value_type = typename leaf_type::value_type;
+	using key_type = typename leaf_type::key_type;
+	using mapped_type = typename leaf_type::mapped_type;
+	using key_compare = Compare;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+
+	using reference = typename leaf_type::reference;
+	using const_reference = typename leaf_type::const_reference;
+
+	using iterator = b_tree_iterator<leaf_type, false>;
+	using const_iterator = b_tree_iterator<leaf_type, true>;
+
+	using bulk_builder = leaf_chain_builder<leaf_type>;
+
+	/* Leaves of the tree (there's no persistent inner node) */
+	struct tree_stats {
+		size_type depth = 1;
+		size_type leaves = 0;
+		size_type leaf_capacity = node_capacity;
+	};
+
+	hybrid_b_tree();
+	~hybrid_b_tree();
+
+	hybrid_b_tree(const hybrid_b_tree &) = delete;
+	hybrid_b_tree &operator=(const hybrid_b_tree &) = delete;
+
+	void runtime_initialize(bool replicate = false);
+	void runtime_finalize();
+
+	template <typename K, typename M>
+	std::pair<iterator, bool> try_emplace(K &&key, M &&obj);
+	template <typename K, typename M, typename F>
+	std::pair<iterator, bool> try_emplace(K &&key, M &&obj, F &&moved);
+
+	template <typename F>
+	void bulk_load(F &&source);
+
+	template <typename K>
+	iterator find(const K &key);
+	template <typename K, typename F>
+	void find_sorted(const K *keys, size_type n, F &&found);
+	template <typename K, typename F>
+	void find_interleaved(const K *keys, size_type n, F &&found);
+	template <typename K>
+	iterator lower_bound(const K &key);
+	template <typename K>
+	iterator lower_bound(const K &key, const iterator &hint);
+	template <typename K>
+	iterator upper_bound(const K &key);
+	template <typename K>
+	iterator upper_bound(const K &key, const iterator &hint);
+
+	template <typename K>
+	size_type erase(const K &key);
+	template <typename K, typename F>
+	size_type erase(const K &key, F &&visit);
+	template <typename K>
+	size_type erase_between(const K &key1, const K &key2);
+
+	iterator begin();
+	iterator end();
+
+	size_type size() const noexcept;
+	tree_stats stats() const;
+	std::vector<string_view> partition_keys(size_type n) const;
+	std::vector<string_view> partition_keys(size_type n, string_view key1,
+						string_view key2) const;
+
+	template <typename K>
+	size_type count_between_approx(const K &key1, const K &key2);
+
+	key_compare &key_comp();
+	const key_compare &key_comp() const;
+
+private:
+	/* minimal number of leaves per thread rebuilding the index */
+	const static std::size_t LEAVES_PER_THREAD = 1024;
+	/* bulk loaded leaves are 3/4 full, so next inserts don't split them at once */
+	const static std::size_t BULK_LOAD_FILL = node_capacity - node_capacity / 4;
+	/* replicas are allocated from (transparent) huge pages */
+	const static std::size_t REPLICA_PAGE_SIZE = 2 << 20;
+	/* number of lookups in flight in find_interleaved() */
+	const static std::size_t INTERLEAVED_LOOKUPS = 16;
+	/* number of leaves searched by bounds with a hint, before the index */
+	const static std::size_t FINGER_SEARCH_LEAVES = 4;
+
+	leaf_pptr head;
+	key_compare compare;
+	volatile_index *index = nullptr;
+
+	template <typename K>
+	typename separators_type::iterator find_separator(const K &key);
+	template <typename K>
+	leaf_type *find_leaf(const K &key);
+	leaf_type *last_leaf();
+	/* replica of the calling thread's NUMA node, null if there are no replicas */
+	replica_type *local_replica() const;
+	void build_replicas(volatile_index &idx);
+	/* adds (removes) the separator to (from) the index and all its replicas */
+	void add_separator(const std::string &sep, leaf_type *leaf);
+	void remove_separator(const std::string &sep);
+
+	template <typename K, typename M>
+	std::pair<iterator, bool> insert(leaf_type *leaf, K &&key, M &&obj);
+	template <typename K, typename M, typename F>
+	std::pair<iterator, bool> split_leaf(leaf_type *leaf, K &&key, M &&obj,
+					     F &&moved);
+
+	static std::string separator(const key_type &key);
+	pool_base get_pool_base() const;
+};
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+hybrid_b_tree<Key, T, Compare, degree>::hybrid_b_tree()
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+	head = make_persistent<leaf_type>(node_alloc_flag<leaf_type>(this));
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+hybrid_b_tree<Key, T, Compare, degree>::~hybrid_b_tree()
+{
+	try {
+		pmem::obj::transaction::run(get_pool_base(), [&] {
+			while (head != nullptr) {
+				leaf_pptr next = head->get_next();
+				delete_persistent<leaf_type>(head);
+				head = next;
+			}
+		});
+	} catch (transaction_error &e) {
+		std::terminate();
+	}
+}
+
+/**
+ * Builds the DRAM index. Leaves are collected by following their links,
+ * then their first keys are copied (and sizes summed) by several threads.
+ * If 'replicate' is set and the system has more than one NUMA node, the
+ * index is also copied to each of them.
+ *
+ * @pre comparator must be already (runtime) initialized.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree<Key, T, Compare, degree>::runtime_initialize(bool replicate)
+{
+	std::unique_ptr<volatile_index> idx(new volatile_index(&compare));
+
+	std::vector<leaf_type *> leaves;
+	for (auto leaf = head.get(); leaf != nullptr; leaf = leaf->get_next().get())
+		leaves.push_back(leaf);
+
+	std::size_t threads = std::thread::hardware_concurrency();
+	threads = std::max<std::size_t>(
+		1, std::min(threads, leaves.size() / LEAVES_PER_THREAD));
+	std::size_t chunk = (leaves.size() + threads - 1) / threads;
+
+	std::vector<std::string> keys(leaves.size());
+	std::vector<size_type> sizes(threads, 0);
+	parallel_run(threads, [&](std::size_t t) {
+		auto first = t * chunk;
+		auto last = std::min(first + chunk, leaves.size());
+		for (auto i = first; i < last; ++i) {
+			sizes[t] += leaves[i]->size();
+			/* the first leaf has no separator */
+			if (i > 0)
+				keys[i] = separator(leaves[i]->front().first);
+		}
+
+		return status::OK;
+	});
+
+	for (std::size_t i = 1; i < leaves.size(); ++i)
+		idx->separators.emplace_hint(idx->separators.end(), std::move(keys[i]),
+					     std::move(leaves[i]));
+	for (auto s : sizes)
+		idx->size += s;
+
+	if (replicate && numa_nodes() > 1)
+		build_replicas(*idx);
+
+	index = idx.release();
+	get_pool_base().persist(&index, sizeof(index));
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree<Key, T, Compare, degree>::runtime_finalize()
+{
+	delete index;
+	index = nullptr;
+	get_pool_base().persist(&index, sizeof(index));
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename M>
+std::pair<typename hybrid_b_tree<Key, T, Compare, degree>::iterator, bool>
+hybrid_b_tree<Key, T, Compare, degree>::try_emplace(K &&key, M &&obj)
+{
+	return try_emplace(std::forward<K>(key), std::forward<M>(obj),
+			   [](const value_type *, const value_type *) {});
+}
+
+/**
+ * Same as try_emplace(key, obj), but if the leaf is split, 'moved' is called
+ * with the old and the new address of each entry moved to the new leaf.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename M, typename F>
+std::pair<typename hybrid_b_tree<Key, T, Compare, degree>::iterator, bool>
+hybrid_b_tree<Key, T, Compare, degree>::try_emplace(K &&key, M &&obj, F &&moved)
+{
+	/* a key above all keys goes to the last leaf, without a search */
+	leaf_type *leaf = last_leaf();
+	if (leaf->size() == 0 || !compare(leaf->back().first, key)) {
+		leaf = find_leaf(key);
+
+		auto leaf_it = leaf->find(key, compare);
+		if (leaf_it != leaf->end())
+			return std::pair<iterator, bool>(iterator(leaf, leaf_it), false);
+	}
+
+	if (!leaf->full())
+		return insert(leaf, std::forward<K>(key), std::forward<M>(obj));
+
+	return split_leaf(leaf, std::forward<K>(key), std::forward<M>(obj),
+			  std::forward<F>(moved));
+}
+
+/**
+ * Replaces the (only, empty) leaf of the tree with leaves filled, in a single
+ * transaction, by 'source' - elements must be passed to the bulk_builder in
+ * strictly increasing order of keys. Separators are appended to the index
+ * after the transaction.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename F>
+void hybrid_b_tree<Key, T, Compare, degree>::bulk_load(F &&source)
+{
+	assert(size() == 0 && index->separators.size() == 0);
+
+	bulk_builder builder(compare, BULK_LOAD_FILL, node_alloc_flag<leaf_type>(this));
+	pmem::obj::transaction::run(get_pool_base(), [&] {
+		source(builder);
+		if (builder.leaves().empty())
+			return;
+
+		delete_persistent<leaf_type>(head);
+		head = builder.leaves().front();
+	});
+
+	auto &leaves = builder.leaves();
+	for (std::size_t i = 1; i < leaves.size(); ++i) {
+		auto sep = separator(leaves[i]->front().first);
+		for (auto &r : index->replicas)
+			r->emplace_hint(r->end(), std::string(sep), leaves[i].get());
+		index->separators.emplace_hint(index->separators.end(), std::move(sep),
+					       leaves[i].get());
+	}
+	index->size = builder.size();
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::iterator
+hybrid_b_tree<Key, T, Compare, degree>::find(const K &key)
+{
+	leaf_type *leaf = find_leaf(key);
+	auto leaf_it = leaf->find(key, compare);
+	if (leaf_it == leaf->end())
+		return end();
+
+	return iterator(leaf, leaf_it);
+}
+
+/**
+ * Finds 'n' keys, sorted in non-decreasing order, and calls found(i, entry)
+ * for each present one. Consecutive keys in the same or in neighbouring
+ * leaves are found without searching the index again.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename F>
+void hybrid_b_tree<Key, T, Compare, degree>::find_sorted(const K *keys, size_type n,
+							 F &&found)
+{
+	find_sorted_in_leaves<leaf_type>(
+		keys, n, compare, [&](const K &key) { return find_leaf(key); }, found);
+}
+
+/**
+ * Finds 'n' keys, in any order, and calls found(i, entry) for each present
+ * one. Only leaves are in PMem, so a lookup has two steps: the index gives
+ * its leaf, which is prefetched, and the leaf is searched once the leaves of
+ * the other INTERLEAVED_LOOKUPS - 1 lookups of the group are prefetched too.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename F>
+void hybrid_b_tree<Key, T, Compare, degree>::find_interleaved(const K *keys,
+							      size_type n, F &&found)
+{
+	leaf_type *leaves[INTERLEAVED_LOOKUPS];
+	for (size_type first = 0; first < n; first += INTERLEAVED_LOOKUPS) {
+		auto group = std::min<size_type>(n - first, INTERLEAVED_LOOKUPS);
+		for (size_type j = 0; j < group; ++j) {
+			leaves[j] = find_leaf(keys[first + j]);
+			leaves[j]->prefetch();
+		}
+
+		for (size_type j = 0; j < group; ++j) {
+			auto it = leaves[j]->find(keys[first + j], compare);
+			if (it != leaves[j]->end())
+				found(first + j, *it);
+		}
+	}
+}
+
+/**
+ * Returns an iterator pointing to the least element which is larger than or equal
+ * to the given key. Keys of the next leaf are not less than its separator, so
+ * if there is no such key in the leaf, it's the first one of the next leaf.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::iterator
+hybrid_b_tree<Key, T, Compare, degree>::lower_bound(const K &key)
+{
+	leaf_type *leaf = find_leaf(key);
+	auto leaf_it = leaf->lower_bound(key, compare);
+	if (leaf_it == leaf->end() && leaf->get_next())
+		return iterator(leaf->get_next().get());
+	if (leaf_it == leaf->end())
+		return end();
+
+	return iterator(leaf, leaf_it);
+}
+
+/**
+ * Same as lower_bound(key), but if 'hint' is not greater than the key (e.g.
+ * it's the bound of a previous, lower key), the bound is searched from it
+ * first - the index is searched only if it's not in one of the next
+ * FINGER_SEARCH_LEAVES leaves.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::iterator
+hybrid_b_tree<Key, T, Compare, degree>::lower_bound(const K &key, const iterator &hint)
+{
+	iterator result(nullptr);
+	if (bound_from_hint(hint, key, false, compare, FINGER_SEARCH_LEAVES, result))
+		return result;
+
+	return lower_bound(key);
+}
+
+/**
+ * Returns an iterator pointing to the least element which is larger than the
+ * given key.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::iterator
+hybrid_b_tree<Key, T, Compare, degree>::upper_bound(const K &key)
+{
+	leaf_type *leaf = find_leaf(key);
+	auto leaf_it = std::upper_bound(leaf->begin(), leaf->end(), key,
+					[this](const K &key, const_reference e) {
+						return compare(key, e.first);
+					});
+	if (leaf_it == leaf->end() && leaf->get_next())
+		return iterator(leaf->get_next().get());
+	if (leaf_it == leaf->end())
+		return end();
+
+	return iterator(leaf, leaf_it);
+}
+
+/**
+ * Same as upper_bound(key), but searched from 'hint' first, as in
+ * lower_bound(key, hint).
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::iterator
+hybrid_b_tree<Key, T, Compare, degree>::upper_bound(const K &key, const iterator &hint)
+{
+	iterator result(nullptr);
+	if (bound_from_hint(hint, key, true, compare, FINGER_SEARCH_LEAVES, result))
+		return result;
+
+	return upper_bound(key);
+}
+
+/**
+ * Erases entry specified by key from the tree. If its leaf becomes empty,
+ * it's unlinked and freed in the same transaction and its separator is
+ * removed from the index.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::size_type
+hybrid_b_tree<Key, T, Compare, degree>::erase(const K &key)
+{
+	return erase(key, [](const value_type &) {});
+}
+
+/**
+ * Same as erase(key), but the entry is passed to 'visit' before it's erased,
+ * so it can be read without looking it up again.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename F>
+typename hybrid_b_tree<Key, T, Compare, degree>::size_type
+hybrid_b_tree<Key, T, Compare, degree>::erase(const K &key, F &&visit)
+{
+	auto sep = find_separator(key);
+	leaf_type *leaf =
+		sep == index->separators.end() ? head.get() : (*sep).second;
+
+	auto it = leaf->find(key, compare);
+	if (it == leaf->end())
+		return 0;
+	visit(*it);
+
+	auto pop = get_pool_base();
+	bool remove_leaf = leaf->size() == 1 && (leaf->get_prev() || leaf->get_next());
+	std::string removed_separator;
+
+	pmem::obj::transaction::run(pop, [&] {
+		leaf->erase(pop, key, compare);
+		if (!remove_leaf)
+			return;
+
+		leaf_pptr prev = leaf->get_prev();
+		leaf_pptr next = leaf->get_next();
+		if (prev)
+			prev->set_next(next);
+		else
+			head = next;
+		if (next)
+			next->set_prev(prev);
+
+		/* if the first leaf is removed, the next one becomes the first */
+		if (sep != index->separators.end())
+			removed_separator = (*sep).first;
+		else
+			removed_separator = (*index->separators.begin()).first;
+
+		delete_persistent<leaf_type>(leaf_pptr(leaf));
+	});
+
+	if (remove_leaf)
+		remove_separator(removed_separator);
+	--index->size;
+
+	return 1;
+}
+
+/**
+ * Erases all entries with keys in range (key1, key2), returns their number.
+ * Leaves are visited in order, starting from the one which may contain key1.
+ * Emptied leaves form a contiguous run, which is unlinked and freed in the
+ * same transaction; their separators are removed from the index after it.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::size_type
+hybrid_b_tree<Key, T, Compare, degree>::erase_between(const K &key1, const K &key2)
+{
+	if (!compare(key1, key2))
+		return 0;
+
+	auto &separators = index->separators;
+	auto sep = find_separator(key1);
+	leaf_type *leaf = sep == separators.end() ? head.get() : (*sep).second;
+
+	auto pop = get_pool_base();
+	size_type erased = 0;
+	bool head_removed = false;
+	std::vector<std::string> removed_separators;
+
+	pmem::obj::transaction::run(pop, [&] {
+		bool removed_any = false;
+		leaf_pptr prev;
+		leaf_pptr next;
+
+		while (leaf != nullptr && leaf->size() > 0 &&
+		       compare(leaf->front().first, key2)) {
+			size_type n = leaf->erase_between(pop, key1, key2, compare);
+			erased += n;
+
+			if (n == 0 || leaf->size() > 0) {
+				leaf = leaf->get_next().get();
+			} else {
+				if (!removed_any)
+					prev = leaf->get_prev();
+				removed_any = true;
+				next = leaf->get_next();
+
+				if (sep != separators.end())
+					removed_separators.push_back((*sep).first);
+				else
+					head_removed = true;
+
+				delete_persistent<leaf_type>(leaf_pptr(leaf));
+				leaf = next.get();
+			}
+
+			/* the first leaf has no separator */
+			if (sep == separators.end())
+				sep = separators.begin();
+			else
+				++sep;
+		}
+
+		if (!removed_any)
+			return;
+
+		if (prev)
+			prev->set_next(next);
+		else
+			head = next;
+		if (next)
+			next->set_prev(prev);
+
+		if (head == nullptr)
+			head = make_persistent<leaf_type>(
+				node_alloc_flag<leaf_type>(this));
+	});
+
+	for (auto &s : removed_separators)
+		remove_separator(s);
+	/* the first remaining leaf becomes the first one */
+	if (head_removed && separators.size() > 0) {
+		std::string first = (*separators.begin()).first;
+		remove_separator(first);
+	}
+	index->size -= erased;
+
+	return erased;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree<Key, T, Compare, degree>::iterator
+hybrid_b_tree<Key, T, Compare, degree>::begin()
+{
+	return iterator(head.get());
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree<Key, T, Compare, degree>::iterator
+hybrid_b_tree<Key, T, Compare, degree>::end()
+{
+	leaf_type *leaf = last_leaf();
+	return iterator(leaf, leaf->end());
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree<Key, T, Compare, degree>::size_type
+hybrid_b_tree<Key, T, Compare, degree>::size() const noexcept
+{
+	return index->size;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree<Key, T, Compare, degree>::tree_stats
+hybrid_b_tree<Key, T, Compare, degree>::stats() const
+{
+	tree_stats s;
+	s.leaves = index->separators.size() + 1;
+
+	return s;
+}
+
+/*
+ * Returns (at most n - 1) separators, in order, which split the tree into n
+ * parts with similar numbers of leaves. Keys are valid until the tree is modified.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+std::vector<string_view>
+hybrid_b_tree<Key, T, Compare, degree>::partition_keys(size_type n) const
+{
+	std::vector<string_view> keys;
+	auto leaves = index->separators.size() + 1;
+	if (n < 2)
+		return keys;
+
+	/* separator of leaf i (there's none for the first one) is at position i - 1 */
+	size_type pos = 0, p = 1;
+	for (auto it = index->separators.begin();
+	     it != index->separators.end() && p < n; ++it, ++pos) {
+		if (leaves > n && pos + 1 != p * leaves / n)
+			continue;
+
+		keys.push_back(make_string_view(it->first));
+		++p;
+	}
+
+	return keys;
+}
+
+/*
+ * Same as above, for the range (key1, key2) - separators of leaves inside
+ * the range are picked evenly.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+std::vector<string_view>
+hybrid_b_tree<Key, T, Compare, degree>::partition_keys(size_type n, string_view key1,
+						       string_view key2) const
+{
+	std::vector<string_view> inside;
+	if (n < 2 || !compare(key1, key2))
+		return inside;
+
+	auto &separators = index->separators;
+	auto last = separators.lower_bound(key2);
+	for (auto it = separators.upper_bound(key1); it != last; ++it)
+		inside.push_back(make_string_view(it->first));
+
+	/* there is one part more than separators */
+	auto parts = inside.size() + 1;
+	if (parts <= n)
+		return inside;
+
+	std::vector<string_view> keys;
+	for (size_type p = 1; p < n; ++p)
+		keys.push_back(inside[p * parts / n - 1]);
+
+	return keys;
+}
+
+/*
+ * Estimates number of elements in range (key1, key2). Elements of the leaves
+ * of both keys are counted exactly and the number of leaves between them is
+ * known from the index (in logarithmic time), only sizes of these leaves are
+ * estimated - as the average size of all other leaves. A leaf holds from 1 to
+ * degree - 1 elements, so the error is at most degree - 2 per leaf between.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::size_type
+hybrid_b_tree<Key, T, Compare, degree>::count_between_approx(const K &key1,
+							     const K &key2)
+{
+	if (!compare(key1, key2))
+		return 0;
+
+	auto &separators = index->separators;
+	/* leaf i has the separator at position i - 1 */
+	auto first = separators.position(separators.upper_bound(key1));
+	auto last = separators.position(separators.upper_bound(key2));
+
+	leaf_type *leaf1 = find_leaf(key1);
+	leaf_type *leaf2 = find_leaf(key2);
+	auto above = static_cast<size_type>(std::distance(
+		std::upper_bound(leaf1->cbegin(), leaf1->cend(), key1,
+				 [this](const K &key, const_reference e) {
+					 return compare(key, e.first);
+				 }),
+		leaf1->cend()));
+	auto below = static_cast<size_type>(std::distance(
+		leaf2->cbegin(),
+		static_cast<const leaf_type *>(leaf2)->lower_bound(key2, compare)));
+
+	if (first == last)
+		return above + below - leaf1->size();
+
+	auto between = last - first - 1;
+	if (between == 0)
+		return above + below;
+
+	/* there are at least 3 leaves, so there are others than leaf1 and leaf2 */
+	auto others = index->size - leaf1->size() - leaf2->size();
+	auto leaves = separators.size() + 1;
+
+	return above + below + (between * others + (leaves - 2) / 2) / (leaves - 2);
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree<Key, T, Compare, degree>::key_compare &
+hybrid_b_tree<Key, T, Compare, degree>::key_comp()
+{
+	return compare;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+const typename hybrid_b_tree<Key, T, Compare, degree>::key_compare &
+hybrid_b_tree<Key, T, Compare, degree>::key_comp() const
+{
+	return compare;
+}
+
+/* Returns separator of the leaf which may contain the key, end() for the first leaf */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::separators_type::iterator
+hybrid_b_tree<Key, T, Compare, degree>::find_separator(const K &key)
+{
+	auto &separators = index->separators;
+	auto it = separators.upper_bound(key);
+	if (it == separators.begin())
+		return separators.end();
+
+	return --it;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree<Key, T, Compare, degree>::leaf_type *
+hybrid_b_tree<Key, T, Compare, degree>::find_leaf(const K &key)
+{
+	auto replica = local_replica();
+	if (replica) {
+		auto it = replica->upper_bound(key);
+		if (it == replica->begin())
+			return head.get();
+
+		return (*--it).second;
+	}
+
+	auto sep = find_separator(key);
+	if (sep == index->separators.end())
+		return head.get();
+
+	return (*sep).second;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree<Key, T, Compare, degree>::leaf_type *
+hybrid_b_tree<Key, T, Compare, degree>::last_leaf()
+{
+	auto replica = local_replica();
+	if (replica)
+		return replica->size() == 0 ? head.get() : (*--replica->end()).second;
+
+	auto &separators = index->separators;
+	if (separators.size() == 0)
+		return head.get();
+
+	return (*--separators.end()).second;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree<Key, T, Compare, degree>::replica_type *
+hybrid_b_tree<Key, T, Compare, degree>::local_replica() const
+{
+	auto &replicas = index->replicas;
+	if (replicas.empty())
+		return nullptr;
+
+	return replicas[numa_node() % replicas.size()].get();
+}
+
+/*
+ * Copies separators of the index to a replica on every NUMA node. Each one
+ * is allocated from a pool which prefers memory of its node, so it doesn't
+ * matter which thread copies it; keys longer than std::string's inline
+ * capacity are allocated separately, by the thread which adds them.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree<Key, T, Compare, degree>::build_replicas(volatile_index &idx)
+{
+	auto nodes = numa_nodes();
+	idx.replicas.resize(nodes);
+
+	parallel_run(nodes, [&](std::size_t node) {
+		pool_allocator<char> alloc(std::make_shared<hugepage_pool>(
+			REPLICA_PAGE_SIZE, static_cast<int>(node)));
+		std::unique_ptr<replica_type> replica(
+			new replica_type(separator_compare{&compare}, alloc));
+		for (auto it = idx.separators.begin(); it != idx.separators.end(); ++it)
+			replica->emplace_hint(replica->end(), std::string(it->first),
+					      static_cast<leaf_type *>(it->second));
+
+		idx.replicas[node] = std::move(replica);
+
+		return status::OK;
+	});
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree<Key, T, Compare, degree>::add_separator(const std::string &sep,
+							   leaf_type *leaf)
+{
+	index->separators.emplace(std::string(sep), static_cast<leaf_type *>(leaf));
+	for (auto &r : index->replicas)
+		r->emplace(std::string(sep), static_cast<leaf_type *>(leaf));
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree<Key, T, Compare, degree>::remove_separator(const std::string &sep)
+{
+	index->separators.erase(sep);
+	for (auto &r : index->replicas)
+		r->erase(sep);
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename M>
+std::pair<typename hybrid_b_tree<Key, T, Compare, degree>::iterator, bool>
+hybrid_b_tree<Key, T, Compare, degree>::insert(leaf_type *leaf, K &&key, M &&obj)
+{
+	auto pos = leaf->lower_bound(key, compare);
+	/* leaf is not changed before only in a standalone insert (see insert) */
+	bool switch_idxs = pmemobj_tx_stage() == TX_STAGE_NONE;
+
+	typename leaf_type::iterator res;
+	pmem::obj::transaction::run(get_pool_base(), [&] {
+		res = leaf->insert(pos, std::forward<K>(key), std::forward<M>(obj),
+				   switch_idxs);
+	});
+	++index->size;
+
+	return std::pair<iterator, bool>(iterator(leaf, res), true);
+}
+
+/**
+ * Moves second half of the full leaf to a new one and inserts the entry in
+ * the right half - or, if the key is above all keys, inserts it into a new
+ * last leaf, leaving the full one as it is. Only leaves are changed in the
+ * transaction, separator of the new leaf is added to the DRAM index (and
+ * removed, if the transaction fails to commit).
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename M, typename F>
+std::pair<typename hybrid_b_tree<Key, T, Compare, degree>::iterator, bool>
+hybrid_b_tree<Key, T, Compare, degree>::split_leaf(leaf_type *leaf, K &&key, M &&obj,
+						  F &&moved)
+{
+	assert(leaf->full());
+	PMEMKV_PROBE1(stree__leaf_split, leaf->size());
+	slow_op_phase_scope split_phase(slow_op_phase::SPLIT);
+
+	auto pop = get_pool_base();
+	leaf_pptr split_leaf(leaf);
+	leaf_pptr node;
+	std::pair<iterator, bool> result(nullptr, false);
+	auto middle = leaf->begin() + leaf->size() / 2;
+	bool less = compare(key, middle->first);
+	bool append = !leaf->get_next() && compare(leaf->back().first, key);
+	auto k = make_string_view(key);
+	std::string sep = append ? std::string(k.data(), k.size()) : separator(middle->first);
+	auto moved_from = append ? std::vector<const value_type *>()
+				 : split_moved_entries(*leaf);
+	bool indexed = false;
+
+	try {
+		pmem::obj::transaction::run(pop, [&] {
+			node = make_persistent<leaf_type>(
+				node_alloc_flag<leaf_type>(this));
+			if (!append)
+				node->move(pop, split_leaf, compare);
+
+			auto target = (less && !append) ? leaf : node.get();
+			auto pos = target->lower_bound(key, compare);
+			result = std::pair<iterator, bool>(
+				iterator(target,
+					 target->insert(pos, std::forward<K>(key),
+							std::forward<M>(obj))),
+				true);
+
+			node->set_next(split_leaf->get_next());
+			node->set_prev(split_leaf);
+			if (split_leaf->get_next())
+				split_leaf->get_next()->set_prev(node);
+			split_leaf->set_next(node);
+
+			indexed = true;
+			add_separator(sep, node.get());
+		});
+	} catch (...) {
+		if (indexed)
+			remove_separator(sep);
+		throw;
+	}
+	++index->size;
+	report_split_moves(moved_from, *node, &*result.first, moved);
+
+	return result;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+std::string hybrid_b_tree<Key, T, Compare, degree>::separator(const key_type &key)
+{
+	auto k = make_string_view(key);
+	return std::string(k.data(), k.size());
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+pool_base hybrid_b_tree<Key, T, Compare, degree>::get_pool_base() const
+{
+	return pool_base(pmemobj_pool_by_ptr(this));
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_HYBRID_B_TREE_H */
@@ -11,12 +11,21 @@
 #include <libpmemobj++/pool.hpp>
 #include <libpmemobj++/transaction.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <numeric>
 #include <type_traits>
 #include <vector>
 
 #include <cassert>
 
+#include "../../comparator/comparator.h"
+#include "../../exceptions.h"
+#include "../../fast_hash.h"
+#include "../../pool_persistence.h"
+#include "../../stats.h"
+#include "../../trace.h"
+
 namespace pmem
 {
 namespace kv
@@ -26,6 +35,20 @@ namespace internal
 
 using namespace pmem::obj;
 
+/*
+ * Returns the flag of allocations of nodes of the given type in the pool of
+ * ptr - they are allocated from the class registered by the engine (see
+ * pool_persistence.h), if there is one.
+ */
+template <typename Node>
+inline allocation_flag node_alloc_flag(const void *ptr) noexcept
+{
+	if (alloc_class_pools.load(std::memory_order_relaxed) == 0)
+		return allocation_flag::none();
+
+	return alloc_class_flag(pmemobj_pool_by_ptr(ptr), sizeof(Node));
+}
+
 /**
  * Base node type for inner and leaf node types
  */
@@ -129,7 +152,7 @@ public:
 
 	void move(pool_base &pop, persistent_ptr<leaf_node_t> other, const key_compare &);
 	template <typename K, typename M>
-	iterator insert(iterator idxs_pos, K &&key, M &&obj);
+	iterator insert(iterator idxs_pos, K &&key, M &&obj, bool switch_idxs = false);
 
 	template <typename K>
 	iterator find(const K &key, const key_compare &);
@@ -137,9 +160,14 @@ public:
 	const_iterator find(const K &key, const key_compare &) const;
 	template <typename K>
 	iterator lower_bound(const K &key, const key_compare &comp);
+	template <typename K>
+	const_iterator lower_bound(const K &key, const key_compare &comp) const;
 
 	template <typename K>
 	size_type erase(pool_base &pop, const K &key, const key_compare &);
+	template <typename K>
+	size_type erase_between(pool_base &pop, const K &key1, const K &key2,
+				const key_compare &);
 
 	iterator begin();
 	const_iterator begin() const;
@@ -160,29 +188,87 @@ public:
 	const persistent_ptr<leaf_node_t> &get_prev() const;
 	void set_prev(const persistent_ptr<leaf_node_t> &p);
 
+	void prefetch() const;
+	void prefetch_keys() const;
+
+	/* keys up to this size are kept whole in the key block */
+	static constexpr size_type inline_key_size = 24;
+
 private:
+	/* fingerprints are compared in 8 byte words */
+	static constexpr size_type fingerprints_size = (capacity + 7) / 8 * 8;
+	/* bit of state which selects the current copy of idxs */
+	static constexpr uint64_t current_bit = uint64_t(1) << 63;
+
+	/* one byte hashes of keys, indexed as entries (see find_binary) */
+	uint8_t fingerprints[fingerprints_size];
+	/* sizes of keys (capped at inline_key_size + 1) and their first
+	 * inline_key_size bytes, indexed as entries (see compare_binary) */
+	uint8_t key_sizes[capacity];
+	char key_block[capacity][inline_key_size];
 	/* uninitialized static array of value_type is used to avoid entries
 	 * default initialization and to avoid additional allocations */
 	union {
 		value_type entries[capacity];
 	};
-	/* array of indexes to support ordering */
-	pmem::obj::array<difference_type, capacity> idxs;
-	pmem::obj::p<size_type> _size;
+	/* two copies of the array of indexes to support ordering, the highest
+	 * bit of state selects the current one */
+	difference_type idxs[2][capacity];
+	/* number of entries and the current copy of idxs, in a single word */
+	pmem::obj::p<uint64_t> state;
 	/* persistent pointers to the neighboring leafs */
 	pmem::obj::persistent_ptr<leaf_node_t> prev;
 	pmem::obj::persistent_ptr<leaf_node_t> next;
 
 	/* private helper methods */
+	static uint8_t fingerprint(string_view key);
+	size_type find_binary(string_view key) const;
+	size_type lower_bound_binary(string_view key) const;
+	int compare_binary(difference_type slot, string_view key) const;
+	void set_inline_key(difference_type slot, string_view key);
 	template <typename... Args>
 	pointer emplace(difference_type pos, Args &&... args);
-	size_type insert_idx(const_iterator pos);
+	difference_type free_slot() const;
+	size_type insert_idx(const_iterator pos, difference_type slot, bool switch_idxs);
 	void remove_idx(size_type idx);
+	const difference_type *current_idxs() const;
+	difference_type *current_idxs();
+	void set_size(size_type n);
 	void internal_erase(pool_base &pop, iterator it);
 	bool is_sorted(const key_compare &);
 	void add_to_tx(size_type begin, size_type end);
 }; /* class leaf_node_t */
 
+/**
+ * Appends elements, passed in strictly increasing order of keys, to a chain
+ * of new linked leaves, filling each of them up to 'fill' elements. It's used
+ * to bulk load trees, so it must be used in a single transaction scope.
+ */
+template <typename LeafType>
+class leaf_chain_builder {
+public:
+	using leaf_type = LeafType;
+	using leaf_pptr = persistent_ptr<leaf_type>;
+	using key_compare = typename leaf_type::key_compare;
+	using size_type = typename leaf_type::size_type;
+
+	leaf_chain_builder(const key_compare &comp, size_type fill,
+			   allocation_flag leaf_flag = allocation_flag::none());
+
+	template <typename K, typename M>
+	void push_back(K &&key, M &&obj);
+
+	const std::vector<leaf_pptr> &leaves() const;
+	size_type size() const;
+
+private:
+	const key_compare &comp;
+	size_type fill;
+	allocation_flag leaf_flag;
+	size_type _size = 0;
+	std::vector<leaf_pptr> _leaves;
+}; /* class leaf_chain_builder */
+
 template <typename Key, typename Compare, uint64_t capacity>
 class inner_node_t : public node_t {
 private:
@@ -209,6 +295,8 @@ public:
 	inner_node_t(size_type level);
 	inner_node_t(size_type level, const_reference key, const node_pptr &first_child,
 		     const node_pptr &second_child);
+	inner_node_t(size_type level, const node_pptr *first_child,
+		     const node_pptr *last_child, const key_type *const *child_keys);
 	~inner_node_t();
 
 	iterator move(pool_base &pop, inner_node_t &other, key_pptr &partition_key);
@@ -216,6 +304,8 @@ public:
 	void replace(iterator it, const K &key);
 	void delete_with_child(iterator it, bool left);
 	void inherit_child(iterator it, node_pptr &child, bool left);
+	void assign(const node_pptr *first_child, const node_pptr *last_child,
+		    const key_type *const *child_keys);
 	void update_splitted_child(pool_base &pop, const_reference key,
 				   node_pptr &left_child, node_pptr &right_child,
 				   const key_compare &);
@@ -228,6 +318,9 @@ public:
 	const node_pptr &get_child(const_reference key, const key_compare &) const;
 	const node_pptr &get_left_child(const_iterator it) const;
 	const node_pptr &get_right_child(const_iterator it) const;
+	const node_pptr &child_at(size_type pos) const;
+	template <typename K>
+	size_type upper_bound_idx(const K &key, const key_compare &) const;
 
 	bool full() const;
 
@@ -243,13 +336,22 @@ public:
 	reference operator[](size_type pos);
 	const_reference operator[](size_type pos) const;
 
+	void prefetch() const;
+
 private:
 	key_pptr entries[capacity];
 	node_pptr children[capacity + 1];
 	pmem::obj::p<size_type> _size = 0;
+	/* length of the prefix, which all keys of the node share */
+	pmem::obj::p<size_type> prefix_size = 0;
+	/* 8 bytes of each key after the common prefix (see key_head) */
+	uint64_t heads[capacity];
 
 	pool_base get_pool() const noexcept;
 	bool is_sorted(const key_compare &);
+	static uint64_t key_head(string_view key, size_type offset);
+	void update_heads();
+	size_type upper_bound_binary(string_view key) const;
 }; /* class inner_node_t */
 
 template <typename LeafType, bool is_const>
@@ -288,6 +390,19 @@ public:
 	reference operator*() const;
 	pointer operator->() const;
 
+	/*
+	 * Same as comparing with begin() and end() of the tree, which descend
+	 * from the root, but only checks the current leaf.
+	 */
+	bool is_begin() const;
+	bool is_end() const;
+
+	/* leaf of the current element */
+	leaf_node_ptr node() const
+	{
+		return current_node;
+	}
+
 private:
 	leaf_node_ptr current_node;
 	leaf_iterator leaf_it;
@@ -327,27 +442,46 @@ public:
 	using reverse_iterator = std::reverse_iterator<iterator>;
 	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
+	using bulk_builder = leaf_chain_builder<leaf_type>;
+
 	b_tree_base();
 	~b_tree_base();
 
 	template <typename K, typename M>
 	std::pair<iterator, bool> try_emplace(K &&key, M &&obj);
+	template <typename K, typename M, typename F>
+	std::pair<iterator, bool> try_emplace(K &&key, M &&obj, F &&moved);
+
+	template <typename F>
+	void bulk_load(F &&source);
 
 	template <typename K>
 	iterator find(const K &key);
 	template <typename K>
 	const_iterator find(const K &key) const;
+	template <typename K, typename F>
+	void find_sorted(const K *keys, size_type n, F &&found);
+	template <typename K, typename F>
+	void find_interleaved(const K *keys, size_type n, F &&found);
 	template <typename K>
 	iterator lower_bound(const K &key);
 	template <typename K>
 	const_iterator lower_bound(const K &key) const;
 	template <typename K>
+	iterator lower_bound(const K &key, const iterator &hint);
+	template <typename K>
 	iterator upper_bound(const K &key);
 	template <typename K>
 	const_iterator upper_bound(const K &key) const;
+	template <typename K>
+	iterator upper_bound(const K &key, const iterator &hint);
 
 	template <typename K>
 	size_type erase(const K &key);
+	template <typename K, typename F>
+	size_type erase(const K &key, F &&visit);
+	template <typename K>
+	size_type erase_between(const K &key1, const K &key2);
 
 	iterator begin();
 	iterator end();
@@ -360,6 +494,21 @@ public:
 
 	size_type size() const noexcept;
 
+	/* Shape of the tree, computed by walking over all leaves */
+	struct tree_stats {
+		size_type depth = 0;
+		size_type leaves = 0;
+		size_type leaf_capacity = node_capacity;
+	};
+	tree_stats stats() const;
+
+	std::vector<string_view> partition_keys(size_type n) const;
+	std::vector<string_view> partition_keys(size_type n, string_view key1,
+						string_view key2) const;
+
+	template <typename K>
+	size_type count_between_approx(const K &key1, const K &key2) const;
+
 	reference operator[](size_type pos);
 	const_reference operator[](size_type pos) const;
 
@@ -367,6 +516,13 @@ public:
 	const key_compare &key_comp() const;
 
 private:
+	/* bulk loaded nodes are 3/4 full, so next inserts don't split them at once */
+	const static std::size_t BULK_LOAD_FILL = node_capacity - node_capacity / 4;
+	/* number of lookups in flight in find_interleaved() */
+	const static std::size_t INTERLEAVED_LOOKUPS = 16;
+	/* number of leaves searched by bounds with a hint, before a descent */
+	const static std::size_t FINGER_SEARCH_LEAVES = 4;
+
 	node_pptr root;
 	node_pptr split_node;
 	node_pptr left_child;
@@ -375,6 +531,10 @@ private:
 	pmem::obj::p<size_type> _size;
 
 	const key_type &get_last_key(const node_pptr &node);
+	template <typename K>
+	double estimate_position(const K &key, bool above) const;
+	template <typename Keep>
+	std::vector<string_view> partition_subtrees(size_type n, Keep &&keep) const;
 	leaf_type *leftmost_leaf() const;
 	leaf_type *rightmost_leaf() const;
 
@@ -385,13 +545,13 @@ private:
 	void split_inner_node(pool_base &pop, inner_pptr &src_node);
 	void split_inner_node(pool_base &pop, inner_pptr &src_node,
 			      inner_type *parent_node);
-	template <typename K, typename M>
+	template <typename K, typename M, typename F>
 	std::pair<iterator, bool> split_leaf_node(pool_base &pop, leaf_pptr &split_leaf,
-						  K &&key, M &&obj);
-	template <typename K, typename M>
+						  K &&key, M &&obj, F &&moved);
+	template <typename K, typename M, typename F>
 	std::pair<iterator, bool> split_leaf_node(pool_base &pop, inner_type *parent_node,
-						  leaf_pptr &split_leaf, K &&key,
-						  M &&obj);
+						  leaf_pptr &split_leaf, K &&key, M &&obj,
+						  F &&moved);
 
 	leaf_type *find_leaf_node(const key_type &key) const;
 	template <typename K>
@@ -402,6 +562,8 @@ private:
 	template <typename K, typename M>
 	std::pair<iterator, bool> internal_insert(leaf_pptr leaf, K &&key, M &&obj);
 	template <typename K>
+	bool is_append(const leaf_pptr &leaf, const K &key) const;
+	template <typename K>
 	leaf_pptr get_path_ext(const K &key, std::vector<inner_pair> &path,
 			       std::vector<std::pair<node_pptr, node_pptr>> &neighbors,
 			       inner_pair &inner_ptr);
@@ -411,6 +573,19 @@ private:
 			      std::pair<node_pptr, node_pptr> &neighbors,
 			      bool has_left_sibling);
 
+	/* neighbors of the contiguous run of leaves freed by erase_between() */
+	struct removed_leaves {
+		bool any = false;
+		leaf_pptr prev;
+		leaf_pptr next;
+	};
+	template <typename K>
+	size_type erase_range(node_pptr &node, const K &key1, const K &key2, bool above,
+			      bool below, removed_leaves &removed);
+	size_type free_subtree(node_pptr &node, removed_leaves &removed);
+	void remove_leaf(leaf_pptr &leaf, removed_leaves &removed);
+	static const key_type &get_first_key(const node_pptr &node);
+
 	static inner_pptr &cast_inner(node_pptr &node);
 	static inner_type *cast_inner(node_t *node);
 	static leaf_pptr &cast_leaf(node_pptr &node);
@@ -589,8 +764,10 @@ template <typename Key, typename T, typename Compare, uint64_t capacity>
 leaf_node_t<Key, T, Compare, capacity>::leaf_node_t() : node_t()
 {
 	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
-	std::iota(idxs.begin(), idxs.end(), 0);
-	_size = 0;
+	std::iota(idxs[0], idxs[0] + capacity, 0);
+	std::iota(idxs[1], idxs[1] + capacity, 0);
+	std::fill(fingerprints, fingerprints + fingerprints_size, 0);
+	state = 0;
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -637,8 +814,8 @@ void leaf_node_t<Key, T, Compare, capacity>::move(pool_base &pop,
 		while (temp != last) {
 			emplace(count++, *temp++);
 		}
-		_size = static_cast<size_type>(count);
-		other->_size -= static_cast<size_type>(count);
+		set_size(static_cast<size_type>(count));
+		other->set_size(other->size() - static_cast<size_type>(count));
 	});
 	assert(std::distance(begin(), end()) > 0);
 	assert(is_sorted(comp));
@@ -649,31 +826,53 @@ template <typename K>
 typename leaf_node_t<Key, T, Compare, capacity>::iterator
 leaf_node_t<Key, T, Compare, capacity>::lower_bound(const K &key, const key_compare &comp)
 {
+	if (comp.is_binary())
+		return iterator(this, lower_bound_binary(make_string_view(key)));
+
 	return std::lower_bound(
 		begin(), end(), key,
 		[&comp](const_reference e, const K &key) { return comp(e.first, key); });
 }
 
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+typename leaf_node_t<Key, T, Compare, capacity>::const_iterator
+leaf_node_t<Key, T, Compare, capacity>::lower_bound(const K &key,
+						    const key_compare &comp) const
+{
+	if (comp.is_binary())
+		return const_iterator(this, lower_bound_binary(make_string_view(key)));
+
+	return std::lower_bound(
+		cbegin(), cend(), key,
+		[&comp](const_reference e, const K &key) { return comp(e.first, key); });
+}
+
 /**
  * Inserts element into the leaf in a sorted way specified by idxs_pos.
  *
+ * With switch_idxs set, the new order is written to the other copy of idxs,
+ * which is then made current by a single update of the state word. Neither the
+ * entry nor idxs are snapshotted then, so the insert is undone (on abort or
+ * after a crash) by the undo log of that word only. It may be used only if
+ * the leaf wasn't changed before in the same transaction (the other copy of
+ * idxs must not be the one which was current when the transaction started).
+ *
  * @pre key must not already exist in the leaf.
  */
 template <typename Key, typename T, typename Compare, uint64_t capacity>
 template <typename K, typename M>
 typename leaf_node_t<Key, T, Compare, capacity>::iterator
-leaf_node_t<Key, T, Compare, capacity>::insert(iterator idxs_pos, K &&key, M &&obj)
+leaf_node_t<Key, T, Compare, capacity>::insert(iterator idxs_pos, K &&key, M &&obj,
+					       bool switch_idxs)
 {
 	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
 	assert(!full());
-	difference_type insert_pos = idxs[size()];
-	assert(std::none_of(
-		idxs.cdata(), idxs.cdata() + size(),
-		[&insert_pos](difference_type idx) { return insert_pos == idx; }));
-	// insert an entry to the end
-	emplace(insert_pos, std::forward<K>(key), std::forward<M>(obj));
+	difference_type slot = free_slot();
+	// construct an entry in a free slot
+	emplace(slot, std::forward<K>(key), std::forward<M>(obj));
 	// update idxs & return iterator
-	return iterator(this, insert_idx(idxs_pos));
+	return iterator(this, insert_idx(idxs_pos, slot, switch_idxs));
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -681,6 +880,9 @@ template <typename K>
 typename leaf_node_t<Key, T, Compare, capacity>::iterator
 leaf_node_t<Key, T, Compare, capacity>::find(const K &key, const key_compare &comp)
 {
+	if (comp.is_binary())
+		return iterator(this, find_binary(make_string_view(key)));
+
 	iterator it = lower_bound(key, comp);
 	if (it != end() && (!comp(it->first, key) && !comp(key, it->first))) {
 		return it;
@@ -694,6 +896,9 @@ template <typename K>
 typename leaf_node_t<Key, T, Compare, capacity>::const_iterator
 leaf_node_t<Key, T, Compare, capacity>::find(const K &key, const key_compare &comp) const
 {
+	if (comp.is_binary())
+		return const_iterator(this, find_binary(make_string_view(key)));
+
 	const_iterator it = lower_bound(key, comp);
 	if (it != cend() && (!comp(it->first, key) && !comp(key, it->first))) {
 		return it;
@@ -716,6 +921,35 @@ leaf_node_t<Key, T, Compare, capacity>::erase(pool_base &pop, const K &key,
 	return size_type(1);
 }
 
+/**
+ * Erases entries with keys in range (key1, key2), returns their number.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+typename leaf_node_t<Key, T, Compare, capacity>::size_type
+leaf_node_t<Key, T, Compare, capacity>::erase_between(pool_base &pop, const K &key1,
+						      const K &key2,
+						      const key_compare &comp)
+{
+	size_type first = 0;
+	while (first < size() && !comp(key1, (*this)[first].first))
+		++first;
+	size_type last = first;
+	while (last < size() && comp((*this)[last].first, key2))
+		++last;
+
+	if (first == last)
+		return 0;
+
+	pmem::obj::transaction::run(pop, [&] {
+		for (size_type i = last; i > first; --i)
+			internal_erase(pop, begin() + (i - 1));
+	});
+	assert(is_sorted(comp));
+
+	return last - first;
+}
+
 /**
  * Return begin iterator on an array of correct indices.
  */
@@ -783,7 +1017,7 @@ template <typename Key, typename T, typename Compare, uint64_t capacity>
 typename leaf_node_t<Key, T, Compare, capacity>::size_type
 leaf_node_t<Key, T, Compare, capacity>::size() const
 {
-	return _size;
+	return static_cast<size_type>(state.get_ro() & ~current_bit);
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -796,14 +1030,14 @@ template <typename Key, typename T, typename Compare, uint64_t capacity>
 typename leaf_node_t<Key, T, Compare, capacity>::const_reference
 leaf_node_t<Key, T, Compare, capacity>::front() const
 {
-	return entries[idxs[0]];
+	return entries[current_idxs()[0]];
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
 typename leaf_node_t<Key, T, Compare, capacity>::const_reference
 leaf_node_t<Key, T, Compare, capacity>::back() const
 {
-	return entries[idxs[size() - 1]];
+	return entries[current_idxs()[size() - 1]];
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -811,7 +1045,7 @@ typename leaf_node_t<Key, T, Compare, capacity>::reference
 	leaf_node_t<Key, T, Compare, capacity>::operator[](size_type pos)
 {
 	assert(pos <= size());
-	return entries[idxs[pos]];
+	return entries[current_idxs()[pos]];
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -819,7 +1053,7 @@ typename leaf_node_t<Key, T, Compare, capacity>::const_reference
 	leaf_node_t<Key, T, Compare, capacity>::operator[](size_type pos) const
 {
 	assert(pos <= size());
-	return entries[idxs[pos]];
+	return entries[current_idxs()[pos]];
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -851,7 +1085,145 @@ void leaf_node_t<Key, T, Compare, capacity>::set_prev(
 }
 
 /**
- * Constructs value_type in position 'pos' of entries with arguments 'args'.
+ * Prefetches the whole node, so reading its entries (and links) later doesn't
+ * wait for the media.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+void leaf_node_t<Key, T, Compare, capacity>::prefetch() const
+{
+	auto p = reinterpret_cast<const char *>(this);
+	for (std::size_t off = 0; off < sizeof(*this); off += 64)
+		__builtin_prefetch(p + off);
+}
+
+/**
+ * Prefetches data of keys (for keys which are not stored inline it's another
+ * allocation). Entries are read, so the node should be prefetched already.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+void leaf_node_t<Key, T, Compare, capacity>::prefetch_keys() const
+{
+	for (size_type i = 0; i < size(); ++i)
+		__builtin_prefetch(make_string_view((*this)[i].first).data());
+}
+
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+uint8_t leaf_node_t<Key, T, Compare, capacity>::fingerprint(string_view key)
+{
+	return static_cast<uint8_t>(fast_hash(key.size(), key.data()));
+}
+
+/**
+ * Returns position of the key (or size() if it's not found), comparing keys
+ * only in slots with matching fingerprints, so usually just one key is read.
+ * Keys are compared byte by byte, it can be used only by binary comparator.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+typename leaf_node_t<Key, T, Compare, capacity>::size_type
+leaf_node_t<Key, T, Compare, capacity>::find_binary(string_view key) const
+{
+	const uint64_t lows = 0x0101010101010101ULL;
+	auto fp = fingerprint(key);
+
+	for (size_type w = 0; w < fingerprints_size; w += 8) {
+		uint64_t word;
+		std::memcpy(&word, fingerprints + w, sizeof(word));
+
+		/* may report false positives (above a real match), keys are compared */
+		auto x = word ^ (lows * fp);
+		auto matches = (x - lows) & ~x & (lows << 7);
+
+		for (; matches != 0; matches &= matches - 1) {
+			auto slot = w +
+				static_cast<size_type>(__builtin_ctzll(matches)) / 8;
+			if (slot >= capacity)
+				break;
+
+			/* fingerprints of free slots are stale, their keys destroyed */
+			auto first = current_idxs();
+			auto last = first + size();
+			auto it = std::find(first, last,
+					    static_cast<difference_type>(slot));
+			if (it == last)
+				continue;
+
+			if (compare_binary(static_cast<difference_type>(slot), key) == 0)
+				return static_cast<size_type>(it - first);
+		}
+	}
+
+	return size();
+}
+
+/**
+ * Returns position of the first key not less than 'key', in binary order.
+ * The search reads only idxs and the key block, keys longer than
+ * inline_key_size are read from entries to break ties.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+typename leaf_node_t<Key, T, Compare, capacity>::size_type
+leaf_node_t<Key, T, Compare, capacity>::lower_bound_binary(string_view key) const
+{
+	auto cur = current_idxs();
+	size_type lo = 0, hi = size();
+	while (lo < hi) {
+		auto mid = lo + (hi - lo) / 2;
+		if (compare_binary(cur[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * Compares the key in 'slot' with 'key' (as std::string::compare). Only if both
+ * are longer than inline_key_size and their inline bytes are equal, the key
+ * of the entry is read.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+int leaf_node_t<Key, T, Compare, capacity>::compare_binary(difference_type slot,
+							   string_view key) const
+{
+	size_type stored = key_sizes[slot];
+	auto n = std::min(std::min(stored, key.size()), inline_key_size);
+	int c = n > 0 ? std::memcmp(key_block[slot], key.data(), n) : 0;
+	if (c != 0)
+		return c;
+
+	/* one of the keys ends within the inline bytes, they decide */
+	if (stored <= inline_key_size || key.size() <= inline_key_size)
+		return stored < key.size() ? -1 : (stored > key.size() ? 1 : 0);
+
+	return make_string_view(entries[slot].first).compare(key);
+}
+
+/**
+ * Stores the size and the first bytes of the key of a new entry in 'slot'.
+ * Like its fingerprint, it's not snapshotted, as the slot is free.
+ *
+ * @pre must be called in a transaction scope.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+void leaf_node_t<Key, T, Compare, capacity>::set_inline_key(difference_type slot,
+							    string_view key)
+{
+	pmemobj_tx_xadd_range_direct(key_sizes + slot, sizeof(uint8_t),
+				     POBJ_XADD_NO_SNAPSHOT);
+	key_sizes[slot] =
+		static_cast<uint8_t>(std::min(key.size(), inline_key_size + 1));
+
+	pmemobj_tx_xadd_range_direct(key_block[slot], inline_key_size,
+				     POBJ_XADD_NO_SNAPSHOT);
+	auto n = std::min(key.size(), inline_key_size);
+	std::memcpy(key_block[slot], key.data(), n);
+	std::memset(key_block[slot] + n, 0, inline_key_size - n);
+}
+
+/**
+ * Constructs value_type in position 'pos' of entries with arguments 'args'
+ * and sets its fingerprint.
  *
  * @pre must be called in a transaction scope.
  */
@@ -864,33 +1236,72 @@ leaf_node_t<Key, T, Compare, capacity>::emplace(difference_type pos, Args &&...
 	/* to avoid snapshotting of an uninitialized memory */
 	pmemobj_tx_xadd_range_direct(entries + pos, sizeof(value_type),
 				     POBJ_XADD_NO_SNAPSHOT);
-	return new (entries + pos) value_type(std::forward<Args>(args)...);
+	auto entry = new (entries + pos) value_type(std::forward<Args>(args)...);
+
+	/* fingerprint of a free slot isn't used, so it's not snapshotted either */
+	pmemobj_tx_xadd_range_direct(fingerprints + pos, sizeof(uint8_t),
+				     POBJ_XADD_NO_SNAPSHOT);
+	fingerprints[pos] = fingerprint(make_string_view(entry->first));
+	set_inline_key(pos, make_string_view(entry->first));
+
+	return entry;
+}
+
+/**
+ * Returns a slot of entries which is not used by any element.
+ *
+ * @pre !full()
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+typename leaf_node_t<Key, T, Compare, capacity>::difference_type
+leaf_node_t<Key, T, Compare, capacity>::free_slot() const
+{
+	bool used[capacity] = {};
+	auto cur = current_idxs();
+	for (size_type i = 0; i < size(); ++i)
+		used[cur[i]] = true;
+
+	return std::find(used, used + capacity, false) - used;
 }
 
 /**
- * Replaces index of newly allocated on position idxs[size()] element in sorted order.
+ * Puts index of a newly constructed element (in 'slot') in sorted order.
  *
  * @param pos - position in sorted idxs array where entry must reside.
+ * @param switch_idxs - write the order to the other copy of idxs (see insert).
  *
  * @pre must be used right after addition of a new entry
- * @pre new entry must be added into idxs[size()] position
  */
 template <typename Key, typename T, typename Compare, uint64_t capacity>
 typename leaf_node_t<Key, T, Compare, capacity>::size_type
-leaf_node_t<Key, T, Compare, capacity>::insert_idx(const_iterator pos)
+leaf_node_t<Key, T, Compare, capacity>::insert_idx(const_iterator pos,
+						   difference_type slot,
+						   bool switch_idxs)
 {
 	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
-	difference_type new_entry_idx = idxs[size()];
 
 	auto idx_pos = static_cast<size_type>(std::distance(cbegin(), pos));
-	auto slice = idxs.range(idx_pos, size() - idx_pos);
-	auto to_insert = std::copy_backward(slice.begin(), slice.end(), slice.end() + 1);
-	*(--to_insert) = new_entry_idx;
-	++_size;
+	auto cur = current_idxs();
+	auto n = size();
+
+	if (switch_idxs) {
+		auto other = idxs[(state.get_ro() & current_bit) ? 0 : 1];
+		/* the other copy isn't used, it's not snapshotted */
+		pmemobj_tx_xadd_range_direct(other, sizeof(difference_type) * (n + 1),
+					     POBJ_XADD_NO_SNAPSHOT);
+		std::copy(cur, cur + idx_pos, other);
+		other[idx_pos] = slot;
+		std::copy(cur + idx_pos, cur + n, other + idx_pos + 1);
+		state = (state.get_ro() ^ current_bit) + 1;
+	} else {
+		pmemobj_tx_add_range_direct(cur + idx_pos,
+					    sizeof(difference_type) * (n - idx_pos + 1));
+		std::copy_backward(cur + idx_pos, cur + n, cur + n + 1);
+		cur[idx_pos] = slot;
+		set_size(n + 1);
+	}
 
-	size_type result = static_cast<size_type>(to_insert - idxs.cbegin());
-	assert(result >= 0);
-	return result;
+	return idx_pos;
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -899,11 +1310,35 @@ void leaf_node_t<Key, T, Compare, capacity>::remove_idx(size_type idx)
 	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
 	assert(size() > 0);
 
-	difference_type to_replace = idxs[idx];
-	auto slice = idxs.range(idx, size() - idx);
-	auto replace_pos = std::copy(slice.begin() + 1, slice.end(), slice.begin());
-	*replace_pos = to_replace;
-	--_size;
+	auto cur = current_idxs();
+	pmemobj_tx_add_range_direct(cur + idx, sizeof(difference_type) * (size() - idx));
+	std::copy(cur + idx + 1, cur + size(), cur + idx);
+	set_size(size() - 1);
+}
+
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+const typename leaf_node_t<Key, T, Compare, capacity>::difference_type *
+leaf_node_t<Key, T, Compare, capacity>::current_idxs() const
+{
+	return idxs[(state.get_ro() & current_bit) ? 1 : 0];
+}
+
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+typename leaf_node_t<Key, T, Compare, capacity>::difference_type *
+leaf_node_t<Key, T, Compare, capacity>::current_idxs()
+{
+	return idxs[(state.get_ro() & current_bit) ? 1 : 0];
+}
+
+/**
+ * Sets number of entries, the current copy of idxs is not changed.
+ *
+ * @pre must be called in a transaction scope.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+void leaf_node_t<Key, T, Compare, capacity>::set_size(size_type n)
+{
+	state = (state.get_ro() & current_bit) | n;
 }
 
 /**
@@ -942,6 +1377,168 @@ void leaf_node_t<Key, T, Compare, capacity>::add_to_tx(size_type begin, size_typ
 				     POBJ_XADD_ASSUME_INITIALIZED);
 }
 
+// -------------------------------------------------------------------------------------
+// --------------------------------- leaf_chain_builder --------------------------------
+// -------------------------------------------------------------------------------------
+
+template <typename LeafType>
+leaf_chain_builder<LeafType>::leaf_chain_builder(const key_compare &comp, size_type fill,
+						 allocation_flag leaf_flag)
+    : comp(comp), fill(fill), leaf_flag(leaf_flag)
+{
+	assert(fill > 0);
+}
+
+/**
+ * Appends the entry to the last leaf, or to a new one linked after it, if
+ * the last leaf is already filled. Entries are written one after another,
+ * so leaves are filled sequentially and none of them is snapshotted.
+ *
+ * @throw internal::invalid_argument if the key is not greater than the last one.
+ */
+template <typename LeafType>
+template <typename K, typename M>
+void leaf_chain_builder<LeafType>::push_back(K &&key, M &&obj)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+	if (!_leaves.empty() && !comp(_leaves.back()->back().first, key))
+		throw internal::invalid_argument(
+			"Keys of bulk load are not in strictly increasing order");
+
+	if (_leaves.empty() || _leaves.back()->size() == fill) {
+		leaf_pptr leaf = make_persistent<leaf_type>(leaf_flag);
+		if (!_leaves.empty()) {
+			leaf->set_prev(_leaves.back());
+			_leaves.back()->set_next(leaf);
+		}
+		_leaves.push_back(leaf);
+	}
+
+	leaf_pptr &leaf = _leaves.back();
+	leaf->insert(leaf->end(), std::forward<K>(key), std::forward<M>(obj));
+	++_size;
+}
+
+template <typename LeafType>
+const std::vector<typename leaf_chain_builder<LeafType>::leaf_pptr> &
+leaf_chain_builder<LeafType>::leaves() const
+{
+	return _leaves;
+}
+
+template <typename LeafType>
+typename leaf_chain_builder<LeafType>::size_type
+leaf_chain_builder<LeafType>::size() const
+{
+	return _size;
+}
+
+/**
+ * Returns addresses of entries, in order of keys, which are moved from the
+ * full leaf to a new one by its split (see leaf_node_t::move()).
+ */
+template <typename LeafType>
+std::vector<const typename LeafType::value_type *> split_moved_entries(LeafType &leaf)
+{
+	assert(leaf.full());
+	std::vector<const typename LeafType::value_type *> from;
+	from.reserve(leaf.size() - leaf.size() / 2);
+	for (auto it = leaf.begin() + leaf.size() / 2; it != leaf.end(); ++it)
+		from.push_back(&*it);
+
+	return from;
+}
+
+/**
+ * Passes to 'moved' the old and the new address of each entry moved to the
+ * new leaf 'node' by a split - 'from' are the old ones, taken before it by
+ * split_moved_entries(). The entry 'inserted' by the split is skipped.
+ */
+template <typename LeafType, typename F>
+void report_split_moves(const std::vector<const typename LeafType::value_type *> &from,
+			LeafType &node, const typename LeafType::value_type *inserted,
+			F &&moved)
+{
+	auto old = from.begin();
+	for (auto it = node.begin(); it != node.end(); ++it) {
+		if (&*it == inserted)
+			continue;
+		assert(old != from.end());
+		moved(*old++, &*it);
+	}
+}
+
+/**
+ * Looks up 'n' keys, passed in non-decreasing order, calling found(i, entry)
+ * for each present one. A key not above the last key of the leaf of the
+ * previous one is in that leaf (if anywhere), a key not above the last key of
+ * the next leaf is in the next one; only other keys are found by 'descend',
+ * which returns the leaf of a key.
+ */
+template <typename LeafType, typename K, typename Descend, typename F>
+void find_sorted_in_leaves(const K *keys, std::size_t n,
+			   const typename LeafType::key_compare &comp, Descend &&descend,
+			   F &&found)
+{
+	LeafType *leaf = nullptr;
+	for (std::size_t i = 0; i < n; ++i) {
+		/* only the root leaf can be empty */
+		if (leaf && (leaf->size() == 0 || comp(leaf->back().first, keys[i]))) {
+			LeafType *next = leaf->get_next().get();
+			leaf = (next && !comp(next->back().first, keys[i])) ? next : nullptr;
+		}
+		if (!leaf)
+			leaf = descend(keys[i]);
+
+		auto it = leaf->find(keys[i], comp);
+		if (it != leaf->end())
+			found(i, *it);
+	}
+}
+
+/**
+ * Finger search of the lower bound of 'key' (or of the upper bound, if
+ * 'upper') from 'hint', which must not be greater than the key. The bound is
+ * looked for in the hint's leaf and in the next ones, up to 'max_leaves'
+ * leaves; returns false (and the caller descends from the root) if it's
+ * further, or if the hint is the end or is greater than the key.
+ */
+template <typename Iterator, typename K, typename Compare>
+bool bound_from_hint(const Iterator &hint, const K &key, bool upper,
+		     const Compare &comp, std::size_t max_leaves, Iterator &result)
+{
+	if (hint.is_end() || comp(key, hint->first))
+		return false;
+
+	using leaf_type = typename std::remove_pointer<decltype(hint.node())>::type;
+	auto less = [&](const K &k, const typename leaf_type::value_type &e) {
+		return comp(k, e.first);
+	};
+
+	leaf_type *leaf = hint.node();
+	for (std::size_t i = 0; i < max_leaves; ++i) {
+		/* only the root leaf can be empty */
+		bool in_leaf = leaf->size() > 0 &&
+			(upper ? comp(key, leaf->back().first)
+			       : !comp(leaf->back().first, key));
+		if (in_leaf) {
+			auto it = upper ? std::upper_bound(leaf->begin(), leaf->end(), key, less)
+					: leaf->lower_bound(key, comp);
+			result = Iterator(leaf, it);
+			return true;
+		}
+
+		if (!leaf->get_next()) {
+			result = Iterator(leaf, leaf->end());
+			return true;
+		}
+		leaf = leaf->get_next().get();
+	}
+
+	return false;
+}
+
 // -------------------------------------------------------------------------------------
 // ------------------------------------- inner_node_t ----------------------------------
 // -------------------------------------------------------------------------------------
@@ -964,6 +1561,30 @@ inner_node_t<Key, Compare, capacity>::inner_node_t(size_type level, const_refere
 	children[0] = first_child;
 	children[1] = second_child;
 	_size = 1;
+	update_heads();
+}
+
+/**
+ * Creates a node of children [first_child, last_child), used by bulk load.
+ * child_keys[i] is the least key in the subtree of first_child[i], so it
+ * separates it from the previous child.
+ */
+template <typename Key, typename Compare, uint64_t capacity>
+inner_node_t<Key, Compare, capacity>::inner_node_t(size_type level,
+						   const node_pptr *first_child,
+						   const node_pptr *last_child,
+						   const key_type *const *child_keys)
+    : node_t(level)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+	auto n = static_cast<size_type>(last_child - first_child);
+	assert(n > 1 && n <= capacity + 1);
+
+	std::copy(first_child, last_child, children);
+	for (size_type i = 1; i < n; ++i)
+		entries[i - 1] = pmem::obj::persistent_ptr<key_type>(child_keys[i]);
+	_size = n - 1;
+	update_heads();
 }
 
 template <typename Key, typename Compare, uint64_t capacity>
@@ -995,6 +1616,8 @@ inner_node_t<Key, Compare, capacity>::move(pool_base &pop, inner_node_t &other,
 		std::move(middle_child, last_child, children);
 		_size = new_size;
 		other._size -= (new_size + 1);
+		update_heads();
+		other.update_heads();
 	});
 	assert(std::distance(begin(), end()) > 0);
 	return begin();
@@ -1009,6 +1632,7 @@ void inner_node_t<Key, Compare, capacity>::replace(iterator it, const K &key)
 {
 	size_type pos = static_cast<size_type>(std::distance(begin(), it));
 	entries[pos] = pmem::obj::persistent_ptr<key_type>(&key);
+	update_heads();
 }
 
 /**
@@ -1044,6 +1668,7 @@ void inner_node_t<Key, Compare, capacity>::update_splitted_child(pool_base &pop,
 		children + insert_idx + 1, children + size(), children + size() + 1);
 	*(--to_insert_child) = right_child;
 	*(--to_insert_child) = left_child;
+	update_heads();
 
 	assert(is_sorted(comp));
 }
@@ -1066,6 +1691,7 @@ void inner_node_t<Key, Compare, capacity>::delete_with_child(iterator it, bool l
 		std::move(children + pos + 2, children + size() + 1, children + pos + 1);
 	}
 	--_size;
+	update_heads();
 }
 
 /**
@@ -1090,16 +1716,36 @@ void inner_node_t<Key, Compare, capacity>::inherit_child(iterator it, node_pptr
 	}
 }
 
+/**
+ * Replaces all children of the node. Keys are the least keys of subtrees of
+ * the children (the first one is not used).
+ */
+template <typename Key, typename Compare, uint64_t capacity>
+void inner_node_t<Key, Compare, capacity>::assign(const node_pptr *first_child,
+						  const node_pptr *last_child,
+						  const key_type *const *child_keys)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+	auto n = static_cast<size_type>(std::distance(first_child, last_child));
+	assert(n > 1 && n <= capacity + 1);
+
+	pmemobj_tx_add_range_direct(entries, sizeof(entries));
+	pmemobj_tx_add_range_direct(children, sizeof(children));
+	std::copy(first_child, last_child, children);
+	for (size_type i = 1; i < n; ++i)
+		entries[i - 1] = pmem::obj::persistent_ptr<key_type>(child_keys[i]);
+	_size = n - 1;
+	update_heads();
+}
+
 template <typename Key, typename Compare, uint64_t capacity>
 template <typename K>
 const typename inner_node_t<Key, Compare, capacity>::node_pptr &
 inner_node_t<Key, Compare, capacity>::get_child(const K &key,
 						const key_compare &comp) const
 {
-	const_iterator it = std::upper_bound(
-		cbegin(), cend(), key,
-		[&comp](const K &lhs, const_reference rhs) { return comp(lhs, rhs); });
-	return get_left_child(it);
+	return children[upper_bound_idx(key, comp)];
 }
 
 template <typename Key, typename Compare, uint64_t capacity>
@@ -1110,9 +1756,7 @@ inner_node_t<Key, Compare, capacity>::get_child_and_siblings(const K &key,
 							     const key_compare &comp)
 {
 	assert(size() > 0);
-	iterator it = std::upper_bound(
-		begin(), end(), key,
-		[&comp](const K &lhs, const_reference rhs) { return comp(lhs, rhs); });
+	iterator it = begin() + upper_bound_idx(key, comp);
 	if (it == begin()) {
 		return std::make_tuple(get_left_child(it).get(), nullptr,
 				       get_right_child(it).get(), it);
@@ -1131,11 +1775,7 @@ const typename inner_node_t<Key, Compare, capacity>::node_pptr &
 inner_node_t<Key, Compare, capacity>::get_child(const_reference key,
 						const key_compare &comp) const
 {
-	const_iterator it = std::upper_bound(
-		cbegin(), cend(), key, [&comp](const_reference lhs, const_reference rhs) {
-			return comp(lhs, rhs);
-		});
-	return get_left_child(it);
+	return children[upper_bound_idx(key, comp)];
 }
 
 template <typename Key, typename Compare, uint64_t capacity>
@@ -1160,6 +1800,14 @@ inner_node_t<Key, Compare, capacity>::get_right_child(const_iterator it) const
 	return children[child_pos];
 }
 
+template <typename Key, typename Compare, uint64_t capacity>
+const typename inner_node_t<Key, Compare, capacity>::node_pptr &
+inner_node_t<Key, Compare, capacity>::child_at(size_type pos) const
+{
+	assert(pos <= size());
+	return children[pos];
+}
+
 template <typename Key, typename Compare, uint64_t capacity>
 bool inner_node_t<Key, Compare, capacity>::full() const
 {
@@ -1276,9 +1924,120 @@ pool_base inner_node_t<Key, Compare, capacity>::get_pool() const noexcept
 	return pool_base(pop);
 }
 
-// -------------------------------------------------------------------------------------
-// ----------------------------------- b_tree_iterator ---------------------------------
-// -------------------------------------------------------------------------------------
+/**
+ * Returns 8 bytes of the key starting at 'offset' (padded with zeros) as
+ * a big-endian integer, so heads of keys are ordered as the keys, unless
+ * they are equal.
+ */
+template <typename Key, typename Compare, uint64_t capacity>
+uint64_t inner_node_t<Key, Compare, capacity>::key_head(string_view key,
+							size_type offset)
+{
+	uint64_t head = 0;
+	for (size_type i = offset; i < offset + sizeof(head); ++i) {
+		head <<= 8;
+		if (i < key.size())
+			head |= static_cast<unsigned char>(key.data()[i]);
+	}
+
+	return head;
+}
+
+/**
+ * Recomputes the common prefix of keys and their heads, it's called (in a
+ * transaction) after every change of entries. Keys are sorted, so the prefix
+ * of the first and the last key is shared by all of them.
+ */
+template <typename Key, typename Compare, uint64_t capacity>
+void inner_node_t<Key, Compare, capacity>::update_heads()
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+	size_type prefix = 0;
+	if (size() > 0) {
+		auto first = make_string_view(*entries[0]);
+		auto last = make_string_view(*entries[size() - 1]);
+		auto n = std::min(first.size(), last.size());
+		while (prefix < n && first.data()[prefix] == last.data()[prefix])
+			++prefix;
+	}
+
+	if (size() > 0)
+		pmemobj_tx_add_range_direct(heads, sizeof(uint64_t) * size());
+	for (size_type i = 0; i < size(); ++i)
+		heads[i] = key_head(make_string_view(*entries[i]), prefix);
+	prefix_size = prefix;
+}
+
+template <typename Key, typename Compare, uint64_t capacity>
+template <typename K>
+typename inner_node_t<Key, Compare, capacity>::size_type
+inner_node_t<Key, Compare, capacity>::upper_bound_idx(const K &key,
+						      const key_compare &comp) const
+{
+	if (comp.is_binary())
+		return upper_bound_binary(make_string_view(key));
+
+	auto it = std::upper_bound(
+		cbegin(), cend(), key,
+		[&comp](const K &lhs, const_reference rhs) { return comp(lhs, rhs); });
+	return static_cast<size_type>(std::distance(cbegin(), it));
+}
+
+/**
+ * Returns position of the first key greater than 'key', in binary order.
+ * The common prefix is compared once and keys with the same head as 'key'
+ * are read only to break ties, so a lookup usually reads from PMem
+ * just one key (of the node, for its prefix) instead of log2(size) keys
+ * of leaves.
+ */
+template <typename Key, typename Compare, uint64_t capacity>
+typename inner_node_t<Key, Compare, capacity>::size_type
+inner_node_t<Key, Compare, capacity>::upper_bound_binary(string_view key) const
+{
+	if (size() == 0)
+		return 0;
+
+	auto first = make_string_view(*entries[0]);
+	string_view prefix(first.data(), prefix_size);
+	auto c = string_view(key.data(), std::min<size_type>(key.size(), prefix_size))
+			 .compare(prefix);
+	if (c < 0)
+		return 0;
+	if (c > 0)
+		return size();
+
+	auto head = key_head(key, prefix_size);
+	size_type lo = 0, hi = size();
+	while (lo < hi) {
+		auto mid = lo + (hi - lo) / 2;
+		bool less = head != heads[mid]
+			? head < heads[mid]
+			: key.compare(make_string_view(*entries[mid])) < 0;
+		if (less)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+/**
+ * Prefetches the whole node, so a descent through it doesn't wait for the
+ * media (only the node's first key, for its prefix, is read elsewhere).
+ */
+template <typename Key, typename Compare, uint64_t capacity>
+void inner_node_t<Key, Compare, capacity>::prefetch() const
+{
+	auto p = reinterpret_cast<const char *>(this);
+	for (std::size_t off = 0; off < sizeof(*this); off += 64)
+		__builtin_prefetch(p + off);
+}
+
+// -------------------------------------------------------------------------------------
+// ----------------------------------- b_tree_iterator ---------------------------------
+// -------------------------------------------------------------------------------------
 
 template <typename LeafType, bool is_const>
 b_tree_iterator<LeafType, is_const>::b_tree_iterator(std::nullptr_t)
@@ -1322,6 +2081,12 @@ b_tree_iterator<LeafType, is_const>::operator=(const b_tree_iterator &other)
 	return *this;
 }
 
+/*
+ * Moving to the next leaf starts prefetching ahead of the scan: keys of the
+ * following leaf (prefetched itself on the previous move) and the whole leaf
+ * after that one. So, in a long scan, every leaf is fetched two leaves ahead
+ * and its keys one leaf ahead of the cursor.
+ */
 template <typename LeafType, bool is_const>
 b_tree_iterator<LeafType, is_const> &b_tree_iterator<LeafType, is_const>::operator++()
 {
@@ -1331,6 +2096,13 @@ b_tree_iterator<LeafType, is_const> &b_tree_iterator<LeafType, is_const>::operat
 		if (tmp) {
 			current_node = tmp;
 			leaf_it = current_node->begin();
+
+			leaf_node_ptr ahead = current_node->get_next().get();
+			if (ahead) {
+				ahead->prefetch_keys();
+				if (ahead->get_next())
+					ahead->get_next()->prefetch();
+			}
 		}
 	}
 	return *this;
@@ -1344,18 +2116,31 @@ b_tree_iterator<LeafType, is_const> b_tree_iterator<LeafType, is_const>::operato
 	return tmp;
 }
 
+/*
+ * Leaves are linked in both directions, so moving back is as cheap as moving
+ * forward, and it prefetches the same way - behind the scan.
+ */
 template <typename LeafType, bool is_const>
 b_tree_iterator<LeafType, is_const> &b_tree_iterator<LeafType, is_const>::operator--()
 {
 	if (leaf_it == current_node->begin()) {
 		leaf_node_ptr tmp = current_node->get_prev().get();
-		if (tmp) {
-			current_node = tmp;
-			leaf_it = current_node->end();
+		if (!tmp)
+			return *this;
+
+		current_node = tmp;
+		leaf_it = current_node->end();
+
+		leaf_node_ptr behind = current_node->get_prev().get();
+		if (behind) {
+			behind->prefetch_keys();
+			if (behind->get_prev())
+				behind->get_prev()->prefetch();
 		}
-	} else {
-		--leaf_it;
 	}
+
+	/* leaves, except the root one, are never empty */
+	--leaf_it;
 	return *this;
 }
 
@@ -1379,6 +2164,18 @@ bool b_tree_iterator<LeafType, is_const>::operator!=(const b_tree_iterator &othe
 	return !(*this == other);
 }
 
+template <typename LeafType, bool is_const>
+bool b_tree_iterator<LeafType, is_const>::is_begin() const
+{
+	return leaf_it == current_node->begin() && !current_node->get_prev();
+}
+
+template <typename LeafType, bool is_const>
+bool b_tree_iterator<LeafType, is_const>::is_end() const
+{
+	return leaf_it == current_node->end() && !current_node->get_next();
+}
+
 template <typename LeafType, bool is_const>
 typename b_tree_iterator<LeafType, is_const>::reference
 	b_tree_iterator<LeafType, is_const>::operator*() const
@@ -1419,9 +2216,28 @@ template <typename Key, typename T, typename Compare, std::size_t degree>
 template <typename K, typename M>
 std::pair<typename b_tree_base<Key, T, Compare, degree>::iterator, bool>
 b_tree_base<Key, T, Compare, degree>::try_emplace(K &&key, M &&obj)
+{
+	return try_emplace(std::forward<K>(key), std::forward<M>(obj),
+			   [](const value_type *, const value_type *) {});
+}
+
+/**
+ * Same as try_emplace(key, obj), but if a leaf is split, 'moved' is called
+ * with the old and the new address of each entry moved to the new leaf
+ * (after the split's transaction), so entries can be tracked by addresses.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename M, typename F>
+std::pair<typename b_tree_base<Key, T, Compare, degree>::iterator, bool>
+b_tree_base<Key, T, Compare, degree>::try_emplace(K &&key, M &&obj, F &&moved)
 {
 	auto pop = get_pool_base();
 
+	// ----- key above all keys -> append to the last leaf, without a descent -----
+	leaf_pptr last(rightmost_leaf());
+	if (!last->full() && is_append(last, std::forward<K>(key)))
+		return internal_insert(last, std::forward<K>(key), std::forward<M>(obj));
+
 	path_type path;
 	leaf_pptr leaf = find_leaf_to_insert(std::forward<K>(key), path);
 
@@ -1439,7 +2255,7 @@ b_tree_base<Key, T, Compare, degree>::try_emplace(K &&key, M &&obj)
 	// -------------------- if root is leaf ------------------------
 	if (path.empty()) {
 		return split_leaf_node(pop, leaf, std::forward<K>(key),
-				       std::forward<M>(obj));
+				       std::forward<M>(obj), std::forward<F>(moved));
 	}
 
 	// ---------- find the first not full node from leaf -----------
@@ -1468,7 +2284,63 @@ b_tree_base<Key, T, Compare, degree>::try_emplace(K &&key, M &&obj)
 	}
 
 	return split_leaf_node(pop, parent_node, leaf, std::forward<K>(key),
-			       std::forward<M>(obj));
+			       std::forward<M>(obj), std::forward<F>(moved));
+}
+
+/**
+ * Builds the empty tree bottom-up. 'source' is called with a bulk_builder,
+ * to which all elements must be passed in strictly increasing order of keys.
+ * Leaves are filled sequentially, then each level of inner nodes is built
+ * on top of the previous one, all in a single transaction.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename F>
+void b_tree_base<Key, T, Compare, degree>::bulk_load(F &&source)
+{
+	assert(size() == 0);
+
+	auto pop = get_pool_base();
+	pmem::obj::transaction::run(pop, [&] {
+		bulk_builder builder(compare, BULK_LOAD_FILL,
+				     node_alloc_flag<leaf_type>(this));
+		source(builder);
+		if (builder.leaves().empty())
+			return;
+
+		/* nodes of the current level and the least keys of their subtrees */
+		std::vector<node_pptr> nodes;
+		std::vector<const key_type *> keys;
+		for (auto &leaf : builder.leaves()) {
+			nodes.emplace_back(leaf);
+			keys.push_back(&leaf->front().first);
+		}
+
+		/* children are spread evenly, so each inner node has at least two */
+		for (size_type level = 1; nodes.size() > 1; ++level) {
+			size_type parents =
+				(nodes.size() + BULK_LOAD_FILL) / (BULK_LOAD_FILL + 1);
+			std::vector<node_pptr> parent_nodes;
+			std::vector<const key_type *> parent_keys;
+
+			size_type first = 0;
+			for (size_type p = 0; p < parents; ++p) {
+				size_type last =
+					first + (nodes.size() - first) / (parents - p);
+				parent_nodes.emplace_back(allocate_inner(
+					level, nodes.data() + first, nodes.data() + last,
+					keys.data() + first));
+				parent_keys.push_back(keys[first]);
+				first = last;
+			}
+
+			nodes.swap(parent_nodes);
+			keys.swap(parent_keys);
+		}
+
+		deallocate(root);
+		root = nodes.front();
+		_size = builder.size();
+	});
 }
 
 template <typename Key, typename T, typename Compare, std::size_t degree>
@@ -1497,6 +2369,77 @@ b_tree_base<Key, T, Compare, degree>::find(const K &key) const
 	return const_iterator(leaf, leaf_it);
 }
 
+/**
+ * Finds 'n' keys, sorted in non-decreasing order, and calls found(i, entry)
+ * for each present one. Consecutive keys in the same or in neighbouring
+ * leaves are found without descending from the root again.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename F>
+void b_tree_base<Key, T, Compare, degree>::find_sorted(const K *keys, size_type n,
+						       F &&found)
+{
+	find_sorted_in_leaves<leaf_type>(
+		keys, n, compare, [&](const K &key) { return find_leaf_node(key); },
+		found);
+}
+
+/**
+ * Finds 'n' keys, in any order, and calls found(i, entry) for each present
+ * one. Lookups are interleaved: each of INTERLEAVED_LOOKUPS lookups in flight
+ * is a small state machine (a key and the node it visits next), which takes
+ * one step - reads the node, prefetches its child and yields to the next
+ * lookup - so misses of different descents overlap instead of adding up.
+ * A finished lookup takes the next key, starting from the root.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename F>
+void b_tree_base<Key, T, Compare, degree>::find_interleaved(const K *keys, size_type n,
+							    F &&found)
+{
+	assert(root != nullptr);
+
+	struct lookup {
+		size_type i;
+		node_t *node;
+	};
+	lookup lookups[INTERLEAVED_LOOKUPS];
+
+	size_type next = 0, active = 0;
+	for (; active < INTERLEAVED_LOOKUPS && next < n; ++active)
+		lookups[active] = lookup{next++, root.get()};
+
+	while (active > 0) {
+		for (size_type s = 0; s < active;) {
+			auto &l = lookups[s];
+			if (!l.node->leaf()) {
+				auto inner = cast_inner(l.node);
+				node_t *child = inner->get_child(keys[l.i], compare).get();
+				if (inner->level() == 1)
+					cast_leaf(child)->prefetch();
+				else
+					cast_inner(child)->prefetch();
+				l.node = child;
+				++s;
+				continue;
+			}
+
+			auto leaf = cast_leaf(l.node);
+			auto it = leaf->find(keys[l.i], compare);
+			if (it != leaf->end())
+				found(l.i, *it);
+
+			if (next < n) {
+				l = lookup{next++, root.get()};
+				++s;
+			} else {
+				/* the last lookup takes the finished one's place */
+				l = lookups[--active];
+			}
+		}
+	}
+}
+
 /**
  * Returns an iterator pointing to the least element which is larger than or equal
  * to the given key. Keys are sorted in binary order (see
@@ -1512,16 +2455,31 @@ typename b_tree_base<Key, T, Compare, degree>::iterator
 b_tree_base<Key, T, Compare, degree>::lower_bound(const K &key)
 {
 	leaf_type *leaf = find_leaf_node(key);
-	typename leaf_type::iterator leaf_it = std::lower_bound(
-		leaf->begin(), leaf->end(), key, [this](const_reference e, const K &key) {
-			return compare(e.first, key);
-		});
+	typename leaf_type::iterator leaf_it = leaf->lower_bound(key, compare);
 	if (leaf->end() == leaf_it)
 		return end();
 
 	return iterator(leaf, leaf_it);
 }
 
+/**
+ * Same as lower_bound(key), but if 'hint' is not greater than the key (e.g.
+ * it's the bound of a previous, lower key), the bound is searched from it
+ * first - the tree is descended only if it's not in one of the next
+ * FINGER_SEARCH_LEAVES leaves.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename b_tree_base<Key, T, Compare, degree>::iterator
+b_tree_base<Key, T, Compare, degree>::lower_bound(const K &key, const iterator &hint)
+{
+	iterator result(nullptr);
+	if (bound_from_hint(hint, key, false, compare, FINGER_SEARCH_LEAVES, result))
+		return result;
+
+	return lower_bound(key);
+}
+
 /**
  * Returns a const iterator pointing to the least element which is larger than or
  * equal to the given key. Keys are sorted in binary order (see
@@ -1536,12 +2494,8 @@ template <typename K>
 typename b_tree_base<Key, T, Compare, degree>::const_iterator
 b_tree_base<Key, T, Compare, degree>::lower_bound(const K &key) const
 {
-	leaf_type *leaf = find_leaf_node(key);
-	typename leaf_type::const_iterator leaf_it =
-		std::lower_bound(leaf->cbegin(), leaf->cend(), key,
-				 [this](const_reference e, const K &key) {
-					 return compare(e.first, key);
-				 });
+	const leaf_type *leaf = find_leaf_node(key);
+	typename leaf_type::const_iterator leaf_it = leaf->lower_bound(key, compare);
 	if (leaf->cend() == leaf_it)
 		return cend();
 
@@ -1577,6 +2531,22 @@ b_tree_base<Key, T, Compare, degree>::upper_bound(const K &key)
 	return iterator(leaf, leaf_it);
 }
 
+/**
+ * Same as upper_bound(key), but searched from 'hint' first, as in
+ * lower_bound(key, hint).
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename b_tree_base<Key, T, Compare, degree>::iterator
+b_tree_base<Key, T, Compare, degree>::upper_bound(const K &key, const iterator &hint)
+{
+	iterator result(nullptr);
+	if (bound_from_hint(hint, key, true, compare, FINGER_SEARCH_LEAVES, result))
+		return result;
+
+	return upper_bound(key);
+}
+
 /**
  * Returns a const iterator pointing to the least element which is larger than the
  * given key. Keys are sorted in binary order (see
@@ -1693,6 +2663,18 @@ template <typename Key, typename T, typename Compare, std::size_t degree>
 template <typename K>
 typename b_tree_base<Key, T, Compare, degree>::size_type
 b_tree_base<Key, T, Compare, degree>::erase(const K &key)
+{
+	return erase(key, [](const value_type &) {});
+}
+
+/**
+ * Same as erase(key), but the entry is passed to 'visit' before it's erased,
+ * so it can be read without descending the tree again.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename F>
+typename b_tree_base<Key, T, Compare, degree>::size_type
+b_tree_base<Key, T, Compare, degree>::erase(const K &key, F &&visit)
 {
 	using const_key = const key_type &;
 	/* search leaf saving path, neighbors */
@@ -1701,6 +2683,11 @@ b_tree_base<Key, T, Compare, degree>::erase(const K &key)
 	inner_pair to_replace; // inner node with key reference
 	leaf_pptr leaf = get_path_ext(key, path, neighbors, to_replace);
 
+	auto it = leaf->find(key, compare);
+	if (it == leaf->end())
+		return size_type(0);
+	visit(*it);
+
 	auto pop = get_pool_base();
 	size_type result(1);
 	pmem::obj::transaction::run(pop, [&] {
@@ -1757,6 +2744,166 @@ b_tree_base<Key, T, Compare, degree>::erase(const K &key)
 	return result;
 }
 
+/**
+ * Erases all entries with keys in range (key1, key2), returns their number.
+ *
+ * Subtrees which lie entirely in the range are freed without visiting their
+ * entries, so the cost depends on the number of nodes on the range's edges and
+ * removed leaves, not on the number of removed entries.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename b_tree_base<Key, T, Compare, degree>::size_type
+b_tree_base<Key, T, Compare, degree>::erase_between(const K &key1, const K &key2)
+{
+	if (!compare(key1, key2))
+		return size_type(0);
+
+	auto pop = get_pool_base();
+	size_type result(0);
+	pmem::obj::transaction::run(pop, [&] {
+		removed_leaves removed;
+		result = erase_range(root, key1, key2, false, false, removed);
+		if (!result)
+			return;
+
+		if (removed.any) {
+			if (removed.prev)
+				removed.prev->set_next(removed.next);
+			if (removed.next)
+				removed.next->set_prev(removed.prev);
+		}
+		if (root == nullptr)
+			cast_leaf(root) = allocate_leaf();
+		_size = _size - result;
+	});
+
+	return result;
+}
+
+/**
+ * Erases entries with keys in range (key1, key2) from the subtree. 'above' and
+ * 'below' tell if all keys of the subtree are greater than key1 and less than
+ * key2. Emptied nodes are freed (and node is set to null), an inner node left
+ * with one child is replaced by the child.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename b_tree_base<Key, T, Compare, degree>::size_type
+b_tree_base<Key, T, Compare, degree>::erase_range(node_pptr &node, const K &key1,
+						  const K &key2, bool above, bool below,
+						  removed_leaves &removed)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+	if (above && below)
+		return free_subtree(node, removed);
+
+	if (node->leaf()) {
+		auto pop = get_pool_base();
+		leaf_pptr &leaf = cast_leaf(node);
+		size_type erased = leaf->erase_between(pop, key1, key2, compare);
+		if (erased && leaf->size() == 0)
+			remove_leaf(leaf, removed);
+		return erased;
+	}
+
+	inner_type *inner = cast_inner(node).get();
+	size_type first = inner->upper_bound_idx(key1, compare);
+	size_type last = inner->upper_bound_idx(key2, compare);
+	size_type n = inner->size() + 1;
+
+	/*
+	 * Separators point to keys in leaves, so they are all checked before
+	 * any entry is erased.
+	 */
+	std::vector<node_pptr> children(n);
+	std::vector<char> child_above(n), child_below(n);
+	for (size_type i = 0; i < n; ++i) {
+		children[i] = inner->child_at(i);
+		child_above[i] = i == 0 ? above : compare(key1, (*inner)[i - 1]);
+		child_below[i] = i == n - 1 ? below : !compare(key2, (*inner)[i]);
+	}
+
+	size_type erased = 0;
+	for (size_type i = first; i <= last; ++i)
+		erased += erase_range(children[i], key1, key2, child_above[i],
+				      child_below[i], removed);
+	if (!erased)
+		return erased;
+
+	std::vector<node_pptr> kept;
+	std::vector<const key_type *> keys;
+	for (auto &child : children) {
+		if (child == nullptr)
+			continue;
+		kept.push_back(child);
+		keys.push_back(&get_first_key(child));
+	}
+
+	if (kept.empty()) {
+		deallocate(node);
+	} else if (kept.size() == 1) {
+		deallocate(node);
+		node = kept.front();
+	} else {
+		inner->assign(kept.data(), kept.data() + kept.size(), keys.data());
+	}
+
+	return erased;
+}
+
+/**
+ * Frees the subtree, returns the number of its entries.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename b_tree_base<Key, T, Compare, degree>::size_type
+b_tree_base<Key, T, Compare, degree>::free_subtree(node_pptr &node,
+						   removed_leaves &removed)
+{
+	if (node->leaf()) {
+		size_type erased = cast_leaf(node)->size();
+		remove_leaf(cast_leaf(node), removed);
+		return erased;
+	}
+
+	size_type erased = 0;
+	inner_type *inner = cast_inner(node).get();
+	for (size_type i = 0; i <= inner->size(); ++i) {
+		node_pptr child = inner->child_at(i);
+		erased += free_subtree(child, removed);
+	}
+	deallocate(node);
+
+	return erased;
+}
+
+/**
+ * Frees the leaf, leaves are removed in order, so the neighbors of the whole
+ * run are known once erase_range() is done.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void b_tree_base<Key, T, Compare, degree>::remove_leaf(leaf_pptr &leaf,
+						       removed_leaves &removed)
+{
+	if (!removed.any) {
+		removed.any = true;
+		removed.prev = leaf->get_prev();
+	}
+	removed.next = leaf->get_next();
+	deallocate(leaf);
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+const typename b_tree_base<Key, T, Compare, degree>::key_type &
+b_tree_base<Key, T, Compare, degree>::get_first_key(const node_pptr &node)
+{
+	const node_t *temp = node.get();
+	while (!temp->leaf())
+		temp = static_cast<const inner_type *>(temp)->child_at(0).get();
+	return static_cast<const leaf_type *>(temp)->front().first;
+}
+
 template <typename Key, typename T, typename Compare, std::size_t degree>
 typename b_tree_base<Key, T, Compare, degree>::iterator
 b_tree_base<Key, T, Compare, degree>::begin()
@@ -1822,6 +2969,163 @@ b_tree_base<Key, T, Compare, degree>::size() const noexcept
 	return _size;
 }
 
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename b_tree_base<Key, T, Compare, degree>::tree_stats
+b_tree_base<Key, T, Compare, degree>::stats() const
+{
+	tree_stats s;
+	if (root == nullptr)
+		return s;
+
+	s.depth = static_cast<size_type>(root->level()) + 1;
+	for (auto leaf = leftmost_leaf(); leaf != nullptr; leaf = leaf->get_next().get())
+		++s.leaves;
+
+	return s;
+}
+
+/*
+ * Returns (at most n - 1) keys, in order, which split the tree into n parts
+ * of similar size. They are separators of the highest level of inner nodes
+ * with at least n children in total (or of the lowest one, if there's no
+ * such level), picked evenly. Keys are valid until the tree is modified.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+std::vector<string_view>
+b_tree_base<Key, T, Compare, degree>::partition_keys(size_type n) const
+{
+	return partition_subtrees(n, [](const inner_type *, size_type) { return true; });
+}
+
+/*
+ * Same as above, but splits only the range (key1, key2) - subtrees which
+ * can't contain keys from the range are not counted, all returned keys are
+ * greater than key1 and lower than key2.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+std::vector<string_view>
+b_tree_base<Key, T, Compare, degree>::partition_keys(size_type n, string_view key1,
+						     string_view key2) const
+{
+	if (!compare(key1, key2))
+		return {};
+
+	return partition_subtrees(n, [&](const inner_type *inner, size_type j) {
+		/* child j holds keys between separators j - 1 and j */
+		return (j == inner->size() || compare(key1, (*inner)[j])) &&
+			(j == 0 || compare((*inner)[j - 1], key2));
+	});
+}
+
+/*
+ * Walks levels of inner nodes down from the root, keeping only children for
+ * which keep(inner, j) is true (they must be contiguous on every level),
+ * until there are at least n of them. Returns separators of the kept
+ * subtrees, picked evenly if there are more than n of them.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename Keep>
+std::vector<string_view>
+b_tree_base<Key, T, Compare, degree>::partition_subtrees(size_type n, Keep &&keep) const
+{
+	std::vector<string_view> keys;
+	if (root == nullptr || root->leaf() || n < 2)
+		return keys;
+
+	/* subtrees of the current level, keys[i] separates nodes[i] and nodes[i + 1] */
+	std::vector<node_pptr> nodes{root};
+	while (nodes.size() < n && !nodes.front()->leaf()) {
+		std::vector<node_pptr> children;
+		std::vector<string_view> separators;
+
+		for (size_type i = 0; i < nodes.size(); ++i) {
+			inner_type *inner = cast_inner(nodes[i]).get();
+			for (size_type j = 0; j <= inner->size(); ++j) {
+				if (!keep(inner, j))
+					continue;
+
+				if (!children.empty())
+					separators.push_back(
+						j > 0 ? make_string_view((*inner)[j - 1])
+						      : keys[i - 1]);
+				children.push_back(inner->child_at(j));
+			}
+		}
+
+		nodes.swap(children);
+		keys.swap(separators);
+	}
+
+	if (nodes.size() <= n)
+		return keys;
+
+	std::vector<string_view> picked;
+	for (size_type p = 1; p < n; ++p)
+		picked.push_back(keys[p * nodes.size() / n - 1]);
+
+	return picked;
+}
+
+/*
+ * Estimates number of elements in range (key1, key2), from positions of both
+ * keys (see estimate_position). Parts of the paths to the keys, which are
+ * the same, add the same to both positions, so the result is exact if both
+ * keys are in the same leaf; otherwise only sizes of whole subtrees between
+ * the leaves of the keys (and of the leaf of key1) are estimated.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename b_tree_base<Key, T, Compare, degree>::size_type
+b_tree_base<Key, T, Compare, degree>::count_between_approx(const K &key1,
+							   const K &key2) const
+{
+	if (root == nullptr || !compare(key1, key2))
+		return 0;
+
+	auto estimate = estimate_position(key2, false) - estimate_position(key1, true);
+	if (estimate <= 0)
+		return 0;
+
+	return std::min(static_cast<size_type>(estimate + 0.5), size());
+}
+
+/*
+ * Returns estimated number of elements less than the key (or, if 'above', not
+ * greater than it). Inner nodes don't keep sizes of their subtrees, so all
+ * children of a node are assumed to hold equal shares of the node's elements
+ * (the root holds all of them); elements of the leaf are counted exactly.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+double b_tree_base<Key, T, Compare, degree>::estimate_position(const K &key,
+							       bool above) const
+{
+	double position = 0;
+	double share = static_cast<double>(size());
+
+	node_pptr node = root;
+	while (!node->leaf()) {
+		inner_type *inner = cast_inner(node).get();
+		auto idx = inner->upper_bound_idx(key, compare);
+
+		share /= static_cast<double>(inner->size() + 1);
+		position += static_cast<double>(idx) * share;
+		node = inner->child_at(idx);
+	}
+
+	leaf_type *leaf = cast_leaf(node).get();
+	typename leaf_type::const_iterator it;
+	if (above)
+		it = std::upper_bound(leaf->cbegin(), leaf->cend(), key,
+				      [this](const K &key, const_reference e) {
+					      return compare(key, e.first);
+				      });
+	else
+		it = static_cast<const leaf_type *>(leaf)->lower_bound(key, compare);
+
+	return position + static_cast<double>(std::distance(leaf->cbegin(), it));
+}
+
 template <typename Key, typename T, typename Compare, std::size_t degree>
 typename b_tree_base<Key, T, Compare, degree>::reference
 	b_tree_base<Key, T, Compare, degree>::operator[](size_type pos)
@@ -1876,6 +3180,8 @@ b_tree_base<Key, T, Compare, degree>::split_half(pool_base &pop, inner_pptr &nod
 {
 	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
 	assert(other == nullptr);
+	PMEMKV_PROBE1(stree__inner_split, node->level());
+	slow_op_phase_scope split_phase(slow_op_phase::SPLIT);
 	other = allocate_inner(node->level());
 	return other->move(pop, *node, partition_key);
 }
@@ -1913,24 +3219,31 @@ void b_tree_base<Key, T, Compare, degree>::split_inner_node(pool_base &pop,
 
 /* split leaf in case when root is leaf */
 template <typename Key, typename T, typename Compare, std::size_t degree>
-template <typename K, typename M>
+template <typename K, typename M, typename F>
 std::pair<typename b_tree_base<Key, T, Compare, degree>::iterator, bool>
 b_tree_base<Key, T, Compare, degree>::split_leaf_node(pool_base &pop,
 						      leaf_pptr &split_leaf, K &&key,
-						      M &&obj)
+						      M &&obj, F &&moved)
 {
 	assert(split_leaf->full());
+	PMEMKV_PROBE1(stree__leaf_split, split_leaf->size());
+	slow_op_phase_scope split_phase(slow_op_phase::SPLIT);
 
 	leaf_pptr node;
 	std::pair<iterator, bool> result(nullptr, false);
 	auto middle = split_leaf->begin() + split_leaf->size() / 2;
 	bool less = compare(std::forward<K>(key), middle->first);
+	bool append = is_append(split_leaf, std::forward<K>(key));
+	auto moved_from = append ? std::vector<const value_type *>()
+				 : split_moved_entries(*split_leaf);
 	// move second half into node and insert new element where needed
 	pmem::obj::transaction::run(pop, [&] {
 		node = allocate_leaf();
-		node->move(pop, split_leaf, compare);
+		/* the last leaf is left full by an append, nothing is moved */
+		if (!append)
+			node->move(pop, split_leaf, compare);
 		/* insert entry(key, obj) into needed half */
-		if (less) {
+		if (less && !append) {
 			result = internal_insert(split_leaf, std::forward<K>(key),
 						 std::forward<M>(obj));
 		} else {
@@ -1947,6 +3260,7 @@ b_tree_base<Key, T, Compare, degree>::split_leaf_node(pool_base &pop,
 		}
 		split_leaf->set_next(node);
 	});
+	report_split_moves(moved_from, *node, &*result.first, moved);
 
 	assert(!compare(result.first->first, key) && !compare(key, result.first->first));
 	return result;
@@ -1954,25 +3268,32 @@ b_tree_base<Key, T, Compare, degree>::split_leaf_node(pool_base &pop,
 
 /* split leaf in case when root is not leaf */
 template <typename Key, typename T, typename Compare, std::size_t degree>
-template <typename K, typename M>
+template <typename K, typename M, typename F>
 std::pair<typename b_tree_base<Key, T, Compare, degree>::iterator, bool>
 b_tree_base<Key, T, Compare, degree>::split_leaf_node(pool_base &pop,
 						      inner_type *parent_node,
 						      leaf_pptr &split_leaf, K &&key,
-						      M &&obj)
+						      M &&obj, F &&moved)
 {
 	assert(split_leaf->full());
+	PMEMKV_PROBE1(stree__leaf_split, split_leaf->size());
+	slow_op_phase_scope split_phase(slow_op_phase::SPLIT);
 
 	leaf_pptr node;
 	std::pair<iterator, bool> result(nullptr, false);
 	auto middle = split_leaf->begin() + split_leaf->size() / 2;
 	bool less = compare(std::forward<K>(key), middle->first);
+	bool append = is_append(split_leaf, std::forward<K>(key));
+	auto moved_from = append ? std::vector<const value_type *>()
+				 : split_moved_entries(*split_leaf);
 	// move second half into node and insert new element where needed
 	pmem::obj::transaction::run(pop, [&] {
 		node = allocate_leaf();
-		node->move(pop, split_leaf, compare);
+		/* the last leaf is left full by an append, nothing is moved */
+		if (!append)
+			node->move(pop, split_leaf, compare);
 		/* insert entry(key, obj) into needed half */
-		if (less) {
+		if (less && !append) {
 			result = internal_insert(split_leaf, std::forward<K>(key),
 						 std::forward<M>(obj));
 		} else {
@@ -1991,6 +3312,7 @@ b_tree_base<Key, T, Compare, degree>::split_leaf_node(pool_base &pop,
 		}
 		split_leaf->set_next(node);
 	});
+	report_split_moves(moved_from, *node, &*result.first, moved);
 
 	assert(!compare(result.first->first, key) && !compare(key, result.first->first));
 	return result;
@@ -2036,6 +3358,18 @@ b_tree_base<Key, T, Compare, degree>::find_leaf_to_insert(const K &key,
 	return cast_leaf(node);
 }
 
+/**
+ * Checks if the key is above all keys of the tree, given its leaf - then it's
+ * the last leaf and the key is above its last key.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+bool b_tree_base<Key, T, Compare, degree>::is_append(const leaf_pptr &leaf,
+						     const K &key) const
+{
+	return !leaf->get_next() && leaf->size() > 0 && compare(leaf->back().first, key);
+}
+
 template <typename Key, typename T, typename Compare, std::size_t degree>
 typename b_tree_base<Key, T, Compare, degree>::path_type::const_iterator
 b_tree_base<Key, T, Compare, degree>::find_full_node(const path_type &path)
@@ -2059,9 +3393,12 @@ b_tree_base<Key, T, Compare, degree>::internal_insert(leaf_pptr leaf, K &&key, M
 		return std::pair<iterator, bool>(iterator(leaf.get(), idxs_pos), false);
 	}
 	auto pop = get_pool_base();
+	/* leaf is not changed before only in a standalone insert (see insert) */
+	bool switch_idxs = pmemobj_tx_stage() == TX_STAGE_NONE;
 	typename leaf_type::iterator res;
 	pmem::obj::transaction::run(pop, [&] {
-		res = leaf->insert(idxs_pos, std::forward<K>(key), std::forward<M>(obj));
+		res = leaf->insert(idxs_pos, std::forward<K>(key), std::forward<M>(obj),
+				   switch_idxs);
 		++_size;
 	});
 	return std::pair<iterator, bool>(iterator(leaf.get(), res), true);
@@ -2155,7 +3492,8 @@ inline typename b_tree_base<Key, T, Compare, degree>::inner_pptr
 b_tree_base<Key, T, Compare, degree>::allocate_inner(Args &&... args)
 {
 	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
-	return make_persistent<inner_type>(std::forward<Args>(args)...);
+	return make_persistent<inner_type>(node_alloc_flag<inner_type>(this),
+					   std::forward<Args>(args)...);
 }
 
 template <typename Key, typename T, typename Compare, std::size_t degree>
@@ -2164,7 +3502,8 @@ inline typename b_tree_base<Key, T, Compare, degree>::leaf_pptr
 b_tree_base<Key, T, Compare, degree>::allocate_leaf(Args &&... args)
 {
 	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
-	return make_persistent<leaf_type>(std::forward<Args>(args)...);
+	return make_persistent<leaf_type>(node_alloc_flag<leaf_type>(this),
+					  std::forward<Args>(args)...);
 }
 
 template <typename Key, typename T, typename Compare, std::size_t degree>
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_STREE_POINT_INDEX_H
+#define LIBPMEMKV_STREE_POINT_INDEX_H
+
+#include "../../fast_hash.h"
+#include "../../libpmemkv.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace stree
+{
+
+/**
+ * point_index is a DRAM hash table from keys to entries of leaves (pairs of
+ * pmem::obj::string key and value), so a point lookup reads a single entry
+ * instead of descending the tree. Only hashes and addresses of entries are
+ * kept - keys are read from the entries, so they are compared byte by byte.
+ *
+ * It's an open addressing table with linear probing; removals shift the
+ * following entries back, so there are no tombstones. Entries don't move in
+ * the tree, except for splits of leaves, which report new addresses of the
+ * moved ones (moved()). The index is not synchronized, readers and writers
+ * are serialized by the engine's lock.
+ */
+template <typename Entry>
+class point_index {
+public:
+	static uint64_t hash(string_view key)
+	{
+		return fast_hash(key.size(), key.data());
+	}
+
+	/* Clears the index and sizes it for (more than) 'entries' entries */
+	void reset(std::size_t entries)
+	{
+		std::size_t capacity = MIN_CAPACITY;
+		while (capacity * MAX_LOAD_PERCENT / 100 <= entries)
+			capacity *= 2;
+
+		slots.assign(capacity, slot{0, nullptr});
+		used = 0;
+	}
+
+	/* Returns the entry of the key, null if it's not indexed */
+	const Entry *find(string_view key) const
+	{
+		auto h = hash(key);
+		for (auto i = home(h);; i = next(i)) {
+			auto &s = slots[i];
+			if (!s.entry)
+				return nullptr;
+			if (s.hash == h && key_of(s.entry).compare(key) == 0)
+				return s.entry;
+		}
+	}
+
+	/* Indexes the entry of the key, replacing the one indexed for it */
+	void insert(string_view key, const Entry *entry)
+	{
+		if ((used + 1) * 100 > slots.size() * MAX_LOAD_PERCENT)
+			grow();
+
+		auto h = hash(key);
+		auto i = home(h);
+		for (; slots[i].entry; i = next(i)) {
+			if (slots[i].hash == h && key_of(slots[i].entry).compare(key) == 0) {
+				slots[i].entry = entry;
+				return;
+			}
+		}
+
+		slots[i] = slot{h, entry};
+		++used;
+	}
+
+	/*
+	 * Removes the entry with the given hash of its key. The entry is
+	 * matched by its address, so it may be already destroyed.
+	 */
+	void erase(uint64_t h, const Entry *entry)
+	{
+		auto i = home(h);
+		for (; slots[i].entry != entry; i = next(i)) {
+			if (!slots[i].entry)
+				return;
+		}
+
+		/* entries which can't be found past the hole are moved to it */
+		for (auto j = next(i); slots[j].entry; j = next(j)) {
+			auto k = home(slots[j].hash);
+			bool stays = i < j ? (i < k && k <= j) : (i < k || k <= j);
+			if (stays)
+				continue;
+
+			slots[i] = slots[j];
+			i = j;
+		}
+
+		slots[i] = slot{0, nullptr};
+		--used;
+	}
+
+	/* Points the index to the new address of the entry moved by a split */
+	void moved(const Entry *from, const Entry *to)
+	{
+		auto i = home(hash(key_of(to)));
+		for (; slots[i].entry; i = next(i)) {
+			if (slots[i].entry == from) {
+				slots[i].entry = to;
+				return;
+			}
+		}
+		assert(false);
+	}
+
+	std::size_t size_bytes() const
+	{
+		return slots.size() * sizeof(slot);
+	}
+
+private:
+	static constexpr std::size_t MIN_CAPACITY = 1024;
+	static constexpr std::size_t MAX_LOAD_PERCENT = 75;
+
+	struct slot {
+		uint64_t hash;
+		/* null if the slot is empty */
+		const Entry *entry;
+	};
+
+	static string_view key_of(const Entry *entry)
+	{
+		return string_view(entry->first.cdata(), entry->first.size());
+	}
+
+	std::size_t home(uint64_t h) const
+	{
+		return static_cast<std::size_t>(h) & (slots.size() - 1);
+	}
+
+	std::size_t next(std::size_t i) const
+	{
+		return (i + 1) & (slots.size() - 1);
+	}
+
+	/* doubles the table, slots are rehashed by their stored hashes */
+	void grow()
+	{
+		std::vector<slot> old(slots.size() * 2, slot{0, nullptr});
+		old.swap(slots);
+
+		for (auto &s : old) {
+			if (!s.entry)
+				continue;
+			auto i = home(s.hash);
+			while (slots[i].entry)
+				i = next(i);
+			slots[i] = s;
+		}
+	}
+
+	std::vector<slot> slots = std::vector<slot>(MIN_CAPACITY, slot{0, nullptr});
+	std::size_t used = 0;
+};
+
+} /* namespace stree */
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_STREE_POINT_INDEX_H */
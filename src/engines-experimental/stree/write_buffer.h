@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_STREE_WRITE_BUFFER_H
+#define LIBPMEMKV_STREE_WRITE_BUFFER_H
+
+#include "../../comparator/volatile_comparator.h"
+#include "../../pool_persistence.h"
+
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace stree
+{
+
+/*
+ * Persistent part of the write buffer - log of writes which are not applied
+ * to the tree yet. If the buffer is enabled, the root of the engine points
+ * to this object (allocated with PMEM_TYPE_NUM_LOGGED type number) instead
+ * of the tree.
+ */
+struct write_log {
+	PMEMoid tree;
+	PMEMoid data;
+	pmem::obj::p<uint64_t> capacity;
+	/* bytes of complete records in data, the only field modified by appends */
+	pmem::obj::p<uint64_t> used;
+};
+
+/*
+ * DRAM memtable of recent writes (puts and removes), in order of the tree's
+ * comparator. Every write is appended to the write_log (with a single
+ * persist) before it's visible in the memtable, so the buffered writes
+ * survive a crash - they are replayed from the log on the next open.
+ * Once the log is full, the memtable is drained into the tree (in sorted
+ * order) and the log is truncated.
+ */
+class write_buffer {
+public:
+	struct entry {
+		std::string value;
+		bool removed;
+	};
+	using map_type = std::map<std::string, entry, volatile_compare>;
+
+	enum class lookup { NOT_BUFFERED, FOUND, REMOVED };
+
+	write_buffer(pmem::obj::pool_base pop, write_log *log, const comparator *cmp)
+	    : pop(pop),
+	      log(log),
+	      data(static_cast<char *>(pmemobj_direct(log->data))),
+	      memtable(volatile_compare(cmp)),
+	      buffered(false)
+	{
+	}
+
+	/*
+	 * Appends puts of the pairs (or removes of the keys, if values is null)
+	 * to the log and the memtable - all of them or none. Returns false if
+	 * they don't fit into the free space of the log.
+	 */
+	bool append(const string_view *keys, const string_view *values, std::size_t n)
+	{
+		std::size_t total = 0;
+		for (std::size_t i = 0; i < n; ++i) {
+			auto vsize = values ? values[i].size() : 0;
+			if (keys[i].size() >= REMOVED || vsize >= REMOVED)
+				return false;
+			total += sizeof(record_header) + keys[i].size() + vsize;
+		}
+
+		std::lock_guard<std::mutex> lock(mtx);
+
+		auto used = log->used.get_ro();
+		if (total > log->capacity.get_ro() - used)
+			return false;
+
+		staging.clear();
+		for (std::size_t i = 0; i < n; ++i) {
+			record_header h;
+			h.key_size = static_cast<uint32_t>(keys[i].size());
+			h.value_size = REMOVED;
+			if (values)
+				h.value_size = static_cast<uint32_t>(values[i].size());
+			staging.append(reinterpret_cast<const char *>(&h), sizeof(h));
+			staging.append(keys[i].data(), keys[i].size());
+			if (values)
+				staging.append(values[i].data(), values[i].size());
+		}
+
+		/* records are complete before 'used' covers them */
+		auto nt_threshold = nontemporal_threshold(pop.handle());
+		if (nt_threshold > 0 && staging.size() >= nt_threshold)
+			pmemobj_memcpy(pop.handle(), data + used, staging.data(),
+				       staging.size(), PMEMOBJ_F_MEM_NONTEMPORAL);
+		else
+			pop.memcpy_persist(data + used, staging.data(), staging.size());
+		log->used = used + total;
+		pop.persist(log->used);
+
+		for (std::size_t i = 0; i < n; ++i)
+			put(keys[i], values ? &values[i] : nullptr);
+
+		return true;
+	}
+
+	/* Calls callback with the buffered value of the key, if there is one */
+	lookup find(string_view key, get_v_callback *callback, void *arg)
+	{
+		if (!buffered.load(std::memory_order_acquire))
+			return lookup::NOT_BUFFERED;
+
+		std::lock_guard<std::mutex> lock(mtx);
+
+		auto it = memtable.find(key);
+		if (it == memtable.end())
+			return lookup::NOT_BUFFERED;
+		if (it->second.removed)
+			return lookup::REMOVED;
+
+		if (callback)
+			callback(it->second.value.data(), it->second.value.size(), arg);
+
+		return lookup::FOUND;
+	}
+
+	/*
+	 * Calls apply(memtable) if any writes are buffered, then truncates the
+	 * log. If apply is interrupted by a crash, the whole log is replayed
+	 * once again - writes in order of the log are idempotent.
+	 */
+	template <typename F>
+	bool drain(F &&apply)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		if (log->used.get_ro() == 0)
+			return false;
+
+		apply(static_cast<const map_type &>(memtable));
+
+		log->used = 0;
+		pop.persist(log->used);
+		memtable.clear();
+		buffered.store(false, std::memory_order_release);
+
+		return true;
+	}
+
+	/* Rebuilds the memtable from records of the log, on open */
+	void replay()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		std::size_t pos = 0;
+		auto used = log->used.get_ro();
+		while (pos < used) {
+			record_header h;
+			std::memcpy(&h, data + pos, sizeof(h));
+			pos += sizeof(h);
+
+			string_view key(data + pos, h.key_size);
+			pos += h.key_size;
+
+			if (h.value_size == REMOVED) {
+				put(key, nullptr);
+			} else {
+				string_view value(data + pos, h.value_size);
+				pos += h.value_size;
+				put(key, &value);
+			}
+		}
+	}
+
+	bool empty() const
+	{
+		return !buffered.load(std::memory_order_acquire);
+	}
+
+	std::size_t capacity() const
+	{
+		return log->capacity.get_ro();
+	}
+
+private:
+	struct record_header {
+		uint32_t key_size;
+		/* REMOVED for removes */
+		uint32_t value_size;
+	};
+
+	static constexpr uint32_t REMOVED = std::numeric_limits<uint32_t>::max();
+
+	/* mtx must be locked */
+	void put(string_view key, const string_view *value)
+	{
+		auto &e = memtable[std::string(key.data(), key.size())];
+		e.removed = value == nullptr;
+		if (value)
+			e.value.assign(value->data(), value->size());
+		else
+			e.value.clear();
+
+		buffered.store(true, std::memory_order_release);
+	}
+
+	pmem::obj::pool_base pop;
+	write_log *log;
+	char *data;
+
+	/* appends are serialized, so records in the log are in order of writes */
+	std::mutex mtx;
+	map_type memtable;
+	/* reused for records of appends */
+	std::string staging;
+	/* set if the memtable is not empty, allows lookups without the mutex */
+	std::atomic<bool> buffered;
+};
+
+} /* namespace stree */
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_STREE_WRITE_BUFFER_H */
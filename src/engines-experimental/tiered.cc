@@ -0,0 +1,399 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "tiered.h"
+#include "../fast_hash.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace pmem
+{
+namespace kv
+{
+
+/* one of SAMPLE_RATE accesses (of a thread) is counted */
+static const unsigned SAMPLE_RATE = 4;
+/* sampled accesses after which a key of the cold engine becomes a candidate */
+static const uint32_t CANDIDATE_FREQUENCY = 2;
+static const std::size_t MAX_CANDIDATES = 1024;
+/* keys moved to the hot engine by a single migration step */
+static const std::size_t MAX_PROMOTIONS = 256;
+static const std::size_t VICTIM_SAMPLES = 8;
+
+static void copy_value(const char *v, size_t vb, void *arg)
+{
+	static_cast<std::string *>(arg)->assign(v, vb);
+}
+
+static int collect_key(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	static_cast<std::vector<std::string> *>(arg)->emplace_back(k, kb);
+	return 0;
+}
+
+static std::unique_ptr<engine_base> open_tier(internal::config &cfg, const char *tier)
+{
+	auto engine_key = std::string(tier) + "_engine";
+	auto config_key = std::string(tier) + "_config";
+
+	const char *engine_name;
+	if (!cfg.get_string(engine_key.c_str(), &engine_name))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"" + engine_key + "\"");
+
+	void *sub_config;
+	if (!cfg.get_object(config_key.c_str(), &sub_config))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"" + config_key + "\"");
+
+	return storage_engine_factory::create_engine(
+		engine_name, static_cast<internal::config *>(sub_config)->shared_copy());
+}
+
+static uint64_t get_uint64(internal::config &cfg, const char *key, uint64_t def)
+{
+	uint64_t value = def;
+	cfg.get_uint64(key, &value);
+
+	return value;
+}
+
+tiered::tiered(std::unique_ptr<internal::config> cfg)
+    : config(std::move(cfg)),
+      mtx(std::thread::hardware_concurrency()),
+      hot_capacity(get_uint64(*config, "hot_capacity", 0)),
+      demote_on_close(get_uint64(*config, "demote_on_close", 1) != 0),
+      interval(std::chrono::milliseconds(
+	      get_uint64(*config, "migration_interval_ms", 100))),
+      sketch(std::max<std::size_t>(hot_capacity * 4, 1024)),
+      promotions(0),
+      demotions(0)
+{
+	if (hot_capacity == 0)
+		throw internal::invalid_argument(
+			"Config item \"hot_capacity\" must be greater than 0");
+
+	cold = open_tier(*config, "cold");
+	hot = open_tier(*config, "hot");
+
+	/*
+	 * Keys of a persistent hot engine are still there after reopening. A key
+	 * could have been copied to it by an interrupted migration, before it
+	 * was removed from the cold engine - the hot engine's copy is the valid one.
+	 */
+	std::vector<std::string> keys;
+	auto s = hot->get_all(collect_key, &keys);
+	if (s != status::OK && s != status::NOT_SUPPORTED)
+		throw internal::error("Failed to read keys of the hot engine",
+				      static_cast<int>(s));
+	for (auto &key : keys) {
+		cold->remove(key);
+		add_hot_key(key);
+	}
+
+	migration_task.reset(new internal::background_task(
+		[this] { return migration_step(); }, interval));
+
+	LOG("Started ok");
+}
+
+tiered::~tiered()
+{
+	/* waits for the running step */
+	migration_task.reset();
+
+	if (demote_on_close) {
+		try {
+			demote_all();
+		} catch (std::exception &e) {
+			LOG("Failed to move keys to the cold engine: " << e.what());
+		}
+	}
+
+	/* engines use objects from their sub-configs, close them first */
+	hot.reset();
+	cold.reset();
+	LOG("Stopped ok");
+}
+
+std::string tiered::name()
+{
+	return "tiered";
+}
+
+status tiered::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	std::size_t hot_cnt = 0, cold_cnt = 0;
+	auto s = hot->count_all(hot_cnt);
+	if (s != status::OK)
+		return s;
+
+	s = cold->count_all(cold_cnt);
+	cnt = hot_cnt + cold_cnt;
+
+	return s;
+}
+
+/* keys of the hot engine come first, so keys are not ordered */
+status tiered::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = hot->get_all(callback, arg);
+	if (s != status::OK)
+		return s;
+
+	return cold->get_all(callback, arg);
+}
+
+status tiered::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = hot->exists(key);
+	sample(key, s == status::OK);
+	if (s != status::NOT_FOUND)
+		return s;
+
+	return cold->exists(key);
+}
+
+status tiered::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = hot->get(key, callback, arg);
+	sample(key, s == status::OK);
+	if (s != status::NOT_FOUND)
+		return s;
+
+	return cold->get(key, callback, arg);
+}
+
+/* a key is overwritten in the engine which holds it, new keys go to the cold one */
+status tiered::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = hot->exists(key);
+	sample(key, s == status::OK);
+	if (s == status::OK)
+		return hot->put(key, value);
+	if (s != status::NOT_FOUND)
+		return s;
+
+	return cold->put(key, value);
+}
+
+status tiered::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto s = hot->remove(key);
+	if (s != status::NOT_FOUND)
+		return s;
+
+	return cold->remove(key);
+}
+
+status tiered::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	std::size_t cnt;
+	auto s = count_all(cnt);
+	if (s != status::OK)
+		return s;
+
+	std::size_t hot_cnt;
+	{
+		internal::shared_lock_guard<mutex_type> lock(mtx);
+		s = hot->count_all(hot_cnt);
+		if (s != status::OK)
+			return s;
+	}
+
+	sink.add("count", cnt);
+	sink.add("tiered.hot_count", hot_cnt);
+	sink.add("tiered.promotions", promotions.load());
+	sink.add("tiered.demotions", demotions.load());
+	/* if it's much bigger than hot_capacity, hot keys are often replaced */
+	sink.add("tiered.working_set_keys", sampled_keys.estimate());
+
+	return status::OK;
+}
+
+void tiered::sample(string_view key, bool hot_key)
+{
+	static thread_local unsigned accesses = 0;
+	if (++accesses % SAMPLE_RATE != 0)
+		return;
+
+	sketch.add(key);
+	sampled_keys.add(fast_hash(key.size(), key.data()));
+	if (hot_key || sketch.estimate(key) < CANDIDATE_FREQUENCY)
+		return;
+
+	std::lock_guard<std::mutex> lock(candidates_mtx);
+	if (candidates.size() < MAX_CANDIDATES)
+		candidates.emplace_back(key.data(), key.size());
+}
+
+/*
+ * Promotes candidates in order of their estimated frequency. Once the hot
+ * engine is full, a candidate replaces the least frequent of a few sampled
+ * hot keys, if it's more frequent than that one. Counters are halved after
+ * every step.
+ */
+tiered::clock_type::duration tiered::migration_step()
+{
+	std::vector<std::string> keys;
+	{
+		std::lock_guard<std::mutex> lock(candidates_mtx);
+		keys.swap(candidates);
+	}
+
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	std::vector<std::pair<uint32_t, const std::string *>> ranked;
+	ranked.reserve(keys.size());
+	for (auto &key : keys)
+		ranked.emplace_back(sketch.estimate(key), &key);
+	std::sort(ranked.begin(), ranked.end(),
+		  [](const std::pair<uint32_t, const std::string *> &a,
+		     const std::pair<uint32_t, const std::string *> &b) {
+			  return a.first > b.first;
+		  });
+	if (ranked.size() > MAX_PROMOTIONS)
+		ranked.resize(MAX_PROMOTIONS);
+
+	/*
+	 * Failure of a move (e.g. when the hot engine is out of space) is not
+	 * fatal, the key will become a candidate again.
+	 */
+	try {
+		std::unique_lock<mutex_type> lock(mtx);
+		for (auto &c : ranked) {
+			auto &key = *c.second;
+			if (hot_index.count(key) || !make_room(c.first))
+				continue;
+
+			if (move(key, *cold, *hot)) {
+				add_hot_key(key);
+				++promotions;
+			}
+		}
+	} catch (std::exception &e) {
+		LOG("Migration failed: " << e.what());
+	}
+
+	sketch.age();
+
+	return interval;
+}
+
+bool tiered::make_room(uint32_t frequency)
+{
+	if (hot_keys.size() < hot_capacity)
+		return true;
+
+	auto victim = hot_keys.size();
+	auto victim_frequency = std::numeric_limits<uint32_t>::max();
+	for (std::size_t i = 0; i < VICTIM_SAMPLES; ++i) {
+		/* xorshift */
+		rng_state ^= rng_state << 13;
+		rng_state ^= rng_state >> 7;
+		rng_state ^= rng_state << 17;
+		auto idx = rng_state % hot_keys.size();
+
+		/* the key was removed by the user, its place is free */
+		if (hot->exists(hot_keys[idx]) != status::OK) {
+			remove_hot_key(idx);
+			return true;
+		}
+
+		auto f = sketch.estimate(hot_keys[idx]);
+		if (f < victim_frequency) {
+			victim = idx;
+			victim_frequency = f;
+		}
+	}
+
+	if (victim_frequency >= frequency)
+		return false;
+
+	auto key = hot_keys[victim];
+	remove_hot_key(victim);
+	if (move(key, *hot, *cold))
+		++demotions;
+
+	return true;
+}
+
+/*
+ * The key is put into the destination before it's removed from the source,
+ * so it's never missing - a crash in between leaves it in both engines.
+ */
+bool tiered::move(const std::string &key, engine_base &from, engine_base &to)
+{
+	std::string value;
+	if (from.get(key, copy_value, &value) != status::OK)
+		return false;
+
+	if (to.put(key, value) != status::OK)
+		return false;
+
+	from.remove(key);
+
+	return true;
+}
+
+void tiered::add_hot_key(const std::string &key)
+{
+	if (hot_index.count(key))
+		return;
+
+	hot_index.emplace(key, hot_keys.size());
+	hot_keys.push_back(key);
+}
+
+void tiered::remove_hot_key(std::size_t index)
+{
+	hot_index.erase(hot_keys[index]);
+	if (index != hot_keys.size() - 1) {
+		hot_keys[index] = std::move(hot_keys.back());
+		hot_index[hot_keys[index]] = index;
+	}
+	hot_keys.pop_back();
+}
+
+void tiered::demote_all()
+{
+	std::vector<std::string> keys;
+	auto s = hot->get_all(collect_key, &keys);
+	if (s != status::OK)
+		return;
+
+	for (auto &key : keys)
+		move(key, *hot, *cold);
+
+	hot_keys.clear();
+	hot_index.clear();
+}
+
+static factory_registerer
+	register_tiered(std::unique_ptr<engine_base::factory_base>(new tiered_factory));
+
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_TIERED_H
+#define LIBPMEMKV_TIERED_H
+
+#include "../access_stats.h"
+#include "../engine.h"
+#include "../sharded_shared_mutex.h"
+#include "../thread_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+
+/**
+ * Meta-engine which keeps frequently accessed keys in a fast (e.g. volatile)
+ * engine and the rest in a big (persistent) one, each key in exactly one of
+ * them. Accesses are sampled into a frequency sketch and a background task
+ * periodically moves the most frequent keys of the cold engine to the hot one,
+ * replacing (demoting) hot keys with lower estimates once the hot engine holds
+ * "hot_capacity" keys.
+ */
+class tiered : public engine_base {
+public:
+	tiered(std::unique_ptr<internal::config> cfg);
+	~tiered();
+
+	tiered(const tiered &) = delete;
+	tiered &operator=(const tiered &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status get_all(get_kv_callback *callback, void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+
+	status stats(internal::stats_sink &sink) final;
+
+private:
+	using mutex_type = internal::sharded_shared_mutex;
+	using clock_type = internal::background_task::clock_type;
+
+	/* Samples an access to the key, found in the hot engine or not */
+	void sample(string_view key, bool hot_key);
+
+	clock_type::duration migration_step();
+	/* Moves the key between engines, mtx must be locked exclusively */
+	bool move(const std::string &key, engine_base &from, engine_base &to);
+	void add_hot_key(const std::string &key);
+	void remove_hot_key(std::size_t index);
+	/*
+	 * Makes room in the hot engine for a key with the given frequency,
+	 * demoting a less frequent one if it's full. Returns false if none is.
+	 */
+	bool make_room(uint32_t frequency);
+	/* Moves all keys of the hot engine to the cold one */
+	void demote_all();
+
+	/* sub-configs of engines are owned (and shared) by this config */
+	std::unique_ptr<internal::config> config;
+
+	std::unique_ptr<engine_base> hot;
+	std::unique_ptr<engine_base> cold;
+
+	/* operations hold it shared, migration of keys exclusively */
+	mutex_type mtx;
+
+	std::size_t hot_capacity;
+	bool demote_on_close;
+	clock_type::duration interval;
+
+	internal::frequency_sketch sketch;
+	/* distinct sampled keys, compared with hot_capacity */
+	internal::distinct_counter sampled_keys;
+
+	std::mutex candidates_mtx;
+	/* sampled keys of the cold engine, considered by the next migration */
+	std::vector<std::string> candidates;
+
+	/*
+	 * Keys moved to the hot engine (with their indexes), used by migration
+	 * only - keys removed by the user are dropped from it lazily.
+	 */
+	std::vector<std::string> hot_keys;
+	std::unordered_map<std::string, std::size_t> hot_index;
+	uint64_t rng_state = 88172645463325252ULL;
+
+	std::atomic<uint64_t> promotions;
+	std::atomic<uint64_t> demotions;
+
+	std::unique_ptr<internal::background_task> migration_task;
+};
+
+class tiered_factory : public engine_base::factory_base {
+public:
+	std::unique_ptr<engine_base>
+	create(std::unique_ptr<internal::config> cfg) override
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new tiered(std::move(cfg)));
+	};
+	std::string get_name() override
+	{
+		return "tiered";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_TIERED_H */
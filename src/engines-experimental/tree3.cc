@@ -3,12 +3,15 @@
 
 #include "tree3.h"
 #include "../out.h"
+#include "../parallel_scan.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
-#include <list>
+#include <iterator>
+#include <thread>
+#include <unordered_set>
 #include <unistd.h>
 
 namespace pmem
@@ -17,9 +20,29 @@ namespace kv
 {
 
 tree3::tree3(std::unique_ptr<internal::config> cfg)
-    : pmemobj_engine_base(cfg, "pmemkv_tree3")
+    : pmemobj_engine_base(cfg, "pmemkv_tree3_v2"),
+      mtx(std::thread::hardware_concurrency())
 {
+	register_alloc_class(sizeof(internal::tree3::KVLeaf));
+
+	uint64_t compact = 0;
+	cfg->get_uint64("compact_leaves", &compact);
+	if (compact) {
+		uint64_t read_only = 0;
+		cfg->get_uint64("read_only", &read_only);
+		if (read_only)
+			throw internal::invalid_argument(
+				"Config item \"compact_leaves\" cannot be set with \"read_only\"");
+		compact_leaves = true;
+	}
+
+	uint64_t compact_keys = 0;
+	cfg->get_uint64("compact_index", &compact_keys);
+	compact_index = compact_keys != 0;
+
+	internal::open_phase phase("tree3.recover");
 	Recover();
+	phase.end();
 	LOG("Started ok");
 }
 
@@ -41,16 +64,13 @@ status tree3::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	// leaves, which are not in the tree, are empty
 	std::size_t result = 0;
-	auto leaf = (pmem::kv::internal::tree3::KVLeaf *)pmemobj_direct(*root_oid);
-	while (leaf) {
-		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = leaf->slots[slot].get_ro();
-			if (kvslot.empty() || kvslot.hash() == 0)
-				continue;
-			result++;
-		}
-		leaf = leaf->next.get(); // advance to next linked leaf
+	for (auto leafnode = LeafFirst(); leafnode; leafnode = leafnode->next) {
+		std::shared_lock<leaf_mutex_type> leaf_lock(leafnode->mtx);
+		result += leafnode->count;
 	}
 
 	cnt = result;
@@ -58,23 +78,127 @@ status tree3::count_all(std::size_t &cnt)
 	return status::OK;
 }
 
+status tree3::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return CountRange(&low, false, nullptr, false, cnt);
+}
+
+status tree3::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return CountRange(&low, true, nullptr, false, cnt);
+}
+
+status tree3::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return CountRange(nullptr, false, &high, true, cnt);
+}
+
+status tree3::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return CountRange(nullptr, false, &high, false, cnt);
+}
+
+status tree3::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between for key1=" << std::string(key1.data(), key1.size())
+				      << ", key2="
+				      << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	std::string low(key1.data(), key1.size());
+	std::string high(key2.data(), key2.size());
+	return CountRange(&low, false, &high, false, cnt);
+}
+
 status tree3::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 	check_outside_tx();
-	auto leaf = (pmem::kv::internal::tree3::KVLeaf *)pmemobj_direct(*root_oid);
-	while (leaf) {
-		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = leaf->slots[slot].get_ro();
-			if (kvslot.empty() || kvslot.hash() == 0)
-				continue;
-			auto ret = callback(kvslot.key(), kvslot.get_ks(), kvslot.val(),
-					    kvslot.get_vs(), arg);
-			if (ret != 0)
-				return status::STOPPED_BY_CB;
-		}
-		leaf = leaf->next.get(); // advance to next linked leaf
-	}
+	return GetRange(nullptr, false, nullptr, false, callback, arg);
+}
+
+status tree3::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return GetRange(&low, false, nullptr, false, callback, arg);
+}
+
+status tree3::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string low(key.data(), key.size());
+	return GetRange(&low, true, nullptr, false, callback, arg);
+}
+
+status tree3::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return GetRange(nullptr, false, &high, true, callback, arg);
+}
+
+status tree3::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	std::string high(key.data(), key.size());
+	return GetRange(nullptr, false, &high, false, callback, arg);
+}
+
+status tree3::get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			  void *arg)
+{
+	LOG("get_between for key1=" << std::string(key1.data(), key1.size())
+				    << ", key2="
+				    << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	std::string low(key1.data(), key1.size());
+	std::string high(key2.data(), key2.size());
+	return GetRange(&low, false, &high, false, callback, arg);
+}
+
+status tree3::GetRange(const std::string *low, bool low_eq, const std::string *high,
+		       bool high_eq, get_kv_callback *callback, void *arg)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	auto ret = LeafScan(low, low_eq, high, high_eq,
+			    [&](internal::tree3::KVLeafNode *leafnode, int slot) {
+				    auto &kvslot = leafnode->leaf->slots[slot].get_ro();
+				    return callback(kvslot.key(), kvslot.get_ks(),
+						    kvslot.val(), kvslot.get_vs(), arg);
+			    });
+
+	return ret != 0 ? status::STOPPED_BY_CB : status::OK;
+}
+
+status tree3::CountRange(const std::string *low, bool low_eq, const std::string *high,
+			 bool high_eq, std::size_t &cnt)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+
+	std::size_t result = 0;
+	LeafScan(low, low_eq, high, high_eq, [&](internal::tree3::KVLeafNode *, int) {
+		result++;
+		return 0;
+	});
+
+	cnt = result;
 
 	return status::OK;
 }
@@ -83,17 +207,14 @@ status tree3::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	// XXX - do not create temporary string
 	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
 	if (leafnode) {
+		std::shared_lock<leaf_mutex_type> leaf_lock(leafnode->mtx);
 		const uint8_t hash = PearsonHash(key.data(), key.size());
-		for (int slot = LEAF_KEYS; slot--;) {
-			if (leafnode->hashes[slot] == hash) {
-				if (leafnode->keys[slot].compare(
-					    std::string(key.data(), key.size())) == 0)
-					return status::OK;
-			}
-		}
+		if (LeafFindSlot(leafnode, hash, key) >= 0)
+			return status::OK;
 	}
 	LOG("   could not find key");
 	return status::NOT_FOUND;
@@ -103,23 +224,19 @@ status tree3::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get using callback for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	// XXX - do not create temporary string
 	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
 	if (leafnode) {
+		std::shared_lock<leaf_mutex_type> leaf_lock(leafnode->mtx);
 		const uint8_t hash = PearsonHash(key.data(), key.size());
-		for (int slot = LEAF_KEYS; slot--;) {
-			if (leafnode->hashes[slot] == hash) {
-				LOG("   found hash match, slot=" << slot);
-				if (leafnode->keys[slot].compare(
-					    std::string(key.data(), key.size())) == 0) {
-					auto kv = leafnode->leaf->slots[slot].get_ro();
-					LOG("   found value, slot="
-					    << slot
-					    << ", size=" << std::to_string(kv.valsize()));
-					callback(kv.val(), kv.valsize(), arg);
-					return status::OK;
-				}
-			}
+		auto slot = LeafFindSlot(leafnode, hash, key);
+		if (slot >= 0) {
+			auto &kv = leafnode->leaf->slots[slot].get_ro();
+			LOG("   found value, slot=" << slot << ", size="
+						     << std::to_string(kv.valsize()));
+			callback(kv.val(), kv.valsize(), arg);
+			return status::OK;
 		}
 	}
 	LOG("   could not find key");
@@ -133,13 +250,29 @@ status tree3::put(string_view key, string_view value)
 	check_outside_tx();
 
 	const auto hash = PearsonHash(key.data(), key.size());
+
+	// most puts fill a slot of an existing leaf, holding the leaf's lock only
+	{
+		internal::shared_lock_guard<mutex_type> lock(mtx);
+		// XXX - do not create temporary string
+		auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+		if (leafnode) {
+			std::unique_lock<leaf_mutex_type> leaf_lock(leafnode->mtx);
+			if (LeafFillSlotForKey(leafnode, hash,
+					       std::string(key.data(), key.size()),
+					       std::string(value.data(), value.size())))
+				return status::OK;
+		}
+	}
+
+	// the leaf is full (or there's none yet), the tree is changed exclusively;
+	// other thread might have split the leaf in the meantime, so search again
+	std::unique_lock<mutex_type> lock(mtx);
 	// XXX - do not create temporary string
 	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
 	if (!leafnode) {
 		LOG("   adding head leaf");
-		unique_ptr<internal::tree3::KVLeafNode> new_node(
-			new internal::tree3::KVLeafNode());
-		new_node->is_leaf = true;
+		auto new_node = LeafNew();
 		transaction::run(pmpool, [&] {
 			if (!leaves_prealloc.empty()) {
 				new_node->leaf = leaves_prealloc.back();
@@ -147,8 +280,10 @@ status tree3::put(string_view key, string_view value)
 			} else {
 				auto old_head = persistent_ptr<internal::tree3::KVLeaf>(
 					*root_oid);
-				auto new_leaf =
-					make_persistent<internal::tree3::KVLeaf>();
+				auto new_leaf = make_persistent<internal::tree3::KVLeaf>(
+					internal::alloc_class_flag(
+						pmpool.handle(),
+						sizeof(internal::tree3::KVLeaf)));
 				transaction::snapshot(root_oid);
 				*root_oid = new_leaf.raw();
 				new_leaf->next = old_head;
@@ -174,6 +309,7 @@ status tree3::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 
 	// XXX - do not create temporary string
 	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
@@ -182,29 +318,84 @@ status tree3::remove(string_view key)
 		return status::NOT_FOUND;
 	}
 
+	std::unique_lock<leaf_mutex_type> leaf_lock(leafnode->mtx);
+
 	const auto hash = PearsonHash(key.data(), key.size());
-	for (int slot = LEAF_KEYS; slot--;) {
-		if (leafnode->hashes[slot] == hash) {
-			if (leafnode->keys[slot].compare(
-				    std::string(key.data(), key.size())) == 0) {
-				LOG("   freeing slot=" << slot);
-				leafnode->hashes[slot] = 0;
-				leafnode->keys[slot].clear();
-				auto leaf = leafnode->leaf;
-				transaction::run(pmpool, [&] {
-					leaf->slots[slot].get_rw().clear();
-				});
-				return status::OK; // no duplicate keys allowed
-			}
-		}
-	}
-	return status::NOT_FOUND;
+	auto slot = LeafFindSlot(leafnode, hash, key);
+	if (slot < 0)
+		return status::NOT_FOUND;
+
+	LOG("   freeing slot=" << slot);
+	LeafOrderErase(leafnode, slot);
+	leafnode->hashes[slot] = 0;
+	if (leafnode->keys)
+		leafnode->keys[slot].clear();
+	auto leaf = leafnode->leaf;
+	transaction::run(pmpool, [&] { leaf->slots[slot].get_rw().clear(); });
+	return status::OK;
+}
+
+status tree3::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	std::size_t cnt = 0;
+	count_all(cnt);
+	report_memory(sink, cnt);
+	sink.add("tree3.compacted_leaves", compacted_leaves);
+
+	return status::OK;
+}
+
+// records (keys with values) are allocated separately from leaves
+internal::memory_stats tree3::memory_types()
+{
+	internal::memory_stats mem;
+	mem.add_type(pmem::detail::type_num<internal::tree3::KVLeaf>(), "leaves",
+		     sizeof(internal::tree3::KVLeaf));
+	mem.add_type(pmem::detail::type_num<char>(), "records");
+
+	return mem;
+}
+
+internal::iterator_base *tree3::new_iterator()
+{
+	return new tree3_iterator{this};
+}
+
+internal::iterator_base *tree3::new_const_iterator()
+{
+	return new tree3_const_iterator{this};
 }
 
 // ===============================================================================================
 // PROTECTED LEAF METHODS
 // ===============================================================================================
 
+unique_ptr<internal::tree3::KVLeafNode> tree3::LeafNew()
+{
+	unique_ptr<internal::tree3::KVLeafNode> leafnode(
+		new internal::tree3::KVLeafNode());
+	leafnode->is_leaf = true;
+	if (!compact_index)
+		leafnode->keys.reset(new std::string[LEAF_KEYS]);
+	return leafnode;
+}
+
+string_view internal::tree3::KVLeafNode::key(const int slot) const
+{
+	if (keys)
+		return keys[slot];
+
+	auto &kvslot = leaf->slots[slot].get_ro();
+	return string_view(kvslot.key(), kvslot.get_ks());
+}
+
 internal::tree3::KVLeafNode *tree3::LeafSearch(const std::string &key)
 {
 	internal::tree3::KVNode *node = tree_top.get();
@@ -231,37 +422,162 @@ internal::tree3::KVLeafNode *tree3::LeafSearch(const std::string &key)
 	return (internal::tree3::KVLeafNode *)node;
 }
 
-void tree3::LeafFillEmptySlot(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
-			      const std::string &key, const std::string &value)
+/*
+ * Returns mask with the highest bit set in bytes of 'word' equal to 'hash'
+ * (SWAR, i.e. SIMD within a 64-bit register). It may report false positives,
+ * but only above a real match.
+ */
+static uint64_t HashesMatch(uint64_t word, uint8_t hash)
 {
-	for (int slot = LEAF_KEYS; slot--;) {
-		if (leafnode->hashes[slot] == 0) {
-			LeafFillSpecificSlot(leafnode, hash, key, value, slot);
-			return;
+	const uint64_t lows = 0x0101010101010101ULL;
+	auto x = word ^ (lows * hash);
+
+	return (x - lows) & ~x & (lows << 7);
+}
+
+int tree3::LeafFindSlot(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
+			string_view key)
+{
+	for (int w = 0; w < LEAF_KEYS; w += (int)sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, leafnode->hashes + w, sizeof(word));
+
+		for (auto matches = HashesMatch(word, hash); matches != 0;
+		     matches &= matches - 1) {
+			auto slot = w + __builtin_ctzll(matches) / 8;
+			if (leafnode->hashes[slot] != hash)
+				continue; // false positive
+			LOG("   found hash match, slot=" << slot);
+			if (leafnode->key(slot).compare(key) == 0)
+				return slot; // no duplicate keys allowed
 		}
 	}
+	return -1;
 }
 
-bool tree3::LeafFillSlotForKey(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
-			       const std::string &key, const std::string &value)
+int tree3::LeafFindEmptySlot(internal::tree3::KVLeafNode *leafnode)
 {
-	// scan for empty/matching slots
-	int last_empty_slot = -1;
-	int key_match_slot = -1;
-	for (int slot = LEAF_KEYS; slot--;) {
-		auto slot_hash = leafnode->hashes[slot];
-		if (slot_hash == 0) {
-			last_empty_slot = slot;
-		} else if (slot_hash == hash) {
-			if (leafnode->keys[slot].compare(key) == 0) {
-				key_match_slot = slot;
-				break; // no duplicate keys allowed
+	for (int w = 0; w < LEAF_KEYS; w += (int)sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, leafnode->hashes + w, sizeof(word));
+
+		// the lowest reported byte is always a real match
+		auto matches = HashesMatch(word, 0);
+		if (matches != 0)
+			return w + __builtin_ctzll(matches) / 8;
+	}
+	return -1;
+}
+
+internal::tree3::KVLeafNode *tree3::LeafFirst()
+{
+	internal::tree3::KVNode *node = tree_top.get();
+	if (node == nullptr)
+		return nullptr;
+	while (!node->is_leaf)
+		node = ((internal::tree3::KVInnerNode *)node)->children[0].get();
+	return (internal::tree3::KVLeafNode *)node;
+}
+
+internal::tree3::KVLeafNode *tree3::LeafLast()
+{
+	internal::tree3::KVNode *node = tree_top.get();
+	if (node == nullptr)
+		return nullptr;
+	while (!node->is_leaf) {
+		auto inner = (internal::tree3::KVInnerNode *)node;
+		node = inner->children[inner->keycount].get();
+	}
+	return (internal::tree3::KVLeafNode *)node;
+}
+
+int tree3::LeafScan(const std::string *low, const bool low_eq, const std::string *high,
+		    const bool high_eq,
+		    const std::function<int(internal::tree3::KVLeafNode *, int)> &f)
+{
+	// keys above low are in its leaf or in the next ones
+	auto leafnode = low ? LeafSearch(*low) : LeafFirst();
+	for (bool first = true; leafnode; leafnode = leafnode->next, first = false) {
+		std::shared_lock<leaf_mutex_type> leaf_lock(leafnode->mtx);
+		int idx = (low && first) ? LeafOrderBound(leafnode, *low, !low_eq) : 0;
+		for (; idx < leafnode->count; idx++) {
+			const int slot = leafnode->order[idx];
+			if (high) {
+				auto cmp = leafnode->key(slot).compare(*high);
+				if (cmp > 0 || (cmp == 0 && !high_eq))
+					return 0;
 			}
+			auto ret = f(leafnode, slot);
+			if (ret != 0)
+				return ret;
 		}
 	}
+	return 0;
+}
+
+void tree3::LeafOrderBuild(internal::tree3::KVLeafNode *leafnode)
+{
+	uint8_t count = 0;
+	for (int slot = 0; slot < LEAF_KEYS; slot++) {
+		if (leafnode->hashes[slot] != 0)
+			leafnode->order[count++] = (uint8_t)slot;
+	}
+	std::sort(leafnode->order, leafnode->order + count,
+		  [&](uint8_t lhs, uint8_t rhs) {
+			  return leafnode->key(lhs).compare(leafnode->key(rhs)) < 0;
+		  });
+	leafnode->count = count;
+}
+
+void tree3::LeafOrderInsert(internal::tree3::KVLeafNode *leafnode, const int slot)
+{
+	auto idx = LeafOrderBound(leafnode, leafnode->key(slot), false);
+	std::copy_backward(leafnode->order + idx, leafnode->order + leafnode->count,
+			   leafnode->order + leafnode->count + 1);
+	leafnode->order[idx] = (uint8_t)slot;
+	leafnode->count++;
+}
+
+void tree3::LeafOrderErase(internal::tree3::KVLeafNode *leafnode, const int slot)
+{
+	auto idx = LeafOrderBound(leafnode, leafnode->key(slot), false);
+	assert(idx < leafnode->count && leafnode->order[idx] == slot);
+	std::copy(leafnode->order + idx + 1, leafnode->order + leafnode->count,
+		  leafnode->order + idx);
+	leafnode->count--;
+}
+
+int tree3::LeafOrderBound(internal::tree3::KVLeafNode *leafnode, string_view key,
+			  const bool upper)
+{
+	int first = 0;
+	int last = leafnode->count;
+	while (first < last) {
+		int mid = first + (last - first) / 2;
+		auto cmp = leafnode->key(leafnode->order[mid]).compare(key);
+		if (cmp < 0 || (upper && cmp == 0))
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	return first;
+}
+
+void tree3::LeafFillEmptySlot(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
+			      const std::string &key, const std::string &value)
+{
+	auto slot = LeafFindEmptySlot(leafnode);
+	if (slot >= 0)
+		LeafFillSpecificSlot(leafnode, hash, key, value, slot);
+}
 
-	// update suitable slot if found
-	int slot = key_match_slot >= 0 ? key_match_slot : last_empty_slot;
+bool tree3::LeafFillSlotForKey(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
+			       const std::string &key, const std::string &value)
+{
+	// update matching slot or, if there's none, an empty one
+	int slot = LeafFindSlot(leafnode, hash, key);
+	if (slot < 0)
+		slot = LeafFindEmptySlot(leafnode);
 	if (slot >= 0) {
 		LOG("   filling slot=" << slot);
 		transaction::run(pmpool, [&] {
@@ -275,9 +591,30 @@ void tree3::LeafFillSpecificSlot(internal::tree3::KVLeafNode *leafnode,
 				 const uint8_t hash, const std::string &key,
 				 const std::string &value, const int slot)
 {
+	const bool added = leafnode->hashes[slot] == 0;
 	leafnode->leaf->slots[slot].get_rw().set(hash, key, value);
 	leafnode->hashes[slot] = hash;
-	leafnode->keys[slot] = key;
+	if (leafnode->keys)
+		leafnode->keys[slot] = key;
+	if (added)
+		LeafOrderInsert(leafnode, slot);
+}
+
+/*
+ * Returns a short key s, such that left <= s < right (left < right), used to
+ * separate leaves in inner nodes (compact_index), instead of the whole left one.
+ */
+static std::string SeparatorKey(const std::string &left, const std::string &right)
+{
+	std::size_t common = 0;
+	while (common < left.size() && common < right.size() &&
+	       left[common] == right[common])
+		common++;
+
+	// prefix of right one byte longer than the common one sorts above left
+	if (common + 1 < right.size())
+		return right.substr(0, common + 1);
+	return left;
 }
 
 void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
@@ -285,20 +622,22 @@ void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t h
 {
 	std::string keys[LEAF_KEYS + 1];
 	keys[LEAF_KEYS] = key;
-	for (int slot = LEAF_KEYS; slot--;)
-		keys[slot] = leafnode->keys[slot];
+	for (int slot = LEAF_KEYS; slot--;) {
+		auto k = leafnode->key(slot);
+		keys[slot].assign(k.data(), k.size());
+	}
 	std::sort(std::begin(keys), std::end(keys),
 		  [](const std::string &lhs, const std::string &rhs) {
 			  return lhs.compare(rhs) < 0;
 		  });
-	std::string split_key = keys[LEAF_KEYS_MIDPOINT];
+	std::string split_key = compact_index
+		? SeparatorKey(keys[LEAF_KEYS_MIDPOINT], keys[LEAF_KEYS_MIDPOINT + 1])
+		: keys[LEAF_KEYS_MIDPOINT];
 	LOG("   splitting leaf at key=" << split_key);
 
 	// split leaf into two leaves, moving slots that sort above split key to new leaf
-	unique_ptr<internal::tree3::KVLeafNode> new_leafnode(
-		new internal::tree3::KVLeafNode());
+	auto new_leafnode = LeafNew();
 	new_leafnode->parent = leafnode->parent;
-	new_leafnode->is_leaf = true;
 	transaction::run(pmpool, [&] {
 		persistent_ptr<internal::tree3::KVLeaf> new_leaf;
 		if (!leaves_prealloc.empty()) {
@@ -308,25 +647,38 @@ void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t h
 		} else {
 			auto old_head =
 				persistent_ptr<internal::tree3::KVLeaf>(*root_oid);
-			new_leaf = make_persistent<internal::tree3::KVLeaf>();
+			new_leaf = make_persistent<internal::tree3::KVLeaf>(
+				internal::alloc_class_flag(
+					pmpool.handle(), sizeof(internal::tree3::KVLeaf)));
 			transaction::snapshot(root_oid);
 			*root_oid = new_leaf.raw();
 			new_leaf->next = old_head;
 			new_leafnode->leaf = new_leaf;
 		}
 		for (int slot = LEAF_KEYS; slot--;) {
-			if (leafnode->keys[slot].compare(split_key) > 0) {
+			if (leafnode->key(slot).compare(split_key) > 0) {
 				new_leaf->slots[slot].swap(leafnode->leaf->slots[slot]);
 				new_leafnode->hashes[slot] = leafnode->hashes[slot];
-				new_leafnode->keys[slot] = leafnode->keys[slot];
 				leafnode->hashes[slot] = 0;
-				leafnode->keys[slot].clear();
+				if (leafnode->keys) {
+					new_leafnode->keys[slot] = leafnode->keys[slot];
+					leafnode->keys[slot].clear();
+				}
 			}
 		}
+		LeafOrderBuild(leafnode);
+		LeafOrderBuild(new_leafnode.get());
 		auto target = key.compare(split_key) > 0 ? new_leafnode.get() : leafnode;
 		LeafFillEmptySlot(target, hash, key, value);
 	});
 
+	// new leaf node holds keys above split key, so it follows the split one
+	new_leafnode->prev = leafnode;
+	new_leafnode->next = leafnode->next;
+	if (leafnode->next)
+		leafnode->next->prev = new_leafnode.get();
+	leafnode->next = new_leafnode.get();
+
 	// recursively update volatile parents outside persistent transaction
 	InnerUpdateAfterSplit(leafnode, move(new_leafnode), &split_key);
 }
@@ -411,71 +763,93 @@ void tree3::Recover()
 {
 	LOG("Recovering");
 
-	// traverse persistent leaves to build list of leaves to recover
-	std::list<internal::tree3::KVRecoveredLeaf> leaves;
-
+	// collect persistent leaves first, so they can be recovered in chunks
+	internal::open_phase phase("tree3.leaf_walk");
+	vector<persistent_ptr<internal::tree3::KVLeaf>> pleaves;
 	auto root_leaf = persistent_ptr<internal::tree3::KVLeaf>(*root_oid);
-
 	while (root_leaf) {
-		unique_ptr<internal::tree3::KVLeafNode> leafnode(
-			new internal::tree3::KVLeafNode());
-		leafnode->leaf = root_leaf;
-		leafnode->is_leaf = true;
-
-		// find highest sorting key in leaf, while recovering all hashes
-		bool empty_leaf = true;
-		std::string max_key;
-		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = root_leaf->slots[slot].get_ro();
-			if (kvslot.empty())
-				continue;
-			leafnode->hashes[slot] = kvslot.hash();
-			if (leafnode->hashes[slot] == 0)
-				continue;
-			const char *key = kvslot.key();
-			if (empty_leaf) {
-				max_key = std::string(kvslot.key(), kvslot.get_ks());
-				empty_leaf = false;
-			} else if (max_key.compare(0, std::string::npos, kvslot.key(),
-						   kvslot.get_ks()) < 0) {
-				max_key = std::string(kvslot.key(), kvslot.get_ks());
-			}
-			leafnode->keys[slot] = std::string(key, kvslot.get_ks());
-		}
-
-		// use highest sorting key to decide how to recover the leaf
-		if (empty_leaf) {
-			leaves_prealloc.push_back(root_leaf);
-		} else {
-			leaves.push_back({move(leafnode), max_key});
-		}
-
+		pleaves.push_back(root_leaf);
 		root_leaf = root_leaf->next.get(); // advance to next linked leaf
 	}
 
-	// sort recovered leaves in ascending key order
-	leaves.sort([](const internal::tree3::KVRecoveredLeaf &lhs,
-		       const internal::tree3::KVRecoveredLeaf &rhs) {
+	std::size_t threads = std::thread::hardware_concurrency();
+	threads = std::max<std::size_t>(
+		1, std::min(threads, pleaves.size() / RECOVERY_LEAVES));
+	std::size_t chunk = (pleaves.size() + threads - 1) / threads;
+
+	auto by_max_key = [](const internal::tree3::KVRecoveredLeaf &lhs,
+			     const internal::tree3::KVRecoveredLeaf &rhs) {
 		return (lhs.max_key.compare(rhs.max_key) < 0);
+	};
+
+	// each thread recovers its chunk of leaves into a run sorted by max_key
+	phase.next("tree3.leaf_recovery");
+	vector<vector<internal::tree3::KVRecoveredLeaf>> runs(threads);
+	vector<vector<persistent_ptr<internal::tree3::KVLeaf>>> prealloc(threads);
+	internal::parallel_run(threads, [&](std::size_t t) {
+		auto first = std::min(t * chunk, pleaves.size());
+		auto last = std::min(first + chunk, pleaves.size());
+		for (auto i = first; i < last; ++i) {
+			internal::tree3::KVRecoveredLeaf recovered;
+			if (RecoverLeaf(pleaves[i], recovered))
+				runs[t].push_back(move(recovered));
+			else
+				prealloc[t].push_back(pleaves[i]);
+		}
+		std::sort(runs[t].begin(), runs[t].end(), by_max_key);
+
+		return status::OK;
 	});
 
+	// merge sorted runs in ascending key order
+	phase.next("tree3.merge");
+	vector<internal::tree3::KVRecoveredLeaf> leaves;
+	vector<std::size_t> bounds = {0};
+	for (std::size_t t = 0; t < threads; ++t) {
+		leaves_prealloc.insert(leaves_prealloc.end(), prealloc[t].begin(),
+				       prealloc[t].end());
+		std::move(runs[t].begin(), runs[t].end(), std::back_inserter(leaves));
+		bounds.push_back(leaves.size());
+	}
+	while (bounds.size() > 2) {
+		vector<std::size_t> merged = {0};
+		auto at = [&](std::size_t r) {
+			return leaves.begin() + static_cast<std::ptrdiff_t>(bounds[r]);
+		};
+		for (std::size_t r = 2; r < bounds.size(); r += 2) {
+			std::inplace_merge(at(r - 2), at(r - 1), at(r), by_max_key);
+			merged.push_back(bounds[r]);
+		}
+		if (bounds.size() % 2 == 0)
+			merged.push_back(bounds.back());
+		bounds = move(merged);
+	}
+
+	if (compact_leaves) {
+		phase.next("tree3.compaction");
+		CompactLeaves(leaves, pleaves);
+	}
+
 	// reconstruct top/inner nodes using adjacent pairs of recovered leaves
+	phase.next("tree3.inner_nodes");
 	tree_top.reset(nullptr);
 
 	if (!leaves.empty()) {
+		auto prevnode = leaves.front().leafnode.get();
 		tree_top = move(leaves.front().leafnode);
 		auto max_key = leaves.front().max_key;
-		leaves.pop_front();
 
-		auto prevnode = tree_top.get();
-		while (!leaves.empty()) {
-			std::string split_key = std::string(max_key);
-			auto nextnode = leaves.front().leafnode.get();
+		for (std::size_t i = 1; i < leaves.size(); ++i) {
+			std::string split_key = compact_index
+				? SeparatorKey(max_key, leaves[i].min_key)
+				: std::string(max_key);
+			auto nextnode = leaves[i].leafnode.get();
 			nextnode->parent = prevnode->parent;
-			InnerUpdateAfterSplit(prevnode, move(leaves.front().leafnode),
+			nextnode->prev = prevnode;
+			prevnode->next = nextnode;
+			InnerUpdateAfterSplit(prevnode, move(leaves[i].leafnode),
 					      &split_key);
-			max_key = leaves.front().max_key;
-			leaves.pop_front();
+			max_key = leaves[i].max_key;
 			prevnode = nextnode;
 		}
 	}
@@ -483,6 +857,132 @@ void tree3::Recover()
 	LOG("Recovered ok");
 }
 
+/*
+ * Neighbouring leaves (in key order) are merged while they fit in
+ * COMPACTION_FILL slots, so that they are not split again by the next few
+ * inserts. Every merge is a separate transaction; the merged leaf stays in
+ * the persistent list until it's freed, as an empty one, so it's simply
+ * recovered as empty after a crash.
+ *
+ * Merged and empty leaves (the ones which would be preallocated for splits)
+ * are then unlinked from the persistent list and freed, in transactions of
+ * at most COMPACTION_FREE_LEAVES leaves, walking the list in its order.
+ */
+void tree3::CompactLeaves(vector<internal::tree3::KVRecoveredLeaf> &leaves,
+			  const vector<persistent_ptr<internal::tree3::KVLeaf>> &pleaves)
+{
+	std::unordered_set<uint64_t> freed;
+	for (auto &leaf : leaves_prealloc)
+		freed.insert(leaf.raw().off);
+	leaves_prealloc.clear();
+
+	std::size_t kept = 0;
+	for (std::size_t i = 1; i < leaves.size(); ++i) {
+		auto dst = leaves[kept].leafnode.get();
+		auto src = leaves[i].leafnode.get();
+		if (dst->count + src->count <= COMPACTION_FILL) {
+			LeafMerge(dst, src);
+			leaves[kept].max_key = move(leaves[i].max_key);
+			freed.insert(src->leaf.raw().off);
+		} else if (++kept != i) {
+			leaves[kept] = move(leaves[i]);
+		}
+	}
+	if (!leaves.empty())
+		leaves.resize(kept + 1);
+
+	persistent_ptr<internal::tree3::KVLeaf> prev = nullptr;
+	for (std::size_t i = 0; i < pleaves.size();) {
+		if (freed.count(pleaves[i].raw().off) == 0) {
+			prev = pleaves[i++];
+			continue;
+		}
+
+		auto last = i;
+		while (last < pleaves.size() && last - i < COMPACTION_FREE_LEAVES &&
+		       freed.count(pleaves[last].raw().off) != 0)
+			++last;
+
+		transaction::run(pmpool, [&] {
+			auto next = pleaves[last - 1]->next;
+			if (prev) {
+				prev->next = next;
+			} else {
+				transaction::snapshot(root_oid);
+				*root_oid = next.raw();
+			}
+			for (auto j = i; j < last; ++j)
+				delete_persistent<internal::tree3::KVLeaf>(pleaves[j]);
+		});
+		i = last;
+	}
+
+	compacted_leaves = freed.size();
+	LOG("   compacted leaves=" << compacted_leaves);
+}
+
+void tree3::LeafMerge(internal::tree3::KVLeafNode *dst, internal::tree3::KVLeafNode *src)
+{
+	transaction::run(pmpool, [&] {
+		for (int slot = 0; slot < LEAF_KEYS; slot++) {
+			if (src->hashes[slot] == 0)
+				continue;
+			auto empty = LeafFindEmptySlot(dst);
+			assert(empty >= 0);
+			dst->leaf->slots[empty].swap(src->leaf->slots[slot]);
+			dst->hashes[empty] = src->hashes[slot];
+			if (dst->keys)
+				dst->keys[empty] = move(src->keys[slot]);
+			src->hashes[slot] = 0;
+		}
+	});
+
+	// keys of src are above the ones of dst
+	LeafOrderBuild(dst);
+}
+
+bool tree3::RecoverLeaf(persistent_ptr<internal::tree3::KVLeaf> leaf,
+			internal::tree3::KVRecoveredLeaf &recovered)
+{
+	auto leafnode = LeafNew();
+	leafnode->leaf = leaf;
+
+	// find lowest and highest sorting keys in leaf, while recovering all hashes
+	bool empty_leaf = true;
+	std::string min_key, max_key;
+	for (int slot = LEAF_KEYS; slot--;) {
+		auto &kvslot = leaf->slots[slot].get_ro();
+		if (kvslot.empty())
+			continue;
+		leafnode->hashes[slot] = kvslot.hash();
+		if (leafnode->hashes[slot] == 0)
+			continue;
+		const char *key = kvslot.key();
+		if (empty_leaf) {
+			min_key = max_key = std::string(key, kvslot.get_ks());
+			empty_leaf = false;
+		} else if (max_key.compare(0, std::string::npos, key, kvslot.get_ks()) <
+			   0) {
+			max_key = std::string(key, kvslot.get_ks());
+		} else if (min_key.compare(0, std::string::npos, key, kvslot.get_ks()) >
+			   0) {
+			min_key = std::string(key, kvslot.get_ks());
+		}
+		if (leafnode->keys)
+			leafnode->keys[slot] = std::string(key, kvslot.get_ks());
+	}
+
+	// use highest sorting key to decide how to recover the leaf
+	if (empty_leaf)
+		return false;
+
+	LeafOrderBuild(leafnode.get());
+	recovered.leafnode = move(leafnode);
+	recovered.min_key = move(min_key);
+	recovered.max_key = move(max_key);
+	return true;
+}
+
 // ===============================================================================================
 // PEARSON HASH METHODS
 // ===============================================================================================
@@ -522,12 +1022,13 @@ uint8_t tree3::PearsonHash(const char *data, const size_t size)
 // SLOT CLASS METHODS
 // ===============================================================================================
 
-bool internal::tree3::KVSlot::empty()
+bool internal::tree3::KVSlot::empty() const
 {
+	// Pearson hashes are never 0, it's kept for unused slots
 	if (kv)
 		return false;
 	else
-		return true;
+		return get_ph() == 0;
 }
 
 void internal::tree3::KVSlot::clear()
@@ -543,6 +1044,10 @@ void internal::tree3::KVSlot::clear()
 						  get_vs_direct(p) + 2);
 		kv = nullptr;
 	}
+	// inline header may be left from before the pair was moved out-of-line
+	set_ph_direct(inline_kv, 0);
+	set_ks_direct(inline_kv, 0);
+	set_vs_direct(inline_kv, 0);
 }
 
 void internal::tree3::KVSlot::set(const uint8_t hash, const std::string &key,
@@ -554,6 +1059,7 @@ void internal::tree3::KVSlot::set(const uint8_t hash, const std::string &key,
 					  sizeof(uint8_t) + sizeof(uint32_t) +
 						  sizeof(uint32_t) + get_ks_direct(p) +
 						  get_vs_direct(p) + 2);
+		kv = nullptr;
 	}
 	size_t ksize;
 	size_t vsize;
@@ -561,8 +1067,11 @@ void internal::tree3::KVSlot::set(const uint8_t hash, const std::string &key,
 	vsize = value.size();
 	size_t size =
 		ksize + vsize + 2 + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint8_t);
-	kv = make_persistent<char[]>(size);
-	char *p = kv.get();
+	if (size > SLOT_INLINE_SIZE)
+		kv = make_persistent<char[]>(size);
+	else
+		memset(inline_kv, 0, size); // zero terminators of key and value
+	char *p = data();
 	set_ph_direct(p, hash);
 	set_ks_direct(p, (uint32_t)ksize);
 	set_vs_direct(p, (uint32_t)vsize);
@@ -572,6 +1081,241 @@ void internal::tree3::KVSlot::set(const uint8_t hash, const std::string &key,
 	memcpy(kvptr, value.data(), vsize); // copy value into buffer
 }
 
+// ===============================================================================================
+// ITERATOR METHODS
+// ===============================================================================================
+
+tree3::tree3_const_iterator::tree3_const_iterator(tree3 *engine)
+    : engine(engine), leafnode(nullptr), idx(0)
+{
+}
+
+tree3::tree3_iterator::tree3_iterator(tree3 *engine) : tree3::tree3_const_iterator(engine)
+{
+}
+
+status tree3::tree3_const_iterator::forward(internal::tree3::KVLeafNode *&leafnode,
+					    int &idx)
+{
+	// leaf nodes emptied by removes are skipped
+	while (leafnode && idx >= leafnode->count) {
+		leafnode = leafnode->next;
+		idx = 0;
+	}
+	return leafnode ? status::OK : status::NOT_FOUND;
+}
+
+status tree3::tree3_const_iterator::backward(internal::tree3::KVLeafNode *&leafnode,
+					     int &idx)
+{
+	while (leafnode && idx < 0) {
+		leafnode = leafnode->prev;
+		idx = leafnode ? leafnode->count - 1 : 0;
+	}
+	return leafnode ? status::OK : status::NOT_FOUND;
+}
+
+const internal::tree3::KVSlot &tree3::tree3_const_iterator::slot()
+{
+	assert(leafnode && idx < leafnode->count);
+	return leafnode->leaf->slots[leafnode->order[idx]].get_ro();
+}
+
+status tree3::tree3_const_iterator::seek(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	std::string k(key.data(), key.size());
+	leafnode = engine->LeafSearch(k);
+	if (leafnode) {
+		idx = engine->LeafOrderBound(leafnode, k, false);
+		if (idx < leafnode->count &&
+		    leafnode->key(leafnode->order[idx]).compare(k) == 0)
+			return status::OK;
+	}
+
+	leafnode = nullptr;
+	return status::NOT_FOUND;
+}
+
+status tree3::tree3_const_iterator::seek_lower(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	std::string k(key.data(), key.size());
+	leafnode = engine->LeafSearch(k);
+	if (leafnode)
+		idx = engine->LeafOrderBound(leafnode, k, false) - 1;
+
+	return backward(leafnode, idx);
+}
+
+status tree3::tree3_const_iterator::seek_lower_eq(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	std::string k(key.data(), key.size());
+	leafnode = engine->LeafSearch(k);
+	if (leafnode)
+		idx = engine->LeafOrderBound(leafnode, k, true) - 1;
+
+	return backward(leafnode, idx);
+}
+
+status tree3::tree3_const_iterator::seek_higher(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	std::string k(key.data(), key.size());
+	leafnode = engine->LeafSearch(k);
+	if (leafnode)
+		idx = engine->LeafOrderBound(leafnode, k, true);
+
+	return forward(leafnode, idx);
+}
+
+status tree3::tree3_const_iterator::seek_higher_eq(string_view key)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	std::string k(key.data(), key.size());
+	leafnode = engine->LeafSearch(k);
+	if (leafnode)
+		idx = engine->LeafOrderBound(leafnode, k, false);
+
+	return forward(leafnode, idx);
+}
+
+status tree3::tree3_const_iterator::seek_to_first()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	leafnode = engine->LeafFirst();
+	idx = 0;
+
+	return forward(leafnode, idx);
+}
+
+status tree3::tree3_const_iterator::seek_to_last()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	leafnode = engine->LeafLast();
+	idx = leafnode ? leafnode->count - 1 : 0;
+
+	return backward(leafnode, idx);
+}
+
+status tree3::tree3_const_iterator::is_next()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	if (!leafnode)
+		return status::NOT_FOUND;
+
+	auto next_leafnode = leafnode;
+	auto next_idx = idx + 1;
+
+	return forward(next_leafnode, next_idx);
+}
+
+status tree3::tree3_const_iterator::next()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	if (!leafnode)
+		return status::NOT_FOUND;
+
+	idx++;
+
+	return forward(leafnode, idx);
+}
+
+status tree3::tree3_const_iterator::prev()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	init_seek();
+
+	if (!leafnode)
+		return status::NOT_FOUND;
+
+	// stays at the first element, if there's nothing before it
+	auto prev_leafnode = leafnode;
+	auto prev_idx = idx - 1;
+	if (backward(prev_leafnode, prev_idx) != status::OK)
+		return status::NOT_FOUND;
+
+	leafnode = prev_leafnode;
+	idx = prev_idx;
+
+	return status::OK;
+}
+
+result<string_view> tree3::tree3_const_iterator::key()
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	auto &kvslot = slot();
+
+	return string_view(kvslot.key(), kvslot.get_ks());
+}
+
+result<pmem::obj::slice<const char *>> tree3::tree3_const_iterator::read_range(size_t pos,
+									       size_t n)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	auto &kvslot = slot();
+
+	if (pos + n > kvslot.get_vs() || pos + n < pos)
+		n = kvslot.get_vs() - pos;
+
+	auto val = kvslot.val() + pos;
+
+	return {pmem::obj::slice<const char *>(val, val + n)};
+}
+
+result<pmem::obj::slice<char *>> tree3::tree3_iterator::write_range(size_t pos, size_t n)
+{
+	internal::shared_lock_guard<mutex_type> lock(engine->mtx);
+	auto &kvslot = slot();
+
+	if (pos + n > kvslot.get_vs() || pos + n < pos)
+		n = kvslot.get_vs() - pos;
+
+	log.push_back({std::string(kvslot.val() + pos, n), pos});
+	auto &val = log.back().first;
+
+	return {{&val[0], &val[0] + n}};
+}
+
+status tree3::tree3_iterator::commit()
+{
+	std::unique_lock<mutex_type> lock(engine->mtx);
+	transaction::run(engine->pmpool, [&] {
+		auto val = const_cast<char *>(slot().val());
+		for (auto &p : log) {
+			if (p.first.empty())
+				continue;
+			transaction::snapshot(val + p.second, p.first.size());
+			std::copy(p.first.begin(), p.first.end(), val + p.second);
+		}
+	});
+	log.clear();
+
+	return status::OK;
+}
+
+void tree3::tree3_iterator::abort()
+{
+	log.clear();
+}
+
 // ===============================================================================================
 // Node invariants
 // ===============================================================================================
@@ -4,14 +4,19 @@
 #ifndef LIBPMEMKV_TREE3_H
 #define LIBPMEMKV_TREE3_H
 
+#include "../iterator.h"
 #include "../pmemobj_engine.h"
+#include "../sharded_shared_mutex.h"
 
+#include <functional>
 #include <libpmemobj++/make_persistent.hpp>
 #include <libpmemobj++/make_persistent_array.hpp>
 #include <libpmemobj++/p.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
 #include <libpmemobj++/transaction.hpp>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <vector>
 
 using pmem::obj::delete_persistent;
@@ -38,6 +43,12 @@ namespace tree3
 #define INNER_KEYS_UPPER ((INNER_KEYS / 2) + 1) // index where upper half of keys begins
 #define LEAF_KEYS 48				// maximum keys in tree nodes
 #define LEAF_KEYS_MIDPOINT (LEAF_KEYS / 2)	// halfway point within the node
+#define RECOVERY_LEAVES 1024			// minimum leaves recovered by a thread
+#define COMPACTION_FILL (LEAF_KEYS * 3 / 4)	// maximum keys in a leaf merged on recovery
+#define COMPACTION_FREE_LEAVES 1024		// maximum leaves freed by a transaction
+#define SLOT_INLINE_SIZE 112			// bytes of small key & value kept in slot
+
+static_assert(LEAF_KEYS % sizeof(uint64_t) == 0, "hashes are matched in 8-byte words");
 
 class KVSlot {
 public:
@@ -51,7 +62,7 @@ public:
 	}
 	const char *key() const
 	{
-		return ((char *)(kv.get()) + sizeof(uint8_t) + sizeof(uint32_t) +
+		return ((char *)(data()) + sizeof(uint8_t) + sizeof(uint32_t) +
 			sizeof(uint32_t));
 	}
 	static const char *key_direct(char *p)
@@ -68,7 +79,7 @@ public:
 	}
 	const char *val() const
 	{
-		return ((char *)(kv.get()) + sizeof(uint8_t) + sizeof(uint32_t) +
+		return ((char *)(data()) + sizeof(uint8_t) + sizeof(uint32_t) +
 			sizeof(uint32_t) + get_ks() + 1);
 	}
 	static const char *val_direct(char *p)
@@ -88,7 +99,7 @@ public:
 	void set(const uint8_t hash, const std::string &key, const std::string &value);
 	void set_ph(uint8_t v)
 	{
-		*((uint8_t *)((char *)(kv.get()) + sizeof(uint32_t) + sizeof(uint32_t))) =
+		*((uint8_t *)((char *)(data()) + sizeof(uint32_t) + sizeof(uint32_t))) =
 			v;
 	}
 	static void set_ph_direct(char *p, uint8_t v)
@@ -97,7 +108,7 @@ public:
 	}
 	void set_ks(uint32_t v)
 	{
-		*((uint32_t *)(kv.get())) = v;
+		*((uint32_t *)(data())) = v;
 	}
 	static void set_ks_direct(char *p, uint32_t v)
 	{
@@ -105,7 +116,7 @@ public:
 	}
 	void set_vs(uint32_t v)
 	{
-		*((uint32_t *)((char *)(kv.get()) + sizeof(uint32_t))) = v;
+		*((uint32_t *)((char *)(data()) + sizeof(uint32_t))) = v;
 	}
 	static void set_vs_direct(char *p, uint32_t v)
 	{
@@ -113,7 +124,7 @@ public:
 	}
 	uint8_t get_ph() const
 	{
-		return *((uint8_t *)((char *)(kv.get()) + sizeof(uint32_t) +
+		return *((uint8_t *)((char *)(data()) + sizeof(uint32_t) +
 				     sizeof(uint32_t)));
 	}
 	static uint8_t get_ph_direct(char *p)
@@ -122,7 +133,7 @@ public:
 	}
 	uint32_t get_ks() const
 	{
-		return *((uint32_t *)(kv.get()));
+		return *((uint32_t *)(data()));
 	}
 	static uint32_t get_ks_direct(char *p)
 	{
@@ -130,16 +141,23 @@ public:
 	}
 	uint32_t get_vs() const
 	{
-		return *((uint32_t *)((char *)(kv.get()) + sizeof(uint32_t)));
+		return *((uint32_t *)((char *)(data()) + sizeof(uint32_t)));
 	}
 	static uint32_t get_vs_direct(char *p)
 	{
 		return *((uint32_t *)((char *)(p) + sizeof(uint32_t)));
 	}
-	bool empty();
+	bool empty() const;
 
 private:
-	persistent_ptr<char[]> kv; // buffer for key & value
+	// small pairs are stored inline, larger ones in a separate allocation
+	char *data() const
+	{
+		return kv ? kv.get() : const_cast<char *>(inline_kv);
+	}
+
+	persistent_ptr<char[]> kv;	    // buffer for key & value (null if inline)
+	char inline_kv[SLOT_INLINE_SIZE]; // key & value, if they fit in the slot
 };
 
 struct KVLeaf {
@@ -162,14 +180,21 @@ struct KVInnerNode final : KVNode {		     // volatile inner nodes of the tree
 	void assert_invariants();
 };
 
-struct KVLeafNode final : KVNode {   // volatile leaf nodes of the tree
-	uint8_t hashes[LEAF_KEYS];   // Pearson hashes of keys
-	std::string keys[LEAF_KEYS]; // keys stored in this leaf
-	persistent_ptr<KVLeaf> leaf; // pointer to persistent leaf
+struct KVLeafNode final : KVNode {	 // volatile leaf nodes of the tree
+	uint8_t hashes[LEAF_KEYS];	 // Pearson hashes of keys
+	unique_ptr<std::string[]> keys;	 // keys stored in this leaf (null if compact)
+	uint8_t order[LEAF_KEYS];	 // used slots in ascending key order
+	uint8_t count = 0;		 // count of used slots
+	KVLeafNode *prev = nullptr;	 // previous leaf node in key order
+	KVLeafNode *next = nullptr;	 // next leaf node in key order
+	persistent_ptr<KVLeaf> leaf;	 // pointer to persistent leaf
+	std::shared_timed_mutex mtx;	 // guards slots, shared for readers
+	string_view key(int slot) const; // key of used slot (read from pmem if compact)
 };
 
 struct KVRecoveredLeaf {		 // temporary wrapper used for recovery
 	unique_ptr<KVLeafNode> leafnode; // leaf node being recovered
+	std::string min_key;		 // lowest sorting key present
 	std::string max_key;		 // highest sorting key present
 };
 
@@ -187,8 +212,21 @@ public:
 	std::string name() final;
 
 	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
 
 	status exists(string_view key) final;
 
@@ -198,8 +236,35 @@ public:
 
 	status remove(string_view key) final;
 
+	status stats(internal::stats_sink &sink) final;
+
+	internal::iterator_base *new_iterator() final;
+	internal::iterator_base *new_const_iterator() final;
+
 protected:
+	internal::memory_stats memory_types() final;
+	// new leaf node, with DRAM copies of keys unless compact_index is set
+	unique_ptr<internal::tree3::KVLeafNode> LeafNew();
 	internal::tree3::KVLeafNode *LeafSearch(const std::string &key);
+	// returns slot holding the key (or -1), comparing only keys with matching hash
+	int LeafFindSlot(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
+			 string_view key);
+	// returns the lowest empty slot (or -1)
+	int LeafFindEmptySlot(internal::tree3::KVLeafNode *leafnode);
+	internal::tree3::KVLeafNode *LeafFirst();
+	internal::tree3::KVLeafNode *LeafLast();
+	// calls f for used slots with keys in range (null bound means unbounded),
+	// in ascending key order; stops at the first non-zero result and returns it
+	int LeafScan(const std::string *low, bool low_eq, const std::string *high,
+		     bool high_eq,
+		     const std::function<int(internal::tree3::KVLeafNode *, int)> &f);
+	// maintain order of used slots in leaf node
+	void LeafOrderBuild(internal::tree3::KVLeafNode *leafnode);
+	void LeafOrderInsert(internal::tree3::KVLeafNode *leafnode, int slot);
+	void LeafOrderErase(internal::tree3::KVLeafNode *leafnode, int slot);
+	// index in order of first key not less (or greater, if upper) than key
+	int LeafOrderBound(internal::tree3::KVLeafNode *leafnode, string_view key,
+			   bool upper);
 	void LeafFillEmptySlot(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
 			       const std::string &key, const std::string &value);
 	bool LeafFillSlotForKey(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
@@ -214,13 +279,92 @@ protected:
 				   std::string *split_key);
 	uint8_t PearsonHash(const char *data, size_t size);
 	void Recover();
+	// recovers leaf node of a persistent leaf, returns false if it's empty
+	bool RecoverLeaf(persistent_ptr<internal::tree3::KVLeaf> leaf,
+			 internal::tree3::KVRecoveredLeaf &recovered);
+	// merges sparse neighbouring leaves (in key order) and frees emptied ones
+	void CompactLeaves(vector<internal::tree3::KVRecoveredLeaf> &leaves,
+			   const vector<persistent_ptr<internal::tree3::KVLeaf>> &pleaves);
+	// moves all slots of src leaf to empty slots of dst leaf
+	void LeafMerge(internal::tree3::KVLeafNode *dst, internal::tree3::KVLeafNode *src);
 
 private:
+	using mutex_type = internal::sharded_shared_mutex;
+	using leaf_mutex_type = std::shared_timed_mutex;
+
+	class tree3_const_iterator;
+	class tree3_iterator;
+
+	status GetRange(const std::string *low, bool low_eq, const std::string *high,
+			bool high_eq, get_kv_callback *callback, void *arg);
+	status CountRange(const std::string *low, bool low_eq, const std::string *high,
+			  bool high_eq, std::size_t &cnt);
+
+	/*
+	 * Protects the structure of the tree: operations on slots of a leaf hold
+	 * shared lock (and lock the leaf), splits and adding a new head leaf hold
+	 * exclusive one.
+	 */
+	mutex_type mtx;
+
+	bool compact_leaves = false; // merge and free sparse leaves on recovery
+	bool compact_index = false;  // no keys in leaf nodes, truncated inner keys
+	std::size_t compacted_leaves = 0; // leaves freed by the last recovery
+
 	vector<persistent_ptr<internal::tree3::KVLeaf>>
 		leaves_prealloc;		      // persisted but unused leaves
 	unique_ptr<internal::tree3::KVNode> tree_top; // pointer to uppermost inner node
 };
 
+/*
+ * Iterators hold the shared lock only for the duration of a call, so they
+ * must not be used while other threads modify the database.
+ */
+class tree3::tree3_const_iterator : public internal::iterator_base {
+public:
+	tree3_const_iterator(tree3 *engine);
+
+	status seek(string_view key) final;
+	status seek_lower(string_view key) final;
+	status seek_lower_eq(string_view key) final;
+	status seek_higher(string_view key) final;
+	status seek_higher_eq(string_view key) final;
+
+	status seek_to_first() final;
+	status seek_to_last() final;
+
+	status is_next() final;
+	status next() final;
+	status prev() final;
+
+	result<string_view> key() final;
+
+	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
+
+protected:
+	// moves to the nearest used position at or after (before) the given one
+	static status forward(internal::tree3::KVLeafNode *&leafnode, int &idx);
+	static status backward(internal::tree3::KVLeafNode *&leafnode, int &idx);
+	const internal::tree3::KVSlot &slot();
+
+	tree3 *engine;
+	internal::tree3::KVLeafNode *leafnode; // current leaf node, null if none
+	int idx;			       // index in order of current leaf node
+};
+
+class tree3::tree3_iterator : public tree3::tree3_const_iterator {
+public:
+	tree3_iterator(tree3 *engine);
+
+	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
+
+	status commit() final;
+	void abort() final;
+
+private:
+	std::vector<std::pair<std::string, size_t>> log;
+};
+
 class tree3_factory : public engine_base::factory_base {
 public:
 	unique_ptr<engine_base> create(unique_ptr<internal::config> cfg) override
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "vart.h"
+
+namespace pmem
+{
+namespace kv
+{
+
+template <>
+std::string vart::name()
+{
+	return "vart";
+}
+
+template <>
+std::string dram_vart::name()
+{
+	return "dram_vart";
+}
+
+static factory_registerer
+	register_vart(std::unique_ptr<engine_base::factory_base>(new vart_factory));
+static factory_registerer register_dram_vart(
+	std::unique_ptr<engine_base::factory_base>(new dram_vart_factory));
+
+} // namespace kv
+} // namespace pmem
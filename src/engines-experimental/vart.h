@@ -0,0 +1,1259 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_VART_H
+#define LIBPMEMKV_VART_H
+
+#include "../comparator/comparator.h"
+#include "../engine.h"
+#include "../engines/hugepage_allocator_factory.h"
+#include "../engines/memkind_allocator_factory.h"
+#include "../epoch_reclaimer.h"
+#include "../exceptions.h"
+#include "../out.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+namespace pmem
+{
+namespace kv
+{
+
+/**
+ * basic_vart is a volatile, sorted engine - an adaptive radix tree (ART),
+ * with nodes of 4, 16, 48 and 256 children (grown and shrunk as needed) and
+ * path compression: a node keeps the whole prefix its children share. Keys
+ * ending at a node are kept in its 'terminal' slot, so keys may be prefixes
+ * of other keys. Leaves hold the key and the value and are immutable.
+ *
+ * Reads take no locks: children (and terminals) are atomic pointers and
+ * everything else in a node is immutable, except for nodes of 48 and 256
+ * children, which get new children in place. Other changes of the structure
+ * (a child added to or removed from a small node, a prefix split) are made
+ * on a copy of the node, which replaces it in its parent. Writers find their
+ * node optimistically, then lock it (and its parent, when it's replaced) and
+ * restart if the node became obsolete meanwhile - as optimistic lock coupling
+ * does. Replaced nodes and leaves are freed by the epoch_reclaimer.
+ *
+ * Memory comes from the allocator made by AllocatorFactory (as in
+ * basic_vcmap), the tree is not split into partitions.
+ */
+template <typename AllocatorFactory>
+class basic_vart : public engine_base {
+public:
+	basic_vart(std::unique_ptr<internal::config> cfg);
+	~basic_vart();
+
+	basic_vart(const basic_vart &) = delete;
+	basic_vart &operator=(const basic_vart &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback, void *arg) final;
+
+	status exists(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+
+private:
+	using allocator_type = typename AllocatorFactory::template allocator_type<char>;
+
+	enum node_type : uint8_t { NODE4, NODE16, NODE48, NODE256 };
+
+	/* bits of node's version: the node is locked by a writer, replaced */
+	static constexpr uint64_t LOCKED = 2;
+	static constexpr uint64_t OBSOLETE = 1;
+	/* links to leaves are tagged with the lowest bit */
+	static constexpr uintptr_t LEAF = 1;
+
+	/* Key and value follow the header */
+	struct leaf {
+		uint64_t key_size;
+		uint64_t value_size;
+
+		string_view key() const
+		{
+			return string_view(reinterpret_cast<const char *>(this + 1),
+					   key_size);
+		}
+
+		string_view value() const
+		{
+			return string_view(reinterpret_cast<const char *>(this + 1) +
+						   key_size,
+					   value_size);
+		}
+	};
+
+	/* Prefix follows the node (of a type below) */
+	struct node {
+		node(node_type type, uint32_t prefix_size)
+		    : version(0), type(type), count(0), prefix_size(prefix_size), terminal(0)
+		{
+		}
+
+		std::atomic<uint64_t> version;
+		const node_type type;
+		/* number of children, modified only with the node locked */
+		uint16_t count;
+		const uint32_t prefix_size;
+		/* leaf of the key which ends at this node */
+		std::atomic<uintptr_t> terminal;
+	};
+
+	/* keys of small nodes are sorted */
+	struct node4 : node {
+		node4(uint32_t prefix_size) : node(NODE4, prefix_size)
+		{
+			for (auto &c : children)
+				c.store(0, std::memory_order_relaxed);
+		}
+
+		uint8_t keys[4];
+		std::atomic<uintptr_t> children[4];
+	};
+
+	struct node16 : node {
+		node16(uint32_t prefix_size) : node(NODE16, prefix_size)
+		{
+			for (auto &c : children)
+				c.store(0, std::memory_order_relaxed);
+		}
+
+		uint8_t keys[16];
+		std::atomic<uintptr_t> children[16];
+	};
+
+	/* slots of children are never reused in place, the node is copied */
+	struct node48 : node {
+		node48(uint32_t prefix_size) : node(NODE48, prefix_size)
+		{
+			for (auto &i : index)
+				i.store(0, std::memory_order_relaxed);
+			for (auto &c : children)
+				c.store(0, std::memory_order_relaxed);
+		}
+
+		/* slot of the child of each byte, plus one (0 - none) */
+		std::atomic<uint8_t> index[256];
+		std::atomic<uintptr_t> children[48];
+	};
+
+	struct node256 : node {
+		node256(uint32_t prefix_size) : node(NODE256, prefix_size)
+		{
+			for (auto &c : children)
+				c.store(0, std::memory_order_relaxed);
+		}
+
+		std::atomic<uintptr_t> children[256];
+	};
+
+	/* Keeps a node locked in a scope (if lock() succeeded) */
+	class write_lock {
+	public:
+		write_lock() = default;
+
+		~write_lock()
+		{
+			if (n)
+				n->version.fetch_add(LOCKED, std::memory_order_release);
+		}
+
+		write_lock(const write_lock &) = delete;
+		write_lock &operator=(const write_lock &) = delete;
+
+		/* Returns false if the node is obsolete */
+		bool lock(node *to_lock)
+		{
+			auto v = to_lock->version.load(std::memory_order_acquire);
+			while (true) {
+				if (v & OBSOLETE)
+					return false;
+
+				if (v & LOCKED) {
+					std::this_thread::yield();
+					v = to_lock->version.load(std::memory_order_acquire);
+				} else if (to_lock->version.compare_exchange_weak(
+						   v, v | LOCKED, std::memory_order_acquire,
+						   std::memory_order_relaxed)) {
+					n = to_lock;
+					return true;
+				}
+			}
+		}
+
+		/* Unlocks the node, marking it replaced */
+		void obsolete()
+		{
+			n->version.fetch_add(LOCKED | OBSOLETE, std::memory_order_release);
+			n = nullptr;
+		}
+
+	private:
+		node *n = nullptr;
+	};
+
+	/* Blocks unlinked by an operation, retired after it leaves the read */
+	struct garbage {
+		void add(void *p, std::size_t size)
+		{
+			assert(n < 3);
+			blocks[n] = p;
+			sizes[n++] = size;
+		}
+
+		void *blocks[3];
+		std::size_t sizes[3];
+		std::size_t n = 0;
+	};
+
+	/* Bounds of a scan, keys within them are visited in order */
+	struct range {
+		const string_view *low;
+		bool low_eq;
+		const string_view *high;
+		bool high_eq;
+	};
+
+	enum class result { RESTART, DONE, CHANGED };
+
+	static bool is_leaf(uintptr_t p)
+	{
+		return (p & LEAF) != 0;
+	}
+
+	static leaf *as_leaf(uintptr_t p)
+	{
+		return reinterpret_cast<leaf *>(p & ~LEAF);
+	}
+
+	static node *as_node(uintptr_t p)
+	{
+		return reinterpret_cast<node *>(p);
+	}
+
+	static uintptr_t link(leaf *l)
+	{
+		return reinterpret_cast<uintptr_t>(l) | LEAF;
+	}
+
+	static uintptr_t link(node *n)
+	{
+		return reinterpret_cast<uintptr_t>(n);
+	}
+
+	static std::size_t node_size(node_type type);
+	static std::size_t capacity(node_type type);
+	/* Returns the smallest type of a node with that many children */
+	static node_type type_for(std::size_t children);
+
+	static const char *prefix_of(const node *n)
+	{
+		return reinterpret_cast<const char *>(n) + node_size(n->type);
+	}
+
+	static std::size_t leaf_bytes(const leaf *l)
+	{
+		return sizeof(leaf) + l->key_size + l->value_size;
+	}
+
+	static std::size_t node_bytes(const node *n)
+	{
+		return node_size(n->type) + n->prefix_size;
+	}
+
+	/* Returns the slot of the byte's child (which may be empty) or nullptr */
+	static std::atomic<uintptr_t> *slot_of(node *n, uint8_t byte);
+	static uintptr_t child_of(node *n, uint8_t byte);
+	/* Adds a child, there must be space for it; small nodes must be unpublished */
+	static void add_child(node *n, uint8_t byte, uintptr_t child);
+	/* Puts the link at the position 'depth' of the key (or as a terminal) */
+	static void add_entry(node *n, string_view key, std::size_t depth, uintptr_t child);
+
+	/* Calls f(byte, child) for children in order, until it returns false */
+	template <typename F>
+	static bool for_each_child(node *n, F f);
+
+	leaf *new_leaf(string_view key, string_view value);
+	node *new_node(node_type type, string_view prefix);
+	/*
+	 * Returns a new node of the type and prefix, with all entries of
+	 * the (locked) node, except for the child of 'skip' (if not negative).
+	 */
+	node *copy_node(node *n, node_type type, string_view prefix, int skip = -1);
+	void free_tree(uintptr_t p);
+
+	/* Returns the leaf of the key or nullptr, must be called inside a read */
+	leaf *lookup(string_view key);
+
+	result try_insert(string_view key, leaf *l, garbage &g);
+	result try_remove(string_view key, garbage &g);
+	/* Replaces the (locked) node with its only entry left, in the parent */
+	bool collapse(node *parent, uint8_t parent_byte, node *n, int byte,
+		      uintptr_t remaining, garbage &g);
+	void retire(garbage &g);
+
+	template <typename F>
+	bool scan(uintptr_t p, std::string &path, const range &r, F &f);
+	template <typename F>
+	void scan(const range &r, F f);
+
+	status GetRange(const range &r, get_kv_callback *callback, void *arg);
+	status CountRange(const range &r, std::size_t &cnt);
+
+	allocator_type allocator;
+	internal::epoch_reclaimer reclaimer;
+	/* root is never replaced, so it's a node of 256 children */
+	node *root = nullptr;
+	std::atomic<std::size_t> count;
+};
+
+template <typename AllocatorFactory>
+basic_vart<AllocatorFactory>::basic_vart(std::unique_ptr<internal::config> cfg)
+    : allocator(AllocatorFactory::template create<char>(*cfg, 0)),
+      reclaimer(std::thread::hardware_concurrency(),
+		[this](void *ptr, std::size_t size) {
+			allocator.deallocate(static_cast<char *>(ptr), size);
+		}),
+      count(0)
+{
+	if (AllocatorFactory::partitions_number(*cfg) > 1)
+		throw internal::invalid_argument(
+			"Config item \"numa_paths\" is not supported by vart engines");
+
+	root = new_node(NODE256, string_view());
+
+	LOG("Started ok");
+}
+
+template <typename AllocatorFactory>
+basic_vart<AllocatorFactory>::~basic_vart()
+{
+	free_tree(link(root));
+
+	LOG("Stopped ok");
+}
+
+template <typename AllocatorFactory>
+std::string basic_vart<AllocatorFactory>::name()
+{
+	return "basic_vart";
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	cnt = count.load();
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	return CountRange({&key, false, nullptr, false}, cnt);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	return CountRange({&key, true, nullptr, false}, cnt);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	return CountRange({nullptr, false, &key, true}, cnt);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	return CountRange({nullptr, false, &key, false}, cnt);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::count_between(string_view key1, string_view key2,
+						   std::size_t &cnt)
+{
+	LOG("count_between for key1=" << std::string(key1.data(), key1.size())
+				      << ", key2="
+				      << std::string(key2.data(), key2.size()));
+	return CountRange({&key1, false, &key2, false}, cnt);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	return GetRange({nullptr, false, nullptr, false}, callback, arg);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::get_above(string_view key, get_kv_callback *callback,
+					       void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	return GetRange({&key, false, nullptr, false}, callback, arg);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::get_equal_above(string_view key,
+						     get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	return GetRange({&key, true, nullptr, false}, callback, arg);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::get_equal_below(string_view key,
+						     get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	return GetRange({nullptr, false, &key, true}, callback, arg);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::get_below(string_view key, get_kv_callback *callback,
+					       void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	return GetRange({nullptr, false, &key, false}, callback, arg);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::get_between(string_view key1, string_view key2,
+						 get_kv_callback *callback, void *arg)
+{
+	LOG("get_between for key1=" << std::string(key1.data(), key1.size())
+				    << ", key2="
+				    << std::string(key2.data(), key2.size()));
+	return GetRange({&key1, false, &key2, false}, callback, arg);
+}
+
+/* keys with the prefix are those not lower than it and lower than its successor */
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::get_prefix(string_view prefix,
+						get_kv_callback *callback, void *arg)
+{
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+
+	std::string upper;
+	string_view high;
+	if (internal::prefix_upper_bound(prefix, upper)) {
+		high = string_view(upper.data(), upper.size());
+		return GetRange({&prefix, true, &high, false}, callback, arg);
+	}
+
+	return GetRange({&prefix, true, nullptr, false}, callback, arg);
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::GetRange(const range &r, get_kv_callback *callback,
+					      void *arg)
+{
+	status s = status::OK;
+	scan(r, [&](const leaf *l) {
+		auto key = l->key();
+		auto value = l->value();
+		if (callback(key.data(), key.size(), value.data(), value.size(), arg) !=
+		    0) {
+			s = status::STOPPED_BY_CB;
+			return false;
+		}
+
+		return true;
+	});
+
+	return s;
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::CountRange(const range &r, std::size_t &cnt)
+{
+	std::size_t counted = 0;
+	scan(r, [&](const leaf *) {
+		counted++;
+		return true;
+	});
+
+	cnt = counted;
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+
+	internal::epoch_guard guard(reclaimer);
+
+	return lookup(key) ? status::OK : status::NOT_FOUND;
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::get(string_view key, get_v_callback *callback,
+					 void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+
+	internal::epoch_guard guard(reclaimer);
+
+	auto l = lookup(key);
+	if (!l) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	/* leaf can't be freed until the guard is released */
+	auto value = l->value();
+	callback(value.data(), value.size(), arg);
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+
+	auto l = new_leaf(key, value);
+
+	garbage g;
+	result r;
+	try {
+		do {
+			internal::epoch_guard guard(reclaimer);
+			r = try_insert(key, l, g);
+		} while (r == result::RESTART);
+	} catch (...) {
+		/* the leaf is linked as the last step, which can't throw */
+		allocator.deallocate(reinterpret_cast<char *>(l), leaf_bytes(l));
+		throw;
+	}
+
+	if (r == result::CHANGED)
+		count++;
+
+	retire(g);
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vart<AllocatorFactory>::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+
+	garbage g;
+	result r;
+	do {
+		internal::epoch_guard guard(reclaimer);
+		r = try_remove(key, g);
+	} while (r == result::RESTART);
+
+	if (r == result::DONE)
+		return status::NOT_FOUND;
+
+	count--;
+	retire(g);
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+std::size_t basic_vart<AllocatorFactory>::node_size(node_type type)
+{
+	switch (type) {
+		case NODE4:
+			return sizeof(node4);
+		case NODE16:
+			return sizeof(node16);
+		case NODE48:
+			return sizeof(node48);
+		default:
+			return sizeof(node256);
+	}
+}
+
+template <typename AllocatorFactory>
+std::size_t basic_vart<AllocatorFactory>::capacity(node_type type)
+{
+	switch (type) {
+		case NODE4:
+			return 4;
+		case NODE16:
+			return 16;
+		case NODE48:
+			return 48;
+		default:
+			return 256;
+	}
+}
+
+template <typename AllocatorFactory>
+typename basic_vart<AllocatorFactory>::node_type
+basic_vart<AllocatorFactory>::type_for(std::size_t children)
+{
+	if (children <= 4)
+		return NODE4;
+	if (children <= 16)
+		return NODE16;
+	if (children <= 48)
+		return NODE48;
+	return NODE256;
+}
+
+template <typename AllocatorFactory>
+std::atomic<uintptr_t> *basic_vart<AllocatorFactory>::slot_of(node *n, uint8_t byte)
+{
+	switch (n->type) {
+		case NODE4: {
+			auto n4 = static_cast<node4 *>(n);
+			for (std::size_t i = 0; i < n->count; ++i) {
+				if (n4->keys[i] == byte)
+					return &n4->children[i];
+			}
+			return nullptr;
+		}
+		case NODE16: {
+			auto n16 = static_cast<node16 *>(n);
+			for (std::size_t i = 0; i < n->count; ++i) {
+				if (n16->keys[i] == byte)
+					return &n16->children[i];
+			}
+			return nullptr;
+		}
+		case NODE48: {
+			auto n48 = static_cast<node48 *>(n);
+			auto idx = n48->index[byte].load(std::memory_order_acquire);
+			return idx != 0 ? &n48->children[idx - 1] : nullptr;
+		}
+		default:
+			return &static_cast<node256 *>(n)->children[byte];
+	}
+}
+
+template <typename AllocatorFactory>
+uintptr_t basic_vart<AllocatorFactory>::child_of(node *n, uint8_t byte)
+{
+	auto slot = slot_of(n, byte);
+
+	return slot ? slot->load(std::memory_order_acquire) : 0;
+}
+
+/*
+ * In nodes of 48 children, the child is stored before its index is set, so
+ * that readers which find the index, find the child as well.
+ */
+template <typename AllocatorFactory>
+void basic_vart<AllocatorFactory>::add_child(node *n, uint8_t byte, uintptr_t child)
+{
+	assert(n->count < capacity(n->type));
+
+	switch (n->type) {
+		case NODE4:
+		case NODE16: {
+			auto keys = n->type == NODE4 ? static_cast<node4 *>(n)->keys
+						     : static_cast<node16 *>(n)->keys;
+			auto children = n->type == NODE4
+				? static_cast<node4 *>(n)->children
+				: static_cast<node16 *>(n)->children;
+
+			std::size_t i = n->count;
+			for (; i > 0 && keys[i - 1] > byte; --i) {
+				keys[i] = keys[i - 1];
+				children[i].store(children[i - 1].load(std::memory_order_relaxed),
+						  std::memory_order_relaxed);
+			}
+			keys[i] = byte;
+			children[i].store(child, std::memory_order_relaxed);
+			break;
+		}
+		case NODE48: {
+			auto n48 = static_cast<node48 *>(n);
+			std::size_t slot = 0;
+			while (n48->children[slot].load(std::memory_order_relaxed) != 0)
+				slot++;
+
+			n48->children[slot].store(child, std::memory_order_release);
+			n48->index[byte].store(static_cast<uint8_t>(slot + 1),
+					       std::memory_order_release);
+			break;
+		}
+		default:
+			static_cast<node256 *>(n)->children[byte].store(
+				child, std::memory_order_release);
+	}
+
+	n->count++;
+}
+
+template <typename AllocatorFactory>
+void basic_vart<AllocatorFactory>::add_entry(node *n, string_view key, std::size_t depth,
+					     uintptr_t child)
+{
+	if (depth == key.size())
+		n->terminal.store(child, std::memory_order_relaxed);
+	else
+		add_child(n, static_cast<uint8_t>(key[depth]), child);
+}
+
+template <typename AllocatorFactory>
+template <typename F>
+bool basic_vart<AllocatorFactory>::for_each_child(node *n, F f)
+{
+	switch (n->type) {
+		case NODE4:
+		case NODE16: {
+			auto keys = n->type == NODE4 ? static_cast<node4 *>(n)->keys
+						     : static_cast<node16 *>(n)->keys;
+			auto children = n->type == NODE4
+				? static_cast<node4 *>(n)->children
+				: static_cast<node16 *>(n)->children;
+
+			for (std::size_t i = 0; i < n->count; ++i) {
+				auto child = children[i].load(std::memory_order_acquire);
+				if (child != 0 && !f(keys[i], child))
+					return false;
+			}
+			return true;
+		}
+		default:
+			for (std::size_t b = 0; b < 256; ++b) {
+				auto child = child_of(n, static_cast<uint8_t>(b));
+				if (child != 0 && !f(static_cast<uint8_t>(b), child))
+					return false;
+			}
+			return true;
+	}
+}
+
+template <typename AllocatorFactory>
+typename basic_vart<AllocatorFactory>::leaf *
+basic_vart<AllocatorFactory>::new_leaf(string_view key, string_view value)
+{
+	auto memory = allocator.allocate(sizeof(leaf) + key.size() + value.size());
+
+	auto l = new (memory) leaf;
+	l->key_size = key.size();
+	l->value_size = value.size();
+	std::memcpy(memory + sizeof(leaf), key.data(), key.size());
+	std::memcpy(memory + sizeof(leaf) + key.size(), value.data(), value.size());
+
+	return l;
+}
+
+template <typename AllocatorFactory>
+typename basic_vart<AllocatorFactory>::node *
+basic_vart<AllocatorFactory>::new_node(node_type type, string_view prefix)
+{
+	auto size = node_size(type);
+	auto memory = allocator.allocate(size + prefix.size());
+	auto prefix_size = static_cast<uint32_t>(prefix.size());
+
+	node *n;
+	switch (type) {
+		case NODE4:
+			n = new (memory) node4(prefix_size);
+			break;
+		case NODE16:
+			n = new (memory) node16(prefix_size);
+			break;
+		case NODE48:
+			n = new (memory) node48(prefix_size);
+			break;
+		default:
+			n = new (memory) node256(prefix_size);
+	}
+	if (prefix.size() > 0)
+		std::memcpy(memory + size, prefix.data(), prefix.size());
+
+	return n;
+}
+
+template <typename AllocatorFactory>
+typename basic_vart<AllocatorFactory>::node *
+basic_vart<AllocatorFactory>::copy_node(node *n, node_type type, string_view prefix,
+					int skip)
+{
+	auto copy = new_node(type, prefix);
+	copy->terminal.store(n->terminal.load(std::memory_order_relaxed),
+			     std::memory_order_relaxed);
+	for_each_child(n, [&](uint8_t byte, uintptr_t child) {
+		if (static_cast<int>(byte) != skip)
+			add_child(copy, byte, child);
+		return true;
+	});
+
+	return copy;
+}
+
+/* called only when there are no other threads */
+template <typename AllocatorFactory>
+void basic_vart<AllocatorFactory>::free_tree(uintptr_t p)
+{
+	if (is_leaf(p)) {
+		allocator.deallocate(reinterpret_cast<char *>(as_leaf(p)),
+				     leaf_bytes(as_leaf(p)));
+		return;
+	}
+
+	auto n = as_node(p);
+	auto terminal = n->terminal.load(std::memory_order_relaxed);
+	if (terminal != 0)
+		free_tree(terminal);
+	for_each_child(n, [&](uint8_t, uintptr_t child) {
+		free_tree(child);
+		return true;
+	});
+
+	allocator.deallocate(reinterpret_cast<char *>(n), node_bytes(n));
+}
+
+template <typename AllocatorFactory>
+typename basic_vart<AllocatorFactory>::leaf *
+basic_vart<AllocatorFactory>::lookup(string_view key)
+{
+	auto n = root;
+	std::size_t depth = 0;
+	while (true) {
+		auto prefix_size = n->prefix_size;
+		if (key.size() - depth < prefix_size ||
+		    std::memcmp(prefix_of(n), key.data() + depth, prefix_size) != 0)
+			return nullptr;
+		depth += prefix_size;
+
+		auto child = depth == key.size()
+			? n->terminal.load(std::memory_order_acquire)
+			: child_of(n, static_cast<uint8_t>(key[depth]));
+		if (child == 0)
+			return nullptr;
+
+		if (is_leaf(child)) {
+			auto l = as_leaf(child);
+			return l->key().compare(key) == 0 ? l : nullptr;
+		}
+
+		n = as_node(child);
+		depth++;
+	}
+}
+
+/*
+ * Inserts the leaf: in place of the key's leaf, into a free slot of a large
+ * node or a copy of the node which gets the new child. A prefix, which
+ * the key diverges from, is split by a new node (holding the node, with
+ * the rest of the prefix, and the leaf), and so is a leaf of another key.
+ * Returns CHANGED if the key was inserted, DONE if its leaf was replaced.
+ */
+template <typename AllocatorFactory>
+typename basic_vart<AllocatorFactory>::result
+basic_vart<AllocatorFactory>::try_insert(string_view key, leaf *l, garbage &g)
+{
+	node *parent = nullptr;
+	uint8_t parent_byte = 0;
+	auto n = root;
+	std::size_t depth = 0;
+
+	while (true) {
+		string_view prefix(prefix_of(n), n->prefix_size);
+		std::size_t p = 0;
+		while (p < prefix.size() && depth + p < key.size() &&
+		       prefix[p] == key[depth + p])
+			p++;
+
+		if (p < prefix.size()) {
+			assert(parent);
+			write_lock parent_lock, lock;
+			if (!parent_lock.lock(parent) || !lock.lock(n) ||
+			    child_of(parent, parent_byte) != link(n))
+				return result::RESTART;
+
+			auto split = new_node(NODE4, string_view(prefix.data(), p));
+			node *rest;
+			try {
+				rest = copy_node(n, n->type,
+						 string_view(prefix.data() + p + 1,
+							     prefix.size() - p - 1));
+			} catch (...) {
+				allocator.deallocate(reinterpret_cast<char *>(split),
+						     node_bytes(split));
+				throw;
+			}
+
+			add_child(split, static_cast<uint8_t>(prefix[p]), link(rest));
+			add_entry(split, key, depth + p, link(l));
+
+			slot_of(parent, parent_byte)->store(link(split), std::memory_order_release);
+			lock.obsolete();
+			g.add(n, node_bytes(n));
+
+			return result::CHANGED;
+		}
+
+		auto d = depth + prefix.size();
+		if (d == key.size()) {
+			write_lock lock;
+			if (!lock.lock(n))
+				return result::RESTART;
+
+			auto old = n->terminal.load(std::memory_order_relaxed);
+			n->terminal.store(link(l), std::memory_order_release);
+			if (old == 0)
+				return result::CHANGED;
+
+			g.add(as_leaf(old), leaf_bytes(as_leaf(old)));
+			return result::DONE;
+		}
+
+		auto byte = static_cast<uint8_t>(key[d]);
+		auto child = child_of(n, byte);
+
+		if (child == 0) {
+			if (n->type == NODE48 || n->type == NODE256) {
+				write_lock lock;
+				if (!lock.lock(n))
+					return result::RESTART;
+				if (child_of(n, byte) != 0)
+					continue;
+
+				if (n->count < capacity(n->type)) {
+					add_child(n, byte, link(l));
+					return result::CHANGED;
+				}
+			}
+
+			/* the node is replaced by a copy with the new child */
+			assert(parent);
+			write_lock parent_lock, lock;
+			if (!parent_lock.lock(parent) || !lock.lock(n) ||
+			    child_of(parent, parent_byte) != link(n))
+				return result::RESTART;
+			if (child_of(n, byte) != 0)
+				continue;
+
+			auto copy = copy_node(n, type_for(n->count + 1U), prefix);
+			add_child(copy, byte, link(l));
+
+			slot_of(parent, parent_byte)->store(link(copy), std::memory_order_release);
+			lock.obsolete();
+			g.add(n, node_bytes(n));
+
+			return result::CHANGED;
+		}
+
+		if (is_leaf(child)) {
+			write_lock lock;
+			if (!lock.lock(n))
+				return result::RESTART;
+			if (child_of(n, byte) != child)
+				continue;
+
+			auto old = as_leaf(child);
+			auto old_key = old->key();
+			if (old_key.compare(key) == 0) {
+				slot_of(n, byte)->store(link(l), std::memory_order_release);
+				g.add(old, leaf_bytes(old));
+				return result::DONE;
+			}
+
+			/* both leaves go to a new node, with their common part as prefix */
+			auto start = d + 1;
+			std::size_t common = 0;
+			while (start + common < key.size() &&
+			       start + common < old_key.size() &&
+			       key[start + common] == old_key[start + common])
+				common++;
+
+			auto split = new_node(NODE4, string_view(key.data() + start, common));
+			add_entry(split, old_key, start + common, child);
+			add_entry(split, key, start + common, link(l));
+
+			slot_of(n, byte)->store(link(split), std::memory_order_release);
+
+			return result::CHANGED;
+		}
+
+		parent = n;
+		parent_byte = byte;
+		n = as_node(child);
+		depth = d + 1;
+	}
+}
+
+/*
+ * Removes the key's leaf: in place, from the root or a large node, or from
+ * a copy of the node (which may be smaller). A node left with a single entry
+ * is replaced by it. Returns CHANGED if the key was removed, DONE if it was
+ * not found.
+ */
+template <typename AllocatorFactory>
+typename basic_vart<AllocatorFactory>::result
+basic_vart<AllocatorFactory>::try_remove(string_view key, garbage &g)
+{
+	node *parent = nullptr;
+	uint8_t parent_byte = 0;
+	auto n = root;
+	std::size_t depth = 0;
+
+	while (true) {
+		string_view prefix(prefix_of(n), n->prefix_size);
+		if (key.size() - depth < prefix.size() ||
+		    std::memcmp(key.data() + depth, prefix.data(), prefix.size()) != 0)
+			return result::DONE;
+
+		auto d = depth + prefix.size();
+		int byte = d == key.size() ? -1 : static_cast<uint8_t>(key[d]);
+		auto child = byte < 0 ? n->terminal.load(std::memory_order_acquire)
+				      : child_of(n, static_cast<uint8_t>(byte));
+		if (child == 0)
+			return result::DONE;
+
+		if (!is_leaf(child)) {
+			parent = n;
+			parent_byte = static_cast<uint8_t>(byte);
+			n = as_node(child);
+			depth = d + 1;
+			continue;
+		}
+
+		auto l = as_leaf(child);
+		if (l->key().compare(key) != 0)
+			return result::DONE;
+
+		write_lock parent_lock, lock;
+		if (parent && !parent_lock.lock(parent))
+			return result::RESTART;
+		if (!lock.lock(n))
+			return result::RESTART;
+		if (parent && child_of(parent, parent_byte) != link(n))
+			return result::RESTART;
+
+		auto current = byte < 0 ? n->terminal.load(std::memory_order_relaxed)
+					: child_of(n, static_cast<uint8_t>(byte));
+		if (current != child)
+			continue;
+
+		auto terminal = n->terminal.load(std::memory_order_relaxed);
+		std::size_t children = n->count - (byte < 0 ? 0U : 1U);
+		std::size_t entries = children + (terminal != 0 && byte >= 0 ? 1U : 0U);
+
+		if (!parent || (byte < 0 && entries > 1) ||
+		    (n->type == NODE256 && type_for(children) == NODE256)) {
+			/* in place, slots of nodes of 256 children are fixed */
+			if (byte < 0)
+				n->terminal.store(0, std::memory_order_release);
+			else
+				slot_of(n, static_cast<uint8_t>(byte))
+					->store(0, std::memory_order_release);
+			if (byte >= 0)
+				n->count--;
+		} else if (entries == 1) {
+			/* the other entry: the terminal or the only other child */
+			int other = -1;
+			uintptr_t remaining = byte >= 0 ? terminal : 0;
+			if (remaining == 0) {
+				for_each_child(n, [&](uint8_t b, uintptr_t c) {
+					if (static_cast<int>(b) == byte)
+						return true;
+					other = b;
+					remaining = c;
+					return false;
+				});
+			}
+
+			if (!collapse(parent, parent_byte, n, other, remaining, g))
+				return result::RESTART;
+			lock.obsolete();
+			g.add(n, node_bytes(n));
+		} else {
+			auto copy = copy_node(n, type_for(children), prefix, byte);
+			if (byte < 0)
+				copy->terminal.store(0, std::memory_order_relaxed);
+
+			slot_of(parent, parent_byte)->store(link(copy), std::memory_order_release);
+			lock.obsolete();
+			g.add(n, node_bytes(n));
+		}
+
+		g.add(l, leaf_bytes(l));
+
+		return result::CHANGED;
+	}
+}
+
+/*
+ * A leaf takes the node's place in the parent as it is, a child node is
+ * copied with the node's prefix and the byte of the child prepended to its
+ * own prefix (the copy replaces it).
+ */
+template <typename AllocatorFactory>
+bool basic_vart<AllocatorFactory>::collapse(node *parent, uint8_t parent_byte, node *n,
+					    int byte, uintptr_t remaining, garbage &g)
+{
+	if (is_leaf(remaining)) {
+		slot_of(parent, parent_byte)->store(remaining, std::memory_order_release);
+		return true;
+	}
+
+	auto child = as_node(remaining);
+	write_lock lock;
+	if (!lock.lock(child))
+		return false;
+
+	std::string prefix(prefix_of(n), n->prefix_size);
+	prefix += static_cast<char>(byte);
+	prefix.append(prefix_of(child), child->prefix_size);
+
+	auto copy = copy_node(child, child->type, prefix);
+
+	slot_of(parent, parent_byte)->store(link(copy), std::memory_order_release);
+	lock.obsolete();
+	g.add(child, node_bytes(child));
+
+	return true;
+}
+
+template <typename AllocatorFactory>
+void basic_vart<AllocatorFactory>::retire(garbage &g)
+{
+	for (std::size_t i = 0; i < g.n; ++i)
+		reclaimer.retire(g.blocks[i], g.sizes[i]);
+}
+
+/*
+ * Visits leaves of the subtree in order (a terminal is lower than keys of
+ * children), 'path' is the part of keys common to the subtree. Subtrees with
+ * paths lower than the beginning of the low bound are skipped, and the scan
+ * ends at the first path or key above the high bound. Returns false if it's
+ * ended.
+ */
+template <typename AllocatorFactory>
+template <typename F>
+bool basic_vart<AllocatorFactory>::scan(uintptr_t p, std::string &path, const range &r,
+					F &f)
+{
+	if (is_leaf(p)) {
+		auto key = as_leaf(p)->key();
+		if (r.high) {
+			auto c = key.compare(*r.high);
+			if (c > 0 || (c == 0 && !r.high_eq))
+				return false;
+		}
+		if (r.low) {
+			auto c = key.compare(*r.low);
+			if (c < 0 || (c == 0 && !r.low_eq))
+				return true;
+		}
+
+		return f(as_leaf(p));
+	}
+
+	auto n = as_node(p);
+	auto size = path.size();
+	path.append(prefix_of(n), n->prefix_size);
+
+	string_view current(path.data(), path.size());
+	auto head = [&](const string_view *bound) {
+		return string_view(bound->data(), std::min(bound->size(), current.size()));
+	};
+	if (r.high && current.compare(head(r.high)) > 0)
+		return false;
+
+	bool more = true;
+	if (!r.low || current.compare(head(r.low)) >= 0) {
+		auto terminal = n->terminal.load(std::memory_order_acquire);
+		if (terminal != 0)
+			more = scan(terminal, path, r, f);
+
+		if (more)
+			more = for_each_child(n, [&](uint8_t byte, uintptr_t child) {
+				path.push_back(static_cast<char>(byte));
+				auto ret = scan(child, path, r, f);
+				path.pop_back();
+				return ret;
+			});
+	}
+
+	path.resize(size);
+
+	return more;
+}
+
+template <typename AllocatorFactory>
+template <typename F>
+void basic_vart<AllocatorFactory>::scan(const range &r, F f)
+{
+	internal::epoch_guard guard(reclaimer);
+
+	std::string path;
+	scan(link(root), path, r, f);
+}
+
+using vart = basic_vart<internal::memkind_allocator_factory>;
+using dram_vart = basic_vart<internal::hugepage_allocator_factory>;
+
+class vart_factory : public engine_base::factory_base {
+public:
+	virtual std::unique_ptr<engine_base> create(std::unique_ptr<internal::config> cfg)
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new vart(std::move(cfg)));
+	};
+	virtual std::string get_name()
+	{
+		return "vart";
+	};
+};
+
+class dram_vart_factory : public engine_base::factory_base {
+public:
+	virtual std::unique_ptr<engine_base> create(std::unique_ptr<internal::config> cfg)
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new dram_vart(std::move(cfg)));
+	};
+	virtual std::string get_name()
+	{
+		return "dram_vart";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_VART_H */
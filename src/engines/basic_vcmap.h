@@ -4,13 +4,23 @@
 #ifndef LIBPMEMKV_BASIC_VCMAP_H
 #define LIBPMEMKV_BASIC_VCMAP_H
 
+#include "../clock_eviction.h"
+#include "../crc_hash.h"
 #include "../engine.h"
+#include "../hot_cache.h"
 #include "../out.h"
+#include "../parallel_scan.h"
+#include "../snapshot.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <deque>
 #include <memory>
 #include <scoped_allocator>
 #include <string>
+#include <thread>
+#include <vector>
 #include <tbb/concurrent_hash_map.h>
 
 namespace pmem
@@ -22,6 +32,7 @@ template <typename AllocatorFactory>
 class basic_vcmap : public engine_base {
 	class basic_vcmap_iterator;
 	class basic_vcmap_const_iterator;
+	class basic_vcmap_transaction;
 
 public:
 	basic_vcmap(std::unique_ptr<internal::config> cfg);
@@ -32,6 +43,8 @@ public:
 	status count_all(std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
 
 	status exists(string_view key) final;
 
@@ -39,33 +52,197 @@ public:
 
 	status put(string_view key, string_view value) final;
 
+	uint64_t key_hash(string_view key) final;
+	status exists_hashed(string_view key, uint64_t hash) final;
+	status get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			  void *arg) final;
+	status put_hashed(string_view key, uint64_t hash, string_view value) final;
+
+	status update(string_view key, update_callback *callback, void *arg) final;
+	status put_if_absent(string_view key, string_view value, bool &inserted) final;
+
 	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
 
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
+	internal::transaction *begin_tx() final;
+
 private:
 	using ch_allocator_t = typename AllocatorFactory::template allocator_type<char>;
 	using pmem_string =
 		std::basic_string<char, std::char_traits<char>, ch_allocator_t>;
+
+	/*
+	 * Key of the map. Keys stored in the map own their data, while keys
+	 * created by view() (used only for lookups) refer to a string_view,
+	 * so that lookups don't need any allocation.
+	 */
+	class key_type {
+	public:
+		using allocator_type = ch_allocator_t;
+
+		key_type(const key_type &other)
+		    : str(other.data(), other.size(), other.str.get_allocator())
+		{
+		}
+
+		key_type(key_type &&other) = default;
+
+		key_type(const key_type &other, const allocator_type &a)
+		    : str(other.data(), other.size(), a)
+		{
+		}
+
+		key_type &operator=(const key_type &) = delete;
+
+		/*
+		 * Returns key referring to 'key', which must outlive it. Its hash
+		 * is computed by the caller, so it's done once per operation.
+		 */
+		static key_type view(string_view key, uint64_t hash,
+				     const allocator_type &a)
+		{
+			return key_type(key, hash, a);
+		}
+
+		/* Returns hash of the key (cached for views) */
+		uint64_t hash() const
+		{
+			return view_data ? view_hash : basic_vcmap::hash(data(), size());
+		}
+
+		const char *data() const
+		{
+			return view_data ? view_data : str.data();
+		}
+
+		/* keys stored in the map are always null-terminated */
+		const char *c_str() const
+		{
+			return data();
+		}
+
+		size_t size() const
+		{
+			return view_data ? view_size : str.size();
+		}
+
+		bool operator==(const key_type &other) const
+		{
+			return size() == other.size() &&
+				std::memcmp(data(), other.data(), size()) == 0;
+		}
+
+	private:
+		/* empty std::basic_string does not allocate */
+		key_type(string_view key, uint64_t hash, const allocator_type &a)
+		    : str(a),
+		      view_data(key.data()),
+		      view_size(key.size()),
+		      view_hash(hash)
+		{
+		}
+
+		pmem_string str;
+		const char *view_data = nullptr;
+		size_t view_size = 0;
+		uint64_t view_hash = 0;
+	};
+
+	struct key_hash_compare {
+		static size_t hash(const key_type &key)
+		{
+			return key.hash();
+		}
+
+		static bool equal(const key_type &lhs, const key_type &rhs)
+		{
+			return lhs == rhs;
+		}
+	};
+
 	using kv_allocator_t = typename AllocatorFactory::template allocator_type<
-		std::pair<const pmem_string, pmem_string>>;
+		std::pair<const key_type, pmem_string>>;
 
-	typedef tbb::concurrent_hash_map<pmem_string, pmem_string,
-					 tbb::tbb_hash_compare<pmem_string>,
+	typedef tbb::concurrent_hash_map<key_type, pmem_string, key_hash_compare,
 					 std::scoped_allocator_adaptor<kv_allocator_t>>
 		map_t;
-	kv_allocator_t kv_allocator;
-	ch_allocator_t ch_allocator;
-	map_t pmem_kv_container;
+	static constexpr std::size_t HOT_CACHE_SHARDS = 16;
+	static constexpr std::size_t EVICTION_SHARDS = 16;
+
+	static uint64_t hash(const char *key, std::size_t size)
+	{
+		return internal::crc_hash(size, key);
+	}
+
+	static uint64_t hash(string_view key)
+	{
+		return hash(key.data(), key.size());
+	}
+
+	/* Map and allocators using one memory (e.g. one NUMA node's PMEM) */
+	struct partition {
+		partition(internal::config &cfg, std::size_t index)
+		    : kv_allocator(AllocatorFactory::template create<ch_allocator_t>(
+			      cfg, index)),
+		      ch_allocator(kv_allocator),
+		      pmem_kv_container(
+			      std::scoped_allocator_adaptor<kv_allocator_t>(kv_allocator))
+		{
+		}
+
+		kv_allocator_t kv_allocator;
+		ch_allocator_t ch_allocator;
+		map_t pmem_kv_container;
+	};
+
+	/*
+	 * Returns partition storing the key. Keys are spread by high bits of
+	 * the hash, as the low ones select a bucket within the hashmap.
+	 */
+	partition &get_partition(uint64_t hash)
+	{
+		if (partitions.size() == 1)
+			return *partitions[0];
+
+		return *partitions[(hash >> 48) % partitions.size()];
+	}
+
+	void make_room();
+
+	std::vector<std::unique_ptr<partition>> partitions;
+	/* DRAM copies of recently read entries, enabled by "hot_cache_size" */
+	std::unique_ptr<internal::hot_cache> cache;
+	/* limits of records, enabled by "max_items" and/or "max_bytes" */
+	std::unique_ptr<internal::clock_eviction> eviction;
 };
 
 template <typename AllocatorFactory>
 basic_vcmap<AllocatorFactory>::basic_vcmap(std::unique_ptr<internal::config> cfg)
-    : kv_allocator(AllocatorFactory::template create<ch_allocator_t>(*cfg)),
-      ch_allocator(kv_allocator),
-      pmem_kv_container(std::scoped_allocator_adaptor<kv_allocator_t>(kv_allocator))
 {
+	auto partitions_number = AllocatorFactory::partitions_number(*cfg);
+	for (std::size_t i = 0; i < partitions_number; ++i)
+		partitions.emplace_back(new partition(*cfg, i));
+
+	uint64_t hot_cache_size = 0;
+	cfg->get_uint64("hot_cache_size", &hot_cache_size);
+	if (hot_cache_size > 0)
+		cache.reset(new internal::hot_cache(
+			static_cast<std::size_t>(hot_cache_size), HOT_CACHE_SHARDS));
+
+	uint64_t max_items = 0, max_bytes = 0;
+	cfg->get_uint64("max_items", &max_items);
+	cfg->get_uint64("max_bytes", &max_bytes);
+	if (max_items > 0 || max_bytes > 0)
+		eviction.reset(new internal::clock_eviction(
+			static_cast<std::size_t>(max_items),
+			static_cast<std::size_t>(max_bytes), EVICTION_SHARDS));
+
 	LOG("Started ok");
 }
 
@@ -75,6 +252,29 @@ basic_vcmap<AllocatorFactory>::~basic_vcmap()
 	LOG("Stopped ok");
 }
 
+/*
+ * Evicts records while the limits are exceeded. It's called after
+ * a modification, with no accessor held, as it locks evicted records.
+ */
+template <typename AllocatorFactory>
+void basic_vcmap<AllocatorFactory>::make_room()
+{
+	eviction->make_room([&](string_view key, uint64_t h, bool erase) {
+		auto &p = get_partition(h);
+		typename map_t::accessor acc;
+		if (!p.pmem_kv_container.find(acc, key_type::view(key, h, p.ch_allocator)))
+			return false;
+		if (!erase)
+			return true;
+
+		eviction->removed(key.size() + acc->second.size());
+		if (cache)
+			cache->invalidate(h);
+		p.pmem_kv_container.erase(acc);
+		return true;
+	});
+}
+
 template <typename AllocatorFactory>
 std::string basic_vcmap<AllocatorFactory>::name()
 {
@@ -85,7 +285,9 @@ template <typename AllocatorFactory>
 status basic_vcmap<AllocatorFactory>::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
-	cnt = pmem_kv_container.size();
+	cnt = 0;
+	for (auto &p : partitions)
+		cnt += p->pmem_kv_container.size();
 
 	return status::OK;
 }
@@ -94,61 +296,237 @@ template <typename AllocatorFactory>
 status basic_vcmap<AllocatorFactory>::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
-	for (auto &iterator : pmem_kv_container) {
-		auto ret = callback(iterator.first.c_str(), iterator.first.size(),
-				    iterator.second.c_str(), iterator.second.size(), arg);
-
-		if (ret != 0)
-			return status::STOPPED_BY_CB;
+	for (auto &p : partitions) {
+		for (auto &iterator : p->pmem_kv_container) {
+			auto ret = callback(iterator.first.c_str(), iterator.first.size(),
+					    iterator.second.c_str(),
+					    iterator.second.size(), arg);
+
+			if (ret != 0)
+				return status::STOPPED_BY_CB;
+		}
 	}
 
 	return status::OK;
 }
 
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::get_all_parallel(std::size_t partitions,
+						       get_kv_callback *callback,
+						       void **args)
+{
+	LOG("get_all_parallel");
+
+	/* split the ranges of buckets in halves, until there are enough parts */
+	using range_type = typename map_t::const_range_type;
+	std::vector<range_type> ranges;
+	for (auto &p : this->partitions) {
+		const map_t &map = p->pmem_kv_container;
+		ranges.push_back(map.range());
+	}
+
+	bool divisible = true;
+	while (ranges.size() < partitions && divisible) {
+		divisible = false;
+
+		auto n = ranges.size();
+		for (std::size_t i = 0; i < n && ranges.size() < partitions; ++i) {
+			if (!ranges[i].is_divisible())
+				continue;
+
+			range_type second_half(ranges[i], tbb::split());
+			ranges.push_back(second_half);
+			divisible = true;
+		}
+	}
+
+	return internal::parallel_scan(
+		ranges.size(), callback, args,
+		[&](std::size_t partition, get_kv_callback *cb, void *arg) {
+			return internal::iterate_through_pairs(
+				ranges[partition].begin(), ranges[partition].end(), cb,
+				arg);
+		});
+}
+
 template <typename AllocatorFactory>
 status basic_vcmap<AllocatorFactory>::exists(string_view key)
+{
+	return exists_hashed(key, hash(key));
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::get(string_view key, get_v_callback *callback,
+					  void *arg)
+{
+	return get_hashed(key, hash(key), callback, arg);
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::put(string_view key, string_view value)
+{
+	return put_hashed(key, hash(key), value);
+}
+
+template <typename AllocatorFactory>
+uint64_t basic_vcmap<AllocatorFactory>::key_hash(string_view key)
+{
+	return hash(key);
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::exists_hashed(string_view key, uint64_t h)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
+	auto &p = get_partition(h);
 	typename map_t::const_accessor result;
-	// XXX - do not create temporary string
-	const bool result_found = pmem_kv_container.find(
-		result, pmem_string(key.data(), key.size(), ch_allocator));
+	const bool result_found =
+		p.pmem_kv_container.find(result, key_type::view(key, h, p.ch_allocator));
 	return (result_found ? status::OK : status::NOT_FOUND);
 }
 
 template <typename AllocatorFactory>
-status basic_vcmap<AllocatorFactory>::get(string_view key, get_v_callback *callback,
-					  void *arg)
+status basic_vcmap<AllocatorFactory>::get_hashed(string_view key, uint64_t h,
+						 get_v_callback *callback, void *arg)
 {
 	LOG("get key=" << std::string(key.data(), key.size()));
+
+	if (eviction)
+		eviction->touch(h);
+
+	if (cache && cache->get(key, h, callback, arg))
+		return status::OK;
+
+	auto &p = get_partition(h);
 	typename map_t::const_accessor result;
-	// XXX - do not create temporary string
-	const bool result_found = pmem_kv_container.find(
-		result, pmem_string(key.data(), key.size(), ch_allocator));
+	const bool result_found =
+		p.pmem_kv_container.find(result, key_type::view(key, h, p.ch_allocator));
 	if (!result_found) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
 	}
 
+	/* filled under the record's lock, so it can't race with invalidation */
+	if (cache)
+		cache->put(key, h, string_view(result->second.data(), result->second.size()));
+
 	callback(result->second.c_str(), result->second.size(), arg);
 	return status::OK;
 }
 
 template <typename AllocatorFactory>
-status basic_vcmap<AllocatorFactory>::put(string_view key, string_view value)
+status basic_vcmap<AllocatorFactory>::put_hashed(string_view key, uint64_t h,
+						 string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 
+	auto &p = get_partition(h);
+	typename map_t::value_type kv_pair(
+		std::piecewise_construct,
+		std::forward_as_tuple(key_type::view(key, h, p.ch_allocator)),
+		std::forward_as_tuple(p.ch_allocator));
+
+	typename map_t::accessor acc;
+	bool inserted = p.pmem_kv_container.insert(acc, std::move(kv_pair));
+	auto old_size = acc->second.size();
+	acc->second.assign(value.data(), value.size());
+
+	if (cache)
+		cache->invalidate(h);
+
+	if (eviction) {
+		if (inserted)
+			eviction->inserted(key, h, key.size() + value.size());
+		else
+			eviction->resized(old_size, value.size());
+
+		acc.release();
+		make_room();
+	}
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::update(string_view key, update_callback *callback,
+					     void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+
+	auto h = hash(key);
+	auto &p = get_partition(h);
+	typename map_t::value_type kv_pair(
+		std::piecewise_construct,
+		std::forward_as_tuple(key_type::view(key, h, p.ch_allocator)),
+		std::forward_as_tuple(p.ch_allocator));
+
+	/* accessor keeps the record locked until the new value is assigned */
+	typename map_t::accessor acc;
+	bool inserted = p.pmem_kv_container.insert(acc, std::move(kv_pair));
+
+	const char *new_value;
+	size_t new_valuebytes;
+	auto ret = inserted ? callback(nullptr, 0, &new_value, &new_valuebytes, arg)
+			    : callback(acc->second.c_str(), acc->second.size(),
+				       &new_value, &new_valuebytes, arg);
+	if (ret != 0) {
+		if (inserted)
+			p.pmem_kv_container.erase(acc);
+		return status::STOPPED_BY_CB;
+	}
+
+	auto old_size = acc->second.size();
+	acc->second.assign(new_value, new_valuebytes);
+
+	if (cache)
+		cache->invalidate(h);
+
+	if (eviction) {
+		if (inserted)
+			eviction->inserted(key, h, key.size() + new_valuebytes);
+		else
+			eviction->resized(old_size, new_valuebytes);
+
+		acc.release();
+		make_room();
+	}
+
+	return status::OK;
+}
+
+/* insert() finds or creates the record in a single probe, holding its lock */
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::put_if_absent(string_view key, string_view value,
+						    bool &inserted)
+{
+	LOG("put_if_absent key=" << std::string(key.data(), key.size())
+				 << ", value.size=" << std::to_string(value.size()));
+
+	auto h = hash(key);
+	auto &p = get_partition(h);
 	typename map_t::value_type kv_pair(
 		std::piecewise_construct,
-		std::forward_as_tuple(key.data(), key.size(), ch_allocator),
-		std::forward_as_tuple(ch_allocator));
+		std::forward_as_tuple(key_type::view(key, h, p.ch_allocator)),
+		std::forward_as_tuple(p.ch_allocator));
 
 	typename map_t::accessor acc;
-	pmem_kv_container.insert(acc, std::move(kv_pair));
+	inserted = p.pmem_kv_container.insert(acc, std::move(kv_pair));
+	if (!inserted)
+		return status::OK;
+
 	acc->second.assign(value.data(), value.size());
 
+	if (cache)
+		cache->invalidate(h);
+
+	if (eviction) {
+		eviction->inserted(key, h, key.size() + value.size());
+
+		acc.release();
+		make_room();
+	}
+
 	return status::OK;
 }
 
@@ -157,20 +535,94 @@ status basic_vcmap<AllocatorFactory>::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 
-	// XXX - do not create temporary string
-	bool erased = pmem_kv_container.erase(
-		pmem_string(key.data(), key.size(), ch_allocator));
+	auto h = hash(key);
+	auto &p = get_partition(h);
+	if (cache || eviction) {
+		typename map_t::accessor acc;
+		auto found = p.pmem_kv_container.find(
+			acc, key_type::view(key, h, p.ch_allocator));
+		if (!found)
+			return status::NOT_FOUND;
+
+		if (cache)
+			cache->invalidate(h);
+		if (eviction)
+			eviction->removed(key.size() + acc->second.size());
+		p.pmem_kv_container.erase(acc);
+		return status::OK;
+	}
+
+	bool erased = p.pmem_kv_container.erase(key_type::view(key, h, p.ch_allocator));
 	return (erased ? status::OK : status::NOT_FOUND);
 }
 
+/* the value is read and the record erased under the same accessor */
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::take(string_view key, get_v_callback *callback,
+					   void *arg)
+{
+	LOG("take key=" << std::string(key.data(), key.size()));
+
+	auto h = hash(key);
+	auto &p = get_partition(h);
+	typename map_t::accessor acc;
+	if (!p.pmem_kv_container.find(acc, key_type::view(key, h, p.ch_allocator))) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	callback(acc->second.c_str(), acc->second.size(), arg);
+
+	if (cache)
+		cache->invalidate(h);
+	if (eviction)
+		eviction->removed(key.size() + acc->second.size());
+	p.pmem_kv_container.erase(acc);
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::snapshot_save(const std::string &path)
+{
+	LOG("snapshot_save path=" << path);
+
+	internal::snapshot_writer writer(path);
+	for (auto &p : partitions) {
+		for (auto &it : p->pmem_kv_container)
+			writer.write(string_view(it.first.data(), it.first.size()),
+				     string_view(it.second.data(), it.second.size()));
+	}
+	writer.commit();
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::snapshot_load(const std::string &path)
+{
+	LOG("snapshot_load path=" << path);
+
+	internal::snapshot_reader reader(path);
+
+	/* allocate all buckets upfront, so the hashmaps don't grow while loading */
+	for (auto &p : partitions)
+		p->pmem_kv_container.rehash(
+			static_cast<std::size_t>(reader.records() / partitions.size()));
+
+	reader.read_parallel(std::thread::hardware_concurrency(),
+			     [&](string_view key, string_view value) { put(key, value); });
+
+	return status::OK;
+}
+
 template <typename AllocatorFactory>
 class basic_vcmap<AllocatorFactory>::basic_vcmap_const_iterator
     : virtual public internal::iterator_base {
 	using container_type = basic_vcmap<AllocatorFactory>::map_t;
-	using ch_allocator_t = basic_vcmap<AllocatorFactory>::ch_allocator_t;
 
 public:
-	basic_vcmap_const_iterator(container_type *container, ch_allocator_t *ca);
+	basic_vcmap_const_iterator(basic_vcmap<AllocatorFactory> *engine);
 
 	status seek(string_view key) final;
 
@@ -178,20 +630,18 @@ public:
 
 	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
 
+	void reset() final;
+
 protected:
-	container_type *container;
+	basic_vcmap<AllocatorFactory> *engine;
 	typename container_type::accessor acc_;
-	ch_allocator_t *ch_allocator;
 };
 
 template <typename AllocatorFactory>
 class basic_vcmap<AllocatorFactory>::basic_vcmap_iterator
     : public basic_vcmap<AllocatorFactory>::basic_vcmap_const_iterator {
-	using container_type = basic_vcmap<AllocatorFactory>::map_t;
-	using ch_allocator_t = basic_vcmap<AllocatorFactory>::ch_allocator_t;
-
 public:
-	basic_vcmap_iterator(container_type *container, ch_allocator_t *ca);
+	basic_vcmap_iterator(basic_vcmap<AllocatorFactory> *engine);
 
 	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
 	status commit() final;
@@ -201,29 +651,67 @@ private:
 	std::vector<std::pair<std::string, size_t>> log;
 };
 
+/*
+ * Transaction of vcmap. Operations are buffered in dram_log and only the
+ * last operation on every key is applied on commit. New values are allocated
+ * upfront, then all affected records are locked (in order of their hashes,
+ * so concurrent commits can't deadlock) and modified at once - readers of
+ * these records wait until the whole transaction is applied.
+ */
+template <typename AllocatorFactory>
+class basic_vcmap<AllocatorFactory>::basic_vcmap_transaction
+    : public internal::transaction {
+public:
+	basic_vcmap_transaction(basic_vcmap<AllocatorFactory> *engine);
+
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status commit() final;
+	void abort() final;
+
+private:
+	/* operation on a key, 'value' is nullptr for remove */
+	struct operation {
+		uint64_t hash;
+		string_view key;
+		const string_view *value;
+	};
+
+	basic_vcmap<AllocatorFactory> *engine;
+	internal::dram_log log;
+	std::vector<operation> ops;
+};
+
+template <typename AllocatorFactory>
+internal::transaction *basic_vcmap<AllocatorFactory>::begin_tx()
+{
+	return new basic_vcmap_transaction{this};
+}
+
 template <typename AllocatorFactory>
 internal::iterator_base *basic_vcmap<AllocatorFactory>::new_iterator()
 {
-	return new basic_vcmap_iterator{&pmem_kv_container, &ch_allocator};
+	return new basic_vcmap_iterator{this};
 }
 
 template <typename AllocatorFactory>
 internal::iterator_base *basic_vcmap<AllocatorFactory>::new_const_iterator()
 {
-	return new basic_vcmap_const_iterator{&pmem_kv_container, &ch_allocator};
+	return new basic_vcmap_const_iterator{this};
 }
 
 template <typename AllocatorFactory>
 basic_vcmap<AllocatorFactory>::basic_vcmap_const_iterator::basic_vcmap_const_iterator(
-	container_type *c, ch_allocator_t *ca)
-    : container(c), ch_allocator(ca)
+	basic_vcmap<AllocatorFactory> *engine)
+    : engine(engine)
 {
 }
 
 template <typename AllocatorFactory>
 basic_vcmap<AllocatorFactory>::basic_vcmap_iterator::basic_vcmap_iterator(
-	container_type *c, ch_allocator_t *ca)
-    : basic_vcmap<AllocatorFactory>::basic_vcmap_const_iterator(c, ca)
+	basic_vcmap<AllocatorFactory> *engine)
+    : basic_vcmap<AllocatorFactory>::basic_vcmap_const_iterator(engine)
 {
 }
 
@@ -232,18 +720,27 @@ status basic_vcmap<AllocatorFactory>::basic_vcmap_const_iterator::seek(string_vi
 {
 	init_seek();
 
-	if (container->find(acc_, pmem_string(key.data(), key.size(), *ch_allocator)))
+	auto h = hash(key);
+	auto &p = engine->get_partition(h);
+	if (p.pmem_kv_container.find(acc_, key_type::view(key, h, p.ch_allocator)))
 		return status::OK;
 
 	return status::NOT_FOUND;
 }
 
+template <typename AllocatorFactory>
+void basic_vcmap<AllocatorFactory>::basic_vcmap_const_iterator::reset()
+{
+	init_seek();
+	acc_.release();
+}
+
 template <typename AllocatorFactory>
 result<string_view> basic_vcmap<AllocatorFactory>::basic_vcmap_const_iterator::key()
 {
 	assert(!acc_.empty());
 
-	return string_view(acc_->first.data(), acc_->first.length());
+	return string_view(acc_->first.data(), acc_->first.size());
 }
 
 template <typename AllocatorFactory>
@@ -277,6 +774,11 @@ basic_vcmap<AllocatorFactory>::basic_vcmap_iterator::write_range(size_t pos, siz
 template <typename AllocatorFactory>
 status basic_vcmap<AllocatorFactory>::basic_vcmap_iterator::commit()
 {
+	auto &cache = this->engine->cache;
+	if (cache && !log.empty())
+		cache->invalidate(
+			hash(string_view(this->acc_->first.data(), this->acc_->first.size())));
+
 	for (auto &p : log) {
 		auto dest = &(this->acc_->second[0]) + p.second;
 		std::copy(p.first.begin(), p.first.end(), dest);
@@ -292,6 +794,143 @@ void basic_vcmap<AllocatorFactory>::basic_vcmap_iterator::abort()
 	log.clear();
 }
 
+template <typename AllocatorFactory>
+basic_vcmap<AllocatorFactory>::basic_vcmap_transaction::basic_vcmap_transaction(
+	basic_vcmap<AllocatorFactory> *engine)
+    : engine(engine)
+{
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::basic_vcmap_transaction::put(string_view key,
+								   string_view value)
+{
+	log.insert(key, value);
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::basic_vcmap_transaction::remove(string_view key)
+{
+	log.remove(key);
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::basic_vcmap_transaction::get(
+	string_view key, get_v_callback *callback, void *arg)
+{
+	return log.get(key, callback, arg,
+		       [&] { return engine->get(key, callback, arg); });
+}
+
+template <typename AllocatorFactory>
+status basic_vcmap<AllocatorFactory>::basic_vcmap_transaction::commit()
+{
+	ops.clear();
+	log.foreach (
+		[&](const internal::dram_log::element_type &e) {
+			ops.push_back(operation{hash(e.first), e.first, &e.second});
+		},
+		[&](const internal::dram_log::element_type &e) {
+			ops.push_back(operation{hash(e.first), e.first, nullptr});
+		});
+
+	/* operations on the same key stay in order, only the last one is kept */
+	std::stable_sort(ops.begin(), ops.end(),
+			 [](const operation &lhs, const operation &rhs) {
+				 if (lhs.hash != rhs.hash)
+					 return lhs.hash < rhs.hash;
+				 return lhs.key.compare(rhs.key) < 0;
+			 });
+
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < ops.size(); ++i) {
+		if (i + 1 < ops.size() && ops[i + 1].hash == ops[i].hash &&
+		    ops[i + 1].key.compare(ops[i].key) == 0)
+			continue;
+		ops[n++] = ops[i];
+	}
+	ops.resize(n);
+
+	/* allocated before locking, so that applying operations can't fail */
+	std::vector<pmem_string> values;
+	for (auto &op : ops) {
+		if (op.value)
+			values.emplace_back(op.value->data(), op.value->size(),
+					    engine->get_partition(op.hash).ch_allocator);
+	}
+
+	std::deque<typename map_t::accessor> accessors;
+	std::vector<bool> inserted(ops.size(), false);
+	try {
+		for (std::size_t i = 0; i < ops.size(); ++i) {
+			auto &op = ops[i];
+			auto &p = engine->get_partition(op.hash);
+			auto key = key_type::view(op.key, op.hash, p.ch_allocator);
+
+			accessors.emplace_back();
+			if (!op.value) {
+				p.pmem_kv_container.find(accessors.back(), key);
+				continue;
+			}
+
+			typename map_t::value_type kv_pair(
+				std::piecewise_construct,
+				std::forward_as_tuple(std::move(key)),
+				std::forward_as_tuple(p.ch_allocator));
+			inserted[i] = p.pmem_kv_container.insert(accessors.back(),
+								 std::move(kv_pair));
+		}
+	} catch (...) {
+		/* new (empty) records must not become visible */
+		for (std::size_t i = 0; i < accessors.size(); ++i) {
+			if (inserted[i])
+				engine->get_partition(ops[i].hash)
+					.pmem_kv_container.erase(accessors[i]);
+		}
+		throw;
+	}
+
+	auto &cache = engine->cache;
+	auto &eviction = engine->eviction;
+	auto value = values.begin();
+	for (std::size_t i = 0; i < ops.size(); ++i) {
+		auto &op = ops[i];
+		if (eviction && op.value && inserted[i])
+			eviction->inserted(op.key, op.hash, op.key.size() + value->size());
+		else if (eviction && op.value)
+			eviction->resized(accessors[i]->second.size(), value->size());
+		else if (eviction && !accessors[i].empty())
+			eviction->removed(op.key.size() + accessors[i]->second.size());
+
+		if (op.value)
+			accessors[i]->second.swap(*value++);
+		else if (!accessors[i].empty())
+			engine->get_partition(op.hash).pmem_kv_container.erase(
+				accessors[i]);
+
+		if (cache)
+			cache->invalidate(op.hash);
+	}
+	accessors.clear();
+
+	if (eviction)
+		engine->make_room();
+
+	ops.clear();
+	log.clear();
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+void basic_vcmap<AllocatorFactory>::basic_vcmap_transaction::abort()
+{
+	ops.clear();
+	log.clear();
+}
+
 } /* namespace kv */
 } /* namespace pmem */
 
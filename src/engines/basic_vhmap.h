@@ -0,0 +1,787 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_BASIC_VHMAP_H
+#define LIBPMEMKV_BASIC_VHMAP_H
+
+#include "../crc_hash.h"
+#include "../engine.h"
+#include "../epoch_reclaimer.h"
+#include "../out.h"
+#include "../parallel_scan.h"
+#include "../snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+
+/**
+ * basic_vhmap is a volatile hashmap with lock-free reads. It's an open
+ * addressing table, probed linearly by groups of GROUP_SLOTS slots. Each group
+ * takes one cache line: a word of one-byte tags (7 bits of the hash of each
+ * slot's key) and pointers to immutable entries. Lookup compares all tags of
+ * a group at once (SWAR, i.e. SIMD within a 64-bit register) and reads only
+ * entries with a matching tag.
+ *
+ * Readers never write shared memory other than their shard of
+ * the epoch_reclaimer: put and update replace the entry pointer with a new
+ * entry, remove replaces it with a tombstone, and old entries are freed once
+ * no reader can see them. Writers of keys from the same stripe (picked by
+ * the hash) are serialized by the stripe's mutex; free slots are claimed with
+ * CAS, so writers of different stripes don't have to exclude each other.
+ * Growing (or cleaning tombstones from) the table locks all stripes, builds
+ * a new table and publishes it, while readers still use the old one.
+ *
+ * As in basic_vcmap, data can be split into partitions (see AllocatorFactory).
+ */
+template <typename AllocatorFactory>
+class basic_vhmap : public engine_base {
+public:
+	basic_vhmap(std::unique_ptr<internal::config> cfg);
+	~basic_vhmap();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+
+	status put(string_view key, string_view value) final;
+
+	status update(string_view key, update_callback *callback, void *arg) final;
+
+	status remove(string_view key) final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
+
+private:
+	using allocator_type = typename AllocatorFactory::template allocator_type<char>;
+
+	static constexpr std::size_t GROUP_SLOTS = 7;
+	static constexpr std::size_t MIN_GROUPS = 64;
+	static constexpr std::size_t STRIPES = 64;
+	static constexpr std::size_t CACHE_LINE = 64;
+
+	static constexpr uint8_t EMPTY_TAG = 0;
+	static constexpr uint8_t TOMBSTONE_TAG = 1;
+	/* tag of the unused, last byte of tags, it matches nothing */
+	static constexpr uint8_t UNUSED_TAG = 2;
+
+	/* Key and value (both null-terminated) follow the header */
+	struct entry {
+		uint64_t hash;
+		uint64_t key_size;
+		uint64_t value_size;
+
+		const char *key() const
+		{
+			return reinterpret_cast<const char *>(this + 1);
+		}
+
+		const char *value() const
+		{
+			return key() + key_size + 1;
+		}
+	};
+
+	struct alignas(CACHE_LINE) group {
+		group() : tags(uint64_t(UNUSED_TAG) << (8 * GROUP_SLOTS))
+		{
+			for (auto &slot : slots)
+				slot.store(nullptr, std::memory_order_relaxed);
+		}
+
+		std::atomic<uint64_t> tags;
+		std::atomic<entry *> slots[GROUP_SLOTS];
+	};
+
+	static_assert(sizeof(group) == CACHE_LINE, "Wrong size of group");
+
+	/* Groups follow the header (aligned to CACHE_LINE) in one allocation */
+	struct table {
+		std::size_t groups_number;
+		std::size_t memory_size;
+		group *groups;
+	};
+
+	struct slot_ref {
+		group *grp = nullptr;
+		std::size_t idx = 0;
+
+		std::atomic<entry *> &ptr() const
+		{
+			return grp->slots[idx];
+		}
+	};
+
+	struct stripe {
+		std::mutex mtx;
+		/* avoids false sharing between neighbouring stripes */
+		char padding[64];
+	};
+
+	struct partition {
+		partition(internal::config &cfg, std::size_t index);
+		~partition();
+
+		allocator_type allocator;
+		std::atomic<table *> current;
+		/* numbers of entries and tombstones in the current table */
+		std::atomic<std::size_t> count;
+		std::atomic<std::size_t> tombstones;
+		std::unique_ptr<stripe[]> stripes;
+		internal::epoch_reclaimer reclaimer;
+	};
+
+	static uint64_t hash(string_view key)
+	{
+		return internal::crc_hash(key.size(), key.data());
+	}
+
+	/* Tag is made of the low bits, group index of the next ones */
+	static uint8_t tag_of(uint64_t h)
+	{
+		return static_cast<uint8_t>((h & 0x7f) | 0x80);
+	}
+
+	static std::size_t home_group(uint64_t h, std::size_t mask)
+	{
+		return static_cast<std::size_t>(h >> 7) & mask;
+	}
+
+	/* Returns mask with the highest bit set in bytes of 'tags' equal to 'tag' */
+	static uint64_t match(uint64_t tags, uint8_t tag)
+	{
+		const uint64_t lows = 0x0101010101010101ULL;
+		auto x = tags ^ (lows * tag);
+
+		/* may report false positives (above a real match), keys are compared */
+		return (x - lows) & ~x & (lows << 7);
+	}
+
+	static std::size_t slot_index(uint64_t mask)
+	{
+		return static_cast<std::size_t>(__builtin_ctzll(mask)) / 8;
+	}
+
+	static entry *tombstone()
+	{
+		return reinterpret_cast<entry *>(uintptr_t(1));
+	}
+
+	static bool is_entry(const entry *e)
+	{
+		return e != nullptr && e != tombstone();
+	}
+
+	static bool equal(const entry *e, string_view key, uint64_t h)
+	{
+		return e->hash == h && e->key_size == key.size() &&
+			std::memcmp(e->key(), key.data(), key.size()) == 0;
+	}
+
+	static std::size_t entry_size(std::size_t key_size, std::size_t value_size)
+	{
+		return sizeof(entry) + key_size + value_size + 2;
+	}
+
+	static void set_tag(group &grp, std::size_t idx, uint8_t tag);
+
+	partition &get_partition(uint64_t h)
+	{
+		if (partitions.size() == 1)
+			return *partitions[0];
+
+		return *partitions[(h >> 48) % partitions.size()];
+	}
+
+	static table *new_table(partition &p, std::size_t groups_number);
+	static void free_table(partition &p, table *t);
+
+	entry *make_entry(partition &p, uint64_t h, string_view key, string_view value);
+	entry *find(partition &p, string_view key, uint64_t h);
+	bool lookup(table *t, string_view key, uint64_t h, slot_ref &ref);
+	bool overloaded(partition &p);
+	void resize(partition &p, std::size_t min_count);
+
+	template <typename F>
+	bool modify(string_view key, F f);
+
+	template <typename F>
+	status scan(table *t, std::size_t first, std::size_t last, F f);
+
+	std::vector<std::unique_ptr<partition>> partitions;
+};
+
+template <typename AllocatorFactory>
+basic_vhmap<AllocatorFactory>::partition::partition(internal::config &cfg,
+						    std::size_t index)
+    : allocator(AllocatorFactory::template create<char>(cfg, index)),
+      count(0),
+      tombstones(0),
+      stripes(new stripe[STRIPES]),
+      reclaimer(std::thread::hardware_concurrency(),
+		[this](void *ptr, std::size_t size) {
+			allocator.deallocate(static_cast<char *>(ptr), size);
+		})
+{
+	current.store(new_table(*this, MIN_GROUPS));
+}
+
+template <typename AllocatorFactory>
+basic_vhmap<AllocatorFactory>::partition::~partition()
+{
+	auto t = current.load();
+	for (std::size_t g = 0; g < t->groups_number; ++g) {
+		for (auto &slot : t->groups[g].slots) {
+			auto e = slot.load(std::memory_order_relaxed);
+			if (is_entry(e))
+				allocator.deallocate(reinterpret_cast<char *>(e),
+						     entry_size(e->key_size, e->value_size));
+		}
+	}
+
+	free_table(*this, t);
+}
+
+template <typename AllocatorFactory>
+basic_vhmap<AllocatorFactory>::basic_vhmap(std::unique_ptr<internal::config> cfg)
+{
+	auto partitions_number = AllocatorFactory::partitions_number(*cfg);
+	for (std::size_t i = 0; i < partitions_number; ++i)
+		partitions.emplace_back(new partition(*cfg, i));
+
+	LOG("Started ok");
+}
+
+template <typename AllocatorFactory>
+basic_vhmap<AllocatorFactory>::~basic_vhmap()
+{
+	LOG("Stopped ok");
+}
+
+template <typename AllocatorFactory>
+std::string basic_vhmap<AllocatorFactory>::name()
+{
+	return "basic_vhmap";
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	cnt = 0;
+	for (auto &p : partitions)
+		cnt += p->count.load();
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	for (auto &p : partitions) {
+		internal::epoch_guard guard(p->reclaimer);
+		auto t = p->current.load(std::memory_order_acquire);
+		auto s = scan(t, 0, t->groups_number, [&](const entry *e) {
+			return callback(e->key(), e->key_size, e->value(), e->value_size,
+					arg);
+		});
+		if (s != status::OK)
+			return s;
+	}
+
+	return status::OK;
+}
+
+/*
+ * Groups of tables of all partitions are split evenly between the threads.
+ * The tables are taken (and protected from being freed) by the calling thread,
+ * so all threads scan the same tables, even if they are replaced meanwhile.
+ */
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::get_all_parallel(std::size_t partitions,
+						       get_kv_callback *callback,
+						       void **args)
+{
+	LOG("get_all_parallel");
+
+	std::vector<std::unique_ptr<internal::epoch_guard>> guards;
+	std::vector<table *> tables;
+	std::size_t groups_number = 0;
+	for (auto &p : this->partitions) {
+		guards.emplace_back(new internal::epoch_guard(p->reclaimer));
+		tables.push_back(p->current.load(std::memory_order_acquire));
+		groups_number += tables.back()->groups_number;
+	}
+
+	auto ranges = std::min(partitions, groups_number);
+	return internal::parallel_scan(
+		ranges, callback, args,
+		[&](std::size_t range, get_kv_callback *cb, void *arg) {
+			/* range of groups counted over concatenated tables */
+			auto first = groups_number * range / ranges;
+			auto last = groups_number * (range + 1) / ranges;
+
+			std::size_t offset = 0;
+			for (auto t : tables) {
+				auto begin = std::max(first, offset);
+				auto end = std::min(last, offset + t->groups_number);
+				if (begin < end) {
+					auto s = scan(t, begin - offset, end - offset,
+						      [&](const entry *e) {
+							      return cb(e->key(),
+									e->key_size,
+									e->value(),
+									e->value_size,
+									arg);
+						      });
+					if (s != status::OK)
+						return s;
+				}
+				offset += t->groups_number;
+			}
+
+			return status::OK;
+		});
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+
+	auto h = hash(key);
+	auto &p = get_partition(h);
+	internal::epoch_guard guard(p.reclaimer);
+
+	return find(p, key, h) ? status::OK : status::NOT_FOUND;
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::get(string_view key, get_v_callback *callback,
+					  void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+
+	auto h = hash(key);
+	auto &p = get_partition(h);
+	internal::epoch_guard guard(p.reclaimer);
+
+	auto e = find(p, key, h);
+	if (!e) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	/* entry can't be freed until the guard is released */
+	callback(e->value(), e->value_size, arg);
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+
+	auto h = hash(key);
+	auto &p = get_partition(h);
+	modify(key, [&](const entry *) { return make_entry(p, h, key, value); });
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::update(string_view key, update_callback *callback,
+					     void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+
+	auto h = hash(key);
+	auto &p = get_partition(h);
+	bool stopped = false;
+	modify(key, [&](entry *old) {
+		const char *new_value;
+		size_t new_valuebytes;
+		auto ret = old ? callback(old->value(), old->value_size, &new_value,
+					  &new_valuebytes, arg)
+			       : callback(nullptr, 0, &new_value, &new_valuebytes, arg);
+		if (ret != 0) {
+			stopped = true;
+			return old;
+		}
+
+		return make_entry(p, h, key, string_view(new_value, new_valuebytes));
+	});
+
+	return stopped ? status::STOPPED_BY_CB : status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+
+	bool found = modify(key, [](entry *) -> entry * { return nullptr; });
+	return found ? status::OK : status::NOT_FOUND;
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::snapshot_save(const std::string &path)
+{
+	LOG("snapshot_save path=" << path);
+
+	internal::snapshot_writer writer(path);
+	for (auto &p : partitions) {
+		internal::epoch_guard guard(p->reclaimer);
+		auto t = p->current.load(std::memory_order_acquire);
+		scan(t, 0, t->groups_number, [&](const entry *e) {
+			writer.write(string_view(e->key(), e->key_size),
+				     string_view(e->value(), e->value_size));
+			return 0;
+		});
+	}
+	writer.commit();
+
+	return status::OK;
+}
+
+template <typename AllocatorFactory>
+status basic_vhmap<AllocatorFactory>::snapshot_load(const std::string &path)
+{
+	LOG("snapshot_load path=" << path);
+
+	internal::snapshot_reader reader(path);
+
+	/* allocate all groups upfront, so the tables don't grow while loading */
+	for (auto &p : partitions)
+		resize(*p, static_cast<std::size_t>(reader.records() / partitions.size()));
+
+	reader.read_parallel(std::thread::hardware_concurrency(),
+			     [&](string_view key, string_view value) { put(key, value); });
+
+	return status::OK;
+}
+
+/* Sets tag of a slot, other slots of the group may be changed concurrently */
+template <typename AllocatorFactory>
+void basic_vhmap<AllocatorFactory>::set_tag(group &grp, std::size_t idx, uint8_t tag)
+{
+	auto shift = 8 * idx;
+	auto tags = grp.tags.load(std::memory_order_relaxed);
+	uint64_t new_tags;
+	do {
+		new_tags = (tags & ~(uint64_t(0xff) << shift)) | (uint64_t(tag) << shift);
+	} while (!grp.tags.compare_exchange_weak(tags, new_tags, std::memory_order_release,
+						 std::memory_order_relaxed));
+}
+
+template <typename AllocatorFactory>
+typename basic_vhmap<AllocatorFactory>::table *
+basic_vhmap<AllocatorFactory>::new_table(partition &p, std::size_t groups_number)
+{
+	auto memory_size = sizeof(table) + CACHE_LINE + groups_number * sizeof(group);
+	auto memory = p.allocator.allocate(memory_size);
+
+	auto t = new (memory) table;
+	t->groups_number = groups_number;
+	t->memory_size = memory_size;
+
+	auto groups = reinterpret_cast<uintptr_t>(memory + sizeof(table));
+	groups = (groups + CACHE_LINE - 1) & ~(uintptr_t(CACHE_LINE) - 1);
+	t->groups = reinterpret_cast<group *>(groups);
+	for (std::size_t g = 0; g < groups_number; ++g)
+		new (&t->groups[g]) group;
+
+	return t;
+}
+
+template <typename AllocatorFactory>
+void basic_vhmap<AllocatorFactory>::free_table(partition &p, table *t)
+{
+	p.allocator.deallocate(reinterpret_cast<char *>(t), t->memory_size);
+}
+
+template <typename AllocatorFactory>
+typename basic_vhmap<AllocatorFactory>::entry *
+basic_vhmap<AllocatorFactory>::make_entry(partition &p, uint64_t h, string_view key,
+					  string_view value)
+{
+	auto memory = p.allocator.allocate(entry_size(key.size(), value.size()));
+
+	auto e = new (memory) entry;
+	e->hash = h;
+	e->key_size = key.size();
+	e->value_size = value.size();
+
+	auto data = memory + sizeof(entry);
+	std::memcpy(data, key.data(), key.size());
+	data[key.size()] = '\0';
+	std::memcpy(data + key.size() + 1, value.data(), value.size());
+	data[key.size() + 1 + value.size()] = '\0';
+
+	return e;
+}
+
+/*
+ * Returns entry of the key or nullptr, must be called inside a read. Probing
+ * stops at the first empty slot - slots never become empty again (only
+ * tombstones), so the key can't be stored after it.
+ */
+template <typename AllocatorFactory>
+typename basic_vhmap<AllocatorFactory>::entry *
+basic_vhmap<AllocatorFactory>::find(partition &p, string_view key, uint64_t h)
+{
+	auto t = p.current.load(std::memory_order_acquire);
+	auto mask = t->groups_number - 1;
+	auto tag = tag_of(h);
+
+	auto g = home_group(h, mask);
+	for (std::size_t i = 0; i <= mask; ++i, g = (g + 1) & mask) {
+		auto &grp = t->groups[g];
+		auto tags = grp.tags.load(std::memory_order_acquire);
+
+		for (auto m = match(tags, tag); m != 0; m &= m - 1) {
+			auto e = grp.slots[slot_index(m)].load(std::memory_order_acquire);
+			if (is_entry(e) && equal(e, key, h))
+				return e;
+		}
+
+		/* slot is claimed before its tag is set, so check the pointer */
+		for (auto m = match(tags, EMPTY_TAG); m != 0; m &= m - 1) {
+			auto idx = slot_index(m);
+			if (idx < GROUP_SLOTS &&
+			    grp.slots[idx].load(std::memory_order_acquire) == nullptr)
+				return nullptr;
+		}
+	}
+
+	return nullptr;
+}
+
+/*
+ * Looks for the key in the table, must be called inside a read, with the
+ * key's stripe locked. Returns true and the slot of the key, if it's found.
+ * Otherwise returns false and the first free slot on the key's probe path
+ * (ref.grp is nullptr if the table is full).
+ */
+template <typename AllocatorFactory>
+bool basic_vhmap<AllocatorFactory>::lookup(table *t, string_view key, uint64_t h,
+					   slot_ref &ref)
+{
+	auto mask = t->groups_number - 1;
+	ref.grp = nullptr;
+
+	auto g = home_group(h, mask);
+	for (std::size_t i = 0; i <= mask; ++i, g = (g + 1) & mask) {
+		auto &grp = t->groups[g];
+		for (std::size_t idx = 0; idx < GROUP_SLOTS; ++idx) {
+			auto e = grp.slots[idx].load(std::memory_order_acquire);
+			if (is_entry(e)) {
+				if (equal(e, key, h)) {
+					ref.grp = &grp;
+					ref.idx = idx;
+					return true;
+				}
+				continue;
+			}
+
+			if (!ref.grp) {
+				ref.grp = &grp;
+				ref.idx = idx;
+			}
+
+			if (e == nullptr)
+				return false;
+		}
+	}
+
+	return false;
+}
+
+/* Table is resized when entries and tombstones take more than 80% of slots */
+template <typename AllocatorFactory>
+bool basic_vhmap<AllocatorFactory>::overloaded(partition &p)
+{
+	auto slots = p.current.load()->groups_number * GROUP_SLOTS;
+	return (p.count.load() + p.tombstones.load()) * 5 > slots * 4;
+}
+
+/*
+ * Replaces the table with one big enough for twice the number of entries (or
+ * 'min_count'), without tombstones. Must not be called inside a read.
+ */
+template <typename AllocatorFactory>
+void basic_vhmap<AllocatorFactory>::resize(partition &p, std::size_t min_count)
+{
+	/* with all stripes locked there are no writers */
+	std::vector<std::unique_lock<std::mutex>> locks;
+	for (std::size_t i = 0; i < STRIPES; ++i)
+		locks.emplace_back(p.stripes[i].mtx);
+
+	auto old = p.current.load();
+	auto count = std::max(p.count.load(), min_count);
+	auto groups_number = old->groups_number;
+	while (2 * (count + 1) > groups_number * GROUP_SLOTS)
+		groups_number *= 2;
+
+	/* someone else has already resized it */
+	if (groups_number == old->groups_number && !overloaded(p))
+		return;
+
+	auto t = new_table(p, groups_number);
+	auto mask = groups_number - 1;
+	for (std::size_t g = 0; g < old->groups_number; ++g) {
+		for (auto &slot : old->groups[g].slots) {
+			auto e = slot.load(std::memory_order_relaxed);
+			if (!is_entry(e))
+				continue;
+
+			/* there are no tombstones, so the first free slot is empty */
+			slot_ref ref;
+			for (auto n = home_group(e->hash, mask); !ref.grp; n = (n + 1) & mask) {
+				auto tags = t->groups[n].tags.load(std::memory_order_relaxed);
+				auto m = match(tags, EMPTY_TAG) & ~(uint64_t(0xff)
+								   << (8 * GROUP_SLOTS));
+				if (m != 0) {
+					ref.grp = &t->groups[n];
+					ref.idx = slot_index(m);
+				}
+			}
+
+			ref.ptr().store(e, std::memory_order_relaxed);
+			set_tag(*ref.grp, ref.idx, tag_of(e->hash));
+		}
+	}
+
+	p.current.store(t, std::memory_order_release);
+	p.tombstones = 0;
+
+	for (auto &lock : locks)
+		lock.unlock();
+
+	p.reclaimer.retire(old, old->memory_size);
+}
+
+/*
+ * Replaces entry of the key with one returned by f(entry or nullptr, if
+ * the key doesn't exist), called with the key's stripe locked. If f returns
+ * nullptr, the key is removed; if it returns the old entry, nothing changes.
+ * Returns true if the key existed. f may be called again if the table fills
+ * up in the meantime.
+ */
+template <typename AllocatorFactory>
+template <typename F>
+bool basic_vhmap<AllocatorFactory>::modify(string_view key, F f)
+{
+	auto h = hash(key);
+	auto &p = get_partition(h);
+	auto &mtx = p.stripes[(h >> 16) % STRIPES].mtx;
+
+	while (true) {
+		if (overloaded(p))
+			resize(p, 0);
+
+		entry *old = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			internal::epoch_guard guard(p.reclaimer);
+
+			auto t = p.current.load(std::memory_order_acquire);
+			slot_ref ref;
+			bool found = lookup(t, key, h, ref);
+			if (!ref.grp)
+				continue;
+
+			old = found ? ref.ptr().load(std::memory_order_relaxed) : nullptr;
+			auto e = f(old);
+			if (e == old)
+				return found;
+
+			if (found) {
+				if (e) {
+					ref.ptr().store(e, std::memory_order_release);
+				} else {
+					/* tag is cleared first, the slot may be reused right after */
+					set_tag(*ref.grp, ref.idx, TOMBSTONE_TAG);
+					ref.ptr().store(tombstone(), std::memory_order_release);
+					p.count--;
+					p.tombstones++;
+				}
+			} else {
+				/* free slots are shared with other stripes */
+				auto expected = ref.ptr().load(std::memory_order_relaxed);
+				while (is_entry(expected) ||
+				       !ref.ptr().compare_exchange_strong(
+					       expected, e, std::memory_order_acq_rel,
+					       std::memory_order_relaxed)) {
+					lookup(t, key, h, ref);
+					if (!ref.grp)
+						break;
+					expected = ref.ptr().load(std::memory_order_relaxed);
+				}
+
+				if (!ref.grp) {
+					/* unpublished, so it can be freed right away */
+					p.allocator.deallocate(
+						reinterpret_cast<char *>(e),
+						entry_size(e->key_size, e->value_size));
+					continue;
+				}
+
+				set_tag(*ref.grp, ref.idx, tag_of(h));
+				p.count++;
+				if (expected == tombstone())
+					p.tombstones--;
+			}
+		}
+
+		if (old)
+			p.reclaimer.retire(old, entry_size(old->key_size, old->value_size));
+
+		return old != nullptr;
+	}
+}
+
+/* Calls f for every entry in groups [first, last), until it returns non-zero */
+template <typename AllocatorFactory>
+template <typename F>
+status basic_vhmap<AllocatorFactory>::scan(table *t, std::size_t first, std::size_t last,
+					   F f)
+{
+	for (auto g = first; g < last; ++g) {
+		for (auto &slot : t->groups[g].slots) {
+			auto e = slot.load(std::memory_order_acquire);
+			if (is_entry(e) && f(e) != 0)
+				return status::STOPPED_BY_CB;
+		}
+	}
+
+	return status::OK;
+}
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_BASIC_VHMAP_H */
@@ -151,6 +151,15 @@ status blackhole::remove(string_view key)
 	return status::OK;
 }
 
+status blackhole::remove_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("remove_between for key1=" << key1.data() << ", key2=" << key2.data());
+
+	cnt = 0;
+
+	return status::OK;
+}
+
 internal::iterator_base *blackhole::new_iterator()
 {
 	LOG("create write iterator");
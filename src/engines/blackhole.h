@@ -44,6 +44,7 @@ public:
 	status put(string_view key, string_view value) final;
 
 	status remove(string_view key) final;
+	status remove_between(string_view key1, string_view key2, std::size_t &cnt) final;
 
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
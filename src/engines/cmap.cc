@@ -3,6 +3,17 @@
 
 #include "cmap.h"
 #include "../out.h"
+#include "../parallel_scan.h"
+#include "../snapshot.h"
+#include "../trace.h"
+
+#include <libpmemobj++/make_persistent.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+#include <vector>
 
 #include <unistd.h>
 
@@ -11,14 +22,552 @@ namespace pmem
 namespace kv
 {
 
+namespace internal
+{
+namespace cmap
+{
+
+enum class tx_log_op : char { put = 'p', remove = 'r' };
+
+/* Appends string_view to the log, preceded by its size */
+static void append_tx_log(std::string &log, string_view s)
+{
+	uint64_t size = s.size();
+	log.append(reinterpret_cast<const char *>(&size), sizeof(size));
+	log.append(s.data(), s.size());
+}
+
+/* Writes string_view (preceded by its size) at 'dst', returns the end of it */
+static char *write_tx_log(char *dst, string_view s)
+{
+	uint64_t size = s.size();
+	std::memcpy(dst, &size, sizeof(size));
+	std::memcpy(dst + sizeof(size), s.data(), s.size());
+
+	return dst + sizeof(size) + s.size();
+}
+
+/* Reads string_view (preceded by its size) from position 'pos' of the log */
+static string_view read_tx_log(const char *log, size_t &pos)
+{
+	uint64_t size;
+	std::memcpy(&size, log + pos, sizeof(size));
+	pos += sizeof(size);
+
+	string_view s(log + pos, size);
+	pos += size;
+
+	return s;
+}
+
+static void apply_tx_ops(pmem_type *data, const char *log, size_t size)
+{
+	size_t pos = 0;
+	while (pos < size) {
+		auto op = static_cast<tx_log_op>(log[pos++]);
+		key_view key(read_tx_log(log, pos));
+
+		if (op == tx_log_op::put)
+			data->map.insert_or_assign(key, read_tx_log(log, pos));
+		else
+			data->map.erase(key);
+	}
+}
+
+/* Finds the last operation on the key in the log, returns false if there's none */
+static bool find_tx_op(const char *log, size_t size, string_view key, tx_log_op &op,
+		       string_view &value)
+{
+	bool found = false;
+	size_t pos = 0;
+	while (pos < size) {
+		auto o = static_cast<tx_log_op>(log[pos++]);
+		auto k = read_tx_log(log, pos);
+		string_view v;
+		if (o == tx_log_op::put)
+			v = read_tx_log(log, pos);
+
+		if (k.compare(key) == 0) {
+			found = true;
+			op = o;
+			value = v;
+		}
+	}
+
+	return found;
+}
+
+/* Frees the chunk and all chunks spilled before it, must be called in a transaction */
+static void free_tx_chunks(pmem::obj::persistent_ptr<tx_chunk> chunk)
+{
+	while (chunk) {
+		auto prev = chunk->prev;
+		pmem::obj::delete_persistent<tx_chunk>(chunk);
+		chunk = prev;
+	}
+}
+
+/*
+ * Applies operations from the redo log of a committed transaction (its
+ * spilled chunks, from the oldest one, and then tx_log) and frees the log.
+ * Operations are idempotent, so it can be restarted if interrupted.
+ */
+void apply_tx_log(pmem::obj::pool_base &pop, pmem_type *data)
+{
+	std::vector<const tx_chunk *> chunks;
+	size_t size = data->tx_log ? data->tx_log->size() : 0;
+	for (auto c = data->tx_staged; c; c = c->prev) {
+		chunks.push_back(c.get());
+		size += c->size;
+	}
+	PMEMKV_PROBE1(cmap__tx_log_apply, size);
+
+	for (auto c = chunks.rbegin(); c != chunks.rend(); ++c)
+		apply_tx_ops(data, (*c)->ops(), (*c)->size);
+	if (data->tx_log)
+		apply_tx_ops(data, data->tx_log->c_str(), data->tx_log->size());
+
+	pmem::obj::transaction::run(pop, [&] {
+		free_tx_chunks(data->tx_staged);
+		data->tx_staged = nullptr;
+		if (data->tx_log) {
+			pmem::obj::delete_persistent<string_t>(data->tx_log);
+			data->tx_log = nullptr;
+		}
+	});
+}
+
+/* Frees stages (and spilled chunks) of transactions which weren't committed */
+void free_tx_stages(pmem::obj::pool_base &pop, pmem_type *data)
+{
+	pmem::obj::transaction::run(pop, [&] {
+		while (data->tx_stages) {
+			auto stage = data->tx_stages;
+			free_tx_chunks(stage->chunks);
+			data->tx_stages = stage->next;
+			pmem::obj::delete_persistent<tx_stage>(stage);
+		}
+	});
+}
+
+constexpr uint64_t optimistic_index::WRITER;
+constexpr uint64_t optimistic_index::WRITERS_MASK;
+constexpr uint64_t optimistic_index::SEQ;
+
+optimistic_index::optimistic_index(std::size_t slots)
+{
+	std::size_t n = 1;
+	while (n < slots)
+		n *= 2;
+
+	this->slots.reset(new slot[n]);
+	mask = n - 1;
+}
+
+/*
+ * Sizes and pointers read from the element are used only after the word is
+ * checked, so they were read before the element could be changed or erased.
+ * Even so, only bytes of the element itself are read - a long value (or key)
+ * is read with the lock, as its allocation may be already freed.
+ */
+bool optimistic_index::read(const key_view &key, std::string &value) const
+{
+	auto &s = slot_of(key.hash);
+	auto v = s.word.load(std::memory_order_acquire);
+	if (v & WRITERS_MASK)
+		return false;
+
+	auto element = s.element.load(std::memory_order_acquire);
+	if (!element || element->first.hash() != key.hash)
+		return false;
+
+	auto value_size = element->second.size();
+	if (value_size > inline_string::INLINE_CAPACITY)
+		return false;
+
+	auto key_size = element->first.size();
+	auto key_data = element->first.c_str();
+	auto value_data = element->second.c_str();
+
+	auto begin = reinterpret_cast<const char *>(element);
+	auto end = begin + sizeof(*element);
+	auto inside = [&](const char *data, std::size_t size) {
+		return data >= begin && data <= end &&
+			size <= static_cast<std::size_t>(end - data);
+	};
+
+	auto changed = [&] {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return s.word.load(std::memory_order_relaxed) != v;
+	};
+	if (changed() || !inside(key_data, key_size) ||
+	    !inside(value_data, value_size) || key_size != key.str.size() ||
+	    std::memcmp(key_data, key.str.data(), key_size) != 0)
+		return false;
+
+	value.assign(value_data, value_size);
+
+	return !changed();
+}
+
+void optimistic_index::publish(const map_t::value_type &element)
+{
+	auto &s = slot_of(element.first.hash());
+	auto v = s.word.load(std::memory_order_relaxed);
+
+	/* a writer of the slot may be waiting for the lock of the element */
+	if ((v & WRITERS_MASK) ||
+	    !s.word.compare_exchange_strong(v, v + SEQ + WRITER,
+					    std::memory_order_acquire))
+		return;
+
+	s.element.store(&element, std::memory_order_relaxed);
+	s.word.fetch_sub(WRITER, std::memory_order_release);
+}
+
+void optimistic_index::begin_write(uint64_t hash)
+{
+	slot_of(hash).word.fetch_add(SEQ + WRITER, std::memory_order_acq_rel);
+}
+
+void optimistic_index::end_write(uint64_t hash)
+{
+	auto &s = slot_of(hash);
+	s.element.store(nullptr, std::memory_order_relaxed);
+	s.word.fetch_sub(WRITER, std::memory_order_release);
+}
+
+void optimistic_index::begin_write_all()
+{
+	for (std::size_t i = 0; i <= mask; ++i)
+		begin_write(i);
+}
+
+void optimistic_index::end_write_all()
+{
+	for (std::size_t i = 0; i <= mask; ++i)
+		end_write(i);
+}
+
+transaction::transaction(pmem::obj::pool_base &pop, pmem_type *data,
+			 std::mutex &commit_mtx, write_mutexes &write_mtxs,
+			 optimistic_index *index, std::size_t spill_bytes)
+    : pop(pop),
+      data(data),
+      commit_mtx(commit_mtx),
+      write_mtxs(write_mtxs),
+      index(index),
+      spill_bytes(spill_bytes)
+{
+}
+
+transaction::~transaction()
+{
+	if (!stage)
+		return;
+
+	try {
+		abort();
+	} catch (...) {
+		/* the stage is freed when the pool is opened */
+	}
+}
+
+status transaction::put(string_view key, string_view value)
+{
+	log.insert(key, value);
+	if (spill_bytes && log.bytes() >= spill_bytes)
+		spill();
+
+	return status::OK;
+}
+
+status transaction::remove(string_view key)
+{
+	log.remove(key);
+	if (spill_bytes && log.bytes() >= spill_bytes)
+		spill();
+
+	return status::OK;
+}
+
+/* Moves the log to a new chunk of the stage (created by the first spill) */
+void transaction::spill()
+{
+	uint64_t size = 0;
+	log.foreach (
+		[&](const dram_log::element_type &e) {
+			size += 1 + 2 * sizeof(uint64_t) + e.first.size() +
+				e.second.size();
+		},
+		[&](const dram_log::element_type &e) {
+			size += 1 + sizeof(uint64_t) + e.first.size();
+		});
+
+	/* a new stage is linked to the list of stages, which commits modify */
+	std::unique_lock<std::mutex> lock(commit_mtx, std::defer_lock);
+	if (!stage)
+		lock.lock();
+
+	auto s = stage;
+	pmem::obj::transaction::run(pop, [&] {
+		if (!s) {
+			s = pmem::obj::make_persistent<tx_stage>();
+			s->next = data->tx_stages;
+			data->tx_stages = s;
+		}
+
+		auto oid = pmemobj_tx_xalloc(sizeof(tx_chunk) + size, TX_CHUNK_TYPE_NUM,
+					     POBJ_XALLOC_NO_ABORT);
+		if (OID_IS_NULL(oid))
+			throw pmem::transaction_alloc_error(
+				"Failed to allocate transaction's chunk");
+
+		/* a new allocation, written without snapshots and flushed on commit */
+		auto chunk = new (pmemobj_direct(oid)) tx_chunk();
+		chunk->prev = s->chunks;
+		chunk->size = size;
+
+		auto dst = reinterpret_cast<char *>(chunk + 1);
+		log.foreach (
+			[&](const dram_log::element_type &e) {
+				*dst++ = static_cast<char>(tx_log_op::put);
+				dst = write_tx_log(dst, e.first);
+				dst = write_tx_log(dst, e.second);
+			},
+			[&](const dram_log::element_type &e) {
+				*dst++ = static_cast<char>(tx_log_op::remove);
+				dst = write_tx_log(dst, e.first);
+			});
+
+		s->chunks = pmem::obj::persistent_ptr<tx_chunk>(oid);
+	});
+
+	stage = s;
+	log.clear();
+}
+
+void transaction::unlink_stage()
+{
+	if (data->tx_stages == stage) {
+		data->tx_stages = stage->next;
+		return;
+	}
+
+	auto s = data->tx_stages;
+	while (s->next != stage)
+		s = s->next;
+	s->next = stage->next;
+}
+
+status transaction::get(string_view key, get_v_callback *callback, void *arg)
+{
+	return log.get(key, callback, arg, [&] {
+		/* the last spilled operation on the key, from the newest chunk */
+		pmem::obj::persistent_ptr<tx_chunk> chunk;
+		if (stage)
+			chunk = stage->chunks;
+		for (; chunk; chunk = chunk->prev) {
+			tx_log_op op;
+			string_view value;
+			if (!find_tx_op(chunk->ops(), chunk->size, key, op, value))
+				continue;
+
+			if (op == tx_log_op::remove)
+				return status::NOT_FOUND;
+
+			callback(value.data(), value.size(), arg);
+			return status::OK;
+		}
+
+		map_t::const_accessor result;
+		if (!data->map.find(result, key_view(key)))
+			return status::NOT_FOUND;
+
+		callback(result->second.c_str(), result->second.size(), arg);
+		return status::OK;
+	});
+}
+
+status transaction::commit()
+{
+	/* only the last operation on every key has to be applied */
+	std::unordered_map<std::string, const string_view *> last_ops;
+	log.foreach (
+		[&](const dram_log::element_type &e) {
+			last_ops[std::string(e.first.data(), e.first.size())] = &e.second;
+		},
+		[&](const dram_log::element_type &e) {
+			last_ops[std::string(e.first.data(), e.first.size())] = nullptr;
+		});
+
+	std::lock_guard<std::mutex> lock(commit_mtx);
+	PMEMKV_PROBE2(tx__commit_start, "cmap", last_ops.size());
+
+	/* write locks are taken in order of their indexes, before accessors */
+	std::vector<std::size_t> idxs;
+	if (stage) {
+		for (std::size_t i = 0; i < write_mtxs.size(); ++i)
+			idxs.push_back(i);
+	} else {
+		for (auto &op : last_ops) {
+			key_view key(string_view(op.first.data(), op.first.size()));
+			idxs.push_back(key.hash % write_mtxs.size());
+		}
+		std::sort(idxs.begin(), idxs.end());
+		idxs.erase(std::unique(idxs.begin(), idxs.end()), idxs.end());
+	}
+	std::vector<std::unique_lock<write_mutex>> write_locks;
+	for (auto i : idxs)
+		write_locks.emplace_back(write_mtxs[i]);
+
+	/*
+	 * lock-free readers skip the keys until their changes are applied
+	 * (all keys, if some of them were spilled)
+	 */
+	std::deque<optimistic_write> writes;
+	if (index && stage) {
+		writes.emplace_back(index);
+	} else if (index) {
+		for (auto &op : last_ops) {
+			key_view key(string_view(op.first.data(), op.first.size()));
+			writes.emplace_back(index, key.hash);
+		}
+	}
+
+	/* existing records are locked until their new values are committed */
+	std::deque<map_t::accessor> accessors;
+	std::vector<string_view> values;
+	std::string redo_log;
+	for (auto &op : last_ops) {
+		string_view key(op.first.data(), op.first.size());
+
+		if (op.second) {
+			string_view value(op.second->data(), op.second->size());
+
+			/* spilled operations are applied after the commit */
+			if (!stage) {
+				accessors.emplace_back();
+				if (data->map.find(accessors.back(), key_view(key))) {
+					values.push_back(value);
+					continue;
+				}
+				accessors.pop_back();
+			}
+
+			redo_log.push_back(static_cast<char>(tx_log_op::put));
+			append_tx_log(redo_log, key);
+			append_tx_log(redo_log, value);
+		} else {
+			redo_log.push_back(static_cast<char>(tx_log_op::remove));
+			append_tx_log(redo_log, key);
+		}
+	}
+
+	pmem::obj::transaction::run(pop, [&] {
+		for (size_t i = 0; i < values.size(); ++i)
+			accessors[i]->second = values[i];
+
+		if (!redo_log.empty())
+			data->tx_log = pmem::obj::make_persistent<string_t>(
+				string_view(redo_log.data(), redo_log.size()));
+
+		if (stage) {
+			unlink_stage();
+			data->tx_staged = stage->chunks;
+			pmem::obj::delete_persistent<tx_stage>(stage);
+		}
+	});
+	accessors.clear();
+	stage = nullptr;
+
+	if (data->tx_log || data->tx_staged)
+		apply_tx_log(pop, data);
+
+	log.clear();
+	PMEMKV_PROBE1(tx__commit_done, "cmap");
+
+	return status::OK;
+}
+
+void transaction::abort()
+{
+	log.clear();
+	if (!stage)
+		return;
+
+	std::lock_guard<std::mutex> lock(commit_mtx);
+	pmem::obj::transaction::run(pop, [&] {
+		unlink_stage();
+		free_tx_chunks(stage->chunks);
+		pmem::obj::delete_persistent<tx_stage>(stage);
+	});
+	stage = nullptr;
+}
+
+} /* namespace cmap */
+} /* namespace internal */
+
+/* percent of elements defragmented at once by the background defrag */
+static const double BACKGROUND_DEFRAG_SLICE = 1;
+
+/* minimal number of elements of put_batch inserted by a single thread */
+static const std::size_t BATCH_ELEMENTS_PER_THREAD = 1024;
+
 cmap::cmap(std::unique_ptr<internal::config> cfg) : pmemobj_engine_base(cfg, "pmemkv")
 {
 	static_assert(
 		sizeof(internal::cmap::string_t) == 40,
 		"Wrong size of cmap value and key. This probably means that std::string has size > 32");
+	static_assert(sizeof(internal::cmap::hashed_string) == 48,
+		      "Wrong size of cmap key (string with its hash)");
 
 	LOG("Started ok");
-	Recover();
+	PMEMKV_PROBE1(recovery__start, "cmap");
+	{
+		internal::open_phase phase("cmap.recover");
+		Recover();
+	}
+	PMEMKV_PROBE2(recovery__done, "cmap", container->size());
+
+	uint64_t expected_count = 0;
+	cfg->get_uint64("expected_count", &expected_count);
+	if (expected_count > container->bucket_count()) {
+		internal::open_phase phase("cmap.rehash");
+		PMEMKV_PROBE2(cmap__rehash, container->bucket_count(), expected_count);
+		container->rehash(static_cast<std::size_t>(expected_count));
+	}
+
+	uint64_t spill_bytes = 0;
+	cfg->get_uint64("tx_spill_bytes", &spill_bytes);
+	tx_spill_bytes = static_cast<std::size_t>(spill_bytes);
+
+	uint64_t threads = 1;
+	cfg->get_uint64("batch_threads", &threads);
+	batch_threads = std::max<std::size_t>(1, static_cast<std::size_t>(threads));
+
+	uint64_t warm_up = 0;
+	cfg->get_uint64("warm_up", &warm_up);
+	if (warm_up) {
+		internal::open_phase phase("cmap.warm_up");
+		WarmUp();
+	}
+
+	uint64_t optimistic_slots = 0;
+	cfg->get_uint64("optimistic_reads", &optimistic_slots);
+	if (optimistic_slots > 0)
+		optimistic.reset(new internal::cmap::optimistic_index(
+			static_cast<std::size_t>(optimistic_slots)));
+
+	uint64_t defrag_budget = 0;
+	cfg->get_uint64("background_defrag", &defrag_budget);
+	if (defrag_budget > 0) {
+		defrag_svc.reset(new internal::defrag_service(
+			[this](double start, double amount) {
+				return defrag(start, amount);
+			},
+			static_cast<double>(defrag_budget), BACKGROUND_DEFRAG_SLICE));
+	}
 }
 
 cmap::~cmap()
@@ -40,6 +589,34 @@ status cmap::count_all(std::size_t &cnt)
 	return status::OK;
 }
 
+status cmap::stats(internal::stats_sink &sink)
+{
+	LOG("stats");
+	check_outside_tx();
+
+	auto s = pmemobj_engine_base::stats(sink);
+	if (s != status::OK)
+		return s;
+
+	auto size = container->size();
+	auto buckets = container->bucket_count();
+
+	sink.add("count", size);
+	sink.add("cmap.bucket_count", buckets);
+	sink.add("cmap.load_factor_percent", buckets ? size * 100 / buckets : 0);
+
+	internal::lock_class_stats bucket_stats, write_stats;
+	bucket_stats.add(bucket_locks);
+	bucket_stats.report(sink, "cmap_bucket");
+	for (auto &m : write_mtxs)
+		write_stats.add(m);
+	write_stats.report(sink, "cmap_write");
+
+	report_memory(sink, size);
+
+	return status::OK;
+}
+
 status cmap::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
@@ -49,35 +626,300 @@ status cmap::get_all(get_kv_callback *callback, void *arg)
 	return internal::iterate_through_pairs(it, end, callback, arg);
 }
 
+/* long values are allocated out of the nodes, key-only scans don't touch them */
+status cmap::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_keys_all");
+	check_outside_tx();
+	auto it = container->begin();
+	auto end = container->end();
+	return internal::iterate_through_keys(it, end, callback, arg);
+}
+
+/*
+ * concurrent_hash_map does not expose ranges of its buckets, so the map is
+ * split into parts with (about) equal number of elements by a single walk
+ * through the list of its nodes. Keys and values (including the ones stored
+ * outside of the nodes) are then read and passed to the callbacks in parallel.
+ */
+status cmap::get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+			      void **args)
+{
+	LOG("get_all_parallel");
+	check_outside_tx();
+
+	auto size = container->size();
+	partitions = std::max<std::size_t>(1, std::min(partitions, size));
+
+	std::vector<internal::cmap::map_t::iterator> bounds;
+	bounds.reserve(partitions + 1);
+
+	auto it = container->begin();
+	std::size_t pos = 0;
+	for (std::size_t i = 0; i < partitions; ++i) {
+		bounds.push_back(it);
+
+		if (i + 1 == partitions)
+			break;
+
+		auto next = (i + 1) * size / partitions;
+		for (; pos < next && it != container->end(); ++pos)
+			++it;
+	}
+	bounds.push_back(container->end());
+
+	return internal::parallel_scan(
+		partitions, callback, args,
+		[&](std::size_t partition, get_kv_callback *cb, void *arg) {
+			return internal::iterate_through_pairs(
+				bounds[partition], bounds[partition + 1], cb, arg);
+		});
+}
+
 status cmap::exists(string_view key)
+{
+	return exists_hashed(key, key_hash(key));
+}
+
+status cmap::get(string_view key, get_v_callback *callback, void *arg)
+{
+	return get_hashed(key, key_hash(key), callback, arg);
+}
+
+uint64_t cmap::key_hash(string_view key)
+{
+	return internal::cmap::key_view(key).hash;
+}
+
+status cmap::exists_hashed(string_view key, uint64_t hash)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	return container->count(key) == 1 ? status::OK : status::NOT_FOUND;
+	return container->count(internal::cmap::key_view(key, hash)) == 1
+		? status::OK
+		: status::NOT_FOUND;
 }
 
-status cmap::get(string_view key, get_v_callback *callback, void *arg)
+status cmap::get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			void *arg)
 {
 	LOG("get key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+
+	if (optimistic) {
+		static thread_local std::string value;
+		if (optimistic->read(internal::cmap::key_view(key, hash), value)) {
+			callback(value.data(), value.size(), arg);
+			return status::OK;
+		}
+	}
+
 	internal::cmap::map_t::const_accessor result;
-	bool found = container->find(result, key);
+	bool found;
+	{
+		internal::lock_timer timer(bucket_locks);
+		found = container->find(result, internal::cmap::key_view(key, hash));
+	}
 	if (!found) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
 	}
 
+	if (optimistic)
+		optimistic->publish(*result);
+
 	callback(result->second.c_str(), result->second.size(), arg);
 	return status::OK;
 }
 
+status cmap::get_batch(const string_view *keys, std::size_t n, get_kv_callback *callback,
+		       void *arg)
+{
+	LOG("get_batch n=" << n);
+	check_outside_tx();
+
+	/*
+	 * concurrent_hash_map does not expose its buckets, so lookups cannot be
+	 * prefetched here, but we can at least reuse a single accessor and avoid
+	 * going through the C API (and its status handling) for every key.
+	 */
+	auto s = status::OK;
+	internal::cmap::map_t::const_accessor result;
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!container->find(result, internal::cmap::key_view(keys[i]))) {
+			LOG("  key not found");
+			s = status::NOT_FOUND;
+			continue;
+		}
+
+		auto ret = callback(keys[i].data(), keys[i].size(),
+				    result->second.c_str(), result->second.size(), arg);
+		result.release();
+
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return s;
+}
+
+status cmap::get_pinned(string_view key,
+			std::unique_ptr<internal::pinned_value_base> &pinned)
+{
+	LOG("get_pinned key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	std::unique_ptr<cmap_pinned_value> p(new cmap_pinned_value());
+	bool found;
+	{
+		internal::lock_timer timer(bucket_locks);
+		found = container->find(p->acc, internal::cmap::key_view(key));
+	}
+	if (!found) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	pinned = std::move(p);
+	return status::OK;
+}
+
 status cmap::put(string_view key, string_view value)
+{
+	return put_hashed(key, key_hash(key), value);
+}
+
+status cmap::put_hashed(string_view key, uint64_t hash, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
 
-	container->insert_or_assign(key, value);
+	internal::cmap::write_guard guard(write_mtxs, optimistic.get(), hash);
+	container->insert_or_assign(internal::cmap::key_view(key, hash), value);
+
+	return status::OK;
+}
+
+/*
+ * Big batches are inserted by (up to) batch_threads threads. Every thread
+ * inserts keys whose hash modulo number of threads is equal to its index,
+ * in order of the batch, so the last value of a repeated key is stored.
+ */
+status cmap::put_batch(const string_view *keys, const string_view *values,
+		       std::size_t n)
+{
+	LOG("put_batch n=" << n);
+	check_outside_tx();
+
+	auto threads = std::min(batch_threads, n / BATCH_ELEMENTS_PER_THREAD);
+	if (threads <= 1) {
+		for (std::size_t i = 0; i < n; ++i)
+			put(keys[i], values[i]);
+
+		return status::OK;
+	}
+
+	std::vector<uint64_t> hashes(n);
+	internal::parallel_run(threads, [&](std::size_t t) {
+		for (std::size_t i = t * n / threads; i < (t + 1) * n / threads; ++i)
+			hashes[i] = internal::cmap::key_view(keys[i]).hash;
+
+		return status::OK;
+	});
+
+	return internal::parallel_run(threads, [&](std::size_t t) {
+		for (std::size_t i = 0; i < n; ++i) {
+			if (hashes[i] % threads != t)
+				continue;
+
+			internal::cmap::write_guard guard(write_mtxs, optimistic.get(),
+							  hashes[i]);
+			container->insert_or_assign(
+				internal::cmap::key_view(keys[i], hashes[i]), values[i]);
+		}
+
+		return status::OK;
+	});
+}
+
+/*
+ * Calls the callback and assigns the new value holding the accessor (lock)
+ * of the record. Returns false if there is no record with such key.
+ */
+bool cmap::update_existing(const internal::cmap::key_view &key,
+			   update_callback *callback, void *arg, status &s)
+{
+	internal::cmap::map_t::accessor acc;
+	bool found;
+	{
+		internal::lock_timer timer(bucket_locks);
+		found = container->find(acc, key);
+	}
+	if (!found)
+		return false;
+
+	const char *new_value;
+	size_t new_valuebytes;
+	if (callback(acc->second.c_str(), acc->second.size(), &new_value,
+		     &new_valuebytes, arg) != 0) {
+		s = status::STOPPED_BY_CB;
+		return true;
+	}
+
+	acc->second = string_view(new_value, new_valuebytes);
+	s = status::OK;
+	return true;
+}
+
+status cmap::update(string_view key, update_callback *callback, void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	/*
+	 * concurrent_hash_map cannot insert a record under an accessor without
+	 * constructing a key, so a missing record is created by insert_or_assign,
+	 * under the write lock of the key, which makes it atomic with respect to
+	 * other updates (and puts).
+	 */
+	internal::cmap::key_view k(key);
+	internal::cmap::write_guard guard(write_mtxs, optimistic.get(), k.hash);
+
+	auto s = status::OK;
+	if (update_existing(k, callback, arg, s))
+		return s;
+
+	const char *new_value;
+	size_t new_valuebytes;
+	if (callback(nullptr, 0, &new_value, &new_valuebytes, arg) != 0)
+		return status::STOPPED_BY_CB;
+
+	container->insert_or_assign(k, string_view(new_value, new_valuebytes));
+
+	return status::OK;
+}
+
+/*
+ * insert() finds or creates the record in a single lookup, holding its lock,
+ * and never assigns an existing one. A new record is created with an empty
+ * value, so if it's interrupted, the key may be left with an empty value.
+ */
+status cmap::put_if_absent(string_view key, string_view value, bool &inserted)
+{
+	LOG("put_if_absent key=" << std::string(key.data(), key.size())
+				 << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+
+	internal::cmap::key_view k(key);
+	internal::cmap::write_guard guard(write_mtxs, optimistic.get(), k.hash);
+	internal::cmap::map_t::accessor acc;
+	{
+		internal::lock_timer timer(bucket_locks);
+		inserted = container->insert(acc, k);
+	}
+	if (inserted)
+		acc->second = value;
 
 	return status::OK;
 }
@@ -87,10 +929,69 @@ status cmap::remove(string_view key)
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	bool erased = container->erase(key);
+	internal::cmap::key_view k(key);
+	internal::cmap::write_guard guard(write_mtxs, optimistic.get(), k.hash);
+	bool erased = container->erase(k);
 	return erased ? status::OK : status::NOT_FOUND;
 }
 
+/*
+ * concurrent_hash_map cannot erase a record under its accessor, so the value
+ * is copied and the record erased while the write lock of the key is held -
+ * no put, update or commit of a transaction can change it in the meantime.
+ * Write iterators don't take write locks, so a take racing a commit of an
+ * iterator may erase the value it has just written.
+ */
+status cmap::take(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("take key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	internal::cmap::key_view k(key);
+	std::string value;
+	{
+		internal::cmap::write_guard guard(write_mtxs, optimistic.get(), k.hash);
+		{
+			internal::cmap::map_t::const_accessor acc;
+			bool found;
+			{
+				internal::lock_timer timer(bucket_locks);
+				found = container->find(acc, k);
+			}
+			if (!found)
+				return status::NOT_FOUND;
+
+			value.assign(acc->second.c_str(), acc->second.size());
+		}
+
+		if (!container->erase(k))
+			return status::NOT_FOUND;
+	}
+
+	callback(value.data(), value.size(), arg);
+
+	return status::OK;
+}
+
+/*
+ * Buckets for all records of the snapshot are allocated upfront (as for
+ * "expected_count"), so the map doesn't grow while they are put.
+ */
+status cmap::snapshot_load(const std::string &path)
+{
+	LOG("snapshot_load path=" << path);
+	check_outside_tx();
+
+	{
+		internal::snapshot_reader reader(path);
+		auto expected_count = container->size() + reader.records();
+		if (expected_count > container->bucket_count())
+			container->rehash(static_cast<std::size_t>(expected_count));
+	}
+
+	return engine_base::snapshot_load(path);
+}
+
 status cmap::defrag(double start_percent, double amount_percent)
 {
 	LOG("defrag: start_percent = " << start_percent
@@ -98,38 +999,179 @@ status cmap::defrag(double start_percent, double amount_percent)
 	check_outside_tx();
 
 	try {
+		/* elements are moved, lock-free readers must not follow them */
+		internal::cmap::optimistic_write write(optimistic.get());
 		container->defragment(start_percent, amount_percent);
 	} catch (std::range_error &e) {
-		out_err_stream("defrag") << e.what();
+		out_err("defrag", e.what());
 		return status::INVALID_ARGUMENT;
 	} catch (pmem::defrag_error &e) {
-		out_err_stream("defrag") << e.what();
+		out_err("defrag", e.what());
 		return status::DEFRAG_ERROR;
 	}
 
 	return status::OK;
 }
 
+internal::transaction *cmap::begin_tx()
+{
+	return new internal::cmap::transaction(pmpool, data, tx_mtx, write_mtxs,
+					       optimistic.get(), tx_spill_bytes);
+}
+
+/*
+ * Allocates and constructs pmem_type, must be called in a transaction.
+ * It's not allocated by make_persistent, to set a well-known type number.
+ */
+static PMEMoid make_pmem_type()
+{
+	auto oid = pmemobj_tx_xalloc(sizeof(internal::cmap::pmem_type),
+				     internal::cmap::PMEM_TYPE_NUM, POBJ_XALLOC_NO_ABORT);
+	if (OID_IS_NULL(oid))
+		throw pmem::transaction_alloc_error("Failed to allocate cmap data");
+
+	new (pmemobj_direct(oid)) internal::cmap::pmem_type();
+
+	return oid;
+}
+
+/*
+ * Keys and values which don't fit in nodes are allocated separately (keys as
+ * pmem::obj::string data, values by inline_string, with type number 0), the
+ * rest are nodes of the map (with inline keys, values and locks) and buckets.
+ */
+internal::memory_stats cmap::memory_types()
+{
+	internal::memory_stats mem("nodes");
+	mem.add_type(internal::cmap::PMEM_TYPE_NUM, "root",
+		     sizeof(internal::cmap::pmem_type));
+	mem.add_type(pmem::detail::type_num<char>(), "keys");
+	mem.add_type(0, "values");
+	mem.add_type(pmem::detail::type_num<internal::cmap::string_t>(), "tx_log",
+		     sizeof(internal::cmap::string_t));
+	mem.add_type(internal::cmap::TX_CHUNK_TYPE_NUM, "tx_chunks");
+	mem.add_type(pmem::detail::type_num<internal::cmap::tx_stage>(), "tx_stages",
+		     sizeof(internal::cmap::tx_stage));
+
+	return mem;
+}
+
 void cmap::Recover()
 {
 	if (!OID_IS_NULL(*root_oid)) {
-		container = (pmem::kv::internal::cmap::map_t *)pmemobj_direct(*root_oid);
+		if (pmemobj_type_num(*root_oid) != internal::cmap::PMEM_TYPE_NUM) {
+			/* pool created by an older version, which stored map_t
+			 * directly - keep it to be moved to the new map */
+			LOG("Upgrading cmap layout");
+			pmem::obj::transaction::run(pmpool, [&] {
+				pmem::obj::transaction::snapshot(root_oid);
+				auto legacy = *root_oid;
+				*root_oid = make_pmem_type();
+				static_cast<internal::cmap::pmem_type *>(
+					pmemobj_direct(*root_oid))
+					->legacy_map = legacy;
+			});
+		}
+
+		data = static_cast<internal::cmap::pmem_type *>(pmemobj_direct(*root_oid));
+		if (data->layout_version != internal::cmap::LAYOUT_VERSION)
+			throw internal::invalid_argument(
+				"Unsupported cmap layout version: " +
+				std::to_string(data->layout_version));
+
+		container = &data->map;
+		PMEMKV_PROBE2(recovery__phase, "cmap", "runtime_initialize");
+		internal::open_phase phase("cmap.runtime_initialize");
 		container->runtime_initialize();
+
+		if (data->legacy_map) {
+			PMEMKV_PROBE2(recovery__phase, "cmap", "migrate_legacy");
+			phase.next("cmap.migrate_legacy");
+			migrate_legacy(data);
+		}
+
+		if (data->tx_log || data->tx_staged) {
+			PMEMKV_PROBE2(recovery__phase, "cmap", "tx_log");
+			phase.next("cmap.tx_log");
+			internal::cmap::apply_tx_log(pmpool, data);
+		}
+
+		if (data->tx_stages) {
+			PMEMKV_PROBE2(recovery__phase, "cmap", "tx_stages");
+			phase.next("cmap.tx_stages");
+			internal::cmap::free_tx_stages(pmpool, data);
+		}
 	} else {
 		pmem::obj::transaction::run(pmpool, [&] {
 			pmem::obj::transaction::snapshot(root_oid);
-			*root_oid =
-				pmem::obj::make_persistent<internal::cmap::map_t>().raw();
-			container = (pmem::kv::internal::cmap::map_t *)pmemobj_direct(
-				*root_oid);
+			*root_oid = make_pmem_type();
+			data = static_cast<internal::cmap::pmem_type *>(
+				pmemobj_direct(*root_oid));
+			container = &data->map;
 			container->runtime_initialize();
 		});
 	}
 }
 
+/* Reads one byte of every page of the buffer */
+static char touch_pages(const char *data, size_t size)
+{
+	const size_t page_size = 4096;
+
+	char c = 0;
+	for (size_t off = 0; off < size; off += page_size)
+		c ^= data[off];
+
+	return c;
+}
+
+/*
+ * Reads all records (nodes, keys and values), so that pages of the pool are
+ * faulted in before the engine is used. It's not needed for correctness -
+ * runtime state of buckets (e.g. locks) is initialized lazily, on first use.
+ * Must be called before any other thread uses the engine.
+ */
+void cmap::WarmUp()
+{
+	LOG("Warming up " << container->size() << " elements");
+
+	volatile char sink = 0;
+	for (auto it = container->begin(); it != container->end(); ++it) {
+		sink = sink ^ touch_pages(it->first.c_str(), it->first.size() + 1) ^
+			touch_pages(it->second.c_str(), it->second.size() + 1);
+	}
+}
+
+/*
+ * Moves all elements of the map created by an older version (with the legacy
+ * hash function) to the current one and frees the legacy map. If interrupted,
+ * it's restarted on the next open - elements which were already moved are
+ * just overwritten with the same values.
+ */
+void cmap::migrate_legacy(internal::cmap::pmem_type *data)
+{
+	auto legacy = data->legacy_map.get();
+	legacy->runtime_initialize();
+
+	LOG("Rehashing " << legacy->size() << " elements of legacy cmap");
+
+	for (auto it = legacy->begin(); it != legacy->end(); ++it)
+		container->insert_or_assign(
+			internal::cmap::key_view(
+				string_view(it->first.c_str(), it->first.size())),
+			string_view(it->second.c_str(), it->second.size()));
+
+	pmem::obj::transaction::run(pmpool, [&] {
+		legacy->free_data();
+		pmem::obj::delete_persistent<internal::cmap::legacy_map_t>(
+			data->legacy_map);
+		data->legacy_map = nullptr;
+	});
+}
+
 internal::iterator_base *cmap::new_iterator()
 {
-	return new cmap_iterator<false>{container};
+	return new cmap_iterator<false>{container, direct_write_range, optimistic.get()};
 }
 
 internal::iterator_base *cmap::new_const_iterator()
@@ -142,8 +1184,9 @@ cmap::cmap_iterator<true>::cmap_iterator(container_type *c)
 {
 }
 
-cmap::cmap_iterator<false>::cmap_iterator(container_type *c)
-    : cmap::cmap_iterator<true>(c)
+cmap::cmap_iterator<false>::cmap_iterator(container_type *c, bool direct_write,
+					  internal::cmap::optimistic_index *index)
+    : cmap::cmap_iterator<true>(c), direct_write(direct_write), index(index), tx(pop)
 {
 }
 
@@ -151,10 +1194,74 @@ status cmap::cmap_iterator<true>::seek(string_view key)
 {
 	init_seek();
 
-	if (container->find(acc_, key))
-		return status::OK;
+	internal::cmap::key_view k(key);
+	if (!container->find(acc_, k))
+		return status::NOT_FOUND;
 
-	return status::NOT_FOUND;
+	/* element is locked, so it can't be removed before it_ is set */
+	it_ = container->equal_range(k).first;
+
+	return status::OK;
+}
+
+status cmap::cmap_iterator<true>::seek_to_first()
+{
+	init_seek();
+
+	it_ = container->begin();
+
+	return lock_current();
+}
+
+status cmap::cmap_iterator<true>::is_next()
+{
+	if (acc_.empty())
+		return status::NOT_FOUND;
+
+	auto tmp = it_;
+	if (++tmp == container->end())
+		return status::NOT_FOUND;
+
+	return status::OK;
+}
+
+status cmap::cmap_iterator<true>::next()
+{
+	init_seek();
+
+	if (acc_.empty())
+		return status::NOT_FOUND;
+
+	/* current element is still locked, so its node is valid */
+	++it_;
+
+	return lock_current();
+}
+
+/*
+ * Locks the element pointed by it_ (releasing the previous one). Returns
+ * NOT_FOUND if it_ is the end of the map or the element was removed
+ * in the meantime.
+ */
+status cmap::cmap_iterator<true>::lock_current()
+{
+	acc_.release();
+
+	if (it_ == container->end())
+		return status::NOT_FOUND;
+
+	internal::cmap::key_view k(string_view(it_->first.c_str(), it_->first.size()),
+				   it_->first.hash());
+	if (!container->find(acc_, k))
+		return status::NOT_FOUND;
+
+	return status::OK;
+}
+
+void cmap::cmap_iterator<true>::reset()
+{
+	init_seek();
+	acc_.release();
 }
 
 result<string_view> cmap::cmap_iterator<true>::key()
@@ -183,6 +1290,13 @@ result<pmem::obj::slice<char *>> cmap::cmap_iterator<false>::write_range(size_t
 	if (pos + n > acc_->second.size() || pos + n < pos)
 		n = acc_->second.size() - pos;
 
+	if (direct_write) {
+		if (index && !direct_write_pending)
+			direct_write_pending.reset(new internal::cmap::optimistic_write(
+				index, acc_->first.hash()));
+		return {tx.add(acc_->second.c_str() + pos, n)};
+	}
+
 	log.push_back({std::string(acc_->second.c_str() + pos, n), pos});
 	auto &val = log.back().first;
 
@@ -191,6 +1305,15 @@ result<pmem::obj::slice<char *>> cmap::cmap_iterator<false>::write_range(size_t
 
 status cmap::cmap_iterator<false>::commit()
 {
+	if (direct_write) {
+		tx.commit();
+		direct_write_pending.reset();
+		return status::OK;
+	}
+
+	/* acc_ is set if there is anything to commit */
+	uint64_t hash = (index && !log.empty()) ? acc_->first.hash() : 0;
+	internal::cmap::optimistic_write write(log.empty() ? nullptr : index, hash);
 	pmem::obj::transaction::run(pop, [&] {
 		for (auto &p : log) {
 			auto dest = acc_->second.range(p.second, p.first.size());
@@ -204,6 +1327,8 @@ status cmap::cmap_iterator<false>::commit()
 
 void cmap::cmap_iterator<false>::abort()
 {
+	tx.abort();
+	direct_write_pending.reset();
 	log.clear();
 }
 
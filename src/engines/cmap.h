@@ -4,13 +4,24 @@
 #ifndef LIBPMEMKV_CMAP_H
 #define LIBPMEMKV_CMAP_H
 
+#include "../defrag_service.h"
+#include "../fast_hash.h"
+#include "../inline_string.h"
 #include "../iterator.h"
+#include "../lock_stats.h"
 #include "../pmemobj_engine.h"
 #include "../polymorphic_string.h"
 
 #include <libpmemobj++/container/concurrent_hash_map.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
 
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+
 namespace pmem
 {
 namespace kv
@@ -20,6 +31,54 @@ namespace internal
 namespace cmap
 {
 
+/*
+ * Key used for lookups - the key with its hash, so that it's computed only
+ * once per operation.
+ */
+struct key_view {
+	explicit key_view(string_view str)
+	    : str(str), hash(fast_hash(str.size(), str.data()))
+	{
+	}
+
+	/* for keys whose hash is already known (e.g. read from the map) */
+	key_view(string_view str, uint64_t hash) : str(str), hash(hash)
+	{
+	}
+
+	string_view str;
+	uint64_t hash;
+};
+
+/*
+ * Key stored in the map, along with its full hash. It allows rehashing
+ * buckets (when the map grows) and skipping most of the mismatched elements
+ * during lookups without reading the key's data, which may be stored
+ * in a separate allocation.
+ */
+class hashed_string : public polymorphic_string {
+public:
+	hashed_string(const key_view &key) : polymorphic_string(key.str), hash_(key.hash)
+	{
+	}
+
+	hashed_string(string_view str) : hashed_string(key_view(str))
+	{
+	}
+
+	hashed_string(const hashed_string &s) : polymorphic_string(s), hash_(s.hash_)
+	{
+	}
+
+	uint64_t hash() const
+	{
+		return hash_;
+	}
+
+private:
+	pmem::obj::p<uint64_t> hash_;
+};
+
 class key_equal {
 public:
 	template <typename M, typename U>
@@ -27,9 +86,49 @@ public:
 	{
 		return lhs == rhs;
 	}
+
+	bool operator()(const hashed_string &lhs, const hashed_string &rhs) const
+	{
+		return lhs.hash() == rhs.hash() && lhs == rhs;
+	}
+
+	bool operator()(const hashed_string &lhs, const key_view &rhs) const
+	{
+		return lhs.hash() == rhs.hash && lhs == rhs.str;
+	}
+
+	bool operator()(const key_view &lhs, const hashed_string &rhs) const
+	{
+		return (*this)(rhs, lhs);
+	}
 };
 
+/* Hashes keys 8 bytes at a time (using fast_hash) */
 class string_hasher {
+public:
+	using transparent_key_equal = key_equal;
+
+	size_t operator()(const hashed_string &str) const
+	{
+		return str.hash();
+	}
+
+	size_t operator()(const key_view &key) const
+	{
+		return key.hash;
+	}
+
+	size_t operator()(string_view str) const
+	{
+		return fast_hash(str.size(), str.data());
+	}
+};
+
+/*
+ * Hash function used by pools created before LAYOUT_VERSION was introduced.
+ * Such pools are moved to the current hash function when opened.
+ */
+class legacy_string_hasher {
 	/* hash multiplier used by fibonacci hashing */
 	static const size_t hash_multiplier = 11400714819323198485ULL;
 
@@ -58,12 +157,241 @@ private:
 };
 
 using string_t = pmem::kv::polymorphic_string;
-using map_t = pmem::obj::concurrent_hash_map<string_t, string_t, string_hasher>;
+/* values up to inline_string::INLINE_CAPACITY bytes are stored in map's nodes */
+using value_t = internal::inline_string;
+using map_t = pmem::obj::concurrent_hash_map<hashed_string, value_t, string_hasher>;
+using legacy_map_t =
+	pmem::obj::concurrent_hash_map<string_t, string_t, legacy_string_hasher>;
+
+/*
+ * Version of the hash function (string_hasher) and of the layout of map's
+ * nodes, stored in pmem_type. Versions 1 (keys without hashes) and 2
+ * (values not inlined) were never released.
+ */
+static constexpr uint64_t LAYOUT_VERSION = 3;
+
+/*
+ * Type number of pmem_type allocation. Older versions allocated map_t
+ * directly (with a type number computed by libpmemobj-cpp), so it
+ * distinguishes the two layouts.
+ */
+static constexpr uint64_t PMEM_TYPE_NUM = 0x636d61705f763031ULL; /* "cmap_v01" */
+
+/* Type number of tx_chunk allocations */
+static constexpr uint64_t TX_CHUNK_TYPE_NUM = 0x636d61705f747863ULL; /* "cmap_txc" */
+
+/*
+ * Operations of a transaction spilled to the pool (see "tx_spill_bytes"),
+ * encoded as in the redo log. The chunk is followed by 'size' bytes of them.
+ */
+struct tx_chunk {
+	/* chunk of the same transaction spilled before this one */
+	pmem::obj::persistent_ptr<tx_chunk> prev;
+	pmem::obj::p<uint64_t> size;
+
+	const char *ops() const
+	{
+		return reinterpret_cast<const char *>(this + 1);
+	}
+};
+
+/* Chunks spilled by a transaction, which isn't committed yet */
+struct tx_stage {
+	pmem::obj::persistent_ptr<tx_stage> next;
+	/* the newest chunk */
+	pmem::obj::persistent_ptr<tx_chunk> chunks;
+};
+
+struct pmem_type {
+	pmem_type() : map()
+	{
+		layout_version = LAYOUT_VERSION;
+	}
+
+	map_t map;
+	pmem::obj::p<uint64_t> layout_version;
+	/* map of an older pool, which is being moved to 'map' */
+	pmem::obj::persistent_ptr<legacy_map_t> legacy_map;
+	/* redo log of a committed transaction, which is being applied */
+	pmem::obj::persistent_ptr<string_t> tx_log;
+	/* spilled operations of that transaction, applied before tx_log */
+	pmem::obj::persistent_ptr<tx_chunk> tx_staged;
+	/* stages of open transactions, freed when the pool is opened */
+	pmem::obj::persistent_ptr<tx_stage> tx_stages;
+};
+
+/*
+ * Index of elements for lookups without bucket locks ("optimistic_reads"
+ * config parameter). Every slot (selected by the hash of a key) points to
+ * the element last read with the lock and has a word with a sequence number,
+ * incremented by every writer of keys of the slot, and the number of such
+ * writers in progress. A reader copies the value and checks that the word
+ * didn't change, otherwise it falls back to the accessor (and publishes the
+ * element again). Writers clear the pointer when they finish, so a slot never
+ * points to an element changed (or erased) since it was published. An element
+ * may be erased while it's read, but its memory stays in the pool and such
+ * a read doesn't pass the check. Only keys and values stored inline in the
+ * element are read this way - pointers to other allocations, read from
+ * a freed element, could point anywhere.
+ */
+class optimistic_index {
+public:
+	explicit optimistic_index(std::size_t slots);
+
+	optimistic_index(const optimistic_index &) = delete;
+	optimistic_index &operator=(const optimistic_index &) = delete;
+
+	/* Copies the value of the key, returns false if it has to be read with the lock */
+	bool read(const key_view &key, std::string &value) const;
+	/* Points the slot of the element to it, the element must be locked */
+	void publish(const map_t::value_type &element);
+
+	void begin_write(uint64_t hash);
+	void end_write(uint64_t hash);
+	/* for writers which may change any element (e.g. defrag) */
+	void begin_write_all();
+	void end_write_all();
+
+private:
+	/* lower bits of the word count writers, upper bits are the sequence */
+	static constexpr uint64_t WRITER = 1;
+	static constexpr uint64_t WRITERS_MASK = (uint64_t(1) << 16) - 1;
+	static constexpr uint64_t SEQ = uint64_t(1) << 16;
+
+	struct slot {
+		std::atomic<uint64_t> word{0};
+		std::atomic<const map_t::value_type *> element{nullptr};
+	};
+
+	slot &slot_of(uint64_t hash) const
+	{
+		return slots[hash & mask];
+	}
+
+	std::unique_ptr<slot[]> slots;
+	std::size_t mask;
+};
+
+/*
+ * Marks a write of the key (or of all keys, if no hash is given) as in
+ * progress in a scope. Does nothing if the index is null (not enabled).
+ */
+class optimistic_write {
+public:
+	optimistic_write(optimistic_index *index, uint64_t hash) : index(index), hash(hash)
+	{
+		if (index)
+			index->begin_write(hash);
+	}
+
+	explicit optimistic_write(optimistic_index *index) : index(index), all(true)
+	{
+		if (index)
+			index->begin_write_all();
+	}
+
+	~optimistic_write()
+	{
+		if (index && all)
+			index->end_write_all();
+		else if (index)
+			index->end_write(hash);
+	}
+
+	optimistic_write(const optimistic_write &) = delete;
+	optimistic_write &operator=(const optimistic_write &) = delete;
+
+private:
+	optimistic_index *index;
+	uint64_t hash = 0;
+	bool all = false;
+};
+
+/*
+ * Locks of writers of records, selected by key's hash. concurrent_hash_map
+ * cannot erase a record under its accessor, so take() holds the lock of the
+ * key between reading and erasing the record. Every write of a value (but
+ * of write iterators, which commit under the accessor) takes it as well, so
+ * no value put in the meantime is erased.
+ */
+using write_mutex = instrumented_mutex<std::mutex>;
+using write_mutexes = std::array<write_mutex, 256>;
+
+/*
+ * Holds the write lock of the key and marks its write in the optimistic
+ * index in a scope. Writes of single keys are done under it.
+ */
+class write_guard {
+public:
+	write_guard(write_mutexes &mtxs, optimistic_index *index, uint64_t hash)
+	    : lock(mtxs[hash % mtxs.size()]), write(index, hash)
+	{
+	}
+
+	write_guard(const write_guard &) = delete;
+	write_guard &operator=(const write_guard &) = delete;
+
+private:
+	std::unique_lock<write_mutex> lock;
+	optimistic_write write;
+};
+
+/*
+ * Transaction of cmap. Operations are buffered in dram_log and only the
+ * last operation on every key is applied on commit. Values of existing keys
+ * are assigned in a single pmemobj transaction (with all of these records
+ * locked), which also stores the rest of operations (inserts of new keys and
+ * removes, which concurrent_hash_map can't do in a transaction) in a redo
+ * log. The redo log is then applied and freed - if that's interrupted, it's
+ * applied again when the pool is opened.
+ *
+ * If 'spill_bytes' is not 0, the log is moved to a new tx_chunk of the
+ * transaction's stage in the pool whenever it grows over that many bytes,
+ * so DRAM usage of large transactions is bounded. On commit the chunks are
+ * linked as a part of the redo log, without copying them again, and all
+ * of the remaining operations are written to the redo log (they have to be
+ * applied after the spilled ones).
+ *
+ * Commits (and changes of the list of stages) are serialized by
+ * 'commit_mtx'. A commit also holds write locks of all of its keys (all of
+ * them, if some operations were spilled) until its redo log is applied. Concurrent readers may see a part of new keys or removes
+ * of a transaction, before its commit returns.
+ */
+class transaction : public ::pmem::kv::internal::transaction {
+public:
+	transaction(pmem::obj::pool_base &pop, pmem_type *data, std::mutex &commit_mtx,
+		    write_mutexes &write_mtxs, optimistic_index *index,
+		    std::size_t spill_bytes);
+	~transaction();
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status commit() final;
+	void abort() final;
+
+private:
+	void spill();
+	/* removes the stage from the list of stages, must be called in a transaction */
+	void unlink_stage();
+
+	pmem::obj::pool_base &pop;
+	dram_log log;
+	pmem_type *data;
+	std::mutex &commit_mtx;
+	write_mutexes &write_mtxs;
+	optimistic_index *index;
+	std::size_t spill_bytes;
+	/* set after the first spill */
+	pmem::obj::persistent_ptr<tx_stage> stage;
+};
+
+void apply_tx_log(pmem::obj::pool_base &pop, pmem_type *data);
+void free_tx_stages(pmem::obj::pool_base &pop, pmem_type *data);
 
 } /* namespace cmap */
 } /* namespace internal */
 
-class cmap : public pmemobj_engine_base<internal::cmap::map_t> {
+class cmap : public pmemobj_engine_base<internal::cmap::pmem_type> {
 	template <bool IsConst>
 	class cmap_iterator;
 
@@ -80,23 +408,92 @@ public:
 	status count_all(std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
 
 	status exists(string_view key) final;
 
 	status get(string_view key, get_v_callback *callback, void *arg) final;
 
+	status get_batch(const string_view *keys, std::size_t n, get_kv_callback *callback,
+			 void *arg) final;
+
+	status get_pinned(string_view key,
+			  std::unique_ptr<internal::pinned_value_base> &pinned) final;
+
 	status put(string_view key, string_view value) final;
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
+
+	uint64_t key_hash(string_view key) final;
+	status exists_hashed(string_view key, uint64_t hash) final;
+	status get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			  void *arg) final;
+	status put_hashed(string_view key, uint64_t hash, string_view value) final;
+
+	status update(string_view key, update_callback *callback, void *arg) final;
+	status put_if_absent(string_view key, string_view value, bool &inserted) final;
 
 	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
 
 	status defrag(double start_percent, double amount_percent) final;
 
+	status snapshot_load(const std::string &path) final;
+
+	status stats(internal::stats_sink &sink) final;
+
+	internal::transaction *begin_tx() final;
+
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
 private:
+	internal::memory_stats memory_types() final;
 	void Recover();
+	void WarmUp();
+	void migrate_legacy(internal::cmap::pmem_type *data);
+	bool update_existing(const internal::cmap::key_view &key,
+			     update_callback *callback, void *arg, status &s);
+
+	internal::cmap::pmem_type *data;
 	internal::cmap::map_t *container;
+	/* serializes commits of transactions */
+	std::mutex tx_mtx;
+	/* size of transaction's log spilled to the pool ("tx_spill_bytes") */
+	std::size_t tx_spill_bytes = 0;
+	/* number of threads inserting elements of put_batch */
+	std::size_t batch_threads = 1;
+	/* serialize writes of values with take() (selected by key's hash) */
+	internal::cmap::write_mutexes write_mtxs;
+	/*
+	 * accessors (bucket locks) are acquired inside of the container's
+	 * find(), so the whole lookup is counted as waiting for the lock
+	 */
+	internal::lock_counters bucket_locks;
+	/* set only if lookups without locks are enabled ("optimistic_reads") */
+	std::unique_ptr<internal::cmap::optimistic_index> optimistic;
+	/*
+	 * set only if background defrag is enabled ("background_defrag" config
+	 * parameter); declared last, so it's stopped before anything else
+	 * is destroyed
+	 */
+	std::unique_ptr<internal::defrag_service> defrag_svc;
+};
+
+/*
+ * Holds const_accessor to the element, so the value can be read in place.
+ * Element is read-locked until the pinned value is destroyed.
+ */
+class cmap_pinned_value : public internal::pinned_value_base {
+public:
+	string_view value() const final
+	{
+		return string_view(acc->second.c_str(), acc->second.size());
+	}
+
+	internal::cmap::map_t::const_accessor acc;
 };
 
 template <>
@@ -107,15 +504,26 @@ public:
 	cmap_iterator(container_type *container);
 
 	status seek(string_view key) final;
+	status seek_to_first() final;
+
+	status is_next() final;
+	status next() final;
 
 	result<string_view> key() final;
 
 	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
 
+	void reset() final;
+
 protected:
 	container_type *container;
 	container_type::accessor acc_;
+	/* position in the map (in order of buckets), valid only if acc_ is set */
+	container_type::iterator it_;
 	pmem::obj::pool_base pop;
+
+private:
+	status lock_current();
 };
 
 template <>
@@ -123,7 +531,8 @@ class cmap::cmap_iterator<false> : public cmap::cmap_iterator<true> {
 	using container_type = internal::cmap::map_t;
 
 public:
-	cmap_iterator(container_type *container);
+	cmap_iterator(container_type *container, bool direct_write,
+		      internal::cmap::optimistic_index *index);
 
 	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
 
@@ -132,6 +541,12 @@ public:
 
 private:
 	std::vector<std::pair<std::string, size_t>> log;
+	/* used instead of the log in the direct mode, the record is locked by acc_ */
+	bool direct_write;
+	internal::cmap::optimistic_index *index;
+	/* the record is modified in place until commit or abort (direct mode) */
+	std::unique_ptr<internal::cmap::optimistic_write> direct_write_pending;
+	internal::direct_write_tx tx;
 };
 
 class cmap_factory : public engine_base::factory_base {
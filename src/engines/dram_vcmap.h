@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_DRAM_VCMAP_H
+#define LIBPMEMKV_DRAM_VCMAP_H
+
+#include "basic_vcmap.h"
+#include "hugepage_allocator_factory.h"
+
+namespace pmem
+{
+namespace kv
+{
+
+using dram_vcmap = basic_vcmap<internal::hugepage_allocator_factory>;
+
+class dram_vcmap_factory : public engine_base::factory_base {
+public:
+	virtual std::unique_ptr<engine_base> create(std::unique_ptr<internal::config> cfg)
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new dram_vcmap(std::move(cfg)));
+	};
+	virtual std::string get_name()
+	{
+		return "dram_vcmap";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_DRAM_VCMAP_H */
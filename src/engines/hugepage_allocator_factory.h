@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_HUGEPAGE_ALLOCATOR_FACTORY_H
+#define LIBPMEMKV_HUGEPAGE_ALLOCATOR_FACTORY_H
+
+#include "../config.h"
+#include "../exceptions.h"
+#include "../hugepage_pool.h"
+
+#include <memory>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Creates allocators of DRAM pools of huge pages, used by volatile engines */
+class hugepage_allocator_factory {
+public:
+	template <typename T>
+	using allocator_type = pool_allocator<T>;
+
+	static constexpr uint64_t DEFAULT_HUGEPAGE_SIZE = 2 << 20;
+
+	static std::size_t partitions_number(internal::config &cfg)
+	{
+		return 1;
+	}
+
+	/* Each partition gets its own pool, released when the engine is closed */
+	template <typename T>
+	static allocator_type<T> create(internal::config &cfg, std::size_t partition)
+	{
+		uint64_t hugepage_size = DEFAULT_HUGEPAGE_SIZE;
+		cfg.get_uint64("hugepage_size", &hugepage_size);
+		if (hugepage_size != 0 && hugepage_size != (2 << 20) &&
+		    hugepage_size != (1 << 30))
+			throw internal::invalid_argument(
+				"Config item \"hugepage_size\" must be 0, "
+				"2097152 (2MB) or 1073741824 (1GB)");
+
+		return allocator_type<T>(std::make_shared<hugepage_pool>(
+			static_cast<std::size_t>(hugepage_size)));
+	}
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_HUGEPAGE_ALLOCATOR_FACTORY_H */
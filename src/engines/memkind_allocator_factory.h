@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2017-2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_MEMKIND_ALLOCATOR_FACTORY_H
+#define LIBPMEMKV_MEMKIND_ALLOCATOR_FACTORY_H
+
+#include "../config.h"
+#include "../exceptions.h"
+#include "../thread_cache_allocator.h"
+
+#include "pmem_allocator.h"
+#include <string>
+#include <vector>
+
+#ifdef USE_LIBMEMKIND_NAMESPACE
+namespace memkind_ns = libmemkind::pmem;
+#else
+namespace memkind_ns = pmem;
+#endif
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Creates allocators of memkind kinds, used by volatile engines */
+class memkind_allocator_factory {
+public:
+	template <typename T>
+	using allocator_type = thread_cache_allocator<T, memkind_ns::allocator<char>>;
+
+	/* One partition per path (e.g. per NUMA node) given in "numa_paths" */
+	static std::size_t partitions_number(internal::config &cfg)
+	{
+		return get_paths(cfg).size();
+	}
+
+	template <typename T>
+	static allocator_type<T> create(internal::config &cfg, std::size_t partition)
+	{
+		uint64_t thread_caches = 0;
+		cfg.get_uint64("thread_caches", &thread_caches);
+
+		return allocator_type<T>(memkind_ns::allocator<char>(
+						 get_paths(cfg)[partition], cfg.get_size()),
+					 static_cast<std::size_t>(thread_caches));
+	}
+
+private:
+	/* Returns comma-separated paths from "numa_paths" or just "path" */
+	static std::vector<std::string> get_paths(internal::config &cfg)
+	{
+		const char *numa_paths;
+		if (!cfg.get_string("numa_paths", &numa_paths))
+			return {cfg.get_path()};
+
+		std::vector<std::string> paths;
+		std::string list(numa_paths);
+		std::size_t begin = 0, end;
+		do {
+			end = list.find(',', begin);
+			/* for the last path, count is clamped to the end of string */
+			auto path = list.substr(begin, end - begin);
+			if (path.empty())
+				throw internal::invalid_argument(
+					"Config item \"numa_paths\" contains an empty path");
+
+			paths.push_back(path);
+			begin = end + 1;
+		} while (end != std::string::npos);
+
+		return paths;
+	}
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_MEMKIND_ALLOCATOR_FACTORY_H */
@@ -5,33 +5,12 @@
 #define LIBPMEMKV_VCMAP_H
 
 #include "basic_vcmap.h"
-#include "pmem_allocator.h"
-
-#ifdef USE_LIBMEMKIND_NAMESPACE
-namespace memkind_ns = libmemkind::pmem;
-#else
-namespace memkind_ns = pmem;
-#endif
+#include "memkind_allocator_factory.h"
 
 namespace pmem
 {
 namespace kv
 {
-namespace internal
-{
-
-class memkind_allocator_factory {
-public:
-	template <typename T>
-	using allocator_type = memkind_ns::allocator<T>;
-
-	template <typename T>
-	static allocator_type<T> create(internal::config &cfg)
-	{
-		return allocator_type<T>(cfg.get_path(), cfg.get_size());
-	}
-};
-}
 
 using vcmap = basic_vcmap<internal::memkind_allocator_factory>;
 
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "vhmap.h"
+
+namespace pmem
+{
+namespace kv
+{
+
+template <>
+std::string vhmap::name()
+{
+	return "vhmap";
+}
+
+template <>
+std::string dram_vhmap::name()
+{
+	return "dram_vhmap";
+}
+
+static factory_registerer
+	register_vhmap(std::unique_ptr<engine_base::factory_base>(new vhmap_factory));
+static factory_registerer register_dram_vhmap(
+	std::unique_ptr<engine_base::factory_base>(new dram_vhmap_factory));
+
+} // namespace kv
+} // namespace pmem
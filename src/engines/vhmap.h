@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_VHMAP_H
+#define LIBPMEMKV_VHMAP_H
+
+#include "basic_vhmap.h"
+#include "hugepage_allocator_factory.h"
+#include "memkind_allocator_factory.h"
+
+namespace pmem
+{
+namespace kv
+{
+
+using vhmap = basic_vhmap<internal::memkind_allocator_factory>;
+using dram_vhmap = basic_vhmap<internal::hugepage_allocator_factory>;
+
+class vhmap_factory : public engine_base::factory_base {
+public:
+	virtual std::unique_ptr<engine_base> create(std::unique_ptr<internal::config> cfg)
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new vhmap(std::move(cfg)));
+	};
+	virtual std::string get_name()
+	{
+		return "vhmap";
+	};
+};
+
+class dram_vhmap_factory : public engine_base::factory_base {
+public:
+	virtual std::unique_ptr<engine_base> create(std::unique_ptr<internal::config> cfg)
+	{
+		check_config_null(get_name(), cfg);
+		return std::unique_ptr<engine_base>(new dram_vhmap(std::move(cfg)));
+	};
+	virtual std::string get_name()
+	{
+		return "dram_vhmap";
+	};
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_VHMAP_H */
@@ -6,91 +6,122 @@
 #include "../comparator/comparator.h"
 #include "../comparator/volatile_comparator.h"
 #include "../out.h"
+#include "../snapshot.h"
 
 #include <libpmemobj++/transaction.hpp>
 
 #include <cassert>
+#include <mutex>
+#include <thread>
 
 namespace pmem
 {
 namespace kv
 {
 
-vsmap::vsmap(std::unique_ptr<internal::config> cfg)
-    : kv_allocator(cfg->get_path(), cfg->get_size()),
+template <typename MapTraits>
+basic_vsmap<MapTraits>::basic_vsmap(std::unique_ptr<internal::config> cfg)
+    : kv_allocator(make_allocator(*cfg)),
       pmem_kv_container(internal::volatile_compare(internal::extract_comparator(*cfg)),
 			kv_allocator),
+      mtx(std::thread::hardware_concurrency()),
       config(std::move(cfg))
 {
 	LOG("Started ok");
 }
 
-vsmap::~vsmap()
+template <typename MapTraits>
+basic_vsmap<MapTraits>::~basic_vsmap()
 {
 	LOG("Stopped ok");
 }
 
-std::string vsmap::name()
+template <typename MapTraits>
+typename basic_vsmap<MapTraits>::map_allocator_type
+basic_vsmap<MapTraits>::make_allocator(internal::config &cfg)
+{
+	uint64_t thread_caches = 0;
+	cfg.get_uint64("thread_caches", &thread_caches);
+
+	return map_allocator_type(
+		memkind_ns::allocator<char>(cfg.get_path(), cfg.get_size()),
+		static_cast<std::size_t>(thread_caches));
+}
+
+template <typename MapTraits>
+std::string basic_vsmap<MapTraits>::name()
 {
 	return "vsmap";
 }
 
-status vsmap::count_all(std::size_t &cnt)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::count_all(std::size_t &cnt)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	cnt = pmem_kv_container.size();
 	return status::OK;
 }
 
-status vsmap::count_above(string_view key, std::size_t &cnt)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::count_above(string_view key, std::size_t &cnt)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("count_above for key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
 	auto it = pmem_kv_container.upper_bound(
 		key_type(key.data(), key.size(), kv_allocator));
 	auto end = pmem_kv_container.end();
 
-	cnt = internal::distance(it, end);
+	cnt = MapTraits::distance(pmem_kv_container, it, end);
 	return status::OK;
 }
 
-status vsmap::count_equal_above(string_view key, std::size_t &cnt)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::count_equal_above(string_view key, std::size_t &cnt)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
 	auto it = pmem_kv_container.lower_bound(
 		key_type(key.data(), key.size(), kv_allocator));
 	auto end = pmem_kv_container.end();
 
-	cnt = internal::distance(it, end);
+	cnt = MapTraits::distance(pmem_kv_container, it, end);
 	return status::OK;
 }
 
-status vsmap::count_equal_below(string_view key, std::size_t &cnt)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::count_equal_below(string_view key, std::size_t &cnt)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
 	auto it = pmem_kv_container.begin();
 	// XXX - do not create temporary string
 	auto end = pmem_kv_container.upper_bound(
 		key_type(key.data(), key.size(), kv_allocator));
 
-	cnt = internal::distance(it, end);
+	cnt = MapTraits::distance(pmem_kv_container, it, end);
 	return status::OK;
 }
 
-status vsmap::count_below(string_view key, std::size_t &cnt)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::count_below(string_view key, std::size_t &cnt)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("count_below for key=" << std::string(key.data(), key.size()));
 	auto it = pmem_kv_container.begin();
 	// XXX - do not create temporary string
 	auto end = pmem_kv_container.lower_bound(
 		key_type(key.data(), key.size(), kv_allocator));
 
-	cnt = internal::distance(it, end);
+	cnt = MapTraits::distance(pmem_kv_container, it, end);
 	return status::OK;
 }
 
-status vsmap::count_between(string_view key1, string_view key2, std::size_t &cnt)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::count_between(string_view key1, string_view key2, std::size_t &cnt)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("count_between for key1=" << key1.data() << ", key2=" << key2.data());
 	std::size_t result = 0;
 	if (pmem_kv_container.key_comp()(key1, key2)) {
@@ -99,22 +130,26 @@ status vsmap::count_between(string_view key1, string_view key2, std::size_t &cnt
 			key_type(key1.data(), key1.size(), kv_allocator));
 		auto end = pmem_kv_container.lower_bound(
 			key_type(key2.data(), key2.size(), kv_allocator));
-		result = internal::distance(it, end);
+		result = MapTraits::distance(pmem_kv_container, it, end);
 	}
 
 	cnt = result;
 	return status::OK;
 }
 
-status vsmap::get_all(get_kv_callback *callback, void *arg)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_all(get_kv_callback *callback, void *arg)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("get_all");
 	return internal::iterate_through_pairs(pmem_kv_container.begin(),
 					       pmem_kv_container.end(), callback, arg);
 }
 
-status vsmap::get_above(string_view key, get_kv_callback *callback, void *arg)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_above(string_view key, get_kv_callback *callback, void *arg)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("get_above for key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
 	auto it = pmem_kv_container.upper_bound(
@@ -123,8 +158,10 @@ status vsmap::get_above(string_view key, get_kv_callback *callback, void *arg)
 	return internal::iterate_through_pairs(it, end, callback, arg);
 }
 
-status vsmap::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
 	auto it = pmem_kv_container.lower_bound(
@@ -133,8 +170,10 @@ status vsmap::get_equal_above(string_view key, get_kv_callback *callback, void *
 	return internal::iterate_through_pairs(it, end, callback, arg);
 }
 
-status vsmap::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
 	auto it = pmem_kv_container.begin();
 	// XXX - do not create temporary string
@@ -143,8 +182,10 @@ status vsmap::get_equal_below(string_view key, get_kv_callback *callback, void *
 	return internal::iterate_through_pairs(it, end, callback, arg);
 }
 
-status vsmap::get_below(string_view key, get_kv_callback *callback, void *arg)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_below(string_view key, get_kv_callback *callback, void *arg)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("get_below for key=" << std::string(key.data(), key.size()));
 	auto it = pmem_kv_container.begin();
 	// XXX - do not create temporary string
@@ -153,9 +194,11 @@ status vsmap::get_below(string_view key, get_kv_callback *callback, void *arg)
 	return internal::iterate_through_pairs(it, end, callback, arg);
 }
 
-status vsmap::get_between(string_view key1, string_view key2, get_kv_callback *callback,
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			  void *arg)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("get_between for key1=" << key1.data() << ", key2=" << key2.data());
 	if (pmem_kv_container.key_comp()(key1, key2)) {
 		// XXX - do not create temporary string
@@ -169,8 +212,111 @@ status vsmap::get_between(string_view key1, string_view key2, get_kv_callback *c
 	return status::OK;
 }
 
-status vsmap::exists(string_view key)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	LOG("get_keys_all");
+	return internal::iterate_through_keys(pmem_kv_container.begin(),
+					      pmem_kv_container.end(), callback, arg);
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_keys_between(string_view key1, string_view key2,
+						get_kv_callback *callback, void *arg)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	LOG("get_keys_between for key1=" << std::string(key1.data(), key1.size())
+					 << ", key2="
+					 << std::string(key2.data(), key2.size()));
+	if (pmem_kv_container.key_comp()(key1, key2)) {
+		// XXX - do not create temporary string
+		auto it = pmem_kv_container.upper_bound(
+			key_type(key1.data(), key1.size(), kv_allocator));
+		auto end = pmem_kv_container.lower_bound(
+			key_type(key2.data(), key2.size(), kv_allocator));
+		return internal::iterate_through_keys(it, end, callback, arg);
+	}
+
+	return status::OK;
+}
+
+/*
+ * Iterates over at most 'limit' elements of range [first, last), skipping
+ * 'offset' first ones. With b_tree, both ends are found from sizes of
+ * subtrees, so skipped elements are not visited.
+ */
+template <typename MapTraits>
+template <typename It>
+status basic_vsmap<MapTraits>::iterate_paged(It first, It last, std::size_t offset,
+					     std::size_t limit, get_kv_callback *callback,
+					     void *arg)
+{
+	first = MapTraits::advance(pmem_kv_container, first, last, offset);
+	last = MapTraits::advance(pmem_kv_container, first, last, limit);
+
+	return internal::iterate_through_pairs(first, last, callback, arg);
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_above_paged(string_view key, std::size_t offset,
+					       std::size_t limit,
+					       get_kv_callback *callback, void *arg)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	LOG("get_above_paged for key=" << std::string(key.data(), key.size())
+				       << ", offset=" << offset << ", limit=" << limit);
+	// XXX - do not create temporary string
+	auto it = pmem_kv_container.upper_bound(
+		key_type(key.data(), key.size(), kv_allocator));
+	return iterate_paged(it, pmem_kv_container.end(), offset, limit, callback, arg);
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_between_paged(string_view key1, string_view key2,
+						 std::size_t offset, std::size_t limit,
+						 get_kv_callback *callback, void *arg)
+{
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	LOG("get_between_paged for key1=" << std::string(key1.data(), key1.size())
+					  << ", key2=" << std::string(key2.data(), key2.size())
+					  << ", offset=" << offset << ", limit=" << limit);
+	if (!pmem_kv_container.key_comp()(key1, key2))
+		return status::OK;
+
+	// XXX - do not create temporary string
+	auto it = pmem_kv_container.upper_bound(
+		key_type(key1.data(), key1.size(), kv_allocator));
+	auto end = pmem_kv_container.lower_bound(
+		key_type(key2.data(), key2.size(), kv_allocator));
+	return iterate_paged(it, end, offset, limit, callback, arg);
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get_prefix(string_view prefix, get_kv_callback *callback,
+					  void *arg)
+{
+	if (!pmem_kv_container.key_comp().is_binary())
+		return engine_base::get_prefix(prefix, callback, arg);
+
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+
+	std::string upper;
+	// XXX - do not create temporary string
+	auto it = pmem_kv_container.lower_bound(
+		key_type(prefix.data(), prefix.size(), kv_allocator));
+	auto end = internal::prefix_upper_bound(prefix, upper)
+		? pmem_kv_container.lower_bound(
+			  key_type(upper.data(), upper.size(), kv_allocator))
+		: pmem_kv_container.end();
+	return internal::iterate_through_pairs(it, end, callback, arg);
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::exists(string_view key)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
 	bool r = pmem_kv_container.find(key_type(key.data(), key.size(), kv_allocator)) !=
@@ -178,8 +324,10 @@ status vsmap::exists(string_view key)
 	return (r ? status::OK : status::NOT_FOUND);
 }
 
-status vsmap::get(string_view key, get_v_callback *callback, void *arg)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::get(string_view key, get_v_callback *callback, void *arg)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
 	LOG("get key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
 	const auto pos =
@@ -193,24 +341,51 @@ status vsmap::get(string_view key, get_v_callback *callback, void *arg)
 	return status::OK;
 }
 
-status vsmap::put(string_view key, string_view value)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::put(string_view key, string_view value)
 {
+	std::unique_lock<mutex_type> lock(mtx);
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
+	put_locked(key, value);
+	return status::OK;
+}
+
+template <typename MapTraits>
+void basic_vsmap<MapTraits>::put_locked(string_view key, string_view value)
+{
 	// XXX - starting from C++17 std::map has try_emplace method which could be more
 	// efficient
 	auto res = pmem_kv_container.emplace(
-		std::piecewise_construct, std::forward_as_tuple(key.data(), key.size()),
-		std::forward_as_tuple(value.data(), value.size()));
+		key_type(key.data(), key.size(), kv_allocator),
+		mapped_type(value.data(), value.size(), kv_allocator));
 	if (!res.second) {
 		auto it = res.first;
 		it->second.assign(value.data(), value.size());
 	}
+}
+
+/* emplace() doesn't overwrite an existing element, so the map is searched once */
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::put_if_absent(string_view key, string_view value,
+					     bool &inserted)
+{
+	std::unique_lock<mutex_type> lock(mtx);
+	LOG("put_if_absent key=" << std::string(key.data(), key.size())
+				 << ", value.size=" << std::to_string(value.size()));
+
+	auto res = pmem_kv_container.emplace(
+		key_type(key.data(), key.size(), kv_allocator),
+		mapped_type(value.data(), value.size(), kv_allocator));
+	inserted = res.second;
+
 	return status::OK;
 }
 
-status vsmap::remove(string_view key)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::remove(string_view key)
 {
+	std::unique_lock<mutex_type> lock(mtx);
 	LOG("remove key=" << std::string(key.data(), key.size()));
 
 	// XXX - do not create temporary string
@@ -219,45 +394,140 @@ status vsmap::remove(string_view key)
 	return (erased ? status::OK : status::NOT_FOUND);
 }
 
-internal::iterator_base *vsmap::new_iterator()
+/* the value is read and the record erased under the same exclusive lock */
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::take(string_view key, get_v_callback *callback, void *arg)
 {
-	return new vsmap_iterator<false>{&pmem_kv_container, &kv_allocator};
+	std::unique_lock<mutex_type> lock(mtx);
+	LOG("take key=" << std::string(key.data(), key.size()));
+
+	key_type k(key.data(), key.size(), kv_allocator);
+	auto pos = pmem_kv_container.find(k);
+	if (pos == pmem_kv_container.end()) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	callback(pos->second.c_str(), pos->second.size(), arg);
+	pmem_kv_container.erase(k);
+
+	return status::OK;
 }
 
-internal::iterator_base *vsmap::new_const_iterator()
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::remove_between(string_view key1, string_view key2,
+					      std::size_t &cnt)
 {
-	return new vsmap_iterator<true>{&pmem_kv_container, &kv_allocator};
+	std::unique_lock<mutex_type> lock(mtx);
+	LOG("remove_between for key1=" << key1.data() << ", key2=" << key2.data());
+
+	cnt = 0;
+	if (pmem_kv_container.key_comp()(key1, key2)) {
+		// XXX - do not create temporary string
+		cnt = MapTraits::erase_between(
+			pmem_kv_container,
+			key_type(key1.data(), key1.size(), kv_allocator),
+			key_type(key2.data(), key2.size(), kv_allocator));
+	}
+
+	return status::OK;
 }
 
-vsmap::vsmap_iterator<true>::vsmap_iterator(container_type *c,
-					    vsmap::map_allocator_type *alloc)
-    : container(c), kv_allocator(alloc)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::snapshot_save(const std::string &path)
 {
+	internal::shared_lock_guard<mutex_type> lock(mtx);
+	LOG("snapshot_save path=" << path);
+
+	internal::snapshot_writer writer(path, internal::snapshot::FLAG_SORTED);
+	for (const auto &e : pmem_kv_container)
+		writer.write(string_view(e.first.data(), e.first.size()),
+			     string_view(e.second.data(), e.second.size()));
+	writer.commit();
+
+	return status::OK;
 }
 
-vsmap::vsmap_iterator<false>::vsmap_iterator(container_type *c,
-					     vsmap::map_allocator_type *alloc)
-    : vsmap::vsmap_iterator<true>(c, alloc)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::snapshot_load(const std::string &path)
+{
+	internal::snapshot_reader reader(path);
+
+	std::unique_lock<mutex_type> lock(mtx);
+	LOG("snapshot_load path=" << path);
+
+	/* sorted records are appended to the (empty) map, without lookups */
+	if ((reader.flags() & internal::snapshot::FLAG_SORTED) &&
+	    pmem_kv_container.empty()) {
+		reader.read([&](string_view key, string_view value) {
+			pmem_kv_container.emplace_hint(
+				pmem_kv_container.end(),
+				key_type(key.data(), key.size(), kv_allocator),
+				mapped_type(value.data(), value.size(), kv_allocator));
+		});
+
+		return status::OK;
+	}
+
+	reader.read([&](string_view key, string_view value) { put_locked(key, value); });
+
+	return status::OK;
+}
+
+template <typename MapTraits>
+internal::transaction *basic_vsmap<MapTraits>::begin_tx()
+{
+	return new vsmap_transaction{this};
+}
+
+template <typename MapTraits>
+internal::iterator_base *basic_vsmap<MapTraits>::new_iterator()
+{
+	return new vsmap_iterator{&pmem_kv_container, &kv_allocator, &mtx};
+}
+
+template <typename MapTraits>
+internal::iterator_base *basic_vsmap<MapTraits>::new_const_iterator()
+{
+	return new vsmap_const_iterator{&pmem_kv_container, &kv_allocator, &mtx};
+}
+
+template <typename MapTraits>
+basic_vsmap<MapTraits>::vsmap_const_iterator::vsmap_const_iterator(
+	container_type *c, map_allocator_type *alloc, mutex_type *mtx)
+    : container(c), kv_allocator(alloc), mtx(mtx)
+{
+}
+
+template <typename MapTraits>
+basic_vsmap<MapTraits>::vsmap_iterator::vsmap_iterator(container_type *c,
+						       map_allocator_type *alloc,
+						       mutex_type *mtx)
+    : vsmap_const_iterator(c, alloc, mtx)
 {
 }
 
-status vsmap::vsmap_iterator<true>::seek(string_view key)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::seek(string_view key)
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
-	it_ = container->find(vsmap::key_type(key.data(), key.size(), *kv_allocator));
+	it_ = container->find(key_type(key.data(), key.size(), *kv_allocator));
 	if (it_ != container->end())
 		return status::OK;
 
 	return status::NOT_FOUND;
 }
 
-status vsmap::vsmap_iterator<true>::seek_lower(string_view key)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::seek_lower(string_view key)
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
 	it_ = container->lower_bound(
-		vsmap::key_type(key.data(), key.size(), *kv_allocator));
+		key_type(key.data(), key.size(), *kv_allocator));
 	if (it_ == container->begin()) {
 		it_ = container->end();
 		return status::NOT_FOUND;
@@ -268,12 +538,14 @@ status vsmap::vsmap_iterator<true>::seek_lower(string_view key)
 	return status::OK;
 }
 
-status vsmap::vsmap_iterator<true>::seek_lower_eq(string_view key)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::seek_lower_eq(string_view key)
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
 	it_ = container->upper_bound(
-		vsmap::key_type(key.data(), key.size(), *kv_allocator));
+		key_type(key.data(), key.size(), *kv_allocator));
 	if (it_ == container->begin()) {
 		it_ = container->end();
 		return status::NOT_FOUND;
@@ -284,32 +556,34 @@ status vsmap::vsmap_iterator<true>::seek_lower_eq(string_view key)
 	return status::OK;
 }
 
-status vsmap::vsmap_iterator<true>::seek_higher(string_view key)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::seek_higher(string_view key)
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
 	it_ = container->upper_bound(
-		vsmap::key_type(key.data(), key.size(), *kv_allocator));
-	if (it_ == container->end())
-		return status::NOT_FOUND;
+		key_type(key.data(), key.size(), *kv_allocator));
 
-	return status::OK;
+	return check_bound();
 }
 
-status vsmap::vsmap_iterator<true>::seek_higher_eq(string_view key)
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::seek_higher_eq(string_view key)
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
 	it_ = container->lower_bound(
-		vsmap::key_type(key.data(), key.size(), *kv_allocator));
-	if (it_ == container->end())
-		return status::NOT_FOUND;
+		key_type(key.data(), key.size(), *kv_allocator));
 
-	return status::OK;
+	return check_bound();
 }
 
-status vsmap::vsmap_iterator<true>::seek_to_first()
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::seek_to_first()
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
 	if (container->empty())
@@ -317,11 +591,13 @@ status vsmap::vsmap_iterator<true>::seek_to_first()
 
 	it_ = container->begin();
 
-	return status::OK;
+	return check_bound();
 }
 
-status vsmap::vsmap_iterator<true>::seek_to_last()
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::seek_to_last()
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
 	if (container->empty())
@@ -333,27 +609,35 @@ status vsmap::vsmap_iterator<true>::seek_to_last()
 	return status::OK;
 }
 
-status vsmap::vsmap_iterator<true>::is_next()
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::is_next()
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	auto tmp = it_;
-	if (tmp == container->end() || ++tmp == container->end())
+	if (tmp == container->end() || past_bound(++tmp))
 		return status::NOT_FOUND;
 
 	return status::OK;
 }
 
-status vsmap::vsmap_iterator<true>::next()
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::next()
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
-	if (it_ == container->end() || ++it_ == container->end())
+	if (it_ == container->end())
 		return status::NOT_FOUND;
 
-	return status::OK;
+	++it_;
+
+	return check_bound();
 }
 
-status vsmap::vsmap_iterator<true>::prev()
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::prev()
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	init_seek();
 
 	if (it_ == container->begin())
@@ -364,16 +648,68 @@ status vsmap::vsmap_iterator<true>::prev()
 	return status::OK;
 }
 
-result<string_view> vsmap::vsmap_iterator<true>::key()
+template <typename MapTraits>
+status
+basic_vsmap<MapTraits>::vsmap_const_iterator::next_batch(internal::iterator_batch &batch)
+{
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
+	init_seek();
+
+	for (; !past_bound(it_) && !batch.full(); ++it_)
+		batch.push(string_view(it_->first.data(), it_->first.length()),
+			   batch.keys_only()
+				   ? string_view()
+				   : string_view(it_->second.data(), it_->second.size()));
+
+	check_bound();
+
+	return batch.size > 0 ? status::OK : status::NOT_FOUND;
+}
+
+template <typename MapTraits>
+status
+basic_vsmap<MapTraits>::vsmap_const_iterator::set_upper_bound(const string_view *key)
+{
+	bound.set(key);
+
+	return status::OK;
+}
+
+/* Returns true if 'it' is the end or is not lower than the upper bound */
+template <typename MapTraits>
+bool basic_vsmap<MapTraits>::vsmap_const_iterator::past_bound(
+	const typename container_type::iterator &it)
 {
+	return it == container->end() ||
+		bound.reached(string_view(it->first.data(), it->first.length()),
+			      container->key_comp());
+}
+
+/* Moves the iterator to the end if it's past the upper bound */
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_const_iterator::check_bound()
+{
+	if (!past_bound(it_))
+		return status::OK;
+
+	it_ = container->end();
+	return status::NOT_FOUND;
+}
+
+template <typename MapTraits>
+result<string_view> basic_vsmap<MapTraits>::vsmap_const_iterator::key()
+{
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	assert(it_ != container->end());
 
 	return string_view(it_->first.data(), it_->first.length());
 }
 
-result<pmem::obj::slice<const char *>> vsmap::vsmap_iterator<true>::read_range(size_t pos,
-									       size_t n)
+template <typename MapTraits>
+result<pmem::obj::slice<const char *>>
+basic_vsmap<MapTraits>::vsmap_const_iterator::read_range(size_t pos, size_t n)
 {
+	internal::shared_lock_guard<mutex_type> lock(*mtx);
 	assert(it_ != container->end());
 
 	if (pos + n > it_->second.size() || pos + n < pos)
@@ -382,10 +718,13 @@ result<pmem::obj::slice<const char *>> vsmap::vsmap_iterator<true>::read_range(s
 	return {{it_->second.data() + pos, it_->second.data() + pos + n}};
 }
 
-result<pmem::obj::slice<char *>> vsmap::vsmap_iterator<false>::write_range(size_t pos,
-									   size_t n)
+template <typename MapTraits>
+result<pmem::obj::slice<char *>>
+basic_vsmap<MapTraits>::vsmap_iterator::write_range(size_t pos, size_t n)
 {
-	assert(it_ != container->end());
+	internal::shared_lock_guard<mutex_type> lock(*this->mtx);
+	auto &it_ = this->it_;
+	assert(it_ != this->container->end());
 
 	if (pos + n > it_->second.size() || pos + n < pos)
 		n = it_->second.size() - pos;
@@ -396,10 +735,12 @@ result<pmem::obj::slice<char *>> vsmap::vsmap_iterator<false>::write_range(size_
 	return {{&val[0], &val[0] + n}};
 }
 
-status vsmap::vsmap_iterator<false>::commit()
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_iterator::commit()
 {
+	std::unique_lock<mutex_type> lock(*this->mtx);
 	for (auto &p : log) {
-		auto dest = &(it_->second[0]) + p.second;
+		auto dest = &(this->it_->second[0]) + p.second;
 		std::copy(p.first.begin(), p.first.end(), dest);
 	}
 	log.clear();
@@ -407,11 +748,74 @@ status vsmap::vsmap_iterator<false>::commit()
 	return status::OK;
 }
 
-void vsmap::vsmap_iterator<false>::abort()
+template <typename MapTraits>
+void basic_vsmap<MapTraits>::vsmap_iterator::abort()
 {
 	log.clear();
 }
 
+template <typename MapTraits>
+basic_vsmap<MapTraits>::vsmap_transaction::vsmap_transaction(
+	basic_vsmap<MapTraits> *engine)
+    : engine(engine)
+{
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_transaction::put(string_view key,
+						       string_view value)
+{
+	log.insert(key, value);
+	return status::OK;
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_transaction::remove(string_view key)
+{
+	log.remove(key);
+	return status::OK;
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_transaction::get(string_view key,
+						       get_v_callback *callback,
+						       void *arg)
+{
+	return log.get(key, callback, arg,
+		       [&] { return engine->get(key, callback, arg); });
+}
+
+template <typename MapTraits>
+status basic_vsmap<MapTraits>::vsmap_transaction::commit()
+{
+	auto insert_cb = [&](const internal::dram_log::element_type &e) {
+		engine->put_locked(e.first, e.second);
+	};
+
+	auto remove_cb = [&](const internal::dram_log::element_type &e) {
+		// XXX - do not create temporary string
+		engine->pmem_kv_container.erase(
+			key_type(e.first.data(), e.first.size(), engine->kv_allocator));
+	};
+
+	std::unique_lock<mutex_type> lock(engine->mtx);
+	log.foreach (insert_cb, remove_cb);
+	lock.unlock();
+
+	log.clear();
+
+	return status::OK;
+}
+
+template <typename MapTraits>
+void basic_vsmap<MapTraits>::vsmap_transaction::abort()
+{
+	log.clear();
+}
+
+template class basic_vsmap<internal::vsmap_std_map>;
+template class basic_vsmap<internal::vsmap_b_tree>;
+
 static factory_registerer
 	register_vsmap(std::unique_ptr<engine_base::factory_base>(new vsmap_factory));
 
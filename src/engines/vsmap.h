@@ -7,8 +7,11 @@
 #include "../comparator/volatile_comparator.h"
 #include "../engine.h"
 #include "../iterator.h"
+#include "../sharded_shared_mutex.h"
+#include "../thread_cache_allocator.h"
 
 #include "pmem_allocator.h"
+#include "vsmap/volatile_b_tree.h"
 #include <map>
 #include <scoped_allocator>
 #include <string>
@@ -23,14 +26,86 @@ namespace pmem
 {
 namespace kv
 {
+namespace internal
+{
+
+/* Containers, which can be used by vsmap */
+struct vsmap_std_map {
+	template <typename Key, typename T, typename Compare, typename Allocator>
+	using map_type =
+		std::map<Key, T, Compare, std::scoped_allocator_adaptor<Allocator>>;
+
+	/* Number of elements in range [first, last), walks over the range */
+	template <typename Map, typename It>
+	static std::size_t distance(const Map &map, It first, It last)
+	{
+		return internal::distance(first, last);
+	}
+
+	/* Returns iterator n elements after first (or last, if it's closer) */
+	template <typename Map, typename It>
+	static It advance(Map &map, It first, It last, std::size_t n)
+	{
+		for (; n > 0 && first != last; --n)
+			++first;
+
+		return first;
+	}
+
+	/* Erases elements with keys in range (key1, key2), returns their number */
+	template <typename Map, typename K>
+	static std::size_t erase_between(Map &map, const K &key1, const K &key2)
+	{
+		auto first = map.upper_bound(key1);
+		auto last = map.lower_bound(key2);
+		auto cnt = internal::distance(first, last);
+		map.erase(first, last);
+
+		return cnt;
+	}
+};
 
-class vsmap : public engine_base {
-	template <bool IsConst>
+struct vsmap_b_tree {
+	template <typename Key, typename T, typename Compare, typename Allocator>
+	using map_type = volatile_b_tree<Key, T, Compare, Allocator>;
+
+	/* Number of elements in range [first, last), from sizes of subtrees */
+	template <typename Map, typename It>
+	static std::size_t distance(const Map &map, It first, It last)
+	{
+		return map.distance(first, last);
+	}
+
+	/* Returns iterator n elements after first (or last), from sizes of subtrees */
+	template <typename Map, typename It>
+	static It advance(Map &map, It first, It last, std::size_t n)
+	{
+		auto pos = map.position(first) + n;
+		if (pos >= map.position(last))
+			return last;
+
+		return map.at(pos);
+	}
+
+	/* Erases elements with keys in range (key1, key2), frees whole subtrees */
+	template <typename Map, typename K>
+	static std::size_t erase_between(Map &map, const K &key1, const K &key2)
+	{
+		return map.erase_between(key1, key2);
+	}
+};
+
+} /* namespace internal */
+
+template <typename MapTraits>
+class basic_vsmap : public engine_base {
+	class vsmap_const_iterator;
 	class vsmap_iterator;
+	class vsmap_transaction;
 
 public:
-	vsmap(std::unique_ptr<internal::config> cfg);
-	~vsmap();
+	basic_vsmap(std::unique_ptr<internal::config> cfg);
+	~basic_vsmap();
 
 	std::string name() final;
 
@@ -50,41 +125,78 @@ public:
 	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			   void *arg) final;
+	status get_above_paged(string_view key, std::size_t offset, std::size_t limit,
+			       get_kv_callback *callback, void *arg) final;
+	status get_between_paged(string_view key1, string_view key2, std::size_t offset,
+				 std::size_t limit, get_kv_callback *callback,
+				 void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
+	status get_keys_between(string_view key1, string_view key2,
+				get_kv_callback *callback, void *arg) final;
 
 	status exists(string_view key) final;
 
 	status get(string_view key, get_v_callback *callback, void *arg) final;
 
 	status put(string_view key, string_view value) final;
+	status put_if_absent(string_view key, string_view value, bool &inserted) final;
 
 	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
 
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
+	internal::transaction *begin_tx() final;
+
 private:
-	using storage_type = std::basic_string<char, std::char_traits<char>,
-					       memkind_ns::allocator<char>>;
+	template <typename T>
+	using allocator_type =
+		internal::thread_cache_allocator<T, memkind_ns::allocator<char>>;
+
+	using storage_type =
+		std::basic_string<char, std::char_traits<char>, allocator_type<char>>;
 
 	using key_type = storage_type;
 	using mapped_type = storage_type;
 	using map_allocator_type =
-		memkind_ns::allocator<std::pair<const key_type, mapped_type>>;
-	using map_type = std::map<key_type, mapped_type, internal::volatile_compare,
-				  std::scoped_allocator_adaptor<map_allocator_type>>;
+		allocator_type<std::pair<const key_type, mapped_type>>;
+	using map_type =
+		typename MapTraits::template map_type<key_type, mapped_type,
+						      internal::volatile_compare,
+						      map_allocator_type>;
+
+	using mutex_type = internal::sharded_shared_mutex;
+
+	static map_allocator_type make_allocator(internal::config &cfg);
+
+	template <typename It>
+	status iterate_paged(It first, It last, std::size_t offset, std::size_t limit,
+			     get_kv_callback *callback, void *arg);
+
+	/* Inserts or overwrites the element, mutex must be locked */
+	void put_locked(string_view key, string_view value);
 
 	map_allocator_type kv_allocator;
 	map_type pmem_kv_container;
+	/* readers hold shared lock, put and remove exclusive one */
+	mutex_type mtx;
 	std::unique_ptr<internal::config> config;
 };
 
-template <>
-class vsmap::vsmap_iterator<true> : public internal::iterator_base {
-	using container_type = vsmap::map_type;
+template <typename MapTraits>
+class basic_vsmap<MapTraits>::vsmap_const_iterator : public internal::iterator_base {
+	using container_type = basic_vsmap<MapTraits>::map_type;
 
 public:
-	vsmap_iterator(container_type *container,
-		       vsmap::map_allocator_type *kv_allocator);
+	vsmap_const_iterator(container_type *container,
+			     map_allocator_type *kv_allocator, mutex_type *mtx);
 
 	status seek(string_view key) final;
 	status seek_lower(string_view key) final;
@@ -98,6 +210,9 @@ public:
 	status is_next() final;
 	status next() final;
 	status prev() final;
+	status next_batch(internal::iterator_batch &batch) final;
+
+	status set_upper_bound(const string_view *key) final;
 
 	result<string_view> key() final;
 
@@ -105,17 +220,23 @@ public:
 
 protected:
 	container_type *container;
-	vsmap::map_allocator_type *kv_allocator;
-	container_type::iterator it_;
+	map_allocator_type *kv_allocator;
+	mutex_type *mtx;
+	typename container_type::iterator it_;
+	internal::iterator_bound bound;
+
+	bool past_bound(const typename container_type::iterator &it);
+	status check_bound();
 };
 
-template <>
-class vsmap::vsmap_iterator<false> : public vsmap::vsmap_iterator<true> {
-	using container_type = vsmap::map_type;
+template <typename MapTraits>
+class basic_vsmap<MapTraits>::vsmap_iterator
+    : public basic_vsmap<MapTraits>::vsmap_const_iterator {
+	using container_type = basic_vsmap<MapTraits>::map_type;
 
 public:
-	vsmap_iterator(container_type *container,
-		       vsmap::map_allocator_type *kv_allocator);
+	vsmap_iterator(container_type *container, map_allocator_type *kv_allocator,
+		       mutex_type *mtx);
 
 	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
 
@@ -126,11 +247,42 @@ private:
 	std::vector<std::pair<std::string, size_t>> log;
 };
 
+/*
+ * Transaction of vsmap. Operations are buffered in dram_log and applied in
+ * order on commit, with the exclusive lock held, so readers see either none
+ * or all of them.
+ */
+template <typename MapTraits>
+class basic_vsmap<MapTraits>::vsmap_transaction : public internal::transaction {
+public:
+	vsmap_transaction(basic_vsmap<MapTraits> *engine);
+
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status commit() final;
+	void abort() final;
+
+private:
+	basic_vsmap<MapTraits> *engine;
+	internal::dram_log log;
+};
+
+using vsmap = basic_vsmap<internal::vsmap_std_map>;
+using vsmap_b_tree = basic_vsmap<internal::vsmap_b_tree>;
+
 class vsmap_factory : public engine_base::factory_base {
 public:
 	virtual std::unique_ptr<engine_base> create(std::unique_ptr<internal::config> cfg)
 	{
 		check_config_null(get_name(), cfg);
+
+		uint64_t b_tree = 0;
+		cfg->get_uint64("b_tree", &b_tree);
+		if (b_tree)
+			return std::unique_ptr<engine_base>(
+				new vsmap_b_tree(std::move(cfg)));
+
 		return std::unique_ptr<engine_base>(new vsmap(std::move(cfg)));
 	};
 	virtual std::string get_name()
@@ -0,0 +1,1034 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_VOLATILE_B_TREE_H
+#define LIBPMEMKV_VOLATILE_B_TREE_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * volatile_b_tree is a B+tree with wide nodes: each node keeps its keys in
+ * a contiguous array (sized to a multiple of a cache line for std::string
+ * keys), so a lookup touches a few nodes instead of chasing a pointer per
+ * level, as in a red-black tree. Leaves are linked in both directions.
+ *
+ * Interface is a subset of std::map's. Lookups are templates, so they accept
+ * any type comparable by Compare (if it's transparent). There are two
+ * important differences:
+ * - iterators are invalidated by every insertion and erase,
+ * - element is inserted by moving already constructed key and value
+ *   (no allocator is passed to them by the tree).
+ *
+ * Inner nodes keep numbers of elements in subtrees of their children, so
+ * position of an element (and distance between two iterators) is computed
+ * in logarithmic time.
+ *
+ * Nodes are never merged, only empty ones are removed.
+ *
+ * Compare has to provide key_prefix(key), returning an integer such that
+ * key_prefix(k1) <= key_prefix(k2) for any keys k1 < k2. Nodes keep prefixes
+ * of their keys next to them and a lookup computes prefix of the searched key
+ * once, so most comparisons are resolved on integers, without touching the
+ * keys (and calling a custom comparison function). Keys are compared only
+ * when prefixes are equal.
+ */
+template <typename Key, typename T, typename Compare, typename Allocator,
+	  std::size_t LeafCapacity = 16, std::size_t InnerCapacity = 32>
+class volatile_b_tree {
+	static_assert(LeafCapacity >= 2, "LeafCapacity must be at least 2");
+	static_assert(InnerCapacity >= 4, "InnerCapacity must be at least 4");
+
+	struct inner_node;
+
+	struct node_base {
+		node_base(bool leaf) : leaf(leaf)
+		{
+		}
+
+		inner_node *parent = nullptr;
+		/* number of elements (for leaves) or children (for inner nodes) */
+		std::size_t size = 0;
+		bool leaf;
+	};
+
+	struct leaf_node : node_base {
+		leaf_node() : node_base(true)
+		{
+		}
+
+		Key &key(std::size_t i)
+		{
+			return *reinterpret_cast<Key *>(&keys[i]);
+		}
+
+		T &value(std::size_t i)
+		{
+			return *reinterpret_cast<T *>(&values[i]);
+		}
+
+		leaf_node *prev = nullptr;
+		leaf_node *next = nullptr;
+		uint64_t prefixes[LeafCapacity];
+		typename std::aligned_storage<sizeof(Key), alignof(Key)>::type
+			keys[LeafCapacity];
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type
+			values[LeafCapacity];
+	};
+
+	/* child i keeps keys k such that key(i - 1) <= k < key(i) */
+	struct inner_node : node_base {
+		inner_node() : node_base(false)
+		{
+		}
+
+		Key &key(std::size_t i)
+		{
+			return *reinterpret_cast<Key *>(&keys[i]);
+		}
+
+		std::size_t index_of(const node_base *child) const
+		{
+			std::size_t i = 0;
+			while (children[i] != child)
+				++i;
+
+			return i;
+		}
+
+		uint64_t prefixes[InnerCapacity - 1];
+		typename std::aligned_storage<sizeof(Key), alignof(Key)>::type
+			keys[InnerCapacity - 1];
+		node_base *children[InnerCapacity];
+		/* number of elements in subtree of each child */
+		std::size_t counts[InnerCapacity];
+	};
+
+	using leaf_allocator_type = typename std::allocator_traits<
+		Allocator>::template rebind_alloc<leaf_node>;
+	using inner_allocator_type = typename std::allocator_traits<
+		Allocator>::template rebind_alloc<inner_node>;
+
+	template <bool IsConst>
+	class basic_iterator {
+		using mapped_reference =
+			typename std::conditional<IsConst, const T &, T &>::type;
+		friend class volatile_b_tree;
+		friend class basic_iterator<true>;
+
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = std::pair<const Key, T>;
+		using difference_type = std::ptrdiff_t;
+		using reference = std::pair<const Key &, mapped_reference>;
+
+		/* references are created on the fly, pointer has to keep one */
+		struct pointer {
+			const reference *operator->() const
+			{
+				return &ref;
+			}
+
+			reference ref;
+		};
+
+		basic_iterator() = default;
+
+		template <bool C = IsConst, typename = typename std::enable_if<C>::type>
+		basic_iterator(const basic_iterator<false> &other)
+		    : tree(other.tree), node(other.node), pos(other.pos)
+		{
+		}
+
+		reference operator*() const
+		{
+			assert(node != nullptr);
+			return reference(node->key(pos), node->value(pos));
+		}
+
+		pointer operator->() const
+		{
+			return pointer{**this};
+		}
+
+		basic_iterator &operator++()
+		{
+			assert(node != nullptr);
+			if (++pos == node->size) {
+				node = node->next;
+				pos = 0;
+			}
+
+			return *this;
+		}
+
+		basic_iterator operator++(int)
+		{
+			auto tmp = *this;
+			++*this;
+			return tmp;
+		}
+
+		basic_iterator &operator--()
+		{
+			if (node == nullptr) {
+				node = tree->last;
+				pos = node->size - 1;
+			} else if (pos == 0) {
+				node = node->prev;
+				pos = node->size - 1;
+			} else {
+				--pos;
+			}
+
+			return *this;
+		}
+
+		basic_iterator operator--(int)
+		{
+			auto tmp = *this;
+			--*this;
+			return tmp;
+		}
+
+		bool operator==(const basic_iterator &other) const
+		{
+			return node == other.node && pos == other.pos;
+		}
+
+		bool operator!=(const basic_iterator &other) const
+		{
+			return !(*this == other);
+		}
+
+	private:
+		basic_iterator(const volatile_b_tree *tree, leaf_node *node,
+			       std::size_t pos)
+		    : tree(tree), node(node), pos(pos)
+		{
+		}
+
+		const volatile_b_tree *tree = nullptr;
+		/* nullptr for end() */
+		leaf_node *node = nullptr;
+		std::size_t pos = 0;
+	};
+
+public:
+	using key_type = Key;
+	using mapped_type = T;
+	using value_type = std::pair<const Key, T>;
+	using size_type = std::size_t;
+	using key_compare = Compare;
+	using allocator_type = Allocator;
+	using iterator = basic_iterator<false>;
+	using const_iterator = basic_iterator<true>;
+
+	volatile_b_tree(const Compare &comp, const Allocator &alloc)
+	    : comp(comp), leaf_allocator(alloc), inner_allocator(alloc)
+	{
+	}
+
+	~volatile_b_tree()
+	{
+		if (root)
+			destroy(root);
+	}
+
+	volatile_b_tree(const volatile_b_tree &) = delete;
+	volatile_b_tree &operator=(const volatile_b_tree &) = delete;
+
+	iterator begin()
+	{
+		return iterator(this, first, 0);
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(this, first, 0);
+	}
+
+	iterator end()
+	{
+		return iterator(this, nullptr, 0);
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(this, nullptr, 0);
+	}
+
+	size_type size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	key_compare key_comp() const
+	{
+		return comp;
+	}
+
+	template <typename K>
+	iterator lower_bound(const K &key)
+	{
+		auto prefix = comp.key_prefix(key);
+		auto leaf = find_leaf(key, prefix);
+		if (!leaf)
+			return end();
+
+		return make_iterator(leaf, leaf_lower_bound(leaf, key, prefix));
+	}
+
+	template <typename K>
+	const_iterator lower_bound(const K &key) const
+	{
+		return const_cast<volatile_b_tree *>(this)->lower_bound(key);
+	}
+
+	template <typename K>
+	iterator upper_bound(const K &key)
+	{
+		auto prefix = comp.key_prefix(key);
+		auto leaf = find_leaf(key, prefix);
+		if (!leaf)
+			return end();
+
+		return make_iterator(leaf, leaf_upper_bound(leaf, key, prefix));
+	}
+
+	template <typename K>
+	const_iterator upper_bound(const K &key) const
+	{
+		return const_cast<volatile_b_tree *>(this)->upper_bound(key);
+	}
+
+	template <typename K>
+	iterator find(const K &key)
+	{
+		auto prefix = comp.key_prefix(key);
+		auto leaf = find_leaf(key, prefix);
+		if (!leaf)
+			return end();
+
+		auto pos = leaf_lower_bound(leaf, key, prefix);
+		if (pos == leaf->size || key_less(key, prefix, leaf, pos))
+			return end();
+
+		return iterator(this, leaf, pos);
+	}
+
+	template <typename K>
+	const_iterator find(const K &key) const
+	{
+		return const_cast<volatile_b_tree *>(this)->find(key);
+	}
+
+	/*
+	 * Inserts element (moving the key and the value), if there's no element
+	 * with equivalent key. Returns iterator to the element with the key and
+	 * true if insertion took place.
+	 */
+	std::pair<iterator, bool> emplace(Key &&key, T &&value)
+	{
+		if (!root) {
+			auto leaf = new_leaf();
+			root = first = last = leaf;
+		}
+
+		auto prefix = comp.key_prefix(key);
+		auto leaf = find_leaf(key, prefix);
+		auto pos = leaf_lower_bound(leaf, key, prefix);
+		if (pos < leaf->size && !key_less(key, prefix, leaf, pos))
+			return {iterator(this, leaf, pos), false};
+
+		if (leaf->size == LeafCapacity) {
+			auto right = split_leaf(leaf);
+			if (pos > leaf->size) {
+				pos -= leaf->size;
+				leaf = right;
+			}
+		}
+
+		for (auto i = leaf->size; i > pos; --i)
+			move_element(leaf, i - 1, leaf, i);
+
+		construct_key(leaf, pos, std::move(key), prefix);
+		new (&leaf->value(pos)) T(std::move(value));
+		++leaf->size;
+		++count;
+		update_counts(leaf, true);
+
+		return {iterator(this, leaf, pos), true};
+	}
+
+	/*
+	 * Same as emplace, but if 'hint' is end() and the key is greater than
+	 * all keys in the tree, it's appended to the last leaf without a lookup.
+	 * A new leaf is started when the last one is full, so inserting sorted
+	 * elements leaves all (but the last) leaves full.
+	 */
+	iterator emplace_hint(const_iterator hint, Key &&key, T &&value)
+	{
+		if (hint.node != nullptr || !last || last->size == 0)
+			return emplace(std::move(key), std::move(value)).first;
+
+		auto prefix = comp.key_prefix(key);
+		if (!node_less(last, last->size - 1, key, prefix))
+			return emplace(std::move(key), std::move(value)).first;
+
+		auto leaf = last;
+		if (leaf->size == LeafCapacity)
+			leaf = split_leaf(leaf, leaf->size, Key(key), prefix);
+
+		auto pos = leaf->size;
+		construct_key(leaf, pos, std::move(key), prefix);
+		new (&leaf->value(pos)) T(std::move(value));
+		++leaf->size;
+		++count;
+		update_counts(leaf, true);
+
+		return iterator(this, leaf, pos);
+	}
+
+	/* Removes element with the key, returns number of removed elements */
+	template <typename K>
+	size_type erase(const K &key)
+	{
+		auto prefix = comp.key_prefix(key);
+		auto leaf = find_leaf(key, prefix);
+		if (!leaf)
+			return 0;
+
+		auto pos = leaf_lower_bound(leaf, key, prefix);
+		if (pos == leaf->size || key_less(key, prefix, leaf, pos))
+			return 0;
+
+		leaf->key(pos).~Key();
+		leaf->value(pos).~T();
+		for (auto i = pos + 1; i < leaf->size; ++i)
+			move_element(leaf, i, leaf, i - 1);
+
+		--leaf->size;
+		--count;
+		update_counts(leaf, false);
+
+		if (leaf->size == 0) {
+			(leaf->prev ? leaf->prev->next : first) = leaf->next;
+			(leaf->next ? leaf->next->prev : last) = leaf->prev;
+			remove_node(leaf);
+		}
+
+		return 1;
+	}
+
+	/*
+	 * Removes elements with keys in range (key1, key2), returns number of
+	 * removed elements. Subtrees, all keys of which are in the range, are
+	 * destroyed as a whole, so only nodes on both ends of the range are
+	 * searched for keys.
+	 */
+	template <typename K>
+	size_type erase_between(const K &key1, const K &key2)
+	{
+		if (!root || !comp(key1, key2))
+			return 0;
+
+		removed_leaves removed;
+		auto erased = erase_range(root, key_bound<K>{key1, comp.key_prefix(key1)},
+					  key_bound<K>{key2, comp.key_prefix(key2)},
+					  false, false, removed);
+
+		if (removed.any) {
+			(removed.prev ? removed.prev->next : first) = removed.next;
+			(removed.next ? removed.next->prev : last) = removed.prev;
+		}
+
+		/* root with a single child is not needed */
+		while (root && !root->leaf && root->size == 1) {
+			auto old_root = static_cast<inner_node *>(root);
+			root = old_root->children[0];
+			root->parent = nullptr;
+			free_inner(old_root);
+		}
+
+		count -= erased;
+
+		return erased;
+	}
+
+	/* Returns number of elements before the one pointed by 'it' */
+	size_type position(const_iterator it) const
+	{
+		if (it.node == nullptr)
+			return count;
+
+		size_type result = it.pos;
+		const node_base *node = it.node;
+		for (auto parent = node->parent; parent;
+		     node = parent, parent = parent->parent) {
+			auto idx = parent->index_of(node);
+			for (std::size_t i = 0; i < idx; ++i)
+				result += parent->counts[i];
+		}
+
+		return result;
+	}
+
+	/* Returns number of elements in range [first, last) */
+	size_type distance(const_iterator first, const_iterator last) const
+	{
+		return position(last) - position(first);
+	}
+
+	/*
+	 * Returns iterator to the element at position 'pos' (end() if there is
+	 * no such element), found by numbers of elements in subtrees.
+	 */
+	iterator at(size_type pos)
+	{
+		if (pos >= count)
+			return end();
+
+		auto node = root;
+		while (!node->leaf) {
+			auto inner = static_cast<inner_node *>(node);
+			std::size_t i = 0;
+			while (pos >= inner->counts[i])
+				pos -= inner->counts[i++];
+			node = inner->children[i];
+		}
+
+		return iterator(this, static_cast<leaf_node *>(node), pos);
+	}
+
+	const_iterator at(size_type pos) const
+	{
+		return const_cast<volatile_b_tree *>(this)->at(pos);
+	}
+
+private:
+	/* Neighbours of leaves removed by erase_between (they are contiguous) */
+	struct removed_leaves {
+		void add(leaf_node *first_leaf, leaf_node *last_leaf)
+		{
+			if (!any)
+				prev = first_leaf->prev;
+			next = last_leaf->next;
+			any = true;
+		}
+
+		bool any = false;
+		leaf_node *prev = nullptr;
+		leaf_node *next = nullptr;
+	};
+
+	iterator make_iterator(leaf_node *leaf, std::size_t pos)
+	{
+		if (pos == leaf->size)
+			return iterator(this, leaf->next, 0);
+
+		return iterator(this, leaf, pos);
+	}
+
+	/* key of a lookup, with its prefix */
+	template <typename K>
+	struct key_bound {
+		const K &key;
+		uint64_t prefix;
+	};
+
+	/* Returns true if the key is less than i-th key of the node */
+	template <typename Node, typename K>
+	bool key_less(const K &key, uint64_t prefix, Node *node, std::size_t i) const
+	{
+		if (prefix != node->prefixes[i])
+			return prefix < node->prefixes[i];
+
+		return comp(key, node->key(i));
+	}
+
+	/* Returns true if i-th key of the node is less than the key */
+	template <typename Node, typename K>
+	bool node_less(Node *node, std::size_t i, const K &key, uint64_t prefix) const
+	{
+		if (prefix != node->prefixes[i])
+			return node->prefixes[i] < prefix;
+
+		return comp(node->key(i), key);
+	}
+
+	/* Constructs i-th key of the node, 'prefix' is the key's prefix */
+	template <typename Node>
+	static void construct_key(Node *node, std::size_t i, Key &&key, uint64_t prefix)
+	{
+		new (&node->key(i)) Key(std::move(key));
+		node->prefixes[i] = prefix;
+	}
+
+	/* Moves key (with its prefix) to an uninitialized place */
+	template <typename Node>
+	static void move_key(Node *from, std::size_t from_pos, Node *to,
+			     std::size_t to_pos)
+	{
+		construct_key(to, to_pos, std::move(from->key(from_pos)),
+			      from->prefixes[from_pos]);
+		from->key(from_pos).~Key();
+	}
+
+	template <typename K>
+	leaf_node *find_leaf(const K &key, uint64_t prefix) const
+	{
+		auto node = root;
+		if (!node)
+			return nullptr;
+
+		while (!node->leaf) {
+			auto inner = static_cast<inner_node *>(node);
+			node = inner->children[child_index(inner, key, prefix)];
+		}
+
+		return static_cast<leaf_node *>(node);
+	}
+
+	/* Returns position of the child which may contain the key */
+	template <typename K>
+	std::size_t child_index(inner_node *inner, const K &key, uint64_t prefix) const
+	{
+		/* first separator greater than the key */
+		std::size_t lo = 0, hi = inner->size - 1;
+		while (lo < hi) {
+			auto mid = lo + (hi - lo) / 2;
+			if (key_less(key, prefix, inner, mid))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+
+		return lo;
+	}
+
+	static leaf_node *edge_leaf(node_base *node, bool leftmost)
+	{
+		while (!node->leaf) {
+			auto inner = static_cast<inner_node *>(node);
+			node = inner->children[leftmost ? 0 : inner->size - 1];
+		}
+
+		return static_cast<leaf_node *>(node);
+	}
+
+	/*
+	 * Erases elements with keys in range (key1, key2) from the subtree.
+	 * 'above' ('below') is set if all keys of the subtree are greater than
+	 * key1 (less than key2). Node is freed (and set to nullptr) if it becomes
+	 * empty. Separators are not changed - they still bound keys of remaining
+	 * children. Returns number of erased elements.
+	 */
+	template <typename K>
+	size_type erase_range(node_base *&node, key_bound<K> key1, key_bound<K> key2,
+			      bool above, bool below, removed_leaves &removed)
+	{
+		if (above && below) {
+			auto n = subtree_size(node);
+			removed.add(edge_leaf(node, true), edge_leaf(node, false));
+			destroy(node);
+			node = nullptr;
+
+			return n;
+		}
+
+		if (node->leaf) {
+			auto leaf = static_cast<leaf_node *>(node);
+			auto lo = above ? 0
+					: leaf_upper_bound(leaf, key1.key, key1.prefix);
+			auto hi = below ? leaf->size
+					: leaf_lower_bound(leaf, key2.key, key2.prefix);
+			if (lo >= hi)
+				return 0;
+
+			for (auto i = lo; i < hi; ++i) {
+				leaf->key(i).~Key();
+				leaf->value(i).~T();
+			}
+			for (auto i = hi; i < leaf->size; ++i)
+				move_element(leaf, i, leaf, i - (hi - lo));
+			leaf->size -= hi - lo;
+
+			if (leaf->size == 0) {
+				removed.add(leaf, leaf);
+				free_leaf(leaf);
+				node = nullptr;
+			}
+
+			return hi - lo;
+		}
+
+		auto inner = static_cast<inner_node *>(node);
+		auto first_child = child_index(inner, key1.key, key1.prefix);
+		auto last_child = child_index(inner, key2.key, key2.prefix);
+
+		size_type erased = 0;
+		for (auto i = first_child; i <= last_child; ++i) {
+			bool child_above = i > 0
+				? key_less(key1.key, key1.prefix, inner, i - 1)
+				: above;
+			bool child_below = i + 1 < inner->size
+				? !key_less(key2.key, key2.prefix, inner, i)
+				: below;
+			auto n = erase_range(inner->children[i], key1, key2, child_above,
+					     child_below, removed);
+			inner->counts[i] -= n;
+			erased += n;
+		}
+
+		/* remove freed children, with their separators */
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < inner->size; ++i) {
+			if (inner->children[i] == nullptr || kept == 0) {
+				if (i > 0)
+					inner->key(i - 1).~Key();
+				if (inner->children[i] == nullptr)
+					continue;
+			} else if (kept != i) {
+				move_key(inner, i - 1, inner, kept - 1);
+			}
+
+			inner->children[kept] = inner->children[i];
+			inner->counts[kept] = inner->counts[i];
+			++kept;
+		}
+		inner->size = kept;
+
+		if (kept == 0) {
+			free_inner(inner);
+			node = nullptr;
+		}
+
+		return erased;
+	}
+
+	/* Returns position of the first element not less than the key */
+	template <typename K>
+	std::size_t leaf_lower_bound(leaf_node *leaf, const K &key, uint64_t prefix) const
+	{
+		std::size_t lo = 0, hi = leaf->size;
+		while (lo < hi) {
+			auto mid = lo + (hi - lo) / 2;
+			if (node_less(leaf, mid, key, prefix))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		return lo;
+	}
+
+	/* Returns position of the first element greater than the key */
+	template <typename K>
+	std::size_t leaf_upper_bound(leaf_node *leaf, const K &key, uint64_t prefix) const
+	{
+		std::size_t lo = 0, hi = leaf->size;
+		while (lo < hi) {
+			auto mid = lo + (hi - lo) / 2;
+			if (key_less(key, prefix, leaf, mid))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+
+		return lo;
+	}
+
+	static std::size_t subtree_size(const node_base *node)
+	{
+		if (node->leaf)
+			return node->size;
+
+		auto inner = static_cast<const inner_node *>(node);
+		std::size_t result = 0;
+		for (std::size_t i = 0; i < inner->size; ++i)
+			result += inner->counts[i];
+
+		return result;
+	}
+
+	/* Updates counts of all ancestors after insertion to (or erase from) leaf */
+	static void update_counts(node_base *leaf, bool inserted)
+	{
+		node_base *node = leaf;
+		for (auto parent = node->parent; parent;
+		     node = parent, parent = parent->parent) {
+			auto &cnt = parent->counts[parent->index_of(node)];
+			if (inserted)
+				++cnt;
+			else
+				--cnt;
+		}
+	}
+
+	static void move_element(leaf_node *from, std::size_t from_pos, leaf_node *to,
+				 std::size_t to_pos)
+	{
+		move_key(from, from_pos, to, to_pos);
+		new (&to->value(to_pos)) T(std::move(from->value(from_pos)));
+		from->value(from_pos).~T();
+	}
+
+	/* Moves upper half of a full leaf to a new leaf */
+	leaf_node *split_leaf(leaf_node *leaf)
+	{
+		auto mid = leaf->size / 2;
+		return split_leaf(leaf, mid, Key(leaf->key(mid)), leaf->prefixes[mid]);
+	}
+
+	/*
+	 * Moves elements from position 'mid' of a full leaf to a new leaf and
+	 * inserts it into the parent, with 'separator' (greater than keys left
+	 * in the leaf and not greater than the moved ones) and its prefix. All
+	 * allocations are done before the tree is modified.
+	 */
+	leaf_node *split_leaf(leaf_node *leaf, std::size_t mid, Key &&separator,
+			      uint64_t prefix)
+	{
+		/* every full ancestor will be split, new root may be needed too */
+		std::size_t inner_needed = 1;
+		for (auto p = leaf->parent; p && p->size == InnerCapacity; p = p->parent)
+			++inner_needed;
+
+		std::vector<inner_node *> spare;
+		spare.reserve(inner_needed);
+
+		leaf_node *right = nullptr;
+		try {
+			for (std::size_t i = 0; i < inner_needed; ++i)
+				spare.push_back(new_inner());
+			right = new_leaf();
+		} catch (...) {
+			for (auto n : spare)
+				free_inner(n);
+			throw;
+		}
+
+		for (auto i = mid; i < leaf->size; ++i)
+			move_element(leaf, i, right, i - mid);
+		right->size = leaf->size - mid;
+		leaf->size = mid;
+
+		right->prev = leaf;
+		right->next = leaf->next;
+		(leaf->next ? leaf->next->prev : last) = right;
+		leaf->next = right;
+
+		insert_into_parent(leaf, std::move(separator), prefix, right, spare);
+
+		for (auto n : spare)
+			free_inner(n);
+
+		return right;
+	}
+
+	/* Inserts 'right' just after 'left' into left's parent */
+	void insert_into_parent(node_base *left, Key &&separator, uint64_t prefix,
+				node_base *right, std::vector<inner_node *> &spare)
+	{
+		auto parent = left->parent;
+		if (!parent) {
+			auto new_root = spare.back();
+			spare.pop_back();
+
+			construct_key(new_root, 0, std::move(separator), prefix);
+			new_root->children[0] = left;
+			new_root->children[1] = right;
+			new_root->counts[0] = subtree_size(left);
+			new_root->counts[1] = subtree_size(right);
+			new_root->size = 2;
+			left->parent = right->parent = new_root;
+			root = new_root;
+			return;
+		}
+
+		auto idx = parent->index_of(left);
+		if (parent->size < InnerCapacity) {
+			insert_child(parent, idx, std::move(separator), prefix, right);
+			return;
+		}
+
+		/* split parent in halves, then insert into the proper one */
+		auto sibling = spare.back();
+		spare.pop_back();
+
+		auto mid = InnerCapacity / 2;
+		Key up_separator(std::move(parent->key(mid - 1)));
+		auto up_prefix = parent->prefixes[mid - 1];
+		parent->key(mid - 1).~Key();
+
+		for (auto i = mid; i < InnerCapacity; ++i) {
+			sibling->children[i - mid] = parent->children[i];
+			sibling->children[i - mid]->parent = sibling;
+			sibling->counts[i - mid] = parent->counts[i];
+		}
+		for (auto i = mid; i < InnerCapacity - 1; ++i)
+			move_key(parent, i, sibling, i - mid);
+		sibling->size = InnerCapacity - mid;
+		parent->size = mid;
+
+		if (idx < mid)
+			insert_child(parent, idx, std::move(separator), prefix, right);
+		else
+			insert_child(sibling, idx - mid, std::move(separator), prefix,
+				     right);
+
+		insert_into_parent(parent, std::move(up_separator), up_prefix, sibling,
+				   spare);
+	}
+
+	/* Inserts child after the one at position idx, node must not be full */
+	static void insert_child(inner_node *node, std::size_t idx, Key &&separator,
+				 uint64_t prefix, node_base *child)
+	{
+		assert(node->size < InnerCapacity);
+
+		for (auto i = node->size; i > idx + 1; --i) {
+			node->children[i] = node->children[i - 1];
+			node->counts[i] = node->counts[i - 1];
+		}
+		for (auto i = node->size - 1; i > idx; --i)
+			move_key(node, i - 1, node, i);
+
+		construct_key(node, idx, std::move(separator), prefix);
+		node->children[idx + 1] = child;
+		child->parent = node;
+		++node->size;
+
+		/* elements were moved from the left child to the new one */
+		node->counts[idx] = subtree_size(node->children[idx]);
+		node->counts[idx + 1] = subtree_size(child);
+	}
+
+	/* Removes (already empty) node from its parent and frees it */
+	void remove_node(node_base *node)
+	{
+		auto parent = node->parent;
+		auto idx = parent ? parent->index_of(node) : 0;
+		free_node(node);
+
+		if (!parent) {
+			root = nullptr;
+			return;
+		}
+
+		if (parent->size == 1) {
+			remove_node(parent);
+			return;
+		}
+
+		auto key_idx = idx == 0 ? 0 : idx - 1;
+
+		parent->key(key_idx).~Key();
+		for (auto i = key_idx + 1; i < parent->size - 1; ++i)
+			move_key(parent, i, parent, i - 1);
+		for (auto i = idx + 1; i < parent->size; ++i) {
+			parent->children[i - 1] = parent->children[i];
+			parent->counts[i - 1] = parent->counts[i];
+		}
+		--parent->size;
+
+		/* root with a single child is not needed */
+		if (parent == root && parent->size == 1) {
+			root = parent->children[0];
+			root->parent = nullptr;
+			free_node(parent);
+		}
+	}
+
+	leaf_node *new_leaf()
+	{
+		auto leaf = std::allocator_traits<leaf_allocator_type>::allocate(
+			leaf_allocator, 1);
+		return new (leaf) leaf_node();
+	}
+
+	inner_node *new_inner()
+	{
+		auto inner = std::allocator_traits<inner_allocator_type>::allocate(
+			inner_allocator, 1);
+		return new (inner) inner_node();
+	}
+
+	void free_leaf(leaf_node *leaf)
+	{
+		leaf->~leaf_node();
+		std::allocator_traits<leaf_allocator_type>::deallocate(leaf_allocator, leaf,
+								       1);
+	}
+
+	void free_inner(inner_node *inner)
+	{
+		inner->~inner_node();
+		std::allocator_traits<inner_allocator_type>::deallocate(inner_allocator,
+									inner, 1);
+	}
+
+	/* Frees node (which is empty or whose content was already destroyed) */
+	void free_node(node_base *node)
+	{
+		if (node->leaf)
+			free_leaf(static_cast<leaf_node *>(node));
+		else
+			free_inner(static_cast<inner_node *>(node));
+	}
+
+	/* Destroys content of the subtree and frees its nodes */
+	void destroy(node_base *node)
+	{
+		if (node->leaf) {
+			auto leaf = static_cast<leaf_node *>(node);
+			for (std::size_t i = 0; i < leaf->size; ++i) {
+				leaf->key(i).~Key();
+				leaf->value(i).~T();
+			}
+		} else {
+			auto inner = static_cast<inner_node *>(node);
+			for (std::size_t i = 0; i + 1 < inner->size; ++i)
+				inner->key(i).~Key();
+			for (std::size_t i = 0; i < inner->size; ++i)
+				destroy(inner->children[i]);
+		}
+
+		free_node(node);
+	}
+
+	Compare comp;
+	leaf_allocator_type leaf_allocator;
+	inner_allocator_type inner_allocator;
+
+	node_base *root = nullptr;
+	leaf_node *first = nullptr;
+	leaf_node *last = nullptr;
+	size_type count = 0;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_VOLATILE_B_TREE_H */
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "epoch_reclaimer.h"
+#include "thread_id.h"
+
+#include <thread>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr std::size_t epoch_reclaimer::RETIRED_BYTES_LIMIT;
+constexpr std::size_t epoch_reclaimer::RETIRED_BLOCKS_LIMIT;
+constexpr std::size_t epoch_reclaimer::BACKLOG_FACTOR;
+
+epoch_reclaimer::epoch_reclaimer(std::size_t shards_number, deleter_type deleter,
+				 thread_pool *pool)
+    : epoch(0), shards_number(shards_number ? shards_number : 1),
+      shards(new shard[this->shards_number]), deleter(std::move(deleter))
+{
+	for (std::size_t i = 0; i < this->shards_number; ++i) {
+		shards[i].readers[0] = 0;
+		shards[i].readers[1] = 0;
+	}
+
+	if (pool)
+		task.reset(new background_task(
+			[this] {
+				synchronize();
+				return background_task::idle;
+			},
+			background_task::idle, *pool));
+}
+
+epoch_reclaimer::~epoch_reclaimer()
+{
+	/* the running batch (if any) is finished, the rest is freed here */
+	task.reset();
+
+	for (auto &block : retired)
+		deleter(block.first, block.second);
+}
+
+std::size_t epoch_reclaimer::enter()
+{
+	auto &s = shards[thread_id() % shards_number];
+	while (true) {
+		auto e = epoch.load();
+		s.readers[e & 1]++;
+
+		/*
+		 * If the epoch was switched in the meantime, synchronize()
+		 * may have already checked this counter - try again.
+		 */
+		if (epoch.load() == e)
+			return static_cast<std::size_t>(e & 1);
+
+		s.readers[e & 1]--;
+	}
+}
+
+void epoch_reclaimer::leave(std::size_t token)
+{
+	shards[thread_id() % shards_number].readers[token]--;
+}
+
+void epoch_reclaimer::retire(void *p, std::size_t size)
+{
+	std::unique_lock<std::mutex> lock(retired_mtx);
+	retired.emplace_back(p, size);
+	retired_bytes += size;
+
+	/* without the task, or if it can't keep up, the writer frees the batch */
+	auto factor = task ? BACKLOG_FACTOR : 1;
+	bool full = retired.size() >= RETIRED_BLOCKS_LIMIT ||
+		retired_bytes >= RETIRED_BYTES_LIMIT;
+	bool sync = retired.size() >= RETIRED_BLOCKS_LIMIT * factor ||
+		retired_bytes >= RETIRED_BYTES_LIMIT * factor;
+	lock.unlock();
+
+	if (sync)
+		synchronize();
+	else if (full && task)
+		task->wake();
+}
+
+/*
+ * Frees all blocks retired before the call. Readers which may still see
+ * them entered in the current epoch, so it's switched to the next one
+ * (new readers can't find retired blocks) and the old readers are waited for.
+ */
+void epoch_reclaimer::synchronize()
+{
+	std::unique_lock<std::mutex> sync_lock(sync_mtx);
+	std::vector<std::pair<void *, std::size_t>> blocks;
+	{
+		std::unique_lock<std::mutex> lock(retired_mtx);
+		blocks.swap(retired);
+		retired_bytes = 0;
+	}
+
+	if (blocks.empty())
+		return;
+
+	/* sync_lock is held, so the epoch can't be switched again before they leave */
+	auto parity = epoch++ & 1;
+	for (std::size_t i = 0; i < shards_number; ++i) {
+		while (shards[i].readers[parity].load() != 0)
+			std::this_thread::yield();
+	}
+
+	for (auto &block : blocks)
+		deleter(block.first, block.second);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
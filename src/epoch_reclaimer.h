@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_EPOCH_RECLAIMER_H
+#define LIBPMEMKV_EPOCH_RECLAIMER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * epoch_reclaimer defers freeing of memory, which may still be read by
+ * lock-free readers. Readers announce themselves for the duration of a read
+ * (enter()/leave(), or epoch_guard) in one of the shards, picked by
+ * thread_id(), so readers on different shards don't share any cache line.
+ *
+ * Blocks passed to retire() must already be unreachable for new readers.
+ * They are freed (by the deleter) in batches: synchronize() switches readers
+ * to the next epoch and waits until all readers which entered in the previous
+ * one leave. A thread must not call retire() or synchronize() while it's
+ * inside a read - it would wait for itself.
+ *
+ * If a thread_pool is given, batches are freed by a background_task on it, so
+ * writers which retire blocks don't wait for readers. They only do it if the
+ * task falls behind by BACKLOG_FACTOR batches, so the memory stays bounded.
+ *
+ * It's used by vart, vhmap and robinhood. Engines whose elements are freed
+ * in transactions of libpmemobj-cpp containers (cmap, stree, csmap) can't
+ * defer these frees, so they don't use it.
+ */
+class epoch_reclaimer {
+public:
+	using deleter_type = std::function<void(void *p, std::size_t size)>;
+
+	/* synchronize() is called by retire() once that many bytes are retired */
+	static constexpr std::size_t RETIRED_BYTES_LIMIT = 16 << 20;
+	static constexpr std::size_t RETIRED_BLOCKS_LIMIT = 4096;
+	static constexpr std::size_t BACKLOG_FACTOR = 4;
+
+	epoch_reclaimer(std::size_t shards_number, deleter_type deleter,
+			thread_pool *pool = &thread_pool::get_default());
+	/* frees all retired blocks, there must be no readers left */
+	~epoch_reclaimer();
+
+	epoch_reclaimer(const epoch_reclaimer &) = delete;
+	epoch_reclaimer &operator=(const epoch_reclaimer &) = delete;
+
+	/* Returns a token, which must be passed to leave() */
+	std::size_t enter();
+	void leave(std::size_t token);
+
+	void retire(void *p, std::size_t size);
+	void synchronize();
+
+private:
+	struct shard {
+		/* numbers of readers which entered in even and odd epochs */
+		std::atomic<std::size_t> readers[2];
+		/* avoids false sharing between neighbouring shards */
+		char padding[64];
+	};
+
+	std::atomic<uint64_t> epoch;
+	std::size_t shards_number;
+	std::unique_ptr<shard[]> shards;
+	deleter_type deleter;
+
+	/* serializes epoch switches, retire() doesn't wait for it */
+	std::mutex sync_mtx;
+
+	std::mutex retired_mtx;
+	std::vector<std::pair<void *, std::size_t>> retired;
+	std::size_t retired_bytes = 0;
+
+	/* declared last, so it's stopped before the other members are destroyed */
+	std::unique_ptr<background_task> task;
+};
+
+/* Keeps the calling thread inside a read of epoch_reclaimer in a scope */
+class epoch_guard {
+public:
+	explicit epoch_guard(epoch_reclaimer &reclaimer)
+	    : reclaimer(reclaimer), token(reclaimer.enter())
+	{
+	}
+
+	~epoch_guard()
+	{
+		reclaimer.leave(token);
+	}
+
+	epoch_guard(const epoch_guard &) = delete;
+	epoch_guard &operator=(const epoch_guard &) = delete;
+
+private:
+	epoch_reclaimer &reclaimer;
+	std::size_t token;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_EPOCH_RECLAIMER_H */
@@ -26,6 +26,7 @@
 
 #include "fast_hash.h"
 #include <endian.h>
+#include <string.h>
 
 /*
  * mix -- (internal) helper for the fast-hash mixing step
@@ -52,9 +53,10 @@ uint64_t fast_hash(size_t key_size, const char *key)
 		h = (h ^ mix(*pos++)) * m;
 
 	if (key_size & 7) {
-		uint64_t shift = (key_size & 7) * 8;
-		uint64_t mask = (1ULL << shift) - 1;
-		uint64_t v = htole64(*pos) & mask;
+		/* copy the tail, not to read past the end of the key */
+		uint64_t v = 0;
+		memcpy(&v, pos, key_size & 7);
+		v = htole64(v);
 		h = (h ^ mix(v)) * m;
 	}
 
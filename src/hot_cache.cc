@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "hot_cache.h"
+
+#include <cstring>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr std::size_t hot_cache::ENTRY_OVERHEAD;
+constexpr std::size_t hot_cache::LRU_SAMPLES;
+
+hot_cache::hot_cache(std::size_t budget, std::size_t shards_number,
+		     eviction_policy policy)
+    : policy(policy),
+      shard_budget(budget / (shards_number ? shards_number : 1)),
+      shards_number(shards_number ? shards_number : 1),
+      shards(new shard[this->shards_number])
+{
+}
+
+/*
+ * Calls callback with the cached value of the key. Returns false (without
+ * calling the callback) if the key is not cached, setting 'generation' (if
+ * not null) to the current generation of its shard.
+ */
+bool hot_cache::get(string_view key, uint64_t hash, get_v_callback *callback, void *arg,
+		    uint64_t *generation)
+{
+	/* value is copied, so the callback doesn't block the shard */
+	static thread_local std::string value;
+
+	auto &s = shard_for(hash);
+	{
+		std::unique_lock<std::mutex> lock(s.mtx);
+		auto it = s.index.find(hash);
+		auto e = it != s.index.end() ? &s.entries[it->second] : nullptr;
+		if (!e || e->key.size() != key.size() ||
+		    std::memcmp(e->key.data(), key.data(), key.size()) != 0) {
+			++s.misses;
+			if (generation)
+				*generation = s.generation;
+			return false;
+		}
+
+		e->referenced = true;
+		e->last_used = ++s.tick;
+		++s.hits;
+		value.assign(e->value);
+	}
+
+	callback(value.data(), value.size(), arg);
+	return true;
+}
+
+/* Caches a copy of the entry, evicting others if the budget is exceeded */
+void hot_cache::put(string_view key, uint64_t hash, string_view value)
+{
+	auto &s = shard_for(hash);
+	std::unique_lock<std::mutex> lock(s.mtx);
+
+	insert(s, key, hash, value);
+}
+
+/*
+ * Like put(), but the entry is cached only if its shard was not invalidated
+ * since get() returned the given generation.
+ */
+void hot_cache::put(string_view key, uint64_t hash, string_view value,
+		    uint64_t generation)
+{
+	auto &s = shard_for(hash);
+	std::unique_lock<std::mutex> lock(s.mtx);
+
+	if (s.generation == generation)
+		insert(s, key, hash, value);
+}
+
+void hot_cache::invalidate(uint64_t hash)
+{
+	auto &s = shard_for(hash);
+	std::unique_lock<std::mutex> lock(s.mtx);
+
+	++s.generation;
+	auto it = s.index.find(hash);
+	if (it != s.index.end())
+		remove_at(s, it->second);
+}
+
+/* Removes all entries, e.g. after a modification of unknown keys */
+void hot_cache::clear()
+{
+	for (std::size_t i = 0; i < shards_number; ++i) {
+		auto &s = shards[i];
+		std::unique_lock<std::mutex> lock(s.mtx);
+
+		++s.generation;
+		s.entries.clear();
+		s.index.clear();
+		s.hand = 0;
+		s.used = 0;
+	}
+}
+
+hot_cache::statistics hot_cache::stats()
+{
+	statistics result;
+	for (std::size_t i = 0; i < shards_number; ++i) {
+		auto &s = shards[i];
+		std::unique_lock<std::mutex> lock(s.mtx);
+
+		result.hits += s.hits;
+		result.misses += s.misses;
+		result.entries += s.entries.size();
+		result.used += s.used;
+	}
+
+	return result;
+}
+
+hot_cache::shard &hot_cache::shard_for(uint64_t hash)
+{
+	/* low bits are used by the index, shard is picked by the high ones */
+	return shards[(hash >> 32) % shards_number];
+}
+
+void hot_cache::insert(shard &s, string_view key, uint64_t hash, string_view value)
+{
+	auto size = key.size() + value.size() + ENTRY_OVERHEAD;
+	if (size > shard_budget)
+		return;
+
+	auto it = s.index.find(hash);
+	if (it != s.index.end())
+		remove_at(s, it->second);
+
+	while (s.used + size > shard_budget)
+		evict(s);
+
+	s.entries.push_back(entry{hash, std::string(key.data(), key.size()),
+				  std::string(value.data(), value.size()), false,
+				  ++s.tick});
+	s.index[hash] = s.entries.size() - 1;
+	s.used += size;
+}
+
+/* Removes one entry, picked by the eviction policy */
+void hot_cache::evict(shard &s)
+{
+	if (s.hand >= s.entries.size())
+		s.hand = 0;
+
+	if (policy == eviction_policy::LRU) {
+		auto victim = s.hand;
+		for (std::size_t i = 1; i < LRU_SAMPLES && i < s.entries.size(); ++i) {
+			auto pos = (s.hand + i) % s.entries.size();
+			if (s.entries[pos].last_used < s.entries[victim].last_used)
+				victim = pos;
+		}
+
+		remove_at(s, victim);
+		s.hand += LRU_SAMPLES;
+		return;
+	}
+
+	while (s.entries[s.hand].referenced) {
+		s.entries[s.hand].referenced = false;
+		if (++s.hand >= s.entries.size())
+			s.hand = 0;
+	}
+
+	remove_at(s, s.hand);
+}
+
+/* Removes entry by moving the last one to its place */
+void hot_cache::remove_at(shard &s, std::size_t pos)
+{
+	auto &e = s.entries[pos];
+	s.used -= e.key.size() + e.value.size() + ENTRY_OVERHEAD;
+	s.index.erase(e.hash);
+
+	if (pos != s.entries.size() - 1) {
+		e = std::move(s.entries.back());
+		s.index[e.hash] = pos;
+	}
+	s.entries.pop_back();
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_HOT_CACHE_H
+#define LIBPMEMKV_HOT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * hot_cache keeps copies of recently read entries in DRAM, up to the given
+ * budget (in bytes, including a fixed per-entry overhead). It's divided into
+ * shards (by the key hash), each protected by its own mutex and evicting
+ * entries with the CLOCK policy (entry which was read since the last pass
+ * of the clock hand gets a second chance) or an approximated LRU (the least
+ * recently read of LRU_SAMPLES entries at the hand is evicted).
+ *
+ * Entries are identified by the 64-bit hash: entry of a different key with
+ * the same hash gets replaced (and invalidated along with the key). Users must
+ * call invalidate() on every modification of the key, in a way which excludes
+ * concurrent put() of the old value (e.g. holding a lock on the record in both
+ * cases). Alternatively, put() can be given the generation returned by
+ * a missed get(): the entry is not cached if the shard was invalidated since
+ * then, so a value read before a concurrent modification can't be cached
+ * after its invalidation.
+ */
+class hot_cache {
+public:
+	static constexpr std::size_t ENTRY_OVERHEAD = 64;
+	static constexpr std::size_t LRU_SAMPLES = 8;
+
+	enum class eviction_policy { CLOCK, LRU };
+
+	struct statistics {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		std::size_t entries = 0;
+		std::size_t used = 0;
+	};
+
+	hot_cache(std::size_t budget, std::size_t shards_number,
+		  eviction_policy policy = eviction_policy::CLOCK);
+
+	hot_cache(const hot_cache &) = delete;
+	hot_cache &operator=(const hot_cache &) = delete;
+
+	bool get(string_view key, uint64_t hash, get_v_callback *callback, void *arg,
+		 uint64_t *generation = nullptr);
+	void put(string_view key, uint64_t hash, string_view value);
+	void put(string_view key, uint64_t hash, string_view value, uint64_t generation);
+	void invalidate(uint64_t hash);
+	void clear();
+
+	statistics stats();
+
+private:
+	struct entry {
+		uint64_t hash;
+		std::string key;
+		std::string value;
+		bool referenced;
+		uint64_t last_used;
+	};
+
+	struct shard {
+		std::mutex mtx;
+		std::vector<entry> entries;
+		/* hash -> position in entries */
+		std::unordered_map<uint64_t, std::size_t> index;
+		std::size_t hand = 0;
+		std::size_t used = 0;
+		/* incremented by every invalidation of the shard */
+		uint64_t generation = 0;
+		/* clock of reads, for LRU */
+		uint64_t tick = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+	};
+
+	shard &shard_for(uint64_t hash);
+	void insert(shard &s, string_view key, uint64_t hash, string_view value);
+	void evict(shard &s);
+	static void remove_at(shard &s, std::size_t pos);
+
+	eviction_policy policy;
+	std::size_t shard_budget;
+	std::size_t shards_number;
+	std::unique_ptr<shard[]> shards;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_HOT_CACHE_H */
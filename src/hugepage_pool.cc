@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "hugepage_pool.h"
+#include "numa.h"
+#include "thread_id.h"
+
+#include <cstdint>
+#include <new>
+#include <thread>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+static std::size_t floor_log2(std::size_t n)
+{
+	return static_cast<std::size_t>(63 - __builtin_clzll(n));
+}
+
+static std::size_t align_up(std::size_t size, std::size_t alignment)
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+hugepage_pool::hugepage_pool(std::size_t page_size, int node)
+    : page_size(page_size),
+      node(node),
+      arena_size(page_size > ARENA_SIZE ? page_size : ARENA_SIZE),
+      shards_number(std::thread::hardware_concurrency()
+			    ? std::thread::hardware_concurrency()
+			    : 1),
+      shards(new shard[shards_number])
+{
+}
+
+hugepage_pool::~hugepage_pool()
+{
+	for (auto &arena : arenas)
+		munmap(arena.first, arena.second);
+}
+
+void *hugepage_pool::allocate(std::size_t bytes)
+{
+	if (bytes > MAX_BLOCK_SIZE)
+		return map(align_up(bytes, static_cast<std::size_t>(sysconf(_SC_PAGESIZE))),
+			   false);
+
+	auto cls = size_class(bytes);
+	auto &s = shards[thread_id() % shards_number];
+
+	std::unique_lock<std::mutex> lock(s.mtx);
+	auto block = s.lists[cls];
+	if (block) {
+		s.lists[cls] = block->next;
+		return block;
+	}
+
+	auto size = class_size(cls);
+	if (static_cast<std::size_t>(s.run_end - s.run_begin) < size)
+		take_run(s);
+
+	void *p = s.run_begin;
+	s.run_begin += size;
+
+	return p;
+}
+
+void hugepage_pool::deallocate(void *p, std::size_t bytes)
+{
+	if (bytes > MAX_BLOCK_SIZE) {
+		munmap(p, align_up(bytes, static_cast<std::size_t>(sysconf(_SC_PAGESIZE))));
+		return;
+	}
+
+	auto cls = size_class(bytes);
+	auto &s = shards[thread_id() % shards_number];
+
+	std::unique_lock<std::mutex> lock(s.mtx);
+	auto block = static_cast<free_block *>(p);
+	block->next = s.lists[cls];
+	s.lists[cls] = block;
+}
+
+/*
+ * Classes 0-7 are multiples of 16 (up to 128 bytes), each next power of two
+ * is split into four classes (160, 192, 224, 256, 320, ...).
+ */
+std::size_t hugepage_pool::size_class(std::size_t bytes)
+{
+	if (bytes <= 8 * MIN_BLOCK_SIZE)
+		return bytes ? (bytes - 1) / MIN_BLOCK_SIZE : 0;
+
+	auto b = bytes - 1;
+	auto shift = floor_log2(b) - 2;
+
+	return 8 + (shift - 5) * 4 + ((b >> shift) - 4);
+}
+
+std::size_t hugepage_pool::class_size(std::size_t cls)
+{
+	if (cls < 8)
+		return (cls + 1) * MIN_BLOCK_SIZE;
+
+	auto k = cls - 8;
+	return (5 + k % 4) << (k / 4 + 5);
+}
+
+/* Maps anonymous memory, of huge pages if 'huge' is set */
+void *hugepage_pool::map(std::size_t size, bool huge)
+{
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	huge = huge && page_size > 0;
+
+	if (huge && use_hugetlb) {
+		auto page_flag = static_cast<int>(floor_log2(page_size) << MAP_HUGE_SHIFT);
+		auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			      flags | MAP_HUGETLB | page_flag, -1, 0);
+		if (p != MAP_FAILED) {
+			if (node >= 0)
+				numa_prefer(p, size, static_cast<std::size_t>(node));
+			return p;
+		}
+
+		/* no (free) reserved huge pages, don't try again */
+		use_hugetlb = false;
+	}
+
+	if (!huge) {
+		auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (p == MAP_FAILED)
+			throw std::bad_alloc();
+
+		if (node >= 0)
+			numa_prefer(p, size, static_cast<std::size_t>(node));
+		return p;
+	}
+
+	/* transparent huge pages are used only for aligned ranges */
+	auto p = mmap(nullptr, size + page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (p == MAP_FAILED)
+		throw std::bad_alloc();
+
+	auto begin = reinterpret_cast<uintptr_t>(p);
+	auto aligned = align_up(begin, page_size);
+	if (aligned > begin)
+		munmap(p, aligned - begin);
+	if (page_size > aligned - begin)
+		munmap(reinterpret_cast<void *>(aligned + size),
+		       page_size - (aligned - begin));
+
+	madvise(reinterpret_cast<void *>(aligned), size, MADV_HUGEPAGE);
+	if (node >= 0)
+		numa_prefer(reinterpret_cast<void *>(aligned), size,
+			    static_cast<std::size_t>(node));
+
+	return reinterpret_cast<void *>(aligned);
+}
+
+/* Gives the shard a new run, the rest of its current run is wasted */
+void hugepage_pool::take_run(shard &s)
+{
+	std::unique_lock<std::mutex> lock(arenas_mtx);
+
+	if (static_cast<std::size_t>(arena_end - arena_begin) < RUN_SIZE) {
+		arenas.reserve(arenas.size() + 1);
+		arena_begin = static_cast<char *>(map(arena_size, true));
+		arena_end = arena_begin + arena_size;
+		arenas.emplace_back(arena_begin, arena_size);
+	}
+
+	s.run_begin = arena_begin;
+	s.run_end = arena_begin + RUN_SIZE;
+	arena_begin += RUN_SIZE;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
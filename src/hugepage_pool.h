@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_HUGEPAGE_POOL_H
+#define LIBPMEMKV_HUGEPAGE_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * hugepage_pool allocates DRAM from big arenas mapped with huge pages of
+ * the given size (2MB or 1GB; 0 means regular pages). If the system has no
+ * reserved huge pages of that size, arenas are mapped with regular pages
+ * and transparent huge pages are requested for them (madvise).
+ *
+ * Small blocks (up to MAX_BLOCK_SIZE bytes) are served in size classes
+ * (every 16 bytes up to 128, then four classes per power of two), from
+ * free lists and runs of arena memory kept in shards, picked by thread_id().
+ * Freed blocks are only put on a free list, memory of arenas is released
+ * (in bulk) when the pool is destroyed. Bigger blocks are mapped separately
+ * and unmapped on deallocate.
+ *
+ * If 'node' is not negative, all mappings prefer memory of that NUMA node.
+ *
+ * Allocation failure is reported by std::bad_alloc.
+ */
+class hugepage_pool {
+public:
+	static constexpr std::size_t MIN_BLOCK_SIZE = 16;
+	static constexpr std::size_t MAX_BLOCK_SIZE = 64 * 1024;
+	static constexpr std::size_t SIZE_CLASSES = 44;
+	static constexpr std::size_t RUN_SIZE = 1 << 20;
+	static constexpr std::size_t ARENA_SIZE = 64 << 20;
+
+	explicit hugepage_pool(std::size_t page_size, int node = -1);
+	~hugepage_pool();
+
+	hugepage_pool(const hugepage_pool &) = delete;
+	hugepage_pool &operator=(const hugepage_pool &) = delete;
+
+	void *allocate(std::size_t bytes);
+	void deallocate(void *p, std::size_t bytes);
+
+private:
+	struct free_block {
+		free_block *next;
+	};
+
+	struct shard {
+		std::mutex mtx;
+		free_block *lists[SIZE_CLASSES] = {};
+		/* unused part of the current run */
+		char *run_begin = nullptr;
+		char *run_end = nullptr;
+		/* avoids false sharing between neighbouring shards */
+		char padding[64];
+	};
+
+	static std::size_t size_class(std::size_t bytes);
+	static std::size_t class_size(std::size_t cls);
+
+	void *map(std::size_t size, bool huge);
+	void take_run(shard &s);
+
+	std::size_t page_size;
+	int node;
+	std::size_t arena_size;
+	std::size_t shards_number;
+	std::unique_ptr<shard[]> shards;
+
+	std::mutex arenas_mtx;
+	std::vector<std::pair<char *, std::size_t>> arenas;
+	char *arena_begin = nullptr;
+	char *arena_end = nullptr;
+	/* cleared when mapping of reserved huge pages fails */
+	bool use_hugetlb = true;
+};
+
+/**
+ * pool_allocator allocates memory from a hugepage_pool shared by all its
+ * copies (and rebound copies), so the pool lives as long as any container
+ * using it.
+ */
+template <typename T>
+class pool_allocator {
+public:
+	using value_type = T;
+	using pointer = T *;
+	using const_pointer = const T *;
+	using reference = T &;
+	using const_reference = const T &;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+
+	template <typename U>
+	struct rebind {
+		using other = pool_allocator<U>;
+	};
+
+	explicit pool_allocator(std::shared_ptr<hugepage_pool> pool) : pool(std::move(pool))
+	{
+	}
+
+	template <typename U>
+	pool_allocator(const pool_allocator<U> &other) : pool(other.pool)
+	{
+	}
+
+	T *allocate(std::size_t n)
+	{
+		static_assert(alignof(T) <= hugepage_pool::MIN_BLOCK_SIZE,
+			      "Type requires bigger alignment than hugepage_pool offers");
+
+		return static_cast<T *>(pool->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, std::size_t n)
+	{
+		pool->deallocate(p, n * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const pool_allocator<U> &other) const
+	{
+		return pool == other.pool;
+	}
+
+	template <typename U>
+	bool operator!=(const pool_allocator<U> &other) const
+	{
+		return !(*this == other);
+	}
+
+private:
+	template <typename U>
+	friend class pool_allocator;
+
+	std::shared_ptr<hugepage_pool> pool;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_HUGEPAGE_POOL_H */
@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_INLINE_STRING_H
+#define LIBPMEMKV_INLINE_STRING_H
+
+#include <cassert>
+#include <cstring>
+
+#include <libpmemobj.h>
+#include <libpmemobj++/pexceptions.hpp>
+#include <libpmemobj++/slice.hpp>
+#include <libpmemobj++/transaction.hpp>
+#include <libpmemobj++/utils.hpp>
+
+#include "libpmemkv.hpp"
+#include "pool_persistence.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * inline_string is a persistent string which stores up to INLINE_CAPACITY
+ * bytes in the object itself and only longer ones in a separate allocation
+ * (whose PMEMoid is then kept in the inline buffer). Data is always
+ * null-terminated.
+ *
+ * It must be constructed, assigned and destroyed in a transaction (as it's
+ * done by containers of libpmemobj-cpp). operator= starts its own transaction.
+ */
+class inline_string {
+public:
+	static constexpr size_t INLINE_CAPACITY = 55;
+
+	inline_string() : size_(0)
+	{
+		data_[0] = '\0';
+	}
+
+	inline_string(string_view s)
+	{
+		init(s);
+	}
+
+	inline_string(const inline_string &s)
+	{
+		init(string_view(s.c_str(), s.size()));
+	}
+
+	~inline_string()
+	{
+		if (is_external())
+			pmemobj_tx_free(external_oid());
+	}
+
+	inline_string &operator=(string_view s)
+	{
+		auto pop = pmem::obj::pool_by_vptr(this);
+		pmem::obj::transaction::run(pop, [&] {
+			pmem::obj::transaction::snapshot(reinterpret_cast<char *>(this),
+							 sizeof(*this));
+			if (is_external())
+				pmemobj_tx_free(external_oid());
+			init(s);
+		});
+
+		return *this;
+	}
+
+	inline_string &operator=(const inline_string &s)
+	{
+		return *this = string_view(s.c_str(), s.size());
+	}
+
+	const char *c_str() const
+	{
+		return is_external() ? static_cast<const char *>(
+					       pmemobj_direct(external_oid()))
+				     : data_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	size_t length() const
+	{
+		return size();
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	bool operator==(string_view rhs) const
+	{
+		return size() == rhs.size() && std::memcmp(c_str(), rhs.data(), size()) == 0;
+	}
+
+	/* Snapshots n bytes starting from p, must be called in a transaction */
+	pmem::obj::slice<char *> range(size_t p, size_t n)
+	{
+		assert(p + n <= size());
+
+		auto data = const_cast<char *>(c_str()) + p;
+		pmem::obj::transaction::snapshot(data, n);
+
+		return {data, data + n};
+	}
+
+private:
+	bool is_external() const
+	{
+		return size_ > INLINE_CAPACITY;
+	}
+
+	PMEMoid external_oid() const
+	{
+		PMEMoid oid;
+		std::memcpy(&oid, data_, sizeof(oid));
+		return oid;
+	}
+
+	/* Sets the content, object must be already added to the transaction */
+	void init(string_view s)
+	{
+		size_ = s.size();
+
+		char *dest = data_;
+		if (is_external()) {
+			/* large data is copied with non-temporal stores, which
+			 * need no flush on commit (only its drain) */
+			auto nt_pop = nontemporal_pool(this, s.size());
+			auto oid = pmemobj_tx_xalloc(
+				s.size() + 1, 0,
+				POBJ_XALLOC_NO_ABORT |
+					(nt_pop ? POBJ_XALLOC_NO_FLUSH : 0));
+			if (OID_IS_NULL(oid))
+				throw pmem::transaction_alloc_error(
+					"Failed to allocate inline_string data");
+
+			std::memcpy(data_, &oid, sizeof(oid));
+			dest = static_cast<char *>(pmemobj_direct(oid));
+
+			if (nt_pop) {
+				pmemobj_memcpy(nt_pop, dest, s.data(), s.size(),
+					       PMEMOBJ_F_MEM_NONTEMPORAL |
+						       PMEMOBJ_F_MEM_NODRAIN);
+				dest[s.size()] = '\0';
+				pmemobj_flush(nt_pop, dest + s.size(), 1);
+				return;
+			}
+		}
+
+		std::memcpy(dest, s.data(), s.size());
+		dest[s.size()] = '\0';
+	}
+
+	uint64_t size_;
+	char data_[INLINE_CAPACITY + 1];
+};
+
+static_assert(sizeof(inline_string) == 64, "Wrong size of inline_string");
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_INLINE_STRING_H */
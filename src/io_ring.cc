@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "io_ring.h"
+#include "exceptions.h"
+#include "thread_id.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* from newer versions of linux/io_uring.h */
+#ifndef IORING_FEAT_SINGLE_MMAP
+#define IORING_FEAT_SINGLE_MMAP (1U << 0)
+#endif
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+static int io_uring_setup(unsigned entries, io_uring_params *p)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+			  unsigned flags)
+{
+	return static_cast<int>(
+		syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static void throw_errno(const std::string &what, int err)
+{
+	throw internal::error(what + ": " + std::strerror(err));
+}
+
+/* Submission and completion rings, shared with the kernel */
+struct io_ring::ring {
+	std::mutex mtx;
+
+	int fd = -1;
+	void *sq_ptr = nullptr;
+	std::size_t sq_size = 0;
+	void *cq_ptr = nullptr;
+	std::size_t cq_size = 0;
+	io_uring_sqe *sqes = nullptr;
+	std::size_t sqes_size = 0;
+
+	unsigned entries = 0;
+	unsigned *sq_tail = nullptr;
+	unsigned *sq_mask = nullptr;
+	unsigned *sq_array = nullptr;
+	unsigned *cq_head = nullptr;
+	unsigned *cq_tail = nullptr;
+	unsigned *cq_mask = nullptr;
+	io_uring_cqe *cqes = nullptr;
+
+	/* vectors of read and write operations of the batch */
+	std::vector<iovec> iovecs;
+
+	/* returns errno on failure */
+	int setup(unsigned n)
+	{
+		io_uring_params p;
+		std::memset(&p, 0, sizeof(p));
+
+		fd = io_uring_setup(n, &p);
+		if (fd < 0)
+			return errno;
+
+		sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+			sq_size = cq_size = std::max(sq_size, cq_size);
+
+		sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sq_ptr == MAP_FAILED) {
+			sq_ptr = nullptr;
+			return errno;
+		}
+
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			cq_ptr = sq_ptr;
+		} else {
+			cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+				      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (cq_ptr == MAP_FAILED) {
+				cq_ptr = nullptr;
+				return errno;
+			}
+		}
+
+		sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+		auto s = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (s == MAP_FAILED)
+			return errno;
+		sqes = static_cast<io_uring_sqe *>(s);
+
+		auto sq = static_cast<char *>(sq_ptr);
+		auto cq = static_cast<char *>(cq_ptr);
+		entries = p.sq_entries;
+		sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+		sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+		sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+		cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+		cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+		iovecs.resize(entries);
+
+		return 0;
+	}
+
+	~ring()
+	{
+		if (sqes)
+			munmap(sqes, sqes_size);
+		if (cq_ptr && cq_ptr != sq_ptr)
+			munmap(cq_ptr, cq_size);
+		if (sq_ptr)
+			munmap(sq_ptr, sq_size);
+		if (fd >= 0)
+			close(fd);
+	}
+};
+
+io_ring::io_ring(int fd, unsigned entries, std::size_t rings_number)
+    : fd(fd), rings_number(rings_number ? rings_number : 1)
+{
+	rings.reset(new ring[this->rings_number]);
+
+	for (std::size_t i = 0; i < this->rings_number; ++i) {
+		if (rings[i].setup(entries ? entries : 1) != 0) {
+			rings.reset();
+			this->rings_number = 0;
+			break;
+		}
+	}
+}
+
+io_ring::~io_ring()
+{
+}
+
+void io_ring::run(io_op *ops, std::size_t n)
+{
+	if (rings_number == 0) {
+		for (std::size_t i = 0; i < n; ++i)
+			run_sync(ops[i], 0);
+		return;
+	}
+
+	auto &r = rings[thread_id() % rings_number];
+	std::unique_lock<std::mutex> lock(r.mtx);
+
+	for (std::size_t i = 0; i < n; i += r.entries)
+		submit(r, ops + i, std::min<std::size_t>(n - i, r.entries));
+}
+
+/* Runs the rest of the operation (from byte 'done') synchronously */
+void io_ring::run_sync(io_op &op, std::size_t done)
+{
+	if (op.op == io_op::type::fsync) {
+		if (fdatasync(fd) != 0)
+			throw_errno("fdatasync failed", errno);
+		return;
+	}
+
+	auto buf = static_cast<char *>(op.buf);
+	while (done < op.size) {
+		auto off = static_cast<off_t>(op.offset + done);
+		auto ret = op.op == io_op::type::read
+			? pread(fd, buf + done, op.size - done, off)
+			: pwrite(fd, buf + done, op.size - done, off);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			throw_errno(op.op == io_op::type::read ? "read failed"
+							       : "write failed",
+				    errno);
+		if (ret == 0 && op.op == io_op::type::read) {
+			std::memset(buf + done, 0, op.size - done);
+			return;
+		}
+		done += static_cast<std::size_t>(ret);
+	}
+}
+
+/*
+ * Fills submission queue entries of the operations (fsync is drained - it
+ * starts after all previous entries complete), submits all of them and
+ * reaps completions until every operation is done.
+ */
+void io_ring::submit(ring &r, io_op *ops, std::size_t n)
+{
+	auto tail = *r.sq_tail;
+	for (std::size_t i = 0; i < n; ++i) {
+		auto idx = tail & *r.sq_mask;
+		auto sqe = &r.sqes[idx];
+		std::memset(sqe, 0, sizeof(*sqe));
+
+		sqe->fd = fd;
+		sqe->user_data = i;
+		if (ops[i].op == io_op::type::fsync) {
+			sqe->opcode = IORING_OP_FSYNC;
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+			sqe->flags = IOSQE_IO_DRAIN;
+		} else {
+			r.iovecs[i].iov_base = ops[i].buf;
+			r.iovecs[i].iov_len = ops[i].size;
+			sqe->opcode = ops[i].op == io_op::type::read ? IORING_OP_READV
+								     : IORING_OP_WRITEV;
+			sqe->addr = reinterpret_cast<uint64_t>(&r.iovecs[i]);
+			sqe->len = 1;
+			sqe->off = ops[i].offset;
+		}
+
+		r.sq_array[idx] = idx;
+		tail++;
+	}
+	__atomic_store_n(r.sq_tail, tail, __ATOMIC_RELEASE);
+
+	std::vector<int> results(n);
+	auto to_submit = static_cast<unsigned>(n);
+	std::size_t completed = 0;
+	while (completed < n) {
+		auto ret = io_uring_enter(r.fd, to_submit,
+					  static_cast<unsigned>(n - completed),
+					  IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			throw_errno("io_uring_enter failed", errno);
+		to_submit -= std::min(to_submit, static_cast<unsigned>(ret));
+
+		auto head = *r.cq_head;
+		auto cq_tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != cq_tail; ++head, ++completed) {
+			auto &cqe = r.cqes[head & *r.cq_mask];
+			results[cqe.user_data] = cqe.res;
+		}
+		__atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	bool resync = false;
+	for (std::size_t i = 0; i < n; ++i) {
+		if (results[i] < 0)
+			throw_errno(ops[i].op == io_op::type::fsync
+					    ? "fdatasync failed"
+					    : (ops[i].op == io_op::type::read ? "read failed"
+									      : "write failed"),
+				    -results[i]);
+		if (ops[i].op != io_op::type::fsync &&
+		    static_cast<std::size_t>(results[i]) < ops[i].size) {
+			run_sync(ops[i], static_cast<std::size_t>(results[i]));
+			resync = true;
+		}
+	}
+
+	/* the rest of a short write could be written after fsync of the batch */
+	if (resync) {
+		for (std::size_t i = 0; i < n; ++i) {
+			if (ops[i].op == io_op::type::fsync) {
+				run_sync(ops[i], 0);
+				break;
+			}
+		}
+	}
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
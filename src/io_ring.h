@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_IO_RING_H
+#define LIBPMEMKV_IO_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Operation of a batch run by io_ring */
+struct io_op {
+	enum class type { read, write, fsync };
+
+	type op;
+	/* buffer and range of the file, unused by fsync */
+	void *buf;
+	std::size_t size;
+	uint64_t offset;
+
+	static io_op read(void *buf, std::size_t size, uint64_t offset)
+	{
+		return io_op{type::read, buf, size, offset};
+	}
+	static io_op write(const void *buf, std::size_t size, uint64_t offset)
+	{
+		return io_op{type::write, const_cast<void *>(buf), size, offset};
+	}
+	/* flushes data of the file, after all previous operations of the batch */
+	static io_op fsync()
+	{
+		return io_op{type::fsync, nullptr, 0, 0};
+	}
+};
+
+/**
+ * Runs batches of I/O operations on a file through io_uring - a whole batch
+ * is submitted by a single system call and completes asynchronously, in any
+ * order, except for fsync, which waits for the operations before it. Rings
+ * are set up by raw system calls, so there's no dependency on liburing.
+ *
+ * If io_uring isn't available (e.g. on kernels older than 5.1, or disabled by
+ * seccomp), the operations are run synchronously, one by one.
+ *
+ * A ring runs a single batch at a time - concurrent batches are spread over
+ * a few rings, picked by thread_id().
+ */
+class io_ring {
+public:
+	/* 'entries' is the maximum number of operations submitted at once */
+	io_ring(int fd, unsigned entries, std::size_t rings = 4);
+	~io_ring();
+
+	io_ring(const io_ring &) = delete;
+	io_ring &operator=(const io_ring &) = delete;
+
+	/*
+	 * Runs all operations and waits for them. Short reads and writes are
+	 * completed synchronously; reads past the end of the file fill the
+	 * rest of the buffer with zeros. Throws internal::error on failure.
+	 */
+	void run(io_op *ops, std::size_t n);
+
+	/* false if operations run synchronously */
+	bool async() const
+	{
+		return rings_number != 0;
+	}
+
+private:
+	struct ring;
+
+	void run_sync(io_op &op, std::size_t done);
+	void submit(ring &r, io_op *ops, std::size_t n);
+
+	int fd;
+	std::size_t rings_number;
+	std::unique_ptr<ring[]> rings;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_IO_RING_H */
@@ -1,7 +1,8 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #include "iterator.h"
+#include "comparator/comparator.h"
 
 namespace pmem
 {
@@ -30,6 +31,23 @@ status iterator_base::seek_higher_eq(string_view key)
 	return status::NOT_SUPPORTED;
 }
 
+/*
+ * Default implementation of seek_prefix - it relies on keys with a common
+ * prefix being ordered next to each other (as they are in binary order).
+ */
+status iterator_base::seek_prefix(string_view prefix)
+{
+	auto s = seek_higher_eq(prefix);
+	if (s != status::OK)
+		return s;
+
+	auto k = key();
+	if (!k.is_ok())
+		return k.get_status();
+
+	return has_prefix(k.get_value(), prefix) ? status::OK : status::NOT_FOUND;
+}
+
 status iterator_base::seek_to_first()
 {
 	return status::NOT_SUPPORTED;
@@ -55,6 +73,16 @@ status iterator_base::prev()
 	return status::NOT_SUPPORTED;
 }
 
+status iterator_base::next_batch(iterator_batch &batch)
+{
+	return status::NOT_SUPPORTED;
+}
+
+status iterator_base::set_upper_bound(const string_view *key)
+{
+	return status::NOT_SUPPORTED;
+}
+
 result<pmem::obj::slice<char *>> iterator_base::write_range(size_t pos, size_t n)
 {
 	return {status::NOT_SUPPORTED};
@@ -70,6 +98,14 @@ void iterator_base::abort()
 	/* by default NOT_SUPPORTED */
 }
 
+/*
+ * By default, iterators hold no locks between calls.
+ */
+void iterator_base::reset()
+{
+	init_seek();
+}
+
 void iterator_base::init_seek()
 {
 	abort();
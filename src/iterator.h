@@ -16,6 +16,88 @@ namespace kv
 {
 namespace internal
 {
+
+/*
+ * Output of iterator_base::next_batch - caller-provided arrays of keys and
+ * values (pointers and sizes) of 'capacity' elements, 'size' of which are set.
+ */
+struct iterator_batch {
+	iterator_batch(const char **keys, size_t *key_sizes, const char **values,
+		       size_t *value_sizes, size_t capacity)
+	    : keys(keys),
+	      key_sizes(key_sizes),
+	      values(values),
+	      value_sizes(value_sizes),
+	      capacity(capacity),
+	      size(0)
+	{
+	}
+
+	bool full() const
+	{
+		return size == capacity;
+	}
+
+	/* Keys-only batches have no arrays for values, engines don't read them */
+	bool keys_only() const
+	{
+		return values == nullptr;
+	}
+
+	void push(string_view key, string_view value)
+	{
+		assert(!full());
+
+		keys[size] = key.data();
+		key_sizes[size] = key.size();
+		if (!keys_only()) {
+			values[size] = value.data();
+			value_sizes[size] = value.size();
+		}
+		++size;
+	}
+
+	const char **keys;
+	size_t *key_sizes;
+	const char **values;
+	size_t *value_sizes;
+	const size_t capacity;
+	size_t size;
+};
+
+/*
+ * Upper bound of an iterator of a sorted engine (set_upper_bound) - a copy of
+ * the key, which the engine compares with its keys by its own comparator.
+ */
+class iterator_bound {
+public:
+	/* Sets the bound or, if key is null, removes it */
+	void set(const string_view *key)
+	{
+		active = key != nullptr;
+		if (active)
+			bound.assign(key->data(), key->size());
+	}
+
+	/* Returns true if the key is not lower than the bound, 'less' compares keys */
+	template <typename Less>
+	bool reached(string_view key, const Less &less) const
+	{
+		return active && !less(key, string_view(bound.data(), bound.size()));
+	}
+
+	/* As above, for engines which order keys bytewise */
+	bool reached(string_view key) const
+	{
+		return active &&
+			key.compare(string_view(bound.data(), bound.size())) >= 0;
+	}
+
+private:
+	std::string bound;
+	bool active = false;
+};
+
 class iterator_base {
 public:
 	virtual ~iterator_base() = default;
@@ -25,6 +107,7 @@ public:
 	virtual status seek_lower_eq(string_view key);
 	virtual status seek_higher(string_view key);
 	virtual status seek_higher_eq(string_view key);
+	virtual status seek_prefix(string_view prefix);
 
 	virtual status seek_to_first();
 	virtual status seek_to_last();
@@ -33,6 +116,20 @@ public:
 	virtual status next();
 	virtual status prev();
 
+	/*
+	 * Fills the batch with the current entry and the following ones (up to
+	 * its capacity) and moves the iterator past the last one returned.
+	 * Returned data is valid until the iterator is moved again.
+	 */
+	virtual status next_batch(iterator_batch &batch);
+
+	/*
+	 * Makes forward moves (seek_higher, seek_higher_eq, seek_to_first, next,
+	 * is_next and next_batch) stop at records with keys not lower than 'key',
+	 * as if it was the end; removes the bound if key is null.
+	 */
+	virtual status set_upper_bound(const string_view *key);
+
 	virtual result<string_view> key() = 0;
 	virtual result<pmem::obj::slice<const char *>> read_range(size_t pos,
 								  size_t n) = 0;
@@ -42,10 +139,103 @@ public:
 	virtual status commit();
 	virtual void abort();
 
+	/*
+	 * Aborts uncommitted changes and releases all locks held by the
+	 * iterator, leaving it on an undefined position - it can be used again
+	 * after a seek. A reset iterator doesn't access the engine when it's
+	 * deleted, so it may outlive it (see the per-thread cache in the C API).
+	 */
+	virtual void reset();
+
+	/* id of the engine which created the iterator, set by the C API */
+	uint64_t engine_id = 0;
+
 protected:
 	virtual void init_seek();
 };
 
+/*
+ * Undo log of a write iterator in the direct mode ("direct_write_range" config
+ * item) - ranges returned by write_range are snapshotted in a pmemobj
+ * transaction and modified in place. The transaction stays open (in the
+ * iterator's thread) until commit or abort, so no other operation on
+ * a pmemobj-based engine may be called by that thread in the meantime.
+ */
+class direct_write_tx {
+public:
+	direct_write_tx(pmem::obj::pool_base &pop) : pop(pop)
+	{
+	}
+
+	~direct_write_tx()
+	{
+		abort();
+	}
+
+	direct_write_tx(const direct_write_tx &) = delete;
+	direct_write_tx &operator=(const direct_write_tx &) = delete;
+
+	bool active() const
+	{
+		return started;
+	}
+
+	/* Starts the transaction (if not yet started) and snapshots the range */
+	pmem::obj::slice<char *> add(const char *data, size_t n)
+	{
+		if (!started) {
+			if (pmemobj_tx_stage() != TX_STAGE_NONE)
+				throw pmem::transaction_scope_error(
+					"Write iterator used inside transaction scope.");
+			if (pmemobj_tx_begin(pop.handle(), nullptr, TX_PARAM_NONE) != 0)
+				throw pmem::transaction_error(
+					"Cannot start write iterator transaction.");
+			started = true;
+		}
+
+		if (pmemobj_tx_add_range_direct(data, n) != 0) {
+			/* the transaction is already aborted */
+			end();
+			throw pmem::transaction_error("Cannot snapshot value range.");
+		}
+
+		auto begin = const_cast<char *>(data);
+		return {begin, begin + n};
+	}
+
+	void commit()
+	{
+		if (!started)
+			return;
+
+		pmemobj_tx_commit();
+		if (end() != 0)
+			throw pmem::transaction_error(
+				"Cannot commit write iterator transaction.");
+	}
+
+	/* Rolls back all snapshotted ranges */
+	void abort()
+	{
+		if (!started)
+			return;
+
+		if (pmemobj_tx_stage() == TX_STAGE_WORK)
+			pmemobj_tx_abort(ECANCELED);
+		end();
+	}
+
+private:
+	int end()
+	{
+		started = false;
+		return pmemobj_tx_end();
+	}
+
+	pmem::obj::pool_base pop;
+	bool started = false;
+};
+
 template <typename It>
 std::size_t distance(It first, It last)
 {
@@ -70,6 +260,21 @@ status iterate_through_pairs(It first, It last, get_kv_callback *callback, void
 	return status::OK;
 }
 
+/**
+ * As above, but only keys are passed to the callback (value is null),
+ * so values of the elements are not accessed.
+ */
+template <typename It>
+status iterate_through_keys(It first, It last, get_kv_callback *callback, void *arg)
+{
+	for (auto it = first; it != last; ++it) {
+		auto ret = callback(it->first.c_str(), it->first.size(), nullptr, 0, arg);
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+	return status::OK;
+}
+
 } /* namespace internal */
 } /* namespace kv */
 } /* namespace pmem */
@@ -5,16 +5,27 @@
 
 #include <sys/stat.h>
 
+#include "async_queue.h"
+#include "catch_status.h"
 #include "comparator/comparator.h"
+#ifdef BUILD_COMPRESSION
+#include "compression.h"
+#endif
 #include "config.h"
+#include "deferred.h"
 #include "engine.h"
 #include "exceptions.h"
 #include "iterator.h"
 #include "libpmemkv.h"
 #include "libpmemkv.hpp"
 #include "libpmemobj++/pexceptions.hpp"
+#include "migrate.h"
 #include "out.h"
+#include "read_cache.h"
+#include "read_only.h"
+#include "stats.h"
 #include "transaction.h"
+#include "ttl.h"
 
 #include <iostream>
 #include <memory>
@@ -22,6 +33,24 @@
 #include <utility>
 #include <vector>
 
+using latency_timer = pmem::kv::internal::latency_timer;
+using persist_scope = pmem::kv::internal::persist_scope;
+using open_stats = pmem::kv::internal::open_stats;
+using open_phase = pmem::kv::internal::open_phase;
+using stats_op = pmem::kv::internal::stats_op;
+#ifdef BUILD_COMPRESSION
+using compression_options = pmem::kv::internal::compression_options;
+using compressed_engine = pmem::kv::internal::compressed_engine;
+#endif
+using read_cache_options = pmem::kv::internal::read_cache_options;
+using deferred_options = pmem::kv::internal::deferred_options;
+using deferred_engine = pmem::kv::internal::deferred_engine;
+using cached_engine = pmem::kv::internal::cached_engine;
+using read_only_engine = pmem::kv::internal::read_only_engine;
+using ttl_options = pmem::kv::internal::ttl_options;
+using ttl_engine = pmem::kv::internal::ttl_engine;
+using pmem::kv::internal::catch_and_return_status;
+
 static inline pmemkv_config *config_from_internal(pmem::kv::internal::config *config)
 {
 	return reinterpret_cast<pmemkv_config *>(config);
@@ -64,6 +93,60 @@ static inline pmem::kv::internal::transaction *tx_to_internal(pmemkv_tx *tx)
 	return reinterpret_cast<pmem::kv::internal::transaction *>(tx);
 }
 
+static inline pmemkv_async *async_from_internal(pmem::kv::internal::async_queue *async)
+{
+	return reinterpret_cast<pmemkv_async *>(async);
+}
+
+static inline pmem::kv::internal::async_queue *async_to_internal(pmemkv_async *async)
+{
+	return reinterpret_cast<pmem::kv::internal::async_queue *>(async);
+}
+
+static inline pmemkv_pinned *
+pinned_from_internal(pmem::kv::internal::pinned_value_base *pinned)
+{
+	return reinterpret_cast<pmemkv_pinned *>(pinned);
+}
+
+static inline pmem::kv::internal::pinned_value_base *
+pinned_to_internal(pmemkv_pinned *pinned)
+{
+	return reinterpret_cast<pmem::kv::internal::pinned_value_base *>(pinned);
+}
+
+/* Samples an access to the key, if "access_sampling" is enabled for the db */
+static inline void record_access(pmemkv_db *db, pmem::kv::string_view key)
+{
+	auto access = db_to_internal(db)->access();
+	if (access)
+		access->record(key);
+}
+
+/* Key with its hash computed by the engine of the database it was created for */
+struct key_handle {
+	pmem::kv::engine_base *engine;
+	std::string key;
+	uint64_t hash;
+};
+
+static inline pmemkv_key_handle *key_handle_from_internal(key_handle *handle)
+{
+	return reinterpret_cast<pmemkv_key_handle *>(handle);
+}
+
+static inline const key_handle *key_handle_to_internal(const pmemkv_key_handle *handle)
+{
+	return reinterpret_cast<const key_handle *>(handle);
+}
+
+/* checks if the handle was created for the database */
+static inline bool key_handle_valid(pmemkv_db *db, const pmemkv_key_handle *handle)
+{
+	return db && handle &&
+		key_handle_to_internal(handle)->engine == db_to_internal(db);
+}
+
 pmem::kv::internal::iterator_base *iterator_to_base(pmemkv_iterator *it)
 {
 	return reinterpret_cast<pmem::kv::internal::iterator_base *>(it);
@@ -75,37 +158,46 @@ iterator_from_internal(pmem::kv::internal::iterator_base *it)
 	return reinterpret_cast<pmemkv_iterator *>(it);
 }
 
-template <typename Function>
-static inline int catch_and_return_status(const char *func_name, Function &&f)
-{
-	int status = PMEMKV_STATUS_UNKNOWN_ERROR;
-	try {
-		status = static_cast<int>(f());
-	} catch (pmem::kv::internal::error &e) {
-		out_err_stream(func_name) << e.what();
-		status = e.status_code;
-	} catch (std::bad_alloc &e) {
-		out_err_stream(func_name) << e.what();
-		status = PMEMKV_STATUS_OUT_OF_MEMORY;
-	} catch (std::runtime_error &e) {
-		out_err_stream(func_name) << e.what();
-		status = PMEMKV_STATUS_UNKNOWN_ERROR;
-	} catch (std::invalid_argument &e) {
-		out_err_stream(func_name) << e.what();
-		status = PMEMKV_STATUS_INVALID_ARGUMENT;
-	} catch (pmem::transaction_scope_error &e) {
-		out_err_stream(func_name) << e.what();
-		status = PMEMKV_STATUS_TRANSACTION_SCOPE_ERROR;
-	} catch (std::exception &e) {
-		out_err_stream(func_name) << e.what();
-		status = PMEMKV_STATUS_UNKNOWN_ERROR;
-	} catch (...) {
-		out_err_stream(func_name) << "Unspecified error";
-		status = PMEMKV_STATUS_UNKNOWN_ERROR;
+/*
+ * Per-thread cache of read iterators, deleted by pmemkv_iterator_delete, which
+ * are reused by pmemkv_iterator_new for the same db (instead of allocating
+ * and setting up new ones). Cached iterators are reset, so they hold no locks
+ * and can be freed also after their db is closed - iterators of closed dbs
+ * are evicted by newer ones (ids of engines are not reused).
+ */
+class iterator_cache {
+public:
+	static const size_t CAPACITY = 4;
+
+	pmem::kv::internal::iterator_base *get(const pmem::kv::engine_base *engine)
+	{
+		for (auto it = entries.begin(); it != entries.end(); ++it) {
+			if ((*it)->engine_id == engine->id()) {
+				auto ret = it->release();
+				entries.erase(it);
+				return ret;
+			}
+		}
+
+		return nullptr;
 	}
-	set_last_status(status);
-	return status;
-}
+
+	void put(pmem::kv::internal::iterator_base *it)
+	{
+		std::unique_ptr<pmem::kv::internal::iterator_base> ptr(it);
+		ptr->reset();
+		ptr->set_upper_bound(nullptr);
+
+		if (entries.size() == CAPACITY)
+			entries.erase(entries.begin());
+		entries.push_back(std::move(ptr));
+	}
+
+private:
+	std::vector<std::unique_ptr<pmem::kv::internal::iterator_base>> entries;
+};
+
+static thread_local iterator_cache thread_iterators;
 
 extern "C" {
 
@@ -114,10 +206,10 @@ pmemkv_config *pmemkv_config_new(void)
 	try {
 		return config_from_internal(new pmem::kv::internal::config);
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 		return nullptr;
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 		return nullptr;
 	}
 }
@@ -127,9 +219,9 @@ void pmemkv_config_delete(pmemkv_config *config)
 	try {
 		delete config_to_internal(config);
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 	}
 }
 
@@ -230,6 +322,17 @@ int pmemkv_config_put_create_if_missing(pmemkv_config *config, bool value)
 					static_cast<std::uint64_t>(value));
 }
 
+int pmemkv_config_put_read_only(pmemkv_config *config, bool value)
+{
+	return pmemkv_config_put_uint64(config, "read_only",
+					static_cast<std::uint64_t>(value));
+}
+
+int pmemkv_config_put_namespace(pmemkv_config *config, const char *value)
+{
+	return pmemkv_config_put_string(config, "namespace", value);
+}
+
 int pmemkv_config_put_comparator(pmemkv_config *config, pmemkv_comparator *comparator)
 {
 	return pmemkv_config_put_object(config, "comparator", comparator,
@@ -306,7 +409,7 @@ pmemkv_comparator *pmemkv_comparator_new(pmemkv_compare_function *fn, const char
 					 void *arg)
 {
 	if (!fn || !name) {
-		ERR() << "comparison function and name must not be NULL";
+		ERR("comparison function and name must not be NULL");
 		return nullptr;
 	}
 
@@ -314,22 +417,34 @@ pmemkv_comparator *pmemkv_comparator_new(pmemkv_compare_function *fn, const char
 		return comparator_from_internal(
 			new pmem::kv::internal::comparator(fn, name, arg));
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 		return nullptr;
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 		return nullptr;
 	}
 }
 
+int pmemkv_comparator_set_key_prefix(pmemkv_comparator *comparator,
+				     pmemkv_key_prefix_function *fn)
+{
+	if (!comparator)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		comparator_to_internal(comparator)->set_key_prefix(fn);
+		return PMEMKV_STATUS_OK;
+	});
+}
+
 void pmemkv_comparator_delete(pmemkv_comparator *comparator)
 {
 	try {
 		delete comparator_to_internal(comparator);
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 	}
 }
 
@@ -339,7 +454,11 @@ int pmemkv_tx_begin(pmemkv_db *db, pmemkv_tx **tx)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
-		*tx = tx_from_internal(db_to_internal(db)->begin_tx());
+		auto internal_tx = db_to_internal(db)->begin_tx();
+		internal_tx->latency = db_to_internal(db)->latency();
+		internal_tx->persist = db_to_internal(db)->persist();
+		internal_tx->slow_ops = db_to_internal(db)->slow_ops();
+		*tx = tx_from_internal(internal_tx);
 		return PMEMKV_STATUS_OK;
 	});
 }
@@ -350,6 +469,7 @@ int pmemkv_tx_put(pmemkv_tx *tx, const char *k, size_t kb, const char *v, size_t
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		tx_to_internal(tx)->user_bytes += kb + vb;
 		return tx_to_internal(tx)->put(pmem::kv::string_view(k, kb),
 					       pmem::kv::string_view(v, vb));
 	});
@@ -361,10 +481,22 @@ int pmemkv_tx_remove(pmemkv_tx *tx, const char *k, size_t kb)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		tx_to_internal(tx)->user_bytes += kb;
 		return tx_to_internal(tx)->remove(pmem::kv::string_view(k, kb));
 	});
 }
 
+int pmemkv_tx_get(pmemkv_tx *tx, const char *k, size_t kb, pmemkv_get_v_callback *c,
+		  void *arg)
+{
+	if (!tx)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return tx_to_internal(tx)->get(pmem::kv::string_view(k, kb), c, arg);
+	});
+}
+
 int pmemkv_tx_commit(pmemkv_tx *tx)
 {
 	if (!tx)
@@ -372,7 +504,14 @@ int pmemkv_tx_commit(pmemkv_tx *tx)
 
 	auto internal_tx = tx_to_internal(tx);
 
-	return catch_and_return_status(__func__, [&] { return internal_tx->commit(); });
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(internal_tx->latency, stats_op::TX_COMMIT,
+				    internal_tx->slow_ops);
+		persist_scope persist(internal_tx->persist, stats_op::TX_COMMIT,
+				      internal_tx->user_bytes);
+		internal_tx->user_bytes = 0;
+		return internal_tx->commit();
+	});
 }
 
 void pmemkv_tx_abort(pmemkv_tx *tx)
@@ -385,9 +524,9 @@ void pmemkv_tx_abort(pmemkv_tx *tx)
 	try {
 		internal_tx->abort();
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 	}
 }
 
@@ -398,9 +537,9 @@ void pmemkv_tx_end(pmemkv_tx *tx)
 	try {
 		delete internal_tx;
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 	}
 }
 
@@ -412,8 +551,83 @@ int pmemkv_open(const char *engine_c_str, pmemkv_config *config, pmemkv_db **db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		/* phases measured by engines are collected in timings */
+		std::unique_ptr<open_stats> timings(new open_stats());
+		open_stats::scope timings_scope(timings.get());
+		open_phase total("total");
+
+		uint64_t latency_stats = 0;
+		uint64_t persist_stats = 0;
+		uint64_t access_sampling = 0;
+		uint64_t slow_op_threshold = 0;
+		if (cfg) {
+			cfg->get_uint64("latency_stats", &latency_stats);
+			cfg->get_uint64("persist_stats", &persist_stats);
+			cfg->get_uint64("access_sampling", &access_sampling);
+			cfg->get_uint64("slow_op_threshold_ns", &slow_op_threshold);
+		}
+
+#ifdef BUILD_COMPRESSION
+		/* the engine may free the config, options are copied */
+		compression_options compression;
+		if (cfg)
+			compression = compression_options::from_config(*cfg);
+#else
+		const char *compression;
+		if (cfg && cfg->get_string("compression", &compression) &&
+		    std::string(compression) != "none")
+			throw pmem::kv::internal::not_supported(
+				"pmemkv was built without compression support");
+#endif
+		read_cache_options read_cache;
+		deferred_options deferred;
+		ttl_options ttl;
+		uint64_t read_only = 0;
+		if (cfg) {
+			read_cache = read_cache_options::from_config(*cfg);
+			deferred = deferred_options::from_config(*cfg);
+			ttl = ttl_options::from_config(*cfg);
+			cfg->get_uint64("read_only", &read_only);
+		}
+		if (read_only)
+			ttl.remove_expired = false;
+		if (read_only && deferred.enabled)
+			throw pmem::kv::internal::invalid_argument(
+				"Flag \"read_only\" can't be set with deferred durability");
+
 		auto engine = pmem::kv::storage_engine_factory::create_engine(
 			engine_c_str, std::move(cfg));
+		if (read_only)
+			engine = std::unique_ptr<pmem::kv::engine_base>(
+				new read_only_engine(std::move(engine)));
+#ifdef BUILD_COMPRESSION
+		if (compression.enabled)
+			engine = std::unique_ptr<pmem::kv::engine_base>(
+				new compressed_engine(std::move(engine), compression));
+#endif
+		/* writes are deferred above compression, so they're compressed in batches */
+		if (deferred.enabled)
+			engine = std::unique_ptr<pmem::kv::engine_base>(
+				new deferred_engine(std::move(engine), deferred));
+		/* cached values are the decompressed ones */
+		if (read_cache.size > 0)
+			engine = std::unique_ptr<pmem::kv::engine_base>(
+				new cached_engine(std::move(engine), read_cache));
+		/* expiration is checked above the cache, which keeps stored values */
+		if (ttl.enabled)
+			engine = std::unique_ptr<pmem::kv::engine_base>(
+				new ttl_engine(std::move(engine), ttl));
+		if (latency_stats)
+			engine->enable_latency_stats();
+		if (persist_stats)
+			engine->enable_persist_stats();
+		if (access_sampling)
+			engine->enable_access_stats(access_sampling);
+		if (slow_op_threshold)
+			engine->enable_slow_op_log(engine_c_str, slow_op_threshold);
+
+		total.end();
+		engine->set_open_timings(std::move(timings));
 
 		*db = db_from_internal(engine.release());
 
@@ -426,9 +640,9 @@ void pmemkv_close(pmemkv_db *db)
 	try {
 		delete db_to_internal(db);
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 	}
 }
 
@@ -498,13 +712,40 @@ int pmemkv_count_between(pmemkv_db *db, const char *k1, size_t kb1, const char *
 	});
 }
 
+int pmemkv_count_between_approx(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+				size_t kb2, size_t *cnt)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->count_between_approx(
+			pmem::kv::string_view(k1, kb1), pmem::kv::string_view(k2, kb2),
+			*cnt);
+	});
+}
+
 int pmemkv_get_all(pmemkv_db *db, pmemkv_get_kv_callback *c, void *arg)
 {
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(
-		__func__, [&] { return db_to_internal(db)->get_all(c, arg); });
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
+		return db_to_internal(db)->get_all(c, arg);
+	});
+}
+
+int pmemkv_get_all_parallel(pmemkv_db *db, size_t partitions, pmemkv_get_kv_callback *c,
+			    void **args)
+{
+	if (!db || partitions == 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
+		return db_to_internal(db)->get_all_parallel(partitions, c, args);
+	});
 }
 
 int pmemkv_get_above(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_callback *c,
@@ -514,6 +755,7 @@ int pmemkv_get_above(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_call
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
 		return db_to_internal(db)->get_above(pmem::kv::string_view(k, kb), c,
 						     arg);
 	});
@@ -526,6 +768,7 @@ int pmemkv_get_equal_above(pmemkv_db *db, const char *k, size_t kb,
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
 		return db_to_internal(db)->get_equal_above(pmem::kv::string_view(k, kb),
 							   c, arg);
 	});
@@ -538,6 +781,7 @@ int pmemkv_get_equal_below(pmemkv_db *db, const char *k, size_t kb,
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
 		return db_to_internal(db)->get_equal_below(pmem::kv::string_view(k, kb),
 							   c, arg);
 	});
@@ -550,6 +794,7 @@ int pmemkv_get_below(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_call
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
 		return db_to_internal(db)->get_below(pmem::kv::string_view(k, kb), c,
 						     arg);
 	});
@@ -562,18 +807,123 @@ int pmemkv_get_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
 		return db_to_internal(db)->get_between(pmem::kv::string_view(k1, kb1),
 						       pmem::kv::string_view(k2, kb2), c,
 						       arg);
 	});
 }
 
+int pmemkv_get_between_parallel(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+				size_t kb2, size_t partitions, pmemkv_get_kv_callback *c,
+				void **args)
+{
+	if (!db || partitions == 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
+		return db_to_internal(db)->get_between_parallel(
+			pmem::kv::string_view(k1, kb1), pmem::kv::string_view(k2, kb2),
+			partitions, c, args);
+	});
+}
+
+int pmemkv_get_above_paged(pmemkv_db *db, const char *k, size_t kb, size_t offset,
+			   size_t limit, pmemkv_get_kv_callback *c, void *arg)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
+		return db_to_internal(db)->get_above_paged(pmem::kv::string_view(k, kb),
+							   offset, limit, c, arg);
+	});
+}
+
+int pmemkv_get_between_paged(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			     size_t kb2, size_t offset, size_t limit,
+			     pmemkv_get_kv_callback *c, void *arg)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
+		return db_to_internal(db)->get_between_paged(
+			pmem::kv::string_view(k1, kb1), pmem::kv::string_view(k2, kb2),
+			offset, limit, c, arg);
+	});
+}
+
+int pmemkv_get_prefix(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_callback *c,
+		      void *arg)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
+		return db_to_internal(db)->get_prefix(pmem::kv::string_view(k, kb), c,
+						      arg);
+	});
+}
+
+int pmemkv_get_keys_all(pmemkv_db *db, pmemkv_get_kv_callback *c, void *arg)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
+		return db_to_internal(db)->get_keys_all(c, arg);
+	});
+}
+
+int pmemkv_get_keys_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			    size_t kb2, pmemkv_get_kv_callback *c, void *arg)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::ITERATE);
+		return db_to_internal(db)->get_keys_between(
+			pmem::kv::string_view(k1, kb1), pmem::kv::string_view(k2, kb2), c,
+			arg);
+	});
+}
+
+int pmemkv_prefetch(pmemkv_db *db, const char *k, size_t kb)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->prefetch(pmem::kv::string_view(k, kb));
+	});
+}
+
+int pmemkv_prefetch_range(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			  size_t kb2)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->prefetch_range(pmem::kv::string_view(k1, kb1),
+							  pmem::kv::string_view(k2, kb2));
+	});
+}
+
 int pmemkv_exists(pmemkv_db *db, const char *k, size_t kb)
 {
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		record_access(db, pmem::kv::string_view(k, kb));
 		return db_to_internal(db)->exists(pmem::kv::string_view(k, kb));
 	});
 }
@@ -585,6 +935,9 @@ int pmemkv_get(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::GET,
+				    db_to_internal(db)->slow_ops(), kb);
+		record_access(db, pmem::kv::string_view(k, kb));
 		return db_to_internal(db)->get(pmem::kv::string_view(k, kb), c, arg);
 	});
 }
@@ -627,6 +980,9 @@ int pmemkv_get_copy(pmemkv_db *db, const char *k, size_t kb, char *buffer,
 		memset(buffer, 0, buffer_size);
 
 	auto ret = catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::GET,
+				    db_to_internal(db)->slow_ops(), kb);
+		record_access(db, pmem::kv::string_view(k, kb));
 		return db_to_internal(db)->get(pmem::kv::string_view(k, kb),
 					       &get_copy_callback, &ctx);
 	});
@@ -637,27 +993,363 @@ int pmemkv_get_copy(pmemkv_db *db, const char *k, size_t kb, char *buffer,
 	return ctx.result;
 }
 
+int pmemkv_get_value_size(pmemkv_db *db, const char *k, size_t kb, size_t *value_size)
+{
+	if (!db || !value_size)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::GET,
+				    db_to_internal(db)->slow_ops(), kb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->value_size(pmem::kv::string_view(k, kb),
+						      *value_size);
+	});
+}
+
+int pmemkv_get_batch(pmemkv_db *db, const char *const *ks, const size_t *kbs, size_t n,
+		     pmemkv_get_kv_callback *c, void *arg)
+{
+	if (!db || (n > 0 && (!ks || !kbs)))
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		std::vector<pmem::kv::string_view> keys;
+		keys.reserve(n);
+		for (size_t i = 0; i < n; ++i) {
+			keys.emplace_back(ks[i], kbs[i]);
+			record_access(db, keys.back());
+		}
+
+		return db_to_internal(db)->get_batch(keys.data(), n, c, arg);
+	});
+}
+
+int pmemkv_get_pinned(pmemkv_db *db, const char *k, size_t kb, pmemkv_pinned **pinned,
+		      const char **value, size_t *valuebytes)
+{
+	if (!db || !pinned || !value || !valuebytes)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		std::unique_ptr<pmem::kv::internal::pinned_value_base> p;
+		record_access(db, pmem::kv::string_view(k, kb));
+		auto s = db_to_internal(db)->get_pinned(pmem::kv::string_view(k, kb), p);
+		if (s != pmem::kv::status::OK)
+			return s;
+
+		auto v = p->value();
+		*value = v.data();
+		*valuebytes = v.size();
+		*pinned = pinned_from_internal(p.release());
+		return pmem::kv::status::OK;
+	});
+}
+
+void pmemkv_pinned_delete(pmemkv_pinned *pinned)
+{
+	if (!pinned)
+		return;
+
+	try {
+		delete pinned_to_internal(pinned);
+	} catch (const std::exception &exc) {
+		ERR(exc.what());
+	} catch (...) {
+		ERR("Unspecified failure");
+	}
+}
+
 int pmemkv_put(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb)
 {
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::PUT,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::PUT,
+				      kb + vb);
+		record_access(db, pmem::kv::string_view(k, kb));
 		return db_to_internal(db)->put(pmem::kv::string_view(k, kb),
 					       pmem::kv::string_view(v, vb));
 	});
 }
 
+int pmemkv_put_ttl(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb,
+		   uint64_t ttl_ms)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::PUT,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::PUT,
+				      kb + vb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->put_ttl(pmem::kv::string_view(k, kb),
+						   pmem::kv::string_view(v, vb), ttl_ms);
+	});
+}
+
+int pmemkv_key_handle_new(pmemkv_db *db, const char *k, size_t kb,
+			  pmemkv_key_handle **handle)
+{
+	if (!db || !handle)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto engine = db_to_internal(db);
+		auto key = pmem::kv::string_view(k, kb);
+		*handle = key_handle_from_internal(new key_handle{
+			engine, std::string(key.data(), key.size()),
+			engine->key_hash(key)});
+		return pmem::kv::status::OK;
+	});
+}
+
+void pmemkv_key_handle_delete(pmemkv_key_handle *handle)
+{
+	delete key_handle_to_internal(handle);
+}
+
+int pmemkv_exists_by_handle(pmemkv_db *db, const pmemkv_key_handle *handle)
+{
+	if (!key_handle_valid(db, handle))
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto h = key_handle_to_internal(handle);
+		record_access(db, h->key);
+		return db_to_internal(db)->exists_hashed(h->key, h->hash);
+	});
+}
+
+int pmemkv_get_by_handle(pmemkv_db *db, const pmemkv_key_handle *handle,
+			 pmemkv_get_v_callback *c, void *arg)
+{
+	if (!key_handle_valid(db, handle))
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto h = key_handle_to_internal(handle);
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::GET,
+				    db_to_internal(db)->slow_ops(), h->key.size());
+		record_access(db, h->key);
+		return db_to_internal(db)->get_hashed(h->key, h->hash, c, arg);
+	});
+}
+
+int pmemkv_put_by_handle(pmemkv_db *db, const pmemkv_key_handle *handle, const char *v,
+			 size_t vb)
+{
+	if (!key_handle_valid(db, handle))
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto h = key_handle_to_internal(handle);
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::PUT,
+				    db_to_internal(db)->slow_ops(), h->key.size());
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::PUT,
+				      h->key.size() + vb);
+		record_access(db, h->key);
+		return db_to_internal(db)->put_hashed(h->key, h->hash,
+						      pmem::kv::string_view(v, vb));
+	});
+}
+
+int pmemkv_put_batch(pmemkv_db *db, const char *const *ks, const size_t *kbs,
+		     const char *const *vs, const size_t *vbs, size_t n)
+{
+	if (!db || (n > 0 && (!ks || !kbs || !vs || !vbs)))
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		std::vector<pmem::kv::string_view> keys;
+		std::vector<pmem::kv::string_view> values;
+		keys.reserve(n);
+		values.reserve(n);
+		uint64_t bytes = 0;
+		for (size_t i = 0; i < n; ++i) {
+			keys.emplace_back(ks[i], kbs[i]);
+			values.emplace_back(vs[i], vbs[i]);
+			bytes += kbs[i] + vbs[i];
+			record_access(db, keys.back());
+		}
+
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::PUT,
+				      bytes);
+		return db_to_internal(db)->put_batch(keys.data(), values.data(), n);
+	});
+}
+
+int pmemkv_update(pmemkv_db *db, const char *k, size_t kb, pmemkv_update_callback *c,
+		  void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::UPDATE,
+				    db_to_internal(db)->slow_ops(), kb);
+		/* size of the new value is not known here, only the key is counted */
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::UPDATE,
+				      kb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->update(pmem::kv::string_view(k, kb), c, arg);
+	});
+}
+
+int pmemkv_read_value(pmemkv_db *db, const char *k, size_t kb, size_t pos, size_t n,
+		      pmemkv_get_v_callback *c, void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::GET,
+				    db_to_internal(db)->slow_ops(), kb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->read_value(pmem::kv::string_view(k, kb), pos,
+						      n, c, arg);
+	});
+}
+
+int pmemkv_write_value(pmemkv_db *db, const char *k, size_t kb, size_t pos,
+		       const char *v, size_t vb)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::UPDATE,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::UPDATE,
+				      vb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->write_value(pmem::kv::string_view(k, kb), pos,
+						       pmem::kv::string_view(v, vb));
+	});
+}
+
+int pmemkv_append_value(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			size_t vb)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::UPDATE,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::UPDATE,
+				      vb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->append_value(pmem::kv::string_view(k, kb),
+							pmem::kv::string_view(v, vb));
+	});
+}
+
+int pmemkv_compare_exchange(pmemkv_db *db, const char *k, size_t kb, const char *e,
+			    size_t eb, const char *v, size_t vb)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::UPDATE,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::UPDATE,
+				      kb + vb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->compare_exchange(pmem::kv::string_view(k, kb),
+							    pmem::kv::string_view(e, eb),
+							    pmem::kv::string_view(v, vb));
+	});
+}
+
+int pmemkv_fetch_add(pmemkv_db *db, const char *k, size_t kb, uint64_t delta,
+		     uint64_t *old_value)
+{
+	if (!db || !old_value)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::UPDATE,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::UPDATE,
+				      kb + sizeof(uint64_t));
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->fetch_add(pmem::kv::string_view(k, kb), delta,
+						     *old_value);
+	});
+}
+
+int pmemkv_put_if_absent(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			 size_t vb, bool *inserted)
+{
+	if (!db || !inserted)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::PUT,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::PUT,
+				      kb + vb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->put_if_absent(pmem::kv::string_view(k, kb),
+							 pmem::kv::string_view(v, vb),
+							 *inserted);
+	});
+}
+
 int pmemkv_remove(pmemkv_db *db, const char *k, size_t kb)
 {
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::REMOVE,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::REMOVE,
+				      kb);
+		record_access(db, pmem::kv::string_view(k, kb));
 		return db_to_internal(db)->remove(pmem::kv::string_view(k, kb));
 	});
 }
 
+int pmemkv_take(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c,
+		void *arg)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::REMOVE,
+				    db_to_internal(db)->slow_ops(), kb);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::REMOVE,
+				      kb);
+		record_access(db, pmem::kv::string_view(k, kb));
+		return db_to_internal(db)->take(pmem::kv::string_view(k, kb), c, arg);
+	});
+}
+
+int pmemkv_remove_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			  size_t kb2, size_t *cnt)
+{
+	if (!db || !cnt)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		latency_timer timer(db_to_internal(db)->latency(), stats_op::REMOVE);
+		persist_scope persist(db_to_internal(db)->persist(), stats_op::REMOVE,
+				      kb1 + kb2);
+		return db_to_internal(db)->remove_between(pmem::kv::string_view(k1, kb1),
+							  pmem::kv::string_view(k2, kb2),
+							  *cnt);
+	});
+}
+
 int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent)
 {
 	if (!db)
@@ -668,13 +1360,216 @@ int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent)
 	});
 }
 
+int pmemkv_sync(pmemkv_db *db)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__,
+				       [&] { return db_to_internal(db)->sync(); });
+}
+
+int pmemkv_stats_get(pmemkv_db *db, pmemkv_stats_callback *c, void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		pmem::kv::internal::stats_sink sink(c, arg);
+		auto s = db_to_internal(db)->stats(sink);
+		if (s != pmem::kv::status::OK)
+			return static_cast<int>(s);
+
+		auto latency = db_to_internal(db)->latency();
+		if (latency)
+			latency->get(sink);
+
+		auto persist = db_to_internal(db)->persist();
+		if (persist)
+			persist->get(sink);
+
+		auto open = db_to_internal(db)->open_timings();
+		if (open)
+			open->get(sink);
+
+		auto access = db_to_internal(db)->access();
+		if (access)
+			access->get(sink);
+
+		auto slow_ops = db_to_internal(db)->slow_ops();
+		if (slow_ops)
+			slow_ops->get(sink);
+
+		return sink.stopped() ? PMEMKV_STATUS_STOPPED_BY_CB : PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_stats_reset(pmemkv_db *db)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto latency = db_to_internal(db)->latency();
+		if (latency)
+			latency->reset();
+
+		auto persist = db_to_internal(db)->persist();
+		if (persist)
+			persist->reset();
+
+		auto access = db_to_internal(db)->access();
+		if (access)
+			access->reset();
+
+		auto slow_ops = db_to_internal(db)->slow_ops();
+		if (slow_ops)
+			slow_ops->reset();
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_snapshot_save(pmemkv_db *db, const char *path)
+{
+	if (!db || !path)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->snapshot_save(std::string(path));
+	});
+}
+
+int pmemkv_snapshot_load(pmemkv_db *db, const char *path)
+{
+	if (!db || !path)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->snapshot_load(std::string(path));
+	});
+}
+
+int pmemkv_snapshot_export(pmemkv_db *db, int fd, uint64_t max_bytes_per_sec)
+{
+	if (!db || fd < 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->snapshot_export(fd, max_bytes_per_sec);
+	});
+}
+
+int pmemkv_migrate(pmemkv_db *src, pmemkv_db *dst, size_t partitions)
+{
+	if (!src || !dst || partitions == 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return pmem::kv::internal::migrate(*db_to_internal(src),
+						   *db_to_internal(dst), partitions);
+	});
+}
+
+int pmemkv_async_new(pmemkv_db *db, unsigned flags, pmemkv_async **async)
+{
+	if (!db || !async || (flags & ~PMEMKV_ASYNC_INLINE_COMPLETION))
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		*async = async_from_internal(new pmem::kv::internal::async_queue(
+			db_to_internal(db), pmem::kv::internal::thread_pool::get_default(),
+			flags & PMEMKV_ASYNC_INLINE_COMPLETION));
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+void pmemkv_async_delete(pmemkv_async *async)
+{
+	try {
+		delete async_to_internal(async);
+	} catch (const std::exception &exc) {
+		ERR(exc.what());
+	} catch (...) {
+		ERR("Unspecified failure");
+	}
+}
+
+int pmemkv_async_get(pmemkv_async *async, const char *k, size_t kb,
+		     pmemkv_async_callback *c, void *arg)
+{
+	if (!async)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		async_to_internal(async)->get(pmem::kv::string_view(k, kb), c, arg);
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_async_put(pmemkv_async *async, const char *k, size_t kb, const char *v,
+		     size_t vb, pmemkv_async_callback *c, void *arg)
+{
+	if (!async)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		async_to_internal(async)->put(pmem::kv::string_view(k, kb),
+					      pmem::kv::string_view(v, vb), c, arg);
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_async_remove(pmemkv_async *async, const char *k, size_t kb,
+			pmemkv_async_callback *c, void *arg)
+{
+	if (!async)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		async_to_internal(async)->remove(pmem::kv::string_view(k, kb), c, arg);
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_async_poll(pmemkv_async *async, size_t max, size_t *completed)
+{
+	if (!async)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto n = async_to_internal(async)->poll(max);
+		if (completed)
+			*completed = n;
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_async_wait(pmemkv_async *async)
+{
+	if (!async)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		async_to_internal(async)->wait();
+		return PMEMKV_STATUS_OK;
+	});
+}
+
 int pmemkv_iterator_new(pmemkv_db *db, pmemkv_iterator **it)
 {
 	if (!db || !it)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
-		*it = iterator_from_internal(db_to_internal(db)->new_const_iterator());
+		auto engine = db_to_internal(db);
+		auto cached = thread_iterators.get(engine);
+		if (!cached) {
+			cached = engine->new_const_iterator();
+			cached->engine_id = engine->id();
+		}
+
+		*it = iterator_from_internal(cached);
 		return PMEMKV_STATUS_OK;
 	});
 }
@@ -702,11 +1597,11 @@ void pmemkv_iterator_delete(pmemkv_iterator *it)
 		return;
 
 	try {
-		delete iterator_to_base(it);
+		thread_iterators.put(iterator_to_base(it));
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 	}
 }
 
@@ -719,12 +1614,23 @@ void pmemkv_write_iterator_delete(pmemkv_write_iterator *it)
 		delete iterator_to_base(it->iter);
 		delete it;
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 	}
 }
 
+int pmemkv_iterator_reset(pmemkv_iterator *it)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		iterator_to_base(it)->reset();
+		return PMEMKV_STATUS_OK;
+	});
+}
+
 int pmemkv_iterator_seek(pmemkv_iterator *it, const char *k, size_t kb)
 {
 	if (!it)
@@ -775,6 +1681,16 @@ int pmemkv_iterator_seek_higher_eq(pmemkv_iterator *it, const char *k, size_t kb
 	});
 }
 
+int pmemkv_iterator_seek_prefix(pmemkv_iterator *it, const char *k, size_t kb)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return iterator_to_base(it)->seek_prefix(pmem::kv::string_view(k, kb));
+	});
+}
+
 int pmemkv_iterator_seek_to_first(pmemkv_iterator *it)
 {
 	if (!it)
@@ -820,6 +1736,38 @@ int pmemkv_iterator_prev(pmemkv_iterator *it)
 				       [&] { return iterator_to_base(it)->prev(); });
 }
 
+int pmemkv_iterator_next_batch(pmemkv_iterator *it, size_t n, const char **k, size_t *kb,
+			       const char **v, size_t *vb, size_t *cnt)
+{
+	/* values are not read if both v and vb are null */
+	if (!it || n == 0 || !k || !kb || !v != !vb || !cnt)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	*cnt = 0;
+
+	return catch_and_return_status(__func__, [&] {
+		pmem::kv::internal::iterator_batch batch(k, kb, v, vb, n);
+		auto s = iterator_to_base(it)->next_batch(batch);
+		*cnt = batch.size;
+
+		return s;
+	});
+}
+
+int pmemkv_iterator_set_upper_bound(pmemkv_iterator *it, const char *k, size_t kb)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		if (!k)
+			return iterator_to_base(it)->set_upper_bound(nullptr);
+
+		pmem::kv::string_view key(k, kb);
+		return iterator_to_base(it)->set_upper_bound(&key);
+	});
+}
+
 int pmemkv_iterator_key(pmemkv_iterator *it, const char **k, size_t *kb)
 {
 	if (!it)
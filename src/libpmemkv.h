@@ -26,11 +26,18 @@ extern "C" {
 #define PMEMKV_STATUS_TRANSACTION_SCOPE_ERROR 10
 #define PMEMKV_STATUS_DEFRAG_ERROR 11
 #define PMEMKV_STATUS_COMPARATOR_MISMATCH 12
+#define PMEMKV_STATUS_TRANSACTION_CONFLICT 13
+#define PMEMKV_STATUS_VALUE_MISMATCH 14
+
+#define PMEMKV_ASYNC_INLINE_COMPLETION (1U << 0)
 
 typedef struct pmemkv_db pmemkv_db;
 typedef struct pmemkv_config pmemkv_config;
 typedef struct pmemkv_comparator pmemkv_comparator;
 typedef struct pmemkv_tx pmemkv_tx;
+typedef struct pmemkv_async pmemkv_async;
+typedef struct pmemkv_pinned pmemkv_pinned;
+typedef struct pmemkv_key_handle pmemkv_key_handle;
 
 typedef struct pmemkv_iterator pmemkv_iterator;
 typedef struct {
@@ -40,12 +47,22 @@ typedef struct {
 typedef int pmemkv_get_kv_callback(const char *key, size_t keybytes, const char *value,
 				   size_t valuebytes, void *arg);
 typedef void pmemkv_get_v_callback(const char *value, size_t valuebytes, void *arg);
+typedef int pmemkv_stats_callback(const char *name, uint64_t value, void *arg);
+typedef int pmemkv_update_callback(const char *value, size_t valuebytes,
+				   const char **new_value, size_t *new_valuebytes,
+				   void *arg);
+
+typedef void pmemkv_async_callback(int status, const char *value, size_t valuebytes,
+				   void *arg);
 
 typedef int pmemkv_compare_function(const char *key1, size_t keybytes1, const char *key2,
 				    size_t keybytes2, void *arg);
+typedef uint64_t pmemkv_key_prefix_function(const char *key, size_t keybytes, void *arg);
 
 pmemkv_comparator *pmemkv_comparator_new(pmemkv_compare_function *fn, const char *name,
 					 void *arg);
+int pmemkv_comparator_set_key_prefix(pmemkv_comparator *comparator,
+				     pmemkv_key_prefix_function *fn);
 void pmemkv_comparator_delete(pmemkv_comparator *comparator);
 
 pmemkv_config *pmemkv_config_new(void);
@@ -72,6 +89,8 @@ int __attribute__((deprecated("use pmemkv_config_put_create_or_error_if_exists i
 pmemkv_config_put_force_create(pmemkv_config *config, bool value);
 int pmemkv_config_put_create_or_error_if_exists(pmemkv_config *config, bool value);
 int pmemkv_config_put_create_if_missing(pmemkv_config *config, bool value);
+int pmemkv_config_put_read_only(pmemkv_config *config, bool value);
+int pmemkv_config_put_namespace(pmemkv_config *config, const char *value);
 int pmemkv_config_put_comparator(pmemkv_config *config, pmemkv_comparator *comparator);
 int pmemkv_config_put_oid(pmemkv_config *config, PMEMoid *oid);
 
@@ -85,8 +104,12 @@ int pmemkv_count_equal_below(pmemkv_db *db, const char *k, size_t kb, size_t *cn
 int pmemkv_count_below(pmemkv_db *db, const char *k, size_t kb, size_t *cnt);
 int pmemkv_count_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
 			 size_t kb2, size_t *cnt);
+int pmemkv_count_between_approx(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+				size_t kb2, size_t *cnt);
 
 int pmemkv_get_all(pmemkv_db *db, pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_get_all_parallel(pmemkv_db *db, size_t partitions, pmemkv_get_kv_callback *c,
+			    void **args);
 int pmemkv_get_above(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_callback *c,
 		     void *arg);
 int pmemkv_get_equal_above(pmemkv_db *db, const char *k, size_t kb,
@@ -97,6 +120,22 @@ int pmemkv_get_below(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_call
 		     void *arg);
 int pmemkv_get_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
 		       size_t kb2, pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_get_between_parallel(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+				size_t kb2, size_t partitions, pmemkv_get_kv_callback *c,
+				void **args);
+int pmemkv_get_prefix(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_callback *c,
+		      void *arg);
+int pmemkv_get_above_paged(pmemkv_db *db, const char *k, size_t kb, size_t offset,
+			   size_t limit, pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_get_between_paged(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			     size_t kb2, size_t offset, size_t limit,
+			     pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_get_keys_all(pmemkv_db *db, pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_get_keys_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			    size_t kb2, pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_prefetch(pmemkv_db *db, const char *k, size_t kb);
+int pmemkv_prefetch_range(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			  size_t kb2);
 
 int pmemkv_exists(pmemkv_db *db, const char *k, size_t kb);
 
@@ -104,11 +143,60 @@ int pmemkv_get(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c
 	       void *arg);
 int pmemkv_get_copy(pmemkv_db *db, const char *k, size_t kb, char *buffer,
 		    size_t buffer_size, size_t *value_size);
+int pmemkv_get_value_size(pmemkv_db *db, const char *k, size_t kb, size_t *value_size);
+int pmemkv_get_batch(pmemkv_db *db, const char *const *ks, const size_t *kbs, size_t n,
+		     pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_get_pinned(pmemkv_db *db, const char *k, size_t kb, pmemkv_pinned **pinned,
+		      const char **value, size_t *valuebytes);
+void pmemkv_pinned_delete(pmemkv_pinned *pinned);
 int pmemkv_put(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb);
+int pmemkv_put_ttl(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb,
+		   uint64_t ttl_ms);
+int pmemkv_put_batch(pmemkv_db *db, const char *const *ks, const size_t *kbs,
+		     const char *const *vs, const size_t *vbs, size_t n);
+
+int pmemkv_key_handle_new(pmemkv_db *db, const char *k, size_t kb,
+			  pmemkv_key_handle **handle);
+void pmemkv_key_handle_delete(pmemkv_key_handle *handle);
+int pmemkv_exists_by_handle(pmemkv_db *db, const pmemkv_key_handle *handle);
+int pmemkv_get_by_handle(pmemkv_db *db, const pmemkv_key_handle *handle,
+			 pmemkv_get_v_callback *c, void *arg);
+int pmemkv_put_by_handle(pmemkv_db *db, const pmemkv_key_handle *handle, const char *v,
+			 size_t vb);
+
+int pmemkv_update(pmemkv_db *db, const char *k, size_t kb, pmemkv_update_callback *c,
+		  void *arg);
+
+int pmemkv_read_value(pmemkv_db *db, const char *k, size_t kb, size_t pos, size_t n,
+		      pmemkv_get_v_callback *c, void *arg);
+int pmemkv_write_value(pmemkv_db *db, const char *k, size_t kb, size_t pos,
+		       const char *v, size_t vb);
+int pmemkv_append_value(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			size_t vb);
+int pmemkv_compare_exchange(pmemkv_db *db, const char *k, size_t kb, const char *e,
+			    size_t eb, const char *v, size_t vb);
+int pmemkv_fetch_add(pmemkv_db *db, const char *k, size_t kb, uint64_t delta,
+		     uint64_t *old_value);
+int pmemkv_put_if_absent(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			 size_t vb, bool *inserted);
 
 int pmemkv_remove(pmemkv_db *db, const char *k, size_t kb);
+int pmemkv_take(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c,
+		void *arg);
+int pmemkv_remove_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			  size_t kb2, size_t *cnt);
 
 int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent);
+int pmemkv_sync(pmemkv_db *db);
+
+int pmemkv_stats_get(pmemkv_db *db, pmemkv_stats_callback *c, void *arg);
+int pmemkv_stats_reset(pmemkv_db *db);
+
+int pmemkv_snapshot_save(pmemkv_db *db, const char *path);
+int pmemkv_snapshot_load(pmemkv_db *db, const char *path);
+int pmemkv_snapshot_export(pmemkv_db *db, int fd, uint64_t max_bytes_per_sec);
+
+int pmemkv_migrate(pmemkv_db *src, pmemkv_db *dst, size_t partitions);
 
 const char *pmemkv_errormsg(void);
 
@@ -116,10 +204,24 @@ const char *pmemkv_errormsg(void);
 int pmemkv_tx_begin(pmemkv_db *db, pmemkv_tx **tx);
 int pmemkv_tx_put(pmemkv_tx *tx, const char *k, size_t kb, const char *v, size_t vb);
 int pmemkv_tx_remove(pmemkv_tx *tx, const char *k, size_t kb);
+int pmemkv_tx_get(pmemkv_tx *tx, const char *k, size_t kb, pmemkv_get_v_callback *c,
+		  void *arg);
 int pmemkv_tx_commit(pmemkv_tx *tx);
 void pmemkv_tx_abort(pmemkv_tx *tx);
 void pmemkv_tx_end(pmemkv_tx *tx);
 
+/* This API is EXPERIMENTAL and might change. */
+int pmemkv_async_new(pmemkv_db *db, unsigned flags, pmemkv_async **async);
+void pmemkv_async_delete(pmemkv_async *async);
+int pmemkv_async_get(pmemkv_async *async, const char *k, size_t kb,
+		     pmemkv_async_callback *c, void *arg);
+int pmemkv_async_put(pmemkv_async *async, const char *k, size_t kb, const char *v,
+		     size_t vb, pmemkv_async_callback *c, void *arg);
+int pmemkv_async_remove(pmemkv_async *async, const char *k, size_t kb,
+			pmemkv_async_callback *c, void *arg);
+int pmemkv_async_poll(pmemkv_async *async, size_t max, size_t *completed);
+int pmemkv_async_wait(pmemkv_async *async);
+
 /* This API is EXPERIMENTAL and might change. */
 int pmemkv_iterator_new(pmemkv_db *db, pmemkv_iterator **it);
 int pmemkv_write_iterator_new(pmemkv_db *db, pmemkv_write_iterator **it);
@@ -127,11 +229,14 @@ int pmemkv_write_iterator_new(pmemkv_db *db, pmemkv_write_iterator **it);
 void pmemkv_iterator_delete(pmemkv_iterator *it);
 void pmemkv_write_iterator_delete(pmemkv_write_iterator *it);
 
+int pmemkv_iterator_reset(pmemkv_iterator *it);
+
 int pmemkv_iterator_seek(pmemkv_iterator *it, const char *k, size_t kb);
 int pmemkv_iterator_seek_lower(pmemkv_iterator *it, const char *k, size_t kb);
 int pmemkv_iterator_seek_lower_eq(pmemkv_iterator *it, const char *k, size_t kb);
 int pmemkv_iterator_seek_higher(pmemkv_iterator *it, const char *k, size_t kb);
 int pmemkv_iterator_seek_higher_eq(pmemkv_iterator *it, const char *k, size_t kb);
+int pmemkv_iterator_seek_prefix(pmemkv_iterator *it, const char *k, size_t kb);
 
 int pmemkv_iterator_seek_to_first(pmemkv_iterator *it);
 int pmemkv_iterator_seek_to_last(pmemkv_iterator *it);
@@ -139,6 +244,9 @@ int pmemkv_iterator_seek_to_last(pmemkv_iterator *it);
 int pmemkv_iterator_is_next(pmemkv_iterator *it);
 int pmemkv_iterator_next(pmemkv_iterator *it);
 int pmemkv_iterator_prev(pmemkv_iterator *it);
+int pmemkv_iterator_next_batch(pmemkv_iterator *it, size_t n, const char **k, size_t *kb,
+			       const char **v, size_t *vb, size_t *cnt);
+int pmemkv_iterator_set_upper_bound(pmemkv_iterator *it, const char *k, size_t kb);
 
 int pmemkv_iterator_key(pmemkv_iterator *it, const char **k, size_t *kb);
 
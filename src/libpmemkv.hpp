@@ -9,10 +9,13 @@
 #include <iostream>
 #include <libpmemobj++/slice.hpp>
 #include <libpmemobj++/string_view.hpp>
+#include <map>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "libpmemkv.h"
 #include <libpmemobj/pool_base.h>
@@ -60,6 +63,16 @@ typedef int get_kv_function(string_view key, string_view value);
  * @param[in] value returned by callback item's data
  */
 typedef void get_v_function(string_view value);
+/**
+ * The C++ idiomatic function type to use for read-modify-write callback
+ * (see db::update()).
+ *
+ * @param[in] value current value of the record or nullptr if it doesn't exist
+ * @param[out] new_value value to be stored in the record
+ *
+ * @return 0 to store new_value, non-zero to leave the record unchanged
+ */
+typedef int update_function(const string_view *value, std::string &new_value);
 
 /**
  * Key-value pair callback, C-style.
@@ -69,6 +82,18 @@ using get_kv_callback = pmemkv_get_kv_callback;
  * Value-only callback, C-style.
  */
 using get_v_callback = pmemkv_get_v_callback;
+/**
+ * Statistics callback, C-style.
+ */
+using stats_callback = pmemkv_stats_callback;
+/**
+ * Completion callback of an asynchronous operation, C-style.
+ */
+using async_callback = pmemkv_async_callback;
+/**
+ * Read-modify-write callback, C-style.
+ */
+using update_callback = pmemkv_update_callback;
 
 /*! \enum status
 	\brief Status returned by most of pmemkv functions.
@@ -110,6 +135,11 @@ enum class status {
 	COMPARATOR_MISMATCH =
 		PMEMKV_STATUS_COMPARATOR_MISMATCH, /**< db was created with a different
 						      comparator */
+	TRANSACTION_CONFLICT =
+		PMEMKV_STATUS_TRANSACTION_CONFLICT, /**< data read by the transaction was
+						       changed before its commit */
+	VALUE_MISMATCH = PMEMKV_STATUS_VALUE_MISMATCH, /**< value of the record is
+							  different than expected */
 };
 
 /**
@@ -135,7 +165,9 @@ inline std::ostream &operator<<(std::ostream &os, const status &s)
 					       "WRONG_ENGINE_NAME",
 					       "TRANSACTION_SCOPE_ERROR",
 					       "DEFRAG_ERROR",
-					       "COMPARATOR_MISMATCH"};
+					       "COMPARATOR_MISMATCH",
+					       "TRANSACTION_CONFLICT",
+					       "VALUE_MISMATCH"};
 
 	int status_no = static_cast<int>(s);
 	os << statuses[status_no] << " (" << status_no << ")";
@@ -468,6 +500,8 @@ public:
 	status put_force_create(bool value) noexcept force_create_deprecated;
 	status put_create_or_error_if_exists(bool value) noexcept;
 	status put_create_if_missing(bool value) noexcept;
+	status put_read_only(bool value) noexcept;
+	status put_namespace(const std::string &name) noexcept;
 	status put_oid(PMEMoid *oid) noexcept;
 	template <typename Comparator>
 	status put_comparator(Comparator &&comparator);
@@ -490,6 +524,36 @@ private:
 	std::unique_ptr<pmemkv_config, decltype(&pmemkv_config_delete)> config_;
 };
 
+namespace internal
+{
+
+/*
+ * Checks if F can be called as a function of type Signature (other than
+ * through std::function, which has its own overloads).
+ */
+template <typename F, typename Signature>
+struct is_callback;
+
+template <typename F, typename R, typename... Args>
+struct is_callback<F, R(Args...)> {
+	template <typename G>
+	static auto test(int) -> std::is_convertible<
+		decltype(std::declval<G &>()(std::declval<Args>()...)), R>;
+	template <typename G>
+	static std::false_type test(...);
+
+	static constexpr bool value = decltype(test<F>(0))::value &&
+		!std::is_same<typename std::decay<F>::type,
+			      std::function<R(Args...)>>::value;
+};
+
+/* Return type of template overloads taking a callable of type Signature */
+template <typename F, typename Signature>
+using enable_if_callback =
+	typename std::enable_if<is_callback<F, Signature>::value, status>::type;
+
+} /* namespace internal */
+
 /*! \class tx
 	\brief Pmemkv transaction handle.
 
@@ -502,6 +566,12 @@ private:
 	durability. Actions in a transaction are executed in the order in which they were
 	called.
 
+	get() returns values written by the transaction itself (if any), otherwise
+	the current value from the database. Engines which keep versions of records
+	(csmap) validate on commit that records read by the transaction were not
+	changed in the meantime - if they were, commit() fails with
+	pmem::kv::status::TRANSACTION_CONFLICT.
+
 	__Example__ usage:
 	@snippet examples/pmemkv_transaction_cpp/pmemkv_transaction.cpp transaction
 */
@@ -511,6 +581,12 @@ public:
 
 	status put(string_view key, string_view value) noexcept;
 	status remove(string_view key) noexcept;
+	status get(string_view key, get_v_callback *callback, void *arg) noexcept;
+	status get(string_view key, std::function<get_v_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_v_function> get(string_view key,
+							  F &&f) noexcept;
+	status get(string_view key, std::string *value) noexcept;
 	status commit() noexcept;
 	void abort() noexcept;
 
@@ -518,6 +594,101 @@ private:
 	std::unique_ptr<pmemkv_tx, decltype(&pmemkv_tx_end)> tx_;
 };
 
+/**
+ * The C++ idiomatic function type to use for completion of an asynchronous
+ * operation. It is used by async_queue.
+ *
+ * @param[in] s status of the completed operation
+ * @param[in] value value of the record (only for successful get, empty otherwise)
+ */
+typedef void async_function(status s, string_view value);
+
+/*! \class async_queue
+	\brief Pmemkv asynchronous submission/completion queue.
+
+	__This API is EXPERIMENTAL and might change.__
+
+	The async_queue class allows submitting get, put and remove operations without
+	waiting for their results. Operations are executed by a thread pool owned by
+	the library (its size can be set using PMEMKV_WORKER_THREADS environment
+	variable). Operations submitted to a single queue are executed one at a time,
+	in order of submission, so the queue may be used with single-threaded engines.
+	Multiple queues may be used to execute operations in parallel (only on
+	concurrent engines).
+
+	When operation is finished its completion function is called. By default,
+	it happens in a thread which calls poll() or wait(). If the queue was created
+	with inline completion, the function is called directly by a worker thread.
+	Completion functions must not throw.
+
+	All queues must be destroyed before the database is closed. Destructor waits
+	for all submitted operations and calls their completion functions.
+*/
+class async_queue {
+public:
+	async_queue(pmemkv_async *async_) noexcept;
+
+	status get(string_view key, async_callback *callback, void *arg) noexcept;
+	status get(string_view key, std::function<async_function> f) noexcept;
+	status put(string_view key, string_view value, async_callback *callback,
+		   void *arg) noexcept;
+	status put(string_view key, string_view value,
+		   std::function<async_function> f) noexcept;
+	status remove(string_view key, async_callback *callback, void *arg) noexcept;
+	status remove(string_view key, std::function<async_function> f) noexcept;
+
+	status poll(std::size_t max, std::size_t &completed) noexcept;
+	status wait() noexcept;
+
+private:
+	std::unique_ptr<pmemkv_async, decltype(&pmemkv_async_delete)> async_;
+};
+
+/*! \class pinned_value
+	\brief Handle to a value of a record, which can be read without copying.
+
+	It's returned by db::get_pinned(). The value is valid until the handle is
+	destroyed or released. Engines which cannot reference the value in place
+	(see libpmemkv(7) for details) return a handle to a copy of the value.
+
+	For cmap engine the record is read-locked while the handle is alive, so it
+	must not be modified (or removed) by the thread which holds the handle.
+	For single-threaded engines the value is valid only until the next
+	modification of the database.
+*/
+class pinned_value {
+public:
+	pinned_value() noexcept;
+	pinned_value(pmemkv_pinned *pinned_, string_view value_) noexcept;
+
+	string_view value() const noexcept;
+	void release() noexcept;
+
+private:
+	std::unique_ptr<pmemkv_pinned, decltype(&pmemkv_pinned_delete)> pinned_;
+	string_view value_;
+};
+
+/*! \class key_handle
+	\brief Key with its hash precomputed by the engine.
+
+	It's returned by db::make_key_handle() and can be passed to db::exists(),
+	db::get() and db::put() instead of the key, to avoid rehashing keys which
+	are looked up repeatedly. A handle holds a copy of the key and may be used
+	only with the database it was created for. Engines which don't hash keys
+	(e.g. sorted ones) accept handles, but gain nothing from them.
+*/
+class key_handle {
+public:
+	key_handle() noexcept;
+	explicit key_handle(pmemkv_key_handle *handle_) noexcept;
+
+	const pmemkv_key_handle *get() const noexcept;
+
+private:
+	std::unique_ptr<pmemkv_key_handle, decltype(&pmemkv_key_handle_delete)> handle_;
+};
+
 /*! \class db
 	\brief Main pmemkv class, it provides functions to operate on data in database.
 
@@ -560,43 +731,171 @@ public:
 	status count_below(string_view key, std::size_t &cnt) noexcept;
 	status count_between(string_view key1, string_view key2,
 			     std::size_t &cnt) noexcept;
+	status count_between_approx(string_view key1, string_view key2,
+				    std::size_t &cnt) noexcept;
 
 	status get_all(get_kv_callback *callback, void *arg) noexcept;
 	status get_all(std::function<get_kv_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function> get_all(F &&f) noexcept;
+
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) noexcept;
+	status get_all_parallel(
+		const std::vector<std::function<get_kv_function>> &fs) noexcept;
 
 	status get_above(string_view key, get_kv_callback *callback, void *arg) noexcept;
 	status get_above(string_view key, std::function<get_kv_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function> get_above(string_view key,
+								    F &&f) noexcept;
 
 	status get_equal_above(string_view key, get_kv_callback *callback,
 			       void *arg) noexcept;
 	status get_equal_above(string_view key,
 			       std::function<get_kv_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function>
+	get_equal_above(string_view key, F &&f) noexcept;
 
 	status get_equal_below(string_view key, get_kv_callback *callback,
 			       void *arg) noexcept;
 	status get_equal_below(string_view key,
 			       std::function<get_kv_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function>
+	get_equal_below(string_view key, F &&f) noexcept;
 
 	status get_below(string_view key, get_kv_callback *callback, void *arg) noexcept;
 	status get_below(string_view key, std::function<get_kv_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function> get_below(string_view key,
+								    F &&f) noexcept;
 
 	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			   void *arg) noexcept;
 	status get_between(string_view key1, string_view key2,
 			   std::function<get_kv_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function>
+	get_between(string_view key1, string_view key2, F &&f) noexcept;
+
+	status get_between_parallel(string_view key1, string_view key2,
+				    std::size_t partitions, get_kv_callback *callback,
+				    void **args) noexcept;
+	status get_between_parallel(
+		string_view key1, string_view key2,
+		const std::vector<std::function<get_kv_function>> &fs) noexcept;
+
+	status get_above_paged(string_view key, std::size_t offset, std::size_t limit,
+			       get_kv_callback *callback, void *arg) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function>
+	get_above_paged(string_view key, std::size_t offset, std::size_t limit,
+			F &&f) noexcept;
+	status get_between_paged(string_view key1, string_view key2, std::size_t offset,
+				 std::size_t limit, get_kv_callback *callback,
+				 void *arg) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function>
+	get_between_paged(string_view key1, string_view key2, std::size_t offset,
+			  std::size_t limit, F &&f) noexcept;
+
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) noexcept;
+	status get_prefix(string_view prefix, std::function<get_kv_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function> get_prefix(string_view prefix,
+								     F &&f) noexcept;
+
+	status get_keys_all(get_kv_callback *callback, void *arg) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function> get_keys_all(F &&f) noexcept;
+	status get_keys_between(string_view key1, string_view key2,
+				get_kv_callback *callback, void *arg) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function>
+	get_keys_between(string_view key1, string_view key2, F &&f) noexcept;
+
+	status prefetch(string_view key) noexcept;
+	status prefetch_range(string_view key1, string_view key2) noexcept;
 
 	status exists(string_view key) noexcept;
 
 	status get(string_view key, get_v_callback *callback, void *arg) noexcept;
 	status get(string_view key, std::function<get_v_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_v_function> get(string_view key,
+							  F &&f) noexcept;
 	status get(string_view key, std::string *value) noexcept;
+	status value_size(string_view key, std::size_t &size) noexcept;
+	result<pinned_value> get_pinned(string_view key) noexcept;
+
+	result<key_handle> make_key_handle(string_view key) noexcept;
+	status exists(const key_handle &key) noexcept;
+	status get(const key_handle &key, get_v_callback *callback, void *arg) noexcept;
+	status get(const key_handle &key, std::function<get_v_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_v_function> get(const key_handle &key,
+							  F &&f) noexcept;
+	status get(const key_handle &key, std::string *value) noexcept;
+	status put(const key_handle &key, string_view value) noexcept;
+
+	status get_batch(const std::vector<string_view> &keys, get_kv_callback *callback,
+			 void *arg) noexcept;
+	status get_batch(const std::vector<string_view> &keys,
+			 std::function<get_kv_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_kv_function>
+	get_batch(const std::vector<string_view> &keys, F &&f) noexcept;
 
 	status put(string_view key, string_view value) noexcept;
+	status put_ttl(string_view key, string_view value, uint64_t ttl_ms) noexcept;
+	status put_batch(const std::vector<string_view> &keys,
+			 const std::vector<string_view> &values) noexcept;
+	status update(string_view key, update_callback *callback, void *arg) noexcept;
+	status update(string_view key, std::function<update_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, update_function> update(string_view key,
+							      F &&f) noexcept;
+
+	status read_value(string_view key, std::size_t pos, std::size_t n,
+			  get_v_callback *callback, void *arg) noexcept;
+	status read_value(string_view key, std::size_t pos, std::size_t n,
+			  std::function<get_v_function> f) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_v_function>
+	read_value(string_view key, std::size_t pos, std::size_t n, F &&f) noexcept;
+	status write_value(string_view key, std::size_t pos, string_view data) noexcept;
+	status append_value(string_view key, string_view data) noexcept;
+	status compare_exchange(string_view key, string_view expected,
+				string_view desired) noexcept;
+	status fetch_add(string_view key, uint64_t delta, uint64_t &old_value) noexcept;
+	status put_if_absent(string_view key, string_view value, bool &inserted) noexcept;
 	status remove(string_view key) noexcept;
+	status take(string_view key, get_v_callback *callback, void *arg) noexcept;
+	template <typename F>
+	internal::enable_if_callback<F, get_v_function> take(string_view key,
+							   F &&f) noexcept;
+	status remove_between(string_view key1, string_view key2,
+			      std::size_t &cnt) noexcept;
 	status defrag(double start_percent = 0, double amount_percent = 100);
+	status sync() noexcept;
+
+	status get_stats(stats_callback *callback, void *arg) noexcept;
+	status get_stats(std::map<std::string, uint64_t> &stats) noexcept;
+	status reset_stats() noexcept;
+
+	status snapshot_save(const std::string &path) noexcept;
+	status snapshot_load(const std::string &path) noexcept;
+	status snapshot_export(int fd, uint64_t max_bytes_per_sec = 0) noexcept;
+
+	status migrate_to(db &destination, std::size_t partitions = 1) noexcept;
 
 	result<tx> tx_begin() noexcept;
 
+	result<async_queue> new_async_queue(bool inline_completion = false) noexcept;
+
 	result<read_iterator> new_read_iterator();
 	result<write_iterator> new_write_iterator();
 
@@ -638,11 +937,14 @@ class db::iterator {
 public:
 	iterator(iterator_type *it);
 
+	status reset() noexcept;
+
 	status seek(string_view key) noexcept;
 	status seek_lower(string_view key) noexcept;
 	status seek_lower_eq(string_view key) noexcept;
 	status seek_higher(string_view key) noexcept;
 	status seek_higher_eq(string_view key) noexcept;
+	status seek_prefix(string_view prefix) noexcept;
 
 	status seek_to_first() noexcept;
 	status seek_to_last() noexcept;
@@ -651,6 +953,13 @@ public:
 	status next() noexcept;
 	status prev() noexcept;
 
+	result<size_t> next_batch(size_t n, string_view *keys,
+				  string_view *values) noexcept;
+	result<size_t> next_batch(size_t n, string_view *keys) noexcept;
+
+	status set_upper_bound(string_view key) noexcept;
+	status clear_upper_bound() noexcept;
+
 	result<string_view> key() noexcept;
 
 	result<string_view>
@@ -674,6 +983,10 @@ private:
 					  decltype(&pmemkv_write_iterator_delete)>::type>
 		it_;
 
+	/* pointers and sizes of keys and values, filled by next_batch */
+	std::vector<const char *> batch_data;
+	std::vector<size_t> batch_sizes;
+
 	pmemkv_iterator *get_raw_it();
 };
 
@@ -926,6 +1239,30 @@ inline status db::iterator<IsConst>::seek_higher_eq(string_view key) noexcept
 		this->get_raw_it(), key.data(), key.size()));
 }
 
+/**
+ * Changes iterator position to the first record with key starting with given
+ * *prefix*. If the record is present and no errors occurred, returns
+ * pmem::kv::status::OK. If the record does not exist, pmem::kv::status::NOT_FOUND
+ * is returned and the iterator position is undefined. Other possible return values
+ * are described in pmem::kv::status.
+ *
+ * Records with keys starting with *prefix* are next to each other only if keys
+ * are ordered by the default (binary) comparator. Iterating with next() does not
+ * stop at the end of the prefix - the caller has to check the keys.
+ *
+ * It internally aborts all changes made to an element previously pointed by the iterator.
+ *
+ * @param[in] prefix prefix of the key of the record on the new iterator position
+ *
+ * @return pmem::kv::status
+ */
+template <bool IsConst>
+inline status db::iterator<IsConst>::seek_prefix(string_view prefix) noexcept
+{
+	return static_cast<status>(pmemkv_iterator_seek_prefix(
+		this->get_raw_it(), prefix.data(), prefix.size()));
+}
+
 /**
  * Changes iterator position to the first record.
  * If db isn't empty, and no errors occurred, returns
@@ -976,6 +1313,24 @@ inline status db::iterator<IsConst>::is_next() noexcept
 	return static_cast<status>(pmemkv_iterator_is_next(this->get_raw_it()));
 }
 
+/**
+ * Releases all locks held by the iterator (and aborts its uncommitted changes),
+ * e.g. to keep it between scans, without blocking writers of elements it
+ * pointed to. After reset the iterator is on an undefined position - it can
+ * be used again after any of seek methods.
+ *
+ * Iterators are cheaper to reuse than to create: deleted read iterators are
+ * also reset and kept in a small per-thread cache, from which they are
+ * reused by db::new_read_iterator() for the same db.
+ *
+ * @return pmem::kv::status
+ */
+template <bool IsConst>
+inline status db::iterator<IsConst>::reset() noexcept
+{
+	return static_cast<status>(pmemkv_iterator_reset(this->get_raw_it()));
+}
+
 /**
  * Changes iterator position to the next record.
  * If the next record exists, returns pmem::kv::status::OK, otherwise
@@ -1014,6 +1369,124 @@ inline status db::iterator<IsConst>::prev() noexcept
 	return static_cast<status>(pmemkv_iterator_prev(this->get_raw_it()));
 }
 
+/**
+ * Reads the current record and the following ones, up to n, in a single call.
+ * Their keys and values are stored in the keys and values arrays (of at least
+ * n elements) and the iterator is moved past the last returned record - on the
+ * next record to process or, if there are no more records, on an undefined
+ * position. It's cheaper than calling db::iterator::next, db::iterator::key
+ * and db::iterator::read_range for each record.
+ *
+ * If any record was read, returns pmem::kv::status::OK and the number of records
+ * in pmem::kv::result, if there are no more records, returns
+ * pmem::kv::status::NOT_FOUND. Returned keys and values are valid until the
+ * iterator is moved again. Engines which don't implement it natively return
+ * pmem::kv::status::NOT_SUPPORTED.
+ *
+ * It internally aborts all changes made to an element previously pointed by the iterator.
+ *
+ * @param[in] n maximal number of records to read
+ * @param[out] keys keys of the read records
+ * @param[out] values values of the read records
+ *
+ * @return pmem::kv::result<size_t>
+ */
+template <bool IsConst>
+inline result<size_t> db::iterator<IsConst>::next_batch(size_t n, string_view *keys,
+							string_view *values) noexcept
+{
+	try {
+		batch_data.resize(2 * n);
+		batch_sizes.resize(2 * n);
+	} catch (std::bad_alloc &) {
+		return {status::OUT_OF_MEMORY};
+	}
+
+	size_t cnt;
+	auto s = static_cast<status>(pmemkv_iterator_next_batch(
+		this->get_raw_it(), n, batch_data.data(), batch_sizes.data(),
+		batch_data.data() + n, batch_sizes.data() + n, &cnt));
+	if (s != status::OK)
+		return {s};
+
+	for (size_t i = 0; i < cnt; i++) {
+		keys[i] = string_view{batch_data[i], batch_sizes[i]};
+		values[i] = string_view{batch_data[n + i], batch_sizes[n + i]};
+	}
+
+	return {cnt};
+}
+
+/**
+ * Reads keys of the current record and the following ones, up to n - like
+ * db::iterator::next_batch(size_t, string_view *, string_view *), but values
+ * of the records are not accessed at all.
+ *
+ * @param[in] n maximal number of records to read
+ * @param[out] keys keys of the read records
+ *
+ * @return pmem::kv::result<size_t>
+ */
+template <bool IsConst>
+inline result<size_t> db::iterator<IsConst>::next_batch(size_t n,
+							string_view *keys) noexcept
+{
+	try {
+		batch_data.resize(n);
+		batch_sizes.resize(n);
+	} catch (std::bad_alloc &) {
+		return {status::OUT_OF_MEMORY};
+	}
+
+	size_t cnt;
+	auto s = static_cast<status>(
+		pmemkv_iterator_next_batch(this->get_raw_it(), n, batch_data.data(),
+					   batch_sizes.data(), nullptr, nullptr, &cnt));
+	if (s != status::OK)
+		return {s};
+
+	for (size_t i = 0; i < cnt; i++)
+		keys[i] = string_view{batch_data[i], batch_sizes[i]};
+
+	return {cnt};
+}
+
+/**
+ * Sets an upper bound of the iterator - records with keys not lower than
+ * the bound are skipped by the engine, as if the iterator reached the end:
+ * db::iterator::seek_higher, db::iterator::seek_higher_eq,
+ * db::iterator::seek_to_first, db::iterator::next and db::iterator::is_next
+ * return pmem::kv::status::NOT_FOUND and db::iterator::next_batch stops
+ * there. It's cheaper than comparing keys of all visited records by the
+ * caller. Other methods are not affected by the bound.
+ *
+ * The key is copied, the bound is kept until it's changed or removed by
+ * db::iterator::clear_upper_bound. Only sorted engines support it, others
+ * return pmem::kv::status::NOT_SUPPORTED.
+ *
+ * @param[in] key exclusive upper bound of keys
+ *
+ * @return pmem::kv::status
+ */
+template <bool IsConst>
+inline status db::iterator<IsConst>::set_upper_bound(string_view key) noexcept
+{
+	return static_cast<status>(pmemkv_iterator_set_upper_bound(
+		this->get_raw_it(), key.data() ? key.data() : "", key.size()));
+}
+
+/**
+ * Removes the upper bound set by db::iterator::set_upper_bound.
+ *
+ * @return pmem::kv::status
+ */
+template <bool IsConst>
+inline status db::iterator<IsConst>::clear_upper_bound() noexcept
+{
+	return static_cast<status>(
+		pmemkv_iterator_set_upper_bound(this->get_raw_it(), nullptr, 0));
+}
+
 /**
  * Returns record's key (pmem::kv::string_view), in
  * pmem::kv::result<pmem::kv::string_view>.
@@ -1187,6 +1660,8 @@ public:
 	{
 	}
 	virtual int compare(string_view key1, string_view key2) = 0;
+	virtual bool has_key_prefix() = 0;
+	virtual std::uint64_t key_prefix(string_view key) = 0;
 };
 
 template <typename Comparator>
@@ -1204,7 +1679,45 @@ struct comparator_wrapper : public comparator_base {
 		return cmp.compare(key1, key2);
 	}
 
+	bool has_key_prefix() override
+	{
+		return has_key_prefix_method<Comparator>(0);
+	}
+
+	std::uint64_t key_prefix(string_view key) override
+	{
+		return call_key_prefix(cmp, key, 0);
+	}
+
 	Comparator cmp;
+
+private:
+	/* key_prefix() of the comparator is optional */
+	template <typename C>
+	static auto has_key_prefix_method(int)
+		-> decltype(std::declval<C &>().key_prefix(string_view()), bool())
+	{
+		return true;
+	}
+
+	template <typename C>
+	static bool has_key_prefix_method(...)
+	{
+		return false;
+	}
+
+	template <typename C>
+	static auto call_key_prefix(C &c, string_view key, int)
+		-> decltype(std::uint64_t(c.key_prefix(key)))
+	{
+		return c.key_prefix(key);
+	}
+
+	template <typename C>
+	static std::uint64_t call_key_prefix(C &, string_view, ...)
+	{
+		return 0;
+	}
 };
 
 struct comparator_config_entry : public unique_ptr_wrapper_base {
@@ -1225,6 +1738,23 @@ struct comparator_config_entry : public unique_ptr_wrapper_base {
 	std::unique_ptr<pmemkv_comparator, decltype(pmemkv_comparator_delete) *> c_cmp;
 };
 
+/*
+ * State of db::update() called with a function - the new value must
+ * outlive the C callback.
+ */
+template <typename F = std::function<update_function>>
+struct update_function_context {
+	F *f;
+	std::string new_value;
+};
+
+/* Passes a callable as an argument of C callback */
+template <typename F>
+inline void *callback_arg(F &f) noexcept
+{
+	return const_cast<void *>(static_cast<const void *>(std::addressof(f)));
+}
+
 /*
  * All functions which will be called by C code must be declared as extern "C"
  * to ensure they have C linkage. It is needed because it is possible that
@@ -1249,6 +1779,12 @@ static inline int call_comparator_function(const char *k1, size_t kb1, const cha
 	auto *cmp = static_cast<comparator_base *>(arg);
 	return cmp->compare(string_view(k1, kb1), string_view(k2, kb2));
 }
+
+static inline std::uint64_t call_key_prefix_function(const char *k, size_t kb, void *arg)
+{
+	auto *cmp = static_cast<comparator_base *>(arg);
+	return cmp->key_prefix(string_view(k, kb));
+}
 } /* extern "C" */
 } /* namespace internal */
 
@@ -1366,6 +1902,12 @@ inline status config::put_object(const std::string &key,
  * - be copy or move constructible
  * - be thread-safe
  *
+ * Comparator may also implement `std::uint64_t key_prefix(pmem::kv::string_view)`,
+ * returning an integer prefix of the key, such that key_prefix(k1) <= key_prefix(k2)
+ * for all keys k1 < k2 (for example, first bytes of the key which are compared
+ * first). Engines which store prefixes next to the keys (vsmap and the index of
+ * stree) call compare() only for keys with equal prefixes.
+ *
  * @param[in] comparator forwarding reference to a comparator
  *
  * @return pmem::kv::status
@@ -1410,6 +1952,13 @@ inline status config::put_comparator(Comparator &&comparator)
 	if (cmp == nullptr)
 		return status::UNKNOWN_ERROR;
 
+	if (wrapper->has_key_prefix()) {
+		auto s = pmemkv_comparator_set_key_prefix(
+			cmp.get(), &internal::call_key_prefix_function);
+		if (s != PMEMKV_STATUS_OK)
+			return static_cast<status>(s);
+	}
+
 	internal::unique_ptr_wrapper_base *entry;
 
 	try {
@@ -1545,6 +2094,36 @@ inline status config::put_create_if_missing(bool value) noexcept
 	return put_uint64("create_if_missing", static_cast<std::uint64_t>(value));
 }
 
+/**
+ * Puts read_only parameter to a config. If true, the pool of a pmemobj-based
+ * engine is opened in copy-on-write mode, so it's never modified and can be
+ * opened read-only by many processes at once. All writes fail with
+ * status::NOT_SUPPORTED. It can't be set together with a create flag.
+ * False by default.
+ *
+ * @return pmem::kv::status
+ */
+inline status config::put_read_only(bool value) noexcept
+{
+	return put_uint64("read_only", static_cast<std::uint64_t>(value));
+}
+
+/**
+ * Puts namespace parameter to a config. The database is opened (or created,
+ * with a create flag) as the named namespace of a pool shared by many
+ * databases, of any pmemobj-based engines, which are open in a single mapping
+ * of the pool. The pool is given by path and created, if it's missing, with
+ * a create flag and size. It can't be set with read_only nor with oid.
+ *
+ * @param[in] name of the namespace
+ *
+ * @return pmem::kv::status
+ */
+inline status config::put_namespace(const std::string &name) noexcept
+{
+	return put_string("namespace", name);
+}
+
 /**
  * Puts PMEMoid object to a config.
  *
@@ -1727,6 +2306,10 @@ inline status tx::put(string_view key, string_view value) noexcept
  * a single power fail-safe atomic action. The tx object can be safely used after
  * commit.
  *
+ * If the engine validates reads and a record read by get() was changed since,
+ * nothing is applied, the transaction is aborted and
+ * pmem::kv::status::TRANSACTION_CONFLICT is returned.
+ *
  * @return pmem::kv::status
  */
 inline status tx::commit() noexcept
@@ -1767,88 +2350,448 @@ static inline void call_get_copy(const char *v, size_t vb, void *arg)
 	auto c = reinterpret_cast<std::string *>(arg);
 	c->assign(v, vb);
 }
+
+static inline int call_update_function(const char *value, size_t valuebytes,
+					const char **new_value, size_t *new_valuebytes,
+					void *arg)
+{
+	auto ctx = reinterpret_cast<internal::update_function_context<> *>(arg);
+	string_view current(value, valuebytes);
+	auto ret = (*ctx->f)(value ? &current : nullptr, ctx->new_value);
+	*new_value = ctx->new_value.data();
+	*new_valuebytes = ctx->new_value.size();
+	return ret;
 }
 
-/**
- * Default constructor with uninitialized database.
- */
-inline db::db() noexcept : db_(nullptr, &pmemkv_close)
+static inline int call_stats_insert(const char *name, uint64_t value, void *arg)
 {
+	(*reinterpret_cast<std::map<std::string, uint64_t> *>(arg))[name] = value;
+	return 0;
 }
 
-/**
- * Opens the pmemkv database with specified config.
- *
- * @param[in] engine_name name of the engine to work with
- * @param[in] cfg pmem::kv::config with parameters specified for the engine
- *
- * @return pmem::kv::status
- */
-inline status db::open(const std::string &engine_name, config &&cfg) noexcept
+/* Calls and deallocates std::function allocated by async_queue methods */
+static inline void call_async_function(int s, const char *value, size_t valuebytes,
+				       void *arg)
 {
-	pmemkv_db *db;
-	auto s =
-		static_cast<status>(pmemkv_open(engine_name.c_str(), cfg.release(), &db));
-	if (s == pmem::kv::status::OK)
-		this->db_.reset(db);
-	return s;
+	std::unique_ptr<std::function<async_function>> f(
+		reinterpret_cast<std::function<async_function> *>(arg));
+	(*f)(static_cast<status>(s), string_view(value, valuebytes));
+}
 }
 
-/**
- * Closes pmemkv database.
+/*
+ * Callbacks of template overloads, which call the callable (passed as arg)
+ * directly, without std::function. Function templates cannot have C linkage,
+ * so these rely on C and C++ functions using the same calling convention,
+ * which holds for all platforms supported by pmemkv.
  */
-inline void db::close() noexcept
+template <typename F>
+static inline int call_get_kv_callable(const char *key, size_t keybytes,
+				       const char *value, size_t valuebytes, void *arg)
 {
-	this->db_.reset(nullptr);
+	return (*static_cast<typename std::remove_reference<F>::type *>(arg))(
+		string_view(key, keybytes), string_view(value, valuebytes));
+}
+
+template <typename F>
+static inline void call_get_v_callable(const char *value, size_t valuebytes, void *arg)
+{
+	(*static_cast<typename std::remove_reference<F>::type *>(arg))(
+		string_view(value, valuebytes));
+}
+
+template <typename F>
+static inline int call_update_callable(const char *value, size_t valuebytes,
+				       const char **new_value, size_t *new_valuebytes,
+				       void *arg)
+{
+	using callable = typename std::remove_reference<F>::type;
+	auto ctx = static_cast<internal::update_function_context<callable> *>(arg);
+	string_view current(value, valuebytes);
+	auto ret = (*ctx->f)(value ? &current : nullptr, ctx->new_value);
+	*new_value = ctx->new_value.data();
+	*new_valuebytes = ctx->new_value.size();
+	return ret;
 }
 
 /**
- * It returns number of currently stored elements in pmem::kv::db.
+ * Executes (C-like) *callback* function for record with given *key*, as seen
+ * by the transaction: if the transaction put the key, its value is passed,
+ * if it removed the key pmem::kv::status::NOT_FOUND is returned, otherwise
+ * the record is read from the database (and, if the engine validates reads,
+ * its version is checked on commit).
  *
- * @param[out] cnt number of records stored in pmem::kv::db.
+ * @param[in] key record's key to query for
+ * @param[in] callback function to be called for returned element
+ * @param[in] arg additional arguments to be passed to callback
  *
  * @return pmem::kv::status
  */
-inline status db::count_all(std::size_t &cnt) noexcept
+inline status tx::get(string_view key, get_v_callback *callback, void *arg) noexcept
 {
-	return static_cast<status>(pmemkv_count_all(this->db_.get(), &cnt));
+	return static_cast<status>(
+		pmemkv_tx_get(tx_.get(), key.data(), key.size(), callback, arg));
 }
 
 /**
- * It returns number of currently stored elements in pmem::kv::db, whose keys
- * are greater than the given *key*.
- * Keys are sorted in order specified by a comparator.
+ * Executes function for record with given *key*, as seen by the transaction
+ * (see the callback variant above).
  *
- * @param[in] key sets the lower bound of counting
- * @param[out] cnt number of records in pmem::kv::db matching query
+ * @param[in] key record's key to query for
+ * @param[in] f function called for returned element, it is called with only
+ *				one param - value (key is known)
  *
  * @return pmem::kv::status
  */
-inline status db::count_above(string_view key, std::size_t &cnt) noexcept
+inline status tx::get(string_view key, std::function<get_v_function> f) noexcept
 {
-	return static_cast<status>(
-		pmemkv_count_above(this->db_.get(), key.data(), key.size(), &cnt));
+	return static_cast<status>(pmemkv_tx_get(tx_.get(), key.data(), key.size(),
+						 call_get_v_function, &f));
 }
 
 /**
- * It returns number of currently stored elements in pmem::kv::db, whose keys
- * are greater than or equal to the given *key*.
- * Keys are sorted in order specified by a comparator.
+ * Executes callable *f* for record with given *key*, as seen by the
+ * transaction - see get(string_view, std::function<get_v_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
  *
- * @param[in] key sets the lower bound of counting
- * @param[out] cnt number of records in pmem::kv::db matching query
+ * @param[in] key record's key to query for
+ * @param[in] f callable invoked for returned element, with the value
  *
  * @return pmem::kv::status
  */
-inline status db::count_equal_above(string_view key, std::size_t &cnt) noexcept
+template <typename F>
+inline internal::enable_if_callback<F, get_v_function> tx::get(string_view key,
+								F &&f) noexcept
 {
-	return static_cast<status>(
-		pmemkv_count_equal_above(this->db_.get(), key.data(), key.size(), &cnt));
+	return get(key, call_get_v_callable<F>, internal::callback_arg(f));
 }
 
 /**
- * It returns number of currently stored elements in pmem::kv::db, whose keys
- * are lower than or equal to the given *key*.
+ * Gets value copy of record with given *key*, as seen by the transaction
+ * (see the callback variant above).
+ *
+ * @param[in] key record's key to query for
+ * @param[out] value stores returned copy of the data
+ *
+ * @return pmem::kv::status
+ */
+inline status tx::get(string_view key, std::string *value) noexcept
+{
+	return static_cast<status>(pmemkv_tx_get(tx_.get(), key.data(), key.size(),
+						 call_get_copy, value));
+}
+
+/**
+ * Constructs C++ async_queue object from a C pmemkv_async pointer
+ */
+inline async_queue::async_queue(pmemkv_async *async_) noexcept
+    : async_(async_, &pmemkv_async_delete)
+{
+}
+
+/**
+ * Submits get operation. Callback is called with status::OK and record's value
+ * or with status::NOT_FOUND if there is no such record.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] callback function to be called when the operation is completed
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status of the submission
+ */
+inline status async_queue::get(string_view key, async_callback *callback,
+			       void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_async_get(async_.get(), key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Submits get operation. Function is called with status::OK and record's value
+ * or with status::NOT_FOUND if there is no such record.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] f function to be called when the operation is completed
+ *
+ * @return pmem::kv::status of the submission
+ */
+inline status async_queue::get(string_view key, std::function<async_function> f) noexcept
+{
+	std::function<async_function> *arg;
+	try {
+		arg = new std::function<async_function>(std::move(f));
+	} catch (std::bad_alloc &e) {
+		return status::OUT_OF_MEMORY;
+	} catch (...) {
+		return status::UNKNOWN_ERROR;
+	}
+
+	auto s = get(key, call_async_function, arg);
+	if (s != status::OK)
+		delete arg;
+
+	return s;
+}
+
+/**
+ * Submits put operation. Key and value are copied, so they do not have to
+ * be valid after this call.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be inserted
+ * @param[in] callback function to be called when the operation is completed
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status of the submission
+ */
+inline status async_queue::put(string_view key, string_view value,
+			       async_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_async_put(async_.get(), key.data(),
+						    key.size(), value.data(),
+						    value.size(), callback, arg));
+}
+
+/**
+ * Submits put operation. Key and value are copied, so they do not have to
+ * be valid after this call.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be inserted
+ * @param[in] f function to be called when the operation is completed
+ *
+ * @return pmem::kv::status of the submission
+ */
+inline status async_queue::put(string_view key, string_view value,
+			       std::function<async_function> f) noexcept
+{
+	std::function<async_function> *arg;
+	try {
+		arg = new std::function<async_function>(std::move(f));
+	} catch (std::bad_alloc &e) {
+		return status::OUT_OF_MEMORY;
+	} catch (...) {
+		return status::UNKNOWN_ERROR;
+	}
+
+	auto s = put(key, value, call_async_function, arg);
+	if (s != status::OK)
+		delete arg;
+
+	return s;
+}
+
+/**
+ * Submits remove operation.
+ *
+ * @param[in] key record's key to be removed
+ * @param[in] callback function to be called when the operation is completed
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status of the submission
+ */
+inline status async_queue::remove(string_view key, async_callback *callback,
+				  void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_async_remove(async_.get(), key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Submits remove operation.
+ *
+ * @param[in] key record's key to be removed
+ * @param[in] f function to be called when the operation is completed
+ *
+ * @return pmem::kv::status of the submission
+ */
+inline status async_queue::remove(string_view key,
+				  std::function<async_function> f) noexcept
+{
+	std::function<async_function> *arg;
+	try {
+		arg = new std::function<async_function>(std::move(f));
+	} catch (std::bad_alloc &e) {
+		return status::OUT_OF_MEMORY;
+	} catch (...) {
+		return status::UNKNOWN_ERROR;
+	}
+
+	auto s = remove(key, call_async_function, arg);
+	if (s != status::OK)
+		delete arg;
+
+	return s;
+}
+
+/**
+ * Calls completion functions of at most *max* finished operations in the
+ * calling thread. Does not block.
+ *
+ * @param[in] max maximum number of completions to process
+ * @param[out] completed number of processed completions
+ *
+ * @return pmem::kv::status
+ */
+inline status async_queue::poll(std::size_t max, std::size_t &completed) noexcept
+{
+	return static_cast<status>(pmemkv_async_poll(async_.get(), max, &completed));
+}
+
+/**
+ * Blocks until all submitted operations are executed. Completion functions
+ * still have to be processed by poll() (unless inline completion is used).
+ *
+ * @return pmem::kv::status
+ */
+inline status async_queue::wait() noexcept
+{
+	return static_cast<status>(pmemkv_async_wait(async_.get()));
+}
+
+/**
+ * Constructs empty pinned_value.
+ */
+inline pinned_value::pinned_value() noexcept : pinned_(nullptr, &pmemkv_pinned_delete)
+{
+}
+
+/**
+ * Constructs C++ pinned_value object from a C pmemkv_pinned pointer
+ * and the value it refers to.
+ */
+inline pinned_value::pinned_value(pmemkv_pinned *pinned_, string_view value_) noexcept
+    : pinned_(pinned_, &pmemkv_pinned_delete), value_(value_)
+{
+}
+
+/**
+ * Returns the pinned value. It's valid until the object is destroyed
+ * or released.
+ *
+ * @return record's value
+ */
+inline string_view pinned_value::value() const noexcept
+{
+	return value_;
+}
+
+/**
+ * Releases the value (and a lock held on the record, if any) before
+ * the object is destroyed. After that, value() returns an empty string_view.
+ */
+inline void pinned_value::release() noexcept
+{
+	pinned_.reset();
+	value_ = string_view();
+}
+
+/**
+ * Constructs empty key_handle.
+ */
+inline key_handle::key_handle() noexcept : handle_(nullptr, &pmemkv_key_handle_delete)
+{
+}
+
+/**
+ * Constructs C++ key_handle object from a C pmemkv_key_handle pointer.
+ */
+inline key_handle::key_handle(pmemkv_key_handle *handle_) noexcept
+    : handle_(handle_, &pmemkv_key_handle_delete)
+{
+}
+
+/**
+ * Returns the C handle (owned by this object).
+ *
+ * @return pointer to pmemkv_key_handle
+ */
+inline const pmemkv_key_handle *key_handle::get() const noexcept
+{
+	return handle_.get();
+}
+
+/**
+ * Default constructor with uninitialized database.
+ */
+inline db::db() noexcept : db_(nullptr, &pmemkv_close)
+{
+}
+
+/**
+ * Opens the pmemkv database with specified config.
+ *
+ * @param[in] engine_name name of the engine to work with
+ * @param[in] cfg pmem::kv::config with parameters specified for the engine
+ *
+ * @return pmem::kv::status
+ */
+inline status db::open(const std::string &engine_name, config &&cfg) noexcept
+{
+	pmemkv_db *db;
+	auto s =
+		static_cast<status>(pmemkv_open(engine_name.c_str(), cfg.release(), &db));
+	if (s == pmem::kv::status::OK)
+		this->db_.reset(db);
+	return s;
+}
+
+/**
+ * Closes pmemkv database.
+ */
+inline void db::close() noexcept
+{
+	this->db_.reset(nullptr);
+}
+
+/**
+ * It returns number of currently stored elements in pmem::kv::db.
+ *
+ * @param[out] cnt number of records stored in pmem::kv::db.
+ *
+ * @return pmem::kv::status
+ */
+inline status db::count_all(std::size_t &cnt) noexcept
+{
+	return static_cast<status>(pmemkv_count_all(this->db_.get(), &cnt));
+}
+
+/**
+ * It returns number of currently stored elements in pmem::kv::db, whose keys
+ * are greater than the given *key*.
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key sets the lower bound of counting
+ * @param[out] cnt number of records in pmem::kv::db matching query
+ *
+ * @return pmem::kv::status
+ */
+inline status db::count_above(string_view key, std::size_t &cnt) noexcept
+{
+	return static_cast<status>(
+		pmemkv_count_above(this->db_.get(), key.data(), key.size(), &cnt));
+}
+
+/**
+ * It returns number of currently stored elements in pmem::kv::db, whose keys
+ * are greater than or equal to the given *key*.
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key sets the lower bound of counting
+ * @param[out] cnt number of records in pmem::kv::db matching query
+ *
+ * @return pmem::kv::status
+ */
+inline status db::count_equal_above(string_view key, std::size_t &cnt) noexcept
+{
+	return static_cast<status>(
+		pmemkv_count_equal_above(this->db_.get(), key.data(), key.size(), &cnt));
+}
+
+/**
+ * It returns number of currently stored elements in pmem::kv::db, whose keys
+ * are lower than or equal to the given *key*.
  * Keys are sorted in order specified by a comparator.
  *
  * @param[in] key sets the lower bound of counting
@@ -1897,6 +2840,28 @@ inline status db::count_between(string_view key1, string_view key2,
 							key2.size(), &cnt));
 }
 
+/**
+ * Estimates number of elements in pmem::kv::db, whose keys are greater than
+ * the *key1* and less than the *key2*, e.g. for planning of queries.
+ * Sorted engines which can estimate it from the shape of their trees (stree)
+ * don't walk over the range, so it takes logarithmic time; error bounds of
+ * the estimates are described in engines' documentation. Other engines
+ * return the exact count, as count_between() does.
+ *
+ * @param[in] key1 sets the lower bound of counting
+ * @param[in] key2 sets the upper bound of counting
+ * @param[out] cnt estimated number of records in pmem::kv::db matching query
+ *
+ * @return pmem::kv::status
+ */
+inline status db::count_between_approx(string_view key1, string_view key2,
+				       std::size_t &cnt) noexcept
+{
+	return static_cast<status>(pmemkv_count_between_approx(
+		this->db_.get(), key1.data(), key1.size(), key2.data(), key2.size(),
+		&cnt));
+}
+
 /**
  * Executes (C-like) *callback* function for every record stored in pmem::kv::db.
  * Arguments passed to the callback function are: pointer to a key, size of the
@@ -1931,26 +2896,103 @@ inline status db::get_all(std::function<get_kv_function> f) noexcept
 }
 
 /**
- * Executes (C-like) callback function for every record stored in pmem::kv::db,
- * whose keys are greater than the given *key*.
- * Arguments passed to the callback function are: pointer to a key, size of the
- * key, pointer to a value, size of the value and *arg* specified by the user.
- * Callback can stop iteration by returning non-zero value. In that case *get_above()*
- * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ * Executes callable *f* for every record stored in pmem::kv::db - see
+ * get_all(std::function<get_kv_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
  *
- * Keys are sorted in order specified by a comparator.
+ * @param[in] f callable invoked for each returned element, with key and value
  *
- * @param[in] key sets the lower bound for querying
- * @param[in] callback function to be called for each returned element
- * @param[in] arg additional arguments to be passed to callback
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_all(F &&f) noexcept
+{
+	return get_all(call_get_kv_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) *callback* function for every record stored in pmem::kv::db,
+ * scanning it in parallel. Records are split into at most *partitions* disjoint
+ * parts, each one scanned by a separate thread; records of partition *i* are
+ * passed to the callback along with args[i] (or nullptr if *args* is null).
+ * Callback may be called concurrently for different partitions.
+ * Engines which do not support parallel scans visit all records in the first
+ * partition, as get_all() does. Sorted engines split records into ranges of
+ * keys: each partition is visited in order and all keys of partition *i* are
+ * lower than keys of partition *i + 1*.
+ *
+ * Callback can stop iteration by returning non-zero value. In that case scans
+ * of all partitions are stopped and *get_all_parallel()* returns
+ * pmem::kv::status::STOPPED_BY_CB.
+ *
+ * @param[in] partitions maximum number of parallel scans, must be greater than 0
+ * @param[in] callback function to be called for every element stored in db
+ * @param[in] args array of *partitions* arguments to be passed to callback
  *
  * @return pmem::kv::status
  */
-inline status db::get_above(string_view key, get_kv_callback *callback,
-			    void *arg) noexcept
+inline status db::get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				   void **args) noexcept
 {
 	return static_cast<status>(
-		pmemkv_get_above(this->db_.get(), key.data(), key.size(), callback, arg));
+		pmemkv_get_all_parallel(this->db_.get(), partitions, callback, args));
+}
+
+/**
+ * Executes functions for every record stored in pmem::kv::db, scanning it in
+ * parallel. Records are split into at most fs.size() disjoint parts, each one
+ * scanned by a separate thread, which calls the function of its index.
+ * Function can stop iteration by returning non-zero value. In that case scans
+ * of all partitions are stopped and *get_all_parallel()* returns
+ * pmem::kv::status::STOPPED_BY_CB.
+ *
+ * @param[in] fs functions (one per partition) called for each returned element,
+ *				with params: key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status
+db::get_all_parallel(const std::vector<std::function<get_kv_function>> &fs) noexcept
+{
+	std::vector<void *> args;
+
+	try {
+		args.reserve(fs.size());
+	} catch (std::bad_alloc &e) {
+		return status::OUT_OF_MEMORY;
+	} catch (...) {
+		return status::UNKNOWN_ERROR;
+	}
+
+	for (auto &f : fs)
+		args.push_back(const_cast<std::function<get_kv_function> *>(&f));
+
+	return get_all_parallel(fs.size(), call_get_kv_function, args.data());
+}
+
+/**
+ * Executes (C-like) callback function for every record stored in pmem::kv::db,
+ * whose keys are greater than the given *key*.
+ * Arguments passed to the callback function are: pointer to a key, size of the
+ * key, pointer to a value, size of the value and *arg* specified by the user.
+ * Callback can stop iteration by returning non-zero value. In that case *get_above()*
+ * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ *
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key sets the lower bound for querying
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_above(string_view key, get_kv_callback *callback,
+			    void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get_above(this->db_.get(), key.data(), key.size(), callback, arg));
 }
 
 /**
@@ -1973,6 +3015,24 @@ inline status db::get_above(string_view key, std::function<get_kv_function> f) n
 		this->db_.get(), key.data(), key.size(), call_get_kv_function, &f));
 }
 
+/**
+ * Executes callable *f* for every record whose key is greater than *key* - see
+ * get_above(string_view, std::function<get_kv_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] key sets the lower bound for query
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_above(string_view key, F &&f) noexcept
+{
+	return get_above(key, call_get_kv_callable<F>, internal::callback_arg(f));
+}
+
 /**
  * Executes (C-like) callback function for every record stored in pmem::kv::db,
  * whose keys are greater than or equal to the given *key*.
@@ -2012,245 +3072,1309 @@ inline status db::get_equal_above(string_view key, get_kv_callback *callback,
  *
  * @return pmem::kv::status
  */
-inline status db::get_equal_above(string_view key,
-				  std::function<get_kv_function> f) noexcept
+inline status db::get_equal_above(string_view key,
+				  std::function<get_kv_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get_equal_above(
+		this->db_.get(), key.data(), key.size(), call_get_kv_function, &f));
+}
+
+/**
+ * Executes callable *f* for every record whose key is greater than or equal
+ * to *key* - see get_equal_above(string_view, std::function<get_kv_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] key sets the lower bound for query
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_equal_above(string_view key, F &&f) noexcept
+{
+	return get_equal_above(key, call_get_kv_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) callback function for every record stored in pmem::kv::db,
+ * whose keys are lower than or equal to the given *key*.
+ * Arguments passed to the callback function are: pointer to a key, size of the
+ * key, pointer to a value, size of the value and *arg* specified by the user.
+ * Callback can stop iteration by returning non-zero value. In that case
+ * *get_equal_below()* returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues
+ * iteration.
+ *
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key sets the upper bound for querying
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_equal_below(string_view key, get_kv_callback *callback,
+				  void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_get_equal_below(this->db_.get(), key.data(),
+							  key.size(), callback, arg));
+}
+
+/**
+ * Executes function for every record stored in pmem::kv::db, whose keys are
+ * lower than or equal to the given *key*.
+ * Callback can stop iteration by returning non-zero value. In that case
+ **get_equal_below()* returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues
+ *iteration.
+ *
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key sets the upper bound for querying
+ * @param[in] f function called for each returned element, it is called with params:
+ *				key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_equal_below(string_view key,
+				  std::function<get_kv_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get_equal_below(
+		this->db_.get(), key.data(), key.size(), call_get_kv_function, &f));
+}
+
+/**
+ * Executes callable *f* for every record whose key is lower than or equal to *key* - see
+ * get_equal_below(string_view, std::function<get_kv_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] key sets the upper bound for query
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_equal_below(string_view key, F &&f) noexcept
+{
+	return get_equal_below(key, call_get_kv_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) callback function for every record stored in pmem::kv::db,
+ * whose keys are lower than the given *key*.
+ * Arguments passed to the callback function are: pointer to a key, size of the
+ * key, pointer to a value, size of the value and *arg* specified by the user.
+ * Callback can stop iteration by returning non-zero value. In that case *get_below()*
+ * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ *
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key sets the upper bound for querying
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_below(string_view key, get_kv_callback *callback,
+			    void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get_below(this->db_.get(), key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Executes function for every record stored in pmem::kv::db, whose keys are
+ * less than the given *key*.
+ * Callback can stop iteration by returning non-zero value. In that case *get_below()*
+ * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ *
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key sets the upper bound for querying
+ * @param[in] f function called for each returned element, it is called with params:
+ *				key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_below(string_view key, std::function<get_kv_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get_below(
+		this->db_.get(), key.data(), key.size(), call_get_kv_function, &f));
+}
+
+/**
+ * Executes callable *f* for every record whose key is lower than *key* - see
+ * get_below(string_view, std::function<get_kv_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] key sets the upper bound for query
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_below(string_view key, F &&f) noexcept
+{
+	return get_below(key, call_get_kv_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) callback function for every record stored in pmem::kv::db,
+ * whose keys are greater than the *key1* and less than the *key2*.
+ * Arguments passed to the callback function are: pointer to a key, size of the
+ * key, pointer to a value, size of the value and *arg* specified by the user.
+ * Callback can stop iteration by returning non-zero value. In that case *get_between()*
+ * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ *
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key1 sets the lower bound for querying
+ * @param[in] key2 sets the upper bound for querying
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_between(string_view key1, string_view key2,
+			      get_kv_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_get_between(this->db_.get(), key1.data(),
+						      key1.size(), key2.data(),
+						      key2.size(), callback, arg));
+}
+/**
+ * Executes function for every record stored in pmem::kv::db, whose keys
+ * are greater than the *key1* and less than the *key2*.
+ * Callback can stop iteration by returning non-zero value. In that case *get_between()*
+ * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ *
+ * Keys are sorted in order specified by a comparator.
+ *
+ * @param[in] key1 sets the lower bound for querying
+ * @param[in] key2 sets the upper bound for querying
+ * @param[in] f function called for each returned element, it is called with params:
+ *				key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_between(string_view key1, string_view key2,
+			      std::function<get_kv_function> f) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get_between(this->db_.get(), key1.data(), key1.size(), key2.data(),
+				   key2.size(), call_get_kv_function, &f));
+}
+
+/**
+ * Executes callable *f* for every record whose key is greater than *key1* and
+ * lower than *key2* - see
+ * get_between(string_view, string_view, std::function<get_kv_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] key1 sets the lower bound for query
+ * @param[in] key2 sets the upper bound for query
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_between(string_view key1, string_view key2, F &&f) noexcept
+{
+	return get_between(key1, key2, call_get_kv_callable<F>,
+			   internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) *callback* function for every record stored in pmem::kv::db,
+ * whose keys are greater than the *key1* and less than the *key2*, scanning
+ * them in parallel, like get_all_parallel() does for all records. The range
+ * is split into at most *partitions* subranges of keys, each one visited in
+ * order by a separate thread; records of partition *i* are passed to the
+ * callback along with args[i] (or nullptr if *args* is null) and all their
+ * keys are lower than keys of partition *i + 1*. Engines which do not support
+ * parallel range scans visit the whole range in the first partition, as
+ * get_between() does.
+ *
+ * Callback can stop iteration by returning non-zero value. In that case scans
+ * of all partitions are stopped and *get_between_parallel()* returns
+ * pmem::kv::status::STOPPED_BY_CB.
+ *
+ * @param[in] key1 lower bound for comparison
+ * @param[in] key2 upper bound for comparison
+ * @param[in] partitions maximum number of parallel scans, must be greater than 0
+ * @param[in] callback function to be called for each returned element
+ * @param[in] args array of *partitions* arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_between_parallel(string_view key1, string_view key2,
+				       std::size_t partitions, get_kv_callback *callback,
+				       void **args) noexcept
+{
+	return static_cast<status>(pmemkv_get_between_parallel(
+		this->db_.get(), key1.data(), key1.size(), key2.data(), key2.size(),
+		partitions, callback, args));
+}
+
+/**
+ * Executes functions for every record stored in pmem::kv::db, whose keys are
+ * greater than the *key1* and less than the *key2*, scanning them in parallel.
+ * The range is split into at most fs.size() subranges, each one scanned by
+ * a separate thread, which calls the function of its index.
+ * Function can stop iteration by returning non-zero value. In that case scans
+ * of all partitions are stopped and *get_between_parallel()* returns
+ * pmem::kv::status::STOPPED_BY_CB.
+ *
+ * @param[in] key1 lower bound for comparison
+ * @param[in] key2 upper bound for comparison
+ * @param[in] fs functions (one per partition) called for each returned element,
+ *				with params: key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_between_parallel(
+	string_view key1, string_view key2,
+	const std::vector<std::function<get_kv_function>> &fs) noexcept
+{
+	std::vector<void *> args;
+
+	try {
+		args.reserve(fs.size());
+	} catch (std::bad_alloc &e) {
+		return status::OUT_OF_MEMORY;
+	} catch (...) {
+		return status::UNKNOWN_ERROR;
+	}
+
+	for (auto &f : fs)
+		args.push_back(const_cast<std::function<get_kv_function> *>(&f));
+
+	return get_between_parallel(key1, key2, fs.size(), call_get_kv_function,
+				    args.data());
+}
+
+/**
+ * Executes (C-like) *callback* function for a page of records whose keys are
+ * greater than the *key* - like get_above(), but the first *offset* records are
+ * skipped and the scan stops after *limit* records were passed to the callback.
+ * Engines which keep sizes of subtrees (vsmap with "b_tree" set) find both ends
+ * of the page in logarithmic time, so reading page N costs O(log n + limit).
+ * Other sorted engines skip the records internally, without calling the callback.
+ *
+ * Callback can stop iteration by returning non-zero value. In that case
+ * *get_above_paged()* returns pmem::kv::status::STOPPED_BY_CB. Reaching the limit
+ * (or the end of the range) returns pmem::kv::status::OK.
+ *
+ * @param[in] key sets the lower bound for querying
+ * @param[in] offset number of records to skip
+ * @param[in] limit maximum number of records passed to the callback
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_above_paged(string_view key, std::size_t offset,
+				  std::size_t limit, get_kv_callback *callback,
+				  void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_get_above_paged(
+		this->db_.get(), key.data(), key.size(), offset, limit, callback, arg));
+}
+
+/**
+ * Executes callable *f* for a page of records whose keys are greater than
+ * the *key* - see get_above_paged(string_view, std::size_t, std::size_t,
+ * get_kv_callback *, void *).
+ *
+ * @param[in] key sets the lower bound for querying
+ * @param[in] offset number of records to skip
+ * @param[in] limit maximum number of records passed to the callable
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_above_paged(string_view key, std::size_t offset, std::size_t limit,
+		    F &&f) noexcept
+{
+	return get_above_paged(key, offset, limit, call_get_kv_callable<F>,
+			       internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) *callback* function for a page of records whose keys are
+ * greater than the *key1* and less than the *key2* - like get_between(), but
+ * the first *offset* records of the range are skipped and the scan stops after
+ * *limit* records were passed to the callback. See get_above_paged().
+ *
+ * @param[in] key1 sets the lower bound for querying
+ * @param[in] key2 sets the upper bound for querying
+ * @param[in] offset number of records to skip
+ * @param[in] limit maximum number of records passed to the callback
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_between_paged(string_view key1, string_view key2,
+				    std::size_t offset, std::size_t limit,
+				    get_kv_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_get_between_paged(
+		this->db_.get(), key1.data(), key1.size(), key2.data(), key2.size(),
+		offset, limit, callback, arg));
+}
+
+/**
+ * Executes callable *f* for a page of records whose keys are greater than
+ * the *key1* and less than the *key2* - see get_between_paged(string_view,
+ * string_view, std::size_t, std::size_t, get_kv_callback *, void *).
+ *
+ * @param[in] key1 sets the lower bound for querying
+ * @param[in] key2 sets the upper bound for querying
+ * @param[in] offset number of records to skip
+ * @param[in] limit maximum number of records passed to the callable
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_between_paged(string_view key1, string_view key2, std::size_t offset,
+		      std::size_t limit, F &&f) noexcept
+{
+	return get_between_paged(key1, key2, offset, limit, call_get_kv_callable<F>,
+				 internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) callback function for every record stored in pmem::kv::db,
+ * whose keys start with the given *prefix*.
+ * Arguments passed to the callback function are: pointer to a key, size of the
+ * key, pointer to a value, size of the value and *arg* specified by the user.
+ * Callback can stop iteration by returning non-zero value. In that case *get_prefix()*
+ * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ *
+ * Sorted engines with the default (binary) comparator visit only the records
+ * with matching keys, in order. Other engines scan all records.
+ *
+ * @param[in] prefix prefix of keys of the returned records
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_prefix(string_view prefix, get_kv_callback *callback,
+			     void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_get_prefix(this->db_.get(), prefix.data(),
+						     prefix.size(), callback, arg));
+}
+
+/**
+ * Executes function for every record stored in pmem::kv::db, whose keys
+ * start with the given *prefix*.
+ * Callback can stop iteration by returning non-zero value. In that case *get_prefix()*
+ * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ *
+ * Sorted engines with the default (binary) comparator visit only the records
+ * with matching keys, in order. Other engines scan all records.
+ *
+ * @param[in] prefix prefix of keys of the returned records
+ * @param[in] f function called for each returned element, it is called with params:
+ *				key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_prefix(string_view prefix,
+			     std::function<get_kv_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get_prefix(this->db_.get(), prefix.data(),
+						     prefix.size(), call_get_kv_function,
+						     &f));
+}
+
+/**
+ * Executes callable *f* for every record whose key starts with *prefix* - see
+ * get_prefix(string_view, std::function<get_kv_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] prefix prefix of keys to query for
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_prefix(string_view prefix, F &&f) noexcept
+{
+	return get_prefix(prefix, call_get_kv_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) *callback* function for every record stored in pmem::kv::db,
+ * like get_all(), but only keys are passed to it - the value is null and of
+ * size 0. cmap, csmap, stree and vsmap don't read values at all, so it's
+ * cheaper than get_all() for engines which keep values out of line (e.g. for
+ * rebuilding an index of keys). Other engines drop values before calling
+ * the callback.
+ *
+ * Callback can stop iteration by returning non-zero value. In that case
+ * *get_keys_all()* returns pmem::kv::status::STOPPED_BY_CB.
+ *
+ * @param[in] callback function to be called for every element stored in db
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_keys_all(get_kv_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_get_keys_all(this->db_.get(), callback, arg));
+}
+
+/**
+ * Executes callable *f* for key of every record stored in pmem::kv::db - see
+ * get_keys_all(get_kv_callback *, void *). The value passed to *f* is empty.
+ *
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_keys_all(F &&f) noexcept
+{
+	return get_keys_all(call_get_kv_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Executes (C-like) *callback* function for every record whose key is greater
+ * than the *key1* and less than the *key2*, like get_between(), but only keys
+ * are passed to it - see get_keys_all(get_kv_callback *, void *).
+ *
+ * @param[in] key1 sets the lower bound for querying
+ * @param[in] key2 sets the upper bound for querying
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_keys_between(string_view key1, string_view key2,
+				   get_kv_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_get_keys_between(this->db_.get(), key1.data(),
+							   key1.size(), key2.data(),
+							   key2.size(), callback, arg));
+}
+
+/**
+ * Executes callable *f* for keys of records between *key1* and *key2* - see
+ * get_keys_between(string_view, string_view, get_kv_callback *, void *).
+ *
+ * @param[in] key1 sets the lower bound for querying
+ * @param[in] key2 sets the upper bound for querying
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_keys_between(string_view key1, string_view key2, F &&f) noexcept
+{
+	return get_keys_between(key1, key2, call_get_kv_callable<F>,
+				internal::callback_arg(f));
+}
+
+/**
+ * Hints that record with given *key* will be read soon. The request is queued
+ * and a thread of the shared background pool looks the key up and prefetches
+ * its value, so a following read finds it in the last level CPU cache. It
+ * returns without waiting for the prefetch.
+ *
+ * It's implemented by stree, csmap and radix.
+ *
+ * @param[in] key record's key to be prefetched
+ *
+ * @return pmem::kv::status
+ */
+inline status db::prefetch(string_view key) noexcept
+{
+	return static_cast<status>(
+		pmemkv_prefetch(this->db_.get(), key.data(), key.size()));
+}
+
+/**
+ * Hints that records with keys in range [*key1*, *key2*] (both included) will
+ * be read soon, e.g. before a latency sensitive batch of reads of the range -
+ * see prefetch(string_view). Nodes of the range are walked and values
+ * prefetched in the background, it returns without waiting for the walk.
+ *
+ * It's implemented by stree, csmap and radix.
+ *
+ * @param[in] key1 the first key of the range
+ * @param[in] key2 the last key of the range
+ *
+ * @return pmem::kv::status
+ */
+inline status db::prefetch_range(string_view key1, string_view key2) noexcept
+{
+	return static_cast<status>(pmemkv_prefetch_range(this->db_.get(), key1.data(),
+							 key1.size(), key2.data(),
+							 key2.size()));
+}
+
+/**
+ * Checks existence of record with given *key*. If record is present
+ * pmem::kv::status::OK is returned, otherwise pmem::kv::status::NOT_FOUND
+ * is returned. Other possible return values are described in pmem::kv::status.
+ *
+ * @param[in] key record's key to query for in database
+ *
+ * @return pmem::kv::status
+ */
+inline status db::exists(string_view key) noexcept
+{
+	return static_cast<status>(
+		pmemkv_exists(this->db_.get(), key.data(), key.size()));
+}
+
+/**
+ * Executes (C-like) *callback* function for record with given *key*. If
+ * record is present and no error occurred, the function returns
+ * pmem::kv::status::OK. If record does not exist pmem::kv::status::NOT_FOUND
+ * is returned. Other possible return values are described in pmem::kv::status.
+ * *Callback* is called with the following parameters:
+ * pointer to a value, size of the value and *arg* specified by the user.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] callback function to be called for returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get(string_view key, get_v_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get(this->db_.get(), key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Executes function for record with given *key*. If record is present and
+ * no error occurred the function returns pmem::kv::status::OK. If record does
+ * not exist pmem::kv::status::NOT_FOUND is returned.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] f function called for returned element, it is called with only
+ *				one param - value (key is known)
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get(string_view key, std::function<get_v_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get(this->db_.get(), key.data(), key.size(),
+					      call_get_v_function, &f));
+}
+
+/**
+ * Executes callable *f* for record with given *key* - see
+ * get(string_view, std::function<get_v_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] key record's key to query for
+ * @param[in] f callable invoked for returned element, with the value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_v_function>
+db::get(string_view key, F &&f) noexcept
+{
+	return get(key, call_get_v_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Gets value copy of record with given *key*. In absence of any errors,
+ * pmem::kv::status::OK is returned.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key to query for
+ * @param[out] value stores returned copy of the data
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get(string_view key, std::string *value) noexcept
+{
+	return static_cast<status>(pmemkv_get(this->db_.get(), key.data(), key.size(),
+					      call_get_copy, value));
+}
+
+/**
+ * Gets size of the value of record with given *key*, e.g. to size a buffer
+ * before copying the value. The value itself is not read: csmap doesn't copy
+ * it and compressed databases read the size from the header of the compressed
+ * value; other engines take it from get().
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key to query for
+ * @param[out] size size of the value
+ *
+ * @return pmem::kv::status::OK or pmem::kv::status::NOT_FOUND if record
+ * does not exist
+ */
+inline status db::value_size(string_view key, std::size_t &size) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get_value_size(this->db_.get(), key.data(), key.size(), &size));
+}
+
+/**
+ * Gets value for given *key* without copying it. Returned handle references
+ * the value stored in the database (and, for concurrent engines, keeps
+ * the record locked) until it is destroyed or released - see pinned_value
+ * for details. It is useful for reading large values.
+ *
+ * @param[in] key record's key to query for
+ *
+ * @return handle to the value or pmem::kv::status::NOT_FOUND if record
+ * does not exist
+ */
+inline result<pinned_value> db::get_pinned(string_view key) noexcept
+{
+	pmemkv_pinned *pinned;
+	const char *value;
+	size_t valuebytes;
+	auto s = static_cast<status>(pmemkv_get_pinned(
+		this->db_.get(), key.data(), key.size(), &pinned, &value, &valuebytes));
+
+	if (s == status::OK)
+		return result<pinned_value>(
+			pinned_value(pinned, string_view(value, valuebytes)));
+	else
+		return result<pinned_value>(s);
+}
+
+/**
+ * Creates a handle to the *key*, with the key's hash computed by the engine.
+ * Passing it to exists(), get() or put() saves rehashing the key on each
+ * call. The handle can be used only with this database.
+ *
+ * @param[in] key record's key
+ *
+ * @return handle to the key
+ */
+inline result<key_handle> db::make_key_handle(string_view key) noexcept
+{
+	pmemkv_key_handle *handle;
+	auto s = static_cast<status>(
+		pmemkv_key_handle_new(this->db_.get(), key.data(), key.size(), &handle));
+
+	if (s == status::OK)
+		return result<key_handle>(key_handle(handle));
+	else
+		return result<key_handle>(s);
+}
+
+/**
+ * Checks existence of record with key given by the handle - see
+ * exists(string_view).
+ *
+ * @param[in] key handle created by make_key_handle() for this database
+ *
+ * @return pmem::kv::status
+ */
+inline status db::exists(const key_handle &key) noexcept
+{
+	return static_cast<status>(pmemkv_exists_by_handle(this->db_.get(), key.get()));
+}
+
+/**
+ * Executes (C-like) *callback* function for record with key given by the
+ * handle - see get(string_view, get_v_callback *, void *).
+ *
+ * @param[in] key handle created by make_key_handle() for this database
+ * @param[in] callback function to be called for returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get(const key_handle &key, get_v_callback *callback,
+		      void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get_by_handle(this->db_.get(), key.get(), callback, arg));
+}
+
+/**
+ * Executes function for record with key given by the handle - see
+ * get(string_view, std::function<get_v_function>).
+ *
+ * @param[in] key handle created by make_key_handle() for this database
+ * @param[in] f function called for returned element, it is called with only
+ *				one param - value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get(const key_handle &key, std::function<get_v_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get_by_handle(this->db_.get(), key.get(),
+							call_get_v_function, &f));
+}
+
+/**
+ * Executes callable *f* for record with key given by the handle - see
+ * get(const key_handle &, std::function<get_v_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] key handle created by make_key_handle() for this database
+ * @param[in] f callable invoked for returned element, with the value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_v_function>
+db::get(const key_handle &key, F &&f) noexcept
+{
+	return get(key, call_get_v_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Gets value copy of record with key given by the handle.
+ *
+ * @param[in] key handle created by make_key_handle() for this database
+ * @param[out] value stores returned copy of the data
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get(const key_handle &key, std::string *value) noexcept
+{
+	return static_cast<status>(pmemkv_get_by_handle(this->db_.get(), key.get(),
+							call_get_copy, value));
+}
+
+/**
+ * Executes (C-like) *callback* function for every record with the key
+ * present in *keys*. Lookups may be overlapped by the engine (e.g. by
+ * prefetching data for subsequent keys), so it is usually faster than
+ * calling get() in a loop. *Callback* is called in order of *keys*, only for
+ * records which exist in the database, with the following parameters:
+ * pointer to a key, size of the key, pointer to a value, size of the value
+ * and *arg* specified by the user. *Callback* can stop the processing by
+ * returning a non-zero value - then pmem::kv::status::STOPPED_BY_CB is
+ * returned.
+ *
+ * If all records were found, pmem::kv::status::OK is returned. If at least
+ * one of the records does not exist, pmem::kv::status::NOT_FOUND is returned
+ * (the callback is still called for all the other keys).
+ * This function is guaranteed to be implemented by all engines; the ones
+ * which don't provide an optimized version fall back to calling get().
+ *
+ * @param[in] keys records' keys to query for
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_batch(const std::vector<string_view> &keys,
+			    get_kv_callback *callback, void *arg) noexcept
+{
+	std::vector<const char *> ks;
+	std::vector<size_t> kbs;
+
+	try {
+		ks.reserve(keys.size());
+		kbs.reserve(keys.size());
+	} catch (std::bad_alloc &e) {
+		return status::OUT_OF_MEMORY;
+	} catch (...) {
+		return status::UNKNOWN_ERROR;
+	}
+
+	for (auto &k : keys) {
+		ks.push_back(k.data());
+		kbs.push_back(k.size());
+	}
+
+	return static_cast<status>(pmemkv_get_batch(this->db_.get(), ks.data(),
+						    kbs.data(), keys.size(), callback,
+						    arg));
+}
+
+/**
+ * Executes function for every record with the key present in *keys*.
+ * See the C-like version of get_batch() for details.
+ *
+ * @param[in] keys records' keys to query for
+ * @param[in] f function called for each returned element, it is called with
+ *				two params - key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_batch(const std::vector<string_view> &keys,
+			    std::function<get_kv_function> f) noexcept
+{
+	return get_batch(keys, call_get_kv_function, &f);
+}
+
+/**
+ * Executes callable *f* for every existing record of given *keys* - see
+ * get_batch(const std::vector<string_view> &, std::function<get_kv_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
+ *
+ * @param[in] keys keys of records to query for
+ * @param[in] f callable invoked for each returned element, with key and value
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_kv_function>
+db::get_batch(const std::vector<string_view> &keys, F &&f) noexcept
+{
+	return get_batch(keys, call_get_kv_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Inserts a key-value pair into pmemkv database.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key; record will be put into database under its name
+ * @param[in] value data to be inserted into this new database record
+ *
+ * @return pmem::kv::status
+ */
+inline status db::put(string_view key, string_view value) noexcept
+{
+	return static_cast<status>(pmemkv_put(this->db_.get(), key.data(), key.size(),
+					      value.data(), value.size()));
+}
+
+/**
+ * Inserts a key-value pair into pmemkv database, which expires after *ttl_ms*
+ * milliseconds: it's no longer returned by reads and it's removed in the
+ * background. It's supported only by databases opened with "ttl" config flag.
+ *
+ * @param[in] key record's key; record will be put into database under its name
+ * @param[in] value data to be inserted into this new database record
+ * @param[in] ttl_ms time to live of the record, greater than 0
+ *
+ * @return pmem::kv::status
+ */
+inline status db::put_ttl(string_view key, string_view value, uint64_t ttl_ms) noexcept
+{
+	return static_cast<status>(pmemkv_put_ttl(this->db_.get(), key.data(),
+						  key.size(), value.data(), value.size(),
+						  ttl_ms));
+}
+
+/**
+ * Inserts a key-value pair, with the key given by the handle, into pmemkv
+ * database - see put(string_view, string_view).
+ *
+ * @param[in] key handle created by make_key_handle() for this database
+ * @param[in] value data to be inserted into this new database record
+ *
+ * @return pmem::kv::status
+ */
+inline status db::put(const key_handle &key, string_view value) noexcept
+{
+	return static_cast<status>(pmemkv_put_by_handle(this->db_.get(), key.get(),
+							value.data(), value.size()));
+}
+
+/**
+ * Inserts a batch of key-value pairs into pmemkv database. *keys* and
+ * *values* must have the same size - i-th value is inserted under i-th key.
+ * If the same key appears more than once, the last value is stored.
+ *
+ * Engines based on libpmemobj transactions (e.g. stree and radix) apply
+ * the batch failure-atomically: pairs are grouped in chunks of at most
+ * "batch_size" elements (config parameter, whole batch by default) and
+ * every chunk is either fully applied or not applied at all. Other engines
+ * insert pairs one by one, hence the batch may be applied only partially
+ * in case of an error or a crash.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] keys records' keys
+ * @param[in] values data to be inserted under corresponding keys
+ *
+ * @return pmem::kv::status
+ */
+inline status db::put_batch(const std::vector<string_view> &keys,
+			    const std::vector<string_view> &values) noexcept
+{
+	if (keys.size() != values.size())
+		return status::INVALID_ARGUMENT;
+
+	std::vector<const char *> ks, vs;
+	std::vector<size_t> kbs, vbs;
+
+	try {
+		ks.reserve(keys.size());
+		kbs.reserve(keys.size());
+		vs.reserve(values.size());
+		vbs.reserve(values.size());
+	} catch (std::bad_alloc &e) {
+		return status::OUT_OF_MEMORY;
+	} catch (...) {
+		return status::UNKNOWN_ERROR;
+	}
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		ks.push_back(keys[i].data());
+		kbs.push_back(keys[i].size());
+		vs.push_back(values[i].data());
+		vbs.push_back(values[i].size());
+	}
+
+	return static_cast<status>(pmemkv_put_batch(this->db_.get(), ks.data(),
+						    kbs.data(), vs.data(), vbs.data(),
+						    keys.size()));
+}
+
+/**
+ * Atomically updates the record under *key* (read-modify-write). *Callback*
+ * is called with a pointer to the current value and its size (or with NULL
+ * if there is no such record), pointers to store the new value with its size
+ * and *arg* specified by the user. If *callback* returns 0, the new value
+ * is stored (the record is created if it didn't exist); the buffer pointed
+ * by the new value must be valid until update() returns. Otherwise,
+ * the record is left unchanged and pmem::kv::status::STOPPED_BY_CB is returned.
+ *
+ * Concurrent engines (cmap, csmap, vcmap and robinhood) look the record up
+ * once and call *callback* holding the lock of the record, so concurrent
+ * updates of the same key are not lost. *Callback* may be called more than
+ * once (e.g. when the record was created by another thread in the meantime)
+ * and must not call any functions of this database. Other engines implement
+ * update() by get() and put().
+ *
+ * @param[in] key record's key
+ * @param[in] callback function computing the new value
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::update(string_view key, update_callback *callback, void *arg) noexcept
 {
-	return static_cast<status>(pmemkv_get_equal_above(
-		this->db_.get(), key.data(), key.size(), call_get_kv_function, &f));
+	return static_cast<status>(
+		pmemkv_update(this->db_.get(), key.data(), key.size(), callback, arg));
 }
 
 /**
- * Executes (C-like) callback function for every record stored in pmem::kv::db,
- * whose keys are lower than or equal to the given *key*.
- * Arguments passed to the callback function are: pointer to a key, size of the
- * key, pointer to a value, size of the value and *arg* specified by the user.
- * Callback can stop iteration by returning non-zero value. In that case
- * *get_equal_below()* returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues
- * iteration.
+ * Atomically updates the record under *key* (read-modify-write).
+ * See the C-like version of update() for details.
  *
- * Keys are sorted in order specified by a comparator.
- *
- * @param[in] key sets the upper bound for querying
- * @param[in] callback function to be called for each returned element
- * @param[in] arg additional arguments to be passed to callback
+ * @param[in] key record's key
+ * @param[in] f function called with pointer to the current value (nullptr if
+ *				the record doesn't exist) and a string to store
+ *				the new value in; it returns 0 to store the new value
  *
  * @return pmem::kv::status
  */
-inline status db::get_equal_below(string_view key, get_kv_callback *callback,
-				  void *arg) noexcept
+inline status db::update(string_view key, std::function<update_function> f) noexcept
 {
-	return static_cast<status>(pmemkv_get_equal_below(this->db_.get(), key.data(),
-							  key.size(), callback, arg));
+	internal::update_function_context<> ctx;
+	ctx.f = &f;
+
+	return update(key, call_update_function, &ctx);
 }
 
 /**
- * Executes function for every record stored in pmem::kv::db, whose keys are
- * lower than or equal to the given *key*.
- * Callback can stop iteration by returning non-zero value. In that case
- **get_equal_below()* returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues
- *iteration.
- *
- * Keys are sorted in order specified by a comparator.
+ * Atomically updates the record under *key* (read-modify-write) with callable
+ * *f* - see update(string_view, std::function<update_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
  *
- * @param[in] key sets the upper bound for querying
- * @param[in] f function called for each returned element, it is called with params:
- *				key and value
+ * @param[in] key record's key
+ * @param[in] f callable invoked with pointer to the current value (nullptr if
+ *				the record doesn't exist) and a string to store
+ *				the new value in; it returns 0 to store the new value
  *
  * @return pmem::kv::status
  */
-inline status db::get_equal_below(string_view key,
-				  std::function<get_kv_function> f) noexcept
+template <typename F>
+inline internal::enable_if_callback<F, update_function> db::update(string_view key,
+								    F &&f) noexcept
 {
-	return static_cast<status>(pmemkv_get_equal_below(
-		this->db_.get(), key.data(), key.size(), call_get_kv_function, &f));
+	using callable = typename std::remove_reference<F>::type;
+	internal::update_function_context<callable> ctx;
+	ctx.f = &f;
+
+	return update(key, call_update_callable<F>, &ctx);
 }
 
 /**
- * Executes (C-like) callback function for every record stored in pmem::kv::db,
- * whose keys are lower than the given *key*.
- * Arguments passed to the callback function are: pointer to a key, size of the
- * key, pointer to a value, size of the value and *arg* specified by the user.
- * Callback can stop iteration by returning non-zero value. In that case *get_below()*
- * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
- *
- * Keys are sorted in order specified by a comparator.
+ * Executes (C-like) *callback* function for consecutive parts of bytes
+ * [*pos*, *pos* + *n*) of the value of record with given *key* (the range is
+ * truncated to the end of the value). Engines which store values in extents
+ * (lvmap) call it once per extent, without copying the value, so the whole
+ * value doesn't have to be read to memory. Other engines get the whole value
+ * and call the callback once.
+ *
+ * If record does not exist pmem::kv::status::NOT_FOUND is returned. If *pos*
+ * is beyond the end of the value, pmem::kv::status::INVALID_ARGUMENT is
+ * returned.
+ * This function is guaranteed to be implemented by all engines.
  *
- * @param[in] key sets the upper bound for querying
- * @param[in] callback function to be called for each returned element
+ * @param[in] key record's key to query for
+ * @param[in] pos position of the first byte to read
+ * @param[in] n number of bytes to read
+ * @param[in] callback function to be called for each part of the value
  * @param[in] arg additional arguments to be passed to callback
  *
  * @return pmem::kv::status
  */
-inline status db::get_below(string_view key, get_kv_callback *callback,
-			    void *arg) noexcept
+inline status db::read_value(string_view key, std::size_t pos, std::size_t n,
+			     get_v_callback *callback, void *arg) noexcept
 {
-	return static_cast<status>(
-		pmemkv_get_below(this->db_.get(), key.data(), key.size(), callback, arg));
+	return static_cast<status>(pmemkv_read_value(this->db_.get(), key.data(),
+						     key.size(), pos, n, callback, arg));
 }
 
 /**
- * Executes function for every record stored in pmem::kv::db, whose keys are
- * less than the given *key*.
- * Callback can stop iteration by returning non-zero value. In that case *get_below()*
- * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
- *
- * Keys are sorted in order specified by a comparator.
+ * Executes function for consecutive parts of bytes [*pos*, *pos* + *n*) of
+ * the value of record with given *key* - see
+ * read_value(string_view, std::size_t, std::size_t, get_v_callback *, void *).
  *
- * @param[in] key sets the upper bound for querying
- * @param[in] f function called for each returned element, it is called with params:
- *				key and value
+ * @param[in] key record's key to query for
+ * @param[in] pos position of the first byte to read
+ * @param[in] n number of bytes to read
+ * @param[in] f function called for each part of the value
  *
  * @return pmem::kv::status
  */
-inline status db::get_below(string_view key, std::function<get_kv_function> f) noexcept
+inline status db::read_value(string_view key, std::size_t pos, std::size_t n,
+			     std::function<get_v_function> f) noexcept
 {
-	return static_cast<status>(pmemkv_get_below(
-		this->db_.get(), key.data(), key.size(), call_get_kv_function, &f));
+	return static_cast<status>(pmemkv_read_value(this->db_.get(), key.data(),
+						     key.size(), pos, n,
+						     call_get_v_function, &f));
 }
 
 /**
- * Executes (C-like) callback function for every record stored in pmem::kv::db,
- * whose keys are greater than the *key1* and less than the *key2*.
- * Arguments passed to the callback function are: pointer to a key, size of the
- * key, pointer to a value, size of the value and *arg* specified by the user.
- * Callback can stop iteration by returning non-zero value. In that case *get_between()*
- * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
+ * Executes callable *f* for consecutive parts of bytes [*pos*, *pos* + *n*) of
+ * the value of record with given *key* - see
+ * read_value(string_view, std::size_t, std::size_t, std::function<get_v_function>).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function (which may allocate memory and adds an indirect call).
  *
- * Keys are sorted in order specified by a comparator.
- *
- * @param[in] key1 sets the lower bound for querying
- * @param[in] key2 sets the upper bound for querying
- * @param[in] callback function to be called for each returned element
- * @param[in] arg additional arguments to be passed to callback
+ * @param[in] key record's key to query for
+ * @param[in] pos position of the first byte to read
+ * @param[in] n number of bytes to read
+ * @param[in] f callable invoked for each part of the value
  *
  * @return pmem::kv::status
  */
-inline status db::get_between(string_view key1, string_view key2,
-			      get_kv_callback *callback, void *arg) noexcept
+template <typename F>
+inline internal::enable_if_callback<F, get_v_function>
+db::read_value(string_view key, std::size_t pos, std::size_t n, F &&f) noexcept
 {
-	return static_cast<status>(pmemkv_get_between(this->db_.get(), key1.data(),
-						      key1.size(), key2.data(),
-						      key2.size(), callback, arg));
+	return read_value(key, pos, n, call_get_v_callable<F>, internal::callback_arg(f));
 }
+
 /**
- * Executes function for every record stored in pmem::kv::db, whose keys
- * are greater than the *key1* and less than the *key2*.
- * Callback can stop iteration by returning non-zero value. In that case *get_between()*
- * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
- *
- * Keys are sorted in order specified by a comparator.
+ * Overwrites bytes of the value of record with given *key*, starting at *pos*,
+ * with *data*. The value is extended if the data doesn't fit in it. Engines
+ * which store values in extents (lvmap) rewrite only the touched extents,
+ * other engines rewrite the whole value (by update()).
+ *
+ * If record does not exist pmem::kv::status::NOT_FOUND is returned. If *pos*
+ * is beyond the end of the value, pmem::kv::status::INVALID_ARGUMENT is
+ * returned.
+ * This function is guaranteed to be implemented by all engines.
  *
- * @param[in] key1 sets the lower bound for querying
- * @param[in] key2 sets the upper bound for querying
- * @param[in] f function called for each returned element, it is called with params:
- *				key and value
+ * @param[in] key record's key
+ * @param[in] pos position of the first byte to write
+ * @param[in] data bytes to be written
  *
  * @return pmem::kv::status
  */
-inline status db::get_between(string_view key1, string_view key2,
-			      std::function<get_kv_function> f) noexcept
+inline status db::write_value(string_view key, std::size_t pos,
+			      string_view data) noexcept
 {
-	return static_cast<status>(
-		pmemkv_get_between(this->db_.get(), key1.data(), key1.size(), key2.data(),
-				   key2.size(), call_get_kv_function, &f));
+	return static_cast<status>(pmemkv_write_value(this->db_.get(), key.data(),
+						      key.size(), pos, data.data(),
+						      data.size()));
 }
 
 /**
- * Checks existence of record with given *key*. If record is present
- * pmem::kv::status::OK is returned, otherwise pmem::kv::status::NOT_FOUND
- * is returned. Other possible return values are described in pmem::kv::status.
+ * Appends *data* to the value of record with given *key*. If the record does
+ * not exist, it's created with *data* as its value. It allows putting values
+ * which don't fit in memory part by part.
+ * This function is guaranteed to be implemented by all engines.
  *
- * @param[in] key record's key to query for in database
+ * @param[in] key record's key
+ * @param[in] data bytes to be appended
  *
  * @return pmem::kv::status
  */
-inline status db::exists(string_view key) noexcept
+inline status db::append_value(string_view key, string_view data) noexcept
 {
-	return static_cast<status>(
-		pmemkv_exists(this->db_.get(), key.data(), key.size()));
+	return static_cast<status>(pmemkv_append_value(this->db_.get(), key.data(),
+						       key.size(), data.data(),
+						       data.size()));
 }
 
 /**
- * Executes (C-like) *callback* function for record with given *key*. If
- * record is present and no error occurred, the function returns
- * pmem::kv::status::OK. If record does not exist pmem::kv::status::NOT_FOUND
- * is returned. Other possible return values are described in pmem::kv::status.
- * *Callback* is called with the following parameters:
- * pointer to a value, size of the value and *arg* specified by the user.
+ * Atomically replaces the value of record with given *key* by *desired*,
+ * if the current value is equal to *expected* (compare-and-swap).
+ * If the values differ, the record is left unchanged and
+ * pmem::kv::status::VALUE_MISMATCH is returned. If the record does not exist
+ * pmem::kv::status::NOT_FOUND is returned.
+ *
+ * It's implemented by update(), so it's atomic with respect to other writes
+ * of the record in the engines which run update() under the lock of the
+ * record (cmap, csmap, vcmap and robinhood).
  * This function is guaranteed to be implemented by all engines.
  *
- * @param[in] key record's key to query for
- * @param[in] callback function to be called for returned element
- * @param[in] arg additional arguments to be passed to callback
+ * @param[in] key record's key
+ * @param[in] expected value the record must have
+ * @param[in] desired new value of the record
  *
  * @return pmem::kv::status
  */
-inline status db::get(string_view key, get_v_callback *callback, void *arg) noexcept
+inline status db::compare_exchange(string_view key, string_view expected,
+				   string_view desired) noexcept
 {
-	return static_cast<status>(
-		pmemkv_get(this->db_.get(), key.data(), key.size(), callback, arg));
+	return static_cast<status>(pmemkv_compare_exchange(
+		this->db_.get(), key.data(), key.size(), expected.data(),
+		expected.size(), desired.data(), desired.size()));
 }
 
 /**
- * Executes function for record with given *key*. If record is present and
- * no error occurred the function returns pmem::kv::status::OK. If record does
- * not exist pmem::kv::status::NOT_FOUND is returned.
+ * Atomically adds *delta* to the value of record with given *key*, which is
+ * an 8-byte integer (stored in native byte order, as by memcpy from uint64_t),
+ * and stores the previous value in *old_value*. A record which does not exist
+ * is created with *delta* as its value (and 0 is returned as the old value).
+ * If the value is not 8 bytes long, pmem::kv::status::INVALID_ARGUMENT
+ * is returned. The addition wraps around on overflow.
+ *
+ * robinhood updates 8-byte values of 8-byte keys in place, with a single
+ * failure atomic store and no transaction. Other engines implement it by
+ * update(), so it's atomic if update() is.
+ * This function is guaranteed to be implemented by all engines.
  *
- * @param[in] key record's key to query for
- * @param[in] f function called for returned element, it is called with only
- *				one param - value (key is known)
+ * @param[in] key record's key
+ * @param[in] delta value to be added
+ * @param[out] old_value value of the record before the addition
  *
  * @return pmem::kv::status
  */
-inline status db::get(string_view key, std::function<get_v_function> f) noexcept
+inline status db::fetch_add(string_view key, uint64_t delta, uint64_t &old_value) noexcept
 {
-	return static_cast<status>(pmemkv_get(this->db_.get(), key.data(), key.size(),
-					      call_get_v_function, &f));
+	return static_cast<status>(pmemkv_fetch_add(this->db_.get(), key.data(),
+						    key.size(), delta, &old_value));
 }
 
 /**
- * Gets value copy of record with given *key*. In absence of any errors,
- * pmem::kv::status::OK is returned.
+ * Inserts a key-value pair into pmemkv datastore, only if there is no record
+ * with given *key* yet. An existing record is left unchanged. *inserted* is set
+ * to true if the record was created and false if it already existed; both
+ * cases return pmem::kv::status::OK.
+ *
+ * vcmap and vsmap find (or create) the record with a single lookup; other
+ * engines implement it by update(), so it's atomic if update() is.
  * This function is guaranteed to be implemented by all engines.
  *
- * @param[in] key record's key to query for
- * @param[out] value stores returned copy of the data
+ * @param[in] key record's key
+ * @param[in] value data to be inserted
+ * @param[out] inserted whether the record was created
  *
  * @return pmem::kv::status
  */
-inline status db::get(string_view key, std::string *value) noexcept
+inline status db::put_if_absent(string_view key, string_view value,
+				bool &inserted) noexcept
 {
-	return static_cast<status>(pmemkv_get(this->db_.get(), key.data(), key.size(),
-					      call_get_copy, value));
+	return static_cast<status>(pmemkv_put_if_absent(this->db_.get(), key.data(),
+							key.size(), value.data(),
+							value.size(), &inserted));
 }
 
 /**
- * Inserts a key-value pair into pmemkv database.
+ * Removes from database record with given *key*.
  * This function is guaranteed to be implemented by all engines.
  *
- * @param[in] key record's key; record will be put into database under its name
- * @param[in] value data to be inserted into this new database record
+ * @param[in] key record's key to query for, to be removed
  *
  * @return pmem::kv::status
  */
-inline status db::put(string_view key, string_view value) noexcept
+inline status db::remove(string_view key) noexcept
 {
-	return static_cast<status>(pmemkv_put(this->db_.get(), key.data(), key.size(),
-					      value.data(), value.size()));
+	return static_cast<status>(
+		pmemkv_remove(this->db_.get(), key.data(), key.size()));
 }
 
 /**
- * Removes from database record with given *key*.
+ * Executes (C-like) *callback* function on the value of record with given
+ * *key* and removes the record, in a single operation. vcmap and csmap do it
+ * under the lock of the record, vsmap, radix and stree (without the write
+ * buffer) under the exclusive lock of the engine, so no other write of the
+ * record happens in between. Other engines (e.g. cmap) get the record and
+ * then remove it.
+ *
+ * The callback is called only if the record was removed. If record does not
+ * exist pmem::kv::status::NOT_FOUND is returned.
  * This function is guaranteed to be implemented by all engines.
  *
  * @param[in] key record's key to query for, to be removed
+ * @param[in] callback function to be called for the value of the record
+ * @param[in] arg additional arguments to be passed to callback
  *
  * @return pmem::kv::status
  */
-inline status db::remove(string_view key) noexcept
+inline status db::take(string_view key, get_v_callback *callback, void *arg) noexcept
 {
 	return static_cast<status>(
-		pmemkv_remove(this->db_.get(), key.data(), key.size()));
+		pmemkv_take(this->db_.get(), key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Executes callable *f* on the value of record with given *key* and removes
+ * the record - see take(string_view, get_v_callback *, void *).
+ * The callable is passed to the engine as is, without wrapping it in
+ * std::function.
+ *
+ * @param[in] key record's key to query for, to be removed
+ * @param[in] f callable invoked for the value of the record
+ *
+ * @return pmem::kv::status
+ */
+template <typename F>
+inline internal::enable_if_callback<F, get_v_function> db::take(string_view key,
+								 F &&f) noexcept
+{
+	return take(key, call_get_v_callable<F>, internal::callback_arg(f));
+}
+
+/**
+ * Removes from database all records, whose keys are greater than the *key1*
+ * and less than the *key2*. Keys are sorted in order specified by a comparator.
+ * Sorted engines remove the whole range at once, which is much faster than
+ * calling remove() for each key. Other engines return
+ * pmem::kv::status::NOT_SUPPORTED.
+ *
+ * @param[in] key1 sets the lower bound of removing
+ * @param[in] key2 sets the upper bound of removing
+ * @param[out] cnt number of removed records
+ *
+ * @return pmem::kv::status
+ */
+inline status db::remove_between(string_view key1, string_view key2,
+				 std::size_t &cnt) noexcept
+{
+	return static_cast<status>(pmemkv_remove_between(this->db_.get(), key1.data(),
+							 key1.size(), key2.data(),
+							 key2.size(), &cnt));
 }
 
 /**
@@ -2268,6 +4392,22 @@ inline status db::defrag(double start_percent, double amount_percent)
 		pmemkv_defrag(this->db_.get(), start_percent, amount_percent));
 }
 
+/**
+ * Makes all writes, which returned before the call, durable. It's needed only
+ * for databases opened with "durability" config parameter set to "deferred",
+ * in which puts and removes are applied to the engine in batches, after they
+ * return. If applying of some writes failed since the last sync(), their
+ * error is returned (those writes are lost).
+ *
+ * For other databases writes are durable when they return and it does nothing.
+ *
+ * @return pmem::kv::status
+ */
+inline status db::sync() noexcept
+{
+	return static_cast<status>(pmemkv_sync(this->db_.get()));
+}
+
 /**
  * Returns new write iterator in pmem::kv::result.
  *
@@ -2310,6 +4450,154 @@ inline std::string db::errormsg()
 	return std::string(pmemkv_errormsg());
 }
 
+/**
+ * Executes (C-like) *callback* for every statistic of the database, with
+ * the following parameters: name of the statistic, its value and *arg*.
+ * If the callback returns non-zero value, no more statistics are passed to it.
+ *
+ * If "latency_stats" config parameter was set to 1 when opening the database,
+ * latencies (in nanoseconds) of get, put, remove, iterate (get_all, get_above,
+ * ...) and tx_commit operations are reported, named
+ * "latency.<operation>.<count|min|mean|p50|p90|p99|p999|max>".
+ *
+ * If "persist_stats" config parameter was set to 1, writes to persistent memory
+ * of put, remove, update and tx_commit operations are reported, named
+ * "persist.<operation>.<count|user_bytes|flushed_bytes|flushes|drains|
+ * undo_log_bytes|write_amplification_percent>".
+ *
+ * Durations (in nanoseconds) of phases of opening the database are always
+ * reported, named "open.<phase>_ns", e.g. "open.total_ns", "open.pool_ns" or
+ * "open.cmap.recover_ns".
+ *
+ * If "memory_stats" config parameter was set to 1 (for pmemobj-based engines),
+ * persistent memory used by structures of the engine is reported, named
+ * "memory.<class>.<objects|bytes|header_bytes|padding_bytes|bytes_per_key>",
+ * with totals in "memory.total_bytes" and "memory.bytes_per_key".
+ *
+ * If "access_sampling" config parameter was set to N > 0, one in N accesses
+ * to keys is sampled and "access.working_set_keys" (estimated number of
+ * distinct keys), "access.top.<key>" (the most frequently accessed keys) and
+ * "access.top_percent" are reported.
+ *
+ * @param[in] callback function to be called for every statistic
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_stats(stats_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_stats_get(this->db_.get(), callback, arg));
+}
+
+/**
+ * Stores all statistics of the database in *stats* (see
+ * db::get_stats(stats_callback*, void*) for details).
+ *
+ * @param[out] stats map to which statistics are inserted
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_stats(std::map<std::string, uint64_t> &stats) noexcept
+{
+	try {
+		std::map<std::string, uint64_t> tmp;
+		auto s = get_stats(call_stats_insert, &tmp);
+		if (s == status::OK)
+			stats.swap(tmp);
+
+		return s;
+	} catch (std::bad_alloc &e) {
+		return status::OUT_OF_MEMORY;
+	} catch (...) {
+		return status::UNKNOWN_ERROR;
+	}
+}
+
+/**
+ * Resets statistics of the database (e.g. latency histograms).
+ *
+ * @return pmem::kv::status
+ */
+inline status db::reset_stats() noexcept
+{
+	return static_cast<status>(pmemkv_stats_reset(this->db_.get()));
+}
+
+/**
+ * Writes all elements of the database to a snapshot file at *path*
+ * (an existing file is replaced only when the new one is complete).
+ * Content of volatile engines (e.g. vcmap and vsmap) can be restored by
+ * db::snapshot_load() after a restart.
+ *
+ * vsmap and stree block writers while the snapshot is saved; vcmap requires
+ * that no other thread modifies the database during the call.
+ *
+ * @param[in] path path of the snapshot file
+ *
+ * @return pmem::kv::status
+ */
+inline status db::snapshot_save(const std::string &path) noexcept
+{
+	return static_cast<status>(pmemkv_snapshot_save(this->db_.get(), path.c_str()));
+}
+
+/**
+ * Inserts all elements from a snapshot file at *path* (written by
+ * db::snapshot_save()) to the database; existing elements with the same
+ * keys are overwritten. If the file is corrupted, status::INVALID_ARGUMENT
+ * is returned and the database may contain only part of the snapshot.
+ *
+ * @param[in] path path of the snapshot file
+ *
+ * @return pmem::kv::status
+ */
+inline status db::snapshot_load(const std::string &path) noexcept
+{
+	return static_cast<status>(pmemkv_snapshot_load(this->db_.get(), path.c_str()));
+}
+
+/**
+ * Writes all elements of the database to an open, regular file *fd* (from its
+ * beginning, the file is truncated to the size of the snapshot), in the format
+ * of db::snapshot_save(), without blocking writers for the whole export:
+ * sorted engines are read in chunks of records, each under the engine's lock
+ * for a short time only. Records written during the export may or may not be
+ * included. The file is synced, but not closed.
+ *
+ * @param[in] fd file descriptor of the file
+ * @param[in] max_bytes_per_sec limit of the average rate of writes to the
+ *	file (0 - no limit)
+ *
+ * @return pmem::kv::status
+ */
+inline status db::snapshot_export(int fd, uint64_t max_bytes_per_sec) noexcept
+{
+	return static_cast<status>(
+		pmemkv_snapshot_export(this->db_.get(), fd, max_bytes_per_sec));
+}
+
+/**
+ * Copies all elements of the database to the *destination* database (of any
+ * engine); existing elements with the same keys are overwritten. The database
+ * is scanned in at most *partitions* parallel scans (as by get_all_parallel()),
+ * each one writing its elements to the destination in batches, by put_batch().
+ * The destination is synced once, after all the writes, so it's best opened
+ * with deferred durability ("durability" config parameter). If writing fails,
+ * its status is returned and only part of the elements may be copied.
+ *
+ * Elements written to the database during the call may or may not be copied.
+ *
+ * @param[in] destination database to copy the elements to, other than this one
+ * @param[in] partitions maximum number of parallel scans, must be greater than 0
+ *
+ * @return pmem::kv::status
+ */
+inline status db::migrate_to(db &destination, std::size_t partitions) noexcept
+{
+	return static_cast<status>(
+		pmemkv_migrate(this->db_.get(), destination.db_.get(), partitions));
+}
+
 /**
  * Returns a human readable string describing the last error.
  *
@@ -2336,6 +4624,27 @@ inline result<tx> db::tx_begin() noexcept
 		return result<tx>(s);
 }
 
+/**
+ * Creates a new asynchronous submission/completion queue.
+ *
+ * @param[in] inline_completion if true, completion functions are called
+ * directly by worker threads instead of by poll()
+ *
+ * @return async_queue handle
+ */
+inline result<async_queue> db::new_async_queue(bool inline_completion) noexcept
+{
+	pmemkv_async *async_;
+	auto s = static_cast<status>(pmemkv_async_new(
+		db_.get(), inline_completion ? PMEMKV_ASYNC_INLINE_COMPLETION : 0,
+		&async_));
+
+	if (s == status::OK)
+		return result<async_queue>(async_queue(async_));
+	else
+		return result<async_queue>(s);
+}
+
 } /* namespace kv */
 } /* namespace pmem */
 
@@ -63,7 +63,7 @@ int pmemkv_config_from_json(pmemkv_config *config, const char *json)
 				auto sub_cfg = pmemkv_config_new();
 
 				if (sub_cfg == nullptr) {
-					ERR() << "Cannot allocate subconfig";
+					ERR("Cannot allocate subconfig");
 					return PMEMKV_STATUS_OUT_OF_MEMORY;
 				}
 
@@ -95,10 +95,10 @@ int pmemkv_config_from_json(pmemkv_config *config, const char *json)
 			}
 		}
 	} catch (const std::exception &exc) {
-		ERR() << exc.what();
+		ERR(exc.what());
 		return PMEMKV_STATUS_CONFIG_PARSING_ERROR;
 	} catch (...) {
-		ERR() << "Unspecified failure";
+		ERR("Unspecified failure");
 		return PMEMKV_STATUS_CONFIG_PARSING_ERROR;
 	}
 
@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_LOCK_STATS_H
+#define LIBPMEMKV_LOCK_STATS_H
+
+#include "stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Contention counters of engines' locks, enabled by BUILD_LOCK_STATS build
+ * option. Without it, instrumented_mutex<Mutex> is just Mutex, lock_counters
+ * is empty and all functions below do nothing - there is no overhead at all.
+ *
+ * Engines report the counters, summed per class of locks (e.g. all shards'
+ * locks of an engine), as "lock.<class>.<acquisitions|contended|wait_ns>".
+ */
+#ifdef BUILD_LOCK_STATS
+
+/**
+ * Counters of a single lock: number of acquisitions, number of the ones which
+ * had to wait (the lock was not available immediately) and total time of
+ * waiting, in nanoseconds.
+ */
+struct lock_counters {
+	lock_counters() : acquisitions(0), contended(0), wait_ns(0)
+	{
+	}
+
+	void record() noexcept
+	{
+		acquisitions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void record_wait(std::chrono::steady_clock::time_point start) noexcept
+	{
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				  std::chrono::steady_clock::now() - start)
+				  .count();
+		acquisitions.fetch_add(1, std::memory_order_relaxed);
+		contended.fetch_add(1, std::memory_order_relaxed);
+		wait_ns.fetch_add(static_cast<uint64_t>(ns), std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> acquisitions;
+	std::atomic<uint64_t> contended;
+	std::atomic<uint64_t> wait_ns;
+};
+
+/**
+ * Wrapper of a mutex, which counts its (shared and exclusive) acquisitions.
+ * A lock is contended if try_lock() (or try_lock_shared()) fails, so Mutex
+ * must provide the try_ functions for every kind of locking used.
+ */
+template <typename Mutex>
+class instrumented_mutex {
+public:
+	template <typename... Args>
+	explicit instrumented_mutex(Args &&... args) : mtx(std::forward<Args>(args)...)
+	{
+	}
+
+	instrumented_mutex(const instrumented_mutex &) = delete;
+	instrumented_mutex &operator=(const instrumented_mutex &) = delete;
+
+	void lock()
+	{
+		if (mtx.try_lock()) {
+			counters_.record();
+			return;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		mtx.lock();
+		counters_.record_wait(start);
+	}
+
+	bool try_lock()
+	{
+		bool locked = mtx.try_lock();
+		if (locked)
+			counters_.record();
+		return locked;
+	}
+
+	template <typename Rep, typename Period>
+	bool try_lock_for(const std::chrono::duration<Rep, Period> &timeout)
+	{
+		if (mtx.try_lock()) {
+			counters_.record();
+			return true;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		bool locked = mtx.try_lock_for(timeout);
+		if (locked)
+			counters_.record_wait(start);
+		return locked;
+	}
+
+	void unlock()
+	{
+		mtx.unlock();
+	}
+
+	void lock_shared()
+	{
+		if (mtx.try_lock_shared()) {
+			counters_.record();
+			return;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		mtx.lock_shared();
+		counters_.record_wait(start);
+	}
+
+	bool try_lock_shared()
+	{
+		bool locked = mtx.try_lock_shared();
+		if (locked)
+			counters_.record();
+		return locked;
+	}
+
+	void unlock_shared()
+	{
+		mtx.unlock_shared();
+	}
+
+	const lock_counters &counters() const
+	{
+		return counters_;
+	}
+
+private:
+	Mutex mtx;
+	lock_counters counters_;
+};
+
+/**
+ * Measures time of its own lifetime as a contended acquisition of a lock,
+ * for locks which cannot be wrapped (e.g. internal locks of a container,
+ * acquired together with a lookup).
+ */
+class lock_timer {
+public:
+	explicit lock_timer(lock_counters &counters) noexcept
+	    : counters(counters), start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~lock_timer()
+	{
+		counters.record_wait(start);
+	}
+
+	lock_timer(const lock_timer &) = delete;
+	lock_timer &operator=(const lock_timer &) = delete;
+
+private:
+	lock_counters &counters;
+	std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * Sums counters of locks of a single class and passes them to a stats_sink.
+ */
+class lock_class_stats {
+public:
+	void add(const lock_counters &c)
+	{
+		acquisitions += c.acquisitions.load(std::memory_order_relaxed);
+		contended += c.contended.load(std::memory_order_relaxed);
+		wait_ns += c.wait_ns.load(std::memory_order_relaxed);
+	}
+
+	template <typename Mutex>
+	void add(const instrumented_mutex<Mutex> &mtx)
+	{
+		add(mtx.counters());
+	}
+
+	void report(stats_sink &sink, const std::string &lock_class) const
+	{
+		std::string prefix = "lock." + lock_class + ".";
+		sink.add(prefix + "acquisitions", acquisitions);
+		sink.add(prefix + "contended", contended);
+		sink.add(prefix + "wait_ns", wait_ns);
+	}
+
+private:
+	uint64_t acquisitions = 0;
+	uint64_t contended = 0;
+	uint64_t wait_ns = 0;
+};
+
+#else
+
+struct lock_counters {
+};
+
+template <typename Mutex>
+using instrumented_mutex = Mutex;
+
+class lock_timer {
+public:
+	explicit lock_timer(lock_counters &) noexcept
+	{
+	}
+};
+
+class lock_class_stats {
+public:
+	template <typename T>
+	void add(const T &)
+	{
+	}
+
+	void report(stats_sink &, const std::string &) const
+	{
+	}
+};
+
+#endif /* BUILD_LOCK_STATS */
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_LOCK_STATS_H */
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "memory_stats.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr std::size_t memory_stats::HEADER_SIZE;
+
+memory_stats::memory_stats(const std::string &default_class)
+    : default_class(default_class)
+{
+}
+
+void memory_stats::add_type(uint64_t type_num, const std::string &class_name,
+			    std::size_t object_size)
+{
+	types[type_num] = type_info{class_name, object_size};
+}
+
+void memory_stats::walk(PMEMobjpool *pop)
+{
+	for (auto oid = pmemobj_first(pop); !OID_IS_NULL(oid); oid = pmemobj_next(oid)) {
+		auto size = pmemobj_alloc_usable_size(oid);
+		auto type = types.find(pmemobj_type_num(oid));
+
+		auto &usage = classes[type == types.end() ? default_class
+							  : type->second.class_name];
+		usage.objects++;
+		usage.bytes += size;
+		if (type != types.end() && type->second.object_size > 0 &&
+		    size > type->second.object_size)
+			usage.padding_bytes += size - type->second.object_size;
+	}
+}
+
+void memory_stats::report(stats_sink &sink, uint64_t keys) const
+{
+	uint64_t total = 0;
+	for (auto &c : classes) {
+		auto &usage = c.second;
+		auto header_bytes = usage.objects * HEADER_SIZE;
+		std::string prefix = "memory." + c.first + ".";
+
+		sink.add(prefix + "objects", usage.objects);
+		sink.add(prefix + "bytes", usage.bytes);
+		sink.add(prefix + "header_bytes", header_bytes);
+		sink.add(prefix + "padding_bytes", usage.padding_bytes);
+		if (keys > 0)
+			sink.add(prefix + "bytes_per_key",
+				 (usage.bytes + header_bytes) / keys);
+
+		total += usage.bytes + header_bytes;
+	}
+
+	sink.add("memory.total_bytes", total);
+	if (keys > 0)
+		sink.add("memory.bytes_per_key", total / keys);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_MEMORY_STATS_H
+#define LIBPMEMKV_MEMORY_STATS_H
+
+#include "stats.h"
+
+#include <libpmemobj.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * memory_stats accounts persistent memory used by an engine, on the allocator
+ * level: it walks all objects of the pool (pmemobj_first/pmemobj_next) and sums
+ * their usable sizes, grouped into classes of the engine's structures by type
+ * numbers of the objects. Types are registered by the engine, objects of other
+ * types are put in the default class.
+ *
+ * For every class, the number of objects, their usable bytes, allocation
+ * headers (memory_stats::HEADER_SIZE per object) and - for types of a known
+ * size - padding (usable bytes above that size, due to rounding up to the
+ * allocation class) are reported as "memory.<class>.<objects|bytes|
+ * header_bytes|padding_bytes>", with bytes per key in "memory.<class>.
+ * bytes_per_key" (and "memory.bytes_per_key" for all of them).
+ *
+ * The walk is O(number of objects), so it's done only if enabled by
+ * "memory_stats" config parameter.
+ */
+class memory_stats {
+public:
+	/* size of the header of a (small) allocation of libpmemobj */
+	static constexpr std::size_t HEADER_SIZE = 16;
+
+	explicit memory_stats(const std::string &default_class = "other");
+
+	/* object_size of 0 means the size of objects of the type is not known */
+	void add_type(uint64_t type_num, const std::string &class_name,
+		      std::size_t object_size = 0);
+
+	void walk(PMEMobjpool *pop);
+
+	/* keys is the number of elements of the engine (0 if unknown) */
+	void report(stats_sink &sink, uint64_t keys) const;
+
+private:
+	struct type_info {
+		std::string class_name;
+		std::size_t object_size;
+	};
+
+	struct class_usage {
+		uint64_t objects = 0;
+		uint64_t bytes = 0;
+		uint64_t padding_bytes = 0;
+	};
+
+	std::string default_class;
+	std::map<uint64_t, type_info> types;
+	std::map<std::string, class_usage> classes;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_MEMORY_STATS_H */
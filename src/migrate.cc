@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "migrate.h"
+#include "exceptions.h"
+
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Records of a single partition, not yet written to the destination */
+struct migrate_batch {
+	static constexpr std::size_t MAX_RECORDS = 1024;
+	static constexpr std::size_t MAX_BYTES = 1 << 20;
+
+	engine_base *dst;
+
+	/* strings of records are reused by the next batches */
+	std::vector<std::pair<std::string, std::string>> records;
+	std::vector<string_view> keys;
+	std::vector<string_view> values;
+	std::size_t n = 0;
+	std::size_t bytes = 0;
+
+	/* first error of the partition, which stopped all the scans */
+	status s = status::OK;
+	std::exception_ptr error;
+
+	bool full() const
+	{
+		return n >= MAX_RECORDS || bytes >= MAX_BYTES;
+	}
+
+	status flush()
+	{
+		if (n == 0)
+			return status::OK;
+
+		keys.resize(n);
+		values.resize(n);
+		for (std::size_t i = 0; i < n; ++i) {
+			keys[i] = string_view(records[i].first);
+			values[i] = string_view(records[i].second);
+		}
+
+		n = 0;
+		bytes = 0;
+
+		return dst->put_batch(keys.data(), values.data(), keys.size());
+	}
+};
+
+constexpr std::size_t migrate_batch::MAX_RECORDS;
+constexpr std::size_t migrate_batch::MAX_BYTES;
+
+/* stops all the scans on the first failed put_batch() */
+static int migrate_record(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	auto batch = static_cast<migrate_batch *>(arg);
+	try {
+		if (batch->n == batch->records.size())
+			batch->records.emplace_back();
+
+		batch->records[batch->n].first.assign(k, kb);
+		batch->records[batch->n].second.assign(v, vb);
+		batch->n++;
+		batch->bytes += kb + vb;
+
+		if (batch->full())
+			batch->s = batch->flush();
+	} catch (...) {
+		batch->error = std::current_exception();
+		return 1;
+	}
+
+	return batch->s == status::OK ? 0 : 1;
+}
+
+status migrate(engine_base &src, engine_base &dst, std::size_t partitions)
+{
+	if (&src == &dst)
+		throw internal::invalid_argument("Source and destination must differ");
+
+	std::vector<migrate_batch> batches(partitions);
+	std::vector<void *> args(partitions);
+	for (std::size_t i = 0; i < partitions; ++i) {
+		batches[i].dst = &dst;
+		args[i] = &batches[i];
+	}
+
+	auto s = src.get_all_parallel(partitions, migrate_record, args.data());
+	if (s == status::STOPPED_BY_CB) {
+		for (auto &batch : batches) {
+			if (batch.error)
+				std::rethrow_exception(batch.error);
+			if (batch.s != status::OK)
+				return batch.s;
+		}
+	}
+	if (s != status::OK)
+		return s;
+
+	/* the rest of every partition is smaller than a batch */
+	for (auto &batch : batches) {
+		s = batch.flush();
+		if (s != status::OK)
+			return s;
+	}
+
+	return dst.sync();
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
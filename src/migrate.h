@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_MIGRATE_H
+#define LIBPMEMKV_MIGRATE_H
+
+#include <cstddef>
+
+#include "engine.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Copies all records of 'src' to 'dst'. The source is scanned in at most
+ * 'partitions' parallel scans (get_all_parallel()), each one writing its
+ * records to the destination by put_batch(), a batch at a time. Writes are
+ * made durable once, by sync() of the destination after all of them.
+ */
+status migrate(engine_base &src, engine_base &dst, std::size_t partitions);
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_MIGRATE_H */
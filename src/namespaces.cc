@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "namespaces.h"
+#include "exceptions.h"
+#include "pool_persistence.h"
+
+#include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include <climits>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+const char *const open_namespace::layout = "pmemkv_namespaces";
+
+struct namespace_entry {
+	namespace_entry(const std::string &name, const std::string &layout)
+	    : oid(OID_NULL), name(name), layout(layout)
+	{
+	}
+
+	pmem::obj::persistent_ptr<namespace_entry> next;
+	/* root oid of the engine */
+	PMEMoid oid;
+	pmem::obj::string name;
+	/* layout of the engine, which the namespace was created for */
+	pmem::obj::string layout;
+};
+
+struct namespace_root {
+	/* directory of namespaces, newest first */
+	pmem::obj::persistent_ptr<namespace_entry> head;
+};
+
+/* pool of namespaces, open as long as any of its namespaces is open */
+class namespace_pool {
+public:
+	namespace_pool(const std::string &path, bool create, const uint64_t *size)
+	{
+		using root_pool = pmem::obj::pool<namespace_root>;
+
+		try {
+			pop = root_pool::open(path, open_namespace::layout);
+			return;
+		} catch (pmem::pool_invalid_argument &e) {
+			if (!create)
+				throw internal::invalid_argument(e.what());
+		}
+
+		if (!size)
+			throw internal::invalid_argument(
+				"Config does not contain item with key: \"size\"");
+
+		try {
+			pop = root_pool::create(path, open_namespace::layout, *size,
+						S_IRWXU);
+		} catch (pmem::pool_invalid_argument &e) {
+			throw internal::invalid_argument(e.what());
+		}
+	}
+
+	/* Returns the entry of the namespace, creating it if allowed */
+	namespace_entry &find_or_create(const std::string &name,
+					const std::string &layout, bool create,
+					bool error_if_exists)
+	{
+		auto root = pmem::obj::pool<namespace_root>(pop).root();
+		for (auto e = root->head; e != nullptr; e = e->next) {
+			if (e->name.compare(name) != 0)
+				continue;
+
+			if (error_if_exists)
+				throw internal::invalid_argument("Namespace \"" + name +
+								 "\" already exists");
+			if (e->layout.compare(layout) != 0)
+				throw internal::invalid_argument(
+					"Namespace \"" + name +
+					"\" was created for engine with layout \"" +
+					std::string(e->layout.c_str()) + "\"");
+			return *e;
+		}
+
+		if (!create)
+			throw internal::invalid_argument("Namespace \"" + name +
+							 "\" does not exist");
+
+		pmem::obj::transaction::run(pop, [&] {
+			auto e = pmem::obj::make_persistent<namespace_entry>(name,
+									     layout);
+			e->next = root->head;
+			root->head = e;
+		});
+
+		return *root->head;
+	}
+
+	pmem::obj::pool_base pop;
+	std::set<std::string> open_names;
+};
+
+/* pools of namespaces open in the process, by their paths */
+static std::map<std::string, std::unique_ptr<namespace_pool>> &open_pools()
+{
+	static std::map<std::string, std::unique_ptr<namespace_pool>> pools;
+	return pools;
+}
+
+/* serializes opens and closes of namespaces (and their pools) */
+static std::mutex &open_pools_mutex()
+{
+	static std::mutex mtx;
+	return mtx;
+}
+
+/* path of an existing file is resolved, so that it's open only once */
+static std::string canonical_path(const std::string &path)
+{
+	char resolved[PATH_MAX];
+	if (realpath(path.c_str(), resolved) == nullptr)
+		return path;
+
+	return resolved;
+}
+
+open_namespace::open_namespace(const std::string &path, const std::string &name,
+			       const std::string &engine_layout, bool create,
+			       bool error_if_exists, const uint64_t *size)
+    : name(name)
+{
+	if (name.empty())
+		throw internal::invalid_argument("Namespace name cannot be empty");
+
+	std::lock_guard<std::mutex> lock(open_pools_mutex());
+
+	auto &pools = open_pools();
+	auto it = pools.find(canonical_path(path));
+	if (it == pools.end()) {
+		std::unique_ptr<namespace_pool> p(new namespace_pool(path, create, size));
+		it = pools.emplace(canonical_path(path), std::move(p)).first;
+	}
+	ns_pool = it->second.get();
+
+	try {
+		if (ns_pool->open_names.count(name) != 0)
+			throw internal::invalid_argument("Namespace \"" + name +
+							 "\" is already open");
+
+		auto &entry = ns_pool->find_or_create(name, engine_layout, create,
+						      error_if_exists);
+		oid = &entry.oid;
+		ns_pool->open_names.insert(name);
+	} catch (...) {
+		if (ns_pool->open_names.empty()) {
+			ns_pool->pop.close();
+			pools.erase(it);
+		}
+		throw;
+	}
+}
+
+open_namespace::~open_namespace()
+{
+	std::lock_guard<std::mutex> lock(open_pools_mutex());
+
+	ns_pool->open_names.erase(name);
+	if (!ns_pool->open_names.empty())
+		return;
+
+	/* settings of the pool were set by engines of its namespaces */
+	clear_pool_persistence(ns_pool->pop.handle());
+	ns_pool->pop.close();
+
+	auto &pools = open_pools();
+	for (auto it = pools.begin(); it != pools.end(); ++it) {
+		if (it->second.get() == ns_pool) {
+			pools.erase(it);
+			break;
+		}
+	}
+}
+
+pmem::obj::pool_base open_namespace::pool() const
+{
+	return ns_pool->pop;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_NAMESPACES_H
+#define LIBPMEMKV_NAMESPACES_H
+
+#include <libpmemobj++/pool.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+class namespace_pool;
+
+/*
+ * Namespaces ("namespace" config parameter) are named databases kept in
+ * a single pool (with layout "pmemkv_namespaces"), each of them used by
+ * an engine of any pmemobj-based type. The root of the pool is a directory:
+ * a list of entries with the name, the layout of the engine (e.g.
+ * "pmemkv_stree_v2") and the oid of its data, which is the root oid of the engine
+ * (as the one given by "oid" config parameter).
+ *
+ * The pool is opened once per process and shared by engines of all of its
+ * open namespaces, so they share its mapping and its heap. A namespace can be
+ * open by one engine at a time. The pool is closed along with the last one.
+ */
+class open_namespace {
+public:
+	static const char *const layout;
+
+	/*
+	 * Opens namespace 'name' of an engine with 'engine_layout', in the pool
+	 * at path. The pool is opened (or created, if it's missing and 'create' is
+	 * set, with 'size' bytes) unless it's already open. The namespace is
+	 * created if it's missing and 'create' is set; if 'error_if_exists' is
+	 * set, it has to be missing.
+	 */
+	open_namespace(const std::string &path, const std::string &name,
+		       const std::string &engine_layout, bool create,
+		       bool error_if_exists, const uint64_t *size);
+	open_namespace(const open_namespace &) = delete;
+	open_namespace &operator=(const open_namespace &) = delete;
+	/* closes the namespace, and the pool if it was the last one open */
+	~open_namespace();
+
+	pmem::obj::pool_base pool() const;
+
+	/* root oid of the engine, null until the engine allocates its data */
+	PMEMoid *root_oid() const
+	{
+		return oid;
+	}
+
+private:
+	namespace_pool *ns_pool;
+	std::string name;
+	PMEMoid *oid;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_NAMESPACES_H */
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "numa.h"
+
+#include <climits>
+#include <fstream>
+#include <string>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* from linux/mempolicy.h */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* nodes of the mask passed to mbind */
+static const std::size_t MAX_NODES = 1024;
+
+/* Parses list of online nodes, e.g. "0-1" or "0,2-3" */
+static std::size_t read_nodes()
+{
+	std::ifstream f("/sys/devices/system/node/online");
+	std::string list;
+	if (!std::getline(f, list))
+		return 1;
+
+	std::size_t max = 0, n = 0;
+	for (auto c : list) {
+		if (c >= '0' && c <= '9') {
+			n = n * 10 + static_cast<std::size_t>(c - '0');
+			continue;
+		}
+
+		max = n > max ? n : max;
+		n = 0;
+	}
+	max = n > max ? n : max;
+
+	return max < MAX_NODES ? max + 1 : 1;
+}
+
+std::size_t numa_nodes()
+{
+	static const std::size_t nodes = read_nodes();
+
+	return nodes;
+}
+
+std::size_t numa_node()
+{
+	static thread_local std::size_t node = 0;
+	static thread_local unsigned calls = 0;
+
+	if (calls++ % NUMA_NODE_REFRESH == 0) {
+		unsigned cpu, n;
+		if (syscall(SYS_getcpu, &cpu, &n, nullptr) == 0)
+			node = n < numa_nodes() ? n : 0;
+	}
+
+	return node;
+}
+
+bool numa_prefer(void *addr, std::size_t size, std::size_t node)
+{
+	const std::size_t bits = sizeof(unsigned long) * CHAR_BIT;
+	if (node >= MAX_NODES)
+		return false;
+
+	unsigned long mask[MAX_NODES / bits] = {};
+	mask[node / bits] = 1UL << (node % bits);
+
+	return syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask, MAX_NODES, 0) == 0;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_NUMA_H
+#define LIBPMEMKV_NUMA_H
+
+#include <cstddef>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * NUMA topology, read from sysfs and from the kernel directly (there's no
+ * dependency on libnuma). On systems without NUMA, there's a single node 0.
+ */
+
+/* Number of NUMA nodes (the highest online node plus one), 1 if it's unknown */
+std::size_t numa_nodes();
+
+/*
+ * Node of the CPU the calling thread runs on. It's cached per thread and
+ * refreshed every NUMA_NODE_REFRESH calls, so a thread which migrated to
+ * another node may get the previous one for a while.
+ */
+std::size_t numa_node();
+
+constexpr unsigned NUMA_NODE_REFRESH = 1024;
+
+/*
+ * Prefers memory of the node for the (page-aligned) range, which applies
+ * to pages not touched yet. Returns false if the policy couldn't be set.
+ */
+bool numa_prefer(void *addr, std::size_t size, std::size_t node);
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_NUMA_H */
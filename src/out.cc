@@ -4,22 +4,17 @@
 #include "out.h"
 #include "libpmemkv.h"
 
-#include "libpmemkv.h"
-
-#include <sstream>
 #include <string>
 
-static thread_local std::stringstream error_stream;
+static thread_local const char *error_func;
+static thread_local std::string error_msg;
 static thread_local std::string str;
 static thread_local int last_status;
 
-std::ostream &out_err_stream(const char *func)
+void out_err(const char *func, const char *msg)
 {
-	error_stream.str(std::string());
-
-	error_stream << "[" << func << "] ";
-
-	return error_stream;
+	error_func = func;
+	error_msg.assign(msg);
 }
 
 void set_last_status(int s)
@@ -30,8 +25,9 @@ void set_last_status(int s)
 const char *out_get_errormsg(void)
 {
 	if (last_status == PMEMKV_STATUS_NOT_FOUND ||
-	    last_status == PMEMKV_STATUS_STOPPED_BY_CB)
+	    last_status == PMEMKV_STATUS_STOPPED_BY_CB || !error_func)
 		return "";
-	str = error_stream.str();
+
+	str.assign("[").append(error_func).append("] ").append(error_msg);
 	return str.c_str();
 }
@@ -6,8 +6,15 @@
 
 #include <ostream>
 
-std::ostream &out_err_stream(const char *func);
+/*
+ * Stores the error message of the current thread. It's only copied here,
+ * "[func] msg" is formatted when the message is read (by out_get_errormsg()),
+ * so func must point to a static string (e.g. __func__). Expected statuses
+ * (NOT_FOUND, STOPPED_BY_CB) never store anything.
+ */
+void out_err(const char *func, const char *msg);
 
+/* Arguments of LOG are not evaluated at all unless DO_LOG is set */
 #define DO_LOG 0
 #define LOG(msg)                                                                         \
 	do {                                                                             \
@@ -15,7 +22,7 @@ std::ostream &out_err_stream(const char *func);
 			std::cout << "[" << name() << "] " << msg << "\n";               \
 	} while (0)
 
-#define ERR() out_err_stream(__func__)
+#define ERR(msg) out_err(__func__, msg)
 
 const char *out_get_errormsg(void);
 void set_last_status(int status);
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "parallel_scan.h"
+
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+struct partition_context {
+	get_kv_callback *callback;
+	void *arg;
+	std::atomic<bool> *stopped;
+};
+
+static int partition_callback(const char *k, size_t kb, const char *v, size_t vb,
+			      void *arg)
+{
+	auto ctx = static_cast<partition_context *>(arg);
+
+	if (ctx->stopped->load(std::memory_order_relaxed))
+		return 1;
+
+	auto ret = ctx->callback(k, kb, v, vb, ctx->arg);
+	if (ret != 0)
+		ctx->stopped->store(true, std::memory_order_relaxed);
+
+	return ret;
+}
+
+status parallel_run(std::size_t n, const std::function<status(std::size_t)> &f)
+{
+	std::vector<status> statuses(n, status::OK);
+	std::vector<std::exception_ptr> exceptions(n);
+
+	auto run = [&](std::size_t i) {
+		try {
+			statuses[i] = f(i);
+		} catch (...) {
+			exceptions[i] = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(n);
+	try {
+		for (std::size_t i = 1; i < n; ++i)
+			threads.emplace_back(run, i);
+	} catch (...) {
+		/* threads which were started must be joined before rethrowing */
+		for (auto &t : threads)
+			t.join();
+		throw;
+	}
+
+	if (n > 0)
+		run(0);
+
+	for (auto &t : threads)
+		t.join();
+
+	for (auto &e : exceptions)
+		if (e)
+			std::rethrow_exception(e);
+
+	for (auto s : statuses)
+		if (s != status::OK)
+			return s;
+
+	return status::OK;
+}
+
+status parallel_scan(std::size_t partitions, get_kv_callback *callback, void **args,
+		     const partition_scan_function &scan)
+{
+	std::atomic<bool> stopped(false);
+	std::vector<partition_context> contexts(partitions);
+	for (std::size_t i = 0; i < partitions; ++i)
+		contexts[i] = {callback, args ? args[i] : nullptr, &stopped};
+
+	std::vector<status> statuses(partitions, status::OK);
+	parallel_run(partitions, [&](std::size_t i) {
+		try {
+			statuses[i] = scan(i, partition_callback, &contexts[i]);
+		} catch (...) {
+			/* stop other partitions as soon as possible */
+			stopped.store(true, std::memory_order_relaxed);
+			throw;
+		}
+
+		return status::OK;
+	});
+
+	auto ret = status::OK;
+	for (auto s : statuses) {
+		if (s == status::STOPPED_BY_CB)
+			return s;
+		if (s != status::OK && ret == status::OK)
+			ret = s;
+	}
+
+	return ret;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
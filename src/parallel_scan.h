@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_PARALLEL_SCAN_H
+#define LIBPMEMKV_PARALLEL_SCAN_H
+
+#include <cstddef>
+#include <functional>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Runs f(i) for every i from range [0, n), each one in a separate thread
+ * (the first one in the calling thread) and waits for all of them.
+ * Returns the first non-OK status; exception thrown by any f is rethrown.
+ */
+status parallel_run(std::size_t n, const std::function<status(std::size_t)> &f);
+
+/*
+ * Scans a single partition, calling 'callback' with 'arg' for every element.
+ * Returns STOPPED_BY_CB if callback returned non-zero value.
+ */
+using partition_scan_function =
+	std::function<status(std::size_t partition, get_kv_callback *callback, void *arg)>;
+
+/*
+ * Runs 'scan' for every partition from range [0, partitions), each one in
+ * a separate thread (the first one in the calling thread). Partition 'i'
+ * passes args[i] (or nullptr if 'args' is null) to 'callback'. As soon as
+ * callback returns non-zero value in any partition, all of them are stopped
+ * and STOPPED_BY_CB is returned. Exception thrown by any scan is rethrown.
+ */
+status parallel_scan(std::size_t partitions, get_kv_callback *callback, void **args,
+		     const partition_scan_function &scan);
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_PARALLEL_SCAN_H */
@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * persist_stats.cc -- wrappers of libpmemobj functions, which write to
+ * persistent memory. The library is linked with --wrap option for each of them
+ * (see CMakeLists.txt), so all calls made by engines (directly or through
+ * libpmemobj-cpp) go through the wrappers, which update persist_counters of
+ * the calling thread and call the original function.
+ *
+ * Allocations and commits of transactions are also marked as phases of slow
+ * operations (see slow_op_log).
+ *
+ * In pools on eADR platforms (see pool_persistence.h) the wrappers also skip
+ * flushes - only the drains (fences) are done. Flushes done internally by
+ * libpmemobj (e.g. of its logs) are not affected, libpmem skips them itself
+ * if it detects eADR (or PMEM_NO_FLUSH=1 is set).
+ */
+
+#include "pool_persistence.h"
+#include "stats.h"
+
+#include <libpmemobj.h>
+
+using pmem::kv::internal::eadr_pools;
+using pmem::kv::internal::pool_eadr;
+using pmem::kv::internal::skip_flushes;
+using pmem::kv::internal::slow_op_phase;
+using pmem::kv::internal::slow_op_phase_scope;
+using pmem::kv::internal::thread_persist_counters;
+
+extern "C" {
+
+void __real_pmemobj_persist(PMEMobjpool *pop, const void *addr, size_t len);
+int __real_pmemobj_xpersist(PMEMobjpool *pop, const void *addr, size_t len,
+			    unsigned flags);
+void __real_pmemobj_flush(PMEMobjpool *pop, const void *addr, size_t len);
+int __real_pmemobj_xflush(PMEMobjpool *pop, const void *addr, size_t len,
+			  unsigned flags);
+void __real_pmemobj_drain(PMEMobjpool *pop);
+void *__real_pmemobj_memcpy_persist(PMEMobjpool *pop, void *dest, const void *src,
+				    size_t len);
+void *__real_pmemobj_memset_persist(PMEMobjpool *pop, void *dest, int c, size_t len);
+void *__real_pmemobj_memcpy(PMEMobjpool *pop, void *dest, const void *src, size_t len,
+			    unsigned flags);
+void *__real_pmemobj_memmove(PMEMobjpool *pop, void *dest, const void *src,
+			     size_t len, unsigned flags);
+void *__real_pmemobj_memset(PMEMobjpool *pop, void *dest, int c, size_t len,
+			    unsigned flags);
+int __real_pmemobj_tx_add_range(PMEMoid oid, uint64_t off, size_t size);
+int __real_pmemobj_tx_add_range_direct(const void *ptr, size_t size);
+int __real_pmemobj_tx_xadd_range(PMEMoid oid, uint64_t off, size_t size,
+				 uint64_t flags);
+int __real_pmemobj_tx_xadd_range_direct(const void *ptr, size_t size, uint64_t flags);
+PMEMoid __real_pmemobj_tx_alloc(size_t size, uint64_t type_num);
+PMEMoid __real_pmemobj_tx_zalloc(size_t size, uint64_t type_num);
+PMEMoid __real_pmemobj_tx_xalloc(size_t size, uint64_t type_num, uint64_t flags);
+void __real_pmemobj_tx_commit(void);
+
+} /* extern "C" */
+
+static inline void count_flush(size_t len)
+{
+	auto &c = thread_persist_counters();
+	c.flushed_bytes += len;
+	++c.flushes;
+}
+
+static inline void count_skipped_flush(size_t len)
+{
+	auto &c = thread_persist_counters();
+	c.skipped_flush_bytes += len;
+	++c.skipped_flushes;
+}
+
+static inline void count_drain()
+{
+	++thread_persist_counters().drains;
+}
+
+/* counts a write of pmemobj_mem* functions, depending on their flags */
+static inline void count_mem(size_t len, unsigned flags)
+{
+	if (!(flags & PMEMOBJ_F_MEM_NOFLUSH))
+		count_flush(len);
+	if (!(flags & (PMEMOBJ_F_MEM_NODRAIN | PMEMOBJ_F_MEM_NOFLUSH)))
+		count_drain();
+}
+
+/*
+ * Writes of pmemobj_mem* functions to a pool on eADR are done without flush
+ * (which means also without drain, so it's done separately, if requested).
+ * Non-temporal stores bypass caches anyway, they are left as they are.
+ */
+template <typename MemOp>
+static inline void *mem_op(PMEMobjpool *pop, size_t len, unsigned flags, MemOp op)
+{
+	if ((flags & (PMEMOBJ_F_MEM_NOFLUSH | PMEMOBJ_F_MEM_NONTEMPORAL)) ||
+	    !skip_flushes(pop)) {
+		count_mem(len, flags);
+		return op(flags);
+	}
+
+	count_skipped_flush(len);
+	auto ret = op(flags | PMEMOBJ_F_MEM_NOFLUSH);
+	if (!(flags & PMEMOBJ_F_MEM_NODRAIN)) {
+		count_drain();
+		__real_pmemobj_drain(pop);
+	}
+
+	return ret;
+}
+
+/*
+ * A range added to a transaction is snapshotted (unless told not to be) and
+ * flushed on commit (unless told not to be or the pool is on eADR). Returns
+ * flags the range should be added with.
+ */
+static inline uint64_t tx_range_flags(PMEMobjpool *pop, size_t size, uint64_t flags)
+{
+	if (!(flags & POBJ_XADD_NO_SNAPSHOT))
+		thread_persist_counters().undo_log_bytes += size;
+
+	if (flags & POBJ_XADD_NO_FLUSH)
+		return flags;
+
+	if (skip_flushes(pop)) {
+		count_skipped_flush(size);
+		return flags | POBJ_XADD_NO_FLUSH;
+	}
+
+	count_flush(size);
+	return flags;
+}
+
+/* pools are looked up only if there is any pool on eADR */
+static inline PMEMobjpool *pool_of(PMEMoid oid)
+{
+	return eadr_pools.load(std::memory_order_relaxed) ? pmemobj_pool_by_oid(oid)
+							    : nullptr;
+}
+
+static inline PMEMobjpool *pool_of(const void *ptr)
+{
+	return eadr_pools.load(std::memory_order_relaxed) ? pmemobj_pool_by_ptr(ptr)
+							    : nullptr;
+}
+
+/*
+ * Objects allocated in a transaction are flushed on commit. Their pool is known
+ * only after the allocation, so if there is any pool on eADR, they are
+ * allocated without the flush and ranges of the ones in other pools are added
+ * to the transaction (without a snapshot), to be flushed on commit anyway.
+ * Returns OID_NULL if it fails.
+ */
+static PMEMoid tx_alloc_no_flush(size_t size, uint64_t type_num, uint64_t flags)
+{
+	auto oid = __real_pmemobj_tx_xalloc(size, type_num, flags | POBJ_XALLOC_NO_FLUSH);
+	if (OID_IS_NULL(oid))
+		return oid;
+
+	if (pool_eadr(pmemobj_pool_by_oid(oid))) {
+		count_skipped_flush(size);
+		return oid;
+	}
+
+	count_flush(size);
+	uint64_t range_flags = POBJ_XADD_NO_SNAPSHOT |
+		((flags & POBJ_XALLOC_NO_ABORT) ? POBJ_XADD_NO_ABORT : 0);
+	if (__real_pmemobj_tx_xadd_range(oid, 0, size, range_flags) != 0)
+		return OID_NULL;
+
+	return oid;
+}
+
+extern "C" {
+
+void __wrap_pmemobj_persist(PMEMobjpool *pop, const void *addr, size_t len)
+{
+	if (skip_flushes(pop)) {
+		count_skipped_flush(len);
+		count_drain();
+		__real_pmemobj_drain(pop);
+		return;
+	}
+
+	count_flush(len);
+	count_drain();
+	__real_pmemobj_persist(pop, addr, len);
+}
+
+int __wrap_pmemobj_xpersist(PMEMobjpool *pop, const void *addr, size_t len,
+			    unsigned flags)
+{
+	if (skip_flushes(pop)) {
+		count_skipped_flush(len);
+		count_drain();
+		__real_pmemobj_drain(pop);
+		return 0;
+	}
+
+	count_flush(len);
+	count_drain();
+	return __real_pmemobj_xpersist(pop, addr, len, flags);
+}
+
+void __wrap_pmemobj_flush(PMEMobjpool *pop, const void *addr, size_t len)
+{
+	if (skip_flushes(pop)) {
+		count_skipped_flush(len);
+		return;
+	}
+
+	count_flush(len);
+	__real_pmemobj_flush(pop, addr, len);
+}
+
+int __wrap_pmemobj_xflush(PMEMobjpool *pop, const void *addr, size_t len,
+			  unsigned flags)
+{
+	if (skip_flushes(pop)) {
+		count_skipped_flush(len);
+		return 0;
+	}
+
+	count_flush(len);
+	return __real_pmemobj_xflush(pop, addr, len, flags);
+}
+
+void __wrap_pmemobj_drain(PMEMobjpool *pop)
+{
+	count_drain();
+	__real_pmemobj_drain(pop);
+}
+
+void *__wrap_pmemobj_memcpy(PMEMobjpool *pop, void *dest, const void *src, size_t len,
+			    unsigned flags)
+{
+	return mem_op(pop, len, flags, [&](unsigned f) {
+		return __real_pmemobj_memcpy(pop, dest, src, len, f);
+	});
+}
+
+void *__wrap_pmemobj_memmove(PMEMobjpool *pop, void *dest, const void *src,
+			     size_t len, unsigned flags)
+{
+	return mem_op(pop, len, flags, [&](unsigned f) {
+		return __real_pmemobj_memmove(pop, dest, src, len, f);
+	});
+}
+
+void *__wrap_pmemobj_memset(PMEMobjpool *pop, void *dest, int c, size_t len,
+			    unsigned flags)
+{
+	return mem_op(pop, len, flags, [&](unsigned f) {
+		return __real_pmemobj_memset(pop, dest, c, len, f);
+	});
+}
+
+void *__wrap_pmemobj_memcpy_persist(PMEMobjpool *pop, void *dest, const void *src,
+				    size_t len)
+{
+	if (skip_flushes(pop))
+		return __wrap_pmemobj_memcpy(pop, dest, src, len, 0);
+
+	count_mem(len, 0);
+	return __real_pmemobj_memcpy_persist(pop, dest, src, len);
+}
+
+void *__wrap_pmemobj_memset_persist(PMEMobjpool *pop, void *dest, int c, size_t len)
+{
+	if (skip_flushes(pop))
+		return __wrap_pmemobj_memset(pop, dest, c, len, 0);
+
+	count_mem(len, 0);
+	return __real_pmemobj_memset_persist(pop, dest, c, len);
+}
+
+int __wrap_pmemobj_tx_add_range(PMEMoid oid, uint64_t off, size_t size)
+{
+	auto flags = tx_range_flags(pool_of(oid), size, 0);
+	if (flags != 0)
+		return __real_pmemobj_tx_xadd_range(oid, off, size, flags);
+
+	return __real_pmemobj_tx_add_range(oid, off, size);
+}
+
+int __wrap_pmemobj_tx_add_range_direct(const void *ptr, size_t size)
+{
+	auto flags = tx_range_flags(pool_of(ptr), size, 0);
+	if (flags != 0)
+		return __real_pmemobj_tx_xadd_range_direct(ptr, size, flags);
+
+	return __real_pmemobj_tx_add_range_direct(ptr, size);
+}
+
+int __wrap_pmemobj_tx_xadd_range(PMEMoid oid, uint64_t off, size_t size,
+				 uint64_t flags)
+{
+	flags = tx_range_flags(pool_of(oid), size, flags);
+	return __real_pmemobj_tx_xadd_range(oid, off, size, flags);
+}
+
+int __wrap_pmemobj_tx_xadd_range_direct(const void *ptr, size_t size, uint64_t flags)
+{
+	flags = tx_range_flags(pool_of(ptr), size, flags);
+	return __real_pmemobj_tx_xadd_range_direct(ptr, size, flags);
+}
+
+PMEMoid __wrap_pmemobj_tx_alloc(size_t size, uint64_t type_num)
+{
+	slow_op_phase_scope phase(slow_op_phase::ALLOC);
+	if (eadr_pools.load(std::memory_order_relaxed))
+		return tx_alloc_no_flush(size, type_num, 0);
+
+	count_flush(size);
+	return __real_pmemobj_tx_alloc(size, type_num);
+}
+
+PMEMoid __wrap_pmemobj_tx_zalloc(size_t size, uint64_t type_num)
+{
+	slow_op_phase_scope phase(slow_op_phase::ALLOC);
+	if (eadr_pools.load(std::memory_order_relaxed))
+		return tx_alloc_no_flush(size, type_num, POBJ_XALLOC_ZERO);
+
+	count_flush(size);
+	return __real_pmemobj_tx_zalloc(size, type_num);
+}
+
+PMEMoid __wrap_pmemobj_tx_xalloc(size_t size, uint64_t type_num, uint64_t flags)
+{
+	slow_op_phase_scope phase(slow_op_phase::ALLOC);
+
+	/* e.g. data written with non-temporal stores isn't flushed again */
+	if (flags & POBJ_XALLOC_NO_FLUSH)
+		return __real_pmemobj_tx_xalloc(size, type_num, flags);
+
+	if (eadr_pools.load(std::memory_order_relaxed))
+		return tx_alloc_no_flush(size, type_num, flags);
+
+	count_flush(size);
+	return __real_pmemobj_tx_xalloc(size, type_num, flags);
+}
+
+void __wrap_pmemobj_tx_commit(void)
+{
+	slow_op_phase_scope phase(slow_op_phase::TX_COMMIT);
+	__real_pmemobj_tx_commit();
+}
+
+} /* extern "C" */
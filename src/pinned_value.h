@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_PINNED_VALUE_H
+#define LIBPMEMKV_PINNED_VALUE_H
+
+#include "libpmemkv.hpp"
+
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * pinned_value_base is an interface for a handle to the value of a record,
+ * returned by engine_base::get_pinned(). The value stays valid (and, depending
+ * on the engine, the record stays locked) until the handle is destroyed.
+ */
+class pinned_value_base {
+public:
+	virtual ~pinned_value_base() = default;
+
+	virtual string_view value() const = 0;
+};
+
+/**
+ * copied_pinned_value holds a copy of the value. It's used by engines which
+ * cannot reference the value in place.
+ */
+class copied_pinned_value : public pinned_value_base {
+public:
+	copied_pinned_value() = default;
+
+	string_view value() const final
+	{
+		return string_view(data.data(), data.size());
+	}
+
+	std::string data;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_PINNED_VALUE_H */
@@ -6,7 +6,19 @@
 
 #include "engine.h"
 #include "libpmemkv.h"
+#include "memory_stats.h"
+#include "namespaces.h"
+#include "pool_persistence.h"
+#include "prefault.h"
+#include <libpmemobj/ctl.h>
 #include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
 
 namespace pmem
 {
@@ -21,6 +33,17 @@ static inline void check_outside_tx()
 
 namespace kv
 {
+namespace internal
+{
+
+/* serializes read-only opens, which change the global copy-on-write ctl */
+inline std::mutex &read_only_open_mutex()
+{
+	static std::mutex mtx;
+	return mtx;
+}
+
+} /* namespace internal */
 
 template <typename EngineData>
 class pmemobj_engine_base : public engine_base {
@@ -34,13 +57,23 @@ public:
 		auto is_path = cfg->get_string("path", &path);
 		auto is_oid = cfg->get_object("oid", (void **)&oid);
 
-		if (is_path && is_oid) {
+		uint64_t read_only = 0;
+		cfg->get_uint64("read_only", &read_only);
+
+		const char *ns_name = nullptr;
+		auto is_namespace = cfg->get_string("namespace", &ns_name);
+
+		if (is_namespace && !is_path) {
+			throw internal::invalid_argument(
+				"Config item \"namespace\" requires \"path\"");
+		} else if (is_path && is_oid) {
 			throw internal::invalid_argument(
 				"Config contains both: \"path\" and \"oid\"");
 		} else if (!is_path && !is_oid) {
 			throw internal::invalid_argument(
 				"Config does not contain item with key: \"path\" or \"oid\"");
 		} else if (is_path) {
+			internal::open_phase phase("pool");
 			uint64_t create_or_error_if_exists = 0;
 			uint64_t create_if_missing = 0;
 			cfg_by_path = true;
@@ -59,7 +92,30 @@ public:
 					"Both flags set in config: \"create_if_missing\" and \"create_or_error_if_exists\"");
 			}
 
-			if (create_if_missing || create_or_error_if_exists) {
+			if (read_only &&
+			    (create_if_missing || create_or_error_if_exists)) {
+				throw internal::invalid_argument(
+					"Flag \"read_only\" cannot be set with a create flag");
+			}
+
+			if (is_namespace) {
+				if (read_only)
+					throw internal::invalid_argument(
+						"Flag \"read_only\" cannot be set with \"namespace\"");
+
+				/* the pool is closed by the last of its namespaces */
+				cfg_by_path = false;
+				uint64_t size = 0;
+				auto has_size = cfg->get_uint64("size", &size);
+				ns.reset(new internal::open_namespace(
+					path, ns_name, layout,
+					create_if_missing || create_or_error_if_exists,
+					create_or_error_if_exists != 0,
+					has_size ? &size : nullptr));
+				pmpool = ns->pool();
+			} else if (read_only) {
+				pmpool = open_read_only(path, layout);
+			} else if (create_if_missing || create_or_error_if_exists) {
 				bool failed_open = false;
 				if (!create_or_error_if_exists)
 					try {
@@ -82,18 +138,115 @@ public:
 				}
 			}
 
-			root_oid = static_cast<pmem::obj::pool<Root>>(pmpool)
-					   .root()
-					   ->ptr.raw_ptr();
+			root_oid = ns ? ns->root_oid()
+				      : static_cast<pmem::obj::pool<Root>>(pmpool)
+						.root()
+						->ptr.raw_ptr();
 
 		} else if (is_oid) {
+			if (read_only)
+				throw internal::invalid_argument(
+					"Flag \"read_only\" requires \"path\" in config");
+
 			pmpool = pmem::obj::pool_base(pmemobj_pool_by_ptr(oid));
 			root_oid = oid;
 		}
+
+		uint64_t prefault_threads = 0;
+		cfg->get_uint64("prefault", &prefault_threads);
+		if (prefault_threads > 0) {
+			internal::open_phase phase("prefault");
+			/* pages of a private mapping would be copied by writes */
+			internal::prefault_mapping(pmpool.handle(),
+						   static_cast<std::size_t>(prefault_threads),
+						   !read_only);
+		}
+
+		uint64_t batch_size_cfg = 0;
+		cfg->get_uint64("batch_size", &batch_size_cfg);
+		batch_size = static_cast<std::size_t>(batch_size_cfg);
+
+		uint64_t direct_write_range_cfg = 0;
+		cfg->get_uint64("direct_write_range", &direct_write_range_cfg);
+		direct_write_range = direct_write_range_cfg != 0;
+
+		uint64_t memory_stats_cfg = 0;
+		cfg->get_uint64("memory_stats", &memory_stats_cfg);
+		memory_stats_enabled = memory_stats_cfg != 0;
+
+		uint64_t nontemporal_threshold_cfg = 0;
+		cfg->get_uint64("nontemporal_threshold", &nontemporal_threshold_cfg);
+
+		bool eadr = false;
+		const char *eadr_cfg;
+		if (cfg->get_string("eadr", &eadr_cfg)) {
+			if (std::strcmp(eadr_cfg, "on") == 0)
+				eadr = true;
+			else if (std::strcmp(eadr_cfg, "auto") == 0)
+				eadr = internal::platform_has_eadr();
+			else if (std::strcmp(eadr_cfg, "off") != 0)
+				throw internal::invalid_argument(
+					"Config item \"eadr\" must be \"on\", \"off\" or \"auto\"");
+		}
+
+		if (nontemporal_threshold_cfg > 0) {
+			internal::set_nontemporal_threshold(
+				pmpool.handle(),
+				static_cast<std::size_t>(nontemporal_threshold_cfg));
+			pool_persistence_set = true;
+		}
+		if (eadr) {
+			internal::set_pool_eadr(pmpool.handle());
+			pool_persistence_set = true;
+		}
+
+		/* nothing is allocated in read-only pools */
+		uint64_t alloc_classes_cfg = 1;
+		cfg->get_uint64("alloc_classes", &alloc_classes_cfg);
+		alloc_classes_enabled = alloc_classes_cfg != 0 && !read_only;
+
+		uint64_t node_alignment_cfg = 0;
+		cfg->get_uint64("node_alignment", &node_alignment_cfg);
+		if (node_alignment_cfg > 0) {
+			if ((node_alignment_cfg & (node_alignment_cfg - 1)) != 0 ||
+			    node_alignment_cfg > MAX_NODE_ALIGNMENT)
+				throw internal::invalid_argument(
+					"Config item \"node_alignment\" must be a power of 2, not greater than " +
+					std::to_string(MAX_NODE_ALIGNMENT));
+			if (alloc_classes_cfg == 0)
+				throw internal::invalid_argument(
+					"Config item \"node_alignment\" requires \"alloc_classes\"");
+			node_alignment = static_cast<std::size_t>(node_alignment_cfg);
+		}
+
+		uint64_t arenas_cfg = 0;
+		cfg->get_uint64("arenas", &arenas_cfg);
+		if (arenas_cfg > MAX_ARENAS)
+			throw internal::invalid_argument(
+				"Config item \"arenas\" must not be greater than " +
+				std::to_string(MAX_ARENAS));
+		/* nothing is allocated in read-only pools */
+		if (arenas_cfg > 0 && !read_only)
+			internal::set_pool_arenas(pmpool.handle(),
+						  static_cast<std::size_t>(arenas_cfg));
+
+		/* heap statistics are needed by stats(), enable them (if not yet
+		 * enabled by the user) - transient ones are cheap */
+		enum pobj_stats_enabled stats_enabled;
+		if (pmemobj_ctl_get(pmpool.handle(), "stats.enabled", &stats_enabled) ==
+			    0 &&
+		    stats_enabled == POBJ_STATS_DISABLED) {
+			stats_enabled = POBJ_STATS_ENABLED_TRANSIENT;
+			pmemobj_ctl_set(pmpool.handle(), "stats.enabled", &stats_enabled);
+		}
 	}
 
 	~pmemobj_engine_base()
 	{
+		/* settings of a shared pool are cleared when it's closed */
+		if (pool_persistence_set && !ns)
+			internal::clear_pool_persistence(pmpool.handle());
+
 		if (cfg_by_path) {
 			try {
 				pmpool.close();
@@ -103,17 +256,179 @@ public:
 		}
 	}
 
+	/*
+	 * Passes statistics of the pmemobj heap: number of allocated bytes and
+	 * fragmentation - percent of memory in active runs (used for small
+	 * allocations), which is not allocated.
+	 */
+	status stats(internal::stats_sink &sink) override
+	{
+		uint64_t allocated = 0, run_allocated = 0, run_active = 0;
+		auto pop = pmpool.handle();
+
+		if (pmemobj_ctl_get(pop, "stats.heap.curr_allocated", &allocated) != 0 ||
+		    pmemobj_ctl_get(pop, "stats.heap.run_allocated", &run_allocated) !=
+			    0 ||
+		    pmemobj_ctl_get(pop, "stats.heap.run_active", &run_active) != 0)
+			return status::OK;
+
+		sink.add("pool.allocated_bytes", allocated);
+		sink.add("pool.run_allocated_bytes", run_allocated);
+		sink.add("pool.run_active_bytes", run_active);
+		sink.add("pool.fragmentation_percent",
+			 run_active > run_allocated
+				 ? (run_active - run_allocated) * 100 / run_active
+				 : 0);
+
+		return status::OK;
+	}
+
 protected:
+	/*
+	 * Returns memory_stats with types of objects allocated by the engine
+	 * registered, so memory used by its structures can be told apart.
+	 * By default all objects are in a single class.
+	 */
+	virtual internal::memory_stats memory_types()
+	{
+		return internal::memory_stats();
+	}
+
+	/*
+	 * Passes usage of memory by the engine's structures, if enabled by
+	 * "memory_stats" config parameter. Called by stats() of engines, with
+	 * the number of their elements (it must not lock the engine itself).
+	 */
+	void report_memory(internal::stats_sink &sink, std::size_t keys)
+	{
+		if (!memory_stats_enabled)
+			return;
+
+		auto mem = memory_types();
+		mem.walk(pmpool.handle());
+		mem.report(sink, keys);
+	}
+
 	struct Root {
 		/* field ptr used when path is specified */
 		pmem::obj::persistent_ptr<EngineData> ptr;
 	};
 
+	/*
+	 * Applies a batch of puts, using 'put_f' for each key-value pair.
+	 * Pairs are grouped in chunks of 'batch_size' elements (or all of them,
+	 * if batch_size is 0) and every chunk is applied in a single
+	 * transaction, so undo log setup and drain are paid once per chunk.
+	 */
+	template <typename F>
+	status put_batch_tx(const string_view *keys, const string_view *values,
+			    std::size_t n, F &&put_f)
+	{
+		check_outside_tx();
+
+		std::size_t chunk = batch_size > 0 ? batch_size : n;
+		for (std::size_t i = 0; i < n; i += chunk) {
+			std::size_t end = (n - i > chunk) ? i + chunk : n;
+			pmem::obj::transaction::run(pmpool, [&] {
+				for (std::size_t j = i; j < end; ++j)
+					put_f(keys[j], values[j]);
+			});
+		}
+
+		return status::OK;
+	}
+
+	/*
+	 * Returns positions [first, last) of elements (out of n) to defragment,
+	 * given by percents passed to defrag(). Throws std::range_error for an
+	 * incorrect range, as concurrent_hash_map::defragment() does.
+	 */
+	static std::pair<std::size_t, std::size_t>
+	defrag_positions(std::size_t n, double start_percent, double amount_percent)
+	{
+		double end_percent = start_percent + amount_percent;
+		if (start_percent < 0 || start_percent >= 100 || end_percent < 0 ||
+		    end_percent > 100 || start_percent >= end_percent)
+			throw std::range_error("incorrect range");
+
+		auto first = static_cast<std::size_t>(start_percent * n / 100);
+		auto last = static_cast<std::size_t>(end_percent * n / 100);
+
+		return {first, std::min(last, n)};
+	}
+
 	pmem::obj::pool_base pmpool;
 	PMEMoid *root_oid;
 	bool cfg_by_path = false;
+	/* namespace of a shared pool, open until the engine is destroyed */
+	std::unique_ptr<internal::open_namespace> ns;
+	/* number of elements applied in a single transaction by put_batch */
+	std::size_t batch_size = 0;
+	/* write iterators modify values in place (see internal::direct_write_tx) */
+	bool direct_write_range = false;
+	/* memory of the engine's structures is reported by stats() */
+	bool memory_stats_enabled = false;
+	/* the pool has settings in pool_persistence.h (non-temporal threshold, eADR,
+	 * allocation classes) */
+	bool pool_persistence_set = false;
+	/* engines register allocation classes of their nodes */
+	bool alloc_classes_enabled = false;
+	/* nodes are aligned and padded to it (e.g. 256 bytes - XPLine of Optane media) */
+	std::size_t node_alignment = 0;
+	static constexpr std::size_t MAX_NODE_ALIGNMENT = 4096;
+	/* arenas of the heap, set by the "arenas" config parameter */
+	static constexpr std::size_t MAX_ARENAS = 1024;
+
+	/*
+	 * Registers an allocation class of objects of exactly size bytes in the
+	 * pool (see pool_persistence.h), which is used by allocations with
+	 * internal::alloc_class_flag(). It must be done before the first
+	 * allocation of such objects. Objects are aligned to node_alignment (if
+	 * set) and their size is rounded up to it, so that a node occupies
+	 * the smallest possible number of media blocks.
+	 */
+	void register_alloc_class(std::size_t size)
+	{
+		if (!alloc_classes_enabled)
+			return;
+
+		/* the pool's slot may be taken even if registration failed */
+		pool_persistence_set = true;
+		internal::register_alloc_class(pmpool.handle(), size, node_alignment);
+	}
 
 private:
+	/*
+	 * Opens the pool in copy-on-write mode (private mapping) - the file is
+	 * never modified, so any number of processes can open it this way.
+	 * Writes done by recovery of the pool and of the engine are discarded.
+	 */
+	pmem::obj::pool<Root> open_read_only(const char *path, const std::string &layout)
+	{
+		std::lock_guard<std::mutex> lock(internal::read_only_open_mutex());
+
+		/* restores the previous mode for pools opened later */
+		struct cow_mode {
+			int prev = 0;
+			~cow_mode()
+			{
+				pmemobj_ctl_set(nullptr, "copy_on_write.at_open", &prev);
+			}
+		} mode;
+
+		int cow = 1;
+		pmemobj_ctl_get(nullptr, "copy_on_write.at_open", &mode.prev);
+		if (pmemobj_ctl_set(nullptr, "copy_on_write.at_open", &cow) != 0)
+			throw internal::not_supported(
+				"Opening pools read-only is not supported by libpmemobj");
+
+		try {
+			return pmem::obj::pool<Root>::open(path, layout);
+		} catch (pmem::pool_invalid_argument &e) {
+			throw internal::invalid_argument(e.what());
+		}
+	}
+
 	pmem::obj::pool<Root> create_or_fail(const char *path, const std::size_t size,
 					     const std::string &layout)
 	{
@@ -0,0 +1,325 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "pool_persistence.h"
+#include "exceptions.h"
+#include "out.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+std::atomic<std::size_t> nontemporal_pools(0);
+std::atomic<std::size_t> eadr_pools(0);
+std::atomic<std::size_t> alloc_class_pools(0);
+
+/* pools with settings set, there are only a few open at a time */
+static const std::size_t MAX_POOLS = 64;
+/* allocation classes per pool, engines register one per type of nodes */
+static const std::size_t MAX_CLASSES = 8;
+
+/* size of the compact header, which keeps type numbers (see memory_stats) */
+static const std::size_t CLASS_HEADER_SIZE = 16;
+/* runs of classes have about that size (a single chunk) */
+static const std::size_t CLASS_RUN_SIZE = 256 * 1024 - 1024;
+
+struct pool_settings {
+	std::atomic<PMEMobjpool *> pop;
+	std::atomic<std::size_t> threshold;
+	std::atomic<bool> eadr;
+	/* sizes of objects of registered allocation classes and their ids */
+	std::atomic<std::size_t> class_sizes[MAX_CLASSES];
+	std::atomic<unsigned> class_ids[MAX_CLASSES];
+};
+
+static pool_settings pools[MAX_POOLS];
+
+/* serializes changes of the table, lookups are lock-free */
+static std::mutex &pools_mutex()
+{
+	static std::mutex mtx;
+	return mtx;
+}
+
+/* Returns the slot of the pool (taking a free one, if there is none) */
+static pool_settings &pool_slot(PMEMobjpool *pop)
+{
+	pool_settings *free_slot = nullptr;
+	for (auto &p : pools) {
+		auto slot_pop = p.pop.load(std::memory_order_relaxed);
+		if (slot_pop == pop)
+			return p;
+		if (slot_pop == nullptr && free_slot == nullptr)
+			free_slot = &p;
+	}
+
+	if (free_slot == nullptr)
+		throw internal::invalid_argument(
+			"Too many pools with \"nontemporal_threshold\" or \"eadr\" set");
+
+	free_slot->threshold.store(0, std::memory_order_relaxed);
+	free_slot->eadr.store(false, std::memory_order_relaxed);
+	for (auto &size : free_slot->class_sizes)
+		size.store(0, std::memory_order_relaxed);
+	free_slot->pop.store(pop, std::memory_order_release);
+
+	return *free_slot;
+}
+
+static const pool_settings *find_slot(PMEMobjpool *pop) noexcept
+{
+	if (pop == nullptr)
+		return nullptr;
+
+	for (auto &p : pools) {
+		if (p.pop.load(std::memory_order_acquire) == pop)
+			return &p;
+	}
+
+	return nullptr;
+}
+
+void set_nontemporal_threshold(PMEMobjpool *pop, std::size_t threshold)
+{
+	std::lock_guard<std::mutex> lock(pools_mutex());
+
+	auto &p = pool_slot(pop);
+	if (p.threshold.exchange(threshold, std::memory_order_relaxed) == 0)
+		nontemporal_pools.fetch_add(1, std::memory_order_relaxed);
+}
+
+void set_pool_eadr(PMEMobjpool *pop)
+{
+	std::lock_guard<std::mutex> lock(pools_mutex());
+
+	auto &p = pool_slot(pop);
+	if (!p.eadr.exchange(true, std::memory_order_relaxed))
+		eadr_pools.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ * Objects of the class have the compact header (as objects of the default
+ * classes), so that they keep their type numbers and can be iterated over.
+ * With alignment, data of objects (not their headers) is aligned.
+ * Classes are only an optimization, so if there are too many of them (or
+ * pools), the default ones are used.
+ */
+unsigned register_alloc_class(PMEMobjpool *pop, std::size_t size, std::size_t alignment)
+{
+	std::lock_guard<std::mutex> lock(pools_mutex());
+
+	pool_settings *slot;
+	try {
+		slot = &pool_slot(pop);
+	} catch (internal::invalid_argument &e) {
+		return 0;
+	}
+
+	auto &p = *slot;
+	std::atomic<std::size_t> *free_size = nullptr;
+	for (auto &class_size : p.class_sizes) {
+		auto s = class_size.load(std::memory_order_relaxed);
+		if (s == size)
+			return p.class_ids[&class_size - p.class_sizes].load(
+				std::memory_order_relaxed);
+		if (s == 0 && free_size == nullptr)
+			free_size = &class_size;
+	}
+
+	if (free_size == nullptr)
+		return 0;
+
+	auto granularity = std::max<std::size_t>(alignment, 16);
+
+	struct pobj_alloc_class_desc desc;
+	desc.unit_size = (size + CLASS_HEADER_SIZE + granularity - 1) / granularity *
+		granularity;
+	desc.alignment = alignment;
+	desc.units_per_block = static_cast<unsigned>(
+		std::max<std::size_t>(1, CLASS_RUN_SIZE / desc.unit_size));
+	desc.header_type = POBJ_HEADER_COMPACT;
+	desc.class_id = 0;
+	if (pmemobj_ctl_set(pop, "heap.alloc_class.new.desc", &desc) != 0)
+		return 0;
+
+	bool first = std::all_of(
+		std::begin(p.class_sizes), std::end(p.class_sizes),
+		[](const std::atomic<std::size_t> &s) { return s.load() == 0; });
+	p.class_ids[free_size - p.class_sizes].store(desc.class_id,
+						      std::memory_order_relaxed);
+	free_size->store(size, std::memory_order_release);
+	if (first)
+		alloc_class_pools.fetch_add(1, std::memory_order_relaxed);
+
+	return desc.class_id;
+}
+
+/*
+ * Arenas created by the ctl are not "automatic" (not assigned to threads),
+ * so the first 'arenas' ones are made automatic and the rest are excluded -
+ * threads assigned to them before keep using them. Arenas are only an
+ * optimization, so if they can't be set, the defaults are used.
+ */
+void set_pool_arenas(PMEMobjpool *pop, std::size_t arenas)
+{
+	unsigned total = 0;
+	if (pmemobj_ctl_get(pop, "heap.narenas.total", &total) != 0)
+		return;
+
+	unsigned max = 0;
+	if (pmemobj_ctl_get(pop, "heap.narenas.max", &max) == 0 && max < arenas) {
+		max = static_cast<unsigned>(arenas);
+		pmemobj_ctl_set(pop, "heap.narenas.max", &max);
+	}
+
+	while (total < arenas) {
+		unsigned arena_id;
+		if (pmemobj_ctl_exec(pop, "heap.arena.create", &arena_id) != 0)
+			break;
+		++total;
+	}
+
+	for (unsigned id = 1; id <= total; ++id) {
+		int automatic = id <= arenas ? 1 : 0;
+		auto name = "heap.arena." + std::to_string(id) + ".automatic";
+		if (pmemobj_ctl_set(pop, name.c_str(), &automatic) != 0)
+			return;
+	}
+}
+
+unsigned create_pool_arena(PMEMobjpool *pop)
+{
+	unsigned total = 0;
+	if (pmemobj_ctl_get(pop, "heap.narenas.total", &total) != 0)
+		return 0;
+
+	unsigned max = 0;
+	if (pmemobj_ctl_get(pop, "heap.narenas.max", &max) == 0 && max <= total) {
+		max = total + 1;
+		pmemobj_ctl_set(pop, "heap.narenas.max", &max);
+	}
+
+	unsigned arena_id = 0;
+	if (pmemobj_ctl_exec(pop, "heap.arena.create", &arena_id) != 0)
+		return 0;
+
+	/* only allocations in an arena_scope of it use the arena */
+	int automatic = 0;
+	auto name = "heap.arena." + std::to_string(arena_id) + ".automatic";
+	pmemobj_ctl_set(pop, name.c_str(), &automatic);
+
+	return arena_id;
+}
+
+arena_scope::arena_scope(PMEMobjpool *pop, unsigned arena_id) : pop(pop)
+{
+	unsigned current = 0;
+	if (arena_id == 0 || pmemobj_ctl_get(pop, "heap.thread.arena_id", &current) != 0)
+		return;
+
+	if (current != arena_id &&
+	    pmemobj_ctl_set(pop, "heap.thread.arena_id", &arena_id) == 0)
+		prev = current;
+}
+
+arena_scope::~arena_scope()
+{
+	if (prev != 0)
+		pmemobj_ctl_set(pop, "heap.thread.arena_id", &prev);
+}
+
+void clear_pool_persistence(PMEMobjpool *pop) noexcept
+{
+	std::lock_guard<std::mutex> lock(pools_mutex());
+
+	for (auto &p : pools) {
+		if (p.pop.load(std::memory_order_relaxed) != pop)
+			continue;
+
+		if (p.threshold.load(std::memory_order_relaxed) > 0)
+			nontemporal_pools.fetch_sub(1, std::memory_order_relaxed);
+		if (p.eadr.load(std::memory_order_relaxed))
+			eadr_pools.fetch_sub(1, std::memory_order_relaxed);
+		if (p.class_sizes[0].load(std::memory_order_relaxed) > 0)
+			alloc_class_pools.fetch_sub(1, std::memory_order_relaxed);
+		p.pop.store(nullptr, std::memory_order_relaxed);
+		return;
+	}
+}
+
+std::size_t nontemporal_threshold(PMEMobjpool *pop) noexcept
+{
+	auto p = find_slot(pop);
+
+	return p ? p->threshold.load(std::memory_order_relaxed) : 0;
+}
+
+bool pool_eadr(PMEMobjpool *pop) noexcept
+{
+	auto p = find_slot(pop);
+
+	return p ? p->eadr.load(std::memory_order_relaxed) : false;
+}
+
+unsigned alloc_class(PMEMobjpool *pop, std::size_t size) noexcept
+{
+	auto p = find_slot(pop);
+	if (!p)
+		return 0;
+
+	for (std::size_t i = 0; i < MAX_CLASSES; ++i) {
+		auto s = p->class_sizes[i].load(std::memory_order_acquire);
+		if (s == size)
+			return p->class_ids[i].load(std::memory_order_relaxed);
+		if (s == 0)
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Checks persistence domains of all regions of persistent memory, the same way
+ * as pmem2_auto_flush() of libpmem2 does (which pmemkv doesn't link with).
+ */
+bool platform_has_eadr() noexcept
+{
+	static const char *REGIONS_PATH = "/sys/bus/nd/devices";
+
+	DIR *dir = opendir(REGIONS_PATH);
+	if (!dir)
+		return false;
+
+	bool found = false, eadr = true;
+	while (auto entry = readdir(dir)) {
+		if (std::strncmp(entry->d_name, "region", std::strlen("region")) != 0)
+			continue;
+
+		std::ifstream domain_file(std::string(REGIONS_PATH) + "/" +
+					  entry->d_name + "/persistence_domain");
+		std::string domain;
+		if (!std::getline(domain_file, domain) || domain != "cpu_cache") {
+			eadr = false;
+			break;
+		}
+		found = true;
+	}
+	closedir(dir);
+
+	return found && eadr;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_POOL_PERSISTENCE_H
+#define LIBPMEMKV_POOL_PERSISTENCE_H
+
+#include <libpmemobj.h>
+#include <libpmemobj++/allocation_flag.hpp>
+
+#include <atomic>
+#include <cstddef>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Settings of how data is allocated and made persistent in a pool, set by
+ * pmemobj-based engines (from their configs) and kept per pool, outside of
+ * engines, so that they can be checked where data is written or allocated
+ * (e.g. by inline_string, constructed by containers, by nodes of persistent
+ * trees or by wrappers of libpmemobj functions in persist_stats.cc).
+ *
+ * Non-temporal threshold ("nontemporal_threshold" config parameter): values
+ * of at least that many bytes are copied to the pool with non-temporal stores,
+ * which bypass CPU caches: they don't evict other data from the LLC and don't
+ * read the destination lines before writing them. Data written this way needs
+ * no flush, only a drain (e.g. the one of the transaction's commit).
+ *
+ * eADR ("eadr" config parameter): CPU caches are in the persistence domain of
+ * the platform, so data in the pool needs no flushes, only fences - all
+ * flushes requested by engines (and libpmemobj-cpp) are skipped.
+ *
+ * Allocation classes ("alloc_classes" config parameter): engines register
+ * classes of objects of exactly the size of their nodes (e.g. leaves of stree
+ * and tree3), so that nodes are not rounded up to the default classes and
+ * don't share runs with other objects. Classes are not persistent, they are
+ * registered on every open of the pool.
+ *
+ * Arenas ("arenas" config parameter): the heap of the pool is set to use that
+ * many arenas for allocations (creating the missing ones). Every thread is
+ * assigned by libpmemobj to the arena with the fewest threads on its first
+ * allocation, so with at least as many arenas as writing threads, concurrent
+ * inserts don't contend on the locks of shared arenas. Arenas are not
+ * persistent either, they are set on every open of the pool.
+ *
+ * Arenas can also segregate objects: an arena created by create_pool_arena()
+ * is not assigned to threads, so it's used only by allocations made in
+ * an arena_scope of it (e.g. big values of stree, kept apart from its nodes).
+ */
+void set_nontemporal_threshold(PMEMobjpool *pop, std::size_t threshold);
+void set_pool_eadr(PMEMobjpool *pop);
+/*
+ * Returns id of the class, or 0 if it can't be registered (defaults are used).
+ * If alignment is not 0, objects are aligned to it and padded to its multiple.
+ */
+unsigned register_alloc_class(PMEMobjpool *pop, std::size_t size,
+			      std::size_t alignment = 0);
+void set_pool_arenas(PMEMobjpool *pop, std::size_t arenas);
+/* Returns id of the new arena, or 0 if it can't be created */
+unsigned create_pool_arena(PMEMobjpool *pop);
+
+/*
+ * Makes allocations of the calling thread (in the pool) use the given arena,
+ * until the end of the scope. Does nothing if the id is 0 or can't be set.
+ */
+class arena_scope {
+public:
+	arena_scope(PMEMobjpool *pop, unsigned arena_id);
+	~arena_scope();
+
+	arena_scope(const arena_scope &) = delete;
+	arena_scope &operator=(const arena_scope &) = delete;
+
+private:
+	PMEMobjpool *pop;
+	/* arena of the thread before the scope, 0 if it wasn't changed */
+	unsigned prev = 0;
+};
+
+/* clears all settings of the pool */
+void clear_pool_persistence(PMEMobjpool *pop) noexcept;
+
+std::size_t nontemporal_threshold(PMEMobjpool *pop) noexcept;
+bool pool_eadr(PMEMobjpool *pop) noexcept;
+unsigned alloc_class(PMEMobjpool *pop, std::size_t size) noexcept;
+
+/* numbers of pools with the settings set, so that lookups are skipped if 0 */
+extern std::atomic<std::size_t> nontemporal_pools;
+extern std::atomic<std::size_t> eadr_pools;
+extern std::atomic<std::size_t> alloc_class_pools;
+
+/*
+ * Returns true if all persistent memory regions of the platform report CPU
+ * caches as their persistence domain (as read from sysfs by libpmem2).
+ */
+bool platform_has_eadr() noexcept;
+
+/*
+ * Returns the pool of ptr, if a copy of size bytes to it should be done with
+ * non-temporal stores, or nullptr otherwise.
+ */
+inline PMEMobjpool *nontemporal_pool(const void *ptr, std::size_t size) noexcept
+{
+	if (nontemporal_pools.load(std::memory_order_relaxed) == 0)
+		return nullptr;
+
+	auto pop = pmemobj_pool_by_ptr(ptr);
+	auto threshold = nontemporal_threshold(pop);
+
+	return (threshold > 0 && size >= threshold) ? pop : nullptr;
+}
+
+/* Returns the flag of allocations of objects of size bytes in the pool */
+inline pmem::obj::allocation_flag alloc_class_flag(PMEMobjpool *pop,
+						   std::size_t size) noexcept
+{
+	if (alloc_class_pools.load(std::memory_order_relaxed) == 0)
+		return pmem::obj::allocation_flag::none();
+
+	auto id = alloc_class(pop, size);
+
+	return id ? pmem::obj::allocation_flag::class_id(id)
+		  : pmem::obj::allocation_flag::none();
+}
+
+/* Returns true if flushes of data in the pool should be skipped */
+inline bool skip_flushes(PMEMobjpool *pop) noexcept
+{
+	return eadr_pools.load(std::memory_order_relaxed) != 0 && pool_eadr(pop);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_POOL_PERSISTENCE_H */
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "prefault.h"
+#include "out.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+/* since Linux 5.14 */
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* parts of threads are aligned to huge pages, so no page is split between them */
+static const std::size_t PART_ALIGNMENT = 2 << 20;
+
+/*
+ * Finds the range of file mappings containing base in /proc/self/maps. Parts
+ * of a poolset are mapped one after another, so adjacent file mappings are
+ * included.
+ */
+static bool find_mapping(std::uintptr_t base, std::uintptr_t &start, std::uintptr_t &end)
+{
+	std::ifstream maps("/proc/self/maps");
+	std::string line;
+	bool found = false;
+
+	while (std::getline(maps, line)) {
+		std::uintptr_t s, e;
+		char path[2];
+		/* the pathname (if any) follows perms, offset, dev and inode */
+		int fields = std::sscanf(line.c_str(),
+					 "%" SCNxPTR "-%" SCNxPTR " %*s %*s %*s %*s %1s",
+					 &s, &e, path);
+		if (fields < 2)
+			continue;
+
+		if (!found) {
+			if (base >= s && base < e) {
+				start = s;
+				end = e;
+				found = true;
+			}
+		} else if (s == end && fields == 3) {
+			end = e;
+		} else {
+			break;
+		}
+	}
+
+	return found;
+}
+
+static void touch_pages(const char *begin, const char *end, std::size_t page_size)
+{
+	for (auto p = begin; p < end; p += page_size)
+		(void)*static_cast<const volatile char *>(p);
+}
+
+static void populate(char *begin, char *end, std::size_t page_size, bool write)
+{
+	if (madvise(begin, static_cast<std::size_t>(end - begin),
+		    write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) != 0)
+		touch_pages(begin, end, page_size);
+}
+
+std::size_t prefault_mapping(const void *base, std::size_t threads, bool write)
+{
+	std::uintptr_t start, end;
+	/* mapping of the pool not found, it's not prefaulted */
+	if (!find_mapping(reinterpret_cast<std::uintptr_t>(base), start, end))
+		return 0;
+
+	auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	auto size = static_cast<std::size_t>(end - start);
+	auto begin = reinterpret_cast<char *>(start);
+
+	threads = std::max<std::size_t>(1, threads);
+	auto part = (size / threads + PART_ALIGNMENT - 1) / PART_ALIGNMENT * PART_ALIGNMENT;
+
+	std::vector<std::thread> workers;
+	for (std::size_t off = part; off < size; off += part) {
+		auto part_end = begin + std::min(off + part, size);
+		try {
+			workers.emplace_back(populate, begin + off, part_end, page_size,
+					     write);
+		} catch (std::system_error &e) {
+			/* no more threads, the part is populated by the caller */
+			populate(begin + off, part_end, page_size, write);
+		}
+	}
+	/* the calling thread populates the first part */
+	populate(begin, begin + std::min(part, size), page_size, write);
+
+	for (auto &w : workers)
+		w.join();
+
+	return size;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_PREFAULT_H
+#define LIBPMEMKV_PREFAULT_H
+
+#include <cstddef>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Prefaults the whole mapping of a pool, so that page tables (and TLB, for
+ * pools mapped with 2 MB or 1 GB pages on DAX) are warm before the first
+ * operation, instead of paying page faults on the first accesses.
+ *
+ * The mapping containing 'base' (together with adjacent mappings of files,
+ * e.g. parts of a poolset) is split between 'threads' threads, which populate
+ * their parts by madvise(MADV_POPULATE_WRITE), or MADV_POPULATE_READ if
+ * 'write' is false (e.g. for private copy-on-write mappings, whose pages would
+ * be copied on write). On kernels without it, every page is read instead.
+ * Returns the number of prefaulted bytes.
+ */
+std::size_t prefault_mapping(const void *base, std::size_t threads, bool write);
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_PREFAULT_H */
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "prefetch.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr std::size_t prefetch_queue::max_pending;
+constexpr std::size_t prefetch_queue::chunk_size;
+
+prefetch_queue::prefetch_queue(walk_function walk, thread_pool &pool)
+    : walk(std::move(walk)),
+      task(new background_task([this] { return step(); }, background_task::idle,
+			       pool))
+{
+}
+
+void prefetch_queue::submit(string_view key)
+{
+	submit(prefetch_request{std::string(key.data(), key.size()), std::string(),
+				true});
+}
+
+void prefetch_queue::submit(string_view key1, string_view key2)
+{
+	submit(prefetch_request{std::string(key1.data(), key1.size()),
+				std::string(key2.data(), key2.size()), false});
+}
+
+void prefetch_queue::submit(prefetch_request request)
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		if (pending.size() >= max_pending)
+			return;
+		pending.push_back(std::move(request));
+	}
+
+	task->wake();
+}
+
+/* walks all pending requests, the next step is run when new ones are submitted */
+background_task::clock_type::duration prefetch_queue::step()
+{
+	while (true) {
+		prefetch_request request;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (pending.empty())
+				return background_task::idle;
+			request = std::move(pending.front());
+			pending.pop_front();
+		}
+
+		/* failed prefetch is not an error, as the request is only a hint */
+		try {
+			walk(request);
+		} catch (...) {
+		}
+	}
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_PREFETCH_H
+#define LIBPMEMKV_PREFETCH_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "libpmemkv.hpp"
+#include "thread_pool.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Prefetches all cache lines of [data, data + size) */
+inline void prefetch_bytes(const void *data, std::size_t size)
+{
+	auto p = static_cast<const char *>(data);
+	for (std::size_t off = 0; off < size; off += 64)
+		__builtin_prefetch(p + off);
+}
+
+/* Key (if 'point' is set) or range of keys [key1, key2] to be prefetched */
+struct prefetch_request {
+	std::string key1;
+	std::string key2;
+	bool point;
+};
+
+/**
+ * prefetch_queue walks keys or ranges of keys of an engine on a thread_pool,
+ * so callers of prefetch() and prefetch_range() don't wait for the walk.
+ * Requests are walked one after another, in order of submission, by a
+ * background_task. Prefetches are only hints, so requests submitted while
+ * max_pending of them are waiting are dropped.
+ *
+ * Destructor waits for the running walk (if any), so the walk function may
+ * use the engine owning the queue, if it's destroyed before the engine's data.
+ */
+class prefetch_queue {
+public:
+	using walk_function = std::function<void(const prefetch_request &)>;
+
+	static constexpr std::size_t max_pending = 64;
+	/*
+	 * number of elements of a range walked under one hold of the engine's
+	 * lock - it's released between chunks, so a long walk doesn't block
+	 * writers, and the next chunk starts at the first key not walked yet
+	 */
+	static constexpr std::size_t chunk_size = 256;
+
+	prefetch_queue(walk_function walk, thread_pool &pool = thread_pool::get_default());
+
+	prefetch_queue(const prefetch_queue &) = delete;
+	prefetch_queue &operator=(const prefetch_queue &) = delete;
+
+	void submit(string_view key);
+	void submit(string_view key1, string_view key2);
+
+private:
+	void submit(prefetch_request request);
+	background_task::clock_type::duration step();
+
+	walk_function walk;
+
+	std::mutex mtx;
+	std::deque<prefetch_request> pending;
+
+	/* declared last, so it's stopped before the other members are destroyed */
+	std::unique_ptr<background_task> task;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_PREFETCH_H */
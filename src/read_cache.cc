@@ -0,0 +1,746 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "read_cache.h"
+#include "exceptions.h"
+#include "fast_hash.h"
+
+#include <cstring>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+static constexpr std::size_t READ_CACHE_SHARDS = 64;
+
+static uint64_t cache_hash(string_view key)
+{
+	return fast_hash(key.size(), key.data());
+}
+
+read_cache_options read_cache_options::from_config(config &cfg)
+{
+	read_cache_options options;
+
+	uint64_t size;
+	if (cfg.get_uint64("read_cache_size", &size))
+		options.size = static_cast<std::size_t>(size);
+
+	const char *policy;
+	if (cfg.get_string("read_cache_policy", &policy)) {
+		if (std::strcmp(policy, "lru") == 0)
+			options.policy = hot_cache::eviction_policy::LRU;
+		else if (std::strcmp(policy, "clock") != 0)
+			throw internal::invalid_argument("Unknown read_cache_policy: " +
+							 std::string(policy));
+	}
+
+	const char *admission;
+	if (cfg.get_string("read_cache_admission", &admission)) {
+		if (std::strcmp(admission, "frequent") == 0)
+			options.frequent_only = true;
+		else if (std::strcmp(admission, "all") != 0)
+			throw internal::invalid_argument("Unknown read_cache_admission: " +
+							 std::string(admission));
+	}
+
+	uint64_t sampling = 0;
+	cfg.get_uint64("access_sampling", &sampling);
+	if (options.size > 0 && options.frequent_only && sampling == 0)
+		throw internal::invalid_argument(
+			"read_cache_admission \"frequent\" requires access_sampling");
+
+	return options;
+}
+
+cached_engine::cached_engine(std::unique_ptr<engine_base> engine,
+			     const read_cache_options &options)
+    : engine(std::move(engine)),
+      cache(options.size, READ_CACHE_SHARDS, options.policy),
+      frequent_only(options.frequent_only),
+      rejected(0)
+{
+}
+
+cached_engine::~cached_engine() = default;
+
+void cached_engine::invalidate(string_view key)
+{
+	cache.invalidate(cache_hash(key));
+}
+
+/* keys sampled at least once are the frequent ones, the access included */
+bool cached_engine::admit(string_view key)
+{
+	if (!frequent_only)
+		return true;
+
+	auto stats = access();
+	if (stats && stats->estimate(key) > 0)
+		return true;
+
+	rejected.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+struct fill_cache_context {
+	hot_cache *cache;
+	string_view key;
+	uint64_t hash;
+	uint64_t generation;
+	bool admitted;
+	get_v_callback *callback;
+	void *arg;
+};
+
+static void fill_cache(const char *v, size_t vb, void *arg)
+{
+	auto ctx = static_cast<fill_cache_context *>(arg);
+	if (ctx->admitted)
+		ctx->cache->put(ctx->key, ctx->hash, string_view(v, vb),
+				ctx->generation);
+	ctx->callback(v, vb, ctx->arg);
+}
+
+template <typename F>
+status cached_engine::cached_get(string_view key, get_v_callback *callback, void *arg,
+				 F &&get_f)
+{
+	auto hash = cache_hash(key);
+
+	uint64_t generation;
+	if (cache.get(key, hash, callback, arg, &generation))
+		return status::OK;
+
+	fill_cache_context ctx{&cache, key, hash, generation, admit(key), callback, arg};
+	return get_f(fill_cache, &ctx);
+}
+
+std::string cached_engine::name()
+{
+	return engine->name();
+}
+
+status cached_engine::count_all(std::size_t &cnt)
+{
+	return engine->count_all(cnt);
+}
+
+status cached_engine::count_above(string_view key, std::size_t &cnt)
+{
+	return engine->count_above(key, cnt);
+}
+
+status cached_engine::count_equal_above(string_view key, std::size_t &cnt)
+{
+	return engine->count_equal_above(key, cnt);
+}
+
+status cached_engine::count_equal_below(string_view key, std::size_t &cnt)
+{
+	return engine->count_equal_below(key, cnt);
+}
+
+status cached_engine::count_below(string_view key, std::size_t &cnt)
+{
+	return engine->count_below(key, cnt);
+}
+
+status cached_engine::count_between(string_view key1, string_view key2,
+				    std::size_t &cnt)
+{
+	return engine->count_between(key1, key2, cnt);
+}
+
+status cached_engine::count_between_approx(string_view key1, string_view key2,
+					   std::size_t &cnt)
+{
+	return engine->count_between_approx(key1, key2, cnt);
+}
+
+status cached_engine::get_all(get_kv_callback *callback, void *arg)
+{
+	return engine->get_all(callback, arg);
+}
+
+status cached_engine::get_all_parallel(std::size_t partitions,
+				       get_kv_callback *callback, void **args)
+{
+	return engine->get_all_parallel(partitions, callback, args);
+}
+
+status cached_engine::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	return engine->get_above(key, callback, arg);
+}
+
+status cached_engine::get_equal_above(string_view key, get_kv_callback *callback,
+				      void *arg)
+{
+	return engine->get_equal_above(key, callback, arg);
+}
+
+status cached_engine::get_equal_below(string_view key, get_kv_callback *callback,
+				      void *arg)
+{
+	return engine->get_equal_below(key, callback, arg);
+}
+
+status cached_engine::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	return engine->get_below(key, callback, arg);
+}
+
+status cached_engine::get_between(string_view key1, string_view key2,
+				  get_kv_callback *callback, void *arg)
+{
+	return engine->get_between(key1, key2, callback, arg);
+}
+
+status cached_engine::get_between_parallel(string_view key1, string_view key2,
+					   std::size_t partitions,
+					   get_kv_callback *callback, void **args)
+{
+	return engine->get_between_parallel(key1, key2, partitions, callback, args);
+}
+
+status cached_engine::get_above_paged(string_view key, std::size_t offset,
+				      std::size_t limit, get_kv_callback *callback,
+				      void *arg)
+{
+	return engine->get_above_paged(key, offset, limit, callback, arg);
+}
+
+status cached_engine::get_between_paged(string_view key1, string_view key2,
+					std::size_t offset, std::size_t limit,
+					get_kv_callback *callback, void *arg)
+{
+	return engine->get_between_paged(key1, key2, offset, limit, callback, arg);
+}
+
+status cached_engine::get_prefix(string_view prefix, get_kv_callback *callback,
+				 void *arg)
+{
+	return engine->get_prefix(prefix, callback, arg);
+}
+
+status cached_engine::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	return engine->get_keys_all(callback, arg);
+}
+
+status cached_engine::get_keys_between(string_view key1, string_view key2,
+				       get_kv_callback *callback, void *arg)
+{
+	return engine->get_keys_between(key1, key2, callback, arg);
+}
+
+status cached_engine::prefetch(string_view key)
+{
+	return engine->prefetch(key);
+}
+
+status cached_engine::prefetch_range(string_view key1, string_view key2)
+{
+	return engine->prefetch_range(key1, key2);
+}
+
+static void ignore_value(const char *, size_t, void *)
+{
+}
+
+status cached_engine::exists(string_view key)
+{
+	if (cache.get(key, cache_hash(key), ignore_value, nullptr))
+		return status::OK;
+
+	return engine->exists(key);
+}
+
+status cached_engine::get(string_view key, get_v_callback *callback, void *arg)
+{
+	return cached_get(key, callback, arg, [&](get_v_callback *cb, void *ctx) {
+		return engine->get(key, cb, ctx);
+	});
+}
+
+/* sizes are not cached, the engine reads them without reading values */
+status cached_engine::value_size(string_view key, std::size_t &size)
+{
+	return engine->value_size(key, size);
+}
+
+static void copy_value(const char *v, size_t vb, void *arg)
+{
+	static_cast<std::string *>(arg)->assign(v, vb);
+}
+
+struct get_batch_context {
+	hot_cache &cache;
+	const string_view *keys;
+	const std::vector<uint64_t> &hashes;
+	const std::vector<uint64_t> &generations;
+	/* indexes (in the whole batch) of keys which are not cached */
+	const std::vector<std::size_t> &missed;
+	const std::vector<bool> &admitted;
+	std::size_t next;
+
+	std::vector<std::string> &values;
+	std::vector<bool> &found;
+};
+
+/*
+ * Underlying get_batch() calls the callback in order of keys, only for the
+ * present ones - keys skipped since the previous call were not found.
+ */
+static int get_batch_fill(const char *k, size_t kb, const char *v, size_t vb,
+			  void *arg)
+{
+	auto c = static_cast<get_batch_context *>(arg);
+	while (c->keys[c->missed[c->next]].compare(string_view(k, kb)) != 0)
+		++c->next;
+
+	auto i = c->missed[c->next++];
+	if (c->admitted[i])
+		c->cache.put(c->keys[i], c->hashes[i], string_view(v, vb),
+			     c->generations[i]);
+	c->values[i].assign(v, vb);
+	c->found[i] = true;
+
+	return 0;
+}
+
+/*
+ * Keys which are not cached are read by a single get_batch() of the underlying
+ * engine (so it can still overlap lookups). Values are copied, so that the
+ * callback can be called in order of the keys, after all lookups.
+ */
+status cached_engine::get_batch(const string_view *keys, std::size_t n,
+				get_kv_callback *callback, void *arg)
+{
+	std::vector<uint64_t> hashes(n), generations(n);
+	std::vector<std::string> values(n);
+	std::vector<bool> found(n, false), admitted(n, false);
+
+	std::vector<std::size_t> missed;
+	std::vector<string_view> missed_keys;
+	for (std::size_t i = 0; i < n; ++i) {
+		hashes[i] = cache_hash(keys[i]);
+		found[i] = cache.get(keys[i], hashes[i], copy_value, &values[i],
+				     &generations[i]);
+		if (!found[i]) {
+			missed.push_back(i);
+			missed_keys.push_back(keys[i]);
+			admitted[i] = admit(keys[i]);
+		}
+	}
+
+	if (!missed.empty()) {
+		get_batch_context ctx{cache,	keys, hashes, generations, missed,
+				      admitted, 0,    values, found};
+
+		auto s = engine->get_batch(missed_keys.data(), missed_keys.size(),
+					   get_batch_fill, &ctx);
+		if (s != status::OK && s != status::NOT_FOUND)
+			return s;
+	}
+
+	auto s = status::OK;
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!found[i]) {
+			s = status::NOT_FOUND;
+			continue;
+		}
+
+		auto ret = callback(keys[i].data(), keys[i].size(), values[i].data(),
+				    values[i].size(), arg);
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return s;
+}
+
+/*
+ * Writes are passed to the underlying engine first and the cached entry is
+ * invalidated after that, so a concurrent get() can't cache the old value
+ * (see hot_cache::put() with a generation).
+ */
+status cached_engine::put(string_view key, string_view value)
+{
+	auto s = engine->put(key, value);
+	invalidate(key);
+
+	return s;
+}
+
+uint64_t cached_engine::key_hash(string_view key)
+{
+	return engine->key_hash(key);
+}
+
+status cached_engine::exists_hashed(string_view key, uint64_t hash)
+{
+	if (cache.get(key, cache_hash(key), ignore_value, nullptr))
+		return status::OK;
+
+	return engine->exists_hashed(key, hash);
+}
+
+status cached_engine::get_hashed(string_view key, uint64_t hash,
+				 get_v_callback *callback, void *arg)
+{
+	return cached_get(key, callback, arg, [&](get_v_callback *cb, void *ctx) {
+		return engine->get_hashed(key, hash, cb, ctx);
+	});
+}
+
+status cached_engine::put_hashed(string_view key, uint64_t hash, string_view value)
+{
+	auto s = engine->put_hashed(key, hash, value);
+	invalidate(key);
+
+	return s;
+}
+
+status cached_engine::put_batch(const string_view *keys, const string_view *values,
+				std::size_t n)
+{
+	auto s = engine->put_batch(keys, values, n);
+	for (std::size_t i = 0; i < n; ++i)
+		invalidate(keys[i]);
+
+	return s;
+}
+
+status cached_engine::update(string_view key, update_callback *callback, void *arg)
+{
+	auto s = engine->update(key, callback, arg);
+	invalidate(key);
+
+	return s;
+}
+
+status cached_engine::read_value(string_view key, std::size_t pos, std::size_t n,
+				 get_v_callback *callback, void *arg)
+{
+	return engine->read_value(key, pos, n, callback, arg);
+}
+
+status cached_engine::write_value(string_view key, std::size_t pos, string_view data)
+{
+	auto s = engine->write_value(key, pos, data);
+	invalidate(key);
+
+	return s;
+}
+
+status cached_engine::append_value(string_view key, string_view data)
+{
+	auto s = engine->append_value(key, data);
+	invalidate(key);
+
+	return s;
+}
+
+status cached_engine::compare_exchange(string_view key, string_view expected,
+				       string_view desired)
+{
+	auto s = engine->compare_exchange(key, expected, desired);
+	invalidate(key);
+
+	return s;
+}
+
+status cached_engine::fetch_add(string_view key, uint64_t delta, uint64_t &old_value)
+{
+	auto s = engine->fetch_add(key, delta, old_value);
+	invalidate(key);
+
+	return s;
+}
+
+status cached_engine::put_if_absent(string_view key, string_view value, bool &inserted)
+{
+	auto s = engine->put_if_absent(key, value, inserted);
+	if (inserted)
+		invalidate(key);
+
+	return s;
+}
+
+status cached_engine::remove(string_view key)
+{
+	auto s = engine->remove(key);
+	invalidate(key);
+
+	return s;
+}
+
+status cached_engine::take(string_view key, get_v_callback *callback, void *arg)
+{
+	auto s = engine->take(key, callback, arg);
+	invalidate(key);
+
+	return s;
+}
+
+/* removed keys are not known, so the whole cache is cleared */
+status cached_engine::remove_between(string_view key1, string_view key2,
+				     std::size_t &cnt)
+{
+	auto s = engine->remove_between(key1, key2, cnt);
+	cache.clear();
+
+	return s;
+}
+
+status cached_engine::defrag(double start_percent, double amount_percent)
+{
+	return engine->defrag(start_percent, amount_percent);
+}
+
+status cached_engine::sync()
+{
+	return engine->sync();
+}
+
+status cached_engine::snapshot_save(const std::string &path)
+{
+	return engine->snapshot_save(path);
+}
+
+status cached_engine::snapshot_load(const std::string &path)
+{
+	auto s = engine->snapshot_load(path);
+	cache.clear();
+
+	return s;
+}
+
+status cached_engine::snapshot_export(int fd, uint64_t max_bytes_per_sec)
+{
+	return engine->snapshot_export(fd, max_bytes_per_sec);
+}
+
+/* Transaction which invalidates cached entries of written keys on commit */
+class cached_transaction : public transaction {
+public:
+	cached_transaction(cached_engine *engine, transaction *tx)
+	    : engine(engine), tx(tx)
+	{
+	}
+
+	status put(string_view key, string_view value) final
+	{
+		written.emplace_back(key.data(), key.size());
+		return tx->put(key, value);
+	}
+
+	status remove(string_view key) final
+	{
+		written.emplace_back(key.data(), key.size());
+		return tx->remove(key);
+	}
+
+	status get(string_view key, get_v_callback *callback, void *arg) final
+	{
+		return tx->get(key, callback, arg);
+	}
+
+	status commit() final
+	{
+		auto s = tx->commit();
+		for (auto &key : written)
+			engine->invalidate(key);
+		written.clear();
+
+		return s;
+	}
+
+	void abort() final
+	{
+		tx->abort();
+		written.clear();
+	}
+
+private:
+	cached_engine *engine;
+	std::unique_ptr<transaction> tx;
+	std::vector<std::string> written;
+};
+
+internal::transaction *cached_engine::begin_tx()
+{
+	std::unique_ptr<transaction> tx(engine->begin_tx());
+	auto result = new cached_transaction(this, tx.get());
+	tx.release();
+
+	return result;
+}
+
+/*
+ * Write iterator which invalidates cached entries of keys, whose values were
+ * returned by write_range, on commit.
+ */
+class cached_write_iterator : public iterator_base {
+public:
+	cached_write_iterator(cached_engine *engine, iterator_base *it)
+	    : engine(engine), it(it)
+	{
+	}
+
+	status seek(string_view key) final
+	{
+		return it->seek(key);
+	}
+
+	status seek_lower(string_view key) final
+	{
+		return it->seek_lower(key);
+	}
+
+	status seek_lower_eq(string_view key) final
+	{
+		return it->seek_lower_eq(key);
+	}
+
+	status seek_higher(string_view key) final
+	{
+		return it->seek_higher(key);
+	}
+
+	status seek_higher_eq(string_view key) final
+	{
+		return it->seek_higher_eq(key);
+	}
+
+	status seek_prefix(string_view prefix) final
+	{
+		return it->seek_prefix(prefix);
+	}
+
+	status seek_to_first() final
+	{
+		return it->seek_to_first();
+	}
+
+	status seek_to_last() final
+	{
+		return it->seek_to_last();
+	}
+
+	status is_next() final
+	{
+		return it->is_next();
+	}
+
+	status next() final
+	{
+		return it->next();
+	}
+
+	status prev() final
+	{
+		return it->prev();
+	}
+
+	status next_batch(iterator_batch &batch) final
+	{
+		return it->next_batch(batch);
+	}
+
+	status set_upper_bound(const string_view *key) final
+	{
+		return it->set_upper_bound(key);
+	}
+
+	result<string_view> key() final
+	{
+		return it->key();
+	}
+
+	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final
+	{
+		return it->read_range(pos, n);
+	}
+
+	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final
+	{
+		auto range = it->write_range(pos, n);
+		auto key = it->key();
+		if (range.is_ok() && key.is_ok()) {
+			auto k = key.get_value();
+			if (written.empty() || k.compare(written.back()) != 0)
+				written.emplace_back(k.data(), k.size());
+		}
+
+		return range;
+	}
+
+	status commit() final
+	{
+		auto s = it->commit();
+		for (auto &key : written)
+			engine->invalidate(key);
+		written.clear();
+
+		return s;
+	}
+
+	void abort() final
+	{
+		it->abort();
+		written.clear();
+	}
+
+	void reset() final
+	{
+		it->reset();
+		written.clear();
+	}
+
+private:
+	cached_engine *engine;
+	std::unique_ptr<iterator_base> it;
+	std::vector<std::string> written;
+};
+
+internal::iterator_base *cached_engine::new_iterator()
+{
+	std::unique_ptr<iterator_base> it(engine->new_iterator());
+	auto result = new cached_write_iterator(this, it.get());
+	it.release();
+
+	return result;
+}
+
+/* read iterators don't use the cache */
+internal::iterator_base *cached_engine::new_const_iterator()
+{
+	return engine->new_const_iterator();
+}
+
+status cached_engine::stats(internal::stats_sink &sink)
+{
+	auto s = engine->stats(sink);
+	if (s != status::OK)
+		return s;
+
+	auto cache_stats = cache.stats();
+	sink.add("read_cache.hits", cache_stats.hits);
+	sink.add("read_cache.misses", cache_stats.misses);
+	sink.add("read_cache.entries", cache_stats.entries);
+	sink.add("read_cache.used_bytes", cache_stats.used);
+	sink.add("read_cache.rejected", rejected.load(std::memory_order_relaxed));
+
+	return status::OK;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_READ_CACHE_H
+#define LIBPMEMKV_READ_CACHE_H
+
+#include "config.h"
+#include "engine.h"
+#include "hot_cache.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Read cache parameters read from the config ("read_cache*" items) */
+struct read_cache_options {
+	/* budget of the cache in bytes, 0 if it's disabled */
+	std::size_t size = 0;
+	hot_cache::eviction_policy policy = hot_cache::eviction_policy::CLOCK;
+	/*
+	 * If set ("read_cache_admission" is "frequent"), only values of keys with
+	 * sampled accesses ("access_sampling") are cached, so e.g. a scan of many
+	 * keys, each read once, doesn't evict the hot ones.
+	 */
+	bool frequent_only = false;
+
+	static read_cache_options from_config(config &cfg);
+};
+
+/*
+ * Engine which keeps copies of recently read values of the underlying engine
+ * in a DRAM cache (hot_cache), so repeated reads of hot keys don't access
+ * the underlying, persistent, memory. Every write is passed to the underlying
+ * engine before invalidating the cached entry (write-through), writes of
+ * unknown keys (remove_between, snapshot_load) clear the whole cache.
+ *
+ * Scans, counts and transactional reads go directly to the underlying engine.
+ *
+ * Access statistics of the database (access_stats) are the ones of this
+ * engine, it's the outermost one (see pmemkv_open()).
+ */
+class cached_engine : public engine_base {
+public:
+	cached_engine(std::unique_ptr<engine_base> engine,
+		      const read_cache_options &options);
+	~cached_engine();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_between_approx(string_view key1, string_view key2,
+				    std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2,
+				    std::size_t partitions, get_kv_callback *callback,
+				    void **args) final;
+	status get_above_paged(string_view key, std::size_t offset, std::size_t limit,
+			       get_kv_callback *callback, void *arg) final;
+	status get_between_paged(string_view key1, string_view key2, std::size_t offset,
+				 std::size_t limit, get_kv_callback *callback,
+				 void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
+	status get_keys_between(string_view key1, string_view key2,
+				get_kv_callback *callback, void *arg) final;
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status value_size(string_view key, std::size_t &size) final;
+	status get_batch(const string_view *keys, std::size_t n,
+			 get_kv_callback *callback, void *arg) final;
+
+	status put(string_view key, string_view value) final;
+
+	uint64_t key_hash(string_view key) final;
+	status exists_hashed(string_view key, uint64_t hash) final;
+	status get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			  void *arg) final;
+	status put_hashed(string_view key, uint64_t hash, string_view value) final;
+
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+
+	status read_value(string_view key, std::size_t pos, std::size_t n,
+			  get_v_callback *callback, void *arg) final;
+	status write_value(string_view key, std::size_t pos, string_view data) final;
+	status append_value(string_view key, string_view data) final;
+	status compare_exchange(string_view key, string_view expected,
+				string_view desired) final;
+	status fetch_add(string_view key, uint64_t delta, uint64_t &old_value) final;
+	status put_if_absent(string_view key, string_view value, bool &inserted) final;
+
+	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2,
+			      std::size_t &cnt) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+	status sync() final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
+	status snapshot_export(int fd, uint64_t max_bytes_per_sec) final;
+
+	internal::transaction *begin_tx() final;
+
+	internal::iterator_base *new_iterator() final;
+	internal::iterator_base *new_const_iterator() final;
+
+	status stats(internal::stats_sink &sink) final;
+
+	/* removes the cached entry of the key, after it was modified */
+	void invalidate(string_view key);
+
+private:
+	/*
+	 * Calls get_f(cb, arg) of the underlying engine on a cache miss, caching
+	 * the value it passes to the callback.
+	 */
+	template <typename F>
+	status cached_get(string_view key, get_v_callback *callback, void *arg,
+			  F &&get_f);
+
+	/* checks if a missed value of the key should be cached */
+	bool admit(string_view key);
+
+	std::unique_ptr<engine_base> engine;
+	hot_cache cache;
+	bool frequent_only;
+	std::atomic<uint64_t> rejected;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_READ_CACHE_H */
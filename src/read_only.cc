@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "read_only.h"
+#include "exceptions.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+[[noreturn]] static void throw_read_only()
+{
+	throw internal::not_supported("Database is opened read-only");
+}
+
+read_only_engine::read_only_engine(std::unique_ptr<engine_base> engine)
+    : engine(std::move(engine))
+{
+}
+
+std::string read_only_engine::name()
+{
+	return engine->name();
+}
+
+status read_only_engine::count_all(std::size_t &cnt)
+{
+	return engine->count_all(cnt);
+}
+
+status read_only_engine::count_above(string_view key, std::size_t &cnt)
+{
+	return engine->count_above(key, cnt);
+}
+
+status read_only_engine::count_equal_above(string_view key, std::size_t &cnt)
+{
+	return engine->count_equal_above(key, cnt);
+}
+
+status read_only_engine::count_equal_below(string_view key, std::size_t &cnt)
+{
+	return engine->count_equal_below(key, cnt);
+}
+
+status read_only_engine::count_below(string_view key, std::size_t &cnt)
+{
+	return engine->count_below(key, cnt);
+}
+
+status read_only_engine::count_between(string_view key1, string_view key2,
+				       std::size_t &cnt)
+{
+	return engine->count_between(key1, key2, cnt);
+}
+
+status read_only_engine::count_between_approx(string_view key1, string_view key2,
+					      std::size_t &cnt)
+{
+	return engine->count_between_approx(key1, key2, cnt);
+}
+
+status read_only_engine::get_all(get_kv_callback *callback, void *arg)
+{
+	return engine->get_all(callback, arg);
+}
+
+status read_only_engine::get_all_parallel(std::size_t partitions,
+					  get_kv_callback *callback, void **args)
+{
+	return engine->get_all_parallel(partitions, callback, args);
+}
+
+status read_only_engine::get_above(string_view key, get_kv_callback *callback,
+				   void *arg)
+{
+	return engine->get_above(key, callback, arg);
+}
+
+status read_only_engine::get_equal_above(string_view key, get_kv_callback *callback,
+					 void *arg)
+{
+	return engine->get_equal_above(key, callback, arg);
+}
+
+status read_only_engine::get_equal_below(string_view key, get_kv_callback *callback,
+					 void *arg)
+{
+	return engine->get_equal_below(key, callback, arg);
+}
+
+status read_only_engine::get_below(string_view key, get_kv_callback *callback,
+				   void *arg)
+{
+	return engine->get_below(key, callback, arg);
+}
+
+status read_only_engine::get_between(string_view key1, string_view key2,
+				     get_kv_callback *callback, void *arg)
+{
+	return engine->get_between(key1, key2, callback, arg);
+}
+
+status read_only_engine::get_between_parallel(string_view key1, string_view key2,
+					      std::size_t partitions,
+					      get_kv_callback *callback, void **args)
+{
+	return engine->get_between_parallel(key1, key2, partitions, callback, args);
+}
+
+status read_only_engine::get_above_paged(string_view key, std::size_t offset,
+					 std::size_t limit, get_kv_callback *callback,
+					 void *arg)
+{
+	return engine->get_above_paged(key, offset, limit, callback, arg);
+}
+
+status read_only_engine::get_between_paged(string_view key1, string_view key2,
+					   std::size_t offset, std::size_t limit,
+					   get_kv_callback *callback, void *arg)
+{
+	return engine->get_between_paged(key1, key2, offset, limit, callback, arg);
+}
+
+status read_only_engine::get_prefix(string_view prefix, get_kv_callback *callback,
+				    void *arg)
+{
+	return engine->get_prefix(prefix, callback, arg);
+}
+
+status read_only_engine::get_keys_all(get_kv_callback *callback, void *arg)
+{
+	return engine->get_keys_all(callback, arg);
+}
+
+status read_only_engine::get_keys_between(string_view key1, string_view key2,
+					  get_kv_callback *callback, void *arg)
+{
+	return engine->get_keys_between(key1, key2, callback, arg);
+}
+
+status read_only_engine::prefetch(string_view key)
+{
+	return engine->prefetch(key);
+}
+
+status read_only_engine::prefetch_range(string_view key1, string_view key2)
+{
+	return engine->prefetch_range(key1, key2);
+}
+
+status read_only_engine::exists(string_view key)
+{
+	return engine->exists(key);
+}
+
+status read_only_engine::get(string_view key, get_v_callback *callback, void *arg)
+{
+	return engine->get(key, callback, arg);
+}
+
+status read_only_engine::value_size(string_view key, std::size_t &size)
+{
+	return engine->value_size(key, size);
+}
+
+status read_only_engine::get_batch(const string_view *keys, std::size_t n,
+				   get_kv_callback *callback, void *arg)
+{
+	return engine->get_batch(keys, n, callback, arg);
+}
+
+status read_only_engine::get_pinned(string_view key,
+				    std::unique_ptr<internal::pinned_value_base> &pinned)
+{
+	return engine->get_pinned(key, pinned);
+}
+
+status read_only_engine::put(string_view key, string_view value)
+{
+	throw_read_only();
+}
+
+uint64_t read_only_engine::key_hash(string_view key)
+{
+	return engine->key_hash(key);
+}
+
+status read_only_engine::exists_hashed(string_view key, uint64_t hash)
+{
+	return engine->exists_hashed(key, hash);
+}
+
+status read_only_engine::get_hashed(string_view key, uint64_t hash,
+				    get_v_callback *callback, void *arg)
+{
+	return engine->get_hashed(key, hash, callback, arg);
+}
+
+status read_only_engine::put_hashed(string_view key, uint64_t hash, string_view value)
+{
+	throw_read_only();
+}
+
+status read_only_engine::put_batch(const string_view *keys, const string_view *values,
+				   std::size_t n)
+{
+	throw_read_only();
+}
+
+status read_only_engine::update(string_view key, update_callback *callback, void *arg)
+{
+	throw_read_only();
+}
+
+status read_only_engine::read_value(string_view key, std::size_t pos, std::size_t n,
+				    get_v_callback *callback, void *arg)
+{
+	return engine->read_value(key, pos, n, callback, arg);
+}
+
+status read_only_engine::write_value(string_view key, std::size_t pos,
+				     string_view data)
+{
+	throw_read_only();
+}
+
+status read_only_engine::append_value(string_view key, string_view data)
+{
+	throw_read_only();
+}
+
+status read_only_engine::compare_exchange(string_view key, string_view expected,
+					  string_view desired)
+{
+	throw_read_only();
+}
+
+status read_only_engine::fetch_add(string_view key, uint64_t delta, uint64_t &old_value)
+{
+	throw_read_only();
+}
+
+status read_only_engine::put_if_absent(string_view key, string_view value,
+				       bool &inserted)
+{
+	throw_read_only();
+}
+
+status read_only_engine::remove(string_view key)
+{
+	throw_read_only();
+}
+
+status read_only_engine::take(string_view key, get_v_callback *callback, void *arg)
+{
+	throw_read_only();
+}
+
+status read_only_engine::remove_between(string_view key1, string_view key2,
+					std::size_t &cnt)
+{
+	throw_read_only();
+}
+
+status read_only_engine::defrag(double start_percent, double amount_percent)
+{
+	throw_read_only();
+}
+
+status read_only_engine::sync()
+{
+	return engine->sync();
+}
+
+status read_only_engine::snapshot_save(const std::string &path)
+{
+	return engine->snapshot_save(path);
+}
+
+status read_only_engine::snapshot_load(const std::string &path)
+{
+	throw_read_only();
+}
+
+status read_only_engine::snapshot_export(int fd, uint64_t max_bytes_per_sec)
+{
+	return engine->snapshot_export(fd, max_bytes_per_sec);
+}
+
+internal::transaction *read_only_engine::begin_tx()
+{
+	throw_read_only();
+}
+
+internal::iterator_base *read_only_engine::new_iterator()
+{
+	throw_read_only();
+}
+
+internal::iterator_base *read_only_engine::new_const_iterator()
+{
+	return engine->new_const_iterator();
+}
+
+status read_only_engine::stats(internal::stats_sink &sink)
+{
+	return engine->stats(sink);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
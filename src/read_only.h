@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_READ_ONLY_H
+#define LIBPMEMKV_READ_ONLY_H
+
+#include "engine.h"
+
+#include <memory>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Engine opened with the "read_only" config flag. Reads (including const
+ * iterators and snapshot_save) are passed to the underlying engine, all
+ * writes throw internal::not_supported - the pool of a pmemobj-based engine
+ * is mapped copy-on-write, so nothing written to it would be persisted.
+ */
+class read_only_engine : public engine_base {
+public:
+	read_only_engine(std::unique_ptr<engine_base> engine);
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_between_approx(string_view key1, string_view key2,
+				    std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2,
+				    std::size_t partitions, get_kv_callback *callback,
+				    void **args) final;
+	status get_above_paged(string_view key, std::size_t offset, std::size_t limit,
+			       get_kv_callback *callback, void *arg) final;
+	status get_between_paged(string_view key1, string_view key2, std::size_t offset,
+				 std::size_t limit, get_kv_callback *callback,
+				 void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status get_keys_all(get_kv_callback *callback, void *arg) final;
+	status get_keys_between(string_view key1, string_view key2,
+				get_kv_callback *callback, void *arg) final;
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status value_size(string_view key, std::size_t &size) final;
+	status get_batch(const string_view *keys, std::size_t n,
+			 get_kv_callback *callback, void *arg) final;
+	status get_pinned(string_view key,
+			  std::unique_ptr<internal::pinned_value_base> &pinned) final;
+
+	status put(string_view key, string_view value) final;
+
+	uint64_t key_hash(string_view key) final;
+	status exists_hashed(string_view key, uint64_t hash) final;
+	status get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			  void *arg) final;
+	status put_hashed(string_view key, uint64_t hash, string_view value) final;
+
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+
+	status read_value(string_view key, std::size_t pos, std::size_t n,
+			  get_v_callback *callback, void *arg) final;
+	status write_value(string_view key, std::size_t pos, string_view data) final;
+	status append_value(string_view key, string_view data) final;
+	status compare_exchange(string_view key, string_view expected,
+				string_view desired) final;
+	status fetch_add(string_view key, uint64_t delta, uint64_t &old_value) final;
+	status put_if_absent(string_view key, string_view value, bool &inserted) final;
+
+	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2,
+			      std::size_t &cnt) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+	status sync() final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
+	status snapshot_export(int fd, uint64_t max_bytes_per_sec) final;
+
+	internal::transaction *begin_tx() final;
+
+	internal::iterator_base *new_iterator() final;
+	internal::iterator_base *new_const_iterator() final;
+
+	status stats(internal::stats_sink &sink) final;
+
+private:
+	std::unique_ptr<engine_base> engine;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_READ_ONLY_H */
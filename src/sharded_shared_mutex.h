@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_SHARDED_SHARED_MUTEX_H
+#define LIBPMEMKV_SHARDED_SHARED_MUTEX_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "stats.h"
+#include "thread_id.h"
+#include "trace.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * A thread starts and ends waiting for a lock: fires lock__wait and
+ * lock__acquired probes and marks the lock wait phase of a traced slow
+ * operation (see slow_op_log).
+ */
+inline void lock_wait_begin(const void *mutex) noexcept
+{
+	PMEMKV_PROBE1(lock__wait, mutex);
+	slow_op_phase_begin(slow_op_phase::LOCK_WAIT);
+}
+
+inline void lock_wait_end(const void *mutex) noexcept
+{
+	PMEMKV_PROBE1(lock__acquired, mutex);
+	slow_op_phase_end(slow_op_phase::LOCK_WAIT);
+}
+
+/**
+ * sharded_shared_mutex is a reader-writer lock optimized for readers: each
+ * reader locks only one of the shards (picked by thread_id()), so readers
+ * running on different shards don't share any cache line. Writer has to lock
+ * all the shards.
+ *
+ * It meets the requirements of SharedMutex (except try_ functions), so it
+ * can be used with std::unique_lock and shared_lock_guard.
+ *
+ * A thread which has to wait for a shard fires lock__wait and lock__acquired
+ * probes (with address of the mutex).
+ */
+class sharded_shared_mutex {
+public:
+	explicit sharded_shared_mutex(std::size_t shards_number)
+	    : shards_number(shards_number ? shards_number : 1),
+	      shards(new shard[this->shards_number])
+	{
+	}
+
+	sharded_shared_mutex(const sharded_shared_mutex &) = delete;
+	sharded_shared_mutex &operator=(const sharded_shared_mutex &) = delete;
+
+	void lock()
+	{
+		for (std::size_t i = 0; i < shards_number; ++i)
+			lock_shard(shards[i].mtx);
+	}
+
+	void unlock()
+	{
+		for (std::size_t i = shards_number; i > 0; --i)
+			shards[i - 1].mtx.unlock();
+	}
+
+	void lock_shared()
+	{
+		lock_shard(shards[thread_id() % shards_number].mtx);
+	}
+
+	void unlock_shared()
+	{
+		shards[thread_id() % shards_number].mtx.unlock();
+	}
+
+private:
+	void lock_shard(std::mutex &mtx)
+	{
+		if (mtx.try_lock())
+			return;
+
+		lock_wait_begin(this);
+		mtx.lock();
+		lock_wait_end(this);
+	}
+
+	struct shard {
+		std::mutex mtx;
+		/* avoids false sharing between neighbouring shards */
+		char padding[64];
+	};
+
+	std::size_t shards_number;
+	std::unique_ptr<shard[]> shards;
+};
+
+/**
+ * reader_indicator_mutex is a reader-writer lock in which readers only
+ * increment a counter in one of the shards (picked by thread_id()) and check
+ * that there is no writer, so readers running on different shards don't share
+ * any written cache line. Unlike sharded_shared_mutex, threads on the same
+ * shard don't exclude each other, so a thread may hold it shared more than
+ * once (e.g. by an iterator), as long as no writer is waiting.
+ *
+ * Writers are serialized by a mutex, announce themselves and wait (yielding)
+ * until readers of all shards leave; new readers wait until the writer is done.
+ *
+ * It meets the requirements of SharedMutex, and try_lock_for() lets a writer
+ * give up instead of blocking new readers forever.
+ * Waiting threads fire the same probes as sharded_shared_mutex.
+ */
+class reader_indicator_mutex {
+public:
+	explicit reader_indicator_mutex(std::size_t shards_number)
+	    : shards_number(shards_number ? shards_number : 1),
+	      shards(new shard[this->shards_number]), writer(false)
+	{
+		for (std::size_t i = 0; i < this->shards_number; ++i)
+			shards[i].readers = 0;
+	}
+
+	reader_indicator_mutex(const reader_indicator_mutex &) = delete;
+	reader_indicator_mutex &operator=(const reader_indicator_mutex &) = delete;
+
+	void lock()
+	{
+		bool waited = !writer_mtx.try_lock();
+		if (waited) {
+			lock_wait_begin(this);
+			writer_mtx.lock();
+		}
+
+		writer = true;
+		for (std::size_t i = 0; i < shards_number; ++i) {
+			while (shards[i].readers.load() != 0) {
+				if (!waited) {
+					lock_wait_begin(this);
+					waited = true;
+				}
+				std::this_thread::yield();
+			}
+		}
+
+		if (waited)
+			lock_wait_end(this);
+	}
+
+	bool try_lock()
+	{
+		if (!writer_mtx.try_lock())
+			return false;
+
+		writer = true;
+		for (std::size_t i = 0; i < shards_number; ++i) {
+			if (shards[i].readers.load() != 0) {
+				unlock();
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/*
+	 * Waits for readers at most for the given time; if they don't leave,
+	 * lets new readers in again and returns false.
+	 */
+	template <typename Rep, typename Period>
+	bool try_lock_for(const std::chrono::duration<Rep, Period> &timeout)
+	{
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		if (!writer_mtx.try_lock())
+			return false;
+
+		writer = true;
+		for (std::size_t i = 0; i < shards_number; ++i) {
+			while (shards[i].readers.load() != 0) {
+				if (std::chrono::steady_clock::now() >= deadline) {
+					unlock();
+					return false;
+				}
+				std::this_thread::yield();
+			}
+		}
+
+		return true;
+	}
+
+	void unlock()
+	{
+		writer = false;
+		writer_mtx.unlock();
+	}
+
+	void lock_shared()
+	{
+		auto &s = shards[thread_id() % shards_number];
+		bool waited = false;
+		while (true) {
+			s.readers++;
+
+			/* writer checks readers after setting the flag */
+			if (!writer.load()) {
+				if (waited)
+					lock_wait_end(this);
+				return;
+			}
+
+			s.readers--;
+			if (!waited) {
+				lock_wait_begin(this);
+				waited = true;
+			}
+			while (writer.load())
+				std::this_thread::yield();
+		}
+	}
+
+	bool try_lock_shared()
+	{
+		auto &s = shards[thread_id() % shards_number];
+		s.readers++;
+		if (!writer.load())
+			return true;
+
+		s.readers--;
+		return false;
+	}
+
+	void unlock_shared()
+	{
+		shards[thread_id() % shards_number].readers--;
+	}
+
+private:
+	struct shard {
+		std::atomic<std::size_t> readers;
+		/* avoids false sharing between neighbouring shards */
+		char padding[64];
+	};
+
+	std::size_t shards_number;
+	std::unique_ptr<shard[]> shards;
+	std::atomic<bool> writer;
+	std::mutex writer_mtx;
+};
+
+/* Holds shared ownership of a mutex in a scope (std::shared_lock is C++14) */
+template <typename Mutex>
+class shared_lock_guard {
+public:
+	explicit shared_lock_guard(Mutex &mtx) : mtx(mtx)
+	{
+		mtx.lock_shared();
+	}
+
+	/* Doesn't lock the mutex if the caller already holds it exclusively */
+	shared_lock_guard(Mutex &mtx, bool locked) : mtx(mtx), locked(locked)
+	{
+		if (!locked)
+			mtx.lock_shared();
+	}
+
+	~shared_lock_guard()
+	{
+		if (!locked)
+			mtx.unlock_shared();
+	}
+
+	shared_lock_guard(const shared_lock_guard &) = delete;
+	shared_lock_guard &operator=(const shared_lock_guard &) = delete;
+
+private:
+	Mutex &mtx;
+	bool locked = false;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_SHARDED_SHARED_MUTEX_H */
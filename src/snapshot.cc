@@ -0,0 +1,435 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "snapshot.h"
+#include "exceptions.h"
+#include "fast_hash.h"
+#include "parallel_scan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+namespace snapshot
+{
+static const char MAGIC[8] = {'P', 'M', 'E', 'M', 'K', 'V', 'S', 'N'};
+static constexpr uint64_t VERSION = 1;
+
+struct file_header {
+	char magic[8];
+	uint64_t version;
+	uint64_t flags;
+	uint64_t records;
+	uint64_t blocks;
+	uint64_t file_size;
+	/* of all the fields above */
+	uint64_t checksum;
+};
+
+struct block_header {
+	uint64_t payload_size;
+	uint64_t records;
+	uint64_t payload_checksum;
+	/* of all the fields above */
+	uint64_t checksum;
+};
+
+static_assert(sizeof(file_header) <= BLOCK_ALIGNMENT, "Wrong size of file_header");
+
+static std::size_t align_up(std::size_t size)
+{
+	return (size + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1);
+}
+
+template <typename Header>
+static uint64_t header_checksum(const Header &h)
+{
+	return fast_hash(offsetof(Header, checksum), reinterpret_cast<const char *>(&h));
+}
+
+[[noreturn]] static void throw_io_error(const std::string &msg)
+{
+	auto err = errno;
+	auto what = msg + ": " + std::strerror(err);
+	if (err == ENOSPC)
+		throw internal::error(what, PMEMKV_STATUS_OUT_OF_MEMORY);
+
+	throw internal::error(what);
+}
+
+[[noreturn]] static void throw_corrupted(const std::string &path)
+{
+	throw internal::invalid_argument("Snapshot file " + path + " is corrupted");
+}
+} /* namespace snapshot */
+
+snapshot_writer::snapshot_writer(const std::string &path, uint64_t flags)
+    : path(path), tmp_path(path + ".tmp"), flags(flags), offset(snapshot::BLOCK_ALIGNMENT)
+{
+	reserve(snapshot::BLOCK_SIZE);
+	used = sizeof(snapshot::block_header);
+
+	fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		throw internal::invalid_argument("Cannot create snapshot file " +
+						 tmp_path + ": " + std::strerror(errno));
+}
+
+snapshot_writer::snapshot_writer(int fd, uint64_t flags)
+    : external_fd(true), flags(flags), fd(fd), offset(snapshot::BLOCK_ALIGNMENT)
+{
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		throw internal::invalid_argument(
+			"Snapshot can be written only to a regular file");
+
+	path = tmp_path = "fd " + std::to_string(fd);
+
+	reserve(snapshot::BLOCK_SIZE);
+	used = sizeof(snapshot::block_header);
+}
+
+snapshot_writer::~snapshot_writer()
+{
+	if (!external_fd) {
+		if (fd >= 0)
+			close(fd);
+		if (!committed)
+			unlink(tmp_path.c_str());
+	}
+
+	free(buffer);
+}
+
+void snapshot_writer::write(string_view key, string_view value)
+{
+	auto record_size = 2 * sizeof(uint64_t) + key.size() + value.size();
+	if (block_records > 0 && used + record_size > capacity)
+		flush_block();
+
+	/* record which doesn't fit in an empty block gets a bigger one */
+	if (used + record_size > capacity)
+		reserve(snapshot::align_up(used + record_size));
+
+	if (sorted) {
+		if (records > 0 && key.compare(string_view(last_key)) <= 0)
+			sorted = false;
+		else
+			last_key.assign(key.data(), key.size());
+	}
+
+	uint64_t sizes[2] = {key.size(), value.size()};
+	std::memcpy(buffer + used, sizes, sizeof(sizes));
+	used += sizeof(sizes);
+	std::memcpy(buffer + used, key.data(), key.size());
+	used += key.size();
+	std::memcpy(buffer + used, value.data(), value.size());
+	used += value.size();
+
+	++block_records;
+	++records;
+}
+
+void snapshot_writer::commit()
+{
+	flush_block();
+
+	snapshot::file_header header;
+	std::memcpy(header.magic, snapshot::MAGIC, sizeof(header.magic));
+	header.version = snapshot::VERSION;
+	header.flags = sorted ? (flags | snapshot::FLAG_SORTED) : flags;
+	header.records = records;
+	header.blocks = blocks;
+	header.file_size = offset;
+	header.checksum = snapshot::header_checksum(header);
+
+	/* header is written last, so an incomplete file is never valid */
+	std::memset(buffer, 0, snapshot::BLOCK_ALIGNMENT);
+	std::memcpy(buffer, &header, sizeof(header));
+	write_all(buffer, snapshot::BLOCK_ALIGNMENT, 0);
+
+	if (external_fd) {
+		if (ftruncate(fd, static_cast<off_t>(offset)) != 0)
+			snapshot::throw_io_error("Cannot truncate snapshot file " +
+						 path);
+		if (fsync(fd) != 0)
+			snapshot::throw_io_error("Cannot sync snapshot file " + path);
+
+		committed = true;
+		return;
+	}
+
+	if (fsync(fd) != 0)
+		snapshot::throw_io_error("Cannot sync snapshot file " + tmp_path);
+
+	auto ret = close(fd);
+	fd = -1;
+	if (ret != 0)
+		snapshot::throw_io_error("Cannot close snapshot file " + tmp_path);
+
+	if (rename(tmp_path.c_str(), path.c_str()) != 0)
+		snapshot::throw_io_error("Cannot rename snapshot file to " + path);
+
+	committed = true;
+}
+
+/* Makes buffer big enough for 'size' bytes, keeping its content */
+void snapshot_writer::reserve(std::size_t size)
+{
+	void *new_buffer;
+	if (posix_memalign(&new_buffer, snapshot::BLOCK_ALIGNMENT, size) != 0)
+		throw std::bad_alloc();
+
+	if (buffer) {
+		std::memcpy(new_buffer, buffer, used);
+		free(buffer);
+	}
+
+	buffer = static_cast<char *>(new_buffer);
+	capacity = size;
+}
+
+void snapshot_writer::flush_block()
+{
+	if (block_records == 0)
+		return;
+
+	snapshot::block_header header;
+	header.payload_size = used - sizeof(header);
+	header.records = block_records;
+	header.payload_checksum =
+		fast_hash(header.payload_size, buffer + sizeof(header));
+	header.checksum = snapshot::header_checksum(header);
+	std::memcpy(buffer, &header, sizeof(header));
+
+	/* padding keeps every write (and the next block) aligned */
+	auto aligned_size = snapshot::align_up(used);
+	std::memset(buffer + used, 0, aligned_size - used);
+	write_all(buffer, aligned_size, offset);
+
+	offset += aligned_size;
+	++blocks;
+	used = sizeof(header);
+	block_records = 0;
+
+	throttle();
+}
+
+void snapshot_writer::set_rate_limit(uint64_t bytes_per_sec)
+{
+	rate_limit = bytes_per_sec;
+	rate_start = std::chrono::steady_clock::now();
+}
+
+/* Sleeps until the average rate of writes (since the limit was set) fits in it */
+void snapshot_writer::throttle()
+{
+	if (rate_limit == 0)
+		return;
+
+	auto seconds = static_cast<double>(offset) / static_cast<double>(rate_limit);
+	auto due = rate_start +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			   std::chrono::duration<double>(seconds));
+	std::this_thread::sleep_until(due);
+}
+
+void snapshot_writer::write_all(const char *data, std::size_t size, uint64_t off)
+{
+	while (size > 0) {
+		auto ret = pwrite(fd, data, size, static_cast<off_t>(off));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			snapshot::throw_io_error("Cannot write snapshot file " + tmp_path);
+		}
+
+		data += ret;
+		size -= static_cast<std::size_t>(ret);
+		off += static_cast<uint64_t>(ret);
+	}
+}
+
+snapshot_reader::snapshot_reader(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw internal::invalid_argument("Cannot open snapshot file " + path +
+						 ": " + std::strerror(errno));
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		snapshot::throw_io_error("Cannot stat snapshot file " + path);
+	}
+
+	size = static_cast<std::size_t>(st.st_size);
+	if (size < snapshot::BLOCK_ALIGNMENT) {
+		close(fd);
+		throw internal::invalid_argument(path + " is not a pmemkv snapshot");
+	}
+
+	auto addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	auto mmap_errno = errno;
+	close(fd);
+	if (addr == MAP_FAILED) {
+		errno = mmap_errno;
+		snapshot::throw_io_error("Cannot map snapshot file " + path);
+	}
+
+	data = static_cast<const char *>(addr);
+	madvise(addr, size, MADV_SEQUENTIAL);
+
+	try {
+		snapshot::file_header header;
+		std::memcpy(&header, data, sizeof(header));
+		if (std::memcmp(header.magic, snapshot::MAGIC, sizeof(header.magic)) != 0)
+			throw internal::invalid_argument(path +
+							 " is not a pmemkv snapshot");
+		if (header.checksum != snapshot::header_checksum(header) ||
+		    header.file_size != size)
+			snapshot::throw_corrupted(path);
+		if (header.version != snapshot::VERSION)
+			throw internal::invalid_argument(
+				"Unsupported version of snapshot file " + path);
+		if (header.blocks > size / snapshot::BLOCK_ALIGNMENT)
+			snapshot::throw_corrupted(path);
+
+		flags_ = header.flags;
+		records_ = header.records;
+
+		/* payloads are verified when blocks are read */
+		blocks.reserve(header.blocks);
+		std::size_t off = snapshot::BLOCK_ALIGNMENT;
+		uint64_t block_records = 0;
+		for (uint64_t i = 0; i < header.blocks; ++i) {
+			snapshot::block_header block;
+			if (size - off < sizeof(block))
+				snapshot::throw_corrupted(path);
+
+			std::memcpy(&block, data + off, sizeof(block));
+			if (block.checksum != snapshot::header_checksum(block) ||
+			    block.payload_size > size - off - sizeof(block))
+				snapshot::throw_corrupted(path);
+
+			blocks.push_back(off);
+			block_records += block.records;
+			off += snapshot::align_up(sizeof(block) + block.payload_size);
+		}
+
+		if (off != size || block_records != records_)
+			snapshot::throw_corrupted(path);
+	} catch (...) {
+		munmap(addr, size);
+		throw;
+	}
+}
+
+snapshot_reader::~snapshot_reader()
+{
+	munmap(const_cast<char *>(data), size);
+}
+
+uint64_t snapshot_reader::flags() const
+{
+	return flags_;
+}
+
+uint64_t snapshot_reader::records() const
+{
+	return records_;
+}
+
+void snapshot_reader::read(const snapshot_record_function &f) const
+{
+	for (std::size_t i = 0; i < blocks.size(); ++i)
+		read_block(i, f);
+}
+
+void snapshot_reader::read_parallel(std::size_t threads_number,
+				    const snapshot_record_function &f) const
+{
+	threads_number = std::max<std::size_t>(
+		1, std::min<std::size_t>(threads_number, blocks.size()));
+
+	std::atomic<std::size_t> next(0);
+	std::atomic<bool> failed(false);
+	parallel_run(threads_number, [&](std::size_t) {
+		for (auto i = next++; i < blocks.size() && !failed; i = next++) {
+			try {
+				read_block(i, f);
+			} catch (...) {
+				failed = true;
+				throw;
+			}
+		}
+
+		return status::OK;
+	});
+}
+
+void snapshot_reader::read_batches(const snapshot_batch_function &f) const
+{
+	std::vector<string_view> keys, values;
+	for (std::size_t i = 0; i < blocks.size(); ++i) {
+		keys.clear();
+		values.clear();
+		read_block(i, [&](string_view key, string_view value) {
+			keys.emplace_back(key);
+			values.emplace_back(value);
+		});
+
+		if (!keys.empty())
+			f(keys.data(), values.data(), keys.size());
+	}
+}
+
+void snapshot_reader::read_block(std::size_t i, const snapshot_record_function &f) const
+{
+	snapshot::block_header header;
+	std::memcpy(&header, data + blocks[i], sizeof(header));
+
+	auto p = data + blocks[i] + sizeof(header);
+	auto remaining = static_cast<std::size_t>(header.payload_size);
+	if (fast_hash(remaining, p) != header.payload_checksum)
+		throw internal::invalid_argument("Snapshot block is corrupted");
+
+	for (uint64_t r = 0; r < header.records; ++r) {
+		uint64_t sizes[2];
+		if (remaining < sizeof(sizes))
+			throw internal::invalid_argument("Snapshot block is corrupted");
+
+		std::memcpy(sizes, p, sizeof(sizes));
+		p += sizeof(sizes);
+		remaining -= sizeof(sizes);
+		if (sizes[0] > remaining || sizes[1] > remaining - sizes[0])
+			throw internal::invalid_argument("Snapshot block is corrupted");
+
+		f(string_view(p, sizes[0]), string_view(p + sizes[0], sizes[1]));
+		p += sizes[0] + sizes[1];
+		remaining -= sizes[0] + sizes[1];
+	}
+
+	if (remaining != 0)
+		throw internal::invalid_argument("Snapshot block is corrupted");
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_SNAPSHOT_H
+#define LIBPMEMKV_SNAPSHOT_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Snapshot file consists of a header (padded to BLOCK_ALIGNMENT) and
+ * a sequence of blocks. Each block starts at an aligned offset and contains
+ * a header (with checksum of its payload) followed by whole records:
+ * key size (8 bytes), value size (8 bytes), key and value. Blocks can be
+ * verified and parsed independently, so they are loaded in parallel.
+ *
+ * Integers are stored in native byte order.
+ */
+namespace snapshot
+{
+static constexpr std::size_t BLOCK_ALIGNMENT = 4096;
+static constexpr std::size_t BLOCK_SIZE = 4 << 20;
+
+/*
+ * Records were written in the order of keys - set by the writer if keys were
+ * written in strictly increasing (bytewise) order, or by engines with their
+ * own order
+ */
+static constexpr uint64_t FLAG_SORTED = 1;
+} /* namespace snapshot */
+
+/**
+ * snapshot_writer streams records to a new snapshot file. Data is written
+ * to "<path>.tmp" in blocks of snapshot::BLOCK_SIZE bytes (from an aligned
+ * buffer, at aligned offsets) and renamed to 'path' by commit(), so
+ * the previous snapshot is replaced only by a complete one.
+ *
+ * A writer created with a file descriptor writes from the beginning of the
+ * (seekable) file in place; commit() truncates the file to the size of the
+ * snapshot and syncs it, but doesn't close it.
+ *
+ * Errors are reported by exceptions (internal::error); if the writer is
+ * destroyed without commit(), the temporary file is removed.
+ */
+class snapshot_writer {
+public:
+	snapshot_writer(const std::string &path, uint64_t flags = 0);
+	snapshot_writer(int fd, uint64_t flags = 0);
+	~snapshot_writer();
+
+	snapshot_writer(const snapshot_writer &) = delete;
+	snapshot_writer &operator=(const snapshot_writer &) = delete;
+
+	void write(string_view key, string_view value);
+
+	/* Flushes the last block, writes the header and syncs the file */
+	void commit();
+
+	/*
+	 * Limits the average rate of writes to the file - writes of blocks
+	 * are delayed (in write() and commit()) to keep below the limit.
+	 */
+	void set_rate_limit(uint64_t bytes_per_sec);
+
+private:
+	void reserve(std::size_t payload);
+	void flush_block();
+	void write_all(const char *data, std::size_t size, uint64_t offset);
+	void throttle();
+
+	std::string path;
+	std::string tmp_path;
+	/* set if the file is given by the caller (no temporary file) */
+	bool external_fd = false;
+	uint64_t flags;
+	uint64_t rate_limit = 0;
+	std::chrono::steady_clock::time_point rate_start;
+	/* the last written key, to check if records are sorted */
+	std::string last_key;
+	bool sorted = true;
+	int fd = -1;
+	bool committed = false;
+
+	char *buffer = nullptr;
+	std::size_t capacity = 0;
+	std::size_t used = 0;
+	uint64_t block_records = 0;
+
+	uint64_t offset;
+	uint64_t records = 0;
+	uint64_t blocks = 0;
+};
+
+/* Called for every record of the snapshot; key and value are valid only during the call */
+using snapshot_record_function = std::function<void(string_view key, string_view value)>;
+/* Called for all records of a block; keys and values are valid only during the call */
+using snapshot_batch_function = std::function<void(
+	const string_view *keys, const string_view *values, std::size_t n)>;
+
+/**
+ * snapshot_reader maps a snapshot file, validates its header and all block
+ * headers. Payload of a block is verified just before its records are
+ * passed to the function, so a corrupted block is detected only after
+ * records of some other blocks were already loaded.
+ *
+ * Throws internal::invalid_argument if the file can't be opened or its
+ * format is wrong.
+ */
+class snapshot_reader {
+public:
+	snapshot_reader(const std::string &path);
+	~snapshot_reader();
+
+	snapshot_reader(const snapshot_reader &) = delete;
+	snapshot_reader &operator=(const snapshot_reader &) = delete;
+
+	uint64_t flags() const;
+	uint64_t records() const;
+
+	/* Calls f for every record, in the order they were written */
+	void read(const snapshot_record_function &f) const;
+
+	/*
+	 * Calls f for every record from 'threads_number' threads (blocks are
+	 * distributed dynamically), so f must be thread-safe.
+	 */
+	void read_parallel(std::size_t threads_number,
+			   const snapshot_record_function &f) const;
+
+	/*
+	 * Calls f once per block, with all its records (in the order they
+	 * were written), pointing directly to the mapped file.
+	 */
+	void read_batches(const snapshot_batch_function &f) const;
+
+private:
+	void read_block(std::size_t i, const snapshot_record_function &f) const;
+
+	const char *data = nullptr;
+	std::size_t size = 0;
+	uint64_t flags_ = 0;
+	uint64_t records_ = 0;
+	/* offsets of blocks within the file */
+	std::vector<std::size_t> blocks;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_SNAPSHOT_H */
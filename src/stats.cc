@@ -0,0 +1,528 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr size_t latency_histogram::SUB_BUCKET_BITS;
+constexpr size_t latency_histogram::SUB_BUCKETS;
+constexpr size_t latency_histogram::BUCKETS;
+constexpr size_t latency_stats::SHARDS;
+constexpr size_t persist_stats::SHARDS;
+constexpr size_t slow_op_trace::PHASES;
+constexpr size_t slow_op_log::CAPACITY;
+
+static const char *stats_op_names[] = {"get",	  "put",       "remove",
+				       "iterate", "tx_commit", "update"};
+
+static const char *slow_op_phase_names[] = {"lock_wait", "alloc", "tx_commit",
+					    "split"};
+
+stats_sink::stats_sink(pmemkv_stats_callback *callback, void *arg)
+    : callback(callback), arg(arg)
+{
+}
+
+void stats_sink::add(const std::string &name, uint64_t value)
+{
+	if (stopped_)
+		return;
+
+	if (callback(name.c_str(), value, arg) != 0)
+		stopped_ = true;
+}
+
+bool stats_sink::stopped() const
+{
+	return stopped_;
+}
+
+latency_histogram::latency_histogram()
+{
+	reset();
+}
+
+/* Values smaller than SUB_BUCKETS are stored exactly, bigger ones are grouped
+ * by position of their most significant bit */
+size_t latency_histogram::bucket_index(uint64_t value) noexcept
+{
+	if (value < SUB_BUCKETS)
+		return static_cast<size_t>(value);
+
+	size_t msb = static_cast<size_t>(63 - __builtin_clzll(value));
+	size_t shift = msb - SUB_BUCKET_BITS;
+	size_t sub = static_cast<size_t>(value >> shift) & (SUB_BUCKETS - 1);
+
+	return (shift + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t latency_histogram::bucket_upper_bound(size_t index) noexcept
+{
+	if (index < SUB_BUCKETS)
+		return index;
+
+	size_t shift = index / SUB_BUCKETS - 1;
+	uint64_t sub = index % SUB_BUCKETS;
+	uint64_t lower = (SUB_BUCKETS + sub) << shift;
+
+	return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void latency_histogram::record(uint64_t value) noexcept
+{
+	buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+	count_.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+
+	auto cur = min_.load(std::memory_order_relaxed);
+	while (value < cur &&
+	       !min_.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+		;
+
+	cur = max_.load(std::memory_order_relaxed);
+	while (value > cur &&
+	       !max_.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+		;
+}
+
+void latency_histogram::merge_into(latency_histogram &other) const noexcept
+{
+	for (size_t i = 0; i < BUCKETS; ++i) {
+		auto n = buckets[i].load(std::memory_order_relaxed);
+		if (n)
+			other.buckets[i].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	other.count_.fetch_add(count_.load(std::memory_order_relaxed),
+			       std::memory_order_relaxed);
+	other.sum.fetch_add(sum.load(std::memory_order_relaxed),
+			    std::memory_order_relaxed);
+
+	auto mn = min_.load(std::memory_order_relaxed);
+	if (mn < other.min_.load(std::memory_order_relaxed))
+		other.min_.store(mn, std::memory_order_relaxed);
+
+	auto mx = max_.load(std::memory_order_relaxed);
+	if (mx > other.max_.load(std::memory_order_relaxed))
+		other.max_.store(mx, std::memory_order_relaxed);
+}
+
+void latency_histogram::reset() noexcept
+{
+	for (auto &b : buckets)
+		b.store(0, std::memory_order_relaxed);
+
+	count_.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+	max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::count() const noexcept
+{
+	return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::min() const noexcept
+{
+	return count() ? min_.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t latency_histogram::max() const noexcept
+{
+	return max_.load(std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::mean() const noexcept
+{
+	auto n = count();
+	return n ? sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+/* Returns (upper bound of) the value below which p percent of values fall */
+uint64_t latency_histogram::percentile(double p) const noexcept
+{
+	auto n = count();
+	if (n == 0)
+		return 0;
+
+	auto rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(n));
+	if (rank >= n)
+		rank = n - 1;
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKETS; ++i) {
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if (seen > rank) {
+			/* bucket's upper bound can't exceed the real maximum */
+			auto v = bucket_upper_bound(i);
+			return v < max() ? v : max();
+		}
+	}
+
+	return max();
+}
+
+/* Returns id of the calling thread, used to choose a shard of statistics */
+static size_t stats_thread_id() noexcept
+{
+	static std::atomic<size_t> next_id(0);
+	thread_local size_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+
+	return id;
+}
+
+size_t latency_stats::shard_index() noexcept
+{
+	return stats_thread_id() % SHARDS;
+}
+
+void latency_stats::record(stats_op op, uint64_t ns) noexcept
+{
+	shards[shard_index()].histograms[static_cast<size_t>(op)].record(ns);
+}
+
+void latency_stats::reset() noexcept
+{
+	for (auto &s : shards)
+		for (auto &h : s.histograms)
+			h.reset();
+}
+
+/*
+ * Passes statistics of every operation to the sink. Names have the following
+ * format: "latency.<operation>.<count|min|mean|p50|p90|p99|p999|max>".
+ * All latencies are in nanoseconds.
+ */
+void latency_stats::get(stats_sink &sink) const
+{
+	std::unique_ptr<latency_histogram> merged(new latency_histogram());
+
+	for (size_t op = 0; op < static_cast<size_t>(stats_op::MAX_OP); ++op) {
+		merged->reset();
+		for (auto &s : shards)
+			s.histograms[op].merge_into(*merged);
+
+		std::string prefix = std::string("latency.") + stats_op_names[op] + ".";
+		sink.add(prefix + "count", merged->count());
+		sink.add(prefix + "min", merged->min());
+		sink.add(prefix + "mean", merged->mean());
+		sink.add(prefix + "p50", merged->percentile(50));
+		sink.add(prefix + "p90", merged->percentile(90));
+		sink.add(prefix + "p99", merged->percentile(99));
+		sink.add(prefix + "p999", merged->percentile(99.9));
+		sink.add(prefix + "max", merged->max());
+	}
+}
+
+persist_counters &thread_persist_counters() noexcept
+{
+	thread_local persist_counters counters = {0, 0, 0, 0, 0, 0};
+
+	return counters;
+}
+
+persist_stats::persist_stats()
+{
+	reset();
+}
+
+void persist_stats::record(stats_op op, const persist_counters &delta,
+			   uint64_t user_bytes) noexcept
+{
+	auto &c = shards[stats_thread_id() % SHARDS].counters[static_cast<size_t>(op)];
+
+	c.ops.fetch_add(1, std::memory_order_relaxed);
+	c.user_bytes.fetch_add(user_bytes, std::memory_order_relaxed);
+	c.flushed_bytes.fetch_add(delta.flushed_bytes, std::memory_order_relaxed);
+	c.flushes.fetch_add(delta.flushes, std::memory_order_relaxed);
+	c.drains.fetch_add(delta.drains, std::memory_order_relaxed);
+	c.undo_log_bytes.fetch_add(delta.undo_log_bytes, std::memory_order_relaxed);
+	c.skipped_flush_bytes.fetch_add(delta.skipped_flush_bytes,
+					std::memory_order_relaxed);
+	c.skipped_flushes.fetch_add(delta.skipped_flushes, std::memory_order_relaxed);
+}
+
+void persist_stats::reset() noexcept
+{
+	for (auto &s : shards) {
+		for (auto &c : s.counters) {
+			c.ops.store(0, std::memory_order_relaxed);
+			c.user_bytes.store(0, std::memory_order_relaxed);
+			c.flushed_bytes.store(0, std::memory_order_relaxed);
+			c.flushes.store(0, std::memory_order_relaxed);
+			c.drains.store(0, std::memory_order_relaxed);
+			c.undo_log_bytes.store(0, std::memory_order_relaxed);
+			c.skipped_flush_bytes.store(0, std::memory_order_relaxed);
+			c.skipped_flushes.store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+/*
+ * Passes statistics of every operation, which writes data, to the sink. Names
+ * have the following format: "persist.<operation>.<count|user_bytes|
+ * flushed_bytes|flushes|drains|undo_log_bytes|skipped_flush_bytes|
+ * skipped_flushes|write_amplification_percent>".
+ * Write amplification is the ratio of all bytes written to persistent memory
+ * (flushed bytes, bytes whose flush was skipped on eADR and the undo log) to
+ * the user bytes.
+ */
+void persist_stats::get(stats_sink &sink) const
+{
+	for (auto op : {stats_op::PUT, stats_op::REMOVE, stats_op::TX_COMMIT,
+			stats_op::UPDATE}) {
+		uint64_t ops = 0, user_bytes = 0, flushed_bytes = 0, flushes = 0,
+			 drains = 0, undo_log_bytes = 0, skipped_flush_bytes = 0,
+			 skipped_flushes = 0;
+		for (auto &s : shards) {
+			auto &c = s.counters[static_cast<size_t>(op)];
+			ops += c.ops.load(std::memory_order_relaxed);
+			user_bytes += c.user_bytes.load(std::memory_order_relaxed);
+			flushed_bytes += c.flushed_bytes.load(std::memory_order_relaxed);
+			flushes += c.flushes.load(std::memory_order_relaxed);
+			drains += c.drains.load(std::memory_order_relaxed);
+			undo_log_bytes +=
+				c.undo_log_bytes.load(std::memory_order_relaxed);
+			skipped_flush_bytes +=
+				c.skipped_flush_bytes.load(std::memory_order_relaxed);
+			skipped_flushes +=
+				c.skipped_flushes.load(std::memory_order_relaxed);
+		}
+
+		std::string prefix = std::string("persist.") +
+			stats_op_names[static_cast<size_t>(op)] + ".";
+		sink.add(prefix + "count", ops);
+		sink.add(prefix + "user_bytes", user_bytes);
+		sink.add(prefix + "flushed_bytes", flushed_bytes);
+		sink.add(prefix + "flushes", flushes);
+		sink.add(prefix + "drains", drains);
+		sink.add(prefix + "undo_log_bytes", undo_log_bytes);
+		sink.add(prefix + "skipped_flush_bytes", skipped_flush_bytes);
+		sink.add(prefix + "skipped_flushes", skipped_flushes);
+		sink.add(prefix + "write_amplification_percent",
+			 user_bytes ? (flushed_bytes + skipped_flush_bytes +
+				       undo_log_bytes) *
+					 100 / user_bytes
+				    : 0);
+	}
+}
+
+static uint64_t ns_between(std::chrono::steady_clock::time_point from,
+			   std::chrono::steady_clock::time_point to) noexcept
+{
+	return static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+slow_op_trace::~slow_op_trace()
+{
+	if (active)
+		current_ref() = prev;
+}
+
+/* Makes it the current trace of the calling thread */
+void slow_op_trace::start(std::chrono::steady_clock::time_point now) noexcept
+{
+	started = now;
+	prev = current_ref();
+	current_ref() = this;
+	active = true;
+}
+
+void slow_op_trace::begin(slow_op_phase phase) noexcept
+{
+	auto p = static_cast<size_t>(phase);
+	if (depth[p]++ > 0)
+		return;
+
+	phase_start[p] = std::chrono::steady_clock::now();
+	if (phase_at[p] == 0)
+		phase_at[p] = ns_between(started, phase_start[p]) + 1;
+}
+
+void slow_op_trace::end(slow_op_phase phase) noexcept
+{
+	auto p = static_cast<size_t>(phase);
+	/* e.g. a lock waited for before the operation started */
+	if (depth[p] == 0 || --depth[p] > 0)
+		return;
+
+	phase_ns[p] += ns_between(phase_start[p], std::chrono::steady_clock::now());
+}
+
+slow_op_log::slow_op_log(std::string engine, uint64_t threshold_ns)
+    : count(0),
+      reset_count(0),
+      engine(std::move(engine)),
+      threshold_ns(threshold_ns),
+      created(std::chrono::steady_clock::now())
+{
+	for (auto &s : slots)
+		s.version.store(0, std::memory_order_relaxed);
+}
+
+void slow_op_log::record(stats_op op, size_t key_size, const slow_op_trace &trace,
+			 uint64_t total_ns) noexcept
+{
+	auto seq = count.fetch_add(1, std::memory_order_relaxed);
+	auto &s = slots[seq % CAPACITY];
+
+	auto version = s.version.load(std::memory_order_relaxed);
+	if ((version & 1) ||
+	    !s.version.compare_exchange_strong(version, 2 * seq + 1,
+					       std::memory_order_acquire))
+		return;
+	/* readers which see the fields written see the odd version too */
+	std::atomic_thread_fence(std::memory_order_release);
+
+	s.op.store(static_cast<uint64_t>(op), std::memory_order_relaxed);
+	s.key_size.store(key_size, std::memory_order_relaxed);
+	s.start_ns.store(ns_between(created, trace.started), std::memory_order_relaxed);
+	s.total_ns.store(total_ns, std::memory_order_relaxed);
+	for (size_t p = 0; p < slow_op_trace::PHASES; ++p) {
+		s.phase_at[p].store(trace.phase_at[p], std::memory_order_relaxed);
+		s.phase_ns[p].store(trace.phase_ns[p], std::memory_order_relaxed);
+	}
+
+	s.version.store(2 * seq + 2, std::memory_order_release);
+}
+
+/* records written before are not reported anymore */
+void slow_op_log::reset() noexcept
+{
+	reset_count.store(count.load(std::memory_order_relaxed),
+			  std::memory_order_relaxed);
+}
+
+/*
+ * Passes "slow_op.threshold_ns", "slow_op.count" (number of slow operations,
+ * including the ones whose records were overwritten or dropped) and records
+ * kept in the log, in order of their sequence numbers, to the sink. Names of
+ * the records have the following format: "slow_op.<seq>.<engine>.<operation>.
+ * <key_size|start_ns|total_ns|<phase>_at_ns|<phase>_ns>", start_ns is counted
+ * from opening of the database and <phase>_at_ns from the start of the
+ * operation; phases which didn't occur are omitted.
+ */
+void slow_op_log::get(stats_sink &sink) const
+{
+	struct record {
+		uint64_t seq, op, key_size, start_ns, total_ns;
+		uint64_t phase_at[slow_op_trace::PHASES];
+		uint64_t phase_ns[slow_op_trace::PHASES];
+	};
+
+	auto first = reset_count.load(std::memory_order_relaxed);
+	std::vector<record> records;
+	for (auto &s : slots) {
+		auto version = s.version.load(std::memory_order_acquire);
+		if (version == 0 || (version & 1))
+			continue;
+
+		record r;
+		r.seq = version / 2 - 1;
+		r.op = s.op.load(std::memory_order_relaxed);
+		r.key_size = s.key_size.load(std::memory_order_relaxed);
+		r.start_ns = s.start_ns.load(std::memory_order_relaxed);
+		r.total_ns = s.total_ns.load(std::memory_order_relaxed);
+		for (size_t p = 0; p < slow_op_trace::PHASES; ++p) {
+			r.phase_at[p] = s.phase_at[p].load(std::memory_order_relaxed);
+			r.phase_ns[p] = s.phase_ns[p].load(std::memory_order_relaxed);
+		}
+
+		/* the slot was written in the meantime */
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (s.version.load(std::memory_order_relaxed) != version || r.seq < first)
+			continue;
+
+		records.push_back(r);
+	}
+
+	std::sort(records.begin(), records.end(),
+		  [](const record &a, const record &b) { return a.seq < b.seq; });
+
+	sink.add("slow_op.threshold_ns", threshold_ns);
+	sink.add("slow_op.count", count.load(std::memory_order_relaxed) - first);
+	for (auto &r : records) {
+		std::string prefix = "slow_op." + std::to_string(r.seq) + "." + engine +
+			"." + stats_op_names[r.op] + ".";
+		sink.add(prefix + "key_size", r.key_size);
+		sink.add(prefix + "start_ns", r.start_ns);
+		sink.add(prefix + "total_ns", r.total_ns);
+		for (size_t p = 0; p < slow_op_trace::PHASES; ++p) {
+			if (r.phase_at[p] == 0)
+				continue;
+			sink.add(prefix + slow_op_phase_names[p] + "_at_ns",
+				 r.phase_at[p] - 1);
+			sink.add(prefix + slow_op_phase_names[p] + "_ns", r.phase_ns[p]);
+		}
+	}
+}
+
+void open_stats::add(const std::string &phase, uint64_t ns)
+{
+	for (auto &p : phases) {
+		if (p.first == phase) {
+			p.second += ns;
+			return;
+		}
+	}
+
+	phases.emplace_back(phase, ns);
+}
+
+void open_stats::get(stats_sink &sink) const
+{
+	for (auto &p : phases)
+		sink.add("open." + p.first + "_ns", p.second);
+}
+
+static open_stats *&current_open_stats() noexcept
+{
+	thread_local open_stats *current = nullptr;
+	return current;
+}
+
+open_stats *open_stats::current() noexcept
+{
+	return current_open_stats();
+}
+
+open_stats::scope::scope(open_stats *stats) noexcept : prev(current_open_stats())
+{
+	current_open_stats() = stats;
+}
+
+open_stats::scope::~scope()
+{
+	current_open_stats() = prev;
+}
+
+void open_phase::end() noexcept
+{
+	if (!stats || !name)
+		return;
+
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			  std::chrono::steady_clock::now() - start)
+			  .count();
+	try {
+		stats->add(name, static_cast<uint64_t>(ns));
+	} catch (...) {
+		/* timings are not worth failing the open */
+	}
+	name = nullptr;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,470 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_STATS_H
+#define LIBPMEMKV_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libpmemkv.h"
+#include "trace.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * stats_sink passes named statistics to the user's callback. After the
+ * callback returns non-zero value, all subsequent statistics are ignored.
+ */
+class stats_sink {
+public:
+	stats_sink(pmemkv_stats_callback *callback, void *arg);
+
+	void add(const std::string &name, uint64_t value);
+
+	bool stopped() const;
+
+private:
+	pmemkv_stats_callback *callback;
+	void *arg;
+	bool stopped_ = false;
+};
+
+/**
+ * latency_histogram is a HDR-style histogram of latencies (in nanoseconds).
+ * Values are grouped by powers of two and every such group is split into
+ * SUB_BUCKETS linear sub-buckets, which gives relative error below 1/SUB_BUCKETS
+ * in the whole range of uint64_t, with fixed memory usage.
+ *
+ * All operations are lock-free, it can be updated concurrently.
+ */
+class latency_histogram {
+public:
+	static constexpr size_t SUB_BUCKET_BITS = 4;
+	static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	latency_histogram();
+
+	void record(uint64_t value) noexcept;
+	void merge_into(latency_histogram &other) const noexcept;
+	void reset() noexcept;
+
+	uint64_t count() const noexcept;
+	uint64_t min() const noexcept;
+	uint64_t max() const noexcept;
+	uint64_t mean() const noexcept;
+	uint64_t percentile(double p) const noexcept;
+
+private:
+	static size_t bucket_index(uint64_t value) noexcept;
+	static uint64_t bucket_upper_bound(size_t index) noexcept;
+
+	std::array<std::atomic<uint64_t>, BUCKETS> buckets;
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> min_;
+	std::atomic<uint64_t> max_;
+};
+
+enum class stats_op { GET, PUT, REMOVE, ITERATE, TX_COMMIT, UPDATE, MAX_OP };
+
+/**
+ * latency_stats collects latency histograms of operations executed on a single
+ * database. To keep overhead low, histograms are sharded - every thread
+ * updates (mostly) its own shard and shards are merged only when statistics
+ * are read.
+ */
+class latency_stats {
+public:
+	static constexpr size_t SHARDS = 8;
+
+	latency_stats() = default;
+
+	latency_stats(const latency_stats &) = delete;
+	latency_stats &operator=(const latency_stats &) = delete;
+
+	void record(stats_op op, uint64_t ns) noexcept;
+	void reset() noexcept;
+	void get(stats_sink &sink) const;
+
+private:
+	static size_t shard_index() noexcept;
+
+	struct shard {
+		latency_histogram histograms[static_cast<size_t>(stats_op::MAX_OP)];
+	};
+
+	std::array<shard, SHARDS> shards;
+};
+
+/* Phases of operations, whose durations are kept in records of slow_op_log */
+enum class slow_op_phase { LOCK_WAIT, ALLOC, TX_COMMIT, SPLIT, MAX_PHASE };
+
+/**
+ * slow_op_trace collects phases of a single operation of a database with
+ * slow_op_log enabled. Once started, it's the current trace of the calling
+ * thread until its destruction, so engines (and wrappers of libpmemobj) mark
+ * phases with slow_op_phase_begin()/end() without knowing about the log.
+ * Marking a phase costs one thread-local read if no operation is traced.
+ */
+class slow_op_trace {
+public:
+	static constexpr size_t PHASES = static_cast<size_t>(slow_op_phase::MAX_PHASE);
+
+	slow_op_trace() = default;
+	~slow_op_trace();
+
+	slow_op_trace(const slow_op_trace &) = delete;
+	slow_op_trace &operator=(const slow_op_trace &) = delete;
+
+	void start(std::chrono::steady_clock::time_point now) noexcept;
+
+	void begin(slow_op_phase phase) noexcept;
+	void end(slow_op_phase phase) noexcept;
+
+	/* Returns the trace of the calling thread or nullptr */
+	static slow_op_trace *current() noexcept
+	{
+		return current_ref();
+	}
+
+	std::chrono::steady_clock::time_point started;
+	/* offset of the first begin of each phase (+1, 0 if it didn't occur) and
+	 * the total duration of the phase, in nanoseconds */
+	uint64_t phase_at[PHASES] = {};
+	uint64_t phase_ns[PHASES] = {};
+
+private:
+	static slow_op_trace *&current_ref() noexcept
+	{
+		thread_local slow_op_trace *current = nullptr;
+		return current;
+	}
+
+	std::chrono::steady_clock::time_point phase_start[PHASES];
+	/* nesting of begins of each phase, only the outermost is measured */
+	unsigned depth[PHASES] = {};
+	slow_op_trace *prev = nullptr;
+	bool active = false;
+};
+
+inline void slow_op_phase_begin(slow_op_phase phase) noexcept
+{
+	auto trace = slow_op_trace::current();
+	if (trace)
+		trace->begin(phase);
+}
+
+inline void slow_op_phase_end(slow_op_phase phase) noexcept
+{
+	auto trace = slow_op_trace::current();
+	if (trace)
+		trace->end(phase);
+}
+
+/**
+ * Marks a phase of the traced operation for its own lifetime.
+ */
+class slow_op_phase_scope {
+public:
+	explicit slow_op_phase_scope(slow_op_phase phase) noexcept : phase(phase)
+	{
+		slow_op_phase_begin(phase);
+	}
+
+	~slow_op_phase_scope()
+	{
+		slow_op_phase_end(phase);
+	}
+
+	slow_op_phase_scope(const slow_op_phase_scope &) = delete;
+	slow_op_phase_scope &operator=(const slow_op_phase_scope &) = delete;
+
+private:
+	slow_op_phase phase;
+};
+
+/**
+ * slow_op_log keeps records of the last CAPACITY operations of a database
+ * which took at least threshold nanoseconds, with their phases. Records are
+ * written to a ring buffer without locks: every slot has a sequence number,
+ * which is odd while the slot is written, so readers skip records changed
+ * while they were read. A record is dropped if its slot is being written
+ * by another thread.
+ */
+class slow_op_log {
+public:
+	static constexpr size_t CAPACITY = 64;
+
+	slow_op_log(std::string engine, uint64_t threshold_ns);
+
+	slow_op_log(const slow_op_log &) = delete;
+	slow_op_log &operator=(const slow_op_log &) = delete;
+
+	uint64_t threshold() const noexcept
+	{
+		return threshold_ns;
+	}
+
+	void record(stats_op op, size_t key_size, const slow_op_trace &trace,
+		    uint64_t total_ns) noexcept;
+	void reset() noexcept;
+	void get(stats_sink &sink) const;
+
+private:
+	struct slot {
+		std::atomic<uint64_t> version;
+		std::atomic<uint64_t> op;
+		std::atomic<uint64_t> key_size;
+		std::atomic<uint64_t> start_ns;
+		std::atomic<uint64_t> total_ns;
+		std::atomic<uint64_t> phase_at[slow_op_trace::PHASES];
+		std::atomic<uint64_t> phase_ns[slow_op_trace::PHASES];
+	};
+
+	std::array<slot, CAPACITY> slots;
+	/* number of slow operations and the one of the last reset */
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> reset_count;
+	std::string engine;
+	uint64_t threshold_ns;
+	std::chrono::steady_clock::time_point created;
+};
+
+/**
+ * Measures time of its own lifetime and records it in latency_stats (if not null)
+ * and, if it took long enough, in slow_op_log (if not null), with the phases
+ * marked in the meantime. Its construction and destruction fire op__start and
+ * op__done probes, with the operation (stats_op) as their argument.
+ */
+class latency_timer {
+public:
+	latency_timer(latency_stats *stats, stats_op op, slow_op_log *slow = nullptr,
+		      size_t key_size = 0) noexcept
+	    : stats(stats), slow(slow), op(op), key_size(key_size)
+	{
+		PMEMKV_PROBE1(op__start, static_cast<int>(op));
+		if (stats || slow)
+			start = std::chrono::steady_clock::now();
+		if (slow)
+			trace.start(start);
+	}
+
+	~latency_timer()
+	{
+		if (stats || slow) {
+			auto ns = static_cast<uint64_t>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start)
+					.count());
+			if (stats)
+				stats->record(op, ns);
+			if (slow && ns >= slow->threshold())
+				slow->record(op, key_size, trace, ns);
+		}
+		PMEMKV_PROBE1(op__done, static_cast<int>(op));
+	}
+
+	latency_timer(const latency_timer &) = delete;
+	latency_timer &operator=(const latency_timer &) = delete;
+
+private:
+	latency_stats *stats;
+	slow_op_log *slow;
+	stats_op op;
+	size_t key_size;
+	std::chrono::steady_clock::time_point start;
+	slow_op_trace trace;
+};
+
+/**
+ * Writes to persistent memory done by a single thread. They are counted by
+ * wrappers of libpmemobj functions (see persist_stats.cc): flushes (with number
+ * of flushed bytes, including ranges and objects allocated in transactions -
+ * flushed on commit) and drains. undo_log_bytes is the size of ranges
+ * snapshotted by transactions.
+ */
+struct persist_counters {
+	uint64_t flushed_bytes;
+	uint64_t flushes;
+	uint64_t drains;
+	uint64_t undo_log_bytes;
+	/* flushes skipped in pools on eADR platforms (see pool_persistence.h) */
+	uint64_t skipped_flush_bytes;
+	uint64_t skipped_flushes;
+};
+
+/* Returns counters of the calling thread */
+persist_counters &thread_persist_counters() noexcept;
+
+/**
+ * persist_stats collects writes to persistent memory done by operations
+ * executed on a single database, together with sizes of keys and values
+ * passed to them, so write amplification of every operation can be computed.
+ * Counters are sharded, as histograms of latency_stats.
+ */
+class persist_stats {
+public:
+	static constexpr size_t SHARDS = 8;
+
+	persist_stats();
+
+	persist_stats(const persist_stats &) = delete;
+	persist_stats &operator=(const persist_stats &) = delete;
+
+	void record(stats_op op, const persist_counters &delta,
+		    uint64_t user_bytes) noexcept;
+	void reset() noexcept;
+	void get(stats_sink &sink) const;
+
+private:
+	struct op_counters {
+		std::atomic<uint64_t> ops;
+		std::atomic<uint64_t> user_bytes;
+		std::atomic<uint64_t> flushed_bytes;
+		std::atomic<uint64_t> flushes;
+		std::atomic<uint64_t> drains;
+		std::atomic<uint64_t> undo_log_bytes;
+		std::atomic<uint64_t> skipped_flush_bytes;
+		std::atomic<uint64_t> skipped_flushes;
+	};
+
+	struct shard {
+		op_counters counters[static_cast<size_t>(stats_op::MAX_OP)];
+	};
+
+	std::array<shard, SHARDS> shards;
+};
+
+/**
+ * Records writes to persistent memory done by the calling thread during its own
+ * lifetime in persist_stats (if not null).
+ */
+class persist_scope {
+public:
+	persist_scope(persist_stats *stats, stats_op op, uint64_t user_bytes) noexcept
+	    : stats(stats), op(op), user_bytes(user_bytes)
+	{
+		if (stats)
+			start = thread_persist_counters();
+	}
+
+	~persist_scope()
+	{
+		if (!stats)
+			return;
+
+		auto &now = thread_persist_counters();
+		persist_counters delta;
+		delta.flushed_bytes = now.flushed_bytes - start.flushed_bytes;
+		delta.flushes = now.flushes - start.flushes;
+		delta.drains = now.drains - start.drains;
+		delta.undo_log_bytes = now.undo_log_bytes - start.undo_log_bytes;
+		delta.skipped_flush_bytes =
+			now.skipped_flush_bytes - start.skipped_flush_bytes;
+		delta.skipped_flushes = now.skipped_flushes - start.skipped_flushes;
+		stats->record(op, delta, user_bytes);
+	}
+
+	persist_scope(const persist_scope &) = delete;
+	persist_scope &operator=(const persist_scope &) = delete;
+
+private:
+	persist_stats *stats;
+	stats_op op;
+	uint64_t user_bytes;
+	persist_counters start;
+};
+
+/**
+ * open_stats holds durations (in nanoseconds) of phases of opening a database,
+ * in order of their completion, e.g. opening of the pool and recovery of the
+ * engine. They are collected once, by pmemkv_open(), and cannot be reset.
+ */
+class open_stats {
+public:
+	/* phases with the same name (e.g. of nested engines) are summed up */
+	void add(const std::string &phase, uint64_t ns);
+	void get(stats_sink &sink) const;
+
+	/* Returns open_stats of pmemkv_open() running in this thread or nullptr */
+	static open_stats *current() noexcept;
+
+	/**
+	 * Makes stats current in this thread for its own lifetime, so the
+	 * phases measured by open_phase are recorded there.
+	 */
+	class scope {
+	public:
+		explicit scope(open_stats *stats) noexcept;
+		~scope();
+
+		scope(const scope &) = delete;
+		scope &operator=(const scope &) = delete;
+
+	private:
+		open_stats *prev;
+	};
+
+private:
+	std::vector<std::pair<std::string, uint64_t>> phases;
+};
+
+/**
+ * Measures a phase of opening a database - from its construction (or the
+ * last next() call) to its destruction, reported as "open.<name>_ns". It does
+ * nothing if no pmemkv_open() is running in the calling thread (e.g. for an
+ * engine created directly).
+ */
+class open_phase {
+public:
+	explicit open_phase(const char *name) noexcept
+	    : stats(open_stats::current()), name(name)
+	{
+		if (stats)
+			start = std::chrono::steady_clock::now();
+	}
+
+	~open_phase()
+	{
+		end();
+	}
+
+	/* Ends the current phase and starts the next one */
+	void next(const char *next_name) noexcept
+	{
+		end();
+		name = next_name;
+		if (stats)
+			start = std::chrono::steady_clock::now();
+	}
+
+	/* Ends the current phase before destruction */
+	void end() noexcept;
+
+	open_phase(const open_phase &) = delete;
+	open_phase &operator=(const open_phase &) = delete;
+
+private:
+	open_stats *stats;
+	const char *name;
+	std::chrono::steady_clock::time_point start;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_STATS_H */
@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_THREAD_CACHE_ALLOCATOR_H
+#define LIBPMEMKV_THREAD_CACHE_ALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "thread_id.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * slab_cache keeps free lists of small blocks (in power-of-two size classes,
+ * up to MAX_BLOCK_SIZE bytes), allocated from an underlying char allocator.
+ *
+ * Each thread uses one of local caches (picked by thread_id()), so
+ * threads don't contend on the underlying allocator. Local caches exchange
+ * blocks with a global pool in batches of BATCH_SIZE and the global pool
+ * allocates whole slabs of BATCH_SIZE blocks. Memory of slabs is given back
+ * to the underlying allocator only when slab_cache is destroyed.
+ */
+template <typename CharAllocator>
+class slab_cache {
+public:
+	static constexpr std::size_t MIN_BLOCK_SIZE = 16;
+	static constexpr std::size_t MAX_BLOCK_SIZE = 1024;
+	static constexpr std::size_t SIZE_CLASSES = 7;
+	static constexpr std::size_t BATCH_SIZE = 32;
+
+	slab_cache(const CharAllocator &alloc, std::size_t caches_number)
+	    : alloc(alloc), caches_number(caches_number),
+	      caches(new local_cache[caches_number])
+	{
+	}
+
+	~slab_cache()
+	{
+		for (auto &slab : slabs)
+			alloc.deallocate(slab.first, slab.second);
+	}
+
+	slab_cache(const slab_cache &) = delete;
+	slab_cache &operator=(const slab_cache &) = delete;
+
+	void *allocate(std::size_t bytes)
+	{
+		if (bytes > MAX_BLOCK_SIZE)
+			return alloc.allocate(bytes);
+
+		auto cls = size_class(bytes);
+		auto &cache = caches[thread_id() % caches_number];
+
+		std::unique_lock<std::mutex> lock(cache.mtx);
+		auto &list = cache.lists[cls];
+		if (list.head == nullptr)
+			refill(list, cls);
+
+		auto block = list.head;
+		list.head = block->next;
+		--list.size;
+
+		return block;
+	}
+
+	void deallocate(void *p, std::size_t bytes)
+	{
+		if (bytes > MAX_BLOCK_SIZE) {
+			alloc.deallocate(static_cast<char *>(p), bytes);
+			return;
+		}
+
+		auto cls = size_class(bytes);
+		auto &cache = caches[thread_id() % caches_number];
+
+		std::unique_lock<std::mutex> lock(cache.mtx);
+		auto &list = cache.lists[cls];
+		auto block = static_cast<free_block *>(p);
+		block->next = list.head;
+		list.head = block;
+		++list.size;
+
+		/* return surplus to the global pool, so other threads can reuse it */
+		if (list.size > 2 * BATCH_SIZE) {
+			std::unique_lock<std::mutex> global_lock(global_mtx);
+			move_blocks(list, global[cls], BATCH_SIZE);
+		}
+	}
+
+private:
+	struct free_block {
+		free_block *next;
+	};
+
+	struct free_list {
+		free_block *head = nullptr;
+		std::size_t size = 0;
+	};
+
+	struct local_cache {
+		std::mutex mtx;
+		free_list lists[SIZE_CLASSES];
+		/* avoids false sharing between neighbouring caches */
+		char padding[64];
+	};
+
+	static std::size_t size_class(std::size_t bytes)
+	{
+		std::size_t cls = 0;
+		while ((MIN_BLOCK_SIZE << cls) < bytes)
+			++cls;
+
+		return cls;
+	}
+
+	static void move_blocks(free_list &from, free_list &to, std::size_t n)
+	{
+		while (n-- > 0 && from.head != nullptr) {
+			auto block = from.head;
+			from.head = block->next;
+			--from.size;
+
+			block->next = to.head;
+			to.head = block;
+			++to.size;
+		}
+	}
+
+	/* Moves a batch of blocks from the global pool to the (empty) list */
+	void refill(free_list &list, std::size_t cls)
+	{
+		std::unique_lock<std::mutex> lock(global_mtx);
+		auto &pool = global[cls];
+
+		if (pool.head == nullptr) {
+			auto block_size = MIN_BLOCK_SIZE << cls;
+			auto slab_size = block_size * BATCH_SIZE;
+
+			slabs.reserve(slabs.size() + 1);
+			char *slab = alloc.allocate(slab_size);
+			slabs.emplace_back(slab, slab_size);
+
+			for (std::size_t i = 0; i < BATCH_SIZE; ++i) {
+				auto block = reinterpret_cast<free_block *>(slab +
+									    i * block_size);
+				block->next = pool.head;
+				pool.head = block;
+			}
+			pool.size = BATCH_SIZE;
+		}
+
+		move_blocks(pool, list, BATCH_SIZE);
+	}
+
+	CharAllocator alloc;
+	std::size_t caches_number;
+	std::unique_ptr<local_cache[]> caches;
+
+	std::mutex global_mtx;
+	free_list global[SIZE_CLASSES];
+	std::vector<std::pair<char *, std::size_t>> slabs;
+};
+
+/**
+ * thread_cache_allocator allocates memory through a slab_cache shared by all
+ * its copies. If 'caches_number' is 0 (or T requires alignment bigger than
+ * slab_cache::MIN_BLOCK_SIZE), it forwards requests directly to the underlying
+ * allocator.
+ */
+template <typename T, typename CharAllocator>
+class thread_cache_allocator {
+	using base_allocator_type =
+		typename std::allocator_traits<CharAllocator>::template rebind_alloc<T>;
+	using cache_type = slab_cache<CharAllocator>;
+
+public:
+	using value_type = T;
+	using pointer = T *;
+	using const_pointer = const T *;
+	using reference = T &;
+	using const_reference = const T &;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+
+	template <typename U>
+	struct rebind {
+		using other = thread_cache_allocator<U, CharAllocator>;
+	};
+
+	thread_cache_allocator(const CharAllocator &alloc, std::size_t caches_number)
+	    : alloc(alloc),
+	      cache(caches_number ? std::make_shared<cache_type>(alloc, caches_number)
+				  : nullptr)
+	{
+	}
+
+	template <typename U>
+	thread_cache_allocator(const thread_cache_allocator<U, CharAllocator> &other)
+	    : alloc(other.alloc), cache(other.cache)
+	{
+	}
+
+	T *allocate(std::size_t n)
+	{
+		if (!use_cache())
+			return alloc.allocate(n);
+
+		return static_cast<T *>(cache->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, std::size_t n)
+	{
+		if (!use_cache())
+			alloc.deallocate(p, n);
+		else
+			cache->deallocate(p, n * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const thread_cache_allocator<U, CharAllocator> &other) const
+	{
+		return cache == other.cache && alloc == other.alloc;
+	}
+
+	template <typename U>
+	bool operator!=(const thread_cache_allocator<U, CharAllocator> &other) const
+	{
+		return !(*this == other);
+	}
+
+private:
+	template <typename U, typename A>
+	friend class thread_cache_allocator;
+
+	bool use_cache() const
+	{
+		return cache && alignof(T) <= cache_type::MIN_BLOCK_SIZE;
+	}
+
+	base_allocator_type alloc;
+	std::shared_ptr<cache_type> cache;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_THREAD_CACHE_ALLOCATOR_H */
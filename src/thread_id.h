@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_THREAD_ID_H
+#define LIBPMEMKV_THREAD_ID_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Returns small id of the calling thread, ids are assigned in order of
+ * the first call. Used to spread threads over per-thread structures.
+ */
+inline std::size_t thread_id()
+{
+	static std::atomic<std::size_t> next_id(0);
+	static thread_local std::size_t id = next_id++;
+
+	return id;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_THREAD_ID_H */
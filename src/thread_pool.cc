@@ -0,0 +1,265 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "thread_pool.h"
+
+#include <cstdlib>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+thread_pool::thread_pool(std::size_t threads_number, std::vector<int> cpus,
+			 int nice_value)
+    : cpus(std::move(cpus)), nice_value(nice_value)
+{
+	if (threads_number == 0)
+		threads_number = 1;
+
+	threads.reserve(threads_number);
+	for (std::size_t i = 0; i < threads_number; ++i)
+		threads.emplace_back(&thread_pool::worker, this);
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		stopped = true;
+	}
+	cv.notify_all();
+
+	for (auto &t : threads)
+		t.join();
+}
+
+void thread_pool::submit(task_type task)
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		tasks.emplace_back(std::move(task));
+	}
+	cv.notify_one();
+}
+
+void thread_pool::submit_after(clock_type::duration delay, task_type task)
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		delayed_tasks.push(
+			delayed_task{clock_type::now() + delay, std::move(task)});
+	}
+	/* a waiting worker may have to wait for a shorter time now */
+	cv.notify_one();
+}
+
+std::size_t thread_pool::size() const
+{
+	return threads.size();
+}
+
+/*
+ * Binds the calling worker to the pool's CPUs and sets its nice value. Both
+ * are best effort - e.g. a negative nice value requires privileges, so errors
+ * are ignored and the worker runs with default settings.
+ */
+void thread_pool::set_worker_options()
+{
+#ifdef __linux__
+	if (!cpus.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (auto cpu : cpus)
+			if (cpu >= 0 && cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	if (nice_value != 0)
+		setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)),
+			    nice_value);
+#endif
+}
+
+void thread_pool::worker()
+{
+	set_worker_options();
+
+	while (true) {
+		task_type task;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			while (true) {
+				if (!tasks.empty()) {
+					task = std::move(tasks.front());
+					tasks.pop_front();
+					break;
+				}
+
+				/* finish all pending tasks before stopping */
+				if (stopped)
+					return;
+
+				if (delayed_tasks.empty()) {
+					cv.wait(lock);
+					continue;
+				}
+
+				auto time = delayed_tasks.top().time;
+				if (time <= clock_type::now()) {
+					task = delayed_tasks.top().task;
+					delayed_tasks.pop();
+					break;
+				}
+				cv.wait_until(lock, time);
+			}
+		}
+
+		task();
+	}
+}
+
+/* Parses list of CPUs, e.g. "0-3,8" */
+static std::vector<int> parse_cpus(const std::string &list)
+{
+	std::vector<int> cpus;
+
+	std::size_t pos = 0;
+	while (pos < list.size()) {
+		auto end = list.find(',', pos);
+		if (end == std::string::npos)
+			end = list.size();
+
+		auto range = list.substr(pos, end - pos);
+		auto dash = range.find('-');
+		int first = std::stoi(range.substr(0, dash));
+		int last = dash == std::string::npos ? first
+						     : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+
+		pos = end + 1;
+	}
+
+	return cpus;
+}
+
+/*
+ * Returns the pool owned by the library. Number of its threads can be set
+ * by PMEMKV_WORKER_THREADS env variable, by default it's equal to the number
+ * of hardware threads. Workers can be bound to CPUs listed in
+ * PMEMKV_WORKER_CPUS (e.g. "0-3,8") and run with the nice value given by
+ * PMEMKV_WORKER_NICE.
+ */
+thread_pool &thread_pool::get_default()
+{
+	static thread_pool pool(
+		[] {
+			auto env = std::getenv("PMEMKV_WORKER_THREADS");
+			if (env)
+				return static_cast<std::size_t>(std::stoul(env));
+
+			return static_cast<std::size_t>(
+				std::thread::hardware_concurrency());
+		}(),
+		[] {
+			auto env = std::getenv("PMEMKV_WORKER_CPUS");
+			return env ? parse_cpus(env) : std::vector<int>();
+		}(),
+		[] {
+			auto env = std::getenv("PMEMKV_WORKER_NICE");
+			return env ? std::stoi(env) : 0;
+		}());
+
+	return pool;
+}
+
+constexpr background_task::clock_type::duration background_task::idle;
+
+background_task::background_task(step_function step, clock_type::duration delay,
+				 thread_pool &pool)
+    : state(std::make_shared<state_type>(std::move(step), pool))
+{
+	if (delay != idle)
+		schedule(state, delay);
+}
+
+background_task::~background_task()
+{
+	std::unique_lock<std::mutex> lock(state->mtx);
+	state->stopped = true;
+	state->cv.wait(lock, [&] { return !state->running; });
+}
+
+void background_task::wake()
+{
+	{
+		std::unique_lock<std::mutex> lock(state->mtx);
+		/* a run is already queued */
+		if (state->woken || state->stopped)
+			return;
+		state->woken = true;
+	}
+
+	schedule(state, clock_type::duration::zero());
+}
+
+void background_task::schedule(const std::shared_ptr<state_type> &state,
+			       clock_type::duration delay)
+{
+	auto s = state;
+	if (delay == clock_type::duration::zero())
+		state->pool.submit([s] { run(s); });
+	else
+		state->pool.submit_after(delay, [s] { run(s); });
+}
+
+void background_task::run(const std::shared_ptr<state_type> &state)
+{
+	std::unique_lock<std::mutex> lock(state->mtx);
+	if (state->stopped)
+		return;
+	state->woken = false;
+
+	/* the running step will be repeated right after it's finished */
+	if (state->running) {
+		state->rerun = true;
+		return;
+	}
+
+	state->running = true;
+	lock.unlock();
+
+	auto delay = state->step();
+
+	lock.lock();
+	state->running = false;
+	if (state->stopped) {
+		state->cv.notify_all();
+		return;
+	}
+
+	if (state->rerun) {
+		state->rerun = false;
+		delay = clock_type::duration::zero();
+	}
+
+	if (delay != idle)
+		schedule(state, delay);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_THREAD_POOL_H
+#define LIBPMEMKV_THREAD_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * thread_pool is a fixed-size pool of worker threads, executing submitted
+ * tasks in FIFO order. Tasks may also be delayed (submit_after()), they are
+ * executed once their time comes. Destructor waits for all already submitted
+ * tasks, except delayed ones which are not due yet - those are discarded.
+ *
+ * Workers can be bound to a set of CPUs and run with a lower priority (a nice
+ * value), so all background work of the library shares one CPU budget.
+ *
+ * The pool returned by get_default() is owned by the library and shared
+ * by all of its users.
+ */
+class thread_pool {
+public:
+	using task_type = std::function<void()>;
+	using clock_type = std::chrono::steady_clock;
+
+	thread_pool(std::size_t threads_number, std::vector<int> cpus = {},
+		    int nice_value = 0);
+	~thread_pool();
+
+	thread_pool(const thread_pool &) = delete;
+	thread_pool &operator=(const thread_pool &) = delete;
+
+	void submit(task_type task);
+	void submit_after(clock_type::duration delay, task_type task);
+
+	std::size_t size() const;
+
+	static thread_pool &get_default();
+
+private:
+	struct delayed_task {
+		clock_type::time_point time;
+		task_type task;
+
+		bool operator>(const delayed_task &other) const
+		{
+			return time > other.time;
+		}
+	};
+
+	void worker();
+	void set_worker_options();
+
+	std::vector<int> cpus;
+	int nice_value;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<task_type> tasks;
+	std::priority_queue<delayed_task, std::vector<delayed_task>,
+			    std::greater<delayed_task>>
+		delayed_tasks;
+	bool stopped = false;
+
+	std::vector<std::thread> threads;
+};
+
+/**
+ * background_task runs maintenance work of an engine on a thread_pool, one
+ * step at a time. Each step returns the delay after which the next one should
+ * be run, or background_task::idle to wait for wake().
+ *
+ * Steps are never run concurrently. Destructor waits for the running step (if
+ * any) and no step is run after it returns, so the step may safely use the
+ * engine which owns the task. It must not be called from the step itself.
+ */
+class background_task {
+public:
+	using clock_type = thread_pool::clock_type;
+	using step_function = std::function<clock_type::duration()>;
+
+	static constexpr clock_type::duration idle = clock_type::duration::max();
+
+	background_task(step_function step, clock_type::duration delay = idle,
+			thread_pool &pool = thread_pool::get_default());
+	~background_task();
+
+	background_task(const background_task &) = delete;
+	background_task &operator=(const background_task &) = delete;
+
+	/* Runs the next step as soon as possible */
+	void wake();
+
+private:
+	/* shared with tasks in the pool, which may outlive the background_task */
+	struct state_type {
+		step_function step;
+		thread_pool &pool;
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		bool running = false;
+		bool rerun = false;
+		bool woken = false;
+		bool stopped = false;
+
+		state_type(step_function step, thread_pool &pool)
+		    : step(std::move(step)), pool(pool)
+		{
+		}
+	};
+
+	static void schedule(const std::shared_ptr<state_type> &state,
+			     clock_type::duration delay);
+	static void run(const std::shared_ptr<state_type> &state);
+
+	std::shared_ptr<state_type> state;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_THREAD_POOL_H */
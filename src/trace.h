@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_TRACE_H
+#define LIBPMEMKV_TRACE_H
+
+/*
+ * Static tracepoints (USDT probes of "pmemkv" provider), enabled by USE_SDT
+ * build option. A probe which is not attached is a single nop instruction,
+ * so they can be left in release builds. Probes can be listed and attached,
+ * e.g. by bpftrace:
+ *
+ *	bpftrace -l 'usdt:/usr/lib/libpmemkv.so:pmemkv:*'
+ *
+ * Arguments of probes must be integers or pointers (names of engines are
+ * passed as C strings). Probes:
+ *	op__start(op), op__done(op) - operation of the public API (stats_op),
+ *		fired by latency_timer
+ *	lock__wait(mutex), lock__acquired(mutex) - a thread blocks on
+ *		sharded_shared_mutex or reader_indicator_mutex
+ *	recovery__start(engine), recovery__phase(engine, phase),
+ *		recovery__done(engine, count) - opening of a pmemobj-based engine
+ *	tx__commit_start(engine, operations), tx__commit_done(engine)
+ *	cmap__rehash(buckets, expected_count), cmap__tx_log_apply(bytes)
+ *	stree__leaf_split(size), stree__inner_split(level)
+ */
+#ifdef USE_SDT
+
+#include <sys/sdt.h>
+
+#define PMEMKV_PROBE(name) DTRACE_PROBE(pmemkv, name)
+#define PMEMKV_PROBE1(name, a1) DTRACE_PROBE1(pmemkv, name, a1)
+#define PMEMKV_PROBE2(name, a1, a2) DTRACE_PROBE2(pmemkv, name, a1, a2)
+#define PMEMKV_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(pmemkv, name, a1, a2, a3)
+
+#else
+
+#define PMEMKV_PROBE(name)                                                               \
+	do {                                                                             \
+	} while (0)
+#define PMEMKV_PROBE1(name, a1) PMEMKV_PROBE(name)
+#define PMEMKV_PROBE2(name, a1, a2) PMEMKV_PROBE(name)
+#define PMEMKV_PROBE3(name, a1, a2, a3) PMEMKV_PROBE(name)
+
+#endif /* USE_SDT */
+
+#endif /* LIBPMEMKV_TRACE_H */
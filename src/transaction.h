@@ -7,6 +7,8 @@
 #include "libpmemkv.hpp"
 
 #include <cassert>
+#include <utility>
+#include <vector>
 
 namespace pmem
 {
@@ -17,6 +19,10 @@ namespace kv
 namespace internal
 {
 
+class latency_stats;
+class persist_stats;
+class slow_op_log;
+
 class transaction {
 public:
 	transaction()
@@ -35,40 +41,89 @@ public:
 	{
 		return status::NOT_SUPPORTED;
 	}
+
+	/* reads the key, as seen by the transaction (including its own writes) */
+	virtual status get(string_view key, get_v_callback *callback, void *arg)
+	{
+		return status::NOT_SUPPORTED;
+	}
+
+	/* latency statistics of the engine, which created this transaction */
+	latency_stats *latency = nullptr;
+	/* log of slow operations of the engine */
+	slow_op_log *slow_ops = nullptr;
+	/* persist statistics of the engine and sizes of keys and values written */
+	persist_stats *persist = nullptr;
+	uint64_t user_bytes = 0;
 };
 
+/*
+ * Log of the operations of a transaction, kept in DRAM until the commit.
+ * Keys and values are copied, one record after another, into a single arena,
+ * which (as all other buffers of the log) keeps its capacity after clear() -
+ * once the log is warmed up, insert() and remove() don't allocate memory.
+ */
 class dram_log {
 public:
-	using element_type = std::pair<std::string, std::string>;
+	using element_type = std::pair<string_view, string_view>;
 
 	void insert(string_view key, string_view value)
 	{
-		op_type.emplace_back(operation::insert);
-		log.emplace_back(std::piecewise_construct,
-				 std::forward_as_tuple(key.data(), key.size()),
-				 std::forward_as_tuple(value.data(), value.size()));
+		append(operation::insert, key, value);
 	}
 
 	void remove(string_view key)
 	{
-		op_type.emplace_back(operation::remove);
-		log.emplace_back(std::piecewise_construct,
-				 std::forward_as_tuple(key.data(), key.size()),
-				 std::forward_as_tuple());
+		append(operation::remove, key, string_view());
+	}
+
+	/*
+	 * Calls callback with the value of the last operation on the key, if
+	 * it's an insert, or returns NOT_FOUND if it's a remove. If the key is
+	 * not in the log, returns result of read() (which should read the key
+	 * from the engine).
+	 */
+	template <typename F>
+	status get(string_view key, get_v_callback *callback, void *arg, F &&read) const
+	{
+		for (auto r = records.rbegin(); r != records.rend(); ++r) {
+			const char *k = arena.data() + r->offset;
+			if (string_view(k, r->key_size).compare(key) != 0)
+				continue;
+
+			if (r->op == operation::remove)
+				return status::NOT_FOUND;
+
+			callback(k + r->key_size, r->value_size, arg);
+			return status::OK;
+		}
+
+		return read();
 	}
 
+	/*
+	 * Calls the callbacks for all records, in order of the operations.
+	 * Elements (and data they point to) are valid until clear() is called.
+	 */
 	template <typename F1, typename F2>
 	void foreach (F1 &&insert_cb, F2 && remove_cb)
 	{
-		assert(op_type.size() == log.size());
+		/* the arena doesn't grow anymore, so views can be created */
+		elements.clear();
+		for (const auto &r : records) {
+			const char *key = arena.data() + r.offset;
+			const char *value = key + r.key_size;
+			elements.emplace_back(string_view(key, r.key_size),
+					      string_view(value, r.value_size));
+		}
 
-		for (size_t i = 0; i < log.size(); i++) {
-			switch (op_type[i]) {
+		for (size_t i = 0; i < records.size(); i++) {
+			switch (records[i].op) {
 				case operation::insert:
-					insert_cb(log[i]);
+					insert_cb(elements[i]);
 					break;
 				case operation::remove:
-					remove_cb(log[i]);
+					remove_cb(elements[i]);
 					break;
 				default:
 					assert(false);
@@ -77,17 +132,46 @@ public:
 		}
 	}
 
+	/* number of logged operations (including repeated ones on the same key) */
+	std::size_t size() const
+	{
+		return records.size();
+	}
+
+	/* bytes of logged keys and values */
+	std::size_t bytes() const
+	{
+		return arena.size();
+	}
+
 	void clear()
 	{
-		op_type.clear();
-		log.clear();
+		records.clear();
+		elements.clear();
+		arena.clear();
 	}
 
 private:
 	enum class operation { insert, remove };
 
-	std::vector<operation> op_type;
-	std::vector<element_type> log;
+	struct record {
+		operation op;
+		/* key starts at 'offset' of the arena, value follows it */
+		std::size_t offset;
+		std::size_t key_size;
+		std::size_t value_size;
+	};
+
+	void append(operation op, string_view key, string_view value)
+	{
+		records.push_back(record{op, arena.size(), key.size(), value.size()});
+		arena.insert(arena.end(), key.data(), key.data() + key.size());
+		arena.insert(arena.end(), value.data(), value.data() + value.size());
+	}
+
+	std::vector<record> records;
+	std::vector<char> arena;
+	std::vector<element_type> elements;
 };
 
 } /* namespace internal */
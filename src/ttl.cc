@@ -0,0 +1,767 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "ttl.h"
+#include "exceptions.h"
+#include "fast_hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr std::size_t ttl_engine::LOCK_STRIPES;
+constexpr std::size_t ttl_engine::INDEX_SHARDS;
+
+/* first byte of every stored value */
+enum ttl_header : char { VALUE_PERMANENT = 0, VALUE_EXPIRING = 1 };
+
+static void throw_corrupted()
+{
+	throw internal::error("Stored value is corrupted or was written without "
+			      "\"ttl\" config flag");
+}
+
+ttl_options ttl_options::from_config(config &cfg)
+{
+	ttl_options options;
+
+	uint64_t ttl = 0;
+	cfg.get_uint64("ttl", &ttl);
+	options.enabled = ttl != 0;
+
+	uint64_t interval_ms;
+	if (cfg.get_uint64("ttl_interval_ms", &interval_ms)) {
+		if (interval_ms == 0)
+			throw internal::invalid_argument(
+				"Config item \"ttl_interval_ms\" must be greater than 0");
+		options.interval = std::chrono::milliseconds(interval_ms);
+	}
+
+	return options;
+}
+
+ttl_engine::ttl_engine(std::unique_ptr<engine_base> engine, const ttl_options &options)
+    : engine(std::move(engine)),
+      options(options),
+      stripes(new std::mutex[LOCK_STRIPES]),
+      shards(new index_shard[INDEX_SHARDS]),
+      expired_removed(0)
+{
+	if (!options.remove_expired)
+		return;
+
+	build_index();
+
+	expire_task.reset(new background_task(
+		[this] {
+			remove_expired();
+			return background_task::clock_type::duration(
+				this->options.interval);
+		},
+		options.interval));
+}
+
+ttl_engine::~ttl_engine()
+{
+	/* waits for the running step */
+	expire_task.reset();
+}
+
+uint64_t ttl_engine::now()
+{
+	using namespace std::chrono;
+	return static_cast<uint64_t>(
+		duration_cast<milliseconds>(system_clock::now().time_since_epoch())
+			.count());
+}
+
+void ttl_engine::encode(string_view value, uint64_t expires_at, std::string &out)
+{
+	if (expires_at == 0) {
+		out.push_back(VALUE_PERMANENT);
+	} else {
+		out.push_back(VALUE_EXPIRING);
+		out.append(reinterpret_cast<const char *>(&expires_at), sizeof(expires_at));
+	}
+
+	out.append(value.data(), value.size());
+}
+
+bool ttl_engine::decode(string_view stored, string_view &value, uint64_t &expires_at)
+{
+	if (stored.size() == 0)
+		return false;
+
+	if (stored.data()[0] == VALUE_PERMANENT) {
+		expires_at = 0;
+		value = string_view(stored.data() + 1, stored.size() - 1);
+		return true;
+	}
+
+	auto header_size = 1 + sizeof(expires_at);
+	if (stored.data()[0] != VALUE_EXPIRING || stored.size() < header_size)
+		return false;
+
+	std::memcpy(&expires_at, stored.data() + 1, sizeof(expires_at));
+	value = string_view(stored.data() + header_size, stored.size() - header_size);
+	return true;
+}
+
+std::mutex &ttl_engine::stripe(string_view key)
+{
+	return stripes[fast_hash(key.size(), key.data()) % LOCK_STRIPES];
+}
+
+std::vector<std::unique_lock<std::mutex>> ttl_engine::lock_keys(const string_view *keys,
+								std::size_t n)
+{
+	std::vector<std::size_t> indexes;
+	indexes.reserve(n);
+	for (std::size_t i = 0; i < n; ++i)
+		indexes.push_back(fast_hash(keys[i].size(), keys[i].data()) %
+				  LOCK_STRIPES);
+
+	std::sort(indexes.begin(), indexes.end());
+	indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+
+	std::vector<std::unique_lock<std::mutex>> locks;
+	for (auto i : indexes)
+		locks.emplace_back(stripes[i]);
+
+	return locks;
+}
+
+/* Adds the key to the bucket of its expiration time */
+void ttl_engine::index(string_view key, uint64_t expires_at)
+{
+	auto interval = static_cast<uint64_t>(options.interval.count());
+	auto bucket = (expires_at + interval - 1) / interval;
+
+	auto &s = shards[fast_hash(key.size(), key.data()) % INDEX_SHARDS];
+	std::lock_guard<std::mutex> lock(s.mtx);
+
+	s.buckets[bucket].emplace_back(key.data(), key.size());
+	++s.keys;
+}
+
+struct index_context {
+	ttl_engine *engine;
+	bool corrupted;
+};
+
+static int index_expiring(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	auto ctx = static_cast<index_context *>(arg);
+
+	string_view value;
+	uint64_t expires_at;
+	if (!ttl_engine::decode(string_view(v, vb), value, expires_at)) {
+		ctx->corrupted = true;
+		return 1;
+	}
+
+	if (expires_at != 0)
+		ctx->engine->index(string_view(k, kb), expires_at);
+
+	return 0;
+}
+
+void ttl_engine::build_index()
+{
+	for (std::size_t i = 0; i < INDEX_SHARDS; ++i) {
+		std::lock_guard<std::mutex> lock(shards[i].mtx);
+		shards[i].buckets.clear();
+		shards[i].keys = 0;
+	}
+
+	index_context ctx{this, false};
+	engine->get_all(index_expiring, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+}
+
+/* corrupted value is left as it is, reads of it fail */
+static void copy_expiration(const char *v, size_t vb, void *arg)
+{
+	auto expires_at = static_cast<uint64_t *>(arg);
+
+	string_view value;
+	if (!ttl_engine::decode(string_view(v, vb), value, *expires_at))
+		*expires_at = 0;
+}
+
+void ttl_engine::remove_expired()
+{
+	auto time = now();
+	auto interval = static_cast<uint64_t>(options.interval.count());
+
+	/* keys of all buckets which have passed */
+	std::vector<std::string> keys;
+	for (std::size_t i = 0; i < INDEX_SHARDS; ++i) {
+		auto &s = shards[i];
+		std::lock_guard<std::mutex> lock(s.mtx);
+
+		auto end = s.buckets.upper_bound(time / interval);
+		for (auto it = s.buckets.begin(); it != end; ++it) {
+			s.keys -= it->second.size();
+			std::move(it->second.begin(), it->second.end(),
+				  std::back_inserter(keys));
+		}
+		s.buckets.erase(s.buckets.begin(), end);
+	}
+
+	for (auto &key : keys) {
+		std::lock_guard<std::mutex> lock(stripe(key));
+
+		/* the key could be written again, or removed, since it was indexed */
+		uint64_t expires_at = 0;
+		try {
+			auto s = engine->get(key, copy_expiration, &expires_at);
+			if (s == status::OK && expired(expires_at, time) &&
+			    engine->remove(key) == status::OK)
+				expired_removed.fetch_add(1, std::memory_order_relaxed);
+		} catch (...) {
+			/* retried in the next interval */
+			index(key, time);
+		}
+	}
+}
+
+struct ttl_kv_context {
+	get_kv_callback *callback;
+	void *arg;
+	uint64_t now;
+	bool corrupted;
+};
+
+static int live_kv(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	auto ctx = static_cast<ttl_kv_context *>(arg);
+
+	string_view value;
+	uint64_t expires_at;
+	if (!ttl_engine::decode(string_view(v, vb), value, expires_at)) {
+		ctx->corrupted = true;
+		return 1;
+	}
+
+	if (ttl_engine::expired(expires_at, ctx->now))
+		return 0;
+
+	return ctx->callback(k, kb, value.data(), value.size(), ctx->arg);
+}
+
+/* Calls f with a callback, which passes only live records to 'callback' */
+template <typename F>
+status ttl_engine::read_kv(get_kv_callback *callback, void *arg, F &&f)
+{
+	ttl_kv_context ctx{callback, arg, now(), false};
+
+	auto s = f(live_kv, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	return s;
+}
+
+template <typename F>
+status ttl_engine::read_kv_parallel(std::size_t partitions, get_kv_callback *callback,
+				    void **args, F &&f)
+{
+	auto time = now();
+
+	std::vector<ttl_kv_context> contexts;
+	std::vector<void *> ctx_args;
+	contexts.reserve(partitions);
+	for (std::size_t i = 0; i < partitions; ++i) {
+		contexts.push_back({callback, args ? args[i] : nullptr, time, false});
+		ctx_args.push_back(&contexts.back());
+	}
+
+	auto s = f(live_kv, ctx_args.data());
+	for (auto &ctx : contexts) {
+		if (ctx.corrupted)
+			throw_corrupted();
+	}
+
+	return s;
+}
+
+std::string ttl_engine::name()
+{
+	return engine->name();
+}
+
+status ttl_engine::count_all(std::size_t &cnt)
+{
+	return engine->count_all(cnt);
+}
+
+status ttl_engine::count_above(string_view key, std::size_t &cnt)
+{
+	return engine->count_above(key, cnt);
+}
+
+status ttl_engine::count_equal_above(string_view key, std::size_t &cnt)
+{
+	return engine->count_equal_above(key, cnt);
+}
+
+status ttl_engine::count_equal_below(string_view key, std::size_t &cnt)
+{
+	return engine->count_equal_below(key, cnt);
+}
+
+status ttl_engine::count_below(string_view key, std::size_t &cnt)
+{
+	return engine->count_below(key, cnt);
+}
+
+status ttl_engine::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	return engine->count_between(key1, key2, cnt);
+}
+
+status ttl_engine::count_between_approx(string_view key1, string_view key2,
+					std::size_t &cnt)
+{
+	return engine->count_between_approx(key1, key2, cnt);
+}
+
+status ttl_engine::get_all(get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_all(cb, ctx);
+	});
+}
+
+status ttl_engine::get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				    void **args)
+{
+	return read_kv_parallel(partitions, callback, args,
+				[&](get_kv_callback *cb, void **ctx_args) {
+					return engine->get_all_parallel(partitions, cb,
+									ctx_args);
+				});
+}
+
+status ttl_engine::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_above(key, cb, ctx);
+	});
+}
+
+status ttl_engine::get_equal_above(string_view key, get_kv_callback *callback,
+				   void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_equal_above(key, cb, ctx);
+	});
+}
+
+status ttl_engine::get_equal_below(string_view key, get_kv_callback *callback,
+				   void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_equal_below(key, cb, ctx);
+	});
+}
+
+status ttl_engine::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_below(key, cb, ctx);
+	});
+}
+
+status ttl_engine::get_between(string_view key1, string_view key2,
+			       get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_between(key1, key2, cb, ctx);
+	});
+}
+
+status ttl_engine::get_between_parallel(string_view key1, string_view key2,
+					std::size_t partitions, get_kv_callback *callback,
+					void **args)
+{
+	return read_kv_parallel(partitions, callback, args,
+				[&](get_kv_callback *cb, void **ctx_args) {
+					return engine->get_between_parallel(
+						key1, key2, partitions, cb, ctx_args);
+				});
+}
+
+status ttl_engine::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_prefix(prefix, cb, ctx);
+	});
+}
+
+status ttl_engine::prefetch(string_view key)
+{
+	return engine->prefetch(key);
+}
+
+status ttl_engine::prefetch_range(string_view key1, string_view key2)
+{
+	return engine->prefetch_range(key1, key2);
+}
+
+struct ttl_v_context {
+	get_v_callback *callback;
+	void *arg;
+	uint64_t now;
+	bool corrupted;
+	bool expired;
+};
+
+static void live_v(const char *v, size_t vb, void *arg)
+{
+	auto ctx = static_cast<ttl_v_context *>(arg);
+
+	string_view value;
+	uint64_t expires_at;
+	if (!ttl_engine::decode(string_view(v, vb), value, expires_at)) {
+		ctx->corrupted = true;
+		return;
+	}
+
+	ctx->expired = ttl_engine::expired(expires_at, ctx->now);
+	if (!ctx->expired && ctx->callback)
+		ctx->callback(value.data(), value.size(), ctx->arg);
+}
+
+/* Calls f with a callback, which passes the value to 'callback' if it's live */
+template <typename F>
+static status read_v(get_v_callback *callback, void *arg, F &&f)
+{
+	ttl_v_context ctx{callback, arg, ttl_engine::now(), false, false};
+
+	auto s = f(live_v, &ctx);
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	return s == status::OK && ctx.expired ? status::NOT_FOUND : s;
+}
+
+/* the value is read, as the record may be expired */
+status ttl_engine::exists(string_view key)
+{
+	return read_v(nullptr, nullptr, [&](get_v_callback *cb, void *ctx) {
+		return engine->get(key, cb, ctx);
+	});
+}
+
+status ttl_engine::get(string_view key, get_v_callback *callback, void *arg)
+{
+	return read_v(callback, arg, [&](get_v_callback *cb, void *ctx) {
+		return engine->get(key, cb, ctx);
+	});
+}
+
+static void copy_size(const char *v, size_t vb, void *arg)
+{
+	*static_cast<std::size_t *>(arg) = vb;
+}
+
+status ttl_engine::value_size(string_view key, std::size_t &size)
+{
+	return read_v(copy_size, &size, [&](get_v_callback *cb, void *ctx) {
+		return engine->get(key, cb, ctx);
+	});
+}
+
+/* expired keys are not passed to the callback, as the missing ones */
+status ttl_engine::get_batch(const string_view *keys, std::size_t n,
+			     get_kv_callback *callback, void *arg)
+{
+	return read_kv(callback, arg, [&](get_kv_callback *cb, void *ctx) {
+		return engine->get_batch(keys, n, cb, ctx);
+	});
+}
+
+status ttl_engine::put(string_view key, string_view value)
+{
+	static thread_local std::string stored;
+	stored.clear();
+	encode(value, 0, stored);
+
+	std::lock_guard<std::mutex> lock(stripe(key));
+	return engine->put(key, stored);
+}
+
+status ttl_engine::put_ttl(string_view key, string_view value, uint64_t ttl_ms)
+{
+	if (ttl_ms == 0)
+		throw internal::invalid_argument("TTL must be greater than 0");
+
+	auto expires_at = now() + ttl_ms;
+
+	static thread_local std::string stored;
+	stored.clear();
+	encode(value, expires_at, stored);
+
+	{
+		std::lock_guard<std::mutex> lock(stripe(key));
+		auto s = engine->put(key, stored);
+		if (s != status::OK)
+			return s;
+	}
+
+	if (options.remove_expired)
+		index(key, expires_at);
+
+	return status::OK;
+}
+
+uint64_t ttl_engine::key_hash(string_view key)
+{
+	return engine->key_hash(key);
+}
+
+status ttl_engine::exists_hashed(string_view key, uint64_t hash)
+{
+	return read_v(nullptr, nullptr, [&](get_v_callback *cb, void *ctx) {
+		return engine->get_hashed(key, hash, cb, ctx);
+	});
+}
+
+status ttl_engine::get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			      void *arg)
+{
+	return read_v(callback, arg, [&](get_v_callback *cb, void *ctx) {
+		return engine->get_hashed(key, hash, cb, ctx);
+	});
+}
+
+status ttl_engine::put_hashed(string_view key, uint64_t hash, string_view value)
+{
+	static thread_local std::string stored;
+	stored.clear();
+	encode(value, 0, stored);
+
+	std::lock_guard<std::mutex> lock(stripe(key));
+	return engine->put_hashed(key, hash, stored);
+}
+
+status ttl_engine::put_batch(const string_view *keys, const string_view *values,
+			     std::size_t n)
+{
+	std::vector<std::string> stored(n);
+	std::vector<string_view> stored_views;
+	stored_views.reserve(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		encode(values[i], 0, stored[i]);
+		stored_views.emplace_back(stored[i]);
+	}
+
+	auto locks = lock_keys(keys, n);
+	return engine->put_batch(keys, stored_views.data(), n);
+}
+
+struct ttl_update_context {
+	update_callback *callback;
+	void *arg;
+	uint64_t now;
+	bool corrupted;
+	std::string stored;
+};
+
+/* expired value is passed as a missing one, a live one keeps its expiration */
+static int ttl_update(const char *v, size_t vb, const char **new_value,
+		      size_t *new_valuebytes, void *arg)
+{
+	auto ctx = static_cast<ttl_update_context *>(arg);
+
+	string_view current;
+	uint64_t expires_at = 0;
+	if (v && !ttl_engine::decode(string_view(v, vb), current, expires_at)) {
+		ctx->corrupted = true;
+		return 1;
+	}
+
+	bool live = v && !ttl_engine::expired(expires_at, ctx->now);
+	if (!live)
+		expires_at = 0;
+
+	const char *value;
+	size_t valuebytes;
+	auto ret = ctx->callback(live ? current.data() : nullptr,
+				 live ? current.size() : 0, &value, &valuebytes, ctx->arg);
+	if (ret != 0)
+		return ret;
+
+	ctx->stored.clear();
+	ttl_engine::encode(string_view(value, valuebytes), expires_at, ctx->stored);
+	*new_value = ctx->stored.data();
+	*new_valuebytes = ctx->stored.size();
+
+	return 0;
+}
+
+status ttl_engine::update(string_view key, update_callback *callback, void *arg)
+{
+	ttl_update_context ctx{callback, arg, now(), false, {}};
+
+	std::unique_lock<std::mutex> lock(stripe(key));
+	auto s = engine->update(key, ttl_update, &ctx);
+	lock.unlock();
+
+	if (ctx.corrupted)
+		throw_corrupted();
+
+	return s;
+}
+
+/* an expired record, which wasn't removed yet, is removed as any other */
+status ttl_engine::remove(string_view key)
+{
+	std::lock_guard<std::mutex> lock(stripe(key));
+	return engine->remove(key);
+}
+
+status ttl_engine::take(string_view key, get_v_callback *callback, void *arg)
+{
+	std::lock_guard<std::mutex> lock(stripe(key));
+	return read_v(callback, arg, [&](get_v_callback *cb, void *ctx) {
+		return engine->take(key, cb, ctx);
+	});
+}
+
+status ttl_engine::remove_between(string_view key1, string_view key2,
+				  std::size_t &cnt)
+{
+	return engine->remove_between(key1, key2, cnt);
+}
+
+status ttl_engine::defrag(double start_percent, double amount_percent)
+{
+	return engine->defrag(start_percent, amount_percent);
+}
+
+status ttl_engine::sync()
+{
+	return engine->sync();
+}
+
+/* snapshots keep stored values, with their expiration times */
+status ttl_engine::snapshot_save(const std::string &path)
+{
+	return engine->snapshot_save(path);
+}
+
+status ttl_engine::snapshot_load(const std::string &path)
+{
+	auto s = engine->snapshot_load(path);
+	if (s == status::OK && options.remove_expired)
+		build_index();
+
+	return s;
+}
+
+status ttl_engine::snapshot_export(int fd, uint64_t max_bytes_per_sec)
+{
+	return engine->snapshot_export(fd, max_bytes_per_sec);
+}
+
+/* Transaction which puts values which don't expire */
+class ttl_transaction : public transaction {
+public:
+	ttl_transaction(ttl_engine *engine, transaction *tx) : engine(engine), tx(tx)
+	{
+	}
+
+	status put(string_view key, string_view value) final
+	{
+		stored.clear();
+		ttl_engine::encode(value, 0, stored);
+
+		auto s = tx->put(key, stored);
+		if (s == status::OK)
+			keys.emplace_back(key.data(), key.size());
+
+		return s;
+	}
+
+	status remove(string_view key) final
+	{
+		auto s = tx->remove(key);
+		if (s == status::OK)
+			keys.emplace_back(key.data(), key.size());
+
+		return s;
+	}
+
+	status get(string_view key, get_v_callback *callback, void *arg) final
+	{
+		return read_v(callback, arg, [&](get_v_callback *cb, void *ctx) {
+			return tx->get(key, cb, ctx);
+		});
+	}
+
+	/* keys of the transaction are locked, as they're written by put */
+	status commit() final
+	{
+		std::vector<string_view> views(keys.begin(), keys.end());
+		auto locks = engine->lock_keys(views.data(), views.size());
+
+		auto s = tx->commit();
+		keys.clear();
+
+		return s;
+	}
+
+	void abort() final
+	{
+		tx->abort();
+		keys.clear();
+	}
+
+private:
+	ttl_engine *engine;
+	std::unique_ptr<transaction> tx;
+	std::string stored;
+	std::vector<std::string> keys;
+};
+
+internal::transaction *ttl_engine::begin_tx()
+{
+	std::unique_ptr<transaction> tx(engine->begin_tx());
+	auto result = new ttl_transaction(this, tx.get());
+	tx.release();
+
+	return result;
+}
+
+status ttl_engine::stats(internal::stats_sink &sink)
+{
+	auto s = engine->stats(sink);
+	if (s != status::OK)
+		return s;
+
+	std::size_t indexed_keys = 0;
+	for (std::size_t i = 0; i < INDEX_SHARDS; ++i) {
+		std::lock_guard<std::mutex> lock(shards[i].mtx);
+		indexed_keys += shards[i].keys;
+	}
+
+	sink.add("ttl.indexed_keys", indexed_keys);
+	sink.add("ttl.expired", expired_removed.load(std::memory_order_relaxed));
+
+	return status::OK;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
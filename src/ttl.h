@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_TTL_H
+#define LIBPMEMKV_TTL_H
+
+#include "config.h"
+#include "engine.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Parameters of expiration of records read from the config */
+struct ttl_options {
+	/* set by "ttl" config flag */
+	bool enabled = false;
+	/* expired records are removed that often ("ttl_interval_ms") */
+	std::chrono::milliseconds interval{1000};
+	/* false for read-only databases, expired records are only hidden */
+	bool remove_expired = true;
+
+	static ttl_options from_config(config &cfg);
+};
+
+/*
+ * Engine which supports records with limited time to live ("ttl" config flag),
+ * written by put_ttl(). Every stored value starts with a header byte, which
+ * tells whether the value expires; if it does, the header is followed by the
+ * expiration time (8 bytes, milliseconds since the epoch, in native byte
+ * order) - so a record written by put() costs a single byte.
+ *
+ * Expired records are hidden by all reads (lazily, reads don't modify the
+ * engine) and removed in the background, every interval. Keys written by
+ * put_ttl() are kept in a DRAM index of buckets (of interval length) of their
+ * expiration times, so the background task only visits keys whose bucket has
+ * passed, without scanning the engine. The index is built by a single scan
+ * when the engine is opened (and after snapshot_load). It's not updated by
+ * overwrites and removes - every indexed key is checked again before it's
+ * removed. Writes of a key and its removal by the background task are
+ * serialized by lock stripes, picked by the key's hash.
+ *
+ * Keys are passed unmodified. Counts (and the engine's own statistics) include
+ * expired records which weren't removed yet. Iterators are not supported, as
+ * their (partial) reads and writes address bytes of the stored values.
+ */
+class ttl_engine : public engine_base {
+public:
+	static constexpr std::size_t LOCK_STRIPES = 64;
+	static constexpr std::size_t INDEX_SHARDS = 16;
+
+	ttl_engine(std::unique_ptr<engine_base> engine, const ttl_options &options);
+	~ttl_engine();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_between_approx(string_view key1, string_view key2,
+				    std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2,
+				    std::size_t partitions, get_kv_callback *callback,
+				    void **args) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+	status prefetch(string_view key) final;
+	status prefetch_range(string_view key1, string_view key2) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status value_size(string_view key, std::size_t &size) final;
+	status get_batch(const string_view *keys, std::size_t n,
+			 get_kv_callback *callback, void *arg) final;
+
+	status put(string_view key, string_view value) final;
+	status put_ttl(string_view key, string_view value, uint64_t ttl_ms) final;
+
+	uint64_t key_hash(string_view key) final;
+	status exists_hashed(string_view key, uint64_t hash) final;
+	status get_hashed(string_view key, uint64_t hash, get_v_callback *callback,
+			  void *arg) final;
+	status put_hashed(string_view key, uint64_t hash, string_view value) final;
+
+	status put_batch(const string_view *keys, const string_view *values,
+			 std::size_t n) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+
+	status remove(string_view key) final;
+	status take(string_view key, get_v_callback *callback, void *arg) final;
+	status remove_between(string_view key1, string_view key2,
+			      std::size_t &cnt) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+	status sync() final;
+
+	status snapshot_save(const std::string &path) final;
+	status snapshot_load(const std::string &path) final;
+	status snapshot_export(int fd, uint64_t max_bytes_per_sec) final;
+
+	internal::transaction *begin_tx() final;
+
+	status stats(internal::stats_sink &sink) final;
+
+	/* milliseconds since the epoch */
+	static uint64_t now();
+
+	/* appends stored form (header and value) of the value to 'out' */
+	static void encode(string_view value, uint64_t expires_at, std::string &out);
+	/*
+	 * Sets 'value' and 'expires_at' (0 if the value doesn't expire) from
+	 * 'stored', returns false if it's corrupted.
+	 */
+	static bool decode(string_view stored, string_view &value, uint64_t &expires_at);
+
+	static bool expired(uint64_t expires_at, uint64_t now)
+	{
+		return expires_at != 0 && expires_at <= now;
+	}
+
+	/* locks stripes of the keys, in order of the stripes */
+	std::vector<std::unique_lock<std::mutex>> lock_keys(const string_view *keys,
+							    std::size_t n);
+	void index(string_view key, uint64_t expires_at);
+
+private:
+	struct index_shard {
+		std::mutex mtx;
+		/* keys by bucket of their expiration time */
+		std::map<uint64_t, std::vector<std::string>> buckets;
+		std::size_t keys = 0;
+	};
+
+	template <typename F>
+	status read_kv(get_kv_callback *callback, void *arg, F &&f);
+	template <typename F>
+	status read_kv_parallel(std::size_t partitions, get_kv_callback *callback,
+				void **args, F &&f);
+
+	std::mutex &stripe(string_view key);
+	/* indexes all expiring records of the engine */
+	void build_index();
+	/* removes records of passed buckets which are (still) expired */
+	void remove_expired();
+
+	std::unique_ptr<engine_base> engine;
+	const ttl_options options;
+
+	std::unique_ptr<std::mutex[]> stripes;
+	std::unique_ptr<index_shard[]> shards;
+
+	std::atomic<uint64_t> expired_removed;
+
+	std::unique_ptr<background_task> expire_task;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_TTL_H */
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_TYPED_DB_H
+#define LIBPMEMKV_TYPED_DB_H
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "catch_status.h"
+#include "config.h"
+#include "engine.h"
+#include "exceptions.h"
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+
+/**
+ * typed_db is a database of an engine known at compile time, e.g.
+ * typed_db<cmap>. It owns the engine directly and calls its methods without
+ * virtual dispatch (nor the C API), so small paths of the engine (most of its
+ * methods are final) can be inlined into the caller. Errors are returned as
+ * statuses, as by pmem::kv::db.
+ *
+ * Engine classes are not exported by libpmemkv.so, so typed_db can only be
+ * used by code built together with pmemkv's sources. It opens the bare engine:
+ * meta-engine config parameters applied by pmem::kv::db::open() (read_only,
+ * compression, durability, read_cache_size and statistics) are not supported.
+ * Functionality not wrapped here is available through engine().
+ */
+template <typename Engine>
+class typed_db {
+	static_assert(std::is_base_of<engine_base, Engine>::value,
+		      "Engine has to be derived from engine_base");
+
+public:
+	typed_db() = default;
+
+	typed_db(const typed_db &) = delete;
+	typed_db &operator=(const typed_db &) = delete;
+
+	/**
+	 * Opens the engine with the given config (see pmem::kv::db::open()).
+	 *
+	 * @param[in] cfg config of the engine
+	 *
+	 * @return pmem::kv::status
+	 */
+	status open(config &&cfg) noexcept
+	{
+		auto s = internal::catch_and_return_status(__func__, [&] {
+			std::unique_ptr<internal::config> c(
+				reinterpret_cast<internal::config *>(cfg.release()));
+			if (!c)
+				throw internal::invalid_argument("Config cannot be null");
+
+			engine_.reset(new Engine(std::move(c)));
+
+			return status::OK;
+		});
+
+		return static_cast<status>(s);
+	}
+
+	/**
+	 * Closes the engine. It's also closed by the destructor.
+	 */
+	void close() noexcept
+	{
+		internal::catch_and_return_status(__func__, [&] {
+			engine_.reset();
+			return status::OK;
+		});
+	}
+
+	/**
+	 * Returns the engine, e.g. to call functions not wrapped by typed_db.
+	 * Exceptions thrown by its methods are not mapped to statuses.
+	 */
+	Engine &engine() noexcept
+	{
+		return *engine_;
+	}
+
+	status count_all(std::size_t &cnt) noexcept
+	{
+		return call(__func__, [&] { return engine_->Engine::count_all(cnt); });
+	}
+
+	status get_all(get_kv_callback *callback, void *arg) noexcept
+	{
+		return call(__func__,
+			    [&] { return engine_->Engine::get_all(callback, arg); });
+	}
+
+	status exists(string_view key) noexcept
+	{
+		return call(__func__, [&] { return engine_->Engine::exists(key); });
+	}
+
+	status get(string_view key, get_v_callback *callback, void *arg) noexcept
+	{
+		return call(__func__,
+			    [&] { return engine_->Engine::get(key, callback, arg); });
+	}
+
+	/**
+	 * Gets a copy of the value of the record with the given key.
+	 *
+	 * @param[in] key record's key
+	 * @param[out] value stores returned copy of the data
+	 *
+	 * @return pmem::kv::status
+	 */
+	status get(string_view key, std::string *value) noexcept
+	{
+		return get(
+			key,
+			[](const char *v, size_t vb, void *arg) {
+				static_cast<std::string *>(arg)->assign(v, vb);
+			},
+			value);
+	}
+
+	status put(string_view key, string_view value) noexcept
+	{
+		return call(__func__, [&] { return engine_->Engine::put(key, value); });
+	}
+
+	status put_batch(const std::vector<string_view> &keys,
+			 const std::vector<string_view> &values) noexcept
+	{
+		if (keys.size() != values.size())
+			return status::INVALID_ARGUMENT;
+
+		return call(__func__, [&] {
+			return engine_->Engine::put_batch(keys.data(), values.data(),
+							  keys.size());
+		});
+	}
+
+	status update(string_view key, update_callback *callback, void *arg) noexcept
+	{
+		return call(__func__,
+			    [&] { return engine_->Engine::update(key, callback, arg); });
+	}
+
+	status remove(string_view key) noexcept
+	{
+		return call(__func__, [&] { return engine_->Engine::remove(key); });
+	}
+
+	status sync() noexcept
+	{
+		return call(__func__, [&] { return engine_->Engine::sync(); });
+	}
+
+private:
+	/* the engine must be open */
+	template <typename Function>
+	status call(const char *func_name, Function &&f) noexcept
+	{
+		if (!engine_)
+			return status::INVALID_ARGUMENT;
+
+		return static_cast<status>(
+			internal::catch_and_return_status(func_name, f));
+	}
+
+	std::unique_ptr<Engine> engine_;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_TYPED_DB_H */
@@ -18,6 +18,14 @@ static int reverse_three_way_compare(const char *key1, size_t keybytes1, const c
 	return key2[0] - key1[0];
 }
 
+/* order-preserving prefix for reverse_three_way_compare */
+static uint64_t reverse_key_prefix(const char *key, size_t keybytes, void *arg)
+{
+	UT_ASSERT(*((int *)arg) == ARG_VALUE);
+
+	return keybytes ? 255 - (unsigned char)key[0] : 255;
+}
+
 static const char *keys[3];
 static int keys_count = 0;
 
@@ -65,6 +73,56 @@ static void test_valid_comparator(const char *engine, pmemkv_config *cfg)
 	pmemkv_close(db);
 }
 
+static int prev_key = 256;
+static int prefix_keys_count = 0;
+
+static int check_reverse_order(const char *key, size_t kb, const char *value, size_t vb,
+			       void *arg)
+{
+	UT_ASSERT((unsigned char)key[0] < prev_key);
+	prev_key = (unsigned char)key[0];
+	prefix_keys_count++;
+
+	return 0;
+}
+
+static void test_key_prefix(const char *engine, pmemkv_config *cfg)
+{
+	pmemkv_comparator *cmp = pmemkv_comparator_new(&reverse_three_way_compare,
+						       "single_byte_compare", &ARG_VALUE);
+	UT_ASSERTne(cmp, NULL);
+
+	int s = pmemkv_comparator_set_key_prefix(cmp, &reverse_key_prefix);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	s = pmemkv_config_put_comparator(cfg, cmp);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	pmemkv_db *db;
+
+	s = pmemkv_open(engine, cfg, &db);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	/* enough keys to split nodes, in mixed order */
+	for (int i = 0; i < 256; i++) {
+		char key[2] = {(char)((i * 7) % 256), 'x'};
+		s = pmemkv_put(db, key, 2, "1", 1);
+		UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+	}
+
+	/* keys with equal first bytes are equal */
+	s = pmemkv_exists(db, "7y", 2);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	pmemkv_get_all(db, &check_reverse_order, NULL);
+	UT_ASSERTeq(prefix_keys_count, 256);
+
+	pmemkv_close(db);
+
+	s = pmemkv_comparator_set_key_prefix(NULL, &reverse_key_prefix);
+	UT_ASSERTeq(s, PMEMKV_STATUS_INVALID_ARGUMENT);
+}
+
 static void test_nullptr_function(const char *engine, pmemkv_config *cfg)
 {
 	pmemkv_comparator *cmp = pmemkv_comparator_new(NULL, "name", &ARG_VALUE);
@@ -81,6 +139,7 @@ int main(int argc, char *argv[])
 		UT_FATAL("usage %s: engine config", argv[0]);
 
 	test_valid_comparator(argv[1], C_CONFIG_FROM_JSON(argv[2]));
+	test_key_prefix(argv[1], C_CONFIG_FROM_JSON(argv[2]));
 	test_nullptr_function(argv[1], C_CONFIG_FROM_JSON(argv[2]));
 
 	return 0;
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include <libpmemkv.h>
+
+#include "unittest.h"
+
+#include <string.h>
+
+/**
+ * Tests "key_type" config parameter: with "uint64" 8-byte keys are sorted
+ * as native-endian unsigned integers.
+ */
+
+#define KEYS_COUNT 300
+
+static uint64_t prev_key = 0;
+static size_t keys_count = 0;
+
+static int check_order(const char *key, size_t kb, const char *value, size_t vb,
+		       void *arg)
+{
+	UT_ASSERTeq(kb, sizeof(uint64_t));
+
+	uint64_t k;
+	memcpy(&k, key, kb);
+	UT_ASSERT(keys_count == 0 || prev_key < k);
+
+	prev_key = k;
+	keys_count++;
+
+	return 0;
+}
+
+static void test_uint64_keys(const char *engine, pmemkv_config *cfg)
+{
+	int s = pmemkv_config_put_string(cfg, "key_type", "uint64");
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	pmemkv_db *db;
+	s = pmemkv_open(engine, cfg, &db);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	/* binary order of little-endian keys would differ from numeric one */
+	for (uint64_t i = 0; i < KEYS_COUNT; i++) {
+		uint64_t key = (i * 7919) % KEYS_COUNT + 250;
+		s = pmemkv_put(db, (const char *)&key, sizeof(key), "1", 1);
+		UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+	}
+
+	s = pmemkv_get_all(db, &check_order, NULL);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+	UT_ASSERTeq(keys_count, KEYS_COUNT);
+	UT_ASSERTeq(prev_key, KEYS_COUNT + 249);
+
+	uint64_t key = 256;
+	size_t cnt;
+	s = pmemkv_count_below(db, (const char *)&key, sizeof(key), &cnt);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+	UT_ASSERTeq(cnt, 6);
+
+	pmemkv_close(db);
+}
+
+static void test_invalid_key_type(const char *engine, pmemkv_config *cfg)
+{
+	int s = pmemkv_config_put_string(cfg, "key_type", "int128");
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	pmemkv_db *db;
+	s = pmemkv_open(engine, cfg, &db);
+	UT_ASSERTeq(s, PMEMKV_STATUS_INVALID_ARGUMENT);
+}
+
+int main(int argc, char *argv[])
+{
+	START();
+
+	if (argc < 3)
+		UT_FATAL("usage %s: engine config", argv[0]);
+
+	test_uint64_keys(argv[1], C_CONFIG_FROM_JSON(argv[2]));
+	test_invalid_key_type(argv[1], C_CONFIG_FROM_JSON(argv[2]));
+
+	return 0;
+}
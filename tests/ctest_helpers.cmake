@@ -188,6 +188,23 @@ function(build_test name)
 	add_dependencies(tests ${name})
 endfunction()
 
+# Builds test together with pmemkv's sources (instead of linking libpmemkv),
+# so it can use internals not exported by the library, e.g. engine classes.
+function(build_test_with_sources name)
+	set(srcs ${ARGN})
+	prepend(srcs ${CMAKE_CURRENT_SOURCE_DIR} ${srcs})
+	prepend(pmemkv_srcs ${PMEMKV_ROOT_DIR} ${SOURCE_FILES})
+
+	add_executable(${name} ${srcs} ${pmemkv_srcs})
+	setup_pmemkv_sources_target(${name})
+	target_link_libraries(${name} PRIVATE ${LIBPMEMOBJ_LIBRARIES} test_backtrace)
+	if(LIBUNWIND_FOUND)
+		target_link_libraries(${name} PRIVATE ${LIBUNWIND_LIBRARIES} ${CMAKE_DL_LIBS})
+	endif()
+
+	add_dependencies(tests ${name})
+endfunction()
+
 # Configures testcase ${test_name}_${testcase} with ${tracer}
 # and cmake_script used to execute test
 function(add_testcase executable test_name tracer testcase cmake_script)
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests statistics of sampled accesses to keys (db::get_stats,
+ * db::reset_stats). Database must be opened with "access_sampling" config
+ * parameter set to 1, so that every access is sampled.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 1000;
+static const size_t HOT_READS = 500;
+
+static void AccessStatsTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i)),
+			      status::OK);
+
+	std::string value;
+	for (size_t i = 0; i < HOT_READS; ++i)
+		ASSERT_STATUS(kv.get(entry_from_number(7), &value), status::OK);
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+
+	UT_ASSERTeq(stats["access.sampling_rate"], 1);
+	UT_ASSERTeq(stats["access.sampled_ops"], N_KEYS + HOT_READS);
+
+	/* estimate of distinct keys is within a few percent */
+	UT_ASSERT(stats["access.working_set_keys"] >= N_KEYS * 95 / 100);
+	UT_ASSERT(stats["access.working_set_keys"] <= N_KEYS * 105 / 100);
+
+	/* the hot key is in the table of the most frequent keys */
+	auto hot = stats.find("access.top." + entry_from_number(7));
+	UT_ASSERT(hot != stats.end());
+	UT_ASSERT(hot->second >= HOT_READS + 1);
+	UT_ASSERT(stats["access.top_percent"] >= HOT_READS * 100 / (N_KEYS + HOT_READS));
+
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+	stats.clear();
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERTeq(stats["access.sampled_ops"], 0);
+	UT_ASSERTeq(stats["access.working_set_keys"], 0);
+	UT_ASSERT(stats.find("access.top." + entry_from_number(7)) == stats.end());
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 AccessStatsTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <atomic>
+#include <limits>
+
+/**
+ * Tests asynchronous operations (db::async_queue) - ordering of operations,
+ * completion by poll() and inline completion.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+
+static void PutGetRemoveTest(pmem::kv::db &kv)
+{
+	auto q_res = kv.new_async_queue();
+	ASSERT_STATUS(q_res.get_status(), status::OK);
+	auto &q = q_res.get_value();
+
+	size_t put_ok = 0;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		auto s = q.put(entry_from_number(i, "", "k"), entry_from_number(i, "", "v"),
+			       [&](status s, string_view) {
+				       ASSERT_STATUS(s, status::OK);
+				       ++put_ok;
+			       });
+		ASSERT_STATUS(s, status::OK);
+	}
+
+	/* submits after puts, must see their results */
+	std::vector<std::string> values(N_KEYS);
+	size_t get_ok = 0;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		auto s = q.get(entry_from_number(i, "", "k"), [&, i](status s, string_view v) {
+			ASSERT_STATUS(s, status::OK);
+			values[i].assign(v.data(), v.size());
+			++get_ok;
+		});
+		ASSERT_STATUS(s, status::OK);
+	}
+
+	ASSERT_STATUS(q.wait(), status::OK);
+
+	/* completions are not called before poll */
+	UT_ASSERTeq(put_ok, 0);
+	UT_ASSERTeq(get_ok, 0);
+
+	size_t completed;
+	ASSERT_STATUS(q.poll(N_KEYS, completed), status::OK);
+	UT_ASSERTeq(completed, N_KEYS);
+	UT_ASSERTeq(put_ok, N_KEYS);
+
+	ASSERT_STATUS(q.poll(std::numeric_limits<size_t>::max(), completed), status::OK);
+	UT_ASSERTeq(completed, N_KEYS);
+	UT_ASSERTeq(get_ok, N_KEYS);
+
+	ASSERT_STATUS(q.poll(1, completed), status::OK);
+	UT_ASSERTeq(completed, 0);
+
+	for (size_t i = 0; i < N_KEYS; ++i)
+		UT_ASSERT(values[i] == entry_from_number(i, "", "v"));
+	ASSERT_SIZE(kv, N_KEYS);
+
+	size_t not_found = 0;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		ASSERT_STATUS(q.remove(entry_from_number(i, "", "k"),
+				       [&](status s, string_view) {
+					       ASSERT_STATUS(s, status::OK);
+				       }),
+			      status::OK);
+		ASSERT_STATUS(q.get(entry_from_number(i, "", "k"),
+				    [&](status s, string_view v) {
+					    ASSERT_STATUS(s, status::NOT_FOUND);
+					    UT_ASSERTeq(v.size(), 0);
+					    ++not_found;
+				    }),
+			      status::OK);
+	}
+
+	ASSERT_STATUS(q.wait(), status::OK);
+	ASSERT_STATUS(q.poll(std::numeric_limits<size_t>::max(), completed), status::OK);
+	UT_ASSERTeq(completed, 2 * N_KEYS);
+	UT_ASSERTeq(not_found, N_KEYS);
+	ASSERT_SIZE(kv, 0);
+}
+
+static void InlineCompletionTest(pmem::kv::db &kv)
+{
+	auto q_res = kv.new_async_queue(true);
+	ASSERT_STATUS(q_res.get_status(), status::OK);
+	auto &q = q_res.get_value();
+
+	std::atomic<size_t> put_ok(0);
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		auto s = q.put(entry_from_number(i, "", "k"), entry_from_number(i, "", "v"),
+			       [&](status s, string_view) {
+				       ASSERT_STATUS(s, status::OK);
+				       ++put_ok;
+			       });
+		ASSERT_STATUS(s, status::OK);
+	}
+
+	ASSERT_STATUS(q.wait(), status::OK);
+	UT_ASSERTeq(put_ok.load(), N_KEYS);
+
+	size_t completed;
+	ASSERT_STATUS(q.poll(std::numeric_limits<size_t>::max(), completed), status::OK);
+	UT_ASSERTeq(completed, 0);
+
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(entry_from_number(i, "", "k"), &value), status::OK);
+		UT_ASSERT(value == entry_from_number(i, "", "v"));
+	}
+}
+
+static void DestroyWithPendingTest(pmem::kv::db &kv)
+{
+	size_t put_ok = 0;
+	{
+		auto q_res = kv.new_async_queue();
+		ASSERT_STATUS(q_res.get_status(), status::OK);
+		auto &q = q_res.get_value();
+
+		for (size_t i = 0; i < N_KEYS; ++i) {
+			auto s = q.put(entry_from_number(i, "", "k"),
+				       entry_from_number(i, "", "v"),
+				       [&](status s, string_view) {
+					       ASSERT_STATUS(s, status::OK);
+					       ++put_ok;
+				       });
+			ASSERT_STATUS(s, status::OK);
+		}
+	}
+
+	/* destructor waits for all operations and calls all completions */
+	UT_ASSERTeq(put_ok, N_KEYS);
+	ASSERT_SIZE(kv, N_KEYS);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 PutGetRemoveTest,
+				 InlineCompletionTest,
+				 DestroyWithPendingTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
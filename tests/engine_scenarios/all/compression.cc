@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests value compression. Database must be opened with "compression"
+ * config parameter set to "zstd".
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 300;
+
+/* every third value is not compressible, so it's stored raw */
+static std::string make_value(size_t i)
+{
+	if (i % 3 == 0) {
+		std::string value;
+		for (size_t j = 0; j < i; ++j)
+			value.push_back(static_cast<char>((j * 7919 + i) % 251));
+		return value;
+	}
+
+	std::string value;
+	while (value.size() < i)
+		value += "{\"id\":" + std::to_string(i) + ",\"name\":\"value\"},";
+
+	return value.substr(0, i);
+}
+
+static void PutGetTest(pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), make_value(i * 11)),
+			      status::OK);
+
+	std::string value;
+	std::size_t size;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+		UT_ASSERT(value == make_value(i * 11));
+
+		/* read from the header of compressed (or raw) value */
+		ASSERT_STATUS(kv.value_size(entry_from_number(i), size), status::OK);
+		UT_ASSERTeq(size, i * 11);
+	}
+
+	size_t cnt = 0;
+	auto s = kv.get_all([&](string_view k, string_view v) {
+		auto i = std::stoull(std::string(k.data(), k.size()));
+		UT_ASSERT(v == make_value(i * 11));
+		++cnt;
+		return 0;
+	});
+	ASSERT_STATUS(s, status::OK);
+	UT_ASSERTeq(cnt, N_KEYS);
+
+	/* overwrite with values of different sizes */
+	for (size_t i = 0; i < N_KEYS; i += 2)
+		ASSERT_STATUS(kv.put(entry_from_number(i), make_value(i)), status::OK);
+
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+		UT_ASSERT(value == make_value(i % 2 ? i * 11 : i));
+	}
+
+	ASSERT_STATUS(kv.remove(entry_from_number(1)), status::OK);
+	ASSERT_STATUS(kv.get(entry_from_number(1), &value), status::NOT_FOUND);
+	ASSERT_SIZE(kv, N_KEYS - 1);
+
+	CLEAR_KV(kv);
+}
+
+static void UpdateTest(pmem::kv::db &kv)
+{
+	auto key = entry_from_string("key1");
+	auto long_value = make_value(5000);
+
+	ASSERT_STATUS(kv.put(key, long_value), status::OK);
+	ASSERT_STATUS(kv.update(key,
+				[&](const string_view *v, std::string &new_value) {
+					UT_ASSERT(v != nullptr);
+					UT_ASSERT(*v == long_value);
+					new_value = long_value + long_value;
+					return 0;
+				}),
+		      status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == long_value + long_value);
+
+	CLEAR_KV(kv);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 PutGetTest,
+				 UpdateTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests deferred durability (db::sync). Database must be opened with
+ * "durability" config parameter set to "deferred".
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 1000;
+
+static void PendingWritesTest(pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+	ASSERT_STATUS(kv.remove(entry_from_number(0)), status::OK);
+
+	/* pending writes are seen by reads */
+	std::string value;
+	ASSERT_STATUS(kv.get(entry_from_number(1), &value), status::OK);
+	UT_ASSERT(value == entry_from_number(1, "v"));
+	ASSERT_STATUS(kv.get(entry_from_number(0), &value), status::NOT_FOUND);
+	ASSERT_STATUS(kv.exists(entry_from_number(0)), status::NOT_FOUND);
+	ASSERT_STATUS(kv.exists(entry_from_number(2)), status::OK);
+
+	/* a removed or missing key can't be removed again */
+	ASSERT_STATUS(kv.remove(entry_from_number(0)), status::NOT_FOUND);
+	ASSERT_STATUS(kv.remove(entry_from_number(N_KEYS)), status::NOT_FOUND);
+
+	/* counts apply pending writes first */
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, N_KEYS - 1);
+
+	ASSERT_STATUS(kv.put(entry_from_number(0), entry_from_number(0, "v")),
+		      status::OK);
+	ASSERT_STATUS(kv.sync(), status::OK);
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERTeq(stats["deferred.pending_keys"], 0);
+	UT_ASSERT(stats["deferred.applied_keys"] >= N_KEYS);
+
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, N_KEYS);
+	ASSERT_STATUS(kv.get(entry_from_number(0), &value), status::OK);
+	UT_ASSERT(value == entry_from_number(0, "v"));
+}
+
+static void OverwriteTest(pmem::kv::db &kv)
+{
+	/* only the last pending write of a key is applied */
+	ASSERT_STATUS(kv.put("key", "value1"), status::OK);
+	ASSERT_STATUS(kv.put("key", "value2"), status::OK);
+	ASSERT_STATUS(kv.remove("key"), status::OK);
+	ASSERT_STATUS(kv.put("key", "value3"), status::OK);
+	ASSERT_STATUS(kv.sync(), status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get("key", &value), status::OK);
+	UT_ASSERT(value == "value3");
+
+	ASSERT_STATUS(kv.remove("key"), status::OK);
+	ASSERT_STATUS(kv.sync(), status::OK);
+	ASSERT_STATUS(kv.exists("key"), status::NOT_FOUND);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 PendingWritesTest,
+				 OverwriteTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <map>
+
+/**
+ * Tests batched get (db::get_batch) - found, missing and duplicated keys,
+ * stopping by callback and comparison with results of a simple get().
+ */
+
+using namespace pmem::kv;
+
+static void EmptyBatchTest(pmem::kv::db &kv)
+{
+	std::vector<string_view> keys;
+	size_t calls = 0;
+	ASSERT_STATUS(kv.get_batch(keys,
+				   [&](string_view, string_view) {
+					   calls++;
+					   return 0;
+				   }),
+		      status::OK);
+	UT_ASSERTeq(calls, 0);
+}
+
+static void GetBatchTest(pmem::kv::db &kv, size_t n_keys)
+{
+	std::vector<std::string> keys_storage;
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < n_keys; ++i) {
+		auto key = entry_from_number(i, "", "k");
+		auto val = entry_from_number(i, "", "v");
+		ASSERT_STATUS(kv.put(key, val), status::OK);
+		keys_storage.emplace_back(key);
+		expected[key] = val;
+	}
+
+	std::vector<string_view> keys;
+	for (auto &k : keys_storage)
+		keys.emplace_back(k);
+
+	std::vector<std::pair<std::string, std::string>> returned;
+	ASSERT_STATUS(kv.get_batch(keys,
+				   [&](string_view k, string_view v) {
+					   returned.emplace_back(
+						   std::string(k.data(), k.size()),
+						   std::string(v.data(), v.size()));
+					   return 0;
+				   }),
+		      status::OK);
+
+	/* callback is called in order of keys */
+	UT_ASSERTeq(returned.size(), n_keys);
+	for (size_t i = 0; i < n_keys; ++i) {
+		UT_ASSERT(returned[i].first == keys_storage[i]);
+		UT_ASSERT(returned[i].second == expected[keys_storage[i]]);
+
+		std::string value;
+		ASSERT_STATUS(kv.get(keys_storage[i], &value), status::OK);
+		UT_ASSERT(value == returned[i].second);
+	}
+}
+
+static void GetBatchSmallTest(pmem::kv::db &kv)
+{
+	GetBatchTest(kv, 3);
+}
+
+static void GetBatchLargeTest(pmem::kv::db &kv)
+{
+	GetBatchTest(kv, 1000);
+}
+
+static void GetBatchNotFoundTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto key2 = entry_from_string("key2");
+	auto key3 = entry_from_string("key3");
+	ASSERT_STATUS(kv.put(key1, entry_from_string("value1")), status::OK);
+	ASSERT_STATUS(kv.put(key3, entry_from_string("value3")), status::OK);
+
+	std::vector<std::string> returned;
+	ASSERT_STATUS(kv.get_batch({key1, key2, key3, key1},
+				   [&](string_view k, string_view v) {
+					   returned.emplace_back(v.data(), v.size());
+					   return 0;
+				   }),
+		      status::NOT_FOUND);
+
+	UT_ASSERTeq(returned.size(), 3);
+	UT_ASSERT(returned[0] == entry_from_string("value1"));
+	UT_ASSERT(returned[1] == entry_from_string("value3"));
+	UT_ASSERT(returned[2] == entry_from_string("value1"));
+}
+
+static void GetBatchUnsortedTest(pmem::kv::db &kv)
+{
+	const size_t n_keys = 1000;
+	for (size_t i = 0; i < n_keys; i += 2)
+		ASSERT_STATUS(kv.put(entry_from_number(i, "", "k"),
+				     entry_from_number(i, "", "v")),
+			      status::OK);
+
+	/* keys in an order other than the engine's one, every other missing */
+	std::vector<std::string> keys_storage;
+	for (size_t i = 0; i < n_keys; ++i)
+		keys_storage.emplace_back(entry_from_number((i * 7) % n_keys, "", "k"));
+	std::vector<string_view> keys(keys_storage.begin(), keys_storage.end());
+
+	std::vector<std::string> returned;
+	ASSERT_STATUS(kv.get_batch(keys,
+				   [&](string_view k, string_view v) {
+					   returned.emplace_back(k.data(), k.size());
+					   return 0;
+				   }),
+		      status::NOT_FOUND);
+
+	/* callback is called in order of the batch */
+	UT_ASSERTeq(returned.size(), n_keys / 2);
+	size_t r = 0;
+	for (size_t i = 0; i < n_keys; ++i) {
+		if ((i * 7) % n_keys % 2 == 0)
+			UT_ASSERT(returned[r++] == keys_storage[i]);
+	}
+}
+
+static void GetBatchStoppedByCallbackTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto key2 = entry_from_string("key2");
+	auto key3 = entry_from_string("key3");
+	ASSERT_STATUS(kv.put(key1, entry_from_string("value1")), status::OK);
+	ASSERT_STATUS(kv.put(key2, entry_from_string("value2")), status::OK);
+	ASSERT_STATUS(kv.put(key3, entry_from_string("value3")), status::OK);
+
+	size_t calls = 0;
+	ASSERT_STATUS(kv.get_batch({key1, key2, key3},
+				   [&](string_view k, string_view v) {
+					   calls++;
+					   return calls == 2 ? 1 : 0;
+				   }),
+		      status::STOPPED_BY_CB);
+	UT_ASSERTeq(calls, 2);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 EmptyBatchTest,
+				 GetBatchSmallTest,
+				 GetBatchLargeTest,
+				 GetBatchNotFoundTest,
+				 GetBatchUnsortedTest,
+				 GetBatchStoppedByCallbackTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
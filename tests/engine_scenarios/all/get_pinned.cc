@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests reading values without copying (db::get_pinned).
+ */
+
+using namespace pmem::kv;
+
+static void NotFoundTest(pmem::kv::db &kv)
+{
+	auto res = kv.get_pinned(entry_from_string("key1"));
+	ASSERT_STATUS(res.get_status(), status::NOT_FOUND);
+}
+
+static void GetPinnedTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto value1 = entry_from_string("value1");
+	auto key2 = entry_from_string("key2");
+	auto value2 = std::string(10000, 'x');
+
+	ASSERT_STATUS(kv.put(key1, value1), status::OK);
+	ASSERT_STATUS(kv.put(key2, value2), status::OK);
+
+	{
+		auto res1 = kv.get_pinned(key1);
+		ASSERT_STATUS(res1.get_status(), status::OK);
+		auto res2 = kv.get_pinned(key2);
+		ASSERT_STATUS(res2.get_status(), status::OK);
+
+		UT_ASSERT(res1.get_value().value() == value1);
+		UT_ASSERT(res2.get_value().value() == value2);
+
+		res1.get_value().release();
+		UT_ASSERTeq(res1.get_value().value().size(), 0);
+		UT_ASSERT(res2.get_value().value() == value2);
+	}
+
+	/* records can be modified after handles are destroyed */
+	auto new_value = entry_from_string("new_value");
+	ASSERT_STATUS(kv.put(key1, new_value), status::OK);
+	ASSERT_STATUS(kv.remove(key2), status::OK);
+
+	auto res = kv.get_pinned(key1);
+	ASSERT_STATUS(res.get_status(), status::OK);
+	UT_ASSERT(res.get_value().value() == new_value);
+	res.get_value().release();
+
+	ASSERT_STATUS(kv.get_pinned(key2).get_status(), status::NOT_FOUND);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 NotFoundTest,
+				 GetPinnedTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -4,6 +4,7 @@
 #include "unittest.hpp"
 
 #include <algorithm>
+#include <memory>
 #include <vector>
 
 /**
@@ -74,6 +75,30 @@ static void GetAllTest(pmem::kv::db &kv)
 		&result);
 	ASSERT_STATUS(s, status::OK);
 	UT_ASSERT((sort(result) == sort(entries)));
+
+	/* get_all with a callable which can't be wrapped in std::function */
+	struct move_only_counter {
+		std::unique_ptr<size_t> cnt;
+
+		int operator()(string_view, string_view)
+		{
+			++*cnt;
+			return 0;
+		}
+	};
+	move_only_counter counter{std::unique_ptr<size_t>(new size_t(0))};
+	ASSERT_STATUS(kv.get_all(counter), status::OK);
+	UT_ASSERTeq(*counter.cnt, entries.size());
+
+	/* get_all with std::function object */
+	result = {};
+	std::function<get_kv_function> f = [&](string_view k, string_view v) {
+		result.emplace_back(std::string(k.data(), k.size()),
+				    std::string(v.data(), v.size()));
+		return 0;
+	};
+	ASSERT_STATUS(kv.get_all(f), status::OK);
+	UT_ASSERT((sort(result) == sort(entries)));
 }
 
 static void test(int argc, char *argv[])
@@ -129,6 +129,132 @@ static void write_abort_test(pmem::kv::db &kv)
 	verify_keys<false>(it);
 }
 
+/* for write iterators in the direct mode, which modify values in place */
+static void write_direct_test(pmem::kv::db &kv)
+{
+	insert_keys(kv);
+
+	{
+		auto it = new_iterator<false>(kv);
+
+		std::for_each(keys.begin(), keys.end(), [&](pair p) {
+			ASSERT_STATUS(it.seek(p.first), pmem::kv::status::OK);
+
+			auto res = it.write_range();
+			UT_ASSERT(res.is_ok());
+			for (auto &c : res.get_value())
+				c = 'x';
+
+			/* the iterator sees its own changes before commit */
+			auto x = std::string(res.get_value().size(), 'x');
+			verify_value<false>(it, x);
+
+			ASSERT_STATUS(it.commit(), pmem::kv::status::OK);
+			verify_value<false>(it, x);
+
+			/* changes of many ranges are rolled back by abort */
+			auto res2 = it.write_range(0, 1);
+			UT_ASSERT(res2.is_ok());
+			*res2.get_value().begin() = 'a';
+			auto res3 = it.write_range(x.size() - 1, 1);
+			UT_ASSERT(res3.is_ok());
+			*res3.get_value().begin() = 'b';
+
+			it.abort();
+			verify_value<false>(it, x);
+		});
+
+		/* seek rolls back uncommitted changes */
+		ASSERT_STATUS(it.seek(keys.front().first), pmem::kv::status::OK);
+		auto res = it.write_range();
+		UT_ASSERT(res.is_ok());
+		for (auto &c : res.get_value())
+			c = 'a';
+
+		ASSERT_STATUS(it.seek(keys.back().first), pmem::kv::status::OK);
+	}
+
+	std::for_each(keys.begin(), keys.end(), [&](pair p) {
+		std::string value;
+		ASSERT_STATUS(kv.get(p.first, &value), pmem::kv::status::OK);
+		UT_ASSERT(value == std::string(value.size(), 'x'));
+	});
+
+	/* uncommitted changes are rolled back when the iterator is deleted */
+	{
+		auto it = new_iterator<false>(kv);
+		ASSERT_STATUS(it.seek(keys.front().first), pmem::kv::status::OK);
+		auto res = it.write_range();
+		UT_ASSERT(res.is_ok());
+		for (auto &c : res.get_value())
+			c = 'a';
+	}
+
+	std::string value;
+	ASSERT_STATUS(kv.get(keys.front().first, &value), pmem::kv::status::OK);
+	UT_ASSERT(value == std::string(value.size(), 'x'));
+}
+
+template <bool IsConst>
+static void reset_test(pmem::kv::db &kv)
+{
+	insert_keys(kv);
+
+	auto it = new_iterator<IsConst>(kv);
+	ASSERT_STATUS(it.seek(keys.front().first), pmem::kv::status::OK);
+	ASSERT_STATUS(it.reset(), pmem::kv::status::OK);
+
+	/* reset iterator doesn't block writes to the record it pointed to */
+	ASSERT_STATUS(kv.put(keys.front().first, "new"), pmem::kv::status::OK);
+	ASSERT_STATUS(kv.remove(keys.back().first), pmem::kv::status::OK);
+
+	/* and it can be used again */
+	ASSERT_STATUS(it.seek(keys.front().first), pmem::kv::status::OK);
+	verify_value<IsConst>(it, "new");
+	ASSERT_STATUS(it.seek(keys.back().first), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(kv.put(keys.back().first, keys.back().second),
+		      pmem::kv::status::OK);
+	ASSERT_STATUS(kv.put(keys.front().first, keys.front().second),
+		      pmem::kv::status::OK);
+	verify_keys<IsConst>(it);
+}
+
+/* only for non const (write) iterators */
+static void reset_abort_test(pmem::kv::db &kv)
+{
+	insert_keys(kv);
+
+	auto it = new_iterator<false>(kv);
+	ASSERT_STATUS(it.seek(keys.front().first), pmem::kv::status::OK);
+	auto res = it.write_range();
+	UT_ASSERT(res.is_ok());
+	for (auto &c : res.get_value())
+		c = 'x';
+
+	/* uncommitted changes are dropped by reset */
+	ASSERT_STATUS(it.reset(), pmem::kv::status::OK);
+	ASSERT_STATUS(it.commit(), pmem::kv::status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(keys.front().first, &value), pmem::kv::status::OK);
+	UT_ASSERT(value == keys.front().second);
+}
+
+/* read iterators deleted in a loop are reused (from the per-thread cache) */
+static void reuse_test(pmem::kv::db &kv)
+{
+	for (auto &p : keys) {
+		{
+			auto it = new_iterator<true>(kv);
+			ASSERT_STATUS(it.seek(p.first), pmem::kv::status::NOT_FOUND);
+		}
+		ASSERT_STATUS(kv.put(p.first, p.second), pmem::kv::status::OK);
+	}
+
+	auto it = new_iterator<true>(kv);
+	verify_keys<true>(it);
+}
+
 static void zeroed_key_test(pmem::kv::db &kv)
 {
 	auto element = pmem::kv::string_view("z\0z", 3);
@@ -149,16 +275,34 @@ static void zeroed_key_test(pmem::kv::db &kv)
 static void test(int argc, char *argv[])
 {
 	if (argc < 3)
-		UT_FATAL("usage: %s engine json_config", argv[0]);
-
-	run_engine_tests(argv[1], argv[2],
-			 {
-				 seek_test<true>,
-				 seek_test<false>,
-				 write_test,
-				 write_abort_test,
-				 zeroed_key_test,
-			 });
+		UT_FATAL("usage: %s engine json_config [direct]", argv[0]);
+
+	/* with "direct_write_range" write iterators see their uncommitted changes */
+	if (argc > 3 && std::string(argv[3]) == "direct")
+		run_engine_tests(argv[1], argv[2],
+				 {
+					 seek_test<true>,
+					 seek_test<false>,
+					 write_direct_test,
+					 reset_test<true>,
+					 reset_test<false>,
+					 reset_abort_test,
+					 reuse_test,
+					 zeroed_key_test,
+				 });
+	else
+		run_engine_tests(argv[1], argv[2],
+				 {
+					 seek_test<true>,
+					 seek_test<false>,
+					 write_test,
+					 write_abort_test,
+					 reset_test<true>,
+					 reset_test<false>,
+					 reset_abort_test,
+					 reuse_test,
+					 zeroed_key_test,
+				 });
 }
 
 int main(int argc, char *argv[])
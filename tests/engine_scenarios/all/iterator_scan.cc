@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/**
+ * Test full scans by iterators (seek_to_first and next), also in chunks
+ * resumed from the last visited key. Order of elements is not checked.
+ */
+
+#include <map>
+#include <vector>
+
+#include "../iterator.hpp"
+
+static const size_t N_KEYS = 100;
+
+static void insert_n_keys(pmem::kv::db &kv, std::map<std::string, std::string> &expected)
+{
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		auto k = entry_from_number(i, "", "k");
+		auto v = entry_from_number(i, "", "v");
+		ASSERT_STATUS(kv.put(k, v), pmem::kv::status::OK);
+		expected[k] = v;
+	}
+}
+
+template <bool IsConst>
+static void scan_empty_test(pmem::kv::db &kv)
+{
+	auto it = new_iterator<IsConst>(kv);
+
+	ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(it.is_next(), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(it.next(), pmem::kv::status::NOT_FOUND);
+}
+
+template <bool IsConst>
+static void scan_test(pmem::kv::db &kv)
+{
+	std::map<std::string, std::string> expected;
+	insert_n_keys(kv, expected);
+
+	auto it = new_iterator<IsConst>(kv);
+
+	std::map<std::string, std::string> visited;
+	auto s = it.seek_to_first();
+	while (s == pmem::kv::status::OK) {
+		auto k = it.key();
+		UT_ASSERT(k.is_ok());
+		auto v = it.read_range();
+		UT_ASSERT(v.is_ok());
+
+		std::string key(k.get_value().data(), k.get_value().size());
+		UT_ASSERT(visited.find(key) == visited.end());
+		visited[key] =
+			std::string(v.get_value().begin(), v.get_value().end());
+
+		auto has_next = it.is_next();
+		s = it.next();
+		ASSERT_STATUS(s, has_next);
+	}
+	ASSERT_STATUS(s, pmem::kv::status::NOT_FOUND);
+
+	UT_ASSERT(visited == expected);
+}
+
+template <bool IsConst>
+static void scan_chunks_test(pmem::kv::db &kv)
+{
+	const size_t CHUNK = 7;
+
+	std::map<std::string, std::string> expected;
+	insert_n_keys(kv, expected);
+
+	std::vector<std::string> visited;
+	std::string position;
+	bool finished = false;
+	while (!finished) {
+		/* each chunk uses a new iterator, resumed from the last key */
+		auto it = new_iterator<IsConst>(kv);
+
+		pmem::kv::status s;
+		if (visited.empty()) {
+			s = it.seek_to_first();
+		} else {
+			ASSERT_STATUS(it.seek(position), pmem::kv::status::OK);
+			s = it.next();
+		}
+
+		for (size_t i = 0; i < CHUNK && s == pmem::kv::status::OK; ++i) {
+			auto k = it.key();
+			UT_ASSERT(k.is_ok());
+			position.assign(k.get_value().data(), k.get_value().size());
+			visited.push_back(position);
+
+			if (i + 1 < CHUNK)
+				s = it.next();
+		}
+
+		finished = (s != pmem::kv::status::OK);
+	}
+
+	UT_ASSERTeq(visited.size(), expected.size());
+	for (auto &k : visited)
+		UT_ASSERTeq(expected.erase(k), 1);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 scan_empty_test<true>,
+				 scan_empty_test<false>,
+				 scan_test<true>,
+				 scan_test<false>,
+				 scan_chunks_test<true>,
+				 scan_chunks_test<false>,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests operations on keys with precomputed hashes (db::make_key_handle).
+ */
+
+using namespace pmem::kv;
+
+static void NotFoundTest(pmem::kv::db &kv)
+{
+	auto res = kv.make_key_handle(entry_from_string("key1"));
+	ASSERT_STATUS(res.get_status(), status::OK);
+	auto &handle = res.get_value();
+
+	ASSERT_STATUS(kv.exists(handle), status::NOT_FOUND);
+	std::string value;
+	ASSERT_STATUS(kv.get(handle, &value), status::NOT_FOUND);
+}
+
+static void PutGetTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto value1 = entry_from_string("value1");
+	auto key2 = entry_from_string("key2");
+	auto value2 = std::string(10000, 'x');
+
+	auto res1 = kv.make_key_handle(key1);
+	ASSERT_STATUS(res1.get_status(), status::OK);
+	auto res2 = kv.make_key_handle(key2);
+	ASSERT_STATUS(res2.get_status(), status::OK);
+	auto &handle1 = res1.get_value();
+	auto &handle2 = res2.get_value();
+
+	/* records put by handles are visible by their keys and vice versa */
+	ASSERT_STATUS(kv.put(handle1, value1), status::OK);
+	ASSERT_STATUS(kv.put(key2, value2), status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == value1);
+	ASSERT_STATUS(kv.exists(handle2), status::OK);
+	ASSERT_STATUS(kv.get(handle2, &value), status::OK);
+	UT_ASSERT(value == value2);
+
+	/* handles stay valid after their records are modified */
+	for (int i = 0; i < 10; ++i) {
+		auto v = std::to_string(i);
+		ASSERT_STATUS(kv.put(handle1, v), status::OK);
+		auto s = kv.get(handle1,
+				[&](string_view res) { UT_ASSERT(res.compare(v) == 0); });
+		ASSERT_STATUS(s, status::OK);
+	}
+
+	ASSERT_STATUS(kv.remove(key2), status::OK);
+	ASSERT_STATUS(kv.exists(handle2), status::NOT_FOUND);
+	ASSERT_STATUS(kv.get(handle2, &value), status::NOT_FOUND);
+
+	ASSERT_STATUS(kv.put(handle2, value1), status::OK);
+	ASSERT_STATUS(kv.get(key2, &value), status::OK);
+	UT_ASSERT(value == value1);
+
+	/* an empty handle is rejected */
+	key_handle empty;
+	ASSERT_STATUS(kv.exists(empty), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.get(empty, &value), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.put(empty, value1), status::INVALID_ARGUMENT);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 NotFoundTest,
+				 PutGetTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests latency statistics (db::get_stats, db::reset_stats). Database must be
+ * opened with "latency_stats" config parameter set to 1.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+
+static void LatencyStatsTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i)),
+			      status::OK);
+
+	std::string value;
+	for (size_t i = 0; i < N_KEYS * 2; ++i) {
+		auto s = kv.get(entry_from_number(i), &value);
+		UT_ASSERT(s == status::OK || s == status::NOT_FOUND);
+	}
+
+	ASSERT_STATUS(kv.remove(entry_from_number(0)), status::OK);
+	ASSERT_STATUS(kv.get_all([](string_view, string_view) { return 0; }),
+		      status::OK);
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+
+	UT_ASSERTeq(stats["latency.put.count"], N_KEYS);
+	UT_ASSERTeq(stats["latency.get.count"], N_KEYS * 2);
+	UT_ASSERTeq(stats["latency.remove.count"], 1);
+	UT_ASSERTeq(stats["latency.iterate.count"], 1);
+
+	for (auto op : {"put", "get"}) {
+		std::string prefix = std::string("latency.") + op + ".";
+		UT_ASSERT(stats[prefix + "min"] <= stats[prefix + "p50"]);
+		UT_ASSERT(stats[prefix + "p50"] <= stats[prefix + "p90"]);
+		UT_ASSERT(stats[prefix + "p90"] <= stats[prefix + "p99"]);
+		UT_ASSERT(stats[prefix + "p99"] <= stats[prefix + "p999"]);
+		UT_ASSERT(stats[prefix + "p999"] <= stats[prefix + "max"]);
+		UT_ASSERT(stats[prefix + "mean"] <= stats[prefix + "max"]);
+	}
+
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERTeq(stats["latency.put.count"], 0);
+	UT_ASSERTeq(stats["latency.get.count"], 0);
+	UT_ASSERTeq(stats["latency.put.max"], 0);
+}
+
+static void StopByCallbackTest(pmem::kv::db &kv)
+{
+	size_t called = 0;
+	auto s = kv.get_stats(
+		[](const char *, uint64_t, void *arg) {
+			++(*static_cast<size_t *>(arg));
+			return 1;
+		},
+		&called);
+
+	ASSERT_STATUS(s, status::STOPPED_BY_CB);
+	UT_ASSERTeq(called, 1);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 LatencyStatsTest,
+				 StopByCallbackTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests copying content of the database to a database of another engine
+ * and back (db::migrate_to).
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 5000;
+
+static pmem::kv::db destination;
+static size_t partitions;
+
+/* ASSERT_SIZE() can only be used for a db named kv */
+static void AssertSize(pmem::kv::db &kv, size_t expected_size)
+{
+	ASSERT_SIZE(kv, expected_size);
+}
+
+static void VerifyContent(pmem::kv::db &kv, const std::string &big_value)
+{
+	ASSERT_SIZE(kv, N_KEYS + 2);
+
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(entry_from_number(i, "", "k"), &value), status::OK);
+		UT_ASSERT(value == entry_from_number(i, "", "v"));
+	}
+
+	std::string value;
+	ASSERT_STATUS(kv.get("big", &value), status::OK);
+	UT_ASSERT(value == big_value);
+	ASSERT_STATUS(kv.get("empty", &value), status::OK);
+	UT_ASSERTeq(value.size(), 0);
+}
+
+static void MigrateTest(pmem::kv::db &kv)
+{
+	/* more than a single batch of records in every partition */
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i, "", "k"),
+				     entry_from_number(i, "", "v")),
+			      status::OK);
+
+	/* bigger than a single batch */
+	auto big_value = std::string(3 << 20, 'x');
+	ASSERT_STATUS(kv.put("big", big_value), status::OK);
+	ASSERT_STATUS(kv.put("empty", ""), status::OK);
+
+	ASSERT_STATUS(kv.migrate_to(destination, partitions), status::OK);
+	VerifyContent(destination, big_value);
+	VerifyContent(kv, big_value);
+
+	CLEAR_KV(kv);
+	ASSERT_STATUS(destination.migrate_to(kv, partitions), status::OK);
+	VerifyContent(kv, big_value);
+
+	CLEAR_KV(destination);
+}
+
+static void OverwriteTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put("key1", "value1"), status::OK);
+	ASSERT_STATUS(kv.put("key2", "value2"), status::OK);
+
+	ASSERT_STATUS(destination.put("key1", "old_value"), status::OK);
+	ASSERT_STATUS(destination.put("key3", "value3"), status::OK);
+
+	/* migrated elements overwrite existing ones, others are kept */
+	ASSERT_STATUS(kv.migrate_to(destination, partitions), status::OK);
+	AssertSize(destination, 3);
+
+	std::string value;
+	ASSERT_STATUS(destination.get("key1", &value), status::OK);
+	UT_ASSERT(value == "value1");
+	ASSERT_STATUS(destination.get("key2", &value), status::OK);
+	UT_ASSERT(value == "value2");
+	ASSERT_STATUS(destination.get("key3", &value), status::OK);
+	UT_ASSERT(value == "value3");
+
+	CLEAR_KV(destination);
+}
+
+static void EmptyTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.migrate_to(destination, partitions), status::OK);
+	AssertSize(destination, 0);
+}
+
+static void InvalidArgumentTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put("key1", "value1"), status::OK);
+
+	ASSERT_STATUS(kv.migrate_to(destination, 0), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.migrate_to(kv, partitions), status::INVALID_ARGUMENT);
+	AssertSize(destination, 0);
+	ASSERT_SIZE(kv, 1);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 6)
+		UT_FATAL("usage: %s engine json_config destination_engine "
+			 "destination_json_config partitions",
+			 argv[0]);
+
+	ASSERT_STATUS(destination.open(argv[3], CONFIG_FROM_JSON(argv[4])), status::OK);
+	partitions = std::stoull(argv[5]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 MigrateTest,
+				 OverwriteTest,
+				 EmptyTest,
+				 InvalidArgumentTest,
+			 });
+
+	destination.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
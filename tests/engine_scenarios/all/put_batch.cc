@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <algorithm>
+
+/**
+ * Tests batched put (db::put_batch) - inserting, overwriting
+ * and invalid arguments.
+ */
+
+using namespace pmem::kv;
+
+static void EmptyBatchTest(pmem::kv::db &kv)
+{
+	std::vector<string_view> keys, values;
+	ASSERT_STATUS(kv.put_batch(keys, values), status::OK);
+	ASSERT_SIZE(kv, 0);
+}
+
+static void WrongSizesTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto key2 = entry_from_string("key2");
+	auto value1 = entry_from_string("value1");
+
+	ASSERT_STATUS(kv.put_batch({key1, key2}, {value1}), status::INVALID_ARGUMENT);
+	ASSERT_SIZE(kv, 0);
+}
+
+static void PutBatchTest(pmem::kv::db &kv, size_t n_keys)
+{
+	std::vector<std::string> keys_storage, values_storage;
+	for (size_t i = 0; i < n_keys; ++i) {
+		keys_storage.emplace_back(entry_from_number(i, "", "k"));
+		values_storage.emplace_back(entry_from_number(i, "", "v"));
+	}
+
+	std::vector<string_view> keys(keys_storage.begin(), keys_storage.end());
+	std::vector<string_view> values(values_storage.begin(), values_storage.end());
+
+	ASSERT_STATUS(kv.put_batch(keys, values), status::OK);
+	ASSERT_SIZE(kv, n_keys);
+
+	for (size_t i = 0; i < n_keys; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(keys_storage[i], &value), status::OK);
+		UT_ASSERT(value == values_storage[i]);
+	}
+
+	/* overwrite every second element */
+	std::vector<std::string> new_values_storage;
+	std::vector<string_view> new_keys;
+	for (size_t i = 0; i < n_keys; i += 2) {
+		new_keys.emplace_back(keys_storage[i]);
+		new_values_storage.emplace_back(entry_from_number(i, "", "n"));
+	}
+	std::vector<string_view> new_values(new_values_storage.begin(),
+					    new_values_storage.end());
+
+	ASSERT_STATUS(kv.put_batch(new_keys, new_values), status::OK);
+	ASSERT_SIZE(kv, n_keys);
+
+	for (size_t i = 0; i < n_keys; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(keys_storage[i], &value), status::OK);
+		if (i % 2 == 0)
+			UT_ASSERT(value == new_values_storage[i / 2]);
+		else
+			UT_ASSERT(value == values_storage[i]);
+	}
+}
+
+static void PutBatchSmallTest(pmem::kv::db &kv)
+{
+	PutBatchTest(kv, 5);
+}
+
+static void PutBatchLargeTest(pmem::kv::db &kv)
+{
+	PutBatchTest(kv, 1000);
+}
+
+/* sorted batch put into an empty database (bulk loaded by sorted engines) */
+static void PutBatchSortedTest(pmem::kv::db &kv)
+{
+	const size_t N_KEYS = 10000;
+
+	std::vector<std::string> keys_storage, values_storage;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		keys_storage.emplace_back(entry_from_number(i, "", "k"));
+		values_storage.emplace_back(entry_from_number(i, "", "v"));
+	}
+	std::sort(keys_storage.begin(), keys_storage.end());
+
+	std::vector<string_view> keys(keys_storage.begin(), keys_storage.end());
+	std::vector<string_view> values(values_storage.begin(), values_storage.end());
+
+	ASSERT_STATUS(kv.put_batch(keys, values), status::OK);
+	ASSERT_SIZE(kv, N_KEYS);
+
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(keys_storage[i], &value), status::OK);
+		UT_ASSERT(value == values_storage[i]);
+	}
+
+	/* the loaded database must still handle inserts and removals */
+	for (size_t i = 0; i < N_KEYS; i += 2) {
+		ASSERT_STATUS(kv.put(keys_storage[i] + "x", values_storage[i]),
+			      status::OK);
+		ASSERT_STATUS(kv.remove(keys_storage[i + 1]), status::OK);
+	}
+	ASSERT_SIZE(kv, N_KEYS);
+
+	for (size_t i = 0; i < N_KEYS; i += 2) {
+		std::string value;
+		ASSERT_STATUS(kv.get(keys_storage[i] + "x", &value), status::OK);
+		UT_ASSERT(value == values_storage[i]);
+		ASSERT_STATUS(kv.get(keys_storage[i], &value), status::OK);
+		ASSERT_STATUS(kv.exists(keys_storage[i + 1]), status::NOT_FOUND);
+	}
+}
+
+static void DuplicatedKeysTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto value1 = entry_from_string("value1");
+	auto value2 = entry_from_string("value2");
+
+	ASSERT_STATUS(kv.put_batch({key1, key1}, {value1, value2}), status::OK);
+	ASSERT_SIZE(kv, 1);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == value2);
+}
+
+/* big enough to be inserted in parallel by engines which support it */
+static void DuplicatedKeysLargeTest(pmem::kv::db &kv)
+{
+	const size_t N_PAIRS = 4096;
+	const size_t N_KEYS = 16;
+
+	std::vector<std::string> keys, values;
+	for (size_t i = 0; i < N_PAIRS; ++i) {
+		keys.push_back(entry_from_number(i % N_KEYS, "", "k"));
+		values.push_back(entry_from_number(i, "", "v"));
+	}
+
+	std::vector<string_view> ks(keys.begin(), keys.end());
+	std::vector<string_view> vs(values.begin(), values.end());
+	ASSERT_STATUS(kv.put_batch(ks, vs), status::OK);
+	ASSERT_SIZE(kv, N_KEYS);
+
+	for (size_t i = N_PAIRS - N_KEYS; i < N_PAIRS; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(keys[i], &value), status::OK);
+		UT_ASSERT(value == values[i]);
+	}
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 EmptyBatchTest,
+				 WrongSizesTest,
+				 PutBatchSmallTest,
+				 PutBatchLargeTest,
+				 PutBatchSortedTest,
+				 DuplicatedKeysTest,
+				 DuplicatedKeysLargeTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -122,6 +122,31 @@ static void GetNonexistentTest(pmem::kv::db &kv)
 	ASSERT_STATUS(kv.get(entry_from_string("waldo"), &value), status::NOT_FOUND);
 }
 
+static void ValueSizeTest(pmem::kv::db &kv)
+{
+	auto value1 = entry_from_string("value1");
+	auto value2 = entry_from_string("val2");
+	ASSERT_STATUS(kv.put(entry_from_string("key1"), value1), status::OK);
+
+	std::size_t size = 0;
+	ASSERT_STATUS(kv.value_size(entry_from_string("key1"), size), status::OK);
+	UT_ASSERTeq(size, value1.size());
+	ASSERT_STATUS(kv.value_size(entry_from_string("waldo"), size), status::NOT_FOUND);
+
+	/* the size follows overwrites with a different value */
+	ASSERT_STATUS(kv.put(entry_from_string("key1"), value2), status::OK);
+	ASSERT_STATUS(kv.value_size(entry_from_string("key1"), size), status::OK);
+	UT_ASSERTeq(size, value2.size());
+
+	ASSERT_STATUS(kv.remove(entry_from_string("key1")), status::OK);
+	ASSERT_STATUS(kv.value_size(entry_from_string("key1"), size), status::NOT_FOUND);
+
+	/* C API doesn't accept a null output */
+	auto key = entry_from_string("key1");
+	UT_ASSERTeq(pmemkv_get_value_size(nullptr, key.data(), key.size(), &size),
+		    PMEMKV_STATUS_INVALID_ARGUMENT);
+}
+
 static void PutTest(pmem::kv::db &kv)
 {
 	std::size_t cnt = std::numeric_limits<std::size_t>::max();
@@ -261,6 +286,30 @@ static void RemoveNonexistentTest(pmem::kv::db &kv)
 	ASSERT_STATUS(kv.exists(entry_from_string("key1")), status::OK);
 }
 
+static void TakeTest(pmem::kv::db &kv)
+{
+	auto value1 = entry_from_string("value1");
+	ASSERT_STATUS(kv.put(entry_from_string("key1"), value1), status::OK);
+	ASSERT_STATUS(kv.put(entry_from_string("key2"), entry_from_string("value2")),
+		      status::OK);
+
+	std::string value;
+	auto copy = [&](string_view v) { value.assign(v.data(), v.size()); };
+	ASSERT_STATUS(kv.take(entry_from_string("key1"), copy), status::OK);
+	UT_ASSERT(value == value1);
+	ASSERT_STATUS(kv.exists(entry_from_string("key1")), status::NOT_FOUND);
+	ASSERT_SIZE(kv, 1);
+
+	/* callback is not called for a missing record */
+	value.clear();
+	ASSERT_STATUS(kv.take(entry_from_string("key1"), copy), status::NOT_FOUND);
+	ASSERT_STATUS(kv.take(entry_from_string("nada"), copy), status::NOT_FOUND);
+	UT_ASSERT(value.empty());
+
+	ASSERT_STATUS(kv.get(entry_from_string("key2"), &value), status::OK);
+	UT_ASSERT(value == entry_from_string("value2"));
+}
+
 static void ZeroFilledStringTest(pmem::kv::db &kv)
 {
 	uint64_t z = 0;
@@ -337,12 +386,14 @@ static void test(int argc, char *argv[])
 			GetMultipleTest,
 			GetMultiple2Test,
 			GetNonexistentTest,
+			ValueSizeTest,
 			PutTest,
 			RemoveAllTest,
 			RemoveAndInsertTest,
 			RemoveExistingTest,
 			RemoveHeadlessTest,
 			RemoveNonexistentTest,
+			TakeTest,
 			ZeroFilledStringTest,
 			/* move DB test has to be the last one; it invalidates kv */
 			MoveDBTest,
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests the DRAM read cache. Database must be opened with "read_cache_size"
+ * config parameter big enough to keep all N_KEYS entries.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+
+static std::map<std::string, uint64_t> get_stats(pmem::kv::db &kv)
+{
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+
+	return stats;
+}
+
+static void HitsTest(pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+
+	auto before = get_stats(kv);
+
+	/* the first reads miss and fill the cache, the following ones hit */
+	std::string value;
+	for (size_t round = 0; round < 3; ++round) {
+		for (size_t i = 0; i < N_KEYS; ++i) {
+			ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+			UT_ASSERT(value == entry_from_number(i, "v"));
+		}
+	}
+
+	auto after = get_stats(kv);
+	UT_ASSERTeq(after["read_cache.misses"] - before["read_cache.misses"], N_KEYS);
+	UT_ASSERTeq(after["read_cache.hits"] - before["read_cache.hits"], N_KEYS * 2);
+	UT_ASSERT(after["read_cache.entries"] >= N_KEYS);
+	UT_ASSERT(after["read_cache.used_bytes"] > 0);
+
+	CLEAR_KV(kv);
+}
+
+static void WriteThroughTest(pmem::kv::db &kv)
+{
+	auto key = entry_from_string("key1");
+	std::string value;
+
+	ASSERT_STATUS(kv.put(key, entry_from_string("value1")), status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+
+	/* every write invalidates the cached entry */
+	ASSERT_STATUS(kv.put(key, entry_from_string("value2")), status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == entry_from_string("value2"));
+
+	ASSERT_STATUS(kv.update(key,
+				[&](const string_view *v, std::string &new_value) {
+					new_value = entry_from_string("value3");
+					return 0;
+				}),
+		      status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == entry_from_string("value3"));
+
+	std::vector<string_view> keys = {key};
+	std::vector<string_view> values = {entry_from_string("value4")};
+	ASSERT_STATUS(kv.put_batch(keys, values), status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == entry_from_string("value4"));
+
+	ASSERT_STATUS(kv.remove(key), status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::NOT_FOUND);
+	ASSERT_STATUS(kv.exists(key), status::NOT_FOUND);
+}
+
+static void GetBatchTest(pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+
+	/* every second key is cached */
+	std::string value;
+	for (size_t i = 0; i < N_KEYS; i += 2)
+		ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+
+	std::vector<std::string> keys_storage;
+	for (size_t i = 0; i < N_KEYS; ++i)
+		keys_storage.push_back(entry_from_number(N_KEYS - i - 1));
+	keys_storage.push_back(entry_from_string("missing"));
+
+	std::vector<string_view> keys(keys_storage.begin(), keys_storage.end());
+	std::vector<std::string> returned;
+	ASSERT_STATUS(kv.get_batch(keys,
+				   [&](string_view k, string_view v) {
+					   returned.emplace_back(k.data(), k.size());
+					   UT_ASSERT(v ==
+						     entry_from_number(std::stoull(
+							     returned.back()), "v"));
+					   return 0;
+				   }),
+		      status::NOT_FOUND);
+
+	/* callback is called in order of keys, whether they were cached or not */
+	keys_storage.pop_back();
+	UT_ASSERT(returned == keys_storage);
+
+	CLEAR_KV(kv);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 HitsTest,
+				 WriteThroughTest,
+				 GetBatchTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
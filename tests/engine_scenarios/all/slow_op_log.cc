@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests the log of slow operations (db::get_stats, db::reset_stats). Database
+ * must be opened with "slow_op_threshold_ns" config parameter set to 1, so
+ * every operation is slow.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+/* records kept by the log */
+static const size_t CAPACITY = 64;
+
+static void SlowOpLogTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i)),
+			      status::OK);
+
+	std::string value;
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+
+	UT_ASSERTeq(stats["slow_op.threshold_ns"], 1);
+	UT_ASSERTeq(stats["slow_op.count"], N_KEYS * 2);
+
+	/* only the last operations (gets) are kept */
+	size_t records = 0;
+	for (auto &s : stats) {
+		auto &name = s.first;
+		auto pos = name.find(".get.total_ns");
+		if (name.compare(0, 8, "slow_op.") != 0 || pos == std::string::npos)
+			continue;
+
+		UT_ASSERT(std::stoull(name.substr(8)) >= N_KEYS);
+		auto prefix = name.substr(0, pos + 5);
+		UT_ASSERTeq(stats[prefix + "key_size"], entry_from_number(0).size());
+		UT_ASSERT(s.second >= 1);
+		++records;
+	}
+	UT_ASSERT(records > 0 && records <= CAPACITY);
+
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+	stats.clear();
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERTeq(stats["slow_op.count"], 0);
+	for (auto &s : stats)
+		UT_ASSERT(s.first.find(".total_ns") == std::string::npos);
+
+	ASSERT_STATUS(kv.remove(entry_from_number(0)), status::OK);
+	stats.clear();
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERTeq(stats["slow_op.count"], 1);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 SlowOpLogTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * Tests saving content of the database to a snapshot file and loading it
+ * (db::snapshot_save, db::snapshot_export and db::snapshot_load).
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 1000;
+
+static std::string snapshot_path;
+
+static void SaveLoadTest(pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i, "", "k"),
+				     entry_from_number(i, "", "v")),
+			      status::OK);
+
+	/* bigger than a single block of the snapshot */
+	auto big_value = std::string(5 << 20, 'x');
+	ASSERT_STATUS(kv.put("big", big_value), status::OK);
+	ASSERT_STATUS(kv.put("empty", ""), status::OK);
+
+	ASSERT_STATUS(kv.snapshot_save(snapshot_path), status::OK);
+	CLEAR_KV(kv);
+	ASSERT_SIZE(kv, 0);
+
+	ASSERT_STATUS(kv.snapshot_load(snapshot_path), status::OK);
+	ASSERT_SIZE(kv, N_KEYS + 2);
+
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(entry_from_number(i, "", "k"), &value), status::OK);
+		UT_ASSERT(value == entry_from_number(i, "", "v"));
+	}
+
+	std::string value;
+	ASSERT_STATUS(kv.get("big", &value), status::OK);
+	UT_ASSERT(value == big_value);
+	ASSERT_STATUS(kv.get("empty", &value), status::OK);
+	UT_ASSERTeq(value.size(), 0);
+}
+
+static void LoadOverwriteTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put("key1", "value1"), status::OK);
+	ASSERT_STATUS(kv.put("key2", "value2"), status::OK);
+	ASSERT_STATUS(kv.snapshot_save(snapshot_path), status::OK);
+
+	ASSERT_STATUS(kv.put("key1", "new_value"), status::OK);
+	ASSERT_STATUS(kv.remove("key2"), status::OK);
+	ASSERT_STATUS(kv.put("key3", "value3"), status::OK);
+
+	/* elements from the snapshot overwrite existing ones, others are kept */
+	ASSERT_STATUS(kv.snapshot_load(snapshot_path), status::OK);
+	ASSERT_SIZE(kv, 3);
+
+	std::string value;
+	ASSERT_STATUS(kv.get("key1", &value), status::OK);
+	UT_ASSERT(value == "value1");
+	ASSERT_STATUS(kv.get("key2", &value), status::OK);
+	UT_ASSERT(value == "value2");
+	ASSERT_STATUS(kv.get("key3", &value), status::OK);
+	UT_ASSERT(value == "value3");
+}
+
+static void EmptyTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.snapshot_save(snapshot_path), status::OK);
+	ASSERT_STATUS(kv.snapshot_load(snapshot_path), status::OK);
+	ASSERT_SIZE(kv, 0);
+}
+
+static void CorruptedTest(pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i, "", "k"),
+				     entry_from_number(i, "", "v")),
+			      status::OK);
+	ASSERT_STATUS(kv.snapshot_save(snapshot_path), status::OK);
+	CLEAR_KV(kv);
+
+	/* modify a byte of the first block's payload (after 4KB header) */
+	{
+		std::fstream f(snapshot_path,
+			       std::ios::in | std::ios::out | std::ios::binary);
+		f.seekg(4096 + 100);
+		char c = static_cast<char>(f.get());
+		f.seekp(4096 + 100);
+		f.put(static_cast<char>(c ^ 1));
+	}
+	ASSERT_STATUS(kv.snapshot_load(snapshot_path), status::INVALID_ARGUMENT);
+	CLEAR_KV(kv);
+
+	{
+		std::ofstream f(snapshot_path, std::ios::trunc);
+		f << "not a snapshot";
+	}
+	ASSERT_STATUS(kv.snapshot_load(snapshot_path), status::INVALID_ARGUMENT);
+	ASSERT_SIZE(kv, 0);
+
+	ASSERT_STATUS(kv.snapshot_load(snapshot_path + ".nope"), status::INVALID_ARGUMENT);
+}
+
+static void ExportTest(pmem::kv::db &kv)
+{
+	/* more than a single chunk of records read by the export */
+	const size_t n_keys = 3 * N_KEYS;
+	for (size_t i = 0; i < n_keys; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i, "", "k"),
+				     entry_from_number(i, "", "v")),
+			      status::OK);
+
+	/* the file is bigger than the snapshot, it's truncated */
+	int fd = open(snapshot_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	UT_ASSERT(fd >= 0);
+	UT_ASSERTeq(ftruncate(fd, 64 << 20), 0);
+
+	ASSERT_STATUS(kv.snapshot_export(fd, 10 << 20), status::OK);
+	close(fd);
+	CLEAR_KV(kv);
+
+	ASSERT_STATUS(kv.snapshot_load(snapshot_path), status::OK);
+	ASSERT_SIZE(kv, n_keys);
+	for (size_t i = 0; i < n_keys; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(entry_from_number(i, "", "k"), &value), status::OK);
+		UT_ASSERT(value == entry_from_number(i, "", "v"));
+	}
+
+	/* only regular files can be written */
+	int fds[2];
+	UT_ASSERTeq(pipe(fds), 0);
+	ASSERT_STATUS(kv.snapshot_export(fds[1]), status::INVALID_ARGUMENT);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config snapshot_path", argv[0]);
+
+	snapshot_path = argv[3];
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 SaveLoadTest,
+				 LoadOverwriteTest,
+				 EmptyTest,
+				 CorruptedTest,
+				 ExportTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
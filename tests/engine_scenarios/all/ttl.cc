@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <chrono>
+#include <thread>
+
+/**
+ * Tests records with time to live (db::put_ttl). Database must be opened with
+ * "ttl" config flag and a short "ttl_interval_ms" (e.g. 10).
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+static const uint64_t TTL_MS = 200;
+
+static void sleep_ms(uint64_t ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+/* waits (for a few seconds at most) until expired records are removed */
+static void wait_for_count(pmem::kv::db &kv, std::size_t expected)
+{
+	std::size_t cnt = 0;
+	for (int i = 0; i < 1000; ++i) {
+		ASSERT_STATUS(kv.count_all(cnt), status::OK);
+		if (cnt == expected)
+			return;
+		sleep_ms(10);
+	}
+
+	UT_ASSERTeq(cnt, expected);
+}
+
+static void ExpireTest(pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+		ASSERT_STATUS(kv.put_ttl(entry_from_number(i, "ttl"),
+					 entry_from_number(i, "v"), TTL_MS),
+			      status::OK);
+	}
+
+	std::string value;
+	ASSERT_STATUS(kv.get(entry_from_number(0, "ttl"), &value), status::OK);
+	UT_ASSERT(value == entry_from_number(0, "v"));
+
+	sleep_ms(TTL_MS * 2);
+
+	/* expired records are hidden, whether or not they were removed yet */
+	ASSERT_STATUS(kv.get(entry_from_number(0, "ttl"), &value), status::NOT_FOUND);
+	ASSERT_STATUS(kv.exists(entry_from_number(1, "ttl")), status::NOT_FOUND);
+	ASSERT_STATUS(kv.get(entry_from_number(0), &value), status::OK);
+	UT_ASSERT(value == entry_from_number(0, "v"));
+
+	std::size_t visited = 0;
+	ASSERT_STATUS(kv.get_all([&](string_view k, string_view v) {
+		UT_ASSERT(k.compare(entry_from_number(0, "ttl")) != 0);
+		++visited;
+		return 0;
+	}),
+		      status::OK);
+	UT_ASSERTeq(visited, N_KEYS);
+
+	wait_for_count(kv, N_KEYS);
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERT(stats["ttl.expired"] >= N_KEYS);
+}
+
+static void OverwriteTest(pmem::kv::db &kv)
+{
+	/* put replaces the expiring record with a permanent one */
+	ASSERT_STATUS(kv.put_ttl("key1", "value1", TTL_MS), status::OK);
+	ASSERT_STATUS(kv.put("key1", "value2"), status::OK);
+
+	/* update keeps the expiration time */
+	ASSERT_STATUS(kv.put_ttl("key2", "value1", TTL_MS), status::OK);
+	ASSERT_STATUS(kv.update("key2",
+				[](const string_view *current, std::string &value) {
+					value = "value2";
+					return 0;
+				}),
+		      status::OK);
+
+	sleep_ms(TTL_MS * 2);
+
+	std::string value;
+	ASSERT_STATUS(kv.get("key1", &value), status::OK);
+	UT_ASSERT(value == "value2");
+	ASSERT_STATUS(kv.exists("key2"), status::NOT_FOUND);
+
+	/* an expired record is absent for put_if_absent */
+	bool inserted = false;
+	ASSERT_STATUS(kv.put_if_absent("key2", "value3", inserted), status::OK);
+	UT_ASSERT(inserted);
+	ASSERT_STATUS(kv.get("key2", &value), status::OK);
+	UT_ASSERT(value == "value3");
+
+	sleep_ms(TTL_MS * 2);
+	ASSERT_STATUS(kv.get("key2", &value), status::OK);
+}
+
+static void InvalidTTLTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put_ttl("key1", "value1", 0), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.exists("key1"), status::NOT_FOUND);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 ExpireTest,
+				 OverwriteTest,
+				 InvalidTTLTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
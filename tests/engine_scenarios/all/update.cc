@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests read-modify-write of a single record (db::update,
+ * db::compare_exchange, db::fetch_add and db::put_if_absent).
+ */
+
+using namespace pmem::kv;
+
+static int append_x(const string_view *value, std::string &new_value)
+{
+	new_value = value ? std::string(value->data(), value->size()) + "x" : "x";
+	return 0;
+}
+
+static void UpdateTest(pmem::kv::db &kv)
+{
+	auto key = entry_from_string("key1");
+
+	/* record is created if it doesn't exist */
+	ASSERT_STATUS(kv.update(key, append_x), status::OK);
+	ASSERT_SIZE(kv, 1);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == "x");
+
+	ASSERT_STATUS(kv.update(key, append_x), status::OK);
+	ASSERT_STATUS(kv.update(key, append_x), status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == "xxx");
+
+	auto long_value = std::string(10000, 'y');
+	ASSERT_STATUS(kv.update(key,
+				[&](const string_view *v, std::string &new_value) {
+					UT_ASSERT(v != nullptr);
+					UT_ASSERT(*v == "xxx");
+					new_value = long_value;
+					return 0;
+				}),
+		      status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == long_value);
+
+	ASSERT_STATUS(kv.update(key,
+				[&](const string_view *, std::string &new_value) {
+					new_value.clear();
+					return 0;
+				}),
+		      status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERTeq(value.size(), 0);
+	ASSERT_SIZE(kv, 1);
+}
+
+static void StoppedByCallbackTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto key2 = entry_from_string("key2");
+	auto value1 = entry_from_string("value1");
+
+	ASSERT_STATUS(kv.put(key1, value1), status::OK);
+
+	auto stop = [](const string_view *, std::string &new_value) {
+		new_value = "new";
+		return 1;
+	};
+
+	/* neither existing record is modified nor a new one created */
+	ASSERT_STATUS(kv.update(key1, stop), status::STOPPED_BY_CB);
+	ASSERT_STATUS(kv.update(key2, stop), status::STOPPED_BY_CB);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == value1);
+	ASSERT_STATUS(kv.exists(key2), status::NOT_FOUND);
+	ASSERT_SIZE(kv, 1);
+}
+
+static void CApiTest(pmem::kv::db &kv)
+{
+	auto key = entry_from_string("key1");
+	std::string buffer = entry_from_string("value1");
+
+	auto set_buffer = [](const char *v, size_t vb, const char **new_value,
+			     size_t *new_valuebytes, void *arg) {
+		UT_ASSERT(v == nullptr);
+		UT_ASSERTeq(vb, 0);
+		auto buf = static_cast<std::string *>(arg);
+		*new_value = buf->data();
+		*new_valuebytes = buf->size();
+		return 0;
+	};
+
+	ASSERT_STATUS(kv.update(key, set_buffer, &buffer), status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == buffer);
+}
+
+static void CompareExchangeTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto key2 = entry_from_string("key2");
+	auto value1 = entry_from_string("value1");
+	auto value2 = entry_from_string("value2");
+
+	/* record is not created */
+	ASSERT_STATUS(kv.compare_exchange(key1, value1, value2), status::NOT_FOUND);
+	ASSERT_STATUS(kv.exists(key1), status::NOT_FOUND);
+
+	ASSERT_STATUS(kv.put(key1, value1), status::OK);
+	ASSERT_STATUS(kv.put(key2, value1), status::OK);
+
+	ASSERT_STATUS(kv.compare_exchange(key1, value2, "new"), status::VALUE_MISMATCH);
+	ASSERT_STATUS(kv.compare_exchange(key1, "", "new"), status::VALUE_MISMATCH);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == value1);
+
+	ASSERT_STATUS(kv.compare_exchange(key1, value1, value2), status::OK);
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == value2);
+
+	/* value can be swapped to an empty one and back */
+	ASSERT_STATUS(kv.compare_exchange(key1, value2, ""), status::OK);
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERTeq(value.size(), 0);
+	ASSERT_STATUS(kv.compare_exchange(key1, "", value1), status::OK);
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == value1);
+
+	/* other records are not modified */
+	ASSERT_STATUS(kv.get(key2, &value), status::OK);
+	UT_ASSERT(value == value1);
+	ASSERT_SIZE(kv, 2);
+}
+
+static std::string uint64_value(uint64_t n)
+{
+	return std::string(reinterpret_cast<const char *>(&n), sizeof(n));
+}
+
+static void FetchAddTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("counter");
+	auto key2 = entry_from_string("key2");
+
+	/* record is created with delta as its value */
+	uint64_t old_value = 1;
+	ASSERT_STATUS(kv.fetch_add(key1, 5, old_value), status::OK);
+	UT_ASSERTeq(old_value, 0);
+
+	ASSERT_STATUS(kv.fetch_add(key1, 3, old_value), status::OK);
+	UT_ASSERTeq(old_value, 5);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == uint64_value(8));
+
+	/* values put by put() are added to, the addition wraps around */
+	ASSERT_STATUS(kv.put(key1, uint64_value(UINT64_MAX)), status::OK);
+	ASSERT_STATUS(kv.fetch_add(key1, 2, old_value), status::OK);
+	UT_ASSERTeq(old_value, UINT64_MAX);
+	ASSERT_STATUS(kv.fetch_add(key1, 0, old_value), status::OK);
+	UT_ASSERTeq(old_value, 1);
+
+	/* values of other sizes are not modified */
+	ASSERT_STATUS(kv.put(key2, "abc"), status::OK);
+	ASSERT_STATUS(kv.fetch_add(key2, 1, old_value), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.get(key2, &value), status::OK);
+	UT_ASSERT(value == "abc");
+	ASSERT_SIZE(kv, 2);
+}
+
+static void PutIfAbsentTest(pmem::kv::db &kv)
+{
+	auto key1 = entry_from_string("key1");
+	auto key2 = entry_from_string("key2");
+	auto value1 = entry_from_string("value1");
+	auto value2 = entry_from_string("value2");
+
+	bool inserted = false;
+	ASSERT_STATUS(kv.put_if_absent(key1, value1, inserted), status::OK);
+	UT_ASSERT(inserted);
+
+	/* existing record is not overwritten */
+	ASSERT_STATUS(kv.put_if_absent(key1, value2, inserted), status::OK);
+	UT_ASSERT(!inserted);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == value1);
+
+	/* not even by an empty value, which can be inserted as well */
+	ASSERT_STATUS(kv.put_if_absent(key1, "", inserted), status::OK);
+	UT_ASSERT(!inserted);
+	ASSERT_STATUS(kv.put_if_absent(key2, "", inserted), status::OK);
+	UT_ASSERT(inserted);
+	ASSERT_STATUS(kv.get(key2, &value), status::OK);
+	UT_ASSERTeq(value.size(), 0);
+
+	ASSERT_STATUS(kv.remove(key1), status::OK);
+	ASSERT_STATUS(kv.put_if_absent(key1, value2, inserted), status::OK);
+	UT_ASSERT(inserted);
+	ASSERT_STATUS(kv.get(key1, &value), status::OK);
+	UT_ASSERT(value == value2);
+	ASSERT_SIZE(kv, 2);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 UpdateTest,
+				 StoppedByCallbackTest,
+				 CApiTest,
+				 CompareExchangeTest,
+				 FetchAddTest,
+				 PutIfAbsentTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests partial reads and writes of values (db::read_value, db::write_value
+ * and db::append_value).
+ */
+
+using namespace pmem::kv;
+
+static std::string read_value(pmem::kv::db &kv, const std::string &key, size_t pos,
+			      size_t n)
+{
+	std::string value;
+	auto s = kv.read_value(key, pos, n, [&](string_view part) {
+		UT_ASSERT(part.size() > 0);
+		value.append(part.data(), part.size());
+	});
+	ASSERT_STATUS(s, status::OK);
+
+	return value;
+}
+
+static void NotFoundTest(pmem::kv::db &kv)
+{
+	auto key = entry_from_string("key1");
+
+	auto s = kv.read_value(key, 0, 1, [&](string_view) { UT_ASSERT(0); });
+	ASSERT_STATUS(s, status::NOT_FOUND);
+	ASSERT_STATUS(kv.write_value(key, 0, "abc"), status::NOT_FOUND);
+	ASSERT_STATUS(kv.exists(key), status::NOT_FOUND);
+}
+
+static void AppendTest(pmem::kv::db &kv)
+{
+	auto key = entry_from_string("key1");
+	std::string expected;
+
+	/* the record is created by the first append */
+	for (size_t i = 0; i < 100; ++i) {
+		auto part = std::string(i % 10 + 1, char('a' + i % 26));
+		ASSERT_STATUS(kv.append_value(key, part), status::OK);
+		expected += part;
+	}
+
+	std::string value;
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == expected);
+	UT_ASSERT(read_value(kv, key, 0, expected.size()) == expected);
+
+	ASSERT_STATUS(kv.append_value(key, ""), status::OK);
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERT(value == expected);
+
+	ASSERT_STATUS(kv.remove(key), status::OK);
+	ASSERT_STATUS(kv.exists(key), status::NOT_FOUND);
+}
+
+static void ReadWriteTest(pmem::kv::db &kv)
+{
+	auto key = entry_from_string("key1");
+	std::string expected;
+	for (size_t i = 0; i < 1000; ++i)
+		expected += char('a' + i % 26);
+
+	ASSERT_STATUS(kv.put(key, expected), status::OK);
+
+	/* ranges are truncated to the end of the value */
+	for (size_t pos : std::vector<size_t>{0, 1, 15, 16, 17, 500, 999, 1000}) {
+		for (size_t n : std::vector<size_t>{0, 1, 16, 100, 2000}) {
+			auto part = read_value(kv, key, pos, n);
+			UT_ASSERT(part == expected.substr(pos, n));
+		}
+	}
+
+	auto s = kv.read_value(key, 1001, 1, [&](string_view) { UT_ASSERT(0); });
+	ASSERT_STATUS(s, status::INVALID_ARGUMENT);
+
+	/* writes in the middle, at the end and past the end of the value */
+	for (size_t pos : std::vector<size_t>{0, 7, 16, 100, 990, 1000}) {
+		auto data = std::string(20, char('A' + pos % 26));
+		ASSERT_STATUS(kv.write_value(key, pos, data), status::OK);
+		expected.replace(pos, data.size(), data);
+
+		std::string value;
+		ASSERT_STATUS(kv.get(key, &value), status::OK);
+		UT_ASSERT(value == expected);
+	}
+
+	ASSERT_STATUS(kv.write_value(key, expected.size() + 1, "x"),
+		      status::INVALID_ARGUMENT);
+
+	/* put replaces the whole value */
+	ASSERT_STATUS(kv.put(key, "short"), status::OK);
+	UT_ASSERT(read_value(kv, key, 0, 100) == "short");
+	ASSERT_STATUS(kv.write_value(key, 5, "er"), status::OK);
+	UT_ASSERT(read_value(kv, key, 0, 100) == "shorter");
+
+	ASSERT_STATUS(kv.remove(key), status::OK);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 NotFoundTest,
+				 AppendTest,
+				 ReadWriteTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
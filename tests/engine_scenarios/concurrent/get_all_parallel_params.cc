@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <atomic>
+#include <map>
+
+/**
+ * Tests parallel scans (db::get_all_parallel) - every element must be visited
+ * exactly once, in one of the partitions. For sorted engines (if_sorted
+ * parameter) partitions must be ranges of keys, visited in order.
+ */
+
+using namespace pmem::kv;
+
+static void insert_items(pmem::kv::db &kv, const size_t items)
+{
+	for (size_t i = 0; i < items; i++)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "", "!")),
+			      status::OK);
+}
+
+static void GetAllParallelTest(const size_t partitions, const size_t items,
+			       pmem::kv::db &kv)
+{
+	insert_items(kv, items);
+
+	/* each partition stores visited elements in its own map */
+	std::vector<std::map<std::string, std::string>> visited(partitions);
+	std::vector<std::function<get_kv_function>> fs;
+	for (size_t i = 0; i < partitions; i++)
+		fs.emplace_back([&, i](string_view k, string_view v) {
+			auto res = visited[i].emplace(std::string(k.data(), k.size()),
+						      std::string(v.data(), v.size()));
+			UT_ASSERT(res.second);
+			return 0;
+		});
+
+	ASSERT_STATUS(kv.get_all_parallel(fs), status::OK);
+
+	std::map<std::string, std::string> all;
+	for (auto &m : visited) {
+		for (auto &e : m)
+			UT_ASSERT(all.emplace(e.first, e.second).second);
+	}
+
+	UT_ASSERTeq(all.size(), items);
+	for (size_t i = 0; i < items; i++)
+		UT_ASSERT(all[entry_from_number(i)] == entry_from_number(i, "", "!"));
+}
+
+static void GetAllParallelSortedTest(const size_t partitions, const size_t items,
+				     pmem::kv::db &kv)
+{
+	insert_items(kv, items);
+
+	std::vector<std::vector<std::string>> visited(partitions);
+	std::vector<std::function<get_kv_function>> fs;
+	for (size_t i = 0; i < partitions; i++)
+		fs.emplace_back([&, i](string_view k, string_view v) {
+			visited[i].emplace_back(k.data(), k.size());
+			return 0;
+		});
+
+	ASSERT_STATUS(kv.get_all_parallel(fs), status::OK);
+
+	/* partitions taken in order of their indexes give all keys sorted */
+	std::vector<std::string> all;
+	for (auto &keys : visited)
+		all.insert(all.end(), keys.begin(), keys.end());
+
+	UT_ASSERTeq(all.size(), items);
+	for (size_t i = 1; i < all.size(); i++)
+		UT_ASSERT(all[i - 1] < all[i]);
+}
+
+static void GetAllParallelStopTest(const size_t partitions, const size_t items,
+				   pmem::kv::db &kv)
+{
+	insert_items(kv, items);
+
+	std::atomic<size_t> visited(0);
+	auto s = kv.get_all_parallel(
+		partitions,
+		[](const char *, size_t, const char *, size_t, void *arg) {
+			++*static_cast<std::atomic<size_t> *>(arg);
+			return 1;
+		},
+		std::vector<void *>(partitions, &visited).data());
+
+	ASSERT_STATUS(s, status::STOPPED_BY_CB);
+	UT_ASSERT(visited.load() >= 1);
+	UT_ASSERT(visited.load() <= partitions);
+}
+
+static void GetAllParallelInvalidTest(pmem::kv::db &kv)
+{
+	auto s = kv.get_all_parallel(
+		0, [](const char *, size_t, const char *, size_t, void *) { return 0; },
+		nullptr);
+	ASSERT_STATUS(s, status::INVALID_ARGUMENT);
+}
+
+static void test(int argc, char *argv[])
+{
+	using namespace std::placeholders;
+
+	if (argc < 5)
+		UT_FATAL("usage: %s engine json_config partitions items [if_sorted]",
+			 argv[0]);
+
+	size_t partitions = std::stoull(argv[3]);
+	size_t items = std::stoull(argv[4]);
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 std::bind(GetAllParallelTest, partitions, items, _1),
+				 std::bind(GetAllParallelStopTest, partitions, items, _1),
+				 GetAllParallelInvalidTest,
+			 });
+
+	if (argc > 5 && std::string(argv[5]).compare("true") == 0)
+		run_engine_tests(argv[1], argv[2],
+				 {
+					 std::bind(GetAllParallelSortedTest, partitions,
+						   items, _1),
+				 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
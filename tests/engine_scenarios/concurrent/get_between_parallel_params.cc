@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+/**
+ * Tests parallel range scans (db::get_between_parallel) of sorted engines -
+ * every element from the range must be visited exactly once and partitions
+ * must be ranges of keys, visited in order.
+ */
+
+using namespace pmem::kv;
+
+static std::vector<std::string> insert_items(pmem::kv::db &kv, const size_t items)
+{
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < items; i++) {
+		keys.push_back(entry_from_number(i));
+		ASSERT_STATUS(kv.put(keys.back(), entry_from_number(i, "", "!")),
+			      status::OK);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	return keys;
+}
+
+static std::vector<std::string> scan(pmem::kv::db &kv, const size_t partitions,
+				     const std::string &key1, const std::string &key2)
+{
+	std::vector<std::vector<std::string>> visited(partitions);
+	std::vector<std::function<get_kv_function>> fs;
+	for (size_t i = 0; i < partitions; i++)
+		fs.emplace_back([&, i](string_view k, string_view v) {
+			visited[i].emplace_back(k.data(), k.size());
+			return 0;
+		});
+
+	ASSERT_STATUS(kv.get_between_parallel(key1, key2, fs), status::OK);
+
+	/* partitions taken in order of their indexes give all keys sorted */
+	std::vector<std::string> all;
+	for (auto &keys : visited)
+		all.insert(all.end(), keys.begin(), keys.end());
+
+	return all;
+}
+
+static void GetBetweenParallelTest(const size_t partitions, const size_t items,
+				   pmem::kv::db &kv)
+{
+	auto keys = insert_items(kv, items);
+
+	auto &key1 = keys[items / 4];
+	auto &key2 = keys[items - items / 4 - 1];
+	std::vector<std::string> expected(keys.begin() + items / 4 + 1,
+					  keys.end() - items / 4 - 1);
+	UT_ASSERT(scan(kv, partitions, key1, key2) == expected);
+
+	/* bounds don't have to be stored keys */
+	UT_ASSERT(scan(kv, partitions, "", keys.back() + "!") == keys);
+	UT_ASSERT(scan(kv, partitions, key1 + "!", key2) == expected);
+
+	/* empty ranges */
+	UT_ASSERT(scan(kv, partitions, key1, key1).empty());
+	UT_ASSERT(scan(kv, partitions, key2, key1).empty());
+}
+
+static void GetBetweenParallelStopTest(const size_t partitions, const size_t items,
+				       pmem::kv::db &kv)
+{
+	auto keys = insert_items(kv, items);
+
+	std::atomic<size_t> visited(0);
+	auto s = kv.get_between_parallel(
+		keys.front(), keys.back(), partitions,
+		[](const char *, size_t, const char *, size_t, void *arg) {
+			++*static_cast<std::atomic<size_t> *>(arg);
+			return 1;
+		},
+		std::vector<void *>(partitions, &visited).data());
+
+	ASSERT_STATUS(s, status::STOPPED_BY_CB);
+	UT_ASSERT(visited.load() >= 1);
+	UT_ASSERT(visited.load() <= partitions);
+}
+
+static void GetBetweenParallelInvalidTest(pmem::kv::db &kv)
+{
+	auto s = kv.get_between_parallel(
+		"a", "b", 0,
+		[](const char *, size_t, const char *, size_t, void *) { return 0; },
+		nullptr);
+	ASSERT_STATUS(s, status::INVALID_ARGUMENT);
+}
+
+static void test(int argc, char *argv[])
+{
+	using namespace std::placeholders;
+
+	if (argc < 5)
+		UT_FATAL("usage: %s engine json_config partitions items", argv[0]);
+
+	size_t partitions = std::stoull(argv[3]);
+	size_t items = std::stoull(argv[4]);
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 std::bind(GetBetweenParallelTest, partitions, items, _1),
+				 std::bind(GetBetweenParallelStopTest, partitions, items,
+					   _1),
+				 GetBetweenParallelInvalidTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
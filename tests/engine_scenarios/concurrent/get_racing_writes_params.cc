@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <atomic>
+
+/**
+ * Tests gets of keys, while other threads put, update and remove them and
+ * one thread defragments the pool - every value read is a whole value put
+ * to that key and no reader sees an older value of a writer after a newer
+ * one. Keys and values are of various lengths, so that some of them are
+ * stored in separate allocations (of engines which store short ones inline).
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 8;
+
+static std::string key_of(size_t k)
+{
+	if (k % 2)
+		return entry_from_number(k, "racy_");
+
+	return entry_from_number(k, std::string(32, 'x') + "_");
+}
+
+static std::string value_of(size_t k, size_t writer, size_t seq)
+{
+	auto value = std::to_string(k) + ":" + std::to_string(writer) + ":" +
+		std::to_string(seq) + ":";
+	value.append((seq * 13) % 100, static_cast<char>('a' + (writer + seq) % 26));
+
+	return value;
+}
+
+/* checks the value of the key and returns its writer and sequence number */
+static void verify(string_view v, size_t k, size_t &writer, size_t &seq)
+{
+	std::string value(v.data(), v.size());
+	auto first = value.find(':');
+	auto second = value.find(':', first + 1);
+	auto third = value.find(':', second + 1);
+	UT_ASSERT(first != std::string::npos && second != std::string::npos &&
+		  third != std::string::npos);
+
+	UT_ASSERTeq(std::stoull(value.substr(0, first)), k);
+	writer = std::stoull(value.substr(first + 1, second - first - 1));
+	seq = std::stoull(value.substr(second + 1, third - second - 1));
+	UT_ASSERT(value == value_of(k, writer, seq));
+}
+
+static void ConcurrentGetAndWritesTest(const size_t threads_number,
+				       const size_t thread_items, pmem::kv::db &kv)
+{
+	UT_ASSERT(threads_number >= 3);
+
+	/* thread 0 defragments, other even threads write, odd ones read */
+	size_t writers = (threads_number - 1) / 2;
+	std::atomic<size_t> writers_done(0);
+
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		if (thread_id == 0) {
+			while (writers_done.load() < writers) {
+				auto s = kv.defrag(0, 100);
+				UT_ASSERT(s == status::OK || s == status::NOT_SUPPORTED);
+			}
+			return;
+		}
+
+		if (thread_id % 2 == 0) {
+			for (size_t i = 0; i < thread_items; i++) {
+				auto k = (i + thread_id) % N_KEYS;
+				auto value = value_of(k, thread_id, i);
+
+				if (i % 4 == 2) {
+					auto s = kv.remove(key_of(k));
+					UT_ASSERT(s == status::OK || s == status::NOT_FOUND);
+				} else if (i % 4 == 3) {
+					ASSERT_STATUS(kv.update(key_of(k),
+								[&](const string_view *,
+								    std::string &new_value) {
+									new_value = value;
+									return 0;
+								}),
+						      status::OK);
+				} else {
+					ASSERT_STATUS(kv.put(key_of(k), value), status::OK);
+				}
+			}
+			writers_done++;
+			return;
+		}
+
+		std::vector<std::vector<size_t>> seen(threads_number,
+						      std::vector<size_t>(N_KEYS, 0));
+		while (writers_done.load() < writers) {
+			for (size_t k = 0; k < N_KEYS; k++) {
+				auto s = kv.get(key_of(k), [&](string_view v) {
+					size_t writer, seq;
+					verify(v, k, writer, seq);
+					UT_ASSERT(writer < threads_number && writer % 2 == 0);
+					UT_ASSERT(seen[writer][k] <= seq);
+					seen[writer][k] = seq;
+				});
+				UT_ASSERT(s == status::OK || s == status::NOT_FOUND);
+			}
+		}
+	});
+
+	for (size_t k = 0; k < N_KEYS; k++) {
+		size_t writer, seq;
+		auto s = kv.get(key_of(k), [&](string_view v) { verify(v, k, writer, seq); });
+		UT_ASSERT(s == status::OK || s == status::NOT_FOUND);
+	}
+}
+
+static void test(int argc, char *argv[])
+{
+	using namespace std::placeholders;
+
+	if (argc < 5)
+		UT_FATAL("usage: %s engine json_config threads items", argv[0]);
+
+	size_t threads_number = std::stoull(argv[3]);
+	size_t thread_items = std::stoull(argv[4]);
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 std::bind(ConcurrentGetAndWritesTest, threads_number,
+					   thread_items, _1),
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/**
+ * Tests snapshot reads (csmap with "snapshot_reads") - read iterators see
+ * the database as of their last seek and get_* as of the start of the call,
+ * regardless of concurrent writes.
+ */
+
+#include "../iterator.hpp"
+
+#include <vector>
+
+static const size_t N_KEYS = 100;
+
+static std::vector<pair> insert_n_keys(pmem::kv::db &kv)
+{
+	std::vector<pair> expected;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		auto k = entry_from_number(i * 2, "", "k");
+		auto v = entry_from_number(i * 2, "", "v");
+		ASSERT_STATUS(kv.put(k, v), pmem::kv::status::OK);
+		expected.emplace_back(k, v);
+	}
+
+	return expected;
+}
+
+static std::vector<pair> scan(iterator<true> &it)
+{
+	std::vector<pair> visited;
+	do {
+		auto key = it.key();
+		auto value = it.read_range();
+		UT_ASSERT(key.is_ok() && value.is_ok());
+		visited.emplace_back(
+			std::string(key.get_value().data(), key.get_value().size()),
+			std::string(value.get_value().begin(), value.get_value().end()));
+	} while (it.next() == pmem::kv::status::OK);
+
+	return visited;
+}
+
+static std::vector<pair> get_all(pmem::kv::db &kv)
+{
+	std::vector<pair> all;
+	kv.get_all([&](pmem::kv::string_view k, pmem::kv::string_view v) {
+		all.emplace_back(std::string(k.data(), k.size()),
+				 std::string(v.data(), v.size()));
+		return 0;
+	});
+
+	return all;
+}
+
+/* changes all records: every second one is updated, the rest are removed, and
+ * new keys are inserted between them */
+static void change_all(pmem::kv::db &kv, const std::vector<pair> &records)
+{
+	for (size_t i = 0; i < records.size(); ++i) {
+		auto &key = records[i].first;
+		if (i % 2)
+			ASSERT_STATUS(kv.put(key, "changed"), pmem::kv::status::OK);
+		else
+			ASSERT_STATUS(kv.remove(key), pmem::kv::status::OK);
+		ASSERT_STATUS(kv.put(key + "_new", "new"), pmem::kv::status::OK);
+	}
+}
+
+static void iterator_snapshot_test(pmem::kv::db &kv)
+{
+	auto expected = insert_n_keys(kv);
+
+	auto it = new_iterator<true>(kv);
+	ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::OK);
+
+	/* the current record is not locked, it can be changed as well */
+	change_all(kv, expected);
+	UT_ASSERT(scan(it) == expected);
+
+	/* the next seek takes a new snapshot */
+	ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::OK);
+	UT_ASSERT(scan(it) == get_all(kv));
+	ASSERT_STATUS(it.seek(expected.front().first), pmem::kv::status::NOT_FOUND);
+}
+
+static void get_all_snapshot_test(pmem::kv::db &kv)
+{
+	auto expected = insert_n_keys(kv);
+
+	std::vector<pair> visited;
+	auto s = kv.get_all([&](pmem::kv::string_view k, pmem::kv::string_view v) {
+		if (visited.empty())
+			change_all(kv, expected);
+		visited.emplace_back(std::string(k.data(), k.size()),
+				     std::string(v.data(), v.size()));
+		return 0;
+	});
+	ASSERT_STATUS(s, pmem::kv::status::OK);
+	UT_ASSERT(visited == expected);
+
+	ASSERT_SIZE(kv, N_KEYS + N_KEYS / 2);
+}
+
+/*
+ * Writers move amounts between records in transactions, readers check that
+ * the sum of all records is the same in every scan.
+ */
+static void concurrent_transfer_test(size_t threads_number, pmem::kv::db &kv)
+{
+	const size_t n = 50;
+	const size_t transfers = 200;
+	const int initial = 1000;
+
+	for (size_t i = 0; i < n; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), std::to_string(initial)),
+			      pmem::kv::status::OK);
+
+	parallel_exec(threads_number * 2, [&](size_t thread_id) {
+		if (thread_id % 2) {
+			for (size_t i = 0; i < transfers; ++i) {
+				auto it = new_iterator<true>(kv);
+				ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::OK);
+
+				long sum = 0;
+				for (auto &p : scan(it))
+					sum += std::stol(p.second);
+				UT_ASSERTeq(sum, static_cast<long>(n) * initial);
+			}
+			return;
+		}
+
+		for (size_t i = 0; i < transfers; ++i) {
+			auto from = entry_from_number((thread_id + i) % n);
+			auto to = entry_from_number((thread_id + i * 7 + 1) % n);
+			if (from == to)
+				continue;
+
+			pmem::kv::status s;
+			do {
+				auto tx = kv.tx_begin().get_value();
+				std::string a, b;
+				ASSERT_STATUS(tx.get(from, &a), pmem::kv::status::OK);
+				ASSERT_STATUS(tx.get(to, &b), pmem::kv::status::OK);
+				tx.put(from, std::to_string(std::stol(a) - 1));
+				tx.put(to, std::to_string(std::stol(b) + 1));
+				s = tx.commit();
+			} while (s == pmem::kv::status::TRANSACTION_CONFLICT);
+			ASSERT_STATUS(s, pmem::kv::status::OK);
+		}
+	});
+}
+
+static void test(int argc, char *argv[])
+{
+	using namespace std::placeholders;
+
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config threads", argv[0]);
+
+	size_t threads_number = std::stoull(argv[3]);
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 iterator_snapshot_test,
+				 get_all_snapshot_test,
+				 std::bind(concurrent_transfer_test, threads_number, _1),
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
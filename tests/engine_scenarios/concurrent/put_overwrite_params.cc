@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <cstdint>
+
+/**
+ * Tests puts of the same keys by many threads at once, while other threads
+ * read them - a reader never sees an older value of a writer after a newer
+ * one and every key ends with the last value put by one of the writers.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 8;
+
+static std::string key_of(size_t k)
+{
+	return entry_from_number(k, "hot_");
+}
+
+static std::string value_of(size_t writer, size_t seq)
+{
+	return std::to_string(writer) + "_" + std::to_string(seq);
+}
+
+/* splits the value into the writer and its sequence number */
+static void parse(string_view v, size_t &writer, size_t &seq)
+{
+	std::string value(v.data(), v.size());
+	auto sep = value.find('_');
+	UT_ASSERT(sep != std::string::npos);
+
+	writer = std::stoull(value.substr(0, sep));
+	seq = std::stoull(value.substr(sep + 1));
+}
+
+static void ConcurrentOverwriteTest(const size_t threads_number,
+				    const size_t thread_items, pmem::kv::db &kv)
+{
+	UT_ASSERT(threads_number >= 2);
+
+	/* sequence number of the last put of every writer to every key */
+	std::vector<std::vector<size_t>> last(threads_number,
+					      std::vector<size_t>(N_KEYS, SIZE_MAX));
+
+	/* even threads put, odd ones read */
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		if (thread_id % 2 == 0) {
+			for (size_t i = 0; i < thread_items; i++) {
+				auto k = (i + thread_id) % N_KEYS;
+				ASSERT_STATUS(kv.put(key_of(k), value_of(thread_id, i)),
+					      status::OK);
+				last[thread_id][k] = i;
+			}
+			return;
+		}
+
+		std::vector<std::vector<size_t>> seen(threads_number,
+						      std::vector<size_t>(N_KEYS, 0));
+		for (size_t i = 0; i < thread_items; i++) {
+			for (size_t k = 0; k < N_KEYS; k++) {
+				auto s = kv.get(key_of(k), [&](string_view v) {
+					size_t writer, seq;
+					parse(v, writer, seq);
+					UT_ASSERT(writer < threads_number && writer % 2 == 0);
+					UT_ASSERT(seq < thread_items);
+					/* the writer put this sequence number to this key */
+					UT_ASSERTeq((seq + writer) % N_KEYS, k);
+					UT_ASSERT(seen[writer][k] <= seq);
+					seen[writer][k] = seq;
+				});
+				UT_ASSERT(s == status::OK || s == status::NOT_FOUND);
+			}
+		}
+	});
+
+	for (size_t k = 0; k < N_KEYS; k++) {
+		std::string value;
+		auto s = kv.get(key_of(k), &value);
+
+		bool written = false;
+		for (size_t w = 0; w < threads_number; w += 2)
+			written = written || last[w][k] != SIZE_MAX;
+		if (!written) {
+			ASSERT_STATUS(s, status::NOT_FOUND);
+			continue;
+		}
+
+		ASSERT_STATUS(s, status::OK);
+		size_t writer, seq;
+		parse(value, writer, seq);
+		UT_ASSERTeq(seq, last[writer][k]);
+	}
+}
+
+static void test(int argc, char *argv[])
+{
+	using namespace std::placeholders;
+
+	if (argc < 5)
+		UT_FATAL("usage: %s engine json_config threads items", argv[0]);
+
+	size_t threads_number = std::stoull(argv[3]);
+	size_t thread_items = std::stoull(argv[4]);
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 std::bind(ConcurrentOverwriteTest, threads_number,
+					   thread_items, _1),
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
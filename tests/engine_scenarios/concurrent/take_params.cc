@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <atomic>
+
+/**
+ * Tests take of keys, while other threads put them - every value put is
+ * taken at most once, in order of puts, and no value is lost by a take
+ * which removes a record put after the value it returned.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 4;
+
+static std::string key_of(size_t pair, size_t k)
+{
+	return entry_from_number(k, "pair" + std::to_string(pair) + "_");
+}
+
+static void ConcurrentPutAndTakeTest(const size_t threads_number,
+				     const size_t thread_items, pmem::kv::db &kv)
+{
+	UT_ASSERT(threads_number >= 2);
+
+	/* sequence number of the last value put to every key of every pair */
+	size_t pairs = threads_number / 2;
+	std::vector<std::vector<std::atomic<size_t>>> last_put(pairs);
+	std::vector<std::atomic<bool>> done(pairs);
+	for (size_t p = 0; p < pairs; p++) {
+		last_put[p] = std::vector<std::atomic<size_t>>(N_KEYS);
+		for (auto &l : last_put[p])
+			l.store(0);
+		done[p].store(false);
+	}
+
+	/* even threads of every pair put, odd ones take the same keys */
+	parallel_exec(pairs * 2, [&](size_t thread_id) {
+		auto pair = thread_id / 2;
+
+		if (thread_id % 2 == 0) {
+			for (size_t i = 1; i <= thread_items; i++) {
+				auto k = i % N_KEYS;
+				ASSERT_STATUS(kv.put(key_of(pair, k), std::to_string(i)),
+					      status::OK);
+				last_put[pair][k].store(i, std::memory_order_release);
+			}
+			done[pair].store(true, std::memory_order_release);
+			return;
+		}
+
+		std::vector<size_t> max_taken(N_KEYS, 0);
+		auto take_all = [&] {
+			for (size_t k = 0; k < N_KEYS; k++) {
+				auto put = last_put[pair][k].load(std::memory_order_acquire);
+				size_t taken = 0;
+				auto s = kv.take(key_of(pair, k), [&](string_view v) {
+					taken = std::stoull(std::string(v.data(), v.size()));
+				});
+
+				if (s == status::NOT_FOUND) {
+					/* the last value put before was already taken */
+					UT_ASSERT(max_taken[k] >= put);
+					continue;
+				}
+
+				ASSERT_STATUS(s, status::OK);
+				UT_ASSERT(taken > max_taken[k]);
+				UT_ASSERTeq(taken % N_KEYS, k);
+				UT_ASSERT(taken >= put || max_taken[k] >= put);
+				max_taken[k] = taken;
+			}
+		};
+
+		while (!done[pair].load(std::memory_order_acquire))
+			take_all();
+		take_all();
+
+		/* the last value of every key was taken */
+		for (size_t k = 0; k < N_KEYS; k++)
+			UT_ASSERTeq(max_taken[k], last_put[pair][k].load());
+	});
+
+	ASSERT_SIZE(kv, 0);
+}
+
+static void test(int argc, char *argv[])
+{
+	using namespace std::placeholders;
+
+	if (argc < 5)
+		UT_FATAL("usage: %s engine json_config threads items", argv[0]);
+
+	size_t threads_number = std::stoull(argv[3]);
+	size_t thread_items = std::stoull(argv[4]);
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 std::bind(ConcurrentPutAndTakeTest, threads_number,
+					   thread_items, _1),
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
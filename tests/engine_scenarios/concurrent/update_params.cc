@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <atomic>
+
+/**
+ * Tests concurrent read-modify-write (db::update, db::compare_exchange,
+ * db::fetch_add, db::put_if_absent and db::take) - increments of counters by
+ * multiple threads must not be lost, every record is inserted (and taken)
+ * by exactly one thread and put_if_absent never overwrites a concurrent put.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_COUNTERS = 8;
+
+static std::string counter_key(size_t i)
+{
+	return entry_from_number(i, "cnt_");
+}
+
+static void ConcurrentIncrementTest(const size_t threads_number,
+				    const size_t thread_items, pmem::kv::db &kv)
+{
+	auto increment = [](const string_view *value, std::string &new_value) {
+		auto n = value ? std::stoull(std::string(value->data(), value->size()))
+			       : 0;
+		new_value = std::to_string(n + 1);
+		return 0;
+	};
+
+	/* counters don't exist at the beginning, so their creation is tested too */
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i++)
+			ASSERT_STATUS(kv.update(counter_key((i + thread_id) % N_COUNTERS),
+						increment),
+				      status::OK);
+	});
+
+	size_t sum = 0;
+	for (size_t i = 0; i < N_COUNTERS; i++) {
+		std::string value;
+		ASSERT_STATUS(kv.get(counter_key(i), &value), status::OK);
+		sum += std::stoull(value);
+	}
+
+	UT_ASSERTeq(sum, threads_number * thread_items);
+	ASSERT_SIZE(kv, std::min(N_COUNTERS, threads_number * thread_items));
+}
+
+static void ConcurrentCompareExchangeTest(const size_t threads_number,
+					  const size_t thread_items, pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < N_COUNTERS; i++)
+		ASSERT_STATUS(kv.put(counter_key(i), "0"), status::OK);
+
+	/* optimistic increments, retried until the value wasn't changed by others */
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i++) {
+			auto key = counter_key((i + thread_id) % N_COUNTERS);
+			status s;
+			do {
+				std::string value;
+				ASSERT_STATUS(kv.get(key, &value), status::OK);
+				s = kv.compare_exchange(
+					key, value, std::to_string(std::stoull(value) + 1));
+				UT_ASSERT(s == status::OK || s == status::VALUE_MISMATCH);
+			} while (s != status::OK);
+		}
+	});
+
+	size_t sum = 0;
+	for (size_t i = 0; i < N_COUNTERS; i++) {
+		std::string value;
+		ASSERT_STATUS(kv.get(counter_key(i), &value), status::OK);
+		sum += std::stoull(value);
+	}
+
+	UT_ASSERTeq(sum, threads_number * thread_items);
+}
+
+static void ConcurrentFetchAddTest(const size_t threads_number,
+				   const size_t thread_items, pmem::kv::db &kv)
+{
+	/* counters are created by the first addition */
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i++) {
+			uint64_t old_value;
+			ASSERT_STATUS(kv.fetch_add(counter_key((i + thread_id) % N_COUNTERS),
+						   i + 1, old_value),
+				      status::OK);
+		}
+	});
+
+	uint64_t sum = 0;
+	for (size_t i = 0; i < N_COUNTERS; i++) {
+		uint64_t value;
+		ASSERT_STATUS(kv.fetch_add(counter_key(i), 0, value), status::OK);
+		sum += value;
+	}
+
+	UT_ASSERTeq(sum, threads_number * thread_items * (thread_items + 1) / 2);
+}
+
+static void ConcurrentPutIfAbsentTest(const size_t threads_number,
+				      const size_t thread_items, pmem::kv::db &kv)
+{
+	/* all threads try to insert the same keys, each with its own value */
+	std::vector<std::atomic<size_t>> inserts(thread_items);
+	std::vector<std::atomic<size_t>> winner(thread_items);
+	for (size_t i = 0; i < thread_items; i++)
+		inserts[i] = 0;
+
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i++) {
+			bool inserted;
+			ASSERT_STATUS(kv.put_if_absent(entry_from_number(i, "key_"),
+						       std::to_string(thread_id), inserted),
+				      status::OK);
+			if (inserted) {
+				inserts[i]++;
+				winner[i] = thread_id;
+			}
+		}
+	});
+
+	/* the first value put is never overwritten */
+	for (size_t i = 0; i < thread_items; i++) {
+		UT_ASSERTeq(inserts[i].load(), 1);
+
+		std::string value;
+		ASSERT_STATUS(kv.get(entry_from_number(i, "key_"), &value), status::OK);
+		UT_ASSERTeq(std::stoull(value), winner[i].load());
+	}
+}
+
+static void ConcurrentPutAndPutIfAbsentTest(const size_t threads_number,
+					    const size_t thread_items, pmem::kv::db &kv)
+{
+	auto key_of = [](size_t pair, size_t i) {
+		return entry_from_number(i, "pair" + std::to_string(pair) + "_");
+	};
+
+	/* in every pair of threads, one puts and the other puts if absent */
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i++) {
+			auto key = key_of(thread_id / 2, i);
+			if (thread_id % 2 == 0) {
+				ASSERT_STATUS(kv.put(key, "put"), status::OK);
+			} else {
+				bool inserted;
+				ASSERT_STATUS(kv.put_if_absent(key, "absent", inserted),
+					      status::OK);
+			}
+		}
+	});
+
+	/*
+	 * put overwrites the record inserted before it, while put_if_absent
+	 * leaves the one put before it, so the value of put is always kept
+	 */
+	for (size_t pair = 0; pair < (threads_number + 1) / 2; pair++) {
+		for (size_t i = 0; i < thread_items; i++) {
+			std::string value;
+			ASSERT_STATUS(kv.get(key_of(pair, i), &value), status::OK);
+			UT_ASSERT(value == "put");
+		}
+	}
+}
+
+static void ConcurrentTakeTest(const size_t threads_number, const size_t thread_items,
+			       pmem::kv::db &kv)
+{
+	for (size_t i = 0; i < thread_items; i++)
+		ASSERT_STATUS(kv.put(entry_from_number(i, "take_"), entry_from_number(i)),
+			      status::OK);
+
+	/* all threads try to take the same keys, each one is taken once */
+	std::vector<std::atomic<size_t>> takes(thread_items);
+	for (size_t i = 0; i < thread_items; i++)
+		takes[i] = 0;
+
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i++) {
+			auto key = entry_from_number(i, "take_");
+			auto s = kv.take(key, [&](string_view v) {
+				UT_ASSERT(v.compare(entry_from_number(i)) == 0);
+				takes[i]++;
+			});
+			UT_ASSERT(s == status::OK || s == status::NOT_FOUND);
+		}
+	});
+
+	for (size_t i = 0; i < thread_items; i++) {
+		UT_ASSERTeq(takes[i].load(), 1);
+		ASSERT_STATUS(kv.exists(entry_from_number(i, "take_")),
+			      status::NOT_FOUND);
+	}
+}
+
+static void test(int argc, char *argv[])
+{
+	using namespace std::placeholders;
+
+	if (argc < 5)
+		UT_FATAL("usage: %s engine json_config threads items", argv[0]);
+
+	size_t threads_number = std::stoull(argv[3]);
+	size_t thread_items = std::stoull(argv[4]);
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 std::bind(ConcurrentIncrementTest, threads_number,
+					   thread_items, _1),
+				 std::bind(ConcurrentCompareExchangeTest, threads_number,
+					   thread_items, _1),
+				 std::bind(ConcurrentFetchAddTest, threads_number,
+					   thread_items, _1),
+				 std::bind(ConcurrentPutIfAbsentTest, threads_number,
+					   thread_items, _1),
+				 std::bind(ConcurrentPutAndPutIfAbsentTest, threads_number,
+					   thread_items, _1),
+				 std::bind(ConcurrentTakeTest, threads_number,
+					   thread_items, _1),
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests eviction of records over the limit. Database must be opened with
+ * "max_items" config parameter, equal to the max_items param of the test.
+ */
+
+using namespace pmem::kv;
+
+static void LimitTest(pmem::kv::db &kv, size_t max_items)
+{
+	auto hot = entry_from_string("hot");
+	ASSERT_STATUS(kv.put(hot, entry_from_string("value")), status::OK);
+
+	/* the hot record is read after every put, so it's never evicted */
+	std::string value;
+	for (size_t i = 0; i < max_items * 10; ++i) {
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+		ASSERT_STATUS(kv.get(hot, &value), status::OK);
+		UT_ASSERT(value == entry_from_string("value"));
+
+		std::size_t cnt;
+		ASSERT_STATUS(kv.count_all(cnt), status::OK);
+		UT_ASSERT(cnt <= max_items);
+	}
+
+	/* the most recently put record wasn't evicted either */
+	ASSERT_STATUS(kv.get(entry_from_number(max_items * 10 - 1), &value), status::OK);
+	UT_ASSERT(value == entry_from_number(max_items * 10 - 1, "v"));
+}
+
+static void RemoveTest(pmem::kv::db &kv, size_t max_items)
+{
+	for (size_t i = 0; i < max_items; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+	for (size_t i = 0; i < max_items; ++i)
+		ASSERT_STATUS(kv.remove(entry_from_number(i)), status::OK);
+
+	/* removed records don't count, so the new ones fit without evictions */
+	for (size_t i = 0; i < max_items; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i, "new"), entry_from_number(i, "v")),
+			      status::OK);
+
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, max_items);
+	for (size_t i = 0; i < max_items; ++i)
+		ASSERT_STATUS(kv.exists(entry_from_number(i, "new")), status::OK);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config max_items", argv[0]);
+
+	size_t max_items = std::stoul(argv[3]);
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 [&](pmem::kv::db &kv) { LimitTest(kv, max_items); },
+				 [&](pmem::kv::db &kv) { RemoveTest(kv, max_items); },
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests reopening a database after most of its elements were removed (which
+ * leaves sparse nodes, e.g. merged and freed on open by tree3 with
+ * "compact_leaves" set). Engine must be sorted.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 5000;
+/* every KEPT_EVERY-th element is not removed */
+static const size_t KEPT_EVERY = 10;
+
+static void check(pmem::kv::db &kv, size_t expected)
+{
+	ASSERT_SIZE(kv, expected);
+
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		std::string value;
+		if (i % KEPT_EVERY == 0 || expected == N_KEYS) {
+			ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+			UT_ASSERT(value == entry_from_number(i, "v"));
+		} else {
+			ASSERT_STATUS(kv.get(entry_from_number(i), &value),
+				      status::NOT_FOUND);
+		}
+	}
+
+	/* elements are still in order */
+	std::string prev;
+	size_t cnt = 0;
+	ASSERT_STATUS(kv.get_all([&](string_view k, string_view v) {
+		auto key = std::string(k.data(), k.size());
+		UT_ASSERT(cnt == 0 || prev.compare(key) < 0);
+		prev = key;
+		cnt++;
+		return 0;
+	}),
+		      status::OK);
+	UT_ASSERTeq(cnt, expected);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	auto kv = INITIALIZE_KV(argv[1], CONFIG_FROM_JSON(argv[2]));
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		if (i % KEPT_EVERY != 0)
+			ASSERT_STATUS(kv.remove(entry_from_number(i)), status::OK);
+	}
+	kv.close();
+
+	const size_t kept = (N_KEYS + KEPT_EVERY - 1) / KEPT_EVERY;
+	kv = INITIALIZE_KV(argv[1], CONFIG_FROM_JSON(argv[2]));
+	check(kv, kept);
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	if (stats.find("tree3.compacted_leaves") != stats.end())
+		UT_ASSERT(stats["tree3.compacted_leaves"] > 0);
+
+	/* removed elements can be put again */
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+	check(kv, N_KEYS);
+	kv.close();
+
+	kv = INITIALIZE_KV(argv[1], CONFIG_FROM_JSON(argv[2]));
+	check(kv, N_KEYS);
+	kv.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
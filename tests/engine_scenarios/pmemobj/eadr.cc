@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests fence-only persistence of pools on eADR platforms. Database must be
+ * opened with "eadr" config parameter set to "on" and "persist_stats" set to 1.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+static const size_t VALUE_SIZE = 100;
+
+static void SkippedFlushesTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), std::string(VALUE_SIZE, 'x')),
+			      status::OK);
+	ASSERT_STATUS(kv.remove(entry_from_number(0)), status::OK);
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+
+	/* all flushes are skipped, drains are still done */
+	UT_ASSERTeq(stats["persist.put.count"], N_KEYS);
+	UT_ASSERTeq(stats["persist.put.flushed_bytes"], 0);
+	UT_ASSERTeq(stats["persist.put.flushes"], 0);
+	UT_ASSERT(stats["persist.put.skipped_flush_bytes"] >= N_KEYS * VALUE_SIZE);
+	UT_ASSERT(stats["persist.put.skipped_flushes"] >= N_KEYS);
+	UT_ASSERT(stats["persist.put.drains"] >= N_KEYS);
+	UT_ASSERT(stats["persist.put.write_amplification_percent"] >= 100);
+
+	UT_ASSERTeq(stats["persist.remove.flushes"], 0);
+	UT_ASSERT(stats["persist.remove.skipped_flushes"] > 0);
+
+	std::string value;
+	for (size_t i = 1; i < N_KEYS; ++i) {
+		ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+		UT_ASSERT(value == std::string(VALUE_SIZE, 'x'));
+	}
+	ASSERT_STATUS(kv.exists(entry_from_number(0)), status::NOT_FOUND);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 SkippedFlushesTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests statistics of pmemobj-based engines (db::get_stats) - number of
+ * elements, pool usage, durations of phases of opening and (if enabled by
+ * "memory_stats" config parameter) memory used by the engine's structures
+ * and fill of leaves after ascending inserts.
+ */
+
+using namespace pmem::kv;
+
+static void EngineStatsTest(pmem::kv::db &kv, size_t n_inserts)
+{
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERT(stats.find("pool.allocated_bytes") != stats.end());
+	UT_ASSERT(stats.find("pool.fragmentation_percent") != stats.end());
+	UT_ASSERT(stats["pool.fragmentation_percent"] <= 100);
+	auto allocated_empty = stats["pool.allocated_bytes"];
+	if (stats.find("count") != stats.end())
+		UT_ASSERTeq(stats["count"], 0);
+
+	for (size_t i = 0; i < n_inserts; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), std::string(100, 'x')),
+			      status::OK);
+
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERT(stats["pool.allocated_bytes"] > allocated_empty);
+	if (stats.find("count") != stats.end())
+		UT_ASSERTeq(stats["count"], n_inserts);
+
+	if (stats.find("memory.total_bytes") != stats.end() && n_inserts > 0) {
+		auto per_key = stats["memory.bytes_per_key"];
+		UT_ASSERT(per_key > 100);
+		UT_ASSERT(per_key * n_inserts <= stats["memory.total_bytes"]);
+
+		/* classes sum up to the total */
+		uint64_t sum = 0;
+		for (auto &s : stats) {
+			auto &name = s.first;
+			auto dot = name.rfind('.');
+			if (name.compare(0, 7, "memory.") == 0 && dot > 7 &&
+			    (name.compare(dot, std::string::npos, ".bytes") == 0 ||
+			     name.compare(dot, std::string::npos, ".header_bytes") == 0))
+				sum += s.second;
+		}
+		UT_ASSERTeq(sum, stats["memory.total_bytes"]);
+
+		/* leaves are allocated from classes of their size (rounded up to 16) */
+		if (stats.find("memory.leaves.objects") != stats.end())
+			UT_ASSERT(stats["memory.leaves.padding_bytes"] <
+				  16 * stats["memory.leaves.objects"]);
+	}
+}
+
+static void AppendLeafFillTest(pmem::kv::db &kv, size_t n_inserts)
+{
+	/**
+	 * TEST: keys put in increasing order are appended to the last leaf,
+	 * which is not split in half, so leaves (if reported) stay full.
+	 */
+	for (size_t i = 0; i < n_inserts; ++i) {
+		auto key = std::to_string(i);
+		key.insert(0, 20 - key.size(), '0');
+		ASSERT_STATUS(kv.put(entry_from_string(key), entry_from_number(i)),
+			      status::OK);
+	}
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	if (stats.find("stree.leaf_fill_percent") != stats.end() && n_inserts >= 1000)
+		UT_ASSERT(stats["stree.leaf_fill_percent"] >= 90);
+
+	for (size_t i = 0; i < n_inserts; ++i) {
+		auto key = std::to_string(i);
+		key.insert(0, 20 - key.size(), '0');
+		std::string value;
+		ASSERT_STATUS(kv.get(entry_from_string(key), &value), status::OK);
+		UT_ASSERT(value == entry_from_number(i));
+	}
+}
+
+static void OpenStatsTest(pmem::kv::db &kv)
+{
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERT(stats.find("open.total_ns") != stats.end());
+	UT_ASSERT(stats.find("open.pool_ns") != stats.end());
+	UT_ASSERT(stats["open.pool_ns"] <= stats["open.total_ns"]);
+
+	bool recover = false;
+	for (auto &s : stats) {
+		auto &name = s.first;
+		if (name.compare(0, 5, "open.") == 0 && name.size() > 11 &&
+		    name.compare(name.size() - 11, 11, ".recover_ns") == 0)
+			recover = true;
+	}
+	UT_ASSERT(recover);
+
+	/* timings of opening are not reset */
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+	std::map<std::string, uint64_t> after_reset;
+	ASSERT_STATUS(kv.get_stats(after_reset), status::OK);
+	UT_ASSERTeq(after_reset["open.total_ns"], stats["open.total_ns"]);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config n_inserts", argv[0]);
+
+	auto n_inserts = std::stoull(argv[3]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 OpenStatsTest,
+				 std::bind(EngineStatsTest, std::placeholders::_1,
+					   n_inserts),
+				 std::bind(AppendLeafFillTest, std::placeholders::_1,
+					   n_inserts),
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
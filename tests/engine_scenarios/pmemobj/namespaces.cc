@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/*
+ * Tests for config parameter namespace - many databases in a single pool.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+
+static status open_namespace(db &kv, const std::string &engine, const std::string &path,
+			     const std::string &name, std::size_t size = 0,
+			     bool error_if_exists = false)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_path(path), status::OK);
+	ASSERT_STATUS(cfg.put_namespace(name), status::OK);
+	if (size > 0) {
+		ASSERT_STATUS(cfg.put_size(size), status::OK);
+		if (error_if_exists)
+			ASSERT_STATUS(cfg.put_create_or_error_if_exists(true),
+				      status::OK);
+		else
+			ASSERT_STATUS(cfg.put_create_if_missing(true), status::OK);
+	}
+
+	return kv.open(engine, std::move(cfg));
+}
+
+static void verify(db &kv, const std::string &prefix)
+{
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, N_KEYS);
+
+	std::string value;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		ASSERT_STATUS(kv.get(entry_from_number(i, prefix), &value), status::OK);
+		UT_ASSERT(value == entry_from_number(i, prefix + "v"));
+	}
+}
+
+static void fill(db &kv, const std::string &prefix)
+{
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i, prefix),
+				     entry_from_number(i, prefix + "v")),
+			      status::OK);
+}
+
+static void CreateTest(std::string engine, std::string path, std::size_t size)
+{
+	/**
+	 * TEST: namespaces created in a single pool, open at the same time,
+	 * keep separate records.
+	 */
+	db kv_a, kv_b;
+	ASSERT_STATUS(open_namespace(kv_a, engine, path, "a", size), status::OK);
+	ASSERT_STATUS(open_namespace(kv_b, engine, path, "b", size), status::OK);
+
+	fill(kv_a, "a");
+	fill(kv_b, "b");
+
+	verify(kv_a, "a");
+	verify(kv_b, "b");
+	ASSERT_STATUS(kv_a.exists(entry_from_number(0, "b")), status::NOT_FOUND);
+	ASSERT_STATUS(kv_b.exists(entry_from_number(0, "a")), status::NOT_FOUND);
+
+	/* a namespace is open only once at a time */
+	db kv;
+	ASSERT_STATUS(open_namespace(kv, engine, path, "a"), status::INVALID_ARGUMENT);
+}
+
+static void ReopenTest(std::string engine, std::string path, std::size_t size)
+{
+	/**
+	 * TEST: records of namespaces are there after the pool is reopened, only
+	 * existing namespaces are opened without create flags.
+	 */
+	db kv_b;
+	ASSERT_STATUS(open_namespace(kv_b, engine, path, "b"), status::OK);
+	verify(kv_b, "b");
+
+	{
+		db kv_a;
+		ASSERT_STATUS(open_namespace(kv_a, engine, path, "a"), status::OK);
+		verify(kv_a, "a");
+	}
+
+	db kv;
+	ASSERT_STATUS(open_namespace(kv, engine, path, "c"), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(open_namespace(kv, engine, path, "a", size, true),
+		      status::INVALID_ARGUMENT);
+	ASSERT_STATUS(open_namespace(kv, engine, path, ""), status::INVALID_ARGUMENT);
+
+	/* pool was not closed by failed opens */
+	verify(kv_b, "b");
+}
+
+static void OtherEngineTest(std::string engine, std::string other_engine,
+			    std::string path, std::size_t size)
+{
+	/**
+	 * TEST: namespaces of different engines share a pool, a namespace is
+	 * opened only by the engine it was created with.
+	 */
+	db kv;
+	ASSERT_STATUS(open_namespace(kv, other_engine, path, "a"),
+		      status::INVALID_ARGUMENT);
+
+	db kv_a, kv_d;
+	ASSERT_STATUS(open_namespace(kv_a, engine, path, "a"), status::OK);
+	ASSERT_STATUS(open_namespace(kv_d, other_engine, path, "d", size), status::OK);
+	fill(kv_d, "d");
+	verify(kv_d, "d");
+	verify(kv_a, "a");
+}
+
+static void InvalidConfigTest(std::string engine, std::string path)
+{
+	/**
+	 * TEST: namespace requires path and can't be set with read_only.
+	 */
+	{
+		config cfg;
+		ASSERT_STATUS(cfg.put_namespace("a"), status::OK);
+
+		db kv;
+		ASSERT_STATUS(kv.open(engine, std::move(cfg)), status::INVALID_ARGUMENT);
+	}
+
+	config cfg;
+	ASSERT_STATUS(cfg.put_path(path), status::OK);
+	ASSERT_STATUS(cfg.put_namespace("a"), status::OK);
+	ASSERT_STATUS(cfg.put_read_only(true), status::OK);
+
+	db kv;
+	ASSERT_STATUS(kv.open(engine, std::move(cfg)), status::INVALID_ARGUMENT);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine path size [other_engine]", argv[0]);
+
+	auto engine = argv[1];
+	/* pool of namespaces is created next to the one of the engine */
+	auto path = std::string(argv[2]) + "_namespaces";
+	size_t size = std::stoul(argv[3]);
+
+	CreateTest(engine, path, size);
+	ReopenTest(engine, path, size);
+	if (argc > 4)
+		OtherEngineTest(engine, argv[4], path, size);
+	InvalidConfigTest(engine, path);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
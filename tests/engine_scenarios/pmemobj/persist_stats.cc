@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests statistics of writes to persistent memory (db::get_stats,
+ * db::reset_stats). Database must be opened with "persist_stats" config
+ * parameter set to 1.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+static const size_t VALUE_SIZE = 100;
+
+static void PersistStatsTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), std::string(VALUE_SIZE, 'x')),
+			      status::OK);
+	ASSERT_STATUS(kv.remove(entry_from_number(0)), status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(entry_from_number(1), &value), status::OK);
+
+	std::map<std::string, uint64_t> stats;
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+
+	UT_ASSERTeq(stats["persist.put.count"], N_KEYS);
+	UT_ASSERTeq(stats["persist.put.user_bytes"],
+		    N_KEYS * (entry_from_number(0).size() + VALUE_SIZE));
+	/* every value has to be written to the pool at least once */
+	UT_ASSERT(stats["persist.put.flushed_bytes"] >= N_KEYS * VALUE_SIZE);
+	UT_ASSERT(stats["persist.put.flushes"] >= N_KEYS);
+	UT_ASSERT(stats["persist.put.drains"] >= N_KEYS);
+	UT_ASSERT(stats["persist.put.write_amplification_percent"] >= 100);
+	UT_ASSERT(stats["persist.put.write_amplification_percent"] ==
+		  (stats["persist.put.flushed_bytes"] +
+		   stats["persist.put.skipped_flush_bytes"] +
+		   stats["persist.put.undo_log_bytes"]) *
+			  100 / stats["persist.put.user_bytes"]);
+
+	UT_ASSERTeq(stats["persist.remove.count"], 1);
+	UT_ASSERT(stats["persist.remove.flushes"] > 0);
+
+	/* reads are not reported */
+	UT_ASSERT(stats.find("persist.get.count") == stats.end());
+
+	ASSERT_STATUS(kv.reset_stats(), status::OK);
+	ASSERT_STATUS(kv.get_stats(stats), status::OK);
+	UT_ASSERTeq(stats["persist.put.count"], 0);
+	UT_ASSERTeq(stats["persist.put.flushed_bytes"], 0);
+	UT_ASSERTeq(stats["persist.put.write_amplification_percent"], 0);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 PersistStatsTest,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/*
+ * Tests for config flag read_only with existing pool.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 100;
+
+static void open_read_only(db &kv, const std::string &path, const std::string &engine)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_path(path), status::OK);
+	ASSERT_STATUS(cfg.put_read_only(true), status::OK);
+
+	ASSERT_STATUS(kv.open(engine, std::move(cfg)), status::OK);
+}
+
+static void Fill(std::string path, std::string engine, std::size_t size)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_path(path), status::OK);
+	ASSERT_STATUS(cfg.put_size(size), status::OK);
+
+	db kv;
+	ASSERT_STATUS(kv.open(engine, std::move(cfg)), status::OK);
+	for (size_t i = 0; i < N_KEYS; ++i)
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "v")),
+			      status::OK);
+}
+
+static void ReadsTest(std::string path, std::string engine, std::size_t size)
+{
+	/**
+	 * TEST: all records are readable in a database opened read-only.
+	 */
+	db kv;
+	open_read_only(kv, path, engine);
+
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, N_KEYS);
+
+	std::string value;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		ASSERT_STATUS(kv.exists(entry_from_number(i)), status::OK);
+		ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+		UT_ASSERT(value == entry_from_number(i, "v"));
+	}
+
+	std::size_t visited = 0;
+	ASSERT_STATUS(kv.get_all([&](string_view k, string_view v) {
+		++visited;
+		return 0;
+	}),
+		      status::OK);
+	UT_ASSERTeq(visited, N_KEYS);
+}
+
+static void WritesFailTest(std::string path, std::string engine, std::size_t size)
+{
+	/**
+	 * TEST: writes to a database opened read-only fail and the pool is not
+	 * modified.
+	 */
+	{
+		db kv;
+		open_read_only(kv, path, engine);
+
+		auto key = entry_from_number(0);
+		ASSERT_STATUS(kv.put(key, entry_from_string("new")),
+			      status::NOT_SUPPORTED);
+		ASSERT_STATUS(kv.put(entry_from_string("new"), entry_from_string("new")),
+			      status::NOT_SUPPORTED);
+		ASSERT_STATUS(kv.remove(key), status::NOT_SUPPORTED);
+
+		std::vector<string_view> keys = {key};
+		std::vector<string_view> values = {entry_from_string("new")};
+		ASSERT_STATUS(kv.put_batch(keys, values), status::NOT_SUPPORTED);
+
+		ASSERT_STATUS(kv.defrag(), status::NOT_SUPPORTED);
+
+		ASSERT_STATUS(kv.tx_begin().get_status(), status::NOT_SUPPORTED);
+	}
+
+	config cfg;
+	ASSERT_STATUS(cfg.put_path(path), status::OK);
+
+	db kv;
+	ASSERT_STATUS(kv.open(engine, std::move(cfg)), status::OK);
+
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, N_KEYS);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(entry_from_number(0), &value), status::OK);
+	UT_ASSERT(value == entry_from_number(0, "v"));
+}
+
+static void CreateFlagFailsTest(std::string path, std::string engine, std::size_t size)
+{
+	/**
+	 * TEST: read_only can't be set with a create flag.
+	 */
+	config cfg;
+	ASSERT_STATUS(cfg.put_path(path), status::OK);
+	ASSERT_STATUS(cfg.put_size(size), status::OK);
+	ASSERT_STATUS(cfg.put_create_if_missing(true), status::OK);
+	ASSERT_STATUS(cfg.put_read_only(true), status::OK);
+
+	db kv;
+	ASSERT_STATUS(kv.open(engine, std::move(cfg)), status::INVALID_ARGUMENT);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine path size", argv[0]);
+
+	auto engine = argv[1];
+	auto path = argv[2];
+	size_t size = std::stoul(argv[3]);
+
+	Fill(path, engine, size);
+	ReadsTest(path, engine, size);
+	WritesFailTest(path, engine, size);
+	CreateFlagFailsTest(path, engine, size);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
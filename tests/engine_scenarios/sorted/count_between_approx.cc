@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "iterate.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+/**
+ * Tests for count_between_approx method for sorted engines. It estimates
+ * the number of elements with keys greater than key1 and lesser than key2;
+ * engines which don't estimate it return the exact count.
+ */
+
+/* allowed error of estimates: half of the exact count plus a few leaves */
+static const size_t ABSOLUTE_ERROR = 64;
+
+static std::string num_key(size_t i)
+{
+	std::ostringstream s;
+	s << std::setw(10) << std::setfill('0') << i;
+	return s.str();
+}
+
+static void verify_estimate(pmem::kv::db &kv, const std::string &key1,
+			    const std::string &key2)
+{
+	std::size_t exact, approx, all;
+	ASSERT_STATUS(kv.count_between(key1, key2, exact), status::OK);
+	ASSERT_STATUS(kv.count_between_approx(key1, key2, approx), status::OK);
+	ASSERT_STATUS(kv.count_all(all), status::OK);
+
+	UT_ASSERT(approx <= all);
+	UT_ASSERT(approx + exact / 2 + ABSOLUTE_ERROR >= exact);
+	UT_ASSERT(approx <= exact + exact / 2 + ABSOLUTE_ERROR);
+}
+
+static void CountBetweenApproxTest(std::string engine, pmem::kv::config &&config)
+{
+	/**
+	 * TEST: Basic test with hardcoded strings.
+	 * It's NOT suitable to test with custom comparator.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	std::size_t cnt = 1;
+	ASSERT_STATUS(kv.count_between_approx(MIN_KEY, MAX_KEY, cnt), status::OK);
+	UT_ASSERT(cnt == 0);
+
+	add_basic_keys(kv);
+
+	/* empty and reversed ranges */
+	cnt = 1;
+	ASSERT_STATUS(kv.count_between_approx("B", "B", cnt), status::OK);
+	UT_ASSERT(cnt == 0);
+	cnt = 1;
+	ASSERT_STATUS(kv.count_between_approx("C", "A", cnt), status::OK);
+	UT_ASSERT(cnt == 0);
+
+	/* all keys fit in a single node, so estimates are exact */
+	ASSERT_STATUS(kv.count_between_approx(EMPTY_KEY, MAX_KEY, cnt), status::OK);
+	UT_ASSERT(cnt == 6);
+	ASSERT_STATUS(kv.count_between_approx("A", "B", cnt), status::OK);
+	UT_ASSERT(cnt == 2);
+	ASSERT_STATUS(kv.count_between_approx("AZ", "BC", cnt), status::OK);
+	UT_ASSERT(cnt == 2);
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void CountBetweenApproxRangeTest(std::string engine, pmem::kv::config &&config,
+					const size_t items)
+{
+	/**
+	 * TEST: estimates of ranges of various sizes, with keys inserted in
+	 * random order, then with every other key removed.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	std::vector<size_t> order(items);
+	for (size_t i = 0; i < items; ++i)
+		order[i] = i;
+	std::shuffle(order.begin(), order.end(), std::mt19937(items));
+
+	for (auto i : order)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i)), status::OK);
+	ASSERT_SIZE(kv, items);
+
+	verify_estimate(kv, EMPTY_KEY, MAX_KEY);
+	for (size_t parts = 1; parts <= 16; parts *= 2) {
+		for (size_t p = 0; p < parts; ++p)
+			verify_estimate(kv, num_key(p * items / parts),
+					num_key((p + 1) * items / parts));
+	}
+
+	std::size_t cnt = 1;
+	ASSERT_STATUS(kv.count_between_approx(num_key(items), num_key(0), cnt),
+		      status::OK);
+	UT_ASSERT(cnt == 0);
+
+	for (size_t i = 0; i < items; i += 2)
+		ASSERT_STATUS(kv.remove(num_key(i)), status::OK);
+
+	verify_estimate(kv, EMPTY_KEY, MAX_KEY);
+	for (size_t p = 0; p < 4; ++p)
+		verify_estimate(kv, num_key(p * items / 4), num_key((p + 1) * items / 4));
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config items", argv[0]);
+
+	auto engine = std::string(argv[1]);
+	size_t items = std::stoull(argv[3]);
+
+	CountBetweenApproxTest(engine, CONFIG_FROM_JSON(argv[2]));
+	CountBetweenApproxRangeTest(engine, CONFIG_FROM_JSON(argv[2]), items);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
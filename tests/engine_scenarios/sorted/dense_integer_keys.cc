@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/**
+ * Tests engines with 8-byte (big-endian integer) keys and values of a fixed
+ * size - dense ranges of keys (filling whole pages of an array), removed and
+ * inserted again, and sparse keys far apart, with range queries.
+ */
+
+#include <map>
+#include <vector>
+
+#include "unittest.hpp"
+
+static const uint64_t N_KEYS = 3000;
+
+static size_t value_size;
+
+static std::string int_key(uint64_t k)
+{
+	std::string key(8, '\0');
+	for (size_t i = 8; i > 0; --i) {
+		key[i - 1] = static_cast<char>(k & 0xff);
+		k >>= 8;
+	}
+
+	return key;
+}
+
+static std::string make_value(uint64_t n, char fill)
+{
+	auto value = std::to_string(n);
+	value.resize(value_size, fill);
+
+	return value;
+}
+
+static void verify(pmem::kv::db &kv, const std::map<std::string, std::string> &expected)
+{
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, expected.size());
+
+	std::vector<std::pair<std::string, std::string>> all;
+	ASSERT_STATUS(kv.get_all([&](pmem::kv::string_view k, pmem::kv::string_view v) {
+		all.emplace_back(std::string(k.data(), k.size()),
+				 std::string(v.data(), v.size()));
+		return 0;
+	}),
+		      pmem::kv::status::OK);
+	UT_ASSERT(all ==
+		  std::vector<std::pair<std::string, std::string>>(expected.begin(),
+								   expected.end()));
+
+	for (auto &e : expected) {
+		std::string value;
+		ASSERT_STATUS(kv.get(e.first, &value), pmem::kv::status::OK);
+		UT_ASSERT(value == e.second);
+	}
+}
+
+static void dense_test(pmem::kv::db &kv)
+{
+	std::map<std::string, std::string> expected;
+	for (uint64_t n = 0; n < N_KEYS; ++n) {
+		ASSERT_STATUS(kv.put(int_key(n), make_value(n, 'a')), pmem::kv::status::OK);
+		expected[int_key(n)] = make_value(n, 'a');
+	}
+	verify(kv, expected);
+
+	/* overwrites */
+	for (uint64_t n = 0; n < N_KEYS; n += 2) {
+		ASSERT_STATUS(kv.put(int_key(n), make_value(n, 'b')), pmem::kv::status::OK);
+		expected[int_key(n)] = make_value(n, 'b');
+	}
+	verify(kv, expected);
+
+	/* removes of whole pages and parts of them, then inserts in their place */
+	for (uint64_t n = 500; n < 2000; ++n) {
+		ASSERT_STATUS(kv.remove(int_key(n)), pmem::kv::status::OK);
+		ASSERT_STATUS(kv.remove(int_key(n)), pmem::kv::status::NOT_FOUND);
+		expected.erase(int_key(n));
+	}
+	verify(kv, expected);
+	ASSERT_STATUS(kv.exists(int_key(1000)), pmem::kv::status::NOT_FOUND);
+
+	for (uint64_t n = 1000; n < 1100; ++n) {
+		ASSERT_STATUS(kv.put(int_key(n), make_value(n, 'c')), pmem::kv::status::OK);
+		expected[int_key(n)] = make_value(n, 'c');
+	}
+	verify(kv, expected);
+}
+
+static void sparse_test(pmem::kv::db &kv)
+{
+	std::vector<uint64_t> numbers = {0,	    1,		511,	     512,
+					 1ULL << 20, 1ULL << 40, 1ULL << 63, ~0ULL};
+
+	std::map<std::string, std::string> expected;
+	for (auto it = numbers.rbegin(); it != numbers.rend(); ++it) {
+		ASSERT_STATUS(kv.put(int_key(*it), make_value(*it, 'x')),
+			      pmem::kv::status::OK);
+		expected[int_key(*it)] = make_value(*it, 'x');
+	}
+	verify(kv, expected);
+
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_between(int_key(1), int_key(1ULL << 40), cnt),
+		      pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 3);
+	ASSERT_STATUS(kv.count_equal_above(int_key(1ULL << 63), cnt),
+		      pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 2);
+	ASSERT_STATUS(kv.count_above(int_key(~0ULL), cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 0);
+	ASSERT_STATUS(kv.count_below(int_key(0), cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 0);
+	ASSERT_STATUS(kv.count_equal_below(int_key(512), cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 4);
+
+	/* bounds of other sizes are compared bytewise, as keys */
+	ASSERT_STATUS(kv.count_above(std::string(1, '\x80'), cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 2);
+	ASSERT_STATUS(kv.count_below(int_key(512) + "x", cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 4);
+
+	std::vector<std::string> keys;
+	ASSERT_STATUS(kv.get_equal_above(int_key(512),
+					 [&](pmem::kv::string_view k, pmem::kv::string_view) {
+						 keys.emplace_back(k.data(), k.size());
+						 return 0;
+					 }),
+		      pmem::kv::status::OK);
+	UT_ASSERT(keys ==
+		  std::vector<std::string>({int_key(512), int_key(1ULL << 20),
+					    int_key(1ULL << 40), int_key(1ULL << 63),
+					    int_key(~0ULL)}));
+
+	for (auto n : numbers)
+		ASSERT_STATUS(kv.remove(int_key(n)), pmem::kv::status::OK);
+	verify(kv, {});
+}
+
+static void size_test(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put("key", make_value(1, 'a')), pmem::kv::status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.put(int_key(1), make_value(1, 'a') + "x"),
+		      pmem::kv::status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.put(int_key(1), ""), pmem::kv::status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.exists(int_key(1)), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(kv.remove("key"), pmem::kv::status::NOT_FOUND);
+
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 0);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config value_size", argv[0]);
+
+	value_size = std::stoull(argv[3]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 dense_test,
+				 sparse_test,
+				 size_test,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "iterate.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+/**
+ * Tests for get_keys_all and get_keys_between methods for sorted engines.
+ * They visit the same keys as get_all and get_between, without values.
+ */
+
+static std::string num_key(size_t i)
+{
+	std::ostringstream s;
+	s << std::setw(10) << std::setfill('0') << i;
+	return s.str();
+}
+
+static void GetKeysBasicTest(std::string engine, pmem::kv::config &&config)
+{
+	/**
+	 * TEST: Basic test with hardcoded strings.
+	 * It's NOT suitable to test with custom comparator.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	std::vector<std::string> keys;
+	auto collect = [&](string_view k, string_view v) {
+		UT_ASSERTeq(v.size(), 0);
+		keys.emplace_back(k.data(), k.size());
+		return 0;
+	};
+
+	ASSERT_STATUS(kv.get_keys_all(collect), status::OK);
+	UT_ASSERT(keys.empty());
+
+	add_basic_keys(kv);
+
+	ASSERT_STATUS(kv.get_keys_all(collect), status::OK);
+	UT_ASSERT(keys == std::vector<std::string>({"A", "AB", "AC", "B", "BB", "BC"}));
+
+	keys.clear();
+	ASSERT_STATUS(kv.get_keys_between("A", "BB", collect), status::OK);
+	UT_ASSERT(keys == std::vector<std::string>({"AB", "AC", "B"}));
+
+	/* empty and reversed ranges */
+	keys.clear();
+	ASSERT_STATUS(kv.get_keys_between("B", "B", collect), status::OK);
+	ASSERT_STATUS(kv.get_keys_between("C", "A", collect), status::OK);
+	UT_ASSERT(keys.empty());
+
+	/* C-like callback gets a null value */
+	size_t cnt = 0;
+	ASSERT_STATUS(kv.get_keys_all(
+			      [](const char *k, size_t kb, const char *v, size_t vb,
+				 void *arg) {
+				      UT_ASSERT(v == nullptr);
+				      UT_ASSERTeq(vb, 0);
+				      ++*static_cast<size_t *>(arg);
+				      return 0;
+			      },
+			      &cnt),
+		      status::OK);
+	UT_ASSERTeq(cnt, 6);
+
+	/* callback stops the scan */
+	keys.clear();
+	ASSERT_STATUS(kv.get_keys_between(EMPTY_KEY, "C",
+					  [&](string_view k, string_view v) {
+						  keys.emplace_back(k.data(), k.size());
+						  return keys.size() == 2 ? 1 : 0;
+					  }),
+		      status::STOPPED_BY_CB);
+	UT_ASSERT(keys == std::vector<std::string>({"A", "AB"}));
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void GetKeysRangeTest(std::string engine, pmem::kv::config &&config,
+			     const size_t items)
+{
+	/**
+	 * TEST: keys visited by key-only scans are the same as visited by
+	 * get_all and get_between, with every other key removed.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	for (size_t i = 0; i < items; ++i)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i)), status::OK);
+	for (size_t i = 0; i < items; i += 2)
+		ASSERT_STATUS(kv.remove(num_key(i)), status::OK);
+
+	std::vector<std::string> expected, keys;
+	auto collect_expected = [&](string_view k, string_view v) {
+		expected.emplace_back(k.data(), k.size());
+		return 0;
+	};
+	auto collect = [&](string_view k, string_view v) {
+		keys.emplace_back(k.data(), k.size());
+		return 0;
+	};
+
+	ASSERT_STATUS(kv.get_all(collect_expected), status::OK);
+	ASSERT_STATUS(kv.get_keys_all(collect), status::OK);
+	UT_ASSERTeq(keys.size(), items / 2);
+	UT_ASSERT(keys == expected);
+
+	expected.clear();
+	keys.clear();
+	ASSERT_STATUS(kv.get_between(num_key(items / 4), num_key(items / 2),
+				     collect_expected),
+		      status::OK);
+	ASSERT_STATUS(kv.get_keys_between(num_key(items / 4), num_key(items / 2), collect),
+		      status::OK);
+	UT_ASSERT(keys == expected);
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config items", argv[0]);
+
+	auto engine = std::string(argv[1]);
+	size_t items = std::stoull(argv[3]);
+
+	GetKeysBasicTest(engine, CONFIG_FROM_JSON(argv[2]));
+	GetKeysRangeTest(engine, CONFIG_FROM_JSON(argv[2]), items);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
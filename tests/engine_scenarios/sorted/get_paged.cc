@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "iterate.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+/**
+ * Tests for get_above_paged and get_between_paged methods for sorted engines.
+ * They skip 'offset' first records of the range and visit at most 'limit'
+ * of them.
+ */
+
+static std::string num_key(size_t i)
+{
+	std::ostringstream s;
+	s << std::setw(10) << std::setfill('0') << i;
+	return s.str();
+}
+
+/* keys with numbers from 'first' (inclusive) to 'last' (exclusive), limited by the page */
+static std::vector<std::string> expected_page(size_t first, size_t last, size_t offset,
+					      size_t limit)
+{
+	std::vector<std::string> result;
+	for (size_t i = first + offset; i < last && result.size() < limit; ++i)
+		result.push_back(num_key(i));
+
+	return result;
+}
+
+static void GetPagedBasicTest(std::string engine, pmem::kv::config &&config)
+{
+	/**
+	 * TEST: Basic test with hardcoded strings.
+	 * It's NOT suitable to test with custom comparator.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	std::vector<std::string> keys;
+	auto collect = [&](string_view k, string_view v) {
+		keys.emplace_back(k.data(), k.size());
+		return 0;
+	};
+
+	ASSERT_STATUS(kv.get_above_paged(EMPTY_KEY, 0, 10, collect), status::OK);
+	UT_ASSERT(keys.empty());
+
+	add_basic_keys(kv);
+
+	ASSERT_STATUS(kv.get_above_paged("A", 1, 2, collect), status::OK);
+	UT_ASSERT(keys == std::vector<std::string>({"AC", "B"}));
+
+	keys.clear();
+	ASSERT_STATUS(kv.get_between_paged("A", "C", 2, 10, collect), status::OK);
+	UT_ASSERT(keys == std::vector<std::string>({"B", "BB", "BC"}));
+
+	/* empty pages */
+	keys.clear();
+	ASSERT_STATUS(kv.get_above_paged(EMPTY_KEY, 0, 0, collect), status::OK);
+	ASSERT_STATUS(kv.get_above_paged(EMPTY_KEY, 6, 10, collect), status::OK);
+	ASSERT_STATUS(kv.get_between_paged("A", "C", 5, 1, collect), status::OK);
+	ASSERT_STATUS(kv.get_between_paged("C", "A", 0, 10, collect), status::OK);
+	UT_ASSERT(keys.empty());
+
+	/* callback stops the scan before the limit */
+	ASSERT_STATUS(kv.get_above_paged(EMPTY_KEY, 1, 3,
+					 [&](string_view k, string_view v) {
+						 keys.emplace_back(k.data(), k.size());
+						 return keys.size() == 2 ? 1 : 0;
+					 }),
+		      status::STOPPED_BY_CB);
+	UT_ASSERT(keys == std::vector<std::string>({"AB", "AC"}));
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void GetPagedRangeTest(std::string engine, pmem::kv::config &&config,
+			      const size_t items)
+{
+	/**
+	 * TEST: pages of various sizes, at offsets spread over ranges of keys
+	 * inserted in random order.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	std::vector<size_t> order(items);
+	for (size_t i = 0; i < items; ++i)
+		order[i] = i;
+	std::shuffle(order.begin(), order.end(), std::mt19937(items));
+
+	for (auto i : order)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i)), status::OK);
+	ASSERT_SIZE(kv, items);
+
+	std::vector<std::string> keys;
+	auto collect = [&](string_view k, string_view v) {
+		UT_ASSERT(v.compare(std::to_string(std::stoull(
+				  std::string(k.data(), k.size())))) == 0);
+		keys.emplace_back(k.data(), k.size());
+		return 0;
+	};
+
+	for (size_t page : {1, 7, 100, 1000}) {
+		for (size_t offset = 0; offset <= items;
+		     offset += std::max(page, items / 64)) {
+			keys.clear();
+			ASSERT_STATUS(kv.get_above_paged(EMPTY_KEY, offset, page, collect),
+				      status::OK);
+			UT_ASSERT(keys == expected_page(0, items, offset, page));
+
+			keys.clear();
+			ASSERT_STATUS(kv.get_between_paged(num_key(items / 4),
+							   num_key(items / 2), offset,
+							   page, collect),
+				      status::OK);
+			UT_ASSERT(keys ==
+				  expected_page(items / 4 + 1, items / 2, offset, page));
+		}
+	}
+
+	/* pages of a range with every other key removed */
+	for (size_t i = 0; i < items; i += 2)
+		ASSERT_STATUS(kv.remove(num_key(i)), status::OK);
+
+	for (size_t offset = 0; offset < items / 2; offset += 33) {
+		keys.clear();
+		ASSERT_STATUS(kv.get_above_paged(num_key(0), offset, 33, collect),
+			      status::OK);
+		std::vector<std::string> expected;
+		for (size_t i = 1 + 2 * offset; i < items && expected.size() < 33; i += 2)
+			expected.push_back(num_key(i));
+		UT_ASSERT(keys == expected);
+	}
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config items", argv[0]);
+
+	auto engine = std::string(argv[1]);
+	size_t items = std::stoull(argv[3]);
+
+	GetPagedBasicTest(engine, CONFIG_FROM_JSON(argv[2]));
+	GetPagedRangeTest(engine, CONFIG_FROM_JSON(argv[2]), items);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
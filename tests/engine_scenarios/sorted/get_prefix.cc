@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "iterate.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+/**
+ * Tests for get_prefix method for sorted engines. get_prefix returns
+ * all elements in db with keys starting with the given prefix, in order.
+ */
+
+static std::string num_key(size_t i)
+{
+	std::ostringstream s;
+	s << std::setw(10) << std::setfill('0') << i;
+	return s.str();
+}
+
+static kv_list get_prefix(pmem::kv::db &kv, const std::string &prefix)
+{
+	kv_list result;
+	auto s = KV_GET_1KEY_CPP_CB_LST(get_prefix, prefix, result);
+	ASSERT_STATUS(s, status::OK);
+
+	kv_list result_c;
+	s = KV_GET_1KEY_C_CB_LST(get_prefix, prefix, result_c);
+	ASSERT_STATUS(s, status::OK);
+	UT_ASSERT(result == result_c);
+
+	return result;
+}
+
+static void GetPrefixTest(std::string engine, pmem::kv::config &&config)
+{
+	/**
+	 * TEST: Basic test with hardcoded strings.
+	 * It's NOT suitable to test with custom comparator.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	UT_ASSERT(get_prefix(kv, "A").empty());
+	UT_ASSERT(get_prefix(kv, EMPTY_KEY).empty());
+
+	add_basic_keys(kv);
+
+	auto expected = kv_list{{"A", "1"}, {"AB", "2"}, {"AC", "3"}};
+	UT_ASSERT(get_prefix(kv, "A") == expected);
+
+	expected = kv_list{{"B", "4"}, {"BB", "5"}, {"BC", "6"}};
+	UT_ASSERT(get_prefix(kv, "B") == expected);
+
+	expected = kv_list{{"BB", "5"}};
+	UT_ASSERT(get_prefix(kv, "BB") == expected);
+
+	UT_ASSERT(get_prefix(kv, "AA").empty());
+	UT_ASSERT(get_prefix(kv, "BBB").empty());
+	UT_ASSERT(get_prefix(kv, "C").empty());
+	UT_ASSERT(get_prefix(kv, MIN_KEY).empty());
+
+	/* empty prefix matches all keys */
+	expected = kv_list{{"A", "1"}, {"AB", "2"}, {"AC", "3"},
+			   {"B", "4"}, {"BB", "5"}, {"BC", "6"}};
+	UT_ASSERT(get_prefix(kv, EMPTY_KEY) == expected);
+
+	/* prefixes ending with 0xff bytes have no upper bound of their own */
+	std::string ff = std::string(1, char(255));
+	ASSERT_STATUS(kv.put(ff, "7"), status::OK);
+	ASSERT_STATUS(kv.put(ff + ff, "8"), status::OK);
+	ASSERT_STATUS(kv.put("B" + ff, "9"), status::OK);
+	ASSERT_STATUS(kv.put("B" + ff + "A", "10"), status::OK);
+
+	expected = kv_list{{ff, "7"}, {ff + ff, "8"}};
+	UT_ASSERT(get_prefix(kv, ff) == expected);
+
+	expected = kv_list{{"B" + ff, "9"}, {"B" + ff + "A", "10"}};
+	UT_ASSERT(get_prefix(kv, "B" + ff) == expected);
+
+	/* callback can stop the iteration */
+	std::size_t cnt = 0;
+	auto s = kv.get_prefix("B", [&](string_view k, string_view v) {
+		return ++cnt == 2 ? 1 : 0;
+	});
+	ASSERT_STATUS(s, status::STOPPED_BY_CB);
+	UT_ASSERT(cnt == 2);
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void GetPrefixRangeTest(std::string engine, pmem::kv::config &&config,
+			       const size_t items)
+{
+	/**
+	 * TEST: Prefixes matching ranges spanning many nodes of the engine's
+	 * structure.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	for (size_t i = 0; i < items; ++i)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i)), status::OK);
+
+	/* keys differ in the last digits only */
+	for (size_t i = 0; i < items; i += 100) {
+		auto prefix = num_key(i).substr(0, 8);
+
+		kv_list expected;
+		for (size_t j = i; j < std::min(i + 100, items); ++j)
+			expected.emplace_back(num_key(j), std::to_string(j));
+
+		UT_ASSERT(get_prefix(kv, prefix) == expected);
+	}
+
+	kv_list expected;
+	for (size_t i = 0; i < items; ++i)
+		expected.emplace_back(num_key(i), std::to_string(i));
+	UT_ASSERT(get_prefix(kv, num_key(0).substr(0, 5)) == expected);
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config items", argv[0]);
+
+	auto engine = std::string(argv[1]);
+	size_t items = std::stoull(argv[3]);
+
+	GetPrefixTest(engine, CONFIG_FROM_JSON(argv[2]));
+	GetPrefixRangeTest(engine, CONFIG_FROM_JSON(argv[2]), items);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
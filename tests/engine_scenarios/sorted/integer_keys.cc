@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/**
+ * Tests sorted engines with 8-byte (big-endian integer) keys - enough of them
+ * (in ascending, descending and random order) to fill and split internal
+ * structures, with removes, range queries and iterators. Also checks keys of
+ * other sizes are rejected, for engines which support only 8-byte ones.
+ */
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "../iterator.hpp"
+
+static const size_t N_KEYS = 5000;
+
+static std::string int_key(uint64_t k)
+{
+	std::string key(8, '\0');
+	for (size_t i = 8; i > 0; --i) {
+		key[i - 1] = static_cast<char>(k & 0xff);
+		k >>= 8;
+	}
+
+	return key;
+}
+
+static std::vector<uint64_t> numbers(int order)
+{
+	std::vector<uint64_t> n(N_KEYS);
+	for (size_t i = 0; i < N_KEYS; ++i)
+		n[i] = i * 7 + 3;
+
+	if (order < 0)
+		std::reverse(n.begin(), n.end());
+	else if (order == 0)
+		std::shuffle(n.begin(), n.end(), std::mt19937_64(N_KEYS));
+
+	return n;
+}
+
+static void verify(pmem::kv::db &kv, const std::map<std::string, std::string> &expected)
+{
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, expected.size());
+
+	std::vector<pair> all;
+	ASSERT_STATUS(kv.get_all([&](pmem::kv::string_view k, pmem::kv::string_view v) {
+		all.emplace_back(std::string(k.data(), k.size()),
+				 std::string(v.data(), v.size()));
+		return 0;
+	}),
+		      pmem::kv::status::OK);
+	UT_ASSERT(all == std::vector<pair>(expected.begin(), expected.end()));
+
+	for (auto &e : expected) {
+		std::string value;
+		ASSERT_STATUS(kv.get(e.first, &value), pmem::kv::status::OK);
+		UT_ASSERT(value == e.second);
+	}
+}
+
+template <int Order>
+static void put_remove_test(pmem::kv::db &kv)
+{
+	std::map<std::string, std::string> expected;
+	for (auto n : numbers(Order)) {
+		auto value = std::to_string(n);
+		ASSERT_STATUS(kv.put(int_key(n), value), pmem::kv::status::OK);
+		expected[int_key(n)] = value;
+	}
+	verify(kv, expected);
+
+	/* keys between the inserted ones */
+	ASSERT_STATUS(kv.exists(int_key(4)), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(kv.exists(int_key(N_KEYS * 7 + 3)), pmem::kv::status::NOT_FOUND);
+
+	/* overwrites, removes and inserts in place of removed keys */
+	for (auto n : numbers(Order)) {
+		if (n % 3 == 0) {
+			ASSERT_STATUS(kv.remove(int_key(n)), pmem::kv::status::OK);
+			ASSERT_STATUS(kv.remove(int_key(n)), pmem::kv::status::NOT_FOUND);
+			expected.erase(int_key(n));
+		} else if (n % 3 == 1) {
+			ASSERT_STATUS(kv.put(int_key(n), "updated"), pmem::kv::status::OK);
+			expected[int_key(n)] = "updated";
+		}
+	}
+	verify(kv, expected);
+
+	for (auto n : numbers(Order)) {
+		if (n % 3 == 0) {
+			ASSERT_STATUS(kv.put(int_key(n), "again"), pmem::kv::status::OK);
+			expected[int_key(n)] = "again";
+		}
+	}
+	verify(kv, expected);
+}
+
+static void range_test(pmem::kv::db &kv)
+{
+	std::map<std::string, std::string> expected;
+	for (auto n : numbers(0)) {
+		ASSERT_STATUS(kv.put(int_key(n), "v"), pmem::kv::status::OK);
+		expected[int_key(n)] = "v";
+	}
+
+	auto low = int_key(700 * 7 + 3);
+	auto high = int_key(3000 * 7 + 3);
+
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_between(low, high, cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 2299);
+	ASSERT_STATUS(kv.count_equal_above(low, cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, N_KEYS - 700);
+	ASSERT_STATUS(kv.count_below(high, cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 3000);
+
+	/* bounds of other sizes are compared bytewise, as keys */
+	ASSERT_STATUS(kv.count_above(low.substr(0, 6), cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, N_KEYS);
+	ASSERT_STATUS(kv.count_above(low + "x", cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, N_KEYS - 701);
+	ASSERT_STATUS(kv.count_below(low + "x", cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 701);
+
+	std::vector<std::string> keys;
+	ASSERT_STATUS(kv.get_between(low, high,
+				     [&](pmem::kv::string_view k, pmem::kv::string_view) {
+					     keys.emplace_back(k.data(), k.size());
+					     return 0;
+				     }),
+		      pmem::kv::status::OK);
+	auto first = expected.upper_bound(low);
+	auto last = expected.lower_bound(high);
+	UT_ASSERTeq(keys.size(), 2299);
+	UT_ASSERT(std::equal(keys.begin(), keys.end(), first, [](const std::string &k,
+								  const pair &p) {
+		return k == p.first;
+	}));
+	UT_ASSERT(std::prev(last)->first == keys.back());
+}
+
+template <bool IsConst>
+static void iterator_test(pmem::kv::db &kv)
+{
+	for (auto n : numbers(0))
+		ASSERT_STATUS(kv.put(int_key(n), std::to_string(n)), pmem::kv::status::OK);
+
+	auto it = new_iterator<IsConst>(kv);
+
+	ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::OK);
+	size_t visited = 1;
+	verify_key<IsConst>(it, int_key(3));
+	while (it.next() == pmem::kv::status::OK)
+		visited++;
+	UT_ASSERTeq(visited, N_KEYS);
+
+	ASSERT_STATUS(it.seek_to_last(), pmem::kv::status::OK);
+	verify_key<IsConst>(it, int_key((N_KEYS - 1) * 7 + 3));
+	ASSERT_STATUS(it.prev(), pmem::kv::status::OK);
+	verify_key<IsConst>(it, int_key((N_KEYS - 2) * 7 + 3));
+
+	ASSERT_STATUS(it.seek(int_key(10)), pmem::kv::status::OK);
+	verify_value<IsConst>(it, "10");
+	ASSERT_STATUS(it.seek(int_key(11)), pmem::kv::status::NOT_FOUND);
+
+	ASSERT_STATUS(it.seek_higher(int_key(10)), pmem::kv::status::OK);
+	verify_key<IsConst>(it, int_key(17));
+	ASSERT_STATUS(it.seek_higher_eq(int_key(11)), pmem::kv::status::OK);
+	verify_key<IsConst>(it, int_key(17));
+	ASSERT_STATUS(it.seek_lower(int_key(10)), pmem::kv::status::OK);
+	verify_key<IsConst>(it, int_key(3));
+	ASSERT_STATUS(it.seek_lower_eq(int_key(16)), pmem::kv::status::OK);
+	verify_key<IsConst>(it, int_key(10));
+	ASSERT_STATUS(it.seek_lower(int_key(3)), pmem::kv::status::NOT_FOUND);
+
+	ASSERT_STATUS(it.set_upper_bound(int_key(31)), pmem::kv::status::OK);
+	ASSERT_STATUS(it.seek_higher(int_key(17)), pmem::kv::status::OK);
+	verify_key<IsConst>(it, int_key(24));
+	ASSERT_STATUS(it.next(), pmem::kv::status::NOT_FOUND);
+}
+
+static void write_iterator_test(pmem::kv::db &kv)
+{
+	for (auto n : numbers(1))
+		ASSERT_STATUS(kv.put(int_key(n), "value"), pmem::kv::status::OK);
+
+	auto it = new_iterator<false>(kv);
+	ASSERT_STATUS(it.seek(int_key(700 * 7 + 3)), pmem::kv::status::OK);
+
+	auto range = it.write_range(1, 3);
+	UT_ASSERT(range.is_ok());
+	std::fill(range.get_value().begin(), range.get_value().end(), 'X');
+	ASSERT_STATUS(it.commit(), pmem::kv::status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get(int_key(700 * 7 + 3), &value), pmem::kv::status::OK);
+	UT_ASSERT(value == "vXXXe");
+}
+
+static void key_size_test(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put("key", "value"), pmem::kv::status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.put(int_key(1) + "x", "value"),
+		      pmem::kv::status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.exists("key"), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(kv.remove("key"), pmem::kv::status::NOT_FOUND);
+
+	std::size_t cnt;
+	ASSERT_STATUS(kv.count_all(cnt), pmem::kv::status::OK);
+	UT_ASSERTeq(cnt, 0);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config fixed_size_only", argv[0]);
+
+	std::vector<std::function<void(pmem::kv::db &)>> tests = {
+		put_remove_test<1>,  put_remove_test<-1>,   put_remove_test<0>,
+		range_test,	     iterator_test<true>,   iterator_test<false>,
+		write_iterator_test,
+	};
+	if (std::string(argv[3]) == "1")
+		tests.push_back(key_size_test);
+
+	run_engine_tests(argv[1], argv[2], tests);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
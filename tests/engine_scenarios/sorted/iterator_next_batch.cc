@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/**
+ * Tests reading records in batches by iterators (next_batch), in sorted order.
+ */
+
+#include <map>
+#include <vector>
+
+#include "../iterator.hpp"
+
+static const size_t N_KEYS = 100;
+
+static std::map<std::string, std::string> insert_n_keys(pmem::kv::db &kv)
+{
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		auto k = entry_from_number(i, "", "k");
+		auto v = entry_from_number(i, "", "v");
+		ASSERT_STATUS(kv.put(k, v), pmem::kv::status::OK);
+		expected[k] = v;
+	}
+
+	return expected;
+}
+
+template <bool IsConst>
+static void next_batch_scan_test(pmem::kv::db &kv)
+{
+	const size_t BATCH = 7;
+
+	auto expected = insert_n_keys(kv);
+	auto it = new_iterator<IsConst>(kv);
+
+	std::vector<pair> visited;
+	pmem::kv::string_view keys[BATCH], values[BATCH];
+
+	ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::OK);
+	while (true) {
+		auto res = it.next_batch(BATCH, keys, values);
+		if (!res.is_ok()) {
+			ASSERT_STATUS(res.get_status(), pmem::kv::status::NOT_FOUND);
+			break;
+		}
+
+		auto cnt = res.get_value();
+		UT_ASSERT(cnt > 0 && cnt <= BATCH);
+		for (size_t i = 0; i < cnt; ++i) {
+			auto &v = values[i];
+			visited.emplace_back(std::string(keys[i].data(), keys[i].size()),
+					     std::string(v.data(), v.size()));
+		}
+	}
+
+	UT_ASSERT(visited == std::vector<pair>(expected.begin(), expected.end()));
+}
+
+template <bool IsConst>
+static void next_batch_position_test(pmem::kv::db &kv)
+{
+	auto expected = insert_n_keys(kv);
+	auto it = new_iterator<IsConst>(kv);
+
+	std::vector<pmem::kv::string_view> keys(N_KEYS), values(N_KEYS);
+
+	/* the batch starts at the current record... */
+	auto first = std::next(expected.begin(), N_KEYS / 2);
+	ASSERT_STATUS(it.seek(first->first), pmem::kv::status::OK);
+	auto res = it.next_batch(3, keys.data(), values.data());
+	UT_ASSERT(res.is_ok());
+	UT_ASSERTeq(res.get_value(), 3);
+	for (size_t i = 0; i < 3; ++i, ++first) {
+		UT_ASSERTeq(keys[i].compare(first->first), 0);
+		UT_ASSERTeq(values[i].compare(first->second), 0);
+	}
+
+	/* ... and the iterator is left on the next one */
+	verify_key<IsConst>(it, first->first);
+	verify_value<IsConst>(it, first->second);
+
+	/* a batch larger than the rest of records returns all of them */
+	res = it.next_batch(N_KEYS, keys.data(), values.data());
+	UT_ASSERT(res.is_ok());
+	UT_ASSERTeq(res.get_value(),
+		    static_cast<size_t>(std::distance(first, expected.end())));
+	UT_ASSERTeq(keys[res.get_value() - 1].compare(expected.rbegin()->first), 0);
+
+	res = it.next_batch(N_KEYS, keys.data(), values.data());
+	ASSERT_STATUS(res.get_status(), pmem::kv::status::NOT_FOUND);
+}
+
+template <bool IsConst>
+static void next_batch_keys_only_test(pmem::kv::db &kv)
+{
+	const size_t BATCH = 7;
+
+	auto expected = insert_n_keys(kv);
+	auto it = new_iterator<IsConst>(kv);
+
+	std::vector<std::string> visited;
+	pmem::kv::string_view keys[BATCH];
+
+	ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::OK);
+	while (true) {
+		auto res = it.next_batch(BATCH, keys);
+		if (!res.is_ok()) {
+			ASSERT_STATUS(res.get_status(), pmem::kv::status::NOT_FOUND);
+			break;
+		}
+
+		for (size_t i = 0; i < res.get_value(); ++i)
+			visited.emplace_back(keys[i].data(), keys[i].size());
+	}
+
+	UT_ASSERTeq(visited.size(), expected.size());
+	auto e = expected.begin();
+	for (auto &k : visited)
+		UT_ASSERT(k == (e++)->first);
+}
+
+static void next_batch_write_test(pmem::kv::db &kv)
+{
+	auto expected = insert_n_keys(kv);
+	auto it = new_iterator<false>(kv);
+
+	pmem::kv::string_view keys[2], values[2];
+
+	/* uncommitted changes are aborted by next_batch */
+	auto first = expected.begin();
+	ASSERT_STATUS(it.seek(first->first), pmem::kv::status::OK);
+	auto range = it.write_range();
+	UT_ASSERT(range.is_ok());
+	for (auto &c : range.get_value())
+		c = 'x';
+
+	auto res = it.next_batch(2, keys, values);
+	UT_ASSERT(res.is_ok());
+	UT_ASSERTeq(values[0].compare(first->second), 0);
+
+	ASSERT_STATUS(it.commit(), pmem::kv::status::OK);
+	std::string value;
+	ASSERT_STATUS(kv.get(first->first, &value), pmem::kv::status::OK);
+	UT_ASSERT(value == first->second);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 next_batch_scan_test<true>,
+				 next_batch_scan_test<false>,
+				 next_batch_position_test<true>,
+				 next_batch_position_test<false>,
+				 next_batch_keys_only_test<true>,
+				 next_batch_keys_only_test<false>,
+				 next_batch_write_test,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/**
+ * Tests seeks of a single iterator to mostly increasing keys (as in a merge
+ * join or a skip scan), which engines may search from the current position.
+ * Targets are near and far from the previous one, between present keys and
+ * sometimes below the previous one.
+ */
+
+#include <cstdio>
+#include <map>
+
+#include "../iterator.hpp"
+
+static const size_t N_KEYS = 2000;
+
+/* fixed width, so the order of numbers is the order of keys */
+static std::string key_from_number(size_t number)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "key%08zu", number);
+	return buf;
+}
+
+template <bool IsConst>
+static void verify_seek(iterator<IsConst> &it, pmem::kv::status s,
+			const std::map<std::string, std::string> &expected,
+			std::map<std::string, std::string>::const_iterator e)
+{
+	if (e == expected.end()) {
+		ASSERT_STATUS(s, pmem::kv::status::NOT_FOUND);
+		return;
+	}
+
+	ASSERT_STATUS(s, pmem::kv::status::OK);
+	verify_key<IsConst>(it, e->first);
+	verify_value<IsConst>(it, e->second);
+}
+
+template <bool IsConst>
+static void skip_scan_test(pmem::kv::db &kv)
+{
+	/* only even numbers are present */
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < N_KEYS; i += 2) {
+		auto k = key_from_number(i);
+		auto v = "v" + std::to_string(i);
+		ASSERT_STATUS(kv.put(k, v), pmem::kv::status::OK);
+		expected[k] = v;
+	}
+
+	auto it = new_iterator<IsConst>(kv);
+
+	size_t target = 0;
+	for (size_t step = 0; target < N_KEYS + 10; ++step) {
+		auto key = key_from_number(target);
+
+		switch (step % 4) {
+			case 0:
+				verify_seek<IsConst>(it, it.seek_higher_eq(key), expected,
+						     expected.lower_bound(key));
+				break;
+			case 1:
+				verify_seek<IsConst>(it, it.seek_higher(key), expected,
+						     expected.upper_bound(key));
+				break;
+			case 2: {
+				auto e = expected.find(key);
+				verify_seek<IsConst>(it, it.seek(key), expected, e);
+				break;
+			}
+			case 3: {
+				auto e = expected.upper_bound(key);
+				e = e == expected.begin() ? expected.end() : std::prev(e);
+				verify_seek<IsConst>(it, it.seek_lower_eq(key), expected, e);
+				break;
+			}
+		}
+
+		/* strides from 1 to 60 keys, every 50th seek goes back */
+		if (step % 50 == 49 && target > 300)
+			target -= 300;
+		else
+			target += 1 + (step * 7) % 60;
+	}
+}
+
+template <bool IsConst>
+static void skip_scan_next_test(pmem::kv::db &kv)
+{
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		auto k = key_from_number(i);
+		ASSERT_STATUS(kv.put(k, k), pmem::kv::status::OK);
+		expected[k] = k;
+	}
+
+	/* moves by next() and seeks interleaved */
+	auto it = new_iterator<IsConst>(kv);
+	for (size_t target = 0; target < N_KEYS; target += 37) {
+		auto key = key_from_number(target);
+		verify_seek<IsConst>(it, it.seek_higher_eq(key), expected,
+				     expected.find(key));
+
+		auto e = expected.find(key);
+		for (int i = 0; i < 5 && ++e != expected.end(); ++i)
+			verify_seek<IsConst>(it, it.next(), expected, e);
+	}
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 skip_scan_test<true>,
+				 skip_scan_test<false>,
+				 skip_scan_next_test<true>,
+				 skip_scan_next_test<false>,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
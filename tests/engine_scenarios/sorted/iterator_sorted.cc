@@ -1,8 +1,12 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #include "../iterator.hpp"
 
+#include <algorithm>
+#include <functional>
+#include <vector>
+
 /**
  * Test methods available only in sorted engines' iterators.
  */
@@ -103,6 +107,36 @@ static void seek_higher_eq_test(pmem::kv::db &kv)
 	});
 }
 
+template <bool IsConst>
+static void seek_prefix_test(pmem::kv::db &kv)
+{
+	auto it = new_iterator<IsConst>(kv);
+
+	std::for_each(keys.begin(), keys.end(), [&](pair p) {
+		ASSERT_STATUS(it.seek_prefix(p.first), pmem::kv::status::NOT_FOUND);
+	});
+
+	insert_keys(kv);
+
+	std::for_each(keys.begin(), keys.end(), [&](pair p) {
+		ASSERT_STATUS(it.seek_prefix(p.first.substr(0, 1)), pmem::kv::status::OK);
+		verify_key<IsConst>(it, p.first);
+		verify_value<IsConst>(it, p.second);
+
+		ASSERT_STATUS(it.seek_prefix(p.first), pmem::kv::status::OK);
+		verify_key<IsConst>(it, p.first);
+
+		/* the next key is higher, but doesn't start with the prefix */
+		ASSERT_STATUS(it.seek_prefix(p.first + "a"), pmem::kv::status::NOT_FOUND);
+		ASSERT_STATUS(it.seek_prefix(p.first.substr(0, 2) + "z"),
+			      pmem::kv::status::NOT_FOUND);
+	});
+
+	/* empty prefix matches the first key */
+	ASSERT_STATUS(it.seek_prefix(""), pmem::kv::status::OK);
+	verify_key<IsConst>(it, keys[0].first);
+}
+
 template <bool IsConst>
 static void next_test(pmem::kv::db &kv)
 {
@@ -145,6 +179,32 @@ static void prev_test(pmem::kv::db &kv)
 	ASSERT_STATUS(it.prev(), pmem::kv::status::NOT_FOUND);
 }
 
+/* scans back over enough records to cross many nodes of tree-based engines */
+template <bool IsConst>
+static void prev_scan_test(pmem::kv::db &kv)
+{
+	const size_t n = 1000;
+
+	std::vector<std::string> expected;
+	for (size_t i = 0; i < n; ++i) {
+		expected.push_back(entry_from_number(i, "", "k"));
+		ASSERT_STATUS(kv.put(expected.back(), "v"), pmem::kv::status::OK);
+	}
+	std::sort(expected.begin(), expected.end(), std::greater<std::string>());
+
+	auto it = new_iterator<IsConst>(kv);
+	ASSERT_STATUS(it.seek_to_last(), pmem::kv::status::OK);
+
+	std::vector<std::string> visited;
+	do {
+		auto key = it.key();
+		UT_ASSERT(key.is_ok());
+		visited.emplace_back(key.get_value().data(), key.get_value().size());
+	} while (it.prev() == pmem::kv::status::OK);
+
+	UT_ASSERT(visited == expected);
+}
+
 template <bool IsConst>
 static void seek_to_first_test(pmem::kv::db &kv)
 {
@@ -260,6 +320,8 @@ static void test(int argc, char *argv[])
 				 seek_higher_test<false>,
 				 seek_higher_eq_test<true>,
 				 seek_higher_eq_test<false>,
+				 seek_prefix_test<true>,
+				 seek_prefix_test<false>,
 				 next_test<true>,
 				 next_test<false>,
 				 seek_to_first_test<true>,
@@ -273,6 +335,8 @@ static void test(int argc, char *argv[])
 				 {
 					 prev_test<true>,
 					 prev_test<false>,
+					 prev_scan_test<true>,
+					 prev_scan_test<false>,
 					 seek_to_last_test<true>,
 					 seek_to_last_test<false>,
 					 seek_to_last_write_test,
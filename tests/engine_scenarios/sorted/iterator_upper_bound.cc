@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/**
+ * Tests upper bound of iterators (set_upper_bound) - forward moves stop at
+ * keys not lower than the bound, other moves are not affected.
+ */
+
+#include <map>
+#include <vector>
+
+#include "../iterator.hpp"
+
+static const size_t N_KEYS = 100;
+
+static std::map<std::string, std::string> insert_n_keys(pmem::kv::db &kv)
+{
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		auto k = entry_from_number(i, "", "k");
+		auto v = entry_from_number(i, "", "v");
+		ASSERT_STATUS(kv.put(k, v), pmem::kv::status::OK);
+		expected[k] = v;
+	}
+
+	return expected;
+}
+
+template <bool IsConst>
+static std::vector<std::string> scan(iterator<IsConst> &it)
+{
+	std::vector<std::string> visited;
+	if (it.seek_to_first() != pmem::kv::status::OK)
+		return visited;
+
+	do {
+		auto key = it.key();
+		UT_ASSERT(key.is_ok());
+		visited.emplace_back(key.get_value().data(), key.get_value().size());
+	} while (it.next() == pmem::kv::status::OK);
+
+	return visited;
+}
+
+template <bool IsConst>
+static void upper_bound_scan_test(pmem::kv::db &kv)
+{
+	auto expected = insert_n_keys(kv);
+	auto it = new_iterator<IsConst>(kv);
+
+	auto bound = std::next(expected.begin(), N_KEYS / 2);
+	ASSERT_STATUS(it.set_upper_bound(bound->first), pmem::kv::status::OK);
+
+	std::vector<std::string> expected_keys;
+	for (auto e = expected.begin(); e != bound; ++e)
+		expected_keys.push_back(e->first);
+	UT_ASSERT(scan<IsConst>(it) == expected_keys);
+	ASSERT_STATUS(it.next(), pmem::kv::status::NOT_FOUND);
+
+	/* a bound between keys */
+	ASSERT_STATUS(it.set_upper_bound(bound->first + "0"), pmem::kv::status::OK);
+	expected_keys.push_back(bound->first);
+	UT_ASSERT(scan<IsConst>(it) == expected_keys);
+
+	/* the bound can be removed */
+	ASSERT_STATUS(it.clear_upper_bound(), pmem::kv::status::OK);
+	UT_ASSERTeq(scan<IsConst>(it).size(), N_KEYS);
+
+	/* an empty key is the lowest one */
+	ASSERT_STATUS(it.set_upper_bound(""), pmem::kv::status::OK);
+	ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::NOT_FOUND);
+}
+
+template <bool IsConst>
+static void upper_bound_seek_test(pmem::kv::db &kv)
+{
+	auto expected = insert_n_keys(kv);
+	auto it = new_iterator<IsConst>(kv);
+
+	auto bound = std::next(expected.begin(), N_KEYS / 2);
+	auto last = std::prev(bound);
+	ASSERT_STATUS(it.set_upper_bound(bound->first), pmem::kv::status::OK);
+
+	ASSERT_STATUS(it.seek_higher_eq(bound->first), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(it.seek_higher(last->first), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(it.seek_higher_eq(last->first), pmem::kv::status::OK);
+	verify_key<IsConst>(it, last->first);
+	ASSERT_STATUS(it.is_next(), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(it.next(), pmem::kv::status::NOT_FOUND);
+
+	/* other moves are not affected */
+	auto above = std::next(bound, 10);
+	ASSERT_STATUS(it.seek(above->first), pmem::kv::status::OK);
+	verify_key<IsConst>(it, above->first);
+	ASSERT_STATUS(it.next(), pmem::kv::status::NOT_FOUND);
+
+	ASSERT_STATUS(it.seek_lower_eq(bound->first), pmem::kv::status::OK);
+	verify_key<IsConst>(it, bound->first);
+	ASSERT_STATUS(it.seek_lower(bound->first), pmem::kv::status::OK);
+	verify_key<IsConst>(it, last->first);
+}
+
+template <bool IsConst>
+static void upper_bound_next_batch_test(pmem::kv::db &kv)
+{
+	const size_t BATCH = 7;
+
+	auto expected = insert_n_keys(kv);
+	auto it = new_iterator<IsConst>(kv);
+
+	auto bound = std::next(expected.begin(), N_KEYS / 2);
+	ASSERT_STATUS(it.set_upper_bound(bound->first), pmem::kv::status::OK);
+
+	std::vector<pair> visited;
+	pmem::kv::string_view keys[BATCH], values[BATCH];
+
+	ASSERT_STATUS(it.seek_to_first(), pmem::kv::status::OK);
+	while (true) {
+		auto res = it.next_batch(BATCH, keys, values);
+		if (!res.is_ok()) {
+			ASSERT_STATUS(res.get_status(), pmem::kv::status::NOT_FOUND);
+			break;
+		}
+
+		for (size_t i = 0; i < res.get_value(); ++i) {
+			auto &v = values[i];
+			visited.emplace_back(std::string(keys[i].data(), keys[i].size()),
+					     std::string(v.data(), v.size()));
+		}
+	}
+
+	UT_ASSERT(visited == std::vector<pair>(expected.begin(), bound));
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 upper_bound_scan_test<true>,
+				 upper_bound_scan_test<false>,
+				 upper_bound_seek_test<true>,
+				 upper_bound_seek_test<false>,
+				 upper_bound_next_batch_test<true>,
+				 upper_bound_next_batch_test<false>,
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
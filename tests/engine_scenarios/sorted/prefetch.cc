@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "iterate.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+/**
+ * Tests for prefetch and prefetch_range methods for sorted engines. They
+ * only queue a walk over the keys, which must not change the records and
+ * may still be running when the records are modified or the db is closed.
+ */
+
+static std::string num_key(size_t i)
+{
+	std::ostringstream s;
+	s << std::setw(10) << std::setfill('0') << i;
+	return s.str();
+}
+
+static void PrefetchTest(std::string engine, pmem::kv::config &&config,
+			 const size_t items)
+{
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	/* empty db, reversed and empty ranges */
+	ASSERT_STATUS(kv.prefetch(num_key(0)), status::OK);
+	ASSERT_STATUS(kv.prefetch_range(num_key(0), num_key(items)), status::OK);
+	ASSERT_STATUS(kv.prefetch_range(num_key(items), num_key(0)), status::OK);
+	ASSERT_STATUS(kv.prefetch_range(EMPTY_KEY, EMPTY_KEY), status::OK);
+
+	for (size_t i = 0; i < items; ++i)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i)), status::OK);
+
+	/* more requests than can be queued, the rest is dropped */
+	for (size_t i = 0; i < items; ++i) {
+		ASSERT_STATUS(kv.prefetch(num_key(i)), status::OK);
+		ASSERT_STATUS(kv.prefetch_range(num_key(i), num_key(items)), status::OK);
+	}
+
+	/* records are modified while they may be walked */
+	for (size_t i = 0; i < items; i += 2)
+		ASSERT_STATUS(kv.remove(num_key(i)), status::OK);
+	for (size_t i = 1; i < items; i += 2)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i * 2)), status::OK);
+
+	ASSERT_STATUS(kv.prefetch_range(EMPTY_KEY, MAX_KEY), status::OK);
+
+	std::string value;
+	for (size_t i = 0; i < items; ++i) {
+		if (i % 2 == 0) {
+			ASSERT_STATUS(kv.get(num_key(i), &value), status::NOT_FOUND);
+		} else {
+			ASSERT_STATUS(kv.get(num_key(i), &value), status::OK);
+			UT_ASSERT(value == std::to_string(i * 2));
+		}
+	}
+
+	/* closed with walks still queued */
+	ASSERT_STATUS(kv.prefetch_range(EMPTY_KEY, MAX_KEY), status::OK);
+	kv.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config items", argv[0]);
+
+	auto engine = std::string(argv[1]);
+	size_t items = std::stoull(argv[3]);
+
+	PrefetchTest(engine, CONFIG_FROM_JSON(argv[2]), items);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
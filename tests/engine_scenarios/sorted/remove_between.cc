@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "iterate.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+/**
+ * Tests for remove_between method for sorted engines. remove_between removes
+ * all elements in db with keys greater than key1 and lesser than key2 and
+ * returns the number of removed elements.
+ */
+
+static std::string num_key(size_t i)
+{
+	std::ostringstream s;
+	s << std::setw(10) << std::setfill('0') << i;
+	return s.str();
+}
+
+static void RemoveBetweenTest(std::string engine, pmem::kv::config &&config)
+{
+	/**
+	 * TEST: Basic test with hardcoded strings.
+	 * It's NOT suitable to test with custom comparator.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	std::size_t cnt = 1;
+	ASSERT_STATUS(kv.remove_between(MIN_KEY, MAX_KEY, cnt), status::OK);
+	UT_ASSERT(cnt == 0);
+
+	add_basic_keys(kv);
+
+	/* empty and reversed ranges don't remove anything */
+	cnt = 1;
+	ASSERT_STATUS(kv.remove_between("B", "B", cnt), status::OK);
+	UT_ASSERT(cnt == 0);
+	cnt = 1;
+	ASSERT_STATUS(kv.remove_between("C", "A", cnt), status::OK);
+	UT_ASSERT(cnt == 0);
+	cnt = 1;
+	ASSERT_STATUS(kv.remove_between("AC", "B", cnt), status::OK);
+	UT_ASSERT(cnt == 0);
+	ASSERT_SIZE(kv, 6);
+
+	/* the keys themselves are not removed */
+	ASSERT_STATUS(kv.remove_between("A", "B", cnt), status::OK);
+	UT_ASSERT(cnt == 2);
+
+	auto expected = kv_list{{"A", "1"}, {"B", "4"}, {"BB", "5"}, {"BC", "6"}};
+	verify_get_all(kv, 4, kv_sort(expected));
+
+	ASSERT_STATUS(kv.remove_between("AZ", "BC", cnt), status::OK);
+	UT_ASSERT(cnt == 2);
+
+	expected = kv_list{{"A", "1"}, {"BC", "6"}};
+	verify_get_all(kv, 2, kv_sort(expected));
+
+	/* removed keys can be inserted again */
+	ASSERT_STATUS(kv.put("AB", "7"), status::OK);
+	ASSERT_STATUS(kv.put("B", "8"), status::OK);
+
+	expected = kv_list{{"A", "1"}, {"AB", "7"}, {"B", "8"}, {"BC", "6"}};
+	verify_get_all(kv, 4, kv_sort(expected));
+
+	ASSERT_STATUS(kv.remove_between(EMPTY_KEY, MAX_KEY, cnt), status::OK);
+	UT_ASSERT(cnt == 4);
+	verify_get_all(kv, 0, kv_list());
+
+	ASSERT_STATUS(kv.put("A", "1"), status::OK);
+	verify_get_all(kv, 1, kv_list{{"A", "1"}});
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void RemoveBetweenRangeTest(std::string engine, pmem::kv::config &&config,
+				   const size_t items)
+{
+	/**
+	 * TEST: Removes ranges spanning many nodes of the engine's structure,
+	 * checks all remaining elements are still in order and reachable.
+	 */
+	auto kv = INITIALIZE_KV(engine, std::move(config));
+
+	for (size_t i = 0; i < items; ++i)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i)), status::OK);
+
+	auto first = items / 4;
+	auto last = items - items / 4;
+
+	std::size_t cnt;
+	ASSERT_STATUS(kv.remove_between(num_key(first), num_key(last), cnt), status::OK);
+	UT_ASSERT(cnt == last - first - 1);
+
+	kv_list expected;
+	for (size_t i = 0; i < items; ++i) {
+		if (i <= first || i >= last)
+			expected.emplace_back(num_key(i), std::to_string(i));
+	}
+	verify_get_all(kv, expected.size(), expected);
+
+	for (size_t i = 0; i < items; ++i) {
+		auto s = (i <= first || i >= last) ? status::OK : status::NOT_FOUND;
+		ASSERT_STATUS(kv.exists(num_key(i)), s);
+	}
+
+	/* range starting before the first key */
+	ASSERT_STATUS(kv.remove_between(EMPTY_KEY, num_key(first / 2), cnt), status::OK);
+	UT_ASSERT(cnt == first / 2);
+
+	/* range ending after the last key */
+	ASSERT_STATUS(kv.remove_between(num_key(last), MAX_KEY, cnt), status::OK);
+	UT_ASSERT(cnt == items - last - 1);
+
+	std::size_t left;
+	ASSERT_STATUS(kv.count_all(left), status::OK);
+	UT_ASSERT(left == items - (last - first - 1) - first / 2 - (items - last - 1));
+
+	/* fill the removed range again */
+	for (size_t i = first + 1; i < last; ++i)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i)), status::OK);
+	ASSERT_SIZE(kv, left + (last - first - 1));
+
+	ASSERT_STATUS(kv.remove_between(EMPTY_KEY, MAX_KEY, cnt), status::OK);
+	UT_ASSERT(cnt == left + (last - first - 1));
+	verify_get_all(kv, 0, kv_list());
+
+	for (size_t i = 0; i < items; ++i)
+		ASSERT_STATUS(kv.put(num_key(i), std::to_string(i)), status::OK);
+	ASSERT_SIZE(kv, items);
+
+	CLEAR_KV(kv);
+	kv.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config items", argv[0]);
+
+	auto engine = std::string(argv[1]);
+	size_t items = std::stoull(argv[3]);
+
+	RemoveBetweenTest(engine, CONFIG_FROM_JSON(argv[2]));
+	RemoveBetweenRangeTest(engine, CONFIG_FROM_JSON(argv[2]), items);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
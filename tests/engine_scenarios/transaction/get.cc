@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests get in transactions: reads of own (buffered) writes and, for engines
+ * which validate reads, conflicts with concurrent writes.
+ */
+
+static void test_get_own_writes(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put("a", "old"), pmem::kv::status::OK);
+
+	auto tx = kv.tx_begin().get_value();
+
+	std::string value;
+	ASSERT_STATUS(tx.get("a", &value), pmem::kv::status::OK);
+	UT_ASSERT(value == "old");
+	ASSERT_STATUS(tx.get("b", &value), pmem::kv::status::NOT_FOUND);
+
+	ASSERT_STATUS(tx.put("a", "new"), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.put("b", ""), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.get("a", &value), pmem::kv::status::OK);
+	UT_ASSERT(value == "new");
+	ASSERT_STATUS(tx.get("b", &value), pmem::kv::status::OK);
+	UT_ASSERT(value == "");
+
+	ASSERT_STATUS(tx.remove("a"), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.get("a", &value), pmem::kv::status::NOT_FOUND);
+
+	/* nothing is visible outside of the transaction */
+	ASSERT_STATUS(kv.get("a", &value), pmem::kv::status::OK);
+	UT_ASSERT(value == "old");
+	ASSERT_STATUS(kv.exists("b"), pmem::kv::status::NOT_FOUND);
+
+	ASSERT_STATUS(tx.commit(), pmem::kv::status::OK);
+
+	ASSERT_STATUS(kv.exists("a"), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(kv.get("b", &value), pmem::kv::status::OK);
+	UT_ASSERT(value == "");
+}
+
+static void test_read_modify_write(pmem::kv::db &kv)
+{
+	const int N = 10;
+
+	ASSERT_STATUS(kv.put("counter", "0"), pmem::kv::status::OK);
+
+	auto tx = kv.tx_begin().get_value();
+	for (int i = 0; i < N; i++) {
+		std::string value;
+		ASSERT_STATUS(tx.get("counter", &value), pmem::kv::status::OK);
+		ASSERT_STATUS(tx.put("counter", std::to_string(std::stoi(value) + 1)),
+			      pmem::kv::status::OK);
+	}
+	ASSERT_STATUS(tx.commit(), pmem::kv::status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get("counter", &value), pmem::kv::status::OK);
+	UT_ASSERT(value == std::to_string(N));
+}
+
+static void test_conflict(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put("k", "v1"), pmem::kv::status::OK);
+
+	auto tx = kv.tx_begin().get_value();
+
+	std::string value;
+	ASSERT_STATUS(tx.get("k", &value), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.put("k", value + "+tx"), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.put("other", "x"), pmem::kv::status::OK);
+
+	ASSERT_STATUS(kv.put("k", "v2"), pmem::kv::status::OK);
+
+	ASSERT_STATUS(tx.commit(), pmem::kv::status::TRANSACTION_CONFLICT);
+	ASSERT_STATUS(kv.get("k", &value), pmem::kv::status::OK);
+	UT_ASSERT(value == "v2");
+	ASSERT_STATUS(kv.exists("other"), pmem::kv::status::NOT_FOUND);
+
+	/* the transaction was aborted, it can be retried */
+	ASSERT_STATUS(tx.get("k", &value), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.put("k", value + "+tx"), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.commit(), pmem::kv::status::OK);
+	ASSERT_STATUS(kv.get("k", &value), pmem::kv::status::OK);
+	UT_ASSERT(value == "v2+tx");
+}
+
+static void test_conflict_not_found(pmem::kv::db &kv)
+{
+	std::string value;
+
+	/* key read as missing and inserted by the transaction itself */
+	auto tx = kv.tx_begin().get_value();
+	ASSERT_STATUS(tx.get("a", &value), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(tx.put("a", "1"), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.commit(), pmem::kv::status::OK);
+
+	/* key read as missing and inserted by someone else */
+	ASSERT_STATUS(tx.get("b", &value), pmem::kv::status::NOT_FOUND);
+	ASSERT_STATUS(tx.put("c", "1"), pmem::kv::status::OK);
+	ASSERT_STATUS(kv.put("b", "1"), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.commit(), pmem::kv::status::TRANSACTION_CONFLICT);
+	ASSERT_STATUS(kv.exists("c"), pmem::kv::status::NOT_FOUND);
+
+	/* removed key */
+	ASSERT_STATUS(tx.get("a", &value), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.put("c", value), pmem::kv::status::OK);
+	ASSERT_STATUS(kv.remove("a"), pmem::kv::status::OK);
+	ASSERT_STATUS(tx.commit(), pmem::kv::status::TRANSACTION_CONFLICT);
+	ASSERT_STATUS(kv.exists("c"), pmem::kv::status::NOT_FOUND);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config [validate]", argv[0]);
+
+	std::vector<std::function<void(pmem::kv::db &)>> tests = {test_get_own_writes,
+								  test_read_modify_write};
+	if (argc > 3 && std::string(argv[3]) == "validate") {
+		tests.push_back(test_conflict);
+		tests.push_back(test_conflict_not_found);
+	}
+
+	run_engine_tests(argv[1], argv[2], tests);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include "engines/cmap.h"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+using namespace pmem::kv;
+
+/**
+ * Tests opening of cmap pools created by versions without LAYOUT_VERSION,
+ * which stored their map (with the legacy hash function) directly in the
+ * root object. Such pools are migrated to the current layout on open, also
+ * when a previous migration was interrupted. This test is built together
+ * with pmemkv's sources.
+ */
+
+static const size_t N_ELEMENTS = 10000;
+
+/* root object of the pool, as in pmemobj_engine_base */
+struct root {
+	PMEMoid oid;
+};
+
+static std::string key_of(size_t i)
+{
+	return entry_from_number(i, "key");
+}
+
+/* every 10th value doesn't fit in map's nodes */
+static std::string value_of(size_t i)
+{
+	return entry_from_number(i, "value", i % 10 ? "" : std::string(200, 'x'));
+}
+
+/* Creates the map the way older versions did (legacy_map_t was their map_t) */
+static pmem::obj::persistent_ptr<internal::cmap::legacy_map_t>
+create_legacy_map(pmem::obj::pool<root> &pop)
+{
+	pmem::obj::persistent_ptr<internal::cmap::legacy_map_t> map;
+	pmem::obj::transaction::run(pop, [&] {
+		map = pmem::obj::make_persistent<internal::cmap::legacy_map_t>();
+	});
+
+	map->runtime_initialize();
+	for (size_t i = 0; i < N_ELEMENTS; ++i)
+		map->insert_or_assign(string_view(key_of(i)), string_view(value_of(i)));
+
+	return map;
+}
+
+static void set_root(pmem::obj::pool<root> &pop, PMEMoid oid)
+{
+	pmem::obj::transaction::run(pop, [&] {
+		pmem::obj::transaction::snapshot(&pop.root()->oid);
+		pop.root()->oid = oid;
+	});
+}
+
+static config make_config(std::string path)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_path(path), status::OK);
+
+	return cfg;
+}
+
+static void verify(std::string path)
+{
+	db kv;
+	ASSERT_STATUS(kv.open("cmap", make_config(path)), status::OK);
+
+	ASSERT_SIZE(kv, N_ELEMENTS);
+	for (size_t i = 0; i < N_ELEMENTS; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(key_of(i), &value), status::OK);
+		UT_ASSERT(value == value_of(i));
+	}
+
+	/* the migrated map works with the current hash function */
+	ASSERT_STATUS(kv.remove(key_of(0)), status::OK);
+	ASSERT_STATUS(kv.exists(key_of(0)), status::NOT_FOUND);
+	ASSERT_STATUS(kv.put(key_of(0), value_of(0)), status::OK);
+}
+
+/* Checks that the pool has the current layout, without the legacy map */
+static void verify_migrated(std::string path)
+{
+	auto pop = pmem::obj::pool<root>::open(path, "pmemkv");
+
+	auto oid = pop.root()->oid;
+	UT_ASSERTeq(pmemobj_type_num(oid), internal::cmap::PMEM_TYPE_NUM);
+
+	auto data = static_cast<internal::cmap::pmem_type *>(pmemobj_direct(oid));
+	UT_ASSERT(data->legacy_map == nullptr);
+	UT_ASSERTeq(data->layout_version, internal::cmap::LAYOUT_VERSION);
+
+	/* the legacy map was freed */
+	size_t maps = 0;
+	PMEMoid o;
+	POBJ_FOREACH(pop.handle(), o)
+	{
+		if (pmemobj_type_num(o) ==
+		    pmem::detail::type_num<internal::cmap::legacy_map_t>())
+			++maps;
+	}
+	UT_ASSERTeq(maps, 0);
+
+	pop.close();
+}
+
+static void MigrateTest(std::string path)
+{
+	/**
+	 * TEST: all records of a pool of an older version are kept when it's
+	 * opened and the pool isn't migrated again by the next open.
+	 */
+	auto pop = pmem::obj::pool<root>::open(path, "pmemkv");
+	set_root(pop, create_legacy_map(pop).raw());
+	pop.close();
+
+	verify(path);
+	verify_migrated(path);
+
+	/* the second open finds the current layout */
+	verify(path);
+	verify_migrated(path);
+}
+
+static void MigrateInterruptedTest(std::string path)
+{
+	/**
+	 * TEST: migration interrupted after the legacy map was moved under
+	 * the new root object and some of its elements were already copied
+	 * (as if the process crashed), is finished by the next open.
+	 */
+	auto pop = pmem::obj::pool<root>::open(path, "pmemkv");
+	auto legacy = create_legacy_map(pop);
+
+	/* the state of cmap::Recover() after the layout upgrade transaction */
+	PMEMoid oid = OID_NULL;
+	pmem::obj::transaction::run(pop, [&] {
+		oid = pmemobj_tx_alloc(sizeof(internal::cmap::pmem_type),
+				       internal::cmap::PMEM_TYPE_NUM);
+		auto data = new (pmemobj_direct(oid)) internal::cmap::pmem_type();
+		data->legacy_map = legacy;
+	});
+
+	/* ... and after a part of elements was rehashed by migrate_legacy() */
+	auto data = static_cast<internal::cmap::pmem_type *>(pmemobj_direct(oid));
+	data->map.runtime_initialize();
+	for (size_t i = 0; i < N_ELEMENTS / 2; ++i) {
+		auto key = key_of(i);
+		auto value = value_of(i);
+		data->map.insert_or_assign(internal::cmap::key_view(key),
+					   string_view(value));
+	}
+
+	set_root(pop, oid);
+	pop.close();
+
+	verify(path);
+	verify_migrated(path);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 5)
+		UT_FATAL("usage: %s engine path size complete|interrupted", argv[0]);
+
+	std::string path = argv[2];
+	std::string mode = argv[4];
+
+	if (mode == "complete")
+		MigrateTest(path);
+	else if (mode == "interrupted")
+		MigrateInterruptedTest(path);
+	else
+		UT_FATAL("unknown mode: %s", mode.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
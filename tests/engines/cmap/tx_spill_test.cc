@@ -0,0 +1,517 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include "engines/cmap.h"
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace pmem::kv;
+namespace cm = pmem::kv::internal::cmap;
+
+/**
+ * Tests transactions of cmap, which spill their operations to the pool
+ * ("tx_spill_bytes"). The state of the pool after a crash - stages of open
+ * transactions and the redo log of a committed one, which was partially
+ * applied - is built the way cmap builds it, and the next open must free
+ * the stages and finish the commit. In the concurrent mode, spilling
+ * transactions are committed and aborted by many threads at once. The engine
+ * is opened by oid, so the pool can be inspected while it's open. This test
+ * is built together with pmemkv's sources.
+ */
+
+/* root object of the pool, as in pmemobj_engine_base */
+struct root {
+	PMEMoid oid;
+};
+
+static const size_t SPILL_BYTES = 64;
+static const size_t N_ELEMENTS = 100;
+
+/* operations of the redo log (tx_log_op of cmap.cc) */
+static const char OP_PUT = 'p';
+static const char OP_REMOVE = 'r';
+
+struct operation {
+	char op;
+	std::string key;
+	std::string value;
+};
+
+static std::string key_of(size_t i)
+{
+	return entry_from_number(i, "key");
+}
+
+/* every 10th value doesn't fit in map's nodes */
+static std::string value_of(size_t i, const std::string &tag)
+{
+	return entry_from_number(i, tag, i % 10 ? "" : std::string(200, 'x'));
+}
+
+static cm::pmem_type *engine_data(pmem::obj::pool<root> &pop)
+{
+	return static_cast<cm::pmem_type *>(pmemobj_direct(pop.root()->oid));
+}
+
+static db open_kv(pmem::obj::pool<root> &pop)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_oid(&pop.root()->oid), status::OK);
+	ASSERT_STATUS(cfg.put_uint64("tx_spill_bytes", SPILL_BYTES), status::OK);
+
+	return INITIALIZE_KV("cmap", std::move(cfg));
+}
+
+static size_t count_chunks(pmem::obj::pool<root> &pop)
+{
+	size_t chunks = 0;
+	PMEMoid o;
+	POBJ_FOREACH(pop.handle(), o)
+	{
+		if (pmemobj_type_num(o) == cm::TX_CHUNK_TYPE_NUM)
+			++chunks;
+	}
+
+	return chunks;
+}
+
+static void append_string(std::string &ops, const std::string &s)
+{
+	uint64_t size = s.size();
+	ops.append(reinterpret_cast<const char *>(&size), sizeof(size));
+	ops.append(s);
+}
+
+/* Encodes operations the way cmap writes its redo log */
+static std::string encode(const std::vector<operation> &ops)
+{
+	std::string log;
+	for (auto &o : ops) {
+		log.push_back(o.op);
+		append_string(log, o.key);
+		if (o.op == OP_PUT)
+			append_string(log, o.value);
+	}
+
+	return log;
+}
+
+static std::string read_string(const char *log, size_t &pos)
+{
+	uint64_t size;
+	std::memcpy(&size, log + pos, sizeof(size));
+	pos += sizeof(size);
+
+	std::string s(log + pos, size);
+	pos += size;
+
+	return s;
+}
+
+static std::vector<operation> decode(const char *log, size_t size)
+{
+	std::vector<operation> ops;
+	size_t pos = 0;
+	while (pos < size) {
+		operation o;
+		o.op = log[pos++];
+		UT_ASSERT(o.op == OP_PUT || o.op == OP_REMOVE);
+		o.key = read_string(log, pos);
+		if (o.op == OP_PUT)
+			o.value = read_string(log, pos);
+		ops.push_back(o);
+	}
+	UT_ASSERTeq(pos, size);
+
+	return ops;
+}
+
+/* Allocates a chunk with the operations, as transaction::spill() does */
+static pmem::obj::persistent_ptr<cm::tx_chunk>
+make_chunk(pmem::obj::pool<root> &pop, pmem::obj::persistent_ptr<cm::tx_chunk> prev,
+	   const std::vector<operation> &ops)
+{
+	auto log = encode(ops);
+	pmem::obj::persistent_ptr<cm::tx_chunk> chunk;
+	pmem::obj::transaction::run(pop, [&] {
+		auto oid = pmemobj_tx_xalloc(sizeof(cm::tx_chunk) + log.size(),
+					     cm::TX_CHUNK_TYPE_NUM, 0);
+		auto c = new (pmemobj_direct(oid)) cm::tx_chunk();
+		c->prev = prev;
+		c->size = log.size();
+		std::memcpy(c + 1, log.data(), log.size());
+		chunk = pmem::obj::persistent_ptr<cm::tx_chunk>(oid);
+	});
+
+	return chunk;
+}
+
+/* Links a stage with chunks of the operations (one chunk per element) */
+static void make_stage(pmem::obj::pool<root> &pop,
+		       const std::vector<std::vector<operation>> &chunks)
+{
+	auto data = engine_data(pop);
+	pmem::obj::persistent_ptr<cm::tx_chunk> last;
+	for (auto &ops : chunks)
+		last = make_chunk(pop, last, ops);
+
+	pmem::obj::transaction::run(pop, [&] {
+		auto s = pmem::obj::make_persistent<cm::tx_stage>();
+		s->chunks = last;
+		s->next = data->tx_stages;
+		data->tx_stages = s;
+	});
+}
+
+static void fill(pmem::obj::pool<root> &pop, const std::string &tag)
+{
+	auto kv = open_kv(pop);
+	for (size_t i = 0; i < N_ELEMENTS; ++i)
+		ASSERT_STATUS(kv.put(key_of(i), value_of(i, tag)), status::OK);
+	kv.close();
+}
+
+static void verify(db &kv, const std::map<std::string, std::string> &expected)
+{
+	for (auto &e : expected) {
+		std::string value;
+		ASSERT_STATUS(kv.get(e.first, &value), status::OK);
+		UT_ASSERT(value == e.second);
+	}
+
+	ASSERT_SIZE(kv, expected.size());
+}
+
+static std::map<std::string, std::string> elements(const std::string &tag)
+{
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < N_ELEMENTS; ++i)
+		expected[key_of(i)] = value_of(i, tag);
+
+	return expected;
+}
+
+static void StagesTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: operations spilled by a transaction are written to chunks of
+	 * its stage in the redo log format and are freed by an abort. Stages
+	 * left by transactions open when the process crashed are freed by the
+	 * next open, without applying any of their operations.
+	 */
+	fill(pop, "a");
+
+	{
+		auto kv = open_kv(pop);
+		auto t = kv.tx_begin();
+		UT_ASSERT(t.is_ok());
+		auto &tx = t.get_value();
+		for (size_t i = 0; i < N_ELEMENTS; i += 2)
+			ASSERT_STATUS(tx.put(key_of(i), value_of(i, "b")), status::OK);
+		ASSERT_STATUS(tx.remove(key_of(1)), status::OK);
+
+		/* operations logged before the last spill were moved to chunks */
+		auto data = engine_data(pop);
+		UT_ASSERT(data->tx_stages != nullptr);
+		UT_ASSERT(data->tx_stages->next == nullptr);
+		std::vector<pmem::obj::persistent_ptr<cm::tx_chunk>> chunks;
+		for (auto c = data->tx_stages->chunks; c; c = c->prev)
+			chunks.insert(chunks.begin(), c);
+		UT_ASSERT(chunks.size() > 1);
+		UT_ASSERTeq(count_chunks(pop), chunks.size());
+
+		std::vector<operation> spilled;
+		for (auto &c : chunks) {
+			auto ops = decode(c->ops(), c->size);
+			spilled.insert(spilled.end(), ops.begin(), ops.end());
+		}
+		UT_ASSERT(spilled.size() <= N_ELEMENTS / 2 + 1);
+		for (size_t i = 0; i < spilled.size(); ++i) {
+			if (i == N_ELEMENTS / 2) {
+				UT_ASSERT(spilled[i].op == OP_REMOVE);
+				UT_ASSERT(spilled[i].key == key_of(1));
+				continue;
+			}
+			UT_ASSERT(spilled[i].op == OP_PUT);
+			UT_ASSERT(spilled[i].key == key_of(2 * i));
+			UT_ASSERT(spilled[i].value == value_of(2 * i, "b"));
+		}
+
+		std::string value;
+		ASSERT_STATUS(tx.get(key_of(0), &value), status::OK);
+		UT_ASSERT(value == value_of(0, "b"));
+		ASSERT_STATUS(kv.get(key_of(0), &value), status::OK);
+		UT_ASSERT(value == value_of(0, "a"));
+
+		tx.abort();
+		UT_ASSERT(data->tx_stages == nullptr);
+		UT_ASSERTeq(count_chunks(pop), 0);
+		verify(kv, elements("a"));
+		kv.close();
+	}
+
+	/* the state after a crash: stages of two transactions, never committed */
+	std::vector<std::vector<operation>> first, second;
+	for (size_t i = 0; i < N_ELEMENTS; i += 10)
+		first.push_back({{OP_PUT, key_of(i), value_of(i, "c")},
+				 {OP_REMOVE, key_of(i + 1), ""}});
+	second.push_back({{OP_PUT, key_of(N_ELEMENTS), value_of(N_ELEMENTS, "c")}});
+	make_stage(pop, first);
+	make_stage(pop, second);
+	UT_ASSERTeq(count_chunks(pop), first.size() + second.size());
+
+	{
+		auto kv = open_kv(pop);
+		auto data = engine_data(pop);
+		UT_ASSERT(data->tx_stages == nullptr);
+		UT_ASSERT(data->tx_staged == nullptr);
+		UT_ASSERT(data->tx_log == nullptr);
+		UT_ASSERTeq(count_chunks(pop), 0);
+		verify(kv, elements("a"));
+
+		/* transactions spill and commit after the recovery */
+		auto t = kv.tx_begin();
+		UT_ASSERT(t.is_ok());
+		auto &tx = t.get_value();
+		for (size_t i = 0; i < N_ELEMENTS; ++i)
+			ASSERT_STATUS(tx.put(key_of(i), value_of(i, "d")), status::OK);
+		UT_ASSERT(data->tx_stages != nullptr);
+		ASSERT_STATUS(tx.commit(), status::OK);
+		UT_ASSERT(data->tx_stages == nullptr);
+		UT_ASSERTeq(count_chunks(pop), 0);
+		verify(kv, elements("d"));
+		kv.close();
+	}
+
+	auto kv = open_kv(pop);
+	verify(kv, elements("d"));
+	kv.close();
+}
+
+static void StagedTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: a commit interrupted after its spilled chunks were linked as a
+	 * part of the redo log (and after some of the operations were applied)
+	 * is finished by the next open - all operations are applied, in order
+	 * of chunks and then the rest of the log, and the log is freed. A stage
+	 * of another transaction, open at the time, is freed.
+	 */
+	fill(pop, "a");
+	auto expected = elements("a");
+
+	/* puts overwritten by later chunks and the log, removes and new keys */
+	std::vector<std::vector<operation>> chunks;
+	for (size_t i = 0; i < N_ELEMENTS; i += 5) {
+		std::vector<operation> ops;
+		ops.push_back({OP_PUT, key_of(i), value_of(i, "b")});
+		ops.push_back({OP_REMOVE, key_of(i + 1), ""});
+		ops.push_back({OP_PUT, key_of(N_ELEMENTS + i), value_of(i, "b")});
+		chunks.push_back(ops);
+	}
+	chunks.push_back({{OP_PUT, key_of(0), value_of(0, "c")},
+			  {OP_PUT, key_of(1), value_of(1, "c")},
+			  {OP_REMOVE, key_of(N_ELEMENTS), ""}});
+	std::vector<operation> log = {{OP_PUT, key_of(0), value_of(0, "d")},
+				      {OP_REMOVE, key_of(5), ""},
+				      {OP_PUT, key_of(6), value_of(6, "d")}};
+
+	std::vector<operation> all;
+	for (auto &ops : chunks)
+		all.insert(all.end(), ops.begin(), ops.end());
+	all.insert(all.end(), log.begin(), log.end());
+	for (auto &o : all) {
+		if (o.op == OP_PUT)
+			expected[o.key] = o.value;
+		else
+			expected.erase(o.key);
+	}
+
+	/* the state of transaction::commit() after its pmemobj transaction */
+	auto data = engine_data(pop);
+	pmem::obj::persistent_ptr<cm::tx_chunk> last;
+	for (auto &ops : chunks)
+		last = make_chunk(pop, last, ops);
+	auto encoded = encode(log);
+	pmem::obj::transaction::run(pop, [&] {
+		data->tx_staged = last;
+		data->tx_log = pmem::obj::make_persistent<cm::string_t>(
+			string_view(encoded.data(), encoded.size()));
+	});
+	std::vector<operation> open_tx = {{OP_PUT, key_of(2), value_of(2, "e")}};
+	make_stage(pop, {open_tx});
+
+	/* ... and after a part of its operations was applied */
+	data->map.runtime_initialize();
+	for (size_t i = 0; i < all.size() / 2; ++i) {
+		cm::key_view key(string_view(all[i].key));
+		if (all[i].op == OP_PUT)
+			data->map.insert_or_assign(key, string_view(all[i].value));
+		else
+			data->map.erase(key);
+	}
+
+	{
+		auto kv = open_kv(pop);
+		UT_ASSERT(data->tx_staged == nullptr);
+		UT_ASSERT(data->tx_log == nullptr);
+		UT_ASSERT(data->tx_stages == nullptr);
+		UT_ASSERTeq(count_chunks(pop), 0);
+		verify(kv, expected);
+		kv.close();
+	}
+
+	auto kv = open_kv(pop);
+	verify(kv, expected);
+	kv.close();
+}
+
+/* values of the concurrent mode: "<writer>:<seq>:" and a filler */
+static std::string tx_value(size_t writer, size_t seq)
+{
+	auto value = std::to_string(writer) + ":" + std::to_string(seq) + ":";
+	value.append((seq * 7) % 40, 'v');
+
+	return value;
+}
+
+static void parse_tx_value(const std::string &value, size_t &writer, size_t &seq)
+{
+	auto first = value.find(':');
+	auto second = value.find(':', first + 1);
+	UT_ASSERT(first != std::string::npos && second != std::string::npos);
+
+	writer = std::stoull(value.substr(0, first));
+	seq = std::stoull(value.substr(first + 1, second - first - 1));
+	UT_ASSERT(value == tx_value(writer, seq));
+}
+
+static std::string tx_key(size_t writer, size_t k)
+{
+	return entry_from_number(k, "w" + std::to_string(writer) + "_");
+}
+
+static void ConcurrentTest(pmem::obj::pool<root> &pop, size_t threads_number,
+			   size_t thread_items)
+{
+	/**
+	 * TEST: writers commit transactions which spill (and abort every third
+	 * of them), so stages are linked and unlinked concurrently, while
+	 * readers check that no value of an aborted transaction is ever seen
+	 * and that values of a writer's keys never go back. Afterwards, the
+	 * last committed values are read, also after reopen, and no stage nor
+	 * chunk is left in the pool.
+	 */
+	const size_t N_TX_KEYS = 8;
+	UT_ASSERT(threads_number >= 2);
+	size_t writers = threads_number / 2;
+	std::atomic<size_t> writers_done(0);
+
+	auto kv = open_kv(pop);
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		if (thread_id < writers) {
+			for (size_t seq = 1; seq <= thread_items; ++seq) {
+				auto t = kv.tx_begin();
+				UT_ASSERT(t.is_ok());
+				auto &tx = t.get_value();
+				auto value = tx_value(thread_id, seq);
+				for (size_t k = 0; k < N_TX_KEYS; ++k)
+					ASSERT_STATUS(tx.put(tx_key(thread_id, k), value),
+						      status::OK);
+
+				std::string v;
+				auto key = tx_key(thread_id, 0);
+				ASSERT_STATUS(tx.get(key, &v), status::OK);
+				UT_ASSERT(v == value);
+
+				if (seq % 3 == 0)
+					tx.abort();
+				else
+					ASSERT_STATUS(tx.commit(), status::OK);
+			}
+			writers_done++;
+			return;
+		}
+
+		std::vector<std::vector<size_t>> seen(writers,
+						      std::vector<size_t>(N_TX_KEYS, 0));
+		while (writers_done.load() < writers) {
+			for (size_t w = 0; w < writers; ++w) {
+				for (size_t k = 0; k < N_TX_KEYS; ++k) {
+					std::string v;
+					auto s = kv.get(tx_key(w, k), &v);
+					if (s == status::NOT_FOUND)
+						continue;
+					ASSERT_STATUS(s, status::OK);
+
+					size_t writer, seq;
+					parse_tx_value(v, writer, seq);
+					UT_ASSERTeq(writer, w);
+					UT_ASSERT(seq % 3 != 0);
+					UT_ASSERT(seen[w][k] <= seq);
+					seen[w][k] = seq;
+				}
+			}
+		}
+	});
+
+	/* the last transaction of every writer which wasn't aborted */
+	size_t last = thread_items % 3 ? thread_items : thread_items - 1;
+	std::map<std::string, std::string> expected;
+	for (size_t w = 0; w < writers; ++w) {
+		for (size_t k = 0; k < N_TX_KEYS; ++k)
+			expected[tx_key(w, k)] = tx_value(w, last);
+	}
+
+	auto data = engine_data(pop);
+	UT_ASSERT(data->tx_stages == nullptr);
+	UT_ASSERTeq(count_chunks(pop), 0);
+	verify(kv, expected);
+	kv.close();
+
+	auto reopened = open_kv(pop);
+	verify(reopened, expected);
+	reopened.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine path stages|staged|concurrent [threads items]",
+			 argv[0]);
+
+	std::string path = argv[2];
+	std::string mode = argv[3];
+
+	auto pop = pmem::obj::pool<root>::open(path, "pmemkv");
+
+	if (mode == "stages") {
+		StagesTest(pop);
+	} else if (mode == "staged") {
+		StagedTest(pop);
+	} else if (mode == "concurrent") {
+		if (argc < 6)
+			UT_FATAL("usage: %s engine path concurrent threads items",
+				 argv[0]);
+		ConcurrentTest(pop, std::stoull(argv[4]), std::stoull(argv[5]));
+	} else {
+		UT_FATAL("unknown mode: %s", mode.c_str());
+	}
+
+	pop.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
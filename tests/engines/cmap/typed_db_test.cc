@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include "engines/cmap.h"
+#include "typed_db.h"
+
+#include <vector>
+
+using namespace pmem::kv;
+
+/**
+ * Tests typed_db<cmap>, i.e. cmap called directly (without pmem::kv::db and
+ * the C API). This test is built together with pmemkv's sources.
+ */
+
+static config make_config(std::string path, size_t size)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_path(path), status::OK);
+	ASSERT_STATUS(cfg.put_size(size), status::OK);
+
+	return cfg;
+}
+
+static void TypedDbTest(std::string path, size_t size)
+{
+	/**
+	 * TEST: put, get, exists, remove and count_all, with statuses
+	 * of the engine returned to the caller.
+	 */
+	typed_db<cmap> kv;
+	ASSERT_STATUS(kv.open(make_config(path, size)), status::OK);
+
+	std::string value;
+	ASSERT_STATUS(kv.get("key1", &value), status::NOT_FOUND);
+	ASSERT_STATUS(kv.exists("key1"), status::NOT_FOUND);
+	ASSERT_STATUS(kv.remove("key1"), status::NOT_FOUND);
+
+	ASSERT_STATUS(kv.put("key1", "value1"), status::OK);
+	ASSERT_STATUS(kv.put("key2", "value2"), status::OK);
+	ASSERT_STATUS(kv.put("key1", "value3"), status::OK);
+
+	ASSERT_STATUS(kv.exists("key1"), status::OK);
+	ASSERT_STATUS(kv.get("key1", &value), status::OK);
+	UT_ASSERT(value == "value3");
+	ASSERT_STATUS(kv.get("key2", &value), status::OK);
+	UT_ASSERT(value == "value2");
+
+	size_t cnt = 0;
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, 2);
+
+	ASSERT_STATUS(kv.remove("key1"), status::OK);
+	ASSERT_STATUS(kv.remove("key1"), status::NOT_FOUND);
+	ASSERT_STATUS(kv.get("key1", &value), status::NOT_FOUND);
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, 1);
+
+	/* break from get_all is returned as STOPPED_BY_CB */
+	ASSERT_STATUS(kv.get_all([](const char *, size_t, const char *, size_t,
+				    void *) { return 1; },
+				 nullptr),
+		      status::STOPPED_BY_CB);
+
+	ASSERT_STATUS(kv.sync(), status::OK);
+	kv.close();
+
+	/* records are persistent, as with pmem::kv::db */
+	ASSERT_STATUS(kv.open(make_config(path, size)), status::OK);
+	ASSERT_STATUS(kv.get("key2", &value), status::OK);
+	UT_ASSERT(value == "value2");
+	ASSERT_STATUS(kv.remove("key2"), status::OK);
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, 0);
+}
+
+static void TypedDbPutBatchTest(std::string path, size_t size)
+{
+	/**
+	 * TEST: put_batch inserts all records, batches of keys and values
+	 * of different sizes are rejected.
+	 */
+	typed_db<cmap> kv;
+	ASSERT_STATUS(kv.open(make_config(path, size)), status::OK);
+
+	std::vector<std::string> keys, values;
+	for (size_t i = 0; i < 100; ++i) {
+		keys.emplace_back(entry_from_number(i, "key"));
+		values.emplace_back(entry_from_number(i, "value"));
+	}
+
+	std::vector<string_view> k(keys.begin(), keys.end());
+	std::vector<string_view> v(values.begin(), values.end());
+	ASSERT_STATUS(kv.put_batch(k, v), status::OK);
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(keys[i], &value), status::OK);
+		UT_ASSERT(value == values[i]);
+	}
+
+	v.pop_back();
+	ASSERT_STATUS(kv.put_batch(k, v), status::INVALID_ARGUMENT);
+
+	size_t cnt = 0;
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, keys.size());
+}
+
+static void TypedDbErrorsTest(std::string path, size_t size)
+{
+	/**
+	 * TEST: errors of the engine are returned as statuses (with an error
+	 * message) and a database which is not open rejects all operations.
+	 */
+	typed_db<cmap> kv;
+
+	std::string value;
+	size_t cnt;
+	ASSERT_STATUS(kv.put("key1", "value1"), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.get("key1", &value), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.remove("key1"), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.count_all(cnt), status::INVALID_ARGUMENT);
+
+	/* no path in the config */
+	config cfg;
+	ASSERT_STATUS(cfg.put_size(size), status::OK);
+	ASSERT_STATUS(kv.open(std::move(cfg)), status::INVALID_ARGUMENT);
+	UT_ASSERT(!errormsg().empty());
+	ASSERT_STATUS(kv.put("key1", "value1"), status::INVALID_ARGUMENT);
+
+	/* conflicting flags */
+	auto conflicting = make_config(path, size);
+	ASSERT_STATUS(conflicting.put_create_if_missing(true), status::OK);
+	ASSERT_STATUS(conflicting.put_create_or_error_if_exists(true), status::OK);
+	ASSERT_STATUS(kv.open(std::move(conflicting)), status::INVALID_ARGUMENT);
+	ASSERT_STATUS(kv.exists("key1"), status::INVALID_ARGUMENT);
+
+	ASSERT_STATUS(kv.open(make_config(path, size)), status::OK);
+	ASSERT_STATUS(kv.put("key1", "value1"), status::OK);
+	kv.close();
+	ASSERT_STATUS(kv.get("key1", &value), status::INVALID_ARGUMENT);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine path size", argv[0]);
+
+	std::string path = argv[2];
+	size_t size = std::stoul(argv[3]);
+
+	TypedDbTest(path, size);
+	TypedDbPutBatchTest(path, size);
+	TypedDbErrorsTest(path, size);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
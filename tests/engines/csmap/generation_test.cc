@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include "engines-experimental/csmap.h"
+
+#include <libpmemobj++/pool.hpp>
+
+#include <string>
+
+using namespace pmem::kv;
+namespace cs = pmem::kv::internal::csmap;
+
+/**
+ * Tests generations of csmap record locks: every open increments the
+ * generation persisted in the pool, and record locks left by an earlier open
+ * (e.g. held by writers when the process crashed) are treated as unlocked.
+ * The engine is opened by oid, so records can be locked between opens. This
+ * test is built together with pmemkv's sources.
+ */
+
+struct root {
+	PMEMoid oid;
+};
+
+static const size_t N_ELEMENTS = 64;
+
+static std::string key_of(size_t i)
+{
+	return "key" + std::to_string(i);
+}
+
+/* every other value is too long to be stored inline in the record */
+static std::string value_of(size_t i, const std::string &tag)
+{
+	auto value = tag + std::to_string(i);
+	if (i % 2)
+		value.append(64, 'x');
+
+	return value;
+}
+
+static cs::pmem_type *engine_data(pmem::obj::pool<root> &pop)
+{
+	return static_cast<cs::pmem_type *>(pmemobj_direct(pop.root()->oid));
+}
+
+static db open_kv(pmem::obj::pool<root> &pop)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_oid(&pop.root()->oid), status::OK);
+
+	return INITIALIZE_KV("csmap", std::move(cfg));
+}
+
+static void verify(db &kv, const std::string &tag)
+{
+	for (size_t i = 0; i < N_ELEMENTS; ++i) {
+		std::string value;
+		ASSERT_STATUS(kv.get(key_of(i), &value), status::OK);
+		UT_ASSERT(value == value_of(i, tag));
+	}
+
+	ASSERT_SIZE(kv, N_ELEMENTS);
+}
+
+static void GenerationTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: the generation is incremented and persisted by every open, also
+	 * by the one which creates the engine.
+	 */
+	UT_ASSERT(OID_IS_NULL(pop.root()->oid));
+
+	uint64_t generation = 0;
+	for (int i = 0; i < 3; ++i) {
+		auto kv = open_kv(pop);
+		UT_ASSERTeq(engine_data(pop)->generation, generation + 1);
+		generation = engine_data(pop)->generation;
+		kv.close();
+	}
+
+	UT_ASSERTeq(engine_data(pop)->generation, generation);
+}
+
+static void StaleLockTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: records left locked by an earlier open are read and written
+	 * after reopen - by gets (which lock records with long values), puts,
+	 * updates, transactions, write iterators and removes.
+	 */
+	{
+		auto kv = open_kv(pop);
+		for (size_t i = 0; i < N_ELEMENTS; ++i)
+			ASSERT_STATUS(kv.put(key_of(i), value_of(i, "a")), status::OK);
+		kv.close();
+	}
+
+	/* the state after a crash: all records locked by writers of the last open */
+	auto data = engine_data(pop);
+	uint64_t stale = data->generation.get_ro() << 32;
+	for (auto it = data->map.begin(); it != data->map.end(); ++it)
+		it->second.mtx.lock(stale);
+
+	{
+		auto kv = open_kv(pop);
+		UT_ASSERTeq(engine_data(pop)->generation, (stale >> 32) + 1);
+		verify(kv, "a");
+
+		for (size_t i = 0; i < N_ELEMENTS; i += 2)
+			ASSERT_STATUS(kv.put(key_of(i), value_of(i, "b")), status::OK);
+		for (size_t i = 1; i < N_ELEMENTS; i += 4) {
+			auto set_b = [&](const string_view *, std::string &value) {
+				value = value_of(i, "b");
+				return 0;
+			};
+			ASSERT_STATUS(kv.update(key_of(i), set_b), status::OK);
+		}
+
+		auto t = kv.tx_begin();
+		UT_ASSERT(t.is_ok());
+		auto &tx = t.get_value();
+		for (size_t i = 3; i < N_ELEMENTS; i += 4) {
+			std::string value;
+			ASSERT_STATUS(tx.get(key_of(i), &value), status::OK);
+			UT_ASSERT(value == value_of(i, "a"));
+			ASSERT_STATUS(tx.put(key_of(i), value_of(i, "b")), status::OK);
+		}
+		ASSERT_STATUS(tx.commit(), status::OK);
+		verify(kv, "b");
+
+		auto res = kv.new_write_iterator();
+		UT_ASSERT(res.is_ok());
+		auto &it = res.get_value();
+		ASSERT_STATUS(it.seek(key_of(0)), status::OK);
+		auto range = it.write_range(0, 1);
+		UT_ASSERT(range.is_ok());
+		for (auto &c : range.get_value())
+			c = 'c';
+		ASSERT_STATUS(it.commit(), status::OK);
+		ASSERT_STATUS(it.reset(), status::OK);
+
+		ASSERT_STATUS(kv.remove(key_of(1)), status::OK);
+		ASSERT_STATUS(kv.put(key_of(1), value_of(1, "b")), status::OK);
+
+		std::string value;
+		ASSERT_STATUS(kv.get(key_of(0), &value), status::OK);
+		UT_ASSERT(value == "c" + value_of(0, "b").substr(1));
+
+		kv.close();
+	}
+
+	auto kv = open_kv(pop);
+	std::string value;
+	ASSERT_STATUS(kv.get(key_of(0), &value), status::OK);
+	UT_ASSERT(value == "c" + value_of(0, "b").substr(1));
+	ASSERT_STATUS(kv.put(key_of(0), value_of(0, "b")), status::OK);
+	verify(kv, "b");
+	kv.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine path generation|stale_lock", argv[0]);
+
+	std::string path = argv[2];
+	std::string mode = argv[3];
+
+	auto pop = pmem::obj::pool<root>::open(path, "pmemkv_csmap_v2");
+
+	if (mode == "generation")
+		GenerationTest(pop);
+	else if (mode == "stale_lock")
+		StaleLockTest(pop);
+	else
+		UT_FATAL("unknown mode: %s", mode.c_str());
+
+	pop.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include "engines-experimental/csmap.h"
+
+#include <libpmemobj++/pool.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pmem::kv;
+namespace cs = pmem::kv::internal::csmap;
+
+/**
+ * Tests tombstones of csmap: removed records are unlinked from the map by
+ * the background purge (or by close), which waits for readers holding the
+ * map, and by open, if the engine wasn't closed cleanly. The engine is opened
+ * by oid, so nodes of the map can be counted between operations. This test
+ * is built together with pmemkv's sources.
+ */
+
+struct root {
+	PMEMoid oid;
+};
+
+/* csmap::PURGE_BATCH, number of removed keys after which the purge starts */
+static const size_t PURGE_BATCH = 1024;
+static const size_t N_ELEMENTS = 4 * PURGE_BATCH;
+
+/* fixed width, so the order of numbers is the order of keys */
+static std::string key_of(size_t i)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "key%08zu", i);
+	return buf;
+}
+
+static std::string value_of(size_t i)
+{
+	return "value" + std::to_string(i);
+}
+
+static cs::pmem_type *engine_data(pmem::obj::pool<root> &pop)
+{
+	return static_cast<cs::pmem_type *>(pmemobj_direct(pop.root()->oid));
+}
+
+/* all nodes of the map, tombstones included */
+static size_t nodes(pmem::obj::pool<root> &pop)
+{
+	return engine_data(pop)->map.size();
+}
+
+static uint64_t purge_pending(pmem::obj::pool<root> &pop)
+{
+	return engine_data(pop)->purge_pending;
+}
+
+/* the background purge needs some time to get the exclusive lock */
+static void wait_for_nodes(pmem::obj::pool<root> &pop, size_t expected)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+	while (nodes(pop) != expected) {
+		if (std::chrono::steady_clock::now() > deadline)
+			UT_FATAL("%zu nodes left, expected %zu", nodes(pop), expected);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+static db open_kv(pmem::obj::pool<root> &pop)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_oid(&pop.root()->oid), status::OK);
+
+	return INITIALIZE_KV("csmap", std::move(cfg));
+}
+
+static void fill(db &kv)
+{
+	for (size_t i = 0; i < N_ELEMENTS; ++i)
+		ASSERT_STATUS(kv.put(key_of(i), value_of(i)), status::OK);
+}
+
+/* checks the key and the value of the record pointed by the iterator */
+static void verify_current(db::read_iterator &it, size_t i)
+{
+	auto key = it.key();
+	UT_ASSERT(key.is_ok());
+	UT_ASSERT(std::string(key.get_value().data(), key.get_value().size()) ==
+		  key_of(i));
+
+	auto value = it.read_range();
+	UT_ASSERT(value.is_ok());
+	UT_ASSERT(std::string(value.get_value().data(), value.get_value().size()) ==
+		  value_of(i));
+}
+
+/* records with removed[i] set are invisible, all the other ones are found */
+static void verify(db &kv, const std::vector<bool> &removed)
+{
+	size_t expected = 0;
+	for (size_t i = 0; i < N_ELEMENTS; ++i) {
+		std::string value;
+		if (removed[i]) {
+			ASSERT_STATUS(kv.get(key_of(i), &value), status::NOT_FOUND);
+			ASSERT_STATUS(kv.exists(key_of(i)), status::NOT_FOUND);
+		} else {
+			ASSERT_STATUS(kv.get(key_of(i), &value), status::OK);
+			UT_ASSERT(value == value_of(i));
+			++expected;
+		}
+	}
+
+	ASSERT_SIZE(kv, expected);
+}
+
+static void PurgeTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: removed records are not unlinked while an iterator holds the
+	 * map, even if the purge is retried many times, and the iterator moves
+	 * over them. Once it's reset, they are purged in the background. The
+	 * rest of tombstones is unlinked by close and nothing comes back after
+	 * reopen.
+	 */
+	std::vector<bool> removed(N_ELEMENTS, false);
+	{
+		auto kv = open_kv(pop);
+		UT_ASSERTeq(purge_pending(pop), 1);
+		fill(kv);
+
+		/* the iterator is destroyed (and reset) before close */
+		{
+			auto res = kv.new_read_iterator();
+			UT_ASSERT(res.is_ok());
+			auto &it = res.get_value();
+			ASSERT_STATUS(it.seek(key_of(1)), status::OK);
+
+			/* more than a batch, so the purge is started */
+			for (size_t i = 0; i < N_ELEMENTS; i += 2) {
+				ASSERT_STATUS(kv.remove(key_of(i)), status::OK);
+				removed[i] = true;
+			}
+			ASSERT_STATUS(kv.remove(key_of(0)), status::NOT_FOUND);
+
+			/* many retries of the purge (every 10ms) */
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			UT_ASSERTeq(nodes(pop), N_ELEMENTS);
+
+			/* the iterator is still valid and skips tombstones */
+			verify_current(it, 1);
+			for (size_t i = 3; i < 64; i += 2) {
+				ASSERT_STATUS(it.next(), status::OK);
+				verify_current(it, i);
+			}
+			verify(kv, removed);
+
+			ASSERT_STATUS(it.reset(), status::OK);
+			wait_for_nodes(pop, N_ELEMENTS / 2);
+			verify(kv, removed);
+
+			/* less than a batch, left for close */
+			ASSERT_STATUS(it.seek(key_of(1)), status::OK);
+			verify_current(it, 1);
+			for (size_t i = 3; i < 64; i += 2) {
+				ASSERT_STATUS(kv.remove(key_of(i)), status::OK);
+				removed[i] = true;
+			}
+			ASSERT_STATUS(it.next(), status::OK);
+			verify_current(it, 65);
+			UT_ASSERTeq(nodes(pop), N_ELEMENTS / 2);
+		}
+
+		kv.close();
+	}
+
+	UT_ASSERTeq(nodes(pop), N_ELEMENTS / 2 - 31);
+	UT_ASSERTeq(purge_pending(pop), 0);
+
+	auto kv = open_kv(pop);
+	verify(kv, removed);
+
+	/* removed keys can be put again */
+	ASSERT_STATUS(kv.put(key_of(0), value_of(0)), status::OK);
+	removed[0] = false;
+	verify(kv, removed);
+
+	kv.close();
+}
+
+static void UncleanShutdownTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: tombstones left by an engine which wasn't closed (purge_pending
+	 * is still set) are unlinked when it's opened again, before any
+	 * operation, and the removed records stay invisible.
+	 */
+	{
+		auto kv = open_kv(pop);
+		fill(kv);
+		kv.close();
+	}
+	UT_ASSERTeq(nodes(pop), N_ELEMENTS);
+	UT_ASSERTeq(purge_pending(pop), 0);
+
+	/* the state after a crash: records removed, but not purged yet */
+	auto data = engine_data(pop);
+	std::vector<bool> removed(N_ELEMENTS, false);
+	size_t i = 0, n_removed = 0;
+	for (auto it = data->map.begin(); it != data->map.end(); ++it, ++i) {
+		if (i % 3)
+			continue;
+
+		it->second.deleted = 1;
+		pop.persist(it->second.deleted);
+		removed[i] = true;
+		++n_removed;
+	}
+	UT_ASSERTeq(i, N_ELEMENTS);
+	data->purge_pending = 1;
+	pop.persist(data->purge_pending);
+
+	{
+		auto kv = open_kv(pop);
+		UT_ASSERTeq(nodes(pop), N_ELEMENTS - n_removed);
+		UT_ASSERTeq(purge_pending(pop), 1);
+		verify(kv, removed);
+
+		ASSERT_STATUS(kv.remove(key_of(0)), status::NOT_FOUND);
+		ASSERT_STATUS(kv.put(key_of(0), value_of(0)), status::OK);
+		removed[0] = false;
+		verify(kv, removed);
+
+		kv.close();
+	}
+	UT_ASSERTeq(purge_pending(pop), 0);
+
+	auto kv = open_kv(pop);
+	UT_ASSERTeq(nodes(pop), N_ELEMENTS - n_removed + 1);
+	verify(kv, removed);
+	kv.close();
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine path purge|unclean", argv[0]);
+
+	std::string path = argv[2];
+	std::string mode = argv[3];
+
+	auto pop = pmem::obj::pool<root>::open(path, "pmemkv_csmap_v2");
+
+	if (mode == "purge")
+		PurgeTest(pop);
+	else if (mode == "unclean")
+		UncleanShutdownTest(pop);
+	else
+		UT_FATAL("unknown mode: %s", mode.c_str());
+
+	pop.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
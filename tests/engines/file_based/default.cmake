@@ -0,0 +1,11 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+include(${PARENT_SRC_DIR}/helpers.cmake)
+
+setup()
+
+make_config({"path":"${DIR}/testfile","create_if_missing":1})
+execute(${TEST_EXECUTABLE} ${ENGINE} ${CONFIG} ${PARAMS})
+
+finish()
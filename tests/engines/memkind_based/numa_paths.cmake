@@ -0,0 +1,14 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+include(${PARENT_SRC_DIR}/helpers.cmake)
+
+setup()
+
+# two partitions, as if each directory was on a different NUMA node
+file(MAKE_DIRECTORY ${DIR}/node0 ${DIR}/node1)
+
+make_config({"path":"${DIR}","numa_paths":"${DIR}/node0,${DIR}/node1","size":${DB_SIZE}})
+execute(${TEST_EXECUTABLE} ${ENGINE} ${CONFIG} ${PARAMS})
+
+finish()
@@ -9,3 +9,14 @@ set(LAYOUT "pmemkv")
 if (NOT ${ENGINE} STREQUAL "cmap") 
     string(CONCAT LAYOUT "pmemkv_" ${ENGINE})
 endif()
+
+# stree with inner nodes in DRAM uses a separate layout
+if ((${ENGINE} STREQUAL "stree") AND ("${EXTRA_CONFIG_PARAMS}" MATCHES "volatile_inner_nodes.:1"))
+    string(CONCAT LAYOUT ${LAYOUT} "_hybrid")
+endif()
+
+# engines whose pool layout changed have a version suffix
+if ((${ENGINE} STREQUAL "stree") OR (${ENGINE} STREQUAL "tree3") OR
+    (${ENGINE} STREQUAL "csmap"))
+    string(CONCAT LAYOUT ${LAYOUT} "_v2")
+endif()
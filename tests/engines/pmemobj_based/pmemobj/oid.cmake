@@ -0,0 +1,14 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+# the test opens the pool itself (e.g. to pass oid of its root to the engine)
+
+include(${PARENT_SRC_DIR}/helpers.cmake)
+include(${PARENT_SRC_DIR}/engines/pmemobj_based/helpers.cmake)
+
+setup()
+
+pmempool_execute(create -l ${LAYOUT} -s ${DB_SIZE} obj ${DIR}/testfile)
+execute(${TEST_EXECUTABLE} ${ENGINE} ${DIR}/testfile ${PARAMS})
+
+finish()
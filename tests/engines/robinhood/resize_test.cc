@@ -0,0 +1,480 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include "engines-experimental/robinhood.h"
+
+#include <libpmemobj++/pool.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+using namespace pmem::kv;
+namespace rh = pmem::kv::internal::robinhood;
+
+/**
+ * Tests incremental resizes of robinhood's shards and splitting of shards
+ * on open ("shards_number" config parameter), also with lock-free reads
+ * running concurrently with resizes. The engine is opened by oid,
+ * so the state of resizes can be read from the pool between operations.
+ * robinhood doesn't write to the pool when it's closed, so a reopened engine
+ * sees the same state as after a crash between two operations. This test
+ * is built together with pmemkv's sources.
+ */
+
+struct root {
+	PMEMoid oid;
+};
+
+using model_type = std::map<std::string, std::string>;
+
+/* odd keys (and their values) are longer than ENTRY_SIZE, stored in records */
+static std::string key_of(size_t i)
+{
+	char buf[32];
+	if (i % 2)
+		snprintf(buf, sizeof(buf), "long_key_%zu", i);
+	else
+		snprintf(buf, sizeof(buf), "k%07zu", i % 10000000);
+
+	return buf;
+}
+
+static std::string value_of(size_t i, size_t version)
+{
+	char buf[64];
+	if (i % 2)
+		snprintf(buf, sizeof(buf), "long_value_%zu_%zu", i, version);
+	else
+		snprintf(buf, sizeof(buf), "v%03zu%04zu", version % 1000, i % 10000);
+
+	return buf;
+}
+
+static rh::pmem_type *engine_data(pmem::obj::pool<root> &pop)
+{
+	return static_cast<rh::pmem_type *>(pmemobj_direct(pop.root()->oid));
+}
+
+static size_t shards_number(pmem::obj::pool<root> &pop)
+{
+	return engine_data(pop)->shards_number;
+}
+
+static rh::hashmap_rp_migration migration(pmem::obj::pool<root> &pop, size_t shard)
+{
+	return engine_data(pop)->migrations[shard];
+}
+
+static bool resize_active(const rh::hashmap_rp_migration &mig)
+{
+	return !TOID_IS_NULL(mig.entries);
+}
+
+static bool any_resize_active(pmem::obj::pool<root> &pop)
+{
+	for (size_t i = 0; i < shards_number(pop); ++i)
+		if (resize_active(migration(pop, i)))
+			return true;
+
+	return false;
+}
+
+static config make_config(pmem::obj::pool<root> &pop, uint64_t shards)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_oid(&pop.root()->oid), status::OK);
+	if (shards)
+		ASSERT_STATUS(cfg.put_uint64("shards_number", shards), status::OK);
+
+	return cfg;
+}
+
+/* opens the engine, with the given number of shards (if not 0) */
+static db open_kv(pmem::obj::pool<root> &pop, uint64_t shards)
+{
+	return INITIALIZE_KV("robinhood", make_config(pop, shards));
+}
+
+static status open_status(pmem::obj::pool<root> &pop, uint64_t shards)
+{
+	db kv;
+	return kv.open("robinhood", make_config(pop, shards));
+}
+
+static void put_key(db &kv, model_type &model, size_t i, size_t version)
+{
+	auto key = key_of(i);
+	auto value = value_of(i, version);
+	ASSERT_STATUS(kv.put(key, value), status::OK);
+	model[key] = value;
+}
+
+static void remove_key(db &kv, model_type &model, size_t i)
+{
+	auto key = key_of(i);
+	auto expected = model.erase(key) ? status::OK : status::NOT_FOUND;
+	ASSERT_STATUS(kv.remove(key), expected);
+}
+
+static void check_get(db &kv, const model_type &model, size_t i)
+{
+	auto key = key_of(i);
+	std::string value;
+	auto it = model.find(key);
+	if (it == model.end()) {
+		ASSERT_STATUS(kv.get(key, &value), status::NOT_FOUND);
+		ASSERT_STATUS(kv.exists(key), status::NOT_FOUND);
+	} else {
+		ASSERT_STATUS(kv.get(key, &value), status::OK);
+		UT_ASSERT(value == it->second);
+	}
+}
+
+static void verify(db &kv, const model_type &model)
+{
+	ASSERT_SIZE(kv, model.size());
+
+	for (auto &e : model) {
+		std::string value;
+		ASSERT_STATUS(kv.get(e.first, &value), status::OK);
+		UT_ASSERT(value == e.second);
+	}
+
+	size_t cnt = 0;
+	ASSERT_STATUS(kv.get_all(
+			      [](const char *, size_t, const char *, size_t,
+				 void *arg) {
+				      auto c = static_cast<size_t *>(arg);
+				      ++*c;
+				      return 0;
+			      },
+			      &cnt),
+		      status::OK);
+	UT_ASSERTeq(cnt, model.size());
+}
+
+/* returns the version of the value, fails if it's not a value of the key */
+static size_t version_of(size_t i, const std::string &value)
+{
+	size_t version;
+	if (i % 2) {
+		auto prefix = "long_value_" + std::to_string(i) + "_";
+		UT_ASSERT(value.compare(0, prefix.size(), prefix) == 0);
+		version = std::stoull(value.substr(prefix.size()));
+	} else {
+		UT_ASSERT(value.size() > 4);
+		version = std::stoull(value.substr(1, 3));
+	}
+	UT_ASSERT(value == value_of(i, version));
+
+	return version;
+}
+
+static void ConcurrentResizeTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: lock-free gets and exists, while the only shard is resized
+	 * again and again by puts of new keys (and removes of some of them) on
+	 * one thread and other keys are overwritten by another one. Keys which
+	 * are not changed are always found, with their values, and no older
+	 * value of an overwritten key is read after a newer one.
+	 */
+	const size_t n_stable = 256, n_hot = 16, n_new = 4000, n_versions = 999;
+	const size_t hot_base = n_stable, new_base = n_stable + n_hot;
+	const size_t threads_number = 8;
+
+	auto kv = open_kv(pop, 1);
+	model_type model;
+	for (size_t i = 0; i < new_base; ++i)
+		put_key(kv, model, i, 0);
+
+	/* with the load factor set by test(), new keys start many resizes */
+	std::atomic<size_t> writers_done(0);
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		if (thread_id == 0) {
+			for (size_t k = 0; k < n_new; ++k) {
+				auto key = key_of(new_base + k);
+				auto value = value_of(new_base + k, 0);
+				ASSERT_STATUS(kv.put(key, value), status::OK);
+				if (k % 4 == 3) {
+					auto removed = key_of(new_base + k - 1);
+					ASSERT_STATUS(kv.remove(removed), status::OK);
+				}
+			}
+			writers_done++;
+			return;
+		}
+
+		if (thread_id == 1) {
+			for (size_t v = 1; v <= n_versions; ++v) {
+				auto i = hot_base + v % n_hot;
+				auto value = value_of(i, v);
+				ASSERT_STATUS(kv.put(key_of(i), value), status::OK);
+			}
+			writers_done++;
+			return;
+		}
+
+		std::vector<size_t> seen(n_hot, 0);
+		while (writers_done.load() < 2) {
+			for (size_t i = 0; i < n_stable; ++i) {
+				std::string value;
+				ASSERT_STATUS(kv.get(key_of(i), &value), status::OK);
+				UT_ASSERT(value == value_of(i, 0));
+				ASSERT_STATUS(kv.exists(key_of(i)), status::OK);
+			}
+
+			for (size_t h = 0; h < n_hot; ++h) {
+				std::string value;
+				ASSERT_STATUS(kv.get(key_of(hot_base + h), &value),
+					      status::OK);
+				auto version = version_of(hot_base + h, value);
+				UT_ASSERT(version >= seen[h]);
+				seen[h] = version;
+			}
+		}
+	});
+
+	/* the model is updated after the threads, in the order of their writes */
+	for (size_t k = 0; k < n_new; ++k) {
+		put_key(kv, model, new_base + k, 0);
+		if (k % 4 == 3)
+			model.erase(key_of(new_base + k - 1));
+	}
+	for (size_t v = n_versions - n_hot + 1; v <= n_versions; ++v) {
+		auto i = hot_base + v % n_hot;
+		model[key_of(i)] = value_of(i, v);
+	}
+
+	verify(kv, model);
+
+	kv.close();
+}
+
+static void ResizeTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: puts of new keys, overwrites, removes and gets, while the only
+	 * shard is resized many times. Entries removed before they are moved
+	 * (tombstoned in the old entries) must not come back. With the low load
+	 * factor, a resize also has to be started while the previous one isn't
+	 * finished (which is then finished at once).
+	 */
+	auto kv = open_kv(pop, 1);
+	model_type model;
+
+	const size_t n_ops = 4000;
+	size_t removed_during_resize = 0;
+	size_t resizes_finished_early = 0;
+	for (size_t i = 0; i < n_ops; ++i) {
+		auto before = migration(pop, 0);
+
+		switch (i % 4) {
+			case 0:
+			case 1:
+				put_key(kv, model, i, 0);
+				break;
+			case 2:
+				put_key(kv, model, i / 2, i);
+				break;
+			case 3:
+				remove_key(kv, model, i / 3);
+				if (resize_active(before))
+					++removed_during_resize;
+				break;
+		}
+
+		check_get(kv, model, i / 5);
+		check_get(kv, model, i / 3);
+		ASSERT_SIZE(kv, model.size());
+
+		/* a new resize started, while a step wouldn't finish the previous */
+		auto after = migration(pop, 0);
+		if (resize_active(before) && resize_active(after) &&
+		    !TOID_EQUALS(before.entries, after.entries) &&
+		    before.capacity - before.moved > HASHMAP_RP_MIGRATION_STEP)
+			++resizes_finished_early;
+	}
+
+	UT_ASSERT(removed_during_resize > 0);
+	UT_ASSERT(resizes_finished_early > 0);
+	verify(kv, model);
+
+	/* moves the remaining entries */
+	for (size_t i = n_ops; resize_active(migration(pop, 0)); ++i)
+		put_key(kv, model, i, 0);
+
+	verify(kv, model);
+
+	kv.close();
+}
+
+static void ResumeTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: resize interrupted in the middle is continued after reopen from
+	 * the position saved in the pool; entries are neither lost, nor moved
+	 * twice, and removes of entries not moved yet are persistent.
+	 */
+	model_type model;
+	size_t i = 0;
+	rh::hashmap_rp_migration saved;
+	{
+		auto kv = open_kv(pop, 1);
+
+		/* until a resize of at least 256 slots is half done */
+		for (;; ++i) {
+			put_key(kv, model, i, 0);
+
+			saved = migration(pop, 0);
+			if (resize_active(saved) && saved.capacity >= 256 &&
+			    saved.moved >= saved.capacity / 2)
+				break;
+		}
+
+		kv.close();
+	}
+
+	/* neither close nor open moves entries */
+	auto kv = open_kv(pop, 0);
+	auto reopened = migration(pop, 0);
+	UT_ASSERT(TOID_EQUALS(reopened.entries, saved.entries));
+	UT_ASSERTeq(reopened.moved, saved.moved);
+	UT_ASSERTeq(reopened.count, saved.count);
+
+	/* keys not moved yet are found among the old entries */
+	verify(kv, model);
+
+	/* the next write continues from the saved position */
+	put_key(kv, model, ++i, 0);
+	auto resumed = migration(pop, 0);
+	UT_ASSERT(TOID_EQUALS(resumed.entries, saved.entries));
+	UT_ASSERTeq(resumed.moved, saved.moved + HASHMAP_RP_MIGRATION_STEP);
+
+	/* half of the slots are not moved yet, so are some of these keys */
+	for (size_t k = 0; k < 8; ++k)
+		remove_key(kv, model, k);
+	UT_ASSERT(resize_active(migration(pop, 0)));
+	kv.close();
+
+	kv = open_kv(pop, 0);
+	verify(kv, model);
+
+	for (++i; resize_active(migration(pop, 0)); ++i)
+		put_key(kv, model, i, 0);
+
+	verify(kv, model);
+
+	kv.close();
+}
+
+static void ReshardTest(pmem::obj::pool<root> &pop)
+{
+	/**
+	 * TEST: 4 shards are split into 16 on open, after resizes in progress
+	 * are finished, and all keys stay reachable. Numbers of shards, which
+	 * are not powers of 2 or are smaller than the current one, are rejected.
+	 */
+	model_type model;
+	size_t i = 0;
+	{
+		auto kv = open_kv(pop, 4);
+		UT_ASSERTeq(shards_number(pop), 4);
+
+		/* until the last write leaves a resize unfinished */
+		for (; i < 2000 || !any_resize_active(pop); ++i) {
+			put_key(kv, model, i, 0);
+			if (i % 7 == 0)
+				remove_key(kv, model, i / 2);
+		}
+
+		kv.close();
+	}
+
+	/* not a power of 2 */
+	ASSERT_STATUS(open_status(pop, 24), status::INVALID_ARGUMENT);
+	/* shards can't be merged */
+	ASSERT_STATUS(open_status(pop, 2), status::INVALID_ARGUMENT);
+
+	/* rejected opens change nothing */
+	UT_ASSERTeq(shards_number(pop), 4);
+	UT_ASSERT(any_resize_active(pop));
+
+	{
+		auto kv = open_kv(pop, 16);
+		UT_ASSERTeq(shards_number(pop), 16);
+		UT_ASSERT(!any_resize_active(pop));
+		verify(kv, model);
+
+		for (size_t k = 0; k < 2000; ++k, ++i) {
+			put_key(kv, model, i, 1);
+			if (k % 5 == 0)
+				remove_key(kv, model, k);
+		}
+		verify(kv, model);
+
+		kv.close();
+	}
+
+	/* the number of shards is kept, if it's not set or the same */
+	{
+		auto kv = open_kv(pop, 0);
+		UT_ASSERTeq(shards_number(pop), 16);
+		verify(kv, model);
+		kv.close();
+	}
+	{
+		auto kv = open_kv(pop, 16);
+		UT_ASSERTeq(shards_number(pop), 16);
+		verify(kv, model);
+		kv.close();
+	}
+
+	ASSERT_STATUS(open_status(pop, 8), status::INVALID_ARGUMENT);
+	UT_ASSERTeq(shards_number(pop), 16);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine path resize|resume|reshard|concurrent",
+			 argv[0]);
+
+	std::string path = argv[2];
+	std::string mode = argv[3];
+
+	if (mode == "resize" || mode == "concurrent") {
+		/*
+		 * Each operation moves HASHMAP_RP_MIGRATION_STEP slots, so with
+		 * the default load factor resizes are finished before the next
+		 * ones. With this one, a resize of c slots takes c / 8 operations
+		 * (about c / 32 new keys), and the next one starts after c / 50.
+		 */
+		setenv("PMEMKV_ROBINHOOD_LOAD_FACTOR", "0.02", 1);
+	} else if (mode != "resume" && mode != "reshard") {
+		UT_FATAL("unknown mode: %s", mode.c_str());
+	}
+
+	auto pop = pmem::obj::pool<root>::open(path, "pmemkv_robinhood");
+
+	if (mode == "resize")
+		ResizeTest(pop);
+	else if (mode == "concurrent")
+		ConcurrentResizeTest(pop);
+	else if (mode == "resume")
+		ResumeTest(pop);
+	else
+		ReshardTest(pop);
+
+	pop.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,18 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+#
+# cmap.cmake - runs a test of the sharded engine over two cmap pools
+#
+
+include(${PARENT_SRC_DIR}/helpers.cmake)
+
+setup()
+
+pmempool_execute(create -l pmemkv -s ${DB_SIZE} obj ${DIR}/testfile0)
+pmempool_execute(create -l pmemkv -s ${DB_SIZE} obj ${DIR}/testfile1)
+
+make_config({"engine":"cmap","shards":2,"lock_shards":0,"shard_0":{"path":"${DIR}/testfile0"},"shard_1":{"path":"${DIR}/testfile1"}})
+execute(${TEST_EXECUTABLE} ${ENGINE} ${CONFIG} ${PARAMS})
+
+finish()
@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace pmem::kv;
+
+/**
+ * Tests get_batch of stree with batches sparse enough (fewer keys than
+ * leaves) to be looked up by interleaved descents - more lookups than are
+ * in flight at once, unsorted, with duplicates and missing keys. In the
+ * pmreorder modes (create, insert, open) and in the reopen modes (insert,
+ * check), the tree is reopened after puts which split leaves and every
+ * batch must return the state after some prefix (or all) of these puts. In
+ * the concurrent mode, readers look up sparse batches while writers put and
+ * remove keys between the ones which never change.
+ */
+
+/* keys put by create are even, the tree has many leaves of any degree */
+static const size_t N_INITIAL = 1024;
+/* keys of a batch, more than lookups in flight and fewer than leaves */
+static const size_t BATCH_SIZE = 24;
+/* odd keys put by insert, all of them to the first leaves */
+static const size_t N_INSERTED = 24;
+
+/* fixed width, so the order of numbers is the order of keys */
+static std::string key_of(size_t i)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "key%08zu", i);
+	return buf;
+}
+
+static std::string value_of(size_t i)
+{
+	return key_of(i) + "_value";
+}
+
+static size_t number_of(string_view key)
+{
+	return std::stoull(std::string(key.data() + 3, key.size() - 3));
+}
+
+/*
+ * Looks up the batch and checks that the callback is called in order of the
+ * batch, for keys which are in the model (with their values) and only for
+ * them. Keys which may change concurrently ('volatile_key') are not in the
+ * model - their results are passed to 'check_volatile'.
+ */
+template <typename F, typename C>
+static void check_batch(db &kv, const std::vector<size_t> &batch,
+			const std::map<size_t, std::string> &model, F &&volatile_key,
+			C &&check_volatile)
+{
+	std::vector<std::string> storage;
+	for (auto i : batch)
+		storage.push_back(key_of(i));
+	std::vector<string_view> keys(storage.begin(), storage.end());
+
+	size_t pos = 0;
+	bool missing = false;
+	auto s = kv.get_batch(keys, [&](string_view k, string_view v) {
+		auto i = number_of(k);
+		/* keys skipped by the callback must be missing */
+		while (pos < batch.size() && batch[pos] != i) {
+			if (!volatile_key(batch[pos]))
+				UT_ASSERTeq(model.count(batch[pos]), 0);
+			missing = true;
+			++pos;
+		}
+		UT_ASSERT(pos < batch.size());
+		++pos;
+
+		std::string value(v.data(), v.size());
+		if (volatile_key(i)) {
+			check_volatile(i, value);
+			return 0;
+		}
+		UT_ASSERT(model.count(i) == 1 && model.at(i) == value);
+		return 0;
+	});
+
+	for (; pos < batch.size(); ++pos) {
+		if (!volatile_key(batch[pos]))
+			UT_ASSERTeq(model.count(batch[pos]), 0);
+		missing = true;
+	}
+
+	if (missing)
+		ASSERT_STATUS(s, status::NOT_FOUND);
+	else
+		ASSERT_STATUS(s, status::OK);
+}
+
+static void check_batch(db &kv, const std::vector<size_t> &batch,
+			const std::map<size_t, std::string> &model)
+{
+	check_batch(
+		kv, batch, model, [](size_t) { return false; },
+		[](size_t, const std::string &) { UT_ASSERT(false); });
+}
+
+/* Checks all keys up to 'range' (and a few duplicates) in scrambled batches */
+static void check_all(db &kv, const std::map<size_t, std::string> &model, size_t range)
+{
+	std::vector<size_t> batch;
+	for (size_t i = 0; i < range; ++i) {
+		batch.push_back((i * 7919) % range);
+		if (i % 10 == 0)
+			batch.push_back(batch.front());
+
+		if (batch.size() >= BATCH_SIZE) {
+			check_batch(kv, batch, model);
+			batch.clear();
+		}
+	}
+	if (!batch.empty())
+		check_batch(kv, batch, model);
+}
+
+static std::map<size_t, std::string> initial_model()
+{
+	std::map<size_t, std::string> model;
+	for (size_t i = 0; i < N_INITIAL; ++i)
+		model[2 * i] = value_of(2 * i);
+
+	return model;
+}
+
+static void create(db &kv)
+{
+	for (size_t i = 0; i < N_INITIAL; ++i)
+		ASSERT_STATUS(kv.put(key_of(2 * i), value_of(2 * i)), status::OK);
+}
+
+static void insert(db &kv)
+{
+	size_t count;
+	ASSERT_STATUS(kv.count_all(count), status::OK);
+	if (count == 0)
+		create(kv);
+
+	for (size_t i = 0; i < N_INSERTED; ++i)
+		ASSERT_STATUS(kv.put(key_of(2 * i + 1), value_of(2 * i + 1)), status::OK);
+}
+
+/*
+ * Puts are atomic and done one after another, so the inserted keys found by
+ * a batch must be a prefix of them (all of them, if 'complete'). Afterwards,
+ * batches must see further puts and removes of the reopened tree.
+ */
+static void check_consistency(db &kv, bool complete)
+{
+	std::vector<size_t> inserted;
+	for (size_t i = 0; i < N_INSERTED; ++i)
+		inserted.push_back(2 * i + 1);
+
+	/* looked up in the reverse order, so not in order of the tree */
+	std::vector<std::string> storage;
+	for (auto i : inserted)
+		storage.push_back(key_of(i));
+	std::vector<string_view> keys(storage.rbegin(), storage.rend());
+	std::vector<size_t> found_keys;
+	auto s = kv.get_batch(keys, [&](string_view k, string_view v) {
+		found_keys.insert(found_keys.begin(), number_of(k));
+		UT_ASSERT(std::string(v.data(), v.size()) == value_of(number_of(k)));
+		return 0;
+	});
+
+	size_t found = found_keys.size();
+	UT_ASSERT(std::equal(found_keys.begin(), found_keys.end(), inserted.begin()));
+	ASSERT_STATUS(s, found == N_INSERTED ? status::OK : status::NOT_FOUND);
+	if (complete)
+		UT_ASSERTeq(found, N_INSERTED);
+
+	auto model = initial_model();
+	for (size_t i = 0; i < found; ++i)
+		model[inserted[i]] = value_of(inserted[i]);
+	check_all(kv, model, 2 * N_INITIAL);
+
+	for (size_t i = found; i < N_INSERTED; ++i) {
+		ASSERT_STATUS(kv.put(key_of(inserted[i]), value_of(inserted[i])),
+			      status::OK);
+		model[inserted[i]] = value_of(inserted[i]);
+	}
+	for (size_t i = 0; i < 2 * N_INITIAL; i += 6) {
+		ASSERT_STATUS(kv.remove(key_of(i)), status::OK);
+		model.erase(i);
+	}
+	check_all(kv, model, 2 * N_INITIAL);
+}
+
+/* values of the concurrent mode: "<key>:<seq>" */
+static std::string versioned_value(size_t i, size_t seq)
+{
+	return key_of(i) + ":" + std::to_string(seq);
+}
+
+static size_t version_of(size_t i, const std::string &value)
+{
+	auto prefix = key_of(i) + ":";
+	UT_ASSERT(value.compare(0, prefix.size(), prefix) == 0);
+
+	return std::stoull(value.substr(prefix.size()));
+}
+
+/* LCG of Knuth's MMIX, good enough to pick keys of batches */
+static uint64_t next_random(uint64_t &state)
+{
+	state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return state >> 33;
+}
+
+static void ConcurrentTest(db &kv, size_t threads_number, size_t thread_items)
+{
+	/**
+	 * TEST: writers put (with increasing versions) and remove odd keys
+	 * between the even ones put by create, while readers look up sparse
+	 * batches of random keys - every even key is found with its value,
+	 * versions of odd keys never go back. Afterwards, batches return the
+	 * last value put (or nothing, if it was removed) of every key.
+	 */
+	UT_ASSERT(threads_number >= 2);
+	create(kv);
+	auto model = initial_model();
+
+	size_t writers = threads_number / 2;
+	/* odd keys of every writer and the last operations on them */
+	const size_t writer_keys = N_INITIAL / writers;
+	std::vector<std::map<size_t, std::string>> written(writers);
+	std::atomic<size_t> writers_done(0);
+
+	auto odd_key = [&](size_t writer, size_t j) {
+		return 2 * (j * writers + writer) + 1;
+	};
+	auto is_odd = [](size_t i) { return i % 2 == 1; };
+
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		if (thread_id < writers) {
+			auto &w = written[thread_id];
+			for (size_t seq = 1; seq <= thread_items; ++seq) {
+				auto k = odd_key(thread_id, (seq * 13) % writer_keys);
+				auto key = key_of(k);
+				if (seq % 4 == 0) {
+					auto s = kv.remove(key);
+					UT_ASSERT(s == status::OK ||
+						  s == status::NOT_FOUND);
+					w.erase(k);
+				} else {
+					auto value = versioned_value(k, seq);
+					ASSERT_STATUS(kv.put(key, value), status::OK);
+					w[k] = value;
+				}
+			}
+			writers_done++;
+			return;
+		}
+
+		std::map<size_t, size_t> seen;
+		auto check_version = [&](size_t i, const std::string &value) {
+			auto version = version_of(i, value);
+			UT_ASSERT(seen[i] <= version);
+			seen[i] = version;
+		};
+
+		uint64_t rand = thread_id;
+		std::vector<size_t> batch;
+		while (writers_done.load() < writers) {
+			batch.clear();
+			for (size_t j = 0; j < BATCH_SIZE; ++j)
+				batch.push_back(next_random(rand) % (2 * N_INITIAL));
+			check_batch(kv, batch, model, is_odd, check_version);
+		}
+	});
+
+	for (auto &w : written)
+		model.insert(w.begin(), w.end());
+	check_all(kv, model, 2 * N_INITIAL);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config "
+			 "<create|insert|open|check|concurrent> [threads items]",
+			 argv[0]);
+
+	std::string mode = argv[3];
+	auto kv = INITIALIZE_KV(argv[1], CONFIG_FROM_JSON(argv[2]));
+
+	if (mode == "create") {
+		create(kv);
+	} else if (mode == "insert") {
+		insert(kv);
+	} else if (mode == "open") {
+		check_consistency(kv, false);
+	} else if (mode == "check") {
+		check_consistency(kv, true);
+	} else if (mode == "concurrent") {
+		if (argc < 6)
+			UT_FATAL("usage: %s engine json_config concurrent threads items",
+				 argv[0]);
+		ConcurrentTest(kv, std::stoull(argv[4]), std::stoull(argv[5]));
+	} else {
+		UT_FATAL("unknown mode: %s", mode.c_str());
+	}
+
+	kv.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
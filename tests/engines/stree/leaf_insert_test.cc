@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace pmem::kv;
+
+/**
+ * Tests inserts into stree leaves which don't split them - they write the new
+ * order of entries to the other copy of the leaf's idxs and switch copies by
+ * a single write of the leaf's state word. In the pmreorder modes (create,
+ * insert, open) a few inserts and removes go to a single leaf, and every
+ * state of the pool after a crash must be the state after some prefix of
+ * these operations. In the stress mode, writers insert interleaved keys into
+ * the same leaves, while readers check the order of the whole tree.
+ */
+
+/* fixed width, so the order of numbers is the order of keys */
+static std::string key_of(size_t i)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "key%08zu", i);
+	return buf;
+}
+
+static std::string value_of(size_t i)
+{
+	return key_of(i) + "_value";
+}
+
+/* keys put by create, all of them fit in a single leaf with operations below */
+static const size_t N_INITIAL = 8;
+
+struct operation {
+	bool insert;
+	size_t key;
+};
+
+/* inserts between existing keys, removes and an insert to a removed key */
+static const std::vector<operation> operations = {
+	{true, 5}, {true, 1}, {false, 4}, {true, 13}, {false, 0}, {true, 4},
+};
+
+static std::set<size_t> initial_keys()
+{
+	std::set<size_t> keys;
+	for (size_t i = 0; i < N_INITIAL; ++i)
+		keys.insert(2 * i);
+
+	return keys;
+}
+
+/* checks that keys are returned in order, with their values, returns them */
+static std::set<size_t> read_all(db &kv)
+{
+	std::set<size_t> keys;
+	std::string last;
+	auto s = kv.get_all([&](string_view k, string_view v) {
+		std::string key(k.data(), k.size());
+		UT_ASSERT(last.empty() || last < key);
+		last = key;
+
+		auto i = std::stoull(key.substr(3));
+		UT_ASSERT(key == key_of(i));
+		UT_ASSERT(std::string(v.data(), v.size()) == value_of(i));
+		keys.insert(i);
+		return 0;
+	});
+	ASSERT_STATUS(s, status::OK);
+
+	ASSERT_SIZE(kv, keys.size());
+
+	return keys;
+}
+
+static void create(db &kv)
+{
+	for (auto i : initial_keys())
+		ASSERT_STATUS(kv.put(key_of(i), value_of(i)), status::OK);
+}
+
+static void insert(db &kv)
+{
+	for (auto &op : operations) {
+		auto key = key_of(op.key);
+		if (op.insert)
+			ASSERT_STATUS(kv.put(key, value_of(op.key)), status::OK);
+		else
+			ASSERT_STATUS(kv.remove(key), status::OK);
+	}
+
+	read_all(kv);
+}
+
+/*
+ * Operations are atomic and done one after another, so the keys must be
+ * these after some prefix of them. Afterwards, the leaf must accept more
+ * inserts (e.g. to slots of entries constructed by the interrupted one).
+ */
+static void check_consistency(db &kv)
+{
+	auto keys = read_all(kv);
+
+	auto expected = initial_keys();
+	bool found = keys == expected;
+	for (auto &op : operations) {
+		if (op.insert)
+			expected.insert(op.key);
+		else
+			expected.erase(op.key);
+		found = found || keys == expected;
+	}
+	UT_ASSERT(found);
+
+	for (size_t i = 0; i < 2 * N_INITIAL; ++i) {
+		if (!keys.count(i)) {
+			ASSERT_STATUS(kv.put(key_of(i), value_of(i)), status::OK);
+			keys.insert(i);
+		}
+	}
+	UT_ASSERT(read_all(kv) == keys);
+
+	for (size_t i = 0; i < 2 * N_INITIAL; i += 3) {
+		ASSERT_STATUS(kv.remove(key_of(i)), status::OK);
+		keys.erase(i);
+	}
+	UT_ASSERT(read_all(kv) == keys);
+}
+
+static void StressTest(db &kv, size_t threads_number, size_t thread_items)
+{
+	/**
+	 * TEST: writers insert interleaved keys (so most inserts go between
+	 * keys of other writers, into the same leaves) and remove every third
+	 * of them, readers check the order of all keys and find every key put
+	 * and not removed by a writer before they started the check.
+	 */
+	UT_ASSERT(threads_number >= 2);
+
+	size_t writers = threads_number / 2;
+	std::vector<std::atomic<size_t>> done(writers);
+	for (auto &d : done)
+		d.store(0);
+	std::atomic<size_t> writers_done(0);
+
+	auto key_number = [&](size_t writer, size_t i) { return i * writers + writer; };
+
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		if (thread_id < writers) {
+			for (size_t i = 0; i < thread_items; ++i) {
+				auto k = key_number(thread_id, i);
+				ASSERT_STATUS(kv.put(key_of(k), value_of(k)), status::OK);
+				if (i % 3 == 2) {
+					auto r = key_number(thread_id, i - 1);
+					ASSERT_STATUS(kv.remove(key_of(r)), status::OK);
+				}
+				done[thread_id].store(i + 1, std::memory_order_release);
+			}
+			writers_done++;
+			return;
+		}
+
+		while (writers_done.load() < writers) {
+			std::vector<size_t> seen(writers);
+			for (size_t w = 0; w < writers; ++w)
+				seen[w] = done[w].load(std::memory_order_acquire);
+
+			auto keys = read_all(kv);
+			/* keys which are removed later may be gone already */
+			for (size_t w = 0; w < writers; ++w) {
+				for (size_t i = 0; i < seen[w]; ++i) {
+					if (i % 3 != 1)
+						UT_ASSERT(keys.count(key_number(w, i)));
+				}
+			}
+		}
+	});
+
+	auto keys = read_all(kv);
+	for (size_t w = 0; w < writers; ++w) {
+		for (size_t i = 0; i < thread_items; ++i) {
+			bool removed = i % 3 == 1 && i + 1 < thread_items;
+			UT_ASSERTeq(keys.count(key_number(w, i)), removed ? 0 : 1);
+		}
+	}
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config <create|open|insert|stress> "
+			 "[threads items]",
+			 argv[0]);
+
+	std::string mode = argv[3];
+	auto kv = INITIALIZE_KV(argv[1], CONFIG_FROM_JSON(argv[2]));
+
+	if (mode == "create") {
+		create(kv);
+	} else if (mode == "insert") {
+		insert(kv);
+	} else if (mode == "open") {
+		check_consistency(kv);
+	} else if (mode == "stress") {
+		if (argc < 6)
+			UT_FATAL("usage: %s engine json_config stress threads items",
+				 argv[0]);
+		StressTest(kv, std::stoull(argv[4]), std::stoull(argv[5]));
+	} else {
+		UT_FATAL("unknown mode: %s", mode.c_str());
+	}
+
+	kv.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
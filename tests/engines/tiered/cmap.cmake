@@ -0,0 +1,18 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+#
+# cmap.cmake - runs a test of the tiered engine with dram_vcmap as the hot engine
+#		and cmap as the cold one
+#
+
+include(${PARENT_SRC_DIR}/helpers.cmake)
+
+setup()
+
+pmempool_execute(create -l pmemkv -s ${DB_SIZE} obj ${DIR}/testfile)
+
+make_config({"hot_engine":"dram_vcmap","hot_config":{},"cold_engine":"cmap","cold_config":{"path":"${DIR}/testfile"},"hot_capacity":100,"migration_interval_ms":10})
+execute(${TEST_EXECUTABLE} ${ENGINE} ${CONFIG} ${PARAMS})
+
+finish()
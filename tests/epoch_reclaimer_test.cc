@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include "epoch_reclaimer.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace pmem::kv::internal;
+
+/**
+ * Tests epoch_reclaimer: blocks retired while readers may still see them are
+ * not freed until these readers leave, whether they are freed by the
+ * background task, by a writer which the task can't keep up with
+ * (BACKLOG_FACTOR) or by concurrent calls to synchronize(). This test is
+ * built together with pmemkv's sources.
+ */
+
+static const uint64_t LIVE = 0x4c495645;
+static const uint64_t FREED = 0x46524545;
+
+/* accounted size of every block, so batches are full after a few of them */
+static const std::size_t BLOCK_SIZE = epoch_reclaimer::RETIRED_BYTES_LIMIT / 16;
+static const std::size_t BATCH_BLOCKS = 16;
+
+struct block {
+	std::atomic<uint64_t> state;
+};
+
+/*
+ * Blocks are only marked by the deleter and deleted by the destructor, so
+ * a read of a reclaimed block is caught without a use after free.
+ */
+class blocks {
+public:
+	~blocks()
+	{
+		for (auto b : all)
+			delete b;
+	}
+
+	block *allocate()
+	{
+		auto b = new block();
+		b->state = LIVE;
+
+		std::lock_guard<std::mutex> lock(mtx);
+		all.push_back(b);
+		return b;
+	}
+
+	epoch_reclaimer::deleter_type deleter()
+	{
+		return [this](void *p, std::size_t size) {
+			UT_ASSERTeq(size, BLOCK_SIZE);
+			auto b = static_cast<block *>(p);
+			UT_ASSERTeq(b->state.load(), LIVE);
+			b->state = FREED;
+			freed++;
+		};
+	}
+
+	std::atomic<std::size_t> freed{0};
+
+private:
+	std::mutex mtx;
+	std::vector<block *> all;
+};
+
+static void ReclaimUnderReadersTest(std::size_t threads_number, std::size_t items)
+{
+	/**
+	 * TEST: writers replace the current block and retire the old one,
+	 * while readers read the current block inside of the epoch and one
+	 * thread calls synchronize() - no block read was freed and all of the
+	 * retired ones are freed at the end.
+	 */
+	blocks bs;
+	std::atomic<std::size_t> retired(0);
+	{
+		epoch_reclaimer reclaimer(4, bs.deleter());
+		std::atomic<block *> current(bs.allocate());
+		std::atomic<std::size_t> writers_done(0);
+		auto writers = threads_number / 2;
+
+		parallel_exec(threads_number + 1, [&](size_t thread_id) {
+			if (thread_id == threads_number) {
+				while (writers_done.load() < writers)
+					reclaimer.synchronize();
+				return;
+			}
+
+			if (thread_id < writers) {
+				for (size_t i = 0; i < items; i++) {
+					auto old = current.exchange(bs.allocate());
+					reclaimer.retire(old, BLOCK_SIZE);
+					retired++;
+				}
+				writers_done++;
+				return;
+			}
+
+			while (writers_done.load() < writers) {
+				epoch_guard guard(reclaimer);
+				auto b = current.load();
+				for (int i = 0; i < 16; i++) {
+					UT_ASSERTeq(b->state.load(), LIVE);
+					std::this_thread::yield();
+				}
+			}
+		});
+
+		UT_ASSERT(bs.freed.load() <= retired.load());
+	}
+
+	/* the rest is freed by the destructor */
+	UT_ASSERTeq(bs.freed.load(), retired.load());
+}
+
+static void BacklogTest()
+{
+	/**
+	 * TEST: while a reader stays inside of the epoch, nothing is freed and
+	 * the background task waits for it. Once more than BACKLOG_FACTOR
+	 * batches are retired, the writer waits for the reader as well, so the
+	 * retired memory stays bounded.
+	 */
+	blocks bs;
+	epoch_reclaimer reclaimer(1, bs.deleter());
+
+	std::atomic<bool> reader_in(false), reader_leave(false), writer_done(false);
+	std::thread reader([&] {
+		epoch_guard guard(reclaimer);
+		reader_in = true;
+		while (!reader_leave.load())
+			std::this_thread::yield();
+	});
+	while (!reader_in.load())
+		std::this_thread::yield();
+
+	/* the task may take out one batch (of any size) before it blocks */
+	auto n = 2 * epoch_reclaimer::BACKLOG_FACTOR * BATCH_BLOCKS + 1;
+	std::thread writer([&] {
+		for (std::size_t i = 0; i < n; i++)
+			reclaimer.retire(bs.allocate(), BLOCK_SIZE);
+		writer_done = true;
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	UT_ASSERT(!writer_done.load());
+	UT_ASSERTeq(bs.freed.load(), 0);
+
+	reader_leave = true;
+	reader.join();
+	writer.join();
+	UT_ASSERT(writer_done.load());
+
+	reclaimer.synchronize();
+	UT_ASSERTeq(bs.freed.load(), n);
+}
+
+static void InlineTest()
+{
+	/**
+	 * TEST: without a thread_pool, the writer which fills a batch frees it
+	 * itself, after the readers of the epoch leave.
+	 */
+	blocks bs;
+	epoch_reclaimer reclaimer(2, bs.deleter(), nullptr);
+
+	for (std::size_t i = 0; i < BATCH_BLOCKS - 1; i++)
+		reclaimer.retire(bs.allocate(), BLOCK_SIZE);
+	UT_ASSERTeq(bs.freed.load(), 0);
+
+	reclaimer.retire(bs.allocate(), BLOCK_SIZE);
+	UT_ASSERTeq(bs.freed.load(), BATCH_BLOCKS);
+
+	/* a reader entered before the batch is retired delays its free */
+	std::atomic<bool> reader_in(false), reader_leave(false), writer_done(false);
+	std::thread reader([&] {
+		epoch_guard guard(reclaimer);
+		reader_in = true;
+		while (!reader_leave.load())
+			std::this_thread::yield();
+	});
+	while (!reader_in.load())
+		std::this_thread::yield();
+
+	std::thread writer([&] {
+		for (std::size_t i = 0; i < BATCH_BLOCKS; i++)
+			reclaimer.retire(bs.allocate(), BLOCK_SIZE);
+		writer_done = true;
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	UT_ASSERT(!writer_done.load());
+	UT_ASSERTeq(bs.freed.load(), BATCH_BLOCKS);
+
+	reader_leave = true;
+	reader.join();
+	writer.join();
+	UT_ASSERTeq(bs.freed.load(), 2 * BATCH_BLOCKS);
+}
+
+int main()
+{
+	return run_test([&] {
+		ReclaimUnderReadersTest(8, 2000);
+		BacklogTest();
+		InlineTest();
+	});
+}
@@ -30,9 +30,35 @@ static void errormsg_cleared()
 	UT_ASSERT(err.size() > 0);
 }
 
+static void errormsg_not_set_by_expected_status()
+{
+	pmem::kv::db kv;
+	auto s = kv.open("non-existing name");
+	ASSERT_STATUS(s, pmem::kv::status::WRONG_ENGINE_NAME);
+	auto err = pmem::kv::errormsg();
+	UT_ASSERT(err.find("[pmemkv_open] ") == 0);
+
+	s = kv.open("blackhole");
+	ASSERT_STATUS(s, pmem::kv::status::OK);
+
+	/* NOT_FOUND and STOPPED_BY_CB don't store (or format) any message... */
+	std::string value;
+	for (int i = 0; i < 1000; i++) {
+		s = kv.get("Nonexisting key:", &value);
+		ASSERT_STATUS(s, pmem::kv::status::NOT_FOUND);
+		UT_ASSERT(pmem::kv::errormsg() == "");
+	}
+
+	/* ... so the message of the last error is left unchanged */
+	s = kv.put("key", "value");
+	ASSERT_STATUS(s, pmem::kv::status::OK);
+	UT_ASSERT(pmem::kv::errormsg() == err);
+}
+
 int main()
 {
 	errormsg_cleared();
+	errormsg_not_set_by_expected_status();
 
 	return 0;
 }
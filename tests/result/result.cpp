@@ -15,7 +15,7 @@ template <typename T>
 using result = pmem::kv::result<T>;
 
 /* number of possible statuses */
-const size_t number_of_statuses = 13;
+const size_t number_of_statuses = 15;
 
 class moveable {
 public:
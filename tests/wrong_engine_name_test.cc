@@ -76,12 +76,45 @@ int main()
 	UT_ASSERT(wrong_engine_name_test("radix"));
 #endif
 
+#ifndef ENGINE_LINDEX
+	UT_ASSERT(wrong_engine_name_test("lindex"));
+#endif
+
+#ifndef ENGINE_EHASH
+	UT_ASSERT(wrong_engine_name_test("ehash"));
+#endif
+
+#ifndef ENGINE_SKIPLIST
+	UT_ASSERT(wrong_engine_name_test("skiplist"));
+#endif
+
+#ifndef ENGINE_LOGSTORE
+	UT_ASSERT(wrong_engine_name_test("logstore"));
+#endif
+
+#ifndef ENGINE_BLOCKSTORE
+	UT_ASSERT(wrong_engine_name_test("blockstore"));
+#endif
+
+#ifndef ENGINE_DARRAY
+	UT_ASSERT(wrong_engine_name_test("darray"));
+#endif
+
+#ifndef ENGINE_VART
+	UT_ASSERT(wrong_engine_name_test("vart"));
+	UT_ASSERT(wrong_engine_name_test("dram_vart"));
+#endif
+
 #ifndef ENGINE_ROBINHOOD
 	UT_ASSERT(wrong_engine_name_test("robinhood"));
 #endif
 #ifndef ENGINE_DRAM_VCMAP
 	UT_ASSERT(wrong_engine_name_test("dram_vcmap"));
 #endif
+#ifndef ENGINE_VHMAP
+	UT_ASSERT(wrong_engine_name_test("vhmap"));
+	UT_ASSERT(wrong_engine_name_test("dram_vhmap"));
+#endif
 
 	errormsg_test();
 
@@ -70,6 +70,15 @@ function tests_gcc_debug_cpp14() {
 		-DCOVERAGE=$COVERAGE \
 		-DENGINE_CSMAP=1 \
 		-DENGINE_RADIX=1 \
+		-DENGINE_LVMAP=1 \
+		-DENGINE_LINDEX=1 \
+		-DENGINE_EHASH=1 \
+		-DENGINE_SKIPLIST=1 \
+		-DENGINE_LOGSTORE=1 \
+		-DENGINE_DARRAY=1 \
+		-DENGINE_VART=1 \
+		-DENGINE_SHARDED=1 \
+		-DENGINE_TIERED=1 \
 		-DENGINE_ROBINHOOD=1 \
 		-DENGINE_DRAM_VCMAP=1 \
 		-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG} \
@@ -107,6 +116,15 @@ function tests_gcc_debug_cpp14_valgrind_other() {
 		-DCOVERAGE=$COVERAGE \
 		-DENGINE_CSMAP=1 \
 		-DENGINE_RADIX=1 \
+		-DENGINE_LVMAP=1 \
+		-DENGINE_LINDEX=1 \
+		-DENGINE_EHASH=1 \
+		-DENGINE_SKIPLIST=1 \
+		-DENGINE_LOGSTORE=1 \
+		-DENGINE_DARRAY=1 \
+		-DENGINE_VART=1 \
+		-DENGINE_SHARDED=1 \
+		-DENGINE_TIERED=1 \
 		-DENGINE_ROBINHOOD=1 \
 		-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG} \
 		-DTESTS_LONG=${TESTS_LONG} \
@@ -139,6 +157,15 @@ function tests_gcc_debug_cpp14_valgrind_memcheck_drd() {
 		-DCOVERAGE=$COVERAGE \
 		-DENGINE_CSMAP=1 \
 		-DENGINE_RADIX=1 \
+		-DENGINE_LVMAP=1 \
+		-DENGINE_LINDEX=1 \
+		-DENGINE_EHASH=1 \
+		-DENGINE_SKIPLIST=1 \
+		-DENGINE_LOGSTORE=1 \
+		-DENGINE_DARRAY=1 \
+		-DENGINE_VART=1 \
+		-DENGINE_SHARDED=1 \
+		-DENGINE_TIERED=1 \
 		-DENGINE_ROBINHOOD=1 \
 		-DENGINE_DRAM_VCMAP=1 \
 		-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG} \
@@ -178,6 +205,15 @@ function tests_clang_release_cpp20() {
 		-DCMAKE_INSTALL_PREFIX=$PREFIX \
 		-DCOVERAGE=$COVERAGE \
 		-DENGINE_RADIX=1 \
+		-DENGINE_LVMAP=1 \
+		-DENGINE_LINDEX=1 \
+		-DENGINE_EHASH=1 \
+		-DENGINE_SKIPLIST=1 \
+		-DENGINE_LOGSTORE=1 \
+		-DENGINE_DARRAY=1 \
+		-DENGINE_VART=1 \
+		-DENGINE_SHARDED=1 \
+		-DENGINE_TIERED=1 \
 		-DENGINE_ROBINHOOD=1 \
 		-DENGINE_DRAM_VCMAP=1 \
 		-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG} \
@@ -151,8 +151,18 @@ engines_flags=(
 	ENGINE_STREE
 	ENGINE_TREE3
 	ENGINE_RADIX
+	ENGINE_LVMAP
+	ENGINE_LINDEX
+	ENGINE_EHASH
+	ENGINE_SKIPLIST
+	ENGINE_LOGSTORE
+	ENGINE_DARRAY
+	ENGINE_VART
+	ENGINE_SHARDED
+	ENGINE_TIERED
 	ENGINE_ROBINHOOD
 	ENGINE_DRAM_VCMAP
+	ENGINE_VHMAP
 	# the last item is to test all engines disabled
 	BLACKHOLE_TEST
 )
@@ -171,6 +181,8 @@ do
 		-DENGINE_VCMAP=OFF \
 		-DENGINE_CMAP=OFF \
 		-DENGINE_CSMAP=OFF \
+		-DENGINE_DRAM_VCMAP=OFF \
+		-DENGINE_VHMAP=OFF \
 		-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG} \
 		-D$engine_flag=ON
 	make -j$(nproc)
@@ -196,8 +208,18 @@ cmake .. -DCXX_STANDARD=14 \
 	-DENGINE_STREE=ON \
 	-DENGINE_TREE3=ON \
 	-DENGINE_RADIX=ON \
+	-DENGINE_LVMAP=ON \
+	-DENGINE_LINDEX=ON \
+	-DENGINE_EHASH=ON \
+	-DENGINE_SKIPLIST=ON \
+	-DENGINE_LOGSTORE=ON \
+	-DENGINE_DARRAY=ON \
+	-DENGINE_VART=ON \
+	-DENGINE_SHARDED=ON \
+	-DENGINE_TIERED=ON \
 	-DENGINE_ROBINHOOD=ON \
 	-DENGINE_DRAM_VCMAP=ON \
+	-DENGINE_VHMAP=ON \
 	-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG}
 make -j$(nproc)
 # list all tests in this build